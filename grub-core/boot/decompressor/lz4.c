@@ -0,0 +1,75 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/types.h>
+#include <grub/decompressor.h>
+
+/* Decode the raw LZ4 block grub-mkimage writes.  It needs neither
+   scratch memory nor a dictionary, so it is much quicker to start and
+   run than the xz decompressor.  */
+
+static unsigned long
+lz4_length (const grub_uint8_t **s, const grub_uint8_t *send,
+	    unsigned long len)
+{
+  grub_uint8_t b;
+
+  if (len != 15)
+    return len;
+  do
+    {
+      if (*s >= send)
+	return 0;
+      b = *(*s)++;
+      len += b;
+    }
+  while (b == 255);
+  return len;
+}
+
+void
+grub_decompress_core (void *src, void *dst, unsigned long srcsize,
+		      unsigned long dstsize)
+{
+  const grub_uint8_t *s = src, *send = s + srcsize;
+  grub_uint8_t *d = dst, *dend = d + dstsize;
+
+  while (s < send && d < dend)
+    {
+      unsigned token = *s++;
+      unsigned long len, off;
+      const grub_uint8_t *m;
+
+      len = lz4_length (&s, send, token >> 4);
+      if (len > (unsigned long) (send - s) || len > (unsigned long) (dend - d))
+	return;
+      while (len--)
+	*d++ = *s++;
+      if (s + 2 > send)
+	return;
+
+      off = s[0] | (s[1] << 8);
+      s += 2;
+      len = lz4_length (&s, send, token & 15) + 4;
+      if (off == 0 || off > (unsigned long) (d - (grub_uint8_t *) dst)
+	  || len > (unsigned long) (dend - d))
+	return;
+      for (m = d - off; len--; )
+	*d++ = *m++;
+    }
+}
@@ -39,8 +39,19 @@ struct grub_usb_hub
   struct grub_usb_device **devices;
   struct grub_usb_hub_port *ports;
   grub_usb_device_t dev;
+  /* When to look at the root hub ports next, and how long after that.  */
+  grub_uint64_t next_poll;
+  grub_uint32_t poll_interval;
+  /* The number of ports waiting for stable power.  */
+  int nwaiting;
 };
 
+/* Root hubs whose ports didn't change are looked at less and less often
+   while the terminal polls, up to once a second.  Non-root hubs report
+   changes on their interrupt endpoint already.  */
+#define GRUB_USBHUB_POLL_MIN_MS	10
+#define GRUB_USBHUB_POLL_MAX_MS	1000
+
 static struct grub_usb_hub *hubs;
 static grub_usb_controller_dev_t grub_usb_list;
 
@@ -265,6 +276,9 @@ grub_usb_controller_dev_register_iter (grub_usb_controller_t controller, void *d
 
   grub_memcpy (hub->controller, controller, sizeof (*controller));
   hub->dev = 0;
+  hub->next_poll = 0;
+  hub->poll_interval = GRUB_USBHUB_POLL_MIN_MS;
+  hub->nwaiting = 0;
 
   /* Query the number of ports the root Hub has.  */
   hub->nports = controller->dev->hubports (controller);
@@ -296,11 +310,59 @@ grub_usb_controller_dev_unregister (grub_usb_controller_dev_t usb)
       }
 }
 
+/* Move on the root hub ports of HUB which wait for stable power, attaching
+   the devices on those which got it.  Return how many still wait.  */
+static int
+wait_power_root_hub (struct grub_usb_hub *hub)
+{
+  grub_uint64_t now = grub_get_time_ms ();
+  int portno;
+  int waiting = 0;
+
+  for (portno = 0; portno < hub->nports; portno++)
+    {
+      grub_usb_speed_t speed;
+      int changed = 0;
+
+      if (hub->ports[portno].state != PORT_STATE_WAITING_FOR_STABLE_POWER)
+	continue;
+
+      speed = hub->controller->dev->detect_dev (hub->controller, portno,
+						&changed);
+
+      if (speed == GRUB_USB_SPEED_NONE)
+	{
+	  /* Gone or a bad contact, which gets a new wait, up to the hard
+	     limit.  */
+	  if (now > hub->ports[portno].hard_limit_time)
+	    {
+	      hub->ports[portno].state = PORT_STATE_NORMAL;
+	      continue;
+	    }
+	  hub->ports[portno].soft_limit_time = now + 250;
+	  waiting++;
+	  continue;
+	}
+
+      if (now <= hub->ports[portno].soft_limit_time)
+	{
+	  waiting++;
+	  continue;
+	}
+
+      grub_boot_time ("Got stable power wait for port %p:%d",
+		      hub->controller->dev, portno);
+      hub->ports[portno].state = PORT_STATE_NORMAL;
+      attach_root_port (hub, portno, speed);
+    }
+
+  return waiting;
+}
+
 void
 grub_usb_controller_dev_register (grub_usb_controller_dev_t usb)
 {
   int portno;
-  int continue_waiting = 0;
   struct grub_usb_hub *hub;
 
   usb->next = grub_usb_list;
@@ -309,80 +371,35 @@ grub_usb_controller_dev_register (grub_usb_controller_dev_t usb)
   if (usb->iterate)
     usb->iterate (grub_usb_controller_dev_register_iter, usb);
 
-  grub_boot_time ("waiting for stable power on USB root\n");
-
-  while (1)
-    {
-      for (hub = hubs; hub; hub = hub->next)
-	if (hub->controller->dev == usb)
-	  {
-	    /* Wait for completion of insertion and stable power (USB spec.)
-	     * Should be at least 100ms, some devices requires more...
-	     * There is also another thing - some devices have worse contacts
-	     * and connected signal is unstable for some time - we should handle
-	     * it - but prevent deadlock in case when device is too faulty... */
-	    for (portno = 0; portno < hub->nports; portno++)
-	      {
-		grub_usb_speed_t speed;
-		int changed = 0;
-
-		speed = hub->controller->dev->detect_dev (hub->controller, portno,
-							  &changed);
-
-		if (hub->ports[portno].state == PORT_STATE_NORMAL
-		    && speed != GRUB_USB_SPEED_NONE)
-		  {
-		    hub->ports[portno].soft_limit_time = grub_get_time_ms () + 250;
-		    hub->ports[portno].hard_limit_time = hub->ports[portno].soft_limit_time + 1750;
-		    hub->ports[portno].state = PORT_STATE_WAITING_FOR_STABLE_POWER;
-		    grub_boot_time ("Scheduling stable power wait for port %p:%d",
-				    usb, portno);
-		    continue_waiting++;
-		    continue;
-		  }
-
-		if (hub->ports[portno].state == PORT_STATE_WAITING_FOR_STABLE_POWER
-		    && speed == GRUB_USB_SPEED_NONE)
-		  {
-		    hub->ports[portno].soft_limit_time = grub_get_time_ms () + 250;
-		    continue;
-		  }
-		if (hub->ports[portno].state == PORT_STATE_WAITING_FOR_STABLE_POWER
-		    && grub_get_time_ms () > hub->ports[portno].soft_limit_time)
-		  {
-		    hub->ports[portno].state = PORT_STATE_STABLE_POWER;
-		    grub_boot_time ("Got stable power wait for port %p:%d",
-				    usb, portno);
-		    continue_waiting--;
-		    continue;
-		  }
-		if (hub->ports[portno].state == PORT_STATE_WAITING_FOR_STABLE_POWER
-		    && grub_get_time_ms () > hub->ports[portno].hard_limit_time)
-		  {
-		    hub->ports[portno].state = PORT_STATE_FAILED_DEVICE;
-		    continue_waiting--;
-		    continue;
-		  }
-	      }
-	  }
-      if (!continue_waiting)
-	break;
-      grub_millisleep (1);
-    }
-
-  grub_boot_time ("After the stable power wait on USB root");
-
+  /* Wait for completion of insertion and stable power (USB spec.)
+   * Should be at least 100ms, some devices requires more...
+   * There is also another thing - some devices have worse contacts
+   * and connected signal is unstable for some time - we should handle
+   * it - but prevent deadlock in case when device is too faulty...
+   * The wait is only scheduled here and grub_usb_poll_devices attaches the
+   * devices once it is over, so that the waits of all the controllers and
+   * hubs overlap rather than add up.  */
   for (hub = hubs; hub; hub = hub->next)
     if (hub->controller->dev == usb)
       for (portno = 0; portno < hub->nports; portno++)
-	if (hub->ports[portno].state == PORT_STATE_STABLE_POWER)
-	  {
-	    grub_usb_speed_t speed;
-	    int changed = 0;
-	    hub->ports[portno].state = PORT_STATE_NORMAL;
-	    speed = hub->controller->dev->detect_dev (hub->controller, portno, &changed);
-	    attach_root_port (hub, portno, speed);
-	  }
+	{
+	  grub_usb_speed_t speed;
+	  int changed = 0;
+
+	  speed = hub->controller->dev->detect_dev (hub->controller, portno,
+						    &changed);
+
+	  if (hub->ports[portno].state == PORT_STATE_NORMAL
+	      && speed != GRUB_USB_SPEED_NONE)
+	    {
+	      hub->ports[portno].soft_limit_time = grub_get_time_ms () + 250;
+	      hub->ports[portno].hard_limit_time = hub->ports[portno].soft_limit_time + 1750;
+	      hub->ports[portno].state = PORT_STATE_WAITING_FOR_STABLE_POWER;
+	      hub->nwaiting++;
+	      grub_boot_time ("Scheduling stable power wait for port %p:%d",
+			      usb, portno);
+	    }
+	}
 
   grub_boot_time ("USB root hub registered");
 }
@@ -668,10 +685,26 @@ void
 grub_usb_poll_devices (int wait_for_completion)
 {
   struct grub_usb_hub *hub;
+  grub_uint64_t now = grub_get_time_ms ();
+  int root_waiting;
   int i;
 
+ again:
+  root_waiting = 0;
   for (hub = hubs; hub; hub = hub->next)
     {
+      int hub_changed = 0;
+
+      if (hub->nwaiting)
+	{
+	  hub->nwaiting = wait_power_root_hub (hub);
+	  root_waiting += hub->nwaiting;
+	}
+
+      if (!wait_for_completion && !hub->controller->dev->pending_reset
+	  && now < hub->next_poll)
+	continue;
+
       /* Do we have to recheck number of ports?  */
       /* No, it should be never changed, it should be constant. */
       for (i = 0; i < hub->nports; i++)
@@ -690,18 +723,30 @@ grub_usb_poll_devices (int wait_for_completion)
 		  npending--;
                 }
             }
+	  /* Those are looked after by wait_power_root_hub.  */
+	  if (hub->ports[i].state == PORT_STATE_WAITING_FOR_STABLE_POWER)
+	    continue;
+
           if (!hub->controller->dev->pending_reset)
 	    speed = hub->controller->dev->detect_dev (hub->controller,
 						      i, &changed);
 
 	  if (changed)
 	    {
+	      hub_changed = 1;
 	      detach_device (hub->devices[i]);
 	      hub->devices[i] = NULL;
 	      if (speed != GRUB_USB_SPEED_NONE)
                 attach_root_port (hub, i, speed);
 	    }
 	}
+
+      if (hub_changed || hub->controller->dev->pending_reset)
+	hub->poll_interval = GRUB_USBHUB_POLL_MIN_MS;
+      else if (hub->poll_interval < GRUB_USBHUB_POLL_MAX_MS)
+	hub->poll_interval = grub_min (2 * hub->poll_interval,
+				       GRUB_USBHUB_POLL_MAX_MS);
+      hub->next_poll = now + hub->poll_interval;
     }
 
   while (1)
@@ -724,8 +769,10 @@ grub_usb_poll_devices (int wait_for_completion)
 	    {
 	      grub_usb_device_t dev = grub_usb_devs[i];
 
-	      if (dev && dev->descdev.class == 0x09)
-		continue_waiting = continue_waiting || wait_power_nonroot_hub (dev);
+	      /* Every hub, not just up to the first one still waiting.  */
+	      if (dev && dev->descdev.class == 0x09
+		  && wait_power_nonroot_hub (dev))
+		continue_waiting = 1;
 	    }
 	  if (!continue_waiting)
 	    break;
@@ -734,7 +781,18 @@ grub_usb_poll_devices (int wait_for_completion)
 
       if (!(rescan || (npending && wait_for_completion)))
 	break;
-      grub_millisleep (25);
+      /* Hubs tell about their ports on their interrupt endpoint, which
+	 the next round checks.  */
+      grub_millisleep (1);
+    }
+
+  /* Let the devices on the root ports come up, as many at once as there
+     are.  */
+  if (root_waiting && wait_for_completion)
+    {
+      grub_millisleep (1);
+      now = grub_get_time_ms ();
+      goto again;
     }
 }
 
@@ -39,19 +39,15 @@ grub_usb_bulk_maxpacket (grub_usb_device_t dev,
 }
 
 
+/* Wait for a transfer that has already been set up.  */
 static grub_usb_err_t
-grub_usb_execute_and_wait_transfer (grub_usb_device_t dev,
-				    grub_usb_transfer_t transfer,
-				    int timeout, grub_size_t *actual)
+grub_usb_wait_transfer (grub_usb_device_t dev,
+			grub_usb_transfer_t transfer,
+			int timeout, grub_size_t *actual)
 {
   grub_usb_err_t err;
   grub_uint64_t endtime;
 
-  err = dev->controller.dev->setup_transfer (&dev->controller, transfer);
-  if (err)
-    return err;
-  /* endtime moved behind setup transfer to prevent false timeouts
-   * while debugging... */
   endtime = grub_get_time_ms () + timeout;
   while (1)
     {
@@ -73,6 +69,21 @@ grub_usb_execute_and_wait_transfer (grub_usb_device_t dev,
     }
 }
 
+static grub_usb_err_t
+grub_usb_execute_and_wait_transfer (grub_usb_device_t dev,
+				    grub_usb_transfer_t transfer,
+				    int timeout, grub_size_t *actual)
+{
+  grub_usb_err_t err;
+
+  err = dev->controller.dev->setup_transfer (&dev->controller, transfer);
+  if (err)
+    return err;
+  /* The timeout starts behind setup transfer to prevent false timeouts
+   * while debugging... */
+  return grub_usb_wait_transfer (dev, transfer, timeout, actual);
+}
+
 grub_usb_err_t
 grub_usb_control_msg (grub_usb_device_t dev,
 		      grub_uint8_t reqtype,
@@ -217,11 +228,13 @@ grub_usb_control_msg (grub_usb_device_t dev,
   return err;
 }
 
+/* Prepare a bulk transfer whose first transaction uses data toggle
+   TOGGLE.  */
 static grub_usb_transfer_t
 grub_usb_bulk_setup_readwrite (grub_usb_device_t dev,
 			       struct grub_usb_desc_endp *endpoint,
 			       grub_size_t size0, char *data_in,
-			       grub_transfer_type_t type)
+			       grub_transfer_type_t type, int toggle)
 {
   int i;
   grub_usb_transfer_t transfer;
@@ -231,7 +244,6 @@ grub_usb_bulk_setup_readwrite (grub_usb_device_t dev,
   grub_uint32_t data_addr;
   struct grub_pci_dma_chunk *data_chunk;
   grub_size_t size = size0;
-  int toggle = dev->toggle[endpoint->endp_addr];
 
   grub_dprintf ("usb", "bulk: size=0x%02lx type=%d\n", (unsigned long) size,
 		type);
@@ -299,6 +311,14 @@ grub_usb_bulk_setup_readwrite (grub_usb_device_t dev,
   return transfer;
 }
 
+static void
+grub_usb_bulk_free_readwrite (grub_usb_transfer_t transfer)
+{
+  grub_free (transfer->transactions);
+  grub_dma_free (transfer->data_chunk);
+  grub_free (transfer);
+}
+
 static void
 grub_usb_bulk_finish_readwrite (grub_usb_transfer_t transfer)
 {
@@ -324,9 +344,7 @@ grub_usb_bulk_finish_readwrite (grub_usb_transfer_t transfer)
 		   transfer->size + 1);
     }
 
-  grub_free (transfer->transactions);
-  grub_dma_free (transfer->data_chunk);
-  grub_free (transfer);
+  grub_usb_bulk_free_readwrite (transfer);
 }
 
 static grub_usb_err_t
@@ -340,7 +358,8 @@ grub_usb_bulk_readwrite (grub_usb_device_t dev,
   grub_usb_transfer_t transfer;
 
   transfer = grub_usb_bulk_setup_readwrite (dev, endpoint, size0,
-					    data_in, type);
+					    data_in, type,
+					    dev->toggle[endpoint->endp_addr]);
   if (!transfer)
     return GRUB_USB_ERR_INTERNAL;
   err = grub_usb_execute_and_wait_transfer (dev, transfer, timeout, actual);
@@ -350,17 +369,21 @@ grub_usb_bulk_readwrite (grub_usb_device_t dev,
   return err;
 }
 
+/* Split a large transfer into chunks the controller can handle.  While
+   one chunk runs, the buffers and transactions of the next one are
+   prepared, so it can be started as soon as the previous one is done.  */
 static grub_usb_err_t
 grub_usb_bulk_readwrite_packetize (grub_usb_device_t dev,
 				   struct grub_usb_desc_endp *endpoint,
 				   grub_transfer_type_t type,
 				   grub_size_t size, char *data)
 {
-  grub_size_t actual, transferred;
+  grub_size_t actual, transferred = 0;
   grub_usb_err_t err = GRUB_USB_ERR_NONE;
-  grub_size_t current_size, position;
+  grub_size_t current_size, position = 0;
   grub_size_t max_bulk_transfer_len = MAX_USB_TRANSFER_LEN;
   grub_size_t max;
+  grub_usb_transfer_t transfer, next;
 
   if (dev->controller.dev->max_bulk_tds)
     {
@@ -370,18 +393,72 @@ grub_usb_bulk_readwrite_packetize (grub_usb_device_t dev,
       max_bulk_transfer_len = dev->controller.dev->max_bulk_tds * max;
     }
 
-  for (position = 0, transferred = 0;
-       position < size; position += max_bulk_transfer_len)
+  current_size = size;
+  if (current_size > max_bulk_transfer_len)
+    current_size = max_bulk_transfer_len;
+  transfer = grub_usb_bulk_setup_readwrite (dev, endpoint, current_size,
+					    data, type,
+					    dev->toggle[endpoint->endp_addr]);
+  if (!transfer)
+    return GRUB_USB_ERR_INTERNAL;
+
+  while (1)
     {
-      current_size = size - position;
-      if (current_size >= max_bulk_transfer_len)
-	current_size = max_bulk_transfer_len;
-      err = grub_usb_bulk_readwrite (dev, endpoint, current_size,
-              &data[position], type, 1000, &actual);
+      grub_size_t next_size = 0;
+
+      next = NULL;
+      actual = 0;
+      err = dev->controller.dev->setup_transfer (&dev->controller, transfer);
+      if (!err && position + current_size < size)
+	{
+	  /* If this chunk completes, the next one continues with the
+	     toggle following its last transaction.  */
+	  int toggle = transfer->transactions[transfer->transcnt - 1].toggle;
+
+	  next_size = size - position - current_size;
+	  if (next_size > max_bulk_transfer_len)
+	    next_size = max_bulk_transfer_len;
+	  next = grub_usb_bulk_setup_readwrite (dev, endpoint, next_size,
+						&data[position + current_size],
+						type, toggle ? 0 : 1);
+	}
+      if (!err)
+	err = grub_usb_wait_transfer (dev, transfer, 1000, &actual);
+      grub_usb_bulk_finish_readwrite (transfer);
+
       transferred += actual;
-      if (err || (current_size != actual)) break;
+      if (err || current_size != actual || position + current_size >= size)
+	break;
+      position += current_size;
+      current_size = next_size;
+
+      if (next && next->transactions[0].toggle
+	  != dev->toggle[endpoint->endp_addr])
+	{
+	  grub_usb_bulk_free_readwrite (next);
+	  next = NULL;
+	}
+      if (!next)
+	{
+	  current_size = size - position;
+	  if (current_size > max_bulk_transfer_len)
+	    current_size = max_bulk_transfer_len;
+	  next = grub_usb_bulk_setup_readwrite (dev, endpoint, current_size,
+						&data[position], type,
+						dev->toggle[endpoint->endp_addr]);
+	  if (!next)
+	    {
+	      err = GRUB_USB_ERR_INTERNAL;
+	      break;
+	    }
+	}
+      transfer = next;
+      next = NULL;
     }
 
+  if (next)
+    grub_usb_bulk_free_readwrite (next);
+
   if (!err && transferred != size)
     err = GRUB_USB_ERR_DATA;
   return err;
@@ -432,7 +509,8 @@ grub_usb_bulk_read_background (grub_usb_device_t dev,
   grub_usb_transfer_t transfer;
 
   transfer = grub_usb_bulk_setup_readwrite (dev, endpoint, size,
-					    data, GRUB_USB_TRANSFER_TYPE_IN);
+					    data, GRUB_USB_TRANSFER_TYPE_IN,
+					    dev->toggle[endpoint->endp_addr]);
   if (!transfer)
     return NULL;
 
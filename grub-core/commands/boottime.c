@@ -18,23 +18,34 @@
 
 #include <grub/dl.h>
 #include <grub/misc.h>
-#include <grub/command.h>
+#include <grub/extcmd.h>
+#include <grub/trace.h>
 #include <grub/i18n.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
+static const struct grub_arg_option options[] =
+  {
+    {"trace", 't', 0,
+     N_("Print the trace events in the Trace Event Format of Chrome."), 0, 0},
+    {0, 0, 0, 0, 0, 0}
+  };
 
-static grub_err_t
-grub_cmd_boottime (struct grub_command *cmd __attribute__ ((unused)),
-		   int argc __attribute__ ((unused)),
-		   char *argv[] __attribute__ ((unused)))
+enum
+  {
+    BOOTTIME_TRACE
+  };
+
+#if BOOT_TIME_STATS
+static void
+print_boot_time_stats (void)
 {
   struct grub_boot_time *cur;
   grub_uint64_t last_time = 0, start_time = 0;
   if (!grub_boot_time_head)
     {
       grub_puts_ (N_("No boot time statistics is available\n"));
-      return 0;
+      return;
     }
   start_time = last_time = grub_boot_time_head->tp;
   for (cur = grub_boot_time_head; cur; cur = cur->next)
@@ -47,19 +58,131 @@ grub_cmd_boottime (struct grub_command *cmd __attribute__ ((unused)),
 		   tmabs / 1000, tmabs % 1000, tmrel / 1000, tmrel % 1000, cur->file, cur->line,
 		   cur->msg);
     }
- return 0;
+}
+#endif
+
+/* Print STR as a JSON string.  */
+static void
+print_json_string (const char *str)
+{
+  char buf[6 * GRUB_TRACE_DETAIL_SIZE + 3], *p = buf;
+
+  *p++ = '"';
+  for (; *str; str++)
+    {
+      unsigned char c = *str;
+
+      if (c == '"' || c == '\\')
+	{
+	  *p++ = '\\';
+	  *p++ = c;
+	}
+      else if (c < 0x20)
+	p += grub_snprintf (p, 7, "\\u%04x", c);
+      else
+	*p++ = c;
+    }
+  *p++ = '"';
+  *p = '\0';
+  grub_xputs (buf);
+}
+
+/* The events are copied out one at a time, as printing them may load
+   glyphs from a font file and record more of them, moving the buffer.  */
+static void
+print_trace (grub_size_t n)
+{
+  grub_size_t i;
+
+  grub_printf ("{\"traceEvents\":[");
+  for (i = 0; i < n; i++)
+    {
+      struct grub_trace_event e = grub_trace_events[i];
+      const char *category = grub_trace_category_name (e.category);
+      grub_uint64_t ts = grub_trace_to_us (e.start);
+      grub_uint64_t dur = grub_trace_to_us (e.end) - ts;
+
+      grub_printf ("%s\n{\"name\":", i ? "," : "");
+      print_json_string (e.name[0] ? e.name : category);
+      grub_printf (",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,"
+		   "\"ts\":%" PRIuGRUB_UINT64_T ",\"dur\":%" PRIuGRUB_UINT64_T
+		   ",\"args\":{\"detail\":",
+		   category, ts, dur);
+      print_json_string (e.detail);
+      if (e.arg)
+	grub_printf (",\"bytes\":%" PRIuGRUB_UINT64_T, e.arg);
+      grub_printf ("}}");
+    }
+  grub_printf ("\n],\"otherData\":{\"dropped\":\"%" PRIuGRUB_SIZE "\"}}\n",
+	       grub_trace_dropped);
+}
+
+/* Show the events as a table, in milliseconds since the first one.  */
+static void
+print_events (grub_size_t n)
+{
+  grub_uint64_t base;
+  grub_size_t i;
+
+  if (grub_trace_dropped)
+    grub_printf_ (N_("%" PRIuGRUB_SIZE " events were not recorded\n"),
+		  grub_trace_dropped);
+
+  base = grub_trace_to_us (grub_trace_events[0].start);
+  for (i = 0; i < n; i++)
+    {
+      struct grub_trace_event e = grub_trace_events[i];
+      grub_uint64_t ts = grub_trace_to_us (e.start) - base;
+      grub_uint64_t dur = grub_trace_to_us (e.end) - base - ts;
+      grub_uint64_t ts_us, dur_us;
+
+      ts = grub_divmod64 (ts, 1000, &ts_us);
+      dur = grub_divmod64 (dur, 1000, &dur_us);
+      grub_printf ("%6" PRIuGRUB_UINT64_T ".%03us %4" PRIuGRUB_UINT64_T
+		   ".%03ums %-6s %s %s",
+		   ts, (unsigned) ts_us, dur, (unsigned) dur_us,
+		   grub_trace_category_name (e.category), e.name, e.detail);
+      if (e.arg)
+	grub_printf (" %" PRIuGRUB_UINT64_T, e.arg);
+      grub_printf ("\n");
+    }
+}
+
+static grub_err_t
+grub_cmd_boottime (grub_extcmd_context_t ctxt,
+		   int argc __attribute__ ((unused)),
+		   char **args __attribute__ ((unused)))
+{
+  struct grub_arg_list *state = ctxt->state;
+  grub_size_t n = grub_trace_nevents;
+
+  if (state[BOOTTIME_TRACE].set)
+    {
+      print_trace (n);
+      return GRUB_ERR_NONE;
+    }
+
+#if BOOT_TIME_STATS
+  print_boot_time_stats ();
+#endif
+  if (n)
+    print_events (n);
+  else
+    grub_puts_ (N_("No trace events were recorded"));
+
+  return GRUB_ERR_NONE;
 }
 
-static grub_command_t cmd_boottime;
+static grub_extcmd_t cmd_boottime;
 
 GRUB_MOD_INIT(boottime)
 {
   cmd_boottime =
-    grub_register_command ("boottime", grub_cmd_boottime,
-			   0, N_("Show boot time statistics."));
+    grub_register_extcmd ("boottime", grub_cmd_boottime, 0, N_("[-t]"),
+			  N_("Show boot time statistics."), options);
 }
 
 GRUB_MOD_FINI(boottime)
 {
-  grub_unregister_command (cmd_boottime);
+  grub_unregister_extcmd (cmd_boottime);
 }
@@ -0,0 +1,167 @@
+/* diskstats.c - Command to show disk I/O statistics  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/dl.h>
+#include <grub/misc.h>
+#include <grub/mm.h>
+#include <grub/env.h>
+#include <grub/disk.h>
+#include <grub/extcmd.h>
+#include <grub/i18n.h>
+#include <grub/normal.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+static const struct grub_arg_option options[] =
+  {
+    {"export", 'e', 0, N_("Export the counters as environment variables."), 0, 0},
+    {"reset", 'r', 0, N_("Reset the counters after showing them."), 0, 0},
+    {0, 0, 0, 0, 0, 0}
+  };
+
+enum
+  {
+    DISKSTATS_EXPORT,
+    DISKSTATS_RESET
+  };
+
+static void
+export_counter (const char *disk, const char *counter, grub_uint64_t value)
+{
+  char *name, *p;
+  char buf[sizeof ("18446744073709551615")];
+
+  name = grub_xasprintf ("diskstats_%s_%s", disk, counter);
+  if (name == NULL)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+
+  /* Make the name usable in scripts.  */
+  for (p = name; *p; p++)
+    if (!grub_isalnum (*p))
+      *p = '_';
+
+  grub_snprintf (buf, sizeof (buf), "%llu", (unsigned long long) value);
+  grub_env_set (name, buf);
+  grub_free (name);
+}
+
+static int
+match_disk (const char *name, int argc, char **args)
+{
+  int i;
+
+  if (argc == 0)
+    return 1;
+
+  for (i = 0; i < argc; i++)
+    {
+      const char *arg = args[i];
+      grub_size_t len = grub_strlen (arg);
+
+      if (arg[0] == '(' && len > 1 && arg[len - 1] == ')')
+	{
+	  arg++;
+	  len -= 2;
+	}
+      if (grub_strlen (name) == len && grub_strncmp (name, arg, len) == 0)
+	return 1;
+    }
+
+  return 0;
+}
+
+static grub_err_t
+grub_cmd_diskstats (grub_extcmd_context_t ctxt, int argc, char **args)
+{
+  struct grub_arg_list *state = ctxt->state;
+  struct grub_disk_stats *stats;
+  int found = 0;
+
+  for (stats = grub_disk_stats_list; stats; stats = stats->next)
+    {
+      grub_uint64_t lookups;
+
+      if (!match_disk (stats->name, argc, args))
+	continue;
+      found = 1;
+
+      lookups = stats->hits + stats->misses;
+      grub_printf ("(%s): ", stats->name);
+      if (lookups)
+	{
+	  grub_uint64_t ratio = grub_divmod64 (stats->hits * 10000, lookups, 0);
+
+	  grub_printf_ (N_("cache hits %llu (%u.%02u%%), misses %llu, evictions %llu\n"),
+			(unsigned long long) stats->hits,
+			(unsigned) ratio / 100, (unsigned) ratio % 100,
+			(unsigned long long) stats->misses,
+			(unsigned long long) stats->evictions);
+	}
+      else
+	grub_printf ("%s\n", _("no cache lookups"));
+
+      grub_printf_ (N_("  read %s in %llu device calls taking %llu ms\n"),
+		    grub_get_human_size (stats->bytes_read, GRUB_HUMAN_SIZE_NORMAL),
+		    (unsigned long long) stats->read_calls,
+		    (unsigned long long) stats->read_time_ms);
+
+      if (state[DISKSTATS_EXPORT].set)
+	{
+	  export_counter (stats->name, "hits", stats->hits);
+	  export_counter (stats->name, "misses", stats->misses);
+	  export_counter (stats->name, "evictions", stats->evictions);
+	  export_counter (stats->name, "bytes", stats->bytes_read);
+	  export_counter (stats->name, "calls", stats->read_calls);
+	  export_counter (stats->name, "time_ms", stats->read_time_ms);
+	}
+
+      if (state[DISKSTATS_RESET].set)
+	{
+	  stats->hits = 0;
+	  stats->misses = 0;
+	  stats->evictions = 0;
+	  stats->bytes_read = 0;
+	  stats->read_calls = 0;
+	  stats->read_time_ms = 0;
+	}
+    }
+
+  if (!found)
+    grub_printf ("%s\n", _("No disk statistics available"));
+
+  return GRUB_ERR_NONE;
+}
+
+static grub_extcmd_t cmd;
+
+GRUB_MOD_INIT(diskstats)
+{
+  cmd = grub_register_extcmd ("diskstats", grub_cmd_diskstats, 0,
+			      N_("[-e] [-r] [DISK...]"),
+			      N_("Show disk cache and I/O statistics."),
+			      options);
+}
+
+GRUB_MOD_FINI(diskstats)
+{
+  grub_unregister_extcmd (cmd);
+}
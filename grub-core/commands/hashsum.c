@@ -29,7 +29,8 @@
 GRUB_MOD_LICENSE ("GPLv3+");
 
 static const struct grub_arg_option options[] = {
-  {"hash", 'h', 0, N_("Specify hash to use."), N_("HASH"), ARG_TYPE_STRING},
+  {"hash", 'h', 0, N_("Specify hash to use, or several separated by commas."),
+   N_("HASH[,HASH...]"), ARG_TYPE_STRING},
   {"check", 'c', 0, N_("Check hashes of files with hash list FILE."),
    N_("FILE"), ARG_TYPE_STRING},
   {"prefix", 'p', 0, N_("Base directory for hash list."), N_("DIR"),
@@ -60,142 +61,300 @@ hextoval (char c)
   return -1;
 }
 
+/* Most hashes computed in one pass over the files.  */
+#define HASHSUM_MAX_HASHES 8
+/* Read size, large enough for the disk layer to read whole extents.  */
+#define HASHSUM_BUF_SIZE (256 * 1024)
+#define HASHSUM_MIN_BUF_SIZE 4096
+
+/* The hashes being computed, with a context for each and a read buffer,
+   all of which are shared by the files hashed.  */
+struct hashsum_state
+{
+  const gcry_md_spec_t *hashes[HASHSUM_MAX_HASHES];
+  void *contexts[HASHSUM_MAX_HASHES];
+  unsigned nhashes;
+  grub_uint8_t *buf;
+  grub_size_t bufsize;
+};
+
+static void
+hashsum_fini (struct hashsum_state *state)
+{
+  unsigned i;
+
+  for (i = 0; i < state->nhashes; i++)
+    grub_free (state->contexts[i]);
+  grub_free (state->buf);
+}
+
+/* Set up STATE for the comma separated hash names in HASHNAMES.  */
 static grub_err_t
-hash_file (grub_file_t file, const gcry_md_spec_t *hash, void *result)
+hashsum_init (struct hashsum_state *state, const char *hashnames)
 {
-  void *context;
-  grub_uint8_t *readbuf;
-#define BUF_SIZE 4096
-  readbuf = grub_malloc (BUF_SIZE);
-  if (!readbuf)
-    return grub_errno;
-  context = grub_zalloc (hash->contextsize);
-  if (!readbuf || !context)
-    goto fail;
+  const char *p = hashnames, *end;
+  char name[32];
+
+  grub_memset (state, 0, sizeof (*state));
+  do
+    {
+      const gcry_md_spec_t *hash;
+
+      end = grub_strchr (p, ',');
+      if (!end)
+	end = p + grub_strlen (p);
+      if ((grub_size_t) (end - p) >= sizeof (name))
+	goto unknown;
+      grub_memcpy (name, p, end - p);
+      name[end - p] = 0;
+
+      hash = grub_crypto_lookup_md_by_name (name);
+      if (!hash)
+	goto unknown;
+      if (hash->mdlen > GRUB_CRYPTO_MAX_MDLEN)
+	{
+	  hashsum_fini (state);
+	  return grub_error (GRUB_ERR_BUG, "mdlen is too long");
+	}
+      if (state->nhashes == HASHSUM_MAX_HASHES)
+	{
+	  hashsum_fini (state);
+	  return grub_error (GRUB_ERR_BAD_ARGUMENT, "too many hashes");
+	}
+      state->hashes[state->nhashes] = hash;
+      state->contexts[state->nhashes] = grub_zalloc (hash->contextsize);
+      if (!state->contexts[state->nhashes])
+	{
+	  hashsum_fini (state);
+	  return grub_errno;
+	}
+      state->nhashes++;
+      p = end + 1;
+    }
+  while (*end);
+
+  state->bufsize = HASHSUM_BUF_SIZE;
+  state->buf = grub_malloc (state->bufsize);
+  if (!state->buf)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      state->bufsize = HASHSUM_MIN_BUF_SIZE;
+      state->buf = grub_malloc (state->bufsize);
+    }
+  if (!state->buf)
+    {
+      hashsum_fini (state);
+      return grub_errno;
+    }
+  return GRUB_ERR_NONE;
+
+ unknown:
+  hashsum_fini (state);
+  return grub_error (GRUB_ERR_BAD_ARGUMENT, "unknown hash");
+}
+
+/* Feed FILE to the hashes of STATE selected in MASK, reading it once.
+   The digests are then available through the hashes' read.  */
+static grub_err_t
+hash_file (struct hashsum_state *state, grub_file_t file, unsigned mask)
+{
+  unsigned i;
+
+  for (i = 0; i < state->nhashes; i++)
+    if (mask & (1U << i))
+      state->hashes[i]->init (state->contexts[i]);
 
-  hash->init (context);
   while (1)
     {
       grub_ssize_t r;
-      r = grub_file_read (file, readbuf, BUF_SIZE);
+      r = grub_file_read (file, state->buf, state->bufsize);
       if (r < 0)
-	goto fail;
+	return grub_errno;
       if (r == 0)
 	break;
-      hash->write (context, readbuf, r);
+      for (i = 0; i < state->nhashes; i++)
+	if (mask & (1U << i))
+	  state->hashes[i]->write (state->contexts[i], state->buf, r);
     }
-  hash->final (context);
-  grub_memcpy (result, hash->read (context), hash->mdlen);
 
-  grub_free (readbuf);
-  grub_free (context);
+  for (i = 0; i < state->nhashes; i++)
+    if (mask & (1U << i))
+      state->hashes[i]->final (state->contexts[i]);
 
   return GRUB_ERR_NONE;
+}
 
- fail:
-  grub_free (readbuf);
-  grub_free (context);
-  return grub_errno;
+static grub_file_t
+open_file (const char *name, const char *prefix, int uncompress)
+{
+  enum grub_file_type type = GRUB_FILE_TYPE_TO_HASH
+    | (!uncompress ? GRUB_FILE_TYPE_NO_DECOMPRESS : GRUB_FILE_TYPE_NONE);
+  grub_file_t file;
+  char *filename;
+
+  if (!prefix)
+    return grub_file_open (name, type);
+
+  filename = grub_xasprintf ("%s/%s", prefix, name);
+  if (!filename)
+    return NULL;
+  file = grub_file_open (filename, type);
+  grub_free (filename);
+  return file;
 }
 
-static grub_err_t
-check_list (const gcry_md_spec_t *hash, const char *hashfilename,
-	    const char *prefix, int keep, int uncompress)
+/* Lines of a hash list naming the same file, which are checked with one
+   read of it.  */
+struct check_group
+{
+  char *name;
+  unsigned mask;
+  unsigned count;
+  unsigned hash[HASHSUM_MAX_HASHES];
+  grub_uint8_t expected[HASHSUM_MAX_HASHES][GRUB_CRYPTO_MAX_MDLEN];
+};
+
+/* Check the file of GROUP.  Return 1 if it doesn't match or can't be
+   read, with grub_errno set if the check has to stop there.  */
+static int
+check_group (struct hashsum_state *state, struct check_group *group,
+	     const char *prefix, int keep, int uncompress,
+	     unsigned *unread, unsigned *mismatch)
 {
-  grub_file_t hashlist, file;
-  char *buf = NULL;
-  grub_uint8_t expected[GRUB_CRYPTO_MAX_MDLEN];
-  grub_uint8_t actual[GRUB_CRYPTO_MAX_MDLEN];
+  grub_file_t file;
   grub_err_t err;
   unsigned i;
+
+  file = open_file (group->name, prefix, uncompress);
+  if (!file)
+    return 1;
+
+  err = hash_file (state, file, group->mask);
+  grub_file_close (file);
+  if (err)
+    {
+      grub_printf_ (N_("%s: READ ERROR\n"), group->name);
+      if (!keep)
+	return 1;
+      grub_print_error ();
+      grub_errno = GRUB_ERR_NONE;
+      (*unread)++;
+      return 1;
+    }
+
+  for (i = 0; i < group->count; i++)
+    {
+      const gcry_md_spec_t *hash = state->hashes[group->hash[i]];
+
+      if (grub_crypto_memcmp (group->expected[i],
+			      hash->read (state->contexts[group->hash[i]]),
+			      hash->mdlen) != 0)
+	{
+	  grub_printf_ (N_("%s: HASH MISMATCH\n"), group->name);
+	  if (!keep)
+	    {
+	      grub_error (GRUB_ERR_TEST_FAILURE,
+			  "hash of '%s' mismatches", group->name);
+	      return 1;
+	    }
+	  (*mismatch)++;
+	  return 1;
+	}
+    }
+  grub_printf_ (N_("%s: OK\n"), group->name);
+  return 0;
+}
+
+/* Check the files listed in HASHFILENAME.  The length of each listed
+   digest tells which hash of STATE it was made with, and consecutive lines
+   naming the same file, say its sha256 and its sha512, are checked with
+   one read of it.  */
+static grub_err_t
+check_list (struct hashsum_state *state, const char *hashfilename,
+	    const char *prefix, int keep, int uncompress)
+{
+  grub_file_t hashlist;
+  struct check_group *group;
+  char *buf;
+  unsigned i, h;
   unsigned unread = 0, mismatch = 0;
 
-  if (hash->mdlen > GRUB_CRYPTO_MAX_MDLEN)
-    return grub_error (GRUB_ERR_BUG, "mdlen is too long");
+  group = grub_zalloc (sizeof (*group));
+  if (!group)
+    return grub_errno;
 
   hashlist = grub_file_open (hashfilename, GRUB_FILE_TYPE_HASHLIST);
   if (!hashlist)
-    return grub_errno;
+    {
+      grub_free (group);
+      return grub_errno;
+    }
 
-  while (grub_free (buf), (buf = grub_file_getline (hashlist)))
+  while ((buf = grub_file_getline (hashlist)))
     {
-      const char *p = buf;
+      const char *p = buf, *digest;
+      grub_size_t len;
+
       while (grub_isspace (p[0]))
 	p++;
-      for (i = 0; i < hash->mdlen; i++)
-	{
-	  int high, low;
-	  high = hextoval (*p++);
-	  low = hextoval (*p++);
-	  if (high < 0 || low < 0)
-	    {
-	      grub_free (buf);
-	      return grub_error (GRUB_ERR_BAD_FILE_TYPE, "invalid hash list");
-	    }
-	  expected[i] = (high << 4) | low;
-	}
-      if ((p[0] != ' ' && p[0] != '\t') || (p[1] != ' ' && p[1] != '\t'))
+      digest = p;
+      while (hextoval (*p) >= 0)
+	p++;
+      len = p - digest;
+      for (h = 0; h < state->nhashes; h++)
+	if (len == 2 * state->hashes[h]->mdlen)
+	  break;
+      if (h == state->nhashes
+	  || (p[0] != ' ' && p[0] != '\t') || (p[1] != ' ' && p[1] != '\t'))
 	{
 	  grub_free (buf);
-	  return grub_error (GRUB_ERR_BAD_FILE_TYPE, "invalid hash list");
+	  grub_error (GRUB_ERR_BAD_FILE_TYPE, "invalid hash list");
+	  goto out;
 	}
       p += 2;
-      if (prefix)
-	{
-	  char *filename;
 
-	  filename = grub_xasprintf ("%s/%s", prefix, p);
-	  if (!filename)
-	    {
-	      grub_free (buf);
-	      return grub_errno;
-	    }
-	  file = grub_file_open (filename, GRUB_FILE_TYPE_TO_HASH
-				 | (!uncompress ? GRUB_FILE_TYPE_NO_DECOMPRESS
-				    : GRUB_FILE_TYPE_NONE));
-	  grub_free (filename);
-	}
-      else
-	file = grub_file_open (p, GRUB_FILE_TYPE_TO_HASH
-			       | (!uncompress ? GRUB_FILE_TYPE_NO_DECOMPRESS
-				  : GRUB_FILE_TYPE_NONE));
-      if (!file)
+      if (group->name
+	  && (grub_strcmp (group->name, p) != 0 || (group->mask & (1U << h))))
 	{
-	  grub_file_close (hashlist);
-	  grub_free (buf);
-	  return grub_errno;
-	}
-      err = hash_file (file, hash, actual);
-      grub_file_close (file);
-      if (err)
-	{
-	  grub_printf_ (N_("%s: READ ERROR\n"), p);
-	  if (!keep)
+	  check_group (state, group, prefix, keep, uncompress,
+		       &unread, &mismatch);
+	  grub_free (group->name);
+	  group->name = NULL;
+	  if (grub_errno)
 	    {
-	      grub_file_close (hashlist);
 	      grub_free (buf);
-	      return err;
+	      goto out;
 	    }
-	  grub_print_error ();
-	  grub_errno = GRUB_ERR_NONE;
-	  unread++;
-	  continue;
 	}
-      if (grub_crypto_memcmp (expected, actual, hash->mdlen) != 0)
+      if (!group->name)
 	{
-	  grub_printf_ (N_("%s: HASH MISMATCH\n"), p);
-	  if (!keep)
+	  group->name = grub_strdup (p);
+	  if (!group->name)
 	    {
-	      grub_file_close (hashlist);
 	      grub_free (buf);
-	      return grub_error (GRUB_ERR_TEST_FAILURE,
-				 "hash of '%s' mismatches", p);
+	      goto out;
 	    }
-	  mismatch++;
-	  continue;
+	  group->mask = 0;
+	  group->count = 0;
 	}
-      grub_printf_ (N_("%s: OK\n"), p);
+
+      for (i = 0; i < len / 2; i++)
+	group->expected[group->count][i] = (hextoval (digest[2 * i]) << 4)
+	  | hextoval (digest[2 * i + 1]);
+      group->hash[group->count++] = h;
+      group->mask |= 1U << h;
+      grub_free (buf);
     }
+
+  if (group->name && !grub_errno)
+    check_group (state, group, prefix, keep, uncompress, &unread, &mismatch);
+
+ out:
+  grub_file_close (hashlist);
+  grub_free (group->name);
+  grub_free (group);
+  if (grub_errno)
+    return grub_errno;
   if (mismatch || unread)
     return grub_error (GRUB_ERR_TEST_FAILURE,
 		       "%d files couldn't be read and hash "
@@ -208,9 +367,10 @@ grub_cmd_hashsum (struct grub_extcmd_context *ctxt,
 		  int argc, char **args)
 {
   struct grub_arg_list *state = ctxt->state;
+  struct hashsum_state hs;
   const char *hashname = NULL;
   const char *prefix = NULL;
-  const gcry_md_spec_t *hash;
+  grub_err_t err;
   unsigned i;
   int keep = state[3].set;
   int uncompress = state[4].set;
@@ -225,62 +385,68 @@ grub_cmd_hashsum (struct grub_extcmd_context *ctxt,
   if (!hashname)
     return grub_error (GRUB_ERR_BAD_ARGUMENT, "no hash specified");
 
-  hash = grub_crypto_lookup_md_by_name (hashname);
-  if (!hash)
-    return grub_error (GRUB_ERR_BAD_ARGUMENT, "unknown hash");
-
-  if (hash->mdlen > GRUB_CRYPTO_MAX_MDLEN)
-    return grub_error (GRUB_ERR_BUG, "mdlen is too long");
-
   if (state[2].set)
     prefix = state[2].arg;
 
+  if (state[1].set && argc != 0)
+    return grub_error (GRUB_ERR_BAD_ARGUMENT,
+		       "--check is incompatible with file list");
+
+  if (hashsum_init (&hs, hashname))
+    return grub_errno;
+
   if (state[1].set)
     {
-      if (argc != 0)
-	return grub_error (GRUB_ERR_BAD_ARGUMENT,
-			   "--check is incompatible with file list");
-      return check_list (hash, state[1].arg, prefix, keep, uncompress);
+      err = check_list (&hs, state[1].arg, prefix, keep, uncompress);
+      hashsum_fini (&hs);
+      return err;
     }
 
   for (i = 0; i < (unsigned) argc; i++)
     {
-      GRUB_PROPERLY_ALIGNED_ARRAY (result, GRUB_CRYPTO_MAX_MDLEN);
       grub_file_t file;
-      grub_err_t err;
-      unsigned j;
-      file = grub_file_open (args[i], GRUB_FILE_TYPE_TO_HASH
-			     | (!uncompress ? GRUB_FILE_TYPE_NO_DECOMPRESS
-				: GRUB_FILE_TYPE_NONE));
+      unsigned h, j;
+
+      file = open_file (args[i], NULL, uncompress);
       if (!file)
 	{
 	  if (!keep)
-	    return grub_errno;
+	    goto fail;
 	  grub_print_error ();
 	  grub_errno = GRUB_ERR_NONE;
 	  unread++;
 	  continue;
 	}
-      err = hash_file (file, hash, result);
+      err = hash_file (&hs, file, (1U << hs.nhashes) - 1);
       grub_file_close (file);
       if (err)
 	{
 	  if (!keep)
-	    return err;
+	    goto fail;
 	  grub_print_error ();
 	  grub_errno = GRUB_ERR_NONE;
 	  unread++;
 	  continue;
 	}
-      for (j = 0; j < hash->mdlen; j++)
-	grub_printf ("%02x", ((grub_uint8_t *) result)[j]);
-      grub_printf ("  %s\n", args[i]);
+      for (h = 0; h < hs.nhashes; h++)
+	{
+	  const grub_uint8_t *result = hs.hashes[h]->read (hs.contexts[h]);
+
+	  for (j = 0; j < hs.hashes[h]->mdlen; j++)
+	    grub_printf ("%02x", result[j]);
+	  grub_printf ("  %s\n", args[i]);
+	}
     }
 
+  hashsum_fini (&hs);
   if (unread)
     return grub_error (GRUB_ERR_TEST_FAILURE, "%d files couldn't be read",
 		       unread);
   return GRUB_ERR_NONE;
+
+ fail:
+  hashsum_fini (&hs);
+  return grub_errno;
 }
 
 static grub_extcmd_t cmd, cmd_md5, cmd_sha1, cmd_sha256, cmd_sha512, cmd_crc;
@@ -40,20 +40,16 @@ static const struct grub_arg_option options[] =
     {0, 0, 0, 0, 0, 0}
   };
 
-/* Opens 'filename' with compression filters disabled. Optionally disables the
-   PUBKEY filter (that insists upon properly signed files) as well.  PUBKEY
-   filter is restored before the function returns. */
-static grub_file_t
-open_envblk_file (char *filename,
-		  enum grub_file_type type)
+/* Return the name of the environment block file, FILENAME or the default
+   one, with the device it is on.  */
+static char *
+envblk_file_name (const char *filename)
 {
-  grub_file_t file;
-  char *buf = 0;
+  const char *root;
 
   if (! filename)
     {
       const char *prefix;
-      int len;
 
       prefix = grub_env_get ("prefix");
       if (! prefix)
@@ -62,15 +58,31 @@ open_envblk_file (char *filename,
           return 0;
         }
 
-      len = grub_strlen (prefix);
-      buf = grub_malloc (len + 1 + sizeof (GRUB_ENVBLK_DEFCFG));
+      return grub_xasprintf ("%s/%s", prefix, GRUB_ENVBLK_DEFCFG);
+    }
+
+  root = grub_env_get ("root");
+  if (filename[0] == '(' || ! root)
+    return grub_strdup (filename);
+  return grub_xasprintf ("(%s)%s", root, filename);
+}
+
+/* Opens 'filename' with compression filters disabled. Optionally disables the
+   PUBKEY filter (that insists upon properly signed files) as well.  PUBKEY
+   filter is restored before the function returns. */
+static grub_file_t
+open_envblk_file (char *filename,
+		  enum grub_file_type type)
+{
+  grub_file_t file;
+  char *buf = 0;
+
+  if (! filename)
+    {
+      buf = envblk_file_name (0);
       if (! buf)
         return 0;
       filename = buf;
-
-      grub_strcpy (filename, prefix);
-      filename[len] = '/';
-      grub_strcpy (filename + len + 1, GRUB_ENVBLK_DEFCFG);
     }
 
   file = grub_file_open (filename, type);
@@ -320,9 +332,11 @@ check_blocklists (grub_envblk_t envblk, struct blocklist *blocklists,
   return GRUB_ERR_NONE;
 }
 
+/* Write the blocks of ENVBLK which differ from OLD, as many as there are
+   blocklists, to disk.  */
 static int
-write_blocklists (grub_envblk_t envblk, struct blocklist *blocklists,
-                  grub_file_t file)
+write_blocklists (grub_envblk_t envblk, const char *old,
+		  struct blocklist *blocklists, grub_file_t file)
 {
   char *buf;
   grub_disk_t disk;
@@ -337,6 +351,8 @@ write_blocklists (grub_envblk_t envblk, struct blocklist *blocklists,
   index = 0;
   for (p = blocklists; p; index += p->length, p = p->next)
     {
+      if (grub_memcmp (buf + index, old + index, p->length) == 0)
+	continue;
       if (grub_disk_write (disk, p->sector - part_start,
                            p->offset, p->length, buf + index))
         return 0;
@@ -345,6 +361,32 @@ write_blocklists (grub_envblk_t envblk, struct blocklist *blocklists,
   return 1;
 }
 
+/* The file save_env last wrote, kept open with its block and the verified
+   blocklists so that the next save_env to it, as boot counting does
+   several times a boot, need neither read it nor check the blocklists
+   again.  Anything else writing to a disk, or the disk cache being
+   invalidated, changes grub_disk_generation and drops it.  */
+static struct
+{
+  char *filename;
+  grub_file_t file;
+  grub_envblk_t envblk;
+  struct blocklist *blocklists;
+  unsigned long generation;
+} save_cache;
+
+static void
+save_cache_drop (void)
+{
+  if (save_cache.envblk)
+    grub_envblk_close (save_cache.envblk);
+  free_blocklists (save_cache.blocklists);
+  if (save_cache.file)
+    grub_file_close (save_cache.file);
+  grub_free (save_cache.filename);
+  grub_memset (&save_cache, 0, sizeof (save_cache));
+}
+
 /* Context for grub_cmd_save_env.  */
 struct grub_cmd_save_env_ctx
 {
@@ -378,10 +420,11 @@ save_env_read_hook (grub_disk_addr_t sector, unsigned offset, unsigned length,
   return GRUB_ERR_NONE;
 }
 
+/* Read and check the environment block file FILENAME, taking it over, into
+   save_cache.  */
 static grub_err_t
-grub_cmd_save_env (grub_extcmd_context_t ctxt, int argc, char **args)
+save_cache_load (char *filename)
 {
-  struct grub_arg_list *state = ctxt->state;
   grub_file_t file;
   grub_envblk_t envblk;
   struct grub_cmd_save_env_ctx ctx = {
@@ -389,18 +432,20 @@ grub_cmd_save_env (grub_extcmd_context_t ctxt, int argc, char **args)
     .tail = 0
   };
 
-  if (! argc)
-    return grub_error (GRUB_ERR_BAD_ARGUMENT, "no variable is specified");
+  save_cache_drop ();
 
-  file = open_envblk_file ((state[0].set) ? state[0].arg : 0,
-			   GRUB_FILE_TYPE_SAVEENV
-			   | GRUB_FILE_TYPE_SKIP_SIGNATURE);
+  file = grub_file_open (filename, GRUB_FILE_TYPE_SAVEENV
+			 | GRUB_FILE_TYPE_SKIP_SIGNATURE);
   if (! file)
-    return grub_errno;
+    {
+      grub_free (filename);
+      return grub_errno;
+    }
 
   if (! file->device->disk)
     {
       grub_file_close (file);
+      grub_free (filename);
       return grub_error (GRUB_ERR_BAD_DEVICE, "disk device required");
     }
 
@@ -408,11 +453,50 @@ grub_cmd_save_env (grub_extcmd_context_t ctxt, int argc, char **args)
   file->read_hook_data = &ctx;
   envblk = read_envblk_file (file);
   file->read_hook = 0;
-  if (! envblk)
-    goto fail;
+  if (! envblk || check_blocklists (envblk, ctx.head, file))
+    {
+      if (envblk)
+	grub_envblk_close (envblk);
+      free_blocklists (ctx.head);
+      grub_file_close (file);
+      grub_free (filename);
+      return grub_errno;
+    }
 
-  if (check_blocklists (envblk, ctx.head, file))
-    goto fail;
+  save_cache.filename = filename;
+  save_cache.file = file;
+  save_cache.envblk = envblk;
+  save_cache.blocklists = ctx.head;
+  save_cache.generation = grub_disk_generation;
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+grub_cmd_save_env (grub_extcmd_context_t ctxt, int argc, char **args)
+{
+  struct grub_arg_list *state = ctxt->state;
+  grub_envblk_t envblk;
+  char *filename;
+  char *old;
+
+  if (! argc)
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, "no variable is specified");
+
+  filename = envblk_file_name ((state[0].set) ? state[0].arg : 0);
+  if (! filename)
+    return grub_errno;
+
+  if (save_cache.envblk && save_cache.generation == grub_disk_generation
+      && grub_strcmp (save_cache.filename, filename) == 0)
+    grub_free (filename);
+  else if (save_cache_load (filename))
+    return grub_errno;
+
+  envblk = save_cache.envblk;
+  old = grub_malloc (grub_envblk_size (envblk));
+  if (! old)
+    return grub_errno;
+  grub_memcpy (old, grub_envblk_buffer (envblk), grub_envblk_size (envblk));
 
   while (argc)
     {
@@ -423,6 +507,9 @@ grub_cmd_save_env (grub_extcmd_context_t ctxt, int argc, char **args)
         {
           if (! grub_envblk_set (envblk, args[0], value))
             {
+	      /* Nothing is saved, as without the cache.  */
+	      grub_memcpy (grub_envblk_buffer (envblk), old,
+			   grub_envblk_size (envblk));
               grub_error (GRUB_ERR_BAD_ARGUMENT, "environment block too small");
               goto fail;
             }
@@ -434,13 +521,17 @@ grub_cmd_save_env (grub_extcmd_context_t ctxt, int argc, char **args)
       args++;
     }
 
-  write_blocklists (envblk, ctx.head, file);
+  /* Only the blocks that changed are written, if any.  */
+  if (! write_blocklists (envblk, old, save_cache.blocklists, save_cache.file))
+    {
+      /* What is on disk is unknown now.  */
+      save_cache_drop ();
+      goto fail;
+    }
+  save_cache.generation = grub_disk_generation;
 
  fail:
-  if (envblk)
-    grub_envblk_close (envblk);
-  free_blocklists (ctx.head);
-  grub_file_close (file);
+  grub_free (old);
   return grub_errno;
 }
 
@@ -469,4 +560,5 @@ GRUB_MOD_FINI(loadenv)
   grub_unregister_extcmd (cmd_load);
   grub_unregister_extcmd (cmd_list);
   grub_unregister_extcmd (cmd_save);
+  save_cache_drop ();
 }
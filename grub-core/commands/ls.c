@@ -118,37 +118,45 @@ print_files_long (const char *filename, const struct grub_dirhook_info *info,
     {
       grub_file_t file;
       char *pathname;
+      grub_uint64_t size;
 
-      if (ctx->dirname[grub_strlen (ctx->dirname) - 1] == '/')
-	pathname = grub_xasprintf ("%s%s", ctx->dirname, filename);
+      if (info->sizeset)
+	size = info->size;
       else
-	pathname = grub_xasprintf ("%s/%s", ctx->dirname, filename);
-
-      if (!pathname)
-	return 1;
-
-      /* XXX: For ext2fs symlinks are detected as files while they
-	 should be reported as directories.  */
-      file = grub_file_open (pathname, GRUB_FILE_TYPE_GET_SIZE
-			     | GRUB_FILE_TYPE_NO_DECOMPRESS);
-      if (file)
 	{
-	  if (! ctx->human)
-	    grub_printf ("%-12llu", (unsigned long long) file->size);
+	  if (ctx->dirname[grub_strlen (ctx->dirname) - 1] == '/')
+	    pathname = grub_xasprintf ("%s%s", ctx->dirname, filename);
 	  else
-	    grub_printf ("%-12s", grub_get_human_size (file->size,
-						   GRUB_HUMAN_SIZE_SHORT));
+	    pathname = grub_xasprintf ("%s/%s", ctx->dirname, filename);
+
+	  if (!pathname)
+	    return 1;
+
+	  /* XXX: For ext2fs symlinks are detected as files while they
+	     should be reported as directories.  */
+	  file = grub_file_open (pathname, GRUB_FILE_TYPE_GET_SIZE
+				 | GRUB_FILE_TYPE_NO_DECOMPRESS);
+	  grub_free (pathname);
+	  if (! file)
+	    {
+	      grub_xputs ("????????????");
+	      grub_errno = GRUB_ERR_NONE;
+	      goto print_mtime;
+	    }
+	  size = file->size;
 	  grub_file_close (file);
 	}
-      else
-	grub_xputs ("????????????");
 
-      grub_free (pathname);
-      grub_errno = GRUB_ERR_NONE;
+      if (! ctx->human)
+	grub_printf ("%-12llu", (unsigned long long) size);
+      else
+	grub_printf ("%-12s", grub_get_human_size (size,
+						   GRUB_HUMAN_SIZE_SHORT));
     }
   else
     grub_printf ("%-12s", _("DIR"));
 
+ print_mtime:
   if (info->mtimeset)
     {
       struct grub_datetime datetime;
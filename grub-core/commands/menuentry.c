@@ -24,6 +24,7 @@
 #include <grub/extcmd.h>
 #include <grub/i18n.h>
 #include <grub/normal.h>
+#include <grub/safemath.h>
 
 static const struct grub_arg_option options[] =
   {
@@ -70,9 +71,54 @@ static struct
     {"f12", GRUB_TERM_KEY_F12},
   };
 
+/* Class names, shared by all the entries of that class.  Generated
+   configurations use a handful of classes over and over.  */
+struct menu_class_name
+{
+  struct menu_class_name *next;
+  char name[0];
+};
+
+static struct menu_class_name *class_names;
+
+static char *
+intern_class (const char *name)
+{
+  struct menu_class_name *c;
+  grub_size_t len = grub_strlen (name) + 1;
+
+  for (c = class_names; c; c = c->next)
+    if (grub_strcmp (c->name, name) == 0)
+      return c->name;
+
+  c = grub_malloc (sizeof (*c) + len);
+  if (! c)
+    return NULL;
+  grub_memcpy (c->name, name, len);
+  c->next = class_names;
+  class_names = c;
+  return c->name;
+}
+
+/* Copy the string S to *P and advance *P past it.  */
+static char *
+copy_string (char **p, const char *s)
+{
+  char *ret = *p;
+  grub_size_t len = grub_strlen (s) + 1;
+
+  grub_memcpy (ret, s, len);
+  *p += len;
+  return ret;
+}
+
 /* Add a menu entry to the current menu context (as given by the environment
    variable data slot `menu').  As the configuration file is read, the script
-   parser calls this when a menu entry is to be created.  */
+   parser calls this when a menu entry is to be created.
+
+   The entry is one allocation holding its class list, arguments and
+   strings, so grub_normal_free_menu frees it with one grub_free.  The
+   class names themselves are interned.  */
 grub_err_t
 grub_normal_add_menu_entry (int argc, const char **args,
 			    char **classes, const char *id,
@@ -81,138 +127,107 @@ grub_normal_add_menu_entry (int argc, const char **args,
 			    int submenu)
 {
   int menu_hotkey = 0;
-  char **menu_args = NULL;
-  char *menu_users = NULL;
-  char *menu_title = NULL;
-  char *menu_sourcecode = NULL;
-  char *menu_id = NULL;
-  struct grub_menu_entry_class *menu_classes = NULL;
+  int nclasses = 0;
+  int i;
+  grub_size_t size, prefix_len, source_len;
+  grub_menu_entry_t entry;
+  struct grub_menu_entry_class *menu_classes;
+  char **menu_args;
+  char *p;
 
   grub_menu_t menu;
-  grub_menu_entry_t *last;
+  grub_menu_entry_t *last, tail;
 
   menu = grub_env_get_menu ();
   if (! menu)
     return grub_error (GRUB_ERR_MENU, "no menu context");
 
-  last = &menu->entry_list;
-
-  menu_sourcecode = grub_xasprintf ("%s%s", prefix ?: "", sourcecode);
-  if (! menu_sourcecode)
-    return grub_errno;
-
-  if (classes && classes[0])
-    {
-      int i;
-      for (i = 0; classes[i]; i++); /* count # of menuentry classes */
-      menu_classes = grub_zalloc (sizeof (struct grub_menu_entry_class)
-				  * (i + 1));
-      if (! menu_classes)
-	goto fail;
-
-      for (i = 0; classes[i]; i++)
-	{
-	  menu_classes[i].name = grub_strdup (classes[i]);
-	  if (! menu_classes[i].name)
-	    goto fail;
-	  menu_classes[i].next = classes[i + 1] ? &menu_classes[i + 1] : NULL;
-	}
-    }
-
-  if (users)
-    {
-      menu_users = grub_strdup (users);
-      if (! menu_users)
-	goto fail;
-    }
+  if (! argc)
+    return grub_error (GRUB_ERR_MENU, "menuentry is missing title");
 
   if (hotkey)
     {
-      unsigned i;
-      for (i = 0; i < ARRAY_SIZE (hotkey_aliases); i++)
-	if (grub_strcmp (hotkey, hotkey_aliases[i].name) == 0)
+      unsigned j;
+      for (j = 0; j < ARRAY_SIZE (hotkey_aliases); j++)
+	if (grub_strcmp (hotkey, hotkey_aliases[j].name) == 0)
 	  {
-	    menu_hotkey = hotkey_aliases[i].key;
+	    menu_hotkey = hotkey_aliases[j].key;
 	    break;
 	  }
-      if (i == ARRAY_SIZE (hotkey_aliases))
+      if (j == ARRAY_SIZE (hotkey_aliases))
 	menu_hotkey = hotkey[0];
     }
 
-  if (! argc)
-    {
-      grub_error (GRUB_ERR_MENU, "menuentry is missing title");
-      goto fail;
-    }
+  if (classes)
+    for (; classes[nclasses]; nclasses++);
+
+  prefix_len = prefix ? grub_strlen (prefix) : 0;
+  source_len = grub_strlen (sourcecode);
 
-  menu_title = grub_strdup (args[0]);
-  if (! menu_title)
-    goto fail;
+  size = sizeof (*entry)
+    + nclasses * sizeof (struct grub_menu_entry_class)
+    + (argc + 1) * sizeof (char *);
+  if (grub_add (size, prefix_len + source_len + 1, &size)
+      || grub_add (size, grub_strlen (id ? : args[0]) + 1, &size)
+      || (users && grub_add (size, grub_strlen (users) + 1, &size)))
+    return grub_error (GRUB_ERR_OUT_OF_RANGE, N_("overflow is detected"));
+  for (i = 0; i < argc; i++)
+    if (grub_add (size, grub_strlen (args[i]) + 1, &size))
+      return grub_error (GRUB_ERR_OUT_OF_RANGE, N_("overflow is detected"));
+
+  entry = grub_zalloc (size);
+  if (! entry)
+    return grub_errno;
+  menu_classes = (struct grub_menu_entry_class *) (entry + 1);
+  menu_args = (char **) (menu_classes + nclasses);
+  p = (char *) (menu_args + argc + 1);
 
-  menu_id = grub_strdup (id ? : menu_title);
-  if (! menu_id)
-    goto fail;
+  for (i = 0; i < nclasses; i++)
+    {
+      menu_classes[i].name = intern_class (classes[i]);
+      if (! menu_classes[i].name)
+	{
+	  grub_free (entry);
+	  return grub_errno;
+	}
+      menu_classes[i].next = i + 1 < nclasses ? &menu_classes[i + 1] : NULL;
+    }
 
   /* Save argc, args to pass as parameters to block arg later. */
-  menu_args = grub_calloc (argc + 1, sizeof (char *));
-  if (! menu_args)
-    goto fail;
+  for (i = 0; i < argc; i++)
+    menu_args[i] = copy_string (&p, args[i]);
+  menu_args[argc] = NULL;
 
-  {
-    int i;
-    for (i = 0; i < argc; i++)
-      {
-	menu_args[i] = grub_strdup (args[i]);
-	if (! menu_args[i])
-	  goto fail;
-      }
-    menu_args[argc] = NULL;
-  }
+  entry->sourcecode = p;
+  if (prefix)
+    grub_memcpy (p, prefix, prefix_len);
+  grub_memcpy (p + prefix_len, sourcecode, source_len + 1);
+  p += prefix_len + source_len + 1;
+
+  entry->title = menu_args[0];
+  entry->id = id ? copy_string (&p, id) : copy_string (&p, args[0]);
+  if (users)
+    {
+      entry->users = copy_string (&p, users);
+      entry->restricted = 1;
+    }
+  entry->hotkey = menu_hotkey;
+  entry->classes = nclasses ? menu_classes : NULL;
+  entry->argc = argc;
+  entry->args = menu_args;
+  entry->submenu = submenu;
 
   /* Add the menu entry at the end of the list.  */
+  last = &menu->entry_list;
+  tail = menu->size ? grub_menu_get_entry (menu, menu->size - 1) : NULL;
+  if (tail)
+    last = &tail->next;
   while (*last)
     last = &(*last)->next;
-
-  *last = grub_zalloc (sizeof (**last));
-  if (! *last)
-    goto fail;
-
-  (*last)->title = menu_title;
-  (*last)->id = menu_id;
-  (*last)->hotkey = menu_hotkey;
-  (*last)->classes = menu_classes;
-  if (menu_users)
-    (*last)->restricted = 1;
-  (*last)->users = menu_users;
-  (*last)->argc = argc;
-  (*last)->args = menu_args;
-  (*last)->sourcecode = menu_sourcecode;
-  (*last)->submenu = submenu;
+  *last = entry;
 
   menu->size++;
   return GRUB_ERR_NONE;
-
- fail:
-
-  grub_free (menu_sourcecode);
-  {
-    int i;
-    for (i = 0; menu_classes && menu_classes[i].name; i++)
-      grub_free (menu_classes[i].name);
-    grub_free (menu_classes);
-  }
-
-  {
-    int i;
-    for (i = 0; menu_args && menu_args[i]; i++)
-      grub_free (menu_args[i]);
-    grub_free (menu_args);
-  }
-
-  grub_free (menu_users);
-  grub_free (menu_title);
-  grub_free (menu_id);
-  return grub_errno;
 }
 
 static char *
@@ -332,6 +347,15 @@ grub_menu_init (void)
 void
 grub_menu_fini (void)
 {
+  struct menu_class_name *c, *next;
+
   grub_unregister_extcmd (cmd);
   grub_unregister_extcmd (cmd_sub);
+
+  for (c = class_names; c; c = next)
+    {
+      next = c->next;
+      grub_free (c);
+    }
+  class_names = NULL;
 }
@@ -187,6 +187,58 @@ struct grub_public_subkey
   gcry_mpi_t mpis[10];
 };
 
+/*
+ * Signatures verified during this boot, so that a file checked again
+ * against the same signature does not cost another public key operation.
+ * Only successes are kept, and an entry is only looked at once the key
+ * was found among the trusted ones again.
+ */
+#define VERIFIED_CACHE_SIZE 32
+
+struct verified_cache_entry
+{
+  const gcry_md_spec_t *hash;
+  grub_uint8_t pkeyalgo;
+  grub_uint32_t fingerprint[5];
+  grub_uint8_t hval[GRUB_CRYPTO_MAX_MDLEN];
+};
+
+static struct verified_cache_entry verified_cache[VERIFIED_CACHE_SIZE];
+static unsigned verified_cache_next;
+
+static int
+verified_cache_find (const gcry_md_spec_t *hash, grub_uint8_t pkeyalgo,
+		     const grub_uint32_t *fingerprint, const grub_uint8_t *hval)
+{
+  unsigned i;
+
+  for (i = 0; i < ARRAY_SIZE (verified_cache); i++)
+    if (verified_cache[i].hash == hash
+	&& verified_cache[i].pkeyalgo == pkeyalgo
+	&& grub_memcmp (verified_cache[i].fingerprint, fingerprint,
+			sizeof (verified_cache[i].fingerprint)) == 0
+	&& grub_memcmp (verified_cache[i].hval, hval, hash->mdlen) == 0)
+      return 1;
+  return 0;
+}
+
+static void
+verified_cache_add (const gcry_md_spec_t *hash, grub_uint8_t pkeyalgo,
+		    const grub_uint32_t *fingerprint, const grub_uint8_t *hval)
+{
+  struct verified_cache_entry *e;
+
+  if (hash->mdlen > sizeof (e->hval))
+    return;
+
+  e = &verified_cache[verified_cache_next];
+  verified_cache_next = (verified_cache_next + 1) % ARRAY_SIZE (verified_cache);
+  e->hash = hash;
+  e->pkeyalgo = pkeyalgo;
+  grub_memcpy (e->fingerprint, fingerprint, sizeof (e->fingerprint));
+  grub_memcpy (e->hval, hval, hash->mdlen);
+}
+
 static void
 free_pk (struct grub_public_key *pk)
 {
@@ -638,6 +690,13 @@ grub_verify_signature_real (struct grub_pubkey_context *ctxt,
       goto fail;
     }
 
+  if (verified_cache_find (ctxt->hash, pk, sk->fingerprint, hval))
+    {
+      grub_dprintf ("crypt", "signature already verified\n");
+      grub_free (readbuf);
+      return GRUB_ERR_NONE;
+    }
+
   if (pkalgos[pk].pad (&hmpi, hval, ctxt->hash, sk))
     goto fail;
   if (!*pkalgos[pk].algo)
@@ -655,6 +714,7 @@ grub_verify_signature_real (struct grub_pubkey_context *ctxt,
   if ((*pkalgos[pk].algo)->verify (0, hmpi, mpis, sk->mpis, 0, 0))
     goto fail;
 
+  verified_cache_add (ctxt->hash, pk, sk->fingerprint, hval);
   grub_free (readbuf);
 
   return GRUB_ERR_NONE;
@@ -0,0 +1,571 @@
+/* prefetch.c - record the disk ranges read during boot and read them early */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/dl.h>
+#include <grub/mm.h>
+#include <grub/file.h>
+#include <grub/disk.h>
+#include <grub/misc.h>
+#include <grub/partition.h>
+#include <grub/loader.h>
+#include <grub/extcmd.h>
+#include <grub/i18n.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+/* Most ranges recorded or read from a list.  */
+#define PREFETCH_MAX_RANGES	4096
+/* Most disks named in a list.  */
+#define PREFETCH_MAX_DISKS	16
+/* Bytes read at a time when prefetching.  */
+#define PREFETCH_CHUNK		(1 << 20)
+/* Ranges this close, in sectors, are read as one.  */
+#define PREFETCH_GAP		GRUB_DISK_CACHE_SIZE
+
+#define PREFETCH_HEADER		"# GRUB prefetch list\n"
+
+static const struct grub_arg_option options[] =
+  {
+    {"record", 'r', 0,
+     N_("Record the disk ranges read until boot into FILE."), 0, 0},
+    {0, 0, 0, 0, 0, 0}
+  };
+
+/* SECTOR is in 512-byte sectors from the start of disk DISK, an index
+   into the disk names of the list.  */
+struct prefetch_range
+{
+  unsigned disk;
+  grub_disk_addr_t start;
+  grub_disk_addr_t end;
+};
+
+struct prefetch_list
+{
+  char *disks[PREFETCH_MAX_DISKS];
+  unsigned ndisks;
+  struct prefetch_range *ranges;
+  grub_size_t nranges;
+};
+
+/* The recording in progress.  */
+static struct prefetch_list record;
+static char *record_file;
+static struct grub_preboot *record_preboot;
+
+static void
+list_free (struct prefetch_list *list)
+{
+  unsigned i;
+
+  for (i = 0; i < list->ndisks; i++)
+    grub_free (list->disks[i]);
+  grub_free (list->ranges);
+  grub_memset (list, 0, sizeof (*list));
+}
+
+/* Return the index of disk NAME in LIST, adding it if needed, or -1.  */
+static int
+list_disk (struct prefetch_list *list, const char *name)
+{
+  unsigned i;
+
+  for (i = 0; i < list->ndisks; i++)
+    if (grub_strcmp (list->disks[i], name) == 0)
+      return i;
+  if (list->ndisks == PREFETCH_MAX_DISKS)
+    return -1;
+  list->disks[list->ndisks] = grub_strdup (name);
+  if (!list->disks[list->ndisks])
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return -1;
+    }
+  return list->ndisks++;
+}
+
+static int
+range_less (const struct prefetch_range *a, const struct prefetch_range *b)
+{
+  if (a->disk != b->disk)
+    return a->disk < b->disk;
+  return a->start < b->start;
+}
+
+/* Sort the ranges of LIST by disk and sector, and merge those that
+   overlap or are less than PREFETCH_GAP sectors apart.  */
+static void
+list_compact (struct prefetch_list *list)
+{
+  grub_size_t gap, i, j, n = list->nranges;
+  struct prefetch_range *r = list->ranges;
+
+  /* Shell sort, the lists are too short to need more.  */
+  for (gap = n / 2; gap > 0; gap /= 2)
+    for (i = gap; i < n; i++)
+      {
+	struct prefetch_range tmp = r[i];
+
+	for (j = i; j >= gap && range_less (&tmp, &r[j - gap]); j -= gap)
+	  r[j] = r[j - gap];
+	r[j] = tmp;
+      }
+
+  for (i = 0, j = 0; i < n; i++)
+    {
+      if (j > 0 && r[j - 1].disk == r[i].disk
+	  && r[i].start <= r[j - 1].end + PREFETCH_GAP)
+	{
+	  if (r[i].end > r[j - 1].end)
+	    r[j - 1].end = r[i].end;
+	  continue;
+	}
+      r[j++] = r[i];
+    }
+  list->nranges = j;
+}
+
+/* Add the range from START to END of disk DISK to LIST.  Return 0 if it
+   is full.  */
+static int
+list_add (struct prefetch_list *list, unsigned disk,
+	  grub_disk_addr_t start, grub_disk_addr_t end)
+{
+  struct prefetch_range *last;
+
+  if (!list->ranges)
+    {
+      list->ranges = grub_calloc (PREFETCH_MAX_RANGES,
+				  sizeof (list->ranges[0]));
+      if (!list->ranges)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  return 0;
+	}
+    }
+
+  /* Sequential reads, as of a file, continue the last range.  */
+  last = list->nranges ? &list->ranges[list->nranges - 1] : NULL;
+  if (last && last->disk == disk && start >= last->start
+      && start <= last->end)
+    {
+      if (end > last->end)
+	last->end = end;
+      return 1;
+    }
+
+  if (list->nranges == PREFETCH_MAX_RANGES)
+    {
+      list_compact (list);
+      if (list->nranges == PREFETCH_MAX_RANGES)
+	return 0;
+    }
+  list->ranges[list->nranges].disk = disk;
+  list->ranges[list->nranges].start = start;
+  list->ranges[list->nranges].end = end;
+  list->nranges++;
+  return 1;
+}
+
+static void
+record_read (grub_disk_t disk, grub_disk_addr_t sector, grub_off_t offset,
+	     grub_size_t size)
+{
+  static unsigned last_disk;
+  grub_disk_addr_t start, end;
+  int d;
+
+  if (size == 0)
+    return;
+
+  start = sector + (offset >> GRUB_DISK_SECTOR_BITS);
+  end = sector + ((offset + size + GRUB_DISK_SECTOR_SIZE - 1)
+		  >> GRUB_DISK_SECTOR_BITS);
+
+  if (last_disk < record.ndisks
+      && grub_strcmp (record.disks[last_disk], disk->name) == 0)
+    d = last_disk;
+  else
+    d = list_disk (&record, disk->name);
+  if (d < 0)
+    return;
+  last_disk = d;
+
+  if (!list_add (&record, d, start, end))
+    /* Full, keep what is there.  */
+    grub_disk_read_record = NULL;
+}
+
+/* Parse the list in BUF of SIZE bytes into LIST.  */
+static void
+list_parse (struct prefetch_list *list, char *buf, grub_size_t size)
+{
+  char *line, *next, *end = buf + size;
+
+  for (line = buf; line < end; line = next)
+    {
+      const char *p;
+      char *name;
+      grub_disk_addr_t start, count;
+      int d;
+
+      next = grub_memchr (line, '\n', end - line);
+      if (!next)
+	break;
+      *next++ = 0;
+      if (line[0] == '#' || line[0] == 0)
+	continue;
+
+      name = line;
+      line = grub_strchr (line, ' ');
+      if (!line)
+	continue;
+      *line++ = 0;
+      start = grub_strtoull (line, &p, 0);
+      if (grub_errno || *p != ' ')
+	goto skip;
+      count = grub_strtoull (p + 1, &p, 0);
+      if (grub_errno || *p != 0 || count == 0)
+	goto skip;
+
+      d = list_disk (list, name);
+      if (d < 0 || !list_add (list, d, start, start + count))
+	break;
+      continue;
+
+    skip:
+      grub_errno = GRUB_ERR_NONE;
+    }
+}
+
+/* Read the ranges in LIST, at most BUDGET bytes of them, into the disk
+   cache.  */
+static void
+list_prefetch (struct prefetch_list *list, grub_uint64_t budget)
+{
+  grub_disk_t disk = NULL;
+  unsigned disk_index = 0;
+  grub_size_t i;
+  char *buf;
+  void (*recording) (grub_disk_t, grub_disk_addr_t, grub_off_t, grub_size_t);
+
+  buf = grub_malloc (PREFETCH_CHUNK);
+  if (!buf)
+    return;
+
+  /* Prefetching isn't part of what boot reads.  */
+  recording = grub_disk_read_record;
+  grub_disk_read_record = NULL;
+
+  for (i = 0; i < list->nranges && budget; i++)
+    {
+      struct prefetch_range *r = &list->ranges[i];
+      grub_disk_addr_t sector;
+
+      if (!disk || disk_index != r->disk)
+	{
+	  if (disk)
+	    grub_disk_close (disk);
+	  disk_index = r->disk;
+	  disk = grub_disk_open (list->disks[r->disk]);
+	  if (!disk)
+	    {
+	      grub_errno = GRUB_ERR_NONE;
+	      continue;
+	    }
+	}
+
+      for (sector = r->start; sector < r->end && budget; )
+	{
+	  grub_uint64_t len;
+
+	  len = (r->end - sector) << GRUB_DISK_SECTOR_BITS;
+	  if (len > PREFETCH_CHUNK)
+	    len = PREFETCH_CHUNK;
+	  if (len > budget)
+	    len = budget;
+	  if (grub_disk_read (disk, sector, 0, len, buf))
+	    {
+	      /* The disk changed since, just go on.  */
+	      grub_errno = GRUB_ERR_NONE;
+	      break;
+	    }
+	  budget -= len;
+	  sector += len >> GRUB_DISK_SECTOR_BITS;
+	}
+    }
+
+  if (disk)
+    grub_disk_close (disk);
+  grub_free (buf);
+  grub_disk_read_record = recording;
+}
+
+/* Used to maintain the blocks of the list file.  */
+struct blocklist
+{
+  grub_disk_addr_t sector;
+  unsigned offset;
+  unsigned length;
+  struct blocklist *next;
+};
+
+struct save_ctx
+{
+  struct blocklist *head, *tail;
+};
+
+static grub_err_t
+save_read_hook (grub_disk_addr_t sector, unsigned offset, unsigned length,
+		char *buf __attribute__ ((unused)), void *data)
+{
+  struct save_ctx *ctx = data;
+  struct blocklist *block;
+
+  block = grub_malloc (sizeof (*block));
+  if (! block)
+    return GRUB_ERR_NONE;
+
+  block->sector = sector;
+  block->offset = offset;
+  block->length = length;
+  block->next = 0;
+  if (ctx->tail)
+    ctx->tail->next = block;
+  ctx->tail = block;
+  if (! ctx->head)
+    ctx->head = block;
+
+  return GRUB_ERR_NONE;
+}
+
+/* Write the recorded ranges over the file record_file, which keeps its
+   size, in the way save_env writes an environment block.  */
+static grub_err_t
+record_save (void)
+{
+  struct save_ctx ctx = { 0, 0 };
+  struct blocklist *p, *q;
+  grub_file_t file;
+  grub_size_t size, pos, index;
+  grub_disk_addr_t part_start;
+  char *old = NULL, *new = NULL;
+  grub_size_t i;
+
+  list_compact (&record);
+
+  file = grub_file_open (record_file, GRUB_FILE_TYPE_PREFETCH_LIST
+			 | GRUB_FILE_TYPE_SKIP_SIGNATURE);
+  if (!file)
+    return grub_errno;
+  if (!file->device->disk)
+    {
+      grub_error (GRUB_ERR_BAD_DEVICE, "disk device required");
+      goto out;
+    }
+
+  size = grub_file_size (file);
+  old = grub_malloc (size);
+  new = grub_malloc (size);
+  if (!old || !new)
+    goto out;
+
+  file->read_hook = save_read_hook;
+  file->read_hook_data = &ctx;
+  if (grub_file_read (file, old, size) != (grub_ssize_t) size)
+    {
+      if (!grub_errno)
+	grub_error (GRUB_ERR_FILE_READ_ERROR, N_("premature end of file %s"),
+		    record_file);
+      goto out;
+    }
+  file->read_hook = 0;
+
+  index = 0;
+  for (p = ctx.head; p; p = p->next)
+    index += p->length;
+  if (index != size)
+    {
+      grub_error (GRUB_ERR_BAD_FILE_TYPE, "sparse file not allowed");
+      goto out;
+    }
+
+  /* Fill the file with as many ranges as fit, then '#'.  */
+  pos = grub_strlen (PREFETCH_HEADER);
+  if (pos > size)
+    {
+      grub_error (GRUB_ERR_OUT_OF_RANGE, "prefetch list file too small");
+      goto out;
+    }
+  grub_memcpy (new, PREFETCH_HEADER, pos);
+  for (i = 0; i < record.nranges; i++)
+    {
+      char line[64];
+      grub_size_t len;
+
+      grub_snprintf (line, sizeof (line), " %llu %llu\n",
+		     (unsigned long long) record.ranges[i].start,
+		     (unsigned long long) (record.ranges[i].end
+					   - record.ranges[i].start));
+      len = grub_strlen (record.disks[record.ranges[i].disk]);
+      if (pos + len + grub_strlen (line) > size)
+	break;
+      grub_memcpy (new + pos, record.disks[record.ranges[i].disk], len);
+      pos += len;
+      grub_memcpy (new + pos, line, grub_strlen (line));
+      pos += grub_strlen (line);
+    }
+  grub_memset (new + pos, '#', size - pos);
+
+  part_start = grub_partition_get_start (file->device->disk->partition);
+  index = 0;
+  for (p = ctx.head; p; index += p->length, p = p->next)
+    {
+      if (grub_memcmp (new + index, old + index, p->length) == 0)
+	continue;
+      if (grub_disk_write (file->device->disk, p->sector - part_start,
+			   p->offset, p->length, new + index))
+	goto out;
+    }
+
+ out:
+  for (p = ctx.head; p; p = q)
+    {
+      q = p->next;
+      grub_free (p);
+    }
+  grub_free (old);
+  grub_free (new);
+  grub_file_close (file);
+  return grub_errno;
+}
+
+static void
+record_stop (void)
+{
+  grub_disk_read_record = NULL;
+  if (record_preboot)
+    grub_loader_unregister_preboot_hook (record_preboot);
+  record_preboot = NULL;
+  list_free (&record);
+  grub_free (record_file);
+  record_file = NULL;
+}
+
+static grub_err_t
+record_preboot_hook (int noret __attribute__ ((unused)))
+{
+  /* The boot may have failed and be tried again.  */
+  if (!record_file)
+    return GRUB_ERR_NONE;
+
+  grub_disk_read_record = NULL;
+  if (record_save ())
+    {
+      /* Not worth failing the boot for.  */
+      grub_print_error ();
+      grub_errno = GRUB_ERR_NONE;
+    }
+  list_free (&record);
+  grub_free (record_file);
+  record_file = NULL;
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+grub_cmd_prefetch (grub_extcmd_context_t ctxt, int argc, char **args)
+{
+  struct grub_arg_list *state = ctxt->state;
+  struct prefetch_list list;
+  grub_file_t file;
+  grub_ssize_t size;
+  grub_uint64_t budget;
+  char *buf;
+
+  if (argc != 1)
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("filename expected"));
+
+  if (state[0].set)
+    {
+      record_stop ();
+      record_file = grub_strdup (args[0]);
+      if (!record_file)
+	return grub_errno;
+      record_preboot
+	= grub_loader_register_preboot_hook (record_preboot_hook, NULL,
+					     GRUB_LOADER_PREBOOT_HOOK_PRIO_NORMAL);
+      if (!record_preboot)
+	{
+	  record_stop ();
+	  return grub_errno;
+	}
+      grub_disk_read_record = record_read;
+      return GRUB_ERR_NONE;
+    }
+
+  file = grub_file_open (args[0], GRUB_FILE_TYPE_PREFETCH_LIST
+			 | GRUB_FILE_TYPE_SKIP_SIGNATURE);
+  if (!file)
+    return grub_errno;
+  buf = grub_malloc (grub_file_size (file));
+  if (!buf)
+    {
+      grub_file_close (file);
+      return grub_errno;
+    }
+  size = grub_file_read (file, buf, grub_file_size (file));
+  grub_file_close (file);
+  if (size < 0)
+    {
+      grub_free (buf);
+      return grub_errno;
+    }
+
+  grub_memset (&list, 0, sizeof (list));
+  list_parse (&list, buf, size);
+  grub_free (buf);
+  list_compact (&list);
+
+  /* Don't read more than half of the cache holds, so the first ranges
+     are still there when they're needed.  */
+  budget = ((grub_uint64_t) grub_disk_cache_num_sets * GRUB_DISK_CACHE_WAYS
+	    * (GRUB_DISK_CACHE_SIZE << GRUB_DISK_SECTOR_BITS)) / 2;
+  list_prefetch (&list, budget);
+  list_free (&list);
+
+  return GRUB_ERR_NONE;
+}
+
+static grub_extcmd_t cmd;
+
+GRUB_MOD_INIT(prefetch)
+{
+  cmd = grub_register_extcmd ("prefetch", grub_cmd_prefetch, 0,
+			      N_("[--record] FILE"),
+			      N_("Read the disk ranges listed in FILE into the "
+				 "disk cache, or record those read until boot "
+				 "into it."),
+			      options);
+}
+
+GRUB_MOD_FINI(prefetch)
+{
+  grub_unregister_extcmd (cmd);
+  record_stop ();
+}
@@ -42,6 +42,108 @@ struct cache_entry
 
 static struct cache_entry *cache;
 
+#ifndef DO_SEARCH_FILE
+/* The UUID or label found on each device, so that a search for another
+   key does not probe every filesystem again.  Only what is no match is
+   trusted: a device that matches is probed again to confirm it.  Devices
+   are told apart by disk and partition rather than by name, which a new
+   device can take over, and all are forgotten when grub_disk_generation
+   changes.  */
+struct device_entry
+{
+  struct device_entry *next;
+  unsigned long dev_id;
+  unsigned long disk_id;
+  grub_disk_addr_t part_start;
+  /* NULL when the filesystem has none.  */
+  char *value;
+  int have_fs;
+  /* With no filesystem found, the number of filesystems there were and
+     whether they could be autoloaded, as more may turn up later.  */
+  unsigned nfs;
+  int autoload;
+};
+
+static struct device_entry *devices;
+static unsigned long devices_generation;
+
+static void devices_free (void);
+
+static unsigned
+count_fs (void)
+{
+  grub_fs_t fs;
+  unsigned n = 0;
+
+  FOR_FILESYSTEMS (fs)
+    n++;
+  return n;
+}
+
+static struct device_entry *
+device_find (grub_disk_t disk)
+{
+  struct device_entry *ent;
+
+  if (devices_generation != grub_disk_generation)
+    {
+      devices_free ();
+      devices_generation = grub_disk_generation;
+    }
+
+  for (ent = devices; ent; ent = ent->next)
+    if (ent->dev_id == disk->dev->id
+	&& ent->disk_id == disk->id
+	&& ent->part_start == grub_partition_get_start (disk->partition))
+      return ent;
+  return NULL;
+}
+
+/* Remember what was found on DISK, taking over VALUE.  */
+static void
+device_record (grub_disk_t disk, int have_fs, char *value)
+{
+  struct device_entry *ent = device_find (disk);
+
+  if (! ent)
+    {
+      ent = grub_zalloc (sizeof (*ent));
+      if (! ent)
+	goto fail;
+      ent->dev_id = disk->dev->id;
+      ent->disk_id = disk->id;
+      ent->part_start = grub_partition_get_start (disk->partition);
+      ent->next = devices;
+      devices = ent;
+    }
+
+  grub_free (ent->value);
+  ent->value = value;
+  ent->have_fs = have_fs;
+  ent->nfs = count_fs ();
+  ent->autoload = !!grub_fs_autoload_hook;
+  return;
+
+ fail:
+  grub_free (value);
+  grub_errno = GRUB_ERR_NONE;
+}
+
+static void
+devices_free (void)
+{
+  struct device_entry *ent, *next;
+
+  for (ent = devices; ent; ent = next)
+    {
+      next = ent->next;
+      grub_free (ent->value);
+      grub_free (ent);
+    }
+  devices = NULL;
+}
+#endif
+
 /* Context for FUNC_NAME.  */
 struct search_ctx
 {
@@ -116,10 +218,22 @@ iterate_device (const char *name, void *data)
       grub_device_t dev;
       grub_fs_t fs;
       char *quid;
+      struct device_entry *ent = NULL;
 
       dev = grub_device_open (name);
       if (dev)
 	{
+	  if (dev->disk)
+	    ent = device_find (dev->disk);
+	  if (ent && (ent->have_fs
+		      || (ent->nfs == count_fs ()
+			  && (ent->autoload || ! grub_fs_autoload_hook)))
+	      && ! (ent->value && compare_fn (ent->value, ctx->key) == 0))
+	    {
+	      grub_device_close (dev);
+	      goto known;
+	    }
+
 	  fs = grub_fs_probe (dev);
 
 #ifdef DO_SEARCH_FS_UUID
@@ -130,19 +244,31 @@ iterate_device (const char *name, void *data)
 
 	  if (fs && fs->read_fn)
 	    {
+	      quid = NULL;
 	      fs->read_fn (dev, &quid);
 
-	      if (grub_errno == GRUB_ERR_NONE && quid)
+	      if (grub_errno == GRUB_ERR_NONE)
 		{
-		  if (compare_fn (quid, ctx->key) == 0)
+		  if (quid && compare_fn (quid, ctx->key) == 0)
 		    found = 1;
 
-		  grub_free (quid);
+		  if (dev->disk)
+		    device_record (dev->disk, 1, quid);
+		  else
+		    grub_free (quid);
 		}
+	      else
+		grub_free (quid);
 	    }
+	  else if (fs && dev->disk)
+	    device_record (dev->disk, 1, NULL);
+	  else if (! fs && dev->disk && grub_errno == GRUB_ERR_UNKNOWN_FS)
+	    device_record (dev->disk, 0, NULL);
 
 	  grub_device_close (dev);
 	}
+    known:
+      ;
     }
 #endif
 
@@ -354,4 +480,7 @@ GRUB_MOD_FINI(search_label)
 #endif
 {
   grub_unregister_command (cmd);
+#ifndef DO_SEARCH_FILE
+  devices_free ();
+#endif
 }
@@ -1,4 +1,4 @@
-/* testspeed.c - Command to test file read speed  */
+/* testspeed.c - Command to test file, disk and hash speed  */
 /*
  *  GRUB  --  GRand Unified Bootloader
  *  Copyright (C) 2012  Free Software Foundation, Inc.
@@ -19,93 +19,381 @@
 
 #include <grub/mm.h>
 #include <grub/file.h>
+#include <grub/disk.h>
 #include <grub/time.h>
+#include <grub/trace.h>
 #include <grub/misc.h>
 #include <grub/dl.h>
 #include <grub/extcmd.h>
+#include <grub/crypto.h>
 #include <grub/i18n.h>
 #include <grub/normal.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
 #define DEFAULT_BLOCK_SIZE	65536
+/* Disks are read up to this much unless --count says otherwise.  */
+#define DEFAULT_DISK_BYTES	(64 * 1024 * 1024)
+/* The same offsets on every machine, so that the results compare.  */
+#define RANDOM_SEED		0x9e3779b97f4a7c15ULL
 
 static const struct grub_arg_option options[] =
   {
     {"size", 's', 0, N_("Specify size for each read operation"), 0, ARG_TYPE_INT},
+    {"mode", 'm', 0,
+     N_("Read sequentially, at random offsets or hash what is read."),
+     "seq|random|hash", ARG_TYPE_STRING},
+    {"disk", 'd', 0, N_("Read the disk named by the argument, not a file."),
+     0, 0},
+    {"count", 'c', 0, N_("Specify the number of read operations"), 0,
+     ARG_TYPE_INT},
+    {"passes", 'p', 0, N_("Repeat the test this many times."), 0,
+     ARG_TYPE_INT},
+    {"cold", 'C', 0, N_("Empty the disk cache before each pass."), 0, 0},
+    {"no-decompress", 'n', 0, N_("Read compressed files as they are."),
+     0, 0},
+    {"hash", 'H', 0, N_("Use HASH in hash mode, sha256 by default."),
+     N_("HASH"), ARG_TYPE_STRING},
+    {"machine-readable", 'M', 0, N_("Print each result as KEY=VALUE pairs."),
+     0, 0},
     {0, 0, 0, 0, 0, 0}
   };
 
+enum
+  {
+    TESTSPEED_SIZE,
+    TESTSPEED_MODE,
+    TESTSPEED_DISK,
+    TESTSPEED_COUNT,
+    TESTSPEED_PASSES,
+    TESTSPEED_COLD,
+    TESTSPEED_NO_DECOMPRESS,
+    TESTSPEED_HASH,
+    TESTSPEED_MACHINE
+  };
+
+enum testspeed_mode
+  {
+    MODE_SEQ,
+    MODE_RANDOM,
+    MODE_HASH
+  };
+
+static const char *const mode_names[] =
+  {
+    [MODE_SEQ] = "seq",
+    [MODE_RANDOM] = "random",
+    [MODE_HASH] = "hash"
+  };
+
+struct testspeed
+{
+  enum testspeed_mode mode;
+  grub_file_t file;
+  grub_disk_t disk;
+  /* The size of the file or disk.  */
+  grub_uint64_t size;
+  grub_size_t block_size;
+  grub_uint64_t count;
+  const gcry_md_spec_t *hash;
+  void *hash_context;
+  char *buffer;
+};
+
+struct testspeed_result
+{
+  grub_uint64_t bytes;
+  grub_uint64_t reads;
+  grub_uint64_t us;
+  /* The part of US spent hashing.  */
+  grub_uint64_t hash_us;
+};
+
+static grub_uint64_t
+testspeed_now_us (void)
+{
+  return grub_trace_to_us (grub_trace_now ());
+}
+
+static grub_uint64_t
+random_next (grub_uint64_t *state)
+{
+  *state ^= *state << 13;
+  *state ^= *state >> 7;
+  *state ^= *state << 17;
+  return *state;
+}
+
+static grub_ssize_t
+testspeed_read (struct testspeed *t, grub_uint64_t offset, grub_size_t len)
+{
+  if (t->disk)
+    {
+      if (grub_disk_read (t->disk, offset >> GRUB_DISK_SECTOR_BITS,
+			  offset & (GRUB_DISK_SECTOR_SIZE - 1), len, t->buffer))
+	return -1;
+      return len;
+    }
+
+  grub_file_seek (t->file, offset);
+  return grub_file_read (t->file, t->buffer, len);
+}
+
+static grub_err_t
+testspeed_pass (struct testspeed *t, struct testspeed_result *r)
+{
+  grub_uint64_t offset = 0, nblocks, random = RANDOM_SEED, start, hash_start;
+  grub_ssize_t size;
+
+  grub_memset (r, 0, sizeof (*r));
+  nblocks = grub_divmod64 (t->size, t->block_size, 0);
+  if (nblocks == 0)
+    nblocks = 1;
+
+  if (t->hash)
+    t->hash->init (t->hash_context);
+
+  start = testspeed_now_us ();
+  while (r->reads < t->count)
+    {
+      grub_size_t len = t->block_size;
+
+      if (t->mode == MODE_RANDOM)
+	offset = grub_divmod64 (random_next (&random) >> 1, nblocks, 0)
+		 * t->block_size;
+      if (offset >= t->size)
+	break;
+      if (len > t->size - offset)
+	len = t->size - offset;
+
+      size = testspeed_read (t, offset, len);
+      if (size < 0)
+	return grub_errno;
+      if (size == 0)
+	break;
+      r->bytes += size;
+      r->reads++;
+      offset += size;
+
+      if (t->hash)
+	{
+	  hash_start = testspeed_now_us ();
+	  t->hash->write (t->hash_context, t->buffer, size);
+	  r->hash_us += testspeed_now_us () - hash_start;
+	}
+    }
+
+  if (t->hash)
+    t->hash->final (t->hash_context);
+  r->us = testspeed_now_us () - start;
+
+  return GRUB_ERR_NONE;
+}
+
+/* In KiB/s, BYTES having taken US microseconds.  */
+static grub_uint64_t
+testspeed_speed (grub_uint64_t bytes, grub_uint64_t us)
+{
+  if (us == 0)
+    return 0;
+  return grub_divmod64 (bytes * 1000000ULL / 1024, us, 0);
+}
+
+static void
+testspeed_print (struct testspeed *t, unsigned pass, unsigned long passes,
+		 const struct testspeed_result *r)
+{
+  grub_uint64_t whole, fraction;
+
+  whole = grub_divmod64 (r->us, 1000000, &fraction);
+  if (passes > 1)
+    grub_printf_ (N_("Pass %u:\n"), pass);
+  grub_printf_ (N_("Read: %s in %llu operations\n"),
+		grub_get_human_size (r->bytes, GRUB_HUMAN_SIZE_NORMAL),
+		(unsigned long long) r->reads);
+  grub_printf_ (N_("Elapsed time: %d.%06d s \n"),
+		(unsigned) whole, (unsigned) fraction);
+  if (r->us)
+    grub_printf_ (N_("Speed: %s \n"),
+		  grub_get_human_size (grub_divmod64 (r->bytes * 100ULL * 1000000ULL,
+						      r->us, 0),
+				       GRUB_HUMAN_SIZE_SPEED));
+  if (t->hash && r->hash_us)
+    grub_printf_ (N_("Hash speed: %s \n"),
+		  grub_get_human_size (grub_divmod64 (r->bytes * 100ULL * 1000000ULL,
+						      r->hash_us, 0),
+				       GRUB_HUMAN_SIZE_SPEED));
+}
+
+static void
+testspeed_print_machine (struct testspeed *t, const char *target,
+			 unsigned pass, int cold,
+			 const struct testspeed_result *r)
+{
+  grub_printf ("testspeed mode=%s source=%s target=%s block=%" PRIuGRUB_SIZE
+	       " pass=%u cold=%d bytes=%" PRIuGRUB_UINT64_T
+	       " reads=%" PRIuGRUB_UINT64_T " time_us=%" PRIuGRUB_UINT64_T
+	       " speed_kib_s=%" PRIuGRUB_UINT64_T,
+	       mode_names[t->mode], t->disk ? "disk" : "file", target,
+	       t->block_size, pass, cold, r->bytes, r->reads, r->us,
+	       testspeed_speed (r->bytes, r->us));
+  if (t->hash)
+    grub_printf (" hash=%s hash_us=%" PRIuGRUB_UINT64_T
+		 " hash_speed_kib_s=%" PRIuGRUB_UINT64_T,
+		 t->hash->name, r->hash_us,
+		 testspeed_speed (r->bytes, r->hash_us));
+  grub_printf ("\n");
+}
+
 static grub_err_t
 grub_cmd_testspeed (grub_extcmd_context_t ctxt, int argc, char **args)
 {
   struct grub_arg_list *state = ctxt->state;
-  grub_uint64_t start;
-  grub_uint64_t end;
-  grub_ssize_t block_size;
-  grub_disk_addr_t total_size;
-  char *buffer;
-  grub_file_t file;
-  grub_uint64_t whole, fraction;
+  struct testspeed t;
+  struct testspeed_result result;
+  unsigned long passes = 1, pass;
+  const char *target;
+  grub_err_t err = GRUB_ERR_NONE;
 
   if (argc == 0)
-    return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("filename expected"));
+    return grub_error (GRUB_ERR_BAD_ARGUMENT,
+		       state[TESTSPEED_DISK].set ? N_("one argument expected")
+		       : N_("filename expected"));
 
-  block_size = (state[0].set) ?
-    grub_strtoul (state[0].arg, 0, 0) : DEFAULT_BLOCK_SIZE;
+  grub_memset (&t, 0, sizeof (t));
+  t.mode = MODE_SEQ;
+  if (state[TESTSPEED_MODE].set)
+    {
+      for (t.mode = 0; t.mode < ARRAY_SIZE (mode_names); t.mode++)
+	if (grub_strcmp (state[TESTSPEED_MODE].arg, mode_names[t.mode]) == 0)
+	  break;
+      if (t.mode == ARRAY_SIZE (mode_names))
+	return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("invalid mode `%s'"),
+			   state[TESTSPEED_MODE].arg);
+    }
 
-  if (block_size <= 0)
-    return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("invalid block size"));
+  t.block_size = DEFAULT_BLOCK_SIZE;
+  if (state[TESTSPEED_SIZE].set)
+    {
+      long block_size = grub_strtol (state[TESTSPEED_SIZE].arg, 0, 0);
 
-  buffer = grub_malloc (block_size);
-  if (buffer == NULL)
-    return grub_errno;
+      if (block_size <= 0 || block_size > GRUB_INT_MAX)
+	return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("invalid block size"));
+      t.block_size = block_size;
+    }
+
+  if (state[TESTSPEED_PASSES].set)
+    {
+      passes = grub_strtoul (state[TESTSPEED_PASSES].arg, 0, 0);
+      if (grub_errno || passes == 0)
+	return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("invalid number of passes"));
+    }
+
+  if (t.mode == MODE_HASH)
+    {
+      const char *name = state[TESTSPEED_HASH].set
+			 ? state[TESTSPEED_HASH].arg : "sha256";
+
+      t.hash = grub_crypto_lookup_md_by_name (name);
+      if (!t.hash)
+	return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("unknown hash `%s'"), name);
+      t.hash_context = grub_malloc (t.hash->contextsize);
+      if (!t.hash_context)
+	return grub_errno;
+    }
 
-  file = grub_file_open (args[0], GRUB_FILE_TYPE_TESTLOAD);
-  if (file == NULL)
+  t.buffer = grub_malloc (t.block_size);
+  if (t.buffer == NULL)
     goto quit;
 
-  total_size = 0;
-  start = grub_get_time_ms ();
-  while (1)
+  target = args[0];
+  if (state[TESTSPEED_DISK].set)
     {
-      grub_ssize_t size = grub_file_read (file, buffer, block_size);
-      if (size <= 0)
-	break;
-      total_size += size;
+      grub_size_t len = grub_strlen (target);
+      char *name;
+
+      if (target[0] == '(' && len > 1 && target[len - 1] == ')')
+	name = grub_strndup (target + 1, len - 2);
+      else
+	name = grub_strdup (target);
+      if (!name)
+	goto quit;
+      t.disk = grub_disk_open (name);
+      grub_free (name);
+      if (!t.disk)
+	goto quit;
+      t.size = grub_disk_native_sectors (t.disk);
+      if (t.size == GRUB_DISK_SIZE_UNKNOWN)
+	t.size = DEFAULT_DISK_BYTES;
+      else
+	t.size = grub_disk_from_native_sector (t.disk, t.size)
+		 << GRUB_DISK_SECTOR_BITS;
+    }
+  else
+    {
+      t.file = grub_file_open (target, GRUB_FILE_TYPE_TESTLOAD
+			       | (state[TESTSPEED_NO_DECOMPRESS].set
+				  ? GRUB_FILE_TYPE_NO_DECOMPRESS
+				  : GRUB_FILE_TYPE_NONE));
+      if (!t.file)
+	goto quit;
+      t.size = t.file->size;
     }
-  end = grub_get_time_ms ();
-  grub_file_close (file);
 
-  grub_printf_ (N_("File size: %s\n"),
-		grub_get_human_size (total_size, GRUB_HUMAN_SIZE_NORMAL));
-  whole = grub_divmod64 (end - start, 1000, &fraction);
-  grub_printf_ (N_("Elapsed time: %d.%03d s \n"),
-		(unsigned) whole,
-		(unsigned) fraction);
+  if (state[TESTSPEED_COUNT].set)
+    {
+      t.count = grub_strtoull (state[TESTSPEED_COUNT].arg, 0, 0);
+      if (grub_errno || t.count == 0)
+	{
+	  grub_error (GRUB_ERR_BAD_ARGUMENT, N_("invalid count"));
+	  goto quit;
+	}
+    }
+  else
+    {
+      grub_uint64_t bytes = t.size;
 
-  if (end != start)
+      if (t.disk && bytes > DEFAULT_DISK_BYTES)
+	bytes = DEFAULT_DISK_BYTES;
+      t.count = grub_divmod64 (bytes + t.block_size - 1, t.block_size, 0);
+    }
+
+  for (pass = 1; pass <= passes; pass++)
     {
-      grub_uint64_t speed =
-	grub_divmod64 (total_size * 100ULL * 1000ULL, end - start, 0);
+      if (state[TESTSPEED_COLD].set)
+	grub_disk_cache_invalidate_all ();
+
+      err = testspeed_pass (&t, &result);
+      if (err)
+	break;
 
-      grub_printf_ (N_("Speed: %s \n"),
-		    grub_get_human_size (speed,
-					 GRUB_HUMAN_SIZE_SPEED));
+      if (state[TESTSPEED_MACHINE].set)
+	testspeed_print_machine (&t, target, pass,
+				 state[TESTSPEED_COLD].set, &result);
+      else
+	testspeed_print (&t, pass, passes, &result);
     }
 
  quit:
-  grub_free (buffer);
+  if (t.file)
+    grub_file_close (t.file);
+  if (t.disk)
+    grub_disk_close (t.disk);
+  grub_free (t.buffer);
+  grub_free (t.hash_context);
 
-  return grub_errno;
+  return err ? err : grub_errno;
 }
 
 static grub_extcmd_t cmd;
 
 GRUB_MOD_INIT(testspeed)
 {
-  cmd = grub_register_extcmd ("testspeed", grub_cmd_testspeed, 0, N_("[-s SIZE] FILENAME"),
-			      N_("Test file read speed."),
+  cmd = grub_register_extcmd ("testspeed", grub_cmd_testspeed, 0,
+			      N_("[-m seq|random|hash] [-s SIZE] [-c COUNT] "
+				 "[-p PASSES] [-C] [-n] [-H HASH] [-M] "
+				 "[-d DISK | FILENAME]"),
+			      N_("Test file, disk and hash speed."),
 			      options);
 }
 
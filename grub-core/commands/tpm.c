@@ -26,9 +26,75 @@
 #include <grub/term.h>
 #include <grub/verify.h>
 #include <grub/dl.h>
+#include <grub/loader.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
+/* Flush the deferred measurements once their strings take this much.  */
+#define GRUB_TPM_PENDING_MAX	(64 * 1024)
+
+/*
+ * A string measurement deferred with tpm_defer_strings.  The measured
+ * string is the tail of the description, starting at OFFSET.
+ */
+struct grub_tpm_pending
+{
+  struct grub_tpm_pending *next;
+  grub_size_t offset;
+  char description[];
+};
+
+static struct grub_tpm_pending *pending;
+static struct grub_tpm_pending **pending_tail = &pending;
+static grub_size_t pending_size;
+static struct grub_preboot *preboot_hnd;
+
+static grub_err_t
+grub_tpm_measure_string (char *description, grub_size_t offset)
+{
+  char *str = description + offset;
+  grub_err_t status;
+
+  status = grub_tpm_measure ((unsigned char *) str, grub_strlen (str),
+			     GRUB_STRING_PCR, description);
+  if (status == GRUB_ERR_NONE)
+    return GRUB_ERR_NONE;
+
+  grub_dprintf ("tpm", "Measuring string %s failed: %d\n", str, status);
+  return grub_is_tpm_fail_fatal () ? status : GRUB_ERR_NONE;
+}
+
+/*
+ * Measure the deferred strings in the order they were queued, so that the
+ * PCR ends up with the same value as if each had been measured at once.
+ */
+static grub_err_t
+grub_tpm_flush (void)
+{
+  struct grub_tpm_pending *p;
+  grub_err_t err = GRUB_ERR_NONE, status;
+
+  while (pending)
+    {
+      p = pending;
+      pending = p->next;
+      status = grub_tpm_measure_string (p->description, p->offset);
+      if (err == GRUB_ERR_NONE)
+	err = status;
+      grub_free (p);
+    }
+  pending_tail = &pending;
+  pending_size = 0;
+
+  return err;
+}
+
+static grub_err_t
+grub_tpm_preboot (int noret __attribute__ ((unused)))
+{
+  return grub_tpm_flush ();
+}
+
 static grub_err_t
 grub_tpm_verify_init (grub_file_t io,
 		      enum grub_file_type type __attribute__ ((unused)),
@@ -55,7 +121,8 @@ static grub_err_t
 grub_tpm_verify_string (char *str, enum grub_verify_string_type type)
 {
   const char *prefix = NULL;
-  char *description;
+  struct grub_tpm_pending *p;
+  grub_size_t len;
   grub_err_t status;
 
   switch (type)
@@ -70,21 +137,35 @@ grub_tpm_verify_string (char *str, enum grub_verify_string_type type)
       prefix = "grub_cmd: ";
       break;
     }
-  description = grub_malloc (grub_strlen (str) + grub_strlen (prefix) + 1);
-  if (!description)
+  len = grub_strlen (prefix) + grub_strlen (str) + 1;
+  p = grub_malloc (sizeof (*p) + len);
+  if (!p)
     return grub_errno;
-  grub_memcpy (description, prefix, grub_strlen (prefix));
-  grub_memcpy (description + grub_strlen (prefix), str,
-	       grub_strlen (str) + 1);
-  status =
-    grub_tpm_measure ((unsigned char *) str, grub_strlen (str),
-		      GRUB_STRING_PCR, description);
-  grub_free (description);
+  p->next = NULL;
+  p->offset = grub_strlen (prefix);
+  grub_memcpy (p->description, prefix, p->offset);
+  grub_memcpy (p->description + p->offset, str, grub_strlen (str) + 1);
+
+  /*
+   * Talking to a slow TPM for every command adds up, so the strings may be
+   * queued and measured in one go before boot instead.
+   */
+  if (grub_env_get_bool ("tpm_defer_strings", false))
+    {
+      *pending_tail = p;
+      pending_tail = &p->next;
+      pending_size += len;
+      return pending_size >= GRUB_TPM_PENDING_MAX ? grub_tpm_flush ()
+						   : GRUB_ERR_NONE;
+    }
+
+  /* Keep the order of the PCR extensions.  */
+  status = grub_tpm_flush ();
   if (status == GRUB_ERR_NONE)
-    return GRUB_ERR_NONE;
+    status = grub_tpm_measure_string (p->description, p->offset);
+  grub_free (p);
 
-  grub_dprintf ("tpm", "Measuring string %s failed: %d\n", str, status);
-  return grub_is_tpm_fail_fatal () ? status : GRUB_ERR_NONE;
+  return status;
 }
 
 struct grub_file_verifier grub_tpm_verifier = {
@@ -105,6 +186,9 @@ GRUB_MOD_INIT (tpm)
   if (!grub_tpm_present())
     return;
   grub_verifier_register (&grub_tpm_verifier);
+  preboot_hnd =
+    grub_loader_register_preboot_hook (grub_tpm_preboot, NULL,
+				       GRUB_LOADER_PREBOOT_HOOK_PRIO_NORMAL);
 }
 
 GRUB_MOD_FINI (tpm)
@@ -112,4 +196,7 @@ GRUB_MOD_FINI (tpm)
   if (!grub_tpm_present())
     return;
   grub_verifier_unregister (&grub_tpm_verifier);
+  grub_tpm_flush ();
+  if (preboot_hnd)
+    grub_loader_unregister_preboot_hook (preboot_hnd);
 }
@@ -34,8 +34,20 @@ static int make_regex (const char *regex_start, const char *regex_end,
 		       regex_t *regexp);
 static void split_path (const char *path, const char **suffix_end, const char **regex_end);
 static char ** match_devices (const regex_t *regexp, int noparts);
-static char ** match_files (const char *prefix, const char *suffix_start,
-			    const char *suffix_end, const regex_t *regexp);
+
+/* The device of the last lookup.  It is kept open for the whole expansion,
+   so the filesystem is probed once and its caches stay warm from one path
+   component to the next.  */
+struct expand_dev
+{
+  char *name;
+  grub_device_t dev;
+  grub_fs_t fs;
+};
+
+static char ** match_files (struct expand_dev *ed, const char *prefix,
+			    const char *suffix_start, const char *suffix_end,
+			    const regex_t *regexp);
 
 static grub_err_t wildcard_expand (const char *s, char ***strs);
 
@@ -302,6 +314,49 @@ match_devices (const regex_t *regexp, int noparts)
   return 0;
 }
 
+static void
+expand_dev_put (struct expand_dev *ed)
+{
+  if (ed->dev)
+    grub_device_close (ed->dev);
+  grub_free (ed->name);
+  ed->name = 0;
+  ed->dev = 0;
+  ed->fs = 0;
+}
+
+/* Return the filesystem PATH is on and set *FSPATH to the path within it.  */
+static grub_fs_t
+expand_dev_get (struct expand_dev *ed, const char *path, const char **fspath)
+{
+  char *name;
+
+  name = grub_file_get_device_name (path);
+  if (grub_errno)
+    return 0;
+
+  if (ed->dev && (name == ed->name
+		  || (name && ed->name && grub_strcmp (name, ed->name) == 0)))
+    grub_free (name);
+  else
+    {
+      expand_dev_put (ed);
+      ed->dev = grub_device_open (name);
+      if (! ed->dev)
+	{
+	  grub_free (name);
+	  return 0;
+	}
+      ed->name = name;
+      ed->fs = grub_fs_probe (ed->dev);
+    }
+
+  if (path[0] == '(')
+    path = grub_strchr (path, ')') + 1;
+  *fspath = path;
+  return ed->fs;
+}
+
 /* Context for match_files.  */
 struct match_files_ctx
 {
@@ -355,8 +410,8 @@ match_files_iter (const char *name,
 }
 
 static char **
-match_files (const char *prefix, const char *suffix, const char *end,
-	     const regex_t *regexp)
+match_files (struct expand_dev *ed, const char *prefix, const char *suffix,
+	     const char *end, const regex_t *regexp)
 {
   struct match_files_ctx ctx = {
     .regexp = regexp,
@@ -365,43 +420,22 @@ match_files (const char *prefix, const char *suffix, const char *end,
   };
   int i;
   const char *path;
-  char *device_name;
   grub_fs_t fs;
-  grub_device_t dev;
 
-  dev = 0;
-  device_name = 0;
   grub_error_push ();
 
   ctx.dir = make_dir (prefix, suffix, end);
   if (! ctx.dir)
     goto fail;
 
-  device_name = grub_file_get_device_name (ctx.dir);
-  dev = grub_device_open (device_name);
-  if (! dev)
-    goto fail;
-
-  fs = grub_fs_probe (dev);
+  fs = expand_dev_get (ed, ctx.dir, &path);
   if (! fs)
     goto fail;
 
-  if (ctx.dir[0] == '(')
-    {
-      path = grub_strchr (ctx.dir, ')');
-      if (!path)
-	goto fail;
-      path++;
-    }
-  else
-    path = ctx.dir;
-
-  if (fs->fs_dir (dev, path, match_files_iter, &ctx))
+  if (fs->fs_dir (ed->dev, path, match_files_iter, &ctx))
     goto fail;
 
   grub_free (ctx.dir);
-  grub_device_close (dev);
-  grub_free (device_name);
   grub_error_pop ();
   return ctx.files;
 
@@ -414,78 +448,58 @@ match_files (const char *prefix, const char *suffix, const char *end,
 
   grub_free (ctx.files);
 
-  if (dev)
-    grub_device_close (dev);
-
-  grub_free (device_name);
-
   grub_error_pop ();
   return 0;
 }
 
-/* Context for check_file.  */
-struct check_file_ctx
-{
-  const char *basename;
-  int found;
-};
-
 /* Helper for check_file.  */
 static int
-check_file_iter (const char *name, const struct grub_dirhook_info *info,
-		 void *data)
+check_file_iter (const char *name __attribute__ ((unused)),
+		 const struct grub_dirhook_info *info __attribute__ ((unused)),
+		 void *data __attribute__ ((unused)))
 {
-  struct check_file_ctx *ctx = data;
-
-  if (ctx->basename[0] == 0
-      || (info->case_insensitive ? grub_strcasecmp (name, ctx->basename) == 0
-	  : grub_strcmp (name, ctx->basename) == 0))
-    {
-      ctx->found = 1;
-      return 1;
-    }
-
-  return 0;
+  return 1;
 }
 
+/* Return whether PATH exists.  It is looked up directly rather than found
+   in a listing of its parent, so the filesystem can use its index and its
+   lookup cache.  */
 static int
-check_file (const char *dir, const char *basename)
+check_file (struct expand_dev *ed, const char *path)
 {
-  struct check_file_ctx ctx = {
-    .basename = basename,
-    .found = 0
-  };
   grub_fs_t fs;
-  grub_device_t dev;
-  const char *device_name, *path;
-
-  device_name = grub_file_get_device_name (dir);
-  dev = grub_device_open (device_name);
-  if (! dev)
-    goto fail;
+  struct grub_file file;
+  const char *fspath;
+  int found = 0;
 
-  fs = grub_fs_probe (dev);
+  fs = expand_dev_get (ed, path, &fspath);
   if (! fs)
-    goto fail;
+    goto out;
 
-  if (dir[0] == '(')
+  /* A directory, listed no further than its first entry.  */
+  if (fs->fs_dir (ed->dev, fspath[0] ? fspath : "/",
+		  check_file_iter, 0) == GRUB_ERR_NONE)
     {
-      path = grub_strchr (dir, ')');
-      if (!path)
-	goto fail;
-      path++;
+      found = 1;
+      goto out;
+    }
+  grub_errno = GRUB_ERR_NONE;
+
+  /* A file, opened by the filesystem alone so that no verifier reads or
+     measures it.  */
+  grub_memset (&file, 0, sizeof (file));
+  file.device = ed->dev;
+  file.fs = fs;
+  if (fs->fs_open (&file, fspath) == GRUB_ERR_NONE)
+    {
+      found = 1;
+      if (fs->fs_close)
+	fs->fs_close (&file);
     }
-  else
-    path = dir;
-
-  fs->fs_dir (dev, path[0] ? path : "/", check_file_iter, &ctx);
-  if (grub_errno == 0 && basename[0] == 0)
-    ctx.found = 1;
-
- fail:
-  grub_errno = 0;
 
-  return ctx.found;
+ out:
+  grub_errno = GRUB_ERR_NONE;
+  return found;
 }
 
 static void
@@ -517,6 +531,7 @@ wildcard_expand (const char *s, char ***strs)
   const char *noregexop;
   char **paths = 0;
   int had_regexp = 0;
+  struct expand_dev ed = { 0 };
 
   unsigned i;
   regex_t regexp;
@@ -570,16 +585,13 @@ wildcard_expand (const char *s, char ***strs)
 		      paths[j++] = n;
 		      continue;
 		    }
-		  *p = 0;
-		  if (!check_file (n, p + 1))
+		  if (!check_file (&ed, n))
 		    {
-		      grub_dprintf ("expand", "file <%s> in <%s> not found\n",
-				    p + 1, n);
+		      grub_dprintf ("expand", "file <%s> not found\n", n);
 		      grub_free (o);
 		      grub_free (n);
-			      continue;
+		      continue;
 		    }
-		  *p = '/';
 		  grub_free (o);
 		  paths[j++] = n;
 		}
@@ -607,7 +619,7 @@ wildcard_expand (const char *s, char ***strs)
 	    paths = match_devices (&regexp, *start != '(');
 
 	  else  /* device part explicit wo regexop */
-	    paths = match_files ("", start, noregexop, &regexp);
+	    paths = match_files (&ed, "", start, noregexop, &regexp);
 	}
       else
 	{
@@ -617,7 +629,7 @@ wildcard_expand (const char *s, char ***strs)
 	    {
 	      char **p;
 
-	      p = match_files (paths[i], start, noregexop, &regexp);
+	      p = match_files (&ed, paths[i], start, noregexop, &regexp);
 	      grub_free (paths[i]);
 	      if (! p)
 		continue;
@@ -639,11 +651,14 @@ wildcard_expand (const char *s, char ***strs)
 
  done:
 
+  expand_dev_put (&ed);
   *strs = paths;
   return 0;
 
  fail:
 
+  expand_dev_put (&ed);
+
   for (i = 0; paths && paths[i]; i++)
     grub_free (paths[i]);
   grub_free (paths);
@@ -31,37 +31,34 @@ gcry_err_code_t AF_merge (const gcry_md_spec_t * hash, grub_uint8_t * src,
 			  grub_uint8_t * dst, grub_size_t blocksize,
 			  grub_size_t blocknumbers);
 
+/* Hash every digest-sized block of SRC XOR IN, or of SRC alone if IN is
+   NULL, prefixed with its index into DST, reusing CTX for all of them.  */
 static void
-diffuse (const gcry_md_spec_t * hash, grub_uint8_t * src,
-	 grub_uint8_t * dst, grub_size_t size)
+diffuse (const gcry_md_spec_t * hash, void *ctx, const grub_uint8_t * in,
+	 grub_uint8_t * src, grub_uint8_t * dst, grub_size_t size)
 {
-  grub_size_t i;
+  grub_size_t i, len;
   grub_uint32_t IV;		/* host byte order independend hash IV */
-
-  grub_size_t fullblocks = size / hash->mdlen;
-  int padding = size % hash->mdlen;
-  grub_uint8_t final[GRUB_CRYPTO_MAX_MDLEN];
-  grub_uint8_t temp[sizeof (IV) + GRUB_CRYPTO_MAX_MDLEN];
+  grub_uint8_t block[GRUB_CRYPTO_MAX_MDLEN];
 
   /* hash block the whole data set with different IVs to produce
    * more than just a single data block
    */
-  for (i = 0; i < fullblocks; i++)
+  for (i = 0; i * hash->mdlen < size; i++)
     {
-      IV = grub_cpu_to_be32 (i);
-      grub_memcpy (temp, &IV, sizeof (IV));
-      grub_memcpy (temp + sizeof (IV), src + hash->mdlen * i, hash->mdlen);
-      grub_crypto_hash (hash, dst + hash->mdlen * i, temp,
-			sizeof (IV) + hash->mdlen);
-    }
+      len = grub_min (size - i * hash->mdlen, hash->mdlen);
+      if (in)
+	grub_crypto_xor (block, src + hash->mdlen * i, in + hash->mdlen * i,
+			 len);
+      else
+	grub_memcpy (block, src + hash->mdlen * i, len);
 
-  if (padding)
-    {
       IV = grub_cpu_to_be32 (i);
-      grub_memcpy (temp, &IV, sizeof (IV));
-      grub_memcpy (temp + sizeof (IV), src + hash->mdlen * i, padding);
-      grub_crypto_hash (hash, final, temp, sizeof (IV) + padding);
-      grub_memcpy (dst + hash->mdlen * i, final, padding);
+      hash->init (ctx);
+      hash->write (ctx, &IV, sizeof (IV));
+      hash->write (ctx, block, len);
+      hash->final (ctx);
+      grub_memcpy (dst + hash->mdlen * i, hash->read (ctx), len);
     }
 }
 
@@ -74,6 +71,7 @@ AF_merge (const gcry_md_spec_t * hash, grub_uint8_t * src, grub_uint8_t * dst,
 {
   grub_size_t i;
   grub_uint8_t *bufblock;
+  void *ctx;
 
   if (hash->mdlen > GRUB_CRYPTO_MAX_MDLEN || hash->mdlen == 0)
     return GPG_ERR_INV_ARG;
@@ -82,14 +80,26 @@ AF_merge (const gcry_md_spec_t * hash, grub_uint8_t * src, grub_uint8_t * dst,
   if (bufblock == NULL)
     return GPG_ERR_OUT_OF_MEMORY;
 
-  grub_memset (bufblock, 0, blocksize);
-  for (i = 0; i < blocknumbers - 1; i++)
+  ctx = grub_malloc (hash->contextsize);
+  if (ctx == NULL)
+    {
+      grub_free (bufblock);
+      return GPG_ERR_OUT_OF_MEMORY;
+    }
+
+  /* The first stripe is XORed with zeroes.  */
+  i = 0;
+  if (blocknumbers > 1)
     {
-      grub_crypto_xor (bufblock, src + (blocksize * i), bufblock, blocksize);
-      diffuse (hash, bufblock, bufblock, blocksize);
+      diffuse (hash, ctx, NULL, src, bufblock, blocksize);
+      i++;
     }
+  for (; i < blocknumbers - 1; i++)
+    diffuse (hash, ctx, src + (blocksize * i), bufblock, bufblock, blocksize);
   grub_crypto_xor (dst, src + (i * blocksize), bufblock, blocksize);
 
+  grub_memset (ctx, 0, hash->contextsize);
+  grub_free (ctx);
   grub_free (bufblock);
   return GPG_ERR_NO_ERROR;
 }
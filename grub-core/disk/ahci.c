@@ -52,6 +52,17 @@ struct grub_ahci_cmd_table
   struct grub_ahci_prdt_entry prdt[1];
 };
 
+/* Command table for queued commands.  Tables of all the slots are kept
+   in one chunk and must each be 128-byte aligned.  */
+struct grub_ahci_ncq_table
+{
+  grub_uint8_t cfis[0x40];
+  grub_uint8_t command[0x10];
+  grub_uint8_t reserved[0x30];
+  struct grub_ahci_prdt_entry prdt[1];
+  grub_uint8_t pad[0x70];
+};
+
 struct grub_ahci_hba_port
 {
   grub_uint64_t command_list_base;
@@ -115,9 +126,13 @@ struct grub_ahci_received_fis
 
 enum
   {
-    GRUB_AHCI_HBA_CAP_NPORTS_MASK = 0x1f
+    GRUB_AHCI_HBA_CAP_NPORTS_MASK = 0x1f,
+    GRUB_AHCI_HBA_CAP_NCS_MASK = 0x1f00,
+    GRUB_AHCI_HBA_CAP_SNCQ = 0x40000000
   };
 
+#define GRUB_AHCI_HBA_CAP_NCS_SHIFT 8
+
 enum
   {
     GRUB_AHCI_HBA_GLOBAL_CONTROL_RESET = 0x00000001,
@@ -148,6 +163,11 @@ struct grub_ahci_device
   struct grub_pci_dma_chunk *rfis;
   int present;
   int atapi;
+  /* Command slots used for queued commands, 0 if NCQ is not used.  */
+  unsigned ncq_slots;
+  struct grub_pci_dma_chunk *ncq_table_chunk;
+  volatile struct grub_ahci_ncq_table *ncq_table;
+  struct grub_pci_dma_chunk *ncq_buffer;
 };
 
 static grub_err_t
@@ -176,6 +196,11 @@ enum
 
 #define GRUB_AHCI_PRDT_MAX_CHUNK_LENGTH 0x200000
 
+/* Number of queued commands in flight and the largest transfer of each
+   of them.  */
+#define GRUB_AHCI_NCQ_SLOTS 8
+#define GRUB_AHCI_NCQ_MAX_TRANSFER 0x40000
+
 static struct grub_ahci_device *grub_ahci_devices;
 static int numdevs;
 
@@ -363,6 +388,13 @@ grub_ahci_pciinit (grub_pci_device_t dev,
       adevs[i]->port = i;
       adevs[i]->present = 1;
       adevs[i]->num = numdevs++;
+      if (hba->cap & GRUB_AHCI_HBA_CAP_SNCQ)
+	{
+	  adevs[i]->ncq_slots = ((hba->cap & GRUB_AHCI_HBA_CAP_NCS_MASK)
+				 >> GRUB_AHCI_HBA_CAP_NCS_SHIFT) + 1;
+	  if (adevs[i]->ncq_slots > GRUB_AHCI_NCQ_SLOTS)
+	    adevs[i]->ncq_slots = GRUB_AHCI_NCQ_SLOTS;
+	}
     }
 
   for (i = 0; i < nports; i++)
@@ -695,9 +727,15 @@ grub_ahci_fini_hw (int noreturn __attribute__ ((unused)))
       grub_dma_free (dev->command_list_chunk);
       grub_dma_free (dev->command_table_chunk);
       grub_dma_free (dev->rfis);
+      if (dev->ncq_table_chunk)
+	grub_dma_free (dev->ncq_table_chunk);
+      if (dev->ncq_buffer)
+	grub_dma_free (dev->ncq_buffer);
       dev->command_list_chunk = NULL;
       dev->command_table_chunk = NULL;
       dev->rfis = NULL;
+      dev->ncq_table_chunk = NULL;
+      dev->ncq_buffer = NULL;
     }
   return GRUB_ERR_NONE;
 }
@@ -709,7 +747,8 @@ reinit_port (struct grub_ahci_device *dev)
   struct grub_pci_dma_chunk *command_table;
   grub_uint64_t endtime;
 
-  command_list = grub_memalign_dma32 (1024, sizeof (struct grub_ahci_cmd_head));
+  command_list = grub_memalign_dma32 (1024,
+				      sizeof (struct grub_ahci_cmd_head) * 32);
   if (!command_list)
     return 1;
 
@@ -1102,6 +1141,154 @@ grub_ahci_readwrite (grub_ata_t disk,
   return grub_ahci_readwrite_real (disk->data, parms, spinup, 0);
 }
 
+static grub_err_t
+grub_ahci_ncq_init (struct grub_ahci_device *dev)
+{
+  if (dev->ncq_buffer)
+    return GRUB_ERR_NONE;
+
+  dev->ncq_table_chunk = grub_memalign_dma32 (1024,
+					      sizeof (struct grub_ahci_ncq_table)
+					      * GRUB_AHCI_NCQ_SLOTS);
+  dev->ncq_buffer = grub_memalign_dma32 (4096, GRUB_AHCI_NCQ_SLOTS
+					 * GRUB_AHCI_NCQ_MAX_TRANSFER);
+  if (!dev->ncq_table_chunk || !dev->ncq_buffer)
+    {
+      if (dev->ncq_table_chunk)
+	grub_dma_free (dev->ncq_table_chunk);
+      if (dev->ncq_buffer)
+	grub_dma_free (dev->ncq_buffer);
+      dev->ncq_table_chunk = NULL;
+      dev->ncq_buffer = NULL;
+      return grub_error (GRUB_ERR_OUT_OF_MEMORY, N_("out of memory"));
+    }
+  dev->ncq_table = grub_dma_get_virt (dev->ncq_table_chunk);
+  return GRUB_ERR_NONE;
+}
+
+/* Cut the request into READ/WRITE FPDMA QUEUED commands, issue as many
+   of them as there are slots at once and wait for all of them.  */
+static grub_err_t
+grub_ahci_readwrite_queued (grub_ata_t disk, grub_disk_addr_t sector,
+			    grub_size_t size, char *buf, int is_write)
+{
+  struct grub_ahci_device *dev = disk->data;
+  volatile struct grub_ahci_hba_port *port;
+  grub_size_t per_cmd = GRUB_AHCI_NCQ_MAX_TRANSFER >> disk->log_sector_size;
+  unsigned nslots = dev->ncq_slots;
+  grub_uint8_t *bounce;
+  grub_uint32_t bounce_phys;
+  grub_err_t err;
+
+  if (nslots > disk->queue_depth)
+    nslots = disk->queue_depth;
+  if (!nslots)
+    return grub_error (GRUB_ERR_BUG, "NCQ is not available");
+
+  err = grub_ahci_ncq_init (dev);
+  if (err)
+    return err;
+
+  grub_ahci_reset_port (dev, 0);
+
+  port = &dev->hba->ports[dev->port];
+  bounce = (grub_uint8_t *) grub_dma_get_virt (dev->ncq_buffer);
+  bounce_phys = grub_dma_get_phys (dev->ncq_buffer);
+
+  while (size)
+    {
+      grub_size_t batch = 0;
+      grub_uint32_t mask = 0;
+      grub_uint64_t endtime;
+      unsigned tag;
+
+      if (is_write)
+	{
+	  batch = size;
+	  if (batch > nslots * per_cmd)
+	    batch = nslots * per_cmd;
+	  grub_memcpy (bounce, buf, batch << disk->log_sector_size);
+	  batch = 0;
+	}
+
+      for (tag = 0; tag < nslots && batch < size; tag++)
+	{
+	  volatile struct grub_ahci_cmd_head *head = &dev->command_list[tag];
+	  volatile struct grub_ahci_ncq_table *table = &dev->ncq_table[tag];
+	  grub_disk_addr_t lba = sector + batch;
+	  grub_size_t count = size - batch;
+
+	  if (count > per_cmd)
+	    count = per_cmd;
+
+	  head->config = (5 << GRUB_AHCI_CONFIG_CFIS_LENGTH_SHIFT)
+	    | (1 << GRUB_AHCI_CONFIG_PRDT_LENGTH_SHIFT)
+	    | (is_write ? GRUB_AHCI_CONFIG_WRITE : GRUB_AHCI_CONFIG_READ);
+	  head->transferred = 0;
+	  head->command_table_base = grub_dma_virt2phys (table,
+							 dev->ncq_table_chunk);
+	  grub_memset ((char *) head->unused, 0, sizeof (head->unused));
+
+	  grub_memset ((char *) table, 0, sizeof (*table));
+	  table->cfis[0] = GRUB_AHCI_FIS_REG_H2D;
+	  table->cfis[1] = 0x80;
+	  table->cfis[2] = is_write ? GRUB_ATA_CMD_WRITE_FPDMA_QUEUED
+	    : GRUB_ATA_CMD_READ_FPDMA_QUEUED;
+	  /* The sector count goes into the features registers and the tag
+	     into the sector count register.  */
+	  table->cfis[3] = count & 0xff;
+	  table->cfis[4] = lba & 0xff;
+	  table->cfis[5] = (lba >> 8) & 0xff;
+	  table->cfis[6] = (lba >> 16) & 0xff;
+	  table->cfis[7] = 0x40;
+	  table->cfis[8] = (lba >> 24) & 0xff;
+	  table->cfis[9] = (lba >> 32) & 0xff;
+	  table->cfis[10] = (lba >> 40) & 0xff;
+	  table->cfis[11] = (count >> 8) & 0xff;
+	  table->cfis[12] = tag << 3;
+
+	  table->prdt[0].data_base = bounce_phys
+	    + (batch << disk->log_sector_size);
+	  table->prdt[0].unused = 0;
+	  table->prdt[0].size = (count << disk->log_sector_size) - 1;
+
+	  mask |= 1 << tag;
+	  batch += count;
+	}
+
+      port->intstatus = 0xffffffff;
+      port->sata_active = mask;
+      port->command_issue = mask;
+
+      endtime = grub_get_time_ms () + 20000;
+      while ((port->sata_active | port->command_issue) & mask)
+	if (grub_get_time_ms () > endtime
+	    || (port->intstatus & GRUB_AHCI_HBA_PORT_IS_FATAL_MASK))
+	  {
+	    grub_dprintf ("ahci", "AHCI NCQ status <%x %x %x %x>\n",
+			  port->command_issue, port->sata_active,
+			  port->intstatus, port->task_file_data);
+	    if (port->intstatus & GRUB_AHCI_HBA_PORT_IS_FATAL_MASK)
+	      err = grub_error (GRUB_ERR_IO, "AHCI queued transfer error");
+	    else
+	      err = grub_error (GRUB_ERR_IO, "AHCI queued transfer timed out");
+	    /* Don't try NCQ on this port again.  */
+	    dev->ncq_slots = 0;
+	    grub_ahci_reset_port (dev, 1);
+	    return err;
+	  }
+
+      if (!is_write)
+	grub_memcpy (buf, bounce, batch << disk->log_sector_size);
+
+      buf += batch << disk->log_sector_size;
+      sector += batch;
+      size -= batch;
+    }
+
+  return GRUB_ERR_NONE;
+}
+
 static grub_err_t
 grub_ahci_open (int id, int devnum, struct grub_ata *ata)
 {
@@ -1123,6 +1310,7 @@ grub_ahci_open (int id, int devnum, struct grub_ata *ata)
   ata->dma = 1;
   ata->atapi = dev->atapi;
   ata->maxbuffer = GRUB_AHCI_PRDT_MAX_CHUNK_LENGTH;
+  ata->maxqueued = dev->ncq_slots * GRUB_AHCI_NCQ_MAX_TRANSFER;
   ata->present = &dev->present;
 
   return GRUB_ERR_NONE;
@@ -1133,6 +1321,7 @@ static struct grub_ata_dev grub_ahci_dev =
     .iterate = grub_ahci_iterate,
     .open = grub_ahci_open,
     .readwrite = grub_ahci_readwrite,
+    .readwrite_queued = grub_ahci_readwrite_queued,
   };
 
 
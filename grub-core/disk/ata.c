@@ -168,6 +168,11 @@ grub_ata_identify (struct grub_ata *dev)
 	dev->addr = GRUB_ATA_LBA;
     }
 
+  /* Check if native command queuing is supported.  */
+  if (dev->addr == GRUB_ATA_LBA48
+      && (info16[76] & grub_cpu_to_le16_compile_time ((1 << 8))))
+    dev->queue_depth = (grub_le_to_cpu16 (info16[75]) & 0x1f) + 1;
+
   /* Determine the amount of sectors.  */
   if (dev->addr != GRUB_ATA_LBA48)
     dev->size = grub_le_to_cpu32 (info32[30]);
@@ -291,6 +296,18 @@ grub_ata_readwrite (grub_disk_t disk, grub_disk_addr_t sector,
   grub_dprintf("ata", "grub_ata_readwrite (size=%llu, rw=%d)\n",
 	       (unsigned long long) size, rw);
 
+  if (ata->queue_depth && ata->maxqueued && ata->dev->readwrite_queued)
+    {
+      if (ata->dev->readwrite_queued (ata, sector, size, buf, rw)
+	  == GRUB_ERR_NONE)
+	return GRUB_ERR_NONE;
+
+      /* Fall back to one command at a time.  */
+      grub_dprintf ("ata", "queued transfer failed: %s\n", grub_errmsg);
+      grub_errno = GRUB_ERR_NONE;
+      ata->queue_depth = 0;
+    }
+
   if (addressing == GRUB_ATA_LBA48 && ((sector + size) >> 28) != 0)
     {
       if (ata->dma)
@@ -469,9 +486,15 @@ grub_ata_open (const char *name, grub_disk_t disk)
     return grub_error (GRUB_ERR_UNKNOWN_DEVICE, "not an ATA harddisk");
 
   disk->total_sectors = ata->size;
-  disk->max_agglomerate = (ata->maxbuffer >> (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS));
-  if (disk->max_agglomerate > (256U >> (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS - ata->log_sector_size)))
-    disk->max_agglomerate = (256U >> (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS - ata->log_sector_size));
+  if (ata->queue_depth && ata->maxqueued && ata->dev->readwrite_queued)
+    /* Let a single read fill all the queued commands.  */
+    disk->max_agglomerate = (ata->maxqueued >> (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS));
+  else
+    {
+      disk->max_agglomerate = (ata->maxbuffer >> (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS));
+      if (disk->max_agglomerate > (256U >> (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS - ata->log_sector_size)))
+	disk->max_agglomerate = (256U >> (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS - ata->log_sector_size));
+    }
 
   disk->log_sector_size = ata->log_sector_size;
 
@@ -496,6 +519,14 @@ grub_ata_read (grub_disk_t disk, grub_disk_addr_t sector,
   return grub_ata_readwrite (disk, sector, size, buf, 0);
 }
 
+static grub_err_t
+grub_ata_readv (grub_disk_t disk, const struct grub_disk_iovec *iov,
+		unsigned int iovcnt)
+{
+  /* Issue one command for each run of contiguous segments.  */
+  return grub_disk_readv_merge (disk, iov, iovcnt, grub_ata_read);
+}
+
 static grub_err_t
 grub_ata_write (grub_disk_t disk,
 		grub_disk_addr_t sector,
@@ -514,6 +545,7 @@ static struct grub_disk_dev grub_atadisk_dev =
     .disk_close = grub_ata_close,
     .disk_read = grub_ata_read,
     .disk_write = grub_ata_write,
+    .disk_readv = grub_ata_readv,
     .next = 0
   };
 
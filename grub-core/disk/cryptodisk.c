@@ -75,8 +75,14 @@ static inline int GF_PER_SECTOR (const struct grub_cryptodisk *dev)
   return 1U << (dev->log_sector_size - GRUB_CRYPTODISK_GF_LOG_BYTES);
 }
 
+#define CRYPTODISK_IV_WORDS ((GRUB_CRYPTO_MAX_CIPHER_BLOCKSIZE + 3) / 4)
+
+/* Sectors whose IVs are derived ahead and processed in one go.  */
+#define CRYPTODISK_BATCH_SECTORS 32
+
 static grub_cryptodisk_t cryptodisk_list = NULL;
 static grub_uint8_t last_cryptodisk_id = 0;
+static grub_cryptodisk_accel_t cryptodisk_accel_list = NULL;
 
 static void
 gf_mul_x (grub_uint8_t *g)
@@ -245,6 +251,164 @@ lrw_xor (const struct lrw_sector *sec,
 		   dev->lrw_precalc, sec->low_byte * GRUB_CRYPTODISK_GF_BYTES);
 }
 
+/* Derive the initial vector IV of SECTOR.  */
+static gcry_err_code_t
+cryptodisk_derive_iv (struct grub_cryptodisk *dev, grub_uint32_t *iv,
+		      grub_disk_addr_t sector, grub_size_t log_sector_size)
+{
+  grub_size_t sz = ((dev->cipher->cipher->blocksize
+		     + sizeof (grub_uint32_t) - 1)
+		    / sizeof (grub_uint32_t));
+  gcry_err_code_t err;
+
+  grub_memset (iv, 0, CRYPTODISK_IV_WORDS * sizeof (*iv));
+  switch (dev->mode_iv)
+    {
+    case GRUB_CRYPTODISK_MODE_IV_NULL:
+      break;
+    case GRUB_CRYPTODISK_MODE_IV_BYTECOUNT64_HASH:
+      {
+	grub_uint64_t tmp;
+	void *ctx;
+
+	ctx = grub_zalloc (dev->iv_hash->contextsize);
+	if (!ctx)
+	  return GPG_ERR_OUT_OF_MEMORY;
+
+	tmp = grub_cpu_to_le64 (sector << log_sector_size);
+	dev->iv_hash->init (ctx);
+	dev->iv_hash->write (ctx, dev->iv_prefix, dev->iv_prefix_len);
+	dev->iv_hash->write (ctx, &tmp, sizeof (tmp));
+	dev->iv_hash->final (ctx);
+
+	grub_memcpy (iv, dev->iv_hash->read (ctx),
+		     CRYPTODISK_IV_WORDS * sizeof (*iv));
+	grub_free (ctx);
+      }
+      break;
+    case GRUB_CRYPTODISK_MODE_IV_PLAIN64:
+    case GRUB_CRYPTODISK_MODE_IV_PLAIN:
+      /*
+       * The IV is a 32 or 64 bit value of the dm-crypt native sector
+       * number. If using 32 bit IV mode, zero out the most significant
+       * 32 bits.
+       */
+      {
+	grub_uint64_t iv64;
+
+	iv64 = grub_cpu_to_le64 (sector << (log_sector_size
+					     - GRUB_CRYPTODISK_IV_LOG_SIZE));
+	grub_set_unaligned64 (iv, iv64);
+	if (dev->mode_iv == GRUB_CRYPTODISK_MODE_IV_PLAIN)
+	  iv[1] = 0;
+      }
+      break;
+    case GRUB_CRYPTODISK_MODE_IV_BYTECOUNT64:
+      /* The IV is the 64 bit byte offset of the sector. */
+      iv[1] = grub_cpu_to_le32 (sector >> (GRUB_TYPE_BITS (iv[1])
+					   - log_sector_size));
+      iv[0] = grub_cpu_to_le32 ((sector << log_sector_size)
+				& GRUB_TYPE_U_MAX (iv[0]));
+      break;
+    case GRUB_CRYPTODISK_MODE_IV_BENBI:
+      {
+	grub_uint64_t num = (sector << dev->benbi_log) + 1;
+	iv[sz - 2] = grub_cpu_to_be32 (num >> GRUB_TYPE_BITS (iv[0]));
+	iv[sz - 1] = grub_cpu_to_be32 (num & GRUB_TYPE_U_MAX (iv[0]));
+      }
+      break;
+    case GRUB_CRYPTODISK_MODE_IV_ESSIV:
+      iv[0] = grub_cpu_to_le32 (sector & GRUB_TYPE_U_MAX (iv[0]));
+      err = grub_crypto_ecb_encrypt (dev->essiv_cipher, iv, iv,
+				     dev->cipher->cipher->blocksize);
+      if (err)
+	return err;
+    }
+
+  return GPG_ERR_NO_ERROR;
+}
+
+/*
+ * Process runs of sectors at once: derive all their IVs first, then hand
+ * the whole run to the accelerator, or in XTS mode encrypt all the tweaks
+ * in one call and expand them over the run so the data goes through the
+ * cipher in a single ECB pass.  Only used without rekeying.
+ */
+static gcry_err_code_t
+cryptodisk_endecrypt_batch (struct grub_cryptodisk *dev,
+			    grub_uint8_t *data, grub_size_t len,
+			    grub_disk_addr_t sector, grub_size_t log_sector_size,
+			    int do_encrypt)
+{
+  grub_uint32_t ivs[CRYPTODISK_BATCH_SECTORS * CRYPTODISK_IV_WORDS];
+  grub_size_t bs = dev->cipher->cipher->blocksize;
+  grub_size_t nsectors = len >> log_sector_size;
+  grub_uint8_t *tweaks = NULL;
+  gcry_err_code_t err = GPG_ERR_NO_ERROR;
+  grub_size_t n, k, j;
+
+  if (!dev->accel)
+    {
+      tweaks = grub_malloc (grub_min (nsectors,
+				      (grub_size_t) CRYPTODISK_BATCH_SECTORS)
+			    << log_sector_size);
+      if (!tweaks)
+	return GPG_ERR_OUT_OF_MEMORY;
+    }
+
+  for (; nsectors; nsectors -= n, sector += n, data += n << log_sector_size)
+    {
+      n = grub_min (nsectors, (grub_size_t) CRYPTODISK_BATCH_SECTORS);
+
+      /* The IVs are stored back to back, one cipher block each.  */
+      for (k = 0; k < n; k++)
+	{
+	  err = cryptodisk_derive_iv (dev, ivs + k * CRYPTODISK_IV_WORDS,
+				      sector + k, log_sector_size);
+	  if (err)
+	    goto out;
+	}
+
+      if (dev->accel)
+	{
+	  dev->accel->crypt (dev->accel_ctx, data, n, log_sector_size,
+			     (grub_uint8_t *) ivs, do_encrypt);
+	  continue;
+	}
+
+      err = grub_crypto_ecb_encrypt (dev->secondary_cipher, ivs, ivs, n * bs);
+      if (err)
+	goto out;
+
+      for (k = 0; k < n; k++)
+	{
+	  grub_uint8_t *t = tweaks + (k << log_sector_size);
+
+	  grub_memcpy (t, ivs + k * CRYPTODISK_IV_WORDS, bs);
+	  for (j = bs; j < ((grub_size_t) 1 << log_sector_size); j += bs)
+	    {
+	      grub_memcpy (t + j, t + j - bs, bs);
+	      gf_mul_x (t + j);
+	    }
+	}
+
+      grub_crypto_xor (data, data, tweaks, n << log_sector_size);
+      if (do_encrypt)
+	err = grub_crypto_ecb_encrypt (dev->cipher, data, data,
+				       n << log_sector_size);
+      else
+	err = grub_crypto_ecb_decrypt (dev->cipher, data, data,
+				       n << log_sector_size);
+      if (err)
+	goto out;
+      grub_crypto_xor (data, data, tweaks, n << log_sector_size);
+    }
+
+ out:
+  grub_free (tweaks);
+  return err;
+}
+
 static gcry_err_code_t
 grub_cryptodisk_endecrypt (struct grub_cryptodisk *dev,
 			   grub_uint8_t * data, grub_size_t len,
@@ -262,12 +426,17 @@ grub_cryptodisk_endecrypt (struct grub_cryptodisk *dev,
     return (do_encrypt ? grub_crypto_ecb_encrypt (dev->cipher, data, data, len)
 	    : grub_crypto_ecb_decrypt (dev->cipher, data, data, len));
 
+  /* Accelerators only accept 16-byte blocks, which the XTS batch needs too.  */
+  if (!dev->rekey
+      && (dev->accel
+	  || (dev->mode == GRUB_CRYPTODISK_MODE_XTS
+	      && dev->cipher->cipher->blocksize == GRUB_CRYPTODISK_GF_BYTES)))
+    return cryptodisk_endecrypt_batch (dev, data, len, sector,
+				       log_sector_size, do_encrypt);
+
   for (i = 0; i < len; i += ((grub_size_t) 1 << log_sector_size))
     {
-      grub_size_t sz = ((dev->cipher->cipher->blocksize
-			 + sizeof (grub_uint32_t) - 1)
-			/ sizeof (grub_uint32_t));
-      grub_uint32_t iv[(GRUB_CRYPTO_MAX_CIPHER_BLOCKSIZE + 3) / 4];
+      grub_uint32_t iv[CRYPTODISK_IV_WORDS];
 
       if (dev->rekey)
 	{
@@ -281,68 +450,9 @@ grub_cryptodisk_endecrypt (struct grub_cryptodisk *dev,
 	    }
 	}
 
-      grub_memset (iv, 0, sizeof (iv));
-      switch (dev->mode_iv)
-	{
-	case GRUB_CRYPTODISK_MODE_IV_NULL:
-	  break;
-	case GRUB_CRYPTODISK_MODE_IV_BYTECOUNT64_HASH:
-	  {
-	    grub_uint64_t tmp;
-	    void *ctx;
-
-	    ctx = grub_zalloc (dev->iv_hash->contextsize);
-	    if (!ctx)
-	      return GPG_ERR_OUT_OF_MEMORY;
-
-	    tmp = grub_cpu_to_le64 (sector << log_sector_size);
-	    dev->iv_hash->init (ctx);
-	    dev->iv_hash->write (ctx, dev->iv_prefix, dev->iv_prefix_len);
-	    dev->iv_hash->write (ctx, &tmp, sizeof (tmp));
-	    dev->iv_hash->final (ctx);
-
-	    grub_memcpy (iv, dev->iv_hash->read (ctx), sizeof (iv));
-	    grub_free (ctx);
-	  }
-	  break;
-	case GRUB_CRYPTODISK_MODE_IV_PLAIN64:
-	case GRUB_CRYPTODISK_MODE_IV_PLAIN:
-	  /*
-	   * The IV is a 32 or 64 bit value of the dm-crypt native sector
-	   * number. If using 32 bit IV mode, zero out the most significant
-	   * 32 bits.
-	   */
-	  {
-	    grub_uint64_t iv64;
-
-	    iv64 = grub_cpu_to_le64 (sector << (log_sector_size
-						 - GRUB_CRYPTODISK_IV_LOG_SIZE));
-	    grub_set_unaligned64 (iv, iv64);
-	    if (dev->mode_iv == GRUB_CRYPTODISK_MODE_IV_PLAIN)
-	      iv[1] = 0;
-	  }
-	  break;
-	case GRUB_CRYPTODISK_MODE_IV_BYTECOUNT64:
-	  /* The IV is the 64 bit byte offset of the sector. */
-	  iv[1] = grub_cpu_to_le32 (sector >> (GRUB_TYPE_BITS (iv[1])
-					       - log_sector_size));
-	  iv[0] = grub_cpu_to_le32 ((sector << log_sector_size)
-				    & GRUB_TYPE_U_MAX (iv[0]));
-	  break;
-	case GRUB_CRYPTODISK_MODE_IV_BENBI:
-	  {
-	    grub_uint64_t num = (sector << dev->benbi_log) + 1;
-	    iv[sz - 2] = grub_cpu_to_be32 (num >> GRUB_TYPE_BITS (iv[0]));
-	    iv[sz - 1] = grub_cpu_to_be32 (num & GRUB_TYPE_U_MAX (iv[0]));
-	  }
-	  break;
-	case GRUB_CRYPTODISK_MODE_IV_ESSIV:
-	  iv[0] = grub_cpu_to_le32 (sector & GRUB_TYPE_U_MAX (iv[0]));
-	  err = grub_crypto_ecb_encrypt (dev->essiv_cipher, iv, iv,
-					 dev->cipher->cipher->blocksize);
-	  if (err)
-	    return err;
-	}
+      err = cryptodisk_derive_iv (dev, iv, sector, log_sector_size);
+      if (err)
+	return err;
 
       switch (dev->mode)
 	{
@@ -370,6 +480,7 @@ grub_cryptodisk_endecrypt (struct grub_cryptodisk *dev,
 	case GRUB_CRYPTODISK_MODE_XTS:
 	  {
 	    unsigned j;
+
 	    err = grub_crypto_ecb_encrypt (dev->secondary_cipher, iv, iv,
 					   dev->cipher->cipher->blocksize);
 	    if (err)
@@ -607,6 +718,76 @@ err:
   return ret;
 }
 
+void
+grub_cryptodisk_accel_register (grub_cryptodisk_accel_t accel)
+{
+  grub_list_push (GRUB_AS_LIST_P (&cryptodisk_accel_list), GRUB_AS_LIST (accel));
+}
+
+static void
+cryptodisk_accel_release (grub_cryptodisk_t dev)
+{
+  if (!dev->accel)
+    return;
+  dev->accel->fini (dev->accel_ctx);
+  dev->accel = NULL;
+  dev->accel_ctx = NULL;
+}
+
+void
+grub_cryptodisk_accel_unregister (grub_cryptodisk_accel_t accel)
+{
+  grub_cryptodisk_t dev;
+
+  /* The devices using it go back to the generic code.  */
+  for (dev = cryptodisk_list; dev != NULL; dev = dev->next)
+    if (dev->accel == accel)
+      cryptodisk_accel_release (dev);
+
+  grub_list_remove (GRUB_AS_LIST (accel));
+}
+
+/* Pick a hardware implementation for the new key of DEV, if there is one.  */
+static void
+cryptodisk_accel_setup (grub_cryptodisk_t dev, const grub_uint8_t *key,
+			grub_size_t keysize)
+{
+#ifndef GRUB_UTIL
+  static int autoloaded;
+#endif
+  grub_cryptodisk_accel_t accel;
+
+  cryptodisk_accel_release (dev);
+
+  if (dev->mode != GRUB_CRYPTODISK_MODE_XTS
+      && dev->mode != GRUB_CRYPTODISK_MODE_CBC)
+    return;
+
+#ifndef GRUB_UTIL
+  /* Only platforms with AES instructions have this module.  */
+  if (!autoloaded)
+    {
+      autoloaded = 1;
+      grub_dl_load ("aes_hw");
+      grub_errno = GRUB_ERR_NONE;
+    }
+#endif
+
+  FOR_LIST_ELEMENTS (accel, cryptodisk_accel_list)
+    {
+      dev->accel_ctx = accel->init (dev->cipher->cipher, dev->mode,
+				    key, keysize);
+      if (dev->accel_ctx)
+	{
+	  grub_dprintf ("cryptodisk", "using %s for %s\n", accel->name,
+			dev->cipher->cipher->name);
+	  dev->accel = accel;
+	  return;
+	}
+    }
+  grub_errno = GRUB_ERR_NONE;
+}
+
 gcry_err_code_t
 grub_cryptodisk_setkey (grub_cryptodisk_t dev, grub_uint8_t *key, grub_size_t keysize)
 {
@@ -668,6 +849,8 @@ grub_cryptodisk_setkey (grub_cryptodisk_t dev, grub_uint8_t *key, grub_size_t ke
 	  gf_mul_be (dev->lrw_precalc + i, idx, dev->lrw_key);
 	}
     }
+
+  cryptodisk_accel_setup (dev, key, keysize);
   return GPG_ERR_NO_ERROR;
 }
 
@@ -1023,6 +1206,7 @@ grub_util_cryptodisk_get_uuid (grub_disk_t disk)
 static void
 cryptodisk_close (grub_cryptodisk_t dev)
 {
+  cryptodisk_accel_release (dev);
   grub_crypto_cipher_close (dev->cipher);
   grub_crypto_cipher_close (dev->secondary_cipher);
   grub_crypto_cipher_close (dev->essiv_cipher);
@@ -123,6 +123,86 @@ is_valid_diskfilter_name (const char *name)
 	  || grub_memcmp (name, "ldm/", sizeof ("ldm/") - 1) == 0);
 }
 
+/* Disks and partitions on which no detector found anything.  Every open
+   of a diskfilter device not assembled yet scans all disks again, and
+   without this each scan read all signatures of every such disk again.
+   Members are found from array_list instead.  */
+struct scan_miss
+{
+  struct scan_miss *next;
+  enum grub_disk_dev_id dev_id;
+  unsigned long disk_id;
+  grub_disk_addr_t part_start;
+  grub_uint64_t part_size;
+};
+
+static struct scan_miss *scan_misses;
+/* What the misses were found with: loading a detector or writing a disk
+   forgets them.  */
+static unsigned long scan_misses_generation;
+static grub_diskfilter_t scan_misses_list;
+static int scan_misses_nfilters;
+
+static void
+scan_misses_free (void)
+{
+  struct scan_miss *m;
+
+  while ((m = scan_misses))
+    {
+      scan_misses = m->next;
+      grub_free (m);
+    }
+}
+
+static int
+scan_miss_find (grub_disk_t disk)
+{
+  struct scan_miss *m;
+  grub_diskfilter_t diskfilter;
+  int nfilters = 0;
+
+  FOR_LIST_ELEMENTS (diskfilter, grub_diskfilter_list)
+    nfilters++;
+  if (scan_misses_generation != grub_disk_generation
+      || scan_misses_list != grub_diskfilter_list
+      || scan_misses_nfilters != nfilters)
+    {
+      scan_misses_free ();
+      scan_misses_generation = grub_disk_generation;
+      scan_misses_list = grub_diskfilter_list;
+      scan_misses_nfilters = nfilters;
+      return 0;
+    }
+
+  for (m = scan_misses; m; m = m->next)
+    if (m->disk_id == disk->id && m->dev_id == disk->dev->id
+	&& m->part_start == grub_partition_get_start (disk->partition)
+	&& m->part_size == grub_disk_native_sectors (disk))
+      return 1;
+
+  return 0;
+}
+
+static void
+scan_miss_record (grub_disk_t disk)
+{
+  struct scan_miss *m;
+
+  m = grub_malloc (sizeof (*m));
+  if (!m)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+  m->dev_id = disk->dev->id;
+  m->disk_id = disk->id;
+  m->part_start = grub_partition_get_start (disk->partition);
+  m->part_size = grub_disk_native_sectors (disk);
+  m->next = scan_misses;
+  scan_misses = m;
+}
+
 /* Helper for scan_disk.  */
 static int
 scan_disk_partition_iter (grub_disk_t disk, grub_partition_t p, void *data)
@@ -132,6 +212,7 @@ scan_disk_partition_iter (grub_disk_t disk, grub_partition_t p, void *data)
   grub_disk_addr_t start_sector;
   struct grub_diskfilter_pv_id id;
   grub_diskfilter_t diskfilter;
+  int miss = 1;
 
   grub_dprintf ("diskfilter", "Scanning for DISKFILTER devices on disk %s\n",
 		name);
@@ -152,6 +233,9 @@ scan_disk_partition_iter (grub_disk_t disk, grub_partition_t p, void *data)
 	  return 0;
     }
 
+  if (scan_miss_find (disk))
+    return 0;
+
   for (diskfilter = grub_diskfilter_list; diskfilter; diskfilter = diskfilter->next)
     {
 #ifdef GRUB_UTIL
@@ -170,15 +254,25 @@ scan_disk_partition_iter (grub_disk_t disk, grub_partition_t p, void *data)
 	}
       if (arr && id.uuidlen)
 	grub_free (id.uuid);
+      if (arr)
+	miss = 0;
 
       /* This error usually means it's not diskfilter, no need to display
 	 it.  */
       if (grub_errno != GRUB_ERR_OUT_OF_RANGE)
-	grub_print_error ();
+	{
+	  /* Try again next time after a read error.  */
+	  if (grub_errno != GRUB_ERR_NONE)
+	    miss = 0;
+	  grub_print_error ();
+	}
 
       grub_errno = GRUB_ERR_NONE;
     }
 
+  if (miss)
+    scan_miss_record (disk);
+
   return 0;
 }
 
@@ -602,6 +696,152 @@ validate_segment (struct grub_diskfilter_segment *seg)
 
 }
 
+/* The most sectors read_striped reads from a member at a time.  */
+#define STRIPED_READ_MAX	2048
+
+/* Read SIZE sectors at SECTOR of the striped segment SEG with one read
+   per member, each member holding its chunks of consecutive rows next to
+   each other, and put the chunks in place in BUF.  */
+static grub_err_t
+read_striped_window (struct grub_diskfilter_segment *seg,
+		     grub_disk_addr_t sector, grub_size_t size, char *buf,
+		     char *tmp)
+{
+  grub_uint64_t first, last, b, e, r;
+  unsigned int n = seg->node_count, k;
+  grub_err_t err;
+
+  first = grub_divmod64 (sector, seg->stripe_size, &b);
+  last = grub_divmod64 (sector + size - 1, seg->stripe_size, &e);
+  e++;
+  grub_divmod64 (first, n, &r);
+
+  for (k = 0; k < n; k++)
+    {
+      grub_uint64_t c, c_first, c_last, start, end;
+
+      c_first = first + (k + n - (unsigned int) r) % n;
+      if (c_first > last)
+	continue;
+      c_last = c_first + grub_divmod64 (last - c_first, n, 0) * n;
+
+      start = grub_divmod64 (c_first, n, 0) * seg->stripe_size
+	+ (c_first == first ? b : 0);
+      end = grub_divmod64 (c_last, n, 0) * seg->stripe_size
+	+ (c_last == last ? e : seg->stripe_size);
+
+      err = grub_diskfilter_read_node (&seg->nodes[k], start, end - start,
+				       tmp);
+      if (err)
+	return err;
+
+      for (c = c_first; c <= c_last; c += n)
+	{
+	  grub_uint64_t cs = (c == first ? b : 0);
+	  grub_uint64_t ce = (c == last ? e : seg->stripe_size);
+	  grub_uint64_t mofs, bofs;
+
+	  mofs = grub_divmod64 (c, n, 0) * seg->stripe_size + cs - start;
+	  bofs = c * seg->stripe_size + cs - sector;
+	  grub_memcpy (buf + (bofs << GRUB_DISK_SECTOR_BITS),
+		       tmp + (mofs << GRUB_DISK_SECTOR_BITS),
+		       (ce - cs) << GRUB_DISK_SECTOR_BITS);
+	}
+    }
+
+  return GRUB_ERR_NONE;
+}
+
+/* Read a large request from the striped segment SEG member by member
+   rather than chunk by chunk, in windows of at most STRIPED_READ_MAX
+   sectors per member.  */
+static grub_err_t
+read_striped (struct grub_diskfilter_segment *seg, grub_disk_addr_t sector,
+	      grub_size_t size, char *buf)
+{
+  grub_uint64_t rows, window;
+  char *tmp;
+  grub_err_t err = GRUB_ERR_NONE;
+
+  rows = grub_divmod64 (STRIPED_READ_MAX, seg->stripe_size, 0);
+  if (rows == 0)
+    rows = 1;
+  window = rows * seg->stripe_size * seg->node_count;
+
+  /* A window not aligned on rows gives a member at most one more chunk.  */
+  tmp = grub_malloc ((rows + 1) * seg->stripe_size << GRUB_DISK_SECTOR_BITS);
+  if (!tmp)
+    return grub_errno;
+
+  while (size)
+    {
+      grub_size_t len = size;
+
+      if (len > window)
+	len = window;
+      err = read_striped_window (seg, sector, len, buf, tmp);
+      if (err)
+	break;
+      sector += len;
+      buf += len << GRUB_DISK_SECTOR_BITS;
+      size -= len;
+    }
+
+  grub_free (tmp);
+  return err;
+}
+
+/* Reads of mirrors start at a member chosen by their offset in units of
+   1 << MIRROR_BALANCE_SHIFT sectors, so that the members share the reads
+   and nearby reads stay on one member.  */
+#define MIRROR_BALANCE_SHIFT	11
+
+/* Read the whole request from a single member of the mirror SEG, rather
+   than chunk by chunk.  Members that failed before come last.  */
+static grub_err_t
+read_mirror (struct grub_diskfilter_segment *seg, grub_disk_addr_t sector,
+	     grub_size_t size, char *buf)
+{
+  grub_uint64_t first, failed = 0;
+  unsigned int i, k, pass;
+  grub_err_t err = GRUB_ERR_UNKNOWN_DEVICE;
+
+  grub_divmod64 (sector >> MIRROR_BALANCE_SHIFT, seg->node_count, &first);
+
+  for (pass = 0; pass < 2; pass++)
+    for (i = 0; i < seg->node_count; i++)
+      {
+	struct grub_diskfilter_node *node;
+
+	k = first + i;
+	if (k >= seg->node_count)
+	  k -= seg->node_count;
+	node = &seg->nodes[k];
+
+	if ((node->read_errors != 0) != pass)
+	  continue;
+	/* Do not read again a member which failed in the first pass.  */
+	if (pass && k < 64 && (failed & (1ULL << k)))
+	  continue;
+
+	if (grub_errno == GRUB_ERR_READ_ERROR
+	    || grub_errno == GRUB_ERR_UNKNOWN_DEVICE)
+	  grub_errno = GRUB_ERR_NONE;
+
+	err = grub_diskfilter_read_node (node, sector, size, buf);
+	if (! err)
+	  return GRUB_ERR_NONE;
+	if (err != GRUB_ERR_READ_ERROR && err != GRUB_ERR_UNKNOWN_DEVICE)
+	  return err;
+
+	node->read_errors++;
+	if (k < 64)
+	  failed |= 1ULL << k;
+      }
+
+  return err;
+}
+
 static grub_err_t
 read_segment (struct grub_diskfilter_segment *seg, grub_disk_addr_t sector,
 	      grub_size_t size, char *buf)
@@ -613,8 +853,26 @@ read_segment (struct grub_diskfilter_segment *seg, grub_disk_addr_t sector,
       if (seg->node_count == 1)
 	return grub_diskfilter_read_node (&seg->nodes[0],
 					  sector, size, buf);
+      /* Once a member has several chunks to read, read them at once.  */
+      if (size > seg->stripe_size * seg->node_count)
+	{
+	  err = read_striped (seg, sector, size, buf);
+	  if (err != GRUB_ERR_OUT_OF_MEMORY)
+	    return err;
+	  grub_errno = GRUB_ERR_NONE;
+	}
       /* Fallthrough.  */
     case GRUB_DISKFILTER_MIRROR:
+      if (seg->type == GRUB_DISKFILTER_MIRROR)
+	{
+	  err = read_mirror (seg, sector, size, buf);
+	  /* Copies with bad sectors in different chunks may still make up
+	     the data chunk by chunk.  */
+	  if (err != GRUB_ERR_READ_ERROR || size <= seg->stripe_size)
+	    return err;
+	  grub_errno = GRUB_ERR_NONE;
+	}
+      /* Fallthrough.  */
     case GRUB_DISKFILTER_RAID10:
       {
 	grub_disk_addr_t read_sector, far_ofs;
@@ -1383,4 +1641,5 @@ GRUB_MOD_FINI(diskfilter)
 {
   grub_disk_dev_unregister (&grub_diskfilter_dev);
   free_array ();
+  scan_misses_free ();
 }
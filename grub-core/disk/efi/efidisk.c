@@ -23,21 +23,45 @@
 #include <grub/misc.h>
 #include <grub/err.h>
 #include <grub/term.h>
+#include <grub/env.h>
 #include <grub/efi/api.h>
 #include <grub/efi/efi.h>
 #include <grub/efi/disk.h>
 
+/* Size of the Block I/O 2 read-ahead buffer.  */
+#define GRUB_EFIDISK_ASYNC_SIZE	0xa0000
+
+/* What is read from the start of every disk when they are iterated.  */
+#define GRUB_EFIDISK_PREFETCH_SIZE	0x10000
+
+/* State of an asynchronous Block I/O 2 read-ahead.  */
+struct grub_efidisk_async
+{
+  grub_efi_block_io2_token_t token;
+  char *buf;
+  /* The range being read into BUF, in disk sectors.  */
+  grub_disk_addr_t sector;
+  grub_size_t size;
+  /* Whether the read was submitted and not waited for yet.  */
+  int pending;
+  /* Whether BUF holds the data of the range.  */
+  int valid;
+};
+
 struct grub_efidisk_data
 {
   grub_efi_handle_t handle;
   grub_efi_device_path_t *device_path;
   grub_efi_device_path_t *last_device_path;
   grub_efi_block_io_t *block_io;
+  grub_efi_block_io2_t *block_io2;
+  struct grub_efidisk_async *async;
   struct grub_efidisk_data *next;
 };
 
 /* GUID.  */
 static grub_guid_t block_io_guid = GRUB_EFI_BLOCK_IO_GUID;
+static grub_guid_t block_io2_guid = GRUB_EFI_BLOCK_IO2_GUID;
 
 static struct grub_efidisk_data *fd_devices;
 static struct grub_efidisk_data *hd_devices;
@@ -107,6 +131,9 @@ make_devices (void)
       d->device_path = dp;
       d->last_device_path = ldp;
       d->block_io = bio;
+      d->block_io2 = grub_efi_open_protocol (*handle, &block_io2_guid,
+					     GRUB_EFI_OPEN_PROTOCOL_GET_PROTOCOL);
+      d->async = NULL;
       d->next = devices;
       devices = d;
     }
@@ -370,6 +397,151 @@ name_devices (struct grub_efidisk_data *devices)
     }
 }
 
+/* Wait for the outstanding read-ahead of A, if any.  */
+static void
+grub_efidisk_async_wait (struct grub_efidisk_async *a)
+{
+  grub_efi_uintn_t index;
+
+  if (! a->pending)
+    return;
+
+  grub_efi_system_table->boot_services->wait_for_event (1, &a->token.event,
+							 &index);
+  a->pending = 0;
+  a->valid = (a->token.transaction_status == GRUB_EFI_SUCCESS);
+}
+
+static void
+grub_efidisk_async_free (struct grub_efidisk_data *d)
+{
+  struct grub_efidisk_async *a = d->async;
+
+  if (! a)
+    return;
+
+  /* The firmware may still be writing into the buffer.  */
+  grub_efidisk_async_wait (a);
+  grub_efi_system_table->boot_services->close_event (a->token.event);
+  grub_free (a->buf);
+  grub_free (a);
+  d->async = NULL;
+}
+
+static void
+grub_efidisk_async_init (struct grub_efidisk_data *d, grub_size_t io_align)
+{
+  struct grub_efidisk_async *a;
+  grub_efi_status_t status;
+
+  a = grub_zalloc (sizeof (*a));
+  if (! a)
+    goto fail;
+
+  a->buf = grub_memalign (io_align, GRUB_EFIDISK_ASYNC_SIZE);
+  if (! a->buf)
+    goto fail;
+
+  status = grub_efi_system_table->boot_services->create_event (0, 0, NULL, NULL,
+							      &a->token.event);
+  if (status != GRUB_EFI_SUCCESS)
+    goto fail;
+
+  d->async = a;
+  return;
+
+ fail:
+  /* Read-ahead is optional.  */
+  if (a)
+    grub_free (a->buf);
+  grub_free (a);
+  grub_errno = GRUB_ERR_NONE;
+}
+
+/* Start reading SIZE sectors of 1 << LOG_SECTOR_SIZE bytes from SECTOR of
+   D, which has TOTAL_SECTORS of them, into the read-ahead buffer.  */
+static void
+grub_efidisk_async_start (struct grub_efidisk_data *d, grub_disk_addr_t sector,
+			  grub_size_t size, unsigned int log_sector_size,
+			  grub_disk_addr_t total_sectors)
+{
+  struct grub_efidisk_async *a = d->async;
+  grub_efi_status_t status;
+
+  a->valid = 0;
+
+  if (size > (GRUB_EFIDISK_ASYNC_SIZE >> log_sector_size))
+    size = GRUB_EFIDISK_ASYNC_SIZE >> log_sector_size;
+  if (sector >= total_sectors)
+    return;
+  if (size > total_sectors - sector)
+    size = total_sectors - sector;
+  if (size == 0)
+    return;
+
+  a->token.transaction_status = GRUB_EFI_SUCCESS;
+  status = d->block_io2->read_blocks_ex (d->block_io2,
+					 d->block_io->media->media_id,
+					 (grub_efi_uint64_t) sector, &a->token,
+					 (grub_efi_uintn_t) (size << log_sector_size),
+					 a->buf);
+  if (status != GRUB_EFI_SUCCESS)
+    {
+      grub_dprintf ("efidisk", "async read at 0x%llx failed: %lx\n",
+		    (unsigned long long) sector, (unsigned long) status);
+      return;
+    }
+
+  a->sector = sector;
+  a->size = size;
+  a->pending = 1;
+}
+
+/* Start reading SIZE sectors from SECTOR into the read-ahead buffer.  */
+static void
+grub_efidisk_async_submit (struct grub_disk *disk, grub_disk_addr_t sector,
+			   grub_size_t size)
+{
+  grub_efidisk_async_start (disk->data, sector, size, disk->log_sector_size,
+			    disk->total_sectors);
+}
+
+/* The iteration hooks open the disks one after the other and read their
+   partition tables and superblocks, each waiting out the latency of the
+   firmware.  Before they do, start reading the start of all of them at
+   once, which each open then finds in its read-ahead buffer.  */
+static void
+grub_efidisk_async_prefetch (struct grub_efidisk_data *devices)
+{
+  struct grub_efidisk_data *d;
+  grub_efi_block_io_media_t *m;
+  unsigned int log_sector_size;
+
+  if (! grub_env_get_bool ("efidisk_async", 0))
+    return;
+
+  for (d = devices; d; d = d->next)
+    {
+      m = d->block_io->media;
+      if (! d->block_io2 || ! m->media_present
+	  || ! m->block_size || (m->block_size & (m->block_size - 1))
+	  || (m->io_align & (m->io_align - 1)))
+	continue;
+
+      if (! d->async)
+	grub_efidisk_async_init (d, (m->io_align < m->block_size)
+				 ? m->block_size : m->io_align);
+      if (! d->async || d->async->pending
+	  || (d->async->valid && d->async->sector == 0))
+	continue;
+
+      log_sector_size = grub_log2ull (m->block_size);
+      grub_efidisk_async_start (d, 0,
+				GRUB_EFIDISK_PREFETCH_SIZE >> log_sector_size,
+				log_sector_size, m->last_block + 1);
+    }
+}
+
 static void
 free_devices (struct grub_efidisk_data *devices)
 {
@@ -378,6 +550,7 @@ free_devices (struct grub_efidisk_data *devices)
   for (p = devices; p; p = q)
     {
       q = p->next;
+      grub_efidisk_async_free (p);
       grub_free (p);
     }
 }
@@ -407,6 +580,7 @@ grub_efidisk_iterate (grub_disk_dev_iterate_hook_t hook, void *hook_data,
   switch (pull)
     {
     case GRUB_DISK_PULL_NONE:
+      grub_efidisk_async_prefetch (hd_devices);
       for (d = hd_devices, count = 0; d; d = d->next, count++)
 	{
 	  grub_snprintf (buf, sizeof (buf), "hd%d", count);
@@ -526,6 +700,16 @@ grub_efidisk_open (const char *name, struct grub_disk *disk)
   disk->log_sector_size = grub_log2ull (m->block_size);
   disk->data = d;
 
+  /* Block I/O 2 read-ahead is opt-in as firmware support varies.  */
+  if (d->block_io2 && grub_env_get_bool ("efidisk_async", 0))
+    {
+      if (! d->async)
+	grub_efidisk_async_init (d, (m->io_align < m->block_size)
+				 ? m->block_size : m->io_align);
+    }
+  else
+    grub_efidisk_async_free (d);
+
   grub_dprintf ("efidisk", "opening %s succeeded\n", name);
 
   return GRUB_ERR_NONE;
@@ -598,12 +782,33 @@ static grub_err_t
 grub_efidisk_read (struct grub_disk *disk, grub_disk_addr_t sector,
 		   grub_size_t size, char *buf)
 {
+  struct grub_efidisk_data *d = disk->data;
   grub_efi_status_t status;
 
   grub_dprintf ("efidisk",
 		"reading 0x%lx sectors at the sector 0x%llx from %s\n",
 		(unsigned long) size, (unsigned long long) sector, disk->name);
 
+  if (d->async)
+    {
+      struct grub_efidisk_async *a = d->async;
+
+      /* Never mix outstanding Block I/O 2 requests with blocking ones.  */
+      grub_efidisk_async_wait (a);
+      if (a->valid && sector >= a->sector
+	  && sector + size <= a->sector + a->size)
+	{
+	  grub_memcpy (buf, a->buf + ((sector - a->sector) << disk->log_sector_size),
+		       size << disk->log_sector_size);
+	  /* When the read-ahead is consumed, start the next one and let it
+	     proceed while the caller processes the data.  */
+	  if (sector + size == a->sector + a->size)
+	    grub_efidisk_async_submit (disk, sector + size, a->size);
+	  return GRUB_ERR_NONE;
+	}
+      a->valid = 0;
+    }
+
   status = grub_efidisk_readwrite (disk, sector, size, buf, 0);
 
   if (status == GRUB_EFI_NO_MEDIA)
@@ -614,19 +819,38 @@ grub_efidisk_read (struct grub_disk *disk, grub_disk_addr_t sector,
 		       (unsigned long long) sector,
 		       disk->name);
 
+  if (d->async)
+    grub_efidisk_async_submit (disk, sector + size, size);
+
   return GRUB_ERR_NONE;
 }
 
+static grub_err_t
+grub_efidisk_readv (struct grub_disk *disk, const struct grub_disk_iovec *iov,
+		    unsigned int iovcnt)
+{
+  /* Block I/O has no scatter-gather support, but contiguous segments can
+     at least be read with a single ReadBlocks call.  */
+  return grub_disk_readv_merge (disk, iov, iovcnt, grub_efidisk_read);
+}
+
 static grub_err_t
 grub_efidisk_write (struct grub_disk *disk, grub_disk_addr_t sector,
 		    grub_size_t size, const char *buf)
 {
+  struct grub_efidisk_data *d = disk->data;
   grub_efi_status_t status;
 
   grub_dprintf ("efidisk",
 		"writing 0x%lx sectors at the sector 0x%llx to %s\n",
 		(unsigned long) size, (unsigned long long) sector, disk->name);
 
+  if (d->async)
+    {
+      grub_efidisk_async_wait (d->async);
+      d->async->valid = 0;
+    }
+
   status = grub_efidisk_readwrite (disk, sector, size, (char *) buf, 1);
 
   if (status == GRUB_EFI_NO_MEDIA)
@@ -648,6 +872,7 @@ static struct grub_disk_dev grub_efidisk_dev =
     .disk_close = grub_efidisk_close,
     .disk_read = grub_efidisk_read,
     .disk_write = grub_efidisk_write,
+    .disk_readv = grub_efidisk_readv,
     .next = 0
   };
 
@@ -600,6 +600,63 @@ grub_biosdisk_read (grub_disk_t disk, grub_disk_addr_t sector,
   return grub_errno;
 }
 
+/* Read runs of contiguous segments in chunks as large as possible,
+   scattering each chunk from the scratch buffer.  */
+static grub_err_t
+grub_biosdisk_readv (grub_disk_t disk, const struct grub_disk_iovec *iov,
+		     unsigned int iovcnt)
+{
+  unsigned int i = 0, j;
+  grub_size_t done = 0;
+
+  while (i < iovcnt)
+    {
+      grub_disk_addr_t sector;
+      grub_size_t len, avail, copied;
+
+      if (iov[i].size == 0)
+	{
+	  i++;
+	  continue;
+	}
+
+      sector = iov[i].sector + done;
+      len = get_safe_sectors (disk, sector);
+
+      avail = iov[i].size - done;
+      for (j = i + 1; avail < len && j < iovcnt
+	     && iov[j].sector == iov[j - 1].sector + iov[j - 1].size; j++)
+	avail += iov[j].size;
+      if (len > avail)
+	len = avail;
+
+      if (grub_biosdisk_rw (GRUB_BIOSDISK_READ, disk, sector, len,
+			    GRUB_MEMORY_MACHINE_SCRATCH_SEG))
+	return grub_errno;
+
+      for (copied = 0; copied < len; )
+	{
+	  grub_size_t n = iov[i].size - done;
+
+	  if (n > len - copied)
+	    n = len - copied;
+	  grub_memcpy (iov[i].buf + (done << disk->log_sector_size),
+		       (char *) GRUB_MEMORY_MACHINE_SCRATCH_ADDR
+		       + (copied << disk->log_sector_size),
+		       n << disk->log_sector_size);
+	  copied += n;
+	  done += n;
+	  if (done == iov[i].size)
+	    {
+	      i++;
+	      done = 0;
+	    }
+	}
+    }
+
+  return GRUB_ERR_NONE;
+}
+
 static grub_err_t
 grub_biosdisk_write (grub_disk_t disk, grub_disk_addr_t sector,
 		     grub_size_t size, const char *buf)
@@ -641,6 +698,7 @@ static struct grub_disk_dev grub_biosdisk_dev =
     .disk_close = grub_biosdisk_close,
     .disk_read = grub_biosdisk_read,
     .disk_write = grub_biosdisk_write,
+    .disk_readv = grub_biosdisk_readv,
     .next = 0
   };
 
@@ -25,9 +25,6 @@
 #include <grub/i18n.h>
 #include <grub/time.h>
 
-static char *last_devpath;
-static grub_ieee1275_ihandle_t last_ihandle;
-
 struct ofdisk_hash_ent
 {
   char *devpath;
@@ -40,11 +37,27 @@ struct ofdisk_hash_ent
      otherwise NULL.  */
   const char *shortest;
   const char *grub_shortest;
+  /* Instance of OPEN_PATH kept open across disk opens, or 0.  */
+  grub_ieee1275_ihandle_t ihandle;
+  /* Byte offset IHANDLE is positioned at, or OFDISK_POS_UNKNOWN.  */
+  grub_uint64_t pos;
+  /* Largest transfer IHANDLE accepts in bytes, 0 if not limited.  */
+  grub_size_t max_transfer;
+  unsigned long last_used;
   struct ofdisk_hash_ent *next;
 };
 
+/* Opening an instance is among the slowest client interface calls on
+   some firmware, so keep a few open rather than reopening each time
+   another disk is accessed.  */
+#define OFDISK_MAX_OPEN		4
+#define OFDISK_POS_UNKNOWN	((grub_uint64_t) -1)
+
+static int ofdisk_open_count;
+static unsigned long ofdisk_clock;
+
 static grub_err_t
-grub_ofdisk_get_block_size (const char *device, grub_uint32_t *block_size,
+grub_ofdisk_get_block_size (grub_uint32_t *block_size,
 			    struct ofdisk_hash_ent *op);
 
 #define OFDISK_HASH_SZ	8
@@ -451,6 +464,88 @@ compute_dev_path (const char *name)
   return devpath;
 }
 
+static void
+ofdisk_close_instance (struct ofdisk_hash_ent *op)
+{
+  grub_ieee1275_close (op->ihandle);
+  op->ihandle = 0;
+  ofdisk_open_count--;
+}
+
+/* Ask the disk package how many bytes one read or write may move.  */
+static grub_size_t
+ofdisk_get_max_transfer (grub_ieee1275_ihandle_t ihandle)
+{
+  struct max_transfer_args
+  {
+    struct grub_ieee1275_common_hdr common;
+    grub_ieee1275_cell_t method;
+    grub_ieee1275_cell_t ihandle;
+    grub_ieee1275_cell_t catch_result;
+    grub_ieee1275_cell_t size;
+  }
+  args;
+
+  INIT_IEEE1275_COMMON (&args.common, "call-method", 2, 2);
+  args.method = (grub_ieee1275_cell_t) "max-transfer";
+  args.ihandle = ihandle;
+  args.catch_result = 1;
+
+  if (IEEE1275_CALL_ENTRY_FN (&args) == -1 || args.catch_result)
+    return 0;
+
+  return args.size;
+}
+
+/* Return the open instance of OP, opening it and closing the least
+   recently used one if needed.  */
+static grub_ieee1275_ihandle_t
+ofdisk_get_instance (struct ofdisk_hash_ent *op)
+{
+  op->last_used = ++ofdisk_clock;
+  if (op->ihandle)
+    return op->ihandle;
+
+  if (ofdisk_open_count >= OFDISK_MAX_OPEN)
+    {
+      struct ofdisk_hash_ent *p, *lru = NULL;
+      unsigned i;
+
+      for (i = 0; i < ARRAY_SIZE (ofdisk_hash); i++)
+	for (p = ofdisk_hash[i]; p; p = p->next)
+	  if (p->ihandle && (!lru || p->last_used < lru->last_used))
+	    lru = p;
+      if (lru)
+	ofdisk_close_instance (lru);
+    }
+
+  if (grub_ieee1275_open (op->open_path, &op->ihandle) || ! op->ihandle)
+    {
+      op->ihandle = 0;
+      return 0;
+    }
+  ofdisk_open_count++;
+  op->pos = OFDISK_POS_UNKNOWN;
+  op->max_transfer = ofdisk_get_max_transfer (op->ihandle);
+  grub_dprintf ("disk", "Opened `%s', max-transfer %" PRIuGRUB_SIZE ".\n",
+		op->open_path, op->max_transfer);
+
+  return op->ihandle;
+}
+
+/* Return how many bytes of a request on DISK to move per client call.  */
+static grub_size_t
+ofdisk_chunk_size (grub_disk_t disk, struct ofdisk_hash_ent *op)
+{
+  grub_size_t chunk;
+
+  if (! op->max_transfer)
+    return GRUB_SIZE_MAX;
+
+  chunk = (op->max_transfer >> disk->log_sector_size) << disk->log_sector_size;
+  return chunk ? : (grub_size_t) 1 << disk->log_sector_size;
+}
+
 static grub_err_t
 grub_ofdisk_open (const char *name, grub_disk_t disk)
 {
@@ -509,7 +604,7 @@ grub_ofdisk_open (const char *name, grub_disk_t disk)
     disk->id = (unsigned long) op;
     disk->data = op->open_path;
 
-    err = grub_ofdisk_get_block_size (devpath, &block_size, op);
+    err = grub_ofdisk_get_block_size (&block_size, op);
     if (err)
       {
         grub_free (devpath);
@@ -519,6 +614,20 @@ grub_ofdisk_open (const char *name, grub_disk_t disk)
       disk->log_sector_size = grub_log2ull (block_size);
     else
       disk->log_sector_size = 9;
+
+    /* Let the disk layer hand over as much as the firmware moves in one
+       call.  */
+    if (op->max_transfer)
+      {
+	grub_size_t units;
+
+	units = op->max_transfer >> (GRUB_DISK_CACHE_BITS
+				     + GRUB_DISK_SECTOR_BITS);
+	if (units > GRUB_DISK_MAX_MAX_AGGLOMERATE)
+	  units = GRUB_DISK_MAX_MAX_AGGLOMERATE;
+	if (units)
+	  disk->max_agglomerate = units;
+      }
   }
 
   grub_free (devpath);
@@ -528,42 +637,35 @@ grub_ofdisk_open (const char *name, grub_disk_t disk)
 static void
 grub_ofdisk_close (grub_disk_t disk)
 {
-  if (disk->data == last_devpath)
-    {
-      if (last_ihandle)
-	grub_ieee1275_close (last_ihandle);
-      last_ihandle = 0;
-      last_devpath = NULL;
-    }
+  /* The instance stays open for the next access.  */
   disk->data = 0;
 }
 
 static grub_err_t
 grub_ofdisk_prepare (grub_disk_t disk, grub_disk_addr_t sector)
 {
+  struct ofdisk_hash_ent *op = (struct ofdisk_hash_ent *) disk->id;
   grub_ssize_t status;
-  unsigned long long pos;
+  grub_uint64_t pos;
 
-  if (disk->data != last_devpath)
-    {
-      if (last_ihandle)
-	grub_ieee1275_close (last_ihandle);
-      last_ihandle = 0;
-      last_devpath = NULL;
-
-      grub_ieee1275_open (disk->data, &last_ihandle);
-      if (! last_ihandle)
-	return grub_error (GRUB_ERR_UNKNOWN_DEVICE, "can't open device");
-      last_devpath = disk->data;
-    }
+  if (! ofdisk_get_instance (op))
+    return grub_error (GRUB_ERR_UNKNOWN_DEVICE, "can't open device");
 
   pos = sector << disk->log_sector_size;
 
-  grub_ieee1275_seek (last_ihandle, pos, &status);
+  /* Sequential accesses need no seek.  */
+  if (op->pos == pos)
+    return 0;
+
+  grub_ieee1275_seek (op->ihandle, pos, &status);
   if (status < 0)
-    return grub_error (GRUB_ERR_READ_ERROR,
-		       "seek error, can't seek block %llu",
-		       (long long) sector);
+    {
+      op->pos = OFDISK_POS_UNKNOWN;
+      return grub_error (GRUB_ERR_READ_ERROR,
+			 "seek error, can't seek block %llu",
+			 (long long) sector);
+    }
+  op->pos = pos;
   return 0;
 }
 
@@ -571,18 +673,31 @@ static grub_err_t
 grub_ofdisk_read (grub_disk_t disk, grub_disk_addr_t sector,
 		  grub_size_t size, char *buf)
 {
+  struct ofdisk_hash_ent *op = (struct ofdisk_hash_ent *) disk->id;
+  grub_size_t len = size << disk->log_sector_size;
+  grub_size_t chunk, n;
   grub_err_t err;
   grub_ssize_t actual;
+
   err = grub_ofdisk_prepare (disk, sector);
   if (err)
     return err;
-  grub_ieee1275_read (last_ihandle, buf, size  << disk->log_sector_size,
-		      &actual);
-  if (actual != (grub_ssize_t) (size  << disk->log_sector_size))
-    return grub_error (GRUB_ERR_READ_ERROR, N_("failure reading sector 0x%llx "
-					       "from `%s'"),
-		       (unsigned long long) sector,
-		       disk->name);
+
+  chunk = ofdisk_chunk_size (disk, op);
+  for (; len; len -= n, buf += n)
+    {
+      n = len < chunk ? len : chunk;
+      grub_ieee1275_read (op->ihandle, buf, n, &actual);
+      if (actual != (grub_ssize_t) n)
+	{
+	  op->pos = OFDISK_POS_UNKNOWN;
+	  return grub_error (GRUB_ERR_READ_ERROR,
+			     N_("failure reading sector 0x%llx from `%s'"),
+			     (unsigned long long) sector,
+			     disk->name);
+	}
+      op->pos += n;
+    }
 
   return 0;
 }
@@ -591,18 +706,31 @@ static grub_err_t
 grub_ofdisk_write (grub_disk_t disk, grub_disk_addr_t sector,
 		   grub_size_t size, const char *buf)
 {
+  struct ofdisk_hash_ent *op = (struct ofdisk_hash_ent *) disk->id;
+  grub_size_t len = size << disk->log_sector_size;
+  grub_size_t chunk, n;
   grub_err_t err;
   grub_ssize_t actual;
+
   err = grub_ofdisk_prepare (disk, sector);
   if (err)
     return err;
-  grub_ieee1275_write (last_ihandle, buf, size  << disk->log_sector_size,
-		       &actual);
-  if (actual != (grub_ssize_t) (size << disk->log_sector_size))
-    return grub_error (GRUB_ERR_WRITE_ERROR, N_("failure writing sector 0x%llx "
-						"to `%s'"),
-		       (unsigned long long) sector,
-		       disk->name);
+
+  chunk = ofdisk_chunk_size (disk, op);
+  for (; len; len -= n, buf += n)
+    {
+      n = len < chunk ? len : chunk;
+      grub_ieee1275_write (op->ihandle, buf, n, &actual);
+      if (actual != (grub_ssize_t) n)
+	{
+	  op->pos = OFDISK_POS_UNKNOWN;
+	  return grub_error (GRUB_ERR_WRITE_ERROR,
+			     N_("failure writing sector 0x%llx to `%s'"),
+			     (unsigned long long) sector,
+			     disk->name);
+	}
+      op->pos += n;
+    }
 
   return 0;
 }
@@ -662,10 +790,13 @@ insert_bootpath (void)
 void
 grub_ofdisk_fini (void)
 {
-  if (last_ihandle)
-    grub_ieee1275_close (last_ihandle);
-  last_ihandle = 0;
-  last_devpath = NULL;
+  struct ofdisk_hash_ent *p;
+  unsigned i;
+
+  for (i = 0; i < ARRAY_SIZE (ofdisk_hash); i++)
+    for (p = ofdisk_hash[i]; p; p = p->next)
+      if (p->ihandle)
+	ofdisk_close_instance (p);
 
   grub_disk_dev_unregister (&grub_ofdisk_dev);
 }
@@ -681,7 +812,7 @@ grub_ofdisk_init (void)
 }
 
 static grub_err_t
-grub_ofdisk_get_block_size (const char *device, grub_uint32_t *block_size,
+grub_ofdisk_get_block_size (grub_uint32_t *block_size,
 			    struct ofdisk_hash_ent *op)
 {
   struct size_args_ieee1275
@@ -694,14 +825,10 @@ grub_ofdisk_get_block_size (const char *device, grub_uint32_t *block_size,
       grub_ieee1275_cell_t size2;
     } args_ieee1275;
 
-  if (last_ihandle)
-    grub_ieee1275_close (last_ihandle);
-
-  last_ihandle = 0;
-  last_devpath = NULL;
+  grub_ieee1275_ihandle_t ihandle;
 
-  grub_ieee1275_open (device, &last_ihandle);
-  if (! last_ihandle)
+  ihandle = ofdisk_get_instance (op);
+  if (! ihandle)
     return grub_error (GRUB_ERR_UNKNOWN_DEVICE, "can't open device");
 
   *block_size = 0;
@@ -711,7 +838,7 @@ grub_ofdisk_get_block_size (const char *device, grub_uint32_t *block_size,
 
   INIT_IEEE1275_COMMON (&args_ieee1275.common, "call-method", 2, 2);
   args_ieee1275.method = (grub_ieee1275_cell_t) "block-size";
-  args_ieee1275.ihandle = last_ihandle;
+  args_ieee1275.ihandle = ihandle;
   args_ieee1275.result = 1;
 
   if (IEEE1275_CALL_ENTRY_FN (&args_ieee1275) == -1)
@@ -665,6 +665,7 @@ make_vg (grub_disk_t disk,
 	    }
 	  lv->segments->nodes[lv->segments->node_count].pv = 0;
 	  lv->segments->nodes[lv->segments->node_count].start = 0;
+	  lv->segments->nodes[lv->segments->node_count].read_errors = 0;
 	  lv->segments->nodes[lv->segments->node_count++].lv = comp;
 	  comp->next = vg->lvs;
 	  vg->lvs = comp;
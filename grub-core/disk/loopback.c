@@ -24,15 +24,39 @@
 #include <grub/mm.h>
 #include <grub/extcmd.h>
 #include <grub/i18n.h>
+#include <grub/partition.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
+/* Where a part of the backing file lies on the disk it is on, as seen by
+   the filesystem reading it.  */
+struct loopback_extent
+{
+  grub_off_t offset;
+  /* In bytes, from the start of the partition of the backing file.  */
+  grub_uint64_t pos;
+  grub_uint64_t len;
+};
+
+/* The most extents kept for a device, and found in one read.  */
+#define LOOPBACK_MAX_EXTENTS	8192
+#define LOOPBACK_MAX_PIECES	64
+
 struct grub_loopback
 {
   char *devname;
   grub_file_t file;
   struct grub_loopback *next;
   unsigned long id;
+
+  /* Whether the data of the file is read as is from its disk, so that
+     its extents can be learnt.  */
+  int mappable;
+  grub_disk_addr_t part_start;
+  /* Sorted by offset, and not overlapping.  */
+  struct loopback_extent *extents;
+  unsigned nextents;
+  unsigned extents_alloc;
 };
 
 static struct grub_loopback *loopback_list;
@@ -68,6 +92,7 @@ delete_loopback (const char *name)
   *prev = dev->next;
 
   grub_free (dev->devname);
+  grub_free (dev->extents);
   grub_file_close (dev->file);
   grub_free (dev);
 
@@ -121,6 +146,16 @@ grub_cmd_loopback (grub_extcmd_context_t ctxt, int argc, char **args)
   newdev->file = file;
   newdev->id = last_id++;
 
+  /* Decompressed files and files not read from a disk have no extents.  */
+  newdev->mappable = (!state[1].set && file->device && file->device->disk
+		      && file->size != GRUB_FILE_SIZE_UNKNOWN);
+  newdev->part_start = (newdev->mappable
+			? grub_partition_get_start (file->device->disk->partition)
+			: 0);
+  newdev->extents = NULL;
+  newdev->nextents = 0;
+  newdev->extents_alloc = 0;
+
   /* Add the new entry to the list.  */
   newdev->next = loopback_list;
   loopback_list = newdev;
@@ -178,16 +213,233 @@ grub_loopback_open (const char *name, grub_disk_t disk)
   return 0;
 }
 
+/* Find the first extent of DEV ending after OFFSET.  */
+static unsigned
+loopback_extent_find (struct grub_loopback *dev, grub_off_t offset)
+{
+  unsigned lo = 0, hi = dev->nextents;
+
+  while (lo < hi)
+    {
+      unsigned mid = (lo + hi) / 2;
+
+      if (dev->extents[mid].offset + dev->extents[mid].len <= offset)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+
+  return lo;
+}
+
+/* Read LEN bytes at OFFSET of the backing file of DEV straight from its
+   disk, if its extents there are all known.  Return 0 with no error
+   otherwise.  */
+static int
+loopback_read_direct (struct grub_loopback *dev, grub_off_t offset,
+		      grub_size_t len, char *buf)
+{
+  grub_disk_t disk = dev->file->device->disk;
+  unsigned i;
+  grub_off_t o;
+
+  /* Check first that everything is there.  */
+  i = loopback_extent_find (dev, offset);
+  for (o = offset; o < offset + len; i++)
+    {
+      if (i == dev->nextents || dev->extents[i].offset > o)
+	return 0;
+      o = dev->extents[i].offset + dev->extents[i].len;
+    }
+
+  i = loopback_extent_find (dev, offset);
+  for (o = offset; o < offset + len; i++)
+    {
+      struct loopback_extent *e = &dev->extents[i];
+      grub_uint64_t pos = e->pos + (o - e->offset);
+      grub_size_t piece = e->offset + e->len - o;
+
+      if (piece > offset + len - o)
+	piece = offset + len - o;
+      if (grub_disk_read (disk, pos >> GRUB_DISK_SECTOR_BITS,
+			  pos & (GRUB_DISK_SECTOR_SIZE - 1),
+			  piece, buf + (o - offset)))
+	return 1;
+      o += piece;
+    }
+
+  return 1;
+}
+
+/* The pieces of the backing file its filesystem read for a request.  */
+struct loopback_read_ctx
+{
+  struct grub_loopback *dev;
+  char *buf;
+  grub_size_t len;
+  grub_off_t offset;
+  grub_size_t seen;
+  int bad;
+  unsigned npieces;
+  struct loopback_extent pieces[LOOPBACK_MAX_PIECES];
+};
+
+/* Helper for grub_loopback_read.  Only data read from the disk into the
+   buffer of the request itself says where that part of the file lies.  */
+static grub_err_t
+loopback_read_hook (grub_disk_addr_t sector, unsigned offset, unsigned length,
+		    char *buf, void *data)
+{
+  struct loopback_read_ctx *ctx = data;
+  struct loopback_extent *last;
+  grub_off_t foff;
+  grub_uint64_t pos;
+
+  if (ctx->bad)
+    return GRUB_ERR_NONE;
+  if (buf < ctx->buf || buf + length > ctx->buf + ctx->len
+      || sector < ctx->dev->part_start)
+    {
+      ctx->bad = 1;
+      return GRUB_ERR_NONE;
+    }
+
+  ctx->seen += length;
+  foff = ctx->offset + (buf - ctx->buf);
+  pos = ((sector - ctx->dev->part_start) << GRUB_DISK_SECTOR_BITS) + offset;
+
+  last = ctx->npieces ? &ctx->pieces[ctx->npieces - 1] : NULL;
+  if (last && last->offset + last->len == foff && last->pos + last->len == pos)
+    {
+      last->len += length;
+      return GRUB_ERR_NONE;
+    }
+  if (ctx->npieces == LOOPBACK_MAX_PIECES)
+    {
+      ctx->bad = 1;
+      return GRUB_ERR_NONE;
+    }
+  ctx->pieces[ctx->npieces].offset = foff;
+  ctx->pieces[ctx->npieces].pos = pos;
+  ctx->pieces[ctx->npieces].len = length;
+  ctx->npieces++;
+
+  return GRUB_ERR_NONE;
+}
+
+/* Keep the extent E of DEV, unless it overlaps one kept already.  */
+static void
+loopback_extent_add (struct grub_loopback *dev, const struct loopback_extent *e)
+{
+  unsigned i = loopback_extent_find (dev, e->offset);
+  struct loopback_extent *prev, *next;
+
+  if (i < dev->nextents && dev->extents[i].offset < e->offset + e->len)
+    return;
+
+  prev = i ? &dev->extents[i - 1] : NULL;
+  next = i < dev->nextents ? &dev->extents[i] : NULL;
+  if (prev && prev->offset + prev->len == e->offset
+      && prev->pos + prev->len == e->pos)
+    {
+      prev->len += e->len;
+      if (next && e->offset + e->len == next->offset
+	  && e->pos + e->len == next->pos)
+	{
+	  prev->len += next->len;
+	  grub_memmove (next, next + 1,
+			(dev->nextents - i - 1) * sizeof (*next));
+	  dev->nextents--;
+	}
+      return;
+    }
+  if (next && e->offset + e->len == next->offset
+      && e->pos + e->len == next->pos)
+    {
+      next->offset = e->offset;
+      next->pos = e->pos;
+      next->len += e->len;
+      return;
+    }
+
+  if (dev->nextents == dev->extents_alloc)
+    {
+      struct loopback_extent *t;
+      unsigned n = dev->extents_alloc ? dev->extents_alloc * 2 : 16;
+
+      if (dev->extents_alloc >= LOOPBACK_MAX_EXTENTS)
+	return;
+      t = grub_realloc (dev->extents, n * sizeof (*t));
+      if (!t)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  return;
+	}
+      dev->extents = t;
+      dev->extents_alloc = n;
+    }
+
+  grub_memmove (&dev->extents[i + 1], &dev->extents[i],
+		(dev->nextents - i) * sizeof (dev->extents[0]));
+  dev->extents[i] = *e;
+  dev->nextents++;
+}
+
 static grub_err_t
 grub_loopback_read (grub_disk_t disk, grub_disk_addr_t sector,
 		    grub_size_t size, char *buf)
 {
-  grub_file_t file = ((struct grub_loopback *) disk->data)->file;
+  struct grub_loopback *dev = disk->data;
+  grub_file_t file = dev->file;
   grub_off_t pos;
+  grub_off_t offset = sector << GRUB_DISK_SECTOR_BITS;
+  grub_size_t len = size << GRUB_DISK_SECTOR_BITS;
+  struct loopback_read_ctx *ctx = NULL;
+  grub_ssize_t res;
+
+  /* Once the filesystem of the backing file has said where its data is,
+     read it from there rather than map the file again.  */
+  if (dev->mappable && offset + len <= file->size)
+    {
+      if (loopback_read_direct (dev, offset, len, buf))
+	return grub_errno;
+
+      ctx = grub_malloc (sizeof (*ctx));
+      if (!ctx)
+	grub_errno = GRUB_ERR_NONE;
+    }
+
+  grub_file_seek (file, offset);
+
+  if (ctx)
+    {
+      ctx->dev = dev;
+      ctx->buf = buf;
+      ctx->len = len;
+      ctx->offset = offset;
+      ctx->seen = 0;
+      ctx->bad = 0;
+      ctx->npieces = 0;
+      file->read_hook = loopback_read_hook;
+      file->read_hook_data = ctx;
+    }
+
+  res = grub_file_read (file, buf, len);
 
-  grub_file_seek (file, sector << GRUB_DISK_SECTOR_BITS);
+  if (ctx)
+    {
+      unsigned i;
+
+      file->read_hook = NULL;
+      file->read_hook_data = NULL;
+      /* Data that did not come as is from the disk, for instance because
+	 it was compressed, comes in other amounts.  */
+      if (!grub_errno && !ctx->bad && res >= 0 && ctx->seen == (grub_size_t) res)
+	for (i = 0; i < ctx->npieces; i++)
+	  loopback_extent_add (dev, &ctx->pieces[i]);
+      grub_free (ctx);
+    }
 
-  grub_file_read (file, buf, size << GRUB_DISK_SECTOR_BITS);
   if (grub_errno)
     return grub_errno;
 
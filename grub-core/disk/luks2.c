@@ -26,6 +26,8 @@
 #include <grub/crypto.h>
 #include <grub/partition.h>
 #include <grub/i18n.h>
+#include <grub/time.h>
+#include <grub/efi/mp.h>
 
 #include <base64.h>
 #include <json.h>
@@ -35,9 +37,13 @@ GRUB_MOD_LICENSE ("GPLv3+");
 #define LUKS_MAGIC_1ST "LUKS\xBA\xBE"
 #define LUKS_MAGIC_2ND "SKUL\xBA\xBE"
 
+/* The JSON area is read in pieces of this size up to its terminating NUL.  */
+#define LUKS2_JSON_READ_SIZE 4096
+
 enum grub_luks2_kdf_type
 {
   LUKS2_KDF_TYPE_ARGON2I,
+  LUKS2_KDF_TYPE_ARGON2ID,
   LUKS2_KDF_TYPE_PBKDF2
 };
 typedef enum grub_luks2_kdf_type grub_luks2_kdf_type_t;
@@ -160,7 +166,8 @@ luks2_parse_keyslot (grub_luks2_keyslot_t *out, const grub_json_t *keyslot)
     return grub_error (GRUB_ERR_BAD_ARGUMENT, "Missing or invalid KDF");
   else if (!grub_strcmp (type, "argon2i") || !grub_strcmp (type, "argon2id"))
     {
-      out->kdf.type = LUKS2_KDF_TYPE_ARGON2I;
+      out->kdf.type = (!grub_strcmp (type, "argon2i")
+		       ? LUKS2_KDF_TYPE_ARGON2I : LUKS2_KDF_TYPE_ARGON2ID);
       if (grub_json_getint64 (&out->kdf.u.argon2i.time, &kdf, "time") ||
 	  grub_json_getint64 (&out->kdf.u.argon2i.memory, &kdf, "memory") ||
 	  grub_json_getint64 (&out->kdf.u.argon2i.cpus, &kdf, "cpus"))
@@ -433,56 +440,146 @@ luks2_verify_key (grub_luks2_digest_t *d, grub_uint8_t *candidate_key,
   return GRUB_ERR_NONE;
 }
 
-static grub_err_t
-luks2_decrypt_key (grub_uint8_t *out_key,
-		   grub_disk_t source, grub_cryptodisk_t crypt,
-		   grub_luks2_keyslot_t *k,
-		   const grub_uint8_t *passphrase, grub_size_t passphraselen)
+/*
+ * A keyslot to try.  Its KDF runs as a job of grub_efi_mp_run (), possibly
+ * on an application processor, so all it needs is set up beforehand.
+ */
+struct luks2_trial
 {
-  grub_uint8_t area_key[GRUB_CRYPTODISK_MAX_KEYLEN];
+  grub_luks2_keyslot_t keyslot;
+  grub_luks2_digest_t digest;
+  grub_luks2_segment_t segment;
+  grub_disk_addr_t offset_sectors;
+  grub_disk_addr_t total_sectors;
+  int log_sector_size;
   grub_uint8_t salt[GRUB_CRYPTODISK_MAX_KEYLEN];
-  grub_uint8_t *split_key = NULL;
-  idx_t saltlen = sizeof (salt);
-  char cipher[32], *p;
+  idx_t saltlen;
   const gcry_md_spec_t *hash;
-  gcry_err_code_t gcry_ret;
-  grub_err_t ret;
+  const gcry_md_spec_t *hash_accel;
+  grub_size_t memsize;
+  void *mem;
+  grub_uint8_t area_key[GRUB_CRYPTODISK_MAX_KEYLEN];
+  gcry_err_code_t err;
+};
 
+struct luks2_kdf_batch
+{
+  struct luks2_trial *trials;
+  const grub_uint8_t *passphrase;
+  grub_size_t passphraselen;
+};
+
+static grub_err_t
+luks2_kdf_prepare (struct luks2_trial *t)
+{
+  grub_luks2_keyslot_t *k = &t->keyslot;
+
+  t->saltlen = sizeof (t->salt);
   if (luks2_base64_decode (k->kdf.salt, grub_strlen (k->kdf.salt),
-			   salt, &saltlen) != GRUB_ERR_NONE)
+			   t->salt, &t->saltlen) != GRUB_ERR_NONE)
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, "Invalid keyslot salt");
+
+  switch (k->kdf.type)
     {
-      ret = grub_error (GRUB_ERR_BAD_ARGUMENT, "Invalid keyslot salt");
-      goto err;
+      case LUKS2_KDF_TYPE_ARGON2I:
+      case LUKS2_KDF_TYPE_ARGON2ID:
+	if (k->kdf.u.argon2i.time < 1
+	    || k->kdf.u.argon2i.time > GRUB_UINT_MAX
+	    || k->kdf.u.argon2i.memory < 1
+	    || k->kdf.u.argon2i.memory > GRUB_UINT_MAX
+	    || k->kdf.u.argon2i.cpus < 1
+	    || k->kdf.u.argon2i.cpus > GRUB_UINT_MAX)
+	  return grub_error (GRUB_ERR_BAD_ARGUMENT, "Invalid Argon2 parameters");
+
+	t->memsize = grub_crypto_argon2_memsize (k->kdf.u.argon2i.memory,
+						 k->kdf.u.argon2i.cpus);
+	if (t->memsize == 0)
+	  return grub_error (GRUB_ERR_BAD_ARGUMENT, "Invalid Argon2 parameters");
+	break;
+      case LUKS2_KDF_TYPE_PBKDF2:
+	t->hash = grub_crypto_lookup_md_by_name (k->kdf.u.pbkdf2.hash);
+	if (!t->hash)
+	  return grub_error (GRUB_ERR_FILE_NOT_FOUND, "Couldn't load %s hash",
+			     k->kdf.u.pbkdf2.hash);
+
+	/*
+	 * The firmware does not promise that the APs have the SIMD units
+	 * enabled like the BSP, so they only use the software digest.
+	 */
+	t->hash_accel = t->hash;
+	t->hash = grub_crypto_md_soft (t->hash);
+	t->memsize = grub_max (grub_crypto_pbkdf2_memsize (t->hash),
+			       grub_crypto_pbkdf2_memsize (t->hash_accel));
+	break;
+    }
+
+  return GRUB_ERR_NONE;
+}
+
+/* Calculate the binary area key of the user supplied passphrase.  */
+static void
+luks2_kdf_job (void *data, grub_size_t i, int on_ap)
+{
+  struct luks2_kdf_batch *batch = data;
+  struct luks2_trial *t = &batch->trials[i];
+  grub_luks2_keyslot_t *k = &t->keyslot;
+
+  if (!t->mem)
+    {
+      t->err = GPG_ERR_OUT_OF_MEMORY;
+      return;
     }
 
-  /* Calculate the binary area key of the user supplied passphrase. */
   switch (k->kdf.type)
     {
       case LUKS2_KDF_TYPE_ARGON2I:
-	ret = grub_error (GRUB_ERR_BAD_ARGUMENT, "Argon2 not supported");
-	goto err;
+      case LUKS2_KDF_TYPE_ARGON2ID:
+	t->err = grub_crypto_argon2_prealloc (k->kdf.type == LUKS2_KDF_TYPE_ARGON2I
+					      ? GRUB_CRYPTO_ARGON2I
+					      : GRUB_CRYPTO_ARGON2ID,
+					      k->kdf.u.argon2i.time,
+					      k->kdf.u.argon2i.memory,
+					      k->kdf.u.argon2i.cpus,
+					      batch->passphrase,
+					      batch->passphraselen,
+					      t->salt, t->saltlen,
+					      t->area_key, k->area.key_size,
+					      t->mem);
+	break;
       case LUKS2_KDF_TYPE_PBKDF2:
-	hash = grub_crypto_lookup_md_by_name (k->kdf.u.pbkdf2.hash);
-	if (!hash)
-	  {
-	    ret = grub_error (GRUB_ERR_FILE_NOT_FOUND, "Couldn't load %s hash",
-			      k->kdf.u.pbkdf2.hash);
-	    goto err;
-	  }
-
-	gcry_ret = grub_crypto_pbkdf2 (hash, (grub_uint8_t *) passphrase,
-				       passphraselen,
-				       salt, saltlen,
-				       k->kdf.u.pbkdf2.iterations,
-				       area_key, k->area.key_size);
-	if (gcry_ret)
-	  {
-	    ret = grub_crypto_gcry_error (gcry_ret);
-	    goto err;
-	  }
-
+	t->err = grub_crypto_pbkdf2_prealloc (on_ap ? t->hash : t->hash_accel,
+					      batch->passphrase,
+					      batch->passphraselen,
+					      t->salt, t->saltlen,
+					      k->kdf.u.pbkdf2.iterations,
+					      t->area_key, k->area.key_size,
+					      t->mem);
 	break;
     }
+}
+
+static grub_err_t
+luks2_kdf_error (struct luks2_trial *t)
+{
+  if (t->err == GPG_ERR_OUT_OF_MEMORY
+      && t->keyslot.kdf.type != LUKS2_KDF_TYPE_PBKDF2)
+    return grub_error (GRUB_ERR_OUT_OF_MEMORY,
+		       "Not enough memory for Argon2 with %" PRIdGRUB_INT64_T
+		       " KiB", t->keyslot.kdf.u.argon2i.memory);
+
+  return grub_crypto_gcry_error (t->err);
+}
+
+static grub_err_t
+luks2_decrypt_key (grub_uint8_t *out_key,
+		   grub_disk_t source, grub_cryptodisk_t crypt,
+		   grub_luks2_keyslot_t *k, grub_uint8_t *area_key)
+{
+  grub_uint8_t *split_key = NULL;
+  char cipher[32], *p;
+  const gcry_md_spec_t *hash;
+  gcry_err_code_t gcry_ret;
+  grub_err_t ret;
 
   /* Set up disk encryption parameters for the key area */
   grub_strncpy (cipher, k->area.encryption, sizeof (cipher));
@@ -562,9 +659,12 @@ luks2_recover_key (grub_disk_t source,
   grub_uint8_t candidate_key[GRUB_CRYPTODISK_MAX_KEYLEN];
   char cipher[32], *json_header = NULL, *ptr;
   grub_size_t candidate_key_len = 0, json_idx, size;
+  grub_size_t json_size, json_len, chunk;
   grub_luks2_header_t header;
+  grub_size_t ntrials = 0, nprocs, first, last, i;
+  struct luks2_trial *trials = NULL;
+  struct luks2_kdf_batch batch;
   grub_luks2_keyslot_t keyslot;
-  grub_luks2_digest_t digest;
   grub_luks2_segment_t segment;
   gcry_err_code_t gcry_ret;
   grub_json_t *json = NULL, keyslots;
@@ -577,21 +677,33 @@ luks2_recover_key (grub_disk_t source,
   if (ret)
     return ret;
 
-  json_header = grub_zalloc (grub_be_to_cpu64 (header.hdr_size) - sizeof (header));
+  json_size = grub_be_to_cpu64 (header.hdr_size) - sizeof (header);
+  json_header = grub_zalloc (json_size);
   if (!json_header)
       return GRUB_ERR_OUT_OF_MEMORY;
 
-  /* Read the JSON area. */
-  ret = grub_disk_read (source, 0, grub_be_to_cpu64 (header.hdr_offset) + sizeof (header),
-			grub_be_to_cpu64 (header.hdr_size) - sizeof (header), json_header);
-  if (ret)
-      goto err;
-
-  ptr = grub_memchr (json_header, 0, grub_be_to_cpu64 (header.hdr_size) - sizeof (header));
+  /*
+   * Read the JSON area. The metadata usually takes a few KiB of an area
+   * of up to 4 MiB padded with zeroes, so stop at the first NUL.
+   */
+  ptr = NULL;
+  for (json_len = 0; !ptr && json_len < json_size; json_len += chunk)
+    {
+      chunk = grub_min (json_size - json_len, LUKS2_JSON_READ_SIZE);
+      ret = grub_disk_read (source, 0,
+			    grub_be_to_cpu64 (header.hdr_offset) + sizeof (header) + json_len,
+			    chunk, json_header + json_len);
+      if (ret)
+	goto err;
+      ptr = grub_memchr (json_header + json_len, 0, chunk);
+    }
   if (!ptr)
-    goto err;
+    {
+      ret = grub_error (GRUB_ERR_BAD_ARGUMENT, "Invalid LUKS2 JSON header");
+      goto err;
+    }
 
-  ret = grub_json_parse (&json, json_header, grub_be_to_cpu64 (header.hdr_size));
+  ret = grub_json_parse (&json, json_header, ptr - json_header);
   if (ret)
     {
       ret = grub_error (GRUB_ERR_BAD_ARGUMENT, "Invalid LUKS2 JSON header");
@@ -614,14 +726,21 @@ luks2_recover_key (grub_disk_t source,
       goto err;
     }
 
-  /* Try all keyslot */
+  trials = grub_calloc (size, sizeof (*trials));
+  if (!trials)
+    {
+      ret = grub_errno;
+      goto err;
+    }
+
+  /* Collect the keyslots to try, in order.  */
   for (json_idx = 0; json_idx < size; json_idx++)
     {
-      char indexstr[21]; /* log10(2^64) ~ 20, plus NUL character. */
       typeof (source->total_sectors) max_crypt_sectors = 0;
+      struct luks2_trial *t = &trials[ntrials];
 
       grub_errno = GRUB_ERR_NONE;
-      ret = luks2_get_keyslot (&keyslot, &digest, &segment, json, json_idx);
+      ret = luks2_get_keyslot (&keyslot, &t->digest, &segment, json, json_idx);
       if (ret)
 	{
 	  /*
@@ -729,32 +848,106 @@ luks2_recover_key (grub_disk_t source,
 	  crypt->total_sectors = max_crypt_sectors - crypt->offset_sectors;
 	}
 
-      ret = luks2_decrypt_key (candidate_key, source, crypt, &keyslot,
-			       cargs->key_data, cargs->key_len);
+      t->keyslot = keyslot;
+      t->segment = segment;
+      t->offset_sectors = crypt->offset_sectors;
+      t->total_sectors = crypt->total_sectors;
+      t->log_sector_size = crypt->log_sector_size;
+
+      ret = luks2_kdf_prepare (t);
       if (ret)
 	{
 	  grub_dprintf ("luks2", "Decryption with keyslot \"%" PRIuGRUB_UINT64_T "\" failed: %s\n",
 			keyslot.idx, grub_errmsg);
 	  continue;
 	}
+      ntrials++;
+    }
 
-      ret = luks2_verify_key (&digest, candidate_key, keyslot.key_size);
-      if (ret)
+  /*
+   * Run the KDFs of up to one keyslot per processor at a time, as far as
+   * memory allows, then try the keyslots of the batch in order.  Without
+   * MP services, or unless efi_mp is set to 1, the batches hold a single
+   * keyslot, as before.
+   */
+  batch.passphrase = cargs->key_data;
+  batch.passphraselen = cargs->key_len;
+  nprocs = grub_efi_mp_processors ();
+  for (first = 0; first < ntrials && candidate_key_len == 0; first = last)
+    {
+      grub_uint64_t start;
+
+      for (last = first; last < ntrials && last - first < nprocs; last++)
 	{
-	  grub_dprintf ("luks2", "Could not open keyslot \"%" PRIuGRUB_UINT64_T "\": %s\n",
-			keyslot.idx, grub_errmsg);
-	  continue;
+	  trials[last].mem = grub_malloc (trials[last].memsize);
+	  if (!trials[last].mem)
+	    break;
+	}
+      grub_errno = GRUB_ERR_NONE;
+      /* The job reports the keyslot that got no memory at all.  */
+      if (last == first)
+	last++;
+
+      batch.trials = trials + first;
+      start = grub_get_time_ms ();
+      if (grub_efi_mp_run (luks2_kdf_job, &batch, last - first))
+	{
+	  /* The APs gave up, so run the whole batch again on the BSP.  */
+	  grub_dprintf ("luks2", "%s\n", grub_errmsg);
+	  grub_errno = GRUB_ERR_NONE;
+	  grub_efi_mp_run (luks2_kdf_job, &batch, last - first);
 	}
+      grub_dprintf ("luks2", "KDF of %" PRIuGRUB_SIZE " keyslots took %"
+		    PRIuGRUB_UINT64_T " ms\n", last - first,
+		    grub_get_time_ms () - start);
 
-      grub_snprintf (indexstr, sizeof (indexstr) - 1, "%" PRIuGRUB_UINT64_T, keyslot.idx);
-      /*
-       * TRANSLATORS: It's a cryptographic key slot: one element of an array
-       * where each element is either empty or holds a key.
-       */
-      grub_printf_ (N_("Slot \"%s\" opened\n"), indexstr);
+      for (i = first; i < last; i++)
+	{
+	  grub_free (trials[i].mem);
+	  trials[i].mem = NULL;
+	}
 
-      candidate_key_len = keyslot.key_size;
-      break;
+      for (i = first; i < last; i++)
+	{
+	  char indexstr[21]; /* log10(2^64) ~ 20, plus NUL character. */
+	  struct luks2_trial *t = &trials[i];
+
+	  ret = t->err ? luks2_kdf_error (t) : GRUB_ERR_NONE;
+	  if (ret == GRUB_ERR_NONE)
+	    {
+	      crypt->offset_sectors = t->offset_sectors;
+	      crypt->total_sectors = t->total_sectors;
+	      crypt->log_sector_size = t->log_sector_size;
+	      ret = luks2_decrypt_key (candidate_key, source, crypt, &t->keyslot,
+				       t->area_key);
+	    }
+	  grub_memset (t->area_key, 0, sizeof (t->area_key));
+	  if (ret)
+	    {
+	      grub_dprintf ("luks2", "Decryption with keyslot \"%" PRIuGRUB_UINT64_T "\" failed: %s\n",
+			    t->keyslot.idx, grub_errmsg);
+	      continue;
+	    }
+
+	  ret = luks2_verify_key (&t->digest, candidate_key, t->keyslot.key_size);
+	  if (ret)
+	    {
+	      grub_dprintf ("luks2", "Could not open keyslot \"%" PRIuGRUB_UINT64_T "\": %s\n",
+			    t->keyslot.idx, grub_errmsg);
+	      continue;
+	    }
+
+	  grub_snprintf (indexstr, sizeof (indexstr) - 1, "%" PRIuGRUB_UINT64_T, t->keyslot.idx);
+	  /*
+	   * TRANSLATORS: It's a cryptographic key slot: one element of an array
+	   * where each element is either empty or holds a key.
+	   */
+	  grub_printf_ (N_("Slot \"%s\" opened\n"), indexstr);
+
+	  segment = t->segment;
+	  candidate_key_len = t->keyslot.key_size;
+	  break;
+	}
     }
   if (candidate_key_len == 0)
     {
@@ -782,6 +975,7 @@ luks2_recover_key (grub_disk_t source,
     }
 
  err:
+  grub_free (trials);
   grub_free (json_header);
   grub_json_free (json);
   return ret;
@@ -23,12 +23,130 @@
 #include <grub/misc.h>
 #include <grub/mm.h>
 #include <grub/types.h>
+#include <grub/memdisk.h>
+#include <grub/lz4.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
 static char *memdisk_addr;
 static grub_off_t memdisk_size = 0;
 
+/* A compressed image stays compressed in memory, and its chunks are
+   decompressed as they are read, into the few buffers below.  */
+#define MEMDISK_CACHE_SIZE	16
+
+struct memdisk_cache_entry
+{
+  grub_uint64_t chunk;
+  grub_uint64_t last_use;
+  char *data;
+};
+
+static int memdisk_chunked;
+static grub_uint64_t memdisk_nchunks;
+static grub_uint32_t memdisk_chunk_size;
+/* The chunks written to, kept decompressed for good.  */
+static char **memdisk_written;
+static struct memdisk_cache_entry memdisk_cache[MEMDISK_CACHE_SIZE];
+static grub_uint64_t memdisk_cache_clock;
+
+static grub_uint64_t
+chunk_offset (grub_uint64_t chunk)
+{
+  const grub_uint64_t *offsets;
+
+  offsets = (const grub_uint64_t *) (memdisk_addr
+				     + sizeof (struct grub_memdisk_chunked_header));
+  return grub_le_to_cpu64 (offsets[chunk]);
+}
+
+static grub_size_t
+chunk_len (grub_uint64_t chunk)
+{
+  if (chunk == memdisk_nchunks - 1)
+    return memdisk_size - chunk * memdisk_chunk_size;
+  return memdisk_chunk_size;
+}
+
+/* Return the data of CHUNK, decompressing it if needed.  */
+static const char *
+get_chunk (grub_uint64_t chunk)
+{
+  struct memdisk_cache_entry *e, *lru = NULL;
+  grub_uint64_t start, end;
+  grub_size_t len = chunk_len (chunk);
+
+  if (memdisk_written && memdisk_written[chunk])
+    return memdisk_written[chunk];
+
+  for (e = memdisk_cache; e < memdisk_cache + MEMDISK_CACHE_SIZE; e++)
+    {
+      if (e->data && e->chunk == chunk)
+	{
+	  e->last_use = ++memdisk_cache_clock;
+	  return e->data;
+	}
+      if (!lru || e->last_use < lru->last_use)
+	lru = e;
+    }
+
+  if (!lru->data)
+    {
+      lru->data = grub_malloc (memdisk_chunk_size);
+      if (!lru->data)
+	return NULL;
+    }
+
+  start = chunk_offset (chunk);
+  end = chunk_offset (chunk + 1);
+  if (end - start == len)
+    grub_memcpy (lru->data, memdisk_addr + start, len);
+  else if (grub_lz4_decompress (memdisk_addr + start, end - start,
+				lru->data, len) != (grub_ssize_t) len)
+    {
+      /* Do not keep a partly decompressed chunk.  */
+      lru->last_use = 0;
+      lru->chunk = memdisk_nchunks;
+      if (grub_errno == GRUB_ERR_NONE)
+	grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, "memdisk chunk corrupted");
+      return NULL;
+    }
+
+  lru->chunk = chunk;
+  lru->last_use = ++memdisk_cache_clock;
+  return lru->data;
+}
+
+/* Check the header and the offsets of the compressed image of SIZE bytes
+   at ADDR.  */
+static int
+chunked_valid (const char *addr, grub_size_t size)
+{
+  const struct grub_memdisk_chunked_header *head = (const void *) addr;
+  const grub_uint64_t *offsets = (const void *) (head + 1);
+  grub_uint64_t disk_size, nchunks, chunk_size, i;
+
+  if (size < sizeof (*head))
+    return 0;
+  disk_size = grub_le_to_cpu64 (head->size);
+  nchunks = grub_le_to_cpu64 (head->nchunks);
+  chunk_size = grub_le_to_cpu32 (head->chunk_size);
+  if (grub_le_to_cpu32 (head->compression) != GRUB_MEMDISK_COMPRESSION_LZ4
+      || chunk_size == 0 || (chunk_size & (GRUB_DISK_SECTOR_SIZE - 1))
+      || (disk_size & (GRUB_DISK_SECTOR_SIZE - 1)) || disk_size == 0
+      || nchunks != grub_divmod64 (disk_size + chunk_size - 1, chunk_size, 0)
+      || (size - sizeof (*head)) / sizeof (offsets[0]) < nchunks + 1)
+    return 0;
+
+  for (i = 0; i < nchunks; i++)
+    if (grub_le_to_cpu64 (offsets[i]) > grub_le_to_cpu64 (offsets[i + 1]))
+      return 0;
+
+  return (grub_le_to_cpu64 (offsets[0]) >= sizeof (*head)
+	  + (nchunks + 1) * sizeof (offsets[0])
+	  && grub_le_to_cpu64 (offsets[nchunks]) <= size);
+}
+
 static int
 grub_memdisk_iterate (grub_disk_dev_iterate_hook_t hook, void *hook_data,
 		      grub_disk_pull_t pull)
@@ -61,7 +179,34 @@ static grub_err_t
 grub_memdisk_read (grub_disk_t disk __attribute((unused)), grub_disk_addr_t sector,
 		    grub_size_t size, char *buf)
 {
-  grub_memcpy (buf, memdisk_addr + (sector << GRUB_DISK_SECTOR_BITS), size << GRUB_DISK_SECTOR_BITS);
+  grub_uint64_t pos = sector << GRUB_DISK_SECTOR_BITS;
+  grub_size_t len = size << GRUB_DISK_SECTOR_BITS;
+
+  if (!memdisk_chunked)
+    {
+      grub_memcpy (buf, memdisk_addr + pos, len);
+      return 0;
+    }
+
+  while (len)
+    {
+      grub_uint64_t chunk, ofs;
+      grub_size_t n;
+      const char *data;
+
+      chunk = grub_divmod64 (pos, memdisk_chunk_size, &ofs);
+      data = get_chunk (chunk);
+      if (!data)
+	return grub_errno;
+      n = chunk_len (chunk) - ofs;
+      if (n > len)
+	n = len;
+      grub_memcpy (buf, data + ofs, n);
+      buf += n;
+      pos += n;
+      len -= n;
+    }
+
   return 0;
 }
 
@@ -69,7 +214,50 @@ static grub_err_t
 grub_memdisk_write (grub_disk_t disk __attribute((unused)), grub_disk_addr_t sector,
 		     grub_size_t size, const char *buf)
 {
-  grub_memcpy (memdisk_addr + (sector << GRUB_DISK_SECTOR_BITS), buf, size << GRUB_DISK_SECTOR_BITS);
+  grub_uint64_t pos = sector << GRUB_DISK_SECTOR_BITS;
+  grub_size_t len = size << GRUB_DISK_SECTOR_BITS;
+
+  if (!memdisk_chunked)
+    {
+      grub_memcpy (memdisk_addr + pos, buf, len);
+      return 0;
+    }
+
+  if (!memdisk_written)
+    {
+      memdisk_written = grub_calloc (memdisk_nchunks, sizeof (memdisk_written[0]));
+      if (!memdisk_written)
+	return grub_errno;
+    }
+
+  while (len)
+    {
+      grub_uint64_t chunk, ofs;
+      grub_size_t n;
+
+      chunk = grub_divmod64 (pos, memdisk_chunk_size, &ofs);
+      if (!memdisk_written[chunk])
+	{
+	  const char *data = get_chunk (chunk);
+	  char *copy;
+
+	  if (!data)
+	    return grub_errno;
+	  copy = grub_malloc (chunk_len (chunk));
+	  if (!copy)
+	    return grub_errno;
+	  grub_memcpy (copy, data, chunk_len (chunk));
+	  memdisk_written[chunk] = copy;
+	}
+      n = chunk_len (chunk) - ofs;
+      if (n > len)
+	n = len;
+      grub_memcpy (memdisk_written[chunk] + ofs, buf, n);
+      buf += n;
+      pos += n;
+      len -= n;
+    }
+
   return 0;
 }
 
@@ -102,6 +290,27 @@ GRUB_MOD_INIT(memdisk)
 	grub_dprintf ("memdisk", "Copying memdisk image to dynamic memory\n");
 	grub_memmove (memdisk_addr, memdisk_orig_addr, memdisk_size);
 
+	if (memdisk_size >= sizeof (struct grub_memdisk_chunked_header)
+	    && grub_memcmp (memdisk_addr, GRUB_MEMDISK_CHUNKED_MAGIC,
+			    sizeof (GRUB_MEMDISK_CHUNKED_MAGIC) - 1) == 0)
+	  {
+	    struct grub_memdisk_chunked_header *head = (void *) memdisk_addr;
+
+	    if (!chunked_valid (memdisk_addr, memdisk_size))
+	      {
+		grub_printf ("memdisk: invalid compressed image\n");
+		grub_free (memdisk_addr);
+		memdisk_size = 0;
+		break;
+	      }
+	    memdisk_chunked = 1;
+	    memdisk_chunk_size = grub_le_to_cpu32 (head->chunk_size);
+	    memdisk_nchunks = grub_le_to_cpu64 (head->nchunks);
+	    memdisk_size = grub_le_to_cpu64 (head->size);
+	    grub_dprintf ("memdisk", "Compressed memdisk of %llu bytes\n",
+			  (unsigned long long) memdisk_size);
+	  }
+
 	grub_disk_dev_register (&grub_memdisk_dev);
 	break;
       }
@@ -113,4 +322,15 @@ GRUB_MOD_FINI(memdisk)
     return;
   grub_free (memdisk_addr);
   grub_disk_dev_unregister (&grub_memdisk_dev);
+  if (memdisk_chunked)
+    {
+      grub_uint64_t i;
+      unsigned j;
+
+      for (j = 0; j < MEMDISK_CACHE_SIZE; j++)
+	grub_free (memdisk_cache[j].data);
+      for (i = 0; memdisk_written && i < memdisk_nchunks; i++)
+	grub_free (memdisk_written[i]);
+      grub_free (memdisk_written);
+    }
 }
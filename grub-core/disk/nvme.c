@@ -0,0 +1,799 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/dl.h>
+#include <grub/disk.h>
+#include <grub/mm.h>
+#include <grub/time.h>
+#include <grub/pci.h>
+#include <grub/misc.h>
+#include <grub/list.h>
+#include <grub/loader.h>
+#include <grub/i18n.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+/* Submission queue entry.  */
+struct grub_nvme_sqe
+{
+  grub_uint32_t cdw0;
+  grub_uint32_t nsid;
+  grub_uint64_t reserved;
+  grub_uint64_t mptr;
+  grub_uint64_t prp1;
+  grub_uint64_t prp2;
+  grub_uint32_t cdw10;
+  grub_uint32_t cdw11;
+  grub_uint32_t cdw12;
+  grub_uint32_t cdw13;
+  grub_uint32_t cdw14;
+  grub_uint32_t cdw15;
+} GRUB_PACKED;
+
+/* Completion queue entry.  */
+struct grub_nvme_cqe
+{
+  grub_uint32_t dw0;
+  grub_uint32_t dw1;
+  grub_uint16_t sq_head;
+  grub_uint16_t sq_id;
+  grub_uint16_t cid;
+  grub_uint16_t status;
+} GRUB_PACKED;
+
+enum
+  {
+    GRUB_NVME_REG_CAP_LO = 0x00 / 4,
+    GRUB_NVME_REG_CAP_HI = 0x04 / 4,
+    GRUB_NVME_REG_CC = 0x14 / 4,
+    GRUB_NVME_REG_CSTS = 0x1c / 4,
+    GRUB_NVME_REG_AQA = 0x24 / 4,
+    GRUB_NVME_REG_ASQ_LO = 0x28 / 4,
+    GRUB_NVME_REG_ASQ_HI = 0x2c / 4,
+    GRUB_NVME_REG_ACQ_LO = 0x30 / 4,
+    GRUB_NVME_REG_ACQ_HI = 0x34 / 4,
+    GRUB_NVME_REG_DOORBELL = 0x1000 / 4
+  };
+
+#define GRUB_NVME_REGS_SIZE 0x2000
+
+enum
+  {
+    GRUB_NVME_CC_EN = 0x00000001,
+    GRUB_NVME_CC_IOSQES = 6 << 16,
+    GRUB_NVME_CC_IOCQES = 4 << 20
+  };
+
+enum
+  {
+    GRUB_NVME_CSTS_RDY = 0x00000001,
+    GRUB_NVME_CSTS_CFS = 0x00000002
+  };
+
+enum
+  {
+    GRUB_NVME_ADMIN_CREATE_SQ = 0x01,
+    GRUB_NVME_ADMIN_CREATE_CQ = 0x05,
+    GRUB_NVME_ADMIN_IDENTIFY = 0x06
+  };
+
+enum
+  {
+    GRUB_NVME_CMD_WRITE = 0x01,
+    GRUB_NVME_CMD_READ = 0x02
+  };
+
+#define GRUB_NVME_PAGE_BITS 12
+#define GRUB_NVME_PAGE_SIZE (1 << GRUB_NVME_PAGE_BITS)
+
+/* Entries in the admin and I/O queues.  The I/O queue is kept larger
+   than the number of commands in flight so it never fills.  */
+#define GRUB_NVME_ADMIN_QUEUE_SIZE 16
+#define GRUB_NVME_IO_QUEUE_SIZE 32
+
+/* Largest transfer of one command and number of commands kept in
+   flight at once.  Every command gets its own PRP list page and its own
+   slice of the bounce buffer.  */
+#define GRUB_NVME_MAX_TRANSFER (128 * 1024)
+#define GRUB_NVME_MAX_INFLIGHT 8
+#define GRUB_NVME_BUFFER_SIZE (GRUB_NVME_MAX_TRANSFER * GRUB_NVME_MAX_INFLIGHT)
+
+#define GRUB_NVME_MAX_NAMESPACES 16
+#define GRUB_NVME_COMMAND_TIMEOUT 10000
+
+struct grub_nvme_queue
+{
+  struct grub_pci_dma_chunk *sq_chunk;
+  struct grub_pci_dma_chunk *cq_chunk;
+  volatile struct grub_nvme_sqe *sq;
+  volatile struct grub_nvme_cqe *cq;
+  volatile grub_uint32_t *sq_doorbell;
+  volatile grub_uint32_t *cq_doorbell;
+  unsigned size;
+  unsigned sq_tail;
+  unsigned cq_head;
+  grub_uint16_t phase;
+};
+
+struct grub_nvme_ctrl
+{
+  struct grub_nvme_ctrl *next;
+  struct grub_nvme_ctrl **prev;
+  grub_pci_device_t pcidev;
+  volatile grub_uint32_t *regs;
+  unsigned doorbell_stride;
+  unsigned ready_timeout;
+  unsigned io_queue_size;
+  /* Commands kept in flight, below io_queue_size so the queue never
+     fills.  */
+  unsigned max_inflight;
+  grub_size_t max_transfer;
+  struct grub_nvme_queue admin;
+  struct grub_nvme_queue io;
+  struct grub_pci_dma_chunk *buffer_chunk;
+  struct grub_pci_dma_chunk *prp_chunk;
+  int enabled;
+};
+
+struct grub_nvme_ns
+{
+  struct grub_nvme_ns *next;
+  struct grub_nvme_ns **prev;
+  struct grub_nvme_ctrl *ctrl;
+  grub_uint32_t nsid;
+  int num;
+  grub_uint64_t size;
+  unsigned log_sector_size;
+};
+
+static struct grub_nvme_ctrl *grub_nvme_ctrls;
+static struct grub_nvme_ns *grub_nvme_namespaces;
+static int numdevs;
+
+static volatile grub_uint32_t *
+grub_nvme_doorbell (struct grub_nvme_ctrl *ctrl, unsigned qid, int cq)
+{
+  return ctrl->regs + GRUB_NVME_REG_DOORBELL
+    + ((2 * qid + (cq ? 1 : 0)) << ctrl->doorbell_stride);
+}
+
+static grub_err_t
+grub_nvme_wait_ready (struct grub_nvme_ctrl *ctrl, int ready)
+{
+  grub_uint64_t endtime;
+
+  endtime = grub_get_time_ms () + ctrl->ready_timeout;
+  while (!!(ctrl->regs[GRUB_NVME_REG_CSTS] & GRUB_NVME_CSTS_RDY) != ready)
+    {
+      if (ctrl->regs[GRUB_NVME_REG_CSTS] == 0xffffffff
+	  || grub_get_time_ms () > endtime)
+	return grub_error (GRUB_ERR_IO, "NVMe controller not %s",
+			   ready ? "ready" : "stopped");
+      grub_millisleep (1);
+    }
+  return GRUB_ERR_NONE;
+}
+
+static void
+grub_nvme_queue_free (struct grub_nvme_queue *q)
+{
+  if (q->sq_chunk)
+    grub_dma_free (q->sq_chunk);
+  if (q->cq_chunk)
+    grub_dma_free (q->cq_chunk);
+  q->sq_chunk = NULL;
+  q->cq_chunk = NULL;
+}
+
+static grub_err_t
+grub_nvme_queue_init (struct grub_nvme_ctrl *ctrl, struct grub_nvme_queue *q,
+		      unsigned qid, unsigned size)
+{
+  q->sq_chunk = grub_memalign_dma32 (GRUB_NVME_PAGE_SIZE,
+				     size * sizeof (struct grub_nvme_sqe));
+  q->cq_chunk = grub_memalign_dma32 (GRUB_NVME_PAGE_SIZE,
+				     size * sizeof (struct grub_nvme_cqe));
+  if (!q->sq_chunk || !q->cq_chunk)
+    {
+      grub_nvme_queue_free (q);
+      return grub_errno;
+    }
+
+  q->sq = grub_dma_get_virt (q->sq_chunk);
+  q->cq = grub_dma_get_virt (q->cq_chunk);
+  grub_memset ((void *) q->sq, 0, size * sizeof (struct grub_nvme_sqe));
+  grub_memset ((void *) q->cq, 0, size * sizeof (struct grub_nvme_cqe));
+  q->sq_doorbell = grub_nvme_doorbell (ctrl, qid, 0);
+  q->cq_doorbell = grub_nvme_doorbell (ctrl, qid, 1);
+  q->size = size;
+  q->sq_tail = 0;
+  q->cq_head = 0;
+  q->phase = 1;
+  return GRUB_ERR_NONE;
+}
+
+/* Queue a command without ringing the doorbell.  */
+static void
+grub_nvme_queue_cmd (struct grub_nvme_queue *q, struct grub_nvme_sqe *cmd)
+{
+  cmd->cdw0 = (cmd->cdw0 & 0xffff) | (q->sq_tail << 16);
+  grub_memcpy ((void *) &q->sq[q->sq_tail], cmd, sizeof (*cmd));
+  q->sq_tail = (q->sq_tail + 1) % q->size;
+}
+
+/* Ring the doorbell and wait for COUNT completions.  All of them are
+   reaped even when one fails, so the queue stays consistent.  */
+static grub_err_t
+grub_nvme_queue_run (struct grub_nvme_queue *q, unsigned count)
+{
+  grub_uint64_t endtime;
+  grub_uint16_t failed = 0;
+
+  *q->sq_doorbell = q->sq_tail;
+
+  endtime = grub_get_time_ms () + GRUB_NVME_COMMAND_TIMEOUT;
+  while (count)
+    {
+      volatile struct grub_nvme_cqe *cqe = &q->cq[q->cq_head];
+      grub_uint16_t status = cqe->status;
+
+      if ((status & 1) != q->phase)
+	{
+	  if (grub_get_time_ms () > endtime)
+	    return grub_error (GRUB_ERR_IO, "NVMe command timed out");
+	  continue;
+	}
+
+      if (status >> 1)
+	{
+	  grub_dprintf ("nvme", "command %x failed with status %x\n",
+			cqe->cid, status >> 1);
+	  failed = status >> 1;
+	}
+
+      q->cq_head++;
+      if (q->cq_head == q->size)
+	{
+	  q->cq_head = 0;
+	  q->phase ^= 1;
+	}
+      count--;
+    }
+
+  *q->cq_doorbell = q->cq_head;
+
+  if (failed)
+    return grub_error (GRUB_ERR_IO, "NVMe command failed with status 0x%x",
+		       failed);
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+grub_nvme_admin (struct grub_nvme_ctrl *ctrl, struct grub_nvme_sqe *cmd)
+{
+  grub_nvme_queue_cmd (&ctrl->admin, cmd);
+  return grub_nvme_queue_run (&ctrl->admin, 1);
+}
+
+/* Identify into the start of the bounce buffer.  */
+static grub_err_t
+grub_nvme_identify (struct grub_nvme_ctrl *ctrl, grub_uint32_t nsid,
+		    grub_uint32_t cns)
+{
+  struct grub_nvme_sqe cmd;
+
+  grub_memset (&cmd, 0, sizeof (cmd));
+  cmd.cdw0 = GRUB_NVME_ADMIN_IDENTIFY;
+  cmd.nsid = nsid;
+  cmd.prp1 = grub_dma_get_phys (ctrl->buffer_chunk);
+  cmd.cdw10 = cns;
+  return grub_nvme_admin (ctrl, &cmd);
+}
+
+static void
+grub_nvme_free_hw (struct grub_nvme_ctrl *ctrl)
+{
+  grub_nvme_queue_free (&ctrl->admin);
+  grub_nvme_queue_free (&ctrl->io);
+  if (ctrl->buffer_chunk)
+    grub_dma_free (ctrl->buffer_chunk);
+  if (ctrl->prp_chunk)
+    grub_dma_free (ctrl->prp_chunk);
+  ctrl->buffer_chunk = NULL;
+  ctrl->prp_chunk = NULL;
+}
+
+static void
+grub_nvme_disable (struct grub_nvme_ctrl *ctrl)
+{
+  ctrl->enabled = 0;
+  ctrl->regs[GRUB_NVME_REG_CC] &= ~GRUB_NVME_CC_EN;
+  if (grub_nvme_wait_ready (ctrl, 0))
+    {
+      grub_dprintf ("nvme", "couldn't stop controller\n");
+      grub_errno = GRUB_ERR_NONE;
+    }
+}
+
+/* Reset the controller and set up the admin queue and one I/O queue
+   pair.  */
+static grub_err_t
+grub_nvme_enable (struct grub_nvme_ctrl *ctrl)
+{
+  struct grub_nvme_sqe cmd;
+  grub_uint32_t phys;
+
+  if (ctrl->regs[GRUB_NVME_REG_CC] & GRUB_NVME_CC_EN)
+    grub_nvme_disable (ctrl);
+  grub_nvme_free_hw (ctrl);
+
+  ctrl->buffer_chunk = grub_memalign_dma32 (GRUB_NVME_PAGE_SIZE,
+					    GRUB_NVME_BUFFER_SIZE);
+  ctrl->prp_chunk = grub_memalign_dma32 (GRUB_NVME_PAGE_SIZE,
+					 GRUB_NVME_MAX_INFLIGHT
+					 * GRUB_NVME_PAGE_SIZE);
+  if (!ctrl->buffer_chunk || !ctrl->prp_chunk)
+    goto fail;
+
+  if (grub_nvme_queue_init (ctrl, &ctrl->admin, 0,
+			    GRUB_NVME_ADMIN_QUEUE_SIZE)
+      || grub_nvme_queue_init (ctrl, &ctrl->io, 1, ctrl->io_queue_size))
+    goto fail;
+
+  ctrl->regs[GRUB_NVME_REG_AQA] = ((GRUB_NVME_ADMIN_QUEUE_SIZE - 1) << 16)
+    | (GRUB_NVME_ADMIN_QUEUE_SIZE - 1);
+  ctrl->regs[GRUB_NVME_REG_ASQ_LO] = grub_dma_get_phys (ctrl->admin.sq_chunk);
+  ctrl->regs[GRUB_NVME_REG_ASQ_HI] = 0;
+  ctrl->regs[GRUB_NVME_REG_ACQ_LO] = grub_dma_get_phys (ctrl->admin.cq_chunk);
+  ctrl->regs[GRUB_NVME_REG_ACQ_HI] = 0;
+
+  ctrl->regs[GRUB_NVME_REG_CC] = GRUB_NVME_CC_EN | GRUB_NVME_CC_IOSQES
+    | GRUB_NVME_CC_IOCQES;
+  if (grub_nvme_wait_ready (ctrl, 1))
+    goto fail;
+
+  phys = grub_dma_get_phys (ctrl->io.cq_chunk);
+  grub_memset (&cmd, 0, sizeof (cmd));
+  cmd.cdw0 = GRUB_NVME_ADMIN_CREATE_CQ;
+  cmd.prp1 = phys;
+  /* Queue 1, physically contiguous, interrupts disabled.  */
+  cmd.cdw10 = ((ctrl->io.size - 1) << 16) | 1;
+  cmd.cdw11 = 1;
+  if (grub_nvme_admin (ctrl, &cmd))
+    goto fail;
+
+  phys = grub_dma_get_phys (ctrl->io.sq_chunk);
+  grub_memset (&cmd, 0, sizeof (cmd));
+  cmd.cdw0 = GRUB_NVME_ADMIN_CREATE_SQ;
+  cmd.prp1 = phys;
+  cmd.cdw10 = ((ctrl->io.size - 1) << 16) | 1;
+  cmd.cdw11 = (1 << 16) | 1;
+  if (grub_nvme_admin (ctrl, &cmd))
+    goto fail;
+
+  ctrl->enabled = 1;
+  return GRUB_ERR_NONE;
+
+ fail:
+  if (!grub_errno)
+    grub_error (GRUB_ERR_OUT_OF_MEMORY, N_("out of memory"));
+  grub_nvme_disable (ctrl);
+  grub_nvme_free_hw (ctrl);
+  return grub_errno;
+}
+
+static void
+grub_nvme_scan_namespaces (struct grub_nvme_ctrl *ctrl)
+{
+  volatile grub_uint8_t *id = grub_dma_get_virt (ctrl->buffer_chunk);
+  grub_uint32_t nn, nsid;
+  grub_uint8_t mdts;
+
+  if (grub_nvme_identify (ctrl, 0, 1))
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+
+  mdts = id[77];
+  if (mdts && mdts < 20
+      && (GRUB_NVME_PAGE_SIZE << mdts) < GRUB_NVME_MAX_TRANSFER)
+    ctrl->max_transfer = GRUB_NVME_PAGE_SIZE << mdts;
+
+  nn = grub_le_to_cpu32 (*(volatile grub_uint32_t *) (id + 516));
+  if (nn > GRUB_NVME_MAX_NAMESPACES)
+    nn = GRUB_NVME_MAX_NAMESPACES;
+
+  grub_dprintf ("nvme", "%u namespaces, max transfer %u\n",
+		nn, (unsigned) ctrl->max_transfer);
+
+  for (nsid = 1; nsid <= nn; nsid++)
+    {
+      struct grub_nvme_ns *ns;
+      grub_uint64_t nsze;
+      grub_uint32_t lbaf;
+      unsigned lbads;
+
+      if (grub_nvme_identify (ctrl, nsid, 0))
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  continue;
+	}
+
+      nsze = grub_le_to_cpu64 (*(volatile grub_uint64_t *) id);
+      lbaf = grub_le_to_cpu32 (*(volatile grub_uint32_t *)
+			       (id + 128 + 4 * (id[26] & 0xf)));
+      lbads = (lbaf >> 16) & 0xff;
+
+      /* Inactive namespaces report zero size.  Skip formats with
+	 metadata, which would need bigger than block-sized buffers.  */
+      if (nsze == 0 || (lbaf & 0xffff) != 0
+	  || lbads < GRUB_DISK_SECTOR_BITS || lbads > GRUB_NVME_PAGE_BITS)
+	continue;
+
+      ns = grub_zalloc (sizeof (*ns));
+      if (!ns)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  return;
+	}
+      ns->ctrl = ctrl;
+      ns->nsid = nsid;
+      ns->num = numdevs++;
+      ns->size = nsze;
+      ns->log_sector_size = lbads;
+      grub_dprintf ("nvme", "nvme%d: nsid %u, %llu sectors of %u bytes\n",
+		    ns->num, nsid, (unsigned long long) nsze, 1U << lbads);
+      grub_list_push (GRUB_AS_LIST_P (&grub_nvme_namespaces),
+		      GRUB_AS_LIST (ns));
+    }
+}
+
+static int
+grub_nvme_pciinit (grub_pci_device_t dev,
+		   grub_pci_id_t pciid __attribute__ ((unused)),
+		   void *data __attribute__ ((unused)))
+{
+  grub_pci_address_t addr;
+  grub_uint32_t class;
+  grub_uint32_t bar, cap_lo, cap_hi;
+  grub_uint64_t base;
+  struct grub_nvme_ctrl *ctrl;
+  unsigned mqes;
+
+  addr = grub_pci_make_address (dev, GRUB_PCI_REG_CLASS);
+  class = grub_pci_read (addr);
+
+  /* Mass storage, non-volatile memory, NVM Express.  */
+  if (class >> 8 != 0x010802)
+    return 0;
+
+  addr = grub_pci_make_address (dev, GRUB_PCI_REG_ADDRESS_REG0);
+  bar = grub_pci_read (addr);
+  if ((bar & GRUB_PCI_ADDR_SPACE_MASK) != GRUB_PCI_ADDR_SPACE_MEMORY)
+    return 0;
+  base = bar & GRUB_PCI_ADDR_MEM_MASK;
+  if ((bar & GRUB_PCI_ADDR_MEM_TYPE_MASK) == GRUB_PCI_ADDR_MEM_TYPE_64)
+    {
+      addr = grub_pci_make_address (dev, GRUB_PCI_REG_ADDRESS_REG1);
+      base |= ((grub_uint64_t) grub_pci_read (addr)) << 32;
+    }
+#if GRUB_CPU_SIZEOF_VOID_P == 4
+  if (base >> 32)
+    {
+      grub_dprintf ("nvme", "BAR above 4G, skipping %x:%x.%x\n",
+		    dev.bus, dev.device, dev.function);
+      return 0;
+    }
+#endif
+
+  addr = grub_pci_make_address (dev, GRUB_PCI_REG_COMMAND);
+  grub_pci_write_word (addr, grub_pci_read_word (addr)
+		    | GRUB_PCI_COMMAND_MEM_ENABLED | GRUB_PCI_COMMAND_BUS_MASTER);
+
+  ctrl = grub_zalloc (sizeof (*ctrl));
+  if (!ctrl)
+    return 1;
+  ctrl->pcidev = dev;
+  ctrl->regs = grub_pci_device_map_range (dev, (grub_addr_t) base,
+					  GRUB_NVME_REGS_SIZE);
+
+  cap_lo = ctrl->regs[GRUB_NVME_REG_CAP_LO];
+  cap_hi = ctrl->regs[GRUB_NVME_REG_CAP_HI];
+  grub_dprintf ("nvme", "dev: %x:%x.%x cap: %08x%08x\n",
+		dev.bus, dev.device, dev.function, cap_hi, cap_lo);
+
+  /* Only 4K memory pages are used.  */
+  if ((cap_hi >> 16) & 0xf)
+    {
+      grub_dprintf ("nvme", "unsupported minimum page size\n");
+      grub_free (ctrl);
+      return 0;
+    }
+
+  mqes = (cap_lo & 0xffff) + 1;
+  ctrl->io_queue_size = GRUB_NVME_IO_QUEUE_SIZE;
+  if (ctrl->io_queue_size > mqes)
+    ctrl->io_queue_size = mqes;
+  ctrl->max_inflight = GRUB_NVME_MAX_INFLIGHT;
+  if (ctrl->max_inflight > ctrl->io_queue_size - 1)
+    ctrl->max_inflight = ctrl->io_queue_size - 1;
+  ctrl->doorbell_stride = cap_hi & 0xf;
+  ctrl->ready_timeout = ((cap_lo >> 24) & 0xff) * 500;
+  if (ctrl->ready_timeout < 500)
+    ctrl->ready_timeout = 500;
+  ctrl->max_transfer = GRUB_NVME_MAX_TRANSFER;
+
+  if (grub_nvme_enable (ctrl))
+    {
+      grub_dprintf ("nvme", "couldn't enable controller: %s\n", grub_errmsg);
+      grub_errno = GRUB_ERR_NONE;
+      grub_free (ctrl);
+      return 0;
+    }
+
+  grub_list_push (GRUB_AS_LIST_P (&grub_nvme_ctrls), GRUB_AS_LIST (ctrl));
+  grub_nvme_scan_namespaces (ctrl);
+
+  return 0;
+}
+
+static grub_err_t
+grub_nvme_initialize (void)
+{
+  grub_pci_iterate (grub_nvme_pciinit, NULL);
+  return grub_errno;
+}
+
+static grub_err_t
+grub_nvme_fini_hw (int noreturn __attribute__ ((unused)))
+{
+  struct grub_nvme_ctrl *ctrl;
+
+  FOR_LIST_ELEMENTS (ctrl, grub_nvme_ctrls)
+    {
+      grub_nvme_disable (ctrl);
+      grub_nvme_free_hw (ctrl);
+    }
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+grub_nvme_restore_hw (void)
+{
+  struct grub_nvme_ctrl *ctrl;
+
+  FOR_LIST_ELEMENTS (ctrl, grub_nvme_ctrls)
+    if (grub_nvme_enable (ctrl))
+      {
+	grub_dprintf ("nvme", "couldn't restore controller: %s\n",
+		      grub_errmsg);
+	grub_errno = GRUB_ERR_NONE;
+      }
+  return GRUB_ERR_NONE;
+}
+
+/* Transfer SIZE native sectors.  The request is cut into commands of at
+   most max_transfer bytes and up to max_inflight of them are
+   submitted with a single doorbell write before waiting for any.  */
+static grub_err_t
+grub_nvme_readwrite (struct grub_nvme_ns *ns, grub_disk_addr_t sector,
+		     grub_size_t size, char *buf, int is_write)
+{
+  struct grub_nvme_ctrl *ctrl = ns->ctrl;
+  grub_uint8_t *bounce;
+  volatile grub_uint64_t *prp_lists;
+  grub_uint32_t bounce_phys, prp_phys;
+  grub_size_t per_cmd = ctrl->max_transfer >> ns->log_sector_size;
+
+  if (!ctrl->enabled)
+    return grub_error (GRUB_ERR_IO, "NVMe controller is not running");
+
+  bounce = (grub_uint8_t *) grub_dma_get_virt (ctrl->buffer_chunk);
+  bounce_phys = grub_dma_get_phys (ctrl->buffer_chunk);
+  prp_lists = grub_dma_get_virt (ctrl->prp_chunk);
+  prp_phys = grub_dma_get_phys (ctrl->prp_chunk);
+
+  while (size)
+    {
+      grub_size_t batch = 0;
+      unsigned ncmds;
+      grub_err_t err;
+
+      if (is_write)
+	{
+	  batch = size;
+	  if (batch > (ctrl->max_inflight * per_cmd))
+	    batch = ctrl->max_inflight * per_cmd;
+	  grub_memcpy (bounce, buf, batch << ns->log_sector_size);
+	  batch = 0;
+	}
+
+      for (ncmds = 0; ncmds < ctrl->max_inflight && batch < size; ncmds++)
+	{
+	  struct grub_nvme_sqe cmd;
+	  grub_size_t count = size - batch;
+	  grub_uint32_t data = bounce_phys + (batch << ns->log_sector_size);
+	  grub_size_t bytes, npages, i;
+
+	  if (count > per_cmd)
+	    count = per_cmd;
+	  bytes = count << ns->log_sector_size;
+	  npages = (bytes + GRUB_NVME_PAGE_SIZE - 1) >> GRUB_NVME_PAGE_BITS;
+
+	  grub_memset (&cmd, 0, sizeof (cmd));
+	  cmd.cdw0 = is_write ? GRUB_NVME_CMD_WRITE : GRUB_NVME_CMD_READ;
+	  cmd.nsid = ns->nsid;
+	  cmd.prp1 = data;
+	  if (npages == 2)
+	    cmd.prp2 = data + GRUB_NVME_PAGE_SIZE;
+	  else if (npages > 2)
+	    {
+	      volatile grub_uint64_t *list
+		= prp_lists + ncmds * (GRUB_NVME_PAGE_SIZE / 8);
+
+	      for (i = 1; i < npages; i++)
+		list[i - 1] = data + (i << GRUB_NVME_PAGE_BITS);
+	      cmd.prp2 = prp_phys + ncmds * GRUB_NVME_PAGE_SIZE;
+	    }
+	  cmd.cdw10 = (sector + batch) & 0xffffffff;
+	  cmd.cdw11 = (sector + batch) >> 32;
+	  cmd.cdw12 = count - 1;
+
+	  grub_nvme_queue_cmd (&ctrl->io, &cmd);
+	  batch += count;
+	}
+
+      err = grub_nvme_queue_run (&ctrl->io, ncmds);
+      if (err)
+	{
+	  grub_dprintf ("nvme", "%s\n", grub_errmsg);
+	  grub_errno = GRUB_ERR_NONE;
+	  /* The queue state is unknown after a timeout, start over.  */
+	  if (grub_nvme_enable (ctrl))
+	    grub_errno = GRUB_ERR_NONE;
+	  return grub_error (GRUB_ERR_IO, "NVMe %s failed at sector 0x%llx",
+			     is_write ? "write" : "read",
+			     (unsigned long long) sector);
+	}
+
+      if (!is_write)
+	grub_memcpy (buf, bounce, batch << ns->log_sector_size);
+
+      buf += batch << ns->log_sector_size;
+      sector += batch;
+      size -= batch;
+    }
+
+  return GRUB_ERR_NONE;
+}
+
+static int
+grub_nvme_iterate (grub_disk_dev_iterate_hook_t hook, void *hook_data,
+		   grub_disk_pull_t pull)
+{
+  struct grub_nvme_ns *ns;
+  char devname[40];
+
+  if (pull != GRUB_DISK_PULL_NONE)
+    return 0;
+
+  FOR_LIST_ELEMENTS (ns, grub_nvme_namespaces)
+    {
+      grub_snprintf (devname, sizeof (devname), "nvme%d", ns->num);
+      if (hook (devname, hook_data))
+	return 1;
+    }
+
+  return 0;
+}
+
+static grub_err_t
+grub_nvme_open (const char *name, grub_disk_t disk)
+{
+  struct grub_nvme_ns *ns;
+  int num;
+
+  if (grub_strncmp (name, "nvme", sizeof ("nvme") - 1) != 0
+      || !grub_isdigit (name[sizeof ("nvme") - 1]))
+    return grub_error (GRUB_ERR_UNKNOWN_DEVICE, "not an NVMe disk");
+  num = grub_strtoul (name + sizeof ("nvme") - 1, 0, 0);
+
+  FOR_LIST_ELEMENTS (ns, grub_nvme_namespaces)
+    if (ns->num == num)
+      break;
+  if (!ns)
+    return grub_error (GRUB_ERR_UNKNOWN_DEVICE, "no such NVMe disk");
+
+  disk->total_sectors = ns->size;
+  disk->log_sector_size = ns->log_sector_size;
+  /* Let one call fill all the commands of a batch.  */
+  disk->max_agglomerate = (ns->ctrl->max_inflight * ns->ctrl->max_transfer)
+    >> (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS);
+  disk->id = ns->num;
+  disk->data = ns;
+
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+grub_nvme_read (grub_disk_t disk, grub_disk_addr_t sector,
+		grub_size_t size, char *buf)
+{
+  return grub_nvme_readwrite (disk->data, sector, size, buf, 0);
+}
+
+static grub_err_t
+grub_nvme_readv (grub_disk_t disk, const struct grub_disk_iovec *iov,
+		 unsigned iovcnt)
+{
+  return grub_disk_readv_merge (disk, iov, iovcnt, grub_nvme_read);
+}
+
+static grub_err_t
+grub_nvme_write (grub_disk_t disk, grub_disk_addr_t sector,
+		 grub_size_t size, const char *buf)
+{
+  return grub_nvme_readwrite (disk->data, sector, size, (char *) buf, 1);
+}
+
+static struct grub_disk_dev grub_nvme_dev =
+  {
+    .name = "nvme",
+    .id = GRUB_DISK_DEVICE_NVME_ID,
+    .disk_iterate = grub_nvme_iterate,
+    .disk_open = grub_nvme_open,
+    .disk_read = grub_nvme_read,
+    .disk_write = grub_nvme_write,
+    .disk_readv = grub_nvme_readv,
+    .next = 0
+  };
+
+static struct grub_preboot *fini_hnd;
+
+GRUB_MOD_INIT(nvme)
+{
+  grub_stop_disk_firmware ();
+
+  grub_nvme_initialize ();
+  grub_errno = GRUB_ERR_NONE;
+
+  grub_disk_dev_register (&grub_nvme_dev);
+
+  fini_hnd = grub_loader_register_preboot_hook (grub_nvme_fini_hw,
+						grub_nvme_restore_hw,
+						GRUB_LOADER_PREBOOT_HOOK_PRIO_DISK);
+}
+
+GRUB_MOD_FINI(nvme)
+{
+  struct grub_nvme_ns *ns, *nns;
+  struct grub_nvme_ctrl *ctrl, *nctrl;
+
+  grub_nvme_fini_hw (0);
+  grub_loader_unregister_preboot_hook (fini_hnd);
+
+  grub_disk_dev_unregister (&grub_nvme_dev);
+
+  FOR_LIST_ELEMENTS_SAFE (ns, nns, grub_nvme_namespaces)
+    grub_free (ns);
+  FOR_LIST_ELEMENTS_SAFE (ctrl, nctrl, grub_nvme_ctrls)
+    grub_free (ctrl);
+  grub_nvme_namespaces = NULL;
+  grub_nvme_ctrls = NULL;
+}
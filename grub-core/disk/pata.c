@@ -36,6 +36,38 @@ GRUB_MOD_LICENSE ("GPLv3+");
 static const grub_port_t grub_pata_ioaddress[] = { GRUB_ATA_CH0_PORT1,
 						   GRUB_ATA_CH1_PORT1 };
 
+/* Bus master IDE registers, per channel.  */
+enum
+  {
+    GRUB_PATA_BM_COMMAND = 0,
+    GRUB_PATA_BM_STATUS = 2,
+    GRUB_PATA_BM_PRDT = 4,
+    GRUB_PATA_BM_CHANNEL_SIZE = 8
+  };
+
+#define GRUB_PATA_BM_COMMAND_START	0x01
+/* The bus master writes to memory, the device is read.  */
+#define GRUB_PATA_BM_COMMAND_READ	0x08
+
+#define GRUB_PATA_BM_STATUS_ACTIVE	0x01
+#define GRUB_PATA_BM_STATUS_ERROR	0x02
+#define GRUB_PATA_BM_STATUS_INTERRUPT	0x04
+/* Set by the firmware for each device it set up a DMA mode for.  */
+#define GRUB_PATA_BM_STATUS_DMA_CAPABLE(device) (0x20 << (device))
+
+#define GRUB_PATA_PRD_EOT	0x8000
+/* A region may not cross a 64 KiB boundary.  */
+#define GRUB_PATA_PRD_MAX	0x10000
+
+#define GRUB_PATA_DMA_BUFFER_SIZE	(256 * 512)
+
+struct grub_pata_prd
+{
+  grub_uint32_t addr;
+  grub_uint16_t size;
+  grub_uint16_t flags;
+} GRUB_PACKED;
+
 struct grub_pata_device
 {
   /* IDE port to use.  */
@@ -52,6 +84,14 @@ struct grub_pata_device
 
   int present;
 
+  /* Bus master registers of the channel, 0 for PIO only.  */
+  grub_port_t bmaddress;
+
+  /* PRD table and the buffer the device transfers to, allocated on
+     first use.  */
+  struct grub_pci_dma_chunk *prdt_chunk;
+  struct grub_pci_dma_chunk *buffer_chunk;
+
   struct grub_pata_device *next;
 };
 
@@ -146,6 +186,109 @@ grub_pata_pio_write (struct grub_pata_device *dev, char *buf, grub_size_t size)
     grub_outw(grub_cpu_to_ata16 (grub_get_unaligned16 (buf + 2 * i)), dev->ioaddress + GRUB_ATA_REG_DATA);
 }
 
+#ifndef GRUB_MACHINE_MIPS_QEMU_MIPS
+/* Run a DMA data command, with the data going through the DMA buffer:
+   one command and a few register accesses instead of a port access per
+   word.  */
+static grub_err_t
+grub_pata_dma_readwrite (struct grub_pata_device *dev,
+			 struct grub_disk_ata_pass_through_parms *parms,
+			 int spinup)
+{
+  volatile struct grub_pata_prd *prd;
+  grub_uint32_t phys;
+  grub_size_t done;
+  grub_uint8_t bmsts = 0;
+  grub_uint64_t endtime;
+  int i;
+
+  prd = grub_dma_get_virt (dev->prdt_chunk);
+  phys = grub_dma_get_phys (dev->buffer_chunk);
+  for (done = 0; done < parms->size; done += GRUB_PATA_PRD_MAX, prd++)
+    {
+      grub_size_t cur = grub_min (parms->size - done, GRUB_PATA_PRD_MAX);
+
+      prd->addr = grub_cpu_to_le32 (phys + done);
+      /* 0 stands for 64 KiB.  */
+      prd->size = grub_cpu_to_le16 (cur & 0xffff);
+      prd->flags = (done + cur >= parms->size)
+	? grub_cpu_to_le16_compile_time (GRUB_PATA_PRD_EOT) : 0;
+    }
+
+  if (parms->write)
+    grub_memcpy ((char *) grub_dma_get_virt (dev->buffer_chunk),
+		 parms->buffer, parms->size);
+
+  grub_outb (parms->write ? 0 : GRUB_PATA_BM_COMMAND_READ,
+	     dev->bmaddress + GRUB_PATA_BM_COMMAND);
+  grub_outl (grub_dma_get_phys (dev->prdt_chunk),
+	     dev->bmaddress + GRUB_PATA_BM_PRDT);
+  grub_outb (grub_inb (dev->bmaddress + GRUB_PATA_BM_STATUS)
+	     | GRUB_PATA_BM_STATUS_ERROR | GRUB_PATA_BM_STATUS_INTERRUPT,
+	     dev->bmaddress + GRUB_PATA_BM_STATUS);
+
+  grub_pata_regset (dev, GRUB_ATA_REG_DISK, (dev->device << 4)
+		    | (parms->taskfile.disk & 0xef));
+  if (grub_pata_check_ready (dev, spinup))
+    return grub_errno;
+
+  for (i = GRUB_ATA_REG_SECTORS; i <= GRUB_ATA_REG_LBAHIGH; i++)
+    grub_pata_regset (dev, i,
+		     parms->taskfile.raw[7 + (i - GRUB_ATA_REG_SECTORS)]);
+  for (i = GRUB_ATA_REG_FEATURES; i <= GRUB_ATA_REG_LBAHIGH; i++)
+    grub_pata_regset (dev, i, parms->taskfile.raw[i - GRUB_ATA_REG_FEATURES]);
+
+  grub_pata_regset (dev, GRUB_ATA_REG_CMD, parms->taskfile.cmd);
+  grub_outb ((parms->write ? 0 : GRUB_PATA_BM_COMMAND_READ)
+	     | GRUB_PATA_BM_COMMAND_START,
+	     dev->bmaddress + GRUB_PATA_BM_COMMAND);
+
+  /* The transfer is over when the device raises its interrupt, or the
+     bus master stops on an error.  */
+  endtime = grub_get_time_ms () + GRUB_ATA_TOUT_DATA;
+  while (1)
+    {
+      bmsts = grub_inb (dev->bmaddress + GRUB_PATA_BM_STATUS);
+      if ((bmsts & (GRUB_PATA_BM_STATUS_INTERRUPT | GRUB_PATA_BM_STATUS_ERROR))
+	  || !(bmsts & GRUB_PATA_BM_STATUS_ACTIVE))
+	break;
+      if (grub_get_time_ms () > endtime)
+	break;
+      grub_cpu_idle ();
+    }
+
+  grub_outb (parms->write ? 0 : GRUB_PATA_BM_COMMAND_READ,
+	     dev->bmaddress + GRUB_PATA_BM_COMMAND);
+  grub_outb (bmsts | GRUB_PATA_BM_STATUS_ERROR | GRUB_PATA_BM_STATUS_INTERRUPT,
+	     dev->bmaddress + GRUB_PATA_BM_STATUS);
+
+  if (grub_pata_wait_not_busy (dev, GRUB_ATA_TOUT_DATA))
+    return grub_errno;
+
+  /* Return registers.  */
+  for (i = GRUB_ATA_REG_ERROR; i <= GRUB_ATA_REG_STATUS; i++)
+    parms->taskfile.raw[i - GRUB_ATA_REG_FEATURES] = grub_pata_regget (dev, i);
+
+  grub_dprintf ("pata", "DMA bmstatus=0x%x, status=0x%x, error=0x%x\n",
+		bmsts, parms->taskfile.status, parms->taskfile.error);
+
+  if ((bmsts & GRUB_PATA_BM_STATUS_ERROR)
+      || (parms->taskfile.status
+	  & (GRUB_ATA_STATUS_DRQ | GRUB_ATA_STATUS_ERR)))
+    return grub_error (parms->write ? GRUB_ERR_WRITE_ERROR
+		       : GRUB_ERR_READ_ERROR, "PATA DMA transfer failed");
+  if (!(bmsts & GRUB_PATA_BM_STATUS_INTERRUPT)
+      && (bmsts & GRUB_PATA_BM_STATUS_ACTIVE))
+    return grub_error (GRUB_ERR_TIMEOUT, "PATA DMA timeout");
+
+  if (!parms->write)
+    grub_memcpy (parms->buffer,
+		 (char *) grub_dma_get_virt (dev->buffer_chunk), parms->size);
+
+  return GRUB_ERR_NONE;
+}
+#endif
+
 /* ATA pass through support, used by hdparm.mod.  */
 static grub_err_t
 grub_pata_readwrite (struct grub_ata *disk,
@@ -156,6 +299,12 @@ grub_pata_readwrite (struct grub_ata *disk,
   grub_size_t nread = 0;
   int i;
 
+#ifndef GRUB_MACHINE_MIPS_QEMU_MIPS
+  if (parms->dma && dev->buffer_chunk && !parms->cmdsize
+      && parms->size && parms->size <= GRUB_PATA_DMA_BUFFER_SIZE)
+    return grub_pata_dma_readwrite (dev, parms, spinup);
+#endif
+
   if (! (parms->cmdsize == 0 || parms->cmdsize == 12))
     return grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
 		       "ATAPI non-12 byte commands not supported");
@@ -306,7 +455,7 @@ check_device (struct grub_pata_device *dev)
 }
 
 static grub_err_t
-grub_pata_device_initialize (int port, int device, int addr)
+grub_pata_device_initialize (int port, int device, int addr, int bmaddr)
 {
   struct grub_pata_device *dev;
   struct grub_pata_device **devp;
@@ -324,8 +473,22 @@ grub_pata_device_initialize (int port, int device, int addr)
   dev->device = device;
   dev->ioaddress = addr + GRUB_MACHINE_PCI_IO_BASE;
   dev->present = 1;
+  dev->bmaddress = 0;
+  dev->prdt_chunk = NULL;
+  dev->buffer_chunk = NULL;
   dev->next = NULL;
 
+#ifndef GRUB_MACHINE_MIPS_QEMU_MIPS
+  /* Only use DMA where the firmware has set up a DMA mode, as GRUB
+     does not program the timings.  */
+  if (bmaddr
+      && (grub_inb (bmaddr + GRUB_MACHINE_PCI_IO_BASE + GRUB_PATA_BM_STATUS)
+	  & GRUB_PATA_BM_STATUS_DMA_CAPABLE (device)))
+    dev->bmaddress = bmaddr + GRUB_MACHINE_PCI_IO_BASE;
+#else
+  (void) bmaddr;
+#endif
+
   /* Register the device.  */
   for (devp = &grub_pata_devices; *devp; devp = &(*devp)->next);
   *devp = dev;
@@ -354,7 +517,9 @@ grub_pata_pciinit (grub_pci_device_t dev,
   grub_uint32_t class;
   grub_uint32_t bar1;
   grub_uint32_t bar2;
+  grub_uint32_t bar4;
   int rega;
+  int bmbase = 0;
   int i;
   static int controller = 0;
   int cs5536 = 0;
@@ -375,6 +540,21 @@ grub_pata_pciinit (grub_pci_device_t dev,
   if (!cs5536 && (class >> 16 != 0x0101))
     return 0;
 
+  /* A bus master capable controller has its registers in BAR 4.  */
+  if (!cs5536 && (class & 0x8000))
+    {
+      addr = grub_pci_make_address (dev, GRUB_PCI_REG_ADDRESS_REG4);
+      bar4 = grub_pci_read (addr);
+      if ((bar4 & 1) && (bar4 & ~3))
+	{
+	  bmbase = bar4 & ~3;
+	  addr = grub_pci_make_address (dev, GRUB_PCI_REG_COMMAND);
+	  grub_pci_write_word (addr, grub_pci_read_word (addr)
+			       | GRUB_PCI_COMMAND_IO_ENABLED
+			       | GRUB_PCI_COMMAND_BUS_MASTER);
+	}
+    }
+
   for (i = 0; i < nports; i++)
     {
       /* Set to 0 when the channel operated in compatibility mode.  */
@@ -427,8 +607,10 @@ grub_pata_pciinit (grub_pci_device_t dev,
 
       if (rega)
 	{
+	  int bmaddr = bmbase ? bmbase + GRUB_PATA_BM_CHANNEL_SIZE * i : 0;
+
 	  grub_errno = GRUB_ERR_NONE;
-	  grub_pata_device_initialize (controller * 2 + i, 0, rega);
+	  grub_pata_device_initialize (controller * 2 + i, 0, rega, bmaddr);
 
 	  /* Most errors raised by grub_ata_device_initialize() are harmless.
 	     They just indicate this particular drive is not responding, most
@@ -440,7 +622,7 @@ grub_pata_pciinit (grub_pci_device_t dev,
 	      grub_errno = GRUB_ERR_NONE;
 	    }
 
-	  grub_pata_device_initialize (controller * 2 + i, 1, rega);
+	  grub_pata_device_initialize (controller * 2 + i, 1, rega, bmaddr);
 
 	  /* Likewise.  */
 	  if (grub_errno)
@@ -469,8 +651,8 @@ grub_pata_initialize (void)
   int i;
   for (i = 0; i < 2; i++)
     {
-      grub_pata_device_initialize (i, 0, grub_pata_ioaddress[i]);
-      grub_pata_device_initialize (i, 1, grub_pata_ioaddress[i]);
+      grub_pata_device_initialize (i, 0, grub_pata_ioaddress[i], 0);
+      grub_pata_device_initialize (i, 1, grub_pata_ioaddress[i], 0);
     }
   return 0;
 }
@@ -504,8 +686,30 @@ grub_pata_open (int id, int devnum, struct grub_ata *ata)
   if (err)
     return err;
 
+#ifndef GRUB_MACHINE_MIPS_QEMU_MIPS
+  if (devfnd->bmaddress && !devfnd->buffer_chunk)
+    {
+      devfnd->prdt_chunk = grub_memalign_dma32 (4, sizeof (struct grub_pata_prd)
+						* (GRUB_PATA_DMA_BUFFER_SIZE
+						   / GRUB_PATA_PRD_MAX));
+      devfnd->buffer_chunk = grub_memalign_dma32 (GRUB_PATA_PRD_MAX,
+						  GRUB_PATA_DMA_BUFFER_SIZE);
+      if (!devfnd->prdt_chunk || !devfnd->buffer_chunk)
+	{
+	  /* PIO still works.  */
+	  if (devfnd->prdt_chunk)
+	    grub_dma_free (devfnd->prdt_chunk);
+	  if (devfnd->buffer_chunk)
+	    grub_dma_free (devfnd->buffer_chunk);
+	  devfnd->prdt_chunk = devfnd->buffer_chunk = NULL;
+	  devfnd->bmaddress = 0;
+	  grub_errno = GRUB_ERR_NONE;
+	}
+    }
+#endif
+
   ata->data = devfnd;
-  ata->dma = 0;
+  ata->dma = !!devfnd->buffer_chunk;
   ata->maxbuffer = 256 * 512;
   ata->present = &devfnd->present;
 
@@ -553,4 +757,18 @@ GRUB_MOD_INIT(ata_pthru)
 GRUB_MOD_FINI(ata_pthru)
 {
   grub_ata_dev_unregister (&grub_pata_dev);
+
+#ifndef GRUB_MACHINE_MIPS_QEMU_MIPS
+  {
+    struct grub_pata_device *dev;
+
+    for (dev = grub_pata_devices; dev; dev = dev->next)
+      {
+	if (dev->prdt_chunk)
+	  grub_dma_free (dev->prdt_chunk);
+	if (dev->buffer_chunk)
+	  grub_dma_free (dev->buffer_chunk);
+      }
+  }
+#endif
 }
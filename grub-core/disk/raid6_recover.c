@@ -45,6 +45,43 @@ grub_raid_block_mulx (unsigned mul, char *buf, grub_size_t size)
       *p = powx[mul + powx_inv[*p]];
 }
 
+/* Multiply each byte of BUF by x, a machine word at a time.  */
+static void
+grub_raid_block_mul2 (char *buf, grub_size_t size)
+{
+  grub_uint8_t *p = (grub_uint8_t *) buf;
+
+  for (; size && ((grub_addr_t) p & (sizeof (grub_uint64_t) - 1)); size--, p++)
+    *p = (*p << 1) ^ ((*p & 0x80) ? poly : 0);
+
+  for (; size >= sizeof (grub_uint64_t);
+       size -= sizeof (grub_uint64_t), p += sizeof (grub_uint64_t))
+    {
+      grub_uint64_t v = *(grub_uint64_t *) (void *) p;
+      grub_uint64_t high = v & 0x8080808080808080ULL;
+
+      *(grub_uint64_t *) (void *) p = ((v & 0x7f7f7f7f7f7f7f7fULL) << 1)
+	^ ((high >> 7) * poly);
+    }
+
+  for (; size; size--, p++)
+    *p = (*p << 1) ^ ((*p & 0x80) ? poly : 0);
+}
+
+/* Multiply each byte of BUF by x**MUL.  Small powers are cheaper to apply
+   a word at a time than through the tables.  */
+static void
+grub_raid_block_mulx_pow (unsigned mul, char *buf, grub_size_t size)
+{
+  if (mul > 4)
+    {
+      grub_raid_block_mulx (mul, buf, size);
+      return;
+    }
+  while (mul--)
+    grub_raid_block_mul2 (buf, size);
+}
+
 static void
 grub_raid6_init_table (void)
 {
@@ -90,9 +127,15 @@ grub_raid6_recover_gen (void *data, grub_uint64_t nstripes, int disknr, int p,
 			    char *buf, grub_uint64_t sector, grub_size_t size,
 			    int layout, raid_recover_read_t read_func)
 {
-  int i, q, pos;
+  int i, j, q, pos;
   int bad1 = -1, bad2 = -1;
+  int prev = -1;
   char *pbuf = 0, *qbuf = 0;
+  struct
+  {
+    int disk;
+    int mul;
+  } *order = 0;
 
   pbuf = grub_zalloc (size);
   if (!pbuf)
@@ -102,6 +145,13 @@ grub_raid6_recover_gen (void *data, grub_uint64_t nstripes, int disknr, int p,
   if (!qbuf)
     goto quit;
 
+  if (nstripes < 3)
+    goto quit;
+
+  order = grub_calloc (nstripes - 2, sizeof (order[0]));
+  if (!order)
+    goto quit;
+
   q = p + 1;
   if (q == (int) nstripes)
     q = 0;
@@ -110,6 +160,7 @@ grub_raid6_recover_gen (void *data, grub_uint64_t nstripes, int disknr, int p,
   if (pos == (int) nstripes)
     pos = 0;
 
+  /* Sort the data disks by decreasing multiplier.  */
   for (i = 0; i < (int) nstripes - 2; i++)
     {
       int c;
@@ -117,14 +168,34 @@ grub_raid6_recover_gen (void *data, grub_uint64_t nstripes, int disknr, int p,
 	c = pos;
       else
 	c = i;
-      if (pos == disknr)
+      for (j = i; j > 0 && order[j - 1].mul < c; j--)
+	order[j] = order[j - 1];
+      order[j].disk = pos;
+      order[j].mul = c;
+
+      pos++;
+      if (pos == (int) nstripes)
+        pos = 0;
+    }
+
+  /* Accumulate Q by Horner's rule, so that each data disk costs one
+     multiplication by a small power of x instead of a table lookup per
+     byte with its own multiplier.  */
+  for (i = 0; i < (int) nstripes - 2; i++)
+    {
+      int c = order[i].mul;
+
+      if (prev >= 0)
+	grub_raid_block_mulx_pow (prev - c, qbuf, size);
+      prev = c;
+
+      if (order[i].disk == disknr)
         bad1 = c;
       else
         {
-	  if (!read_func (data, pos, sector, buf, size))
+	  if (!read_func (data, order[i].disk, sector, buf, size))
             {
               grub_crypto_xor (pbuf, pbuf, buf, size);
-              grub_raid_block_mulx (c, buf, size);
               grub_crypto_xor (qbuf, qbuf, buf, size);
             }
           else
@@ -137,11 +208,9 @@ grub_raid6_recover_gen (void *data, grub_uint64_t nstripes, int disknr, int p,
               grub_errno = GRUB_ERR_NONE;
             }
         }
-
-      pos++;
-      if (pos == (int) nstripes)
-        pos = 0;
     }
+  if (prev > 0)
+    grub_raid_block_mulx (prev, qbuf, size);
 
   /* Invalid disknr or p */
   if (bad1 < 0)
@@ -191,6 +260,7 @@ grub_raid6_recover_gen (void *data, grub_uint64_t nstripes, int disknr, int p,
     }
 
 quit:
+  grub_free (order);
   grub_free (pbuf);
   grub_free (qbuf);
 
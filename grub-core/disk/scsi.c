@@ -148,10 +148,87 @@ grub_scsi_inquiry (grub_scsi_t scsi)
 
   scsi->devtype = iqd.devtype & GRUB_SCSI_DEVTYPE_MASK;
   scsi->removable = iqd.rmb >> GRUB_SCSI_REMOVABLE_BIT;
+  scsi->version = iqd.version;
 
   return GRUB_ERR_NONE;
 }
 
+/* Read up to SIZE bytes of the vital product data page PAGE into BUF.  */
+static grub_err_t
+grub_scsi_inquiry_vpd (grub_scsi_t scsi, grub_uint8_t page,
+		       grub_size_t size, void *buf)
+{
+  struct grub_scsi_inquiry iq;
+  grub_err_t err;
+  grub_err_t err_sense;
+
+  iq.opcode = grub_scsi_cmd_inquiry;
+  iq.lun = (scsi->lun << GRUB_SCSI_LUN_SHIFT) | GRUB_SCSI_INQUIRY_EVPD;
+  iq.page = page;
+  iq.reserved = 0;
+  iq.alloc_length = size;
+  iq.control = 0;
+  grub_memset (iq.pad, 0, sizeof(iq.pad));
+
+  grub_memset (buf, 0, size);
+  err = scsi->dev->read (scsi, sizeof (iq), (char *) &iq, size, buf);
+
+  /* Each SCSI command should be followed by Request Sense.
+     If not so, many devices STALLs or definitely freezes. */
+  err_sense = grub_scsi_request_sense (scsi);
+  if (err_sense != GRUB_ERR_NONE)
+  	grub_errno = err;
+
+  if (err)
+    return err;
+
+  if (((struct grub_scsi_vpd_header *) buf)->page != page)
+    return grub_error (GRUB_ERR_IO, "VPD page 0x%02x not returned", page);
+
+  return GRUB_ERR_NONE;
+}
+
+/* Find the largest transfer the device accepts in one command, if it
+   tells.  Devices before SPC-3 often misbehave when asked for VPD pages,
+   and the later ones still don't all have the Block Limits page, so check
+   the list of pages first.  */
+static void
+grub_scsi_block_limits (grub_scsi_t scsi)
+{
+  grub_uint8_t pages[64];
+  struct grub_scsi_block_limits_data bl;
+  grub_size_t i, n;
+
+  if (scsi->devtype != grub_scsi_devtype_direct
+      || scsi->version < GRUB_SCSI_VERSION_SPC3)
+    return;
+
+  if (grub_scsi_inquiry_vpd (scsi, GRUB_SCSI_VPD_SUPPORTED_PAGES,
+			     sizeof (pages), pages))
+    goto out;
+
+  n = grub_be_to_cpu16 (((struct grub_scsi_vpd_header *) pages)->length);
+  if (n > sizeof (pages) - sizeof (struct grub_scsi_vpd_header))
+    n = sizeof (pages) - sizeof (struct grub_scsi_vpd_header);
+  for (i = 0; i < n; i++)
+    if (pages[sizeof (struct grub_scsi_vpd_header) + i]
+	== GRUB_SCSI_VPD_BLOCK_LIMITS)
+      break;
+  if (i == n)
+    goto out;
+
+  if (grub_scsi_inquiry_vpd (scsi, GRUB_SCSI_VPD_BLOCK_LIMITS,
+			     sizeof (bl), &bl))
+    goto out;
+
+  scsi->max_blocks = grub_be_to_cpu32 (bl.max_transfer);
+  grub_dprintf ("scsi", "max transfer = %u blocks\n", scsi->max_blocks);
+
+ out:
+  /* The limits are only a hint.  */
+  grub_errno = GRUB_ERR_NONE;
+}
+
 /* Read the capacity and block size of SCSI.  */
 static grub_err_t
 grub_scsi_read_capacity10 (grub_scsi_t scsi)
@@ -511,7 +588,7 @@ grub_scsi_open (const char *name, grub_disk_t disk)
 
   bus = grub_strtoul (nameend + 1, 0, 0);
 
-  scsi = grub_malloc (sizeof (*scsi));
+  scsi = grub_zalloc (sizeof (*scsi));
   if (! scsi)
     return grub_errno;
 
@@ -606,12 +683,14 @@ grub_scsi_open (const char *name, grub_disk_t disk)
 	}
 
       disk->total_sectors = scsi->last_block + 1;
-      /* PATA doesn't support more than 32K reads.
-	 Not sure about AHCI and USB. If it's confirmed that either of
-	 them can do bigger reads reliably this value can be moved to 'scsi'
-	 structure.  */
-      disk->max_agglomerate = 32768 >> (GRUB_DISK_SECTOR_BITS
-					+ GRUB_DISK_CACHE_BITS);
+      /* PATA doesn't support more than 32K reads, so that's the default
+	 unless the driver knows better.  */
+      if (scsi->max_transfer)
+	disk->max_agglomerate = scsi->max_transfer >> (GRUB_DISK_SECTOR_BITS
+						       + GRUB_DISK_CACHE_BITS);
+      else
+	disk->max_agglomerate = 32768 >> (GRUB_DISK_SECTOR_BITS
+					  + GRUB_DISK_CACHE_BITS);
 
       if (scsi->blocksize & (scsi->blocksize - 1) || !scsi->blocksize)
 	{
@@ -622,6 +701,15 @@ grub_scsi_open (const char *name, grub_disk_t disk)
 	}
       disk->log_sector_size = grub_log2ull (scsi->blocksize);
 
+      grub_scsi_block_limits (scsi);
+      if (scsi->max_blocks
+	  && ((grub_uint64_t) scsi->max_blocks << disk->log_sector_size)
+	  < ((grub_uint64_t) disk->max_agglomerate
+	     << (GRUB_DISK_SECTOR_BITS + GRUB_DISK_CACHE_BITS)))
+	disk->max_agglomerate = ((grub_uint64_t) scsi->max_blocks
+				 << disk->log_sector_size)
+	  >> (GRUB_DISK_SECTOR_BITS + GRUB_DISK_CACHE_BITS);
+
       grub_dprintf ("scsi", "last_block=%" PRIuGRUB_UINT64_T ", blocksize=%u\n",
 		    scsi->last_block, scsi->blocksize);
       grub_dprintf ("scsi", "Disk total sectors = %llu\n",
@@ -654,26 +742,45 @@ grub_scsi_read (grub_disk_t disk, grub_disk_addr_t sector,
   scsi = disk->data;
 
   grub_err_t err;
-  /* Depending on the type, select a read function.  */
-  switch (scsi->devtype)
+
+  while (size)
     {
-    case grub_scsi_devtype_direct:
-      if (sector >> 32)
-	err = grub_scsi_read16 (disk, sector, size, buf);
-      else
-	err = grub_scsi_read10 (disk, sector, size, buf);
-      if (err)
-	return err;
-      break;
+      grub_size_t cur = size;
 
-    case grub_scsi_devtype_cdrom:
-      if (sector >> 32)
-	err = grub_scsi_read16 (disk, sector, size, buf);
-      else
-	err = grub_scsi_read12 (disk, sector, size, buf);
-      if (err)
-	return err;
-      break;
+      /* Even a single cache block may be more than the device takes.  */
+      if (scsi->max_blocks && cur > scsi->max_blocks)
+	cur = scsi->max_blocks;
+
+      /* Depending on the type, select a read function.  READ(10) only
+	 counts 65535 blocks.  */
+      switch (scsi->devtype)
+	{
+	case grub_scsi_devtype_direct:
+	  if ((sector + cur - 1) >> 32)
+	    err = grub_scsi_read16 (disk, sector, cur, buf);
+	  else
+	    {
+	      if (cur > 0xffff)
+		cur = 0xffff;
+	      err = grub_scsi_read10 (disk, sector, cur, buf);
+	    }
+	  if (err)
+	    return err;
+	  break;
+
+	case grub_scsi_devtype_cdrom:
+	  if ((sector + cur - 1) >> 32)
+	    err = grub_scsi_read16 (disk, sector, cur, buf);
+	  else
+	    err = grub_scsi_read12 (disk, sector, cur, buf);
+	  if (err)
+	    return err;
+	  break;
+	}
+
+      size -= cur;
+      sector += cur;
+      buf += cur << disk->log_sector_size;
     }
 
   return GRUB_ERR_NONE;
@@ -724,17 +831,34 @@ grub_scsi_write (grub_disk_t disk,
     return grub_error (GRUB_ERR_IO, N_("cannot write to CD-ROM"));
 
   grub_err_t err;
-  /* Depending on the type, select a read function.  */
-  switch (scsi->devtype)
+
+  while (size)
     {
-    case grub_scsi_devtype_direct:
-      if (sector >> 32)
-	err = grub_scsi_write16 (disk, sector, size, buf);
-      else
-	err = grub_scsi_write10 (disk, sector, size, buf);
-      if (err)
-	return err;
-      break;
+      grub_size_t cur = size;
+
+      if (scsi->max_blocks && cur > scsi->max_blocks)
+	cur = scsi->max_blocks;
+
+      /* Depending on the type, select a write function.  */
+      switch (scsi->devtype)
+	{
+	case grub_scsi_devtype_direct:
+	  if ((sector + cur - 1) >> 32)
+	    err = grub_scsi_write16 (disk, sector, cur, buf);
+	  else
+	    {
+	      if (cur > 0xffff)
+		cur = 0xffff;
+	      err = grub_scsi_write10 (disk, sector, cur, buf);
+	    }
+	  if (err)
+	    return err;
+	  break;
+	}
+
+      size -= cur;
+      sector += cur;
+      buf += cur << disk->log_sector_size;
     }
 
   return GRUB_ERR_NONE;
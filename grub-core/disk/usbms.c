@@ -73,6 +73,11 @@ typedef struct grub_usbms_dev *grub_usbms_dev_t;
 
 /* FIXME: remove limit.  */
 #define MAX_USBMS_DEVICES 128
+
+/* Largest transfer of one SCSI command.  240 sectors are accepted by
+   practically every mass storage device and avoid most of the
+   per-command CBW/CSW overhead.  */
+#define GRUB_USBMS_MAX_TRANSFER (240 * 512)
 static grub_usbms_dev_t grub_usbms_devices[MAX_USBMS_DEVICES];
 static int first_available_slot = 0;
 
@@ -621,6 +626,7 @@ grub_usbms_open (int id, int devnum, struct grub_scsi *scsi)
 
   scsi->data = grub_usbms_devices[devnum];
   scsi->luns = grub_usbms_devices[devnum]->luns;
+  scsi->max_transfer = GRUB_USBMS_MAX_TRANSFER;
 
   return GRUB_ERR_NONE;
 }
@@ -28,6 +28,11 @@
 #include <grub/time.h>
 #include <xen/io/blkif.h>
 
+/* Pages granted to the backend once and reused for every transfer, each
+   transfer queueing requests of up to BLKIF_MAX_SEGMENTS_PER_REQUEST of
+   them before waiting.  */
+#define VIRTDISK_DMA_PAGES 16
+
 struct virtdisk
 {
   int handle;
@@ -38,8 +43,9 @@ struct virtdisk
   struct blkif_front_ring ring;
   grub_xen_grant_t grant;
   grub_xen_evtchn_t evtchn;
-  void *dma_page;
-  grub_xen_grant_t dma_grant;
+  void *dma_pages[VIRTDISK_DMA_PAGES];
+  grub_xen_grant_t dma_grants[VIRTDISK_DMA_PAGES];
+  unsigned ndma_pages;
   struct virtdisk *compat_next;
 };
 
@@ -124,58 +130,96 @@ grub_virtdisk_close (grub_disk_t disk __attribute__ ((unused)))
 {
 }
 
+/* Transfer SIZE sectors at SECTOR between the DMA pages and the disk.  */
 static grub_err_t
-grub_virtdisk_read (grub_disk_t disk, grub_disk_addr_t sector,
-		    grub_size_t size, char *buf)
+grub_virtdisk_transfer (grub_disk_t disk, grub_uint8_t operation,
+			grub_disk_addr_t sector, grub_size_t size)
 {
   struct virtdisk *data = disk->data;
-
-  while (size)
+  grub_size_t per_page = GRUB_XEN_PAGE_SIZE >> disk->log_sector_size;
+  unsigned npages = (size + per_page - 1) / per_page;
+  unsigned page = 0, nreq = 0;
+  struct blkif_response *resp;
+  struct evtchn_send send;
+  int sta = 0;
+
+  /* Pages follow each other on the disk, so only the last segment may
+     be short.  */
+  while (page < npages)
     {
-      grub_size_t cur;
       struct blkif_request *req;
-      struct blkif_response *resp;
-      int sta = 0;
-      struct evtchn_send send;
-      cur = size;
-      if (cur > (unsigned) (GRUB_XEN_PAGE_SIZE >> disk->log_sector_size))
-	cur = GRUB_XEN_PAGE_SIZE >> disk->log_sector_size;
+      unsigned seg;
+
       while (RING_FULL (&data->ring))
 	grub_xen_sched_op (SCHEDOP_yield, 0);
       req = RING_GET_REQUEST (&data->ring, data->ring.req_prod_pvt);
-      req->operation = BLKIF_OP_READ;
-      req->nr_segments = 1;
+      req->operation = operation;
       req->handle = data->handle;
-      req->id = 0;
-      req->sector_number = sector << (disk->log_sector_size - 9);
-      req->seg[0].gref = data->dma_grant;
-      req->seg[0].first_sect = 0;
-      req->seg[0].last_sect = (cur << (disk->log_sector_size - 9)) - 1;
+      req->id = nreq;
+      req->sector_number = (sector + page * per_page)
+	<< (disk->log_sector_size - 9);
+      for (seg = 0; seg < BLKIF_MAX_SEGMENTS_PER_REQUEST && page < npages;
+	   seg++, page++)
+	{
+	  grub_size_t cur = grub_min (size - page * per_page, per_page);
+
+	  req->seg[seg].gref = data->dma_grants[page];
+	  req->seg[seg].first_sect = 0;
+	  req->seg[seg].last_sect = (cur << (disk->log_sector_size - 9)) - 1;
+	}
+      req->nr_segments = seg;
       data->ring.req_prod_pvt++;
-      RING_PUSH_REQUESTS (&data->ring);
-      mb ();
-      send.port = data->evtchn;
-      grub_xen_event_channel_op (EVTCHNOP_send, &send);
+      nreq++;
+    }
+  RING_PUSH_REQUESTS (&data->ring);
+  mb ();
+  send.port = data->evtchn;
+  grub_xen_event_channel_op (EVTCHNOP_send, &send);
 
-      while (!RING_HAS_UNCONSUMED_RESPONSES (&data->ring))
+  while (nreq)
+    {
+      int wtd;
+      RING_FINAL_CHECK_FOR_RESPONSES (&data->ring, wtd);
+      if (!wtd)
 	{
 	  grub_xen_sched_op (SCHEDOP_yield, 0);
 	  mb ();
+	  continue;
 	}
-      while (1)
-	{
-	  int wtd;
-	  RING_FINAL_CHECK_FOR_RESPONSES (&data->ring, wtd);
-	  if (!wtd)
-	    break;
-	  resp = RING_GET_RESPONSE (&data->ring, data->ring.rsp_cons);
-	  data->ring.rsp_cons++;
-	  if (resp->status)
-	    sta = resp->status;
-	}
-      if (sta)
-	return grub_error (GRUB_ERR_IO, "read failed");
-      grub_memcpy (buf, data->dma_page, cur << disk->log_sector_size);
+      resp = RING_GET_RESPONSE (&data->ring, data->ring.rsp_cons);
+      data->ring.rsp_cons++;
+      if (resp->status)
+	sta = resp->status;
+      nreq--;
+    }
+  if (sta)
+    return grub_error (GRUB_ERR_IO, operation == BLKIF_OP_READ
+		       ? "read failed" : "write failed");
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+grub_virtdisk_read (grub_disk_t disk, grub_disk_addr_t sector,
+		    grub_size_t size, char *buf)
+{
+  struct virtdisk *data = disk->data;
+  grub_size_t per_page = GRUB_XEN_PAGE_SIZE >> disk->log_sector_size;
+  grub_err_t err;
+
+  while (size)
+    {
+      grub_size_t cur, done;
+      unsigned i;
+
+      cur = size;
+      if (cur > data->ndma_pages * per_page)
+	cur = data->ndma_pages * per_page;
+      err = grub_virtdisk_transfer (disk, BLKIF_OP_READ, sector, cur);
+      if (err)
+	return err;
+      for (i = 0, done = 0; done < cur; i++, done += per_page)
+	grub_memcpy (buf + (done << disk->log_sector_size), data->dma_pages[i],
+		     grub_min (cur - done, per_page) << disk->log_sector_size);
       size -= cur;
       sector += cur;
       buf += cur << disk->log_sector_size;
@@ -188,55 +232,23 @@ grub_virtdisk_write (grub_disk_t disk, grub_disk_addr_t sector,
 		     grub_size_t size, const char *buf)
 {
   struct virtdisk *data = disk->data;
+  grub_size_t per_page = GRUB_XEN_PAGE_SIZE >> disk->log_sector_size;
+  grub_err_t err;
 
   while (size)
     {
-      grub_size_t cur;
-      struct blkif_request *req;
-      struct blkif_response *resp;
-      int sta = 0;
-      struct evtchn_send send;
-      cur = size;
-      if (cur > (unsigned) (GRUB_XEN_PAGE_SIZE >> disk->log_sector_size))
-	cur = GRUB_XEN_PAGE_SIZE >> disk->log_sector_size;
-
-      grub_memcpy (data->dma_page, buf, cur << disk->log_sector_size);
+      grub_size_t cur, done;
+      unsigned i;
 
-      while (RING_FULL (&data->ring))
-	grub_xen_sched_op (SCHEDOP_yield, 0);
-      req = RING_GET_REQUEST (&data->ring, data->ring.req_prod_pvt);
-      req->operation = BLKIF_OP_WRITE;
-      req->nr_segments = 1;
-      req->handle = data->handle;
-      req->id = 0;
-      req->sector_number = sector << (disk->log_sector_size - 9);
-      req->seg[0].gref = data->dma_grant;
-      req->seg[0].first_sect = 0;
-      req->seg[0].last_sect = (cur << (disk->log_sector_size - 9)) - 1;
-      data->ring.req_prod_pvt++;
-      RING_PUSH_REQUESTS (&data->ring);
-      mb ();
-      send.port = data->evtchn;
-      grub_xen_event_channel_op (EVTCHNOP_send, &send);
-
-      while (!RING_HAS_UNCONSUMED_RESPONSES (&data->ring))
-	{
-	  grub_xen_sched_op (SCHEDOP_yield, 0);
-	  mb ();
-	}
-      while (1)
-	{
-	  int wtd;
-	  RING_FINAL_CHECK_FOR_RESPONSES (&data->ring, wtd);
-	  if (!wtd)
-	    break;
-	  resp = RING_GET_RESPONSE (&data->ring, data->ring.rsp_cons);
-	  data->ring.rsp_cons++;
-	  if (resp->status)
-	    sta = resp->status;
-	}
-      if (sta)
-	return grub_error (GRUB_ERR_IO, "write failed");
+      cur = size;
+      if (cur > data->ndma_pages * per_page)
+	cur = data->ndma_pages * per_page;
+      for (i = 0, done = 0; done < cur; i++, done += per_page)
+	grub_memcpy (data->dma_pages[i], buf + (done << disk->log_sector_size),
+		     grub_min (cur - done, per_page) << disk->log_sector_size);
+      err = grub_virtdisk_transfer (disk, BLKIF_OP_WRITE, sector, cur);
+      if (err)
+	return err;
       size -= cur;
       sector += cur;
       buf += cur << disk->log_sector_size;
@@ -244,6 +256,13 @@ grub_virtdisk_write (grub_disk_t disk, grub_disk_addr_t sector,
   return GRUB_ERR_NONE;
 }
 
+static void
+free_dma_pages (struct virtdisk *vd)
+{
+  while (vd->ndma_pages)
+    grub_xen_free_shared_page (vd->dma_pages[--vd->ndma_pages]);
+}
+
 static struct grub_disk_dev grub_virtdisk_dev = {
   .name = "xen",
   .id = GRUB_DISK_DEVICE_XEN,
@@ -325,10 +344,21 @@ fill (const char *dir, void *data)
   if (!virtdisks[vdiskcnt].shared_page)
     goto out_fail_1;
 
-  virtdisks[vdiskcnt].dma_page =
-    grub_xen_alloc_shared_page (dom, &virtdisks[vdiskcnt].dma_grant);
-  if (!virtdisks[vdiskcnt].dma_page)
+  /* As many pages as there are grant entries for, but at least one.  */
+  virtdisks[vdiskcnt].ndma_pages = 0;
+  while (virtdisks[vdiskcnt].ndma_pages < VIRTDISK_DMA_PAGES)
+    {
+      unsigned n = virtdisks[vdiskcnt].ndma_pages;
+
+      virtdisks[vdiskcnt].dma_pages[n] =
+	grub_xen_alloc_shared_page (dom, &virtdisks[vdiskcnt].dma_grants[n]);
+      if (!virtdisks[vdiskcnt].dma_pages[n])
+	break;
+      virtdisks[vdiskcnt].ndma_pages++;
+    }
+  if (!virtdisks[vdiskcnt].ndma_pages)
     goto out_fail_2;
+  grub_errno = GRUB_ERR_NONE;
 
   alloc_unbound.dom = DOMID_SELF;
   alloc_unbound.remote_dom = dom;
@@ -358,6 +388,13 @@ fill (const char *dir, void *data)
   if (err)
     goto out_fail_3;
 
+  /* The DMA pages stay granted until the disk is closed, so a backend
+     supporting it may keep them mapped.  */
+  grub_snprintf (fdir, sizeof (fdir), "device/vbd/%s/feature-persistent", dir);
+  err = grub_xenstore_write_file (fdir, "1", 1);
+  if (err)
+    goto out_fail_3;
+
   struct gnttab_dump_table dt;
   dt.dom = DOMID_SELF;
   grub_xen_grant_table_op (GNTTABOP_dump_table, (void *) &dt, 1);
@@ -403,7 +440,7 @@ fill (const char *dir, void *data)
   return 0;
 
 out_fail_3:
-  grub_xen_free_shared_page (virtdisks[vdiskcnt].dma_page);
+  free_dma_pages (&virtdisks[vdiskcnt]);
 out_fail_2:
   grub_xen_free_shared_page (virtdisks[vdiskcnt].shared_page);
 out_fail_1:
@@ -470,7 +507,7 @@ grub_xendisk_fini (void)
 		     virtdisks[i].frontend_dir);
       grub_xenstore_write_file (fdir, NULL, 0);
 
-      grub_xen_free_shared_page (virtdisks[i].dma_page);
+      free_dma_pages (&virtdisks[i]);
       grub_xen_free_shared_page (virtdisks[i].shared_page);
 
       grub_xen_event_channel_op (EVTCHNOP_close, &close_op);
@@ -52,6 +52,10 @@ struct char_index_entry
   struct grub_font_glyph *glyph;
 };
 
+/* Number of times find_glyph guesses where a code point is before it
+   falls back to halving the range.  */
+#define FIND_GLYPH_PROBES 4
+
 #define FONT_WEIGHT_NORMAL 100
 #define FONT_WEIGHT_BOLD 200
 #define ASCII_BITMAP_SIZE 16
@@ -63,6 +67,7 @@ static int register_font (grub_font_t font);
 static void font_init (grub_font_t font);
 static void free_font (grub_font_t font);
 static void remove_font (grub_font_t font);
+static void constructed_cache_flush (void);
 
 struct font_file_section
 {
@@ -213,6 +218,9 @@ font_init (grub_font_t font)
   font->num_chars = 0;
   font->char_index = 0;
   font->bmp_idx = 0;
+  font->index_offset = 0;
+  font->index_page_code = 0;
+  font->loaded_glyphs = 0;
 }
 
 /* Open the next section in the file.
@@ -270,6 +278,203 @@ open_section (grub_file_t file, struct font_file_section *section)
    entry in the font file.  */
 #define FONT_CHAR_INDEX_ENTRY_SIZE (4 + 1 + 4)
 
+/*
+ * Fonts with more characters than this keep their index in the file and
+ * read it a page at a time when a glyph is looked up, instead of holding
+ * an entry for every character.  The pages read last are kept, for all
+ * fonts together, in a cache of FONT_INDEX_CACHE_PAGES pages.
+ */
+#define FONT_INDEX_LAZY_MIN	4096
+#define FONT_INDEX_PAGE_ENTRIES	128
+#define FONT_INDEX_CACHE_PAGES	32
+
+/* Glyphs of a font with a lazily read index, by code point.  */
+#define LOADED_GLYPH_HASH_SIZE	256
+
+struct font_index_page
+{
+  /* Font the page belongs to, or NULL if the slot is free.  */
+  grub_font_t font;
+  grub_uint32_t page;
+  grub_uint32_t last_used;
+  grub_size_t len;
+  struct char_index_entry entries[FONT_INDEX_PAGE_ENTRIES];
+};
+
+struct loaded_glyph
+{
+  struct loaded_glyph *next;
+  grub_uint32_t code;
+  struct grub_font_glyph *glyph;
+};
+
+static struct font_index_page *font_index_cache;
+static grub_uint32_t font_index_clock;
+
+/* Read the code point of the first character of every index page.  */
+static int
+load_font_index_pages (grub_file_t file, grub_font_t font)
+{
+  grub_uint32_t num_pages, i, code, last_code = 0;
+
+  num_pages = ALIGN_UP (font->num_chars, FONT_INDEX_PAGE_ENTRIES)
+    / FONT_INDEX_PAGE_ENTRIES;
+
+  font->index_offset = grub_file_tell (file);
+  font->index_page_code = grub_calloc (num_pages,
+				       sizeof (font->index_page_code[0]));
+  font->loaded_glyphs = grub_calloc (LOADED_GLYPH_HASH_SIZE,
+				     sizeof (font->loaded_glyphs[0]));
+  if (!font->index_page_code || !font->loaded_glyphs)
+    return 1;
+
+  for (i = 0; i < num_pages; i++)
+    {
+      grub_file_seek (file, font->index_offset + (grub_off_t) i
+		      * FONT_INDEX_PAGE_ENTRIES * FONT_CHAR_INDEX_ENTRY_SIZE);
+      if (grub_file_read (file, &code, 4) != 4)
+	return 1;
+      code = grub_be_to_cpu32 (code);
+
+      if (i != 0 && code <= last_code)
+	{
+	  grub_error (GRUB_ERR_BAD_FONT,
+		      "font characters not in ascending order: %u <= %u",
+		      code, last_code);
+	  return 1;
+	}
+      font->index_page_code[i] = code;
+      last_code = code;
+    }
+
+  /* Continue with the section after the index.  */
+  grub_file_seek (file, font->index_offset + (grub_off_t) font->num_chars
+		  * FONT_CHAR_INDEX_ENTRY_SIZE);
+
+  return grub_errno != GRUB_ERR_NONE;
+}
+
+/* Return the entries of the index page of FONT which CODE would be in,
+   reading it from the file if it is not cached, and store their number
+   in *LEN.  Return NULL if no page can have CODE.  */
+static struct char_index_entry *
+get_font_index_page (grub_font_t font, grub_uint32_t code, grub_size_t *len)
+{
+  grub_uint8_t raw[FONT_INDEX_PAGE_ENTRIES * FONT_CHAR_INDEX_ENTRY_SIZE];
+  grub_uint32_t num_pages, page, lo, hi, last_code = 0;
+  struct font_index_page *slot = NULL;
+  grub_size_t i, n;
+
+  num_pages = ALIGN_UP (font->num_chars, FONT_INDEX_PAGE_ENTRIES)
+    / FONT_INDEX_PAGE_ENTRIES;
+  if (code < font->index_page_code[0])
+    return NULL;
+
+  /* Find the last page that starts at or before CODE.  */
+  lo = 0;
+  hi = num_pages;
+  while (hi - lo > 1)
+    {
+      grub_uint32_t mid = lo + (hi - lo) / 2;
+
+      if (font->index_page_code[mid] <= code)
+	lo = mid;
+      else
+	hi = mid;
+    }
+  page = lo;
+
+  if (!font_index_cache)
+    {
+      font_index_cache = grub_calloc (FONT_INDEX_CACHE_PAGES,
+				      sizeof (font_index_cache[0]));
+      if (!font_index_cache)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  return NULL;
+	}
+    }
+
+  for (i = 0; i < FONT_INDEX_CACHE_PAGES; i++)
+    {
+      struct font_index_page *cur = &font_index_cache[i];
+
+      if (cur->font == font && cur->page == page)
+	{
+	  cur->last_used = ++font_index_clock;
+	  *len = cur->len;
+	  return cur->entries;
+	}
+      if (!slot || (slot->font && (!cur->font
+				   || cur->last_used < slot->last_used)))
+	slot = cur;
+    }
+
+  n = font->num_chars - (grub_size_t) page * FONT_INDEX_PAGE_ENTRIES;
+  if (n > FONT_INDEX_PAGE_ENTRIES)
+    n = FONT_INDEX_PAGE_ENTRIES;
+
+  slot->font = NULL;
+  grub_file_seek (font->file, font->index_offset + (grub_off_t) page
+		  * FONT_INDEX_PAGE_ENTRIES * FONT_CHAR_INDEX_ENTRY_SIZE);
+  if (grub_file_read (font->file, raw, n * FONT_CHAR_INDEX_ENTRY_SIZE)
+      != (grub_ssize_t) (n * FONT_CHAR_INDEX_ENTRY_SIZE))
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return NULL;
+    }
+
+  for (i = 0; i < n; i++)
+    {
+      struct char_index_entry *entry = &slot->entries[i];
+      const grub_uint8_t *ptr = raw + i * FONT_CHAR_INDEX_ENTRY_SIZE;
+
+      entry->code = grub_be_to_cpu32 (grub_get_unaligned32 (ptr));
+      entry->storage_flags = ptr[4];
+      entry->offset = grub_be_to_cpu32 (grub_get_unaligned32 (ptr + 5));
+      entry->glyph = 0;
+
+      /* The index may have changed since the font was loaded.  */
+      if ((i == 0 && entry->code != font->index_page_code[page])
+	  || (i != 0 && entry->code <= last_code))
+	return NULL;
+      last_code = entry->code;
+    }
+
+  slot->font = font;
+  slot->page = page;
+  slot->len = n;
+  slot->last_used = ++font_index_clock;
+
+  *len = n;
+  return slot->entries;
+}
+
+/* Forget the index pages and glyphs of FONT, which is being freed.  */
+static void
+free_font_index_pages (grub_font_t font)
+{
+  struct loaded_glyph *cur, *next;
+  unsigned i;
+
+  if (font_index_cache)
+    for (i = 0; i < FONT_INDEX_CACHE_PAGES; i++)
+      if (font_index_cache[i].font == font)
+	font_index_cache[i].font = NULL;
+
+  if (font->loaded_glyphs)
+    for (i = 0; i < LOADED_GLYPH_HASH_SIZE; i++)
+      for (cur = font->loaded_glyphs[i]; cur; cur = next)
+	{
+	  next = cur->next;
+	  grub_free (cur->glyph);
+	  grub_free (cur);
+	}
+
+  grub_free (font->loaded_glyphs);
+  grub_free (font->index_page_code);
+}
+
 /* Load the character index (CHIX) section contents from the font file.  This
    presumes that the position of FILE is positioned immediately after the
    section length for the CHIX section (i.e., at the start of the section
@@ -299,6 +504,10 @@ load_font_index (grub_file_t file, grub_uint32_t sect_length, struct
   /* Calculate the number of characters.  */
   font->num_chars = sect_length / FONT_CHAR_INDEX_ENTRY_SIZE;
 
+  /* Seeking around a compressed file would cost more than the memory.  */
+  if (font->num_chars > FONT_INDEX_LAZY_MIN && !file->not_easily_seekable)
+    return load_font_index_pages (file, font);
+
   /* Allocate the character index array.  */
   font->char_index = grub_calloc (font->num_chars, sizeof (struct char_index_entry));
   if (!font->char_index)
@@ -661,7 +870,8 @@ grub_font_load (const char *filename)
   if (font->max_char_width <= 0
       || font->max_char_height <= 0
       || font->num_chars == 0
-      || font->char_index == 0 || font->ascent == 0 || font->descent == 0)
+      || (font->char_index == 0 && font->index_page_code == 0)
+      || font->ascent == 0 || font->descent == 0)
     {
       grub_error (GRUB_ERR_BAD_FONT,
 		  "invalid font file: missing some required data");
@@ -710,10 +920,21 @@ find_glyph (const grub_font_t font, grub_uint32_t code)
 {
   struct char_index_entry *table, *first, *end;
   grub_size_t len;
+  int probes;
 
-  table = font->char_index;
-  if (table == NULL)
-    return NULL;
+  if (font->index_page_code)
+    {
+      table = get_font_index_page (font, code, &len);
+      if (table == NULL)
+	return NULL;
+    }
+  else
+    {
+      table = font->char_index;
+      if (table == NULL)
+	return NULL;
+      len = font->num_chars;
+    }
 
   /* Use BMP index if possible.  */
   if (code < 0x10000 && font->bmp_idx)
@@ -726,14 +947,38 @@ find_glyph (const grub_font_t font, grub_uint32_t code)
        */
     }
 
-  /*
-   * Do a binary search in char_index which is ordered by code point.
-   * The code below is the same as libstdc++'s std::lower_bound().
-   */
   first = table;
-  len = font->num_chars;
   end = first + len;
 
+  /*
+   * Large fonts cover long runs of consecutive code points, like the CJK
+   * extensions outside the BMP, so guess the position of CODE from the
+   * codes at both ends of the range a few times first.
+   */
+  for (probes = 0; probes < FIND_GLYPH_PROBES && end - first > 16; probes++)
+    {
+      grub_uint32_t low = first->code, high = end[-1].code;
+      struct char_index_entry *guess;
+
+      if (code < low || code > high)
+	return NULL;
+
+      guess = first + grub_divmod64 ((grub_uint64_t) (code - low)
+				     * (end - first - 1), high - low, NULL);
+      if (guess->code == code)
+	return guess;
+      if (guess->code < code)
+	first = guess + 1;
+      else
+	end = guess;
+    }
+
+  /*
+   * Do a binary search in the rest of char_index which is ordered by code
+   * point.  The code below is the same as libstdc++'s std::lower_bound().
+   */
+  len = end - first;
+
   while (len > 0)
     {
       grub_size_t half = len >> 1;
@@ -758,6 +1003,15 @@ static struct grub_font_glyph *
 grub_font_get_glyph_internal (grub_font_t font, grub_uint32_t code)
 {
   struct char_index_entry *index_entry;
+  struct loaded_glyph *loaded = NULL;
+
+  if (font->loaded_glyphs)
+    {
+      for (loaded = font->loaded_glyphs[code % LOADED_GLYPH_HASH_SIZE];
+	   loaded; loaded = loaded->next)
+	if (loaded->code == code)
+	  return loaded->glyph;
+    }
 
   index_entry = find_glyph (font, code);
   if (index_entry)
@@ -835,8 +1089,24 @@ grub_font_get_glyph_internal (grub_font_t font, grub_uint32_t code)
       /* Restore old error message.  */
       grub_error_pop ();
 
-      /* Cache the glyph.  */
-      index_entry->glyph = glyph;
+      /* Cache the glyph.  The index entry of a font with a lazily read
+	 index is only good until the next index page is read.  */
+      if (font->loaded_glyphs)
+	{
+	  loaded = grub_malloc (sizeof (*loaded));
+	  if (!loaded)
+	    {
+	      grub_free (glyph);
+	      grub_errno = GRUB_ERR_NONE;
+	      return 0;
+	    }
+	  loaded->code = code;
+	  loaded->glyph = glyph;
+	  loaded->next = font->loaded_glyphs[code % LOADED_GLYPH_HASH_SIZE];
+	  font->loaded_glyphs[code % LOADED_GLYPH_HASH_SIZE] = loaded;
+	}
+      else
+	index_entry->glyph = glyph;
 
       return glyph;
     }
@@ -859,6 +1129,7 @@ free_font (grub_font_t font)
       grub_free (font->family);
       grub_free (font->char_index);
       grub_free (font->bmp_idx);
+      free_font_index_pages (font);
       grub_free (font);
     }
 }
@@ -879,6 +1150,9 @@ register_font (grub_font_t font)
   node->next = grub_font_list;
   grub_font_list = node;
 
+  /* Fallback glyphs of constructed glyphs may come from the new font.  */
+  constructed_cache_flush ();
+
   return 0;
 }
 
@@ -899,6 +1173,8 @@ remove_font (grub_font_t font)
 	  /* Free the node, but not the font itself.  */
 	  grub_free (cur);
 
+	  constructed_cache_flush ();
+
 	  return;
 	}
     }
@@ -1525,6 +1801,157 @@ ensure_comb_space (const struct grub_unicode_glyph *glyph_id)
     }
 }
 
+/*
+ * Glyphs put together by grub_font_construct_glyph, so that text with
+ * combining characters or joined forms is not blitted again on every
+ * redraw.  An entry is found by the hinted font, the base character, its
+ * attributes and the combining characters, and the least recently used one
+ * is given up when the cache is full.
+ */
+#define CONSTRUCTED_CACHE_SIZE	128
+#define CONSTRUCTED_HASH_SIZE	64
+
+struct constructed_glyph
+{
+  struct constructed_glyph *next;
+  unsigned hash;
+  grub_font_t font;
+  grub_uint32_t base;
+  grub_uint8_t attributes;
+  unsigned ncomb;
+  struct grub_unicode_combining *comb;
+  grub_uint32_t last_used;
+
+  /* Glyph if the entry is in use, or NULL otherwise.  */
+  struct grub_font_glyph *glyph;
+};
+
+static struct constructed_glyph constructed_cache[CONSTRUCTED_CACHE_SIZE];
+static struct constructed_glyph *constructed_hash[CONSTRUCTED_HASH_SIZE];
+static grub_uint32_t constructed_clock;
+
+static unsigned
+constructed_hash_key (grub_font_t font,
+		      const struct grub_unicode_glyph *glyph_id)
+{
+  const struct grub_unicode_combining *comb = grub_unicode_get_comb (glyph_id);
+  grub_uint32_t key;
+  unsigned i;
+
+  key = ((grub_addr_t) font >> 4) ^ glyph_id->base
+    ^ ((grub_uint32_t) glyph_id->attributes << 24);
+  for (i = 0; i < glyph_id->ncomb; i++)
+    key = key * 31 + comb[i].code;
+
+  return (key ^ (key >> 12)) % CONSTRUCTED_HASH_SIZE;
+}
+
+static void
+constructed_cache_flush (void)
+{
+  unsigned i;
+
+  for (i = 0; i < CONSTRUCTED_CACHE_SIZE; i++)
+    {
+      grub_free (constructed_cache[i].glyph);
+      grub_free (constructed_cache[i].comb);
+      constructed_cache[i].glyph = NULL;
+      constructed_cache[i].comb = NULL;
+    }
+  grub_memset (constructed_hash, 0, sizeof (constructed_hash));
+}
+
+static struct grub_font_glyph *
+constructed_cache_find (grub_font_t font,
+			const struct grub_unicode_glyph *glyph_id)
+{
+  const struct grub_unicode_combining *comb = grub_unicode_get_comb (glyph_id);
+  struct constructed_glyph *entry;
+  unsigned i;
+
+  for (entry = constructed_hash[constructed_hash_key (font, glyph_id)];
+       entry; entry = entry->next)
+    {
+      if (entry->font != font || entry->base != glyph_id->base
+	  || entry->attributes != glyph_id->attributes
+	  || entry->ncomb != glyph_id->ncomb)
+	continue;
+
+      for (i = 0; i < entry->ncomb; i++)
+	if (entry->comb[i].code != comb[i].code
+	    || entry->comb[i].type != comb[i].type)
+	  break;
+      if (i < entry->ncomb)
+	continue;
+
+      entry->last_used = ++constructed_clock;
+      return entry->glyph;
+    }
+
+  return NULL;
+}
+
+/* Keep a copy of GLYPH, which takes SIZE bytes.  Return the copy, or NULL
+   if there is no memory for it.  */
+static struct grub_font_glyph *
+constructed_cache_add (grub_font_t font,
+		       const struct grub_unicode_glyph *glyph_id,
+		       const struct grub_font_glyph *glyph, grub_size_t size)
+{
+  struct constructed_glyph *entry = &constructed_cache[0], **prev;
+  struct grub_font_glyph *copy;
+  struct grub_unicode_combining *comb = NULL;
+  unsigned i;
+
+  copy = grub_malloc (size);
+  if (copy && glyph_id->ncomb)
+    comb = grub_calloc (glyph_id->ncomb, sizeof (*comb));
+  if (!copy || (glyph_id->ncomb && !comb))
+    {
+      grub_free (copy);
+      grub_errno = GRUB_ERR_NONE;
+      return NULL;
+    }
+  grub_memcpy (copy, glyph, size);
+  if (glyph_id->ncomb)
+    grub_memcpy (comb, grub_unicode_get_comb (glyph_id),
+		 glyph_id->ncomb * sizeof (*comb));
+
+  for (i = 0; i < CONSTRUCTED_CACHE_SIZE; i++)
+    {
+      if (!constructed_cache[i].glyph)
+	{
+	  entry = &constructed_cache[i];
+	  break;
+	}
+      if (constructed_cache[i].last_used < entry->last_used)
+	entry = &constructed_cache[i];
+    }
+
+  if (entry->glyph)
+    {
+      for (prev = &constructed_hash[entry->hash]; *prev != entry;
+	   prev = &(*prev)->next)
+	;
+      *prev = entry->next;
+      grub_free (entry->glyph);
+      grub_free (entry->comb);
+    }
+
+  entry->hash = constructed_hash_key (font, glyph_id);
+  entry->font = font;
+  entry->base = glyph_id->base;
+  entry->attributes = glyph_id->attributes;
+  entry->ncomb = glyph_id->ncomb;
+  entry->comb = comb;
+  entry->glyph = copy;
+  entry->last_used = ++constructed_clock;
+  entry->next = constructed_hash[entry->hash];
+  constructed_hash[entry->hash] = entry;
+
+  return copy;
+}
+
 int
 grub_font_get_constructed_device_width (grub_font_t hinted_font,
 					const struct grub_unicode_glyph
@@ -1533,6 +1960,13 @@ grub_font_get_constructed_device_width (grub_font_t hinted_font,
   int ret;
   struct grub_font_glyph *main_glyph;
 
+  if (glyph_id->ncomb || glyph_id->attributes)
+    {
+      main_glyph = constructed_cache_find (hinted_font, glyph_id);
+      if (main_glyph)
+	return main_glyph->device_width;
+    }
+
   ensure_comb_space (glyph_id);
 
   main_glyph = grub_font_construct_dry_run (hinted_font, glyph_id, NULL,
@@ -1551,6 +1985,14 @@ grub_font_construct_glyph (grub_font_t hinted_font,
   static struct grub_font_glyph *glyph = 0;
   static grub_size_t max_glyph_size = 0;
   grub_size_t cur_glyph_size;
+  struct grub_font_glyph *cached;
+
+  if (glyph_id->ncomb || glyph_id->attributes)
+    {
+      cached = constructed_cache_find (hinted_font, glyph_id);
+      if (cached)
+	return cached;
+    }
 
   ensure_comb_space (glyph_id);
 
@@ -1609,7 +2051,11 @@ grub_font_construct_glyph (grub_font_t hinted_font,
 
   blit_comb (glyph_id, glyph, NULL, main_glyph, render_combining_glyphs, NULL);
 
-  return glyph;
+  /* Without memory to keep it, the glyph is only good until the next one.  */
+  cached = constructed_cache_add (hinted_font, glyph_id, glyph,
+				  cur_glyph_size);
+
+  return cached ? : glyph;
 }
 
 /* Draw the specified glyph at (x, y).  The y coordinate designates the
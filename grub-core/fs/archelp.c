@@ -133,6 +133,337 @@ handle_symlink (struct grub_archelp_data *data,
   return GRUB_ERR_NONE;
 }
 
+/* Archives with more members than this are scanned as before.  */
+#define GRUB_ARCHELP_INDEX_MAX	(1 << 20)
+
+struct grub_archelp_index_entry
+{
+  char *name;
+  grub_off_t pos;
+  grub_int32_t mtime;
+  grub_uint32_t mode;
+  /* Next entry with the same hash, plus one.  */
+  grub_size_t next;
+};
+
+struct grub_archelp_index
+{
+  /* Set if the archive could not be indexed.  */
+  int failed;
+  grub_size_t count;
+  struct grub_archelp_index_entry *entries;
+  grub_size_t nbuckets;
+  /* First entry with the hash, plus one.  */
+  grub_size_t *buckets;
+};
+
+static grub_uint32_t
+hash_name (const char *name, grub_size_t len)
+{
+  grub_uint32_t hash = 0;
+
+  while (len--)
+    hash = hash * 31 + (grub_uint8_t) *name++;
+  return hash;
+}
+
+void
+grub_archelp_free_index (struct grub_archelp_index *index)
+{
+  grub_size_t i;
+
+  if (!index)
+    return;
+  for (i = 0; i < index->count; i++)
+    grub_free (index->entries[i].name);
+  grub_free (index->entries);
+  grub_free (index->buckets);
+  grub_free (index);
+}
+
+/* Read all members of DATA once.  On failure the returned index is only
+   marked as failed, so that the members are scanned as before.  */
+static struct grub_archelp_index *
+build_index (struct grub_archelp_data *data,
+	     struct grub_archelp_ops *arcops)
+{
+  struct grub_archelp_index *index;
+  grub_size_t alloc = 0, i;
+
+  index = grub_zalloc (sizeof (*index));
+  if (!index)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return NULL;
+    }
+
+  arcops->rewind (data);
+  while (1)
+    {
+      struct grub_archelp_index_entry *e;
+      grub_off_t pos = arcops->tell (data);
+      grub_int32_t mtime;
+      grub_uint32_t mode;
+      char *name;
+
+      if (arcops->find_file (data, &name, &mtime, &mode))
+	goto fail;
+
+      if (mode == GRUB_ARCHELP_ATTR_END)
+	break;
+
+      if (index->count == alloc)
+	{
+	  alloc = alloc ? alloc * 2 : 64;
+	  e = NULL;
+	  if (alloc <= GRUB_ARCHELP_INDEX_MAX)
+	    e = grub_realloc (index->entries, alloc * sizeof (*e));
+	  if (!e)
+	    {
+	      grub_free (name);
+	      goto fail;
+	    }
+	  index->entries = e;
+	}
+
+      canonicalize (name);
+      e = &index->entries[index->count++];
+      e->name = name;
+      e->pos = pos;
+      e->mtime = mtime;
+      e->mode = mode;
+    }
+
+  for (index->nbuckets = 64; index->nbuckets < index->count;
+       index->nbuckets <<= 1);
+  index->buckets = grub_calloc (index->nbuckets, sizeof (index->buckets[0]));
+  if (!index->buckets)
+    goto fail;
+
+  /* Insert backwards so that each chain is in archive order.  */
+  for (i = index->count; i > 0; i--)
+    {
+      struct grub_archelp_index_entry *e = &index->entries[i - 1];
+      grub_size_t b = hash_name (e->name, grub_strlen (e->name))
+	& (index->nbuckets - 1);
+
+      e->next = index->buckets[b];
+      index->buckets[b] = i;
+    }
+
+  grub_dprintf ("archelp", "indexed %" PRIuGRUB_SIZE " members\n",
+		index->count);
+  return index;
+
+ fail:
+  for (i = 0; i < index->count; i++)
+    grub_free (index->entries[i].name);
+  grub_free (index->entries);
+  grub_free (index->buckets);
+  grub_memset (index, 0, sizeof (*index));
+  index->failed = 1;
+  grub_errno = GRUB_ERR_NONE;
+  return index;
+}
+
+/* Return the index of DATA, building it on first use, or NULL if the
+   members have to be scanned.  */
+static struct grub_archelp_index *
+get_index (struct grub_archelp_data *data,
+	   struct grub_archelp_ops *arcops)
+{
+  struct grub_archelp_index **slot;
+
+  if (!arcops->get_index || !arcops->tell || !arcops->seek)
+    return NULL;
+
+  slot = arcops->get_index (data);
+  if (!*slot)
+    *slot = build_index (data, arcops);
+  if (!*slot || (*slot)->failed)
+    return NULL;
+  return *slot;
+}
+
+/* Make the state of DATA that of entry I of INDEX, as if find_file had
+   just read it.  */
+static grub_err_t
+load_member (struct grub_archelp_data *data,
+	     struct grub_archelp_ops *arcops,
+	     struct grub_archelp_index *index, grub_size_t i,
+	     char **name)
+{
+  grub_int32_t mtime;
+  grub_uint32_t mode;
+  char *fn;
+
+  arcops->seek (data, index->entries[i].pos);
+  if (arcops->find_file (data, &fn, &mtime, &mode))
+    return grub_errno;
+  if (mode == GRUB_ARCHELP_ATTR_END)
+    return grub_error (GRUB_ERR_BAD_FS, "archive changed");
+  canonicalize (fn);
+  if (name)
+    *name = fn;
+  else
+    grub_free (fn);
+  return GRUB_ERR_NONE;
+}
+
+/* Read the next member for grub_archelp_dir, from INDEX if there is one.
+   *CURSOR counts the entries of INDEX already returned.  */
+static grub_err_t
+next_member (struct grub_archelp_data *data,
+	     struct grub_archelp_ops *arcops,
+	     struct grub_archelp_index *index, grub_size_t *cursor,
+	     char **name, grub_int32_t *mtime, grub_uint32_t *mode)
+{
+  struct grub_archelp_index_entry *e;
+
+  if (!index)
+    {
+      if (arcops->find_file (data, name, mtime, mode))
+	return grub_errno;
+      if (*mode != GRUB_ARCHELP_ATTR_END)
+	canonicalize (*name);
+      return GRUB_ERR_NONE;
+    }
+
+  if (*cursor == index->count)
+    {
+      *mode = GRUB_ARCHELP_ATTR_END;
+      return GRUB_ERR_NONE;
+    }
+
+  e = &index->entries[(*cursor)++];
+  *name = grub_strdup (e->name);
+  if (!*name)
+    return grub_errno;
+  *mtime = e->mtime;
+  *mode = e->mode;
+  return GRUB_ERR_NONE;
+}
+
+/* Collect in archive order the entries of INDEX which can affect the
+   lookup of NAME: those named NAME or one of its parent directories,
+   which might be symlinks.  */
+static grub_err_t
+lookup_candidates (struct grub_archelp_index *index, const char *name,
+		   grub_size_t **cands, grub_size_t *ncands)
+{
+  grub_size_t alloc = 0, len, i, j;
+
+  *cands = NULL;
+  *ncands = 0;
+
+  for (len = 0; ; len++)
+    {
+      if (name[len] == '/' || name[len] == 0)
+	{
+	  grub_size_t b = hash_name (name, len) & (index->nbuckets - 1);
+
+	  for (i = index->buckets[b]; i; i = index->entries[i - 1].next)
+	    {
+	      const char *fn = index->entries[i - 1].name;
+
+	      if (grub_strncmp (fn, name, len) != 0 || fn[len] != 0)
+		continue;
+	      if (*ncands == alloc)
+		{
+		  grub_size_t *n;
+
+		  alloc = alloc ? alloc * 2 : 8;
+		  n = grub_realloc (*cands, alloc * sizeof (**cands));
+		  if (!n)
+		    {
+		      grub_free (*cands);
+		      *cands = NULL;
+		      return grub_errno;
+		    }
+		  *cands = n;
+		}
+	      (*cands)[(*ncands)++] = i - 1;
+	    }
+	}
+      if (name[len] == 0)
+	break;
+    }
+
+  /* The chains are already in order, so this only merges them.  */
+  for (i = 1; i < *ncands; i++)
+    {
+      grub_size_t c = (*cands)[i];
+
+      for (j = i; j > 0 && (*cands)[j - 1] > c; j--)
+	(*cands)[j] = (*cands)[j - 1];
+      (*cands)[j] = c;
+    }
+
+  return GRUB_ERR_NONE;
+}
+
+/* grub_archelp_open using INDEX.  Only the members which the scan would
+   act on are read.  */
+static grub_err_t
+open_indexed (struct grub_archelp_data *data,
+	      struct grub_archelp_ops *arcops,
+	      struct grub_archelp_index *index,
+	      char **name, const char *name_in)
+{
+  grub_size_t *cands, ncands, i;
+  int symlinknest = 0;
+
+ again:
+  if (lookup_candidates (index, *name, &cands, &ncands))
+    return grub_errno;
+
+  for (i = 0; i < ncands; i++)
+    {
+      struct grub_archelp_index_entry *e = &index->entries[cands[i]];
+      int restart;
+      char *fn;
+
+      if ((e->mode & GRUB_ARCHELP_ATTR_TYPE) != GRUB_ARCHELP_ATTR_LNK
+	  && grub_strcmp (*name, e->name) != 0)
+	continue;
+
+      if (load_member (data, arcops, index, cands[i], &fn))
+	goto fail;
+
+      if (handle_symlink (data, arcops, fn, name, e->mode, &restart))
+	{
+	  grub_free (fn);
+	  goto fail;
+	}
+
+      if (restart)
+	{
+	  grub_free (fn);
+	  grub_free (cands);
+	  if (++symlinknest == 8)
+	    return grub_error (GRUB_ERR_SYMLINK_LOOP,
+			       N_("too deep nesting of symlinks"));
+	  goto again;
+	}
+
+      if (grub_strcmp (*name, fn) == 0)
+	{
+	  grub_free (fn);
+	  grub_free (cands);
+	  return GRUB_ERR_NONE;
+	}
+      grub_free (fn);
+    }
+
+  grub_free (cands);
+  return grub_error (GRUB_ERR_FILE_NOT_FOUND, N_("file `%s' not found"),
+		     name_in);
+
+ fail:
+  grub_free (cands);
+  return grub_errno;
+}
+
 grub_err_t
 grub_archelp_dir (struct grub_archelp_data *data,
 		  struct grub_archelp_ops *arcops,
@@ -140,8 +471,9 @@ grub_archelp_dir (struct grub_archelp_data *data,
 		  grub_fs_dir_hook_t hook, void *hook_data)
 {
   char *prev, *name, *path, *ptr;
-  grub_size_t len;
+  grub_size_t len, cursor = 0;
   int symlinknest = 0;
+  struct grub_archelp_index *index;
 
   path = grub_strdup (path_in + 1);
   if (!path)
@@ -152,6 +484,10 @@ grub_archelp_dir (struct grub_archelp_data *data,
 
   prev = 0;
 
+  index = get_index (data, arcops);
+  if (!index)
+    arcops->rewind (data);
+
   len = grub_strlen (path);
   while (1)
     {
@@ -159,14 +495,12 @@ grub_archelp_dir (struct grub_archelp_data *data,
       grub_uint32_t mode;
       grub_err_t err;
 
-      if (arcops->find_file (data, &name, &mtime, &mode))
+      if (next_member (data, arcops, index, &cursor, &name, &mtime, &mode))
 	goto fail;
 
       if (mode == GRUB_ARCHELP_ATTR_END)
 	break;
 
-      canonicalize (name);
-
       if (grub_memcmp (path, name, len) == 0
 	  && (name[len] == 0 || name[len] == '/' || len == 0))
 	{
@@ -210,8 +544,13 @@ grub_archelp_dir (struct grub_archelp_data *data,
 	  else
 	    {
 	      int restart = 0;
-	      err = handle_symlink (data, arcops, name,
-				    &path, mode, &restart);
+	      err = GRUB_ERR_NONE;
+	      if (index && (mode & GRUB_ARCHELP_ATTR_TYPE)
+		  == GRUB_ARCHELP_ATTR_LNK)
+		err = load_member (data, arcops, index, cursor - 1, NULL);
+	      if (!err)
+		err = handle_symlink (data, arcops, name,
+				      &path, mode, &restart);
 	      grub_free (name);
 	      if (err)
 		goto fail;
@@ -224,7 +563,10 @@ grub_archelp_dir (struct grub_archelp_data *data,
 				  N_("too deep nesting of symlinks"));
 		      goto fail;
 		    }
-		  arcops->rewind (data);
+		  if (index)
+		    cursor = 0;
+		  else
+		    arcops->rewind (data);
 		}
 	    }
 	}
@@ -248,12 +590,25 @@ grub_archelp_open (struct grub_archelp_data *data,
   char *fn;
   char *name = grub_strdup (name_in + 1);
   int symlinknest = 0;
+  struct grub_archelp_index *index;
 
   if (!name)
     return grub_errno;
 
   canonicalize (name);
 
+  index = get_index (data, arcops);
+  if (index)
+    {
+      grub_err_t err;
+
+      err = open_indexed (data, arcops, index, &name, name_in);
+      grub_free (name);
+      return err;
+    }
+
+  arcops->rewind (data);
+
   while (1)
     {
       grub_uint32_t mode;
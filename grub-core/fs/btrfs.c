@@ -41,6 +41,7 @@
 #include <grub/crypto.h>
 #include <grub/diskfilter.h>
 #include <grub/safemath.h>
+#include <grub/fshelp.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -81,7 +82,10 @@ struct grub_btrfs_superblock
   grub_uint64_t chunk_tree;
   grub_uint8_t dummy2[0x20];
   grub_uint64_t root_dir_objectid;
-  grub_uint8_t dummy3[0x41];
+  grub_uint64_t num_devices;
+  grub_uint32_t sectorsize;
+  grub_uint32_t nodesize;
+  grub_uint8_t dummy3[0x31];
   struct grub_btrfs_device this_device;
   char label[0x100];
   grub_uint8_t dummy4[0x100];
@@ -102,6 +106,31 @@ struct grub_btrfs_device_desc
 {
   grub_device_t dev;
   grub_uint64_t id;
+  /* Failed reads, after which the copies on this device come last.  */
+  unsigned read_errors;
+};
+
+/* A chunk item and the devices of its stripes.  DEVIDX[I] is 1 + the
+   index of the device of stripe I in devices_attached, or 0 if it
+   hasn't been looked up yet.  */
+struct grub_btrfs_chunk_map
+{
+  grub_uint64_t start;
+  grub_uint64_t size;
+  struct grub_btrfs_chunk_item *chunk;
+  unsigned *devidx;
+};
+
+/* Number of tree nodes cached per mount.  */
+#define GRUB_BTRFS_NODE_CACHE_SIZE 16
+/* Number of sibling leaves read ahead when iterating over a directory.  */
+#define GRUB_BTRFS_PREFETCH_LEAVES 4
+
+struct grub_btrfs_node_cache
+{
+  grub_disk_addr_t addr;
+  grub_uint64_t last_use;
+  grub_uint8_t *buf;
 };
 
 struct grub_btrfs_data
@@ -114,6 +143,17 @@ struct grub_btrfs_data
   unsigned n_devices_attached;
   unsigned n_devices_allocated;
 
+  /* Chunks resolved so far, sorted by logical address.  */
+  struct grub_btrfs_chunk_map *chunks;
+  unsigned n_chunks;
+  unsigned n_chunks_allocated;
+
+  /* Recently used tree nodes.  NODESIZE is 0 if the superblock doesn't
+     give a usable node size, in which case nothing is cached.  */
+  grub_uint32_t nodesize;
+  grub_uint64_t node_clock;
+  struct grub_btrfs_node_cache nodes[GRUB_BTRFS_NODE_CACHE_SIZE];
+
   /* Cached extent data.  */
   grub_uint64_t extstart;
   grub_uint64_t extend;
@@ -121,6 +161,14 @@ struct grub_btrfs_data
   grub_uint64_t exttree;
   grub_size_t extsize;
   struct grub_btrfs_extent_data *extent;
+
+  /* Zstd context, and the last regular zstd extent decompressed into
+     ZSTD_BUF, identified by its logical address and compressed size.  */
+  ZSTD_DCtx *zstd_dctx;
+  char *zstd_buf;
+  grub_size_t zstd_len;
+  grub_uint64_t zstd_laddr;
+  grub_uint64_t zstd_zsize;
 };
 
 struct grub_btrfs_chunk_item
@@ -178,17 +226,21 @@ struct grub_btrfs_dir_item
   char name[0];
 } GRUB_PACKED;
 
+struct grub_btrfs_leaf_descriptor_entry
+{
+  grub_disk_addr_t addr;
+  unsigned iter;
+  unsigned maxiter;
+  int leaf;
+};
+
 struct grub_btrfs_leaf_descriptor
 {
   unsigned depth;
   unsigned allocated;
-  struct
-  {
-    grub_disk_addr_t addr;
-    unsigned iter;
-    unsigned maxiter;
-    int leaf;
-  } *data;
+  struct grub_btrfs_leaf_descriptor_entry *data;
+  /* Read sibling leaves ahead when next () moves to a new leaf.  */
+  int prefetch;
 };
 
 struct grub_btrfs_time
@@ -305,25 +357,174 @@ free_iterator (struct grub_btrfs_leaf_descriptor *desc)
   grub_free (desc->data);
 }
 
-static grub_err_t
+/* The check is advisory: nodes of seed devices and of filesystems with
+   a separate metadata UUID legitimately carry another UUID.  */
+static void
 check_btrfs_header (struct grub_btrfs_data *data, struct btrfs_header *header,
                     grub_disk_addr_t addr)
 {
   if (grub_le_to_cpu64 (header->bytenr) != addr)
+    grub_dprintf ("btrfs", "btrfs_header.bytenr is not equal node addr\n");
+  if (grub_memcmp (data->sblock.uuid, header->uuid, sizeof(grub_btrfs_uuid_t)))
+    grub_dprintf ("btrfs", "btrfs_header.uuid doesn't match sblock uuid\n");
+}
+
+/* Find a cached node holding the SIZE bytes at logical address ADDR.  */
+static struct grub_btrfs_node_cache *
+node_cache_find (struct grub_btrfs_data *data, grub_disk_addr_t addr,
+		 grub_size_t size)
+{
+  unsigned i;
+
+  if (size > data->nodesize)
+    return NULL;
+
+  for (i = 0; i < GRUB_BTRFS_NODE_CACHE_SIZE; i++)
     {
-      grub_dprintf ("btrfs", "btrfs_header.bytenr is not equal node addr\n");
-      return grub_error (GRUB_ERR_BAD_FS,
-			 "header bytenr is not equal node addr");
+      struct grub_btrfs_node_cache *node = &data->nodes[i];
+
+      if (node->buf && addr >= node->addr
+	  && addr - node->addr <= data->nodesize - size)
+	{
+	  node->last_use = ++data->node_clock;
+	  return node;
+	}
     }
-  if (grub_memcmp (data->sblock.uuid, header->uuid, sizeof(grub_btrfs_uuid_t)))
+  return NULL;
+}
+
+/* Check the header of BUF, the node at logical address ADDR, and add the
+   node to the cache, which takes ownership of BUF.  */
+static void
+node_cache_insert (struct grub_btrfs_data *data, grub_disk_addr_t addr,
+		   grub_uint8_t *buf)
+{
+  struct grub_btrfs_node_cache *victim = &data->nodes[0];
+  unsigned i;
+
+  check_btrfs_header (data, (struct btrfs_header *) buf, addr);
+
+  for (i = 0; i < GRUB_BTRFS_NODE_CACHE_SIZE; i++)
     {
-      grub_dprintf ("btrfs", "btrfs_header.uuid doesn't match sblock uuid\n");
-      return grub_error (GRUB_ERR_BAD_FS,
-			 "header uuid doesn't match sblock uuid");
+      if (!data->nodes[i].buf)
+	{
+	  victim = &data->nodes[i];
+	  break;
+	}
+      if (data->nodes[i].last_use < victim->last_use)
+	victim = &data->nodes[i];
     }
+
+  grub_free (victim->buf);
+  victim->addr = addr;
+  victim->buf = buf;
+  victim->last_use = ++data->node_clock;
+}
+
+static void
+node_cache_free (struct grub_btrfs_data *data)
+{
+  unsigned i;
+
+  for (i = 0; i < GRUB_BTRFS_NODE_CACHE_SIZE; i++)
+    {
+      grub_free (data->nodes[i].buf);
+      data->nodes[i].buf = NULL;
+    }
+}
+
+/* Read the header of the tree node at ADDR into HEAD.  The whole node is
+   read into the cache so that walking its items doesn't go to the disk
+   again, and its header is checked only when it is read from disk.  */
+static grub_err_t
+read_node_header (struct grub_btrfs_data *data, grub_disk_addr_t addr,
+		  struct btrfs_header *head, int recursion_depth)
+{
+  struct grub_btrfs_node_cache *node;
+  grub_uint8_t *buf;
+  grub_err_t err;
+
+  if (!data->nodesize)
+    {
+      err = grub_btrfs_read_logical (data, addr, head, sizeof (*head),
+				     recursion_depth);
+      if (err)
+	return err;
+      check_btrfs_header (data, head, addr);
+      return GRUB_ERR_NONE;
+    }
+
+  node = node_cache_find (data, addr, data->nodesize);
+  if (node)
+    {
+      grub_memcpy (head, node->buf, sizeof (*head));
+      return GRUB_ERR_NONE;
+    }
+
+  /* Reading the node may need to look up the chunk tree, which uses the
+     cache too, so only insert the buffer once it is filled.  */
+  buf = grub_malloc (data->nodesize);
+  if (!buf)
+    return grub_errno;
+  err = grub_btrfs_read_logical (data, addr, buf, data->nodesize,
+				 recursion_depth);
+  if (err)
+    {
+      grub_free (buf);
+      return err;
+    }
+  grub_memcpy (head, buf, sizeof (*head));
+  node_cache_insert (data, addr, buf);
   return GRUB_ERR_NONE;
 }
 
+static void
+prefetch_nodes (struct grub_btrfs_data *data, const grub_disk_addr_t *addrs,
+		unsigned n);
+
+/* If the children of the internal node described by PARENT are leaves
+   and the one at its current position isn't cached yet, read it together
+   with the following siblings.  Errors are ignored, the leaves are then
+   simply read on demand.  */
+static void
+prefetch_leaves (struct grub_btrfs_data *data,
+		 const struct grub_btrfs_leaf_descriptor_entry *parent)
+{
+  struct grub_btrfs_node_cache *node;
+  struct btrfs_header *head;
+  grub_disk_addr_t addrs[GRUB_BTRFS_PREFETCH_LEAVES];
+  unsigned i, n = 0;
+
+  node = node_cache_find (data, parent->addr, data->nodesize);
+  if (!node)
+    return;
+  head = (struct btrfs_header *) node->buf;
+  if (head->level != 1)
+    return;
+
+  for (i = parent->iter; i < parent->maxiter
+	 && i < grub_le_to_cpu32 (head->nitems)
+	 && n < GRUB_BTRFS_PREFETCH_LEAVES; i++)
+    {
+      struct grub_btrfs_internal_node *child;
+      grub_disk_addr_t addr;
+
+      if ((i + 1) * sizeof (*child) > data->nodesize - sizeof (*head))
+	break;
+      child = (struct grub_btrfs_internal_node *) (head + 1) + i;
+      addr = grub_le_to_cpu64 (child->addr);
+      if (node_cache_find (data, addr, data->nodesize))
+	{
+	  if (i == parent->iter)
+	    return;
+	  continue;
+	}
+      addrs[n++] = addr;
+    }
+
+  prefetch_nodes (data, addrs, n);
+}
+
 static grub_err_t
 save_ref (struct grub_btrfs_leaf_descriptor *desc,
 	  grub_disk_addr_t addr, unsigned i, unsigned m, int l)
@@ -381,14 +582,17 @@ next (struct grub_btrfs_data *data,
       if (err)
 	return -err;
 
-      err = grub_btrfs_read_logical (data, grub_le_to_cpu64 (node.addr),
-				     &head, sizeof (head), 0);
+      if (desc->prefetch)
+	prefetch_leaves (data, &desc->data[desc->depth - 1]);
+
+      err = read_node_header (data, grub_le_to_cpu64 (node.addr), &head, 0);
       if (err)
 	return -err;
-      check_btrfs_header (data, &head, grub_le_to_cpu64 (node.addr));
 
-      save_ref (desc, grub_le_to_cpu64 (node.addr), 0,
-		grub_le_to_cpu32 (head.nitems), !head.level);
+      err = save_ref (desc, grub_le_to_cpu64 (node.addr), 0,
+		      grub_le_to_cpu32 (head.nitems), !head.level);
+      if (err)
+	return -err;
     }
   err = grub_btrfs_read_logical (data, desc->data[desc->depth - 1].iter
 				 * sizeof (leaf)
@@ -420,6 +624,7 @@ lower_bound (struct grub_btrfs_data *data,
     {
       desc->allocated = 16;
       desc->depth = 0;
+      desc->prefetch = 0;
       desc->data = grub_calloc (desc->allocated, sizeof (desc->data[0]));
       if (!desc->data)
 	return grub_errno;
@@ -442,12 +647,9 @@ lower_bound (struct grub_btrfs_data *data,
 
     reiter:
       depth++;
-      /* FIXME: preread few nodes into buffer. */
-      err = grub_btrfs_read_logical (data, addr, &head, sizeof (head),
-				     recursion_depth + 1);
+      err = read_node_header (data, addr, &head, recursion_depth + 1);
       if (err)
 	return err;
-      check_btrfs_header (data, &head, addr);
       addr += sizeof (head);
       if (head.level)
 	{
@@ -649,12 +851,197 @@ find_device (struct grub_btrfs_data *data, grub_uint64_t id)
     }
   data->devices_attached[data->n_devices_attached - 1].id = id;
   data->devices_attached[data->n_devices_attached - 1].dev = ctx.dev_found;
+  data->devices_attached[data->n_devices_attached - 1].read_errors = 0;
   return ctx.dev_found;
 }
 
+/* Return the device of stripe STRIPEN of the chunk MAP.  */
+static grub_device_t
+chunk_map_device (struct grub_btrfs_data *data,
+		  struct grub_btrfs_chunk_map *map, grub_uint64_t stripen)
+{
+  struct grub_btrfs_chunk_stripe *stripe;
+  grub_device_t dev;
+  unsigned i;
+
+  if (map->devidx[stripen])
+    return data->devices_attached[map->devidx[stripen] - 1].dev;
+
+  stripe = (struct grub_btrfs_chunk_stripe *) (map->chunk + 1) + stripen;
+  dev = find_device (data, stripe->device_id);
+  for (i = 0; i < data->n_devices_attached; i++)
+    if (data->devices_attached[i].id == stripe->device_id)
+      {
+	map->devidx[stripen] = i + 1;
+	break;
+      }
+  return dev;
+}
+
+/* Find the chunk containing the logical address ADDR.  */
+static struct grub_btrfs_chunk_map *
+chunk_map_lookup (struct grub_btrfs_data *data, grub_uint64_t addr)
+{
+  unsigned lo = 0, hi = data->n_chunks;
+
+  while (lo < hi)
+    {
+      unsigned mid = lo + (hi - lo) / 2;
+
+      if (data->chunks[mid].start > addr)
+	hi = mid;
+      else
+	lo = mid + 1;
+    }
+
+  if (lo == 0 || addr - data->chunks[lo - 1].start >= data->chunks[lo - 1].size)
+    return NULL;
+  return &data->chunks[lo - 1];
+}
+
+/* Add CHUNK, a malloc'ed chunk item starting at logical address START,
+   to the chunk map, which takes ownership of it.  */
+static struct grub_btrfs_chunk_map *
+chunk_map_insert (struct grub_btrfs_data *data, grub_uint64_t start,
+		  struct grub_btrfs_chunk_item *chunk)
+{
+  struct grub_btrfs_chunk_map *map;
+  grub_uint16_t nstripes = grub_le_to_cpu16 (chunk->nstripes);
+  unsigned lo = 0, hi = data->n_chunks;
+  unsigned *devidx;
+
+  while (lo < hi)
+    {
+      unsigned mid = lo + (hi - lo) / 2;
+
+      if (data->chunks[mid].start >= start)
+	hi = mid;
+      else
+	lo = mid + 1;
+    }
+
+  if (lo < data->n_chunks && data->chunks[lo].start == start)
+    {
+      grub_free (chunk);
+      return &data->chunks[lo];
+    }
+
+  devidx = grub_calloc (nstripes ? : 1, sizeof (devidx[0]));
+  if (!devidx)
+    {
+      grub_free (chunk);
+      return NULL;
+    }
+
+  if (data->n_chunks == data->n_chunks_allocated)
+    {
+      unsigned n = data->n_chunks_allocated ? data->n_chunks_allocated * 2 : 16;
+      grub_size_t sz;
+
+      if (grub_mul (n, sizeof (data->chunks[0]), &sz))
+	map = NULL;
+      else
+	map = grub_realloc (data->chunks, sz);
+      if (!map)
+	{
+	  grub_free (devidx);
+	  grub_free (chunk);
+	  return NULL;
+	}
+      data->chunks = map;
+      data->n_chunks_allocated = n;
+    }
+
+  map = &data->chunks[lo];
+  grub_memmove (map + 1, map, (data->n_chunks - lo) * sizeof (*map));
+  data->n_chunks++;
+  map->start = start;
+  map->size = grub_le_to_cpu64 (chunk->size);
+  map->chunk = chunk;
+  map->devidx = devidx;
+  return map;
+}
+
+static void
+chunk_map_free (struct grub_btrfs_data *data)
+{
+  unsigned i;
+
+  for (i = 0; i < data->n_chunks; i++)
+    {
+      grub_free (data->chunks[i].chunk);
+      grub_free (data->chunks[i].devidx);
+    }
+  grub_free (data->chunks);
+}
+
+/* Read the tree nodes at logical addresses ADDRS into the cache with one
+   vectored read.  Only nodes in chunks which keep a full copy on their
+   first stripe and on the same disk are read, the others are left to be
+   read on demand.  */
+static void
+prefetch_nodes (struct grub_btrfs_data *data, const grub_disk_addr_t *addrs,
+		unsigned n)
+{
+  struct grub_disk_iovec iov[GRUB_BTRFS_PREFETCH_LEAVES];
+  grub_disk_addr_t laddrs[GRUB_BTRFS_PREFETCH_LEAVES];
+  grub_disk_t disk = NULL;
+  unsigned i, cnt = 0;
+
+  for (i = 0; i < n && cnt < ARRAY_SIZE (iov); i++)
+    {
+      struct grub_btrfs_chunk_map *map;
+      struct grub_btrfs_chunk_stripe *stripe;
+      grub_uint64_t type, off;
+      grub_disk_addr_t paddr;
+      grub_device_t dev;
+
+      map = chunk_map_lookup (data, addrs[i]);
+      if (!map)
+	continue;
+      type = grub_le_to_cpu64 (map->chunk->type)
+	& ~GRUB_BTRFS_CHUNK_TYPE_BITS_DONTCARE;
+      if (type != GRUB_BTRFS_CHUNK_TYPE_SINGLE
+	  && type != GRUB_BTRFS_CHUNK_TYPE_DUPLICATED
+	  && type != GRUB_BTRFS_CHUNK_TYPE_RAID1
+	  && type != GRUB_BTRFS_CHUNK_TYPE_RAID1C3
+	  && type != GRUB_BTRFS_CHUNK_TYPE_RAID1C4)
+	continue;
+      off = addrs[i] - map->start;
+      if (map->size - off < data->nodesize)
+	continue;
+
+      stripe = (struct grub_btrfs_chunk_stripe *) (map->chunk + 1);
+      paddr = grub_le_to_cpu64 (stripe->offset) + off;
+      if (paddr & (GRUB_DISK_SECTOR_SIZE - 1))
+	continue;
+      dev = chunk_map_device (data, map, 0);
+      if (!dev || !dev->disk || (disk && dev->disk != disk))
+	continue;
+      disk = dev->disk;
+
+      iov[cnt].buf = grub_malloc (data->nodesize);
+      if (!iov[cnt].buf)
+	break;
+      iov[cnt].sector = paddr >> GRUB_DISK_SECTOR_BITS;
+      iov[cnt].size = data->nodesize;
+      laddrs[cnt] = addrs[i];
+      cnt++;
+    }
+
+  if (cnt && grub_disk_readv (disk, iov, cnt) == GRUB_ERR_NONE)
+    for (i = 0; i < cnt; i++)
+      node_cache_insert (data, laddrs[i], (grub_uint8_t *) iov[i].buf);
+  else
+    for (i = 0; i < cnt; i++)
+      grub_free (iov[i].buf);
+
+  grub_errno = GRUB_ERR_NONE;
+}
+
 static grub_err_t
 btrfs_read_from_chunk (struct grub_btrfs_data *data,
-		       struct grub_btrfs_chunk_item *chunk,
+		       struct grub_btrfs_chunk_map *map,
 		       grub_uint64_t stripen, grub_uint64_t stripe_offset,
 		       int redundancy, grub_uint64_t csize,
 		       void *buf)
@@ -664,10 +1051,11 @@ btrfs_read_from_chunk (struct grub_btrfs_data *data,
     grub_device_t dev;
     grub_err_t err;
 
-    stripe = (struct grub_btrfs_chunk_stripe *) (chunk + 1);
+    stripe = (struct grub_btrfs_chunk_stripe *) (map->chunk + 1);
     /* Right now the redundancy handling is easy.
        With RAID5-like it will be more difficult.  */
-    stripe += stripen + redundancy;
+    stripen += redundancy;
+    stripe += stripen;
 
     paddr = grub_le_to_cpu64 (stripe->offset) + stripe_offset;
 
@@ -676,7 +1064,7 @@ btrfs_read_from_chunk (struct grub_btrfs_data *data,
 		  "reading paddr 0x%" PRIxGRUB_UINT64_T "\n",
 		  stripen, stripe->offset, paddr);
 
-    dev = find_device (data, stripe->device_id);
+    dev = chunk_map_device (data, map, stripen);
     if (!dev)
       {
 	grub_dprintf ("btrfs",
@@ -692,6 +1080,57 @@ btrfs_read_from_chunk (struct grub_btrfs_data *data,
     return err;
 }
 
+/* Copies of mirrored chunks are read starting at one chosen by the logical
+   address in units of 1 << BTRFS_BALANCE_SHIFT bytes.  */
+#define BTRFS_BALANCE_SHIFT 20
+
+/* Read CSIZE bytes at STRIPE_OFFSET from the first of the REDUNDANCY copies
+   starting at stripe STRIPEN that can be read.  The first copy tried
+   depends on ADDR, and copies on devices which failed before come last.  */
+static grub_err_t
+btrfs_read_copies (struct grub_btrfs_data *data,
+		   struct grub_btrfs_chunk_map *map,
+		   grub_uint64_t stripen, grub_uint64_t stripe_offset,
+		   unsigned redundancy, grub_uint64_t addr,
+		   grub_uint64_t csize, void *buf)
+{
+  grub_uint64_t first;
+  grub_uint32_t failed = 0;
+  unsigned i, k, pass;
+  grub_err_t err = GRUB_ERR_READ_ERROR;
+
+  grub_divmod64 (addr >> BTRFS_BALANCE_SHIFT, redundancy, &first);
+
+  for (pass = 0; pass < 2; pass++)
+    for (i = 0; i < redundancy; i++)
+      {
+	struct grub_btrfs_device_desc *desc = NULL;
+
+	k = ((unsigned) first + i) % redundancy;
+	if (pass && k < 32 && (failed & (1U << k)))
+	  continue;
+
+	if (chunk_map_device (data, map, stripen + k) && map->devidx[stripen + k])
+	  desc = &data->devices_attached[map->devidx[stripen + k] - 1];
+	grub_errno = GRUB_ERR_NONE;
+	if ((! desc || desc->read_errors) != pass)
+	  continue;
+
+	err = btrfs_read_from_chunk (data, map, stripen, stripe_offset,
+				     k, csize, buf);
+	if (!err)
+	  return GRUB_ERR_NONE;
+	grub_errno = GRUB_ERR_NONE;
+
+	if (desc)
+	  desc->read_errors++;
+	if (k < 32)
+	  failed |= 1U << k;
+      }
+
+  return err;
+}
+
 struct raid56_buffer {
   void *buf;
   int  data_is_valid;
@@ -754,10 +1193,11 @@ rebuild_raid6 (struct raid56_buffer *buffers, grub_uint64_t nstripes,
 
 static grub_err_t
 raid56_read_retry (struct grub_btrfs_data *data,
-		   struct grub_btrfs_chunk_item *chunk,
+		   struct grub_btrfs_chunk_map *map,
 		   grub_uint64_t stripe_offset, grub_uint64_t stripen,
 		   grub_uint64_t csize, void *buf, grub_uint64_t parities_pos)
 {
+  struct grub_btrfs_chunk_item *chunk = map->chunk;
   struct raid56_buffer *buffers;
   grub_uint64_t nstripes = grub_le_to_cpu16 (chunk->nstripes);
   grub_uint64_t chunk_type = grub_le_to_cpu64 (chunk->type);
@@ -793,7 +1233,7 @@ raid56_read_retry (struct grub_btrfs_data *data,
                     " from stripe ID %" PRIxGRUB_UINT64_T "\n",
                     paddr, stripe->device_id);
 
-      dev = find_device (data, stripe->device_id);
+      dev = chunk_map_device (data, map, i);
       if (!dev)
 	{
 	  grub_dprintf ("btrfs", "stripe %" PRIuGRUB_UINT64_T " FAILED (dev ID %"
@@ -857,101 +1297,163 @@ raid56_read_retry (struct grub_btrfs_data *data,
   return ret;
 }
 
+/* Look up the chunk containing the logical address ADDR, first in the
+   bootstrap mapping and then in the chunk tree, and add it to the chunk
+   map.  */
+static grub_err_t
+chunk_map_load (struct grub_btrfs_data *data, grub_disk_addr_t addr,
+		int recursion_depth)
+{
+  grub_uint8_t *ptr;
+  grub_uint8_t *end = data->sblock.bootstrap_mapping
+    + sizeof (data->sblock.bootstrap_mapping);
+  struct grub_btrfs_key *key;
+  struct grub_btrfs_chunk_item *chunk;
+  grub_err_t err;
+  struct grub_btrfs_key key_out;
+  struct grub_btrfs_key key_in;
+  grub_size_t chsize;
+  grub_disk_addr_t chaddr;
+
+  for (ptr = data->sblock.bootstrap_mapping;
+       ptr < end - sizeof (struct grub_btrfs_key);)
+    {
+      key = (struct grub_btrfs_key *) ptr;
+      if (key->type != GRUB_BTRFS_ITEM_TYPE_CHUNK)
+	break;
+      chunk = (struct grub_btrfs_chunk_item *) (key + 1);
+      grub_dprintf ("btrfs",
+		    "%" PRIxGRUB_UINT64_T " %" PRIxGRUB_UINT64_T " \n",
+		    grub_le_to_cpu64 (key->offset),
+		    grub_le_to_cpu64 (chunk->size));
+      chsize = sizeof (*chunk) + sizeof (struct grub_btrfs_chunk_stripe)
+	* grub_le_to_cpu16 (chunk->nstripes);
+      if (grub_le_to_cpu64 (key->offset) <= addr
+	  && addr < grub_le_to_cpu64 (key->offset)
+	  + grub_le_to_cpu64 (chunk->size))
+	{
+	  struct grub_btrfs_chunk_item *copy;
+
+	  if ((grub_uint8_t *) chunk + chsize > end)
+	    return grub_error (GRUB_ERR_BAD_FS,
+			       "invalid bootstrap chunk mapping");
+	  copy = grub_malloc (chsize);
+	  if (!copy)
+	    return grub_errno;
+	  grub_memcpy (copy, chunk, chsize);
+	  if (!chunk_map_insert (data, grub_le_to_cpu64 (key->offset), copy))
+	    return grub_errno;
+	  return GRUB_ERR_NONE;
+	}
+      ptr += sizeof (*key) + chsize;
+    }
+
+  key_in.object_id = grub_cpu_to_le64_compile_time (GRUB_BTRFS_OBJECT_ID_CHUNK);
+  key_in.type = GRUB_BTRFS_ITEM_TYPE_CHUNK;
+  key_in.offset = grub_cpu_to_le64 (addr);
+  err = lower_bound (data, &key_in, &key_out,
+		     data->sblock.chunk_tree,
+		     &chaddr, &chsize, NULL, recursion_depth);
+  if (err)
+    return err;
+  key = &key_out;
+  if (key->type != GRUB_BTRFS_ITEM_TYPE_CHUNK
+      || !(grub_le_to_cpu64 (key->offset) <= addr))
+    return grub_error (GRUB_ERR_BAD_FS,
+		       "couldn't find the chunk descriptor");
+
+  if (!chsize)
+    {
+      grub_dprintf ("btrfs", "zero-size chunk\n");
+      return grub_error (GRUB_ERR_BAD_FS,
+			 "got an invalid zero-size chunk");
+    }
+
+  /*
+   * The space being allocated for a chunk should at least be able to
+   * contain one chunk item.
+   */
+  if (chsize < sizeof (struct grub_btrfs_chunk_item))
+   {
+     grub_dprintf ("btrfs", "chunk-size too small\n");
+     return grub_error (GRUB_ERR_BAD_FS,
+                        "got an invalid chunk size");
+   }
+  chunk = grub_malloc (chsize);
+  if (!chunk)
+    return grub_errno;
+
+  err = grub_btrfs_read_logical (data, chaddr, chunk, chsize,
+				 recursion_depth);
+  if (err)
+    {
+      grub_free (chunk);
+      return err;
+    }
+
+  /* The stripes live behind the chunk item.  */
+  if (chsize < sizeof (*chunk) + sizeof (struct grub_btrfs_chunk_stripe)
+      * grub_le_to_cpu16 (chunk->nstripes))
+    {
+      grub_free (chunk);
+      return grub_error (GRUB_ERR_BAD_FS, "got an invalid chunk size");
+    }
+
+  if (!chunk_map_insert (data, grub_le_to_cpu64 (key->offset), chunk))
+    return grub_errno;
+  return GRUB_ERR_NONE;
+}
+
 static grub_err_t
 grub_btrfs_read_logical (struct grub_btrfs_data *data, grub_disk_addr_t addr,
 			 void *buf, grub_size_t size, int recursion_depth)
 {
+  struct grub_btrfs_node_cache *node;
+
+  node = node_cache_find (data, addr, size);
+  if (node)
+    {
+      grub_memcpy (buf, node->buf + (addr - node->addr), size);
+      return GRUB_ERR_NONE;
+    }
+
   while (size > 0)
     {
-      grub_uint8_t *ptr;
-      struct grub_btrfs_key *key;
+      struct grub_btrfs_chunk_map *map;
       struct grub_btrfs_chunk_item *chunk;
       grub_uint64_t csize;
       grub_err_t err = 0;
-      struct grub_btrfs_key key_out;
-      int challoc = 0;
-      struct grub_btrfs_key key_in;
-      grub_size_t chsize;
-      grub_disk_addr_t chaddr;
 
       grub_dprintf ("btrfs", "searching for laddr %" PRIxGRUB_UINT64_T "\n",
 		    addr);
-      for (ptr = data->sblock.bootstrap_mapping;
-	   ptr < data->sblock.bootstrap_mapping
-	   + sizeof (data->sblock.bootstrap_mapping)
-	   - sizeof (struct grub_btrfs_key);)
-	{
-	  key = (struct grub_btrfs_key *) ptr;
-	  if (key->type != GRUB_BTRFS_ITEM_TYPE_CHUNK)
-	    break;
-	  chunk = (struct grub_btrfs_chunk_item *) (key + 1);
-	  grub_dprintf ("btrfs",
-			"%" PRIxGRUB_UINT64_T " %" PRIxGRUB_UINT64_T " \n",
-			grub_le_to_cpu64 (key->offset),
-			grub_le_to_cpu64 (chunk->size));
-	  if (grub_le_to_cpu64 (key->offset) <= addr
-	      && addr < grub_le_to_cpu64 (key->offset)
-	      + grub_le_to_cpu64 (chunk->size))
-	    goto chunk_found;
-	  ptr += sizeof (*key) + sizeof (*chunk)
-	    + sizeof (struct grub_btrfs_chunk_stripe)
-	    * grub_le_to_cpu16 (chunk->nstripes);
-	}
-
-      key_in.object_id = grub_cpu_to_le64_compile_time (GRUB_BTRFS_OBJECT_ID_CHUNK);
-      key_in.type = GRUB_BTRFS_ITEM_TYPE_CHUNK;
-      key_in.offset = grub_cpu_to_le64 (addr);
-      err = lower_bound (data, &key_in, &key_out,
-			 data->sblock.chunk_tree,
-			 &chaddr, &chsize, NULL, recursion_depth);
-      if (err)
-	return err;
-      key = &key_out;
-      if (key->type != GRUB_BTRFS_ITEM_TYPE_CHUNK
-	  || !(grub_le_to_cpu64 (key->offset) <= addr))
-	return grub_error (GRUB_ERR_BAD_FS,
-			   "couldn't find the chunk descriptor");
-
-      if (!chsize)
-	{
-	  grub_dprintf ("btrfs", "zero-size chunk\n");
-	  return grub_error (GRUB_ERR_BAD_FS,
-			     "got an invalid zero-size chunk");
-	}
-
-      /*
-       * The space being allocated for a chunk should at least be able to
-       * contain one chunk item.
-       */
-      if (chsize < sizeof (struct grub_btrfs_chunk_item))
-       {
-         grub_dprintf ("btrfs", "chunk-size too small\n");
-         return grub_error (GRUB_ERR_BAD_FS,
-                            "got an invalid chunk size");
-       }
-      chunk = grub_malloc (chsize);
-      if (!chunk)
-	return grub_errno;
 
-      challoc = 1;
-      err = grub_btrfs_read_logical (data, chaddr, chunk, chsize,
-				     recursion_depth);
-      if (err)
+      map = chunk_map_lookup (data, addr);
+      if (!map)
 	{
-	  grub_free (chunk);
-	  return err;
+	  err = chunk_map_load (data, addr, recursion_depth);
+	  if (err)
+	    return err;
+	  map = chunk_map_lookup (data, addr);
+	  if (!map)
+	    {
+	      grub_dprintf ("btrfs", "no chunk\n");
+	      return grub_error (GRUB_ERR_BAD_FS,
+				 "couldn't find the chunk descriptor");
+	    }
 	}
+      chunk = map->chunk;
 
-    chunk_found:
       {
 	grub_uint64_t stripen;
 	grub_uint64_t stripe_offset;
-	grub_uint64_t off = addr - grub_le_to_cpu64 (key->offset);
+	grub_uint64_t off = addr - map->start;
 	grub_uint64_t chunk_stripe_length;
 	grub_uint16_t nstripes;
 	unsigned redundancy = 1;
-	unsigned i, j;
+	unsigned j;
 	int is_raid56;
+	/* Whether the copies are on different devices.  */
+	int balance = 0;
 	grub_uint64_t parities_pos = 0;
 
         is_raid56 = !!(grub_le_to_cpu64 (chunk->type) &
@@ -971,7 +1473,7 @@ grub_btrfs_read_logical (struct grub_btrfs_data *data, grub_disk_addr_t addr,
 		      "+0x%" PRIxGRUB_UINT64_T
 		      " (%d stripes (%d substripes) of %"
 		      PRIxGRUB_UINT64_T ")\n",
-		      grub_le_to_cpu64 (key->offset),
+		      map->start,
 		      grub_le_to_cpu64 (chunk->size),
 		      nstripes,
 		      grub_le_to_cpu16 (chunk->nsubstripes),
@@ -1009,8 +1511,10 @@ grub_btrfs_read_logical (struct grub_btrfs_data *data, grub_disk_addr_t addr,
 	  case GRUB_BTRFS_CHUNK_TYPE_RAID1C3:
 	    redundancy++;
 	    /* fall through */
-	  case GRUB_BTRFS_CHUNK_TYPE_DUPLICATED:
 	  case GRUB_BTRFS_CHUNK_TYPE_RAID1:
+	    balance = 1;
+	    /* fall through */
+	  case GRUB_BTRFS_CHUNK_TYPE_DUPLICATED:
 	    {
 	      grub_dprintf ("btrfs", "RAID1 (copies: %d)\n", ++redundancy);
 	      stripen = 0;
@@ -1062,6 +1566,7 @@ grub_btrfs_read_logical (struct grub_btrfs_data *data, grub_disk_addr_t addr,
 				    &stripen);
 	      stripen *= nsubstripes;
 	      redundancy = nsubstripes;
+	      balance = 1;
 	      stripe_offset = low + chunk_stripe_length
 		* high;
 	      csize = chunk_stripe_length - low;
@@ -1191,7 +1696,7 @@ grub_btrfs_read_logical (struct grub_btrfs_data *data, grub_disk_addr_t addr,
 			  "+0x%" PRIxGRUB_UINT64_T
 			  " (%d stripes (%d substripes) of %"
 			  PRIxGRUB_UINT64_T ")\n",
-			  grub_le_to_cpu64 (key->offset),
+			  map->start,
 			  grub_le_to_cpu64 (chunk->size),
 			  grub_le_to_cpu16 (chunk->nstripes),
 			  grub_le_to_cpu16 (chunk->nsubstripes),
@@ -1217,26 +1722,19 @@ grub_btrfs_read_logical (struct grub_btrfs_data *data, grub_disk_addr_t addr,
 
 	    if (is_raid56)
 	      {
-		err = btrfs_read_from_chunk (data, chunk, stripen,
+		err = btrfs_read_from_chunk (data, map, stripen,
 					     stripe_offset,
 					     0,     /* no mirror */
 					     csize, buf);
 		grub_errno = GRUB_ERR_NONE;
 		if (err)
-		  err = raid56_read_retry (data, chunk, stripe_offset,
+		  err = raid56_read_retry (data, map, stripe_offset,
 					   stripen, csize, buf, parities_pos);
 	      }
 	    else
-	      for (i = 0; i < redundancy; i++)
-		{
-		  err = btrfs_read_from_chunk (data, chunk, stripen,
-					       stripe_offset,
-					       i,     /* redundancy */
-					       csize, buf);
-		  if (!err)
-		    break;
-		  grub_errno = GRUB_ERR_NONE;
-		}
+	      err = btrfs_read_copies (data, map, stripen, stripe_offset,
+				       redundancy, balance ? addr : 0,
+				       csize, buf);
 	    if (!err)
 	      break;
 	  }
@@ -1246,8 +1744,6 @@ grub_btrfs_read_logical (struct grub_btrfs_data *data, grub_disk_addr_t addr,
       size -= csize;
       buf = (grub_uint8_t *) buf + csize;
       addr += csize;
-      if (challoc)
-	grub_free (chunk);
     }
   return GRUB_ERR_NONE;
 }
@@ -1256,6 +1752,7 @@ static struct grub_btrfs_data *
 grub_btrfs_mount (grub_device_t dev)
 {
   struct grub_btrfs_data *data;
+  grub_uint32_t nodesize;
   grub_err_t err;
 
   if (!dev->disk)
@@ -1264,6 +1761,15 @@ grub_btrfs_mount (grub_device_t dev)
       return NULL;
     }
 
+  /* A parked mount keeps the other devices of the filesystem open, so
+     they need not be searched for again.  */
+  data = grub_fshelp_mount_get ("btrfs", dev->disk);
+  if (data)
+    {
+      data->devices_attached[0].dev = dev;
+      return data;
+    }
+
   data = grub_zalloc (sizeof (*data));
   if (!data)
     return NULL;
@@ -1286,23 +1792,55 @@ grub_btrfs_mount (grub_device_t dev)
   data->n_devices_attached = 1;
   data->devices_attached[0].dev = dev;
   data->devices_attached[0].id = data->sblock.this_device.device_id;
+  data->devices_attached[0].read_errors = 0;
+
+  nodesize = grub_le_to_cpu32 (data->sblock.nodesize);
+  if (nodesize >= 4096 && nodesize <= 65536 && !(nodesize & (nodesize - 1)))
+    data->nodesize = nodesize;
 
   return data;
 }
 
 static void
-grub_btrfs_unmount (struct grub_btrfs_data *data)
+grub_btrfs_free (void *ptr)
 {
+  struct grub_btrfs_data *data = ptr;
   unsigned i;
-  /* The device 0 is closed one layer upper.  */
+
   for (i = 1; i < data->n_devices_attached; i++)
     if (data->devices_attached[i].dev)
         grub_device_close (data->devices_attached[i].dev);
   grub_free (data->devices_attached);
+  chunk_map_free (data);
+  node_cache_free (data);
   grub_free (data->extent);
+  grub_free (data->zstd_buf);
+  ZSTD_freeDCtx (data->zstd_dctx);
   grub_free (data);
 }
 
+/* Release DATA, keeping the mount for the next user of its disk.  */
+static void
+grub_btrfs_unmount (struct grub_btrfs_data *data)
+{
+  grub_disk_t disk = data->devices_attached[0].dev->disk;
+  unsigned i;
+
+  /* The device 0 is closed one layer upper.  */
+  data->devices_attached[0].dev = NULL;
+
+  /* Don't remember devices as missing, they may show up later, e.g.
+     after cryptomount.  */
+  for (i = 1; i < data->n_devices_attached; i++)
+    if (!data->devices_attached[i].dev)
+      {
+	grub_btrfs_free (data);
+	return;
+      }
+
+  grub_fshelp_mount_put ("btrfs", disk, data, grub_btrfs_free);
+}
+
 static grub_err_t
 grub_btrfs_read_inode (struct grub_btrfs_data *data,
 		       struct grub_btrfs_inode *inode, grub_uint64_t num,
@@ -1349,73 +1887,144 @@ static ZSTD_customMem grub_zstd_allocator (void)
   return allocator;
 }
 
+/*
+ * Decompress all the zstd frames in IBUF into the mount's zstd buffer,
+ * invalidating the extent it held.  Returns the decompressed size or -1.
+ */
 static grub_ssize_t
-grub_btrfs_zstd_decompress (char *ibuf, grub_size_t isize, grub_off_t off,
-			    char *obuf, grub_size_t osize)
+grub_btrfs_zstd_decode (struct grub_btrfs_data *data,
+			char *ibuf, grub_size_t isize)
 {
-  void *allocated = NULL;
-  char *otmpbuf = obuf;
-  grub_size_t otmpsize = osize;
-  ZSTD_DCtx *dctx = NULL;
-  grub_size_t zstd_ret;
-  grub_ssize_t ret = -1;
+  grub_size_t olen = 0;
+
+  data->zstd_laddr = 0;
+  data->zstd_zsize = 0;
+  data->zstd_len = 0;
 
   /*
    * Zstd will fail if it can't fit the entire output in the destination
-   * buffer, so if osize isn't large enough, allocate a temporary buffer.
+   * buffer, so always decompress into a buffer large enough for any
+   * extent.
    */
-  if (otmpsize < ZSTD_BTRFS_MAX_INPUT)
+  if (!data->zstd_buf)
     {
-      allocated = grub_malloc (ZSTD_BTRFS_MAX_INPUT);
-      if (!allocated)
+      data->zstd_buf = grub_malloc (ZSTD_BTRFS_MAX_INPUT);
+      if (!data->zstd_buf)
 	{
 	  grub_error (GRUB_ERR_OUT_OF_MEMORY, "failed allocate a zstd buffer");
-	  goto err;
+	  return -1;
 	}
-      otmpbuf = (char *) allocated;
-      otmpsize = ZSTD_BTRFS_MAX_INPUT;
     }
 
-  /* Create the ZSTD_DCtx. */
-  dctx = ZSTD_createDCtx_advanced (grub_zstd_allocator ());
-  if (!dctx)
+  /* Create the ZSTD_DCtx once per mount. */
+  if (!data->zstd_dctx)
     {
-      /* ZSTD_createDCtx_advanced() only fails if it is out of memory. */
-      grub_error (GRUB_ERR_OUT_OF_MEMORY, "failed to create a zstd context");
-      goto err;
+      data->zstd_dctx = ZSTD_createDCtx_advanced (grub_zstd_allocator ());
+      if (!data->zstd_dctx)
+	{
+	  /* ZSTD_createDCtx_advanced() only fails if it is out of memory. */
+	  grub_error (GRUB_ERR_OUT_OF_MEMORY,
+		      "failed to create a zstd context");
+	  return -1;
+	}
     }
 
   /*
-   * Get the real input size, there may be junk at the
-   * end of the frame.
+   * The data normally is one frame, but decode any frames following it
+   * until the junk padding the end of the extent.
    */
-  isize = ZSTD_findFrameCompressedSize (ibuf, isize);
-  if (ZSTD_isError (isize))
+  while (isize > 0 && olen < ZSTD_BTRFS_MAX_INPUT)
     {
-      grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, "zstd data corrupted");
-      goto err;
+      grub_size_t fsize, zstd_ret;
+
+      fsize = ZSTD_findFrameCompressedSize (ibuf, isize);
+      if (ZSTD_isError (fsize))
+	{
+	  if (olen)
+	    break;
+	  grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, "zstd data corrupted");
+	  return -1;
+	}
+
+      zstd_ret = ZSTD_decompressDCtx (data->zstd_dctx, data->zstd_buf + olen,
+				      ZSTD_BTRFS_MAX_INPUT - olen,
+				      ibuf, fsize);
+      if (ZSTD_isError (zstd_ret))
+	{
+	  grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, "zstd data corrupted");
+	  return -1;
+	}
+
+      olen += zstd_ret;
+      ibuf += fsize;
+      isize -= fsize;
     }
 
-  /* Decompress and check for errors. */
-  zstd_ret = ZSTD_decompressDCtx (dctx, otmpbuf, otmpsize, ibuf, isize);
-  if (ZSTD_isError (zstd_ret))
+  data->zstd_len = olen;
+  return olen;
+}
+
+/* Copy OSIZE bytes at offset OFF of the decompressed data into OBUF.  */
+static grub_ssize_t
+grub_btrfs_zstd_copy (struct grub_btrfs_data *data, grub_off_t off,
+		      char *obuf, grub_size_t osize)
+{
+  if (off > data->zstd_len || data->zstd_len - off < osize)
     {
-      grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, "zstd data corrupted");
-      goto err;
+      grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		  "premature end of compressed");
+      return -1;
     }
 
-  /*
-   * Move the requested data into the obuf. obuf may be equal
-   * to otmpbuf, which is why grub_memmove() is required.
-   */
-  grub_memmove (obuf, otmpbuf + off, osize);
-  ret = osize;
+  grub_memcpy (obuf, data->zstd_buf + off, osize);
+  return osize;
+}
 
-err:
-  grub_free (allocated);
-  ZSTD_freeDCtx (dctx);
+static grub_ssize_t
+grub_btrfs_zstd_decompress (struct grub_btrfs_data *data,
+			    char *ibuf, grub_size_t isize, grub_off_t off,
+			    char *obuf, grub_size_t osize)
+{
+  if (grub_btrfs_zstd_decode (data, ibuf, isize) < 0)
+    return -1;
+  return grub_btrfs_zstd_copy (data, off, obuf, osize);
+}
 
-  return ret;
+/*
+ * Read OSIZE bytes at offset OFF of the regular zstd extent of compressed
+ * size ZSIZE at logical address LADDR.  The extent stays decompressed, so
+ * reading through it piece by piece decompresses it only once.
+ */
+static grub_ssize_t
+grub_btrfs_zstd_extent_read (struct grub_btrfs_data *data,
+			     grub_uint64_t laddr, grub_uint64_t zsize,
+			     grub_off_t off, char *obuf, grub_size_t osize)
+{
+  grub_ssize_t ret;
+  grub_err_t err;
+  char *tmp;
+
+  if (data->zstd_laddr == laddr && data->zstd_zsize == zsize)
+    return grub_btrfs_zstd_copy (data, off, obuf, osize);
+
+  tmp = grub_malloc (zsize);
+  if (!tmp)
+    return -1;
+  err = grub_btrfs_read_logical (data, laddr, tmp, zsize, 0);
+  if (err)
+    {
+      grub_free (tmp);
+      return -1;
+    }
+
+  ret = grub_btrfs_zstd_decode (data, tmp, zsize);
+  grub_free (tmp);
+  if (ret < 0)
+    return -1;
+
+  data->zstd_laddr = laddr;
+  data->zstd_zsize = zsize;
+  return grub_btrfs_zstd_copy (data, off, obuf, osize);
 }
 
 static grub_ssize_t
@@ -1668,7 +2277,8 @@ grub_btrfs_extent_read (struct grub_btrfs_data *data,
 	    }
 	  else if (data->extent->compression == GRUB_BTRFS_COMPRESSION_ZSTD)
 	    {
-	      if (grub_btrfs_zstd_decompress (data->extent->inl, data->extsize -
+	      if (grub_btrfs_zstd_decompress (data, data->extent->inl,
+					      data->extsize -
 					      ((grub_uint8_t *) data->extent->inl
 					       - (grub_uint8_t *) data->extent),
 					      extoff, buf, csize)
@@ -1685,6 +2295,19 @@ grub_btrfs_extent_read (struct grub_btrfs_data *data,
 	      break;
 	    }
 
+	  if (data->extent->compression == GRUB_BTRFS_COMPRESSION_ZSTD)
+	    {
+	      if (grub_btrfs_zstd_extent_read (data,
+					       grub_le_to_cpu64 (data->extent->laddr),
+					       grub_le_to_cpu64 (data->extent->compressed_size),
+					       extoff
+					       + grub_le_to_cpu64 (data->extent->offset),
+					       buf, csize)
+		  != (grub_ssize_t) csize)
+		return -1;
+	      break;
+	    }
+
 	  if (data->extent->compression != GRUB_BTRFS_COMPRESSION_NONE)
 	    {
 	      char *tmp;
@@ -1712,10 +2335,6 @@ grub_btrfs_extent_read (struct grub_btrfs_data *data,
 		ret = grub_btrfs_lzo_decompress (tmp, zsize, extoff
 				    + grub_le_to_cpu64 (data->extent->offset),
 				    buf, csize);
-	      else if (data->extent->compression == GRUB_BTRFS_COMPRESSION_ZSTD)
-		ret = grub_btrfs_zstd_decompress (tmp, zsize, extoff
-				    + grub_le_to_cpu64 (data->extent->offset),
-				    buf, csize);
 	      else
 		ret = -1;
 
@@ -2101,6 +2720,7 @@ grub_btrfs_dir (grub_device_t device, const char *path,
       grub_btrfs_unmount (data);
       return err;
     }
+  desc.prefetch = 1;
   if (key_out.type != GRUB_BTRFS_ITEM_TYPE_DIR_ITEM
       || key_out.object_id != key_in.object_id)
     {
@@ -2180,6 +2800,8 @@ grub_btrfs_dir (grub_device_t device, const char *path,
 	    {
 	      info.mtime = grub_le_to_cpu64 (inode.mtime.sec);
 	      info.mtimeset = 1;
+	      info.size = grub_le_to_cpu64 (inode.size);
+	      info.sizeset = (cdirel->type == GRUB_BTRFS_DIR_ITEM_TYPE_REGULAR);
 	    }
 	  c = cdirel->name[grub_le_to_cpu16 (cdirel->n)];
 	  cdirel->name[grub_le_to_cpu16 (cdirel->n)] = 0;
@@ -2419,4 +3041,5 @@ GRUB_MOD_INIT (btrfs)
 GRUB_MOD_FINI (btrfs)
 {
   grub_fs_unregister (&grub_btrfs_fs);
+  grub_fshelp_mount_flush ("btrfs");
 }
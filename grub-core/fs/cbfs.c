@@ -26,6 +26,7 @@
 #include <grub/dl.h>
 #include <grub/i18n.h>
 #include <grub/cbfs_core.h>
+#include <grub/fshelp.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -39,8 +40,43 @@ struct grub_archelp_data
   grub_off_t cbfs_start;
   grub_off_t cbfs_end;
   grub_off_t cbfs_align;
+  struct grub_archelp_index *index;
 };
 
+#if (defined (__i386__) || defined (__x86_64__)) && !defined (GRUB_UTIL) \
+  && !defined (GRUB_MACHINE_EMU) && !defined (GRUB_MACHINE_XEN)
+
+static char *cbfsdisk_addr;
+static grub_off_t cbfsdisk_size = 0;
+
+#endif
+
+/* Read SIZE bytes at OFS of DISK.  The flash mapped ROM is read directly,
+   it is as fast as the disk cache would be.  */
+static grub_err_t
+grub_cbfs_read_raw (grub_disk_t disk, grub_off_t ofs, grub_size_t size,
+		    void *buf)
+{
+#if (defined (__i386__) || defined (__x86_64__)) && !defined (GRUB_UTIL) \
+  && !defined (GRUB_MACHINE_EMU) && !defined (GRUB_MACHINE_XEN)
+  if (disk->dev->id == GRUB_DISK_DEVICE_CBFSDISK_ID && !disk->partition)
+    {
+      if (ofs > cbfsdisk_size || size > cbfsdisk_size - ofs)
+	return grub_error (GRUB_ERR_OUT_OF_RANGE,
+			   N_("attempt to read or write outside of disk `%s'"),
+			   disk->name);
+      grub_memcpy (buf, cbfsdisk_addr + ofs, size);
+      if (disk->read_hook)
+	return (disk->read_hook) (ofs >> GRUB_DISK_SECTOR_BITS,
+				  ofs & (GRUB_DISK_SECTOR_SIZE - 1),
+				  size, buf, disk->read_hook_data);
+      return GRUB_ERR_NONE;
+    }
+#endif
+
+  return grub_disk_read (disk, 0, ofs, size, buf);
+}
+
 static grub_err_t
 grub_cbfs_find_file (struct grub_archelp_data *data, char **name,
 		     grub_int32_t *mtime,
@@ -62,7 +98,7 @@ grub_cbfs_find_file (struct grub_archelp_data *data, char **name,
 	  return GRUB_ERR_NONE;
 	}
 
-      if (grub_disk_read (data->disk, 0, data->hofs, sizeof (hd), &hd))
+      if (grub_cbfs_read_raw (data->disk, data->hofs, sizeof (hd), &hd))
 	return grub_errno;
 
       if (grub_memcmp (hd.magic, CBFS_FILE_MAGIC, sizeof (hd.magic)) != 0)
@@ -85,8 +121,8 @@ grub_cbfs_find_file (struct grub_archelp_data *data, char **name,
       if (*name == NULL)
 	return grub_errno;
 
-      if (grub_disk_read (data->disk, 0, data->hofs + sizeof (hd),
-			  namesize, *name))
+      if (grub_cbfs_read_raw (data->disk, data->hofs + sizeof (hd),
+			      namesize, *name))
 	{
 	  grub_free (*name);
 	  return grub_errno;
@@ -113,12 +149,49 @@ grub_cbfs_rewind (struct grub_archelp_data *data)
   data->next_hofs = data->cbfs_start;
 }
 
+static struct grub_archelp_index **
+grub_cbfs_get_index (struct grub_archelp_data *data)
+{
+  return &data->index;
+}
+
+static grub_off_t
+grub_cbfs_tell (struct grub_archelp_data *data)
+{
+  return data->next_hofs;
+}
+
+static void
+grub_cbfs_seek (struct grub_archelp_data *data, grub_off_t pos)
+{
+  data->next_hofs = pos;
+}
+
 static struct grub_archelp_ops arcops =
   {
     .find_file = grub_cbfs_find_file,
-    .rewind = grub_cbfs_rewind
+    .rewind = grub_cbfs_rewind,
+    .get_index = grub_cbfs_get_index,
+    .tell = grub_cbfs_tell,
+    .seek = grub_cbfs_seek
   };
 
+static void
+grub_cbfs_free (void *ptr)
+{
+  struct grub_archelp_data *data = ptr;
+
+  grub_archelp_free_index (data->index);
+  grub_free (data);
+}
+
+/* Release DATA, keeping it and its index for the next user of its disk.  */
+static void
+grub_cbfs_unmount (struct grub_archelp_data *data)
+{
+  grub_fshelp_mount_put ("cbfs", data->disk, data, grub_cbfs_free);
+}
+
 static int
 validate_head (struct cbfs_header *head)
 {
@@ -148,6 +221,13 @@ grub_cbfs_mount (grub_disk_t disk)
   grub_off_t header_off;
   struct cbfs_header head;
 
+  data = grub_fshelp_mount_get ("cbfs", disk);
+  if (data)
+    {
+      data->disk = disk;
+      return data;
+    }
+
   if (grub_disk_native_sectors (disk) == GRUB_DISK_SIZE_UNKNOWN)
     goto fail;
 
@@ -184,7 +264,7 @@ grub_cbfs_mount (grub_disk_t disk)
 
   data->next_hofs = data->cbfs_start;
 
-  if (grub_disk_read (disk, 0, data->cbfs_start, sizeof (hd), &hd))
+  if (grub_cbfs_read_raw (disk, data->cbfs_start, sizeof (hd), &hd))
     goto fail;
 
   if (grub_memcmp (hd.magic, CBFS_FILE_MAGIC, sizeof (CBFS_FILE_MAGIC) - 1))
@@ -214,7 +294,7 @@ grub_cbfs_dir (grub_device_t device, const char *path_in,
   err = grub_archelp_dir (data, &arcops,
 			  path_in, hook, hook_data);
 
-  grub_free (data);
+  grub_cbfs_unmount (data);
 
   return err;
 }
@@ -232,7 +312,7 @@ grub_cbfs_open (grub_file_t file, const char *name_in)
   err = grub_archelp_open (data, &arcops, name_in);
   if (err)
     {
-      grub_free (data);
+      grub_cbfs_unmount (data);
     }
   else
     {
@@ -252,8 +332,8 @@ grub_cbfs_read (grub_file_t file, char *buf, grub_size_t len)
   data->disk->read_hook = file->read_hook;
   data->disk->read_hook_data = file->read_hook_data;
 
-  ret = (grub_disk_read (data->disk, 0, data->dofs + file->offset,
-			 len, buf)) ? -1 : (grub_ssize_t) len;
+  ret = (grub_cbfs_read_raw (data->disk, data->dofs + file->offset,
+			     len, buf)) ? -1 : (grub_ssize_t) len;
   data->disk->read_hook = 0;
 
   return ret;
@@ -265,7 +345,7 @@ grub_cbfs_close (grub_file_t file)
   struct grub_archelp_data *data;
 
   data = file->data;
-  grub_free (data);
+  grub_cbfs_unmount (data);
 
   return grub_errno;
 }
@@ -273,9 +353,6 @@ grub_cbfs_close (grub_file_t file)
 #if (defined (__i386__) || defined (__x86_64__)) && !defined (GRUB_UTIL) \
   && !defined (GRUB_MACHINE_EMU) && !defined (GRUB_MACHINE_XEN)
 
-static char *cbfsdisk_addr;
-static grub_off_t cbfsdisk_size = 0;
-
 static int
 grub_cbfsdisk_iterate (grub_disk_dev_iterate_hook_t hook, void *hook_data,
 		       grub_disk_pull_t pull)
@@ -396,6 +473,7 @@ GRUB_MOD_INIT (cbfs)
 GRUB_MOD_FINI (cbfs)
 {
   grub_fs_unregister (&grub_cbfs_fs);
+  grub_fshelp_mount_flush ("cbfs");
 #if (defined (__i386__) || defined (__x86_64__)) && !defined (GRUB_UTIL) && !defined (GRUB_MACHINE_EMU) && !defined (GRUB_MACHINE_XEN)
   fini_cbfsdisk ();
 #endif
@@ -58,4 +58,5 @@ GRUB_MOD_INIT (cpio)
 GRUB_MOD_FINI (cpio)
 {
   grub_fs_unregister (&grub_cpio_fs);
+  grub_fshelp_mount_flush (FSNAME);
 }
@@ -58,4 +58,5 @@ GRUB_MOD_INIT (cpio_be)
 GRUB_MOD_FINI (cpio_be)
 {
   grub_fs_unregister (&grub_cpio_fs);
+  grub_fshelp_mount_flush (FSNAME);
 }
@@ -114,6 +114,7 @@ GRUB_MOD_LICENSE ("GPLv3+");
                                        | EXT4_FEATURE_INCOMPAT_FLEX_BG \
                                        | EXT2_FEATURE_INCOMPAT_META_BG \
                                        | EXT4_FEATURE_INCOMPAT_64BIT \
+                                       | EXT4_FEATURE_INCOMPAT_LARGEDIR \
                                        | EXT4_FEATURE_INCOMPAT_ENCRYPT)
 /* List of rationales for the ignored "incompatible" features:
  * needs_recovery: Not really back-incompatible - was added as such to forbid
@@ -130,17 +131,10 @@ GRUB_MOD_LICENSE ("GPLv3+");
  *                 checksummed filesystem. Safe to ignore for now since the
  *                 driver doesn't support checksum verification. However, it
  *                 has to be removed from this list if the support is added later.
- * large_dir:      Not back-incompatible given that the GRUB ext2 driver does
- *                 not implement EXT2_FEATURE_COMPAT_DIR_INDEX. If the GRUB
- *                 eventually supports the htree feature (aka dir_index)
- *                 it should support 3 level htrees and then move
- *                 EXT4_FEATURE_INCOMPAT_LARGEDIR to
- *                 EXT2_DRIVER_SUPPORTED_INCOMPAT.
  */
 #define EXT2_DRIVER_IGNORED_INCOMPAT ( EXT3_FEATURE_INCOMPAT_RECOVER \
 				     | EXT4_FEATURE_INCOMPAT_MMP \
-				     | EXT4_FEATURE_INCOMPAT_CSUM_SEED \
-				     | EXT4_FEATURE_INCOMPAT_LARGEDIR)
+				     | EXT4_FEATURE_INCOMPAT_CSUM_SEED)
 
 #define EXT3_JOURNAL_MAGIC_NUMBER	0xc03b3998U
 
@@ -156,7 +150,12 @@ GRUB_MOD_LICENSE ("GPLv3+");
 #define EXT3_JOURNAL_FLAG_LAST_TAG	8
 
 #define EXT4_ENCRYPT_FLAG              0x800
+#define EXT4_INDEX_FLAG			0x1000
 #define EXT4_EXTENTS_FLAG		0x80000
+#define EXT4_CASEFOLD_FLAG		0x40000000
+
+/* Superblock flags.  */
+#define EXT2_FLAGS_UNSIGNED_HASH	0x0002
 
 /* The ext2 superblock.  */
 struct grub_ext2_sblock
@@ -211,6 +210,12 @@ struct grub_ext2_sblock
   grub_uint32_t first_meta_bg;
   grub_uint32_t mkfs_time;
   grub_uint32_t jnl_blocks[17];
+  grub_uint32_t total_blocks_high;
+  grub_uint32_t reserved_blocks_high;
+  grub_uint32_t free_blocks_high;
+  grub_uint16_t min_extra_isize;
+  grub_uint16_t want_extra_isize;
+  grub_uint32_t flags;
 };
 
 /* The ext2 blockgroup.  */
@@ -277,6 +282,49 @@ struct ext2_dirent
   grub_uint8_t filetype;
 };
 
+/* Hashed directories (htree).  The first block of the directory holds
+   the "." and ".." entries followed by grub_ext2_dx_root_info and an
+   array of grub_ext2_dx_entry, sorted by hash, whose first element is
+   a grub_ext2_dx_countlimit.  Interior nodes hold an empty directory
+   entry covering the block followed by such an array.  */
+struct grub_ext2_dx_root_info
+{
+  grub_uint32_t reserved_zero;
+  grub_uint8_t hash_version;
+  grub_uint8_t info_length;
+  grub_uint8_t indirect_levels;
+  grub_uint8_t unused_flags;
+};
+
+struct grub_ext2_dx_countlimit
+{
+  grub_uint16_t limit;
+  grub_uint16_t count;
+};
+
+struct grub_ext2_dx_entry
+{
+  grub_uint32_t hash;
+  grub_uint32_t block;
+};
+
+/* Offset of grub_ext2_dx_root_info in the first directory block.  */
+#define EXT2_DX_ROOT_INFO_OFFSET	24
+/* Maximum number of indirect levels of an htree (with large_dir).  */
+#define EXT2_DX_MAX_INDIRECT_LEVELS	2
+/* The top bits of grub_ext2_dx_entry.block are reserved.  */
+#define EXT2_DX_BLOCK_MASK		0x0fffffff
+
+enum
+  {
+    EXT2_DX_HASH_LEGACY,
+    EXT2_DX_HASH_HALF_MD4,
+    EXT2_DX_HASH_TEA,
+    EXT2_DX_HASH_LEGACY_UNSIGNED,
+    EXT2_DX_HASH_HALF_MD4_UNSIGNED,
+    EXT2_DX_HASH_TEA_UNSIGNED
+  };
+
 struct grub_ext3_journal_header
 {
   grub_uint32_t magic;
@@ -342,6 +390,29 @@ struct grub_fshelp_node
   int inode_read;
 };
 
+/* One decoded leaf extent of an open file.  */
+struct grub_ext2_extent_run
+{
+  grub_uint32_t fileblock;
+  grub_uint32_t len;
+  grub_disk_addr_t start;
+};
+
+/* Maximum depth of an extent tree.  */
+#define EXT4_EXT_MAX_DEPTH	5
+
+/* Number of inode table blocks cached per mount.  */
+#define EXT2_ITABLE_CACHE_SIZE	4
+/* Most block groups whose inode table locations are kept per mount.  */
+#define EXT2_MAX_CACHED_GROUPS	(1 << 20)
+
+struct grub_ext2_itable_cache
+{
+  grub_disk_addr_t block;
+  grub_uint64_t last_use;
+  char *buf;
+};
+
 /* Information about a "mounted" ext2 filesystem.  */
 struct grub_ext2_data
 {
@@ -350,6 +421,24 @@ struct grub_ext2_data
   grub_disk_t disk;
   struct grub_ext2_inode *inode;
   struct grub_fshelp_node diropen;
+
+  /* Extent map of the open file in DIROPEN, sorted by file block.  It is
+     only used once EXTENTS_STATE is positive; negative means the tree
+     could not be decoded and every block is looked up in the tree.  */
+  struct grub_ext2_extent_run *extents;
+  grub_size_t extents_count;
+  grub_size_t extents_alloc;
+  int extents_state;
+
+  /* Inode table block of each block group, or 0 where its descriptor
+     hasn't been read yet.  NULL if the filesystem has too many groups, in
+     which case the descriptor is read for every inode.  */
+  grub_disk_addr_t *inode_tables;
+  grub_uint32_t group_count;
+
+  /* Recently read inode table blocks.  */
+  grub_uint64_t itable_clock;
+  struct grub_ext2_itable_cache itable[EXT2_ITABLE_CACHE_SIZE];
 };
 
 static grub_dl_t my_mod;
@@ -385,16 +474,16 @@ group_has_super_block (struct grub_ext2_data *data, grub_uint64_t group)
 	  is_power_of(group, 3));
 }
 
-/* Read into BLKGRP the blockgroup descriptor of blockgroup GROUP of
-   the mounted filesystem DATA.  */
-inline static grub_err_t
-grub_ext2_blockgroup (struct grub_ext2_data *data, grub_uint64_t group,
-		      struct grub_ext2_block_group *blkgrp)
+/* Return the block holding the descriptor of blockgroup GROUP of the
+   mounted filesystem DATA, and its offset within the block in OFFSET.  */
+static grub_disk_addr_t
+grub_ext2_blockgroup_block (struct grub_ext2_data *data, grub_uint64_t group,
+			    grub_uint64_t *offset)
 {
   grub_uint64_t full_offset = (group << data->log_group_desc_size);
-  grub_uint64_t block, offset;
+  grub_uint64_t block;
   block = (full_offset >> LOG2_BLOCK_SIZE (data));
-  offset = (full_offset & ((1 << LOG2_BLOCK_SIZE (data)) - 1));
+  *offset = (full_offset & ((1 << LOG2_BLOCK_SIZE (data)) - 1));
   if ((data->sblock.feature_incompat
        & grub_cpu_to_le32_compile_time (EXT2_FEATURE_INCOMPAT_META_BG))
       && block >= grub_le_to_cpu32(data->sblock.first_meta_bg))
@@ -414,11 +503,86 @@ grub_ext2_blockgroup (struct grub_ext2_data *data, grub_uint64_t group,
   else
     /* Superblock.  */
     block++;
-  return grub_disk_read (data->disk,
-                         ((grub_le_to_cpu32 (data->sblock.first_data_block)
-			   + block)
-                          << LOG2_EXT2_BLOCK_SIZE (data)), offset,
-			 sizeof (struct grub_ext2_block_group), blkgrp);
+  return grub_le_to_cpu32 (data->sblock.first_data_block) + block;
+}
+
+/* Read into BLKGRP the blockgroup descriptor of blockgroup GROUP of
+   the mounted filesystem DATA.  */
+inline static grub_err_t
+grub_ext2_blockgroup (struct grub_ext2_data *data, grub_uint64_t group,
+		      struct grub_ext2_block_group *blkgrp)
+{
+  grub_uint64_t offset;
+  grub_disk_addr_t block;
+
+  block = grub_ext2_blockgroup_block (data, group, &offset);
+  return grub_disk_read (data->disk, block << LOG2_EXT2_BLOCK_SIZE (data),
+			 offset, sizeof (struct grub_ext2_block_group), blkgrp);
+}
+
+static grub_disk_addr_t
+grub_ext2_blockgroup_inode_table (struct grub_ext2_data *data,
+				  const struct grub_ext2_block_group *blkgrp)
+{
+  grub_disk_addr_t base;
+
+  base = grub_le_to_cpu32 (blkgrp->inode_table_id);
+  if (data->log_group_desc_size >= 6)
+    base |= (((grub_disk_addr_t) grub_le_to_cpu32 (blkgrp->inode_table_id_hi))
+	     << 32);
+  return base;
+}
+
+/* Return the first block of the inode table of blockgroup GROUP, or 0
+   with grub_errno set.  The descriptors sharing a block with GROUP's are
+   remembered along with it, which with flex_bg covers the inode tables of
+   a whole flex group.  */
+static grub_disk_addr_t
+grub_ext2_inode_table (struct grub_ext2_data *data, grub_uint32_t group)
+{
+  struct grub_ext2_block_group blkgrp;
+  grub_uint32_t per_block, first, i;
+  grub_uint64_t offset;
+  grub_disk_addr_t block;
+  char *buf;
+
+  per_block = EXT2_BLOCK_SIZE (data) >> data->log_group_desc_size;
+  if (!data->inode_tables || group >= data->group_count || per_block == 0)
+    {
+      if (grub_ext2_blockgroup (data, group, &blkgrp))
+	return 0;
+      return grub_ext2_blockgroup_inode_table (data, &blkgrp);
+    }
+
+  if (data->inode_tables[group])
+    return data->inode_tables[group];
+
+  buf = grub_malloc (EXT2_BLOCK_SIZE (data));
+  if (!buf)
+    return 0;
+
+  /* A descriptor block holds consecutive groups in either layout.  */
+  first = group - group % per_block;
+  block = grub_ext2_blockgroup_block (data, first, &offset);
+  if (grub_disk_read (data->disk, block << LOG2_EXT2_BLOCK_SIZE (data),
+		      0, EXT2_BLOCK_SIZE (data), buf))
+    {
+      grub_free (buf);
+      return 0;
+    }
+
+  for (i = 0; i < per_block && first + i < data->group_count; i++)
+    {
+      grub_memcpy (&blkgrp, buf + (i << data->log_group_desc_size),
+		   sizeof (blkgrp));
+      data->inode_tables[first + i]
+	= grub_ext2_blockgroup_inode_table (data, &blkgrp);
+    }
+  grub_free (buf);
+
+  if (!data->inode_tables[group])
+    grub_error (GRUB_ERR_BAD_FS, "invalid inode table of group %u", group);
+  return data->inode_tables[group];
 }
 
 static grub_err_t
@@ -477,6 +641,170 @@ grub_ext4_find_leaf (struct grub_ext2_data *data,
   return GRUB_ERR_BAD_FS;
 }
 
+static void
+grub_ext2_free_extents (struct grub_ext2_data *data)
+{
+  grub_free (data->extents);
+  data->extents = NULL;
+  data->extents_count = 0;
+  data->extents_alloc = 0;
+}
+
+/* Append the leaf extents below EXT_BLOCK to the extent map.  SIZE is
+   the space available for the node.  */
+static grub_err_t
+grub_ext4_collect_extents (struct grub_ext2_data *data,
+			   struct grub_ext4_extent_header *ext_block,
+			   grub_size_t size, int level)
+{
+  unsigned entries, i;
+
+  if (ext_block->magic != grub_cpu_to_le16_compile_time (EXT4_EXT_MAGIC)
+      || level > EXT4_EXT_MAX_DEPTH)
+    return grub_error (GRUB_ERR_BAD_FS, "invalid extent");
+
+  entries = grub_le_to_cpu16 (ext_block->entries);
+  if (sizeof (*ext_block) + entries * sizeof (struct grub_ext4_extent) > size)
+    return grub_error (GRUB_ERR_BAD_FS, "invalid extent");
+
+  if (ext_block->depth == 0)
+    {
+      struct grub_ext4_extent *ext = (struct grub_ext4_extent *) (ext_block + 1);
+
+      for (i = 0; i < entries; i++)
+	{
+	  struct grub_ext2_extent_run *run;
+	  grub_uint32_t fileblock = grub_le_to_cpu32 (ext[i].block);
+	  grub_uint32_t len = grub_le_to_cpu16 (ext[i].len);
+
+	  /* Lengths above 32768 mark uninitialized extents.  */
+	  if (len > 32768)
+	    len -= 32768;
+
+	  if (data->extents_count
+	      && (fileblock
+		  < (grub_uint64_t) data->extents[data->extents_count - 1].fileblock
+		  + data->extents[data->extents_count - 1].len))
+	    return grub_error (GRUB_ERR_BAD_FS, "overlapping extents");
+
+	  if (data->extents_count == data->extents_alloc)
+	    {
+	      struct grub_ext2_extent_run *n;
+	      grub_size_t alloc, sz;
+
+	      alloc = data->extents_alloc ? data->extents_alloc * 2 : 16;
+	      if (grub_mul (alloc, sizeof (*n), &sz))
+		return grub_error (GRUB_ERR_OUT_OF_RANGE,
+				   N_("overflow is detected"));
+	      n = grub_realloc (data->extents, sz);
+	      if (!n)
+		return grub_errno;
+	      data->extents = n;
+	      data->extents_alloc = alloc;
+	    }
+
+	  run = &data->extents[data->extents_count++];
+	  run->fileblock = fileblock;
+	  run->len = len;
+	  run->start = grub_le_to_cpu16 (ext[i].start_hi);
+	  run->start = (run->start << 32) | grub_le_to_cpu32 (ext[i].start);
+	}
+      return GRUB_ERR_NONE;
+    }
+  else
+    {
+      struct grub_ext4_extent_idx *index;
+      void *buf;
+      grub_err_t err = GRUB_ERR_NONE;
+
+      buf = grub_malloc (EXT2_BLOCK_SIZE (data));
+      if (!buf)
+	return grub_errno;
+
+      index = (struct grub_ext4_extent_idx *) (ext_block + 1);
+      for (i = 0; i < entries; i++)
+	{
+	  grub_disk_addr_t block;
+
+	  block = grub_le_to_cpu16 (index[i].leaf_hi);
+	  block = (block << 32) | grub_le_to_cpu32 (index[i].leaf);
+	  if (grub_disk_read (data->disk,
+			      block << LOG2_EXT2_BLOCK_SIZE (data),
+			      0, EXT2_BLOCK_SIZE (data), buf))
+	    {
+	      err = grub_errno;
+	      break;
+	    }
+	  err = grub_ext4_collect_extents (data, buf, EXT2_BLOCK_SIZE (data),
+					   level + 1);
+	  if (err)
+	    break;
+	}
+      grub_free (buf);
+      return err;
+    }
+}
+
+/* Decode the whole extent tree of the open file once.  On failure
+   lookups go through grub_ext4_find_leaf as before.  */
+static void
+grub_ext2_load_extents (struct grub_ext2_data *data)
+{
+  struct grub_ext2_inode *inode = data->inode;
+
+  if (grub_ext4_collect_extents (data,
+				 (struct grub_ext4_extent_header *) inode->blocks.dir_blocks,
+				 sizeof (inode->blocks), 0))
+    {
+      grub_dprintf ("ext2", "couldn't cache extents: %s\n", grub_errmsg);
+      grub_errno = GRUB_ERR_NONE;
+      grub_ext2_free_extents (data);
+      data->extents_state = -1;
+      return;
+    }
+  data->extents_state = 1;
+}
+
+/* Find the physical block of FILEBLOCK in the extent map.  Set COUNT to
+   the number of blocks from FILEBLOCK on that are contiguous on disk,
+   or, for holes, that are absent.  */
+static grub_disk_addr_t
+grub_ext2_extents_lookup (struct grub_ext2_data *data,
+			  grub_disk_addr_t fileblock, grub_disk_addr_t *count)
+{
+  grub_size_t lo = 0, hi = data->extents_count;
+  struct grub_ext2_extent_run *run;
+
+  /* Find the last extent starting at or before FILEBLOCK.  */
+  while (lo < hi)
+    {
+      grub_size_t mid = lo + (hi - lo) / 2;
+
+      if (data->extents[mid].fileblock <= fileblock)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+
+  if (lo == 0)
+    {
+      *count = data->extents_count ? data->extents[0].fileblock - fileblock
+	: ~(grub_disk_addr_t) 0;
+      return 0;
+    }
+
+  run = &data->extents[lo - 1];
+  if (fileblock - run->fileblock < run->len)
+    {
+      *count = run->len - (fileblock - run->fileblock);
+      return run->start + (fileblock - run->fileblock);
+    }
+
+  *count = (lo < data->extents_count) ? data->extents[lo].fileblock - fileblock
+    : ~(grub_disk_addr_t) 0;
+  return 0;
+}
+
 static grub_disk_addr_t
 grub_ext2_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
 {
@@ -591,6 +919,19 @@ indirect:
   return grub_le_to_cpu32 (indir);
 }
 
+static grub_disk_addr_t
+grub_ext2_get_extent (grub_fshelp_node_t node, grub_disk_addr_t fileblock,
+		      grub_disk_addr_t *count)
+{
+  struct grub_ext2_data *data = node->data;
+
+  if (node == &data->diropen && data->extents_state > 0)
+    return grub_ext2_extents_lookup (data, fileblock, count);
+
+  *count = 1;
+  return grub_ext2_read_block (node, fileblock);
+}
+
 /* Read LEN bytes from the file described by DATA starting with byte
    POS.  Return the amount of read bytes in READ.  */
 static grub_ssize_t
@@ -598,13 +939,18 @@ grub_ext2_read_file (grub_fshelp_node_t node,
 		     grub_disk_read_hook_t read_hook, void *read_hook_data,
 		     grub_off_t pos, grub_size_t len, char *buf)
 {
-  return grub_fshelp_read_file (node->data->disk, node,
-				read_hook, read_hook_data,
-				pos, len, buf, grub_ext2_read_block,
-				grub_cpu_to_le32 (node->inode.size)
-				| (((grub_off_t) grub_cpu_to_le32 (node->inode.size_high)) << 32),
-				LOG2_EXT2_BLOCK_SIZE (node->data), 0);
+  struct grub_ext2_data *data = node->data;
+
+  if (node == &data->diropen && data->extents_state == 0
+      && (node->inode.flags & grub_cpu_to_le32_compile_time (EXT4_EXTENTS_FLAG)))
+    grub_ext2_load_extents (data);
 
+  return grub_fshelp_read_file_extents (node->data->disk, node,
+					read_hook, read_hook_data,
+					pos, len, buf, grub_ext2_get_extent,
+					grub_cpu_to_le32 (node->inode.size)
+					| (((grub_off_t) grub_cpu_to_le32 (node->inode.size_high)) << 32),
+					LOG2_EXT2_BLOCK_SIZE (node->data), 0);
 }
 
 
@@ -613,8 +959,8 @@ static grub_err_t
 grub_ext2_read_inode (struct grub_ext2_data *data,
 		      int ino, struct grub_ext2_inode *inode)
 {
-  struct grub_ext2_block_group blkgrp;
   struct grub_ext2_sblock *sblock = &data->sblock;
+  struct grub_ext2_itable_cache *c, *victim = &data->itable[0];
   int inodes_per_block;
   unsigned int blkno;
   unsigned int blkoff;
@@ -623,9 +969,8 @@ grub_ext2_read_inode (struct grub_ext2_data *data,
   /* It is easier to calculate if the first inode is 0.  */
   ino--;
 
-  grub_ext2_blockgroup (data,
-                        ino / grub_le_to_cpu32 (sblock->inodes_per_group),
-			&blkgrp);
+  base = grub_ext2_inode_table (data,
+				ino / grub_le_to_cpu32 (sblock->inodes_per_group));
   if (grub_errno)
     return grub_errno;
 
@@ -635,27 +980,70 @@ grub_ext2_read_inode (struct grub_ext2_data *data,
   blkoff = (ino % grub_le_to_cpu32 (sblock->inodes_per_group))
     % inodes_per_block;
 
-  base = grub_le_to_cpu32 (blkgrp.inode_table_id);
-  if (data->log_group_desc_size >= 6)
-    base |= (((grub_disk_addr_t) grub_le_to_cpu32 (blkgrp.inode_table_id_hi))
-	     << 32);
+  /* Neighbouring inodes, as in a directory listing, usually share the
+     block.  */
+  for (c = data->itable; c < data->itable + EXT2_ITABLE_CACHE_SIZE; c++)
+    {
+      if (c->last_use && c->block == base + blkno)
+	{
+	  c->last_use = ++data->itable_clock;
+	  grub_memcpy (inode, c->buf + EXT2_INODE_SIZE (data) * blkoff,
+		       sizeof (struct grub_ext2_inode));
+	  return 0;
+	}
+      if (c->last_use < victim->last_use)
+	victim = c;
+    }
+
+  if (!victim->buf)
+    victim->buf = grub_malloc (EXT2_BLOCK_SIZE (data));
+  victim->last_use = 0;
 
   /* Read the inode.  */
+  if (!victim->buf)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return grub_disk_read (data->disk,
+			     ((base + blkno) << LOG2_EXT2_BLOCK_SIZE (data)),
+			     EXT2_INODE_SIZE (data) * blkoff,
+			     sizeof (struct grub_ext2_inode), inode);
+    }
+
   if (grub_disk_read (data->disk,
 		      ((base + blkno) << LOG2_EXT2_BLOCK_SIZE (data)),
-		      EXT2_INODE_SIZE (data) * blkoff,
-		      sizeof (struct grub_ext2_inode), inode))
+		      0, EXT2_BLOCK_SIZE (data), victim->buf))
     return grub_errno;
 
+  victim->block = base + blkno;
+  victim->last_use = ++data->itable_clock;
+  grub_memcpy (inode, victim->buf + EXT2_INODE_SIZE (data) * blkoff,
+	       sizeof (struct grub_ext2_inode));
   return 0;
 }
 
+static void
+grub_ext2_free (void *ptr)
+{
+  struct grub_ext2_data *data = ptr;
+  int i;
+
+  grub_free (data->inode_tables);
+  for (i = 0; i < EXT2_ITABLE_CACHE_SIZE; i++)
+    grub_free (data->itable[i].buf);
+  grub_free (data);
+}
+
 static struct grub_ext2_data *
 grub_ext2_mount (grub_disk_t disk)
 {
   struct grub_ext2_data *data;
 
-  data = grub_malloc (sizeof (struct grub_ext2_data));
+  /* Only the root directory has to be set up again in a parked mount.  */
+  data = grub_fshelp_mount_get ("ext2", disk);
+  if (data)
+    goto init_root;
+
+  data = grub_zalloc (sizeof (struct grub_ext2_data));
   if (!data)
     return 0;
 
@@ -703,11 +1091,26 @@ grub_ext2_mount (grub_disk_t disk)
   else
     data->log_group_desc_size = 5;
 
+  data->group_count = (grub_le_to_cpu32 (data->sblock.total_inodes)
+		       / grub_le_to_cpu32 (data->sblock.inodes_per_group));
+  if (grub_le_to_cpu32 (data->sblock.total_inodes)
+      % grub_le_to_cpu32 (data->sblock.inodes_per_group))
+    data->group_count++;
+  if (data->group_count <= EXT2_MAX_CACHED_GROUPS)
+    data->inode_tables = grub_calloc (data->group_count,
+				      sizeof (data->inode_tables[0]));
+  grub_errno = GRUB_ERR_NONE;
+
+ init_root:
   data->disk = disk;
 
   data->diropen.data = data;
   data->diropen.ino = 2;
   data->diropen.inode_read = 1;
+  data->extents = NULL;
+  data->extents_count = 0;
+  data->extents_alloc = 0;
+  data->extents_state = -1;
 
   data->inode = &data->diropen.inode;
 
@@ -721,10 +1124,21 @@ grub_ext2_mount (grub_disk_t disk)
   if (grub_errno == GRUB_ERR_OUT_OF_RANGE)
     grub_error (GRUB_ERR_BAD_FS, "not an ext2 filesystem");
 
-  grub_free (data);
+  grub_ext2_free (data);
   return 0;
 }
 
+/* Release DATA, keeping the mount for the next user of its disk.  */
+static void
+grub_ext2_unmount (struct grub_ext2_data *data)
+{
+  if (! data)
+    return;
+
+  grub_ext2_free_extents (data);
+  grub_fshelp_mount_put ("ext2", data->disk, data, grub_ext2_free);
+}
+
 static char *
 grub_ext2_read_symlink (grub_fshelp_node_t node)
 {
@@ -779,6 +1193,64 @@ grub_ext2_read_symlink (grub_fshelp_node_t node)
   return symlink;
 }
 
+/* Create a node for the directory entry DIRENT of DIRO and determine
+   its type.  */
+static struct grub_fshelp_node *
+grub_ext2_dirent_node (struct grub_fshelp_node *diro,
+		       const struct ext2_dirent *dirent,
+		       enum grub_fshelp_filetype *type)
+{
+  struct grub_fshelp_node *fdiro;
+
+  *type = GRUB_FSHELP_UNKNOWN;
+
+  fdiro = grub_malloc (sizeof (struct grub_fshelp_node));
+  if (! fdiro)
+    return 0;
+
+  fdiro->data = diro->data;
+  fdiro->ino = grub_le_to_cpu32 (dirent->inode);
+
+  if (dirent->filetype != FILETYPE_UNKNOWN)
+    {
+      fdiro->inode_read = 0;
+
+      if (dirent->filetype == FILETYPE_DIRECTORY)
+	*type = GRUB_FSHELP_DIR;
+      else if (dirent->filetype == FILETYPE_SYMLINK)
+	*type = GRUB_FSHELP_SYMLINK;
+      else if (dirent->filetype == FILETYPE_REG)
+	*type = GRUB_FSHELP_REG;
+    }
+  else
+    {
+      /* The filetype can not be read from the dirent, read
+	 the inode to get more information.  */
+      grub_ext2_read_inode (diro->data,
+			    grub_le_to_cpu32 (dirent->inode),
+			    &fdiro->inode);
+      if (grub_errno)
+	{
+	  grub_free (fdiro);
+	  return 0;
+	}
+
+      fdiro->inode_read = 1;
+
+      if ((grub_le_to_cpu16 (fdiro->inode.mode)
+	   & FILETYPE_INO_MASK) == FILETYPE_INO_DIRECTORY)
+	*type = GRUB_FSHELP_DIR;
+      else if ((grub_le_to_cpu16 (fdiro->inode.mode)
+		& FILETYPE_INO_MASK) == FILETYPE_INO_SYMLINK)
+	*type = GRUB_FSHELP_SYMLINK;
+      else if ((grub_le_to_cpu16 (fdiro->inode.mode)
+		& FILETYPE_INO_MASK) == FILETYPE_INO_REG)
+	*type = GRUB_FSHELP_REG;
+    }
+
+  return fdiro;
+}
+
 static int
 grub_ext2_iterate_dir (grub_fshelp_node_t dir,
 		       grub_fshelp_iterate_dir_hook_t hook, void *hook_data)
@@ -816,58 +1288,18 @@ grub_ext2_iterate_dir (grub_fshelp_node_t dir,
 	{
 	  char filename[MAX_NAMELEN + 1];
 	  struct grub_fshelp_node *fdiro;
-	  enum grub_fshelp_filetype type = GRUB_FSHELP_UNKNOWN;
+	  enum grub_fshelp_filetype type;
 
 	  grub_ext2_read_file (diro, 0, 0, fpos + sizeof (struct ext2_dirent),
 			       dirent.namelen, filename);
 	  if (grub_errno)
 	    return 0;
 
-	  fdiro = grub_malloc (sizeof (struct grub_fshelp_node));
-	  if (! fdiro)
-	    return 0;
-
-	  fdiro->data = diro->data;
-	  fdiro->ino = grub_le_to_cpu32 (dirent.inode);
-
 	  filename[dirent.namelen] = '\0';
 
-	  if (dirent.filetype != FILETYPE_UNKNOWN)
-	    {
-	      fdiro->inode_read = 0;
-
-	      if (dirent.filetype == FILETYPE_DIRECTORY)
-		type = GRUB_FSHELP_DIR;
-	      else if (dirent.filetype == FILETYPE_SYMLINK)
-		type = GRUB_FSHELP_SYMLINK;
-	      else if (dirent.filetype == FILETYPE_REG)
-		type = GRUB_FSHELP_REG;
-	    }
-	  else
-	    {
-	      /* The filetype can not be read from the dirent, read
-		 the inode to get more information.  */
-	      grub_ext2_read_inode (diro->data,
-                                    grub_le_to_cpu32 (dirent.inode),
-				    &fdiro->inode);
-	      if (grub_errno)
-		{
-		  grub_free (fdiro);
-		  return 0;
-		}
-
-	      fdiro->inode_read = 1;
-
-	      if ((grub_le_to_cpu16 (fdiro->inode.mode)
-		   & FILETYPE_INO_MASK) == FILETYPE_INO_DIRECTORY)
-		type = GRUB_FSHELP_DIR;
-	      else if ((grub_le_to_cpu16 (fdiro->inode.mode)
-			& FILETYPE_INO_MASK) == FILETYPE_INO_SYMLINK)
-		type = GRUB_FSHELP_SYMLINK;
-	      else if ((grub_le_to_cpu16 (fdiro->inode.mode)
-			& FILETYPE_INO_MASK) == FILETYPE_INO_REG)
-		type = GRUB_FSHELP_REG;
-	    }
+	  fdiro = grub_ext2_dirent_node (diro, &dirent, &type);
+	  if (! fdiro)
+	    return 0;
 
 	  if (hook (filename, type, fdiro, hook_data))
 	    return 1;
@@ -879,6 +1311,526 @@ grub_ext2_iterate_dir (grub_fshelp_node_t dir,
   return 0;
 }
 
+/* The legacy directory hash.  */
+static grub_uint32_t
+grub_ext2_dx_hack_hash (const char *name, grub_size_t len, int is_unsigned)
+{
+  grub_uint32_t hash, hash0 = 0x12a3fe2d, hash1 = 0x37abe8f9;
+  grub_size_t i;
+
+  for (i = 0; i < len; i++)
+    {
+      grub_int32_t c = (is_unsigned ? (grub_int32_t) (grub_uint8_t) name[i]
+			: (grub_int32_t) (grub_int8_t) name[i]);
+
+      hash = hash1 + (hash0 ^ ((grub_uint32_t) c * 7152373));
+      if (hash & 0x80000000)
+	hash -= 0x7fffffff;
+      hash1 = hash0;
+      hash0 = hash;
+    }
+
+  return hash0 << 1;
+}
+
+/* Pack up to NUM * 4 bytes of NAME into BUF, padded with the length.  */
+static void
+grub_ext2_dx_str2hashbuf (const char *name, grub_size_t len,
+			  grub_uint32_t *buf, int num, int is_unsigned)
+{
+  grub_uint32_t pad, val;
+  grub_size_t i;
+
+  pad = (grub_uint32_t) len | ((grub_uint32_t) len << 8);
+  pad |= pad << 16;
+
+  val = pad;
+  if (len > (grub_size_t) num * 4)
+    len = num * 4;
+  for (i = 0; i < len; i++)
+    {
+      grub_int32_t c = (is_unsigned ? (grub_int32_t) (grub_uint8_t) name[i]
+			: (grub_int32_t) (grub_int8_t) name[i]);
+
+      val = (grub_uint32_t) c + (val << 8);
+      if ((i % 4) == 3)
+	{
+	  *buf++ = val;
+	  val = pad;
+	  num--;
+	}
+    }
+  if (--num >= 0)
+    *buf++ = val;
+  while (--num >= 0)
+    *buf++ = pad;
+}
+
+static void
+grub_ext2_dx_tea_transform (grub_uint32_t buf[4], const grub_uint32_t in[4])
+{
+  grub_uint32_t sum = 0;
+  grub_uint32_t b0 = buf[0], b1 = buf[1];
+  grub_uint32_t a = in[0], b = in[1], c = in[2], d = in[3];
+  int n;
+
+  for (n = 0; n < 16; n++)
+    {
+      sum += 0x9e3779b9;
+      b0 += ((b1 << 4) + a) ^ (b1 + sum) ^ ((b1 >> 5) + b);
+      b1 += ((b0 << 4) + c) ^ (b0 + sum) ^ ((b0 >> 5) + d);
+    }
+
+  buf[0] += b0;
+  buf[1] += b1;
+}
+
+#define DX_F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define DX_G(x, y, z) (((x) & (y)) + (((x) ^ (y)) & (z)))
+#define DX_H(x, y, z) ((x) ^ (y) ^ (z))
+#define DX_ROUND(f, a, b, c, d, x, s)				\
+  do								\
+    {								\
+      (a) += f ((b), (c), (d)) + (x);				\
+      (a) = ((a) << (s)) | ((a) >> (32 - (s)));			\
+    }								\
+  while (0)
+#define DX_K2 013240474631U
+#define DX_K3 015666365641U
+
+static void
+grub_ext2_dx_half_md4_transform (grub_uint32_t buf[4],
+				 const grub_uint32_t in[8])
+{
+  grub_uint32_t a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+
+  DX_ROUND (DX_F, a, b, c, d, in[0], 3);
+  DX_ROUND (DX_F, d, a, b, c, in[1], 7);
+  DX_ROUND (DX_F, c, d, a, b, in[2], 11);
+  DX_ROUND (DX_F, b, c, d, a, in[3], 19);
+  DX_ROUND (DX_F, a, b, c, d, in[4], 3);
+  DX_ROUND (DX_F, d, a, b, c, in[5], 7);
+  DX_ROUND (DX_F, c, d, a, b, in[6], 11);
+  DX_ROUND (DX_F, b, c, d, a, in[7], 19);
+
+  DX_ROUND (DX_G, a, b, c, d, in[1] + DX_K2, 3);
+  DX_ROUND (DX_G, d, a, b, c, in[3] + DX_K2, 5);
+  DX_ROUND (DX_G, c, d, a, b, in[5] + DX_K2, 9);
+  DX_ROUND (DX_G, b, c, d, a, in[7] + DX_K2, 13);
+  DX_ROUND (DX_G, a, b, c, d, in[0] + DX_K2, 3);
+  DX_ROUND (DX_G, d, a, b, c, in[2] + DX_K2, 5);
+  DX_ROUND (DX_G, c, d, a, b, in[4] + DX_K2, 9);
+  DX_ROUND (DX_G, b, c, d, a, in[6] + DX_K2, 13);
+
+  DX_ROUND (DX_H, a, b, c, d, in[3] + DX_K3, 3);
+  DX_ROUND (DX_H, d, a, b, c, in[7] + DX_K3, 9);
+  DX_ROUND (DX_H, c, d, a, b, in[2] + DX_K3, 11);
+  DX_ROUND (DX_H, b, c, d, a, in[6] + DX_K3, 15);
+  DX_ROUND (DX_H, a, b, c, d, in[1] + DX_K3, 3);
+  DX_ROUND (DX_H, d, a, b, c, in[5] + DX_K3, 9);
+  DX_ROUND (DX_H, c, d, a, b, in[0] + DX_K3, 11);
+  DX_ROUND (DX_H, b, c, d, a, in[4] + DX_K3, 15);
+
+  buf[0] += a;
+  buf[1] += b;
+  buf[2] += c;
+  buf[3] += d;
+}
+
+/* Compute the major hash of NAME as the kernel does for hashed
+   directories.  Return 0 if VERSION is unknown.  */
+static int
+grub_ext2_dx_hash (struct grub_ext2_data *data, int version,
+		   const char *name, grub_uint32_t *hash)
+{
+  grub_size_t len = grub_strlen (name);
+  grub_uint32_t buf[4], in[8];
+  const char *p;
+  grub_ssize_t left;
+  int i;
+
+  buf[0] = 0x67452301;
+  buf[1] = 0xefcdab89;
+  buf[2] = 0x98badcfe;
+  buf[3] = 0x10325476;
+  for (i = 0; i < 4; i++)
+    if (data->sblock.hash_seed[i])
+      {
+	for (i = 0; i < 4; i++)
+	  buf[i] = grub_le_to_cpu32 (data->sblock.hash_seed[i]);
+	break;
+      }
+
+  switch (version)
+    {
+    case EXT2_DX_HASH_LEGACY:
+    case EXT2_DX_HASH_LEGACY_UNSIGNED:
+      *hash = grub_ext2_dx_hack_hash (name, len,
+				      version == EXT2_DX_HASH_LEGACY_UNSIGNED);
+      break;
+
+    case EXT2_DX_HASH_HALF_MD4:
+    case EXT2_DX_HASH_HALF_MD4_UNSIGNED:
+      for (p = name, left = len; left > 0; p += 32, left -= 32)
+	{
+	  grub_ext2_dx_str2hashbuf (p, left, in, 8,
+				    version == EXT2_DX_HASH_HALF_MD4_UNSIGNED);
+	  grub_ext2_dx_half_md4_transform (buf, in);
+	}
+      *hash = buf[1];
+      break;
+
+    case EXT2_DX_HASH_TEA:
+    case EXT2_DX_HASH_TEA_UNSIGNED:
+      for (p = name, left = len; left > 0; p += 16, left -= 16)
+	{
+	  grub_ext2_dx_str2hashbuf (p, left, in, 4,
+				    version == EXT2_DX_HASH_TEA_UNSIGNED);
+	  grub_ext2_dx_tea_transform (buf, in);
+	}
+      *hash = buf[0];
+      break;
+
+    default:
+      return 0;
+    }
+
+  *hash &= ~1;
+  if (*hash == 0xfffffffe)
+    *hash = 0xfffffffc;
+  return 1;
+}
+
+/* A position in one level of an htree.  */
+struct grub_ext2_dx_frame
+{
+  struct grub_ext2_dx_entry *entries;
+  unsigned count;
+  unsigned at;
+};
+
+/* The directory block below the current entry of FRAME.  */
+static inline grub_uint32_t
+grub_ext2_dx_frame_block (const struct grub_ext2_dx_frame *frame)
+{
+  return grub_le_to_cpu32 (frame->entries[frame->at].block)
+    & EXT2_DX_BLOCK_MASK;
+}
+
+/* Read the directory block BLOCK of DIRO into BUF.  */
+static grub_err_t
+grub_ext2_read_dir_block (struct grub_fshelp_node *diro, grub_uint32_t block,
+			  char *buf)
+{
+  grub_size_t blocksize = EXT2_BLOCK_SIZE (diro->data);
+  grub_ssize_t ret;
+
+  ret = grub_ext2_read_file (diro, 0, 0, (grub_off_t) block * blocksize,
+			     blocksize, buf);
+  if (ret < 0)
+    return grub_errno;
+  if ((grub_size_t) ret != blocksize)
+    return grub_error (GRUB_ERR_BAD_FS, "invalid htree block");
+  return GRUB_ERR_NONE;
+}
+
+/* Set up FRAME for the index node in BUF, with the array starting at
+   OFFSET, and select the entry covering HASH.  */
+static grub_err_t
+grub_ext2_dx_frame_init (struct grub_fshelp_node *diro,
+			 struct grub_ext2_dx_frame *frame, char *buf,
+			 grub_size_t offset, grub_uint32_t hash)
+{
+  grub_size_t blocksize = EXT2_BLOCK_SIZE (diro->data);
+  struct grub_ext2_dx_countlimit *cl;
+  unsigned lo, hi;
+
+  if (offset + sizeof (struct grub_ext2_dx_entry) > blocksize)
+    return grub_error (GRUB_ERR_BAD_FS, "invalid htree node");
+
+  cl = (struct grub_ext2_dx_countlimit *) (buf + offset);
+  frame->entries = (struct grub_ext2_dx_entry *) (buf + offset);
+  frame->count = grub_le_to_cpu16 (cl->count);
+  if (frame->count == 0 || frame->count > grub_le_to_cpu16 (cl->limit)
+      || offset + frame->count * sizeof (struct grub_ext2_dx_entry) > blocksize)
+    return grub_error (GRUB_ERR_BAD_FS, "invalid htree node");
+
+  /* Find the last entry whose hash doesn't exceed HASH.  The first
+     entry has no hash and covers everything below the second.  */
+  lo = 1;
+  hi = frame->count;
+  while (lo < hi)
+    {
+      unsigned mid = lo + (hi - lo) / 2;
+
+      if (grub_le_to_cpu32 (frame->entries[mid].hash) > hash)
+	hi = mid;
+      else
+	lo = mid + 1;
+    }
+  frame->at = lo - 1;
+
+  return GRUB_ERR_NONE;
+}
+
+/* Look up NAME in the leaf block in BUF.  */
+static struct grub_fshelp_node *
+grub_ext2_dx_leaf_find (struct grub_fshelp_node *diro, const char *buf,
+			const char *name, enum grub_fshelp_filetype *foundtype)
+{
+  grub_size_t blocksize = EXT2_BLOCK_SIZE (diro->data);
+  grub_size_t len = grub_strlen (name);
+  grub_size_t pos = 0;
+
+  while (pos + sizeof (struct ext2_dirent) <= blocksize)
+    {
+      struct ext2_dirent dirent;
+      grub_size_t direntlen;
+
+      grub_memcpy (&dirent, buf + pos, sizeof (dirent));
+      direntlen = grub_le_to_cpu16 (dirent.direntlen);
+      if (direntlen < sizeof (dirent) || direntlen > blocksize - pos
+	  || dirent.namelen > direntlen - sizeof (dirent))
+	{
+	  grub_error (GRUB_ERR_BAD_FS, "invalid directory entry");
+	  return 0;
+	}
+
+      if (dirent.inode != 0 && dirent.namelen == len
+	  && grub_memcmp (buf + pos + sizeof (dirent), name, len) == 0)
+	return grub_ext2_dirent_node (diro, &dirent, foundtype);
+
+      pos += direntlen;
+    }
+
+  return 0;
+}
+
+/* Look up NAME in the hashed directory DIRO.  *FOUNDNODE is left NULL
+   if NAME doesn't exist.  GRUB_ERR_BAD_FS means that the index can't be
+   used.  */
+static grub_err_t
+grub_ext2_dx_lookup (struct grub_fshelp_node *diro, const char *name,
+		     struct grub_fshelp_node **foundnode,
+		     enum grub_fshelp_filetype *foundtype)
+{
+  struct grub_ext2_data *data = diro->data;
+  grub_size_t blocksize = EXT2_BLOCK_SIZE (data);
+  struct grub_ext2_dx_frame frames[EXT2_DX_MAX_INDIRECT_LEVELS + 1];
+  struct grub_ext2_dx_root_info *info;
+  char *buf, *leaf;
+  grub_uint32_t hash;
+  unsigned levels, level;
+  int version;
+  grub_err_t err;
+
+  /* One buffer for each index level and one for the leaf.  */
+  buf = grub_malloc (blocksize * (EXT2_DX_MAX_INDIRECT_LEVELS + 2));
+  if (! buf)
+    return grub_errno;
+  leaf = buf + blocksize * (EXT2_DX_MAX_INDIRECT_LEVELS + 1);
+
+  err = grub_ext2_read_dir_block (diro, 0, buf);
+  if (err)
+    goto out;
+
+  info = (struct grub_ext2_dx_root_info *) (buf + EXT2_DX_ROOT_INFO_OFFSET);
+  levels = info->indirect_levels;
+  version = info->hash_version;
+  if (info->info_length < sizeof (*info)
+      || levels > EXT2_DX_MAX_INDIRECT_LEVELS
+      || (info->unused_flags & 1))
+    {
+      err = grub_error (GRUB_ERR_BAD_FS, "unsupported htree");
+      goto out;
+    }
+
+  if (version <= EXT2_DX_HASH_TEA
+      && (data->sblock.flags
+	  & grub_cpu_to_le32_compile_time (EXT2_FLAGS_UNSIGNED_HASH)))
+    version += EXT2_DX_HASH_LEGACY_UNSIGNED;
+  if (! grub_ext2_dx_hash (data, version, name, &hash))
+    {
+      err = grub_error (GRUB_ERR_BAD_FS, "unsupported htree hash %d", version);
+      goto out;
+    }
+
+  err = grub_ext2_dx_frame_init (diro, &frames[0], buf,
+				 EXT2_DX_ROOT_INFO_OFFSET + info->info_length,
+				 hash);
+  level = 0;
+
+  while (1)
+    {
+      /* Descend to the leaf below the current entry of LEVEL.  */
+      for (; !err && level < levels; level++)
+	{
+	  char *node = buf + blocksize * (level + 1);
+
+	  err = grub_ext2_read_dir_block (diro,
+					  grub_ext2_dx_frame_block (&frames[level]),
+					  node);
+	  if (!err)
+	    err = grub_ext2_dx_frame_init (diro, &frames[level + 1], node,
+					   sizeof (struct ext2_dirent), hash);
+	}
+      if (err)
+	goto out;
+
+      err = grub_ext2_read_dir_block (diro,
+				      grub_ext2_dx_frame_block (&frames[levels]),
+				      leaf);
+      if (err)
+	goto out;
+
+      *foundnode = grub_ext2_dx_leaf_find (diro, leaf, name, foundtype);
+      if (*foundnode || grub_errno)
+	{
+	  err = grub_errno;
+	  goto out;
+	}
+
+      /* Names with colliding hashes may continue in the next leaf, which
+	 is then marked by the low bit of its hash.  */
+      for (level = levels + 1; level > 0; level--)
+	if (frames[level - 1].at + 1 < frames[level - 1].count)
+	  break;
+      if (level == 0)
+	break;
+      level--;
+      frames[level].at++;
+      if ((grub_le_to_cpu32 (frames[level].entries[frames[level].at].hash)
+	   & ~1) != hash)
+	break;
+      for (; level < levels; level++)
+	{
+	  char *node = buf + blocksize * (level + 1);
+
+	  err = grub_ext2_read_dir_block (diro,
+					  grub_ext2_dx_frame_block (&frames[level]),
+					  node);
+	  if (err)
+	    goto out;
+	  err = grub_ext2_dx_frame_init (diro, &frames[level + 1], node,
+					 sizeof (struct ext2_dirent), hash);
+	  if (err)
+	    goto out;
+	  frames[level + 1].at = 0;
+	}
+    }
+
+ out:
+  grub_free (buf);
+  return err;
+}
+
+/* Context for grub_ext2_lookup_file.  */
+struct grub_ext2_lookup_ctx
+{
+  const char *name;
+  struct grub_fshelp_node *foundnode;
+  enum grub_fshelp_filetype foundtype;
+};
+
+/* Helper for grub_ext2_lookup_file.  */
+static int
+grub_ext2_lookup_iter (const char *filename, enum grub_fshelp_filetype filetype,
+		       grub_fshelp_node_t node, void *data)
+{
+  struct grub_ext2_lookup_ctx *ctx = data;
+
+  if (filetype == GRUB_FSHELP_UNKNOWN || grub_strcmp (ctx->name, filename))
+    {
+      grub_free (node);
+      return 0;
+    }
+
+  ctx->foundnode = node;
+  ctx->foundtype = filetype;
+  return 1;
+}
+
+/* Look up NAME in the directory DIR, using its hash index if it has
+   one.  */
+static grub_err_t
+grub_ext2_lookup_file (grub_fshelp_node_t dir, const char *name,
+		       grub_fshelp_node_t *foundnode,
+		       enum grub_fshelp_filetype *foundtype)
+{
+  struct grub_fshelp_node *diro = dir;
+  struct grub_ext2_data *data = diro->data;
+  struct grub_ext2_lookup_ctx ctx = {
+    .name = name,
+    .foundnode = 0,
+    .foundtype = GRUB_FSHELP_UNKNOWN
+  };
+
+  *foundnode = 0;
+
+  if (! diro->inode_read)
+    {
+      grub_ext2_read_inode (data, diro->ino, &diro->inode);
+      if (grub_errno)
+	return grub_errno;
+      diro->inode_read = 1;
+    }
+
+  if ((data->sblock.feature_compatibility
+       & grub_cpu_to_le32_compile_time (EXT2_FEATURE_COMPAT_DIR_INDEX))
+      && (diro->inode.flags & grub_cpu_to_le32_compile_time (EXT4_INDEX_FLAG))
+      && !(diro->inode.flags
+	   & grub_cpu_to_le32_compile_time (EXT4_ENCRYPT_FLAG
+					    | EXT4_CASEFOLD_FLAG)))
+    {
+      grub_err_t err;
+
+      err = grub_ext2_dx_lookup (diro, name, foundnode, foundtype);
+      if (err != GRUB_ERR_BAD_FS)
+	return err;
+
+      /* The index is damaged or of an unknown kind, but the leaves are
+	 still ordinary directory blocks.  */
+      grub_dprintf ("ext2", "htree of inode %d unusable: %s\n",
+		    diro->ino, grub_errmsg);
+      grub_errno = GRUB_ERR_NONE;
+    }
+
+  grub_ext2_iterate_dir (diro, grub_ext2_lookup_iter, &ctx);
+  if (grub_errno)
+    return grub_errno;
+
+  *foundnode = ctx.foundnode;
+  *foundtype = ctx.foundtype;
+  return GRUB_ERR_NONE;
+}
+
+static grub_uint64_t
+grub_ext2_node_id (grub_fshelp_node_t node)
+{
+  return node->ino;
+}
+
+static grub_fshelp_node_t
+grub_ext2_node_from_id (grub_fshelp_node_t dir, grub_uint64_t id)
+{
+  struct grub_fshelp_node *node;
+
+  node = grub_malloc (sizeof (*node));
+  if (! node)
+    return NULL;
+
+  node->data = dir->data;
+  node->ino = id;
+  node->inode_read = 0;
+  return node;
+}
+
+static const struct grub_fshelp_dcache_ops grub_ext2_dcache_ops =
+  {
+    .node_id = grub_ext2_node_id,
+    .node_from_id = grub_ext2_node_from_id
+  };
+
 /* Open a file named NAME and initialize FILE.  */
 static grub_err_t
 grub_ext2_open (struct grub_file *file, const char *name)
@@ -896,9 +1848,11 @@ grub_ext2_open (struct grub_file *file, const char *name)
       goto fail;
     }
 
-  err = grub_fshelp_find_file (name, &data->diropen, &fdiro,
-			       grub_ext2_iterate_dir,
-			       grub_ext2_read_symlink, GRUB_FSHELP_REG);
+  err = grub_fshelp_find_file_lookup_cached (name, &data->diropen, &fdiro,
+					     grub_ext2_lookup_file,
+					     grub_ext2_read_symlink,
+					     GRUB_FSHELP_REG, data->disk,
+					     &grub_ext2_dcache_ops);
   if (err)
     goto fail;
 
@@ -918,6 +1872,9 @@ grub_ext2_open (struct grub_file *file, const char *name)
   grub_memcpy (data->inode, &fdiro->inode, sizeof (struct grub_ext2_inode));
   grub_free (fdiro);
 
+  /* DIROPEN now describes the file, let reads build its extent map.  */
+  data->extents_state = 0;
+
   file->size = grub_le_to_cpu32 (data->inode->size);
   file->size |= ((grub_off_t) grub_le_to_cpu32 (data->inode->size_high)) << 32;
   file->data = data;
@@ -928,7 +1885,7 @@ grub_ext2_open (struct grub_file *file, const char *name)
  fail:
   if (fdiro != &data->diropen)
     grub_free (fdiro);
-  grub_free (data);
+  grub_ext2_unmount (data);
 
   grub_dl_unref (my_mod);
 
@@ -938,7 +1895,7 @@ grub_ext2_open (struct grub_file *file, const char *name)
 static grub_err_t
 grub_ext2_close (grub_file_t file)
 {
-  grub_free (file->data);
+  grub_ext2_unmount (file->data);
 
   grub_dl_unref (my_mod);
 
@@ -985,6 +1942,12 @@ grub_ext2_dir_iter (const char *filename, enum grub_fshelp_filetype filetype,
     {
       info.mtimeset = 1;
       info.mtime = grub_le_to_cpu32 (node->inode.mtime);
+      if ((filetype & GRUB_FSHELP_TYPE_MASK) == GRUB_FSHELP_REG)
+	{
+	  info.sizeset = 1;
+	  info.size = grub_le_to_cpu32 (node->inode.size)
+	    | (((grub_uint64_t) grub_le_to_cpu32 (node->inode.size_high)) << 32);
+	}
     }
 
   info.dir = ((filetype & GRUB_FSHELP_TYPE_MASK) == GRUB_FSHELP_DIR);
@@ -1008,9 +1971,11 @@ grub_ext2_dir (grub_device_t device, const char *path, grub_fs_dir_hook_t hook,
   if (! ctx.data)
     goto fail;
 
-  grub_fshelp_find_file (path, &ctx.data->diropen, &fdiro,
-			 grub_ext2_iterate_dir, grub_ext2_read_symlink,
-			 GRUB_FSHELP_DIR);
+  grub_fshelp_find_file_lookup_cached (path, &ctx.data->diropen, &fdiro,
+				       grub_ext2_lookup_file,
+				       grub_ext2_read_symlink,
+				       GRUB_FSHELP_DIR, ctx.data->disk,
+				       &grub_ext2_dcache_ops);
   if (grub_errno)
     goto fail;
 
@@ -1019,7 +1984,7 @@ grub_ext2_dir (grub_device_t device, const char *path, grub_fs_dir_hook_t hook,
  fail:
   if (fdiro != &ctx.data->diropen)
     grub_free (fdiro);
-  grub_free (ctx.data);
+  grub_ext2_unmount (ctx.data);
 
   grub_dl_unref (my_mod);
 
@@ -1041,9 +2006,9 @@ grub_ext2_label (grub_device_t device, char **label)
   else
     *label = NULL;
 
-  grub_dl_unref (my_mod);
+  grub_ext2_unmount (data);
 
-  grub_free (data);
+  grub_dl_unref (my_mod);
 
   return grub_errno;
 }
@@ -1072,9 +2037,9 @@ grub_ext2_uuid (grub_device_t device, char **uuid)
   else
     *uuid = NULL;
 
-  grub_dl_unref (my_mod);
+  grub_ext2_unmount (data);
 
-  grub_free (data);
+  grub_dl_unref (my_mod);
 
   return grub_errno;
 }
@@ -1094,9 +2059,9 @@ grub_ext2_mtime (grub_device_t device, grub_int64_t *tm)
   else
     *tm = grub_le_to_cpu32 (data->sblock.utime);
 
-  grub_dl_unref (my_mod);
+  grub_ext2_unmount (data);
 
-  grub_free (data);
+  grub_dl_unref (my_mod);
 
   return grub_errno;
 
@@ -1130,4 +2095,5 @@ GRUB_MOD_INIT(ext2)
 GRUB_MOD_FINI(ext2)
 {
   grub_fs_unregister (&grub_ext2_fs);
+  grub_fshelp_mount_flush ("ext2");
 }
@@ -124,6 +124,10 @@ GRUB_MOD_LICENSE ("GPLv3+");
 #define MAX_VOLUME_NAME           512
 #define MAX_NAT_BITMAP_SIZE       3900
 
+/* NAT blocks and direct/indirect node blocks kept per mount.  */
+#define F2FS_NAT_CACHE_SIZE       8
+#define F2FS_NODE_CACHE_SIZE      8
+
 enum FILE_TYPE
 {
   F2FS_FT_UNKNOWN,
@@ -291,6 +295,26 @@ struct grub_fshelp_node
   int inode_read;
 };
 
+struct grub_f2fs_nat_jent_sorted
+{
+  grub_uint32_t                   nid;
+  grub_uint32_t                   blkaddr;
+};
+
+struct grub_f2fs_nat_cache
+{
+  grub_uint32_t                   block_off;
+  unsigned long                   last_use;
+  struct grub_f2fs_nat_block      *blk;
+};
+
+struct grub_f2fs_node_cache
+{
+  grub_uint32_t                   nid;
+  unsigned long                   last_use;
+  struct grub_f2fs_node           *blk;
+};
+
 struct grub_f2fs_data
 {
   struct grub_f2fs_superblock     sblock;
@@ -305,6 +329,14 @@ struct grub_f2fs_data
   char                            *nat_bitmap;
   grub_uint32_t                   nat_bitmap_size;
 
+  /* The NAT journal sorted by nid.  */
+  struct grub_f2fs_nat_jent_sorted nat_jsorted[NAT_JOURNAL_ENTRIES];
+  grub_uint16_t                   n_jsorted;
+
+  unsigned long                   cache_clock;
+  struct grub_f2fs_nat_cache      nat_cache[F2FS_NAT_CACHE_SIZE];
+  struct grub_f2fs_node_cache     node_cache[F2FS_NODE_CACHE_SIZE];
+
   grub_disk_t                     disk;
   struct grub_f2fs_node           *inode;
   struct grub_fshelp_node         diropen;
@@ -610,6 +642,34 @@ grub_f2fs_read_cp (struct grub_f2fs_data *data)
   return 0;
 }
 
+/* Sort the NAT journal by nid for get_blkaddr_from_nat_journal.  Equal
+   nids keep their journal order, so the first one is still found.  */
+static grub_err_t
+sort_nat_journal (struct grub_f2fs_data *data)
+{
+  grub_uint16_t n = grub_le_to_cpu16 (data->nat_j.n_nats);
+  grub_uint16_t i, j;
+
+  if (n > NAT_JOURNAL_ENTRIES)
+    return grub_error (GRUB_ERR_BAD_FS,
+                       "invalid number of nat journal entries");
+
+  for (i = 0; i < n; i++)
+    {
+      struct grub_f2fs_nat_jent_sorted e;
+
+      e.nid = grub_le_to_cpu32 (data->nat_j.entries[i].nid);
+      e.blkaddr = grub_le_to_cpu32 (data->nat_j.entries[i].ne.block_addr);
+
+      for (j = i; j > 0 && data->nat_jsorted[j - 1].nid > e.nid; j--)
+        data->nat_jsorted[j] = data->nat_jsorted[j - 1];
+      data->nat_jsorted[j] = e;
+    }
+  data->n_jsorted = n;
+
+  return GRUB_ERR_NONE;
+}
+
 static grub_err_t
 get_nat_journal (struct grub_f2fs_data *data)
 {
@@ -637,6 +697,8 @@ get_nat_journal (struct grub_f2fs_data *data)
   else
     grub_memcpy (&data->nat_j, buf + SUM_ENTRIES_SIZE, SUM_JOURNAL_SIZE);
 
+  err = sort_nat_journal (data);
+
  fail:
   grub_free (buf);
 
@@ -647,47 +709,42 @@ static grub_err_t
 get_blkaddr_from_nat_journal (struct grub_f2fs_data *data, grub_uint32_t nid,
                               grub_uint32_t *blkaddr)
 {
-  grub_uint16_t n = grub_le_to_cpu16 (data->nat_j.n_nats);
-  grub_uint16_t i;
-
-  if (n > NAT_JOURNAL_ENTRIES)
-    return grub_error (GRUB_ERR_BAD_FS,
-                       "invalid number of nat journal entries");
+  grub_uint16_t lo = 0, hi = data->n_jsorted;
 
-  for (i = 0; i < n; i++)
+  while (lo < hi)
     {
-      if (grub_le_to_cpu32 (data->nat_j.entries[i].nid) == nid)
-        {
-          *blkaddr = grub_le_to_cpu32 (data->nat_j.entries[i].ne.block_addr);
-          break;
-        }
+      grub_uint16_t mid = lo + (hi - lo) / 2;
+
+      if (data->nat_jsorted[mid].nid < nid)
+        lo = mid + 1;
+      else
+        hi = mid;
     }
 
+  if (lo < data->n_jsorted && data->nat_jsorted[lo].nid == nid)
+    *blkaddr = data->nat_jsorted[lo].blkaddr;
+
   return GRUB_ERR_NONE;
 }
 
-static grub_uint32_t
-get_node_blkaddr (struct grub_f2fs_data *data, grub_uint32_t nid)
+/* Return NAT block BLOCK_OFF, read through the NAT cache of DATA.  */
+static struct grub_f2fs_nat_block *
+get_nat_block (struct grub_f2fs_data *data, grub_uint32_t block_off)
 {
-  struct grub_f2fs_nat_block *nat_block;
-  grub_uint32_t seg_off, block_off, entry_off, block_addr;
-  grub_uint32_t blkaddr = 0;
-  grub_err_t err;
+  struct grub_f2fs_nat_cache *c, *victim = &data->nat_cache[0];
+  grub_uint32_t seg_off, block_addr;
   int result_bit;
 
-  err = get_blkaddr_from_nat_journal (data, nid, &blkaddr);
-  if (err != GRUB_ERR_NONE)
-    return 0;
-
-  if (blkaddr)
-    return blkaddr;
-
-  nat_block = grub_malloc (F2FS_BLKSIZE);
-  if (!nat_block)
-    return 0;
-
-  block_off = nid / NAT_ENTRY_PER_BLOCK;
-  entry_off = nid % NAT_ENTRY_PER_BLOCK;
+  for (c = data->nat_cache; c < data->nat_cache + F2FS_NAT_CACHE_SIZE; c++)
+    {
+      if (c->last_use && c->block_off == block_off)
+        {
+          c->last_use = ++data->cache_clock;
+          return c->blk;
+        }
+      if (c->last_use < victim->last_use)
+        victim = c;
+    }
 
   seg_off = block_off / data->blocks_per_seg;
   block_addr = data->nat_blkaddr +
@@ -699,23 +756,43 @@ get_node_blkaddr (struct grub_f2fs_data *data, grub_uint32_t nid)
   if (result_bit > 0)
     block_addr += data->blocks_per_seg;
   else if (result_bit == -1)
-    {
-      grub_free (nat_block);
-      return 0;
-    }
+    return NULL;
 
-  err = grub_f2fs_block_read (data, block_addr, nat_block);
-  if (err)
+  if (!victim->blk)
     {
-      grub_free (nat_block);
-      return 0;
+      victim->blk = grub_malloc (F2FS_BLKSIZE);
+      if (!victim->blk)
+        return NULL;
     }
 
-  blkaddr = grub_le_to_cpu32 (nat_block->ne[entry_off].block_addr);
+  victim->last_use = 0;
+  if (grub_f2fs_block_read (data, block_addr, victim->blk))
+    return NULL;
+
+  victim->block_off = block_off;
+  victim->last_use = ++data->cache_clock;
+  return victim->blk;
+}
+
+static grub_uint32_t
+get_node_blkaddr (struct grub_f2fs_data *data, grub_uint32_t nid)
+{
+  struct grub_f2fs_nat_block *nat_block;
+  grub_uint32_t blkaddr = 0;
+  grub_err_t err;
+
+  err = get_blkaddr_from_nat_journal (data, nid, &blkaddr);
+  if (err != GRUB_ERR_NONE)
+    return 0;
 
-  grub_free (nat_block);
+  if (blkaddr)
+    return blkaddr;
 
-  return blkaddr;
+  nat_block = get_nat_block (data, nid / NAT_ENTRY_PER_BLOCK);
+  if (!nat_block)
+    return 0;
+
+  return grub_le_to_cpu32 (nat_block->ne[nid % NAT_ENTRY_PER_BLOCK].block_addr);
 }
 
 static int
@@ -819,13 +896,66 @@ grub_f2fs_read_node (struct grub_f2fs_data *data,
   return grub_f2fs_block_read (data, blkaddr, np);
 }
 
+/* Return direct or indirect node NID, read through the node cache of
+   DATA, or NULL if it is not allocated or can't be read.  The node stays
+   valid until the next call.  Walking the node path of consecutive
+   blocks mostly hits the cache.  */
+static struct grub_f2fs_node *
+grub_f2fs_get_node (struct grub_f2fs_data *data, grub_uint32_t nid)
+{
+  struct grub_f2fs_node_cache *c, *victim = &data->node_cache[0];
+  grub_uint32_t blkaddr;
+
+  for (c = data->node_cache; c < data->node_cache + F2FS_NODE_CACHE_SIZE; c++)
+    {
+      if (c->last_use && c->nid == nid)
+        {
+          c->last_use = ++data->cache_clock;
+          return c->blk;
+        }
+      if (c->last_use < victim->last_use)
+        victim = c;
+    }
+
+  if (!victim->blk)
+    {
+      victim->blk = grub_malloc (F2FS_BLKSIZE);
+      if (!victim->blk)
+        return NULL;
+    }
+
+  victim->last_use = 0;
+  blkaddr = get_node_blkaddr (data, nid);
+  if (!blkaddr || grub_f2fs_block_read (data, blkaddr, victim->blk))
+    return NULL;
+
+  victim->nid = nid;
+  victim->last_use = ++data->cache_clock;
+  return victim->blk;
+}
+
+static void
+grub_f2fs_free (struct grub_f2fs_data *data)
+{
+  int i;
+
+  if (!data)
+    return;
+
+  for (i = 0; i < F2FS_NAT_CACHE_SIZE; i++)
+    grub_free (data->nat_cache[i].blk);
+  for (i = 0; i < F2FS_NODE_CACHE_SIZE; i++)
+    grub_free (data->node_cache[i].blk);
+  grub_free (data);
+}
+
 static struct grub_f2fs_data *
 grub_f2fs_mount (grub_disk_t disk)
 {
   struct grub_f2fs_data *data;
   grub_err_t err;
 
-  data = grub_malloc (sizeof (*data));
+  data = grub_zalloc (sizeof (*data));
   if (!data)
     return NULL;
 
@@ -872,7 +1002,7 @@ grub_f2fs_mount (grub_disk_t disk)
   return data;
 
  fail:
-  grub_free (data);
+  grub_f2fs_free (data);
 
   return NULL;
 }
@@ -896,18 +1026,15 @@ grub_f2fs_get_block (grub_fshelp_node_t node, grub_disk_addr_t block_ofs)
   if (level == 0)
     return grub_le_to_cpu32 (inode->i_addr[offset[0]]);
 
-  node_block = grub_malloc (F2FS_BLKSIZE);
-  if (!node_block)
-    return -1;
-
   nids[1] = get_node_id (&node->inode, offset[0], 1);
 
   /* Get indirect or direct nodes. */
   for (i = 1; i <= level; i++)
     {
-      grub_f2fs_read_node (data, nids[i], node_block);
-      if (grub_errno)
-        goto fail;
+      /* A missing node leaves a hole in the file.  */
+      node_block = grub_f2fs_get_node (data, nids[i]);
+      if (!node_block)
+        return grub_errno ? (grub_disk_addr_t) -1 : 0;
 
       if (i < level)
         nids[i + 1] = get_node_id (node_block, offset[i], 0);
@@ -915,9 +1042,6 @@ grub_f2fs_get_block (grub_fshelp_node_t node, grub_disk_addr_t block_ofs)
 
   block_addr = grub_le_to_cpu32 (node_block->dn.addr[offset[level]]);
 
- fail:
-  grub_free (node_block);
-
   return block_addr;
 }
 
@@ -1173,7 +1297,7 @@ grub_f2fs_dir (grub_device_t device, const char *path,
  fail:
   if (fdiro != &ctx.data->diropen)
     grub_free (fdiro);
-  grub_free (ctx.data);
+  grub_f2fs_free (ctx.data);
   grub_dl_unref (my_mod);
 
   return grub_errno;
@@ -1222,7 +1346,7 @@ grub_f2fs_open (struct grub_file *file, const char *name)
  fail:
   if (fdiro != &data->diropen)
     grub_free (fdiro);
-  grub_free (data);
+  grub_f2fs_free (data);
 
   grub_dl_unref (my_mod);
 
@@ -1244,7 +1368,7 @@ grub_f2fs_close (grub_file_t file)
 {
   struct grub_f2fs_data *data = (struct grub_f2fs_data *) file->data;
 
-  grub_free (data);
+  grub_f2fs_free (data);
 
   grub_dl_unref (my_mod);
 
@@ -1291,7 +1415,7 @@ grub_f2fs_label (grub_device_t device, char **label)
   else
     *label = NULL;
 
-  grub_free (data);
+  grub_f2fs_free (data);
   grub_dl_unref (my_mod);
 
   return grub_errno;
@@ -1327,7 +1451,7 @@ grub_f2fs_uuid (grub_device_t device, char **uuid)
   else
     *uuid = NULL;
 
-  grub_free (data);
+  grub_f2fs_free (data);
   grub_dl_unref (my_mod);
 
   return grub_errno;
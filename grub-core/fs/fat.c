@@ -123,6 +123,7 @@ struct grub_fat_dir_node
   grub_uint32_t first_cluster;
   grub_uint64_t file_size;
   grub_uint64_t valid_size;
+  grub_uint16_t name_hash;
   int have_stream;
   int is_contiguous;
 };
@@ -162,6 +163,30 @@ typedef struct grub_fat_dir_entry grub_fat_dir_node_t;
 
 #endif
 
+#ifdef MODE_EXFAT
+#define GRUB_FAT_MOUNT_NAME	"exfat"
+#else
+#define GRUB_FAT_MOUNT_NAME	"fat"
+#endif
+
+#define GRUB_FAT_INDEX_BUCKETS	256
+#define GRUB_FAT_INDEX_DIRS	64
+#define GRUB_FAT_INDEX_MAX_ENTRIES	4096
+
+struct grub_fat_index_entry
+{
+  struct grub_fat_index_entry *next;
+  grub_uint32_t dir_cluster;
+  grub_uint32_t hash;
+  grub_uint8_t attr;
+  grub_uint64_t file_size;
+  grub_uint32_t file_cluster;
+#ifdef MODE_EXFAT
+  int is_contiguous;
+#endif
+  char name[0];
+};
+
 struct grub_fat_data
 {
   int logical_sector_bits;
@@ -183,6 +208,21 @@ struct grub_fat_data
   grub_uint32_t num_clusters;
 
   grub_uint32_t uuid;
+
+  /* Directory lookup index: buckets of entries hashed by directory
+     cluster and name, and the directories that have been indexed.  */
+  struct grub_fat_index_entry **index;
+  grub_uint32_t index_entries;
+  unsigned num_indexed_dirs;
+  grub_uint32_t indexed_dirs[GRUB_FAT_INDEX_DIRS];
+};
+
+/* A run of consecutive clusters of a file.  */
+struct grub_fat_run
+{
+  grub_uint32_t logical;
+  grub_uint32_t cluster;
+  grub_uint32_t len;
 };
 
 struct grub_fshelp_node {
@@ -202,8 +242,16 @@ struct grub_fshelp_node {
 #ifdef MODE_EXFAT
   int is_contiguous;
 #endif
+
+  /* Cluster chain of an open file, built on its first read.  */
+  int runs_built;
+  grub_uint32_t nruns;
+  struct grub_fat_run *runs;
 };
 
+/* Size of the FAT window used while building a run list.  */
+#define GRUB_FAT_RUN_WINDOW	4096
+
 static grub_dl_t my_mod;
 
 #ifndef MODE_EXFAT
@@ -235,7 +283,11 @@ grub_fat_mount (grub_disk_t disk)
   if (! disk)
     goto fail;
 
-  data = (struct grub_fat_data *) grub_malloc (sizeof (*data));
+  data = grub_fshelp_mount_get (GRUB_FAT_MOUNT_NAME, disk);
+  if (data)
+    return data;
+
+  data = (struct grub_fat_data *) grub_zalloc (sizeof (*data));
   if (! data)
     goto fail;
 
@@ -449,6 +501,228 @@ grub_fat_mount (grub_disk_t disk)
   return 0;
 }
 
+static void
+grub_fat_free (void *ptr)
+{
+  struct grub_fat_data *data = ptr;
+  unsigned i;
+
+  if (data->index)
+    for (i = 0; i < GRUB_FAT_INDEX_BUCKETS; i++)
+      while (data->index[i])
+	{
+	  struct grub_fat_index_entry *e = data->index[i];
+
+	  data->index[i] = e->next;
+	  grub_free (e);
+	}
+  grub_free (data->index);
+  grub_free (data);
+}
+
+/* Release DATA, keeping the mount and its lookup index for the next user
+   of DISK.  */
+static void
+grub_fat_unmount (grub_disk_t disk, struct grub_fat_data *data)
+{
+  if (data)
+    grub_fshelp_mount_put (GRUB_FAT_MOUNT_NAME, disk, data, grub_fat_free);
+}
+
+static grub_uint32_t
+grub_fat_entry_offset (struct grub_fat_data *data, grub_uint32_t cluster)
+{
+  switch (data->fat_size)
+    {
+    case 32:
+      return cluster << 2;
+    case 16:
+      return cluster << 1;
+    default:
+      /* case 12: */
+      return cluster + (cluster >> 1);
+    }
+}
+
+static grub_uint32_t
+grub_fat_entry_value (struct grub_fat_data *data, grub_uint32_t cluster,
+		      grub_uint32_t raw)
+{
+  grub_uint32_t next_cluster = grub_le_to_cpu32 (raw);
+
+  switch (data->fat_size)
+    {
+    case 16:
+      next_cluster &= 0xFFFF;
+      break;
+    case 12:
+      if (cluster & 1)
+	next_cluster >>= 4;
+
+      next_cluster &= 0x0FFF;
+      break;
+    }
+  return next_cluster;
+}
+
+/* Follow the cluster chain of NODE once and record it as a list of runs
+   of consecutive clusters.  The FAT is read a window at a time rather
+   than an entry at a time.  */
+static grub_err_t
+grub_fat_build_runs (grub_disk_t disk, grub_fshelp_node_t node)
+{
+  struct grub_fat_data *data = node->data;
+  grub_uint8_t *window;
+  grub_uint32_t win_off = 0, win_len = 0, fat_bytes;
+  grub_uint32_t cluster, nclusters, logical, alloc = 0;
+  unsigned width = (data->fat_size + 7) >> 3;
+  grub_uint64_t cluster_size = 1ULL << (data->cluster_bits
+					+ GRUB_DISK_SECTOR_BITS);
+
+  node->runs_built = 1;
+
+  if (node->file_size == 0
+      || node->file_cluster < 2 || node->file_cluster >= data->num_clusters)
+    return GRUB_ERR_NONE;
+
+  /* Never follow the chain further than the file size requires.  */
+  nclusters = (node->file_size + cluster_size - 1) >> (data->cluster_bits
+						       + GRUB_DISK_SECTOR_BITS);
+  fat_bytes = data->sectors_per_fat << GRUB_DISK_SECTOR_BITS;
+
+  window = grub_malloc (GRUB_FAT_RUN_WINDOW);
+  if (!window)
+    return grub_errno;
+
+  cluster = node->file_cluster;
+  for (logical = 0; ; logical++)
+    {
+      grub_uint32_t fat_offset, raw = 0, next_cluster;
+
+      if (node->nruns
+	  && node->runs[node->nruns - 1].cluster
+	     + node->runs[node->nruns - 1].len == cluster)
+	node->runs[node->nruns - 1].len++;
+      else
+	{
+	  if (node->nruns == alloc)
+	    {
+	      struct grub_fat_run *n;
+
+	      alloc = alloc ? alloc * 2 : 8;
+	      n = grub_realloc (node->runs, alloc * sizeof (*n));
+	      if (!n)
+		goto fail;
+	      node->runs = n;
+	    }
+	  node->runs[node->nruns].logical = logical;
+	  node->runs[node->nruns].cluster = cluster;
+	  node->runs[node->nruns].len = 1;
+	  node->nruns++;
+	}
+
+      if (logical + 1 >= nclusters)
+	break;
+
+      fat_offset = grub_fat_entry_offset (data, cluster);
+      if (fat_offset + width > fat_bytes)
+	{
+	  grub_error (GRUB_ERR_BAD_FS, "invalid cluster %u", cluster);
+	  goto fail;
+	}
+      if (fat_offset < win_off || fat_offset + width > win_off + win_len)
+	{
+	  win_off = fat_offset & ~(GRUB_DISK_SECTOR_SIZE - 1);
+	  win_len = fat_bytes - win_off;
+	  if (win_len > GRUB_FAT_RUN_WINDOW)
+	    win_len = GRUB_FAT_RUN_WINDOW;
+	  if (grub_disk_read (disk, data->fat_sector, win_off, win_len, window))
+	    goto fail;
+	}
+      grub_memcpy (&raw, window + fat_offset - win_off, width);
+      next_cluster = grub_fat_entry_value (data, cluster, raw);
+
+      if (next_cluster >= data->cluster_eof_mark)
+	break;
+
+      if (next_cluster < 2 || next_cluster >= data->num_clusters)
+	{
+	  grub_error (GRUB_ERR_BAD_FS, "invalid cluster %u", next_cluster);
+	  goto fail;
+	}
+      cluster = next_cluster;
+    }
+
+  grub_free (window);
+  return GRUB_ERR_NONE;
+
+ fail:
+  grub_free (window);
+  grub_free (node->runs);
+  node->runs = NULL;
+  node->nruns = 0;
+  return grub_errno;
+}
+
+/* Read from a file whose run list has been built, one disk read per run.  */
+static grub_ssize_t
+grub_fat_read_runs (grub_disk_t disk, grub_fshelp_node_t node,
+		    grub_disk_read_hook_t read_hook, void *read_hook_data,
+		    grub_off_t offset, grub_size_t len, char *buf)
+{
+  unsigned logical_cluster_bits = (node->data->cluster_bits
+				   + GRUB_DISK_SECTOR_BITS);
+  grub_uint64_t logical_cluster = offset >> logical_cluster_bits;
+  grub_uint32_t lo = 0, hi = node->nruns;
+  grub_ssize_t ret = 0;
+
+  /* Find the last run starting at or before LOGICAL_CLUSTER.  */
+  while (hi - lo > 1)
+    {
+      grub_uint32_t mid = lo + (hi - lo) / 2;
+
+      if (node->runs[mid].logical <= logical_cluster)
+	lo = mid;
+      else
+	hi = mid;
+    }
+
+  for (; len && lo < node->nruns; lo++)
+    {
+      struct grub_fat_run *run = &node->runs[lo];
+      grub_uint64_t start, end, size;
+      grub_disk_addr_t sector;
+
+      start = (grub_uint64_t) run->logical << logical_cluster_bits;
+      end = start + ((grub_uint64_t) run->len << logical_cluster_bits);
+      if (offset >= end)
+	continue;
+
+      size = end - offset;
+      if (size > len)
+	size = len;
+
+      sector = (node->data->cluster_sector
+		+ ((grub_disk_addr_t) (run->cluster - 2)
+		   << node->data->cluster_bits));
+
+      disk->read_hook = read_hook;
+      disk->read_hook_data = read_hook_data;
+      grub_disk_read (disk, sector + ((offset - start) >> GRUB_DISK_SECTOR_BITS),
+		      (offset - start) & (GRUB_DISK_SECTOR_SIZE - 1), size, buf);
+      disk->read_hook = 0;
+      if (grub_errno)
+	return -1;
+
+      len -= size;
+      buf += size;
+      ret += size;
+      offset += size;
+    }
+
+  return ret;
+}
+
 static grub_ssize_t
 grub_fat_read_data (grub_disk_t disk, grub_fshelp_node_t node,
 		    grub_disk_read_hook_t read_hook, void *read_hook_data,
@@ -496,6 +770,10 @@ grub_fat_read_data (grub_disk_t disk, grub_fshelp_node_t node,
     }
 #endif
 
+  if (node->runs)
+    return grub_fat_read_runs (disk, node, read_hook, read_hook_data,
+			       offset, len, buf);
+
   /* Calculate the logical cluster number and offset.  */
   logical_cluster_bits = (node->data->cluster_bits
 			  + GRUB_DISK_SECTOR_BITS);
@@ -516,19 +794,7 @@ grub_fat_read_data (grub_disk_t disk, grub_fshelp_node_t node,
 	  grub_uint32_t next_cluster;
 	  grub_uint32_t fat_offset;
 
-	  switch (node->data->fat_size)
-	    {
-	    case 32:
-	      fat_offset = node->cur_cluster << 2;
-	      break;
-	    case 16:
-	      fat_offset = node->cur_cluster << 1;
-	      break;
-	    default:
-	      /* case 12: */
-	      fat_offset = node->cur_cluster + (node->cur_cluster >> 1);
-	      break;
-	    }
+	  fat_offset = grub_fat_entry_offset (node->data, node->cur_cluster);
 
 	  /* Read the FAT.  */
 	  if (grub_disk_read (disk, node->data->fat_sector, fat_offset,
@@ -536,19 +802,8 @@ grub_fat_read_data (grub_disk_t disk, grub_fshelp_node_t node,
 			      (char *) &next_cluster))
 	    return -1;
 
-	  next_cluster = grub_le_to_cpu32 (next_cluster);
-	  switch (node->data->fat_size)
-	    {
-	    case 16:
-	      next_cluster &= 0xFFFF;
-	      break;
-	    case 12:
-	      if (node->cur_cluster & 1)
-		next_cluster >>= 4;
-
-	      next_cluster &= 0x0FFF;
-	      break;
-	    }
+	  next_cluster = grub_fat_entry_value (node->data, node->cur_cluster,
+					       next_cluster);
 
 	  grub_dprintf ("fat", "fat_size=%d, next_cluster=%u\n",
 			node->data->fat_size, next_cluster);
@@ -686,6 +941,8 @@ grub_fat_iterate_dir_next (grub_fshelp_node_t node,
 		    = grub_cpu_to_le64 (sec.type_specific.stream_extension.valid_size);
 		  ctxt->dir.file_size
 		    = grub_cpu_to_le64 (sec.type_specific.stream_extension.file_size);
+		  ctxt->dir.name_hash
+		    = grub_le_to_cpu16 (sec.type_specific.stream_extension.name_hash);
 		  ctxt->dir.have_stream = 1;
 		  ctxt->dir.is_contiguous = !!(sec.type_specific.stream_extension.flags
 					       & grub_cpu_to_le16_compile_time (FLAG_CONTIGUOUS));
@@ -910,6 +1167,196 @@ grub_fat_timestamp (grub_uint16_t time, grub_uint16_t date, grub_int64_t *nix) {
 
 #endif
 
+#ifdef MODE_EXFAT
+/* Compute the exFAT name hash of NAME.  Without the volume's up-case
+   table this is only possible for ASCII names, so return 0 for others;
+   an ASCII name can only match an ASCII entry anyway.  */
+static int
+grub_fat_name_hash (const char *name, grub_uint32_t *hash)
+{
+  grub_uint16_t h = 0;
+  const char *p;
+
+  for (p = name; *p; p++)
+    {
+      grub_uint8_t c = *p;
+
+      if (c & 0x80)
+	return 0;
+      c = grub_toupper (c);
+      h = ((h & 1) ? 0x8000 : 0) + (h >> 1) + c;
+      h = ((h & 1) ? 0x8000 : 0) + (h >> 1);
+    }
+  *hash = h;
+  return 1;
+}
+#else
+/* Hash NAME the way grub_strcasecmp compares it.  */
+static int
+grub_fat_name_hash (const char *name, grub_uint32_t *hash)
+{
+  grub_uint32_t h = 0;
+  const char *p;
+
+  for (p = name; *p; p++)
+    h = h * 31 + (grub_uint8_t) grub_tolower (*p);
+  *hash = h;
+  return 1;
+}
+#endif
+
+static grub_fshelp_node_t
+grub_fat_new_node (grub_fshelp_node_t dir, grub_uint8_t attr,
+		   grub_uint64_t file_size, grub_uint32_t file_cluster,
+		   int is_contiguous __attribute__ ((unused)))
+{
+  grub_fshelp_node_t node;
+
+  node = grub_malloc (sizeof (struct grub_fshelp_node));
+  if (!node)
+    return NULL;
+  node->attr = attr;
+  node->file_size = file_size;
+  node->file_cluster = file_cluster;
+#ifdef MODE_EXFAT
+  node->is_contiguous = is_contiguous;
+#else
+  /* If directory points to root, starting cluster is 0 */
+  if (!node->file_cluster)
+    node->file_cluster = dir->data->root_cluster;
+#endif
+  node->cur_cluster_num = ~0U;
+  node->runs_built = 0;
+  node->nruns = 0;
+  node->runs = NULL;
+  node->data = dir->data;
+  node->disk = dir->disk;
+  return node;
+}
+
+static int
+grub_fat_dir_indexed (struct grub_fat_data *data, grub_uint32_t dir_cluster)
+{
+  unsigned i;
+
+  for (i = 0; i < data->num_indexed_dirs; i++)
+    if (data->indexed_dirs[i] == dir_cluster)
+      return 1;
+  return 0;
+}
+
+static void
+grub_fat_index_drop_dir (struct grub_fat_data *data, grub_uint32_t dir_cluster)
+{
+  unsigned i;
+
+  for (i = 0; i < GRUB_FAT_INDEX_BUCKETS; i++)
+    {
+      struct grub_fat_index_entry **prev = &data->index[i];
+
+      while (*prev)
+	{
+	  struct grub_fat_index_entry *e = *prev;
+
+	  if (e->dir_cluster == dir_cluster)
+	    {
+	      *prev = e->next;
+	      grub_free (e);
+	      data->index_entries--;
+	    }
+	  else
+	    prev = &e->next;
+	}
+    }
+}
+
+/* Scan the directory NODE once and enter all its names into the lookup
+   index of its mount.  Directories that would overflow the index are
+   left out and looked up by scanning.  */
+static grub_err_t
+grub_fat_index_dir (grub_fshelp_node_t node)
+{
+  struct grub_fat_data *data = node->data;
+  struct grub_fat_iterate_context ctxt;
+  grub_err_t err;
+
+  if (data->num_indexed_dirs == GRUB_FAT_INDEX_DIRS
+      || data->index_entries >= GRUB_FAT_INDEX_MAX_ENTRIES)
+    return GRUB_ERR_NONE;
+
+  if (!data->index)
+    {
+      data->index = grub_zalloc (GRUB_FAT_INDEX_BUCKETS
+				 * sizeof (data->index[0]));
+      if (!data->index)
+	return grub_errno;
+    }
+
+  err = grub_fat_iterate_init (&ctxt);
+  if (err)
+    return err;
+
+  while (!(err = grub_fat_iterate_dir_next (node, &ctxt)))
+    {
+      struct grub_fat_index_entry *e;
+      grub_uint32_t hash;
+      grub_size_t len;
+
+#ifdef MODE_EXFAT
+      if (!ctxt.dir.have_stream)
+	continue;
+      hash = ctxt.dir.name_hash;
+#else
+      if (ctxt.dir.attr & GRUB_FAT_ATTR_VOLUME_ID)
+	continue;
+      grub_fat_name_hash (ctxt.filename, &hash);
+#endif
+
+      if (data->index_entries >= GRUB_FAT_INDEX_MAX_ENTRIES)
+	{
+	  grub_fat_index_drop_dir (data, node->file_cluster);
+	  grub_fat_iterate_fini (&ctxt);
+	  return GRUB_ERR_NONE;
+	}
+
+      len = grub_strlen (ctxt.filename);
+      e = grub_malloc (sizeof (*e) + len + 1);
+      if (!e)
+	{
+	  err = grub_errno;
+	  break;
+	}
+      e->dir_cluster = node->file_cluster;
+      e->hash = hash;
+      e->attr = ctxt.dir.attr;
+#ifdef MODE_EXFAT
+      e->file_size = ctxt.dir.file_size;
+      e->file_cluster = ctxt.dir.first_cluster;
+      e->is_contiguous = ctxt.dir.is_contiguous;
+#else
+      e->file_size = grub_le_to_cpu32 (ctxt.dir.file_size);
+      e->file_cluster = ((grub_le_to_cpu16 (ctxt.dir.first_cluster_high) << 16)
+			 | grub_le_to_cpu16 (ctxt.dir.first_cluster_low));
+#endif
+      grub_memcpy (e->name, ctxt.filename, len + 1);
+
+      e->next = data->index[(hash ^ node->file_cluster) % GRUB_FAT_INDEX_BUCKETS];
+      data->index[(hash ^ node->file_cluster) % GRUB_FAT_INDEX_BUCKETS] = e;
+      data->index_entries++;
+    }
+
+  grub_fat_iterate_fini (&ctxt);
+  if (err != GRUB_ERR_EOF)
+    {
+      grub_fat_index_drop_dir (data, node->file_cluster);
+      return err;
+    }
+
+  grub_errno = GRUB_ERR_NONE;
+  data->indexed_dirs[data->num_indexed_dirs++] = node->file_cluster;
+  return GRUB_ERR_NONE;
+}
+
 static grub_err_t lookup_file (grub_fshelp_node_t node,
 			       const char *name,
 			       grub_fshelp_node_t *foundnode,
@@ -917,6 +1364,41 @@ static grub_err_t lookup_file (grub_fshelp_node_t node,
 {
   grub_err_t err;
   struct grub_fat_iterate_context ctxt;
+  grub_uint32_t hash;
+  int have_hash;
+
+  have_hash = grub_fat_name_hash (name, &hash);
+
+  if (have_hash && !grub_fat_dir_indexed (node->data, node->file_cluster))
+    {
+      err = grub_fat_index_dir (node);
+      if (err)
+	return err;
+    }
+
+  if (have_hash && grub_fat_dir_indexed (node->data, node->file_cluster))
+    {
+      struct grub_fat_index_entry *e;
+
+      for (e = node->data->index[(hash ^ node->file_cluster)
+				 % GRUB_FAT_INDEX_BUCKETS]; e; e = e->next)
+	if (e->dir_cluster == node->file_cluster && e->hash == hash
+	    && grub_strcasecmp (name, e->name) == 0)
+	  {
+#ifdef MODE_EXFAT
+	    *foundnode = grub_fat_new_node (node, e->attr, e->file_size,
+					    e->file_cluster, e->is_contiguous);
+#else
+	    *foundnode = grub_fat_new_node (node, e->attr, e->file_size,
+					    e->file_cluster, 0);
+#endif
+	    if (!*foundnode)
+	      return grub_errno;
+	    *foundtype = ((*foundnode)->attr & GRUB_FAT_ATTR_DIRECTORY) ? GRUB_FSHELP_DIR : GRUB_FSHELP_REG;
+	    return GRUB_ERR_NONE;
+	  }
+      return GRUB_ERR_NONE;
+    }
 
   err = grub_fat_iterate_init (&ctxt);
   if (err)
@@ -928,6 +1410,8 @@ static grub_err_t lookup_file (grub_fshelp_node_t node,
 #ifdef MODE_EXFAT
       if (!ctxt.dir.have_stream)
 	continue;
+      if (have_hash && ctxt.dir.name_hash != hash)
+	continue;
 #else
       if (ctxt.dir.attr & GRUB_FAT_ATTR_VOLUME_ID)
 	continue;
@@ -935,29 +1419,24 @@ static grub_err_t lookup_file (grub_fshelp_node_t node,
 
       if (grub_strcasecmp (name, ctxt.filename) == 0)
 	{
-	  *foundnode = grub_malloc (sizeof (struct grub_fshelp_node));
-	  if (!*foundnode)
-	    return grub_errno;
-	  (*foundnode)->attr = ctxt.dir.attr;
 #ifdef MODE_EXFAT
-	  (*foundnode)->file_size = ctxt.dir.file_size;
-	  (*foundnode)->file_cluster = ctxt.dir.first_cluster;
-	  (*foundnode)->is_contiguous = ctxt.dir.is_contiguous;
+	  *foundnode = grub_fat_new_node (node, ctxt.dir.attr,
+					  ctxt.dir.file_size,
+					  ctxt.dir.first_cluster,
+					  ctxt.dir.is_contiguous);
 #else
-	  (*foundnode)->file_size = grub_le_to_cpu32 (ctxt.dir.file_size);
-	  (*foundnode)->file_cluster = ((grub_le_to_cpu16 (ctxt.dir.first_cluster_high) << 16)
-				| grub_le_to_cpu16 (ctxt.dir.first_cluster_low));
-	  /* If directory points to root, starting cluster is 0 */
-	  if (!(*foundnode)->file_cluster)
-	    (*foundnode)->file_cluster = node->data->root_cluster;
+	  *foundnode = grub_fat_new_node (node, ctxt.dir.attr,
+					  grub_le_to_cpu32 (ctxt.dir.file_size),
+					  (grub_le_to_cpu16 (ctxt.dir.first_cluster_high) << 16)
+					  | grub_le_to_cpu16 (ctxt.dir.first_cluster_low),
+					  0);
 #endif
-	  (*foundnode)->cur_cluster_num = ~0U;
-	  (*foundnode)->data = node->data;
-	  (*foundnode)->disk = node->disk;
+	  grub_fat_iterate_fini (&ctxt);
+	  if (!*foundnode)
+	    return grub_errno;
 
 	  *foundtype = ((*foundnode)->attr & GRUB_FAT_ATTR_DIRECTORY) ? GRUB_FSHELP_DIR : GRUB_FSHELP_REG;
 
-	  grub_fat_iterate_fini (&ctxt);
 	  return GRUB_ERR_NONE;
 	}
     }
@@ -1020,13 +1499,16 @@ grub_fat_dir (grub_device_t device, const char *path, grub_fs_dir_hook_t hook,
       info.mtimeset = grub_exfat_timestamp (grub_le_to_cpu32 (ctxt.entry.type_specific.file.m_time),
 					    ctxt.entry.type_specific.file.m_time_tenth,
 					    &info.mtime);
+      info.size = ctxt.dir.file_size;
 #else
       if (ctxt.dir.attr & GRUB_FAT_ATTR_VOLUME_ID)
 	continue;
       info.mtimeset = grub_fat_timestamp (grub_le_to_cpu16 (ctxt.dir.w_time),
 					  grub_le_to_cpu16 (ctxt.dir.w_date),
 					  &info.mtime);
+      info.size = grub_le_to_cpu32 (ctxt.dir.file_size);
 #endif
+      info.sizeset = !info.dir;
 
       if (hook (ctxt.filename, &info, hook_data))
 	break;
@@ -1039,7 +1521,7 @@ grub_fat_dir (grub_device_t device, const char *path, grub_fs_dir_hook_t hook,
   if (found != &root)
     grub_free (found);
 
-  grub_free (data);
+  grub_fat_unmount (disk, data);
 
   grub_dl_unref (my_mod);
 
@@ -1087,7 +1569,7 @@ grub_fat_open (grub_file_t file, const char *name)
   if (found != &root)
     grub_free (found);
 
-  grub_free (data);
+  grub_fat_unmount (disk, data);
 
   grub_dl_unref (my_mod);
 
@@ -1097,6 +1579,16 @@ grub_fat_open (grub_file_t file, const char *name)
 static grub_ssize_t
 grub_fat_read (grub_file_t file, char *buf, grub_size_t len)
 {
+  grub_fshelp_node_t node = file->data;
+
+  if (!node->runs_built
+#ifdef MODE_EXFAT
+      && !node->is_contiguous
+#endif
+      && grub_fat_build_runs (file->device->disk, node))
+    /* Fall back to following the chain cluster by cluster.  */
+    grub_errno = GRUB_ERR_NONE;
+
   return grub_fat_read_data (file->device->disk, file->data,
 			     file->read_hook, file->read_hook_data,
 			     file->offset, len, buf);
@@ -1107,7 +1599,8 @@ grub_fat_close (grub_file_t file)
 {
   grub_fshelp_node_t node = file->data;
 
-  grub_free (node->data);
+  grub_free (node->runs);
+  grub_fat_unmount (file->device->disk, node->data);
   grub_free (node);
 
   grub_dl_unref (my_mod);
@@ -1163,7 +1656,7 @@ grub_fat_label (grub_device_t device, char **label)
 				* GRUB_MAX_UTF8_PER_UTF16 + 1);
 	  if (!*label)
 	    {
-	      grub_free (root.data);
+	      grub_fat_unmount (disk, root.data);
 	      return grub_errno;
 	    }
 	  chc = dir.type_specific.volume_label.character_count;
@@ -1175,7 +1668,7 @@ grub_fat_label (grub_device_t device, char **label)
 	}
     }
 
-  grub_free (root.data);
+  grub_fat_unmount (disk, root.data);
   return grub_errno;
 }
 
@@ -1222,7 +1715,7 @@ grub_fat_label (grub_device_t device, char **label)
 
   grub_dl_unref (my_mod);
 
-  grub_free (root.data);
+  grub_fat_unmount (disk, root.data);
 
   return grub_errno;
 }
@@ -1252,7 +1745,7 @@ grub_fat_uuid (grub_device_t device, char **uuid)
 
   grub_dl_unref (my_mod);
 
-  grub_free (data);
+  grub_fat_unmount (disk, data);
 
   return grub_errno;
 }
@@ -1275,7 +1768,7 @@ grub_disk_addr_t
 
   *sec_per_lcn = 1ULL << data->cluster_bits;
 
-  grub_free (data);
+  grub_fat_free (data);
   return ret;
 }
 #endif
@@ -1322,5 +1815,6 @@ GRUB_MOD_FINI(fat)
 #endif
 {
   grub_fs_unregister (&grub_fat_fs);
+  grub_fshelp_mount_flush (GRUB_FAT_MOUNT_NAME);
 }
 
@@ -24,6 +24,7 @@
 #include <grub/fshelp.h>
 #include <grub/dl.h>
 #include <grub/i18n.h>
+#include <grub/partition.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -54,8 +55,31 @@ struct grub_fshelp_find_file_ctx
 
   /* Current file being traversed and its parents.  */
   struct stack_element *currnode;
+
+  /* Directory entry cache, if the filesystem supports it.  */
+  grub_disk_t disk;
+  const struct grub_fshelp_dcache_ops *dcache;
 };
 
+#define GRUB_FSHELP_DCACHE_SIZE	256
+
+/* A remembered result of looking up NAME in the directory PARENT.  A
+   TYPE of GRUB_FSHELP_UNKNOWN records that NAME doesn't exist.  */
+struct grub_fshelp_dentry
+{
+  const struct grub_fshelp_dcache_ops *ops;
+  unsigned long dev_id;
+  unsigned long disk_id;
+  grub_disk_addr_t part_start;
+  grub_uint64_t parent;
+  grub_uint64_t child;
+  enum grub_fshelp_filetype type;
+  char *name;
+};
+
+static struct grub_fshelp_dentry dcache_table[GRUB_FSHELP_DCACHE_SIZE];
+static unsigned long dcache_generation;
+
 /* Helper for find_file_iter.  */
 static void
 free_node (grub_fshelp_node_t node, struct grub_fshelp_find_file_ctx *ctx)
@@ -139,6 +163,101 @@ find_file_iter (const char *filename, enum grub_fshelp_filetype filetype,
   return 1;
 }
 
+static void
+dcache_flush (void)
+{
+  unsigned i;
+
+  for (i = 0; i < GRUB_FSHELP_DCACHE_SIZE; i++)
+    {
+      grub_free (dcache_table[i].name);
+      dcache_table[i].name = NULL;
+    }
+}
+
+static struct grub_fshelp_dentry *
+dcache_slot (struct grub_fshelp_find_file_ctx *ctx, grub_uint64_t parent,
+	     const char *name)
+{
+  grub_uint32_t hash;
+  const char *p;
+
+  if (dcache_generation != grub_disk_generation)
+    {
+      dcache_flush ();
+      dcache_generation = grub_disk_generation;
+    }
+
+  hash = (ctx->disk->dev->id * 31 + ctx->disk->id) * 31 + parent;
+  for (p = name; *p; p++)
+    hash = hash * 31 + (grub_uint8_t) *p;
+
+  return &dcache_table[hash % GRUB_FSHELP_DCACHE_SIZE];
+}
+
+/* Look up NAME in the directory NODE in the cache.  Return 1 if the
+   result is known, in which case *FOUNDNODE is a new node or NULL if
+   NAME doesn't exist.  */
+static int
+dcache_lookup (struct grub_fshelp_find_file_ctx *ctx, grub_fshelp_node_t node,
+	       const char *name, grub_fshelp_node_t *foundnode,
+	       enum grub_fshelp_filetype *foundtype)
+{
+  grub_uint64_t parent = ctx->dcache->node_id (node);
+  struct grub_fshelp_dentry *ent = dcache_slot (ctx, parent, name);
+
+  if (ent->name == NULL
+      || ent->ops != ctx->dcache
+      || ent->dev_id != ctx->disk->dev->id
+      || ent->disk_id != ctx->disk->id
+      || ent->part_start != grub_partition_get_start (ctx->disk->partition)
+      || ent->parent != parent
+      || grub_strcmp (ent->name, name) != 0)
+    return 0;
+
+  if (ent->type != GRUB_FSHELP_UNKNOWN)
+    {
+      *foundnode = ctx->dcache->node_from_id (node, ent->child);
+      *foundtype = ent->type;
+    }
+  return 1;
+}
+
+static void
+dcache_insert (struct grub_fshelp_find_file_ctx *ctx, grub_fshelp_node_t node,
+	       const char *name, grub_fshelp_node_t foundnode,
+	       enum grub_fshelp_filetype foundtype)
+{
+  grub_uint64_t parent = ctx->dcache->node_id (node);
+  struct grub_fshelp_dentry *ent = dcache_slot (ctx, parent, name);
+  char *dup;
+
+  dup = grub_strdup (name);
+  if (dup == NULL)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+
+  grub_free (ent->name);
+  ent->name = dup;
+  ent->ops = ctx->dcache;
+  ent->dev_id = ctx->disk->dev->id;
+  ent->disk_id = ctx->disk->id;
+  ent->part_start = grub_partition_get_start (ctx->disk->partition);
+  ent->parent = parent;
+  if (foundnode)
+    {
+      ent->child = ctx->dcache->node_id (foundnode);
+      ent->type = foundtype & GRUB_FSHELP_TYPE_MASK;
+    }
+  else
+    {
+      ent->child = 0;
+      ent->type = GRUB_FSHELP_UNKNOWN;
+    }
+}
+
 static grub_err_t
 directory_find_file (grub_fshelp_node_t node, const char *name, grub_fshelp_node_t *foundnode,
 		     enum grub_fshelp_filetype *foundtype, iterate_dir_func iterate_dir)
@@ -202,10 +321,26 @@ find_file (char *currpath,
       /* Iterate over the directory.  */
       c = *next;
       *next = '\0';
-      if (lookup_file)
-	err = lookup_file (ctx->currnode->node, name, &foundnode, &foundtype);
+      if (ctx->dcache
+	  && dcache_lookup (ctx, ctx->currnode->node, name,
+			    &foundnode, &foundtype))
+	{
+	  /* A cached entry only fails if its node couldn't be read.  */
+	  if (foundtype != GRUB_FSHELP_UNKNOWN && !foundnode)
+	    err = grub_errno;
+	  else
+	    err = GRUB_ERR_NONE;
+	}
       else
-	err = directory_find_file (ctx->currnode->node, name, &foundnode, &foundtype, iterate_dir);
+	{
+	  if (lookup_file)
+	    err = lookup_file (ctx->currnode->node, name, &foundnode, &foundtype);
+	  else
+	    err = directory_find_file (ctx->currnode->node, name, &foundnode, &foundtype, iterate_dir);
+	  if (!err && ctx->dcache)
+	    dcache_insert (ctx, ctx->currnode->node, name,
+			   foundnode, foundtype);
+	}
       *next = c;
 
       if (err)
@@ -264,13 +399,17 @@ grub_fshelp_find_file_real (const char *path, grub_fshelp_node_t rootnode,
 			    iterate_dir_func iterate_dir,
 			    lookup_file_func lookup_file,
 			    read_symlink_func read_symlink,
-			    enum grub_fshelp_filetype expecttype)
+			    enum grub_fshelp_filetype expecttype,
+			    grub_disk_t disk,
+			    const struct grub_fshelp_dcache_ops *dcache)
 {
   struct grub_fshelp_find_file_ctx ctx = {
     .path = path,
     .rootnode = rootnode,
     .symlinknest = 0,
-    .currnode = 0
+    .currnode = 0,
+    .disk = disk,
+    .dcache = dcache
   };
   grub_err_t err;
   enum grub_fshelp_filetype foundtype;
@@ -327,10 +466,24 @@ grub_fshelp_find_file (const char *path, grub_fshelp_node_t rootnode,
 {
   return grub_fshelp_find_file_real (path, rootnode, foundnode,
 				     iterate_dir, NULL,
-				     read_symlink, expecttype);
+				     read_symlink, expecttype, NULL, NULL);
 
 }
 
+grub_err_t
+grub_fshelp_find_file_cached (const char *path, grub_fshelp_node_t rootnode,
+			      grub_fshelp_node_t *foundnode,
+			      iterate_dir_func iterate_dir,
+			      read_symlink_func read_symlink,
+			      enum grub_fshelp_filetype expecttype,
+			      grub_disk_t disk,
+			      const struct grub_fshelp_dcache_ops *ops)
+{
+  return grub_fshelp_find_file_real (path, rootnode, foundnode,
+				     iterate_dir, NULL,
+				     read_symlink, expecttype, disk, ops);
+}
+
 grub_err_t
 grub_fshelp_find_file_lookup (const char *path, grub_fshelp_node_t rootnode,
 			      grub_fshelp_node_t *foundnode,
@@ -340,10 +493,25 @@ grub_fshelp_find_file_lookup (const char *path, grub_fshelp_node_t rootnode,
 {
   return grub_fshelp_find_file_real (path, rootnode, foundnode,
 				     NULL, lookup_file,
-				     read_symlink, expecttype);
+				     read_symlink, expecttype, NULL, NULL);
 
 }
 
+grub_err_t
+grub_fshelp_find_file_lookup_cached (const char *path,
+				     grub_fshelp_node_t rootnode,
+				     grub_fshelp_node_t *foundnode,
+				     lookup_file_func lookup_file,
+				     read_symlink_func read_symlink,
+				     enum grub_fshelp_filetype expecttype,
+				     grub_disk_t disk,
+				     const struct grub_fshelp_dcache_ops *ops)
+{
+  return grub_fshelp_find_file_real (path, rootnode, foundnode,
+				     NULL, lookup_file,
+				     read_symlink, expecttype, disk, ops);
+}
+
 /* Read LEN bytes from the file NODE on disk DISK into the buffer BUF,
    beginning with the block POS.  READ_HOOK should be set before
    reading a block from the file.  READ_HOOK_DATA is passed through as
@@ -439,3 +607,195 @@ grub_fshelp_read_file (grub_disk_t disk, grub_fshelp_node_t node,
 
   return len;
 }
+
+grub_ssize_t
+grub_fshelp_read_file_extents (grub_disk_t disk, grub_fshelp_node_t node,
+			       grub_disk_read_hook_t read_hook,
+			       void *read_hook_data,
+			       grub_off_t pos, grub_size_t len, char *buf,
+			       grub_disk_addr_t (*get_extent) (grub_fshelp_node_t node,
+							       grub_disk_addr_t block,
+							       grub_disk_addr_t *count),
+			       grub_off_t filesize, int log2blocksize,
+			       grub_disk_addr_t blocks_start)
+{
+  int blockbits = log2blocksize + GRUB_DISK_SECTOR_BITS;
+  grub_size_t remaining;
+
+  if (blockbits >= 31)
+    {
+      grub_error (GRUB_ERR_OUT_OF_RANGE,
+		  N_("blocksize too large"));
+      return -1;
+    }
+
+  if (pos > filesize)
+    {
+      grub_error (GRUB_ERR_OUT_OF_RANGE,
+		  N_("attempt to read past the end of file"));
+      return -1;
+    }
+
+  /* Adjust LEN so it we can't read past the end of the file.  */
+  if (pos + len > filesize)
+    len = filesize - pos;
+
+  for (remaining = len; remaining; )
+    {
+      grub_disk_addr_t blknr, count = 1;
+      grub_size_t blockoff = pos & ((1 << blockbits) - 1);
+      grub_size_t chunk = remaining;
+
+      blknr = get_extent (node, pos >> blockbits, &count);
+      if (grub_errno)
+	return -1;
+
+      if (count == 0)
+	count = 1;
+      if (count <= (GRUB_SIZE_MAX >> blockbits)
+	  && chunk > (count << blockbits) - blockoff)
+	chunk = (count << blockbits) - blockoff;
+
+      /* If the block number is 0 this run is not stored on disk but
+	 is zero filled instead.  */
+      if (blknr)
+	{
+	  disk->read_hook = read_hook;
+	  disk->read_hook_data = read_hook_data;
+
+	  grub_disk_read (disk, (blknr << log2blocksize) + blocks_start,
+			  blockoff, chunk, buf);
+	  disk->read_hook = 0;
+	  if (grub_errno)
+	    return -1;
+	}
+      else
+	grub_memset (buf, 0, chunk);
+
+      buf += chunk;
+      pos += chunk;
+      remaining -= chunk;
+    }
+
+  return len;
+}
+
+#define GRUB_FSHELP_MOUNT_CACHE_SIZE	4
+
+/* An idle mount of the filesystem FSNAME, parked by
+   grub_fshelp_mount_put.  */
+struct grub_fshelp_mount
+{
+  const char *fsname;
+  unsigned long dev_id;
+  unsigned long disk_id;
+  grub_disk_addr_t part_start;
+  unsigned long generation;
+  grub_uint64_t last_use;
+  void *data;
+  void (*free_data) (void *data);
+};
+
+static struct grub_fshelp_mount mount_cache[GRUB_FSHELP_MOUNT_CACHE_SIZE];
+static grub_uint64_t mount_clock;
+
+static void
+mount_evict (struct grub_fshelp_mount *m)
+{
+  if (!m->data)
+    return;
+  m->free_data (m->data);
+  m->data = NULL;
+}
+
+static int
+mount_match (struct grub_fshelp_mount *m, const char *fsname, grub_disk_t disk)
+{
+  return (m->data
+	  && grub_strcmp (m->fsname, fsname) == 0
+	  && m->dev_id == disk->dev->id
+	  && m->disk_id == disk->id
+	  && m->part_start == grub_partition_get_start (disk->partition));
+}
+
+/* Drop the mounts whose disks may have changed since they were parked.  */
+static void
+mount_expire (void)
+{
+  unsigned i;
+
+  for (i = 0; i < GRUB_FSHELP_MOUNT_CACHE_SIZE; i++)
+    if (mount_cache[i].generation != grub_disk_generation)
+      mount_evict (&mount_cache[i]);
+}
+
+/* Return the mount of FSNAME on DISK that was handed back by
+   grub_fshelp_mount_put, or NULL.  The mount leaves the cache, so it
+   is never used by two files at once.  */
+void *
+grub_fshelp_mount_get (const char *fsname, grub_disk_t disk)
+{
+  unsigned i;
+
+  mount_expire ();
+
+  for (i = 0; i < GRUB_FSHELP_MOUNT_CACHE_SIZE; i++)
+    if (mount_match (&mount_cache[i], fsname, disk))
+      {
+	void *data = mount_cache[i].data;
+
+	grub_dprintf ("fshelp", "reusing %s mount of %s\n", fsname, disk->name);
+	mount_cache[i].data = NULL;
+	return data;
+      }
+
+  return NULL;
+}
+
+/* Park DATA, a mount of FSNAME on DISK that is no longer used, so that
+   the next grub_fshelp_mount_get can reuse it.  FREE_DATA releases it
+   once it is evicted, which happens at the latest when
+   grub_disk_generation changes.  */
+void
+grub_fshelp_mount_put (const char *fsname, grub_disk_t disk, void *data,
+		       void (*free_data) (void *data))
+{
+  struct grub_fshelp_mount *m = NULL;
+  unsigned i;
+
+  mount_expire ();
+
+  for (i = 0; i < GRUB_FSHELP_MOUNT_CACHE_SIZE; i++)
+    if (mount_match (&mount_cache[i], fsname, disk))
+      {
+	m = &mount_cache[i];
+	break;
+      }
+
+  if (!m)
+    for (i = 0; i < GRUB_FSHELP_MOUNT_CACHE_SIZE; i++)
+      if (!m || !mount_cache[i].data
+	  || (m->data && mount_cache[i].last_use < m->last_use))
+	m = &mount_cache[i];
+
+  mount_evict (m);
+  m->fsname = fsname;
+  m->dev_id = disk->dev->id;
+  m->disk_id = disk->id;
+  m->part_start = grub_partition_get_start (disk->partition);
+  m->generation = grub_disk_generation;
+  m->last_use = ++mount_clock;
+  m->data = data;
+  m->free_data = free_data;
+}
+
+/* Free all parked mounts of FSNAME.  */
+void
+grub_fshelp_mount_flush (const char *fsname)
+{
+  unsigned i;
+
+  for (i = 0; i < GRUB_FSHELP_MOUNT_CACHE_SIZE; i++)
+    if (mount_cache[i].data && grub_strcmp (mount_cache[i].fsname, fsname) == 0)
+      mount_evict (&mount_cache[i]);
+}
@@ -122,10 +122,11 @@ grub_ssize_t (*grub_hfsplus_read_compressed) (struct grub_hfsplus_file *node,
 
 /* Find the extent that points to FILEBLOCK.  If it is not in one of
    the 8 extents described by EXTENT, return -1.  In that case set
-   FILEBLOCK to the next block.  */
+   FILEBLOCK to the next block.  Otherwise set COUNT to the number of
+   blocks left in the extent.  */
 static grub_disk_addr_t
 grub_hfsplus_find_block (struct grub_hfsplus_extent *extent,
-			 grub_disk_addr_t *fileblock)
+			 grub_disk_addr_t *fileblock, grub_disk_addr_t *count)
 {
   int i;
   grub_disk_addr_t blksleft = *fileblock;
@@ -134,7 +135,10 @@ grub_hfsplus_find_block (struct grub_hfsplus_extent *extent,
   for (i = 0; i < 8; i++)
     {
       if (blksleft < grub_be_to_cpu32 (extent[i].count))
-	return grub_be_to_cpu32 (extent[i].start) + blksleft;
+	{
+	  *count = grub_be_to_cpu32 (extent[i].count) - blksleft;
+	  return grub_be_to_cpu32 (extent[i].start) + blksleft;
+	}
       blksleft -= grub_be_to_cpu32 (extent[i].count);
     }
 
@@ -145,16 +149,60 @@ grub_hfsplus_find_block (struct grub_hfsplus_extent *extent,
 static int grub_hfsplus_cmp_extkey (struct grub_hfsplus_key *keya,
 				    struct grub_hfsplus_key_internal *keyb);
 
+/* Find FILEBLOCK among the decoded runs of NODE.  Return its block on
+   disk and set COUNT to the number of blocks left in the run, or return
+   -1 if no run holds it.  */
+static grub_disk_addr_t
+grub_hfsplus_find_run (grub_fshelp_node_t node, grub_disk_addr_t fileblock,
+		       grub_disk_addr_t *count)
+{
+  grub_size_t lo = 0, hi = node->nruns;
+  struct grub_hfsplus_run *run;
+
+  while (lo < hi)
+    {
+      grub_size_t mid = lo + (hi - lo) / 2;
+
+      if (node->runs[mid].fileblock <= fileblock)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+
+  if (lo == 0)
+    return -1;
+  run = &node->runs[lo - 1];
+  if (fileblock - run->fileblock >= run->count)
+    return -1;
+
+  *count = run->count - (fileblock - run->fileblock);
+  return run->start + (fileblock - run->fileblock);
+}
+
 /* Search for the block FILEBLOCK inside the file NODE.  Return the
-   blocknumber of this block on disk.  */
+   blocknumber of this block on disk and set COUNT to the number of
+   blocks that follow it contiguously.  */
 static grub_disk_addr_t
-grub_hfsplus_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
+grub_hfsplus_get_extent (grub_fshelp_node_t node, grub_disk_addr_t fileblock,
+			 grub_disk_addr_t *count)
 {
   struct grub_hfsplus_btnode *nnode = 0;
   grub_disk_addr_t blksleft = fileblock;
   struct grub_hfsplus_extent *extents = node->compressed
     ? &node->resource_extents[0] : &node->extents[0];
 
+  if (node->runs)
+    {
+      grub_disk_addr_t blk = grub_hfsplus_find_run (node, fileblock, count);
+
+      if (blk == (grub_disk_addr_t) -1)
+	grub_error (GRUB_ERR_READ_ERROR,
+		    "no block found for the file id 0x%x and the block"
+		    " offset 0x%" PRIuGRUB_UINT64_T,
+		    node->fileid, fileblock);
+      return blk;
+    }
+
   while (1)
     {
       struct grub_hfsplus_extkey *key;
@@ -163,7 +211,7 @@ grub_hfsplus_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
       grub_off_t ptr;
 
       /* Try to find this block in the current set of extents.  */
-      blk = grub_hfsplus_find_block (extents, &blksleft);
+      blk = grub_hfsplus_find_block (extents, &blksleft, count);
 
       /* The previous iteration of this loop allocated memory.  The
 	 code above used this memory, it can be freed now.  */
@@ -215,6 +263,12 @@ grub_hfsplus_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
       key = (struct grub_hfsplus_extkey *)
 	grub_hfsplus_btree_recptr (&node->data->extoverflow_tree, nnode, ptr);
       extents = (struct grub_hfsplus_extent *) (key + 1);
+      if ((char *) (extents + 8)
+	  > (char *) nnode + node->data->extoverflow_tree.nodesize)
+	{
+	  grub_error (GRUB_ERR_BAD_FS, "HFS+ key beyond end of node");
+	  break;
+	}
 
       /* The block wasn't found.  Perhaps the next iteration will find
 	 it.  The last block we found is stored in BLKSLEFT now.  */
@@ -226,6 +280,98 @@ grub_hfsplus_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
   return -1;
 }
 
+/* Decode all extents of the fork that reads of NODE use, so that reads
+   past its first eight extents don't search the extents overflow tree
+   again.  Leave NODE without runs if the fork can't be fully decoded.  */
+static grub_err_t
+grub_hfsplus_decode_fork (grub_fshelp_node_t node)
+{
+  struct grub_hfsplus_data *data = node->data;
+  struct grub_hfsplus_extent *extents = node->compressed
+    ? &node->resource_extents[0] : &node->extents[0];
+  grub_uint64_t size = node->compressed ? node->resource_size : node->size;
+  grub_uint64_t nblocks, fileblock = 0;
+  struct grub_hfsplus_btnode *nnode = 0;
+  struct grub_hfsplus_run *runs = NULL;
+  grub_size_t nruns = 0, alloc = 0;
+
+  nblocks = (size >> data->log2blksize)
+    + !!(size & ((1ULL << data->log2blksize) - 1));
+
+  while (fileblock < nblocks)
+    {
+      struct grub_hfsplus_key_internal extoverflow;
+      struct grub_hfsplus_extkey *key;
+      grub_off_t ptr;
+      int i;
+
+      for (i = 0; i < 8 && fileblock < nblocks; i++)
+	{
+	  grub_uint32_t count = grub_be_to_cpu32 (extents[i].count);
+
+	  if (count == 0)
+	    break;
+
+	  if (nruns == alloc)
+	    {
+	      struct grub_hfsplus_run *r;
+	      grub_size_t sz;
+
+	      alloc = alloc ? alloc * 2 : 8;
+	      if (grub_mul (alloc, sizeof (*runs), &sz))
+		{
+		  grub_error (GRUB_ERR_OUT_OF_RANGE, "overflow is detected");
+		  goto fail;
+		}
+	      r = grub_realloc (runs, sz);
+	      if (!r)
+		goto fail;
+	      runs = r;
+	    }
+
+	  runs[nruns].fileblock = fileblock;
+	  runs[nruns].start = grub_be_to_cpu32 (extents[i].start);
+	  runs[nruns].count = count;
+	  nruns++;
+	  fileblock += count;
+	}
+
+      grub_free (nnode);
+      nnode = 0;
+
+      if (i < 8 || fileblock >= nblocks
+	  || node->fileid == GRUB_HFSPLUS_FILEID_OVERFLOW
+	  || !data->extoverflow_tree_ready)
+	break;
+
+      extoverflow.extkey.fileid = node->fileid;
+      extoverflow.extkey.start = fileblock;
+      extoverflow.extkey.type = node->compressed ? 0xff : 0;
+      if (grub_hfsplus_btree_search (&data->extoverflow_tree, &extoverflow,
+				     grub_hfsplus_cmp_extkey, &nnode, &ptr)
+	  || !nnode)
+	goto fail;
+
+      key = (struct grub_hfsplus_extkey *)
+	grub_hfsplus_btree_recptr (&data->extoverflow_tree, nnode, ptr);
+      extents = (struct grub_hfsplus_extent *) (key + 1);
+      if ((char *) (extents + 8)
+	  > (char *) nnode + data->extoverflow_tree.nodesize)
+	goto fail;
+    }
+
+  if (fileblock < nblocks)
+    goto fail;
+
+  node->runs = runs;
+  node->nruns = nruns;
+  return GRUB_ERR_NONE;
+
+ fail:
+  grub_free (nnode);
+  grub_free (runs);
+  return grub_errno;
+}
 
 /* Read LEN bytes from the file described by DATA starting with byte
    POS.  Return the amount of read bytes in READ.  */
@@ -234,12 +380,36 @@ grub_hfsplus_read_file (grub_fshelp_node_t node,
 			grub_disk_read_hook_t read_hook, void *read_hook_data,
 			grub_off_t pos, grub_size_t len, char *buf)
 {
-  return grub_fshelp_read_file (node->data->disk, node,
-				read_hook, read_hook_data,
-				pos, len, buf, grub_hfsplus_read_block,
-				node->size,
-				node->data->log2blksize - GRUB_DISK_SECTOR_BITS,
-				node->data->embedded_offset);
+  return grub_fshelp_read_file_extents (node->data->disk, node,
+					read_hook, read_hook_data,
+					pos, len, buf, grub_hfsplus_get_extent,
+					node->size,
+					node->data->log2blksize
+					- GRUB_DISK_SECTOR_BITS,
+					node->data->embedded_offset);
+}
+
+static void
+grub_hfsplus_free (void *ptr)
+{
+  struct grub_hfsplus_data *data = ptr;
+  unsigned i;
+
+  if (!data)
+    return;
+
+  for (i = 0; i < GRUB_HFSPLUS_BTNODE_CACHE_SIZE; i++)
+    grub_free (data->btnode_cache[i].buf);
+  grub_free (data);
+}
+
+/* Release DATA, keeping the mount with its cached B-tree nodes for the
+   next user of its disk.  */
+static void
+grub_hfsplus_unmount (struct grub_hfsplus_data *data)
+{
+  if (data)
+    grub_fshelp_mount_put ("hfsplus", data->disk, data, grub_hfsplus_free);
 }
 
 static struct grub_hfsplus_data *
@@ -254,7 +424,14 @@ grub_hfsplus_mount (grub_disk_t disk)
     struct grub_hfsplus_volheader hfsplus;
   } volheader;
 
-  data = grub_malloc (sizeof (*data));
+  data = grub_fshelp_mount_get ("hfsplus", disk);
+  if (data)
+    {
+      data->disk = disk;
+      return data;
+    }
+
+  data = grub_zalloc (sizeof (*data));
   if (!data)
     return 0;
 
@@ -408,7 +585,7 @@ grub_hfsplus_mount (grub_disk_t disk)
   if (grub_errno == GRUB_ERR_OUT_OF_RANGE)
     grub_error (GRUB_ERR_BAD_FS, "not a HFS+ filesystem");
 
-  grub_free (data);
+  grub_hfsplus_free (data);
   return 0;
 }
 
@@ -523,6 +700,56 @@ grub_hfsplus_read_symlink (grub_fshelp_node_t node)
   return symlink;
 }
 
+/* Return node NODENO of BTREE through the node cache of its mount.  The
+   node stays valid until the next node is read from the cache.  */
+static struct grub_hfsplus_btnode *
+grub_hfsplus_btree_read_node (struct grub_hfsplus_btree *btree,
+			      grub_uint64_t nodeno)
+{
+  struct grub_hfsplus_data *data = btree->file.data;
+  struct grub_hfsplus_btnode_cache *slot, *victim;
+
+  victim = &data->btnode_cache[0];
+  for (slot = data->btnode_cache;
+       slot < data->btnode_cache + GRUB_HFSPLUS_BTNODE_CACHE_SIZE; slot++)
+    {
+      if (slot->last_use && slot->tree == btree && slot->nodeno == nodeno)
+	{
+	  slot->last_use = ++data->btnode_clock;
+	  return (struct grub_hfsplus_btnode *) slot->buf;
+	}
+      if (slot->last_use < victim->last_use)
+	victim = slot;
+    }
+
+  if (victim->alloc < btree->nodesize)
+    {
+      grub_free (victim->buf);
+      victim->alloc = 0;
+      victim->last_use = 0;
+      victim->buf = grub_malloc (btree->nodesize);
+      if (!victim->buf)
+	return NULL;
+      victim->alloc = btree->nodesize;
+    }
+
+  /* Reading the node may go through the extents overflow tree, so keep
+     this slot from being taken meanwhile.  */
+  victim->tree = NULL;
+  victim->last_use = ++data->btnode_clock;
+  if (grub_hfsplus_read_file (&btree->file, 0, 0,
+			      nodeno * (grub_disk_addr_t) btree->nodesize,
+			      btree->nodesize, victim->buf) <= 0)
+    {
+      victim->last_use = 0;
+      return NULL;
+    }
+
+  victim->tree = btree;
+  victim->nodeno = nodeno;
+  return (struct grub_hfsplus_btnode *) victim->buf;
+}
+
 static int
 grub_hfsplus_btree_iterate_node (struct grub_hfsplus_btree *btree,
 				 struct grub_hfsplus_btnode *first_node,
@@ -537,6 +764,7 @@ grub_hfsplus_btree_iterate_node (struct grub_hfsplus_btree *btree,
   for (;;)
     {
       char *cnode = (char *) first_node;
+      struct grub_hfsplus_btnode *next;
 
       /* Iterate over all records in this node.  */
       for (rec = first_rec; rec < grub_be_to_cpu16 (first_node->count); rec++)
@@ -557,12 +785,11 @@ grub_hfsplus_btree_iterate_node (struct grub_hfsplus_btree *btree,
 	saved_node = first_node->next;
       node_count++;
 
-      if (grub_hfsplus_read_file (&btree->file, 0, 0,
-				  (((grub_disk_addr_t)
-				    grub_be_to_cpu32 (first_node->next))
-				   * btree->nodesize),
-				  btree->nodesize, cnode) <= 0)
+      next = grub_hfsplus_btree_read_node (btree,
+					   grub_be_to_cpu32 (first_node->next));
+      if (!next)
 	return 1;
+      grub_memcpy (cnode, next, btree->nodesize);
 
       /* Don't skip any record in the next iteration.  */
       first_rec = 0;
@@ -600,10 +827,6 @@ grub_hfsplus_btree_search (struct grub_hfsplus_btree *btree,
       btree->nodesize > HFSPLUS_BTNODE_MAXSZ)
     return grub_error (GRUB_ERR_BAD_FS, "invalid HFS+ btree node size");
 
-  node = grub_malloc (btree->nodesize);
-  if (! node)
-    return grub_errno;
-
   currnode = btree->root;
   save_node = currnode - 1;
   while (1)
@@ -611,23 +834,15 @@ grub_hfsplus_btree_search (struct grub_hfsplus_btree *btree,
       int match = 0;
 
       if (save_node == currnode)
-	{
-	  grub_free (node);
-	  return grub_error (GRUB_ERR_BAD_FS, "HFS+ btree loop");
-	}
+	return grub_error (GRUB_ERR_BAD_FS, "HFS+ btree loop");
       if (!(node_count & (node_count - 1)))
 	save_node = currnode;
       node_count++;
 
       /* Read a node.  */
-      if (grub_hfsplus_read_file (&btree->file, 0, 0,
-				  (grub_disk_addr_t) currnode
-				  * (grub_disk_addr_t) btree->nodesize,
-				  btree->nodesize, (char *) node) <= 0)
-	{
-	  grub_free (node);
-	  return grub_error (GRUB_ERR_BAD_FS, "couldn't read i-node");
-	}
+      node = (char *) grub_hfsplus_btree_read_node (btree, currnode);
+      if (!node)
+	return grub_error (GRUB_ERR_BAD_FS, "couldn't read i-node");
 
       nodedesc = (struct grub_hfsplus_btnode *) node;
 
@@ -642,9 +857,12 @@ grub_hfsplus_btree_search (struct grub_hfsplus_btree *btree,
 	  if (nodedesc->type == GRUB_HFSPLUS_BTNODE_TYPE_LEAF
 	      && compare_keys (currkey, key) == 0)
 	    {
-	      /* An exact match was found!  */
-
-	      *matchnode = nodedesc;
+	      /* An exact match was found!  The caller owns a copy of the
+		 cached node.  */
+	      *matchnode = grub_malloc (btree->nodesize);
+	      if (!*matchnode)
+		return grub_errno;
+	      grub_memcpy (*matchnode, nodedesc, btree->nodesize);
 	      *keyoffset = rec;
 
 	      return 0;
@@ -668,10 +886,7 @@ grub_hfsplus_btree_search (struct grub_hfsplus_btree *btree,
 			 + 2);
 
 	      if ((char *) pointer > node + btree->nodesize - 2)
-	        {
-	          grub_free (node);
-	          return grub_error (GRUB_ERR_BAD_FS, "HFS+ key beyond end of node");
-	        }
+		return grub_error (GRUB_ERR_BAD_FS, "HFS+ key beyond end of node");
 
 	      currnode = grub_be_to_cpu32 (grub_get_unaligned32 (pointer));
 	      match = 1;
@@ -683,7 +898,6 @@ grub_hfsplus_btree_search (struct grub_hfsplus_btree *btree,
       if (! match)
 	{
 	  *matchnode = 0;
-	  grub_free (node);
 	  return 0;
 	}
     }
@@ -757,6 +971,8 @@ list_nodes (void *record, void *hook_arg)
       node->mtime = 0;
       node->size = 0;
       node->fileid = grub_be_to_cpu32 (fileinfo->parentid);
+      node->runs = 0;
+      node->nruns = 0;
 
       ctx->ret = ctx->hook ("..", GRUB_FSHELP_DIR, node, ctx->hook_data);
       return ctx->ret;
@@ -815,6 +1031,8 @@ list_nodes (void *record, void *hook_arg)
   node->compressed = 0;
   node->cbuf = 0;
   node->compress_index = 0;
+  node->runs = 0;
+  node->nruns = 0;
 
   grub_memcpy (node->extents, fileinfo->data.extents,
 	       sizeof (node->extents));
@@ -905,6 +1123,11 @@ grub_hfsplus_open (struct grub_file *file, const char *name)
 	goto fail;
     }
 
+  /* Inline compressed data is not read through the fork.  Without the
+     runs reads still find their blocks one extent record at a time.  */
+  if (fdiro->compressed != 2 && grub_hfsplus_decode_fork (fdiro))
+    grub_errno = GRUB_ERR_NONE;
+
   file->size = fdiro->size;
   data->opened_file = *fdiro;
   grub_free (fdiro);
@@ -917,7 +1140,7 @@ grub_hfsplus_open (struct grub_file *file, const char *name)
  fail:
   if (data && fdiro != &data->dirroot)
     grub_free (fdiro);
-  grub_free (data);
+  grub_hfsplus_unmount (data);
 
   grub_dl_unref (my_mod);
 
@@ -933,8 +1156,10 @@ grub_hfsplus_close (grub_file_t file)
 
   grub_free (data->opened_file.cbuf);
   grub_free (data->opened_file.compress_index);
+  grub_free (data->opened_file.runs);
+  grub_memset (&data->opened_file, 0, sizeof (data->opened_file));
 
-  grub_free (data);
+  grub_hfsplus_unmount (data);
 
   grub_dl_unref (my_mod);
 
@@ -981,6 +1206,8 @@ grub_hfsplus_dir_iter (const char *filename,
   info.mtime = node->mtime;
   info.inodeset = 1;
   info.inode = node->fileid;
+  info.sizeset = ((filetype & GRUB_FSHELP_TYPE_MASK) == GRUB_FSHELP_REG);
+  info.size = node->size;
   info.case_insensitive = !! (filetype & GRUB_FSHELP_CASE_INSENSITIVE);
   grub_free (node);
   return ctx->hook (filename, &info, ctx->hook_data);
@@ -1013,7 +1240,7 @@ grub_hfsplus_dir (grub_device_t device, const char *path,
  fail:
   if (data && fdiro != &data->dirroot)
     grub_free (fdiro);
-  grub_free (data);
+  grub_hfsplus_unmount (data);
 
   grub_dl_unref (my_mod);
 
@@ -1049,7 +1276,7 @@ grub_hfsplus_label (grub_device_t device, char **label)
 				 grub_hfsplus_cmp_catkey_id, &node, &ptr)
       || !node)
     {
-      grub_free (data);
+      grub_hfsplus_unmount (data);
       return 0;
     }
 
@@ -1070,7 +1297,7 @@ grub_hfsplus_label (grub_device_t device, char **label)
   if (!label_name)
     {
       grub_free (node);
-      grub_free (data);
+      grub_hfsplus_unmount (data);
       return grub_errno;
     }
 
@@ -1083,7 +1310,7 @@ grub_hfsplus_label (grub_device_t device, char **label)
 	{
 	  grub_free (label_name);
 	  grub_free (node);
-	  grub_free (data);
+	  grub_hfsplus_unmount (data);
 	  return 0;
 	}
     }
@@ -1093,7 +1320,7 @@ grub_hfsplus_label (grub_device_t device, char **label)
     {
       grub_free (label_name);
       grub_free (node);
-      grub_free (data);
+      grub_hfsplus_unmount (data);
       return grub_errno;
     }
 
@@ -1102,7 +1329,7 @@ grub_hfsplus_label (grub_device_t device, char **label)
 
   grub_free (label_name);
   grub_free (node);
-  grub_free (data);
+  grub_hfsplus_unmount (data);
 
   return GRUB_ERR_NONE;
 }
@@ -1124,7 +1351,7 @@ grub_hfsplus_mtime (grub_device_t device, grub_int64_t *tm)
 
   grub_dl_unref (my_mod);
 
-  grub_free (data);
+  grub_hfsplus_unmount (data);
 
   return grub_errno;
 
@@ -1150,7 +1377,7 @@ grub_hfsplus_uuid (grub_device_t device, char **uuid)
 
   grub_dl_unref (my_mod);
 
-  grub_free (data);
+  grub_hfsplus_unmount (data);
 
   return grub_errno;
 }
@@ -1183,4 +1410,5 @@ GRUB_MOD_INIT(hfsplus)
 GRUB_MOD_FINI(hfsplus)
 {
   grub_fs_unregister (&grub_hfsplus_fs);
+  grub_fshelp_mount_flush ("hfsplus");
 }
@@ -52,6 +52,10 @@ GRUB_MOD_LICENSE ("GPLv3+");
 #define GRUB_ISO9660_SUSP_HEADER_SZ	4
 #define GRUB_ISO9660_MAX_CE_HOPS	100000
 
+#define GRUB_ISO9660_MAX_PATH_TABLE	(1 << 20)
+#define GRUB_ISO9660_DIR_CACHE_SIZE	8
+#define GRUB_ISO9660_DIR_CACHE_MAX	4096
+
 /* The head of a volume descriptor.  */
 struct grub_iso9660_voldesc
 {
@@ -150,6 +154,30 @@ struct grub_iso9660_susp_ce
   grub_uint32_t len_be;
 } GRUB_PACKED;
 
+/* A directory listed in the path table.  */
+struct grub_iso9660_ptdir
+{
+  grub_uint32_t extent;
+  grub_uint16_t parent;
+  char *name;
+};
+
+/* An entry of a directory whose decoded listing is cached.  */
+struct grub_iso9660_dirlist_entry
+{
+  char *name;
+  enum grub_fshelp_filetype type;
+  struct grub_fshelp_node *node;
+};
+
+struct grub_iso9660_dirlist
+{
+  grub_uint32_t extent;
+  unsigned long last_use;
+  grub_size_t count;
+  struct grub_iso9660_dirlist_entry *entries;
+};
+
 struct grub_iso9660_data
 {
   struct grub_iso9660_primary_voldesc voldesc;
@@ -158,6 +186,15 @@ struct grub_iso9660_data
   int susp_skip;
   int joliet;
   struct grub_fshelp_node *node;
+
+  /* The path table, read on the first lookup.  */
+  int ptable_read;
+  grub_size_t num_ptdirs;
+  struct grub_iso9660_ptdir *ptdirs;
+
+  /* Listings of recently looked up directories.  */
+  unsigned long dirlist_clock;
+  struct grub_iso9660_dirlist dirlists[GRUB_ISO9660_DIR_CACHE_SIZE];
 };
 
 struct grub_fshelp_node
@@ -497,6 +534,14 @@ grub_iso9660_mount (grub_disk_t disk)
   struct grub_iso9660_primary_voldesc voldesc;
   int block;
 
+  data = grub_fshelp_mount_get ("iso9660", disk);
+  if (data)
+    {
+      data->disk = disk;
+      data->node = NULL;
+      return data;
+    }
+
   data = grub_zalloc (sizeof (struct grub_iso9660_data));
   if (! data)
     return 0;
@@ -555,6 +600,44 @@ grub_iso9660_mount (grub_disk_t disk)
   return 0;
 }
 
+static void
+free_dirlist (struct grub_iso9660_dirlist *list)
+{
+  grub_size_t i;
+
+  for (i = 0; i < list->count; i++)
+    {
+      grub_free (list->entries[i].name);
+      grub_free (list->entries[i].node);
+    }
+  grub_free (list->entries);
+  list->entries = NULL;
+  list->count = 0;
+}
+
+static void
+grub_iso9660_free (void *ptr)
+{
+  struct grub_iso9660_data *data = ptr;
+  grub_size_t i;
+
+  for (i = 0; i < data->num_ptdirs; i++)
+    grub_free (data->ptdirs[i].name);
+  grub_free (data->ptdirs);
+  for (i = 0; i < GRUB_ISO9660_DIR_CACHE_SIZE; i++)
+    free_dirlist (&data->dirlists[i]);
+  grub_free (data);
+}
+
+/* Release DATA, keeping the mount with its path table and directory
+   listings for the next user of its disk.  */
+static void
+grub_iso9660_unmount (struct grub_iso9660_data *data)
+{
+  if (data)
+    grub_fshelp_mount_put ("iso9660", data->disk, data, grub_iso9660_free);
+}
+
 
 static char *
 grub_iso9660_read_symlink (grub_fshelp_node_t node)
@@ -970,6 +1053,295 @@ grub_iso9660_iterate_dir (grub_fshelp_node_t dir,
 
 
 
+/* Read the path table of DATA.  It is only an optimisation, so any
+   problem with it just leaves it empty.  */
+static void
+read_path_table (struct grub_iso9660_data *data)
+{
+  grub_uint32_t size = grub_le_to_cpu32 (data->voldesc.path_table_size);
+  grub_uint32_t pos, n;
+  grub_uint8_t *buf = NULL;
+
+  data->ptable_read = 1;
+
+  /* Rock Ridge names are not in the path table.  */
+  if (data->rockridge || size < sizeof (struct grub_iso9660_path)
+      || size > GRUB_ISO9660_MAX_PATH_TABLE)
+    return;
+
+  buf = grub_malloc (size);
+  if (!buf)
+    goto fail;
+  if (grub_disk_read (data->disk,
+		      ((grub_disk_addr_t) grub_le_to_cpu32 (data->voldesc.path_table))
+		      << GRUB_ISO9660_LOG2_BLKSZ, 0, size, buf))
+    goto fail;
+
+  /* Every record takes at least sizeof (struct grub_iso9660_path) + 1
+     bytes.  */
+  data->ptdirs = grub_calloc (size / (sizeof (struct grub_iso9660_path) + 1) + 1,
+			      sizeof (data->ptdirs[0]));
+  if (!data->ptdirs)
+    goto fail;
+
+  for (pos = 0, n = 0; size - pos >= sizeof (struct grub_iso9660_path); n++)
+    {
+      struct grub_iso9660_path *rec = (struct grub_iso9660_path *) (buf + pos);
+      struct grub_iso9660_ptdir *d = &data->ptdirs[n];
+
+      if (rec->len == 0 || size - pos - sizeof (*rec) < rec->len)
+	break;
+
+      d->extent = grub_le_to_cpu32 (rec->first_sector);
+      d->parent = grub_le_to_cpu16 (rec->parentdir);
+      if (data->joliet)
+	d->name = grub_iso9660_convert_string (rec->name, rec->len >> 1);
+      else
+	d->name = grub_strndup ((char *) rec->name, rec->len);
+      if (!d->name)
+	goto fail;
+      data->num_ptdirs = n + 1;
+
+      pos += sizeof (*rec) + rec->len + (rec->len & 1);
+    }
+
+  grub_free (buf);
+  return;
+
+ fail:
+  for (n = 0; n < data->num_ptdirs; n++)
+    grub_free (data->ptdirs[n].name);
+  grub_free (data->ptdirs);
+  data->ptdirs = NULL;
+  data->num_ptdirs = 0;
+  grub_free (buf);
+  grub_errno = GRUB_ERR_NONE;
+}
+
+/* Look NAME up among the subdirectories of DIR listed in the path table.
+   The new node is set up from the "." record of the subdirectory.  */
+static grub_err_t
+path_table_lookup (grub_fshelp_node_t dir, const char *name,
+		   grub_fshelp_node_t *foundnode,
+		   enum grub_fshelp_filetype *foundtype)
+{
+  struct grub_iso9660_data *data = dir->data;
+  grub_uint32_t extent = grub_le_to_cpu32 (dir->dirents[0].first_sector);
+  grub_size_t i;
+
+  if (!data->ptable_read)
+    read_path_table (data);
+
+  /* Record 1, the root directory, is its own parent.  */
+  for (i = 1; i < data->num_ptdirs; i++)
+    {
+      struct grub_iso9660_ptdir *d = &data->ptdirs[i];
+      struct grub_iso9660_dir dot;
+      struct grub_fshelp_node *node;
+
+      if (d->parent == 0 || d->parent > data->num_ptdirs
+	  || data->ptdirs[d->parent - 1].extent != extent)
+	continue;
+      if (data->joliet ? grub_strcmp (name, d->name)
+	  : grub_strcasecmp (name, d->name))
+	continue;
+
+      if (grub_disk_read (data->disk,
+			  (grub_disk_addr_t) d->extent << GRUB_ISO9660_LOG2_BLKSZ,
+			  0, sizeof (dot), &dot))
+	return grub_errno;
+      if (dot.len < sizeof (dot)
+	  || grub_le_to_cpu32 (dot.first_sector) != d->extent
+	  || (dot.flags & FLAG_TYPE) != FLAG_TYPE_DIR)
+	return GRUB_ERR_NONE;
+
+      node = grub_malloc (sizeof (struct grub_fshelp_node));
+      if (!node)
+	return grub_errno;
+      node->data = data;
+      node->alloc_dirents = ARRAY_SIZE (node->dirents);
+      node->have_dirents = 1;
+      node->have_symlink = 0;
+      node->dirents[0] = dot;
+
+      *foundnode = node;
+      *foundtype = GRUB_FSHELP_DIR;
+      return GRUB_ERR_NONE;
+    }
+
+  return GRUB_ERR_NONE;
+}
+
+/* Duplicate NODE, including its extra extents and symlink target.  */
+static grub_fshelp_node_t
+copy_node (grub_fshelp_node_t node)
+{
+  grub_fshelp_node_t copy;
+  grub_size_t size;
+
+  size = (char *) &node->dirents[node->have_dirents] - (char *) node;
+  if (node->have_symlink)
+    size += grub_strlen ((char *) &node->dirents[node->have_dirents]) + 1;
+  if (size < sizeof (*node))
+    size = sizeof (*node);
+
+  copy = grub_malloc (size);
+  if (copy)
+    grub_memcpy (copy, node, size);
+  return copy;
+}
+
+/* Compare like grub_fshelp_find_file does.  */
+static int
+name_matches (const char *name, const char *filename,
+	      enum grub_fshelp_filetype type)
+{
+  if (type == GRUB_FSHELP_UNKNOWN)
+    return 0;
+  return ((type & GRUB_FSHELP_CASE_INSENSITIVE)
+	  ? grub_strcasecmp (name, filename)
+	  : grub_strcmp (name, filename)) == 0;
+}
+
+/* Context for grub_iso9660_lookup_file.  */
+struct grub_iso9660_lookup_ctx
+{
+  const char *name;
+  grub_fshelp_node_t found;
+  enum grub_fshelp_filetype foundtype;
+  struct grub_iso9660_dirlist list;
+  grub_size_t alloc;
+  int overflow;
+};
+
+/* Helper for grub_iso9660_lookup_file.  */
+static int
+grub_iso9660_lookup_iter (const char *filename,
+			  enum grub_fshelp_filetype filetype,
+			  grub_fshelp_node_t node, void *data)
+{
+  struct grub_iso9660_lookup_ctx *ctx = data;
+  struct grub_iso9660_dirlist_entry *e;
+
+  if (!ctx->found && name_matches (ctx->name, filename, filetype))
+    {
+      ctx->found = copy_node (node);
+      if (!ctx->found)
+	{
+	  grub_free (node);
+	  return 1;
+	}
+      ctx->foundtype = filetype;
+    }
+
+  if (!ctx->overflow && ctx->list.count == ctx->alloc)
+    {
+      grub_size_t alloc = ctx->alloc ? ctx->alloc * 2 : 32;
+
+      e = NULL;
+      if (alloc <= GRUB_ISO9660_DIR_CACHE_MAX)
+	e = grub_realloc (ctx->list.entries, alloc * sizeof (*e));
+      if (e)
+	{
+	  ctx->list.entries = e;
+	  ctx->alloc = alloc;
+	}
+      else
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  ctx->overflow = 1;
+	}
+    }
+
+  if (!ctx->overflow)
+    {
+      e = &ctx->list.entries[ctx->list.count];
+      e->name = grub_strdup (filename);
+      if (e->name)
+	{
+	  e->type = filetype;
+	  e->node = node;
+	  ctx->list.count++;
+	  return 0;
+	}
+      grub_errno = GRUB_ERR_NONE;
+      ctx->overflow = 1;
+    }
+
+  grub_free (node);
+  /* Without a listing to complete, stop at the first match.  */
+  return ctx->found != NULL;
+}
+
+/* Look NAME up in DIR.  Subdirectories come from the path table when
+   possible.  Otherwise DIR is read once and its decoded names, Rock
+   Ridge ones included, are kept in the mount for later lookups.  */
+static grub_err_t
+grub_iso9660_lookup_file (grub_fshelp_node_t dir, const char *name,
+			  grub_fshelp_node_t *foundnode,
+			  enum grub_fshelp_filetype *foundtype)
+{
+  struct grub_iso9660_data *data = dir->data;
+  struct grub_iso9660_lookup_ctx ctx;
+  struct grub_iso9660_dirlist *list, *victim;
+  grub_uint32_t extent = grub_le_to_cpu32 (dir->dirents[0].first_sector);
+  grub_size_t i;
+  grub_err_t err;
+
+  err = path_table_lookup (dir, name, foundnode, foundtype);
+  if (err || *foundnode)
+    return err;
+
+  victim = &data->dirlists[0];
+  for (list = data->dirlists;
+       list < data->dirlists + GRUB_ISO9660_DIR_CACHE_SIZE; list++)
+    {
+      if (list->last_use && list->extent == extent)
+	{
+	  list->last_use = ++data->dirlist_clock;
+	  for (i = 0; i < list->count; i++)
+	    if (name_matches (name, list->entries[i].name,
+			      list->entries[i].type))
+	      {
+		*foundnode = copy_node (list->entries[i].node);
+		if (!*foundnode)
+		  return grub_errno;
+		*foundtype = list->entries[i].type;
+		return GRUB_ERR_NONE;
+	      }
+	  return GRUB_ERR_NONE;
+	}
+      if (list->last_use < victim->last_use)
+	victim = list;
+    }
+
+  grub_memset (&ctx, 0, sizeof (ctx));
+  ctx.name = name;
+  ctx.list.extent = extent;
+
+  grub_iso9660_iterate_dir (dir, grub_iso9660_lookup_iter, &ctx);
+  err = grub_errno;
+
+  if (!err && !ctx.overflow)
+    {
+      free_dirlist (victim);
+      *victim = ctx.list;
+      victim->last_use = ++data->dirlist_clock;
+    }
+  else
+    free_dirlist (&ctx.list);
+
+  if (err)
+    {
+      grub_free (ctx.found);
+      return err;
+    }
+
+  *foundnode = ctx.found;
+  *foundtype = ctx.foundtype;
+  return GRUB_ERR_NONE;
+}
+
 /* Context for grub_iso9660_dir.  */
 struct grub_iso9660_dir_ctx
 {
@@ -989,6 +1361,11 @@ grub_iso9660_dir_iter (const char *filename,
   grub_memset (&info, 0, sizeof (info));
   info.dir = ((filetype & GRUB_FSHELP_TYPE_MASK) == GRUB_FSHELP_DIR);
   info.mtimeset = !!iso9660_to_unixtime2 (&node->dirents[0].mtime, &info.mtime);
+  if ((filetype & GRUB_FSHELP_TYPE_MASK) == GRUB_FSHELP_REG)
+    {
+      info.sizeset = 1;
+      info.size = get_node_size (node);
+    }
 
   grub_free (node);
   return ctx->hook (filename, &info, ctx->hook_data);
@@ -1016,11 +1393,11 @@ grub_iso9660_dir (grub_device_t device, const char *path,
   rootnode.dirents[0] = data->voldesc.rootdir;
 
   /* Use the fshelp function to traverse the path.  */
-  if (grub_fshelp_find_file (path, &rootnode,
-			     &foundnode,
-			     grub_iso9660_iterate_dir,
-			     grub_iso9660_read_symlink,
-			     GRUB_FSHELP_DIR))
+  if (grub_fshelp_find_file_lookup (path, &rootnode,
+				    &foundnode,
+				    grub_iso9660_lookup_file,
+				    grub_iso9660_read_symlink,
+				    GRUB_FSHELP_DIR))
     goto fail;
 
   /* List the files in the directory.  */
@@ -1030,7 +1407,7 @@ grub_iso9660_dir (grub_device_t device, const char *path,
     grub_free (foundnode);
 
  fail:
-  grub_free (data);
+  grub_iso9660_unmount (data);
 
   grub_dl_unref (my_mod);
 
@@ -1059,11 +1436,11 @@ grub_iso9660_open (struct grub_file *file, const char *name)
   rootnode.dirents[0] = data->voldesc.rootdir;
 
   /* Use the fshelp function to traverse the path.  */
-  if (grub_fshelp_find_file (name, &rootnode,
-			     &foundnode,
-			     grub_iso9660_iterate_dir,
-			     grub_iso9660_read_symlink,
-			     GRUB_FSHELP_REG))
+  if (grub_fshelp_find_file_lookup (name, &rootnode,
+				    &foundnode,
+				    grub_iso9660_lookup_file,
+				    grub_iso9660_read_symlink,
+				    GRUB_FSHELP_REG))
     goto fail;
 
   data->node = foundnode;
@@ -1076,7 +1453,7 @@ grub_iso9660_open (struct grub_file *file, const char *name)
  fail:
   grub_dl_unref (my_mod);
 
-  grub_free (data);
+  grub_iso9660_unmount (data);
 
   return grub_errno;
 }
@@ -1108,7 +1485,8 @@ grub_iso9660_close (grub_file_t file)
   struct grub_iso9660_data *data =
     (struct grub_iso9660_data *) file->data;
   grub_free (data->node);
-  grub_free (data);
+  data->node = NULL;
+  grub_iso9660_unmount (data);
 
   grub_dl_unref (my_mod);
 
@@ -1137,7 +1515,7 @@ grub_iso9660_label (grub_device_t device, char **label)
 	    *ptr-- = 0;
 	}
 
-      grub_free (data);
+      grub_iso9660_unmount (data);
     }
   else
     *label = 0;
@@ -1195,7 +1573,7 @@ grub_iso9660_uuid (grub_device_t device, char **uuid)
 
 	grub_dl_unref (my_mod);
 
-  grub_free (data);
+  grub_iso9660_unmount (data);
 
   return grub_errno;
 }
@@ -1220,7 +1598,7 @@ grub_iso9660_mtime (grub_device_t device, grub_int64_t *timebuf)
 
   grub_dl_unref (my_mod);
 
-  grub_free (data);
+  grub_iso9660_unmount (data);
 
   return err;
 }
@@ -1254,4 +1632,5 @@ GRUB_MOD_INIT(iso9660)
 GRUB_MOD_FINI(iso9660)
 {
   grub_fs_unregister (&grub_iso9660_fs);
+  grub_fshelp_mount_flush ("iso9660");
 }
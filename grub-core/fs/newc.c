@@ -70,4 +70,5 @@ GRUB_MOD_INIT (newc)
 GRUB_MOD_FINI (newc)
 {
   grub_fs_unregister (&grub_cpio_fs);
+  grub_fshelp_mount_flush (FSNAME);
 }
@@ -49,6 +49,10 @@ GRUB_MOD_LICENSE ("GPLv3+");
 /* nilfs btree node level. */
 #define NILFS_BTREE_LEVEL_DATA          0
 #define NILFS_BTREE_LEVEL_NODE_MIN      (NILFS_BTREE_LEVEL_DATA + 1)
+#define NILFS_BTREE_LEVEL_MAX           14
+
+/* Number of DAT translations kept, a power of 2.  */
+#define NILFS2_DAT_CACHE_SIZE	256
 
 /* nilfs 1st super block posission from beginning of the partition
    in 512 block size */
@@ -272,6 +276,15 @@ struct grub_fshelp_node
   int inode_read;
 };
 
+/* The nodes last read at each level of a B-tree, so that the next lookup
+   only reads the ones it doesn't share with the last.  */
+struct grub_nilfs2_btree_path
+{
+  /* The block of each node, 0 for none.  */
+  grub_uint64_t blocknr[NILFS_BTREE_LEVEL_MAX];
+  void *node[NILFS_BTREE_LEVEL_MAX];
+};
+
 struct grub_nilfs2_data
 {
   struct grub_nilfs2_super_block sblock;
@@ -280,6 +293,15 @@ struct grub_nilfs2_data
   grub_disk_t disk;
   struct grub_nilfs2_inode *inode;
   struct grub_fshelp_node diropen;
+  struct grub_nilfs2_btree_path dat_path;
+  struct grub_nilfs2_btree_path ifile_path;
+  struct grub_nilfs2_btree_path file_path;
+  /* Virtual to disk block numbers, direct mapped.  */
+  struct
+  {
+    grub_uint64_t vblocknr;
+    grub_uint64_t blocknr;
+  } dat_cache[NILFS2_DAT_CACHE_SIZE];
 };
 
 /* Log2 size of nilfs2 block in 512 blocks.  */
@@ -497,38 +519,55 @@ grub_nilfs2_btree_node_get_ptr (struct grub_nilfs2_data *data,
     grub_le_to_cpu64 (*(grub_nilfs2_btree_node_dptrs (data, node) + index));
 }
 
-static inline int
+/* Return the node at LEVEL in block PTR, read unless it is in PATH.  */
+static struct grub_nilfs2_btree_node *
 grub_nilfs2_btree_get_nonroot_node (struct grub_nilfs2_data *data,
-				    grub_uint64_t ptr, void *block)
+				    struct grub_nilfs2_btree_path *path,
+				    int level, grub_uint64_t ptr)
 {
   grub_disk_t disk = data->disk;
   unsigned int nilfs2_block_count = (1 << LOG2_NILFS2_BLOCK_SIZE (data));
 
-  return grub_disk_read (disk, ptr * nilfs2_block_count, 0,
-			 NILFS2_BLOCK_SIZE (data), block);
+  if (path->node[level] && path->blocknr[level] == ptr)
+    return path->node[level];
+
+  if (!path->node[level])
+    {
+      path->node[level] = grub_malloc (NILFS2_BLOCK_SIZE (data));
+      if (!path->node[level])
+	return NULL;
+    }
+
+  path->blocknr[level] = 0;
+  if (grub_disk_read (disk, ptr * nilfs2_block_count, 0,
+		      NILFS2_BLOCK_SIZE (data), path->node[level]))
+    return NULL;
+  path->blocknr[level] = ptr;
+  return path->node[level];
 }
 
 static grub_uint64_t
 grub_nilfs2_btree_lookup (struct grub_nilfs2_data *data,
 			  struct grub_nilfs2_inode *inode,
+			  struct grub_nilfs2_btree_path *path,
 			  grub_uint64_t key, int need_translate)
 {
   struct grub_nilfs2_btree_node *node;
-  void *block;
   grub_uint64_t ptr;
   int level, found = 0, index;
 
-  block = grub_malloc (NILFS2_BLOCK_SIZE (data));
-  if (!block)
-    return -1;
-
   node = grub_nilfs2_btree_get_root (inode);
   level = grub_nilfs2_btree_get_level (node);
+  if (level >= NILFS_BTREE_LEVEL_MAX)
+    {
+      grub_error (GRUB_ERR_BAD_FS, "btree too deep");
+      return -1;
+    }
 
   found = grub_nilfs2_btree_node_lookup (data, node, key, &index);
 
   if (grub_errno != GRUB_ERR_NONE)
-    goto fail;
+    return -1;
 
   ptr = grub_nilfs2_btree_node_get_ptr (data, node, index);
   if (need_translate)
@@ -536,17 +575,16 @@ grub_nilfs2_btree_lookup (struct grub_nilfs2_data *data,
 
   for (level--; level >= NILFS_BTREE_LEVEL_NODE_MIN; level--)
     {
-      grub_nilfs2_btree_get_nonroot_node (data, ptr, block);
       if (grub_errno)
-	{
-	  goto fail;
-	}
-      node = (struct grub_nilfs2_btree_node *) block;
+	return -1;
+      node = grub_nilfs2_btree_get_nonroot_node (data, path, level, ptr);
+      if (!node)
+	return -1;
 
       if (node->bn_level != level)
 	{
 	  grub_error (GRUB_ERR_BAD_FS, "btree level mismatch\n");
-	  goto fail;
+	  return -1;
 	}
 
       if (!found)
@@ -564,19 +602,14 @@ grub_nilfs2_btree_lookup (struct grub_nilfs2_data *data,
       else
 	{
 	  grub_error (GRUB_ERR_BAD_FS, "btree corruption\n");
-	  goto fail;
+	  return -1;
 	}
     }
 
-  grub_free (block);
-
   if (!found)
     return -1;
 
   return ptr;
- fail:
-  grub_free (block);
-  return -1;
 }
 
 static inline grub_uint64_t
@@ -593,11 +626,12 @@ grub_nilfs2_direct_lookup (struct grub_nilfs2_inode *inode, grub_uint64_t key)
 static inline grub_uint64_t
 grub_nilfs2_bmap_lookup (struct grub_nilfs2_data *data,
 			 struct grub_nilfs2_inode *inode,
+			 struct grub_nilfs2_btree_path *path,
 			 grub_uint64_t key, int need_translate)
 {
   struct grub_nilfs2_btree_node *root = grub_nilfs2_btree_get_root (inode);
   if (root->bn_flags & NILFS_BMAP_LARGE)
-    return grub_nilfs2_btree_lookup (data, inode, key, need_translate);
+    return grub_nilfs2_btree_lookup (data, inode, path, key, need_translate);
   else
     {
       grub_uint64_t ptr;
@@ -616,6 +650,10 @@ grub_nilfs2_dat_translate (struct grub_nilfs2_data *data, grub_uint64_t key)
   grub_uint64_t pptr;
   grub_uint64_t blockno, offset;
   unsigned int nilfs2_block_count = (1 << LOG2_NILFS2_BLOCK_SIZE (data));
+  unsigned slot = key & (NILFS2_DAT_CACHE_SIZE - 1);
+
+  if (data->dat_cache[slot].vblocknr == key)
+    return data->dat_cache[slot].blocknr;
 
   blockno = grub_nilfs2_palloc_entry_offset_log (data, key,
 						 LOG_NILFS_DAT_ENTRY_SIZE);
@@ -623,17 +661,21 @@ grub_nilfs2_dat_translate (struct grub_nilfs2_data *data, grub_uint64_t key)
   offset = ((key * sizeof (struct grub_nilfs2_dat_entry))
 	    & ((1 << LOG2_BLOCK_SIZE (data)) - 1));
 
-  pptr = grub_nilfs2_bmap_lookup (data, &data->sroot.sr_dat, blockno, 0);
+  pptr = grub_nilfs2_bmap_lookup (data, &data->sroot.sr_dat, &data->dat_path,
+				  blockno, 0);
   if (pptr == (grub_uint64_t) - 1)
     {
       grub_error (GRUB_ERR_BAD_FS, "btree lookup failure");
       return -1;
     }
 
-  grub_disk_read (disk, pptr * nilfs2_block_count, offset,
-		  sizeof (struct grub_nilfs2_dat_entry), &entry);
+  if (grub_disk_read (disk, pptr * nilfs2_block_count, offset,
+		      sizeof (struct grub_nilfs2_dat_entry), &entry))
+    return -1;
 
-  return grub_le_to_cpu64 (entry.de_blocknr);
+  data->dat_cache[slot].vblocknr = key;
+  data->dat_cache[slot].blocknr = grub_le_to_cpu64 (entry.de_blocknr);
+  return data->dat_cache[slot].blocknr;
 }
 
 
@@ -644,7 +686,7 @@ grub_nilfs2_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
   struct grub_nilfs2_inode *inode = &node->inode;
   grub_uint64_t pptr = -1;
 
-  pptr = grub_nilfs2_bmap_lookup (data, inode, fileblock, 1);
+  pptr = grub_nilfs2_bmap_lookup (data, inode, &data->file_path, fileblock, 1);
   if (pptr == (grub_uint64_t) - 1)
     {
       grub_error (GRUB_ERR_BAD_FS, "btree lookup failure");
@@ -686,7 +728,8 @@ grub_nilfs2_read_checkpoint (struct grub_nilfs2_data *data,
   blockno = grub_divmod64 (cpno, NILFS2_BLOCK_SIZE (data) /
                           sizeof (struct grub_nilfs2_checkpoint), &offset);
 
-  pptr = grub_nilfs2_bmap_lookup (data, &data->sroot.sr_cpfile, blockno, 1);
+  pptr = grub_nilfs2_bmap_lookup (data, &data->sroot.sr_cpfile,
+				  &data->file_path, blockno, 1);
   if (pptr == (grub_uint64_t) - 1)
     {
       return grub_error (GRUB_ERR_BAD_FS, "btree lookup failure");
@@ -723,7 +766,8 @@ grub_nilfs2_read_inode (struct grub_nilfs2_data *data,
 
   offset = ((sizeof (struct grub_nilfs2_inode) * ino)
 	    & ((1 << LOG2_BLOCK_SIZE (data)) - 1));
-  pptr = grub_nilfs2_bmap_lookup (data, &data->ifile, blockno, 1);
+  pptr = grub_nilfs2_bmap_lookup (data, &data->ifile, &data->ifile_path,
+				  blockno, 1);
   if (pptr == (grub_uint64_t) - 1)
     {
       return grub_error (GRUB_ERR_BAD_FS, "btree lookup failure");
@@ -733,6 +777,27 @@ grub_nilfs2_read_inode (struct grub_nilfs2_data *data,
 			 sizeof (struct grub_nilfs2_inode), inodep);
 }
 
+static void
+grub_nilfs2_free_path (struct grub_nilfs2_btree_path *path)
+{
+  int i;
+
+  for (i = 0; i < NILFS_BTREE_LEVEL_MAX; i++)
+    grub_free (path->node[i]);
+}
+
+static void
+grub_nilfs2_free_data (struct grub_nilfs2_data *data)
+{
+  if (!data)
+    return;
+
+  grub_nilfs2_free_path (&data->dat_path);
+  grub_nilfs2_free_path (&data->ifile_path);
+  grub_nilfs2_free_path (&data->file_path);
+  grub_free (data);
+}
+
 static int
 grub_nilfs2_valid_sb (struct grub_nilfs2_super_block *sbp)
 {
@@ -814,12 +879,15 @@ grub_nilfs2_mount (grub_disk_t disk)
   grub_uint64_t last_pseg;
   grub_uint32_t nblocks;
   unsigned int nilfs2_block_count;
+  unsigned i;
 
-  data = grub_malloc (sizeof (struct grub_nilfs2_data));
+  data = grub_zalloc (sizeof (struct grub_nilfs2_data));
   if (!data)
     return 0;
 
   data->disk = disk;
+  for (i = 0; i < NILFS2_DAT_CACHE_SIZE; i++)
+    data->dat_cache[i].vblocknr = (grub_uint64_t) -1;
 
   /* Read the superblock.  */
   grub_nilfs2_load_sb (data);
@@ -865,7 +933,7 @@ fail:
   if (grub_errno == GRUB_ERR_OUT_OF_RANGE)
     grub_error (GRUB_ERR_BAD_FS, "not a nilfs2 filesystem");
 
-  grub_free (data);
+  grub_nilfs2_free_data (data);
   return 0;
 }
 
@@ -1032,7 +1100,7 @@ grub_nilfs2_open (struct grub_file *file, const char *name)
 fail:
   if (fdiro != &data->diropen)
     grub_free (fdiro);
-  grub_free (data);
+  grub_nilfs2_free_data (data);
 
   grub_dl_unref (my_mod);
 
@@ -1042,7 +1110,7 @@ fail:
 static grub_err_t
 grub_nilfs2_close (grub_file_t file)
 {
-  grub_free (file->data);
+  grub_nilfs2_free_data (file->data);
 
   grub_dl_unref (my_mod);
 
@@ -1122,7 +1190,7 @@ grub_nilfs2_dir (grub_device_t device, const char *path,
 fail:
   if (fdiro != &ctx.data->diropen)
     grub_free (fdiro);
-  grub_free (ctx.data);
+  grub_nilfs2_free_data (ctx.data);
 
   grub_dl_unref (my_mod);
 
@@ -1146,7 +1214,7 @@ grub_nilfs2_label (grub_device_t device, char **label)
 
   grub_dl_unref (my_mod);
 
-  grub_free (data);
+  grub_nilfs2_free_data (data);
 
   return grub_errno;
 }
@@ -1179,7 +1247,7 @@ grub_nilfs2_uuid (grub_device_t device, char **uuid)
 
   grub_dl_unref (my_mod);
 
-  grub_free (data);
+  grub_nilfs2_free_data (data);
 
   return grub_errno;
 }
@@ -1201,7 +1269,7 @@ grub_nilfs2_mtime (grub_device_t device, grub_int64_t * tm)
 
   grub_dl_unref (my_mod);
 
-  grub_free (data);
+  grub_nilfs2_free_data (data);
 
   return grub_errno;
 }
@@ -27,6 +27,8 @@
 #include <grub/fshelp.h>
 #include <grub/ntfs.h>
 #include <grub/charset.h>
+#include <grub/i18n.h>
+#include <grub/safemath.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -122,18 +124,37 @@ static grub_err_t read_data (struct grub_ntfs_attr *at, grub_uint8_t *pa,
 static void
 init_attr (struct grub_ntfs_attr *at, struct grub_ntfs_file *mft)
 {
+  unsigned i;
+
   at->mft = mft;
   at->flags = (mft == &mft->data->mmft) ? GRUB_NTFS_AF_MMFT : 0;
   at->attr_nxt = mft->buf + first_attr_off (mft->buf);
-  at->attr_end = at->emft_buf = at->edat_buf = at->sbuf = NULL;
+  at->attr_end = at->emft_buf = at->edat_buf = at->comp_raw = NULL;
+  at->runs_pa = NULL;
+  at->runs = NULL;
+  at->nruns = 0;
+  for (i = 0; i < GRUB_NTFS_COMP_CACHE_SIZE; i++)
+    {
+      at->comp_units[i].vcn = (grub_disk_addr_t) -1;
+      at->comp_units[i].buf = NULL;
+    }
+  at->comp_next = 0;
 }
 
 static void
 free_attr (struct grub_ntfs_attr *at)
 {
+  unsigned i;
+
   grub_free (at->emft_buf);
   grub_free (at->edat_buf);
-  grub_free (at->sbuf);
+  grub_free (at->comp_raw);
+  for (i = 0; i < GRUB_NTFS_COMP_CACHE_SIZE; i++)
+    grub_free (at->comp_units[i].buf);
+  grub_free (at->runs);
+  at->runs_pa = NULL;
+  at->runs = NULL;
+  at->nruns = 0;
 }
 
 static grub_uint8_t *
@@ -150,6 +171,12 @@ find_attr (struct grub_ntfs_attr *at, grub_uint8_t attr)
 	    {
 	      grub_uint8_t *new_pos;
 
+	      /* EMFT_BUF is about to be overwritten.  */
+	      if (at->runs_pa >= at->emft_buf
+		  && at->runs_pa < at->emft_buf + (at->mft->data->mft_size
+						   << GRUB_NTFS_BLK_SHR))
+		at->runs_pa = NULL;
+
 	      if (at->flags & GRUB_NTFS_AF_MMFT)
 		{
 		  if ((grub_disk_read
@@ -396,6 +423,89 @@ grub_ntfs_read_block (grub_fshelp_node_t node, grub_disk_addr_t block)
 					 ctx->curr_vcn + ctx->curr_lcn);
 }
 
+/* Decode the whole run list of the non-resident attribute record PA
+   into a sorted array cached in AT.  */
+static grub_err_t
+decode_runs (struct grub_ntfs_attr *at, grub_uint8_t *pa)
+{
+  grub_uint8_t *run, *end;
+  grub_disk_addr_t vcn, lcn = 0;
+  grub_size_t alloc = 0;
+
+  at->runs_pa = NULL;
+  at->nruns = 0;
+
+  run = pa + u16at (pa, 0x20);
+  end = pa + u32at (pa, 4);
+  vcn = u32at (pa, 0x10);
+  while (run < end && ((*run) & 0x7))
+    {
+      grub_uint8_t c1, c2;
+      grub_disk_addr_t val;
+      struct grub_ntfs_run *r;
+
+      c1 = ((*run) & 0x7);
+      c2 = ((*run) >> 4) & 0x7;
+      if (end - run < 1 + c1 + c2)
+	return grub_error (GRUB_ERR_BAD_FS, "run list overflown");
+      run++;
+
+      if (at->nruns == alloc)
+	{
+	  struct grub_ntfs_run *n;
+	  grub_size_t sz;
+
+	  alloc = alloc ? alloc * 2 : 16;
+	  if (grub_mul (alloc, sizeof (*n), &sz))
+	    return grub_error (GRUB_ERR_OUT_OF_RANGE, N_("overflow is detected"));
+	  n = grub_realloc (at->runs, sz);
+	  if (n == NULL)
+	    return grub_errno;
+	  at->runs = n;
+	}
+
+      r = &at->runs[at->nruns++];
+      r->vcn = vcn;
+      r->len = read_run_data (run, c1, 0);
+      run += c1;
+      val = read_run_data (run, c2, 1);
+      run += c2;
+      lcn += val;
+      r->lcn = lcn;
+      r->sparse = (val == 0);
+      vcn += r->len;
+    }
+
+  at->runs_pa = pa;
+  return 0;
+}
+
+static grub_disk_addr_t
+grub_ntfs_read_block_cached (grub_fshelp_node_t node, grub_disk_addr_t block)
+{
+  struct grub_ntfs_attr *at;
+  grub_size_t lo, hi;
+
+  at = (struct grub_ntfs_attr *) node;
+  lo = 0;
+  hi = at->nruns;
+  while (lo < hi)
+    {
+      grub_size_t mid = lo + (hi - lo) / 2;
+      struct grub_ntfs_run *r = &at->runs[mid];
+
+      if (block < r->vcn)
+	hi = mid;
+      else if (block - r->vcn >= r->len)
+	lo = mid + 1;
+      else
+	return r->sparse ? 0 : block - r->vcn + r->lcn;
+    }
+
+  grub_error (GRUB_ERR_BAD_FS, "run list overflown");
+  return -1;
+}
+
 static grub_err_t
 read_data (struct grub_ntfs_attr *at, grub_uint8_t *pa, grub_uint8_t *dest,
 	   grub_disk_addr_t ofs, grub_size_t len, int cached,
@@ -451,6 +561,25 @@ read_data (struct grub_ntfs_attr *at, grub_uint8_t *pa, grub_uint8_t *dest,
     }
 
   ctx->target_vcn = ofs >> (GRUB_NTFS_BLK_SHR + ctx->comp.log_spc);
+
+  /* Reads that stay within this attribute record go through the decoded
+     run list instead of walking the mapping pairs from the start.  */
+  if (!(at->flags & GRUB_NTFS_AF_GPOS)
+      && ctx->target_vcn >= ctx->next_vcn
+      && ((ofs + len - 1) >> (GRUB_NTFS_BLK_SHR + ctx->comp.log_spc))
+	 <= u64at (pa, 0x18))
+    {
+      if (at->runs_pa != pa && decode_runs (at, pa))
+	return grub_errno;
+
+      grub_fshelp_read_file (ctx->comp.disk, (grub_fshelp_node_t) at,
+			     read_hook, read_hook_data, ofs, len,
+			     (char *) dest,
+			     grub_ntfs_read_block_cached, ofs + len,
+			     ctx->comp.log_spc, 0);
+      return grub_errno;
+    }
+
   while (ctx->next_vcn <= ctx->target_vcn)
     {
       if (grub_ntfs_read_run_list (ctx))
@@ -535,14 +664,52 @@ read_attr (struct grub_ntfs_attr *at, grub_uint8_t *dest, grub_disk_addr_t ofs,
   return ret;
 }
 
+static void
+free_mft_cache (struct grub_ntfs_data *data)
+{
+  unsigned i;
+
+  for (i = 0; i < GRUB_NTFS_MFT_CACHE_SIZE; i++)
+    grub_free (data->mft_cache[i].buf);
+}
+
 static grub_err_t
 read_mft (struct grub_ntfs_data *data, grub_uint8_t *buf, grub_uint64_t mftno)
 {
+  grub_size_t size = data->mft_size << GRUB_NTFS_BLK_SHR;
+  unsigned i, victim = 0;
+
+  for (i = 0; i < GRUB_NTFS_MFT_CACHE_SIZE; i++)
+    {
+      if (data->mft_cache[i].buf && data->mft_cache[i].mftno == mftno)
+	{
+	  data->mft_cache[i].last_use = ++data->mft_clock;
+	  grub_memcpy (buf, data->mft_cache[i].buf, size);
+	  return 0;
+	}
+      if (data->mft_cache[i].last_use < data->mft_cache[victim].last_use)
+	victim = i;
+    }
+
   if (read_attr
       (&data->mmft.attr, buf, mftno * ((grub_disk_addr_t) data->mft_size << GRUB_NTFS_BLK_SHR),
        data->mft_size << GRUB_NTFS_BLK_SHR, 0, 0, 0))
     return grub_error (GRUB_ERR_BAD_FS, "read MFT 0x%llx fails", (unsigned long long) mftno);
-  return fixup (buf, data->mft_size, (const grub_uint8_t *) "FILE");
+  if (fixup (buf, data->mft_size, (const grub_uint8_t *) "FILE"))
+    return grub_errno;
+
+  /* The cache is only an optimisation; ignore allocation failures.  */
+  if (data->mft_cache[victim].buf == NULL)
+    data->mft_cache[victim].buf = grub_malloc (size);
+  if (data->mft_cache[victim].buf == NULL)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return 0;
+    }
+  grub_memcpy (data->mft_cache[victim].buf, buf, size);
+  data->mft_cache[victim].mftno = mftno;
+  data->mft_cache[victim].last_use = ++data->mft_clock;
+  return 0;
 }
 
 static grub_err_t
@@ -1046,6 +1213,7 @@ fail:
     {
       free_file (&data->mmft);
       free_file (&data->cmft);
+      free_mft_cache (data);
       grub_free (data);
     }
   return 0;
@@ -1108,6 +1276,7 @@ fail:
     {
       free_file (&data->mmft);
       free_file (&data->cmft);
+      free_mft_cache (data);
       grub_free (data);
     }
 
@@ -1157,6 +1326,7 @@ fail:
     {
       free_file (&data->mmft);
       free_file (&data->cmft);
+      free_mft_cache (data);
       grub_free (data);
     }
 
@@ -1171,8 +1341,14 @@ grub_ntfs_read (grub_file_t file, char *buf, grub_size_t len)
   struct grub_ntfs_file *mft;
 
   mft = &((struct grub_ntfs_data *) file->data)->cmft;
-  if (file->read_hook)
-    mft->attr.save_pos = 1;
+  /* Whoever watches the disk reads must see them all.  */
+  if (file->read_hook && file->read_hook != grub_file_progress_hook)
+    {
+      unsigned i;
+
+      for (i = 0; i < GRUB_NTFS_COMP_CACHE_SIZE; i++)
+	mft->attr.comp_units[i].vcn = (grub_disk_addr_t) -1;
+    }
 
   read_attr (&mft->attr, (grub_uint8_t *) buf, file->offset, len, 1,
 	     file->read_hook, file->read_hook_data);
@@ -1190,6 +1366,7 @@ grub_ntfs_close (grub_file_t file)
     {
       free_file (&data->mmft);
       free_file (&data->cmft);
+      free_mft_cache (data);
       grub_free (data);
     }
 
@@ -1266,6 +1443,7 @@ fail:
     {
       free_file (&data->mmft);
       free_file (&data->cmft);
+      free_mft_cache (data);
       grub_free (data);
     }
 
@@ -1292,6 +1470,7 @@ grub_ntfs_uuid (grub_device_t device, char **uuid)
 	  *ptr = grub_toupper (*ptr);
       free_file (&data->mmft);
       free_file (&data->cmft);
+      free_mft_cache (data);
       grub_free (data);
     }
   else
@@ -25,411 +25,235 @@
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
+/* Decompress the LZNT1 chunk of SIZE bytes at SRC into the 4096 bytes at
+   DEST.  Whatever the chunk doesn't cover is zeroed.  */
 static grub_err_t
-decomp_nextvcn (struct grub_ntfs_comp *cc)
+decomp_block (const grub_uint8_t *src, grub_size_t size, grub_uint8_t *dest)
 {
-  if (cc->comp_head >= cc->comp_tail)
-    return grub_error (GRUB_ERR_BAD_FS, "compression block overflown");
-  if (grub_disk_read
-      (cc->disk,
-       (cc->comp_table[cc->comp_head].next_lcn -
-	(cc->comp_table[cc->comp_head].next_vcn - cc->cbuf_vcn)) << cc->log_spc,
-       0,
-       1 << (cc->log_spc + GRUB_NTFS_BLK_SHR), cc->cbuf))
-    return grub_errno;
-  cc->cbuf_vcn++;
-  if ((cc->cbuf_vcn >= cc->comp_table[cc->comp_head].next_vcn))
-    cc->comp_head++;
-  cc->cbuf_ofs = 0;
-  return 0;
-}
+  const grub_uint8_t *end = src + size;
+  grub_uint32_t copied = 0, limit = 0x10, lmask = 0xFFF, dshift = 12;
 
-static grub_err_t
-decomp_getch (struct grub_ntfs_comp *cc, grub_uint8_t *res)
-{
-  if (cc->cbuf_ofs >= (1U << (cc->log_spc + GRUB_NTFS_BLK_SHR)))
+  while (src < end)
     {
-      if (decomp_nextvcn (cc))
-	return grub_errno;
-    }
-  *res = cc->cbuf[cc->cbuf_ofs++];
-  return 0;
-}
-
-static grub_err_t
-decomp_get16 (struct grub_ntfs_comp *cc, grub_uint16_t * res)
-{
-  grub_uint8_t c1 = 0, c2 = 0;
-
-  if ((decomp_getch (cc, &c1)) || (decomp_getch (cc, &c2)))
-    return grub_errno;
-  *res = ((grub_uint16_t) c2) * 256 + ((grub_uint16_t) c1);
-  return 0;
-}
+      grub_uint8_t tag = *src++;
+      int bits;
 
-/* Decompress a block (4096 bytes) */
-static grub_err_t
-decomp_block (struct grub_ntfs_comp *cc, grub_uint8_t *dest)
-{
-  grub_uint16_t flg, cnt;
-
-  if (decomp_get16 (cc, &flg))
-    return grub_errno;
-  cnt = (flg & 0xFFF) + 1;
-
-  if (dest)
-    {
-      if (flg & 0x8000)
+      for (bits = 0; bits < 8 && src < end; bits++, tag >>= 1)
 	{
-	  grub_uint8_t tag;
-	  grub_uint32_t bits, copied;
+	  grub_uint32_t code, delta, len;
 
-	  bits = copied = tag = 0;
-	  while (cnt > 0)
+	  if (!(tag & 1))
 	    {
-	      if (copied > GRUB_NTFS_COM_LEN)
+	      if (copied >= GRUB_NTFS_COM_LEN)
 		return grub_error (GRUB_ERR_BAD_FS,
 				   "compression block too large");
+	      dest[copied++] = *src++;
+	      continue;
+	    }
 
-	      if (!bits)
-		{
-		  if (decomp_getch (cc, &tag))
-		    return grub_errno;
-
-		  bits = 8;
-		  cnt--;
-		  if (cnt <= 0)
-		    break;
-		}
-	      if (tag & 1)
-		{
-		  grub_uint32_t i, len, delta, code, lmask, dshift;
-		  grub_uint16_t word = 0;
-
-		  if (decomp_get16 (cc, &word))
-		    return grub_errno;
-
-		  code = word;
-		  cnt -= 2;
-
-		  if (!copied)
-		    {
-		      grub_error (GRUB_ERR_BAD_FS, "nontext window empty");
-		      return 0;
-		    }
-
-		  for (i = copied - 1, lmask = 0xFFF, dshift = 12; i >= 0x10;
-		       i >>= 1)
-		    {
-		      lmask >>= 1;
-		      dshift--;
-		    }
-
-		  delta = code >> dshift;
-		  len = (code & lmask) + 3;
-
-		  for (i = 0; i < len; i++)
-		    {
-		      dest[copied] = dest[copied - delta - 1];
-		      copied++;
-		    }
-		}
-	      else
-		{
-		  grub_uint8_t ch = 0;
-
-		  if (decomp_getch (cc, &ch))
-		    return grub_errno;
-		  dest[copied++] = ch;
-		  cnt--;
-		}
-	      tag >>= 1;
-	      bits--;
+	  if (end - src < 2)
+	    return grub_error (GRUB_ERR_BAD_FS, "compression block overflown");
+	  code = src[0] | (src[1] << 8);
+	  src += 2;
+
+	  if (!copied)
+	    return grub_error (GRUB_ERR_BAD_FS, "nontext window empty");
+
+	  /* The further into the block, the more bits the offset takes.  */
+	  while (copied - 1 >= limit)
+	    {
+	      limit <<= 1;
+	      lmask >>= 1;
+	      dshift--;
 	    }
-	  return 0;
-	}
-      else
-	{
-	  if (cnt != GRUB_NTFS_COM_LEN)
-	    return grub_error (GRUB_ERR_BAD_FS,
-			       "invalid compression block size");
-	}
-    }
 
-  while (cnt > 0)
-    {
-      int n;
+	  delta = (code >> dshift) + 1;
+	  len = (code & lmask) + 3;
+	  if (delta > copied || len > GRUB_NTFS_COM_LEN - copied)
+	    return grub_error (GRUB_ERR_BAD_FS, "invalid compression block");
 
-      n = (1 << (cc->log_spc + GRUB_NTFS_BLK_SHR)) - cc->cbuf_ofs;
-      if (n > cnt)
-	n = cnt;
-      if ((dest) && (n))
-	{
-	  grub_memcpy (dest, &cc->cbuf[cc->cbuf_ofs], n);
-	  dest += n;
+	  if (delta >= len)
+	    grub_memcpy (dest + copied, dest + copied - delta, len);
+	  else
+	    {
+	      /* The copy overlaps its source to repeat it.  */
+	      grub_uint8_t *d = dest + copied;
+	      const grub_uint8_t *from = d - delta;
+	      grub_uint32_t i;
+
+	      for (i = 0; i < len; i++)
+		d[i] = from[i];
+	    }
+	  copied += len;
 	}
-      cnt -= n;
-      cc->cbuf_ofs += n;
-      if ((cnt) && (decomp_nextvcn (cc)))
-	return grub_errno;
     }
+
+  grub_memset (dest + copied, 0, GRUB_NTFS_COM_LEN - copied);
   return 0;
 }
 
+/* Decompress the SIZE bytes of a compressed unit at SRC into the
+   UNIT_SIZE bytes at DEST.  */
 static grub_err_t
-read_block (struct grub_ntfs_rlst *ctx, grub_uint8_t *buf, grub_size_t num)
+decomp_unit (const grub_uint8_t *src, grub_size_t size, grub_uint8_t *dest,
+	     grub_size_t unit_size)
 {
-  int log_cpb = GRUB_NTFS_LOG_COM_SEC - ctx->comp.log_spc;
+  const grub_uint8_t *end = src + size;
+  grub_size_t done;
 
-  while (num)
+  for (done = 0; done < unit_size; done += GRUB_NTFS_COM_LEN)
     {
-      grub_size_t nn;
+      grub_uint16_t flg;
+      grub_size_t cnt;
+
+      /* The data may end before the unit does, the rest is zeros.  */
+      if (end - src < 2)
+	break;
+      flg = grub_get_unaligned16 (src);
+      flg = grub_le_to_cpu16 (flg);
+      if (!flg)
+	break;
+      src += 2;
+
+      cnt = (flg & 0xFFF) + 1;
+      if (cnt > (grub_size_t) (end - src))
+	return grub_error (GRUB_ERR_BAD_FS, "compression block overflown");
 
-      if ((ctx->target_vcn & 0xF) == 0)
+      if (flg & 0x8000)
 	{
-
-	  if (ctx->comp.comp_head != ctx->comp.comp_tail
-	      && !(ctx->flags & GRUB_NTFS_RF_BLNK))
-	    return grub_error (GRUB_ERR_BAD_FS, "invalid compression block");
-	  ctx->comp.comp_head = ctx->comp.comp_tail = 0;
-	  ctx->comp.cbuf_vcn = ctx->target_vcn;
-	  ctx->comp.cbuf_ofs = (1 << (ctx->comp.log_spc + GRUB_NTFS_BLK_SHR));
-	  if (ctx->target_vcn >= ctx->next_vcn)
-	    {
-	      if (grub_ntfs_read_run_list (ctx))
-		return grub_errno;
-	    }
-	  while (ctx->target_vcn + 16 > ctx->next_vcn)
-	    {
-	      if (ctx->flags & GRUB_NTFS_RF_BLNK)
-		break;
-	      ctx->comp.comp_table[ctx->comp.comp_tail].next_vcn = ctx->next_vcn;
-	      ctx->comp.comp_table[ctx->comp.comp_tail].next_lcn =
-		ctx->curr_lcn + ctx->next_vcn - ctx->curr_vcn;
-	      ctx->comp.comp_tail++;
-	      if (grub_ntfs_read_run_list (ctx))
-		return grub_errno;
-	    }
-	}
-
-      nn = (16 - (unsigned) (ctx->target_vcn & 0xF)) >> log_cpb;
-      if (nn > num)
-	nn = num;
-      num -= nn;
-
-      if (ctx->flags & GRUB_NTFS_RF_BLNK)
-	{
-	  ctx->target_vcn += nn << log_cpb;
-	  if (ctx->comp.comp_tail == 0)
-	    {
-	      if (buf)
-		{
-		  grub_memset (buf, 0, nn * GRUB_NTFS_COM_LEN);
-		  buf += nn * GRUB_NTFS_COM_LEN;
-		  if (grub_file_progress_hook && ctx->file)
-		    grub_file_progress_hook (0, 0, nn * GRUB_NTFS_COM_LEN, NULL,
-					     ctx->file);
-		}
-	    }
-	  else
-	    {
-	      while (nn)
-		{
-		  if (decomp_block (&ctx->comp, buf))
-		    return grub_errno;
-		  if (buf)
-		    buf += GRUB_NTFS_COM_LEN;
-		  if (grub_file_progress_hook && ctx->file)
-		    grub_file_progress_hook (0, 0, GRUB_NTFS_COM_LEN, NULL,
-					     ctx->file);
-		  nn--;
-		}
-	    }
+	  if (decomp_block (src, cnt, dest + done))
+	    return grub_errno;
 	}
       else
 	{
-	  nn <<= log_cpb;
-	  while ((ctx->comp.comp_head < ctx->comp.comp_tail) && (nn))
-	    {
-	      grub_disk_addr_t tt;
-
-	      tt =
-		ctx->comp.comp_table[ctx->comp.comp_head].next_vcn -
-		ctx->target_vcn;
-	      if (tt > nn)
-		tt = nn;
-	      ctx->target_vcn += tt;
-	      if (buf)
-		{
-		  if (grub_disk_read
-		      (ctx->comp.disk,
-		       (ctx->comp.comp_table[ctx->comp.comp_head].next_lcn -
-			(ctx->comp.comp_table[ctx->comp.comp_head].next_vcn -
-			 ctx->target_vcn)) << ctx->comp.log_spc, 0,
-		       tt << (ctx->comp.log_spc + GRUB_NTFS_BLK_SHR), buf))
-		    return grub_errno;
-		  if (grub_file_progress_hook && ctx->file)
-		    grub_file_progress_hook (0, 0,
-					     tt << (ctx->comp.log_spc
-						    + GRUB_NTFS_BLK_SHR), NULL,
-					     ctx->file);
-		  buf += tt << (ctx->comp.log_spc + GRUB_NTFS_BLK_SHR);
-		}
-	      nn -= tt;
-	      if (ctx->target_vcn >=
-		  ctx->comp.comp_table[ctx->comp.comp_head].next_vcn)
-		ctx->comp.comp_head++;
-	    }
-	  if (nn)
-	    {
-	      if (buf)
-		{
-		  if (grub_disk_read
-		      (ctx->comp.disk,
-		       (ctx->target_vcn - ctx->curr_vcn +
-			ctx->curr_lcn) << ctx->comp.log_spc, 0,
-		       nn << (ctx->comp.log_spc + GRUB_NTFS_BLK_SHR), buf))
-		    return grub_errno;
-		  buf += nn << (ctx->comp.log_spc + GRUB_NTFS_BLK_SHR);
-		  if (grub_file_progress_hook && ctx->file)
-		    grub_file_progress_hook (0, 0,
-					     nn << (ctx->comp.log_spc
-						    + GRUB_NTFS_BLK_SHR), NULL,
-					     ctx->file);
-		}
-	      ctx->target_vcn += nn;
-	    }
+	  if (cnt != GRUB_NTFS_COM_LEN)
+	    return grub_error (GRUB_ERR_BAD_FS,
+			       "invalid compression block size");
+	  grub_memcpy (dest + done, src, cnt);
 	}
+      src += cnt;
     }
+
+  grub_memset (dest + done, 0, unit_size - done);
   return 0;
 }
 
+/* Read the unit starting at VCN into UNIT.  A unit is stored as is when
+   it has all its clusters, compressed when it is followed by a hole and
+   is a hole when it has none.  */
 static grub_err_t
-ntfscomp (grub_uint8_t *dest, grub_disk_addr_t ofs,
-	  grub_size_t len, struct grub_ntfs_rlst *ctx)
+read_unit (struct grub_ntfs_rlst *ctx, grub_disk_addr_t vcn,
+	   struct grub_ntfs_comp_unit *unit)
 {
-  grub_err_t ret;
-  grub_disk_addr_t vcn;
+  struct grub_ntfs_attr *at = ctx->attr;
+  int cshift = ctx->comp.log_spc + GRUB_NTFS_BLK_SHR;
+  grub_size_t unit_size = (grub_size_t) 1 << (cshift + GRUB_NTFS_LOG_COM_UNIT);
+  grub_disk_addr_t cur = vcn, end = vcn + (1 << GRUB_NTFS_LOG_COM_UNIT);
 
-  if (ctx->attr->sbuf)
+  while (cur < end)
     {
-      if ((ofs & (~(GRUB_NTFS_COM_LEN - 1))) == ctx->attr->save_pos)
-	{
-	  grub_disk_addr_t n;
-
-	  n = GRUB_NTFS_COM_LEN - (ofs - ctx->attr->save_pos);
-	  if (n > len)
-	    n = len;
+      grub_disk_addr_t cnt;
 
-	  grub_memcpy (dest, ctx->attr->sbuf + ofs - ctx->attr->save_pos, n);
-	  if (grub_file_progress_hook && ctx->file)
-	    grub_file_progress_hook (0, 0, n, NULL, ctx->file);
-	  if (n == len)
-	    return 0;
-
-	  dest += n;
-	  len -= n;
-	  ofs += n;
+      while (ctx->next_vcn <= cur)
+	{
+	  if (grub_ntfs_read_run_list (ctx))
+	    return grub_errno;
 	}
-    }
-  else
-    {
-      ctx->attr->sbuf = grub_malloc (GRUB_NTFS_COM_LEN);
-      if (ctx->attr->sbuf == NULL)
-	return grub_errno;
-      ctx->attr->save_pos = 1;
-    }
+      if (ctx->flags & GRUB_NTFS_RF_BLNK)
+	break;
 
-  vcn = ctx->target_vcn = (ofs >> GRUB_NTFS_COM_LOG_LEN) * (GRUB_NTFS_COM_SEC >> ctx->comp.log_spc);
-  ctx->target_vcn &= ~0xFULL;
-  while (ctx->next_vcn <= ctx->target_vcn)
-    {
-      if (grub_ntfs_read_run_list (ctx))
+      cnt = grub_min (ctx->next_vcn, end) - cur;
+      if (grub_disk_read (ctx->comp.disk,
+			  (cur - ctx->curr_vcn + ctx->curr_lcn)
+			  << ctx->comp.log_spc, 0, cnt << cshift,
+			  at->comp_raw + ((cur - vcn) << cshift)))
 	return grub_errno;
+      cur += cnt;
     }
 
-  ctx->comp.comp_head = ctx->comp.comp_tail = 0;
-  ctx->comp.cbuf = grub_malloc (1 << (ctx->comp.log_spc + GRUB_NTFS_BLK_SHR));
-  if (!ctx->comp.cbuf)
-    return 0;
-
-  ret = 0;
-
-  //ctx->comp.disk->read_hook = read_hook;
-  //ctx->comp.disk->read_hook_data = read_hook_data;
+  if (cur == end)
+    {
+      grub_uint8_t *t = unit->buf;
 
-  if ((vcn > ctx->target_vcn) &&
-      (read_block
-       (ctx, NULL, (vcn - ctx->target_vcn) >> (GRUB_NTFS_LOG_COM_SEC - ctx->comp.log_spc))))
+      unit->buf = at->comp_raw;
+      at->comp_raw = t;
+      return 0;
+    }
+  if (cur == vcn)
     {
-      ret = grub_errno;
-      goto quit;
+      grub_memset (unit->buf, 0, unit_size);
+      return 0;
     }
+  return decomp_unit (at->comp_raw, (cur - vcn) << cshift, unit->buf,
+		      unit_size);
+}
 
-  if (ofs % GRUB_NTFS_COM_LEN)
-    {
-      grub_uint32_t t, n, o;
-      void *file = ctx->file;
+/* Return the unit starting at VCN, from the cache if it is there.  */
+static struct grub_ntfs_comp_unit *
+get_unit (struct grub_ntfs_rlst *ctx, grub_disk_addr_t vcn)
+{
+  struct grub_ntfs_attr *at = ctx->attr;
+  grub_size_t unit_size = (grub_size_t) 1 << (ctx->comp.log_spc
+					      + GRUB_NTFS_BLK_SHR
+					      + GRUB_NTFS_LOG_COM_UNIT);
+  struct grub_ntfs_comp_unit *unit;
+  unsigned i;
+
+  for (i = 0; i < GRUB_NTFS_COMP_CACHE_SIZE; i++)
+    if (at->comp_units[i].vcn == vcn)
+      return &at->comp_units[i];
+
+  unit = &at->comp_units[at->comp_next];
+  unit->vcn = (grub_disk_addr_t) -1;
+  if (!unit->buf)
+    unit->buf = grub_malloc (unit_size);
+  if (!at->comp_raw)
+    at->comp_raw = grub_malloc (unit_size);
+  if (!unit->buf || !at->comp_raw)
+    return NULL;
+
+  if (read_unit (ctx, vcn, unit))
+    return NULL;
+
+  unit->vcn = vcn;
+  at->comp_next = (at->comp_next + 1) % GRUB_NTFS_COMP_CACHE_SIZE;
+  return unit;
+}
 
-      ctx->file = 0;
+static grub_err_t
+ntfscomp (grub_uint8_t *dest, grub_disk_addr_t ofs,
+	  grub_size_t len, struct grub_ntfs_rlst *ctx)
+{
+  int ushift = ctx->comp.log_spc + GRUB_NTFS_BLK_SHR + GRUB_NTFS_LOG_COM_UNIT;
+  grub_size_t unit_size = (grub_size_t) 1 << ushift;
 
-      t = ctx->target_vcn << (ctx->comp.log_spc + GRUB_NTFS_BLK_SHR);
-      if (read_block (ctx, ctx->attr->sbuf, 1))
-	{
-	  ret = grub_errno;
-	  goto quit;
-	}
+  /* NTFS doesn't compress with larger clusters.  */
+  if (ctx->comp.log_spc > GRUB_NTFS_LOG_COM_SEC)
+    return grub_error (GRUB_ERR_BAD_FS, "invalid compression block");
 
-      ctx->file = file;
+  while (len)
+    {
+      struct grub_ntfs_comp_unit *unit;
+      grub_size_t o, n;
 
-      ctx->attr->save_pos = t;
+      unit = get_unit (ctx, (ofs >> ushift) << GRUB_NTFS_LOG_COM_UNIT);
+      if (!unit)
+	return grub_errno;
 
-      o = ofs % GRUB_NTFS_COM_LEN;
-      n = GRUB_NTFS_COM_LEN - o;
+      o = ofs & (unit_size - 1);
+      n = unit_size - o;
       if (n > len)
 	n = len;
-      grub_memcpy (dest, &ctx->attr->sbuf[o], n);
+      grub_memcpy (dest, unit->buf + o, n);
       if (grub_file_progress_hook && ctx->file)
 	grub_file_progress_hook (0, 0, n, NULL, ctx->file);
-      if (n == len)
-	goto quit;
+
       dest += n;
+      ofs += n;
       len -= n;
     }
 
-  if (read_block (ctx, dest, len / GRUB_NTFS_COM_LEN))
-    {
-      ret = grub_errno;
-      goto quit;
-    }
-
-  dest += (len / GRUB_NTFS_COM_LEN) * GRUB_NTFS_COM_LEN;
-  len = len % GRUB_NTFS_COM_LEN;
-  if (len)
-    {
-      grub_uint32_t t;
-      void *file = ctx->file;
-
-      ctx->file = 0;
-      t = ctx->target_vcn << (ctx->comp.log_spc + GRUB_NTFS_BLK_SHR);
-      if (read_block (ctx, ctx->attr->sbuf, 1))
-	{
-	  ret = grub_errno;
-	  goto quit;
-	}
-
-      ctx->attr->save_pos = t;
-
-      grub_memcpy (dest, ctx->attr->sbuf, len);
-      if (grub_file_progress_hook && file)
-	grub_file_progress_hook (0, 0, len, NULL, file);
-    }
-
-quit:
-  //ctx->comp.disk->read_hook = 0;
-  if (ctx->comp.cbuf)
-    grub_free (ctx->comp.cbuf);
-  return ret;
+  return 0;
 }
 
 GRUB_MOD_INIT (ntfscomp)
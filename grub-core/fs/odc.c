@@ -58,4 +58,5 @@ GRUB_MOD_INIT (odc)
 GRUB_MOD_FINI (odc)
 {
   grub_fs_unregister (&grub_cpio_fs);
+  grub_fshelp_mount_flush (FSNAME);
 }
@@ -17,6 +17,9 @@
  *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+/* Needed for the custom allocator of zstd, see btrfs.c.  */
+#define ZSTD_STATIC_LINKING_ONLY
+
 #include <grub/err.h>
 #include <grub/file.h>
 #include <grub/mm.h>
@@ -27,7 +30,9 @@
 #include <grub/fshelp.h>
 #include <grub/deflate.h>
 #include <grub/safemath.h>
+#include <grub/lz4.h>
 #include <minilzo.h>
+#include <zstd.h>
 
 #include "xz.h"
 #include "xz_stream.h"
@@ -184,12 +189,28 @@ enum
     COMPRESSION_ZLIB = 1,
     COMPRESSION_LZO = 3,
     COMPRESSION_XZ = 4,
+    COMPRESSION_LZ4 = 5,
+    COMPRESSION_ZSTD = 6,
   };
 
 
 #define SQUASH_CHUNK_SIZE 0x2000
 #define XZBUFSIZ 0x2000
 
+/* Decompressed metadata chunks and data and fragment blocks kept by a
+   mount.  */
+#define SQUASH_CACHE_SIZE 16
+#define SQUASH_CACHE_BYTES (2 << 20)
+
+struct grub_squash_cache_block
+{
+  grub_uint64_t pos;
+  unsigned long last_use;
+  grub_size_t alloc;
+  grub_size_t size;
+  char *buf;
+};
+
 struct grub_squash_data
 {
   grub_disk_t disk;
@@ -203,6 +224,13 @@ struct grub_squash_data
 			      struct grub_squash_data *data);
   struct xz_dec *xzdec;
   char *xzbuf;
+  ZSTD_DCtx *zstd_dctx;
+  /* Whole block buffer for partial lz4 and zstd reads.  */
+  char *ubuf;
+  grub_size_t ubufsz;
+  unsigned long cache_clock;
+  grub_size_t cache_bytes;
+  struct grub_squash_cache_block cache[SQUASH_CACHE_SIZE];
 };
 
 struct grub_fshelp_node
@@ -217,6 +245,94 @@ struct grub_fshelp_node
   } stack[1];
 };
 
+/* Decompress LEN bytes at offset OFF of the compressed block of CSIZE
+   bytes starting at byte POS of the disk, which holds at most USIZE
+   bytes.  Whole blocks are decompressed and kept in a small LRU, so that
+   metadata chunks and fragments shared by many files are only
+   decompressed once.  Return the number of bytes copied to BUF, which is
+   less than LEN if the block is shorter, or -1 on error.  */
+static grub_ssize_t
+read_compressed (struct grub_squash_data *data, grub_uint64_t pos,
+		 grub_size_t csize, grub_size_t usize,
+		 grub_off_t off, char *buf, grub_size_t len)
+{
+  struct grub_squash_cache_block *e = NULL, *slot, *lru;
+  char *in, *out = NULL;
+  grub_ssize_t r;
+  unsigned i;
+
+  for (i = 0; i < SQUASH_CACHE_SIZE; i++)
+    if (data->cache[i].buf && data->cache[i].pos == pos)
+      {
+	e = &data->cache[i];
+	goto copy;
+      }
+
+  in = grub_malloc (csize);
+  if (!in)
+    return -1;
+  if (grub_disk_read (data->disk, pos >> GRUB_DISK_SECTOR_BITS,
+		      pos & (GRUB_DISK_SECTOR_SIZE - 1), csize, in))
+    {
+      grub_free (in);
+      return -1;
+    }
+
+  if (usize <= SQUASH_CACHE_BYTES)
+    out = grub_malloc (usize);
+  if (!out)
+    {
+      /* Too big to cache, or no memory for it.  */
+      grub_errno = GRUB_ERR_NONE;
+      r = data->decompress (in, csize, off, buf, len, data);
+      grub_free (in);
+      return r;
+    }
+
+  r = data->decompress (in, csize, 0, out, usize, data);
+  grub_free (in);
+  if (r < 0)
+    {
+      grub_free (out);
+      return -1;
+    }
+
+  /* Make room, evicting the least recently used blocks.  */
+  while (1)
+    {
+      slot = lru = NULL;
+      for (i = 0; i < SQUASH_CACHE_SIZE; i++)
+	if (!data->cache[i].buf)
+	  {
+	    if (!slot)
+	      slot = &data->cache[i];
+	  }
+	else if (!lru || data->cache[i].last_use < lru->last_use)
+	  lru = &data->cache[i];
+      if (slot && data->cache_bytes + usize <= SQUASH_CACHE_BYTES)
+	break;
+      data->cache_bytes -= lru->alloc;
+      grub_free (lru->buf);
+      lru->buf = NULL;
+    }
+
+  e = slot;
+  e->pos = pos;
+  e->alloc = usize;
+  e->size = r;
+  e->buf = out;
+  data->cache_bytes += usize;
+
+ copy:
+  e->last_use = ++data->cache_clock;
+  if (off >= e->size)
+    return 0;
+  if (len > e->size - off)
+    len = e->size - off;
+  grub_memcpy (buf, e->buf + off, len);
+  return len;
+}
+
 static grub_err_t
 read_chunk (struct grub_squash_data *data, void *buf, grub_size_t len,
 	    grub_uint64_t chunk_start, grub_off_t offset)
@@ -255,29 +371,16 @@ read_chunk (struct grub_squash_data *data, void *buf, grub_size_t len,
 	}
       else
 	{
-	  char *tmp;
 	  grub_size_t bsize = grub_le_to_cpu16 (d) & ~SQUASH_CHUNK_FLAGS;
-	  grub_disk_addr_t a = chunk_start + 2;
-	  tmp = grub_malloc (bsize);
-	  if (!tmp)
-	    return grub_errno;
-	  /* FIXME: buffer uncompressed data.  */
-	  err = grub_disk_read (data->disk, (a >> GRUB_DISK_SECTOR_BITS),
-				a & (GRUB_DISK_SECTOR_SIZE - 1),
-				bsize, tmp);
-	  if (err)
-	    {
-	      grub_free (tmp);
-	      return err;
-	    }
+	  grub_ssize_t r;
 
-	  if (data->decompress (tmp, bsize, offset,
-				buf, csize, data) < 0)
-	    {
-	      grub_free (tmp);
-	      return grub_errno;
-	    }
-	  grub_free (tmp);
+	  r = read_compressed (data, chunk_start + 2, bsize, SQUASH_CHUNK_SIZE,
+			       offset, buf, csize);
+	  if (r < 0)
+	    return grub_errno;
+	  /* The last chunk of a table may be short.  */
+	  if ((grub_size_t) r < csize)
+	    grub_memset ((char *) buf + r, 0, csize - r);
 	}
       len -= csize;
       offset += csize;
@@ -378,6 +481,101 @@ xz_decompress (char *inbuf, grub_size_t insize, grub_off_t off,
   return ret;
 }
 
+static void *
+grub_zstd_malloc (void *state __attribute__ ((unused)), size_t size)
+{
+  return grub_malloc (size);
+}
+
+static void
+grub_zstd_free (void *state __attribute__ ((unused)), void *address)
+{
+  grub_free (address);
+}
+
+static ZSTD_customMem
+grub_zstd_allocator (void)
+{
+  ZSTD_customMem allocator;
+
+  allocator.customAlloc = &grub_zstd_malloc;
+  allocator.customFree = &grub_zstd_free;
+  allocator.opaque = NULL;
+
+  return allocator;
+}
+
+static grub_ssize_t
+lz4_decode (char *inbuf, grub_size_t insize, char *outbuf,
+	    grub_size_t outsize, struct grub_squash_data *data
+	    __attribute__ ((unused)))
+{
+  return grub_lz4_decompress (inbuf, insize, outbuf, outsize);
+}
+
+static grub_ssize_t
+zstd_decode (char *inbuf, grub_size_t insize, char *outbuf,
+	     grub_size_t outsize, struct grub_squash_data *data)
+{
+  grub_size_t ret;
+
+  ret = ZSTD_decompressDCtx (data->zstd_dctx, outbuf, outsize, inbuf, insize);
+  if (ZSTD_isError (ret))
+    {
+      grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, "zstd data corrupted");
+      return -1;
+    }
+  return ret;
+}
+
+/* Decompress LEN bytes at offset OFF of a block with DECODE, which like
+   lz4 and zstd can only produce the whole block.  A read of the start of
+   the block with enough room goes straight to OUTBUF; anything else goes
+   through the mount's block buffer.  */
+static grub_ssize_t
+block_decompress (grub_ssize_t (*decode) (char *inbuf, grub_size_t insize,
+					  char *outbuf, grub_size_t outsize,
+					  struct grub_squash_data *data),
+		  char *inbuf, grub_size_t insize, grub_off_t off,
+		  char *outbuf, grub_size_t len, struct grub_squash_data *data)
+{
+  grub_ssize_t r;
+
+  if (off == 0 && len >= data->ubufsz)
+    return decode (inbuf, insize, outbuf, len, data);
+
+  if (!data->ubuf)
+    {
+      data->ubuf = grub_malloc (data->ubufsz);
+      if (!data->ubuf)
+	return -1;
+    }
+
+  r = decode (inbuf, insize, data->ubuf, data->ubufsz, data);
+  if (r < 0)
+    return -1;
+  if (off >= (grub_uint64_t) r)
+    return 0;
+  if (len > r - off)
+    len = r - off;
+  grub_memcpy (outbuf, data->ubuf + off, len);
+  return len;
+}
+
+static grub_ssize_t
+lz4_decompress (char *inbuf, grub_size_t insize, grub_off_t off,
+		char *outbuf, grub_size_t len, struct grub_squash_data *data)
+{
+  return block_decompress (lz4_decode, inbuf, insize, off, outbuf, len, data);
+}
+
+static grub_ssize_t
+zstd_decompress (char *inbuf, grub_size_t insize, grub_off_t off,
+		 char *outbuf, grub_size_t len, struct grub_squash_data *data)
+{
+  return block_decompress (zstd_decode, inbuf, insize, off, outbuf, len, data);
+}
+
 static struct grub_squash_data *
 squash_mount (grub_disk_t disk)
 {
@@ -386,6 +584,13 @@ squash_mount (grub_disk_t disk)
   struct grub_squash_data *data;
   grub_uint64_t frag;
 
+  data = grub_fshelp_mount_get ("squash4", disk);
+  if (data)
+    {
+      data->disk = disk;
+      return data;
+    }
+
   err = grub_disk_read (disk, 0, 0, sizeof (sb), &sb);
   if (grub_errno == GRUB_ERR_OUT_OF_RANGE)
     grub_error (GRUB_ERR_BAD_FS, "not a squash4");
@@ -440,6 +645,21 @@ squash_mount (grub_disk_t disk)
 	  return NULL;
 	}
       break;
+    case grub_cpu_to_le16_compile_time (COMPRESSION_LZ4):
+      data->decompress = lz4_decompress;
+      break;
+    case grub_cpu_to_le16_compile_time (COMPRESSION_ZSTD):
+      data->decompress = zstd_decompress;
+      /* ZSTD_createDCtx_advanced () only fails if it is out of memory.  */
+      data->zstd_dctx = ZSTD_createDCtx_advanced (grub_zstd_allocator ());
+      if (!data->zstd_dctx)
+	{
+	  grub_free (data);
+	  grub_error (GRUB_ERR_OUT_OF_MEMORY,
+		      "failed to create a zstd context");
+	  return NULL;
+	}
+      break;
     default:
       grub_free (data);
       grub_error (GRUB_ERR_BAD_FS, "unsupported compression %d",
@@ -451,6 +671,8 @@ squash_mount (grub_disk_t disk)
   for (data->log2_blksz = 0;
        (1U << data->log2_blksz) < data->blksz;
        data->log2_blksz++);
+  /* Metadata blocks hold up to 8 KiB whatever the data block size.  */
+  data->ubufsz = data->blksz < 8192 ? 8192 : data->blksz;
 
   return data;
 }
@@ -661,14 +883,32 @@ make_root_node (struct grub_squash_data *data, struct grub_fshelp_node *root)
 }
 
 static void
-squash_unmount (struct grub_squash_data *data)
+squash_free (void *ptr)
 {
+  struct grub_squash_data *data = ptr;
+  unsigned i;
+
+  for (i = 0; i < SQUASH_CACHE_SIZE; i++)
+    grub_free (data->cache[i].buf);
   if (data->xzdec)
     xz_dec_end (data->xzdec);
   grub_free (data->xzbuf);
+  if (data->zstd_dctx)
+    ZSTD_freeDCtx (data->zstd_dctx);
+  grub_free (data->ubuf);
+  grub_free (data);
+}
+
+/* Release DATA, keeping the mount and its decompressor for the next
+   user of its disk.  */
+static void
+squash_unmount (struct grub_squash_data *data)
+{
   grub_free (data->ino.cumulated_block_sizes);
   grub_free (data->ino.block_sizes);
-  grub_free (data);
+  data->ino.cumulated_block_sizes = NULL;
+  data->ino.block_sizes = NULL;
+  grub_fshelp_mount_put ("squash4", data->disk, data, squash_free);
 }
 
 
@@ -691,6 +931,17 @@ grub_squash_dir_iter (const char *filename, enum grub_fshelp_filetype filetype,
   info.dir = ((filetype & GRUB_FSHELP_TYPE_MASK) == GRUB_FSHELP_DIR);
   info.mtimeset = 1;
   info.mtime = grub_le_to_cpu32 (node->ino.mtime);
+  switch (node->ino.type)
+    {
+    case grub_cpu_to_le16_compile_time (SQUASH_TYPE_LONG_REGULAR):
+      info.sizeset = 1;
+      info.size = grub_le_to_cpu64 (node->ino.long_file.size);
+      break;
+    case grub_cpu_to_le16_compile_time (SQUASH_TYPE_REGULAR):
+      info.sizeset = 1;
+      info.size = grub_le_to_cpu32 (node->ino.file.size);
+      break;
+    }
   grub_free (node);
   return ctx->hook (filename, &info, ctx->hook_data);
 }
@@ -711,7 +962,10 @@ grub_squash_dir (grub_device_t device, const char *path,
 
   err = make_root_node (data, &root);
   if (err)
-    return err;
+    {
+      squash_unmount (data);
+      return err;
+    }
 
   grub_fshelp_find_file (path, &root, &fdiro, grub_squash_iterate_dir,
 			 grub_squash_read_symlink, GRUB_FSHELP_DIR);
@@ -737,7 +991,10 @@ grub_squash_open (struct grub_file *file, const char *name)
 
   err = make_root_node (data, &root);
   if (err)
-    return err;
+    {
+      squash_unmount (data);
+      return err;
+    }
 
   grub_fshelp_find_file (name, &root, &fdiro, grub_squash_iterate_dir,
 			 grub_squash_read_symlink, GRUB_FSHELP_REG);
@@ -866,32 +1123,16 @@ direct_read (struct grub_squash_data *data,
       else if (!(ino->block_sizes[i]
 	    & grub_cpu_to_le32_compile_time (SQUASH_BLOCK_UNCOMPRESSED)))
 	{
-	  char *block;
 	  grub_size_t csize;
 	  csize = grub_le_to_cpu32 (ino->block_sizes[i]) & ~SQUASH_BLOCK_FLAGS;
-	  block = grub_malloc (csize);
-	  if (!block)
-	    return -1;
-	  err = grub_disk_read (data->disk,
-				(ino->cumulated_block_sizes[i] + a)
-				>> GRUB_DISK_SECTOR_BITS,
-				(ino->cumulated_block_sizes[i] + a)
-				& (GRUB_DISK_SECTOR_SIZE - 1),
-				csize, block);
-	  if (err)
-	    {
-	      grub_free (block);
-	      return -1;
-	    }
-	  if (data->decompress (block, csize, boff, buf, curread, data)
+	  if (read_compressed (data, ino->cumulated_block_sizes[i] + a, csize,
+			       data->blksz, boff, buf, curread)
 	      != (grub_ssize_t) curread)
 	    {
-	      grub_free (block);
 	      if (!grub_errno)
 		grub_error (GRUB_ERR_BAD_FS, "incorrect compressed chunk");
 	      return -1;
 	    }
-	  grub_free (block);
 	}
       else
 	err = grub_disk_read (data->disk,
@@ -970,32 +1211,16 @@ grub_squash_read (grub_file_t file, char *buf, grub_size_t len)
   else
     b = grub_le_to_cpu32 (ino->ino.file.offset) + off;
 
-  /* FIXME: cache uncompressed chunks.  */
   if (compressed)
     {
-      char *block;
-      block = grub_malloc (grub_le_to_cpu32 (frag.size));
-      if (!block)
-	return -1;
-      err = grub_disk_read (data->disk,
-			    a >> GRUB_DISK_SECTOR_BITS,
-			    a & (GRUB_DISK_SECTOR_SIZE - 1),
-			    grub_le_to_cpu32 (frag.size), block);
-      if (err)
-	{
-	  grub_free (block);
-	  return -1;
-	}
-      if (data->decompress (block, grub_le_to_cpu32 (frag.size),
-			    b, buf, len, data)
+      if (read_compressed (data, a, grub_le_to_cpu32 (frag.size),
+			   data->blksz, b, buf, len)
 	  != (grub_ssize_t) len)
 	{
-	  grub_free (block);
 	  if (!grub_errno)
 	    grub_error (GRUB_ERR_BAD_FS, "incorrect compressed chunk");
 	  return -1;
 	}
-      grub_free (block);
     }
   else
     {
@@ -1050,5 +1275,6 @@ GRUB_MOD_INIT(squash4)
 GRUB_MOD_FINI(squash4)
 {
   grub_fs_unregister (&grub_squash_fs);
+  grub_fshelp_mount_flush ("squash4");
 }
 
@@ -20,6 +20,7 @@
 #include <grub/misc.h>
 #include <grub/disk.h>
 #include <grub/archelp.h>
+#include <grub/fshelp.h>
 
 #include <grub/file.h>
 #include <grub/mm.h>
@@ -67,6 +68,7 @@ struct grub_archelp_data
   grub_off_t size;
   char *linkname;
   grub_size_t linkname_alloc;
+  struct grub_archelp_index *index;
 };
 
 static grub_err_t
@@ -217,19 +219,64 @@ grub_cpio_rewind (struct grub_archelp_data *data)
   data->next_hofs = 0;
 }
 
+static struct grub_archelp_index **
+grub_cpio_get_index (struct grub_archelp_data *data)
+{
+  return &data->index;
+}
+
+static grub_off_t
+grub_cpio_tell (struct grub_archelp_data *data)
+{
+  return data->next_hofs;
+}
+
+static void
+grub_cpio_seek (struct grub_archelp_data *data, grub_off_t pos)
+{
+  data->next_hofs = pos;
+}
+
 static struct grub_archelp_ops arcops =
   {
     .find_file = grub_cpio_find_file,
     .get_link_target = grub_cpio_get_link_target,
-    .rewind = grub_cpio_rewind
+    .rewind = grub_cpio_rewind,
+    .get_index = grub_cpio_get_index,
+    .tell = grub_cpio_tell,
+    .seek = grub_cpio_seek
   };
 
+static void
+grub_cpio_free (void *ptr)
+{
+  struct grub_archelp_data *data = ptr;
+
+  grub_archelp_free_index (data->index);
+  grub_free (data->linkname);
+  grub_free (data);
+}
+
+/* Release DATA, keeping it and its index for the next user of its disk.  */
+static void
+grub_cpio_unmount (struct grub_archelp_data *data)
+{
+  grub_fshelp_mount_put ("tarfs", data->disk, data, grub_cpio_free);
+}
+
 static struct grub_archelp_data *
 grub_cpio_mount (grub_disk_t disk)
 {
   struct head hd;
   struct grub_archelp_data *data;
 
+  data = grub_fshelp_mount_get ("tarfs", disk);
+  if (data)
+    {
+      data->disk = disk;
+      return data;
+    }
+
   if (grub_disk_read (disk, 0, 0, sizeof (hd), &hd))
     goto fail;
 
@@ -263,8 +310,7 @@ grub_cpio_dir (grub_device_t device, const char *path_in,
   err = grub_archelp_dir (data, &arcops,
 			  path_in, hook, hook_data);
 
-  grub_free (data->linkname);
-  grub_free (data);
+  grub_cpio_unmount (data);
 
   return err;
 }
@@ -281,10 +327,7 @@ grub_cpio_open (grub_file_t file, const char *name_in)
 
   err = grub_archelp_open (data, &arcops, name_in);
   if (err)
-    {
-      grub_free (data->linkname);
-      grub_free (data);
-    }
+    grub_cpio_unmount (data);
   else
     {
       file->data = data;
@@ -316,8 +359,7 @@ grub_cpio_close (grub_file_t file)
   struct grub_archelp_data *data;
 
   data = file->data;
-  grub_free (data->linkname);
-  grub_free (data);
+  grub_cpio_unmount (data);
 
   return grub_errno;
 }
@@ -342,4 +384,5 @@ GRUB_MOD_INIT (tar)
 GRUB_MOD_FINI (tar)
 {
   grub_fs_unregister (&grub_cpio_fs);
+  grub_fshelp_mount_flush ("tarfs");
 }
@@ -29,6 +29,7 @@
 #include <grub/datetime.h>
 #include <grub/udf.h>
 #include <grub/safemath.h>
+#include <grub/i18n.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -114,6 +115,19 @@ GRUB_MOD_LICENSE ("GPLv3+");
 #define GRUB_UDF_PARTMAP_TYPE_1		1
 #define GRUB_UDF_PARTMAP_TYPE_2		2
 
+#define GRUB_UDF_PARTMAP_IDENT_SPARABLE	"*UDF Sparable Partition"
+#define GRUB_UDF_PARTMAP_IDENT_METADATA	"*UDF Metadata Partition"
+#define GRUB_UDF_SPARING_IDENT		"*UDF Sparing Table"
+
+/* Sparing table entries past the used ones have original locations
+   from here on.  */
+#define GRUB_UDF_SPARE_UNUSED		0xfffffff0
+
+/* Files whose allocation descriptors are kept decoded in the mount.  */
+#define GRUB_UDF_EXTENT_CACHE_SIZE	8
+/* Bound on the allocation extent descriptors chained from one file.  */
+#define GRUB_UDF_MAX_AEDS		65536
+
 #define GRUB_UDF_INVALID_STRUCT_PTR(_ptr, _struct)	\
   ((char *) (_ptr) >= end_ptr || \
    ((grub_ssize_t) (end_ptr - (char *) (_ptr)) < (grub_ssize_t) sizeof (_struct)))
@@ -321,11 +335,52 @@ struct grub_udf_partmap
 
     struct
     {
-      grub_uint8_t ident[62];
+      grub_uint16_t reserved;
+      struct grub_udf_regid ident;
+      grub_uint16_t seq_num;
+      grub_uint16_t part_num;
+      union
+      {
+	struct
+	{
+	  grub_uint16_t packet_len;
+	  grub_uint8_t num_tables;
+	  grub_uint8_t reserved;
+	  grub_uint32_t table_size;
+	  grub_uint32_t table_loc[4];
+	} sparable;
+
+	struct
+	{
+	  grub_uint32_t file_loc;
+	  grub_uint32_t mirror_loc;
+	  grub_uint32_t bitmap_loc;
+	  grub_uint32_t alloc_unit;
+	  grub_uint16_t align_unit;
+	  grub_uint8_t flags;
+	  grub_uint8_t reserved[5];
+	} metadata;
+      };
     } type2;
   };
 } GRUB_PACKED;
 
+struct grub_udf_sparing_entry
+{
+  grub_uint32_t orig;
+  grub_uint32_t mapped;
+} GRUB_PACKED;
+
+struct grub_udf_sparing_table
+{
+  struct grub_udf_tag tag;
+  struct grub_udf_regid ident;
+  grub_uint16_t num_entries;
+  grub_uint16_t reserved;
+  grub_uint32_t seq_num;
+  struct grub_udf_sparing_entry entries[0];
+} GRUB_PACKED;
+
 struct grub_udf_pvd
 {
   struct grub_udf_tag tag;
@@ -376,6 +431,50 @@ struct grub_udf_aed
   grub_uint32_t ae_len;
 } GRUB_PACKED;
 
+/* An extent of a file, in CPU byte order.  BLOCK is relative to the
+   partition of partition map PART.  */
+struct grub_udf_extent
+{
+  grub_uint64_t offset;
+  grub_uint32_t length;
+  grub_uint32_t block;
+  grub_uint16_t part;
+  grub_uint8_t sparse;
+};
+
+/* The decoded allocation descriptors of the file entry at ICB_BLOCK,
+   sorted by file offset.  */
+struct grub_udf_extent_list
+{
+  grub_uint32_t icb_block;
+  unsigned long last_use;
+  grub_size_t count;
+  struct grub_udf_extent *extents;
+};
+
+enum grub_udf_part_type
+  {
+    GRUB_UDF_PART_PHYSICAL,
+    GRUB_UDF_PART_SPARABLE,
+    GRUB_UDF_PART_METADATA
+  };
+
+/* A partition map resolved at mount.  Sparable partitions keep their
+   sparing table sorted by original packet, metadata partitions the
+   extents of their metadata file, which lies in partition map PHYS.  */
+struct grub_udf_part
+{
+  enum grub_udf_part_type type;
+  int pd;
+  grub_uint32_t start;
+  grub_uint32_t packet_mask;
+  grub_size_t nspares;
+  struct grub_udf_sparing_entry *spares;
+  int phys;
+  grub_size_t nmeta;
+  struct grub_udf_extent *meta;
+};
+
 struct grub_udf_data
 {
   grub_disk_t disk;
@@ -383,14 +482,18 @@ struct grub_udf_data
   struct grub_udf_lvd lvd;
   struct grub_udf_pd pds[GRUB_UDF_MAX_PDS];
   struct grub_udf_partmap *pms[GRUB_UDF_MAX_PMS];
+  struct grub_udf_part parts[GRUB_UDF_MAX_PMS];
   struct grub_udf_long_ad root_icb;
   int npd, npm, lbshift;
+  unsigned long extent_clock;
+  struct grub_udf_extent_list extent_lists[GRUB_UDF_EXTENT_CACHE_SIZE];
 };
 
 struct grub_fshelp_node
 {
   struct grub_udf_data *data;
   int part_ref;
+  grub_uint32_t icb_block;
   union
   {
     struct grub_udf_file_entry fe;
@@ -410,11 +513,64 @@ get_fshelp_size (struct grub_udf_data *data)
 
 static grub_dl_t my_mod;
 
+static void
+grub_udf_free (void *ptr)
+{
+  struct grub_udf_data *data = ptr;
+  int i;
+
+  if (!data)
+    return;
+
+  for (i = 0; i < GRUB_UDF_MAX_PMS; i++)
+    {
+      grub_free (data->parts[i].spares);
+      grub_free (data->parts[i].meta);
+    }
+  for (i = 0; i < GRUB_UDF_EXTENT_CACHE_SIZE; i++)
+    grub_free (data->extent_lists[i].extents);
+  grub_free (data);
+}
+
+/* Release DATA, keeping the mount with its partition maps and decoded
+   extents for the next user of its disk.  */
+static void
+grub_udf_unmount (struct grub_udf_data *data)
+{
+  if (data)
+    grub_fshelp_mount_put ("udf", data->disk, data, grub_udf_free);
+}
+
+/* Return the extent among the COUNT sorted EXTENTS holding byte OFFSET of
+   the file, or NULL.  */
+static struct grub_udf_extent *
+grub_udf_find_extent (struct grub_udf_extent *extents, grub_size_t count,
+		      grub_uint64_t offset)
+{
+  grub_size_t lo = 0, hi = count;
+
+  while (lo < hi)
+    {
+      grub_size_t mid = lo + (hi - lo) / 2;
+
+      if (extents[mid].offset <= offset)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+
+  if (lo == 0 || offset - extents[lo - 1].offset >= extents[lo - 1].length)
+    return NULL;
+  return &extents[lo - 1];
+}
+
+/* Map BLOCK of partition map PART_REF, both in CPU byte order, to a
+   logical block of the disk.  */
 static grub_uint32_t
-grub_udf_get_block (struct grub_udf_data *data,
+grub_udf_map_block (struct grub_udf_data *data,
 		    grub_uint16_t part_ref, grub_uint32_t block)
 {
-  part_ref = U16 (part_ref);
+  struct grub_udf_part *part;
 
   if (part_ref >= data->npm)
     {
@@ -422,8 +578,56 @@ grub_udf_get_block (struct grub_udf_data *data,
       return 0;
     }
 
-  return (U32 (data->pds[data->pms[part_ref]->type1.part_num].start)
-          + U32 (block));
+  part = &data->parts[part_ref];
+  switch (part->type)
+    {
+    case GRUB_UDF_PART_SPARABLE:
+      {
+	grub_uint32_t packet = block & ~part->packet_mask;
+	grub_size_t lo = 0, hi = part->nspares;
+
+	while (lo < hi)
+	  {
+	    grub_size_t mid = lo + (hi - lo) / 2;
+
+	    if (part->spares[mid].orig == packet)
+	      return part->spares[mid].mapped + (block & part->packet_mask);
+	    if (part->spares[mid].orig < packet)
+	      lo = mid + 1;
+	    else
+	      hi = mid;
+	  }
+	break;
+      }
+
+    case GRUB_UDF_PART_METADATA:
+      {
+	int shift = GRUB_DISK_SECTOR_BITS + data->lbshift;
+	grub_uint64_t offset = (grub_uint64_t) block << shift;
+	struct grub_udf_extent *e;
+
+	e = grub_udf_find_extent (part->meta, part->nmeta, offset);
+	if (!e || e->sparse)
+	  {
+	    grub_error (GRUB_ERR_BAD_FS, "invalid metadata block");
+	    return 0;
+	  }
+	return grub_udf_map_block (data, e->part,
+				   e->block + ((offset - e->offset) >> shift));
+      }
+
+    case GRUB_UDF_PART_PHYSICAL:
+      break;
+    }
+
+  return part->start + block;
+}
+
+static grub_uint32_t
+grub_udf_get_block (struct grub_udf_data *data,
+		    grub_uint16_t part_ref, grub_uint32_t block)
+{
+  return grub_udf_map_block (data, U16 (part_ref), U32 (block));
 }
 
 static grub_err_t
@@ -451,204 +655,355 @@ grub_udf_read_icb (struct grub_udf_data *data,
     return grub_error (GRUB_ERR_BAD_FS, "invalid fe/efe descriptor");
 
   node->part_ref = icb->block.part_ref;
+  node->icb_block = block;
   node->data = data;
   return 0;
 }
 
-static grub_disk_addr_t
-grub_udf_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
+/* Decode the allocation descriptors of NODE, following its allocation
+   extent descriptors, into an array of extents sorted by offset.  */
+static grub_err_t
+grub_udf_decode_ads (grub_fshelp_node_t node,
+		     struct grub_udf_extent **extents, grub_size_t *count)
 {
-  char *buf = NULL;
-  char *ptr;
-  grub_ssize_t len;
-  grub_disk_addr_t filebytes;
-  char *end_ptr;
+  struct grub_udf_data *data = node->data;
+  grub_size_t bsize = (grub_size_t) 1 << (GRUB_DISK_SECTOR_BITS
+					  + data->lbshift);
+  grub_uint64_t size = U64 (node->block.fe.file_size);
+  grub_uint64_t offset = 0;
+  grub_uint16_t part = U16 (node->part_ref);
+  struct grub_udf_extent *ext = NULL, *e;
+  grub_size_t n = 0, alloc = 0, adsize, ea_len, len;
+  unsigned naeds = 0;
+  char *buf = NULL, *base, *ptr;
+  int is_short;
 
   switch (U16 (node->block.fe.tag.tag_ident))
     {
     case GRUB_UDF_TAG_IDENT_FE:
-      ptr = (char *) &node->block.fe.ext_attr[0] + U32 (node->block.fe.ext_attr_length);
+      base = (char *) &node->block.fe.ext_attr[0];
+      ea_len = U32 (node->block.fe.ext_attr_length);
       len = U32 (node->block.fe.alloc_descs_length);
       break;
 
     case GRUB_UDF_TAG_IDENT_EFE:
-      ptr = (char *) &node->block.efe.ext_attr[0] + U32 (node->block.efe.ext_attr_length);
+      base = (char *) &node->block.efe.ext_attr[0];
+      ea_len = U32 (node->block.efe.ext_attr_length);
       len = U32 (node->block.efe.alloc_descs_length);
       break;
 
     default:
-      grub_error (GRUB_ERR_BAD_FS, "invalid file entry");
-      return 0;
+      return grub_error (GRUB_ERR_BAD_FS, "invalid file entry");
+    }
+
+  switch (U16 (node->block.fe.icbtag.flags) & GRUB_UDF_ICBTAG_FLAG_AD_MASK)
+    {
+    case GRUB_UDF_ICBTAG_FLAG_AD_SHORT:
+      is_short = 1;
+      adsize = sizeof (struct grub_udf_short_ad);
+      break;
+
+    case GRUB_UDF_ICBTAG_FLAG_AD_LONG:
+      is_short = 0;
+      adsize = sizeof (struct grub_udf_long_ad);
+      break;
+
+    default:
+      return grub_error (GRUB_ERR_BAD_FS, "invalid extent type");
     }
 
-  end_ptr = (char *) node + get_fshelp_size (node->data);
+  if ((grub_size_t) ((char *) node->block.raw + bsize - base) < ea_len
+      || (grub_size_t) ((char *) node->block.raw + bsize - base) - ea_len < len)
+    return grub_error (GRUB_ERR_BAD_FS, "corrupted UDF file system");
+  ptr = base + ea_len;
 
-  if ((U16 (node->block.fe.icbtag.flags) & GRUB_UDF_ICBTAG_FLAG_AD_MASK)
-      == GRUB_UDF_ICBTAG_FLAG_AD_SHORT)
+  while (len >= adsize && offset < size)
     {
-      if (GRUB_UDF_INVALID_STRUCT_PTR (ptr, struct grub_udf_short_ad))
+      grub_uint32_t adlen, adtype, block;
+      grub_uint16_t adpart;
+
+      if (is_short)
 	{
-	  grub_error (GRUB_ERR_BAD_FS, "corrupted UDF file system");
-	  return 0;
+	  struct grub_udf_short_ad *ad = (struct grub_udf_short_ad *) ptr;
+
+	  adlen = U32 (ad->length);
+	  block = U32 (ad->position);
+	  adpart = part;
 	}
+      else
+	{
+	  struct grub_udf_long_ad *ad = (struct grub_udf_long_ad *) ptr;
 
-      struct grub_udf_short_ad *ad = (struct grub_udf_short_ad *) ptr;
+	  adlen = U32 (ad->length);
+	  block = U32 (ad->block.block_num);
+	  adpart = U16 (ad->block.part_ref);
+	}
+      adtype = adlen >> 30;
+      adlen &= 0x3fffffff;
+      if (adlen == 0)
+	break;
+      ptr += adsize;
+      len -= adsize;
 
-      filebytes = fileblock * U32 (node->data->lvd.bsize);
-      while (len >= (grub_ssize_t) sizeof (struct grub_udf_short_ad))
+      if (adtype == 3)
 	{
-	  grub_uint32_t adlen = U32 (ad->length) & 0x3fffffff;
-	  grub_uint32_t adtype = U32 (ad->length) >> 30;
-	  if (adtype == 3)
+	  struct grub_udf_aed *extension;
+	  grub_uint32_t sec;
+
+	  if (++naeds > GRUB_UDF_MAX_AEDS)
 	    {
-	      struct grub_udf_aed *extension;
-	      grub_disk_addr_t sec = grub_udf_get_block(node->data,
-							node->part_ref,
-							ad->position);
+	      grub_error (GRUB_ERR_BAD_FS, "too many allocation extents");
+	      goto fail;
+	    }
+	  if (!buf)
+	    {
+	      buf = grub_malloc (bsize);
 	      if (!buf)
-		{
-		  buf = grub_malloc (U32 (node->data->lvd.bsize));
-		  if (!buf)
-		    return 0;
-		}
-	      if (grub_disk_read (node->data->disk, sec << node->data->lbshift,
-				  0, adlen, buf))
 		goto fail;
+	    }
 
-	      extension = (struct grub_udf_aed *) buf;
-	      if (U16 (extension->tag.tag_ident) != GRUB_UDF_TAG_IDENT_AED)
-		{
-		  grub_error (GRUB_ERR_BAD_FS, "invalid aed tag");
-		  goto fail;
-		}
+	  sec = grub_udf_map_block (data, adpart, block);
+	  if (grub_errno)
+	    goto fail;
+	  if (grub_disk_read (data->disk,
+			      (grub_disk_addr_t) sec << data->lbshift,
+			      0, bsize, buf))
+	    goto fail;
 
-	      len = U32 (extension->ae_len);
-              /*
-               * Ensure AE length is less than block size
-               * per UDF spec v2.01 section 2.3.11.
-               *
-               * node->data->lbshift is initialized by
-               * grub_udf_mount(). lbshift has a maximum value
-               * of 3 and it does not cause an overflow here.
-               */
-              if (len < 0 || len > ((grub_ssize_t) 1 << node->data->lbshift))
-                {
-                  grub_error (GRUB_ERR_BAD_FS, "invalid ae length");
-                  goto fail;
-                }
-
-	      ad = (struct grub_udf_short_ad *)
-		    (buf + sizeof (struct grub_udf_aed));
-	      continue;
+	  extension = (struct grub_udf_aed *) buf;
+	  if (U16 (extension->tag.tag_ident) != GRUB_UDF_TAG_IDENT_AED)
+	    {
+	      grub_error (GRUB_ERR_BAD_FS, "invalid aed tag");
+	      goto fail;
 	    }
 
-	  if (filebytes < adlen)
+	  /*
+	   * The descriptors must fit in the block,
+	   * per UDF spec v2.01 section 2.3.11.
+	   */
+	  len = U32 (extension->ae_len);
+	  if (len > bsize - sizeof (*extension))
 	    {
-	      grub_uint32_t ad_pos = ad->position;
-	      grub_free (buf);
-	      return ((U32 (ad_pos) & GRUB_UDF_EXT_MASK) ? 0 :
-		      (grub_udf_get_block (node->data, node->part_ref, ad_pos)
-		       + (filebytes >> (GRUB_DISK_SECTOR_BITS
-					+ node->data->lbshift))));
+	      grub_error (GRUB_ERR_BAD_FS, "invalid ae length");
+	      goto fail;
 	    }
 
-	  filebytes -= adlen;
-	  ad++;
-	  len -= sizeof (struct grub_udf_short_ad);
+	  ptr = buf + sizeof (*extension);
+	  continue;
+	}
+
+      if (n == alloc)
+	{
+	  grub_size_t sz;
 
-	  if (GRUB_UDF_INVALID_STRUCT_PTR (ad, struct grub_udf_short_ad))
+	  alloc = alloc ? alloc * 2 : 16;
+	  if (grub_mul (alloc, sizeof (*ext), &sz))
 	    {
-	      grub_error (GRUB_ERR_BAD_FS, "corrupted UDF file system");
-	      return 0;
+	      grub_error (GRUB_ERR_OUT_OF_RANGE, N_("overflow is detected"));
+	      goto fail;
 	    }
+	  e = grub_realloc (ext, sz);
+	  if (!e)
+	    goto fail;
+	  ext = e;
 	}
+
+      e = &ext[n++];
+      e->offset = offset;
+      e->length = adlen;
+      e->block = block;
+      e->part = adpart;
+      /* Unrecorded extents read as zeros.  */
+      e->sparse = adtype != 0 || (block & GRUB_UDF_EXT_MASK);
+      offset += adlen;
     }
-  else
+
+  grub_free (buf);
+  *extents = ext;
+  *count = n;
+  return GRUB_ERR_NONE;
+
+ fail:
+  grub_free (buf);
+  grub_free (ext);
+  return grub_errno;
+}
+
+/* Return the decoded extents of NODE, decoding them on first use.  */
+static struct grub_udf_extent_list *
+grub_udf_node_extents (grub_fshelp_node_t node)
+{
+  struct grub_udf_data *data = node->data;
+  struct grub_udf_extent_list *list, *victim;
+  struct grub_udf_extent *extents;
+  grub_size_t count;
+
+  victim = &data->extent_lists[0];
+  for (list = data->extent_lists;
+       list < data->extent_lists + GRUB_UDF_EXTENT_CACHE_SIZE; list++)
     {
-      if (GRUB_UDF_INVALID_STRUCT_PTR (ptr, struct grub_udf_long_ad))
+      if (list->last_use && list->icb_block == node->icb_block)
 	{
-	  grub_error (GRUB_ERR_BAD_FS, "corrupted UDF file system");
-	  return 0;
+	  list->last_use = ++data->extent_clock;
+	  return list;
 	}
+      if (list->last_use < victim->last_use)
+	victim = list;
+    }
 
-      struct grub_udf_long_ad *ad = (struct grub_udf_long_ad *) ptr;
+  if (grub_udf_decode_ads (node, &extents, &count))
+    return NULL;
 
-      filebytes = fileblock * U32 (node->data->lvd.bsize);
-      while (len >= (grub_ssize_t) sizeof (struct grub_udf_long_ad))
-	{
-	  grub_uint32_t adlen = U32 (ad->length) & 0x3fffffff;
-	  grub_uint32_t adtype = U32 (ad->length) >> 30;
-	  if (adtype == 3)
-	    {
-	      struct grub_udf_aed *extension;
-	      grub_disk_addr_t sec = grub_udf_get_block(node->data,
-							ad->block.part_ref,
-							ad->block.block_num);
-	      if (!buf)
-		{
-		  buf = grub_malloc (U32 (node->data->lvd.bsize));
-		  if (!buf)
-		    return 0;
-		}
-	      if (grub_disk_read (node->data->disk, sec << node->data->lbshift,
-				  0, adlen, buf))
-		goto fail;
+  grub_free (victim->extents);
+  victim->icb_block = node->icb_block;
+  victim->extents = extents;
+  victim->count = count;
+  victim->last_use = ++data->extent_clock;
+  return victim;
+}
 
-	      extension = (struct grub_udf_aed *) buf;
-	      if (U16 (extension->tag.tag_ident) != GRUB_UDF_TAG_IDENT_AED)
-		{
-		  grub_error (GRUB_ERR_BAD_FS, "invalid aed tag");
-		  goto fail;
-		}
+static grub_disk_addr_t
+grub_udf_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
+{
+  struct grub_udf_extent_list *list;
+  struct grub_udf_extent *e;
+  grub_uint64_t filebytes;
 
-	      len = U32 (extension->ae_len);
-              /*
-               * Ensure AE length is less than block size
-               * per UDF spec v2.01 section 2.3.11.
-               *
-               * node->data->lbshift is initialized by
-               * grub_udf_mount(). lbshift has a maximum value
-               * of 3 and it does not cause an overflow here.
-               */
-              if (len < 0 || len > ((grub_ssize_t) 1 << node->data->lbshift))
-                {
-                  grub_error (GRUB_ERR_BAD_FS, "invalid ae length");
-                  goto fail;
-                }
-
-	      ad = (struct grub_udf_long_ad *)
-		    (buf + sizeof (struct grub_udf_aed));
-	      continue;
-	    }
+  list = grub_udf_node_extents (node);
+  if (!list)
+    return 0;
 
-	  if (filebytes < adlen)
-	    {
-	      grub_uint32_t ad_block_num = ad->block.block_num;
-	      grub_uint32_t ad_part_ref = ad->block.part_ref;
-	      grub_free (buf);
-	      return ((U32 (ad_block_num) & GRUB_UDF_EXT_MASK) ?  0 :
-		      (grub_udf_get_block (node->data, ad_part_ref,
-					   ad_block_num)
-		       + (filebytes >> (GRUB_DISK_SECTOR_BITS
-				        + node->data->lbshift))));
-	    }
+  filebytes = fileblock * U32 (node->data->lvd.bsize);
+  e = grub_udf_find_extent (list->extents, list->count, filebytes);
+  if (!e || e->sparse)
+    return 0;
 
-	  filebytes -= adlen;
-	  ad++;
-	  len -= sizeof (struct grub_udf_long_ad);
+  return grub_udf_map_block (node->data, e->part,
+			     e->block + ((filebytes - e->offset)
+					 >> (GRUB_DISK_SECTOR_BITS
+					     + node->data->lbshift)));
+}
 
-	  if (GRUB_UDF_INVALID_STRUCT_PTR (ad, struct grub_udf_long_ad))
-	    {
-	      grub_error (GRUB_ERR_BAD_FS, "corrupted UDF file system");
-	      return 0;
-	    }
+/* Load the sparing table of sparable partition map PART_REF from the
+   first of its copies that looks sane.  */
+static grub_err_t
+grub_udf_read_sparing_table (struct grub_udf_data *data, int part_ref)
+{
+  struct grub_udf_partmap *pm = data->pms[part_ref];
+  struct grub_udf_part *part = &data->parts[part_ref];
+  grub_uint16_t packet_len = U16 (pm->type2.sparable.packet_len);
+  unsigned t, ntables;
+
+  if (packet_len == 0 || (packet_len & (packet_len - 1)))
+    return grub_error (GRUB_ERR_BAD_FS, "invalid packet length");
+  part->packet_mask = packet_len - 1;
+
+  ntables = pm->type2.sparable.num_tables;
+  if (ntables > ARRAY_SIZE (pm->type2.sparable.table_loc))
+    ntables = ARRAY_SIZE (pm->type2.sparable.table_loc);
+
+  for (t = 0; t < ntables; t++)
+    {
+      struct grub_udf_sparing_table st;
+      struct grub_udf_sparing_entry *spares;
+      grub_disk_addr_t sec;
+      grub_size_t i, n;
+
+      sec = (grub_disk_addr_t) U32 (pm->type2.sparable.table_loc[t])
+	<< data->lbshift;
+      if (grub_disk_read (data->disk, sec, 0, sizeof (st), &st))
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  continue;
 	}
+      if (grub_memcmp (st.ident.ident, GRUB_UDF_SPARING_IDENT,
+		       sizeof (GRUB_UDF_SPARING_IDENT) - 1) != 0)
+	continue;
+
+      n = U16 (st.num_entries);
+      spares = grub_calloc (n ? n : 1, sizeof (*spares));
+      if (!spares)
+	return grub_errno;
+      if (n && grub_disk_read (data->disk, sec, sizeof (st),
+			       n * sizeof (*spares), spares))
+	{
+	  grub_free (spares);
+	  grub_errno = GRUB_ERR_NONE;
+	  continue;
+	}
+
+      /* The entries are sorted by original location, unused ones last.  */
+      for (i = 0; i < n; i++)
+	{
+	  spares[i].orig = U32 (spares[i].orig);
+	  spares[i].mapped = U32 (spares[i].mapped);
+	  if (spares[i].orig >= GRUB_UDF_SPARE_UNUSED
+	      || (i && spares[i].orig <= spares[i - 1].orig))
+	    break;
+	}
+      if (i < n && spares[i].orig < GRUB_UDF_SPARE_UNUSED)
+	{
+	  grub_free (spares);
+	  continue;
+	}
+
+      part->spares = spares;
+      part->nspares = i;
+      return GRUB_ERR_NONE;
     }
 
-fail:
-  grub_free (buf);
+  return grub_error (GRUB_ERR_BAD_FS, "no valid sparing table");
+}
 
-  return 0;
+/* Decode the metadata file of metadata partition map PART_REF, or its
+   mirror when the file itself is unreadable.  */
+static grub_err_t
+grub_udf_read_metadata_file (struct grub_udf_data *data, int part_ref)
+{
+  struct grub_udf_partmap *pm = data->pms[part_ref];
+  struct grub_udf_part *part = &data->parts[part_ref];
+  grub_uint32_t locs[2] = { pm->type2.metadata.file_loc,
+			    pm->type2.metadata.mirror_loc };
+  grub_fshelp_node_t node;
+  grub_size_t i;
+  int k;
+
+  for (k = 0; k < data->npm; k++)
+    if (k != part_ref && data->parts[k].pd == part->pd
+	&& data->parts[k].type != GRUB_UDF_PART_METADATA)
+      break;
+  if (k == data->npm)
+    return grub_error (GRUB_ERR_BAD_FS, "can\'t find metadata PD");
+  part->phys = k;
+
+  node = grub_malloc (get_fshelp_size (data));
+  if (!node)
+    return grub_errno;
+
+  for (i = 0; i < ARRAY_SIZE (locs); i++)
+    {
+      struct grub_udf_long_ad icb;
+
+      icb.block.part_ref = grub_cpu_to_le16 (part->phys);
+      icb.block.block_num = locs[i];
+      if (grub_udf_read_icb (data, &icb, node) == GRUB_ERR_NONE
+	  && grub_udf_decode_ads (node, &part->meta,
+				  &part->nmeta) == GRUB_ERR_NONE)
+	break;
+      if (i + 1 < ARRAY_SIZE (locs))
+	grub_errno = GRUB_ERR_NONE;
+    }
+  grub_free (node);
+  if (i == ARRAY_SIZE (locs))
+    return grub_errno;
+
+  /* Metadata blocks must not map back into a metadata partition.  */
+  for (i = 0; i < part->nmeta; i++)
+    if (part->meta[i].part >= data->npm
+	|| data->parts[part->meta[i].part].type == GRUB_UDF_PART_METADATA)
+      return grub_error (GRUB_ERR_BAD_FS, "invalid metadata file");
+
+  return GRUB_ERR_NONE;
 }
 
 static grub_ssize_t
@@ -703,7 +1058,14 @@ grub_udf_mount (grub_disk_t disk)
   grub_uint32_t block, vblock;
   int i, lbshift;
 
-  data = grub_malloc (sizeof (struct grub_udf_data));
+  data = grub_fshelp_mount_get ("udf", disk);
+  if (data)
+    {
+      data->disk = disk;
+      return data;
+    }
+
+  data = grub_zalloc (sizeof (struct grub_udf_data));
   if (!data)
     return 0;
 
@@ -837,7 +1199,34 @@ grub_udf_mount (grub_disk_t disk)
 	  ppm = (struct grub_udf_partmap *) &data->lvd.part_maps;
 	  for (k = U32 (data->lvd.num_part_maps); k > 0; k--)
 	    {
-	      if (ppm->type != GRUB_UDF_PARTMAP_TYPE_1)
+	      struct grub_udf_part *part = &data->parts[data->npm];
+
+	      if ((char *) ppm + 2 > (char *) &data->lvd + sizeof (data->lvd)
+		  || ppm->length < 6
+		  || (char *) ppm + ppm->length
+		     > (char *) &data->lvd + sizeof (data->lvd))
+		{
+		  grub_error (GRUB_ERR_BAD_FS, "invalid partition map");
+		  goto fail;
+		}
+
+	      if (ppm->type == GRUB_UDF_PARTMAP_TYPE_1)
+		part->type = GRUB_UDF_PART_PHYSICAL;
+	      else if (ppm->type == GRUB_UDF_PARTMAP_TYPE_2
+		       && ppm->length >= sizeof (*ppm)
+		       && grub_memcmp (ppm->type2.ident.ident,
+				       GRUB_UDF_PARTMAP_IDENT_SPARABLE,
+				       sizeof (GRUB_UDF_PARTMAP_IDENT_SPARABLE)
+				       - 1) == 0)
+		part->type = GRUB_UDF_PART_SPARABLE;
+	      else if (ppm->type == GRUB_UDF_PARTMAP_TYPE_2
+		       && ppm->length >= sizeof (*ppm)
+		       && grub_memcmp (ppm->type2.ident.ident,
+				       GRUB_UDF_PARTMAP_IDENT_METADATA,
+				       sizeof (GRUB_UDF_PARTMAP_IDENT_METADATA)
+				       - 1) == 0)
+		part->type = GRUB_UDF_PART_METADATA;
+	      else
 		{
 		  grub_error (GRUB_ERR_BAD_FS, "partmap type not supported");
 		  goto fail;
@@ -861,12 +1250,18 @@ grub_udf_mount (grub_disk_t disk)
 
   for (i = 0; i < data->npm; i++)
     {
+      grub_uint16_t part_num;
       int j;
 
+      part_num = (data->parts[i].type == GRUB_UDF_PART_PHYSICAL
+		  ? data->pms[i]->type1.part_num
+		  : data->pms[i]->type2.part_num);
+
       for (j = 0; j < data->npd; j++)
-	if (data->pms[i]->type1.part_num == data->pds[j].part_num)
+	if (part_num == data->pds[j].part_num)
 	  {
-	    data->pms[i]->type1.part_num = j;
+	    data->parts[i].pd = j;
+	    data->parts[i].start = U32 (data->pds[j].start);
 	    break;
 	  }
 
@@ -877,6 +1272,18 @@ grub_udf_mount (grub_disk_t disk)
 	}
     }
 
+  /* Metadata files may lie in sparable partitions, so read the sparing
+     tables first.  */
+  for (i = 0; i < data->npm; i++)
+    if (data->parts[i].type == GRUB_UDF_PART_SPARABLE
+	&& grub_udf_read_sparing_table (data, i))
+      goto fail;
+
+  for (i = 0; i < data->npm; i++)
+    if (data->parts[i].type == GRUB_UDF_PART_METADATA
+	&& grub_udf_read_metadata_file (data, i))
+      goto fail;
+
   block = grub_udf_get_block (data,
 			      data->lvd.root_fileset.block.part_ref,
 			      data->lvd.root_fileset.block.block_num);
@@ -902,7 +1309,7 @@ grub_udf_mount (grub_disk_t disk)
   return data;
 
 fail:
-  grub_free (data);
+  grub_udf_free (data);
   return 0;
 }
 
@@ -917,9 +1324,9 @@ grub_udf_get_cluster_sector (grub_disk_t disk, grub_uint64_t *sec_per_lcn)
   if (!data)
     return 0;
 
-  ret = U32 (data->pds[data->pms[0]->type1.part_num].start);
+  ret = data->parts[0].start;
   *sec_per_lcn = 1ULL << data->lbshift;
-  grub_free (data);
+  grub_udf_free (data);
   return ret;
 }
 #endif
@@ -1225,6 +1632,11 @@ grub_udf_dir_iter (const char *filename, enum grub_fshelp_filetype filetype,
 
       info.mtime -= 60 * tz;
     }
+  if ((filetype & GRUB_FSHELP_TYPE_MASK) == GRUB_FSHELP_REG)
+    {
+      info.sizeset = 1;
+      info.size = U64 (node->block.fe.file_size);
+    }
   grub_free (node);
   return ctx->hook (filename, &info, ctx->hook_data);
 }
@@ -1265,7 +1677,7 @@ grub_udf_dir (grub_device_t device, const char *path,
 fail:
   grub_free (rootnode);
 
-  grub_free (data);
+  grub_udf_unmount (data);
 
   grub_dl_unref (my_mod);
 
@@ -1309,7 +1721,7 @@ grub_udf_open (struct grub_file *file, const char *name)
 fail:
   grub_dl_unref (my_mod);
 
-  grub_free (data);
+  grub_udf_unmount (data);
   grub_free (rootnode);
 
   return grub_errno;
@@ -1331,7 +1743,7 @@ grub_udf_close (grub_file_t file)
     {
       struct grub_fshelp_node *node = (struct grub_fshelp_node *) file->data;
 
-      grub_free (node->data);
+      grub_udf_unmount (node->data);
       grub_free (node);
     }
 
@@ -1349,7 +1761,7 @@ grub_udf_label (grub_device_t device, char **label)
   if (data)
     {
       *label = read_dstring (data->lvd.ident, sizeof (data->lvd.ident));
-      grub_free (data);
+      grub_udf_unmount (data);
     }
   else
     *label = 0;
@@ -1430,7 +1842,7 @@ grub_udf_uuid (grub_device_t device, char **uuid)
         }
       else
         *uuid = 0;
-      grub_free (data);
+      grub_udf_unmount (data);
     }
   else
     *uuid = 0;
@@ -1462,4 +1874,5 @@ GRUB_MOD_INIT (udf)
 GRUB_MOD_FINI (udf)
 {
   grub_fs_unregister (&grub_udf_fs);
+  grub_fshelp_mount_flush ("udf");
 }
@@ -47,6 +47,7 @@ GRUB_MOD_LICENSE ("GPLv3+");
 #define	XFS_SB_VERSION_SECTORBIT	0x0800
 #define	XFS_SB_VERSION_EXTFLGBIT	0x1000
 #define	XFS_SB_VERSION_DIRV2BIT		0x2000
+#define	XFS_SB_VERSION_BORGBIT		0x4000	/* ASCII only case-insensitive */
 #define XFS_SB_VERSION_MOREBITSBIT	0x8000
 #define XFS_SB_VERSION_BITS_SUPPORTED \
 	(XFS_SB_VERSION_NUMBITS | \
@@ -240,6 +241,43 @@ struct grub_xfs_dirblock_tail
   grub_uint32_t leaf_stale;
 } GRUB_PACKED;
 
+#define XFS_DIR2_BLOCK_MAGIC	0x58443242	/* XD2B */
+#define XFS_DIR3_BLOCK_MAGIC	0x58444233	/* XDB3 */
+#define XFS_DIR2_LEAF1_MAGIC	0xd2f1
+#define XFS_DIR3_LEAF1_MAGIC	0x3df1
+#define XFS_DIR2_LEAFN_MAGIC	0xd2ff
+#define XFS_DIR3_LEAFN_MAGIC	0x3dff
+#define XFS_DA_NODE_MAGIC	0xfebe
+#define XFS_DA3_NODE_MAGIC	0x3ebe
+
+/* Byte offset of the hash index of leaf and node directories.  */
+#define XFS_DIR2_LEAF_OFFSET	(1ULL << 35)
+
+/* Start of directory leaf and hash B+tree node blocks.  In V5 crc, block
+   number etc. follow, then come the number of entries and the number of
+   stale entries (leaves) or the level (nodes).  */
+struct grub_xfs_da_blkinfo
+{
+  grub_uint32_t forw;
+  grub_uint32_t back;
+  grub_uint16_t magic;
+  grub_uint16_t pad;
+} GRUB_PACKED;
+
+struct grub_xfs_da_node_entry
+{
+  grub_uint32_t hashval;
+  grub_uint32_t before;
+} GRUB_PACKED;
+
+/* A decoded data fork extent, in filesystem blocks.  */
+struct grub_xfs_extent_rec
+{
+  grub_uint64_t offset;
+  grub_uint64_t start;
+  grub_uint64_t size;
+};
+
 struct grub_fshelp_node
 {
   struct grub_xfs_data *data;
@@ -258,6 +296,10 @@ struct grub_xfs_data
   grub_uint32_t agsize;
   unsigned int hasftype:1;
   unsigned int hascrc:1;
+  /* The data fork extents of inode EXTINO, sorted by file offset.  */
+  grub_uint64_t extino;
+  grub_uint64_t nexts;
+  struct grub_xfs_extent_rec *exts;
   struct grub_fshelp_node diropen;
 };
 
@@ -340,6 +382,15 @@ grub_xfs_sb_needs_repair (struct grub_xfs_data *data)
            grub_cpu_to_be32_compile_time (XFS_SB_FEAT_INCOMPAT_NEEDSREPAIR)));
 }
 
+/* Whether directory names are hashed ignoring ASCII case.  Only version 5
+   filesystems with this are mounted.  */
+static int
+grub_xfs_sb_has_ascii_ci (struct grub_xfs_data *data)
+{
+  return !!(data->sblock.version
+	    & grub_cpu_to_be16_compile_time (XFS_SB_VERSION_BORGBIT));
+}
+
 /* Filetype information as used in inodes.  */
 #define FILETYPE_INO_MASK	0170000
 #define FILETYPE_INO_REG	0100000
@@ -565,123 +616,241 @@ grub_xfs_get_inode_nextents (struct grub_xfs_inode *inode)
 	  grub_be_to_cpu32 (inode->nextents);
 }
 
-static grub_disk_addr_t
-grub_xfs_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
+static int
+grub_xfs_is_bmap_block (struct grub_xfs_data *data,
+			struct grub_xfs_btree_node *block)
 {
-  struct grub_xfs_btree_node *leaf = 0;
-  grub_uint64_t ex, nrec;
-  struct grub_xfs_extent *exts;
-  grub_uint64_t ret = 0;
+  return grub_strncmp ((char *) block->magic,
+		       data->hascrc ? "BMA3" : "BMAP", 4) == 0;
+}
 
-  if (node->inode.format == XFS_INODE_FORMAT_BTREE)
+/* Read the bmap B+tree block FSB into BLOCK.  */
+static grub_err_t
+grub_xfs_read_bmap_block (struct grub_xfs_data *data, grub_uint64_t fsb,
+			  struct grub_xfs_btree_node *block)
+{
+  if (grub_disk_read (data->disk,
+		      GRUB_XFS_FSB_TO_BLOCK (data, fsb)
+		      << (data->sblock.log2_bsize - GRUB_DISK_SECTOR_BITS),
+		      0, data->bsize, block))
+    return grub_errno;
+
+  if (!grub_xfs_is_bmap_block (data, block))
+    return grub_error (GRUB_ERR_BAD_FS, "not a correct XFS BMAP node");
+
+  return GRUB_ERR_NONE;
+}
+
+/* Decode the extents in the leaves of the bmap B+tree of NODE into EXTS,
+   which has room for MAX of them.  The leaves are found by going down the
+   leftmost path from the root and then following the right siblings.  */
+static grub_err_t
+grub_xfs_decode_btree_extents (grub_fshelp_node_t node,
+			       struct grub_xfs_extent_rec *exts,
+			       grub_uint64_t max, grub_uint64_t *n)
+{
+  struct grub_xfs_data *data = node->data;
+  struct grub_xfs_btree_root *root;
+  struct grub_xfs_btree_node *block;
+  const char *keys;
+  grub_uint64_t fsb;
+  int recoffset, depth;
+  grub_err_t err;
+
+  *n = 0;
+
+  root = (struct grub_xfs_btree_root *) grub_xfs_inode_data (&node->inode);
+  if (!root->numrecs)
+    return GRUB_ERR_NONE;
+  keys = (char *) &root->keys[0];
+  if (node->inode.fork_offset)
+    recoffset = (node->inode.fork_offset - 1) / 2;
+  else
+    recoffset = (grub_xfs_inode_size (data)
+		 - ((char *) keys - (char *) &node->inode))
+      / (2 * sizeof (grub_uint64_t));
+  fsb = get_fsb (keys, recoffset);
+
+  block = grub_malloc (data->bsize);
+  if (!block)
+    return grub_errno;
+
+  /* Go down to the leftmost leaf.  */
+  for (depth = 0; ; depth++)
     {
-      struct grub_xfs_btree_root *root;
-      const char *keys;
-      int recoffset;
-
-      leaf = grub_malloc (node->data->bsize);
-      if (leaf == 0)
-        return 0;
-
-      root = (struct grub_xfs_btree_root *) grub_xfs_inode_data(&node->inode);
-      nrec = grub_be_to_cpu16 (root->numrecs);
-      keys = (char *) &root->keys[0];
-      if (node->inode.fork_offset)
-	recoffset = (node->inode.fork_offset - 1) / 2;
-      else
-	recoffset = (grub_xfs_inode_size(node->data)
-		     - ((char *) keys - (char *) &node->inode))
-				/ (2 * sizeof (grub_uint64_t));
-      do
-        {
-          grub_uint64_t i;
-
-          for (i = 0; i < nrec; i++)
-            {
-              if (fileblock < get_fsb(keys, i))
-                break;
-            }
-
-          /* Sparse block.  */
-          if (i == 0)
-            {
-              grub_free (leaf);
-              return 0;
-            }
-
-          if (grub_disk_read (node->data->disk,
-                              GRUB_XFS_FSB_TO_BLOCK (node->data, get_fsb (keys, i - 1 + recoffset)) << (node->data->sblock.log2_bsize - GRUB_DISK_SECTOR_BITS),
-                              0, node->data->bsize, leaf))
-            {
-              grub_free (leaf);
-              return 0;
-            }
-
-	  if ((!node->data->hascrc &&
-	       grub_strncmp ((char *) leaf->magic, "BMAP", 4)) ||
-	      (node->data->hascrc &&
-	       grub_strncmp ((char *) leaf->magic, "BMA3", 4)))
-            {
-              grub_free (leaf);
-              grub_error (GRUB_ERR_BAD_FS, "not a correct XFS BMAP node");
-              return 0;
-            }
-
-          nrec = grub_be_to_cpu16 (leaf->numrecs);
-          keys = grub_xfs_btree_keys(node->data, leaf);
-	  recoffset = ((node->data->bsize - ((char *) keys
-					     - (char *) leaf))
-		       / (2 * sizeof (grub_uint64_t)));
+      if (depth > 16)
+	{
+	  err = grub_error (GRUB_ERR_BAD_FS, "XFS bmap B+tree too deep");
+	  goto out;
+	}
+
+      err = grub_xfs_read_bmap_block (data, fsb, block);
+      if (err)
+	goto out;
+      if (!block->level)
+	break;
+      if (!block->numrecs)
+	{
+	  err = grub_error (GRUB_ERR_BAD_FS, "empty XFS BMAP node");
+	  goto out;
+	}
+
+      keys = grub_xfs_btree_keys (data, block);
+      recoffset = ((data->bsize - (keys - (char *) block))
+		   / (2 * sizeof (grub_uint64_t)));
+      fsb = get_fsb (keys, recoffset);
+    }
+
+  /* Collect the records of all the leaves.  */
+  while (1)
+    {
+      struct grub_xfs_extent *recs;
+      grub_uint64_t nrec, i;
+
+      keys = grub_xfs_btree_keys (data, block);
+      recs = (struct grub_xfs_extent *) keys;
+      nrec = grub_be_to_cpu16 (block->numrecs);
+      if (nrec > (data->bsize - (keys - (char *) block)) / sizeof (*recs)
+	  || nrec > max - *n)
+	{
+	  err = grub_error (GRUB_ERR_BAD_FS, "invalid number of XFS extents");
+	  goto out;
+	}
+
+      for (i = 0; i < nrec; i++, (*n)++)
+	{
+	  exts[*n].offset = GRUB_XFS_EXTENT_OFFSET (recs, i);
+	  exts[*n].start = GRUB_XFS_EXTENT_BLOCK (recs, i);
+	  exts[*n].size = GRUB_XFS_EXTENT_SIZE (recs, i);
+	}
+
+      fsb = grub_be_to_cpu64 (block->right);
+      if (fsb == ~(grub_uint64_t) 0)
+	break;
+
+      err = grub_xfs_read_bmap_block (data, fsb, block);
+      if (err)
+	goto out;
+      if (block->level)
+	{
+	  err = grub_error (GRUB_ERR_BAD_FS, "not a correct XFS BMAP leaf");
+	  goto out;
 	}
-      while (leaf->level);
-      exts = (struct grub_xfs_extent *) keys;
     }
-  else if (node->inode.format == XFS_INODE_FORMAT_EXT)
+
+ out:
+  grub_free (block);
+  return err;
+}
+
+/* Make the extents of NODE available in NODE->data->exts.  They are
+   decoded once, so mapping the blocks of a fragmented file doesn't walk
+   its bmap B+tree again for each of them.  */
+static grub_err_t
+grub_xfs_load_extents (grub_fshelp_node_t node)
+{
+  struct grub_xfs_data *data = node->data;
+  struct grub_xfs_extent_rec *exts;
+  grub_uint64_t nrec, n = 0;
+
+  if (data->exts && data->extino == node->ino)
+    return GRUB_ERR_NONE;
+
+  grub_free (data->exts);
+  data->exts = NULL;
+  data->nexts = 0;
+
+  if (node->inode.format != XFS_INODE_FORMAT_BTREE
+      && node->inode.format != XFS_INODE_FORMAT_EXT)
+    return grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
+		       "XFS does not support inode format %d yet",
+		       node->inode.format);
+
+  nrec = grub_xfs_get_inode_nextents (&node->inode);
+
+  if (node->inode.format == XFS_INODE_FORMAT_EXT)
     {
       grub_addr_t exts_end = 0;
       grub_addr_t data_end = 0;
 
-      nrec = grub_xfs_get_inode_nextents (&node->inode);
-      exts = (struct grub_xfs_extent *) grub_xfs_inode_data(&node->inode);
-
       if (grub_mul (sizeof (struct grub_xfs_extent), nrec, &exts_end) ||
 	  grub_add ((grub_addr_t) node->data, exts_end, &exts_end) ||
 	  grub_add ((grub_addr_t) node->data, node->data->data_size, &data_end) ||
 	  exts_end > data_end)
+	return grub_error (GRUB_ERR_BAD_FS, "invalid number of XFS extents");
+    }
+
+  exts = grub_calloc (nrec ? nrec : 1, sizeof (*exts));
+  if (!exts)
+    return grub_errno;
+
+  if (node->inode.format == XFS_INODE_FORMAT_BTREE)
+    {
+      grub_err_t err;
+
+      err = grub_xfs_decode_btree_extents (node, exts, nrec, &n);
+      if (err)
 	{
-	  grub_error (GRUB_ERR_BAD_FS, "invalid number of XFS extents");
-	  return 0;
+	  grub_free (exts);
+	  return err;
 	}
     }
   else
     {
-      grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
-		  "XFS does not support inode format %d yet",
-		  node->inode.format);
-      return 0;
+      struct grub_xfs_extent *recs;
+
+      recs = (struct grub_xfs_extent *) grub_xfs_inode_data (&node->inode);
+      for (n = 0; n < nrec; n++)
+	{
+	  exts[n].offset = GRUB_XFS_EXTENT_OFFSET (recs, n);
+	  exts[n].start = GRUB_XFS_EXTENT_BLOCK (recs, n);
+	  exts[n].size = GRUB_XFS_EXTENT_SIZE (recs, n);
+	}
+    }
+
+  data->extino = node->ino;
+  data->nexts = n;
+  data->exts = exts;
+  return GRUB_ERR_NONE;
+}
+
+static grub_disk_addr_t
+grub_xfs_get_extent (grub_fshelp_node_t node, grub_disk_addr_t fileblock,
+		     grub_disk_addr_t *count)
+{
+  struct grub_xfs_extent_rec *exts;
+  grub_uint64_t lo = 0, hi;
+
+  *count = 1;
+
+  if (grub_xfs_load_extents (node))
+    return 0;
+
+  /* Find the last extent starting at or before FILEBLOCK.  */
+  exts = node->data->exts;
+  hi = node->data->nexts;
+  while (lo < hi)
+    {
+      grub_uint64_t mid = lo + (hi - lo) / 2;
+
+      if (exts[mid].offset <= fileblock)
+	lo = mid + 1;
+      else
+	hi = mid;
     }
 
-  /* Iterate over each extent to figure out which extent has
-     the block we are looking for.  */
-  for (ex = 0; ex < nrec; ex++)
+  if (lo > 0 && fileblock < exts[lo - 1].offset + exts[lo - 1].size)
     {
-      grub_uint64_t start = GRUB_XFS_EXTENT_BLOCK (exts, ex);
-      grub_uint64_t offset = GRUB_XFS_EXTENT_OFFSET (exts, ex);
-      grub_uint64_t size = GRUB_XFS_EXTENT_SIZE (exts, ex);
-
-      /* Sparse block.  */
-      if (fileblock < offset)
-        break;
-      else if (fileblock < offset + size)
-        {
-          ret = (fileblock - offset + start);
-          break;
-        }
+      *count = exts[lo - 1].offset + exts[lo - 1].size - fileblock;
+      return GRUB_XFS_FSB_TO_BLOCK (node->data, fileblock - exts[lo - 1].offset
+						+ exts[lo - 1].start);
     }
 
-  grub_free (leaf);
+  /* Sparse block.  */
+  if (lo < node->data->nexts)
+    *count = exts[lo].offset - fileblock;
 
-  return GRUB_XFS_FSB_TO_BLOCK(node->data, ret);
+  return 0;
 }
 
 
@@ -692,12 +861,12 @@ grub_xfs_read_file (grub_fshelp_node_t node,
 		    grub_disk_read_hook_t read_hook, void *read_hook_data,
 		    grub_off_t pos, grub_size_t len, char *buf, grub_uint32_t header_size)
 {
-  return grub_fshelp_read_file (node->data->disk, node,
-				read_hook, read_hook_data,
-				pos, len, buf, grub_xfs_read_block,
-				grub_be_to_cpu64 (node->inode.size) + header_size,
-				node->data->sblock.log2_bsize
-				- GRUB_DISK_SECTOR_BITS, 0);
+  return grub_fshelp_read_file_extents (node->data->disk, node,
+					read_hook, read_hook_data,
+					pos, len, buf, grub_xfs_get_extent,
+					grub_be_to_cpu64 (node->inode.size) + header_size,
+					node->data->sblock.log2_bsize
+					- GRUB_DISK_SECTOR_BITS, 0);
 }
 
 
@@ -770,33 +939,43 @@ struct grub_xfs_iterate_dir_ctx
   struct grub_fshelp_node *diro;
 };
 
-/* Helper for grub_xfs_iterate_dir.  */
-static int iterate_dir_call_hook (grub_uint64_t ino, const char *filename,
-				  struct grub_xfs_iterate_dir_ctx *ctx)
+/* Create a node for the inode INO, with the inode read.  */
+static struct grub_fshelp_node *
+grub_xfs_get_node (struct grub_xfs_data *data, grub_uint64_t ino)
 {
   struct grub_fshelp_node *fdiro;
-  grub_err_t err;
 
-  fdiro = grub_malloc (grub_xfs_fshelp_size(ctx->diro->data) + 1);
+  fdiro = grub_malloc (grub_xfs_fshelp_size(data) + 1);
   if (!fdiro)
-    {
-      grub_print_error ();
-      return 0;
-    }
+    return 0;
 
   /* The inode should be read, otherwise the filetype can
      not be determined.  */
   fdiro->ino = ino;
   fdiro->inode_read = 1;
-  fdiro->data = ctx->diro->data;
-  err = grub_xfs_read_inode (ctx->diro->data, ino, &fdiro->inode);
-  if (err)
+  fdiro->data = data;
+  if (grub_xfs_read_inode (data, ino, &fdiro->inode))
     {
-      grub_print_error ();
       grub_free (fdiro);
       return 0;
     }
 
+  return fdiro;
+}
+
+/* Helper for grub_xfs_iterate_dir.  */
+static int iterate_dir_call_hook (grub_uint64_t ino, const char *filename,
+				  struct grub_xfs_iterate_dir_ctx *ctx)
+{
+  struct grub_fshelp_node *fdiro;
+
+  fdiro = grub_xfs_get_node (ctx->diro->data, ino);
+  if (!fdiro)
+    {
+      grub_print_error ();
+      return 0;
+    }
+
   return ctx->hook (filename, grub_xfs_mode_to_filetype (fdiro->inode.mode),
 		    fdiro, ctx->hook_data);
 }
@@ -995,12 +1174,394 @@ grub_xfs_iterate_dir (grub_fshelp_node_t dir,
 }
 
 
+/* The name hash used by the directory hash index.  With ASCII_CI, ASCII
+   letters are hashed as lower case, as on ascii-ci filesystems.  */
+static grub_uint32_t
+grub_xfs_da_hashname (const grub_uint8_t *name, grub_size_t len, int ascii_ci)
+{
+  grub_uint32_t hash = 0;
+
+#define ROL32(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+#define C(i) ((grub_uint32_t) (ascii_ci && name[i] >= 'A' && name[i] <= 'Z' \
+			       ? name[i] ^ 0x20 : name[i]))
+  for (; len >= 4; len -= 4, name += 4)
+    hash = (C (0) << 21) ^ (C (1) << 14) ^ (C (2) << 7) ^ C (3)
+      ^ ROL32 (hash, 7 * 4);
+
+  switch (len)
+    {
+    case 3:
+      return (C (0) << 14) ^ (C (1) << 7) ^ C (2) ^ ROL32 (hash, 7 * 3);
+    case 2:
+      return (C (0) << 7) ^ C (1) ^ ROL32 (hash, 7 * 2);
+    case 1:
+      return C (0) ^ ROL32 (hash, 7);
+    default:
+      return hash;
+    }
+#undef C
+#undef ROL32
+}
+
+/* Read the directory block starting at the file block FSB of DIR.  Unlike
+   grub_xfs_read_file this can read the hash index, which is beyond the
+   size of the directory.  */
+static grub_err_t
+grub_xfs_read_dirblock (grub_fshelp_node_t dir, grub_uint64_t fsb, char *buf)
+{
+  struct grub_xfs_data *data = dir->data;
+  grub_uint64_t i, n = 1 << data->sblock.log2_dirblk;
+
+  for (i = 0; i < n; )
+    {
+      grub_disk_addr_t blk, count;
+
+      blk = grub_xfs_get_extent (dir, fsb + i, &count);
+      if (grub_errno)
+	return grub_errno;
+      if (!blk)
+	return grub_error (GRUB_ERR_BAD_FS, "hole in XFS directory");
+      if (count > n - i)
+	count = n - i;
+
+      if (grub_disk_read (data->disk,
+			  blk << (data->sblock.log2_bsize - GRUB_DISK_SECTOR_BITS),
+			  0, count << data->sblock.log2_bsize,
+			  buf + (i << data->sblock.log2_bsize)))
+	return grub_errno;
+      i += count;
+    }
+
+  return GRUB_ERR_NONE;
+}
+
+static grub_size_t
+grub_xfs_da_hdr_size (struct grub_xfs_data *data)
+{
+  return data->hascrc ? 64 : 16;
+}
+
+static grub_uint16_t
+grub_xfs_da_count (struct grub_xfs_data *data, const char *block)
+{
+  return grub_be_to_cpu16 (grub_get_unaligned16 (block + (data->hascrc ? 56 : 12)));
+}
+
+/* Context for grub_xfs_hash_lookup.  */
+struct grub_xfs_hash_lookup_ctx
+{
+  grub_fshelp_node_t dir;
+  const char *name;
+  grub_size_t len;
+  grub_uint32_t hash;
+  /* The data block in DATABLOCK, or ~0 if none.  */
+  grub_uint64_t datafsb;
+  char *datablock;
+  grub_uint64_t ino;
+};
+
+/* Look for the name in CTX among the COUNT leaf entries ENTS, which are
+   sorted by hash.  Set *MORE if entries with the name's hash may follow
+   in the next leaf.  */
+static grub_err_t
+grub_xfs_hash_search (struct grub_xfs_hash_lookup_ctx *ctx,
+		      const struct grub_xfs_dir_leaf_entry *ents,
+		      grub_uint32_t count, int *more)
+{
+  struct grub_xfs_data *data = ctx->dir->data;
+  int dirblk_log2 = data->sblock.log2_bsize + data->sblock.log2_dirblk;
+  grub_size_t dirblk_size = (grub_size_t) 1 << dirblk_log2;
+  grub_size_t first = ((char *) grub_xfs_first_de (data, ctx->datablock)
+		       - ctx->datablock);
+  grub_uint32_t lo = 0, hi = count, i;
+
+  while (lo < hi)
+    {
+      grub_uint32_t mid = lo + (hi - lo) / 2;
+
+      if (grub_be_to_cpu32 (ents[mid].hashval) < ctx->hash)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+
+  for (i = lo; i < count && grub_be_to_cpu32 (ents[i].hashval) == ctx->hash; i++)
+    {
+      struct grub_xfs_dir2_entry *de;
+      grub_uint64_t byte, fsb;
+      grub_size_t off;
+
+      /* Stale entry.  */
+      if (!ents[i].address)
+	continue;
+
+      byte = (grub_uint64_t) grub_be_to_cpu32 (ents[i].address) << 3;
+      fsb = (byte >> dirblk_log2) << data->sblock.log2_dirblk;
+      off = byte & (dirblk_size - 1);
+      if (off < first
+	  || off + sizeof (*de) + ctx->len > dirblk_size)
+	return grub_error (GRUB_ERR_BAD_FS, "invalid XFS directory entry");
+
+      if (fsb != ctx->datafsb)
+	{
+	  ctx->datafsb = ~(grub_uint64_t) 0;
+	  if (grub_xfs_read_dirblock (ctx->dir, fsb, ctx->datablock))
+	    return grub_errno;
+	  ctx->datafsb = fsb;
+	}
+
+      de = (struct grub_xfs_dir2_entry *) (ctx->datablock + off);
+      if (de->len == ctx->len
+	  && grub_memcmp (de + 1, ctx->name, ctx->len) == 0)
+	{
+	  ctx->ino = grub_be_to_cpu64 (de->inode);
+	  return GRUB_ERR_NONE;
+	}
+    }
+
+  *more = (i == count);
+  return GRUB_ERR_NONE;
+}
+
+/* Look up NAME in the block, leaf or node directory DIR through its hash
+   index.  Returns GRUB_ERR_BAD_FS if the index can't be used.  */
+static grub_err_t
+grub_xfs_hash_lookup (grub_fshelp_node_t dir, const char *name,
+		      grub_fshelp_node_t *foundnode,
+		      enum grub_fshelp_filetype *foundtype)
+{
+  struct grub_xfs_data *data = dir->data;
+  grub_size_t dirblk_size = (grub_size_t) 1 << (data->sblock.log2_bsize
+						+ data->sblock.log2_dirblk);
+  grub_size_t hdr_size = grub_xfs_da_hdr_size (data);
+  struct grub_xfs_hash_lookup_ctx ctx = {
+    .dir = dir,
+    .name = name,
+    .len = grub_strlen (name),
+    .datafsb = ~(grub_uint64_t) 0,
+    .ino = 0
+  };
+  struct grub_xfs_dir_leaf_entry *ents;
+  struct grub_xfs_da_blkinfo *info;
+  char *leafblock;
+  grub_uint32_t count;
+  grub_uint16_t magic;
+  grub_uint64_t fsb;
+  grub_err_t err;
+  int more = 0;
+  int depth;
+
+  ctx.hash = grub_xfs_da_hashname ((const grub_uint8_t *) name, ctx.len,
+				   grub_xfs_sb_has_ascii_ci (data));
+
+  ctx.datablock = grub_malloc (dirblk_size);
+  leafblock = grub_malloc (dirblk_size);
+  if (!ctx.datablock || !leafblock)
+    {
+      err = grub_errno;
+      goto out;
+    }
+
+  err = grub_xfs_read_dirblock (dir, 0, leafblock);
+  if (err)
+    goto out;
+
+  if (grub_be_to_cpu32 (grub_get_unaligned32 (leafblock))
+      == (data->hascrc ? XFS_DIR3_BLOCK_MAGIC : XFS_DIR2_BLOCK_MAGIC))
+    {
+      /* A single block holding both the entries and their hash index.  */
+      struct grub_xfs_dirblock_tail *tail = grub_xfs_dir_tail (data, leafblock);
+
+      count = grub_be_to_cpu32 (tail->leaf_count);
+      if (count > (dirblk_size - hdr_size - sizeof (*tail)) / sizeof (*ents))
+	{
+	  err = grub_error (GRUB_ERR_BAD_FS, "invalid XFS directory block");
+	  goto out;
+	}
+      ents = (struct grub_xfs_dir_leaf_entry *) tail - count;
+      grub_memcpy (ctx.datablock, leafblock, dirblk_size);
+      ctx.datafsb = 0;
+      err = grub_xfs_hash_search (&ctx, ents, count, &more);
+      goto found;
+    }
+
+  /* Go down the hash B+tree, if there is one, to the leaf which may have
+     the name.  */
+  fsb = XFS_DIR2_LEAF_OFFSET >> data->sblock.log2_bsize;
+  for (depth = 0; ; depth++)
+    {
+      struct grub_xfs_da_node_entry *entries;
+      grub_uint32_t i;
+
+      if (depth > 16)
+	{
+	  err = grub_error (GRUB_ERR_BAD_FS, "XFS directory B+tree too deep");
+	  goto out;
+	}
+
+      err = grub_xfs_read_dirblock (dir, fsb, leafblock);
+      if (err)
+	goto out;
+
+      info = (struct grub_xfs_da_blkinfo *) leafblock;
+      magic = grub_be_to_cpu16 (info->magic);
+      if (magic != (data->hascrc ? XFS_DA3_NODE_MAGIC : XFS_DA_NODE_MAGIC))
+	break;
+
+      count = grub_xfs_da_count (data, leafblock);
+      if (count > (dirblk_size - hdr_size) / sizeof (*entries))
+	{
+	  err = grub_error (GRUB_ERR_BAD_FS, "invalid XFS directory node");
+	  goto out;
+	}
+
+      /* Each entry has the highest hash found below it.  */
+      entries = (struct grub_xfs_da_node_entry *) (leafblock + hdr_size);
+      for (i = 0; i < count; i++)
+	if (grub_be_to_cpu32 (entries[i].hashval) >= ctx.hash)
+	  break;
+      if (i == count)
+	goto out;
+      fsb = grub_be_to_cpu32 (entries[i].before);
+    }
+
+  if (magic != (data->hascrc ? XFS_DIR3_LEAF1_MAGIC : XFS_DIR2_LEAF1_MAGIC)
+      && magic != (data->hascrc ? XFS_DIR3_LEAFN_MAGIC : XFS_DIR2_LEAFN_MAGIC))
+    {
+      err = grub_error (GRUB_ERR_BAD_FS, "unknown XFS directory leaf");
+      goto out;
+    }
+
+  while (1)
+    {
+      count = grub_xfs_da_count (data, leafblock);
+      if (count > (dirblk_size - hdr_size) / sizeof (*ents))
+	{
+	  err = grub_error (GRUB_ERR_BAD_FS, "invalid XFS directory leaf");
+	  goto out;
+	}
+
+      ents = (struct grub_xfs_dir_leaf_entry *) (leafblock + hdr_size);
+      err = grub_xfs_hash_search (&ctx, ents, count, &more);
+      if (err || ctx.ino || !more
+	  || magic != (data->hascrc ? XFS_DIR3_LEAFN_MAGIC : XFS_DIR2_LEAFN_MAGIC))
+	break;
+
+      /* Entries with the same hash may continue in the next leaf.  */
+      info = (struct grub_xfs_da_blkinfo *) leafblock;
+      fsb = grub_be_to_cpu32 (info->forw);
+      if (!fsb)
+	break;
+      err = grub_xfs_read_dirblock (dir, fsb, leafblock);
+      if (err)
+	goto out;
+      if (grub_be_to_cpu16 (info->magic) != magic)
+	{
+	  err = grub_error (GRUB_ERR_BAD_FS, "unknown XFS directory leaf");
+	  goto out;
+	}
+    }
+
+ found:
+  if (!err && ctx.ino)
+    {
+      struct grub_fshelp_node *fdiro;
+
+      fdiro = grub_xfs_get_node (data, ctx.ino);
+      if (!fdiro)
+	err = grub_errno;
+      else if (grub_xfs_mode_to_filetype (fdiro->inode.mode)
+	       == GRUB_FSHELP_UNKNOWN)
+	grub_free (fdiro);
+      else
+	{
+	  *foundnode = fdiro;
+	  *foundtype = grub_xfs_mode_to_filetype (fdiro->inode.mode);
+	}
+    }
+
+ out:
+  grub_free (leafblock);
+  grub_free (ctx.datablock);
+  return err;
+}
+
+/* Context for grub_xfs_lookup_file.  */
+struct grub_xfs_lookup_ctx
+{
+  const char *name;
+  struct grub_fshelp_node *foundnode;
+  enum grub_fshelp_filetype foundtype;
+};
+
+/* Helper for grub_xfs_lookup_file.  */
+static int
+grub_xfs_lookup_iter (const char *filename, enum grub_fshelp_filetype filetype,
+		      grub_fshelp_node_t node, void *data)
+{
+  struct grub_xfs_lookup_ctx *ctx = data;
+
+  if (filetype == GRUB_FSHELP_UNKNOWN || grub_strcmp (ctx->name, filename))
+    {
+      grub_free (node);
+      return 0;
+    }
+
+  ctx->foundnode = node;
+  ctx->foundtype = filetype;
+  return 1;
+}
+
+/* Look up NAME in the directory DIR, using its hash index if it has
+   one.  */
+static grub_err_t
+grub_xfs_lookup_file (grub_fshelp_node_t dir, const char *name,
+		      grub_fshelp_node_t *foundnode,
+		      enum grub_fshelp_filetype *foundtype)
+{
+  struct grub_xfs_lookup_ctx ctx = {
+    .name = name,
+    .foundnode = 0,
+    .foundtype = GRUB_FSHELP_UNKNOWN
+  };
+
+  *foundnode = 0;
+
+  if (dir->inode.format == XFS_INODE_FORMAT_EXT
+      || dir->inode.format == XFS_INODE_FORMAT_BTREE)
+    {
+      grub_err_t err;
+
+      err = grub_xfs_hash_lookup (dir, name, foundnode, foundtype);
+      if (err != GRUB_ERR_BAD_FS)
+	return err;
+
+      /* Fall back to scanning the entries.  */
+      grub_dprintf ("xfs", "hash index of inode %" PRIuGRUB_UINT64_T
+		    " unusable: %s\n", dir->ino, grub_errmsg);
+      grub_errno = GRUB_ERR_NONE;
+    }
+
+  grub_xfs_iterate_dir (dir, grub_xfs_lookup_iter, &ctx);
+  if (grub_errno)
+    return grub_errno;
+
+  *foundnode = ctx.foundnode;
+  *foundtype = ctx.foundtype;
+  return GRUB_ERR_NONE;
+}
+
 static struct grub_xfs_data *
 grub_xfs_mount (grub_disk_t disk)
 {
   struct grub_xfs_data *data = 0;
   grub_size_t sz;
 
+  /* Only the root directory has to be set up again in a parked mount.  */
+  data = grub_fshelp_mount_get ("xfs", disk);
+  if (data)
+    goto init_root;
+
   data = grub_zalloc (sizeof (struct grub_xfs_data));
   if (!data)
     return 0;
@@ -1029,6 +1590,8 @@ grub_xfs_mount (grub_disk_t disk)
     goto fail;
 
   data->data_size = sz;
+
+ init_root:
   data->diropen.data = data;
   data->diropen.ino = grub_be_to_cpu64(data->sblock.rootino);
   data->diropen.inode_read = 1;
@@ -1055,6 +1618,22 @@ grub_xfs_mount (grub_disk_t disk)
   return 0;
 }
 
+static void
+grub_xfs_free (void *ptr)
+{
+  struct grub_xfs_data *data = ptr;
+
+  grub_free (data->exts);
+  grub_free (data);
+}
+
+/* Release DATA, keeping the mount for the next user of its disk.  */
+static void
+grub_xfs_unmount (struct grub_xfs_data *data)
+{
+  grub_fshelp_mount_put ("xfs", data->disk, data, grub_xfs_free);
+}
+
 
 /* Context for grub_xfs_dir.  */
 struct grub_xfs_dir_ctx
@@ -1097,6 +1676,11 @@ grub_xfs_dir_iter (const char *filename, enum grub_fshelp_filetype filetype,
     {
       info.mtimeset = 1;
       info.mtime = grub_xfs_get_inode_time (&node->inode);
+      if ((filetype & GRUB_FSHELP_TYPE_MASK) == GRUB_FSHELP_REG)
+	{
+	  info.sizeset = 1;
+	  info.size = grub_be_to_cpu64 (node->inode.size);
+	}
     }
   info.dir = ((filetype & GRUB_FSHELP_TYPE_MASK) == GRUB_FSHELP_DIR);
   grub_free (node);
@@ -1117,8 +1701,9 @@ grub_xfs_dir (grub_device_t device, const char *path,
   if (!data)
     goto mount_fail;
 
-  grub_fshelp_find_file (path, &data->diropen, &fdiro, grub_xfs_iterate_dir,
-			 grub_xfs_read_symlink, GRUB_FSHELP_DIR);
+  grub_fshelp_find_file_lookup (path, &data->diropen, &fdiro,
+				grub_xfs_lookup_file, grub_xfs_read_symlink,
+				GRUB_FSHELP_DIR);
   if (grub_errno)
     goto fail;
 
@@ -1127,7 +1712,7 @@ grub_xfs_dir (grub_device_t device, const char *path,
  fail:
   if (fdiro != &data->diropen)
     grub_free (fdiro);
-  grub_free (data);
+  grub_xfs_unmount (data);
 
  mount_fail:
 
@@ -1150,8 +1735,9 @@ grub_xfs_open (struct grub_file *file, const char *name)
   if (!data)
     goto mount_fail;
 
-  grub_fshelp_find_file (name, &data->diropen, &fdiro, grub_xfs_iterate_dir,
-			 grub_xfs_read_symlink, GRUB_FSHELP_REG);
+  grub_fshelp_find_file_lookup (name, &data->diropen, &fdiro,
+				grub_xfs_lookup_file, grub_xfs_read_symlink,
+				GRUB_FSHELP_REG);
   if (grub_errno)
     goto fail;
 
@@ -1177,7 +1763,7 @@ grub_xfs_open (struct grub_file *file, const char *name)
  fail:
   if (fdiro != &data->diropen)
     grub_free (fdiro);
-  grub_free (data);
+  grub_xfs_unmount (data);
 
  mount_fail:
   grub_dl_unref (my_mod);
@@ -1201,7 +1787,7 @@ grub_xfs_read (grub_file_t file, char *buf, grub_size_t len)
 static grub_err_t
 grub_xfs_close (grub_file_t file)
 {
-  grub_free (file->data);
+  grub_xfs_unmount (file->data);
 
   grub_dl_unref (my_mod);
 
@@ -1223,9 +1809,10 @@ grub_xfs_label (grub_device_t device, char **label)
   else
     *label = 0;
 
-  grub_dl_unref (my_mod);
+  if (data)
+    grub_xfs_unmount (data);
 
-  grub_free (data);
+  grub_dl_unref (my_mod);
 
   return grub_errno;
 }
@@ -1254,9 +1841,10 @@ grub_xfs_uuid (grub_device_t device, char **uuid)
   else
     *uuid = NULL;
 
-  grub_dl_unref (my_mod);
+  if (data)
+    grub_xfs_unmount (data);
 
-  grub_free (data);
+  grub_dl_unref (my_mod);
 
   return grub_errno;
 }
@@ -1288,4 +1876,5 @@ GRUB_MOD_INIT(xfs)
 GRUB_MOD_FINI(xfs)
 {
   grub_fs_unregister (&grub_xfs_fs);
+  grub_fshelp_mount_flush ("xfs");
 }
@@ -259,6 +259,8 @@ struct grub_zfs_data
   uberblock_t current_uberblock;
 
   grub_uint64_t guid;
+  /* Number of top-level vdevs of the pool, 0 if the label doesn't say.  */
+  grub_uint64_t vdev_children;
 };
 
 /* Context for grub_zfs_dir.  */
@@ -1095,7 +1097,13 @@ check_pool_label (struct grub_zfs_data *data,
   grub_dprintf ("zfs", "check 11 passed\n");
 
   if (original)
-    data->guid = poolguid;
+    {
+      data->guid = poolguid;
+      if (!grub_zfs_nvlist_lookup_uint64 (nvlist, ZPOOL_CONFIG_VDEV_CHILDREN,
+					  &data->vdev_children))
+	data->vdev_children = 0;
+      grub_errno = GRUB_ERR_NONE;
+    }
 
   if (data->guid != poolguid)
     return grub_error (GRUB_ERR_BAD_FS, "another zpool");
@@ -1149,6 +1157,169 @@ check_pool_label (struct grub_zfs_data *data,
   return GRUB_ERR_NONE;
 }
 
+/*
+ * Pool members found by scan_disk, with the label and uberblock chosen for
+ * them, so that later mounts neither look for the best uberblock again nor
+ * probe every device to find the rest of the pool.  Dropped whenever
+ * grub_disk_generation changes, like the zio cache.
+ */
+#define ZFS_DEVICE_CACHE_ENTRIES	128
+
+struct zfs_device_cache_entry
+{
+  int valid;
+  unsigned long dev_id;
+  unsigned long disk_id;
+  grub_disk_addr_t part_start;
+  /* The name to open the device by, NULL if it has only been mounted.  */
+  char *name;
+  grub_uint64_t pool_guid;
+  grub_disk_addr_t vdev_phys_sector;
+  uberblock_t uberblock;
+};
+
+static struct zfs_device_cache_entry zfs_device_cache[ZFS_DEVICE_CACHE_ENTRIES];
+static unsigned zfs_device_cache_next;
+static unsigned long zfs_device_cache_generation;
+
+static void
+zfs_device_cache_flush (void)
+{
+  unsigned i;
+
+  for (i = 0; i < ZFS_DEVICE_CACHE_ENTRIES; i++)
+    {
+      grub_free (zfs_device_cache[i].name);
+      zfs_device_cache[i].name = NULL;
+      zfs_device_cache[i].valid = 0;
+    }
+}
+
+static void
+zfs_device_cache_expire (void)
+{
+  if (zfs_device_cache_generation != grub_disk_generation)
+    {
+      zfs_device_cache_flush ();
+      zfs_device_cache_generation = grub_disk_generation;
+    }
+}
+
+static struct zfs_device_cache_entry *
+zfs_device_cache_find (grub_disk_t disk)
+{
+  unsigned i;
+
+  for (i = 0; i < ZFS_DEVICE_CACHE_ENTRIES; i++)
+    if (zfs_device_cache[i].valid
+	&& zfs_device_cache[i].dev_id == disk->dev->id
+	&& zfs_device_cache[i].disk_id == disk->id
+	&& zfs_device_cache[i].part_start
+	== grub_partition_get_start (disk->partition))
+      return &zfs_device_cache[i];
+  return NULL;
+}
+
+/* Return whether NAME is known to be a member of the pool POOL_GUID.  */
+static int
+zfs_device_cache_has_name (const char *name, grub_uint64_t pool_guid)
+{
+  unsigned i;
+
+  for (i = 0; i < ZFS_DEVICE_CACHE_ENTRIES; i++)
+    if (zfs_device_cache[i].valid && zfs_device_cache[i].name
+	&& zfs_device_cache[i].pool_guid == pool_guid
+	&& grub_strcmp (zfs_device_cache[i].name, name) == 0)
+      return 1;
+  return 0;
+}
+
+static void
+zfs_device_cache_add (grub_disk_t disk, grub_uint64_t pool_guid,
+		      const struct grub_zfs_device_desc *desc)
+{
+  struct zfs_device_cache_entry *e;
+  unsigned i;
+
+  e = zfs_device_cache_find (disk);
+  if (!e)
+    {
+      for (i = 0; i < ZFS_DEVICE_CACHE_ENTRIES; i++)
+	if (!zfs_device_cache[i].valid)
+	  {
+	    e = &zfs_device_cache[i];
+	    break;
+	  }
+      if (!e)
+	{
+	  e = &zfs_device_cache[zfs_device_cache_next];
+	  zfs_device_cache_next = (zfs_device_cache_next + 1)
+	    % ZFS_DEVICE_CACHE_ENTRIES;
+	}
+      grub_free (e->name);
+      e->name = NULL;
+    }
+
+  e->valid = 1;
+  e->dev_id = disk->dev->id;
+  e->disk_id = disk->id;
+  e->part_start = grub_partition_get_start (disk->partition);
+  e->pool_guid = pool_guid;
+  e->vdev_phys_sector = desc->vdev_phys_sector;
+  e->uberblock = desc->current_uberblock;
+}
+
+/* Return whether every vdev under DESC has its device.  */
+static int
+vdev_complete (const struct grub_zfs_device_desc *desc)
+{
+  unsigned i;
+
+  if (desc->type == DEVICE_LEAF)
+    return desc->dev != NULL;
+
+  if (!desc->children)
+    return 0;
+  for (i = 0; i < desc->n_children; i++)
+    if (!vdev_complete (&desc->children[i]))
+      return 0;
+  return 1;
+}
+
+/* Return whether all devices of the pool of DATA are there, as far as can
+   be told.  */
+static int
+pool_complete (struct grub_zfs_data *data)
+{
+  unsigned i;
+
+  if (!data->vdev_children || data->n_devices_attached < data->vdev_children)
+    return 0;
+  for (i = 0; i < data->n_devices_attached; i++)
+    if (!vdev_complete (&data->devices_attached[i]))
+      return 0;
+  return 1;
+}
+
+/* Return whether the label whose vdev_phys_t is at SECTOR may be valid.
+   Only its last sector is read, so that devices without ZFS labels
+   aren't read 240K at a time.  */
+static int
+label_present (grub_disk_t disk, grub_disk_addr_t sector)
+{
+  zio_eck_t zbt;
+
+  if (grub_disk_read (disk, sector + (VDEV_PHYS_SIZE >> SPA_MINBLOCKSHIFT) - 1,
+		      (1 << SPA_MINBLOCKSHIFT) - sizeof (zbt), sizeof (zbt),
+		      &zbt))
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return 0;
+    }
+  return (grub_zfs_to_cpu64 (zbt.zec_magic, GRUB_ZFS_LITTLE_ENDIAN) == ZEC_MAGIC
+	  || grub_zfs_to_cpu64 (zbt.zec_magic, GRUB_ZFS_BIG_ENDIAN) == ZEC_MAGIC);
+}
+
 static grub_err_t
 scan_disk (grub_device_t dev, struct grub_zfs_data *data,
 	   int original, int *inserted)
@@ -1159,6 +1330,31 @@ scan_disk (grub_device_t dev, struct grub_zfs_data *data,
   grub_err_t err;
   int vdevnum;
   struct grub_zfs_device_desc desc;
+  struct zfs_device_cache_entry *cached;
+
+  desc.dev = dev;
+  desc.original = original;
+
+  zfs_device_cache_expire ();
+  cached = zfs_device_cache_find (dev->disk);
+  if (cached && !original && cached->pool_guid != data->guid)
+    return grub_error (GRUB_ERR_BAD_FS, "another zpool");
+  if (cached)
+    {
+      desc.vdev_phys_sector = cached->vdev_phys_sector;
+      desc.current_uberblock = cached->uberblock;
+      err = check_pool_label (data, &desc, inserted, original);
+      if (!err && *inserted)
+	{
+	  if (original)
+	    data->current_uberblock = desc.current_uberblock;
+	  return GRUB_ERR_NONE;
+	}
+      if (!err)
+	return grub_error (GRUB_ERR_BAD_FS, "couldn't find a valid label");
+      /* Look at all the labels again.  */
+      grub_errno = GRUB_ERR_NONE;
+    }
 
   ub_array = grub_malloc (VDEV_UBERBLOCK_RING);
   if (!ub_array)
@@ -1173,9 +1369,6 @@ scan_disk (grub_device_t dev, struct grub_zfs_data *data,
 
   vdevnum = VDEV_LABELS;
 
-  desc.dev = dev;
-  desc.original = original;
-
   /* Don't check back labels on CDROM.  */
   if (grub_disk_native_sectors (dev->disk) == GRUB_DISK_SIZE_UNKNOWN)
     vdevnum = VDEV_LABELS / 2;
@@ -1189,6 +1382,9 @@ scan_disk (grub_device_t dev, struct grub_zfs_data *data,
 	   ALIGN_DOWN (grub_disk_native_sectors (dev->disk), sizeof (vdev_label_t))
 	   - VDEV_LABELS * (sizeof (vdev_label_t) >> SPA_MINBLOCKSHIFT));
 
+      if (!label_present (dev->disk, desc.vdev_phys_sector))
+	continue;
+
       /* Read in the uberblock ring (128K). */
       err = grub_disk_read (dev->disk, desc.vdev_phys_sector
 			    + (VDEV_PHYS_SIZE >> SPA_MINBLOCKSHIFT),
@@ -1220,6 +1416,7 @@ scan_disk (grub_device_t dev, struct grub_zfs_data *data,
       if (original)
 	grub_memmove (&(data->current_uberblock),
 		      &ubbest->ubp_uberblock, sizeof (uberblock_t));
+      zfs_device_cache_add (dev->disk, data->guid, &desc);
 
 #if 0
       if (find_best_root &&
@@ -1238,11 +1435,12 @@ scan_disk (grub_device_t dev, struct grub_zfs_data *data,
   return grub_error (GRUB_ERR_BAD_FS, "couldn't find a valid label");
 }
 
-/* Helper for scan_devices.  */
+/* Add the device NAME to DATA if it is a member of its pool.  Return 1
+   once the pool is complete.  */
 static int
-scan_devices_iter (const char *name, void *hook_data)
+scan_device (const char *name, struct grub_zfs_data *data)
 {
-  struct grub_zfs_data *data = hook_data;
+  struct zfs_device_cache_entry *cached;
   grub_device_t dev;
   grub_err_t err;
   int inserted;
@@ -1270,14 +1468,56 @@ scan_devices_iter (const char *name, void *hook_data)
     }
 
   if (!inserted)
-    grub_device_close (dev);
+    {
+      grub_device_close (dev);
+      return 0;
+    }
 
-  return 0;
+  cached = zfs_device_cache_find (dev->disk);
+  if (cached && !cached->name)
+    {
+      cached->name = grub_strdup (name);
+      grub_errno = GRUB_ERR_NONE;
+    }
+
+  return pool_complete (data);
+}
+
+/* Helper for scan_devices.  */
+static int
+scan_devices_iter (const char *name, void *hook_data)
+{
+  struct grub_zfs_data *data = hook_data;
+
+  /* Already tried by scan_devices.  */
+  if (zfs_device_cache_has_name (name, data->guid))
+    return 0;
+
+  return scan_device (name, data);
 }
 
 static grub_err_t
 scan_devices (struct grub_zfs_data *data)
 {
+  unsigned i;
+
+  /* The members found before are likely all there is.  */
+  zfs_device_cache_expire ();
+  for (i = 0; i < ZFS_DEVICE_CACHE_ENTRIES; i++)
+    if (zfs_device_cache[i].valid && zfs_device_cache[i].name
+	&& zfs_device_cache[i].pool_guid == data->guid)
+      {
+	char *name = grub_strdup (zfs_device_cache[i].name);
+	int complete;
+
+	if (!name)
+	  return grub_errno;
+	complete = scan_device (name, data);
+	grub_free (name);
+	if (complete)
+	  return GRUB_ERR_NONE;
+      }
+
   grub_device_iterate (scan_devices_iter, data);
   return GRUB_ERR_NONE;
 }
@@ -1847,6 +2087,149 @@ decode_embedded_bp_compressed(const blkptr_t *bp, void *buf)
   return GRUB_ERR_NONE;
 }
 
+/*
+ * Cache of blocks which have been read, verified and decompressed by
+ * zio_read, so that the MOS, indirect blocks and ZAP objects used by
+ * every command aren't read and verified over and over.  A block pointer
+ * of a pool fully identifies the contents, so blocks are looked up by
+ * their first DVA, properties, birth txg and checksum.  The cache is
+ * shared by all mounts and dropped whenever grub_disk_generation changes.
+ */
+#define ZIO_CACHE_ENTRIES	64
+#define ZIO_CACHE_BYTES		(4 << 20)
+/* Blocks larger than this aren't cached, they would evict everything.  */
+#define ZIO_CACHE_MAX_BLOCK	(ZIO_CACHE_BYTES / 8)
+
+struct zio_cache_entry
+{
+  grub_uint64_t guid;
+  dva_t dva;
+  grub_uint64_t prop;
+  grub_uint64_t birth;
+  zio_cksum_t cksum;
+  grub_uint64_t last_use;
+  grub_size_t size;
+  void *buf;
+};
+
+static struct zio_cache_entry zio_cache[ZIO_CACHE_ENTRIES];
+static grub_size_t zio_cache_bytes;
+static grub_uint64_t zio_cache_clock;
+static unsigned long zio_cache_generation;
+
+static void
+zio_cache_free_entry (struct zio_cache_entry *e)
+{
+  zio_cache_bytes -= e->size;
+  grub_free (e->buf);
+  e->buf = NULL;
+  e->size = 0;
+}
+
+static void
+zio_cache_flush (void)
+{
+  unsigned i;
+
+  for (i = 0; i < ZIO_CACHE_ENTRIES; i++)
+    if (zio_cache[i].buf)
+      zio_cache_free_entry (&zio_cache[i]);
+}
+
+static int
+zio_cache_match (const struct zio_cache_entry *e, const blkptr_t *bp,
+		 const struct grub_zfs_data *data)
+{
+  return e->buf && e->guid == data->guid
+    && e->birth == bp->blk_birth && e->prop == bp->blk_prop
+    && grub_memcmp (&e->dva, &bp->blk_dva[0], sizeof (e->dva)) == 0
+    && grub_memcmp (&e->cksum, &bp->blk_cksum, sizeof (e->cksum)) == 0;
+}
+
+/* Return a copy of the cached contents of BP in *BUF, if there are any.  */
+static int
+zio_cache_lookup (const blkptr_t *bp, void **buf,
+		  const struct grub_zfs_data *data)
+{
+  unsigned i;
+
+  if (zio_cache_generation != grub_disk_generation)
+    {
+      zio_cache_flush ();
+      zio_cache_generation = grub_disk_generation;
+      return 0;
+    }
+
+  for (i = 0; i < ZIO_CACHE_ENTRIES; i++)
+    if (zio_cache_match (&zio_cache[i], bp, data))
+      {
+	*buf = grub_malloc (zio_cache[i].size);
+	if (!*buf)
+	  {
+	    grub_errno = GRUB_ERR_NONE;
+	    return 0;
+	  }
+	grub_memcpy (*buf, zio_cache[i].buf, zio_cache[i].size);
+	zio_cache[i].last_use = ++zio_cache_clock;
+	return 1;
+      }
+
+  return 0;
+}
+
+/* Remember the SIZE bytes of BUF as the contents of BP.  */
+static void
+zio_cache_insert (const blkptr_t *bp, const void *buf, grub_size_t size,
+		  const struct grub_zfs_data *data)
+{
+  struct zio_cache_entry *e = NULL;
+  void *copy;
+  unsigned i;
+
+  if (size == 0 || size > ZIO_CACHE_MAX_BLOCK)
+    return;
+
+  copy = grub_malloc (size);
+  if (!copy)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+  grub_memcpy (copy, buf, size);
+
+  /* Evict the least recently used blocks until both a slot and the
+     space are free.  */
+  while (1)
+    {
+      struct zio_cache_entry *lru = NULL;
+
+      e = NULL;
+      for (i = 0; i < ZIO_CACHE_ENTRIES; i++)
+	{
+	  if (!zio_cache[i].buf)
+	    {
+	      if (!e)
+		e = &zio_cache[i];
+	    }
+	  else if (!lru || zio_cache[i].last_use < lru->last_use)
+	    lru = &zio_cache[i];
+	}
+      if (e && zio_cache_bytes + size <= ZIO_CACHE_BYTES)
+	break;
+      zio_cache_free_entry (lru);
+    }
+
+  e->guid = data->guid;
+  e->dva = bp->blk_dva[0];
+  e->prop = bp->blk_prop;
+  e->birth = bp->blk_birth;
+  e->cksum = bp->blk_cksum;
+  e->last_use = ++zio_cache_clock;
+  e->size = size;
+  e->buf = copy;
+  zio_cache_bytes += size;
+}
+
 /*
  * Read in a block of data, verify its checksum, decompress if needed,
  * and put the uncompressed data in buf.
@@ -1890,6 +2273,11 @@ zio_read (blkptr_t *bp, grub_zfs_endian_t endian, void **buf,
   if (size)
     *size = lsize;
 
+  /* Encrypted blocks depend on the keys of the subvolume, so only plain
+     blocks are cached.  */
+  if (!BP_IS_EMBEDDED (bp) && !encrypted && zio_cache_lookup (bp, buf, data))
+    return GRUB_ERR_NONE;
+
   if (comp >= ZIO_COMPRESS_FUNCTIONS)
     return grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
 		       "compression algorithm %u not supported\n", (unsigned int) comp);
@@ -2002,6 +2390,9 @@ zio_read (blkptr_t *bp, grub_zfs_endian_t endian, void **buf,
 	}
     }
 
+  if (!BP_IS_EMBEDDED (bp) && !encrypted)
+    zio_cache_insert (bp, *buf, lsize, data);
+
   return GRUB_ERR_NONE;
 }
 
@@ -4433,4 +4824,6 @@ GRUB_MOD_INIT (zfs)
 GRUB_MOD_FINI (zfs)
 {
   grub_fs_unregister (&grub_zfs_fs);
+  zio_cache_flush ();
+  zfs_device_cache_flush ();
 }
@@ -42,8 +42,7 @@
  * SHA-256 checksum, as specified in FIPS 180-2, available at:
  * http://csrc.nist.gov/cryptval
  *
- * This is a very compact implementation of SHA-256.
- * It is designed to be simple and portable, not to be fast.
+ * This is a compact and portable implementation of SHA-256.
  */
 
 /*
@@ -81,26 +80,51 @@ static const grub_uint32_t SHA256_K[64] = {
 	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
 };
 
+/*
+ * The rounds are unrolled by eight so that the working variables rotate
+ * through the macro arguments instead of being moved every round, and the
+ * message schedule is kept in a 16 word ring.
+ */
+#define	SHA256_ROUND(a, b, c, d, e, f, g, h, t, w) do {			\
+	grub_uint32_t T1 = (h) + SIGMA1(e) + Ch(e, f, g) + SHA256_K[t] + (w); \
+	(d) += T1;							\
+	(h) = T1 + SIGMA0(a) + Maj(a, b, c);				\
+} while (0)
+
+#define	SHA256_W(t)	(W[(t) & 15] += sigma1(W[((t) - 2) & 15]) +	\
+			    W[((t) - 7) & 15] + sigma0(W[((t) - 15) & 15]))
+
 static void
 SHA256Transform(grub_uint32_t *H, const grub_uint8_t *cp)
 {
-	grub_uint32_t a, b, c, d, e, f, g, h, t, T1, T2, W[64];
+	grub_uint32_t a, b, c, d, e, f, g, h, t, W[16];
 
 	for (t = 0; t < 16; t++, cp += 4)
-		W[t] = (cp[0] << 24) | (cp[1] << 16) | (cp[2] << 8) | cp[3];
-
-	for (t = 16; t < 64; t++)
-		W[t] = sigma1(W[t - 2]) + W[t - 7] +
-		    sigma0(W[t - 15]) + W[t - 16];
+		W[t] = grub_be_to_cpu32 (grub_get_unaligned32 (cp));
 
 	a = H[0]; b = H[1]; c = H[2]; d = H[3];
 	e = H[4]; f = H[5]; g = H[6]; h = H[7];
 
-	for (t = 0; t < 64; t++) {
-		T1 = h + SIGMA1(e) + Ch(e, f, g) + SHA256_K[t] + W[t];
-		T2 = SIGMA0(a) + Maj(a, b, c);
-		h = g; g = f; f = e; e = d + T1;
-		d = c; c = b; b = a; a = T1 + T2;
+	for (t = 0; t < 16; t += 8) {
+		SHA256_ROUND(a, b, c, d, e, f, g, h, t + 0, W[t + 0]);
+		SHA256_ROUND(h, a, b, c, d, e, f, g, t + 1, W[t + 1]);
+		SHA256_ROUND(g, h, a, b, c, d, e, f, t + 2, W[t + 2]);
+		SHA256_ROUND(f, g, h, a, b, c, d, e, t + 3, W[t + 3]);
+		SHA256_ROUND(e, f, g, h, a, b, c, d, t + 4, W[t + 4]);
+		SHA256_ROUND(d, e, f, g, h, a, b, c, t + 5, W[t + 5]);
+		SHA256_ROUND(c, d, e, f, g, h, a, b, t + 6, W[t + 6]);
+		SHA256_ROUND(b, c, d, e, f, g, h, a, t + 7, W[t + 7]);
+	}
+
+	for (; t < 64; t += 8) {
+		SHA256_ROUND(a, b, c, d, e, f, g, h, t + 0, SHA256_W(t + 0));
+		SHA256_ROUND(h, a, b, c, d, e, f, g, t + 1, SHA256_W(t + 1));
+		SHA256_ROUND(g, h, a, b, c, d, e, f, t + 2, SHA256_W(t + 2));
+		SHA256_ROUND(f, g, h, a, b, c, d, e, t + 3, SHA256_W(t + 3));
+		SHA256_ROUND(e, f, g, h, a, b, c, d, t + 4, SHA256_W(t + 4));
+		SHA256_ROUND(d, e, f, g, h, a, b, c, t + 5, SHA256_W(t + 5));
+		SHA256_ROUND(c, d, e, f, g, h, a, b, t + 6, SHA256_W(t + 6));
+		SHA256_ROUND(b, c, d, e, f, g, h, a, t + 7, SHA256_W(t + 7));
 	}
 
 	H[0] += a; H[1] += b; H[2] += c; H[3] += d;
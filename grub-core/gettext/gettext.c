@@ -26,6 +26,7 @@
 #include <grub/file.h>
 #include <grub/kernel.h>
 #include <grub/i18n.h>
+#include <grub/safemath.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -49,6 +50,8 @@ struct header
   grub_uint32_t number_of_strings;
   grub_uint32_t offset_original;
   grub_uint32_t offset_translation;
+  grub_uint32_t hash_size;
+  grub_uint32_t offset_hash;
 };
 
 struct string_descriptor
@@ -57,11 +60,15 @@ struct string_descriptor
   grub_uint32_t offset;
 };
 
+/* The descriptor and hash tables are kept in memory, as they are in the
+   file, the strings are read when first needed.  */
 struct grub_gettext_context
 {
   grub_file_t fd_mo;
-  grub_off_t grub_gettext_offset_original;
-  grub_off_t grub_gettext_offset_translation;
+  struct string_descriptor *grub_gettext_originals;
+  struct string_descriptor *grub_gettext_translations;
+  grub_uint32_t *grub_gettext_hash;
+  grub_uint32_t grub_gettext_hash_size;
   grub_size_t grub_gettext_max;
   int grub_gettext_max_log;
   struct grub_gettext_msg *grub_gettext_msg_list;
@@ -88,28 +95,51 @@ grub_gettext_pread (grub_file_t file, void *buf, grub_size_t len,
   return GRUB_ERR_NONE;
 }
 
+/* Read the table of N entries of SIZE bytes at OFFSET.  */
+static void *
+grub_gettext_read_table (grub_file_t file, grub_size_t n, grub_size_t size,
+			 grub_off_t offset)
+{
+  grub_size_t len;
+  void *table;
+
+  if (grub_mul (n, size, &len))
+    {
+      grub_error (GRUB_ERR_OUT_OF_RANGE, N_("overflow is detected"));
+      return NULL;
+    }
+
+  table = grub_malloc (len);
+  if (!table)
+    return NULL;
+  if (grub_gettext_pread (file, table, len, offset))
+    {
+      grub_free (table);
+      return NULL;
+    }
+  return table;
+}
+
 static char *
 grub_gettext_getstr_from_position (struct grub_gettext_context *ctx,
-				   grub_off_t off,
+				   const struct string_descriptor *table,
 				   grub_size_t position)
 {
-  grub_off_t internal_position;
   grub_size_t length;
+  grub_size_t size;
   grub_off_t offset;
   char *translation;
-  struct string_descriptor desc;
   grub_err_t err;
 
-  internal_position = (off + position * sizeof (desc));
+  length = grub_le_to_cpu32 (table[position].length);
+  offset = grub_le_to_cpu32 (table[position].offset);
 
-  err = grub_gettext_pread (ctx->fd_mo, (char *) &desc,
-			    sizeof (desc), internal_position);
-  if (err)
-    return NULL;
-  length = grub_cpu_to_le32 (desc.length);
-  offset = grub_cpu_to_le32 (desc.offset);
-
-  translation = grub_malloc (length + 1);
+  if (grub_add (length, 1, &size))
+    {
+      grub_error (GRUB_ERR_OUT_OF_RANGE, N_("overflow is detected"));
+      return NULL;
+    }
+  translation = grub_malloc (size);
   if (!translation)
     return NULL;
 
@@ -131,7 +161,7 @@ grub_gettext_gettranslation_from_position (struct grub_gettext_context *ctx,
   if (!ctx->grub_gettext_msg_list[position].translated)
     ctx->grub_gettext_msg_list[position].translated
       = grub_gettext_getstr_from_position (ctx,
-					   ctx->grub_gettext_offset_translation,
+					   ctx->grub_gettext_translations,
 					   position);
   return ctx->grub_gettext_msg_list[position].translated;
 }
@@ -143,32 +173,83 @@ grub_gettext_getstring_from_position (struct grub_gettext_context *ctx,
   if (!ctx->grub_gettext_msg_list[position].name)
     ctx->grub_gettext_msg_list[position].name
       = grub_gettext_getstr_from_position (ctx,
-					   ctx->grub_gettext_offset_original,
+					   ctx->grub_gettext_originals,
 					   position);
   return ctx->grub_gettext_msg_list[position].name;
 }
 
-static const char *
-grub_gettext_translate_real (struct grub_gettext_context *ctx,
-			     const char *orig)
+/* The hash function of GNU gettext.  */
+static grub_uint32_t
+grub_gettext_hash_string (const char *str)
 {
-  grub_size_t current = 0;
-  int i;
+  grub_uint32_t hval = 0, g;
+
+  while (*str)
+    {
+      hval = (hval << 4) + (grub_uint8_t) *str++;
+      g = hval & 0xf0000000;
+      if (g)
+	{
+	  hval ^= g >> 24;
+	  hval ^= g;
+	}
+    }
+  return hval;
+}
+
+/* Find ORIG with the hash table of the file, by open addressing with double
+   hashing as msgfmt fills it.  Only the strings that are as long as ORIG
+   need to be read.  */
+static int
+grub_gettext_lookup_hash (struct grub_gettext_context *ctx, const char *orig,
+			  grub_size_t *position)
+{
+  grub_uint32_t size = ctx->grub_gettext_hash_size;
+  grub_uint32_t hash = grub_gettext_hash_string (orig);
+  grub_uint32_t idx = hash % size;
+  grub_uint32_t incr = 1 + hash % (size - 2);
+  grub_size_t len = grub_strlen (orig);
   const char *current_string;
-  static int depth = 0;
+  grub_uint32_t i;
 
-  if (!ctx->grub_gettext_msg_list || !ctx->fd_mo)
-    return NULL;
+  /* A broken table must not make us loop forever.  */
+  for (i = 0; i < size; i++)
+    {
+      grub_uint32_t n = grub_le_to_cpu32 (ctx->grub_gettext_hash[idx]);
 
-  /* Shouldn't happen. Just a precaution if our own code
-     calls gettext somehow.  */
-  if (depth > 2)
-    return NULL;
-  depth++;
+      if (n == 0)
+	return 0;
+      n--;
 
-  /* Make sure we can use grub_gettext_translate for error messages.  Push
-     active error message to error stack and reset error message.  */
-  grub_error_push ();
+      /* Strings with a plural form are longer than their singular part.  */
+      if (n < ctx->grub_gettext_max
+	  && grub_le_to_cpu32 (ctx->grub_gettext_originals[n].length) >= len)
+	{
+	  current_string = grub_gettext_getstring_from_position (ctx, n);
+	  if (!current_string)
+	    return 0;
+	  if (grub_strcmp (current_string, orig) == 0)
+	    {
+	      *position = n;
+	      return 1;
+	    }
+	}
+
+      if (idx >= size - incr)
+	idx -= size - incr;
+      else
+	idx += incr;
+    }
+  return 0;
+}
+
+static int
+grub_gettext_lookup_bisect (struct grub_gettext_context *ctx,
+			    const char *orig, grub_size_t *position)
+{
+  grub_size_t current = 0;
+  int i;
+  const char *current_string;
 
   for (i = ctx->grub_gettext_max_log; i >= 0; i--)
     {
@@ -180,14 +261,8 @@ grub_gettext_translate_real (struct grub_gettext_context *ctx,
 	continue;
 
       current_string = grub_gettext_getstring_from_position (ctx, test);
-
       if (!current_string)
-	{
-	  grub_errno = GRUB_ERR_NONE;
-	  grub_error_pop ();
-	  depth--;
-	  return NULL;
-	}
+	return 0;
 
       /* Search by bisection.  */
       cmp = grub_strcmp (current_string, orig);
@@ -195,53 +270,61 @@ grub_gettext_translate_real (struct grub_gettext_context *ctx,
 	current = test;
       if (cmp == 0)
 	{
-	  const char *ret = 0;
-	  ret = grub_gettext_gettranslation_from_position (ctx, current);
-	  if (!ret)
-	    {
-	      grub_errno = GRUB_ERR_NONE;
-	      grub_error_pop ();
-	      depth--;
-	      return NULL;
-	    }
-	  grub_error_pop ();
-	  depth--;
-	  return ret;
+	  *position = current;
+	  return 1;
 	}
     }
 
   if (current == 0 && ctx->grub_gettext_max != 0)
     {
       current_string = grub_gettext_getstring_from_position (ctx, 0);
-
       if (!current_string)
-	{
-	  grub_errno = GRUB_ERR_NONE;
-	  grub_error_pop ();
-	  depth--;
-	  return NULL;
-	}
+	return 0;
 
       if (grub_strcmp (current_string, orig) == 0)
 	{
-	  const char *ret = 0;
-	  ret = grub_gettext_gettranslation_from_position (ctx, current);
-	  if (!ret)
-	    {
-	      grub_errno = GRUB_ERR_NONE;
-	      grub_error_pop ();
-	      depth--;
-	      return NULL;
-	    }
-	  grub_error_pop ();
-	  depth--;
-	  return ret;
+	  *position = 0;
+	  return 1;
 	}
     }
 
+  return 0;
+}
+
+static const char *
+grub_gettext_translate_real (struct grub_gettext_context *ctx,
+			     const char *orig)
+{
+  grub_size_t position;
+  const char *ret = NULL;
+  int found;
+  static int depth = 0;
+
+  if (!ctx->grub_gettext_msg_list || !ctx->fd_mo)
+    return NULL;
+
+  /* Shouldn't happen. Just a precaution if our own code
+     calls gettext somehow.  */
+  if (depth > 2)
+    return NULL;
+  depth++;
+
+  /* Make sure we can use grub_gettext_translate for error messages.  Push
+     active error message to error stack and reset error message.  */
+  grub_error_push ();
+
+  if (ctx->grub_gettext_hash)
+    found = grub_gettext_lookup_hash (ctx, orig, &position);
+  else
+    found = grub_gettext_lookup_bisect (ctx, orig, &position);
+
+  if (found)
+    ret = grub_gettext_gettranslation_from_position (ctx, position);
+
+  grub_errno = GRUB_ERR_NONE;
   grub_error_pop ();
   depth--;
-  return NULL;
+  return ret;
 }
 
 static const char *
@@ -273,6 +356,9 @@ grub_gettext_delete_list (struct grub_gettext_context *ctx)
     grub_free (l[i].name);
   /* Don't delete the translated message because could be in use.  */
   grub_free (l);
+  grub_free (ctx->grub_gettext_originals);
+  grub_free (ctx->grub_gettext_translations);
+  grub_free (ctx->grub_gettext_hash);
   if (ctx->fd_mo)
     grub_file_close (ctx->fd_mo);
   ctx->fd_mo = 0;
@@ -317,19 +403,42 @@ grub_mofile_open (struct grub_gettext_context *ctx,
 			 "mo: invalid mo version in file: %s", filename);
     }
 
-  ctx->grub_gettext_offset_original = grub_le_to_cpu32 (head.offset_original);
-  ctx->grub_gettext_offset_translation = grub_le_to_cpu32 (head.offset_translation);
   ctx->grub_gettext_max = grub_le_to_cpu32 (head.number_of_strings);
   for (ctx->grub_gettext_max_log = 0; ctx->grub_gettext_max >> ctx->grub_gettext_max_log;
        ctx->grub_gettext_max_log++);
 
-  ctx->grub_gettext_msg_list = grub_zalloc (ctx->grub_gettext_max
-					    * sizeof (ctx->grub_gettext_msg_list[0]));
+  ctx->grub_gettext_originals
+    = grub_gettext_read_table (fd, ctx->grub_gettext_max,
+			       sizeof (struct string_descriptor),
+			       grub_le_to_cpu32 (head.offset_original));
+  if (ctx->grub_gettext_originals)
+    ctx->grub_gettext_translations
+      = grub_gettext_read_table (fd, ctx->grub_gettext_max,
+				 sizeof (struct string_descriptor),
+				 grub_le_to_cpu32 (head.offset_translation));
+  if (ctx->grub_gettext_translations)
+    ctx->grub_gettext_msg_list = grub_calloc (ctx->grub_gettext_max,
+					      sizeof (ctx->grub_gettext_msg_list[0]));
   if (!ctx->grub_gettext_msg_list)
     {
+      grub_free (ctx->grub_gettext_originals);
+      grub_free (ctx->grub_gettext_translations);
+      ctx->grub_gettext_originals = NULL;
+      ctx->grub_gettext_translations = NULL;
       grub_file_close (fd);
       return grub_errno;
     }
+
+  /* Without a usable hash table, bisect the sorted original strings.  */
+  ctx->grub_gettext_hash_size = grub_le_to_cpu32 (head.hash_size);
+  if (ctx->grub_gettext_hash_size > 2 && head.offset_hash != 0)
+    {
+      ctx->grub_gettext_hash
+	= grub_gettext_read_table (fd, ctx->grub_gettext_hash_size,
+				   sizeof (grub_uint32_t),
+				   grub_le_to_cpu32 (head.offset_hash));
+      grub_errno = GRUB_ERR_NONE;
+    }
   ctx->fd_mo = fd;
   if (grub_gettext != grub_gettext_translate)
     {
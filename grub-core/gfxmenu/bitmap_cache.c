@@ -0,0 +1,151 @@
+/* bitmap_cache.c - Keep the images of themes decoded.  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/types.h>
+#include <grub/misc.h>
+#include <grub/mm.h>
+#include <grub/err.h>
+#include <grub/env.h>
+#include <grub/bitmap.h>
+#include <grub/gfxmenu_view.h>
+
+/* The view is built again for a submenu whose theme or video mode differs,
+   and each build used to decode every image of the theme again.  Decoded
+   images are kept here instead, and a hit hands out another reference to
+   the bitmap kept, which is not modified any more.  Boxes take nine images
+   each, hence the number of entries.  */
+#define BITMAP_CACHE_SIZE	64
+#define BITMAP_CACHE_MAX_BYTES	(64 * 1024 * 1024)
+
+struct bitmap_cache_entry
+{
+  struct grub_video_bitmap *bitmap;
+  grub_uint64_t last_use;
+  /* The file name with its device, so that $root changing does not
+     return the image of another disk.  */
+  char *name;
+};
+
+static struct bitmap_cache_entry bitmap_cache[BITMAP_CACHE_SIZE];
+static grub_uint64_t bitmap_cache_clock;
+
+static grub_size_t
+bitmap_bytes (const struct grub_video_bitmap *bitmap)
+{
+  return (grub_size_t) bitmap->mode_info.pitch * bitmap->mode_info.height;
+}
+
+static void
+bitmap_cache_evict (struct bitmap_cache_entry *e)
+{
+  grub_video_bitmap_destroy (e->bitmap);
+  grub_free (e->name);
+  e->bitmap = NULL;
+  e->name = NULL;
+}
+
+/* Keep BITMAP loaded from NAME, evicting the least recently used bitmaps
+   to make room.  NAME is taken over.  */
+static void
+bitmap_cache_add (char *name, struct grub_video_bitmap *bitmap)
+{
+  struct bitmap_cache_entry *e, *lru, *free_entry;
+  grub_size_t size = bitmap_bytes (bitmap), total;
+
+  if (size > BITMAP_CACHE_MAX_BYTES)
+    {
+      grub_free (name);
+      return;
+    }
+
+  while (1)
+    {
+      total = size;
+      lru = free_entry = NULL;
+      for (e = bitmap_cache; e < bitmap_cache + BITMAP_CACHE_SIZE; e++)
+	{
+	  if (!e->bitmap)
+	    {
+	      if (!free_entry)
+		free_entry = e;
+	      continue;
+	    }
+	  total += bitmap_bytes (e->bitmap);
+	  if (!lru || e->last_use < lru->last_use)
+	    lru = e;
+	}
+      if (free_entry && total <= BITMAP_CACHE_MAX_BYTES)
+	break;
+      bitmap_cache_evict (lru);
+    }
+
+  free_entry->bitmap = grub_video_bitmap_ref (bitmap);
+  free_entry->name = name;
+  free_entry->last_use = ++bitmap_cache_clock;
+}
+
+grub_err_t
+grub_gfxmenu_bitmap_load (struct grub_video_bitmap **bitmap,
+			  const char *filename)
+{
+  struct bitmap_cache_entry *e;
+  const char *root = NULL;
+  char *name;
+  grub_err_t err;
+
+  if (filename[0] != '(')
+    root = grub_env_get ("root");
+  if (root)
+    name = grub_xasprintf ("(%s)%s", root, filename);
+  else
+    name = grub_strdup (filename);
+
+  /* Without memory for the name, load it without keeping it.  */
+  if (!name)
+    grub_errno = GRUB_ERR_NONE;
+
+  for (e = bitmap_cache; name && e < bitmap_cache + BITMAP_CACHE_SIZE; e++)
+    if (e->bitmap && grub_strcmp (e->name, name) == 0)
+      {
+	grub_free (name);
+	e->last_use = ++bitmap_cache_clock;
+	*bitmap = grub_video_bitmap_ref (e->bitmap);
+	return GRUB_ERR_NONE;
+      }
+
+  err = grub_video_bitmap_load (bitmap, filename);
+  if (err || !*bitmap || !name)
+    {
+      grub_free (name);
+      return err;
+    }
+
+  bitmap_cache_add (name, *bitmap);
+  return GRUB_ERR_NONE;
+}
+
+void
+grub_gfxmenu_bitmap_cache_flush (void)
+{
+  struct bitmap_cache_entry *e;
+
+  for (e = bitmap_cache; e < bitmap_cache + BITMAP_CACHE_SIZE; e++)
+    if (e->bitmap)
+      bitmap_cache_evict (e);
+}
@@ -146,5 +146,6 @@ GRUB_MOD_INIT (gfxmenu)
 GRUB_MOD_FINI (gfxmenu)
 {
   grub_gfxmenu_view_destroy (cached_view);
+  grub_gfxmenu_bitmap_cache_flush ();
   grub_gfxmenu_try_hook = NULL;
 }
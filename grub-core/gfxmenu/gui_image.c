@@ -23,6 +23,7 @@
 #include <grub/gui_string_util.h>
 #include <grub/bitmap.h>
 #include <grub/bitmap_scale.h>
+#include <grub/gfxmenu_view.h>
 
 struct grub_gui_image
 {
@@ -191,7 +192,7 @@ static grub_err_t
 load_image (grub_gui_image_t self, const char *path)
 {
   struct grub_video_bitmap *bitmap;
-  if (grub_video_bitmap_load (&bitmap, path) != GRUB_ERR_NONE)
+  if (grub_gfxmenu_bitmap_load (&bitmap, path) != GRUB_ERR_NONE)
     return grub_errno;
 
   if (self->bitmap && (self->bitmap != self->raw_bitmap))
@@ -862,6 +862,39 @@ list_refresh_info (void *vself,
     self->first_shown_index = 0;
 }
 
+static int
+list_get_entry_bounds (void *vself, int entry, grub_video_rect_t *bounds)
+{
+  list_impl_t self = vself;
+  int num_shown_items;
+
+  if (! self->visible || ! self->view
+      || ! self->menu_box || ! self->selected_item_box || ! self->item_box)
+    return 0;
+
+  num_shown_items = get_num_shown_items (self);
+  if (entry < self->first_shown_index
+      || entry >= self->first_shown_index + num_shown_items
+      || entry >= self->view->menu->size)
+    return 0;
+
+  grub_gfxmenu_box_t itembox = self->item_box;
+  grub_gfxmenu_box_t selbox = self->selected_item_box;
+  int max_toppad = grub_max (itembox->get_top_pad (itembox),
+                             selbox->get_top_pad (selbox));
+  int max_bottompad = grub_max (itembox->get_bottom_pad (itembox),
+                                selbox->get_bottom_pad (selbox));
+
+  /* The whole width, and both the boxes drawn around the row.  */
+  *bounds = self->bounds;
+  bounds->y += self->menu_box->get_top_pad (self->menu_box)
+    + self->item_padding
+    + (entry - self->first_shown_index)
+      * (self->item_height + self->item_spacing);
+  bounds->height = max_toppad + self->item_height + max_bottompad;
+  return 1;
+}
+
 static struct grub_gui_component_ops list_comp_ops =
   {
     .destroy = list_destroy,
@@ -879,7 +912,8 @@ static struct grub_gui_component_ops list_comp_ops =
 static struct grub_gui_list_ops list_ops =
 {
   .set_view_info = list_set_view_info,
-  .refresh_list = list_refresh_info
+  .refresh_list = list_refresh_info,
+  .get_entry_bounds = list_get_entry_bounds
 };
 
 grub_gui_component_t
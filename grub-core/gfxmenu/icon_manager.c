@@ -26,6 +26,7 @@
 #include <grub/bitmap_scale.h>
 #include <grub/menu.h>
 #include <grub/icon_manager.h>
+#include <grub/gfxmenu_view.h>
 #include <grub/env.h>
 
 /* Currently hard coded to '.png' extension.  */
@@ -154,7 +155,7 @@ try_loading_icon (grub_gfxmenu_icon_manager_t mgr,
   *ptr = '\0';
 
   struct grub_video_bitmap *raw_bitmap;
-  grub_video_bitmap_load (&raw_bitmap, path);
+  grub_gfxmenu_bitmap_load (&raw_bitmap, path);
   grub_free (path);
   grub_errno = GRUB_ERR_NONE;  /* Critical to clear the error!!  */
   if (! raw_bitmap)
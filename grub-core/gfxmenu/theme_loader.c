@@ -21,6 +21,7 @@
 #include <grub/file.h>
 #include <grub/misc.h>
 #include <grub/mm.h>
+#include <grub/arena.h>
 #include <grub/err.h>
 #include <grub/dl.h>
 #include <grub/video.h>
@@ -169,7 +170,7 @@ theme_set_string (grub_gfxmenu_view_t view,
       path = grub_resolve_relative_path (theme_dir, value);
       if (! path)
         return grub_errno;
-      if (grub_video_bitmap_load (&raw_bitmap, path) != GRUB_ERR_NONE)
+      if (grub_gfxmenu_bitmap_load (&raw_bitmap, path) != GRUB_ERR_NONE)
         {
           grub_free (path);
           return grub_errno;
@@ -307,6 +308,8 @@ struct parsebuf
   const char *filename;
   char *theme_dir;
   grub_gfxmenu_view_t view;
+  /* The identifiers and expressions read so far.  */
+  struct grub_arena strings;
 };
 
 static int
@@ -407,7 +410,7 @@ read_identifier (struct parsebuf *p)
   if (end - start < 1)
     return 0;
 
-  return grub_new_substring (p->buf, start, end);
+  return grub_arena_strndup (&p->strings, p->buf + start, end - start);
 }
 
 static char *
@@ -461,7 +464,7 @@ read_expression (struct parsebuf *p)
       return 0;
     }
 
-  return grub_new_substring (p->buf, start, end);
+  return grub_arena_strndup (&p->strings, p->buf + start, end - start);
 }
 
 static grub_err_t
@@ -636,7 +639,6 @@ read_object (struct parsebuf *p, grub_gui_container_t parent)
           grub_error (GRUB_ERR_IO,
                       "%s:%d:%d expected `=' after property name `%s'",
                       p->filename, p->line_num, p->col_num, property);
-          grub_free (property);
           goto cleanup;
         }
       skip_whitespace (p);
@@ -644,10 +646,7 @@ read_object (struct parsebuf *p, grub_gui_container_t parent)
       char *value;
       value = read_expression (p);
       if (! value)
-        {
-          grub_free (property);
-          goto cleanup;
-        }
+        goto cleanup;
 
       /* Handle the property value.  */
       if (grub_strcmp (property, "left") == 0)
@@ -662,14 +661,11 @@ read_object (struct parsebuf *p, grub_gui_container_t parent)
 	/* General property handling.  */
 	component->ops->set_property (component, property, value);
 
-      grub_free (value);
-      grub_free (property);
       if (grub_errno != GRUB_ERR_NONE)
         goto cleanup;
     }
 
 cleanup:
-  grub_free (name);
   return grub_errno;
 }
 
@@ -716,7 +712,6 @@ read_property (struct parsebuf *p)
          below.  */
       theme_set_string (p->view, name, value, p->theme_dir,
                         p->filename, p->line_num, p->col_num);
-      grub_free (value);
     }
   else
     {
@@ -728,7 +723,6 @@ read_property (struct parsebuf *p)
     }
 
 done:
-  grub_free (name);
   return grub_errno;
 }
 
@@ -742,6 +736,7 @@ grub_gfxmenu_view_load_theme (grub_gfxmenu_view_t view, const char *theme_path)
 
   p.view = view;
   p.theme_dir = grub_get_dirname (theme_path);
+  grub_arena_init (&p.strings, 0);
 
   file = grub_file_open (theme_path, GRUB_FILE_TYPE_THEME);
   if (! file)
@@ -806,6 +801,9 @@ grub_gfxmenu_view_load_theme (grub_gfxmenu_view_t view, const char *theme_path)
 
       if (grub_errno != GRUB_ERR_NONE)
         goto fail;
+
+      /* The strings of the item just read are not needed any longer.  */
+      grub_arena_reset (&p.strings);
     }
 
   /* Set the new theme path.  */
@@ -821,6 +819,7 @@ fail:
     }
 
 cleanup:
+  grub_arena_fini (&p.strings);
   grub_free (p.buf);
   grub_file_close (file);
   grub_free (p.theme_dir);
@@ -401,13 +401,53 @@ grub_gfxmenu_redraw_menu (grub_gfxmenu_view_t view)
     }
 }
 
+struct redraw_entries_ctx
+{
+  grub_gfxmenu_view_t view;
+  int old_entry;
+  int new_entry;
+};
+
+static void
+redraw_entries_visit (grub_gui_component_t component, void *userdata)
+{
+  struct redraw_entries_ctx *ctx = userdata;
+  grub_gui_list_t list;
+  grub_video_rect_t old_bounds, new_bounds;
+
+  if (! component->ops->is_instance (component, "list"))
+    return;
+
+  /* Repaint all of the list when it has to scroll.  */
+  list = (grub_gui_list_t) component;
+  if (! list->ops->get_entry_bounds (list, ctx->old_entry, &old_bounds)
+      || ! list->ops->get_entry_bounds (list, ctx->new_entry, &new_bounds))
+    {
+      redraw_menu_visit (component, ctx->view);
+      return;
+    }
+
+  grub_video_set_area_status (GRUB_VIDEO_AREA_ENABLED);
+  grub_gfxmenu_view_redraw (ctx->view, &old_bounds);
+  grub_gfxmenu_view_redraw (ctx->view, &new_bounds);
+}
+
 void
 grub_gfxmenu_set_chosen_entry (int entry, void *data)
 {
   grub_gfxmenu_view_t view = data;
+  struct redraw_entries_ctx ctx = { view, view->selected, entry };
 
+  /* Only the rows of the old and new entries change, unless the list
+     scrolls.  */
+  update_menu_components (view);
   view->selected = entry;
-  grub_gfxmenu_redraw_menu (view);
+  grub_gui_iterate_recursively ((grub_gui_component_t) view->canvas,
+                                redraw_entries_visit, &ctx);
+  grub_video_swap_buffers ();
+  if (view->double_repaint)
+    grub_gui_iterate_recursively ((grub_gui_component_t) view->canvas,
+                                  redraw_entries_visit, &ctx);
 }
 
 static void
@@ -30,23 +30,49 @@ GRUB_MOD_LICENSE ("GPLv3+");
 #define GRUB_BUFIO_DEF_SIZE	8192
 #define GRUB_BUFIO_MAX_SIZE	1048576
 
+struct grub_bufio_buffer
+{
+  char *data;
+  grub_size_t alloc;
+  grub_size_t len;
+  grub_off_t at;
+};
+
+/* The buffer size starts at the size asked for and doubles, up to
+   MAX_SIZE, whenever a refill continues right after the last one, and
+   halves back down to MIN_SIZE on other refills.  Refills alternate
+   between the two buffers, so data just before the last refill is still
+   at hand for readers which step back a little.  */
 struct grub_bufio
 {
   grub_file_t file;
   grub_size_t block_size;
-  grub_size_t buffer_len;
-  grub_off_t buffer_at;
-  char buffer[0];
+  grub_size_t min_size;
+  grub_size_t max_size;
+  struct grub_bufio_buffer buffers[2];
+  /* The buffer filled last.  */
+  unsigned cur;
 };
 typedef struct grub_bufio *grub_bufio_t;
 
 static struct grub_fs grub_bufio_fs;
 
+/* Round SIZE up to a power of 2, which the binary math to calculate
+   next_buf in grub_bufio_read() requires.  */
+static grub_size_t
+grub_bufio_round (grub_size_t size)
+{
+  while (size & (size - 1))
+    size = (size | (size - 1)) + 1;
+  return size;
+}
+
 grub_file_t
 grub_bufio_open (grub_file_t io, grub_size_t size)
 {
   grub_file_t file;
   grub_bufio_t bufio = 0;
+  grub_size_t max_size = GRUB_BUFIO_MAX_SIZE;
 
   file = (grub_file_t) grub_zalloc (sizeof (*file));
   if (! file)
@@ -60,23 +86,37 @@ grub_bufio_open (grub_file_t io, grub_size_t size)
   if (size > io->size)
     size = ((io->size > GRUB_BUFIO_MAX_SIZE) ? GRUB_BUFIO_MAX_SIZE :
             io->size);
+  if (max_size > io->size)
+    max_size = io->size;
 
-  /*
-   * Round up size to power of 2 which the binary math to
-   * calculate next_buf in grub_bufio_read() requires.
-   */
-  while (size & (size - 1))
-    size = (size | (size - 1)) + 1;
+  /* Empty files still get a buffer to read their end into.  */
+  if (size == 0)
+    size = 1;
+  if (max_size < size)
+    max_size = size;
+
+  size = grub_bufio_round (size);
+  max_size = grub_bufio_round (max_size);
 
-  bufio = grub_zalloc (sizeof (struct grub_bufio) + size);
+  bufio = grub_zalloc (sizeof (struct grub_bufio));
   if (! bufio)
     {
       grub_free (file);
       return 0;
     }
+  bufio->buffers[0].data = grub_malloc (size);
+  if (! bufio->buffers[0].data)
+    {
+      grub_free (bufio);
+      grub_free (file);
+      return 0;
+    }
+  bufio->buffers[0].alloc = size;
 
   bufio->file = io;
   bufio->block_size = size;
+  bufio->min_size = size;
+  bufio->max_size = max_size;
 
   file->device = io->device;
   file->size = io->size;
@@ -106,30 +146,86 @@ grub_buffile_open (const char *name, enum grub_file_type type, grub_size_t size)
   return file;
 }
 
+/* Return the buffer holding the byte at POS, if any.  */
+static struct grub_bufio_buffer *
+grub_bufio_find (grub_bufio_t bufio, grub_off_t pos)
+{
+  unsigned i;
+
+  for (i = 0; i < ARRAY_SIZE (bufio->buffers); i++)
+    if (pos >= bufio->buffers[i].at
+	&& pos < bufio->buffers[i].at + bufio->buffers[i].len)
+      return &bufio->buffers[i];
+  return NULL;
+}
+
+/* Choose the buffer size for a refill at POS and return the buffer to
+   fill, with room for the block size.  */
+static struct grub_bufio_buffer *
+grub_bufio_next (grub_bufio_t bufio, grub_off_t pos)
+{
+  struct grub_bufio_buffer *last = &bufio->buffers[bufio->cur];
+  struct grub_bufio_buffer *b;
+
+  if (last->len && pos == last->at + last->len)
+    {
+      if (bufio->block_size < bufio->max_size)
+	bufio->block_size <<= 1;
+    }
+  else if (last->len && bufio->block_size > bufio->min_size)
+    bufio->block_size >>= 1;
+
+  bufio->cur ^= 1;
+  b = &bufio->buffers[bufio->cur];
+  b->len = 0;
+  if (b->alloc < bufio->block_size)
+    {
+      char *data;
+
+      grub_free (b->data);
+      data = grub_malloc (bufio->block_size);
+      if (! data)
+	{
+	  /* Go on with the other buffer at the size it has.  */
+	  grub_errno = GRUB_ERR_NONE;
+	  b->data = NULL;
+	  b->alloc = 0;
+	  bufio->cur ^= 1;
+	  b = &bufio->buffers[bufio->cur];
+	  b->len = 0;
+	  bufio->block_size = b->alloc;
+	  return b;
+	}
+      b->data = data;
+      b->alloc = bufio->block_size;
+    }
+  return b;
+}
+
 static grub_ssize_t
 grub_bufio_read (grub_file_t file, char *buf, grub_size_t len)
 {
   grub_size_t res = 0;
   grub_off_t next_buf;
   grub_bufio_t bufio = file->data;
+  struct grub_bufio_buffer *b;
   grub_ssize_t really_read;
 
   if (file->size == GRUB_FILE_SIZE_UNKNOWN)
     file->size = bufio->file->size;
 
-  /* First part: use whatever we already have in the buffer.  */
-  if ((file->offset >= bufio->buffer_at) &&
-      (file->offset < bufio->buffer_at + bufio->buffer_len))
+  /* First part: use whatever we already have in the buffers.  */
+  while (len && (b = grub_bufio_find (bufio, file->offset + res)))
     {
       grub_size_t n;
       grub_uint64_t pos;
 
-      pos = file->offset - bufio->buffer_at;
-      n = bufio->buffer_len - pos;
+      pos = file->offset + res - b->at;
+      n = b->len - pos;
       if (n > len)
         n = len;
 
-      grub_memcpy (buf, &bufio->buffer[pos], n);
+      grub_memcpy (buf, &b->data[pos], n);
       len -= n;
       res += n;
 
@@ -139,8 +235,9 @@ grub_bufio_read (grub_file_t file, char *buf, grub_size_t len)
     return res;
 
   /* Need to read some more.  */
+  b = grub_bufio_next (bufio, file->offset + res);
   next_buf = (file->offset + res + len - 1) & ~((grub_off_t) bufio->block_size - 1);
-  /* Now read between file->offset + res and bufio->buffer_at.  */
+  /* Now read between file->offset + res and the new buffer.  */
   if (file->offset + res < next_buf)
     {
       grub_size_t read_now;
@@ -159,31 +256,29 @@ grub_bufio_read (grub_file_t file, char *buf, grub_size_t len)
        */
       if (really_read != (grub_ssize_t) read_now)
 	{
-	  bufio->buffer_len = really_read;
-	  if (bufio->buffer_len > bufio->block_size)
-	    bufio->buffer_len = bufio->block_size;
-	  bufio->buffer_at = file->offset + res - bufio->buffer_len;
-	  grub_memcpy (&bufio->buffer[0], buf - bufio->buffer_len,
-		       bufio->buffer_len);
+	  b->len = really_read;
+	  if (b->len > bufio->block_size)
+	    b->len = bufio->block_size;
+	  b->at = file->offset + res - b->len;
+	  grub_memcpy (b->data, buf - b->len, b->len);
 	  return res;
 	}
     }
 
   /* Read into buffer.  */
   grub_file_seek (bufio->file, next_buf);
-  really_read = grub_file_read (bufio->file, bufio->buffer,
-				bufio->block_size);
+  really_read = grub_file_read (bufio->file, b->data, bufio->block_size);
   if (really_read < 0)
     return -1;
-  bufio->buffer_at = next_buf;
-  bufio->buffer_len = really_read;
+  b->at = next_buf;
+  b->len = really_read;
 
   if (file->size == GRUB_FILE_SIZE_UNKNOWN)
     file->size = bufio->file->size;
 
-  if (len > bufio->buffer_len)
-    len = bufio->buffer_len;
-  grub_memcpy (buf, &bufio->buffer[file->offset + res - next_buf], len);
+  if (len > b->len)
+    len = b->len;
+  grub_memcpy (buf, &b->data[file->offset + res - next_buf], len);
   res += len;
 
   return res;
@@ -195,6 +290,8 @@ grub_bufio_close (grub_file_t file)
   grub_bufio_t bufio = file->data;
 
   grub_file_close (bufio->file);
+  grub_free (bufio->buffers[0].data);
+  grub_free (bufio->buffers[1].data);
   grub_free (bufio);
 
   file->device = 0;
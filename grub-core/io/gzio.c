@@ -58,6 +58,26 @@ GRUB_MOD_LICENSE ("GPLv3+");
 
 #define INBUFSIZ  0x2000
 
+/* Access points for seeking back in a file are taken at the first block
+   boundary after every POINT_SPAN bytes of output.  When MAX_POINTS are
+   in use every other one is dropped and the span is doubled.  */
+#define POINT_SPAN	0x100000
+#define MAX_POINTS	64
+
+/* The state needed to resume inflating at a block boundary.  */
+struct grub_gzio_point
+{
+  /* The offset in the uncompressed data.  */
+  grub_off_t out;
+  /* The offset of the next input byte.  */
+  grub_off_t in;
+  /* The bit buffer.  */
+  unsigned long bb;
+  unsigned bk;
+  /* The last WSIZE bytes of output, placed as in the slide.  */
+  grub_uint8_t *window;
+};
+
 /* The state stored in filesystem-specific data.  */
 struct grub_gzio
 {
@@ -83,6 +103,8 @@ struct grub_gzio
   /* The input buffer.  */
   grub_uint8_t inbuf[INBUFSIZ];
   int inbuf_d;
+  /* The offset of the input buffer in the underlying file.  */
+  grub_off_t inbuf_pos;
   /* The bit buffer.  */
   unsigned long bb;
   /* The bits in the bit buffer.  */
@@ -109,6 +131,13 @@ struct grub_gzio
   int bd;
   /* The original offset value.  */
   grub_off_t saved_offset;
+  /* Set when decompression did not start at the beginning of the file,
+     so the checksum cannot be verified.  */
+  int skip_checksum;
+  /* The access points, in order of output offset.  */
+  struct grub_gzio_point points[MAX_POINTS];
+  unsigned num_points;
+  grub_off_t point_span;
 };
 typedef struct grub_gzio *grub_gzio_t;
 
@@ -222,7 +251,13 @@ test_gzip_header (grub_file_t file)
 
   gzio->data_offset = grub_file_tell (gzio->file);
 
+  /* A stream of unknown length, as a response compressed on the fly,
+     has no trailer to read ahead of time.  Its size is known once it
+     ends, and with ORIG_LEN left at 0 its checksum is not checked.  */
+  if (grub_file_size (gzio->file) == GRUB_FILE_SIZE_UNKNOWN)
+    file->size = GRUB_FILE_SIZE_UNKNOWN;
   /* FIXME: don't do this on not easily seekable files.  */
+  else
   {
     grub_file_seek (gzio->file, grub_file_size (gzio->file) - 8);
     if (grub_file_read (gzio->file, &crc32, 4) != 4)
@@ -326,11 +361,15 @@ static ush cpdext[] =
    about one bit more than those, so lbits is 8+1 and dbits is 5+1.
    The optimum values may differ though from machine to machine, and
    possibly even between compilers.  Your mileage may vary.
+
+   GRUB uses larger tables than that: with them almost every code is
+   decoded by inflate_fast in a single lookup, and building the tables
+   is still cheap next to the 32K windows they decode.
  */
 
 
-static int lbits = 9;		/* bits in base literal/length lookup table */
-static int dbits = 6;		/* bits in base distance lookup table */
+static int lbits = 10;		/* bits in base literal/length lookup table */
+static int dbits = 8;		/* bits in base distance lookup table */
 
 
 /* If BMAX needs to be larger than 16, then h and x[] should be ulg. */
@@ -393,6 +432,7 @@ get_byte (grub_gzio_t gzio)
 		     || gzio->inbuf_d == INBUFSIZ))
     {
       gzio->inbuf_d = 0;
+      gzio->inbuf_pos = grub_file_tell (gzio->file);
       grub_file_read (gzio->file, gzio->inbuf, INBUFSIZ);
     }
 
@@ -647,6 +687,169 @@ huft_free (struct huft *t)
 }
 
 
+/* Return the input available to inflate_fast, without refilling.  */
+static grub_size_t
+input_avail (grub_gzio_t gzio, const grub_uint8_t **in)
+{
+  if (gzio->mem_input)
+    {
+      *in = gzio->mem_input + gzio->mem_input_off;
+      return gzio->mem_input_size - gzio->mem_input_off;
+    }
+
+  /* get_byte has not filled the buffer yet.  */
+  if (!gzio->file
+      || grub_file_tell (gzio->file) == (grub_off_t) gzio->data_offset)
+    return 0;
+
+  *in = gzio->inbuf + gzio->inbuf_d;
+  return INBUFSIZ - gzio->inbuf_d;
+}
+
+static void
+input_consume (grub_gzio_t gzio, grub_size_t n)
+{
+  if (gzio->mem_input)
+    gzio->mem_input_off += n;
+  else
+    gzio->inbuf_d += n;
+}
+
+/* Enough room in the window for the longest match.  */
+#define FAST_MIN_OUT	258
+
+/* Enough input for a refill of the bit buffer.  */
+#define FAST_MIN_IN	8
+
+/* Enough bits for a literal/length code, its extra bits, a distance code
+   and its extra bits.  */
+#define FAST_MIN_BITS	48
+
+/*
+ *  Decode codes while the input in the buffer and the room in the window
+ *  cannot run out within a code, like zlib's inflate_fast.  The bit
+ *  buffer is 64 bits wide and refilled a word at a time, so that several
+ *  symbols are decoded per refill, and matches are copied in words.
+ *  Anything unusual, including invalid codes, is left to the caller.
+ *  Return 1 at the end of the block.
+ */
+static int
+inflate_fast (grub_gzio_t gzio, ulg *bp, unsigned *kp, unsigned *wp)
+{
+  const grub_uint8_t *in, *in_start;
+  grub_size_t avail;
+  grub_uint64_t b = *bp;
+  unsigned k = *kp, w = *wp;
+  unsigned ml = mask_bits[gzio->bl], md = mask_bits[gzio->bd];
+  grub_uint8_t *slide = gzio->slide;
+  struct huft *t;
+  unsigned e, l, n, dist;
+  int eob = 0;
+
+  if (!gzio->tl || !gzio->td)
+    return 0;
+
+  avail = input_avail (gzio, &in);
+  in_start = in;
+
+  while (WSIZE - w >= FAST_MIN_OUT)
+    {
+      if (k < FAST_MIN_BITS)
+	{
+	  if ((grub_size_t) (in - in_start) + FAST_MIN_IN > avail)
+	    break;
+	  b |= grub_le_to_cpu64 (grub_get_unaligned64 (in)) << k;
+	  in += (63 - k) >> 3;
+	  k |= 56;
+	}
+
+      /* Look the whole code up before consuming anything, so that the
+	 caller can report invalid codes.  */
+      l = 0;
+      t = gzio->tl + ((unsigned) b & ml);
+      while ((e = t->e) > 16)
+	{
+	  if (e == 99)
+	    goto out;
+	  l += t->b;
+	  t = t->v.t + ((unsigned) (b >> l) & mask_bits[e - 16]);
+	}
+      l += t->b;
+
+      if (e == 16)
+	{
+	  b >>= l;
+	  k -= l;
+	  slide[w++] = (uch) t->v.n;
+	  continue;
+	}
+
+      if (e == 15)
+	{
+	  b >>= l;
+	  k -= l;
+	  eob = 1;
+	  break;
+	}
+
+      n = t->v.n + ((unsigned) (b >> l) & mask_bits[e]);
+      l += e;
+
+      t = gzio->td + ((unsigned) (b >> l) & md);
+      while ((e = t->e) > 16)
+	{
+	  if (e == 99)
+	    goto out;
+	  l += t->b;
+	  t = t->v.t + ((unsigned) (b >> l) & mask_bits[e - 16]);
+	}
+      l += t->b;
+      dist = t->v.n + ((unsigned) (b >> l) & mask_bits[e]);
+      l += e;
+      b >>= l;
+      k -= l;
+
+      if (dist <= w && dist >= 8)
+	{
+	  grub_uint8_t *dst = slide + w, *src = dst - dist;
+
+	  w += n;
+	  for (; n >= 8; n -= 8, dst += 8, src += 8)
+	    grub_memcpy (dst, src, 8);
+	  while (n--)
+	    *dst++ = *src++;
+	}
+      else if (dist == 1 && w)
+	{
+	  grub_memset (slide + w, slide[w - 1], n);
+	  w += n;
+	}
+      else
+	{
+	  unsigned d = w - dist;
+
+	  while (n--)
+	    slide[w++] = slide[d++ & (WSIZE - 1)];
+	}
+    }
+
+ out:
+  /* Give back the whole bytes read ahead, as long as they came from this
+     buffer, so that the bit buffer of the caller can hold the rest.  */
+  n = k >> 3;
+  if (n > (grub_size_t) (in - in_start))
+    n = in - in_start;
+  in -= n;
+  k -= n << 3;
+  b &= ((grub_uint64_t) 1 << k) - 1;
+
+  input_consume (gzio, in - in_start);
+  *bp = b;
+  *kp = k;
+  *wp = w;
+  return eob;
+}
+
 /*
  *  inflate (decompress) the codes in a deflated (compressed) block.
  *  Return an error code or zero if it all goes ok.
@@ -660,8 +863,8 @@ inflate_codes_in_window (grub_gzio_t gzio)
   unsigned w;			/* current window position */
   struct huft *t;		/* pointer to table entry */
   unsigned ml, md;		/* masks for bl and bd bits */
-  register ulg b;		/* bit buffer */
-  register unsigned k;		/* number of bits in bit buffer */
+  ulg b;			/* bit buffer */
+  unsigned k;			/* number of bits in bit buffer */
 
   /* make local copies of globals */
   d = gzio->inflate_d;
@@ -677,6 +880,11 @@ inflate_codes_in_window (grub_gzio_t gzio)
     {
       if (! gzio->code_state)
 	{
+	  if (inflate_fast (gzio, &b, &k, &w))
+	    {
+	      gzio->block_len = 0;
+	      break;
+	    }
 
 	  if (gzio->tl == NULL)
 	    {
@@ -1079,11 +1287,98 @@ get_new_block (grub_gzio_t gzio)
 }
 
 
+/* Record an access point at the block boundary GZIO is at, if the last
+   one is far enough behind.  Only files are worth it: memory buffers are
+   decompressed in one go.  */
+static void
+add_point (grub_gzio_t gzio, unsigned start)
+{
+  struct grub_gzio_point *p;
+  grub_off_t out = gzio->saved_offset + gzio->wp - start;
+  unsigned i;
+
+  if (!gzio->file)
+    return;
+
+  if (!gzio->point_span)
+    gzio->point_span = POINT_SPAN;
+  if (out < (gzio->num_points ? gzio->points[gzio->num_points - 1].out : 0)
+      + gzio->point_span)
+    return;
+
+  if (gzio->num_points == MAX_POINTS)
+    {
+      for (i = 1; i < MAX_POINTS; i += 2)
+	grub_free (gzio->points[i].window);
+      for (i = 0; i < MAX_POINTS / 2; i++)
+	gzio->points[i] = gzio->points[2 * i];
+      gzio->num_points = MAX_POINTS / 2;
+      gzio->point_span *= 2;
+      if (out < gzio->points[gzio->num_points - 1].out + gzio->point_span)
+	return;
+    }
+
+  p = &gzio->points[gzio->num_points];
+  p->window = grub_malloc (WSIZE);
+  if (!p->window)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+  grub_memcpy (p->window, gzio->slide, WSIZE);
+  p->out = out;
+  p->in = gzio->inbuf_pos + gzio->inbuf_d;
+  p->bb = gzio->bb;
+  p->bk = gzio->bk;
+  gzio->num_points++;
+}
+
+/* Return the last access point at or before OFFSET, if any.  */
+static struct grub_gzio_point *
+find_point (grub_gzio_t gzio, grub_off_t offset)
+{
+  unsigned lo = 0, hi = gzio->num_points;
+
+  while (lo < hi)
+    {
+      unsigned mid = (lo + hi) / 2;
+
+      if (gzio->points[mid].out <= offset)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+
+  return lo ? &gzio->points[lo - 1] : NULL;
+}
+
+/* Resume decompression at P.  */
+static void
+restore_point (grub_gzio_t gzio, struct grub_gzio_point *p)
+{
+  gzio_seek (gzio, p->in);
+  gzio->inbuf_d = INBUFSIZ;
+  gzio->bb = p->bb;
+  gzio->bk = p->bk;
+  gzio->last_block = 0;
+  gzio->block_len = 0;
+  huft_free (gzio->tl);
+  huft_free (gzio->td);
+  gzio->tl = NULL;
+  gzio->td = NULL;
+  grub_memcpy (gzio->slide, p->window, WSIZE);
+  gzio->saved_offset = p->out;
+  gzio->skip_checksum = 1;
+}
+
 static void
 inflate_window (grub_gzio_t gzio)
 {
+  /* Decompression resumed at an access point starts within the window.  */
+  unsigned start = gzio->saved_offset & (WSIZE - 1);
+
   /* initialize window */
-  gzio->wp = 0;
+  gzio->wp = start;
 
   /*
    *  Main decompression loop.
@@ -1096,6 +1391,7 @@ inflate_window (grub_gzio_t gzio)
 	  if (gzio->last_block)
 	    break;
 
+	  add_point (gzio, start);
 	  get_new_block (gzio);
 	}
 
@@ -1141,11 +1437,12 @@ inflate_window (grub_gzio_t gzio)
 	}
     }
 
-  gzio->saved_offset += gzio->wp;
+  gzio->saved_offset += gzio->wp - start;
 
-  if (gzio->hcontext)
+  if (gzio->hcontext && !gzio->skip_checksum)
     {
-      gzio->hdesc->write (gzio->hcontext, gzio->slide, gzio->wp);
+      gzio->hdesc->write (gzio->hcontext, gzio->slide + start,
+			  gzio->wp - start);
 
       if (gzio->saved_offset == gzio->orig_len)
 	{
@@ -1167,6 +1464,7 @@ static void
 initialize_tables (grub_gzio_t gzio)
 {
   gzio->saved_offset = 0;
+  gzio->skip_checksum = 0;
   gzio_seek (gzio, gzio->data_offset);
 
   /* Initialize the bit buffer.  */
@@ -1293,10 +1591,18 @@ grub_gzio_read_real (grub_gzio_t gzio, grub_off_t offset,
 		     char *buf, grub_size_t len)
 {
   grub_ssize_t ret = 0;
+  struct grub_gzio_point *point = find_point (gzio, offset);
 
-  /* Do we reset decompression to the beginning of the file?  */
-  if (gzio->saved_offset > offset + WSIZE)
-    initialize_tables (gzio);
+  /* Do we reset decompression to the beginning of the file or to an
+     access point?  */
+  if (gzio->saved_offset > offset + WSIZE
+      || (point && point->out > gzio->saved_offset))
+    {
+      if (point)
+	restore_point (gzio, point);
+      else
+	initialize_tables (gzio);
+    }
 
   /*
    *  This loop operates upon uncompressed data only.  The only
@@ -1311,14 +1617,13 @@ grub_gzio_read_real (grub_gzio_t gzio, grub_off_t offset,
 
       while (offset >= gzio->saved_offset)
 	{
+	  grub_off_t prev = gzio->saved_offset;
+
 	  inflate_window (gzio);
-	  if (gzio->wp == 0)
+	  if (gzio->saved_offset == prev)
 	    goto out;
 	}
 
-      if (gzio->wp == 0)
-	goto out;
-
       srcaddr = (char *) ((offset & (WSIZE - 1)) + gzio->slide);
       size = gzio->saved_offset - offset;
       if (size > len)
@@ -1345,7 +1650,10 @@ grub_gzio_read (grub_file_t file, char *buf, grub_size_t len)
   grub_ssize_t ret;
   ret = grub_gzio_read_real (file->data, file->offset, buf, len);
 
-  if (!grub_errno && ret != (grub_ssize_t) len)
+  if (!grub_errno && ret != (grub_ssize_t) len
+      && file->size == GRUB_FILE_SIZE_UNKNOWN)
+    file->size = file->offset + ret;
+  else if (!grub_errno && ret != (grub_ssize_t) len)
     {
       grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, "premature end of compressed");
       ret = -1;
@@ -1358,8 +1666,11 @@ static grub_err_t
 grub_gzio_close (grub_file_t file)
 {
   grub_gzio_t gzio = file->data;
+  unsigned i;
 
   grub_file_close (gzio->file);
+  for (i = 0; i < gzio->num_points; i++)
+    grub_free (gzio->points[i].window);
   huft_free (gzio->tl);
   huft_free (gzio->td);
   grub_free (gzio->hcontext);
@@ -0,0 +1,387 @@
+/* lz4io.c - decompression support for lz4 */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/err.h>
+#include <grub/mm.h>
+#include <grub/misc.h>
+#include <grub/file.h>
+#include <grub/fs.h>
+#include <grub/dl.h>
+#include <grub/i18n.h>
+#include <grub/lz4.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+#define LZ4_MAGIC		0x184D2204
+#define LZ4_LEGACY_MAGIC	0x184C2102
+#define LZ4_LEGACY_BLOCK_SIZE	(8 << 20)
+
+#define LZ4_FLG_VERSION_MASK	0xc0
+#define LZ4_FLG_VERSION		0x40
+#define LZ4_FLG_BLOCK_INDEP	0x20
+#define LZ4_FLG_BLOCK_CHECKSUM	0x10
+#define LZ4_FLG_CONTENT_SIZE	0x08
+#define LZ4_FLG_DICT_ID		0x01
+
+/* Legacy blocks are not stored uncompressed, so they can grow up to
+   the worst case of the compressor.  */
+#define LZ4_COMPRESS_BOUND(size)	((size) + (size) / 255 + 16)
+
+#define LZ4_BLOCK_UNCOMPRESSED	0x80000000
+#define LZ4_BLOCK_CHECKSUM_SIZE	4
+
+/* Where a block starts in the compressed and in the uncompressed data.  */
+struct grub_lz4io_block
+{
+  grub_off_t in;
+  grub_off_t out;
+};
+
+struct grub_lz4io
+{
+  grub_file_t file;
+  int legacy;
+  int block_checksum;
+  grub_size_t block_max;
+  /* The block to decode next.  */
+  grub_off_t next_in;
+  grub_off_t next_out;
+  /* Set once the end mark has been reached.  */
+  int eof;
+  /* The last decoded block, holding ubuf_len bytes from ubuf_out.  */
+  grub_uint8_t *cbuf;
+  grub_uint8_t *ubuf;
+  grub_off_t ubuf_out;
+  grub_size_t ubuf_len;
+  /* The blocks decoded so far, in order; being independent, decoding can
+     restart at any of them.  */
+  struct grub_lz4io_block *blocks;
+  grub_size_t num_blocks;
+  grub_size_t alloc_blocks;
+};
+typedef struct grub_lz4io *grub_lz4io_t;
+
+static struct grub_fs grub_lz4io_fs;
+
+/* Parse the frame header of FILE.  Return 0 if it is not a frame this
+   filter can decode.  */
+static int
+test_header (grub_file_t file)
+{
+  grub_lz4io_t lz4io = file->data;
+  grub_uint8_t hdr[4 + 2 + 8];
+  grub_uint32_t magic;
+  grub_off_t hdrsize;
+
+  if (grub_file_read (lz4io->file, hdr, 4) != 4)
+    return 0;
+  magic = grub_get_unaligned32 (hdr);
+  magic = grub_le_to_cpu32 (magic);
+
+  if (magic == LZ4_LEGACY_MAGIC)
+    {
+      lz4io->legacy = 1;
+      lz4io->block_max = LZ4_LEGACY_BLOCK_SIZE;
+      lz4io->next_in = 4;
+      return 1;
+    }
+
+  if (magic != LZ4_MAGIC || grub_file_read (lz4io->file, hdr + 4, 2) != 2)
+    return 0;
+
+  if ((hdr[4] & LZ4_FLG_VERSION_MASK) != LZ4_FLG_VERSION)
+    return 0;
+
+  /* Linked blocks would need the previous block as a dictionary, and
+     with a preset dictionary there is nothing to start from.  */
+  if (!(hdr[4] & LZ4_FLG_BLOCK_INDEP) || (hdr[4] & LZ4_FLG_DICT_ID))
+    {
+      grub_dprintf ("lz4io", "unsupported frame flags 0x%x\n", hdr[4]);
+      return 0;
+    }
+
+  switch ((hdr[5] >> 4) & 7)
+    {
+    case 4:
+      lz4io->block_max = 64 << 10;
+      break;
+    case 5:
+      lz4io->block_max = 256 << 10;
+      break;
+    case 6:
+      lz4io->block_max = 1 << 20;
+      break;
+    case 7:
+      lz4io->block_max = 4 << 20;
+      break;
+    default:
+      return 0;
+    }
+
+  lz4io->block_checksum = !!(hdr[4] & LZ4_FLG_BLOCK_CHECKSUM);
+
+  hdrsize = 4 + 2;
+  if (hdr[4] & LZ4_FLG_CONTENT_SIZE)
+    {
+      grub_uint64_t size;
+
+      if (grub_file_read (lz4io->file, hdr + 6, 8) != 8)
+	return 0;
+      size = grub_get_unaligned64 (hdr + 6);
+      file->size = grub_le_to_cpu64 (size);
+      hdrsize += 8;
+    }
+
+  /* Skip the header checksum.  */
+  lz4io->next_in = hdrsize + 1;
+  return 1;
+}
+
+static grub_file_t
+grub_lz4io_open (grub_file_t io, enum grub_file_type type)
+{
+  grub_file_t file;
+  grub_lz4io_t lz4io;
+
+  if (type & GRUB_FILE_TYPE_NO_DECOMPRESS)
+    return io;
+
+  file = (grub_file_t) grub_zalloc (sizeof (*file));
+  if (!file)
+    return 0;
+
+  lz4io = grub_zalloc (sizeof (*lz4io));
+  if (!lz4io)
+    {
+      grub_free (file);
+      return 0;
+    }
+
+  lz4io->file = io;
+
+  file->device = io->device;
+  file->data = lz4io;
+  file->fs = &grub_lz4io_fs;
+  file->size = GRUB_FILE_SIZE_UNKNOWN;
+  file->not_easily_seekable = 1;
+
+  if (grub_file_tell (lz4io->file) != 0)
+    grub_file_seek (lz4io->file, 0);
+
+  if (!test_header (file))
+    {
+      grub_errno = GRUB_ERR_NONE;
+      grub_file_seek (io, 0);
+      grub_free (lz4io);
+      grub_free (file);
+
+      return io;
+    }
+
+  lz4io->cbuf = grub_malloc (LZ4_COMPRESS_BOUND (lz4io->block_max));
+  lz4io->ubuf = grub_malloc (lz4io->block_max);
+  if (!lz4io->cbuf || !lz4io->ubuf)
+    {
+      grub_free (lz4io->cbuf);
+      grub_free (lz4io->ubuf);
+      grub_free (lz4io);
+      grub_free (file);
+      return 0;
+    }
+
+  return file;
+}
+
+/* Go back to the last block starting at or before OFFSET.  */
+static void
+seek_block (grub_lz4io_t lz4io, grub_off_t offset)
+{
+  grub_size_t lo = 0, hi = lz4io->num_blocks;
+
+  while (lo < hi)
+    {
+      grub_size_t mid = (lo + hi) / 2;
+
+      if (lz4io->blocks[mid].out <= offset)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+
+  /* The first block is always recorded.  */
+  lz4io->next_in = lz4io->blocks[lo - 1].in;
+  lz4io->next_out = lz4io->blocks[lo - 1].out;
+  lz4io->eof = 0;
+}
+
+/* Decode the next block into ubuf.  */
+static grub_err_t
+decode_block (grub_lz4io_t lz4io)
+{
+  grub_uint32_t bsize, csize;
+  grub_ssize_t n;
+
+  grub_file_seek (lz4io->file, lz4io->next_in);
+  n = grub_file_read (lz4io->file, &bsize, sizeof (bsize));
+  if (n < 0)
+    return grub_errno;
+  bsize = grub_le_to_cpu32 (bsize);
+
+  /* Legacy streams just end, or go on with another frame.  */
+  if (n != sizeof (bsize)
+      || (lz4io->legacy ? (bsize == LZ4_LEGACY_MAGIC || bsize == LZ4_MAGIC)
+	  : bsize == 0))
+    {
+      lz4io->eof = 1;
+      return GRUB_ERR_NONE;
+    }
+
+  if (lz4io->num_blocks == 0
+      || lz4io->blocks[lz4io->num_blocks - 1].out < lz4io->next_out)
+    {
+      if (lz4io->num_blocks == lz4io->alloc_blocks)
+	{
+	  struct grub_lz4io_block *b;
+	  grub_size_t alloc = lz4io->alloc_blocks ? lz4io->alloc_blocks * 2 : 64;
+
+	  b = grub_realloc (lz4io->blocks, alloc * sizeof (*b));
+	  if (!b)
+	    return grub_errno;
+	  lz4io->blocks = b;
+	  lz4io->alloc_blocks = alloc;
+	}
+      lz4io->blocks[lz4io->num_blocks].in = lz4io->next_in;
+      lz4io->blocks[lz4io->num_blocks].out = lz4io->next_out;
+      lz4io->num_blocks++;
+    }
+
+  csize = lz4io->legacy ? bsize : (bsize & ~LZ4_BLOCK_UNCOMPRESSED);
+  if (csize > LZ4_COMPRESS_BOUND (lz4io->block_max))
+    return grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		       N_("lz4 file corrupted"));
+
+  if (!lz4io->legacy && (bsize & LZ4_BLOCK_UNCOMPRESSED))
+    {
+      if (csize > lz4io->block_max)
+	return grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+			   N_("lz4 file corrupted"));
+      if (grub_file_read (lz4io->file, lz4io->ubuf, csize) != csize)
+	goto fail;
+      n = csize;
+    }
+  else
+    {
+      if (grub_file_read (lz4io->file, lz4io->cbuf, csize) != csize)
+	goto fail;
+      n = grub_lz4_decompress (lz4io->cbuf, csize, lz4io->ubuf,
+			       lz4io->block_max);
+      if (n < 0)
+	return grub_errno;
+    }
+
+  lz4io->ubuf_out = lz4io->next_out;
+  lz4io->ubuf_len = n;
+  lz4io->next_in += sizeof (bsize) + csize;
+  if (lz4io->block_checksum)
+    lz4io->next_in += LZ4_BLOCK_CHECKSUM_SIZE;
+  lz4io->next_out += n;
+  return GRUB_ERR_NONE;
+
+ fail:
+  if (!grub_errno)
+    grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		N_("premature end of compressed"));
+  return grub_errno;
+}
+
+static grub_ssize_t
+grub_lz4io_read (grub_file_t file, char *buf, grub_size_t len)
+{
+  grub_lz4io_t lz4io = file->data;
+  grub_off_t offset = file->offset;
+  grub_ssize_t ret = 0;
+
+  while (len > 0)
+    {
+      grub_size_t size;
+
+      if (offset >= lz4io->ubuf_out
+	  && offset < lz4io->ubuf_out + lz4io->ubuf_len)
+	{
+	  size = lz4io->ubuf_out + lz4io->ubuf_len - offset;
+	  if (size > len)
+	    size = len;
+	  grub_memcpy (buf, lz4io->ubuf + (offset - lz4io->ubuf_out), size);
+	  buf += size;
+	  len -= size;
+	  ret += size;
+	  offset += size;
+	  continue;
+	}
+
+      if (offset < lz4io->next_out && lz4io->num_blocks)
+	seek_block (lz4io, offset);
+
+      if (lz4io->eof)
+	break;
+
+      if (decode_block (lz4io))
+	return -1;
+    }
+
+  return ret;
+}
+
+/* Release everything, including the underlying file object.  */
+static grub_err_t
+grub_lz4io_close (grub_file_t file)
+{
+  grub_lz4io_t lz4io = file->data;
+
+  grub_file_close (lz4io->file);
+  grub_free (lz4io->cbuf);
+  grub_free (lz4io->ubuf);
+  grub_free (lz4io->blocks);
+  grub_free (lz4io);
+
+  /* Device must not be closed twice.  */
+  file->device = 0;
+  file->name = 0;
+  return grub_errno;
+}
+
+static struct grub_fs grub_lz4io_fs = {
+  .name = "lz4io",
+  .fs_dir = 0,
+  .fs_open = 0,
+  .fs_read = grub_lz4io_read,
+  .fs_close = grub_lz4io_close,
+  .fs_label = 0,
+  .next = 0
+};
+
+GRUB_MOD_INIT (lz4io)
+{
+  grub_file_filter_register (GRUB_FILE_FILTER_LZ4IO, grub_lz4io_open);
+}
+
+GRUB_MOD_FINI (lz4io)
+{
+  grub_file_filter_unregister (GRUB_FILE_FILTER_LZ4IO);
+}
@@ -33,6 +33,16 @@ GRUB_MOD_LICENSE ("GPLv3+");
 #define VLI_MAX_DIGITS 9
 #define XZ_STREAM_FOOTER_SIZE 12
 
+/* Limit on the number of blocks indexed for seeking.  */
+#define XZ_MAX_BLOCKS 0x100000
+
+/* Where a block starts in the compressed and in the uncompressed data.  */
+struct grub_xzio_block
+{
+  grub_off_t in;
+  grub_off_t out;
+};
+
 struct grub_xzio
 {
   grub_file_t file;
@@ -41,6 +51,15 @@ struct grub_xzio
   grub_uint8_t inbuf[XZBUFSIZ];
   grub_uint8_t outbuf[XZBUFSIZ];
   grub_off_t saved_offset;
+  /* The blocks of a single-stream file, from its index.  */
+  struct grub_xzio_block *blocks;
+  grub_size_t num_blocks;
+  /* The offset of the stream index.  */
+  grub_off_t index_offset;
+  /* Set when decoding started at a block other than the first one.  The
+     decoder must not see the index then, as it has not seen all of the
+     blocks.  */
+  int limit_input;
 };
 
 typedef struct grub_xzio *grub_xzio_t;
@@ -122,7 +141,11 @@ test_footer (grub_file_t file)
   grub_uint8_t imarker;
   grub_uint64_t uncompressed_size_total = 0;
   grub_uint64_t uncompressed_size;
+  grub_uint64_t unpadded_size;
   grub_uint64_t records;
+  grub_uint64_t compressed_offset = STREAM_HEADER_SIZE;
+  grub_off_t index_offset;
+  grub_size_t i;
 
   grub_file_seek (xzio->file, xzio->file->size - FOOTER_MAGIC_SIZE);
   if (grub_file_read (xzio->file, footer, FOOTER_MAGIC_SIZE)
@@ -139,8 +162,8 @@ test_footer (grub_file_t file)
   backsize = (grub_le_to_cpu32 (backsize) + 1) * 4;
 
   /* Set file to the beginning of stream index.  */
-  grub_file_seek (xzio->file,
-		  xzio->file->size - XZ_STREAM_FOOTER_SIZE - backsize);
+  index_offset = xzio->file->size - XZ_STREAM_FOOTER_SIZE - backsize;
+  grub_file_seek (xzio->file, index_offset);
 
   /* Test index marker.  */
   if (grub_file_read (xzio->file, &imarker, sizeof (imarker))
@@ -150,24 +173,112 @@ test_footer (grub_file_t file)
   if (read_vli (xzio->file, &records) <= 0)
     goto ERROR;
 
-  for (; records != 0; records--)
+  /* Only worth it with more than one block.  Failing to allocate merely
+     makes backward seeks slow.  */
+  if (records > 1 && records <= XZ_MAX_BLOCKS)
     {
-      if (read_vli (xzio->file, &uncompressed_size) <= 0)	/* Ignore unpadded.  */
+      xzio->blocks = grub_calloc (records, sizeof (xzio->blocks[0]));
+      if (!xzio->blocks)
+	grub_errno = GRUB_ERR_NONE;
+    }
+
+  for (i = 0; records != 0; records--, i++)
+    {
+      if (read_vli (xzio->file, &unpadded_size) <= 0)
 	goto ERROR;
       if (read_vli (xzio->file, &uncompressed_size) <= 0)	/* Uncompressed.  */
 	goto ERROR;
 
+      if (xzio->blocks)
+	{
+	  xzio->blocks[i].in = compressed_offset;
+	  xzio->blocks[i].out = uncompressed_size_total;
+	}
+      compressed_offset += ALIGN_UP (unpadded_size, 4);
       uncompressed_size_total += uncompressed_size;
     }
 
+  /* The blocks must end where the index starts, or this is not the only
+     stream in the file.  */
+  if (xzio->blocks && compressed_offset == index_offset)
+    {
+      xzio->num_blocks = i;
+      xzio->index_offset = index_offset;
+    }
+  else
+    {
+      grub_free (xzio->blocks);
+      xzio->blocks = NULL;
+    }
+
   file->size = uncompressed_size_total;
   grub_file_seek (xzio->file, STREAM_HEADER_SIZE);
   return 1;
 
 ERROR:
+  grub_free (xzio->blocks);
+  xzio->blocks = NULL;
   return 0;
 }
 
+/* Return the last block starting at or before OFFSET.  */
+static struct grub_xzio_block *
+find_block (grub_xzio_t xzio, grub_off_t offset)
+{
+  grub_size_t lo = 0, hi = xzio->num_blocks;
+
+  while (lo < hi)
+    {
+      grub_size_t mid = (lo + hi) / 2;
+
+      if (xzio->blocks[mid].out <= offset)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+
+  return lo ? &xzio->blocks[lo - 1] : NULL;
+}
+
+/* Restart decoding at the beginning of BLOCK, or of the stream if BLOCK
+   is NULL.  */
+static grub_err_t
+restart_at (grub_xzio_t xzio, struct grub_xzio_block *block)
+{
+  xz_dec_reset (xzio->dec);
+  xzio->saved_offset = 0;
+  xzio->buf.out_pos = 0;
+  xzio->buf.in_pos = 0;
+  xzio->buf.in_size = 0;
+  xzio->limit_input = 0;
+  grub_file_seek (xzio->file, 0);
+
+  if (!block || block->out == 0)
+    return GRUB_ERR_NONE;
+
+  /* Give the decoder the stream header again, then the block.  */
+  if (grub_file_read (xzio->file, xzio->inbuf, STREAM_HEADER_SIZE)
+      != STREAM_HEADER_SIZE)
+    goto fail;
+  xzio->buf.in_size = STREAM_HEADER_SIZE;
+  if (xz_dec_run (xzio->dec, &xzio->buf) != XZ_OK
+      || xzio->buf.in_pos != STREAM_HEADER_SIZE)
+    goto fail;
+  xzio->buf.in_pos = 0;
+  xzio->buf.in_size = 0;
+
+  grub_file_seek (xzio->file, block->in);
+  xzio->saved_offset = block->out;
+  xzio->limit_input = 1;
+  return GRUB_ERR_NONE;
+
+ fail:
+  if (!grub_errno)
+    grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		N_("xz file corrupted or unsupported block options"));
+  return grub_errno;
+}
+
 static grub_file_t
 grub_xzio_open (grub_file_t io, enum grub_file_type type)
 {
@@ -219,6 +330,7 @@ grub_xzio_open (grub_file_t io, enum grub_file_type type)
       grub_errno = GRUB_ERR_NONE;
       grub_file_seek (io, 0);
       xz_dec_end (xzio->dec);
+      grub_free (xzio->blocks);
       grub_free (xzio);
       grub_free (file);
 
@@ -237,16 +349,19 @@ grub_xzio_read (grub_file_t file, char *buf, grub_size_t len)
   grub_xzio_t xzio = file->data;
   grub_off_t current_offset;
 
-  /* If seek backward need to reset decoder and start from beginning of file.
-     TODO Possible improvement by jumping blocks.  */
-  if (file->offset < xzio->saved_offset)
+  /* Seeking backward needs the decoder to start again, from the block
+     holding the wanted offset when the blocks are known.  Seeking forward
+     past the start of a block skips decoding up to it.  */
+  if (file->offset < xzio->saved_offset || xzio->blocks)
     {
-      xz_dec_reset (xzio->dec);
-      xzio->saved_offset = 0;
-      xzio->buf.out_pos = 0;
-      xzio->buf.in_pos = 0;
-      xzio->buf.in_size = 0;
-      grub_file_seek (xzio->file, 0);
+      struct grub_xzio_block *block = NULL;
+
+      if (xzio->blocks)
+	block = find_block (xzio, file->offset);
+      if (file->offset < xzio->saved_offset
+	  || (block && block->out > xzio->saved_offset))
+	if (restart_at (xzio, block))
+	  return -1;
     }
 
   current_offset = xzio->saved_offset;
@@ -259,7 +374,17 @@ grub_xzio_read (grub_file_t file, char *buf, grub_size_t len)
       /* Feed input.  */
       if (xzio->buf.in_pos == xzio->buf.in_size)
 	{
-	  readret = grub_file_read (xzio->file, xzio->inbuf, XZBUFSIZ);
+	  grub_size_t toread = XZBUFSIZ;
+
+	  if (xzio->limit_input)
+	    {
+	      grub_off_t pos = grub_file_tell (xzio->file);
+
+	      toread = pos < xzio->index_offset ? xzio->index_offset - pos : 0;
+	      if (toread > XZBUFSIZ)
+		toread = XZBUFSIZ;
+	    }
+	  readret = grub_file_read (xzio->file, xzio->inbuf, toread);
 	  if (readret < 0)
 	    return -1;
 	  xzio->buf.in_size = readret;
@@ -317,6 +442,7 @@ grub_xzio_close (grub_file_t file)
   xz_dec_end (xzio->dec);
 
   grub_file_close (xzio->file);
+  grub_free (xzio->blocks);
   grub_free (xzio);
 
   /* Device must not be closed twice.  */
@@ -0,0 +1,439 @@
+/* zstdio.c - decompression support for zstd */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/err.h>
+#include <grub/mm.h>
+#include <grub/misc.h>
+#include <grub/file.h>
+#include <grub/fs.h>
+#include <grub/dl.h>
+#include <grub/i18n.h>
+
+/* Needed for the custom allocator and the frame header parser.  */
+#define ZSTD_STATIC_LINKING_ONLY
+
+#include <zstd.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+#define ZSTDBUFSIZ 0x10000
+#define ZSTD_BLOCK_HEADER_SIZE 3
+#define ZSTD_CHECKSUM_SIZE 4
+#define ZSTD_SKIPPABLE_HEADER_SIZE 8
+
+/* Where a frame starts in the compressed and in the uncompressed data.  */
+struct grub_zstdio_frame
+{
+  grub_off_t in;
+  grub_off_t out;
+};
+
+struct grub_zstdio
+{
+  grub_file_t file;
+  ZSTD_DStream *dstream;
+  ZSTD_inBuffer in;
+  /* Set once the input is exhausted.  */
+  int eof;
+  /* The value of the last ZSTD_decompressStream call, 0 at the end of
+     a frame.  */
+  grub_size_t hint;
+  grub_off_t saved_offset;
+  /* The frames, known when all of them record their content size.  */
+  struct grub_zstdio_frame *frames;
+  grub_size_t num_frames;
+  grub_uint8_t inbuf[ZSTDBUFSIZ];
+  grub_uint8_t outbuf[ZSTDBUFSIZ];
+};
+typedef struct grub_zstdio *grub_zstdio_t;
+
+static struct grub_fs grub_zstdio_fs;
+
+static void *
+grub_zstd_malloc (void *state __attribute__ ((unused)), size_t size)
+{
+  return grub_malloc (size);
+}
+
+static void
+grub_zstd_free (void *state __attribute__ ((unused)), void *address)
+{
+  grub_free (address);
+}
+
+static ZSTD_customMem
+grub_zstd_allocator (void)
+{
+  ZSTD_customMem allocator;
+
+  allocator.customAlloc = &grub_zstd_malloc;
+  allocator.customFree = &grub_zstd_free;
+  allocator.opaque = NULL;
+
+  return allocator;
+}
+
+/* Return the compressed size of the frame at POS with header FH by
+   walking its block headers, or 0 if they are corrupted.  */
+static grub_uint64_t
+frame_compressed_size (grub_file_t file, grub_off_t pos,
+		       const ZSTD_frameHeader *fh)
+{
+  grub_uint64_t size = fh->headerSize;
+  grub_uint8_t bh[ZSTD_BLOCK_HEADER_SIZE];
+
+  while (1)
+    {
+      grub_uint32_t block;
+
+      grub_file_seek (file, pos + size);
+      if (grub_file_read (file, bh, sizeof (bh)) != sizeof (bh))
+	return 0;
+      block = bh[0] | (bh[1] << 8) | ((grub_uint32_t) bh[2] << 16);
+      size += sizeof (bh);
+
+      switch ((block >> 1) & 3)
+	{
+	case 0:			/* Raw.  */
+	case 2:			/* Compressed.  */
+	  size += block >> 3;
+	  break;
+	case 1:			/* RLE.  */
+	  size += 1;
+	  break;
+	default:
+	  return 0;
+	}
+
+      if (block & 1)
+	break;
+    }
+
+  if (fh->checksumFlag)
+    size += ZSTD_CHECKSUM_SIZE;
+  return size;
+}
+
+/* Find the frames of the file and its uncompressed size.  Return 0 if
+   the file is not zstd.  A frame without a content size leaves the size
+   unknown and seeking backward then starts from the beginning.  */
+static int
+scan_frames (grub_file_t file)
+{
+  grub_zstdio_t zstdio = file->data;
+  grub_off_t pos = 0, out = 0;
+  grub_size_t alloc = 0;
+  int seekable = 1;
+
+  while (pos < zstdio->file->size)
+    {
+      grub_uint8_t header[ZSTD_FRAMEHEADERSIZE_MAX];
+      ZSTD_frameHeader fh;
+      grub_ssize_t len;
+      grub_uint64_t csize;
+
+      grub_file_seek (zstdio->file, pos);
+      len = grub_file_read (zstdio->file, header, sizeof (header));
+      if (len <= 0
+	  || ZSTD_getFrameHeader (&fh, header, len) != 0)
+	break;
+
+      if (fh.frameType == ZSTD_skippableFrame)
+	csize = ZSTD_SKIPPABLE_HEADER_SIZE + fh.frameContentSize;
+      else
+	{
+	  csize = frame_compressed_size (zstdio->file, pos, &fh);
+	  if (!csize)
+	    break;
+	  if (fh.frameContentSize == ZSTD_CONTENTSIZE_UNKNOWN)
+	    seekable = 0;
+	}
+
+      if (seekable && fh.frameType != ZSTD_skippableFrame)
+	{
+	  if (zstdio->num_frames == alloc)
+	    {
+	      struct grub_zstdio_frame *n;
+
+	      alloc = alloc ? alloc * 2 : 16;
+	      n = grub_realloc (zstdio->frames, alloc * sizeof (*n));
+	      if (!n)
+		{
+		  grub_errno = GRUB_ERR_NONE;
+		  seekable = 0;
+		}
+	      else
+		zstdio->frames = n;
+	    }
+	  if (seekable)
+	    {
+	      zstdio->frames[zstdio->num_frames].in = pos;
+	      zstdio->frames[zstdio->num_frames].out = out;
+	      zstdio->num_frames++;
+	      out += fh.frameContentSize;
+	    }
+	}
+
+      pos += csize;
+    }
+
+  grub_errno = GRUB_ERR_NONE;
+
+  /* Not even one frame.  */
+  if (pos == 0)
+    return 0;
+
+  if (seekable && pos == zstdio->file->size)
+    file->size = out;
+  else
+    {
+      grub_free (zstdio->frames);
+      zstdio->frames = NULL;
+      zstdio->num_frames = 0;
+    }
+
+  grub_file_seek (zstdio->file, 0);
+  return 1;
+}
+
+static grub_file_t
+grub_zstdio_open (grub_file_t io, enum grub_file_type type)
+{
+  grub_file_t file;
+  grub_zstdio_t zstdio;
+  grub_uint32_t magic;
+
+  if (type & GRUB_FILE_TYPE_NO_DECOMPRESS)
+    return io;
+
+  if (grub_file_tell (io) != 0)
+    grub_file_seek (io, 0);
+  if (grub_file_read (io, &magic, sizeof (magic)) != sizeof (magic)
+      || grub_le_to_cpu32 (magic) != ZSTD_MAGICNUMBER)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      grub_file_seek (io, 0);
+      return io;
+    }
+
+  file = (grub_file_t) grub_zalloc (sizeof (*file));
+  if (!file)
+    return 0;
+
+  zstdio = grub_zalloc (sizeof (*zstdio));
+  if (!zstdio)
+    {
+      grub_free (file);
+      return 0;
+    }
+
+  zstdio->file = io;
+
+  file->device = io->device;
+  file->data = zstdio;
+  file->fs = &grub_zstdio_fs;
+  file->size = GRUB_FILE_SIZE_UNKNOWN;
+  file->not_easily_seekable = 1;
+
+  zstdio->dstream = ZSTD_createDStream_advanced (grub_zstd_allocator ());
+  if (!zstdio->dstream || ZSTD_isError (ZSTD_initDStream (zstdio->dstream)))
+    goto fail;
+
+  zstdio->in.src = zstdio->inbuf;
+
+  if (!scan_frames (file))
+    goto fail;
+
+  return file;
+
+ fail:
+  if (zstdio->dstream)
+    ZSTD_freeDStream (zstdio->dstream);
+  grub_free (zstdio->frames);
+  grub_free (zstdio);
+  grub_free (file);
+  grub_errno = GRUB_ERR_NONE;
+  grub_file_seek (io, 0);
+  return io;
+}
+
+/* Return the last frame starting at or before OFFSET.  */
+static struct grub_zstdio_frame *
+find_frame (grub_zstdio_t zstdio, grub_off_t offset)
+{
+  grub_size_t lo = 0, hi = zstdio->num_frames;
+
+  while (lo < hi)
+    {
+      grub_size_t mid = (lo + hi) / 2;
+
+      if (zstdio->frames[mid].out <= offset)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+
+  return lo ? &zstdio->frames[lo - 1] : NULL;
+}
+
+/* Restart decoding at the beginning of FRAME, or of the file if FRAME is
+   NULL.  */
+static grub_err_t
+restart_at (grub_zstdio_t zstdio, struct grub_zstdio_frame *frame)
+{
+  if (ZSTD_isError (ZSTD_initDStream (zstdio->dstream)))
+    return grub_error (GRUB_ERR_OUT_OF_MEMORY,
+		       "failed to reset the zstd decoder");
+  zstdio->in.pos = 0;
+  zstdio->in.size = 0;
+  zstdio->eof = 0;
+  zstdio->hint = 0;
+  zstdio->saved_offset = frame ? frame->out : 0;
+  grub_file_seek (zstdio->file, frame ? frame->in : 0);
+  return GRUB_ERR_NONE;
+}
+
+/* Decompress into OUT, up to LEN bytes.  Return the number of bytes
+   produced, 0 at the end of the data or -1 on error.  */
+static grub_ssize_t
+decompress (grub_zstdio_t zstdio, void *out, grub_size_t len)
+{
+  ZSTD_outBuffer output = { out, len, 0 };
+
+  while (output.pos == 0)
+    {
+      grub_size_t ret;
+
+      if (zstdio->in.pos == zstdio->in.size && !zstdio->eof)
+	{
+	  grub_ssize_t readret;
+
+	  readret = grub_file_read (zstdio->file, zstdio->inbuf, ZSTDBUFSIZ);
+	  if (readret < 0)
+	    return -1;
+	  zstdio->in.pos = 0;
+	  zstdio->in.size = readret;
+	  zstdio->eof = (readret == 0);
+	}
+
+      ret = ZSTD_decompressStream (zstdio->dstream, &output, &zstdio->in);
+      if (ZSTD_isError (ret))
+	{
+	  grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		      N_("zstd file corrupted: %s"), ZSTD_getErrorName (ret));
+	  return -1;
+	}
+      zstdio->hint = ret;
+
+      if (output.pos == 0 && zstdio->eof && zstdio->in.pos == zstdio->in.size)
+	{
+	  /* Input ran out in the middle of a frame.  */
+	  if (zstdio->hint)
+	    {
+	      grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+			  N_("premature end of compressed"));
+	      return -1;
+	    }
+	  break;
+	}
+    }
+
+  zstdio->saved_offset += output.pos;
+  return output.pos;
+}
+
+static grub_ssize_t
+grub_zstdio_read (grub_file_t file, char *buf, grub_size_t len)
+{
+  grub_zstdio_t zstdio = file->data;
+  struct grub_zstdio_frame *frame = NULL;
+  grub_ssize_t ret = 0;
+
+  /* Seeking backward restarts decoding at the frame holding the wanted
+     offset, so does seeking forward past the start of a frame.  */
+  if (zstdio->frames)
+    frame = find_frame (zstdio, file->offset);
+  if (file->offset < zstdio->saved_offset
+      || (frame && frame->out > zstdio->saved_offset))
+    if (restart_at (zstdio, frame))
+      return -1;
+
+  while (zstdio->saved_offset < file->offset)
+    {
+      grub_off_t skip = file->offset - zstdio->saved_offset;
+      grub_ssize_t n;
+
+      n = decompress (zstdio, zstdio->outbuf,
+		      skip < ZSTDBUFSIZ ? skip : ZSTDBUFSIZ);
+      if (n <= 0)
+	return n;
+    }
+
+  while (len > 0)
+    {
+      grub_ssize_t n;
+
+      n = decompress (zstdio, buf + ret, len);
+      if (n < 0)
+	return -1;
+      if (n == 0)
+	break;
+      ret += n;
+      len -= n;
+    }
+
+  return ret;
+}
+
+/* Release everything, including the underlying file object.  */
+static grub_err_t
+grub_zstdio_close (grub_file_t file)
+{
+  grub_zstdio_t zstdio = file->data;
+
+  ZSTD_freeDStream (zstdio->dstream);
+  grub_file_close (zstdio->file);
+  grub_free (zstdio->frames);
+  grub_free (zstdio);
+
+  /* Device must not be closed twice.  */
+  file->device = 0;
+  file->name = 0;
+  return grub_errno;
+}
+
+static struct grub_fs grub_zstdio_fs = {
+  .name = "zstdio",
+  .fs_dir = 0,
+  .fs_open = 0,
+  .fs_read = grub_zstdio_read,
+  .fs_close = grub_zstdio_close,
+  .fs_label = 0,
+  .next = 0
+};
+
+GRUB_MOD_INIT (zstdio)
+{
+  grub_file_filter_register (GRUB_FILE_FILTER_ZSTDIO, grub_zstdio_open);
+}
+
+GRUB_MOD_FINI (zstdio)
+{
+  grub_file_filter_unregister (GRUB_FILE_FILTER_ZSTDIO);
+}
@@ -0,0 +1,179 @@
+/* arena.c - bump allocation of memory that is freed all at once */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/arena.h>
+#include <grub/misc.h>
+#include <grub/mm.h>
+#include <grub/err.h>
+#include <grub/i18n.h>
+#include <grub/safemath.h>
+
+#define ARENA_ALIGN	(2 * sizeof (void *))
+
+struct grub_arena_chunk
+{
+  struct grub_arena_chunk *next;
+  grub_size_t size;
+};
+
+#define ARENA_CHUNK_HEADER \
+  ALIGN_UP (sizeof (struct grub_arena_chunk), ARENA_ALIGN)
+
+void
+grub_arena_init (grub_arena_t arena, grub_size_t chunk_size)
+{
+  arena->chunks = NULL;
+  arena->cur = arena->end = NULL;
+  arena->chunk_size = chunk_size ? : GRUB_ARENA_CHUNK_SIZE;
+}
+
+static struct grub_arena_chunk *
+arena_new_chunk (grub_size_t size)
+{
+  struct grub_arena_chunk *chunk;
+  grub_size_t total;
+
+  if (grub_add (size, ARENA_CHUNK_HEADER, &total))
+    {
+      grub_error (GRUB_ERR_OUT_OF_RANGE, N_("overflow is detected"));
+      return NULL;
+    }
+
+  chunk = grub_malloc (total);
+  if (!chunk)
+    return NULL;
+  chunk->size = size;
+  return chunk;
+}
+
+void *
+grub_arena_alloc (grub_arena_t arena, grub_size_t size)
+{
+  struct grub_arena_chunk *chunk;
+  grub_uint8_t *ret;
+
+  size = ALIGN_UP (size ? : 1, ARENA_ALIGN);
+  if (size == 0)
+    {
+      grub_error (GRUB_ERR_OUT_OF_RANGE, N_("overflow is detected"));
+      return NULL;
+    }
+
+  if (size <= (grub_size_t) (arena->end - arena->cur))
+    {
+      ret = arena->cur;
+      arena->cur += size;
+      return ret;
+    }
+
+  /*
+   * Objects larger than a quarter of a chunk get a chunk of their own,
+   * behind the current one, so that the rest of the current one is not
+   * wasted.
+   */
+  if (size > arena->chunk_size / 4 && arena->chunks)
+    {
+      chunk = arena_new_chunk (size);
+      if (!chunk)
+	return NULL;
+      chunk->next = arena->chunks->next;
+      arena->chunks->next = chunk;
+      return (grub_uint8_t *) chunk + ARENA_CHUNK_HEADER;
+    }
+
+  chunk = arena_new_chunk (grub_max (size, arena->chunk_size));
+  if (!chunk)
+    return NULL;
+  chunk->next = arena->chunks;
+  arena->chunks = chunk;
+
+  ret = (grub_uint8_t *) chunk + ARENA_CHUNK_HEADER;
+  arena->cur = ret + size;
+  arena->end = ret + chunk->size;
+  return ret;
+}
+
+void *
+grub_arena_zalloc (grub_arena_t arena, grub_size_t size)
+{
+  void *ret;
+
+  ret = grub_arena_alloc (arena, size);
+  if (ret)
+    grub_memset (ret, 0, size);
+  return ret;
+}
+
+char *
+grub_arena_strndup (grub_arena_t arena, const char *s, grub_size_t n)
+{
+  grub_size_t len;
+  char *ret;
+
+  for (len = 0; len < n && s[len]; len++);
+
+  ret = grub_arena_alloc (arena, len + 1);
+  if (!ret)
+    return NULL;
+  grub_memcpy (ret, s, len);
+  ret[len] = '\0';
+  return ret;
+}
+
+char *
+grub_arena_strdup (grub_arena_t arena, const char *s)
+{
+  return grub_arena_strndup (arena, s, grub_strlen (s));
+}
+
+/* Free the chunks from CHUNK on.  */
+static void
+arena_free_chunks (struct grub_arena_chunk *chunk)
+{
+  struct grub_arena_chunk *next;
+
+  for (; chunk; chunk = next)
+    {
+      next = chunk->next;
+      grub_free (chunk);
+    }
+}
+
+void
+grub_arena_reset (grub_arena_t arena)
+{
+  struct grub_arena_chunk *chunk;
+
+  if (!arena->chunks)
+    return;
+
+  /* Keep the last chunk taken, the one being filled.  */
+  chunk = arena->chunks;
+  arena_free_chunks (chunk->next);
+  chunk->next = NULL;
+  arena->cur = (grub_uint8_t *) chunk + ARENA_CHUNK_HEADER;
+  arena->end = arena->cur + chunk->size;
+}
+
+void
+grub_arena_fini (grub_arena_t arena)
+{
+  arena_free_chunks (arena->chunks);
+  grub_arena_init (arena, arena->chunk_size);
+}
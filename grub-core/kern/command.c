@@ -22,6 +22,61 @@
 #include <grub/command.h>
 
 grub_command_t grub_command_list;
+unsigned long grub_command_generation;
+
+/* Active commands indexed by name.  Only the command that
+   grub_command_find must return for a name is in the table, so an
+   inactive lower priority command is entered when the one shadowing it
+   goes away.  */
+#define COMMAND_HASH_SIZE	128
+static grub_command_t command_hash[COMMAND_HASH_SIZE];
+
+static unsigned int
+command_hash_key (const char *s)
+{
+  grub_uint32_t key = 0;
+
+  while (*s)
+    key = key * 65599 + *s++;
+
+  return (key + (key >> 5)) % COMMAND_HASH_SIZE;
+}
+
+static void
+command_hash_insert (grub_command_t cmd)
+{
+  grub_command_t *head = &command_hash[command_hash_key (cmd->name)];
+
+  cmd->hash_next = *head;
+  *head = cmd;
+}
+
+static void
+command_hash_remove (grub_command_t cmd)
+{
+  grub_command_t *p;
+
+  for (p = &command_hash[command_hash_key (cmd->name)]; *p;
+       p = &(*p)->hash_next)
+    if (*p == cmd)
+      {
+	*p = cmd->hash_next;
+	break;
+      }
+  cmd->hash_next = 0;
+}
+
+grub_command_t
+grub_command_find (const char *name)
+{
+  grub_command_t cmd;
+
+  for (cmd = command_hash[command_hash_key (name)]; cmd; cmd = cmd->hash_next)
+    if (grub_strcmp (cmd->name, name) == 0)
+      return cmd;
+
+  return 0;
+}
 
 grub_command_t
 grub_register_command_prio (const char *name,
@@ -59,6 +114,8 @@ grub_register_command_prio (const char *name,
 
       if (cmd->prio >= (q->prio & GRUB_COMMAND_PRIO_MASK))
 	{
+	  if (q->prio & GRUB_COMMAND_FLAG_ACTIVE)
+	    command_hash_remove (q);
 	  q->prio &= ~GRUB_COMMAND_FLAG_ACTIVE;
 	  break;
 	}
@@ -73,7 +130,11 @@ grub_register_command_prio (const char *name,
   cmd->prev = p;
 
   if (! inactive)
-    cmd->prio |= GRUB_COMMAND_FLAG_ACTIVE;
+    {
+      cmd->prio |= GRUB_COMMAND_FLAG_ACTIVE;
+      command_hash_insert (cmd);
+    }
+  grub_command_generation++;
 
   return cmd;
 }
@@ -104,8 +165,16 @@ grub_register_command_lockdown (const char *name,
 void
 grub_unregister_command (grub_command_t cmd)
 {
-  if ((cmd->prio & GRUB_COMMAND_FLAG_ACTIVE) && (cmd->next))
-    cmd->next->prio |= GRUB_COMMAND_FLAG_ACTIVE;
+  if (cmd->prio & GRUB_COMMAND_FLAG_ACTIVE)
+    {
+      command_hash_remove (cmd);
+      if (cmd->next && !(cmd->next->prio & GRUB_COMMAND_FLAG_ACTIVE))
+	{
+	  cmd->next->prio |= GRUB_COMMAND_FLAG_ACTIVE;
+	  command_hash_insert (cmd->next);
+	}
+    }
   grub_list_remove (GRUB_AS_LIST (cmd));
+  grub_command_generation++;
   grub_free (cmd);
 }
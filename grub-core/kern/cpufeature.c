@@ -0,0 +1,324 @@
+/* cpufeature.c - CPU feature detection and function dispatch.  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/cpufeature.h>
+#include <grub/env.h>
+#include <grub/list.h>
+#include <grub/misc.h>
+#include <grub/mm.h>
+
+#if !defined (GRUB_MACHINE_EMU) && (defined (__i386__) || defined (__x86_64__))
+#include <grub/i386/cpuid.h>
+#define CPU_X86 1
+#elif !defined (GRUB_MACHINE_EMU) && defined (__aarch64__)
+#define CPU_ARM64 1
+#endif
+
+static grub_uint32_t cpu_features;
+static int cpu_detected;
+
+/* Set when the firmware left SSE off, so grub_cpu_simd_begin has to
+   turn it on.  */
+static int simd_needs_enable;
+
+static struct grub_cpu_dispatch *dispatch_list;
+
+/* Set by "cpu_dispatch=generic" to rule out all variants.  */
+static int force_generic;
+
+#ifdef CPU_X86
+
+#define CPUID1_EDX_FXSR		(1 << 24)
+#define CPUID1_EDX_SSE2		(1 << 26)
+#define CPUID1_ECX_PCLMUL	(1 << 1)
+#define CPUID1_ECX_SSSE3	(1 << 9)
+#define CPUID1_ECX_SSE41	(1 << 19)
+#define CPUID1_ECX_SSE42	(1 << 20)
+#define CPUID1_ECX_AES		(1 << 25)
+#define CPUID1_ECX_OSXSAVE	(1 << 27)
+#define CPUID1_ECX_AVX		(1 << 28)
+#define CPUID7_EBX_AVX2		(1 << 5)
+#define CPUID7_EBX_SHA		(1 << 29)
+
+#define CR0_MP		(1 << 1)
+#define CR0_EM		(1 << 2)
+#define CR0_TS		(1 << 3)
+#define CR4_OSFXSR	(1 << 9)
+#define CR4_OSXMMEXCPT	(1 << 10)
+
+/* XCR0 bits for the SSE and AVX register state.  */
+#define XCR0_SSE_AVX	6
+
+static inline unsigned long
+read_cr0 (void)
+{
+  unsigned long v;
+
+  asm volatile ("mov %%cr0, %0" : "=r" (v));
+  return v;
+}
+
+static inline unsigned long
+read_cr4 (void)
+{
+  unsigned long v;
+
+  asm volatile ("mov %%cr4, %0" : "=r" (v));
+  return v;
+}
+
+static inline void
+write_cr0 (unsigned long v)
+{
+  asm volatile ("mov %0, %%cr0" : : "r" (v));
+}
+
+static inline void
+write_cr4 (unsigned long v)
+{
+  asm volatile ("mov %0, %%cr4" : : "r" (v));
+}
+
+static grub_uint32_t
+cpu_detect (void)
+{
+  grub_uint32_t max, eax, ebx, ecx, edx, ebx7 = 0;
+  grub_uint32_t features = 0;
+
+  if (!grub_cpu_is_cpuid_supported ())
+    return 0;
+
+  grub_cpuid (0, max, ebx, ecx, edx);
+  grub_cpuid (1, eax, ebx, ecx, edx);
+
+  if (ecx & CPUID1_ECX_SSE42)
+    features |= GRUB_CPU_FEATURE_CRC32C;
+
+  if (!(edx & CPUID1_EDX_FXSR) || !(edx & CPUID1_EDX_SSE2))
+    return features;
+
+#ifdef GRUB_MACHINE_XEN
+  /* A PV guest can't touch the control registers to turn SSE on.  */
+  return features;
+#endif
+
+  simd_needs_enable = !(read_cr4 () & CR4_OSFXSR)
+    || (read_cr0 () & (CR0_EM | CR0_TS));
+
+  features |= GRUB_CPU_FEATURE_SIMD;
+  if (ecx & CPUID1_ECX_SSSE3)
+    features |= GRUB_CPU_FEATURE_SSSE3;
+  if (ecx & CPUID1_ECX_SSE41)
+    features |= GRUB_CPU_FEATURE_SSE4_1;
+  if (ecx & CPUID1_ECX_PCLMUL)
+    features |= GRUB_CPU_FEATURE_CLMUL;
+  if (ecx & CPUID1_ECX_AES)
+    features |= GRUB_CPU_FEATURE_AES;
+
+  if (max >= 7)
+    {
+      grub_uint32_t eax7, ecx7, edx7;
+
+      /* Leaf 7 needs its subleaf in %ecx.  */
+      asm volatile ("cpuid"
+		    : "=a" (eax7), "=b" (ebx7), "=c" (ecx7), "=d" (edx7)
+		    : "0" (7), "2" (0));
+      if (ebx7 & CPUID7_EBX_SHA)
+	features |= GRUB_CPU_FEATURE_SHA1 | GRUB_CPU_FEATURE_SHA256;
+    }
+
+  /* AVX state can only be enabled through XSETBV, so use AVX only if the
+     firmware already did.  */
+  if (!simd_needs_enable && (ecx & CPUID1_ECX_OSXSAVE)
+      && (ecx & CPUID1_ECX_AVX))
+    {
+      grub_uint32_t xcr0_lo, xcr0_hi;
+
+      asm volatile ("xgetbv" : "=a" (xcr0_lo), "=d" (xcr0_hi) : "c" (0));
+      if ((xcr0_lo & XCR0_SSE_AVX) == XCR0_SSE_AVX)
+	{
+	  features |= GRUB_CPU_FEATURE_AVX;
+	  if (ebx7 & CPUID7_EBX_AVX2)
+	    features |= GRUB_CPU_FEATURE_AVX2;
+	}
+    }
+
+  return features;
+}
+
+void
+grub_cpu_simd_begin (struct grub_cpu_simd_state *state)
+{
+  state->saved = 0;
+  if (!simd_needs_enable)
+    return;
+
+  state->cr0 = read_cr0 ();
+  state->cr4 = read_cr4 ();
+  state->saved = 1;
+  write_cr0 ((state->cr0 & ~(CR0_EM | CR0_TS)) | CR0_MP);
+  write_cr4 (state->cr4 | CR4_OSFXSR | CR4_OSXMMEXCPT);
+}
+
+void
+grub_cpu_simd_end (struct grub_cpu_simd_state *state)
+{
+  if (!state->saved)
+    return;
+
+  write_cr4 (state->cr4);
+  write_cr0 (state->cr0);
+  state->saved = 0;
+}
+
+#else
+
+#ifdef CPU_ARM64
+
+static grub_uint32_t
+cpu_detect (void)
+{
+  grub_uint64_t isar0, pfr0;
+  grub_uint32_t features = 0;
+
+  asm ("mrs %0, id_aa64isar0_el1" : "=r" (isar0));
+  asm ("mrs %0, id_aa64pfr0_el1" : "=r" (pfr0));
+
+  /* ID_AA64ISAR0_EL1.CRC32, bits [19:16].  */
+  if ((isar0 >> 16) & 0xf)
+    features |= GRUB_CPU_FEATURE_CRC32C;
+
+  /* ID_AA64PFR0_EL1.AdvSIMD, bits [23:20], is 0xf when absent.  */
+  if (((pfr0 >> 20) & 0xf) == 0xf)
+    return features;
+
+  features |= GRUB_CPU_FEATURE_SIMD;
+  /* ID_AA64ISAR0_EL1.AES is 1 for AES and 2 for AES and PMULL.  */
+  if ((isar0 >> 4) & 0xf)
+    features |= GRUB_CPU_FEATURE_AES;
+  if (((isar0 >> 4) & 0xf) >= 2)
+    features |= GRUB_CPU_FEATURE_CLMUL;
+  if ((isar0 >> 8) & 0xf)
+    features |= GRUB_CPU_FEATURE_SHA1;
+  if ((isar0 >> 12) & 0xf)
+    features |= GRUB_CPU_FEATURE_SHA256;
+
+  return features;
+}
+
+#else
+
+static grub_uint32_t
+cpu_detect (void)
+{
+  return 0;
+}
+
+#endif
+
+/* The firmware keeps the SIMD unit on wherever a variant can run.  */
+void
+grub_cpu_simd_begin (struct grub_cpu_simd_state *state)
+{
+  state->saved = 0;
+}
+
+void
+grub_cpu_simd_end (struct grub_cpu_simd_state *state __attribute__ ((unused)))
+{
+}
+
+#endif
+
+grub_uint32_t
+grub_cpu_get_features (void)
+{
+  if (!cpu_detected)
+    {
+      cpu_features = cpu_detect ();
+      cpu_detected = 1;
+    }
+  return cpu_features;
+}
+
+static void
+dispatch_resolve (struct grub_cpu_dispatch *dispatch)
+{
+  struct grub_cpu_variant *v, *best = NULL;
+  grub_uint32_t features = grub_cpu_get_features ();
+
+  if (!force_generic)
+    for (v = dispatch->variants; v; v = v->next)
+      if ((v->features & features) == v->features
+	  && (!best || v->prio > best->prio))
+	best = v;
+
+  dispatch->func = best ? best->func : dispatch->generic;
+  grub_dprintf ("cpu", "%s: using %s\n", dispatch->name,
+		best ? best->name : "generic");
+}
+
+void
+grub_cpu_dispatch_register (struct grub_cpu_dispatch *dispatch)
+{
+  grub_list_push (GRUB_AS_LIST_P (&dispatch_list), GRUB_AS_LIST (dispatch));
+  dispatch_resolve (dispatch);
+}
+
+void
+grub_cpu_dispatch_unregister (struct grub_cpu_dispatch *dispatch)
+{
+  grub_list_remove (GRUB_AS_LIST (dispatch));
+}
+
+void
+grub_cpu_variant_register (struct grub_cpu_dispatch *dispatch,
+			   struct grub_cpu_variant *variant)
+{
+  grub_list_push (GRUB_AS_LIST_P (&dispatch->variants),
+		  GRUB_AS_LIST (variant));
+  dispatch_resolve (dispatch);
+}
+
+void
+grub_cpu_variant_unregister (struct grub_cpu_dispatch *dispatch,
+			     struct grub_cpu_variant *variant)
+{
+  grub_list_remove (GRUB_AS_LIST (variant));
+  dispatch_resolve (dispatch);
+}
+
+static char *
+write_cpu_dispatch (struct grub_env_var *var __attribute__ ((unused)),
+		    const char *val)
+{
+  struct grub_cpu_dispatch *dispatch;
+
+  force_generic = (grub_strcmp (val, "generic") == 0);
+  FOR_LIST_ELEMENTS (dispatch, dispatch_list)
+    dispatch_resolve (dispatch);
+
+  return grub_strdup (val);
+}
+
+void
+grub_cpu_dispatch_init (void)
+{
+  grub_register_variable_hook ("cpu_dispatch", 0, write_cpu_dispatch);
+}
@@ -25,28 +25,100 @@
 #include <grub/time.h>
 #include <grub/file.h>
 #include <grub/i18n.h>
+#include <grub/env.h>
+#include <grub/trace.h>
+#if !defined (GRUB_UTIL) && !defined (GRUB_MACHINE_EMU)
+#include <grub/mm_private.h>
+#endif
 
 #define	GRUB_CACHE_TIMEOUT	2
 
 /* The last time the disk was used.  */
 static grub_uint64_t grub_last_time = 0;
 
-struct grub_disk_cache grub_disk_cache_table[GRUB_DISK_CACHE_NUM];
+struct grub_disk_cache *grub_disk_cache_table;
+unsigned grub_disk_cache_num_sets = 1;
+unsigned long grub_disk_generation;
+
+/* Incremented on every cache access, used for LRU replacement.  */
+static grub_uint64_t grub_disk_cache_clock;
 
 void (*grub_disk_firmware_fini) (void);
 int grub_disk_firmware_is_tainted;
 
-#if DISK_CACHE_STATS
-static unsigned long grub_disk_cache_hits;
-static unsigned long grub_disk_cache_misses;
+struct grub_disk_stats *grub_disk_stats_list;
+
+void (*grub_disk_read_record) (grub_disk_t disk, grub_disk_addr_t sector,
+			       grub_off_t offset, grub_size_t size);
 
 void
 grub_disk_cache_get_performance (unsigned long *hits, unsigned long *misses)
 {
-  *hits = grub_disk_cache_hits;
-  *misses = grub_disk_cache_misses;
+  struct grub_disk_stats *stats;
+
+  *hits = 0;
+  *misses = 0;
+  for (stats = grub_disk_stats_list; stats; stats = stats->next)
+    {
+      *hits += stats->hits;
+      *misses += stats->misses;
+    }
+}
+
+/* Return the statistics record of DISK, creating it if needed.  */
+static struct grub_disk_stats *
+grub_disk_stats_get (grub_disk_t disk)
+{
+  struct grub_disk_stats *stats;
+
+  for (stats = grub_disk_stats_list; stats; stats = stats->next)
+    if (stats->dev_id == disk->dev->id && stats->disk_id == disk->id
+	&& grub_strcmp (stats->name, disk->name) == 0)
+      return stats;
+
+  /* Statistics are best effort, don't fail the open because of them.  */
+  stats = grub_zalloc (sizeof (*stats));
+  if (stats == NULL)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return NULL;
+    }
+  stats->name = grub_strdup (disk->name);
+  if (stats->name == NULL)
+    {
+      grub_free (stats);
+      grub_errno = GRUB_ERR_NONE;
+      return NULL;
+    }
+  stats->dev_id = disk->dev->id;
+  stats->disk_id = disk->id;
+  stats->next = grub_disk_stats_list;
+  grub_disk_stats_list = stats;
+
+  return stats;
+}
+
+/* Call the device read function and account for it.  */
+static grub_err_t
+grub_disk_read_dev (grub_disk_t disk, grub_disk_addr_t sector,
+		    grub_size_t size, char *buf)
+{
+  grub_uint64_t start, trace_start;
+  grub_err_t err;
+
+  start = grub_get_time_ms ();
+  trace_start = grub_trace_now ();
+  err = (disk->dev->disk_read) (disk, sector, size, buf);
+  grub_trace_record (GRUB_TRACE_DISK, disk->dev->name, disk->name, trace_start,
+		     size << disk->log_sector_size);
+  if (disk->stats)
+    {
+      disk->stats->read_calls++;
+      disk->stats->read_time_ms += grub_get_time_ms () - start;
+    }
+
+  return err;
 }
-#endif
 
 grub_err_t (*grub_disk_write_weak) (grub_disk_t disk,
 				    grub_disk_addr_t sector,
@@ -55,12 +127,31 @@ grub_err_t (*grub_disk_write_weak) (grub_disk_t disk,
 				    const void *buf);
 #include "disk_common.c"
 
+#define DISK_CACHE_ENTRY_SIZE	(GRUB_DISK_SECTOR_SIZE << GRUB_DISK_CACHE_BITS)
+
+static grub_size_t grub_disk_cache_reclaim (struct grub_mm_cache *mm,
+					    grub_size_t target);
+
+static struct grub_mm_cache grub_disk_cache_mm =
+  {
+    .name = "disk",
+    /* Under memory pressure, keep as much as the smallest table holds.  */
+    .budget = GRUB_DISK_CACHE_MIN_SETS * GRUB_DISK_CACHE_WAYS
+	      * DISK_CACHE_ENTRY_SIZE,
+    .reclaim = grub_disk_cache_reclaim
+  };
+
 void
 grub_disk_cache_invalidate_all (void)
 {
   unsigned i;
 
-  for (i = 0; i < GRUB_DISK_CACHE_NUM; i++)
+  grub_disk_generation++;
+
+  if (grub_disk_cache_table == NULL)
+    return;
+
+  for (i = 0; i < grub_disk_cache_num_sets * GRUB_DISK_CACHE_WAYS; i++)
     {
       struct grub_disk_cache *cache = grub_disk_cache_table + i;
 
@@ -68,81 +159,180 @@ grub_disk_cache_invalidate_all (void)
 	{
 	  grub_free (cache->data);
 	  cache->data = 0;
+	  grub_mm_cache_uncharge (&grub_disk_cache_mm, DISK_CACHE_ENTRY_SIZE);
 	}
     }
 }
 
+/* Free the unlocked entries that were not among the most recently used
+   ones, keeping about the newest USED - TARGET bytes.  The contents stay
+   valid, so grub_disk_generation is left alone.  */
+static grub_size_t
+grub_disk_cache_reclaim (struct grub_mm_cache *mm, grub_size_t target)
+{
+  grub_uint64_t keep = 0, cutoff;
+  grub_size_t freed = 0;
+  unsigned i;
+
+  if (target < mm->used)
+    keep = (mm->used - target) / DISK_CACHE_ENTRY_SIZE;
+  /* Entries used since the clock read CUTOFF are the newest KEEP at most.  */
+  cutoff = grub_disk_cache_clock > keep ? grub_disk_cache_clock - keep : 0;
+
+  for (i = 0; i < grub_disk_cache_num_sets * GRUB_DISK_CACHE_WAYS; i++)
+    {
+      struct grub_disk_cache *cache = grub_disk_cache_table + i;
+
+      if (cache->data && ! cache->lock && (!keep || cache->last_use <= cutoff))
+	{
+	  grub_free (cache->data);
+	  cache->data = 0;
+	  grub_mm_cache_uncharge (mm, DISK_CACHE_ENTRY_SIZE);
+	  freed += DISK_CACHE_ENTRY_SIZE;
+	}
+    }
+
+  return freed;
+}
+
+/* Allocate the cache table. The number of sets is chosen so that a full
+   cache takes at most half of the heap present at the time of the first
+   disk access.  */
+static void
+grub_disk_cache_init (void)
+{
+  grub_size_t heap_size = 0;
+  grub_size_t num_sets;
+
+#if !defined (GRUB_UTIL) && !defined (GRUB_MACHINE_EMU)
+  grub_mm_region_t r;
+
+  for (r = grub_mm_base; r; r = r->next)
+    heap_size += r->size;
+#endif
+
+  if (heap_size)
+    num_sets = (heap_size / 2) / ((GRUB_DISK_SECTOR_SIZE << GRUB_DISK_CACHE_BITS)
+				  * GRUB_DISK_CACHE_WAYS);
+  else
+    num_sets = GRUB_DISK_CACHE_NUM / GRUB_DISK_CACHE_WAYS;
+
+  if (num_sets < GRUB_DISK_CACHE_MIN_SETS)
+    num_sets = GRUB_DISK_CACHE_MIN_SETS;
+  if (num_sets > GRUB_DISK_CACHE_MAX_SETS)
+    num_sets = GRUB_DISK_CACHE_MAX_SETS;
+
+  grub_disk_cache_table = grub_calloc (num_sets * GRUB_DISK_CACHE_WAYS,
+				       sizeof (*grub_disk_cache_table));
+  if (grub_disk_cache_table == NULL)
+    {
+      /* Run without a cache.  */
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+
+  grub_disk_cache_num_sets = num_sets;
+  grub_mm_cache_register (&grub_disk_cache_mm);
+  grub_dprintf ("disk", "cache: %u sets of %d entries\n",
+		grub_disk_cache_num_sets, GRUB_DISK_CACHE_WAYS);
+}
+
 static char *
-grub_disk_cache_fetch (unsigned long dev_id, unsigned long disk_id,
-		       grub_disk_addr_t sector)
+grub_disk_cache_fetch (grub_disk_t disk, grub_disk_addr_t sector)
 {
   struct grub_disk_cache *cache;
-  unsigned cache_index;
-
-  cache_index = grub_disk_cache_get_index (dev_id, disk_id, sector);
-  cache = grub_disk_cache_table + cache_index;
 
-  if (cache->dev_id == dev_id && cache->disk_id == disk_id
-      && cache->sector == sector)
+  cache = grub_disk_cache_lookup (disk->dev->id, disk->id, sector);
+  if (cache)
     {
       cache->lock = 1;
-#if DISK_CACHE_STATS
-      grub_disk_cache_hits++;
-#endif
+      cache->last_use = ++grub_disk_cache_clock;
+      if (disk->stats)
+	disk->stats->hits++;
       return cache->data;
     }
 
-#if DISK_CACHE_STATS
-  grub_disk_cache_misses++;
-#endif
+  if (disk->stats)
+    disk->stats->misses++;
 
   return 0;
 }
 
 static void
-grub_disk_cache_unlock (unsigned long dev_id, unsigned long disk_id,
-			grub_disk_addr_t sector)
+grub_disk_cache_unlock (grub_disk_t disk, grub_disk_addr_t sector)
 {
   struct grub_disk_cache *cache;
-  unsigned cache_index;
-
-  cache_index = grub_disk_cache_get_index (dev_id, disk_id, sector);
-  cache = grub_disk_cache_table + cache_index;
 
-  if (cache->dev_id == dev_id && cache->disk_id == disk_id
-      && cache->sector == sector)
+  cache = grub_disk_cache_lookup (disk->dev->id, disk->id, sector);
+  if (cache)
     cache->lock = 0;
 }
 
 static grub_err_t
-grub_disk_cache_store (unsigned long dev_id, unsigned long disk_id,
-		       grub_disk_addr_t sector, const char *data)
+grub_disk_cache_store (grub_disk_t disk, grub_disk_addr_t sector,
+		       const char *data)
 {
-  unsigned cache_index;
+  unsigned long dev_id = disk->dev->id;
+  unsigned long disk_id = disk->id;
+  struct grub_disk_cache *set;
   struct grub_disk_cache *cache;
+  unsigned i;
 
-  cache_index = grub_disk_cache_get_index (dev_id, disk_id, sector);
-  cache = grub_disk_cache_table + cache_index;
+  if (grub_disk_cache_table == NULL)
+    {
+      grub_disk_cache_init ();
+      if (grub_disk_cache_table == NULL)
+	return GRUB_ERR_NONE;
+    }
+
+  /* Reuse the entry already holding SECTOR, otherwise a free entry,
+     otherwise evict the least recently used unlocked one.  */
+  cache = grub_disk_cache_lookup (dev_id, disk_id, sector);
+  if (cache == NULL)
+    {
+      set = grub_disk_cache_get_set (dev_id, disk_id, sector);
+      for (i = 0; i < GRUB_DISK_CACHE_WAYS; i++)
+	{
+	  if (set[i].lock)
+	    continue;
+	  if (set[i].data == NULL)
+	    {
+	      cache = set + i;
+	      break;
+	    }
+	  if (cache == NULL || set[i].last_use < cache->last_use)
+	    cache = set + i;
+	}
+      if (cache == NULL)
+	return GRUB_ERR_NONE;
+      if (cache->data && disk->stats)
+	disk->stats->evictions++;
+    }
 
   cache->lock = 1;
-  grub_free (cache->data);
-  cache->data = 0;
+  if (cache->data)
+    {
+      grub_free (cache->data);
+      cache->data = 0;
+      grub_mm_cache_uncharge (&grub_disk_cache_mm, DISK_CACHE_ENTRY_SIZE);
+    }
   cache->lock = 0;
 
-  cache->data = grub_malloc (GRUB_DISK_SECTOR_SIZE << GRUB_DISK_CACHE_BITS);
+  cache->data = grub_malloc (DISK_CACHE_ENTRY_SIZE);
   if (! cache->data)
     return grub_errno;
+  grub_mm_cache_charge (&grub_disk_cache_mm, DISK_CACHE_ENTRY_SIZE);
 
-  grub_memcpy (cache->data, data,
-	       GRUB_DISK_SECTOR_SIZE << GRUB_DISK_CACHE_BITS);
+  grub_memcpy (cache->data, data, DISK_CACHE_ENTRY_SIZE);
   cache->dev_id = dev_id;
   cache->disk_id = disk_id;
   cache->sector = sector;
+  cache->last_use = ++grub_disk_cache_clock;
 
   return GRUB_ERR_NONE;
 }
 
-
+
 
 grub_disk_dev_t grub_disk_dev_list;
 
@@ -166,6 +356,34 @@ grub_disk_dev_unregister (grub_disk_dev_t dev)
       }
 }
 
+/* Return the maximum read-ahead window for DISK in cache units.  */
+static unsigned int
+grub_disk_read_ahead_limit (grub_disk_t disk)
+{
+  const char *val;
+  unsigned long kib = GRUB_DISK_READ_AHEAD_DEFAULT;
+  unsigned long max;
+
+  val = grub_env_get ("disk_readahead");
+  if (val)
+    {
+      const char *end;
+      unsigned long v;
+
+      v = grub_strtoul (val, &end, 0);
+      if (grub_errno == GRUB_ERR_NONE && *end == '\0')
+	kib = v;
+      grub_errno = GRUB_ERR_NONE;
+    }
+
+  max = kib >> (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS - 10);
+  /* One cache unit is always read for the request itself.  */
+  if (disk->max_agglomerate && max > disk->max_agglomerate - 1)
+    max = disk->max_agglomerate - 1;
+
+  return max;
+}
+
 /* Return the location of the first ',', if any, which is not
    escaped by a '\'.  */
 static const char *
@@ -247,6 +465,8 @@ grub_disk_open (const char *name)
     }
 
   disk->dev = dev;
+  disk->stats = grub_disk_stats_get (disk);
+  disk->read_ahead_max = grub_disk_read_ahead_limit (disk);
 
   if (p)
     {
@@ -314,6 +534,58 @@ grub_disk_close (grub_disk_t disk)
   grub_free (disk);
 }
 
+/* Called before reading the cache unit at SECTOR from the device. Detect
+   sequential access and return the number of cache units following SECTOR
+   which should be read along with it. The window doubles on every miss
+   continuing the previous device read, up to DISK->read_ahead_max, and is
+   dropped on a seek.  */
+static unsigned
+grub_disk_read_ahead (grub_disk_t disk, grub_disk_addr_t sector)
+{
+  grub_disk_addr_t total;
+  grub_disk_addr_t slack;
+  unsigned n, i;
+
+  slack = (grub_disk_addr_t) (disk->read_ahead_window ? disk->read_ahead_window : 1)
+    << GRUB_DISK_CACHE_BITS;
+  if (sector >= disk->read_ahead_next
+      && sector - disk->read_ahead_next <= slack)
+    {
+      if (disk->read_ahead_window == 0)
+	disk->read_ahead_window = 1;
+      else if (disk->read_ahead_window < disk->read_ahead_max / 2)
+	disk->read_ahead_window *= 2;
+      else
+	disk->read_ahead_window = disk->read_ahead_max;
+    }
+  else
+    disk->read_ahead_window = 0;
+
+  if (disk->read_ahead_window > disk->read_ahead_max)
+    disk->read_ahead_window = disk->read_ahead_max;
+  n = disk->read_ahead_window;
+
+  if (disk->total_sectors == GRUB_DISK_SIZE_UNKNOWN)
+    n = 0;
+  else
+    {
+      /* Only read whole cache units which are inside of the disk.  */
+      total = disk->total_sectors << (disk->log_sector_size - GRUB_DISK_SECTOR_BITS);
+      if (((total - sector - 1) >> GRUB_DISK_CACHE_BITS) <= n)
+	n = ((total - sector - 1) >> GRUB_DISK_CACHE_BITS) - 1;
+    }
+
+  /* Stop at the first unit which is already cached.  */
+  for (i = 0; i < n; i++)
+    if (grub_disk_cache_lookup (disk->dev->id, disk->id,
+				sector + ((grub_disk_addr_t) (i + 1) << GRUB_DISK_CACHE_BITS)))
+      break;
+  n = i;
+
+  disk->read_ahead_next = sector + ((grub_disk_addr_t) (n + 1) << GRUB_DISK_CACHE_BITS);
+  return n;
+}
+
 /* Small read (less than cache size and not pass across cache unit boundaries).
    sector is already adjusted and is divisible by cache unit size.
  */
@@ -325,42 +597,66 @@ grub_disk_read_small_real (grub_disk_t disk, grub_disk_addr_t sector,
   char *tmp_buf;
 
   /* Fetch the cache.  */
-  data = grub_disk_cache_fetch (disk->dev->id, disk->id, sector);
+  data = grub_disk_cache_fetch (disk, sector);
   if (data)
     {
       /* Just copy it!  */
       grub_memcpy (buf, data + offset, size);
-      grub_disk_cache_unlock (disk->dev->id, disk->id, sector);
+      grub_disk_cache_unlock (disk, sector);
       return GRUB_ERR_NONE;
     }
 
-  /* Allocate a temporary buffer.  */
-  tmp_buf = grub_malloc (GRUB_DISK_SECTOR_SIZE << GRUB_DISK_CACHE_BITS);
-  if (! tmp_buf)
-    return grub_errno;
-
   /* Otherwise read data from the disk actually.  */
   if (disk->total_sectors == GRUB_DISK_SIZE_UNKNOWN
       || sector + GRUB_DISK_CACHE_SIZE
       < (disk->total_sectors << (disk->log_sector_size - GRUB_DISK_SECTOR_BITS)))
     {
       grub_err_t err;
-      err = (disk->dev->disk_read) (disk, grub_disk_to_native_sector (disk, sector),
+      unsigned units, i;
+
+      units = 1 + grub_disk_read_ahead (disk, sector);
+
+      /* Allocate a temporary buffer.  */
+      tmp_buf = grub_malloc (units << (GRUB_DISK_SECTOR_BITS + GRUB_DISK_CACHE_BITS));
+      if (!tmp_buf && units > 1)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  units = 1;
+	  tmp_buf = grub_malloc (GRUB_DISK_SECTOR_SIZE << GRUB_DISK_CACHE_BITS);
+	}
+      if (! tmp_buf)
+	return grub_errno;
+
+      err = grub_disk_read_dev (disk, grub_disk_to_native_sector (disk, sector),
+				units << (GRUB_DISK_CACHE_BITS
+					  + GRUB_DISK_SECTOR_BITS
+					  - disk->log_sector_size), tmp_buf);
+      if (err && units > 1)
+	{
+	  /* The read-ahead part may be unreadable, retry without it.  */
+	  grub_errno = GRUB_ERR_NONE;
+	  units = 1;
+	  disk->read_ahead_window = 0;
+	  err = grub_disk_read_dev (disk, grub_disk_to_native_sector (disk, sector),
 				    1U << (GRUB_DISK_CACHE_BITS
 					   + GRUB_DISK_SECTOR_BITS
 					   - disk->log_sector_size), tmp_buf);
+	}
       if (!err)
 	{
 	  /* Copy it and store it in the disk cache.  */
 	  grub_memcpy (buf, tmp_buf + offset, size);
-	  grub_disk_cache_store (disk->dev->id, disk->id,
-				 sector, tmp_buf);
+	  for (i = 0; i < units; i++)
+	    grub_disk_cache_store (disk,
+				   sector + (i << GRUB_DISK_CACHE_BITS),
+				   tmp_buf + (i << (GRUB_DISK_CACHE_BITS
+						    + GRUB_DISK_SECTOR_BITS)));
 	  grub_free (tmp_buf);
 	  return GRUB_ERR_NONE;
 	}
+      grub_free (tmp_buf);
     }
 
-  grub_free (tmp_buf);
   grub_errno = GRUB_ERR_NONE;
 
   {
@@ -381,8 +677,8 @@ grub_disk_read_small_real (grub_disk_t disk, grub_disk_addr_t sector,
     if (!tmp_buf)
       return grub_errno;
 
-    if ((disk->dev->disk_read) (disk, grub_disk_to_native_sector (disk, aligned_sector),
-				num, tmp_buf))
+    if (grub_disk_read_dev (disk, grub_disk_to_native_sector (disk, aligned_sector),
+			    num, tmp_buf))
       {
 	grub_error_push ();
 	grub_dprintf ("disk", "%s read failed\n", disk->name);
@@ -427,6 +723,12 @@ grub_disk_read (grub_disk_t disk, grub_disk_addr_t sector,
       return grub_errno;
     }
 
+  if (disk->stats)
+    disk->stats->bytes_read += size;
+
+  if (grub_disk_read_record)
+    grub_disk_read_record (disk, sector, offset, size);
+
   /* First read until first cache boundary.   */
   if (offset || (sector & (GRUB_DISK_CACHE_SIZE - 1)))
     {
@@ -465,7 +767,7 @@ grub_disk_read (grub_disk_t disk, grub_disk_addr_t sector,
 	     && agglomerate < disk->max_agglomerate;
 	   agglomerate++)
 	{
-	  data = grub_disk_cache_fetch (disk->dev->id, disk->id,
+	  data = grub_disk_cache_fetch (disk,
 					sector + (agglomerate
 						  << GRUB_DISK_CACHE_BITS));
 	  if (data)
@@ -478,7 +780,7 @@ grub_disk_read (grub_disk_t disk, grub_disk_addr_t sector,
 		       + (agglomerate << (GRUB_DISK_CACHE_BITS
 					  + GRUB_DISK_SECTOR_BITS)),
 		       data, GRUB_DISK_CACHE_SIZE << GRUB_DISK_SECTOR_BITS);
-	  grub_disk_cache_unlock (disk->dev->id, disk->id,
+	  grub_disk_cache_unlock (disk,
 				  sector + (agglomerate
 					    << GRUB_DISK_CACHE_BITS));
 	}
@@ -487,16 +789,18 @@ grub_disk_read (grub_disk_t disk, grub_disk_addr_t sector,
 	{
 	  grub_disk_addr_t i;
 
-	  err = (disk->dev->disk_read) (disk, grub_disk_to_native_sector (disk, sector),
-					agglomerate << (GRUB_DISK_CACHE_BITS
-							+ GRUB_DISK_SECTOR_BITS
-							- disk->log_sector_size),
-					buf);
+	  err = grub_disk_read_dev (disk, grub_disk_to_native_sector (disk, sector),
+				    agglomerate << (GRUB_DISK_CACHE_BITS
+						    + GRUB_DISK_SECTOR_BITS
+						    - disk->log_sector_size),
+				    buf);
 	  if (err)
 	    return err;
 
+	  disk->read_ahead_next = sector + (agglomerate << GRUB_DISK_CACHE_BITS);
+
 	  for (i = 0; i < agglomerate; i ++)
-	    grub_disk_cache_store (disk->dev->id, disk->id,
+	    grub_disk_cache_store (disk,
 				   sector + (i << GRUB_DISK_CACHE_BITS),
 				   (char *) buf
 				   + (i << (GRUB_DISK_CACHE_BITS
@@ -536,6 +840,190 @@ grub_disk_read (grub_disk_t disk, grub_disk_addr_t sector,
   return grub_errno;
 }
 
+/* Return the maximum number of native sectors to transfer at once.  */
+static grub_size_t
+grub_disk_max_transfer (grub_disk_t disk)
+{
+  return ((grub_size_t) (disk->max_agglomerate ? disk->max_agglomerate : 1))
+    << (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS - disk->log_sector_size);
+}
+
+/* Read segments from the disk. Segments which are aligned to the disk
+   sector size are passed to the device in one call if it supports vectored
+   reads, other ones are read through grub_disk_read.  */
+grub_err_t
+grub_disk_readv (grub_disk_t disk, const struct grub_disk_iovec *iov,
+		 unsigned int iovcnt)
+{
+  struct grub_disk_iovec *dev_iov;
+  unsigned int dev_iovcnt = 0, i;
+  grub_size_t max = grub_disk_max_transfer (disk);
+  grub_size_t n = 0, bytes = 0;
+  grub_uint64_t start, trace_start;
+  grub_err_t err;
+
+  if (disk->dev->disk_readv)
+    for (i = 0; i < iovcnt; i++)
+      n += ((iov[i].size >> disk->log_sector_size) + max - 1) / max;
+
+  dev_iov = n ? grub_calloc (n, sizeof (*dev_iov)) : NULL;
+  if (dev_iov == NULL)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      for (i = 0; i < iovcnt; i++)
+	{
+	  err = grub_disk_read (disk, iov[i].sector, 0, iov[i].size, iov[i].buf);
+	  if (err)
+	    return err;
+	}
+      return GRUB_ERR_NONE;
+    }
+
+  for (i = 0; i < iovcnt; i++)
+    {
+      grub_disk_addr_t sector = iov[i].sector;
+      grub_off_t offset = 0;
+      grub_size_t size = iov[i].size;
+      char *buf = iov[i].buf;
+
+      if (grub_disk_adjust_range (disk, &sector, &offset, size) != GRUB_ERR_NONE)
+	{
+	  grub_free (dev_iov);
+	  return grub_errno;
+	}
+
+      if ((sector & ((1ULL << (disk->log_sector_size - GRUB_DISK_SECTOR_BITS)) - 1))
+	  || (size & ((1ULL << disk->log_sector_size) - 1)) || size == 0)
+	{
+	  err = grub_disk_read (disk, iov[i].sector, 0, size, buf);
+	  if (err)
+	    {
+	      grub_free (dev_iov);
+	      return err;
+	    }
+	  continue;
+	}
+
+      if (disk->stats)
+	disk->stats->bytes_read += size;
+      bytes += size;
+
+      sector = grub_disk_to_native_sector (disk, sector);
+      size >>= disk->log_sector_size;
+      while (size)
+	{
+	  grub_size_t len = size < max ? size : max;
+
+	  dev_iov[dev_iovcnt].sector = sector;
+	  dev_iov[dev_iovcnt].size = len;
+	  dev_iov[dev_iovcnt].buf = buf;
+	  dev_iovcnt++;
+	  sector += len;
+	  size -= len;
+	  buf += len << disk->log_sector_size;
+	}
+    }
+
+  if (dev_iovcnt == 0)
+    {
+      grub_free (dev_iov);
+      return GRUB_ERR_NONE;
+    }
+
+  start = grub_get_time_ms ();
+  trace_start = grub_trace_now ();
+  err = (disk->dev->disk_readv) (disk, dev_iov, dev_iovcnt);
+  grub_trace_record (GRUB_TRACE_DISK, disk->dev->name, disk->name, trace_start,
+		     bytes);
+  if (disk->stats)
+    {
+      disk->stats->read_calls++;
+      disk->stats->read_time_ms += grub_get_time_ms () - start;
+    }
+
+  for (i = 0; !err && i < dev_iovcnt; i++)
+    {
+      grub_disk_addr_t sector = grub_disk_from_native_sector (disk, dev_iov[i].sector);
+      grub_disk_addr_t end = sector + (dev_iov[i].size
+				       << (disk->log_sector_size - GRUB_DISK_SECTOR_BITS));
+      grub_disk_addr_t unit;
+
+      /* Store the cache units covered by this segment.  */
+      for (unit = ALIGN_UP (sector, GRUB_DISK_CACHE_SIZE);
+	   unit + GRUB_DISK_CACHE_SIZE <= end; unit += GRUB_DISK_CACHE_SIZE)
+	grub_disk_cache_store (disk, unit,
+			       dev_iov[i].buf + ((unit - sector) << GRUB_DISK_SECTOR_BITS));
+
+      if (disk->read_hook)
+	err = (disk->read_hook) (sector, 0, (end - sector) << GRUB_DISK_SECTOR_BITS,
+				 dev_iov[i].buf, disk->read_hook_data);
+    }
+
+  grub_free (dev_iov);
+  return err;
+}
+
+/* Helper for disk_readv implementations. Read runs of segments which are
+   contiguous on the disk with a single call of READ through a temporary
+   buffer and scatter the data, and other segments directly.  */
+grub_err_t
+grub_disk_readv_merge (grub_disk_t disk, const struct grub_disk_iovec *iov,
+		       unsigned int iovcnt,
+		       grub_err_t (*read) (grub_disk_t disk,
+					   grub_disk_addr_t sector,
+					   grub_size_t size, char *buf))
+{
+  grub_size_t max = grub_disk_max_transfer (disk);
+  char *tmp = NULL;
+  grub_size_t tmp_size = 0;
+  grub_err_t err = GRUB_ERR_NONE;
+  unsigned int i = 0, j, k;
+
+  while (i < iovcnt)
+    {
+      grub_size_t run = iov[i].size;
+      char *p;
+
+      for (j = i + 1; j < iovcnt
+	     && iov[j].sector == iov[j - 1].sector + iov[j - 1].size
+	     && run + iov[j].size <= max; j++)
+	run += iov[j].size;
+
+      if (j > i + 1 && tmp_size < run)
+	{
+	  grub_free (tmp);
+	  tmp_size = 0;
+	  tmp = grub_malloc (run << disk->log_sector_size);
+	  if (tmp == NULL)
+	    {
+	      /* Read this run segment by segment.  */
+	      grub_errno = GRUB_ERR_NONE;
+	      j = i + 1;
+	    }
+	  else
+	    tmp_size = run;
+	}
+
+      if (j == i + 1)
+	err = read (disk, iov[i].sector, iov[i].size, iov[i].buf);
+      else
+	{
+	  err = read (disk, iov[i].sector, run, tmp);
+	  for (k = i, p = tmp; !err && k < j; k++)
+	    {
+	      grub_memcpy (iov[k].buf, p, iov[k].size << disk->log_sector_size);
+	      p += iov[k].size << disk->log_sector_size;
+	    }
+	}
+      if (err)
+	break;
+      i = j;
+    }
+
+  grub_free (tmp);
+  return err;
+}
+
 grub_uint64_t
 grub_disk_native_sectors (grub_disk_t disk)
 {
@@ -29,9 +29,12 @@
 #include <grub/types.h>
 #include <grub/symbol.h>
 #include <grub/file.h>
+#include <grub/fs.h>
+#include <grub/modpack.h>
 #include <grub/env.h>
 #include <grub/cache.h>
 #include <grub/i18n.h>
+#include <grub/trace.h>
 
 /* Platforms where modules are in a readonly area of memory.  */
 #if defined(GRUB_MACHINE_QEMU)
@@ -75,7 +78,8 @@ grub_dl_remove (grub_dl_t mod)
 
 struct grub_symbol
 {
-  struct grub_symbol *next;
+  /* The full hash of NAME.  */
+  grub_uint32_t hash;
   const char *name;
   void *addr;
   int isfunc;
@@ -83,22 +87,28 @@ struct grub_symbol
 };
 typedef struct grub_symbol *grub_symbol_t;
 
-/* The size of the symbol table.  */
-#define GRUB_SYMTAB_SIZE	509
+/* The initial number of slots of the symbol table, a power of two.  */
+#define GRUB_SYMTAB_INITIAL_SIZE	1024
 
-/* The symbol table (using an open-hash).  */
-static struct grub_symbol *grub_symtab[GRUB_SYMTAB_SIZE];
+/*
+ * The symbol table, open addressed with linear probing.  It doubles when
+ * three quarters of it are used.  Of several symbols with the same name,
+ * the one registered last comes first in the probe sequence.
+ */
+static grub_symbol_t *grub_symtab;
+static grub_size_t grub_symtab_size;
+static grub_size_t grub_symtab_used;
 
 /* Simple hash function.  */
-static unsigned
+static grub_uint32_t
 grub_symbol_hash (const char *s)
 {
-  unsigned key = 0;
+  grub_uint32_t key = 0;
 
   while (*s)
     key = key * 65599 + *s++;
 
-  return (key + (key >> 5)) % GRUB_SYMTAB_SIZE;
+  return key + (key >> 5);
 }
 
 /* Resolve the symbol name NAME and return the address.
@@ -106,22 +116,104 @@ grub_symbol_hash (const char *s)
 static grub_symbol_t
 grub_dl_resolve_symbol (const char *name)
 {
+  grub_uint32_t hash;
+  grub_size_t i, mask;
   grub_symbol_t sym;
 
-  for (sym = grub_symtab[grub_symbol_hash (name)]; sym; sym = sym->next)
-    if (grub_strcmp (sym->name, name) == 0)
+  if (!grub_symtab)
+    return 0;
+
+  hash = grub_symbol_hash (name);
+  mask = grub_symtab_size - 1;
+  for (i = hash & mask; (sym = grub_symtab[i]); i = (i + 1) & mask)
+    if (sym->hash == hash && grub_strcmp (sym->name, name) == 0)
       return sym;
 
   return 0;
 }
 
+/* Put SYM in the symbol table, which has a free slot.  */
+static void
+grub_symtab_insert (grub_symbol_t sym)
+{
+  grub_size_t i, mask = grub_symtab_size - 1;
+  grub_symbol_t cur;
+
+  for (i = sym->hash & mask; (cur = grub_symtab[i]); i = (i + 1) & mask)
+    if (cur->hash == sym->hash && grub_strcmp (cur->name, sym->name) == 0)
+      {
+	/* Shadow the older symbol and move it further down.  */
+	grub_symtab[i] = sym;
+	sym = cur;
+      }
+
+  grub_symtab[i] = sym;
+}
+
+static grub_err_t
+grub_symtab_grow (void)
+{
+  grub_symbol_t *old = grub_symtab;
+  grub_size_t old_size = grub_symtab_size, start, i;
+  grub_size_t size = old ? old_size * 2 : GRUB_SYMTAB_INITIAL_SIZE;
+
+  grub_symtab = grub_calloc (size, sizeof (grub_symtab[0]));
+  if (!grub_symtab)
+    {
+      grub_symtab = old;
+      return grub_errno;
+    }
+  grub_symtab_size = size;
+
+  /*
+   * Insert the old symbols from the end of each run of used slots, so that
+   * newer symbols, which come first in a run, shadow older ones again.
+   * Starting after a free slot, no run is split.
+   */
+  for (start = 0; start < old_size && old[start]; start++);
+  for (i = 0; i < old_size; i++)
+    {
+      grub_symbol_t sym = old[(start + old_size - 1 - i) & (old_size - 1)];
+
+      if (sym)
+	grub_symtab_insert (sym);
+    }
+
+  grub_free (old);
+  return GRUB_ERR_NONE;
+}
+
+/* Empty the slot I of the symbol table, moving back the symbols after it
+   that would no longer be found.  */
+static void
+grub_symtab_remove_at (grub_size_t i)
+{
+  grub_size_t mask = grub_symtab_size - 1, j, home;
+
+  for (j = (i + 1) & mask; grub_symtab[j]; j = (j + 1) & mask)
+    {
+      home = grub_symtab[j]->hash & mask;
+      if (((j - home) & mask) >= ((j - i) & mask))
+	{
+	  grub_symtab[i] = grub_symtab[j];
+	  i = j;
+	}
+    }
+
+  grub_symtab[i] = 0;
+  grub_symtab_used--;
+}
+
 /* Register a symbol with the name NAME and the address ADDR.  */
 grub_err_t
 grub_dl_register_symbol (const char *name, void *addr, int isfunc,
 			 grub_dl_t mod)
 {
   grub_symbol_t sym;
-  unsigned k;
+
+  if ((grub_symtab_used + 1) * 4 > grub_symtab_size * 3
+      && grub_symtab_grow ())
+    return grub_errno;
 
   sym = (grub_symbol_t) grub_malloc (sizeof (*sym));
   if (! sym)
@@ -139,13 +231,13 @@ grub_dl_register_symbol (const char *name, void *addr, int isfunc,
   else
     sym->name = name;
 
+  sym->hash = grub_symbol_hash (name);
   sym->addr = addr;
   sym->mod = mod;
   sym->isfunc = isfunc;
 
-  k = grub_symbol_hash (name);
-  sym->next = grub_symtab[k];
-  grub_symtab[k] = sym;
+  grub_symtab_insert (sym);
+  grub_symtab_used++;
 
   return GRUB_ERR_NONE;
 }
@@ -154,27 +246,24 @@ grub_dl_register_symbol (const char *name, void *addr, int isfunc,
 static void
 grub_dl_unregister_symbols (grub_dl_t mod)
 {
-  unsigned i;
+  grub_size_t i;
 
   if (! mod)
     grub_fatal ("core symbols cannot be unregistered");
 
-  for (i = 0; i < GRUB_SYMTAB_SIZE; i++)
+  for (i = 0; i < grub_symtab_size; )
     {
-      grub_symbol_t sym, *p, q;
+      grub_symbol_t sym = grub_symtab[i];
 
-      for (p = &grub_symtab[i], sym = *p; sym; sym = q)
+      if (sym && sym->mod == mod)
 	{
-	  q = sym->next;
-	  if (sym->mod == mod)
-	    {
-	      *p = q;
-	      grub_free ((void *) sym->name);
-	      grub_free (sym);
-	    }
-	  else
-	    p = &sym->next;
+	  /* Another symbol may have moved into the slot.  */
+	  grub_symtab_remove_at (i);
+	  grub_free ((void *) sym->name);
+	  grub_free (sym);
 	}
+      else
+	i++;
     }
 }
 
@@ -182,13 +271,10 @@ grub_dl_unregister_symbols (grub_dl_t mod)
 static void *
 grub_dl_get_section_addr (grub_dl_t mod, unsigned n)
 {
-  grub_dl_segment_t seg;
-
-  for (seg = mod->segment; seg; seg = seg->next)
-    if (seg->section == n)
-      return seg->addr;
+  if (n >= mod->nsections)
+    return 0;
 
-  return 0;
+  return mod->sections[n].addr;
 }
 
 /* Check if EHDR is a valid ELF header.  */
@@ -233,13 +319,20 @@ grub_dl_load_segments (grub_dl_t mod, const Elf_Ehdr *e)
 #endif
   char *ptr;
 
+  /* Lay out all the sections that stay in memory first, so that they all
+     go in one block.  Relocations, symbols and strings are only needed
+     while loading and are used from the file image.  */
   for (i = 0, s = (const Elf_Shdr *)((const char *) e + e->e_shoff);
        i < e->e_shnum;
        i++, s = (const Elf_Shdr *)((const char *) s + e->e_shentsize))
     {
-      tsize = ALIGN_UP (tsize, s->sh_addralign) + s->sh_size;
-      if (talign < s->sh_addralign)
-	talign = s->sh_addralign;
+      grub_size_t align = s->sh_addralign ? : 1;
+
+      if (!(s->sh_flags & SHF_ALLOC) || !s->sh_size)
+	continue;
+      tsize = ALIGN_UP (tsize, align) + s->sh_size;
+      if (talign < align)
+	talign = align;
     }
 
 #if !defined (__i386__) && !defined (__x86_64__) && !defined(__riscv) && \
@@ -265,23 +358,26 @@ grub_dl_load_segments (grub_dl_t mod, const Elf_Ehdr *e)
   mod->sz = tsize;
   ptr = mod->base;
 
+  /* One descriptor per section, so that sections are found by index.  */
+  mod->sections = grub_calloc (e->e_shnum, sizeof (mod->sections[0]));
+  if (!mod->sections)
+    return grub_errno;
+  mod->nsections = e->e_shnum;
+
   for (i = 0, s = (Elf_Shdr *)((char *) e + e->e_shoff);
        i < e->e_shnum;
        i++, s = (Elf_Shdr *)((char *) s + e->e_shentsize))
     {
       if (s->sh_flags & SHF_ALLOC)
 	{
-	  grub_dl_segment_t seg;
-
-	  seg = (grub_dl_segment_t) grub_malloc (sizeof (*seg));
-	  if (! seg)
-	    return grub_errno;
+	  grub_dl_segment_t seg = &mod->sections[i];
 
 	  if (s->sh_size)
 	    {
 	      void *addr;
 
-	      ptr = (char *) ALIGN_UP ((grub_addr_t) ptr, s->sh_addralign);
+	      ptr = (char *) ALIGN_UP ((grub_addr_t) ptr,
+				       s->sh_addralign ? : 1);
 	      addr = ptr;
 	      ptr += s->sh_size;
 
@@ -589,20 +685,22 @@ grub_dl_relocate_symbols (grub_dl_t mod, void *ehdr)
        i++, s = (Elf_Shdr *) ((char *) s + e->e_shentsize))
     if (s->sh_type == SHT_REL || s->sh_type == SHT_RELA)
       {
-	grub_dl_segment_t seg;
+	const Elf_Shdr *target;
 	grub_err_t err;
 
-	/* Find the target segment.  */
-	for (seg = mod->segment; seg; seg = seg->next)
-	  if (seg->section == s->sh_info)
-	    break;
+	/* Find the target segment, if the section is loaded.  */
+	if (s->sh_info >= e->e_shnum)
+	  continue;
+	target = (const Elf_Shdr *) ((char *) e + e->e_shoff
+				     + e->e_shentsize * s->sh_info);
 
-	if (seg)
+	if (target->sh_flags & SHF_ALLOC)
 	  {
 	    if (!mod->symtab)
 	      return grub_error (GRUB_ERR_BAD_MODULE, "relocation without symbol table");
 
-	    err = grub_arch_dl_relocate_symbols (mod, ehdr, s, seg);
+	    err = grub_arch_dl_relocate_symbols (mod, ehdr, s,
+						 &mod->sections[s->sh_info]);
 	    if (err)
 	      return err;
 	  }
@@ -741,6 +839,220 @@ grub_dl_load_file (const char *filename)
   return mod;
 }
 
+/* The index of the module archive last looked at, read once.  It is NULL
+   if there is no usable archive at MODPACK_PATH.  */
+static char *modpack_path;
+static struct grub_modpack_entry *modpack_index;
+static grub_uint32_t modpack_nentries;
+
+/* A module stored in an opened archive.  */
+struct grub_modpack_member
+{
+  grub_file_t pack;
+  grub_off_t offset;
+};
+
+static grub_ssize_t
+grub_modpack_read (grub_file_t file, char *buf, grub_size_t len)
+{
+  struct grub_modpack_member *member = file->data;
+
+  if (grub_file_seek (member->pack, member->offset + file->offset)
+      == (grub_off_t) -1)
+    return -1;
+  return grub_file_read (member->pack, buf, len);
+}
+
+static grub_err_t
+grub_modpack_close (grub_file_t file)
+{
+  grub_free (file->data);
+
+  /* The device belongs to the archive.  */
+  file->device = 0;
+
+  return GRUB_ERR_NONE;
+}
+
+static struct grub_fs grub_modpack_fs =
+  {
+    .name = "modpack",
+    .fs_read = grub_modpack_read,
+    .fs_close = grub_modpack_close
+  };
+
+/* Make sure the index of the archive PATH is the one held.  Return 0 if
+   there is no usable archive there.  */
+static int
+grub_modpack_load_index (const char *path)
+{
+  struct grub_modpack_header head;
+  grub_file_t file;
+  grub_size_t isize;
+  grub_uint32_t i;
+
+  if (modpack_path && grub_strcmp (modpack_path, path) == 0)
+    return modpack_index != NULL;
+
+  grub_free (modpack_path);
+  grub_free (modpack_index);
+  modpack_index = NULL;
+  modpack_nentries = 0;
+  modpack_path = grub_strdup (path);
+  if (!modpack_path)
+    return 0;
+
+  file = grub_file_open (path, GRUB_FILE_TYPE_GRUB_MODULE
+			 | GRUB_FILE_TYPE_NO_DECOMPRESS);
+  if (!file)
+    goto fail;
+
+  if (grub_file_read (file, &head, sizeof (head)) != sizeof (head)
+      || grub_memcmp (head.magic, GRUB_MODPACK_MAGIC, sizeof (head.magic)) != 0
+      || grub_le_to_cpu32 (head.nentries) > GRUB_MODPACK_MAX_ENTRIES)
+    goto fail;
+
+  modpack_nentries = grub_le_to_cpu32 (head.nentries);
+  isize = modpack_nentries * sizeof (modpack_index[0]);
+  modpack_index = grub_malloc (isize ? : 1);
+  if (!modpack_index
+      || grub_file_read (file, modpack_index, isize) != (grub_ssize_t) isize)
+    goto fail;
+
+  for (i = 0; i < modpack_nentries; i++)
+    {
+      struct grub_modpack_entry *e = &modpack_index[i];
+
+      e->offset = grub_le_to_cpu64 (e->offset);
+      e->size = grub_le_to_cpu32 (e->size);
+      if (e->name[GRUB_MODPACK_NAME_SIZE - 1]
+	  || e->offset > file->size || e->size > file->size - e->offset
+	  || (i && grub_strcmp (e[-1].name, e->name) >= 0))
+	goto fail;
+    }
+
+  grub_file_close (file);
+  return 1;
+
+ fail:
+  grub_dprintf ("modules", "no usable module archive %s\n", path);
+  /* Only an archive that was read and found unusable is remembered.  An
+     open or read that failed, e.g. before the disk holding it was made
+     accessible, is tried again next time.  */
+  if (!file || grub_errno != GRUB_ERR_NONE)
+    {
+      grub_free (modpack_path);
+      modpack_path = NULL;
+    }
+  if (file)
+    grub_file_close (file);
+  grub_free (modpack_index);
+  modpack_index = NULL;
+  modpack_nentries = 0;
+  grub_errno = GRUB_ERR_NONE;
+  return 0;
+}
+
+/* Load the module NAME from the archive PATH.  Return NULL and leave
+   grub_errno clear if the archive does not hold it.  */
+static grub_dl_t
+grub_dl_load_packed (const char *path, const char *name)
+{
+  struct grub_modpack_entry *e = NULL;
+  struct grub_modpack_member *member;
+  grub_uint32_t lo = 0, hi;
+  grub_file_t pack, file, last_file;
+  grub_file_filter_id_t filter;
+  grub_ssize_t size;
+  void *core;
+  grub_dl_t mod;
+
+  if (!grub_modpack_load_index (path))
+    return 0;
+
+  for (hi = modpack_nentries; lo < hi; )
+    {
+      grub_uint32_t mid = lo + (hi - lo) / 2;
+      int r = grub_strcmp (name, modpack_index[mid].name);
+
+      if (r == 0)
+	{
+	  e = &modpack_index[mid];
+	  break;
+	}
+      if (r < 0)
+	hi = mid;
+      else
+	lo = mid + 1;
+    }
+  if (!e)
+    return 0;
+
+  grub_boot_time ("Loading module %s from %s", name, path);
+
+  pack = grub_file_open (path, GRUB_FILE_TYPE_GRUB_MODULE
+			 | GRUB_FILE_TYPE_NO_DECOMPRESS);
+  if (!pack)
+    return 0;
+
+  file = grub_zalloc (sizeof (*file));
+  member = grub_malloc (sizeof (*member));
+  if (!file || !member)
+    {
+      grub_free (file);
+      grub_free (member);
+      grub_file_close (pack);
+      return 0;
+    }
+  member->pack = pack;
+  member->offset = e->offset;
+  file->device = pack->device;
+  file->fs = &grub_modpack_fs;
+  file->data = member;
+  file->size = e->size;
+
+  /* Modules may be stored compressed, like the .mod files.  */
+  last_file = NULL;
+  for (filter = GRUB_FILE_FILTER_COMPRESSION_FIRST;
+       file && filter <= GRUB_FILE_FILTER_COMPRESSION_LAST; filter++)
+    if (grub_file_filters[filter])
+      {
+	last_file = file;
+	file = grub_file_filters[filter] (file, GRUB_FILE_TYPE_GRUB_MODULE);
+      }
+  if (!file)
+    {
+      grub_file_close (last_file);
+      grub_file_close (pack);
+      return 0;
+    }
+
+  size = grub_file_size (file);
+  core = grub_malloc (size);
+  if (core && grub_file_read (file, core, size) != size)
+    {
+      if (!grub_errno)
+	grub_error (GRUB_ERR_FILE_READ_ERROR, N_("premature end of file %s"),
+		    path);
+      grub_free (core);
+      core = 0;
+    }
+
+  /* As for .mod files, close the archive before loading dependencies.  */
+  grub_file_close (file);
+  grub_file_close (pack);
+  if (!core)
+    return 0;
+
+  mod = grub_dl_load_core (core, size);
+  grub_free (core);
+  if (!mod)
+    return 0;
+
+  mod->ref_count--;
+  return mod;
+}
+
 /* Load a module using a symbolic name.  */
 grub_dl_t
 grub_dl_load (const char *name)
@@ -748,6 +1060,7 @@ grub_dl_load (const char *name)
   char *filename;
   grub_dl_t mod;
   const char *grub_dl_dir = grub_env_get ("prefix");
+  grub_uint64_t start;
 
   mod = grub_dl_get (name);
   if (mod)
@@ -761,16 +1074,32 @@ grub_dl_load (const char *name)
     return 0;
   }
 
-  filename = grub_xasprintf ("%s/" GRUB_TARGET_CPU "-" GRUB_PLATFORM "/%s.mod",
-			     grub_dl_dir, name);
+  filename = grub_xasprintf ("%s/" GRUB_TARGET_CPU "-" GRUB_PLATFORM "/"
+			     GRUB_MODPACK_FILENAME, grub_dl_dir);
   if (! filename)
     return 0;
 
-  mod = grub_dl_load_file (filename);
+  /* The time of the dependencies is counted in too.  */
+  start = grub_trace_now ();
+  mod = grub_dl_load_packed (filename, name);
   grub_free (filename);
+  if (! mod && grub_errno)
+    return 0;
 
   if (! mod)
-    return 0;
+    {
+      filename = grub_xasprintf ("%s/" GRUB_TARGET_CPU "-" GRUB_PLATFORM
+				 "/%s.mod", grub_dl_dir, name);
+      if (! filename)
+	return 0;
+
+      mod = grub_dl_load_file (filename);
+      grub_free (filename);
+
+      if (! mod)
+	return 0;
+    }
+  grub_trace_record (GRUB_TRACE_MODULE, NULL, name, start, 0);
 
   if (grub_strcmp (mod->name, name) != 0)
     grub_error (GRUB_ERR_BAD_MODULE, "mismatched names");
@@ -807,6 +1136,7 @@ grub_dl_unload (grub_dl_t mod)
 #else
   grub_free (mod->base);
 #endif
+  grub_free (mod->sections);
   grub_free (mod->name);
 #ifdef GRUB_MODULES_MACHINE_READONLY
   grub_free (mod->symtab);
@@ -155,6 +155,51 @@ grub_efi_stall (grub_efi_uintn_t microseconds)
   grub_efi_system_table->boot_services->stall (microseconds);
 }
 
+static grub_efi_event_t idle_timer;
+
+/* Wait for a key or for MS milliseconds to pass, in WaitForEvent, where
+   the firmware halts the CPU until something happens.  */
+void
+grub_efi_idle (grub_uint32_t ms)
+{
+  grub_efi_boot_services_t *b = grub_efi_system_table->boot_services;
+  grub_efi_simple_input_interface_t *con_in = grub_efi_system_table->con_in;
+  grub_efi_event_t events[2];
+  grub_efi_uintn_t n = 0, index;
+
+  if (!idle_timer
+      && b->create_event (GRUB_EFI_EVT_TIMER, 0, NULL, NULL,
+			  &idle_timer) != GRUB_EFI_SUCCESS)
+    idle_timer = NULL;
+
+  /* In 100ns units.  */
+  if (!idle_timer
+      || b->set_timer (idle_timer, GRUB_EFI_TIMER_RELATIVE,
+		       (grub_efi_uint64_t) ms * 10000) != GRUB_EFI_SUCCESS)
+    {
+      grub_cpu_idle ();
+      return;
+    }
+
+  events[n++] = idle_timer;
+  if (con_in && con_in->wait_for_key)
+    events[n++] = con_in->wait_for_key;
+  b->wait_for_event (n, events, &index);
+
+  /* Don't leave the timer to wake the next wait early.  */
+  b->set_timer (idle_timer, GRUB_EFI_TIMER_CANCEL, 0);
+  b->check_event (idle_timer);
+}
+
+void
+grub_efi_idle_fini (void)
+{
+  if (!idle_timer)
+    return;
+  grub_efi_system_table->boot_services->close_event (idle_timer);
+  idle_timer = NULL;
+}
+
 grub_efi_loaded_image_t *
 grub_efi_get_loaded_image (grub_efi_handle_t image_handle)
 {
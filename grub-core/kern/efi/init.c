@@ -29,6 +29,7 @@
 #include <grub/mm.h>
 #include <grub/kernel.h>
 #include <grub/stack_protector.h>
+#include <grub/time.h>
 
 #ifdef GRUB_STACK_PROTECTOR
 
@@ -128,6 +129,8 @@ grub_efi_init (void)
 
   grub_efi_system_table->boot_services->set_watchdog_timer (0, 0, 0, NULL);
 
+  grub_install_idle (grub_efi_idle);
+
   grub_efidisk_init ();
 
   grub_efi_register_debug_commands ();
@@ -166,6 +169,7 @@ grub_machine_get_bootlocation (char **device, char **path)
 void
 grub_efi_fini (void)
 {
+  grub_efi_idle_fini ();
   grub_efidisk_fini ();
   grub_console_fini ();
 }
@@ -648,12 +648,34 @@ grub_efi_mm_add_regions (grub_size_t required_bytes, unsigned int flags)
   return GRUB_ERR_NONE;
 }
 
+/* Serve a large heap allocation from pages of its own.  */
+static void *
+grub_efi_mm_alloc_pages (grub_size_t size)
+{
+  if (grub_efi_is_finished)
+    return NULL;
+
+  return grub_efi_allocate_any_pages (BYTES_TO_PAGES (size));
+}
+
+static void
+grub_efi_mm_free_pages (void *addr, grub_size_t size)
+{
+  /* The pages belong to the OS once boot services are gone.  */
+  if (grub_efi_is_finished)
+    return;
+
+  grub_efi_free_pages ((grub_addr_t) addr, BYTES_TO_PAGES (size));
+}
+
 void
 grub_efi_mm_init (void)
 {
   if (grub_efi_mm_add_regions (DEFAULT_HEAP_SIZE, GRUB_MM_ADD_REGION_NONE) != GRUB_ERR_NONE)
     grub_fatal ("%s", grub_errmsg);
   grub_mm_add_region_fn = grub_efi_mm_add_regions;
+  grub_mm_alloc_pages_fn = grub_efi_mm_alloc_pages;
+  grub_mm_free_pages_fn = grub_efi_mm_free_pages;
 }
 
 #if defined (__aarch64__) || defined (__arm__) || defined (__riscv) || \
@@ -141,6 +141,7 @@ grub_util_biosdisk_open (const char *name, grub_disk_t disk)
   data->fd = GRUB_UTIL_FD_INVALID;
   data->is_disk = 0;
   data->device_map = map[drive].device_map;
+  data->direct = 0;
 
   /* Get the size.  */
   {
@@ -286,6 +287,7 @@ grub_util_biosdisk_read (grub_disk_t disk, grub_disk_addr_t sector,
     {
       grub_util_fd_t fd;
       grub_disk_addr_t max = ~0ULL;
+      ssize_t ret;
       fd = grub_util_fd_open_device (disk, sector, GRUB_UTIL_FD_O_RDONLY, &max);
       if (!GRUB_UTIL_FD_IS_VALID (fd))
 	return grub_errno;
@@ -302,8 +304,14 @@ grub_util_biosdisk_read (grub_disk_t disk, grub_disk_addr_t sector,
       if (max > size)
 	max = size;
 
-      if (grub_util_fd_read (fd, buf, max << disk->log_sector_size)
-	  != (ssize_t) (max << disk->log_sector_size))
+#ifdef __linux__
+      if (((struct grub_util_hostdisk_data *) disk->data)->direct)
+	ret = grub_hostdisk_linux_read_direct (disk->data, buf,
+					       max << disk->log_sector_size);
+      else
+#endif
+	ret = grub_util_fd_read (fd, buf, max << disk->log_sector_size);
+      if (ret != (ssize_t) (max << disk->log_sector_size))
 	return grub_error (GRUB_ERR_READ_ERROR, N_("cannot read `%s': %s"),
 			   map[disk->id].device, grub_util_fd_strerror ());
       size -= max;
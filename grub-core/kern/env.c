@@ -22,111 +22,284 @@
 #include <grub/misc.h>
 #include <grub/mm.h>
 
+/* Slots of a table to begin with.  */
+#define ENV_TABLE_MIN_SIZE	16
+
 /* The initial context.  */
 static struct grub_env_context initial_context;
 
 /* The current context.  */
 struct grub_env_context *grub_current_context = &initial_context;
 
+/* What a slot is left pointing to when its variable is removed, so that
+   the variables after it in the probe sequence are still found.  */
+static struct grub_env_var deleted_slot;
+
 /* Return the hash representation of the string S.  */
-static unsigned int
+static grub_uint32_t
 grub_env_hashval (const char *s)
 {
-  unsigned int i = 0;
+  grub_uint32_t h = 0x811c9dc5;
 
-  /* XXX: This can be done much more efficiently.  */
   while (*s)
-    i += 5 * *(s++);
+    h = (h ^ (grub_uint8_t) *(s++)) * 0x01000193;
 
-  return i % HASHSZ;
+  return h;
 }
 
-static struct grub_env_var *
-grub_env_find (const char *name)
+/* Return the slot of NAME in CONTEXT, or NULL if it has none.  */
+static struct grub_env_var **
+grub_env_lookup (struct grub_env_context *context, const char *name,
+		 grub_uint32_t hash)
 {
+  grub_size_t mask = context->size - 1, i;
   struct grub_env_var *var;
-  int idx = grub_env_hashval (name);
 
-  /* Look for the variable in the current context.  */
-  for (var = grub_current_context->vars[idx]; var; var = var->next)
-    if (grub_strcmp (var->name, name) == 0)
-      return var;
+  if (! context->size)
+    return 0;
+
+  for (i = hash & mask; (var = context->vars[i]); i = (i + 1) & mask)
+    if (var != &deleted_slot && var->hash == hash
+	&& grub_strcmp (var->name, name) == 0)
+      return &context->vars[i];
 
   return 0;
 }
 
-static void
+/*
+ * Find the variable NAME of an outer context as seen from the current one.
+ * Outer variables are seen if they are exported, or all of them if the
+ * context below was opened that way, unless a nearer context has one of
+ * the same name.
+ */
+static struct grub_env_var *
+grub_env_find_outer (const char *name, grub_uint32_t hash)
+{
+  struct grub_env_context *context;
+  struct grub_env_var **slot;
+
+  for (context = grub_current_context; context->prev; context = context->prev)
+    {
+      slot = grub_env_lookup (context->prev, name, hash);
+      if (! slot)
+	continue;
+      if (! (*slot)->global && ! context->inherit_all)
+	return 0;
+      /* Unset over a variable further out.  */
+      return (*slot)->value ? *slot : 0;
+    }
+
+  return 0;
+}
+
+/* Find the variable NAME as seen from the current context.  *LOCAL tells
+   whether it is the current context's own.  */
+static struct grub_env_var *
+grub_env_find_visible (const char *name, int *local)
+{
+  grub_uint32_t hash = grub_env_hashval (name);
+  struct grub_env_var **slot;
+
+  slot = grub_env_lookup (grub_current_context, name, hash);
+  *local = !! slot;
+  if (slot)
+    return (*slot)->value ? *slot : 0;
+
+  return grub_env_find_outer (name, hash);
+}
+
+static struct grub_env_var *
+grub_env_find (const char *name)
+{
+  int local;
+
+  return grub_env_find_visible (name, &local);
+}
+
+/* Rehash CONTEXT into SIZE slots, dropping the deleted ones.  */
+static grub_err_t
+grub_env_resize (struct grub_env_context *context, grub_size_t size)
+{
+  struct grub_env_var **vars, *var;
+  grub_size_t i, j;
+
+  vars = grub_calloc (size, sizeof (vars[0]));
+  if (! vars)
+    return grub_errno;
+
+  for (i = 0; i < context->size; i++)
+    {
+      var = context->vars[i];
+      if (! var || var == &deleted_slot)
+	continue;
+      for (j = var->hash & (size - 1); vars[j]; j = (j + 1) & (size - 1));
+      vars[j] = var;
+    }
+
+  grub_free (context->vars);
+  context->vars = vars;
+  context->size = size;
+  context->used = context->count;
+
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
 grub_env_insert (struct grub_env_context *context,
 		 struct grub_env_var *var)
 {
-  int idx = grub_env_hashval (var->name);
+  grub_size_t i, size;
+
+  var->hash = grub_env_hashval (var->name);
+
+  /* Keep the table at most three quarters full, counting deleted slots. */
+  if ((context->used + 1) * 4 > context->size * 3)
+    {
+      size = context->size ? : ENV_TABLE_MIN_SIZE;
+      while ((context->count + 1) * 2 > size)
+	size *= 2;
+      if (grub_env_resize (context, size) != GRUB_ERR_NONE)
+	{
+	  if (context->used + 1 >= context->size)
+	    return grub_errno;
+	  grub_errno = GRUB_ERR_NONE;
+	}
+    }
 
   /* Insert the variable into the hashtable.  */
-  var->prevp = &context->vars[idx];
-  var->next = context->vars[idx];
-  if (var->next)
-    var->next->prevp = &(var->next);
-  context->vars[idx] = var;
+  for (i = var->hash & (context->size - 1);
+       context->vars[i] && context->vars[i] != &deleted_slot;
+       i = (i + 1) & (context->size - 1));
+  if (! context->vars[i])
+    context->used++;
+  context->vars[i] = var;
+  context->count++;
+
+  return GRUB_ERR_NONE;
 }
 
 static void
-grub_env_remove (struct grub_env_var *var)
+grub_env_remove (struct grub_env_context *context, struct grub_env_var *var)
 {
+  struct grub_env_var **slot;
+
   /* Remove the entry from the variable table.  */
-  *var->prevp = var->next;
-  if (var->next)
-    var->next->prevp = var->prevp;
+  slot = grub_env_lookup (context, var->name, var->hash);
+  *slot = &deleted_slot;
+  context->count--;
 }
 
-grub_err_t
-grub_env_set (const char *name, const char *val)
+static void
+grub_env_free_var (struct grub_env_var *var)
+{
+  grub_free (var->name);
+  grub_free (var->value);
+  grub_free (var);
+}
+
+/* Add a variable NAME with VALUE, which may be NULL for an unset one, to
+   the current context.  */
+static struct grub_env_var *
+grub_env_add (const char *name, char *value)
 {
   struct grub_env_var *var;
 
-  /* If the variable does already exist, just update the variable.  */
-  var = grub_env_find (name);
-  if (var)
+  var = grub_zalloc (sizeof (*var));
+  if (! var)
+    return 0;
+  var->name = grub_strdup (name);
+  if (! var->name
+      || grub_env_insert (grub_current_context, var) != GRUB_ERR_NONE)
     {
-      char *old = var->value;
+      grub_free (var->name);
+      grub_free (var);
+      return 0;
+    }
+  var->value = value;
+
+  return var;
+}
 
-      if (var->write_hook)
-	var->value = var->write_hook (var, val);
-      else
-	var->value = grub_strdup (val);
+/*
+ * Return the current context's own variable NAME, creating it, empty, if
+ * there is none.  An outer variable seen here is copied first, so that
+ * changes to it stay in the current context.
+ */
+static struct grub_env_var *
+grub_env_get_local (const char *name)
+{
+  struct grub_env_var *var, *outer, **slot;
+  char *value;
+  int local;
 
-      if (! var->value)
+  outer = grub_env_find_visible (name, &local);
+  if (outer && local)
+    return outer;
+
+  value = grub_strdup (outer ? outer->value : "");
+  if (! value)
+    return 0;
+
+  /* Reuse what is left of the variable after an unset.  */
+  slot = grub_env_lookup (grub_current_context, name,
+			  grub_env_hashval (name));
+  if (slot)
+    {
+      var = *slot;
+      var->value = value;
+    }
+  else
+    {
+      var = grub_env_add (name, value);
+      if (! var)
 	{
-	  var->value = old;
-	  return grub_errno;
+	  grub_free (value);
+	  return 0;
 	}
+    }
 
-      grub_free (old);
-      return GRUB_ERR_NONE;
+  if (outer)
+    {
+      var->read_hook = outer->read_hook;
+      var->write_hook = outer->write_hook;
+      var->global = 1;
+    }
+  else
+    {
+      var->read_hook = 0;
+      var->write_hook = 0;
+      var->global = 0;
     }
 
-  /* The variable does not exist, so create a new one.  */
-  var = grub_zalloc (sizeof (*var));
+  return var;
+}
+
+grub_err_t
+grub_env_set (const char *name, const char *val)
+{
+  struct grub_env_var *var;
+  char *old;
+
+  /* If the variable does already exist, just update the variable.  */
+  var = grub_env_get_local (name);
   if (! var)
     return grub_errno;
 
-  var->name = grub_strdup (name);
-  if (! var->name)
-    goto fail;
+  old = var->value;
 
-  var->value = grub_strdup (val);
-  if (! var->value)
-    goto fail;
+  if (var->write_hook)
+    var->value = var->write_hook (var, val);
+  else
+    var->value = grub_strdup (val);
 
-  grub_env_insert (grub_current_context, var);
+  if (! var->value)
+    {
+      var->value = old;
+      return grub_errno;
+    }
 
+  grub_free (old);
   return GRUB_ERR_NONE;
-
- fail:
-  grub_free (var->name);
-  grub_free (var->value);
-  grub_free (var);
-
-  return grub_errno;
 }
 
 const char *
@@ -161,8 +334,9 @@ void
 grub_env_unset (const char *name)
 {
   struct grub_env_var *var;
+  int local;
 
-  var = grub_env_find (name);
+  var = grub_env_find_visible (name, &local);
   if (! var)
     return;
 
@@ -172,38 +346,71 @@ grub_env_unset (const char *name)
       return;
     }
 
-  grub_env_remove (var);
-
-  grub_free (var->name);
-  grub_free (var->value);
-  grub_free (var);
+  /* An outer variable of the same name is hidden by an unset one, which
+     has no value.  */
+  if (! grub_env_find_outer (name, grub_env_hashval (name)))
+    {
+      grub_env_remove (grub_current_context, var);
+      grub_env_free_var (var);
+    }
+  else if (local)
+    {
+      grub_free (var->value);
+      var->value = 0;
+      var->global = 0;
+    }
+  else if (! grub_env_add (name, 0))
+    grub_errno = GRUB_ERR_NONE;
 }
 
-struct grub_env_var *
-grub_env_update_get_sorted (void)
+/* Merge the sorted lists A and B.  */
+static struct grub_env_var *
+grub_env_merge_sorted (struct grub_env_var *a, struct grub_env_var *b)
 {
-  struct grub_env_var *sorted_list = 0;
-  int i;
+  struct grub_env_var *list = 0, **last = &list;
 
-  /* Add variables associated with this context into a sorted list.  */
-  for (i = 0; i < HASHSZ; i++)
+  while (a && b)
     {
-      struct grub_env_var *var;
+      struct grub_env_var **p = grub_strcmp (a->name, b->name) <= 0 ? &a : &b;
 
-      for (var = grub_current_context->vars[i]; var; var = var->next)
-	{
-	  struct grub_env_var *p, **q;
+      *last = *p;
+      last = &(*p)->sorted_next;
+      *p = (*p)->sorted_next;
+    }
+  *last = a ? : b;
 
-	  for (q = &sorted_list, p = *q; p; q = &((*q)->sorted_next), p = *q)
-	    {
-	      if (grub_strcmp (p->name, var->name) > 0)
-		break;
-	    }
+  return list;
+}
 
-	  var->sorted_next = *q;
-	  *q = var;
-	}
-    }
+struct grub_env_var *
+grub_env_update_get_sorted (void)
+{
+  /* Runs of 2^i variables sorted so far.  */
+  struct grub_env_var *runs[sizeof (grub_size_t) * GRUB_CHAR_BIT] = { 0 };
+  struct grub_env_var *sorted_list = 0, *var;
+  struct grub_env_context *context;
+  grub_size_t i;
+  unsigned j;
+
+  /* Add the variables seen in this context into a sorted list.  */
+  for (context = grub_current_context; context; context = context->prev)
+    for (i = 0; i < context->size; i++)
+      {
+	var = context->vars[i];
+	if (! var || var == &deleted_slot || grub_env_find (var->name) != var)
+	  continue;
+
+	var->sorted_next = 0;
+	for (j = 0; runs[j]; j++)
+	  {
+	    var = grub_env_merge_sorted (runs[j], var);
+	    runs[j] = 0;
+	  }
+	runs[j] = var;
+      }
+
+  for (j = 0; j < ARRAY_SIZE (runs); j++)
+    sorted_list = grub_env_merge_sorted (runs[j], sorted_list);
 
   return sorted_list;
 }
@@ -213,16 +420,10 @@ grub_register_variable_hook (const char *name,
 			     grub_env_read_hook_t read_hook,
 			     grub_env_write_hook_t write_hook)
 {
-  struct grub_env_var *var = grub_env_find (name);
+  struct grub_env_var *var = grub_env_get_local (name);
 
   if (! var)
-    {
-      if (grub_env_set (name, "") != GRUB_ERR_NONE)
-	return grub_errno;
-
-      var = grub_env_find (name);
-      /* XXX Insert an assertion?  */
-    }
+    return grub_errno;
 
   var->read_hook = read_hook;
   var->write_hook = write_hook;
@@ -234,18 +435,31 @@ grub_err_t
 grub_env_export (const char *name)
 {
   struct grub_env_var *var;
+  int local;
 
-  var = grub_env_find (name);
-  if (! var)
-    {
-      grub_err_t err;
+  /* Outer variables seen here are seen by inner contexts as well.  */
+  var = grub_env_find_visible (name, &local);
+  if (var && ! local)
+    return GRUB_ERR_NONE;
 
-      err = grub_env_set (name, "");
-      if (err)
-	return err;
-      var = grub_env_find (name);
-    }
+  var = grub_env_get_local (name);
+  if (! var)
+    return grub_errno;
   var->global = 1;
 
   return GRUB_ERR_NONE;
 }
+
+/* Free the variables of CONTEXT.  */
+void
+grub_env_context_free_vars (struct grub_env_context *context)
+{
+  grub_size_t i;
+
+  for (i = 0; i < context->size; i++)
+    if (context->vars[i] && context->vars[i] != &deleted_slot)
+      grub_env_free_var (context->vars[i]);
+  grub_free (context->vars);
+  context->vars = 0;
+  context->size = context->count = context->used = 0;
+}
@@ -25,6 +25,7 @@
 #include <grub/fs.h>
 #include <grub/device.h>
 #include <grub/i18n.h>
+#include <grub/trace.h>
 
 void (*EXPORT_VAR (grub_grubnet_fini)) (void);
 
@@ -65,6 +66,8 @@ grub_file_open (const char *name, enum grub_file_type type)
   char *device_name;
   const char *file_name;
   grub_file_filter_id_t filter;
+  grub_file_filter_t transfer_decode;
+  grub_uint64_t start = grub_trace_now ();
 
   /* Reset grub_errno before we start. */
   grub_errno = GRUB_ERR_NONE;
@@ -117,21 +120,52 @@ grub_file_open (const char *name, enum grub_file_type type)
   file->name = grub_strdup (name);
   grub_errno = GRUB_ERR_NONE;
 
+  transfer_decode = file->transfer_decode;
+  if (transfer_decode && (type & GRUB_FILE_TYPE_NO_DECOMPRESS))
+    {
+      grub_error (GRUB_ERR_BAD_FILE_TYPE,
+		  N_("`%s' was sent compressed"), name);
+      grub_file_close (file);
+      return NULL;
+    }
+
   for (filter = 0; file && filter < ARRAY_SIZE (grub_file_filters);
        filter++)
-    if (grub_file_filters[filter])
-      {
-	last_file = file;
-	file = grub_file_filters[filter] (file, type);
-	if (file && file != last_file)
-	  {
-	    file->name = grub_strdup (name);
-	    grub_errno = GRUB_ERR_NONE;
-	  }
-      }
+    {
+      /* Compression for transfer is undone once the verifiers have seen
+	 the bytes that were sent, so that the decompressors see the file
+	 itself.  */
+      if (filter == GRUB_FILE_FILTER_COMPRESSION_FIRST && transfer_decode)
+	{
+	  last_file = file;
+	  file = transfer_decode (file, type);
+	  if (file == last_file)
+	    {
+	      grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+			  N_("couldn't decode `%s'"), name);
+	      file = NULL;
+	    }
+	  if (!file)
+	    break;
+	  file->name = grub_strdup (name);
+	  grub_errno = GRUB_ERR_NONE;
+	}
+      if (grub_file_filters[filter])
+	{
+	  last_file = file;
+	  file = grub_file_filters[filter] (file, type);
+	  if (file && file != last_file)
+	    {
+	      file->name = grub_strdup (name);
+	      grub_errno = GRUB_ERR_NONE;
+	    }
+	}
+    }
   if (!file)
     grub_file_close (last_file);
 
+  grub_trace_record (GRUB_TRACE_OPEN, file ? file->fs->name : NULL, name,
+		     start, 0);
   return file;
 
  fail:
@@ -154,6 +188,7 @@ grub_file_read (grub_file_t file, void *buf, grub_size_t len)
   grub_ssize_t res;
   grub_disk_read_hook_t read_hook;
   void *read_hook_data;
+  grub_uint64_t start;
 
   if (file->offset > file->size)
     {
@@ -182,7 +217,12 @@ grub_file_read (grub_file_t file, void *buf, grub_size_t len)
       file->read_hook_data = file;
       file->progress_offset = file->offset;
     }
+  /* Filters such as the decompressors are file systems over the file they
+     read, so their time shows as a read of their own.  */
+  start = grub_trace_now ();
   res = (file->fs->fs_read) (file, buf, len);
+  grub_trace_record (GRUB_TRACE_READ, file->fs->name, file->name, start,
+		     res > 0 ? res : 0);
   file->read_hook = read_hook;
   file->read_hook_data = read_hook_data;
   if (res > 0)
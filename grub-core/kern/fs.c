@@ -18,6 +18,7 @@
  */
 
 #include <grub/disk.h>
+#include <grub/partition.h>
 #include <grub/net.h>
 #include <grub/fs.h>
 #include <grub/file.h>
@@ -41,6 +42,140 @@ probe_dummy_iter (const char *filename __attribute__ ((unused)),
   return 1;
 }
 
+/* What recently probed disks were found to carry.  Probing tries every
+   filesystem in turn, and search, ls and completion probe the same
+   devices again and again.  */
+#define FS_PROBE_CACHE_SIZE	32
+
+/* Most filesystems have their superblock within this many bytes from the
+   start, read at once before probing so that the disk cache answers the
+   reads of all the filesystems tried.  */
+#define FS_PROBE_PREFETCH	(64 * 1024)
+
+struct fs_probe_cache_entry
+{
+  enum grub_disk_dev_id dev_id;
+  unsigned long disk_id;
+  grub_disk_addr_t part_start;
+  grub_uint64_t part_len;
+  unsigned long generation;
+  grub_uint64_t last_use;
+  int used;
+
+  /* NULL if no filesystem was recognized.  Since another filesystem may be
+     registered afterwards, that only holds while the list is the same, and
+     if autoloading was tried or cannot be now.  */
+  grub_fs_t fs;
+  grub_fs_t list_head;
+  unsigned list_len;
+  int autoload;
+};
+
+static struct fs_probe_cache_entry fs_probe_cache[FS_PROBE_CACHE_SIZE];
+static grub_uint64_t fs_probe_clock;
+
+static unsigned
+fs_list_len (void)
+{
+  grub_fs_t p;
+  unsigned n = 0;
+
+  for (p = grub_fs_list; p; p = p->next)
+    n++;
+  return n;
+}
+
+static int
+fs_probe_cache_match (const struct fs_probe_cache_entry *e, grub_disk_t disk)
+{
+  return (e->used
+	  && e->generation == grub_disk_generation
+	  && e->dev_id == disk->dev->id
+	  && e->disk_id == disk->id
+	  && e->part_start == grub_partition_get_start (disk->partition)
+	  && e->part_len == grub_disk_native_sectors (disk));
+}
+
+static struct fs_probe_cache_entry *
+fs_probe_cache_find (grub_disk_t disk)
+{
+  struct fs_probe_cache_entry *e;
+  grub_fs_t p;
+
+  for (e = fs_probe_cache; e < fs_probe_cache + FS_PROBE_CACHE_SIZE; e++)
+    if (fs_probe_cache_match (e, disk))
+      break;
+  if (e == fs_probe_cache + FS_PROBE_CACHE_SIZE)
+    return NULL;
+
+  if (e->fs)
+    {
+      /* The module may have been unloaded.  */
+      for (p = grub_fs_list; p; p = p->next)
+	if (p == e->fs)
+	  break;
+      if (! p)
+	e->used = 0;
+    }
+  else if (e->list_head != grub_fs_list || e->list_len != fs_list_len ()
+	   || (! e->autoload && grub_fs_autoload_hook))
+    e->used = 0;
+  if (! e->used)
+    return NULL;
+
+  e->last_use = ++fs_probe_clock;
+  return e;
+}
+
+static grub_fs_t
+fs_probe_cache_add (grub_disk_t disk, grub_fs_t fs, int autoload)
+{
+  struct fs_probe_cache_entry *e, *lru = NULL;
+
+  for (e = fs_probe_cache; e < fs_probe_cache + FS_PROBE_CACHE_SIZE; e++)
+    {
+      if (fs_probe_cache_match (e, disk))
+	{
+	  lru = e;
+	  break;
+	}
+      if (! lru || ! e->used || (lru->used && e->last_use < lru->last_use))
+	lru = e;
+    }
+
+  lru->dev_id = disk->dev->id;
+  lru->disk_id = disk->id;
+  lru->part_start = grub_partition_get_start (disk->partition);
+  lru->part_len = grub_disk_native_sectors (disk);
+  lru->generation = grub_disk_generation;
+  lru->last_use = ++fs_probe_clock;
+  lru->used = 1;
+  lru->fs = fs;
+  lru->list_head = grub_fs_list;
+  lru->list_len = fs_list_len ();
+  lru->autoload = autoload;
+  return fs;
+}
+
+static void
+fs_probe_prefetch (grub_disk_t disk)
+{
+  grub_uint64_t sectors = grub_disk_native_sectors (disk);
+  grub_size_t size = FS_PROBE_PREFETCH;
+  void *buf;
+
+  if (sectors < (FS_PROBE_PREFETCH >> GRUB_DISK_SECTOR_BITS))
+    size = sectors << GRUB_DISK_SECTOR_BITS;
+  if (! size)
+    return;
+
+  buf = grub_malloc (size);
+  if (buf)
+    grub_disk_read (disk, 0, 0, size, buf);
+  grub_free (buf);
+  grub_errno = GRUB_ERR_NONE;
+}
+
 grub_fs_t
 grub_fs_probe (grub_device_t device)
 {
@@ -50,6 +185,22 @@ grub_fs_probe (grub_device_t device)
     {
       /* Make it sure not to have an infinite recursive calls.  */
       static int count = 0;
+      struct fs_probe_cache_entry *cached;
+      int autoload = 0;
+
+      cached = fs_probe_cache_find (device->disk);
+      if (cached && cached->fs)
+	{
+	  grub_dprintf ("fs", "%s found before\n", cached->fs->name);
+	  return cached->fs;
+	}
+      if (cached)
+	{
+	  grub_error (GRUB_ERR_UNKNOWN_FS, N_("unknown filesystem"));
+	  return 0;
+	}
+
+      fs_probe_prefetch (device->disk);
 
       for (p = grub_fs_list; p; p = p->next)
 	{
@@ -72,7 +223,7 @@ grub_fs_probe (grub_device_t device)
 #endif
 	    (p->fs_dir) (device, "/", probe_dummy_iter, NULL);
 	  if (grub_errno == GRUB_ERR_NONE)
-	    return p;
+	    return fs_probe_cache_add (device->disk, p, 0);
 
 	  grub_error_push ();
 	  /* The grub_error_push() does not touch grub_errmsg. */
@@ -91,6 +242,7 @@ grub_fs_probe (grub_device_t device)
       if (grub_fs_autoload_hook && count == 0)
 	{
 	  count++;
+	  autoload = 1;
 
 	  while (grub_fs_autoload_hook ())
 	    {
@@ -100,7 +252,7 @@ grub_fs_probe (grub_device_t device)
 	      if (grub_errno == GRUB_ERR_NONE)
 		{
 		  count--;
-		  return p;
+		  return fs_probe_cache_add (device->disk, p, 1);
 		}
 
 	      if (grub_errno != GRUB_ERR_BAD_FS
@@ -115,6 +267,10 @@ grub_fs_probe (grub_device_t device)
 
 	  count--;
 	}
+
+      /* Autoloading is not tried while it is already going on.  */
+      if (count == 0)
+	fs_probe_cache_add (device->disk, NULL, autoload);
     }
   else if (device->net && device->net->fs)
     return device->net->fs;
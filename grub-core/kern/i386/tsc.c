@@ -24,6 +24,7 @@
 #include <grub/misc.h>
 #include <grub/i386/tsc.h>
 #include <grub/i386/cpuid.h>
+#include <grub/trace.h>
 
 /* This defines the value TSC had at the epoch (that is, when we calibrated it). */
 static grub_uint64_t tsc_boot_time;
@@ -43,6 +44,18 @@ grub_tsc_get_time_ms (void)
   return ((al * grub_tsc_rate) >> 32) + ah * grub_tsc_rate;
 }
 
+/* The trace clock only needs the order of the events kept, not the
+   serializing CPUID of grub_get_tsc.  */
+static grub_uint64_t
+grub_tsc_trace_clock (void)
+{
+  grub_uint32_t lo, hi;
+
+  asm volatile ("rdtsc":"=a" (lo), "=d" (hi));
+
+  return ((((grub_uint64_t) hi) << 32) | lo) - tsc_boot_time;
+}
+
 static int
 calibrate_tsc_hardcode (void)
 {
@@ -75,4 +88,5 @@ grub_tsc_init (void)
   (void) (grub_tsc_calibrate_from_pit () || calibrate_tsc_hardcode());
 #endif
   grub_install_get_time_ms (grub_tsc_get_time_ms);
+  grub_trace_set_clock (grub_tsc_trace_clock, grub_tsc_rate * 1000);
 }
@@ -27,6 +27,7 @@
 #include <grub/env.h>
 #include <grub/mm.h>
 #include <grub/command.h>
+#include <grub/cpufeature.h>
 #include <grub/reader.h>
 #include <grub/parser.h>
 #include <grub/verify.h>
@@ -281,6 +282,8 @@ grub_main (void)
   /* Init verifiers API. */
   grub_verifiers_init ();
 
+  grub_cpu_dispatch_init ();
+
   grub_load_config ();
 
   grub_boot_time ("Before loading embedded modules.");
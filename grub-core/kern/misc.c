@@ -78,6 +78,28 @@ grub_gettext_dummy (const char *s)
 
 const char* (*grub_gettext) (const char *s) = grub_gettext_dummy;
 
+/* clang detects that we're implementing here a memset or a memmove so it
+   decides to optimise and calls memset or memmove resulting in infinite
+   recursion. With volatile we make it not optimise in this way.  */
+#ifdef __clang__
+#define VOLATILE_CLANG volatile
+#else
+#define VOLATILE_CLANG
+#endif
+
+#define WORD_SIZE	sizeof (unsigned long)
+#define WORD_ALIGNED(p)	((((grub_addr_t) (p)) & (WORD_SIZE - 1)) == 0)
+
+#if defined (__x86_64__)
+#define REP_MOVS_WORD	"rep movsq"
+#define REP_STOS_WORD	"rep stosq"
+#elif defined (__i386__)
+#define REP_MOVS_WORD	"rep movsl"
+#define REP_STOS_WORD	"rep stosl"
+#endif
+/* Below this size the plain loops are faster than the string instructions.  */
+#define REP_MIN		64
+
 void *
 grub_memmove (void *dest, const void *src, grub_size_t n)
 {
@@ -85,13 +107,61 @@ grub_memmove (void *dest, const void *src, grub_size_t n)
   const char *s = (const char *) src;
 
   if (d < s)
-    while (n--)
-      *d++ = *s++;
+    {
+#ifdef REP_MOVS_WORD
+      /*
+       * The string instructions copy in ascending order, which is also right
+       * when DEST overlaps SRC from below.  They need no SIMD state, so they
+       * can be used anywhere GRUB runs, but take a while to start up.
+       */
+      if (n >= REP_MIN)
+	{
+	  grub_size_t words = n / WORD_SIZE;
+
+	  n %= WORD_SIZE;
+	  asm volatile (REP_MOVS_WORD
+			: "+D" (d), "+S" (s), "+c" (words) : : "memory");
+	  asm volatile ("rep movsb"
+			: "+D" (d), "+S" (s), "+c" (n) : : "memory");
+	  return dest;
+	}
+#endif
+      if (n >= 2 * WORD_SIZE && WORD_ALIGNED ((grub_addr_t) d ^ (grub_addr_t) s))
+	{
+	  while (!WORD_ALIGNED (d))
+	    {
+	      *d++ = *s++;
+	      n--;
+	    }
+	  for (; n >= WORD_SIZE; n -= WORD_SIZE)
+	    {
+	      *(VOLATILE_CLANG unsigned long *) d = *(const unsigned long *) s;
+	      d += WORD_SIZE;
+	      s += WORD_SIZE;
+	    }
+	}
+      while (n--)
+	*d++ = *s++;
+    }
   else
     {
       d += n;
       s += n;
 
+      if (n >= 2 * WORD_SIZE && WORD_ALIGNED ((grub_addr_t) d ^ (grub_addr_t) s))
+	{
+	  while (!WORD_ALIGNED (d))
+	    {
+	      *--d = *--s;
+	      n--;
+	    }
+	  for (; n >= WORD_SIZE; n -= WORD_SIZE)
+	    {
+	      d -= WORD_SIZE;
+	      s -= WORD_SIZE;
+	      *(VOLATILE_CLANG unsigned long *) d = *(const unsigned long *) s;
+	    }
+	}
       while (n--)
 	*--d = *--s;
     }
@@ -291,6 +361,18 @@ grub_memcmp (const void *s1, const void *s2, grub_size_t n)
   const grub_uint8_t *t1 = s1;
   const grub_uint8_t *t2 = s2;
 
+  /* Skip the equal words, the bytes then tell which one differs.  */
+  if (n >= 2 * WORD_SIZE
+      && WORD_ALIGNED ((grub_addr_t) t1 ^ (grub_addr_t) t2))
+    {
+      for (; !WORD_ALIGNED (t1); n--, t1++, t2++)
+	if (*t1 != *t2)
+	  return (int) *t1 - (int) *t2;
+      for (; n >= WORD_SIZE; n -= WORD_SIZE, t1 += WORD_SIZE, t2 += WORD_SIZE)
+	if (*(const unsigned long *) t1 != *(const unsigned long *) t2)
+	  break;
+    }
+
   while (n--)
     {
       if (*t1 != *t2)
@@ -536,21 +618,26 @@ grub_strndup (const char *s, grub_size_t n)
   return p;
 }
 
-/* clang detects that we're implementing here a memset so it decides to
-   optimise and calls memset resulting in infinite recursion. With volatile
-   we make it not optimise in this way.  */
-#ifdef __clang__
-#define VOLATILE_CLANG volatile
-#else
-#define VOLATILE_CLANG
-#endif
-
 void *
 grub_memset (void *s, int c, grub_size_t len)
 {
   void *p = s;
   grub_uint8_t pattern8 = c;
 
+#ifdef REP_STOS_WORD
+  if (len >= REP_MIN)
+    {
+      unsigned long patternl = pattern8 * (~0UL / 0xff);
+      grub_size_t words = len / WORD_SIZE;
+
+      asm volatile (REP_STOS_WORD
+		    : "+D" (p), "+c" (words)
+		    : "a" (patternl)
+		    : "memory");
+      len %= WORD_SIZE;
+    }
+  else
+#endif
   if (len >= 3 * sizeof (unsigned long))
     {
       unsigned long patternl = 0;
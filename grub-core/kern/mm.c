@@ -51,14 +51,38 @@
   cell.
 
   Free blocks constitutes a ring, using a singly linked list. The first free
-  block is pointed to by the meta information of a region. The allocator
-  attempts to pick up the second block instead of the first one. This is
-  a typical optimization against defragmentation, and makes the
-  implementation a bit easier.
+  block is pointed to by the meta information of a region, and grub_free
+  moves it to the block before the one it freed. Going along the ring, the
+  addresses decrease, except for the single step from the lowest free
+  block back to the highest one. Splitting a block keeps that order, as
+  its pieces are linked from high to low in its place, and a freed block
+  is inserted between the free blocks around it, so that it can be merged
+  with those adjacent to it.
+
+  The free blocks of a region are also indexed by size, to find the
+  smallest one an allocation fits in without walking the ring: the cell
+  after the header of a free block holds its node in a treap ordered by
+  size and address, and the free block before it in the ring. Blocks of
+  a single cell have no room for a node and stay out of the index. The
+  index is built when a region is first allocated from, and built again
+  after the relocator has changed the rings by itself.
 
   For safety, both allocated blocks and free ones are marked by magic
   numbers. Whenever anything unexpected is detected, GRUB aborts the
   operation.
+
+  Small allocations without special alignment are served from slabs in
+  front of all this. A slab is a GRUB_MM_SLAB_SIZE block, aligned to its
+  size and allocated as above, cut into objects of one size class. The
+  objects have no header: the slab header at the start of the block keeps
+  a bitmap of the objects in use and a list of the free ones. Freeing a
+  pointer finds its slab by aligning the pointer down and looking the
+  result up in a hash set of the slabs, so that the contents of an
+  ordinary block can never be taken for a slab header.
+
+  Large allocations get pages of their own from the firmware if it lends
+  them, so that they neither grow the regions nor fragment them. They are
+  kept in a list, which grub_free searches for pointers of no slab.
  */
 
 #include <config.h>
@@ -66,7 +90,6 @@
 #include <grub/misc.h>
 #include <grub/err.h>
 #include <grub/types.h>
-#include <grub/disk.h>
 #include <grub/dl.h>
 #include <grub/i18n.h>
 #include <grub/mm_private.h>
@@ -126,8 +149,26 @@
 /* Minimal heap growth granularity when existing heap space is exhausted. */
 #define GRUB_MM_HEAP_GROW_EXTRA	0x100000
 
+/*
+ * Allocations of at least this many bytes are served from pages of the
+ * firmware, which are aligned to GRUB_MM_PAGE_ALIGN.
+ */
+#define GRUB_MM_LARGE_SIZE	0x100000
+#define GRUB_MM_PAGE_ALIGN	4096
+
 grub_mm_region_t grub_mm_base;
 grub_mm_add_region_func_t grub_mm_add_region_fn;
+grub_mm_alloc_pages_func_t grub_mm_alloc_pages_fn;
+grub_mm_free_pages_func_t grub_mm_free_pages_fn;
+
+struct grub_mm_large
+{
+  struct grub_mm_large *next;
+  void *addr;
+  grub_size_t size;
+};
+
+static struct grub_mm_large *large_allocs;
 
 /* Get a header from the pointer PTR, and set *P and *R to a pointer
    to the header and a pointer to its region, respectively. PTR must
@@ -293,6 +334,8 @@ grub_mm_init_region (void *addr, grub_size_t size)
   h->size = (size >> GRUB_MM_ALIGN_LOG2);
 
   r->first = h;
+  r->index = NULL;
+  r->indexed = 0;
   r->pre_size = (grub_addr_t) r - (grub_addr_t) addr;
   r->size = (h->size << GRUB_MM_ALIGN_LOG2);
   r->post_size = size - r->size;
@@ -307,154 +350,725 @@ grub_mm_init_region (void *addr, grub_size_t size)
   r->next = q;
 }
 
-/* Allocate the number of units N with the alignment ALIGN from the ring
- * buffer given in *FIRST.  ALIGN must be a power of two. Both N and
- * ALIGN are in units of GRUB_MM_ALIGN.  Return a non-NULL if successful,
- * otherwise return NULL.
- *
- * Note: because in certain circumstances we need to adjust the ->next
- * pointer of the previous block, we iterate over the singly linked
- * list with the pair (prev, cur). *FIRST is our initial previous, and
- * *FIRST->next is our initial current pointer. So we will actually
- * allocate from *FIRST->next first and *FIRST itself last.
+/* The node of a free block in the size index.  */
+struct grub_mm_node
+{
+  grub_mm_header_t left;
+  grub_mm_header_t right;
+  grub_mm_header_t parent;
+  /* The free block whose next is this one.  */
+  grub_mm_header_t prev;
+};
+
+#define NODE(h)	((struct grub_mm_node *) ((h) + 1))
+
+/* The treap priority of a free block, a hash of its address.  */
+static grub_uint32_t
+index_priority (grub_mm_header_t h)
+{
+  grub_uint32_t x = (grub_addr_t) h >> GRUB_MM_ALIGN_LOG2;
+
+  x ^= x >> 16;
+  x *= 0x45d9f3b;
+  x ^= x >> 16;
+  return x;
+}
+
+static int
+index_less (grub_mm_header_t a, grub_mm_header_t b)
+{
+  return a->size < b->size || (a->size == b->size && a < b);
+}
+
+static void
+index_replace_child (grub_mm_region_t r, grub_mm_header_t parent,
+		     grub_mm_header_t old, grub_mm_header_t new)
+{
+  if (!parent)
+    r->index = new;
+  else if (NODE (parent)->left == old)
+    NODE (parent)->left = new;
+  else
+    NODE (parent)->right = new;
+}
+
+/* Rotate H above its parent.  */
+static void
+index_rotate_up (grub_mm_region_t r, grub_mm_header_t h)
+{
+  struct grub_mm_node *node = NODE (h);
+  grub_mm_header_t parent = node->parent;
+  struct grub_mm_node *pnode = NODE (parent);
+
+  if (pnode->left == h)
+    {
+      pnode->left = node->right;
+      if (node->right)
+	NODE (node->right)->parent = parent;
+      node->right = parent;
+    }
+  else
+    {
+      pnode->right = node->left;
+      if (node->left)
+	NODE (node->left)->parent = parent;
+      node->left = parent;
+    }
+  node->parent = pnode->parent;
+  pnode->parent = h;
+  index_replace_child (r, node->parent, parent, h);
+}
+
+static void
+index_insert (grub_mm_region_t r, grub_mm_header_t h)
+{
+  grub_mm_header_t *link = &r->index, parent = NULL;
+
+  while (*link)
+    {
+      parent = *link;
+      link = index_less (h, parent) ? &NODE (parent)->left
+				    : &NODE (parent)->right;
+    }
+  NODE (h)->left = NODE (h)->right = NULL;
+  NODE (h)->parent = parent;
+  *link = h;
+
+  while (NODE (h)->parent
+	 && index_priority (NODE (h)->parent) < index_priority (h))
+    index_rotate_up (r, h);
+}
+
+static void
+index_remove (grub_mm_region_t r, grub_mm_header_t h)
+{
+  struct grub_mm_node *node = NODE (h);
+  grub_mm_header_t child;
+
+  while (node->left && node->right)
+    index_rotate_up (r, index_priority (node->left)
+			> index_priority (node->right)
+			? node->left : node->right);
+
+  child = node->left ? node->left : node->right;
+  if (child)
+    NODE (child)->parent = node->parent;
+  index_replace_child (r, node->parent, h, child);
+}
+
+/*
+ * The free blocks of more than one cell are in the index while their
+ * region is indexed.  Changes of the size of a free block go between
+ * index_del and index_add.
+ */
+static void
+index_add (grub_mm_region_t r, grub_mm_header_t h)
+{
+  if (r->indexed && h->size > 1)
+    index_insert (r, h);
+}
+
+static void
+index_del (grub_mm_region_t r, grub_mm_header_t h)
+{
+  if (r->indexed && h->size > 1)
+    index_remove (r, h);
+}
+
+/* Link the free block NEXT after PREV in the free ring of R.  */
+static void
+ring_link (grub_mm_region_t r, grub_mm_header_t prev, grub_mm_header_t next)
+{
+  prev->next = next;
+  if (r->indexed && next->size > 1)
+    NODE (next)->prev = prev;
+}
+
+static void
+index_build (grub_mm_region_t r)
+{
+  grub_mm_header_t p = r->first;
+
+  COMPILE_TIME_ASSERT (sizeof (struct grub_mm_node) <= GRUB_MM_ALIGN);
+
+  r->index = NULL;
+  r->indexed = 1;
+
+  if (p->magic == GRUB_MM_ALLOC_MAGIC)
+    return;
+
+  do
+    {
+      if (p->magic != GRUB_MM_FREE_MAGIC)
+	grub_fatal ("free magic is broken at %p: 0x%x", p, p->magic);
+      ring_link (r, p, p->next);
+      index_add (r, p->next);
+      p = p->next;
+    }
+  while (p != r->first);
+}
+
+void
+grub_mm_drop_index (void)
+{
+  grub_mm_region_t r;
+
+  for (r = grub_mm_base; r; r = r->next)
+    r->indexed = 0;
+}
+
+/* The smallest free block of at least N cells in the index of R.  */
+static grub_mm_header_t
+index_lower_bound (grub_mm_region_t r, grub_size_t n)
+{
+  grub_mm_header_t p = r->index, best = NULL;
+
+  while (p)
+    if (p->size >= n)
+      {
+	best = p;
+	p = NODE (p)->left;
+      }
+    else
+      p = NODE (p)->right;
+
+  return best;
+}
+
+static grub_mm_header_t
+index_next (grub_mm_header_t h)
+{
+  grub_mm_header_t parent;
+
+  if (NODE (h)->right)
+    {
+      for (h = NODE (h)->right; NODE (h)->left; h = NODE (h)->left);
+      return h;
+    }
+
+  for (parent = NODE (h)->parent; parent && NODE (parent)->right == h;
+       h = parent, parent = NODE (parent)->parent);
+  return parent;
+}
+
+/* The number of cells to skip at the start of the free block CUR for the
+   cell after its header to be aligned to ALIGN cells.  */
+static grub_size_t
+align_extra (grub_mm_header_t cur, grub_size_t align)
+{
+  grub_size_t extra;
+
+  extra = ((grub_addr_t) (cur + 1) >> GRUB_MM_ALIGN_LOG2) & (align - 1);
+  if (extra)
+    extra = align - extra;
+  return extra;
+}
+
+/*
+ * Aligned allocations try this many of the smallest blocks that are large
+ * enough before taking the smallest one they are bound to fit in.
+ */
+#define GRUB_MM_INDEX_ALIGN_PROBES	16
+
+/* Find the smallest free block of R that N cells with the alignment ALIGN
+   fit in.  */
+static grub_mm_header_t
+index_find (grub_mm_region_t r, grub_size_t n, grub_size_t align)
+{
+  grub_mm_header_t cur;
+  int i;
+
+  cur = index_lower_bound (r, n);
+  for (i = 0; cur && cur->size < n + align_extra (cur, align); i++)
+    {
+      if (i == GRUB_MM_INDEX_ALIGN_PROBES)
+	{
+	  if (align - 1 > ~n)
+	    return NULL;
+	  return index_lower_bound (r, n + align - 1);
+	}
+      cur = index_next (cur);
+    }
+
+  return cur;
+}
+
+/* Allocate the number of units N with the alignment ALIGN from the
+ * region R.  ALIGN must be a power of two. Both N and ALIGN are in units
+ * of GRUB_MM_ALIGN.  Return a non-NULL if successful, otherwise return
+ * NULL.
  */
 static void *
-grub_real_malloc (grub_mm_header_t *first, grub_size_t n, grub_size_t align)
+grub_real_malloc (grub_mm_region_t r, grub_size_t n, grub_size_t align)
 {
-  grub_mm_header_t cur, prev;
+  grub_mm_header_t cur, prev, block;
+  grub_size_t extra;
+
+  /* When everything is allocated side effect is that r->first will have
+     alloc magic marked, meaning that there is no room in this region.  */
+  if (r->first->magic == GRUB_MM_ALLOC_MAGIC)
+    return 0;
+
+  if (!r->indexed)
+    index_build (r);
 
-  /* When everything is allocated side effect is that *first will have alloc
-     magic marked, meaning that there is no room in this region.  */
-  if ((*first)->magic == GRUB_MM_ALLOC_MAGIC)
+  cur = index_find (r, n, align);
+  if (!cur)
     return 0;
 
-  /* Try to search free slot for allocation in this memory region.  */
-  for (prev = *first, cur = prev->next; ; prev = cur, cur = cur->next)
+  if (cur->magic != GRUB_MM_FREE_MAGIC)
+    grub_fatal ("free magic is broken at %p: 0x%x", cur, cur->magic);
+
+  prev = NODE (cur)->prev;
+  if (prev->next != cur)
+    grub_fatal ("free ring is broken at %p", cur);
+
+  index_del (r, cur);
+
+  extra = align_extra (cur, align);
+  extra += (cur->size - extra - n) & (~(align - 1));
+  if (extra == 0 && cur->size == n)
     {
-      grub_off_t extra;
+      /* There is no special alignment requirement and memory block
+	 is complete match.
 
-      extra = ((grub_addr_t) (cur + 1) >> GRUB_MM_ALIGN_LOG2) & (align - 1);
-      if (extra)
-	extra = align - extra;
+	 1. Just mark memory block as allocated and remove it from
+	    free list.
 
-      if (! cur)
-	grub_fatal ("null in the ring");
+	 Result:
+	 +---------------+ previous block's next
+	 | alloc, size=n |          |
+	 +---------------+          v
+       */
+      if (prev != cur)
+	ring_link (r, prev, cur->next);
+      block = cur;
+    }
+  else if (align == 1 || cur->size == n + extra)
+    {
+      /* There might be alignment requirement, when taking it into
+	 account memory block fits in.
+
+	 1. Allocate new area at end of memory block.
+	 2. Reduce size of available blocks from original node.
+	 3. Mark new area as allocated and "remove" it from free
+	    list.
+
+	 Result:
+	 +---------------+
+	 | free, size-=n | next --+
+	 +---------------+        |
+	 | alloc, size=n |        |
+	 +---------------+        v
+       */
+      cur->size -= n;
+      block = cur + cur->size;
+      index_add (r, cur);
+      prev = cur;
+    }
+  else if (extra == 0)
+    {
+      /* There is alignment requirement and the start of the memory
+	 block is aligned.
+
+	 1. Allocate new area at start of memory block.
+	 2. Put the rest of the block in its place in the free list.
+
+	 Result:
+	 +---------------+
+	 | alloc, size=n |
+	 +---------------+
+	 | free, size-=n | next --+
+	 +---------------+        v
+       */
+      grub_mm_header_t f, next;
+
+      f = cur + n;
+      f->magic = GRUB_MM_FREE_MAGIC;
+      f->size = cur->size - n;
+      next = cur->next;
+
+      if (prev == cur)
+	prev = next = f;
+      ring_link (r, prev, f);
+      ring_link (r, f, next);
+      index_add (r, f);
+      block = cur;
+    }
+  else
+    {
+      /* There is alignment requirement and there is room in memory
+	 block.  Split memory block to three pieces.
+
+	 1. Create new memory block right after section being
+	    allocated.  Mark it as free.
+	 2. Add new memory block to free chain.
+	 3. Mark current memory block having only extra blocks.
+	 4. Advance to aligned block and mark that as allocated and
+	    "remove" it from free list.
+
+	 Result:
+	 +------------------------------+
+	 | free, size=extra             | next --+
+	 +------------------------------+        |
+	 | alloc, size=n                |        |
+	 +------------------------------+        |
+	 | free, size=orig.size-extra-n | <------+, next --+
+	 +------------------------------+                  v
+       */
+      grub_mm_header_t f;
+
+      f = cur + extra + n;
+      f->magic = GRUB_MM_FREE_MAGIC;
+      f->size = cur->size - extra - n;
+
+      cur->size = extra;
+      ring_link (r, prev, f);
+      ring_link (r, f, cur);
+      index_add (r, cur);
+      index_add (r, f);
+      block = cur + extra;
+      prev = cur;
+    }
+
+  /* Keep r->first on a free block, or on the allocated one if the ring
+     is empty now.  */
+  if (r->first == cur)
+    r->first = prev;
+
+  block->magic = GRUB_MM_ALLOC_MAGIC;
+  block->size = n;
+
+  return block + 1;
+}
 
-      if (cur->magic != GRUB_MM_FREE_MAGIC)
-	grub_fatal ("free magic is broken at %p: 0x%x", cur, cur->magic);
 
-      if (cur->size >= n + extra)
+/*
+ * Slabs.  The size classes are in cells, so every object stays aligned to
+ * GRUB_MM_ALIGN like any other allocation.  With 64-bit cells they span
+ * 32 to 2048 bytes.
+ */
+#define GRUB_MM_SLAB_SIZE	0x4000
+#define GRUB_MM_SLAB_MAGIC	0x51ab51ab
+#define GRUB_MM_SLAB_MAX_OBJECTS (GRUB_MM_SLAB_SIZE >> GRUB_MM_ALIGN_LOG2)
+
+static const grub_uint8_t slab_class_cells[] =
+  { 1, 2, 3, 4, 6, 8, 12, 16, 24, 32, 48, 64 };
+
+#define GRUB_MM_SLAB_CLASSES	ARRAY_SIZE (slab_class_cells)
+#define GRUB_MM_SLAB_MAX_CELLS	64
+
+struct grub_mm_slab
+{
+  /* The slabs of a class with free objects.  */
+  struct grub_mm_slab *next;
+  struct grub_mm_slab **prev;
+  /* The free objects, linked through their first word.  */
+  void *free;
+  grub_uint32_t magic;
+  grub_uint16_t class;
+  grub_uint16_t used;
+  grub_uint8_t bitmap[GRUB_MM_SLAB_MAX_OBJECTS / 8];
+};
+
+#define GRUB_MM_SLAB_OBJECTS_OFFSET \
+  ALIGN_UP (sizeof (struct grub_mm_slab), GRUB_MM_ALIGN)
+
+struct grub_mm_slab_class
+{
+  struct grub_mm_slab *partial;
+  /* A slab all of whose objects are free, kept to avoid trashing.  */
+  struct grub_mm_slab *empty;
+  grub_size_t size;
+  grub_size_t objects;
+  grub_size_t nslabs;
+  grub_size_t used;
+};
+
+static struct grub_mm_slab_class slab_classes[GRUB_MM_SLAB_CLASSES];
+
+/* The size class for an allocation of N cells, indexed by N - 1.  */
+static grub_uint8_t slab_class_of[GRUB_MM_SLAB_MAX_CELLS];
+
+/* Open addressing hash set of the slabs, with linear probing.  */
+static grub_addr_t *slab_set;
+static grub_size_t slab_set_size;
+static grub_size_t slab_set_count;
+
+static void *grub_memalign_real (grub_size_t align, grub_size_t size);
+static void grub_free_real (void *ptr);
+
+static grub_size_t
+slab_set_hash (grub_addr_t slab)
+{
+  return ((slab / GRUB_MM_SLAB_SIZE) * 0x9e3779b1) & (slab_set_size - 1);
+}
+
+static int
+slab_set_add (grub_addr_t slab)
+{
+  grub_size_t i;
+
+  if (2 * (slab_set_count + 1) > slab_set_size)
+    {
+      grub_addr_t *old = slab_set;
+      grub_size_t old_size = slab_set_size;
+      grub_size_t size = old_size ? 2 * old_size : 64;
+
+      slab_set = grub_memalign_real (0, size * sizeof (slab_set[0]));
+      if (!slab_set)
 	{
-	  extra += (cur->size - extra - n) & (~(align - 1));
-	  if (extra == 0 && cur->size == n)
-	    {
-	      /* There is no special alignment requirement and memory block
-	         is complete match.
-
-	         1. Just mark memory block as allocated and remove it from
-	            free list.
-
-	         Result:
-	         +---------------+ previous block's next
-	         | alloc, size=n |          |
-	         +---------------+          v
-	       */
-	      prev->next = cur->next;
-	    }
-	  else if (align == 1 || cur->size == n + extra)
-	    {
-	      /* There might be alignment requirement, when taking it into
-	         account memory block fits in.
-
-	         1. Allocate new area at end of memory block.
-	         2. Reduce size of available blocks from original node.
-	         3. Mark new area as allocated and "remove" it from free
-	            list.
-
-	         Result:
-	         +---------------+
-	         | free, size-=n | next --+
-	         +---------------+        |
-	         | alloc, size=n |        |
-	         +---------------+        v
-	       */
-	      cur->size -= n;
-	      cur += cur->size;
-	    }
-	  else if (extra == 0)
-	    {
-	      grub_mm_header_t r;
-
-	      r = cur + extra + n;
-	      r->magic = GRUB_MM_FREE_MAGIC;
-	      r->size = cur->size - extra - n;
-	      r->next = cur->next;
-	      prev->next = r;
-
-	      if (prev == cur)
-		{
-		  prev = r;
-		  r->next = r;
-		}
-	    }
-	  else
-	    {
-	      /* There is alignment requirement and there is room in memory
-	         block.  Split memory block to three pieces.
-
-	         1. Create new memory block right after section being
-	            allocated.  Mark it as free.
-	         2. Add new memory block to free chain.
-	         3. Mark current memory block having only extra blocks.
-	         4. Advance to aligned block and mark that as allocated and
-	            "remove" it from free list.
-
-	         Result:
-	         +------------------------------+
-	         | free, size=extra             | next --+
-	         +------------------------------+        |
-	         | alloc, size=n                |        |
-	         +------------------------------+        |
-	         | free, size=orig.size-extra-n | <------+, next --+
-	         +------------------------------+                  v
-	       */
-	      grub_mm_header_t r;
-
-	      r = cur + extra + n;
-	      r->magic = GRUB_MM_FREE_MAGIC;
-	      r->size = cur->size - extra - n;
-	      r->next = cur;
-
-	      cur->size = extra;
-	      prev->next = r;
-	      cur += extra;
-	    }
+	  slab_set = old;
+	  return 0;
+	}
+      grub_memset (slab_set, 0, size * sizeof (slab_set[0]));
+      slab_set_size = size;
+      for (i = 0; i < old_size; i++)
+	if (old[i])
+	  {
+	    grub_size_t j;
+
+	    for (j = slab_set_hash (old[i]); slab_set[j];
+		 j = (j + 1) & (size - 1));
+	    slab_set[j] = old[i];
+	  }
+      if (old)
+	grub_free_real (old);
+    }
+
+  for (i = slab_set_hash (slab); slab_set[i]; i = (i + 1) & (slab_set_size - 1));
+  slab_set[i] = slab;
+  slab_set_count++;
+  return 1;
+}
 
-	  cur->magic = GRUB_MM_ALLOC_MAGIC;
-	  cur->size = n;
+static struct grub_mm_slab *
+slab_set_find (void *ptr)
+{
+  grub_addr_t slab = (grub_addr_t) ptr & ~(grub_addr_t) (GRUB_MM_SLAB_SIZE - 1);
+  grub_size_t i;
 
-	  /* Mark find as a start marker for next allocation to fasten it.
-	     This will have side effect of fragmenting memory as small
-	     pieces before this will be un-used.  */
-	  /* So do it only for chunks under 32K.  */
-	  if (n < (0x8000 >> GRUB_MM_ALIGN_LOG2)
-	      || *first == cur)
-	    *first = prev;
+  if (!slab_set_count)
+    return NULL;
 
-	  return cur + 1;
+  for (i = slab_set_hash (slab); slab_set[i]; i = (i + 1) & (slab_set_size - 1))
+    if (slab_set[i] == slab)
+      return (struct grub_mm_slab *) slab;
+  return NULL;
+}
+
+static void
+slab_set_remove (grub_addr_t slab)
+{
+  grub_size_t i, j, k;
+
+  for (i = slab_set_hash (slab); slab_set[i] != slab;
+       i = (i + 1) & (slab_set_size - 1));
+
+  /* Move back the entries that probed over the removed one.  */
+  for (j = (i + 1) & (slab_set_size - 1); slab_set[j];
+       j = (j + 1) & (slab_set_size - 1))
+    {
+      k = slab_set_hash (slab_set[j]);
+      if (((j - k) & (slab_set_size - 1)) >= ((j - i) & (slab_set_size - 1)))
+	{
+	  slab_set[i] = slab_set[j];
+	  i = j;
 	}
+    }
+  slab_set[i] = 0;
+  slab_set_count--;
+}
 
-      /* Search was completed without result.  */
-      if (cur == *first)
-	break;
+static void
+slab_init_classes (void)
+{
+  grub_size_t c, n;
+
+  for (c = 0, n = 1; n <= GRUB_MM_SLAB_MAX_CELLS; n++)
+    {
+      if (n > slab_class_cells[c])
+	c++;
+      slab_class_of[n - 1] = c;
     }
 
-  return 0;
+  for (c = 0; c < GRUB_MM_SLAB_CLASSES; c++)
+    {
+      slab_classes[c].size = slab_class_cells[c] << GRUB_MM_ALIGN_LOG2;
+      slab_classes[c].objects = (GRUB_MM_SLAB_SIZE - GRUB_MM_SLAB_OBJECTS_OFFSET)
+				/ slab_classes[c].size;
+    }
 }
 
-/* Allocate SIZE bytes with the alignment ALIGN and return the pointer.  */
-void *
-grub_memalign (grub_size_t align, grub_size_t size)
+static void
+slab_link (struct grub_mm_slab_class *sc, struct grub_mm_slab *slab)
+{
+  slab->next = sc->partial;
+  slab->prev = &sc->partial;
+  if (sc->partial)
+    sc->partial->prev = &slab->next;
+  sc->partial = slab;
+}
+
+static void
+slab_unlink (struct grub_mm_slab *slab)
+{
+  *slab->prev = slab->next;
+  if (slab->next)
+    slab->next->prev = slab->prev;
+}
+
+static struct grub_mm_slab *
+slab_new (grub_size_t class)
+{
+  struct grub_mm_slab_class *sc = &slab_classes[class];
+  struct grub_mm_slab *slab;
+  grub_err_t saved_errno = grub_errno;
+  grub_uint8_t *obj;
+  grub_size_t i;
+
+  slab = grub_memalign_real (GRUB_MM_SLAB_SIZE, GRUB_MM_SLAB_SIZE);
+  if (slab && !slab_set_add ((grub_addr_t) slab))
+    {
+      grub_free_real (slab);
+      slab = NULL;
+    }
+  if (!slab)
+    {
+      /* The caller falls back to an ordinary block.  */
+      grub_errno = saved_errno;
+      return NULL;
+    }
+
+  slab->magic = GRUB_MM_SLAB_MAGIC;
+  slab->class = class;
+  slab->used = 0;
+  grub_memset (slab->bitmap, 0, sizeof (slab->bitmap));
+
+  obj = (grub_uint8_t *) slab + GRUB_MM_SLAB_OBJECTS_OFFSET;
+  slab->free = obj;
+  for (i = 0; i < sc->objects - 1; i++, obj += sc->size)
+    *(void **) obj = obj + sc->size;
+  *(void **) obj = NULL;
+
+  sc->nslabs++;
+  slab_link (sc, slab);
+  return slab;
+}
+
+static void
+slab_release (struct grub_mm_slab *slab)
+{
+  slab_classes[slab->class].nslabs--;
+  slab->magic = 0;
+  slab_set_remove ((grub_addr_t) slab);
+  grub_free_real (slab);
+}
+
+/* Release the empty slabs kept back, for when memory runs out.  */
+static int
+slab_release_empty (void)
+{
+  grub_size_t c;
+  int released = 0;
+
+  for (c = 0; c < GRUB_MM_SLAB_CLASSES; c++)
+    if (slab_classes[c].empty)
+      {
+	slab_unlink (slab_classes[c].empty);
+	slab_release (slab_classes[c].empty);
+	slab_classes[c].empty = NULL;
+	released = 1;
+      }
+  return released;
+}
+
+static grub_size_t
+slab_index (struct grub_mm_slab *slab, void *ptr)
+{
+  grub_size_t off = (grub_uint8_t *) ptr - (grub_uint8_t *) slab;
+  struct grub_mm_slab_class *sc = &slab_classes[slab->class];
+
+  if (slab->magic != GRUB_MM_SLAB_MAGIC)
+    grub_fatal ("slab magic is broken at %p: 0x%x", slab, slab->magic);
+  off -= GRUB_MM_SLAB_OBJECTS_OFFSET;
+  if (off % sc->size || off / sc->size >= sc->objects)
+    grub_fatal ("unaligned pointer %p", ptr);
+  return off / sc->size;
+}
+
+static void *
+slab_alloc (grub_size_t size)
+{
+  struct grub_mm_slab_class *sc;
+  struct grub_mm_slab *slab;
+  grub_size_t n, class;
+  void *obj;
+
+  n = (size + GRUB_MM_ALIGN - 1) >> GRUB_MM_ALIGN_LOG2;
+  if (!n)
+    n = 1;
+  if (!slab_classes[0].size)
+    slab_init_classes ();
+  class = slab_class_of[n - 1];
+  sc = &slab_classes[class];
+
+  slab = sc->partial;
+  if (!slab)
+    {
+      slab = slab_new (class);
+      if (!slab)
+	return NULL;
+    }
+  if (slab == sc->empty)
+    sc->empty = NULL;
+
+  obj = slab->free;
+  slab->free = *(void **) obj;
+  n = slab_index (slab, obj);
+  slab->bitmap[n / 8] |= 1 << (n % 8);
+  slab->used++;
+  sc->used++;
+
+  if (!slab->free)
+    slab_unlink (slab);
+
+  return obj;
+}
+
+static void
+slab_free (struct grub_mm_slab *slab, void *ptr)
+{
+  struct grub_mm_slab_class *sc = &slab_classes[slab->class];
+  grub_size_t i = slab_index (slab, ptr);
+
+  if (!(slab->bitmap[i / 8] & (1 << (i % 8))))
+    grub_fatal ("double free at %p", ptr);
+  slab->bitmap[i / 8] &= ~(1 << (i % 8));
+
+  if (!slab->free)
+    slab_link (sc, slab);
+  *(void **) ptr = slab->free;
+  slab->free = ptr;
+  slab->used--;
+  sc->used--;
+
+  if (slab->used)
+    return;
+
+  /* Keep one empty slab per class, give the others back.  */
+  if (!sc->empty)
+    {
+      sc->empty = slab;
+      return;
+    }
+  slab_unlink (slab);
+  slab_release (slab);
+}
+
+/* Allocate SIZE bytes with the alignment ALIGN from the regions.  */
+static void *
+grub_memalign_real (grub_size_t align, grub_size_t size)
 {
   grub_mm_region_t r;
   grub_size_t n = ((size + GRUB_MM_ALIGN - 1) >> GRUB_MM_ALIGN_LOG2) + 1;
@@ -485,7 +1099,7 @@ grub_memalign (grub_size_t align, grub_size_t size)
     {
       void *p;
 
-      p = grub_real_malloc (&(r->first), n, align);
+      p = grub_real_malloc (r, n, align);
       if (p)
 	return p;
     }
@@ -494,6 +1108,14 @@ grub_memalign (grub_size_t align, grub_size_t size)
   switch (count)
     {
     case 0:
+      /* Trim caches over their budgets before growing the heap.  */
+      count++;
+      if (grub_mm_cache_reclaim (0))
+	goto again;
+
+      /* fallthrough  */
+
+    case 1:
       /* Request additional pages, contiguous */
       count++;
 
@@ -522,7 +1144,7 @@ grub_memalign (grub_size_t align, grub_size_t size)
 
       /* fallthrough  */
 
-    case 1:
+    case 2:
       /* Request additional pages, anything at all */
       count++;
 
@@ -538,9 +1160,10 @@ grub_memalign (grub_size_t align, grub_size_t size)
 
       /* fallthrough */
 
-    case 2:
-      /* Invalidate disk caches.  */
-      grub_disk_cache_invalidate_all ();
+    case 3:
+      /* Empty the caches, the disk cache among them.  */
+      grub_mm_cache_reclaim (GRUB_SIZE_MAX);
+      slab_release_empty ();
       count++;
       goto again;
 
@@ -553,6 +1176,77 @@ grub_memalign (grub_size_t align, grub_size_t size)
   return 0;
 }
 
+static void *
+large_alloc (grub_size_t size)
+{
+  struct grub_mm_large *large;
+  grub_err_t saved_errno = grub_errno;
+
+  large = slab_alloc (sizeof (*large));
+  if (!large)
+    return NULL;
+
+  large->addr = grub_mm_alloc_pages_fn (size);
+  if (!large->addr)
+    {
+      /* The caller falls back to the regions.  */
+      grub_errno = saved_errno;
+      grub_free (large);
+      return NULL;
+    }
+
+  large->size = size;
+  large->next = large_allocs;
+  large_allocs = large;
+  return large->addr;
+}
+
+static struct grub_mm_large **
+large_find (void *ptr)
+{
+  struct grub_mm_large **l;
+
+  for (l = &large_allocs; *l; l = &(*l)->next)
+    if ((*l)->addr == ptr)
+      return l;
+  return NULL;
+}
+
+static void
+large_free (struct grub_mm_large **l)
+{
+  struct grub_mm_large *large = *l;
+
+  *l = large->next;
+  grub_mm_free_pages_fn (large->addr, large->size);
+  grub_free (large);
+}
+
+/* Allocate SIZE bytes with the alignment ALIGN and return the pointer.  */
+void *
+grub_memalign (grub_size_t align, grub_size_t size)
+{
+  void *p;
+
+  if (align <= GRUB_MM_ALIGN
+      && size <= (GRUB_MM_SLAB_MAX_CELLS << GRUB_MM_ALIGN_LOG2))
+    {
+      p = slab_alloc (size);
+      if (p)
+	return p;
+    }
+
+  if (size >= GRUB_MM_LARGE_SIZE && align <= GRUB_MM_PAGE_ALIGN
+      && grub_mm_alloc_pages_fn && grub_mm_free_pages_fn)
+    {
+      p = large_alloc (size);
+      if (p)
+	return p;
+    }
+
+  return grub_memalign_real (align, size);
+}
+
 /*
  * Allocate NMEMB instances of SIZE bytes and return the pointer, or error on
  * integer overflow.
@@ -601,18 +1295,41 @@ grub_zalloc (grub_size_t size)
 void
 grub_free (void *ptr)
 {
-  grub_mm_header_t p;
-  grub_mm_region_t r;
+  struct grub_mm_slab *slab;
+  struct grub_mm_large **large;
 
   if (! ptr)
     return;
 
+  slab = slab_set_find (ptr);
+  if (slab)
+    {
+      slab_free (slab, ptr);
+      return;
+    }
+
+  large = large_allocs ? large_find (ptr) : NULL;
+  if (large)
+    large_free (large);
+  else
+    grub_free_real (ptr);
+}
+
+/* Give the block at PTR back to its region.  */
+static void
+grub_free_real (void *ptr)
+{
+  grub_mm_header_t p;
+  grub_mm_region_t r;
+
   get_header_from_pointer (ptr, &p, &r);
 
   if (r->first->magic == GRUB_MM_ALLOC_MAGIC)
     {
       p->magic = GRUB_MM_FREE_MAGIC;
-      r->first = p->next = p;
+      r->first = p;
+      ring_link (r, p, p);
+      index_add (r, p);
     }
   else
     {
@@ -649,8 +1366,8 @@ grub_free (void *ptr)
 
       /* mark p as free and insert it between cur and cur->next */
       p->magic = GRUB_MM_FREE_MAGIC;
-      p->next = cur->next;
-      cur->next = p;
+      ring_link (r, p, cur->next);
+      ring_link (r, cur, p);
 
       /*
        * If the block we are freeing can be merged with the next
@@ -660,8 +1377,9 @@ grub_free (void *ptr)
 	{
 	  p->magic = 0;
 
+	  index_del (r, p->next);
 	  p->next->size += p->size;
-	  cur->next = p->next;
+	  ring_link (r, cur, p->next);
 	  p = p->next;
 	}
 
@@ -671,16 +1389,19 @@ grub_free (void *ptr)
       if (cur == p + p->size)
 	{
 	  cur->magic = 0;
+	  index_del (r, cur);
 	  p->size += cur->size;
 	  if (cur == prev)
 	    prev = p;
-	  prev->next = p;
+	  ring_link (r, prev, p);
 	  cur = prev;
 	}
 
+      index_add (r, p);
+
       /*
-       * Set r->first such that the just free()d block is tried first.
-       * (An allocation is tried from *first->next, and cur->next == p.)
+       * Set r->first next to the just free()d block, where the next free
+       * starts looking (cur->next == p).
        */
       r->first = cur;
     }
@@ -696,6 +1417,10 @@ grub_realloc (void *ptr, grub_size_t size)
   void *q;
   grub_size_t n;
 
+  struct grub_mm_slab *slab;
+  struct grub_mm_large **large = NULL;
+  grub_size_t old_size;
+
   if (! ptr)
     return grub_malloc (size);
 
@@ -705,26 +1430,243 @@ grub_realloc (void *ptr, grub_size_t size)
       return 0;
     }
 
-  /* FIXME: Not optimal.  */
-  n = ((size + GRUB_MM_ALIGN - 1) >> GRUB_MM_ALIGN_LOG2) + 1;
-  get_header_from_pointer (ptr, &p, &r);
+  slab = slab_set_find (ptr);
+  if (slab)
+    {
+      slab_index (slab, ptr);
+      old_size = slab_classes[slab->class].size;
+      if (old_size >= size)
+	return ptr;
+    }
+  else if (large_allocs && (large = large_find (ptr)) != NULL)
+    {
+      old_size = (*large)->size;
+      if (old_size >= size)
+	return ptr;
+    }
+  else
+    {
+      /* FIXME: Not optimal.  */
+      n = ((size + GRUB_MM_ALIGN - 1) >> GRUB_MM_ALIGN_LOG2) + 1;
+      get_header_from_pointer (ptr, &p, &r);
 
-  if (p->size >= n)
-    return ptr;
+      if (p->size >= n)
+	return ptr;
+      old_size = p->size << GRUB_MM_ALIGN_LOG2;
+    }
 
   q = grub_malloc (size);
   if (! q)
     return q;
 
-  /* We've already checked that p->size < n.  */
-  grub_memcpy (q, ptr, p->size << GRUB_MM_ALIGN_LOG2);
+  /* We've already checked that the old block is smaller.  */
+  grub_memcpy (q, ptr, old_size);
   grub_free (ptr);
   return q;
 }
 
+grub_size_t
+grub_mm_free_size (void)
+{
+  grub_mm_region_t r;
+  grub_mm_header_t p;
+  grub_size_t cells = 0;
+
+  for (r = grub_mm_base; r; r = r->next)
+    {
+      p = r->first;
+      if (p->magic == GRUB_MM_ALLOC_MAGIC)
+	continue;
+      do
+	{
+	  cells += p->size;
+	  p = p->next;
+	}
+      while (p != r->first);
+    }
+
+  return cells << GRUB_MM_ALIGN_LOG2;
+}
+
 #ifdef MM_DEBUG
 int grub_mm_debug = 0;
 
+/* Live allocations made through the debug wrappers, with the module that
+   called for them, so that heap use can be charged to modules.  */
+#define MM_TAG_BUCKETS	1024
+
+struct mm_owner
+{
+  struct mm_owner *next;
+  grub_size_t live;
+  grub_size_t peak;
+  grub_size_t count;
+  grub_size_t total;
+  char name[0];
+};
+
+struct mm_tag
+{
+  struct mm_tag *next;
+  void *ptr;
+  grub_size_t size;
+  struct mm_owner *owner;
+};
+
+static struct mm_tag *mm_tags[MM_TAG_BUCKETS];
+static struct mm_owner *mm_owners;
+
+static struct mm_tag **
+mm_tag_bucket (void *ptr)
+{
+  return &mm_tags[((grub_addr_t) ptr >> GRUB_MM_ALIGN_LOG2)
+		  % MM_TAG_BUCKETS];
+}
+
+/* The owner named after the module containing ADDR, or after the kernel
+   if no module does.  */
+static struct mm_owner *
+mm_owner_get (void *addr)
+{
+  const char *name = "kernel";
+  struct mm_owner *o;
+  grub_dl_t mod;
+
+  FOR_DL_MODULES (mod)
+    if (mod->base && (grub_addr_t) addr >= (grub_addr_t) mod->base
+	&& (grub_addr_t) addr < (grub_addr_t) mod->base + mod->sz)
+      {
+	name = mod->name;
+	break;
+      }
+
+  for (o = mm_owners; o; o = o->next)
+    if (grub_strcmp (o->name, name) == 0)
+      return o;
+
+  /* Owners outlive unloaded modules, so they keep a copy of the name.
+     This allocation is not itself tracked.  */
+  o = grub_zalloc (sizeof (*o) + grub_strlen (name) + 1);
+  if (!o)
+    return NULL;
+  grub_strcpy (o->name, name);
+  o->next = mm_owners;
+  mm_owners = o;
+  return o;
+}
+
+static void
+mm_track (void *ptr, grub_size_t size, void *caller)
+{
+  grub_err_t saved_errno = grub_errno;
+  struct mm_tag *t, **b;
+  struct mm_owner *o;
+
+  if (!ptr)
+    return;
+
+  o = mm_owner_get (caller);
+  t = o ? grub_malloc (sizeof (*t)) : NULL;
+  if (!t)
+    {
+      /* Accounting is best effort, the allocation itself succeeded.  */
+      grub_errno = saved_errno;
+      return;
+    }
+
+  t->ptr = ptr;
+  t->size = size;
+  t->owner = o;
+  b = mm_tag_bucket (ptr);
+  t->next = *b;
+  *b = t;
+
+  o->live += size;
+  o->total += size;
+  o->count++;
+  if (o->live > o->peak)
+    o->peak = o->live;
+}
+
+static void
+mm_untrack (void *ptr)
+{
+  struct mm_tag **t, *found;
+
+  if (!ptr)
+    return;
+
+  for (t = mm_tag_bucket (ptr); *t; t = &(*t)->next)
+    if ((*t)->ptr == ptr)
+      {
+	found = *t;
+	*t = found->next;
+	found->owner->live -= found->size;
+	found->owner->count--;
+	grub_free (found);
+	return;
+      }
+}
+
+void
+grub_mm_dump_owners (void)
+{
+  struct mm_owner *o;
+
+  grub_printf ("%-20s %12s %12s %8s %14s\n",
+	       "Module", "Live", "Peak", "Blocks", "Total");
+  for (o = mm_owners; o; o = o->next)
+    grub_printf ("%-20s %12" PRIuGRUB_SIZE " %12" PRIuGRUB_SIZE
+		 " %8" PRIuGRUB_SIZE " %14" PRIuGRUB_SIZE "\n",
+		 o->name, o->live, o->peak, o->count, o->total);
+}
+
+void
+grub_mm_dump_regions (void)
+{
+  grub_mm_region_t r;
+  struct grub_mm_large *large;
+  grub_size_t large_bytes = 0, nlarge = 0;
+
+  grub_printf ("%-18s %12s %12s %8s %12s %5s\n",
+	       "Region", "Size", "Free", "Blocks", "Largest", "Frag");
+  for (r = grub_mm_base; r; r = r->next)
+    {
+      grub_mm_header_t p;
+      grub_size_t free = 0, largest = 0, blocks = 0;
+
+      p = r->first;
+      if (p->magic != GRUB_MM_ALLOC_MAGIC)
+	do
+	  {
+	    free += p->size;
+	    if (p->size > largest)
+	      largest = p->size;
+	    blocks++;
+	    p = p->next;
+	  }
+	while (p != r->first);
+
+      free <<= GRUB_MM_ALIGN_LOG2;
+      largest <<= GRUB_MM_ALIGN_LOG2;
+      /* The share of free memory outside the largest free block.  */
+      grub_printf ("%-16p %12" PRIuGRUB_SIZE " %12" PRIuGRUB_SIZE
+		   " %8" PRIuGRUB_SIZE " %12" PRIuGRUB_SIZE " %4u%%\n",
+		   r, r->size, free, blocks, largest,
+		   free ? (unsigned) ((free - largest) * 100ULL / free) : 0);
+    }
+
+  for (large = large_allocs; large; large = large->next)
+    {
+      large_bytes += large->size;
+      nlarge++;
+    }
+  if (nlarge)
+    grub_printf ("%" PRIuGRUB_SIZE " bytes in %" PRIuGRUB_SIZE
+		 " page allocations outside the regions\n",
+		 large_bytes, nlarge);
+}
+
 void
 grub_mm_dump_free (void)
 {
@@ -783,7 +1725,38 @@ grub_mm_dump (unsigned lineno)
 	}
     }
 
+  {
+    struct grub_mm_large *large;
+
+    for (large = large_allocs; large; large = large->next)
+      grub_printf ("L:%p:%" PRIuGRUB_SIZE "\n", large->addr, large->size);
+  }
+
   grub_printf ("\n");
+  grub_mm_dump_slabs ();
+}
+
+void
+grub_mm_dump_slabs (void)
+{
+  grub_size_t c, used = 0, reserved = 0;
+
+  for (c = 0; c < GRUB_MM_SLAB_CLASSES; c++)
+    {
+      struct grub_mm_slab_class *sc = &slab_classes[c];
+
+      if (!sc->nslabs)
+	continue;
+      grub_printf ("S:%" PRIuGRUB_SIZE ":%" PRIuGRUB_SIZE " slabs:%"
+		   PRIuGRUB_SIZE "/%" PRIuGRUB_SIZE " objects%s\n",
+		   sc->size, sc->nslabs, sc->used, sc->nslabs * sc->objects,
+		   sc->empty ? " (1 empty slab)" : "");
+      used += sc->used * sc->size;
+      reserved += sc->nslabs * GRUB_MM_SLAB_SIZE;
+    }
+
+  grub_printf ("Slabs: %" PRIuGRUB_SIZE " bytes in use of %" PRIuGRUB_SIZE
+	       " reserved\n\n", used, reserved);
 }
 
 void *
@@ -795,6 +1768,7 @@ grub_debug_calloc (const char *file, int line, grub_size_t nmemb, grub_size_t si
     grub_printf ("%s:%d: calloc (0x%" PRIxGRUB_SIZE ", 0x%" PRIxGRUB_SIZE ") = ",
 		 file, line, nmemb, size);
   ptr = grub_calloc (nmemb, size);
+  mm_track (ptr, nmemb * size, __builtin_return_address (0));
   if (grub_mm_debug)
     grub_printf ("%p\n", ptr);
   return ptr;
@@ -808,6 +1782,7 @@ grub_debug_malloc (const char *file, int line, grub_size_t size)
   if (grub_mm_debug)
     grub_printf ("%s:%d: malloc (0x%" PRIxGRUB_SIZE ") = ", file, line, size);
   ptr = grub_malloc (size);
+  mm_track (ptr, size, __builtin_return_address (0));
   if (grub_mm_debug)
     grub_printf ("%p\n", ptr);
   return ptr;
@@ -821,6 +1796,7 @@ grub_debug_zalloc (const char *file, int line, grub_size_t size)
   if (grub_mm_debug)
     grub_printf ("%s:%d: zalloc (0x%" PRIxGRUB_SIZE ") = ", file, line, size);
   ptr = grub_zalloc (size);
+  mm_track (ptr, size, __builtin_return_address (0));
   if (grub_mm_debug)
     grub_printf ("%p\n", ptr);
   return ptr;
@@ -831,15 +1807,23 @@ grub_debug_free (const char *file, int line, void *ptr)
 {
   if (grub_mm_debug)
     grub_printf ("%s:%d: free (%p)\n", file, line, ptr);
+  mm_untrack (ptr);
   grub_free (ptr);
 }
 
 void *
 grub_debug_realloc (const char *file, int line, void *ptr, grub_size_t size)
 {
+  void *old = ptr;
+
   if (grub_mm_debug)
     grub_printf ("%s:%d: realloc (%p, 0x%" PRIxGRUB_SIZE ") = ", file, line, ptr, size);
   ptr = grub_realloc (ptr, size);
+  /* A failed reallocation leaves the old block alone.  */
+  if (ptr || !size)
+    mm_untrack (old);
+  if (ptr)
+    mm_track (ptr, size, __builtin_return_address (0));
   if (grub_mm_debug)
     grub_printf ("%p\n", ptr);
   return ptr;
@@ -855,6 +1839,7 @@ grub_debug_memalign (const char *file, int line, grub_size_t align,
     grub_printf ("%s:%d: memalign (0x%" PRIxGRUB_SIZE  ", 0x%" PRIxGRUB_SIZE
 		 ") = ", file, line, align, size);
   ptr = grub_memalign (align, size);
+  mm_track (ptr, size, __builtin_return_address (0));
   if (grub_mm_debug)
     grub_printf ("%p\n", ptr);
   return ptr;
@@ -0,0 +1,70 @@
+/* mm_cache.c - caches giving memory back under pressure.  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/mm.h>
+#include <grub/list.h>
+#include <grub/misc.h>
+
+static struct grub_mm_cache *grub_mm_cache_list;
+
+/* Set while the caches are being reclaimed, so that an allocation a
+   reclaim function makes by mistake can't recurse.  */
+static int reclaiming;
+
+void
+grub_mm_cache_register (struct grub_mm_cache *cache)
+{
+  grub_list_push (GRUB_AS_LIST_P (&grub_mm_cache_list), GRUB_AS_LIST (cache));
+}
+
+void
+grub_mm_cache_unregister (struct grub_mm_cache *cache)
+{
+  grub_list_remove (GRUB_AS_LIST (cache));
+}
+
+grub_size_t
+grub_mm_cache_reclaim (grub_size_t target)
+{
+  struct grub_mm_cache *cache;
+  grub_size_t freed = 0;
+
+  if (reclaiming)
+    return 0;
+  reclaiming = 1;
+
+  FOR_LIST_ELEMENTS (cache, grub_mm_cache_list)
+    if (cache->used > cache->budget)
+      freed += cache->reclaim (cache, cache->used - cache->budget);
+
+  FOR_LIST_ELEMENTS (cache, grub_mm_cache_list)
+    {
+      if (freed >= target)
+	break;
+      if (cache->used)
+	freed += cache->reclaim (cache, target - freed);
+    }
+
+  reclaiming = 0;
+
+  if (freed)
+    grub_dprintf ("mm", "reclaimed %" PRIuGRUB_SIZE " bytes from caches\n",
+		  freed);
+  return freed;
+}
@@ -27,6 +27,7 @@ struct grub_term_output *grub_term_outputs_disabled;
 struct grub_term_input *grub_term_inputs_disabled;
 struct grub_term_output *grub_term_outputs;
 struct grub_term_input *grub_term_inputs;
+unsigned long grub_term_font_generation;
 
 /* Current color state.  */
 grub_uint8_t grub_term_normal_color = GRUB_TERM_DEFAULT_NORMAL_COLOR;
@@ -104,6 +105,20 @@ grub_getkey_noblock (void)
   return GRUB_TERM_NO_KEY;
 }
 
+/* Idle for up to MS milliseconds between two polls of the terminals,
+   unless one of them would lose input meanwhile.  */
+void
+grub_term_idle (grub_uint32_t ms)
+{
+  grub_term_input_t term;
+
+  FOR_ACTIVE_TERM_INPUTS(term)
+    if (term->flags & GRUB_TERM_INPUT_POLLED)
+      return;
+
+  grub_idle (ms);
+}
+
 int
 grub_getkey (void)
 {
@@ -116,7 +131,7 @@ grub_getkey (void)
       ret = grub_getkey_noblock ();
       if (ret != GRUB_TERM_NO_KEY)
 	return ret;
-      grub_cpu_idle ();
+      grub_term_idle (GRUB_IDLE_POLL_MS);
     }
 }
 
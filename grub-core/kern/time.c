@@ -35,3 +35,23 @@ grub_install_get_time_ms (get_time_ms_func_t func)
 {
   get_time_ms_func = func;
 }
+
+typedef void (*idle_func_t) (grub_uint32_t ms);
+
+/* Without a way to wait for the firmware, there's only grub_cpu_idle.  */
+static idle_func_t idle_func;
+
+void
+grub_idle (grub_uint32_t ms)
+{
+  if (idle_func)
+    idle_func (ms);
+  else
+    grub_cpu_idle ();
+}
+
+void
+grub_install_idle (idle_func_t func)
+{
+  idle_func = func;
+}
@@ -0,0 +1,155 @@
+/* trace.c - Record the time the boot phases take.  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/trace.h>
+#include <grub/time.h>
+#include <grub/misc.h>
+#include <grub/mm.h>
+#include <grub/err.h>
+
+/* The buffer grows by doubling up to this many events, the later ones are
+   only counted.  */
+#define TRACE_MIN_EVENTS	256
+#define TRACE_MAX_EVENTS	4096
+
+struct grub_trace_event *grub_trace_events;
+grub_size_t grub_trace_nevents;
+grub_size_t grub_trace_dropped;
+
+static grub_size_t trace_allocated;
+
+static const char *const trace_categories[] =
+  {
+    [GRUB_TRACE_MODULE] = "module",
+    [GRUB_TRACE_OPEN] = "open",
+    [GRUB_TRACE_READ] = "read",
+    [GRUB_TRACE_DISK] = "disk",
+    [GRUB_TRACE_VERIFY] = "verify",
+    [GRUB_TRACE_CONFIG] = "config"
+  };
+
+/* Without a finer clock, count in milliseconds.  */
+static grub_trace_clock_t trace_clock;
+static grub_uint32_t trace_rate;
+
+void
+grub_trace_set_clock (grub_trace_clock_t clock, grub_uint32_t rate)
+{
+  if (grub_trace_nevents || grub_trace_dropped)
+    return;
+  trace_clock = clock;
+  trace_rate = rate;
+}
+
+grub_uint64_t
+grub_trace_now (void)
+{
+  if (trace_clock)
+    return trace_clock ();
+  return grub_get_time_ms ();
+}
+
+const char *
+grub_trace_category_name (enum grub_trace_category category)
+{
+  if ((unsigned) category >= ARRAY_SIZE (trace_categories))
+    return "unknown";
+  return trace_categories[category];
+}
+
+grub_uint64_t
+grub_trace_to_us (grub_uint64_t ticks)
+{
+  if (!trace_clock)
+    return ticks * 1000;
+
+  /* Multiply by RATE / 2^32 without a 64-bit division.  */
+  return (ticks >> 32) * trace_rate
+    + (((ticks & 0xffffffff) * trace_rate) >> 32);
+}
+
+/* Return the slot for a new event, or NULL when there is no room.  */
+static struct grub_trace_event *
+trace_slot (void)
+{
+  struct grub_trace_event *events;
+  grub_size_t n;
+  grub_err_t err;
+
+  if (grub_trace_nevents < trace_allocated)
+    return &grub_trace_events[grub_trace_nevents++];
+  if (trace_allocated >= TRACE_MAX_EVENTS)
+    return NULL;
+
+  /* Tracing must not change what the traced code sees.  */
+  err = grub_errno;
+  n = trace_allocated ? trace_allocated * 2 : TRACE_MIN_EVENTS;
+  events = grub_realloc (grub_trace_events, n * sizeof (*events));
+  grub_errno = err;
+  if (!events)
+    {
+      /* Try again later, when memory may have been freed.  */
+      return NULL;
+    }
+
+  grub_trace_events = events;
+  trace_allocated = n;
+  return &grub_trace_events[grub_trace_nevents++];
+}
+
+static void
+trace_copy (char *dest, const char *src, grub_size_t size)
+{
+  grub_size_t len;
+
+  if (!src)
+    {
+      dest[0] = '\0';
+      return;
+    }
+
+  /* Keep the end of long strings, where file names differ.  */
+  len = grub_strlen (src);
+  if (len >= size)
+    src += len - (size - 1);
+  grub_strncpy (dest, src, size - 1);
+  dest[size - 1] = '\0';
+}
+
+void
+grub_trace_record (enum grub_trace_category category, const char *name,
+		   const char *detail, grub_uint64_t start, grub_uint64_t arg)
+{
+  grub_uint64_t end = grub_trace_now ();
+  struct grub_trace_event *e;
+
+  e = trace_slot ();
+  if (!e)
+    {
+      grub_trace_dropped++;
+      return;
+    }
+
+  e->start = start;
+  e->end = end;
+  e->arg = arg;
+  e->category = category;
+  trace_copy (e->name, name, sizeof (e->name));
+  trace_copy (e->detail, detail, sizeof (e->detail));
+}
@@ -21,11 +21,52 @@
 #include <grub/file.h>
 #include <grub/verify.h>
 #include <grub/dl.h>
+#include <grub/trace.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
 struct grub_file_verifier *grub_file_verifiers;
 
+/* Whole files are read in pieces of this size, each one hashed by the
+   verifiers that take the data in pieces before the next one is read.  */
+#define VERIFIED_READ_CHUNK	(256 * 1024)
+
+struct grub_verifier_context
+{
+  struct grub_file_verifier *ver;
+  void *context;
+  /* Whether the verifier wants the whole file in one write.  */
+  int single_chunk;
+};
+
+/* Hash SIZE more bytes of FILE with V.  */
+static grub_err_t
+verifier_write (struct grub_verifier_context *v, grub_file_t file,
+		void *buf, grub_size_t size)
+{
+  grub_uint64_t start = grub_trace_now ();
+  grub_err_t err;
+
+  err = v->ver->write (v->context, buf, size);
+  grub_trace_record (GRUB_TRACE_VERIFY, v->ver->name, file->name, start, size);
+  return err;
+}
+
+static grub_err_t
+verifier_fini (struct grub_verifier_context *v, grub_file_t file)
+{
+  grub_uint64_t start;
+  grub_err_t err;
+
+  if (!v->ver->fini)
+    return GRUB_ERR_NONE;
+
+  start = grub_trace_now ();
+  err = v->ver->fini (v->context);
+  grub_trace_record (GRUB_TRACE_VERIFY, v->ver->name, file->name, start, 0);
+  return err;
+}
+
 struct grub_verified
 {
   grub_file_t file;
@@ -33,6 +74,16 @@ struct grub_verified
 };
 typedef struct grub_verified *grub_verified_t;
 
+static void
+verifiers_close (struct grub_verifier_context *vers, grub_size_t n)
+{
+  grub_size_t i;
+
+  for (i = 0; i < n; i++)
+    if (vers[i].ver && vers[i].ver->close)
+      vers[i].ver->close (vers[i].context);
+}
+
 static void
 verified_free (grub_verified_t verified)
 {
@@ -79,8 +130,10 @@ static grub_file_t
 grub_verifiers_open (grub_file_t io, enum grub_file_type type)
 {
   grub_verified_t verified = NULL;
+  struct grub_verifier_context *active = NULL;
   struct grub_file_verifier *ver;
-  void *context;
+  grub_size_t nvers = 0, nactive = 0, i;
+  grub_size_t done, size;
   grub_file_t ret = 0;
   grub_err_t err;
   int defer = 0;
@@ -97,31 +150,48 @@ grub_verifiers_open (grub_file_t io, enum grub_file_type type)
        || io->device->disk->dev->id == GRUB_DISK_DEVICE_PROCFS_ID))
     return io;
 
+  FOR_LIST_ELEMENTS(ver, grub_file_verifiers)
+    nvers++;
+  if (!nvers)
+    return io;
+
+  active = grub_calloc (nvers, sizeof (*active));
+  if (!active)
+    return NULL;
+
   FOR_LIST_ELEMENTS(ver, grub_file_verifiers)
     {
       enum grub_verify_flags flags = 0;
+      void *context = NULL;
+
       err = ver->init (io, type, &context, &flags);
       if (err)
-	goto fail_noclose;
+	goto fail;
       if (flags & GRUB_VERIFY_FLAGS_DEFER_AUTH)
 	{
 	  defer = 1;
 	  continue;
 	}
-      if (!(flags & GRUB_VERIFY_FLAGS_SKIP_VERIFICATION))
-	break;
+      if (flags & GRUB_VERIFY_FLAGS_SKIP_VERIFICATION)
+	continue;
+
+      active[nactive].ver = ver;
+      active[nactive].context = context;
+      active[nactive].single_chunk = !!(flags & GRUB_VERIFY_FLAGS_SINGLE_CHUNK);
+      nactive++;
     }
 
-  if (!ver)
+  if (!nactive)
     {
       if (defer)
 	{
 	  grub_error (GRUB_ERR_ACCESS_DENIED,
 		      N_("verification requested but nobody cares: %s"), io->name);
-	  goto fail_noclose;
+	  goto fail;
 	}
 
       /* No verifiers wanted to verify. Just return underlying file. */
+      grub_free (active);
       return io;
     }
 
@@ -132,73 +202,78 @@ grub_verifiers_open (grub_file_t io, enum grub_file_type type)
     }
   *ret = *io;
 
-  ret->fs = &verified_fs;
-  ret->not_easily_seekable = 0;
   if (ret->size >> (sizeof (grub_size_t) * GRUB_CHAR_BIT - 1))
     {
       grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
 		  N_("big file signature isn't implemented yet"));
       goto fail;
     }
-  verified = grub_malloc (sizeof (*verified));
+  verified = grub_zalloc (sizeof (*verified));
   if (!verified)
     {
       goto fail;
     }
+  verified->file = io;
+
+  ret->fs = &verified_fs;
+  ret->not_easily_seekable = 0;
   verified->buf = grub_malloc (ret->size);
   if (!verified->buf)
     {
       goto fail;
     }
-  if (grub_file_read (io, verified->buf, ret->size) != (grub_ssize_t) ret->size)
-    {
-      if (!grub_errno)
-	grub_error (GRUB_ERR_FILE_READ_ERROR, N_("premature end of file %s"),
-		    io->name);
-      goto fail;
-    }
 
-  err = ver->write (context, verified->buf, ret->size);
-  if (err)
-    goto fail;
+  /*
+   * Hash each piece as soon as it is read: with a disk that reads ahead
+   * asynchronously, the next piece is fetched in the meantime.
+   */
+  for (done = 0; done < ret->size; done += size)
+    {
+      char *piece = (char *) verified->buf + done;
 
-  err = ver->fini ? ver->fini (context) : GRUB_ERR_NONE;
-  if (err)
-    goto fail;
+      size = grub_min (ret->size - done, VERIFIED_READ_CHUNK);
+      if (grub_file_read (io, piece, size) != (grub_ssize_t) size)
+	{
+	  if (!grub_errno)
+	    grub_error (GRUB_ERR_FILE_READ_ERROR, N_("premature end of file %s"),
+			io->name);
+	  goto fail;
+	}
 
-  if (ver->close)
-    ver->close (context);
+      for (i = 0; i < nactive; i++)
+	if (!active[i].single_chunk)
+	  {
+	    err = verifier_write (&active[i], io, piece, size);
+	    if (err)
+	      goto fail;
+	  }
+    }
 
-  FOR_LIST_ELEMENTS_NEXT(ver, grub_file_verifiers)
+  for (i = 0; i < nactive; i++)
     {
-      enum grub_verify_flags flags = 0;
-      err = ver->init (io, type, &context, &flags);
-      if (err)
-	goto fail_noclose;
-      if (flags & GRUB_VERIFY_FLAGS_SKIP_VERIFICATION ||
-	  /* Verification done earlier. So, we are happy here. */
-	  flags & GRUB_VERIFY_FLAGS_DEFER_AUTH)
-	continue;
-      err = ver->write (context, verified->buf, ret->size);
-      if (err)
-	goto fail;
+      if (active[i].single_chunk)
+	{
+	  err = verifier_write (&active[i], io, verified->buf, ret->size);
+	  if (err)
+	    goto fail;
+	}
 
-      err = ver->fini ? ver->fini (context) : GRUB_ERR_NONE;
+      err = verifier_fini (&active[i], io);
       if (err)
 	goto fail;
 
-      if (ver->close)
-	ver->close (context);
+      if (active[i].ver->close)
+	active[i].ver->close (active[i].context);
+      active[i].ver = NULL;
     }
 
-  verified->file = io;
+  grub_free (active);
   ret->data = verified;
   return ret;
 
  fail:
-  if (ver->close)
-    ver->close (context);
- fail_noclose:
+  verifiers_close (active, nactive);
+  grub_free (active);
   verified_free (verified);
   grub_free (ret);
   return NULL;
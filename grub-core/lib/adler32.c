@@ -39,27 +39,44 @@ adler32_init (void *context)
 
 #define MOD 65521
 
-static grub_uint16_t
-mod_add (grub_uint16_t a, grub_uint16_t b)
-{
-  if ((grub_uint32_t) a + (grub_uint32_t) b >= MOD)
-    return a + b - MOD;
-  return a + b;
-}
+/* The largest N for which 255 N (N + 1) / 2 + (N + 1) (MOD - 1) still fits
+   in 32 bits, so the sums of N bytes need just one reduction.  */
+#define NMAX 5552
 
 static void
 adler32_write (void *context, const void *inbuf, grub_size_t inlen)
 {
   struct adler32_context *ctx = context;
   const grub_uint8_t *ptr = inbuf;
+  grub_uint32_t a = ctx->a, b = ctx->b;
+  grub_size_t n;
 
   while (inlen)
     {
-      ctx->a = mod_add (ctx->a, *ptr);
-      ctx->b = mod_add (ctx->a, ctx->b);
-      inlen--;
-      ptr++;
+      n = inlen < NMAX ? inlen : NMAX;
+      inlen -= n;
+      for (; n >= 4; n -= 4, ptr += 4)
+	{
+	  a += ptr[0];
+	  b += a;
+	  a += ptr[1];
+	  b += a;
+	  a += ptr[2];
+	  b += a;
+	  a += ptr[3];
+	  b += a;
+	}
+      for (; n; n--)
+	{
+	  a += *ptr++;
+	  b += a;
+	}
+      a %= MOD;
+      b %= MOD;
     }
+
+  ctx->a = a;
+  ctx->b = b;
 }
 
 static void
@@ -0,0 +1,440 @@
+/* aes_hw.c - AES-XTS and AES-CBC on the CPU AES instructions.  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/aes_hw.h>
+#include <grub/cryptodisk.h>
+#include <grub/dl.h>
+#include <grub/mm.h>
+#include <grub/misc.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+/* Blocks handed to the CPU at once.  */
+#define AES_HW_BATCH	8
+
+#define AES_HW_KEYS_SIZE	((GRUB_AES_HW_MAX_ROUNDS + 1) \
+				 * GRUB_AES_HW_BLOCK_SIZE)
+
+struct aes_hw_ctx
+{
+  grub_cryptodisk_mode_t mode;
+  int rounds;
+  grub_uint8_t enc[AES_HW_KEYS_SIZE];
+  grub_uint8_t dec[AES_HW_KEYS_SIZE];
+  /* Encryption keys of the XTS tweak.  */
+  grub_uint8_t tweak[AES_HW_KEYS_SIZE];
+};
+
+union aes_hw_block
+{
+  grub_uint8_t bytes[GRUB_AES_HW_BLOCK_SIZE];
+  grub_uint64_t words[2];
+};
+
+/* Expand the KEYSIZE bytes of KEY into round keys and return the number
+   of rounds.  */
+static int
+expand_key (grub_uint8_t *keys, const grub_uint8_t *key, grub_size_t keysize)
+{
+  grub_uint32_t w[(GRUB_AES_HW_MAX_ROUNDS + 1) * 4];
+  unsigned nk = keysize / 4;
+  unsigned rounds = nk + 6;
+  grub_uint32_t rcon = 1;
+  unsigned i;
+
+  for (i = 0; i < nk; i++)
+    w[i] = grub_le_to_cpu32 (grub_get_unaligned32 (key + 4 * i));
+
+  for (; i < 4 * (rounds + 1); i++)
+    {
+      grub_uint32_t t = w[i - 1];
+
+      if (i % nk == 0)
+	{
+	  t = grub_aes_hw_sub_word (t);
+	  t = ((t >> 8) | (t << 24)) ^ rcon;
+	  rcon = (rcon << 1) ^ ((rcon & 0x80) ? 0x11b : 0);
+	}
+      else if (nk > 6 && i % nk == 4)
+	t = grub_aes_hw_sub_word (t);
+      w[i] = w[i - nk] ^ t;
+    }
+
+  for (i = 0; i < 4 * (rounds + 1); i++)
+    grub_set_unaligned32 (keys + 4 * i, grub_cpu_to_le32 (w[i]));
+  grub_memset (w, 0, sizeof (w));
+
+  return rounds;
+}
+
+/* Derive the keys of the equivalent inverse cipher.  */
+static void
+invert_keys (grub_uint8_t *dec, const grub_uint8_t *enc, int rounds)
+{
+  int i;
+
+  grub_memcpy (dec, enc + rounds * GRUB_AES_HW_BLOCK_SIZE,
+	       GRUB_AES_HW_BLOCK_SIZE);
+  for (i = 1; i < rounds; i++)
+    {
+      grub_memcpy (dec + i * GRUB_AES_HW_BLOCK_SIZE,
+		   enc + (rounds - i) * GRUB_AES_HW_BLOCK_SIZE,
+		   GRUB_AES_HW_BLOCK_SIZE);
+      grub_aes_hw_inv_mix_columns (dec + i * GRUB_AES_HW_BLOCK_SIZE);
+    }
+  grub_memcpy (dec + rounds * GRUB_AES_HW_BLOCK_SIZE, enc,
+	       GRUB_AES_HW_BLOCK_SIZE);
+}
+
+/* KEYSIZE is that of each half of an XTS key.  */
+static void
+aes_hw_setkey (struct aes_hw_ctx *ctx, grub_cryptodisk_mode_t mode,
+	       const grub_uint8_t *key, grub_size_t keysize)
+{
+  ctx->mode = mode;
+  ctx->rounds = expand_key (ctx->enc, key, keysize);
+  invert_keys (ctx->dec, ctx->enc, ctx->rounds);
+  if (mode == GRUB_CRYPTODISK_MODE_XTS)
+    expand_key (ctx->tweak, key + keysize, keysize);
+}
+
+static void *
+aes_hw_init (const gcry_cipher_spec_t *cipher, grub_cryptodisk_mode_t mode,
+	     const grub_uint8_t *key, grub_size_t keysize)
+{
+  struct aes_hw_ctx *ctx;
+
+  /* All the AES specs accept any of the key sizes.  */
+  if (grub_strncmp (cipher->name, "AES", 3) != 0
+      || cipher->blocksize != GRUB_AES_HW_BLOCK_SIZE)
+    return NULL;
+
+  if (mode == GRUB_CRYPTODISK_MODE_XTS)
+    keysize /= 2;
+  else if (mode != GRUB_CRYPTODISK_MODE_CBC)
+    return NULL;
+
+  if (keysize != 16 && keysize != 24 && keysize != 32)
+    return NULL;
+
+  ctx = grub_malloc (sizeof (*ctx));
+  if (!ctx)
+    return NULL;
+
+  aes_hw_setkey (ctx, mode, key, keysize);
+
+  return ctx;
+}
+
+/* Multiply the tweak T by x in GF(2^128).  */
+static inline void
+xts_next_tweak (union aes_hw_block *t)
+{
+  grub_uint64_t lo = grub_le_to_cpu64 (t->words[0]);
+  grub_uint64_t hi = grub_le_to_cpu64 (t->words[1]);
+  grub_uint64_t carry = hi >> 63;
+
+  hi = (hi << 1) | (lo >> 63);
+  lo = (lo << 1) ^ (0x87 & -carry);
+  t->words[0] = grub_cpu_to_le64 (lo);
+  t->words[1] = grub_cpu_to_le64 (hi);
+}
+
+/* Process one sector starting with the encrypted tweak T.  */
+static void
+xts_crypt (struct aes_hw_ctx *ctx, grub_uint8_t *data, grub_size_t nblocks,
+	   union aes_hw_block t, int do_encrypt)
+{
+  union aes_hw_block tweaks[AES_HW_BATCH];
+  grub_size_t n, j;
+
+  for (; nblocks; nblocks -= n, data += n * GRUB_AES_HW_BLOCK_SIZE)
+    {
+      n = grub_min (nblocks, (grub_size_t) AES_HW_BATCH);
+
+      for (j = 0; j < n; j++)
+	{
+	  tweaks[j] = t;
+	  grub_crypto_xor (data + j * GRUB_AES_HW_BLOCK_SIZE,
+			   data + j * GRUB_AES_HW_BLOCK_SIZE,
+			   t.bytes, GRUB_AES_HW_BLOCK_SIZE);
+	  xts_next_tweak (&t);
+	}
+
+      if (do_encrypt)
+	grub_aes_hw_encrypt (ctx->enc, ctx->rounds, data, n);
+      else
+	grub_aes_hw_decrypt (ctx->dec, ctx->rounds, data, n);
+
+      for (j = 0; j < n; j++)
+	grub_crypto_xor (data + j * GRUB_AES_HW_BLOCK_SIZE,
+			 data + j * GRUB_AES_HW_BLOCK_SIZE,
+			 tweaks[j].bytes, GRUB_AES_HW_BLOCK_SIZE);
+    }
+}
+
+static void
+cbc_encrypt (struct aes_hw_ctx *ctx, grub_uint8_t *data, grub_size_t nblocks,
+	     const grub_uint8_t *iv)
+{
+  const grub_uint8_t *prev = iv;
+
+  /* Every block depends on the previous one.  */
+  for (; nblocks; nblocks--, data += GRUB_AES_HW_BLOCK_SIZE)
+    {
+      grub_crypto_xor (data, data, prev, GRUB_AES_HW_BLOCK_SIZE);
+      grub_aes_hw_encrypt (ctx->enc, ctx->rounds, data, 1);
+      prev = data;
+    }
+}
+
+static void
+cbc_decrypt (struct aes_hw_ctx *ctx, grub_uint8_t *data, grub_size_t nblocks,
+	     const grub_uint8_t *iv)
+{
+  grub_uint8_t prev[GRUB_AES_HW_BLOCK_SIZE];
+  grub_uint8_t in[AES_HW_BATCH * GRUB_AES_HW_BLOCK_SIZE];
+  grub_size_t n, j;
+
+  grub_memcpy (prev, iv, GRUB_AES_HW_BLOCK_SIZE);
+
+  for (; nblocks; nblocks -= n, data += n * GRUB_AES_HW_BLOCK_SIZE)
+    {
+      n = grub_min (nblocks, (grub_size_t) AES_HW_BATCH);
+
+      grub_memcpy (in, data, n * GRUB_AES_HW_BLOCK_SIZE);
+      grub_aes_hw_decrypt (ctx->dec, ctx->rounds, data, n);
+
+      grub_crypto_xor (data, data, prev, GRUB_AES_HW_BLOCK_SIZE);
+      for (j = 1; j < n; j++)
+	grub_crypto_xor (data + j * GRUB_AES_HW_BLOCK_SIZE,
+			 data + j * GRUB_AES_HW_BLOCK_SIZE,
+			 in + (j - 1) * GRUB_AES_HW_BLOCK_SIZE,
+			 GRUB_AES_HW_BLOCK_SIZE);
+      grub_memcpy (prev, in + (n - 1) * GRUB_AES_HW_BLOCK_SIZE,
+		   GRUB_AES_HW_BLOCK_SIZE);
+    }
+}
+
+static void
+aes_hw_crypt (void *data_ctx, grub_uint8_t *data, grub_size_t nsectors,
+	      grub_size_t log_sector_size, const grub_uint8_t *ivs,
+	      int do_encrypt)
+{
+  struct aes_hw_ctx *ctx = data_ctx;
+  grub_size_t sector_size = (grub_size_t) 1 << log_sector_size;
+  grub_size_t nblocks = sector_size / GRUB_AES_HW_BLOCK_SIZE;
+  union aes_hw_block t[AES_HW_BATCH];
+  grub_size_t n, j;
+
+  if (ctx->mode != GRUB_CRYPTODISK_MODE_XTS)
+    {
+      for (; nsectors; nsectors--, data += sector_size,
+	     ivs += GRUB_AES_HW_BLOCK_SIZE)
+	if (do_encrypt)
+	  cbc_encrypt (ctx, data, nblocks, ivs);
+	else
+	  cbc_decrypt (ctx, data, nblocks, ivs);
+      return;
+    }
+
+  /* Encrypt the tweaks of several sectors at once.  */
+  for (; nsectors; nsectors -= n, ivs += n * GRUB_AES_HW_BLOCK_SIZE)
+    {
+      n = grub_min (nsectors, (grub_size_t) AES_HW_BATCH);
+
+      grub_memcpy (t, ivs, n * GRUB_AES_HW_BLOCK_SIZE);
+      grub_aes_hw_encrypt (ctx->tweak, ctx->rounds, t[0].bytes, n);
+      for (j = 0; j < n; j++, data += sector_size)
+	xts_crypt (ctx, data, nblocks, t[j], do_encrypt);
+    }
+}
+
+static void
+aes_hw_fini (void *ctx)
+{
+  grub_memset (ctx, 0, sizeof (struct aes_hw_ctx));
+  grub_free (ctx);
+}
+
+static struct grub_cryptodisk_accel aes_hw_accel =
+  {
+    .name = "aes_hw",
+    .init = aes_hw_init,
+    .crypt = aes_hw_crypt,
+    .fini = aes_hw_fini
+  };
+
+/* Known answers for each key size and mode, one sector each.  */
+static const struct
+{
+  grub_cryptodisk_mode_t mode;
+  grub_size_t keysize;
+  grub_size_t log_sector_size;
+  grub_uint8_t key[64];
+  grub_uint8_t iv[GRUB_AES_HW_BLOCK_SIZE];
+  grub_uint8_t plain[32];
+  grub_uint8_t cipher[32];
+} aes_hw_kats[] =
+  {
+    /* IEEE 1619 vector 2.  */
+    {
+      GRUB_CRYPTODISK_MODE_XTS, 16, 5,
+      {
+	0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+	0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+	0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22,
+	0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22
+      },
+      {
+	0x33, 0x33, 0x33, 0x33, 0x33, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+      },
+      {
+	0x44, 0x44, 0x44, 0x44, 0x44, 0x44, 0x44, 0x44,
+	0x44, 0x44, 0x44, 0x44, 0x44, 0x44, 0x44, 0x44,
+	0x44, 0x44, 0x44, 0x44, 0x44, 0x44, 0x44, 0x44,
+	0x44, 0x44, 0x44, 0x44, 0x44, 0x44, 0x44, 0x44
+      },
+      {
+	0xc4, 0x54, 0x18, 0x5e, 0x6a, 0x16, 0x93, 0x6e,
+	0x39, 0x33, 0x40, 0x38, 0xac, 0xef, 0x83, 0x8b,
+	0xfb, 0x18, 0x6f, 0xff, 0x74, 0x80, 0xad, 0xc4,
+	0x28, 0x93, 0x82, 0xec, 0xd6, 0xd3, 0x94, 0xf0
+      }
+    },
+    /* SP 800-38A F.2.1.  */
+    {
+      GRUB_CRYPTODISK_MODE_CBC, 16, 5,
+      {
+	0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6,
+	0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c
+      },
+      {
+	0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+	0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f
+      },
+      {
+	0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96,
+	0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a,
+	0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03, 0xac, 0x9c,
+	0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51
+      },
+      {
+	0x76, 0x49, 0xab, 0xac, 0x81, 0x19, 0xb2, 0x46,
+	0xce, 0xe9, 0x8e, 0x9b, 0x12, 0xe9, 0x19, 0x7d,
+	0x50, 0x86, 0xcb, 0x9b, 0x50, 0x72, 0x19, 0xee,
+	0x95, 0xdb, 0x11, 0x3a, 0x91, 0x76, 0x78, 0xb2
+      }
+    },
+    /* FIPS-197 C.2.  */
+    {
+      GRUB_CRYPTODISK_MODE_CBC, 24, 4,
+      {
+	0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+	0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+	0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17
+      },
+      {
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+      },
+      {
+	0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+	0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff
+      },
+      {
+	0xdd, 0xa9, 0x7c, 0xa4, 0x86, 0x4c, 0xdf, 0xe0,
+	0x6e, 0xaf, 0x70, 0xa0, 0xec, 0x0d, 0x71, 0x91
+      }
+    },
+    /* FIPS-197 C.3.  */
+    {
+      GRUB_CRYPTODISK_MODE_CBC, 32, 4,
+      {
+	0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+	0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+	0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17,
+	0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f
+      },
+      {
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+      },
+      {
+	0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+	0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff
+      },
+      {
+	0x8e, 0xa2, 0xb7, 0xca, 0x51, 0x67, 0x45, 0xbf,
+	0xea, 0xfc, 0x49, 0x90, 0x4b, 0x49, 0x60, 0x89
+      }
+    }
+  };
+
+/* Check the CPU code both ways before it is handed out, so that a broken
+   implementation leaves the disks to the generic ciphers.  */
+static int
+aes_hw_selftest (void)
+{
+  struct aes_hw_ctx ctx;
+  grub_uint8_t buf[32];
+  grub_size_t len;
+  unsigned i;
+  int ok = 1;
+
+  for (i = 0; ok && i < ARRAY_SIZE (aes_hw_kats); i++)
+    {
+      len = (grub_size_t) 1 << aes_hw_kats[i].log_sector_size;
+      aes_hw_setkey (&ctx, aes_hw_kats[i].mode, aes_hw_kats[i].key,
+		     aes_hw_kats[i].keysize);
+
+      grub_memcpy (buf, aes_hw_kats[i].plain, len);
+      aes_hw_crypt (&ctx, buf, 1, aes_hw_kats[i].log_sector_size,
+		    aes_hw_kats[i].iv, 1);
+      if (grub_memcmp (buf, aes_hw_kats[i].cipher, len) != 0)
+	ok = 0;
+
+      aes_hw_crypt (&ctx, buf, 1, aes_hw_kats[i].log_sector_size,
+		    aes_hw_kats[i].iv, 0);
+      if (grub_memcmp (buf, aes_hw_kats[i].plain, len) != 0)
+	ok = 0;
+    }
+  grub_memset (&ctx, 0, sizeof (ctx));
+
+  if (!ok)
+    grub_dprintf ("cryptodisk", "AES CPU code fails its self-test\n");
+  return ok;
+}
+
+static int registered;
+
+GRUB_MOD_INIT (aes_hw)
+{
+  if (!grub_aes_hw_supported () || !aes_hw_selftest ())
+    return;
+  grub_cryptodisk_accel_register (&aes_hw_accel);
+  registered = 1;
+}
+
+GRUB_MOD_FINI (aes_hw)
+{
+  if (registered)
+    grub_cryptodisk_accel_unregister (&aes_hw_accel);
+}
@@ -0,0 +1,639 @@
+/* argon2.c - Argon2 memory-hard key derivation function.  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Implements Argon2 version 0x13 as specified by RFC 9106.  */
+
+#include <grub/crypto.h>
+#include <grub/mm.h>
+#include <grub/misc.h>
+#include <grub/dl.h>
+#include <grub/safemath.h>
+#include <grub/efi/mp.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+#define ARGON2_VERSION		0x13
+#define ARGON2_BLOCK_SIZE	1024
+#define ARGON2_QWORDS		(ARGON2_BLOCK_SIZE / 8)
+#define ARGON2_SYNC_POINTS	4
+#define ARGON2_PREHASH_SIZE	64
+#define ARGON2_ADDRESSES	ARGON2_QWORDS
+#define ARGON2_MAX_LANES	0xffffff
+
+#define BLAKE2B_BLOCK_SIZE	128
+#define BLAKE2B_OUT_SIZE	64
+
+struct blake2b_ctx
+{
+  grub_uint64_t h[8];
+  grub_uint64_t t[2];
+  grub_uint8_t buf[BLAKE2B_BLOCK_SIZE];
+  grub_size_t buflen;
+  grub_size_t outlen;
+};
+
+struct argon2_block
+{
+  grub_uint64_t v[ARGON2_QWORDS];
+};
+
+struct argon2_instance
+{
+  struct argon2_block *memory;
+  grub_uint32_t passes;
+  grub_uint32_t lanes;
+  grub_uint32_t lane_length;
+  grub_uint32_t segment_length;
+  grub_uint32_t blocks;
+  int type;
+};
+
+static const grub_uint64_t blake2b_iv[8] =
+  {
+    0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL,
+    0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+    0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL,
+    0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL
+  };
+
+static const grub_uint8_t blake2b_sigma[12][16] =
+  {
+    {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+    { 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 },
+    { 11,  8, 12,  0,  5,  2, 15, 13, 10, 14,  3,  6,  7,  1,  9,  4 },
+    {  7,  9,  3,  1, 13, 12, 11, 14,  2,  6,  5, 10,  4,  0, 15,  8 },
+    {  9,  0,  5,  7,  2,  4, 10, 15, 14,  1, 11, 12,  6,  8,  3, 13 },
+    {  2, 12,  6, 10,  0, 11,  8,  3,  4, 13,  7,  5, 15, 14,  1,  9 },
+    { 12,  5,  1, 15, 14, 13,  4, 10,  0,  7,  6,  3,  9,  2,  8, 11 },
+    { 13, 11,  7, 14, 12,  1,  3,  9,  5,  0, 15,  4,  8,  6,  2, 10 },
+    {  6, 15, 14,  9, 11,  3,  0,  8, 12,  2, 13,  7,  1,  4, 10,  5 },
+    { 10,  2,  8,  4,  7,  6,  1,  5, 15, 11,  9, 14,  3, 12, 13,  0 },
+    {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+    { 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 }
+  };
+
+static inline grub_uint64_t
+rotr64 (grub_uint64_t x, unsigned n)
+{
+  return (x >> n) | (x << (64 - n));
+}
+
+#define BLAKE2B_G(a, b, c, d, x, y)		\
+  do						\
+    {						\
+      a = a + b + (x);				\
+      d = rotr64 (d ^ a, 32);			\
+      c = c + d;				\
+      b = rotr64 (b ^ c, 24);			\
+      a = a + b + (y);				\
+      d = rotr64 (d ^ a, 16);			\
+      c = c + d;				\
+      b = rotr64 (b ^ c, 63);			\
+    }						\
+  while (0)
+
+static void
+blake2b_compress (struct blake2b_ctx *ctx, const grub_uint8_t *block,
+		  int last)
+{
+  grub_uint64_t m[16], v[16];
+  unsigned i;
+
+  for (i = 0; i < 16; i++)
+    m[i] = grub_le_to_cpu64 (grub_get_unaligned64 (block + 8 * i));
+  for (i = 0; i < 8; i++)
+    {
+      v[i] = ctx->h[i];
+      v[i + 8] = blake2b_iv[i];
+    }
+  v[12] ^= ctx->t[0];
+  v[13] ^= ctx->t[1];
+  if (last)
+    v[14] = ~v[14];
+
+  for (i = 0; i < 12; i++)
+    {
+      const grub_uint8_t *s = blake2b_sigma[i];
+
+      BLAKE2B_G (v[0], v[4], v[8], v[12], m[s[0]], m[s[1]]);
+      BLAKE2B_G (v[1], v[5], v[9], v[13], m[s[2]], m[s[3]]);
+      BLAKE2B_G (v[2], v[6], v[10], v[14], m[s[4]], m[s[5]]);
+      BLAKE2B_G (v[3], v[7], v[11], v[15], m[s[6]], m[s[7]]);
+      BLAKE2B_G (v[0], v[5], v[10], v[15], m[s[8]], m[s[9]]);
+      BLAKE2B_G (v[1], v[6], v[11], v[12], m[s[10]], m[s[11]]);
+      BLAKE2B_G (v[2], v[7], v[8], v[13], m[s[12]], m[s[13]]);
+      BLAKE2B_G (v[3], v[4], v[9], v[14], m[s[14]], m[s[15]]);
+    }
+
+  for (i = 0; i < 8; i++)
+    ctx->h[i] ^= v[i] ^ v[i + 8];
+}
+
+static void
+blake2b_init (struct blake2b_ctx *ctx, grub_size_t outlen)
+{
+  unsigned i;
+
+  for (i = 0; i < 8; i++)
+    ctx->h[i] = blake2b_iv[i];
+  /* Unkeyed, sequential mode, digest length OUTLEN.  */
+  ctx->h[0] ^= 0x01010000 | outlen;
+  ctx->t[0] = ctx->t[1] = 0;
+  ctx->buflen = 0;
+  ctx->outlen = outlen;
+}
+
+static void
+blake2b_update (struct blake2b_ctx *ctx, const void *data, grub_size_t len)
+{
+  const grub_uint8_t *in = data;
+
+  while (len)
+    {
+      grub_size_t n;
+
+      /* The last block is compressed by blake2b_final.  */
+      if (ctx->buflen == BLAKE2B_BLOCK_SIZE)
+	{
+	  ctx->t[0] += BLAKE2B_BLOCK_SIZE;
+	  if (ctx->t[0] < BLAKE2B_BLOCK_SIZE)
+	    ctx->t[1]++;
+	  blake2b_compress (ctx, ctx->buf, 0);
+	  ctx->buflen = 0;
+	}
+
+      n = grub_min (len, BLAKE2B_BLOCK_SIZE - ctx->buflen);
+      grub_memcpy (ctx->buf + ctx->buflen, in, n);
+      ctx->buflen += n;
+      in += n;
+      len -= n;
+    }
+}
+
+static void
+blake2b_final (struct blake2b_ctx *ctx, grub_uint8_t *out)
+{
+  grub_uint8_t digest[BLAKE2B_OUT_SIZE];
+  unsigned i;
+
+  ctx->t[0] += ctx->buflen;
+  if (ctx->t[0] < ctx->buflen)
+    ctx->t[1]++;
+  grub_memset (ctx->buf + ctx->buflen, 0, BLAKE2B_BLOCK_SIZE - ctx->buflen);
+  blake2b_compress (ctx, ctx->buf, 1);
+
+  for (i = 0; i < 8; i++)
+    grub_set_unaligned64 (digest + 8 * i, grub_cpu_to_le64 (ctx->h[i]));
+  grub_memcpy (out, digest, ctx->outlen);
+  grub_memset (digest, 0, sizeof (digest));
+  grub_memset (ctx, 0, sizeof (*ctx));
+}
+
+static void
+blake2b_le32 (struct blake2b_ctx *ctx, grub_uint32_t x)
+{
+  grub_uint32_t le = grub_cpu_to_le32 (x);
+
+  blake2b_update (ctx, &le, sizeof (le));
+}
+
+/* The variable-length hash H' of RFC 9106, section 3.3.  */
+static void
+blake2b_long (grub_uint8_t *out, grub_size_t outlen,
+	      const void *in, grub_size_t inlen)
+{
+  grub_uint8_t v[BLAKE2B_OUT_SIZE];
+  struct blake2b_ctx ctx;
+
+  blake2b_init (&ctx, grub_min (outlen, (grub_size_t) BLAKE2B_OUT_SIZE));
+  blake2b_le32 (&ctx, outlen);
+  blake2b_update (&ctx, in, inlen);
+
+  if (outlen <= BLAKE2B_OUT_SIZE)
+    {
+      blake2b_final (&ctx, out);
+      return;
+    }
+
+  blake2b_final (&ctx, v);
+  grub_memcpy (out, v, BLAKE2B_OUT_SIZE / 2);
+  out += BLAKE2B_OUT_SIZE / 2;
+  outlen -= BLAKE2B_OUT_SIZE / 2;
+
+  while (outlen > BLAKE2B_OUT_SIZE)
+    {
+      blake2b_init (&ctx, BLAKE2B_OUT_SIZE);
+      blake2b_update (&ctx, v, BLAKE2B_OUT_SIZE);
+      blake2b_final (&ctx, v);
+      grub_memcpy (out, v, BLAKE2B_OUT_SIZE / 2);
+      out += BLAKE2B_OUT_SIZE / 2;
+      outlen -= BLAKE2B_OUT_SIZE / 2;
+    }
+
+  blake2b_init (&ctx, outlen);
+  blake2b_update (&ctx, v, BLAKE2B_OUT_SIZE);
+  blake2b_final (&ctx, out);
+  grub_memset (v, 0, sizeof (v));
+}
+
+/* The multiply-hardened BlaMka function replacing additions in G.  */
+static inline grub_uint64_t
+blamka (grub_uint64_t x, grub_uint64_t y)
+{
+  return x + y + 2 * ((x & 0xffffffff) * (y & 0xffffffff));
+}
+
+#define ARGON2_G(a, b, c, d)			\
+  do						\
+    {						\
+      a = blamka (a, b);			\
+      d = rotr64 (d ^ a, 32);			\
+      c = blamka (c, d);			\
+      b = rotr64 (b ^ c, 24);			\
+      a = blamka (a, b);			\
+      d = rotr64 (d ^ a, 16);			\
+      c = blamka (c, d);			\
+      b = rotr64 (b ^ c, 63);			\
+    }						\
+  while (0)
+
+/*
+ * The permutation P on eight pairs of words, the pairs starting at V[I0],
+ * V[I0 + STEP], ...  Rows use consecutive pairs, columns pairs that are 16
+ * words apart.
+ */
+#define ARGON2_P(v, i0, step)						\
+  do									\
+    {									\
+      grub_uint64_t *w0 = (v) + (i0), *w1 = w0 + (step);		\
+      grub_uint64_t *w2 = w1 + (step), *w3 = w2 + (step);		\
+      grub_uint64_t *w4 = w3 + (step), *w5 = w4 + (step);		\
+      grub_uint64_t *w6 = w5 + (step), *w7 = w6 + (step);		\
+									\
+      ARGON2_G (w0[0], w2[0], w4[0], w6[0]);				\
+      ARGON2_G (w0[1], w2[1], w4[1], w6[1]);		\
+      ARGON2_G (w1[0], w3[0], w5[0], w7[0]);				\
+      ARGON2_G (w1[1], w3[1], w5[1], w7[1]);		\
+      ARGON2_G (w0[0], w2[1], w5[0], w7[1]);			\
+      ARGON2_G (w0[1], w3[0], w5[1], w6[0]);			\
+      ARGON2_G (w1[0], w3[1], w4[0], w6[1]);			\
+      ARGON2_G (w1[1], w2[0], w4[1], w7[0]);			\
+    }									\
+  while (0)
+
+/*
+ * The compression function G of RFC 9106, section 3.5: NEXT becomes
+ * P (PREV ^ REF) ^ PREV ^ REF, further XORed with the old NEXT when
+ * WITH_XOR is set.  Only one block of scratch space is needed.
+ */
+static void
+fill_block (const struct argon2_block *prev, const struct argon2_block *ref,
+	    struct argon2_block *next, int with_xor)
+{
+  struct argon2_block r;
+  unsigned i;
+
+  for (i = 0; i < ARGON2_QWORDS; i++)
+    r.v[i] = prev->v[i] ^ ref->v[i];
+
+  /* Set NEXT aside as R, or R ^ NEXT, before R gets permuted.  */
+  if (with_xor)
+    for (i = 0; i < ARGON2_QWORDS; i++)
+      next->v[i] ^= r.v[i];
+  else
+    for (i = 0; i < ARGON2_QWORDS; i++)
+      next->v[i] = r.v[i];
+
+  for (i = 0; i < 8; i++)
+    ARGON2_P (r.v, 16 * i, 2);
+  for (i = 0; i < 8; i++)
+    ARGON2_P (r.v, 2 * i, 16);
+
+  for (i = 0; i < ARGON2_QWORDS; i++)
+    next->v[i] ^= r.v[i];
+
+  grub_memset (&r, 0, sizeof (r));
+}
+
+static void
+next_addresses (struct argon2_block *addresses, struct argon2_block *input,
+		const struct argon2_block *zero)
+{
+  input->v[6]++;
+  fill_block (zero, input, addresses, 0);
+  fill_block (zero, addresses, addresses, 0);
+}
+
+/* Map the pseudo-random J1 to a block of the reference area.  */
+static grub_uint32_t
+index_alpha (const struct argon2_instance *inst, grub_uint32_t pass,
+	     grub_uint32_t slice, grub_uint32_t index, grub_uint32_t j1,
+	     int same_lane)
+{
+  grub_uint32_t area, start = 0;
+  grub_uint64_t pos;
+
+  if (pass == 0)
+    {
+      if (slice == 0)
+	area = index - 1;
+      else if (same_lane)
+	area = slice * inst->segment_length + index - 1;
+      else
+	area = slice * inst->segment_length - (index == 0);
+    }
+  else
+    {
+      if (same_lane)
+	area = inst->lane_length - inst->segment_length + index - 1;
+      else
+	area = inst->lane_length - inst->segment_length - (index == 0);
+      if (slice != ARGON2_SYNC_POINTS - 1)
+	start = (slice + 1) * inst->segment_length;
+    }
+
+  pos = j1;
+  pos = (pos * pos) >> 32;
+  pos = area - 1 - ((area * pos) >> 32);
+
+  return (start + pos) % inst->lane_length;
+}
+
+static void
+fill_segment (const struct argon2_instance *inst, grub_uint32_t pass,
+	      grub_uint32_t lane, grub_uint32_t slice)
+{
+  struct argon2_block *addresses = NULL, *input = NULL, *zero = NULL;
+  grub_uint32_t start = 0, index, curr, prev;
+  int independent;
+
+  independent = (inst->type == GRUB_CRYPTO_ARGON2I
+		 || (inst->type == GRUB_CRYPTO_ARGON2ID && pass == 0
+		     && slice < ARGON2_SYNC_POINTS / 2));
+
+  if (independent)
+    {
+      /* The three scratch blocks of each lane follow the memory area, so
+	 that lanes can be filled at the same time.  */
+      addresses = inst->memory + inst->blocks + 3 * lane;
+      input = addresses + 1;
+      zero = addresses + 2;
+      grub_memset (addresses, 0, 3 * sizeof (*addresses));
+      input->v[0] = pass;
+      input->v[1] = lane;
+      input->v[2] = slice;
+      input->v[3] = inst->blocks;
+      input->v[4] = inst->passes;
+      input->v[5] = inst->type;
+    }
+
+  /* The first two blocks of each lane are already set.  */
+  if (pass == 0 && slice == 0)
+    {
+      start = 2;
+      if (independent)
+	next_addresses (addresses, input, zero);
+    }
+
+  curr = lane * inst->lane_length + slice * inst->segment_length + start;
+  if (curr % inst->lane_length == 0)
+    prev = curr + inst->lane_length - 1;
+  else
+    prev = curr - 1;
+
+  for (index = start; index < inst->segment_length; index++, curr++, prev++)
+    {
+      grub_uint64_t pseudo_rand;
+      grub_uint32_t ref_lane, ref_index;
+
+      if (curr % inst->lane_length == 1)
+	prev = curr - 1;
+
+      if (independent)
+	{
+	  if (index % ARGON2_ADDRESSES == 0)
+	    next_addresses (addresses, input, zero);
+	  pseudo_rand = addresses->v[index % ARGON2_ADDRESSES];
+	}
+      else
+	pseudo_rand = inst->memory[prev].v[0];
+
+      if (pass == 0 && slice == 0)
+	ref_lane = lane;
+      else
+	ref_lane = (pseudo_rand >> 32) % inst->lanes;
+
+      ref_index = index_alpha (inst, pass, slice, index,
+			       pseudo_rand & 0xffffffff, ref_lane == lane);
+
+      fill_block (inst->memory + prev,
+		  inst->memory + inst->lane_length * ref_lane + ref_index,
+		  inst->memory + curr, pass != 0);
+    }
+}
+
+/* The segments of one slice, one per lane.  */
+struct argon2_slice
+{
+  const struct argon2_instance *inst;
+  grub_uint32_t pass;
+  grub_uint32_t slice;
+};
+
+static void
+fill_segment_job (void *data, grub_size_t lane,
+		  int on_ap __attribute__ ((unused)))
+{
+  struct argon2_slice *s = data;
+
+  fill_segment (s->inst, s->pass, lane, s->slice);
+}
+
+static void
+block_from_bytes (struct argon2_block *b, const grub_uint8_t *bytes)
+{
+  unsigned i;
+
+  for (i = 0; i < ARGON2_QWORDS; i++)
+    b->v[i] = grub_le_to_cpu64 (grub_get_unaligned64 (bytes + 8 * i));
+}
+
+static void
+block_to_bytes (grub_uint8_t *bytes, const struct argon2_block *b)
+{
+  unsigned i;
+
+  for (i = 0; i < ARGON2_QWORDS; i++)
+    grub_set_unaligned64 (bytes + 8 * i, grub_cpu_to_le64 (b->v[i]));
+}
+
+static void
+initial_hash (grub_uint8_t *h0, int type, grub_uint32_t t_cost,
+	      grub_uint32_t m_cost, grub_uint32_t lanes, grub_size_t dkLen,
+	      const grub_uint8_t *P, grub_size_t Plen,
+	      const grub_uint8_t *S, grub_size_t Slen)
+{
+  struct blake2b_ctx ctx;
+
+  blake2b_init (&ctx, ARGON2_PREHASH_SIZE);
+  blake2b_le32 (&ctx, lanes);
+  blake2b_le32 (&ctx, dkLen);
+  blake2b_le32 (&ctx, m_cost);
+  blake2b_le32 (&ctx, t_cost);
+  blake2b_le32 (&ctx, ARGON2_VERSION);
+  blake2b_le32 (&ctx, type);
+  blake2b_le32 (&ctx, Plen);
+  blake2b_update (&ctx, P, Plen);
+  blake2b_le32 (&ctx, Slen);
+  blake2b_update (&ctx, S, Slen);
+  /* No secret and no associated data.  */
+  blake2b_le32 (&ctx, 0);
+  blake2b_le32 (&ctx, 0);
+  blake2b_final (&ctx, h0);
+}
+
+/* Implement Argon2 version 0x13 as per RFC 9106.  */
+grub_size_t
+grub_crypto_argon2_memsize (grub_uint32_t m_cost, grub_uint32_t parallelism)
+{
+  grub_size_t blocks, memsize;
+
+  if (parallelism < 1 || parallelism > ARGON2_MAX_LANES
+      || m_cost / 8 < parallelism)
+    return 0;
+
+  /*
+   * All the blocks live in one allocation, followed by the scratch blocks
+   * of the data-independent addressing of each lane, rather than one per
+   * block.
+   */
+  blocks = m_cost / (ARGON2_SYNC_POINTS * parallelism)
+	   * ARGON2_SYNC_POINTS * parallelism;
+  if (grub_add (blocks, 3 * (grub_size_t) parallelism, &blocks)
+      || grub_mul (blocks, sizeof (struct argon2_block), &memsize))
+    return 0;
+
+  return memsize;
+}
+
+gcry_err_code_t
+grub_crypto_argon2_prealloc (int type, grub_uint32_t t_cost,
+			     grub_uint32_t m_cost, grub_uint32_t parallelism,
+			     const grub_uint8_t *P, grub_size_t Plen,
+			     const grub_uint8_t *S, grub_size_t Slen,
+			     grub_uint8_t *DK, grub_size_t dkLen,
+			     void *mem)
+{
+  struct argon2_instance inst;
+  struct argon2_slice s;
+  grub_uint8_t h0[ARGON2_PREHASH_SIZE + 8];
+  grub_uint8_t bytes[ARGON2_BLOCK_SIZE];
+  grub_size_t memsize;
+  grub_uint32_t lane;
+
+  memsize = grub_crypto_argon2_memsize (m_cost, parallelism);
+  if (type < GRUB_CRYPTO_ARGON2D || type > GRUB_CRYPTO_ARGON2ID
+      || t_cost < 1 || memsize == 0 || Slen < 8 || dkLen < 4)
+    return GPG_ERR_INV_ARG;
+
+  inst.type = type;
+  inst.passes = t_cost;
+  inst.lanes = parallelism;
+  inst.segment_length = m_cost / (ARGON2_SYNC_POINTS * parallelism);
+  inst.lane_length = inst.segment_length * ARGON2_SYNC_POINTS;
+  inst.blocks = inst.lane_length * parallelism;
+  inst.memory = mem;
+
+  initial_hash (h0, type, t_cost, m_cost, parallelism, dkLen, P, Plen, S, Slen);
+
+ restart:
+  for (lane = 0; lane < inst.lanes; lane++)
+    {
+      grub_uint32_t i;
+
+      grub_set_unaligned32 (h0 + ARGON2_PREHASH_SIZE + 4,
+			    grub_cpu_to_le32 (lane));
+      for (i = 0; i < 2; i++)
+	{
+	  grub_set_unaligned32 (h0 + ARGON2_PREHASH_SIZE,
+				grub_cpu_to_le32 (i));
+	  blake2b_long (bytes, sizeof (bytes), h0, sizeof (h0));
+	  block_from_bytes (inst.memory + lane * inst.lane_length + i, bytes);
+	}
+    }
+
+  /* Lanes only depend on each other at the end of each slice, so the
+     segments of a slice can be filled on several processors.  Should
+     they give up partway, a segment may be half done, so everything is
+     done again from the first blocks, on this processor alone.  */
+  s.inst = &inst;
+  for (s.pass = 0; s.pass < inst.passes; s.pass++)
+    for (s.slice = 0; s.slice < ARGON2_SYNC_POINTS; s.slice++)
+      if (grub_efi_mp_run (fill_segment_job, &s, inst.lanes))
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  goto restart;
+	}
+
+  for (lane = 1; lane < inst.lanes; lane++)
+    {
+      const struct argon2_block *last
+	= inst.memory + lane * inst.lane_length + inst.lane_length - 1;
+      struct argon2_block *final = inst.memory + inst.lane_length - 1;
+      unsigned i;
+
+      for (i = 0; i < ARGON2_QWORDS; i++)
+	final->v[i] ^= last->v[i];
+    }
+
+  block_to_bytes (bytes, inst.memory + inst.lane_length - 1);
+  blake2b_long (DK, dkLen, bytes, sizeof (bytes));
+
+  grub_memset (h0, 0, sizeof (h0));
+  grub_memset (bytes, 0, sizeof (bytes));
+  grub_memset (inst.memory, 0, memsize);
+
+  return GPG_ERR_NO_ERROR;
+}
+
+gcry_err_code_t
+grub_crypto_argon2 (int type, grub_uint32_t t_cost, grub_uint32_t m_cost,
+		    grub_uint32_t parallelism,
+		    const grub_uint8_t *P, grub_size_t Plen,
+		    const grub_uint8_t *S, grub_size_t Slen,
+		    grub_uint8_t *DK, grub_size_t dkLen)
+{
+  gcry_err_code_t err;
+  grub_size_t memsize;
+  void *mem;
+
+  memsize = grub_crypto_argon2_memsize (m_cost, parallelism);
+  if (memsize == 0)
+    return GPG_ERR_INV_ARG;
+
+  mem = grub_malloc (memsize);
+  if (mem == NULL)
+    return GPG_ERR_OUT_OF_MEMORY;
+
+  err = grub_crypto_argon2_prealloc (type, t_cost, m_cost, parallelism,
+				     P, Plen, S, Slen, DK, dkLen, mem);
+  grub_free (mem);
+
+  return err;
+}
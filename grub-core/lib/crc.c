@@ -20,7 +20,16 @@
 #include <grub/types.h>
 #include <grub/lib/crc.h>
 
-static grub_uint32_t crc32c_table [256];
+#if !defined (GRUB_UTIL) && (defined (__i386__) || defined (__x86_64__) \
+			      || defined (__aarch64__))
+#include <grub/dl.h>
+#include <grub/cpufeature.h>
+#define CRC32C_HW 1
+#endif
+
+/* Slicing-by-8: crc32c_table[k][i] is the CRC of byte I followed by K
+   zero bytes.  */
+static grub_uint32_t crc32c_table [8][256];
 
 /* Helper for init_crc32c_table.  */
 static grub_uint32_t
@@ -43,34 +52,207 @@ static void
 init_crc32c_table (void)
 {
   grub_uint32_t polynomial = 0x1edc6f41;
+  grub_uint32_t *t = crc32c_table[0];
   int i, j;
 
   for(i = 0; i < 256; i++)
     {
-      crc32c_table[i] = reflect(i, 8) << 24;
+      t[i] = reflect(i, 8) << 24;
       for (j = 0; j < 8; j++)
-        crc32c_table[i] = (crc32c_table[i] << 1) ^
-            (crc32c_table[i] & (1 << 31) ? polynomial : 0);
-      crc32c_table[i] = reflect(crc32c_table[i], 32);
+        t[i] = (t[i] << 1) ^
+            (t[i] & (1 << 31) ? polynomial : 0);
+      t[i] = reflect(t[i], 32);
     }
+
+  for (j = 1; j < 8; j++)
+    for (i = 0; i < 256; i++)
+      crc32c_table[j][i] = (crc32c_table[j - 1][i] >> 8)
+	^ t[crc32c_table[j - 1][i] & 0xff];
+}
+
+static grub_uint32_t
+crc32c_sw (grub_uint32_t crc, const grub_uint8_t *data, grub_size_t size)
+{
+  grub_uint32_t lo, hi;
+
+  if (! crc32c_table[7][1])
+    init_crc32c_table ();
+
+  for (; size && ((grub_addr_t) data & 7); size--)
+    crc = (crc >> 8) ^ crc32c_table[0][(crc & 0xFF) ^ *data++];
+
+  for (; size >= 8; size -= 8, data += 8)
+    {
+      lo = crc ^ grub_le_to_cpu32 (*(const grub_uint32_t *) data);
+      hi = grub_le_to_cpu32 (*(const grub_uint32_t *) (data + 4));
+      crc = crc32c_table[7][lo & 0xff] ^ crc32c_table[6][(lo >> 8) & 0xff]
+	^ crc32c_table[5][(lo >> 16) & 0xff] ^ crc32c_table[4][lo >> 24]
+	^ crc32c_table[3][hi & 0xff] ^ crc32c_table[2][(hi >> 8) & 0xff]
+	^ crc32c_table[1][(hi >> 16) & 0xff] ^ crc32c_table[0][hi >> 24];
+    }
+
+  for (; size; size--)
+    crc = (crc >> 8) ^ crc32c_table[0][(crc & 0xFF) ^ *data++];
+
+  return crc;
+}
+
+#ifdef CRC32C_HW
+
+#if defined (__i386__) || defined (__x86_64__)
+
+/* The SSE4.2 crc32 instruction works on general purpose registers, so it
+   needs no SIMD state.  */
+static grub_uint32_t
+crc32c_hw_update (grub_uint32_t crc, const grub_uint8_t *data,
+		  grub_size_t size)
+{
+  for (; size && ((grub_addr_t) data & 7); size--)
+    asm ("crc32b %1, %0" : "+r" (crc) : "rm" (*data++));
+
+#ifdef __x86_64__
+  {
+    grub_uint64_t crc64 = crc;
+
+    for (; size >= 8; size -= 8, data += 8)
+      asm ("crc32q %1, %0" : "+r" (crc64)
+	   : "rm" (*(const grub_uint64_t *) data));
+    crc = crc64;
+  }
+#else
+  for (; size >= 4; size -= 4, data += 4)
+    asm ("crc32l %1, %0" : "+r" (crc) : "rm" (*(const grub_uint32_t *) data));
+#endif
+
+  for (; size; size--)
+    asm ("crc32b %1, %0" : "+r" (crc) : "rm" (*data++));
+
+  return crc;
 }
 
+#else
+
+static grub_uint32_t
+crc32c_hw_update (grub_uint32_t crc, const grub_uint8_t *data,
+		  grub_size_t size)
+{
+  asm (".arch_extension crc");
+
+  for (; size && ((grub_addr_t) data & 7); size--)
+    asm ("crc32cb %w0, %w0, %w1" : "+r" (crc) : "r" (*data++));
+
+  for (; size >= 8; size -= 8, data += 8)
+    asm ("crc32cx %w0, %w0, %x1" : "+r" (crc)
+	 : "r" (*(const grub_uint64_t *) data));
+
+  for (; size; size--)
+    asm ("crc32cb %w0, %w0, %w1" : "+r" (crc) : "r" (*data++));
+
+  return crc;
+}
+
+#endif
+
+typedef grub_uint32_t (*crc32c_update_t) (grub_uint32_t crc,
+					  const grub_uint8_t *data,
+					  grub_size_t size);
+
+static struct grub_cpu_dispatch crc32c_dispatch =
+  {
+    .name = "crc32c",
+    .generic = crc32c_sw,
+    .func = crc32c_sw
+  };
+
+static struct grub_cpu_variant crc32c_hw_variant =
+  {
+    .name = "crc32c_hw",
+    .features = GRUB_CPU_FEATURE_CRC32C,
+    .func = crc32c_hw_update
+  };
+#endif
+
 grub_uint32_t
 grub_getcrc32c (grub_uint32_t crc, const void *buf, int size)
 {
-  int i;
+  if (size <= 0)
+    return crc;
+
+  crc^= 0xffffffff;
+
+#ifdef CRC32C_HW
+  return GRUB_CPU_DISPATCH (&crc32c_dispatch, crc32c_update_t)
+    (crc, buf, size) ^ 0xffffffff;
+#endif
+
+  return crc32c_sw (crc, buf, size) ^ 0xffffffff;
+}
+
+/* The CRC-32 of IEEE 802.3, as used by GPT, with the same slicing-by-8
+   tables of the reflected polynomial.  */
+static grub_uint32_t crc32_table [8][256];
+
+static void
+init_crc32_table (void)
+{
+  grub_uint32_t *t = crc32_table[0];
+  grub_uint32_t c;
+  int i, j;
+
+  for (i = 0; i < 256; i++)
+    {
+      c = i;
+      for (j = 0; j < 8; j++)
+	c = (c & 1) ? (c >> 1) ^ 0xedb88320 : c >> 1;
+      t[i] = c;
+    }
+
+  for (j = 1; j < 8; j++)
+    for (i = 0; i < 256; i++)
+      crc32_table[j][i] = (crc32_table[j - 1][i] >> 8)
+	^ t[crc32_table[j - 1][i] & 0xff];
+}
+
+grub_uint32_t
+grub_getcrc32 (grub_uint32_t crc, const void *buf, grub_size_t size)
+{
   const grub_uint8_t *data = buf;
+  grub_uint32_t lo, hi;
 
-  if (! crc32c_table[1])
-    init_crc32c_table ();
+  if (! crc32_table[7][1])
+    init_crc32_table ();
 
-  crc^= 0xffffffff;
+  crc ^= 0xffffffff;
 
-  for (i = 0; i < size; i++)
+  for (; size && ((grub_addr_t) data & 7); size--)
+    crc = (crc >> 8) ^ crc32_table[0][(crc & 0xFF) ^ *data++];
+
+  for (; size >= 8; size -= 8, data += 8)
     {
-      crc = (crc >> 8) ^ crc32c_table[(crc & 0xFF) ^ *data];
-      data++;
+      lo = crc ^ grub_le_to_cpu32 (*(const grub_uint32_t *) data);
+      hi = grub_le_to_cpu32 (*(const grub_uint32_t *) (data + 4));
+      crc = crc32_table[7][lo & 0xff] ^ crc32_table[6][(lo >> 8) & 0xff]
+	^ crc32_table[5][(lo >> 16) & 0xff] ^ crc32_table[4][lo >> 24]
+	^ crc32_table[3][hi & 0xff] ^ crc32_table[2][(hi >> 8) & 0xff]
+	^ crc32_table[1][(hi >> 16) & 0xff] ^ crc32_table[0][hi >> 24];
     }
 
+  for (; size; size--)
+    crc = (crc >> 8) ^ crc32_table[0][(crc & 0xFF) ^ *data++];
+
   return crc ^ 0xffffffff;
 }
+
+#ifdef CRC32C_HW
+GRUB_MOD_INIT (crc)
+{
+  grub_cpu_dispatch_register (&crc32c_dispatch);
+  grub_cpu_variant_register (&crc32c_dispatch, &crc32c_hw_variant);
+}
+
+GRUB_MOD_FINI (crc)
+{
+  grub_cpu_variant_unregister (&crc32c_dispatch, &crc32c_hw_variant);
+  grub_cpu_dispatch_unregister (&crc32c_dispatch);
+}
+#endif
@@ -23,7 +23,9 @@
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
-static grub_uint64_t crc64_table [256];
+/* Slicing-by-8: crc64_table[k][i] is the CRC of byte I followed by K zero
+   bytes.  */
+static grub_uint64_t crc64_table [8][256];
 
 /* Helper for init_crc64_table.  */
 static grub_uint64_t
@@ -46,24 +48,30 @@ static void
 init_crc64_table (void)
 {
   grub_uint64_t polynomial = 0x42f0e1eba9ea3693ULL;
+  grub_uint64_t *t = crc64_table[0];
   int i, j;
 
   for(i = 0; i < 256; i++)
     {
-      crc64_table[i] = reflect(i, 8) << 56;
+      t[i] = reflect(i, 8) << 56;
       for (j = 0; j < 8; j++)
 	{
-	  crc64_table[i] = (crc64_table[i] << 1) ^
-            (crc64_table[i] & (1ULL << 63) ? polynomial : 0);
+	  t[i] = (t[i] << 1) ^
+            (t[i] & (1ULL << 63) ? polynomial : 0);
 	}
-      crc64_table[i] = reflect(crc64_table[i], 64);
+      t[i] = reflect(t[i], 64);
     }
+
+  for (j = 1; j < 8; j++)
+    for (i = 0; i < 256; i++)
+      crc64_table[j][i] = (crc64_table[j - 1][i] >> 8)
+	^ t[crc64_table[j - 1][i] & 0xff];
 }
 
 static void
 crc64_init (void *context)
 {
-  if (! crc64_table[1])
+  if (! crc64_table[7][1])
     init_crc64_table ();
   *(grub_uint64_t *) context = 0;
 }
@@ -71,16 +79,26 @@ crc64_init (void *context)
 static void
 crc64_write (void *context, const void *buf, grub_size_t size)
 {
-  unsigned i;
   const grub_uint8_t *data = buf;
   grub_uint64_t crc = ~grub_le_to_cpu64 (*(grub_uint64_t *) context);
+  grub_uint32_t lo, hi;
+
+  for (; size && ((grub_addr_t) data & 7); size--)
+    crc = (crc >> 8) ^ crc64_table[0][(crc & 0xFF) ^ *data++];
 
-  for (i = 0; i < size; i++)
+  for (; size >= 8; size -= 8, data += 8)
     {
-      crc = (crc >> 8) ^ crc64_table[(crc & 0xFF) ^ *data];
-      data++;
+      lo = crc ^ grub_le_to_cpu32 (*(const grub_uint32_t *) data);
+      hi = (crc >> 32) ^ grub_le_to_cpu32 (*(const grub_uint32_t *) (data + 4));
+      crc = crc64_table[7][lo & 0xff] ^ crc64_table[6][(lo >> 8) & 0xff]
+	^ crc64_table[5][(lo >> 16) & 0xff] ^ crc64_table[4][lo >> 24]
+	^ crc64_table[3][hi & 0xff] ^ crc64_table[2][(hi >> 8) & 0xff]
+	^ crc64_table[1][(hi >> 16) & 0xff] ^ crc64_table[0][hi >> 24];
     }
 
+  for (; size; size--)
+    crc = (crc >> 8) ^ crc64_table[0][(crc & 0xFF) ^ *data++];
+
   *(grub_uint64_t *) context = grub_cpu_to_le64 (~crc);
 }
 
@@ -36,6 +36,9 @@ struct grub_crypto_hmac_handle
 
 static gcry_cipher_spec_t *grub_ciphers = NULL;
 static gcry_md_spec_t *grub_digests = NULL;
+/* Digests running on CPU extensions, only handed out by
+   grub_crypto_md_accel.  */
+static gcry_md_spec_t *grub_digests_accel = NULL;
 
 void (*grub_crypto_autoload_hook) (const char *name) = NULL;
 
@@ -121,6 +124,60 @@ grub_md_unregister (gcry_md_spec_t *cipher)
       }
 }
 
+void
+grub_md_accel_register (gcry_md_spec_t *digest)
+{
+  digest->next = grub_digests_accel;
+  grub_digests_accel = digest;
+}
+
+void
+grub_md_accel_unregister (gcry_md_spec_t *digest)
+{
+  gcry_md_spec_t **md;
+  for (md = &grub_digests_accel; *md; md = &((*md)->next))
+    if (*md == digest)
+      {
+	*md = (*md)->next;
+	break;
+      }
+}
+
+const gcry_md_spec_t *
+grub_crypto_md_accel (const gcry_md_spec_t *hash)
+{
+  const gcry_md_spec_t *md;
+
+#ifndef GRUB_UTIL
+  static int tried;
+
+  if (!tried)
+    {
+      tried = 1;
+      grub_dl_load ("sha_hw");
+      grub_errno = GRUB_ERR_NONE;
+    }
+#endif
+
+  for (md = grub_digests_accel; md; md = md->next)
+    if (grub_strcasecmp (hash->name, md->name) == 0
+	&& md->mdlen == hash->mdlen)
+      return md;
+  return hash;
+}
+
+const gcry_md_spec_t *
+grub_crypto_md_soft (const gcry_md_spec_t *hash)
+{
+  const gcry_md_spec_t *md;
+
+  for (md = grub_digests; md; md = md->next)
+    if (grub_strcasecmp (hash->name, md->name) == 0
+	&& md->mdlen == hash->mdlen)
+      return md;
+  return hash;
+}
+
 void
 grub_crypto_hash (const gcry_md_spec_t *hash, void *out, const void *in,
 		  grub_size_t inlen)
@@ -144,7 +201,7 @@ grub_crypto_lookup_md_by_name (const char *name)
     {
       for (md = grub_digests; md; md = md->next)
 	if (grub_strcasecmp (name, md->name) == 0)
-	  return md;
+	  return grub_crypto_md_accel (md);
       if (grub_crypto_autoload_hook && first)
 	grub_crypto_autoload_hook (name);
       else
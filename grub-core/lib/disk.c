@@ -30,36 +30,66 @@ GRUB_MOD_LICENSE ("GPLv3+");
 
 #include "../kern/disk_common.c"
 
+/* Largest write, in bytes, merged with the partial sectors at its ends
+   into one device call.  */
+#define GRUB_DISK_WRITE_MERGE_MAX	(GRUB_DISK_SECTOR_SIZE << GRUB_DISK_CACHE_BITS)
+
+/* Bring the cached copy of the SIZE bytes at SECTOR up to date with DATA,
+   so that writing does not cost the cache what it holds.  */
 static void
-grub_disk_cache_invalidate (unsigned long dev_id, unsigned long disk_id,
-			    grub_disk_addr_t sector)
+grub_disk_cache_update (grub_disk_t disk, grub_disk_addr_t sector,
+			const char *data, grub_size_t size)
 {
-  unsigned cache_index;
   struct grub_disk_cache *cache;
+  grub_disk_addr_t start;
+  grub_size_t off, len;
 
-  sector &= ~((grub_disk_addr_t) GRUB_DISK_CACHE_SIZE - 1);
-  cache_index = grub_disk_cache_get_index (dev_id, disk_id, sector);
-  cache = grub_disk_cache_table + cache_index;
-
-  if (cache->dev_id == dev_id && cache->disk_id == disk_id
-      && cache->sector == sector && cache->data)
+  while (size)
     {
-      cache->lock = 1;
-      grub_free (cache->data);
-      cache->data = 0;
-      cache->lock = 0;
+      start = sector & ~((grub_disk_addr_t) GRUB_DISK_CACHE_SIZE - 1);
+      off = (sector - start) << GRUB_DISK_SECTOR_BITS;
+      len = (GRUB_DISK_SECTOR_SIZE << GRUB_DISK_CACHE_BITS) - off;
+      if (len > size)
+	len = size;
+
+      cache = grub_disk_cache_lookup (disk->dev->id, disk->id, start);
+      if (cache)
+	grub_memcpy (cache->data + off, data, len);
+
+      sector += len >> GRUB_DISK_SECTOR_BITS;
+      data += len;
+      size -= len;
     }
 }
 
+/* Read the whole device sector at SECTOR, relative to the disk, into BUF.  */
+static grub_err_t
+grub_disk_write_fill (grub_disk_t disk, grub_disk_addr_t sector, char *buf)
+{
+  grub_partition_t part;
+  grub_err_t err;
+
+  part = disk->partition;
+  disk->partition = 0;
+  err = grub_disk_read (disk, sector, 0, 1U << disk->log_sector_size, buf);
+  disk->partition = part;
+
+  return err;
+}
+
 grub_err_t
 grub_disk_write (grub_disk_t disk, grub_disk_addr_t sector,
 		 grub_off_t offset, grub_size_t size, const void *buf)
 {
   unsigned real_offset;
   grub_disk_addr_t aligned_sector;
+  grub_size_t sector_size, max_n;
+  unsigned spb;
 
   grub_dprintf ("disk", "Writing `%s'...\n", disk->name);
 
+  grub_disk_generation++;
+
   if (grub_disk_adjust_range (disk, &sector, &offset, size) != GRUB_ERR_NONE)
     return -1;
 
@@ -68,85 +98,84 @@ grub_disk_write (grub_disk_t disk, grub_disk_addr_t sector,
   real_offset = offset + ((sector - aligned_sector) << GRUB_DISK_SECTOR_BITS);
   sector = aligned_sector;
 
+  sector_size = 1U << disk->log_sector_size;
+  spb = 1U << (disk->log_sector_size - GRUB_DISK_SECTOR_BITS);
+  max_n = (disk->max_agglomerate
+	   << (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS
+	       - disk->log_sector_size));
+  if (max_n == 0)
+    max_n = 1;
+
   while (size)
     {
-      if (real_offset != 0 || (size < (1U << disk->log_sector_size)
-			       && size != 0))
+      grub_size_t n, len;
+      const char *data = buf;
+      char *tmp_buf = NULL;
+      int head, tail;
+
+      /* The device sectors the rest of the write touches.  */
+      n = (real_offset + size + sector_size - 1) >> disk->log_sector_size;
+      if (n > max_n)
+	n = max_n;
+      len = (n << disk->log_sector_size) - real_offset;
+      if (len > size)
+	len = size;
+
+      head = (real_offset != 0);
+      tail = ((real_offset + len) & (sector_size - 1)) != 0;
+
+      /* Partial sectors at either end are read and merged with the data in
+	 between, so that the whole write is one device call.  Past the
+	 merge limit, a partial sector is written on its own.  */
+      if ((head || tail) && n > 1
+	  && (n << disk->log_sector_size) > GRUB_DISK_WRITE_MERGE_MAX)
 	{
-	  char *tmp_buf;
-	  grub_size_t len;
-	  grub_partition_t part;
+	  if (head)
+	    n = 1;
+	  else
+	    n--;
+	  len = (n << disk->log_sector_size) - real_offset;
+	  if (len > size)
+	    len = size;
+	  tail = ((real_offset + len) & (sector_size - 1)) != 0;
+	}
 
-	  tmp_buf = grub_malloc (1U << disk->log_sector_size);
+      if (head || tail)
+	{
+	  tmp_buf = grub_malloc (n << disk->log_sector_size);
 	  if (!tmp_buf)
 	    return grub_errno;
 
-	  part = disk->partition;
-	  disk->partition = 0;
-	  if (grub_disk_read (disk, sector,
-			      0, (1U << disk->log_sector_size), tmp_buf)
-	      != GRUB_ERR_NONE)
-	    {
-	      disk->partition = part;
-	      grub_free (tmp_buf);
-	      goto finish;
-	    }
-	  disk->partition = part;
-
-	  len = (1U << disk->log_sector_size) - real_offset;
-	  if (len > size)
-	    len = size;
+	  if (head && grub_disk_write_fill (disk, sector, tmp_buf))
+	    goto fail;
+	  if (tail && (n > 1 || !head)
+	      && grub_disk_write_fill (disk, sector + (n - 1) * spb,
+				       tmp_buf + ((n - 1)
+						  << disk->log_sector_size)))
+	    goto fail;
 
 	  grub_memcpy (tmp_buf + real_offset, buf, len);
+	  data = tmp_buf;
+	}
 
-	  grub_disk_cache_invalidate (disk->dev->id, disk->id, sector);
+      if ((disk->dev->disk_write) (disk, grub_disk_to_native_sector (disk, sector),
+				   n, data) != GRUB_ERR_NONE)
+	goto fail;
 
-	  if ((disk->dev->disk_write) (disk, grub_disk_to_native_sector (disk, sector),
-				       1, tmp_buf) != GRUB_ERR_NONE)
-	    {
-	      grub_free (tmp_buf);
-	      goto finish;
-	    }
+      grub_disk_cache_update (disk, sector, data, n << disk->log_sector_size);
+      grub_free (tmp_buf);
 
-	  grub_free (tmp_buf);
+      sector += n * spb;
+      buf = (const char *) buf + len;
+      size -= len;
+      real_offset = 0;
+      continue;
 
-	  sector += (1U << (disk->log_sector_size - GRUB_DISK_SECTOR_BITS));
-	  buf = (const char *) buf + len;
-	  size -= len;
-	  real_offset = 0;
-	}
-      else
-	{
-	  grub_size_t len;
-	  grub_size_t n;
-
-	  len = size & ~((1ULL << disk->log_sector_size) - 1);
-	  n = size >> disk->log_sector_size;
-
-	  if (n > (disk->max_agglomerate
-		   << (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS
-		       - disk->log_sector_size)))
-	    n = (disk->max_agglomerate
-		 << (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS
-		     - disk->log_sector_size));
-
-	  if ((disk->dev->disk_write) (disk, grub_disk_to_native_sector (disk, sector),
-				       n, buf) != GRUB_ERR_NONE)
-	    goto finish;
-
-	  while (n--)
-	    {
-	      grub_disk_cache_invalidate (disk->dev->id, disk->id, sector);
-	      sector += (1U << (disk->log_sector_size - GRUB_DISK_SECTOR_BITS));
-	    }
-
-	  buf = (const char *) buf + len;
-	  size -= len;
-	}
+    fail:
+      grub_free (tmp_buf);
+      break;
     }
 
- finish:
-
   return grub_errno;
 }
 
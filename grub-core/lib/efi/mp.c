@@ -0,0 +1,193 @@
+/* mp.c - run jobs on the processors of EFI MP services.  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/efi/mp.h>
+#include <grub/efi/api.h>
+#include <grub/efi/efi.h>
+#include <grub/dl.h>
+#include <grub/env.h>
+#include <grub/err.h>
+#include <grub/misc.h>
+#include <grub/mm.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+static grub_guid_t mp_services_guid = GRUB_EFI_MP_SERVICES_PROTOCOL_GUID;
+
+/* How long the APs get to run their jobs.  A KDF tuned for a second or
+   two on one processor fits well within it.  */
+#define MP_TIMEOUT_US	60000000
+
+/* Set while the APs run jobs.  A job that calls grub_efi_mp_run () itself
+   then gets its jobs run in place, without touching the firmware.  */
+static volatile int mp_busy;
+
+/* Set once the APs didn't finish in time, after which they are not used
+   again.  */
+static int mp_broken;
+
+#define MP_JOB_STARTED	1
+#define MP_JOB_DONE	2
+
+struct mp_run
+{
+  grub_efi_mp_services_t *mp;
+  grub_efi_mp_job_t job;
+  void *data;
+  grub_size_t n;
+  grub_efi_uintn_t nprocs;
+  grub_efi_uintn_t bsp;
+  /* MP_JOB_STARTED or MP_JOB_DONE for the jobs that were run.  */
+  volatile grub_uint8_t *state;
+};
+
+/* The MP services, if they are to be used: only when efi_mp is set to 1,
+   and not after the APs failed once.  */
+static grub_efi_mp_services_t *
+mp_services (grub_efi_uintn_t *nprocs, grub_efi_uintn_t *nenabled)
+{
+  grub_efi_mp_services_t *mp;
+  const char *val;
+
+  val = grub_env_get ("efi_mp");
+  if (mp_broken || val == NULL || grub_strcmp (val, "1") != 0)
+    return NULL;
+
+  mp = grub_efi_locate_protocol (&mp_services_guid, NULL);
+  if (mp == NULL)
+    return NULL;
+
+  if (mp->get_number_of_processors (mp, nprocs, nenabled) != GRUB_EFI_SUCCESS
+      || *nenabled < 2)
+    return NULL;
+
+  return mp;
+}
+
+grub_size_t
+grub_efi_mp_processors (void)
+{
+  grub_efi_uintn_t nprocs, nenabled;
+
+  if (mp_services (&nprocs, &nenabled) == NULL)
+    return 1;
+
+  return nenabled;
+}
+
+/*
+ * Run on every processor.  Job I belongs to processor number I modulo the
+ * number of processors, so no atomics are needed to share them out.  The
+ * jobs of processors that never ran are left to the BSP.
+ */
+static void __grub_efi_api
+mp_procedure (void *arg)
+{
+  struct mp_run *r = arg;
+  grub_efi_uintn_t self;
+  grub_size_t i;
+
+  /* One of the few services APs may call.  */
+  if (r->mp->who_am_i (r->mp, &self) != GRUB_EFI_SUCCESS)
+    return;
+
+  for (i = self; i < r->n; i += r->nprocs)
+    {
+      r->state[i] = MP_JOB_STARTED;
+      r->job (r->data, i, self != r->bsp);
+      r->state[i] = MP_JOB_DONE;
+    }
+}
+
+grub_err_t
+grub_efi_mp_run (grub_efi_mp_job_t job, void *data, grub_size_t n)
+{
+  grub_efi_boot_services_t *b = grub_efi_system_table->boot_services;
+  grub_efi_uintn_t nenabled, index;
+  grub_efi_event_t event;
+  grub_efi_status_t status;
+  struct mp_run r;
+  grub_size_t i;
+
+  if (mp_busy)
+    {
+      for (i = 0; i < n; i++)
+	job (data, i, 1);
+      return GRUB_ERR_NONE;
+    }
+
+  r.job = job;
+  r.data = data;
+  r.n = n;
+  r.state = NULL;
+
+  r.mp = (n > 1) ? mp_services (&r.nprocs, &nenabled) : NULL;
+  if (r.mp == NULL
+      || r.mp->who_am_i (r.mp, &r.bsp) != GRUB_EFI_SUCCESS)
+    goto leftovers;
+
+  r.state = grub_zalloc (n);
+  if (r.state == NULL)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      goto leftovers;
+    }
+
+  /*
+   * Have the BSP run its own share while the APs run theirs.  Firmware
+   * without the non-blocking mode leaves the BSP waiting instead, and its
+   * share runs afterwards.
+   */
+  mp_busy = 1;
+  status = b->create_event (0, 0, NULL, NULL, &event);
+  if (status == GRUB_EFI_SUCCESS)
+    {
+      status = r.mp->startup_all_aps (r.mp, mp_procedure, 0, event,
+				      MP_TIMEOUT_US, &r, NULL);
+      if (status == GRUB_EFI_SUCCESS)
+	{
+	  mp_procedure (&r);
+	  b->wait_for_event (1, &event, &index);
+	}
+      b->close_event (event);
+    }
+  if (status != GRUB_EFI_SUCCESS)
+    r.mp->startup_all_aps (r.mp, mp_procedure, 0, NULL, MP_TIMEOUT_US, &r,
+			   NULL);
+  mp_busy = 0;
+
+  /* The firmware stops the APs that ran out of time, in the middle of a
+     job that may have left its results half written.  */
+  for (i = 0; i < n; i++)
+    if (r.state[i] == MP_JOB_STARTED)
+      {
+	mp_broken = 1;
+	grub_free ((void *) r.state);
+	return grub_error (GRUB_ERR_TIMEOUT,
+			   "processors didn't finish their jobs in time");
+      }
+
+ leftovers:
+  for (i = 0; i < n; i++)
+    if (r.state == NULL || r.state[i] != MP_JOB_DONE)
+      job (data, i, 0);
+
+  grub_free ((void *) r.state);
+  return GRUB_ERR_NONE;
+}
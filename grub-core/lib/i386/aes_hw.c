@@ -0,0 +1,134 @@
+/* aes_hw.c - AES primitives on AES-NI.  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/aes_hw.h>
+#include <grub/cpufeature.h>
+
+/*
+ * GRUB is built without SSE, so only these functions may touch the XMM
+ * registers.  The firmware has enabled them on the EFI platforms this is
+ * built for.
+ */
+#define AES_HW_TARGET	__attribute__ ((target ("sse2,aes")))
+
+/* Run the rounds on four blocks at once to hide the instruction latency.  */
+#define AES_HW_BLOCKS4(round, last)			\
+  "movdqu (%[k]), %%xmm4\n\t"				\
+  "movdqu (%[d]), %%xmm0\n\t"				\
+  "movdqu 16(%[d]), %%xmm1\n\t"				\
+  "movdqu 32(%[d]), %%xmm2\n\t"				\
+  "movdqu 48(%[d]), %%xmm3\n\t"				\
+  "pxor %%xmm4, %%xmm0\n\t"				\
+  "pxor %%xmm4, %%xmm1\n\t"				\
+  "pxor %%xmm4, %%xmm2\n\t"				\
+  "pxor %%xmm4, %%xmm3\n\t"				\
+  "1:\n\t"						\
+  "add $16, %[k]\n\t"					\
+  "movdqu (%[k]), %%xmm4\n\t"				\
+  round " %%xmm4, %%xmm0\n\t"				\
+  round " %%xmm4, %%xmm1\n\t"				\
+  round " %%xmm4, %%xmm2\n\t"				\
+  round " %%xmm4, %%xmm3\n\t"				\
+  "dec %[n]\n\t"					\
+  "jnz 1b\n\t"						\
+  "movdqu 16(%[k]), %%xmm4\n\t"				\
+  last " %%xmm4, %%xmm0\n\t"				\
+  last " %%xmm4, %%xmm1\n\t"				\
+  last " %%xmm4, %%xmm2\n\t"				\
+  last " %%xmm4, %%xmm3\n\t"				\
+  "movdqu %%xmm0, (%[d])\n\t"				\
+  "movdqu %%xmm1, 16(%[d])\n\t"				\
+  "movdqu %%xmm2, 32(%[d])\n\t"				\
+  "movdqu %%xmm3, 48(%[d])\n\t"
+
+#define AES_HW_BLOCK1(round, last)			\
+  "movdqu (%[k]), %%xmm4\n\t"				\
+  "movdqu (%[d]), %%xmm0\n\t"				\
+  "pxor %%xmm4, %%xmm0\n\t"				\
+  "1:\n\t"						\
+  "add $16, %[k]\n\t"					\
+  "movdqu (%[k]), %%xmm4\n\t"				\
+  round " %%xmm4, %%xmm0\n\t"				\
+  "dec %[n]\n\t"					\
+  "jnz 1b\n\t"						\
+  "movdqu 16(%[k]), %%xmm4\n\t"				\
+  last " %%xmm4, %%xmm0\n\t"				\
+  "movdqu %%xmm0, (%[d])\n\t"
+
+#define AES_HW_RUN(blocks, round, last)					\
+  do									\
+    {									\
+      const grub_uint8_t *k = keys;					\
+      grub_size_t n = rounds - 1;					\
+									\
+      asm volatile (blocks (round, last)				\
+		    : [k] "+r" (k), [n] "+r" (n)			\
+		    : [d] "r" (data)					\
+		    : "xmm0", "xmm1", "xmm2", "xmm3", "xmm4",		\
+		      "cc", "memory");					\
+    }									\
+  while (0)
+
+int
+grub_aes_hw_supported (void)
+{
+  return grub_cpu_has_features (GRUB_CPU_FEATURE_AES);
+}
+
+AES_HW_TARGET grub_uint32_t
+grub_aes_hw_sub_word (grub_uint32_t w)
+{
+  /* With all four words equal to W, the first word of the result is
+     SubWord (W).  */
+  asm ("movd %0, %%xmm0\n\t"
+       "pshufd $0, %%xmm0, %%xmm0\n\t"
+       "aeskeygenassist $0, %%xmm0, %%xmm0\n\t"
+       "movd %%xmm0, %0"
+       : "+r" (w) : : "xmm0");
+  return w;
+}
+
+AES_HW_TARGET void
+grub_aes_hw_inv_mix_columns (grub_uint8_t *key)
+{
+  asm volatile ("movdqu (%0), %%xmm0\n\t"
+		"aesimc %%xmm0, %%xmm0\n\t"
+		"movdqu %%xmm0, (%0)"
+		: : "r" (key) : "xmm0", "memory");
+}
+
+AES_HW_TARGET void
+grub_aes_hw_encrypt (const grub_uint8_t *keys, int rounds,
+		     grub_uint8_t *data, grub_size_t nblocks)
+{
+  for (; nblocks >= 4; nblocks -= 4, data += 4 * GRUB_AES_HW_BLOCK_SIZE)
+    AES_HW_RUN (AES_HW_BLOCKS4, "aesenc", "aesenclast");
+  for (; nblocks; nblocks--, data += GRUB_AES_HW_BLOCK_SIZE)
+    AES_HW_RUN (AES_HW_BLOCK1, "aesenc", "aesenclast");
+}
+
+AES_HW_TARGET void
+grub_aes_hw_decrypt (const grub_uint8_t *keys, int rounds,
+		     grub_uint8_t *data, grub_size_t nblocks)
+{
+  for (; nblocks >= 4; nblocks -= 4, data += 4 * GRUB_AES_HW_BLOCK_SIZE)
+    AES_HW_RUN (AES_HW_BLOCKS4, "aesdec", "aesdeclast");
+  for (; nblocks; nblocks--, data += GRUB_AES_HW_BLOCK_SIZE)
+    AES_HW_RUN (AES_HW_BLOCK1, "aesdec", "aesdeclast");
+}
@@ -0,0 +1,285 @@
+/* sha_hw.c - SHA-1 and SHA-256 on the SHA extensions.  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/sha_hw.h>
+#include <grub/cpufeature.h>
+
+/*
+ * GRUB is built without SSE, so only these functions may touch the XMM
+ * registers.  The firmware has enabled them on the EFI platforms this is
+ * built for.
+ */
+#define SHA_HW_TARGET	__attribute__ ((target ("sse4.1,sha")))
+
+/* The round constants, followed by the mask swapping the bytes of each
+   message word.  */
+static const grub_uint32_t sha256_k[64 + 4] __attribute__ ((aligned (16))) =
+  {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+    0x00010203, 0x04050607, 0x08090a0b, 0x0c0d0e0f
+  };
+
+/*
+ * %xmm0 holds the message words plus round constants, as sha256rnds2
+ * requires, %xmm1 and %xmm2 the state as ABEF and CDGH, %xmm3 to %xmm6 the
+ * last sixteen message words and %xmm7 is scratch.
+ */
+#define W0	"%%xmm3"
+#define W1	"%%xmm4"
+#define W2	"%%xmm5"
+#define W3	"%%xmm6"
+
+#define SHA256_LOAD(i, w)				\
+  "movdqu " #i "*16(%[d]), %%xmm0\n\t"			\
+  "pshufb 256(%[k]), %%xmm0\n\t"			\
+  "movdqa %%xmm0, " w "\n\t"
+
+/* Four rounds on the message words in W.  */
+#define SHA256_ROUNDS(i, w)				\
+  "movdqa " w ", %%xmm0\n\t"				\
+  "paddd " #i "*16(%[k]), %%xmm0\n\t"			\
+  "sha256rnds2 %%xmm1, %%xmm2\n\t"			\
+  "pshufd $0x0e, %%xmm0, %%xmm0\n\t"			\
+  "sha256rnds2 %%xmm2, %%xmm1\n\t"
+
+/* Finish the next message words in NEXT.  */
+#define SHA256_MSG2(w, prev, next)			\
+  "movdqa " w ", %%xmm7\n\t"				\
+  "palignr $4, " prev ", %%xmm7\n\t"			\
+  "paddd %%xmm7, " next "\n\t"				\
+  "sha256msg2 " w ", " next "\n\t"
+
+/* Start the message words after NEXT in PREV.  */
+#define SHA256_MSG1(w, prev)				\
+  "sha256msg1 " w ", " prev "\n\t"
+
+#define SHA256_FULL(i, w, prev, next)			\
+  SHA256_ROUNDS (i, w)					\
+  SHA256_MSG2 (w, prev, next)				\
+  SHA256_MSG1 (w, prev)
+
+/* The mask reversing the bytes of all four SHA-1 message words at once.  */
+static const grub_uint32_t sha1_mask[4] __attribute__ ((aligned (16))) =
+  {
+    0x0c0d0e0f, 0x08090a0b, 0x04050607, 0x00010203
+  };
+
+/*
+ * %xmm0 holds the state as ABCD, %xmm1 and %xmm2 take turns holding E plus
+ * the message words, %xmm3 to %xmm6 the last sixteen message words and
+ * %xmm7 is scratch.
+ */
+#define E0	"%%xmm1"
+#define E1	"%%xmm2"
+#define M0	"%%xmm3"
+#define M1	"%%xmm4"
+#define M2	"%%xmm5"
+#define M3	"%%xmm6"
+
+#define SHA1_LOAD(i, w)					\
+  "movdqu " #i "*16(%[d]), " w "\n\t"			\
+  "pshufb (%[m]), " w "\n\t"
+
+#define SHA1_NEXTE(e, w, e_next)			\
+  "sha1nexte " w ", " e "\n\t"				\
+  "movdqa %%xmm0, " e_next "\n\t"
+
+#define SHA1_RNDS(f, e)					\
+  "sha1rnds4 $" #f ", " e ", %%xmm0\n\t"
+
+#define SHA1_MSG1(w, src)	"sha1msg1 " src ", " w "\n\t"
+#define SHA1_MSG2(w, src)	"sha1msg2 " src ", " w "\n\t"
+#define SHA1_XOR(w, src)	"pxor " src ", " w "\n\t"
+
+/* Four rounds on the message words in W, with the message schedule of
+   the rounds to come interleaved.  */
+#define SHA1_FULL(f, w, e, e_next, w1, w2, w3)		\
+  SHA1_NEXTE (e, w, e_next)				\
+  SHA1_MSG2 (w1, w)					\
+  SHA1_RNDS (f, e)					\
+  SHA1_MSG1 (w3, w)					\
+  SHA1_XOR (w2, w)
+
+int
+grub_sha1_hw_supported (void)
+{
+  return grub_sha256_hw_supported ();
+}
+
+int
+grub_sha256_hw_supported (void)
+{
+  return grub_cpu_has_features (GRUB_CPU_FEATURE_SHA256
+				| GRUB_CPU_FEATURE_SSE4_1);
+}
+
+SHA_HW_TARGET void
+grub_sha256_hw_transform (grub_uint32_t *state, const grub_uint8_t *data,
+			  grub_size_t nblocks)
+{
+  grub_uint64_t abef[2], cdgh[2];
+
+  if (!nblocks)
+    return;
+
+  asm volatile ("movdqu (%[s]), %%xmm7\n\t"
+		"movdqu 16(%[s]), %%xmm2\n\t"
+		"pshufd $0xb1, %%xmm7, %%xmm7\n\t"
+		"pshufd $0x1b, %%xmm2, %%xmm2\n\t"
+		"movdqa %%xmm7, %%xmm1\n\t"
+		"palignr $8, %%xmm2, %%xmm1\n\t"
+		"pblendw $0xf0, %%xmm7, %%xmm2\n\t"
+		"1:\n\t"
+		"movdqu %%xmm1, %[abef]\n\t"
+		"movdqu %%xmm2, %[cdgh]\n\t"
+
+		SHA256_LOAD (0, W0)
+		SHA256_ROUNDS (0, W0)
+		SHA256_LOAD (1, W1)
+		SHA256_ROUNDS (1, W1)
+		SHA256_MSG1 (W1, W0)
+		SHA256_LOAD (2, W2)
+		SHA256_ROUNDS (2, W2)
+		SHA256_MSG1 (W2, W1)
+		SHA256_LOAD (3, W3)
+		SHA256_FULL (3, W3, W2, W0)
+		SHA256_FULL (4, W0, W3, W1)
+		SHA256_FULL (5, W1, W0, W2)
+		SHA256_FULL (6, W2, W1, W3)
+		SHA256_FULL (7, W3, W2, W0)
+		SHA256_FULL (8, W0, W3, W1)
+		SHA256_FULL (9, W1, W0, W2)
+		SHA256_FULL (10, W2, W1, W3)
+		SHA256_FULL (11, W3, W2, W0)
+		SHA256_FULL (12, W0, W3, W1)
+		SHA256_ROUNDS (13, W1)
+		SHA256_MSG2 (W1, W0, W2)
+		SHA256_ROUNDS (14, W2)
+		SHA256_MSG2 (W2, W1, W3)
+		SHA256_ROUNDS (15, W3)
+
+		"movdqu %[abef], %%xmm7\n\t"
+		"paddd %%xmm7, %%xmm1\n\t"
+		"movdqu %[cdgh], %%xmm7\n\t"
+		"paddd %%xmm7, %%xmm2\n\t"
+		"add $64, %[d]\n\t"
+		"dec %[n]\n\t"
+		"jnz 1b\n\t"
+
+		"pshufd $0x1b, %%xmm1, %%xmm1\n\t"
+		"pshufd $0xb1, %%xmm2, %%xmm2\n\t"
+		"movdqa %%xmm1, %%xmm7\n\t"
+		"pblendw $0xf0, %%xmm2, %%xmm1\n\t"
+		"palignr $8, %%xmm7, %%xmm2\n\t"
+		"movdqu %%xmm1, (%[s])\n\t"
+		"movdqu %%xmm2, 16(%[s])"
+		: [d] "+r" (data), [n] "+r" (nblocks),
+		  [abef] "=m" (abef), [cdgh] "=m" (cdgh)
+		: [s] "r" (state), [k] "r" (sha256_k)
+		: "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6",
+		  "xmm7", "cc", "memory");
+}
+
+SHA_HW_TARGET void
+grub_sha1_hw_transform (grub_uint32_t *state, const grub_uint8_t *data,
+			grub_size_t nblocks)
+{
+  grub_uint64_t abcd[2], e[2];
+
+  if (!nblocks)
+    return;
+
+  asm volatile ("movdqu (%[s]), %%xmm0\n\t"
+		"pshufd $0x1b, %%xmm0, %%xmm0\n\t"
+		"movd 16(%[s]), " E0 "\n\t"
+		"pslldq $12, " E0 "\n\t"
+		"1:\n\t"
+		"movdqu %%xmm0, %[abcd]\n\t"
+		"movdqu " E0 ", %[e]\n\t"
+
+		SHA1_LOAD (0, M0)
+		"paddd " M0 ", " E0 "\n\t"
+		"movdqa %%xmm0, " E1 "\n\t"
+		SHA1_RNDS (0, E0)
+		SHA1_LOAD (1, M1)
+		SHA1_NEXTE (E1, M1, E0)
+		SHA1_RNDS (0, E1)
+		SHA1_MSG1 (M0, M1)
+		SHA1_LOAD (2, M2)
+		SHA1_NEXTE (E0, M2, E1)
+		SHA1_RNDS (0, E0)
+		SHA1_MSG1 (M1, M2)
+		SHA1_XOR (M0, M2)
+		SHA1_LOAD (3, M3)
+		SHA1_FULL (0, M3, E1, E0, M0, M1, M2)
+		SHA1_FULL (0, M0, E0, E1, M1, M2, M3)
+		SHA1_FULL (1, M1, E1, E0, M2, M3, M0)
+		SHA1_FULL (1, M2, E0, E1, M3, M0, M1)
+		SHA1_FULL (1, M3, E1, E0, M0, M1, M2)
+		SHA1_FULL (1, M0, E0, E1, M1, M2, M3)
+		SHA1_FULL (1, M1, E1, E0, M2, M3, M0)
+		SHA1_FULL (2, M2, E0, E1, M3, M0, M1)
+		SHA1_FULL (2, M3, E1, E0, M0, M1, M2)
+		SHA1_FULL (2, M0, E0, E1, M1, M2, M3)
+		SHA1_FULL (2, M1, E1, E0, M2, M3, M0)
+		SHA1_FULL (2, M2, E0, E1, M3, M0, M1)
+		SHA1_FULL (3, M3, E1, E0, M0, M1, M2)
+		SHA1_FULL (3, M0, E0, E1, M1, M2, M3)
+		SHA1_NEXTE (E1, M1, E0)
+		SHA1_MSG2 (M2, M1)
+		SHA1_RNDS (3, E1)
+		SHA1_XOR (M3, M1)
+		SHA1_NEXTE (E0, M2, E1)
+		SHA1_MSG2 (M3, M2)
+		SHA1_RNDS (3, E0)
+		SHA1_NEXTE (E1, M3, E0)
+		SHA1_RNDS (3, E1)
+
+		"movdqu %[e], %%xmm7\n\t"
+		"sha1nexte %%xmm7, " E0 "\n\t"
+		"movdqu %[abcd], %%xmm7\n\t"
+		"paddd %%xmm7, %%xmm0\n\t"
+		"add $64, %[d]\n\t"
+		"dec %[n]\n\t"
+		"jnz 1b\n\t"
+
+		"pshufd $0x1b, %%xmm0, %%xmm0\n\t"
+		"movdqu %%xmm0, (%[s])\n\t"
+		"pextrd $3, " E0 ", 16(%[s])"
+		: [d] "+r" (data), [n] "+r" (nblocks),
+		  [abcd] "=m" (abcd), [e] "=m" (e)
+		: [s] "r" (state), [m] "r" (sha1_mask)
+		: "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6",
+		  "xmm7", "cc", "memory");
+}
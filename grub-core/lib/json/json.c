@@ -31,7 +31,7 @@ grub_json_parse (grub_json_t **out, char *string, grub_size_t string_len)
   grub_json_t *json = NULL;
   jsmn_parser parser;
   grub_err_t ret = GRUB_ERR_NONE;
-  int jsmn_ret;
+  int jsmn_ret, i;
 
   if (!string)
     return GRUB_ERR_BAD_ARGUMENT;
@@ -68,6 +68,36 @@ grub_json_parse (grub_json_t **out, char *string, grub_size_t string_len)
       goto err;
     }
 
+  json->next = grub_calloc (jsmn_ret, sizeof (json->next[0]));
+  if (!json->next)
+    {
+      ret = GRUB_ERR_OUT_OF_MEMORY;
+      goto err;
+    }
+
+  /*
+   * Link each token to the one after its subtree, so that lookups
+   * step over siblings instead of walking all their descendants.
+   * Children follow their parent, so walking backwards finds their
+   * links already set.
+   */
+  for (i = jsmn_ret - 1; i >= 0; i--)
+    {
+      grub_size_t next = i + 1;
+      int n;
+
+      for (n = 0; n < json->tokens[i].size; n++)
+	{
+	  if (next >= (grub_size_t) jsmn_ret)
+	    {
+	      ret = GRUB_ERR_BAD_ARGUMENT;
+	      goto err;
+	    }
+	  next = json->next[next];
+	}
+      json->next[i] = next;
+    }
+
   *out = json;
 
  err:
@@ -83,6 +113,7 @@ grub_json_free (grub_json_t *json)
   if (json)
     {
       grub_free (json->tokens);
+      grub_free (json->next);
       grub_free (json);
     }
 }
@@ -127,25 +158,20 @@ grub_json_gettype (grub_json_type_t *out, const grub_json_t *json)
 grub_err_t
 grub_json_getchild (grub_json_t *out, const grub_json_t *parent, grub_size_t n)
 {
-  grub_size_t offset = 1, size;
-  jsmntok_t *p;
+  grub_size_t idx, size;
 
   if (grub_json_getsize (&size, parent) || n >= size)
     return GRUB_ERR_OUT_OF_RANGE;
 
-  /*
-   * Skip the first n children. For each of the children, we need
-   * to skip their own potential children (e.g. if it's an
-   * array), as well. We thus add the children's size to n on
-   * each iteration.
-   */
-  p = &parent->tokens[parent->idx];
+  /* Skip the first n children along with their own children. */
+  idx = parent->idx + 1;
   while (n--)
-    n += p[offset++].size;
+    idx = parent->next[idx];
 
   out->string = parent->string;
   out->tokens = parent->tokens;
-  out->idx = parent->idx + offset;
+  out->next = parent->next;
+  out->idx = idx;
 
   return GRUB_ERR_NONE;
 }
@@ -155,6 +181,7 @@ grub_json_getvalue (grub_json_t *out, const grub_json_t *parent, const char *key
 {
   grub_json_type_t type;
   grub_size_t i, size;
+  grub_json_t child;
 
   if (grub_json_gettype (&type, parent) || type != GRUB_JSON_OBJECT)
     return GRUB_ERR_BAD_ARGUMENT;
@@ -162,13 +189,13 @@ grub_json_getvalue (grub_json_t *out, const grub_json_t *parent, const char *key
   if (grub_json_getsize (&size, parent))
     return GRUB_ERR_BAD_ARGUMENT;
 
-  for (i = 0; i < size; i++)
+  child = *parent;
+  child.idx = parent->idx + 1;
+  for (i = 0; i < size; i++, child.idx = parent->next[child.idx])
     {
-      grub_json_t child;
       const char *s;
 
-      if (grub_json_getchild (&child, parent, i) ||
-	  grub_json_getstring (&s, &child, NULL) ||
+      if (grub_json_getstring (&s, &child, NULL) ||
           grub_strcmp (s, key) != 0)
 	continue;
 
@@ -42,6 +42,8 @@ struct jsmntok;
 struct grub_json
 {
   struct jsmntok *tokens;
+  /* For each token, the index of the token following it and its children. */
+  grub_size_t	 *next;
   char		 *string;
   grub_size_t	 idx;
 };
@@ -25,33 +25,43 @@
 
 GRUB_MOD_LICENSE ("GPLv2+");
 
+grub_size_t
+grub_crypto_pbkdf2_memsize (const struct gcry_md_spec *md)
+{
+  /* The working context, the two HMAC pad states and the pad block.  */
+  return 3 * md->contextsize + md->blocksize;
+}
+
 /* Implement PKCS#5 PBKDF2 as per RFC 2898.  The PRF to use is HMAC variant
    of digest supplied by MD.  Inputs are the password P of length PLEN,
    the salt S of length SLEN, the iteration counter C (> 0), and the
    desired derived output length DKLEN.  Output buffer is DK which
    must have room for at least DKLEN octets.  The output buffer will
-   be filled with the derived data.  */
+   be filled with the derived data.  MEM is the scratch memory of
+   grub_crypto_pbkdf2_memsize (MD) octets, which is wiped on return.  */
 
 gcry_err_code_t
-grub_crypto_pbkdf2 (const struct gcry_md_spec *md,
-		    const grub_uint8_t *P, grub_size_t Plen,
-		    const grub_uint8_t *S, grub_size_t Slen,
-		    unsigned int c,
-		    grub_uint8_t *DK, grub_size_t dkLen)
+grub_crypto_pbkdf2_prealloc (const struct gcry_md_spec *md,
+			     const grub_uint8_t *P, grub_size_t Plen,
+			     const grub_uint8_t *S, grub_size_t Slen,
+			     unsigned int c,
+			     grub_uint8_t *DK, grub_size_t dkLen,
+			     void *mem)
 {
-  unsigned int hLen = md->mdlen;
+  unsigned int hLen;
   grub_uint8_t U[GRUB_CRYPTO_MAX_MDLEN];
   grub_uint8_t T[GRUB_CRYPTO_MAX_MDLEN];
+  grub_uint8_t be_i[4];
   unsigned int u;
   unsigned int l;
   unsigned int r;
   unsigned int i;
   unsigned int k;
-  gcry_err_code_t rc;
-  grub_uint8_t *tmp;
-  grub_size_t tmplen = Slen + 4;
+  grub_uint8_t *ctx, *ictx, *octx, *pad;
+  grub_size_t csize;
 
-  if (md->mdlen > GRUB_CRYPTO_MAX_MDLEN || md->mdlen == 0)
+  if (md->mdlen > GRUB_CRYPTO_MAX_MDLEN || md->mdlen == 0
+      || md->mdlen > md->blocksize)
     return GPG_ERR_INV_ARG;
 
   if (c == 0)
@@ -63,47 +73,95 @@ grub_crypto_pbkdf2 (const struct gcry_md_spec *md,
   if (dkLen > 4294967295U)
     return GPG_ERR_INV_ARG;
 
+  hLen = md->mdlen;
+  csize = md->contextsize;
+
   l = ((dkLen - 1) / hLen) + 1;
   r = dkLen - (l - 1) * hLen;
 
-  tmp = grub_malloc (tmplen);
-  if (tmp == NULL)
-    return GPG_ERR_OUT_OF_MEMORY;
-
-  grub_memcpy (tmp, S, Slen);
+  ctx = mem;
+  ictx = ctx + csize;
+  octx = ictx + csize;
+  pad = octx + csize;
+
+  /*
+   * Hash the inner and outer pads of the HMAC key once.  Every HMAC below
+   * resumes from copies of these states rather than hashing the pads
+   * again, which halves the compressions per iteration.
+   */
+  grub_memset (pad, 0, md->blocksize);
+  if (Plen > md->blocksize)
+    grub_crypto_hash (md, pad, P, Plen);
+  else
+    grub_memcpy (pad, P, Plen);
+  for (k = 0; k < md->blocksize; k++)
+    pad[k] ^= 0x36;
+  md->init (ictx);
+  md->write (ictx, pad, md->blocksize);
+  for (k = 0; k < md->blocksize; k++)
+    pad[k] ^= 0x36 ^ 0x5c;
+  md->init (octx);
+  md->write (octx, pad, md->blocksize);
 
   for (i = 1; i - 1 < l; i++)
     {
-      grub_memset (T, 0, hLen);
+      be_i[0] = (i & 0xff000000) >> 24;
+      be_i[1] = (i & 0x00ff0000) >> 16;
+      be_i[2] = (i & 0x0000ff00) >> 8;
+      be_i[3] = (i & 0x000000ff) >> 0;
 
       for (u = 0; u < c; u++)
 	{
+	  grub_memcpy (ctx, ictx, csize);
 	  if (u == 0)
 	    {
-	      tmp[Slen + 0] = (i & 0xff000000) >> 24;
-	      tmp[Slen + 1] = (i & 0x00ff0000) >> 16;
-	      tmp[Slen + 2] = (i & 0x0000ff00) >> 8;
-	      tmp[Slen + 3] = (i & 0x000000ff) >> 0;
-
-	      rc = grub_crypto_hmac_buffer (md, P, Plen, tmp, tmplen, U);
+	      md->write (ctx, S, Slen);
+	      md->write (ctx, be_i, sizeof (be_i));
 	    }
 	  else
-	    rc = grub_crypto_hmac_buffer (md, P, Plen, U, hLen, U);
+	    md->write (ctx, U, hLen);
+	  md->final (ctx);
+	  grub_memcpy (U, md->read (ctx), hLen);
 
-	  if (rc != GPG_ERR_NO_ERROR)
-	    {
-	      grub_free (tmp);
-	      return rc;
-	    }
+	  grub_memcpy (ctx, octx, csize);
+	  md->write (ctx, U, hLen);
+	  md->final (ctx);
+	  grub_memcpy (U, md->read (ctx), hLen);
 
-	  for (k = 0; k < hLen; k++)
-	    T[k] ^= U[k];
+	  if (u == 0)
+	    grub_memcpy (T, U, hLen);
+	  else
+	    for (k = 0; k < hLen; k++)
+	      T[k] ^= U[k];
 	}
 
       grub_memcpy (DK + (i - 1) * hLen, T, i == l ? r : hLen);
     }
 
-  grub_free (tmp);
+  grub_memset (U, 0, sizeof (U));
+  grub_memset (T, 0, sizeof (T));
+  grub_memset (ctx, 0, grub_crypto_pbkdf2_memsize (md));
 
   return GPG_ERR_NO_ERROR;
 }
+
+gcry_err_code_t
+grub_crypto_pbkdf2 (const struct gcry_md_spec *md,
+		    const grub_uint8_t *P, grub_size_t Plen,
+		    const grub_uint8_t *S, grub_size_t Slen,
+		    unsigned int c,
+		    grub_uint8_t *DK, grub_size_t dkLen)
+{
+  gcry_err_code_t err;
+  void *mem;
+
+  md = grub_crypto_md_accel (md);
+  mem = grub_malloc (grub_crypto_pbkdf2_memsize (md));
+  if (mem == NULL)
+    return GPG_ERR_OUT_OF_MEMORY;
+
+  err = grub_crypto_pbkdf2_prealloc (md, P, Plen, S, Slen, c, DK, dkLen, mem);
+  grub_free (mem);
+
+  return err;
+}
@@ -343,6 +343,7 @@ free_subchunk (const struct grub_relocator_subchunk *subchu)
 	    h->magic = GRUB_MM_FREE_MAGIC;
 	    h->size = (r2 - r1 - 1);
 	  }
+	grub_mm_drop_index ();
 	for (r2 = grub_mm_base; r2; r2 = r2->next)
 	  if ((grub_addr_t) r2 + r2->size == (grub_addr_t) r1)
 	    break;
@@ -412,32 +413,32 @@ free_subchunk (const struct grub_relocator_subchunk *subchu)
     }
 }
 
+/* The state of malloc_in_range kept across the ranges it is tried on.  */
+struct grub_relocator_events
+{
+  struct grub_relocator_mmap_event *events, *eventt;
+  unsigned *counter;
+  unsigned n;
+  grub_mm_region_t base_saved;
+  int built;
+};
+
+/*
+ * Build the sorted list of the events where free memory in the heap and
+ * in the firmware starts and ends.  The heap is unavailable from here
+ * until the events are released, so that they stay valid for all the
+ * ranges a chunk allocation tries.
+ */
 static int
-malloc_in_range (struct grub_relocator *rel,
-		 grub_addr_t start, grub_addr_t end, grub_addr_t align,
-		 grub_size_t size, struct grub_relocator_chunk *res,
-		 int from_low_priv, int collisioncheck)
+events_build (struct grub_relocator *rel, struct grub_relocator_events *ev)
 {
-  grub_mm_region_t r, *ra, base_saved;
+  grub_mm_region_t r, *ra;
   struct grub_relocator_mmap_event *events = NULL, *eventt = NULL, *t;
   /* 128 is just in case of additional malloc (shouldn't happen).  */
   unsigned maxevents = 2 + 128;
   grub_mm_header_t p, pa;
   unsigned *counter;
-  int nallocs = 0;
   unsigned j, N = 0;
-  grub_addr_t target = 0;
-
-  grub_dprintf ("relocator",
-		"trying to allocate in 0x%lx-0x%lx aligned 0x%lx size 0x%lx\n",
-		(unsigned long) start, (unsigned long) end,
-		(unsigned long) align, (unsigned long) size);
-
-  start = ALIGN_UP (start, align);
-  end = ALIGN_DOWN (end - size, align) + size;
-
-  if (end < start + size)
-    return 0;
 
   /* We have to avoid any allocations when filling scanline events.
      Hence 2-stages.
@@ -457,7 +458,7 @@ malloc_in_range (struct grub_relocator *rel,
       maxevents += 4;
     }
 
-  if (collisioncheck && rel)
+  if (rel)
     {
       struct grub_relocator_chunk *chunk;
       for (chunk = rel->chunks; chunk; chunk = chunk->next)
@@ -510,7 +511,7 @@ malloc_in_range (struct grub_relocator *rel,
       return 0;
     }
 
-  if (collisioncheck && rel)
+  if (rel)
     {
       struct grub_relocator_chunk *chunk;
       for (chunk = rel->chunks; chunk; chunk = chunk->next)
@@ -589,10 +590,10 @@ malloc_in_range (struct grub_relocator *rel,
 #endif
 
   /* No malloc from this point.  */
-  base_saved = grub_mm_base;
+  ev->base_saved = grub_mm_base;
   grub_mm_base = NULL;
 
-  for (ra = &base_saved, r = *ra; r; ra = &(r->next), r = *ra)
+  for (ra = &ev->base_saved, r = *ra; r; ra = &(r->next), r = *ra)
     {
       pa = r->first;
       p = pa->next;
@@ -669,6 +670,59 @@ malloc_in_range (struct grub_relocator *rel,
       }
   }
 
+  ev->events = events;
+  ev->eventt = eventt;
+  ev->counter = counter;
+  ev->n = N;
+  ev->built = 1;
+  return 1;
+}
+
+/* Give the heap back, after the last range tried.  */
+static void
+events_release (struct grub_relocator_events *ev)
+{
+  if (!ev->built)
+    return;
+
+  grub_mm_base = ev->base_saved;
+  grub_mm_drop_index ();
+  grub_free (ev->events);
+  grub_free (ev->eventt);
+  grub_free (ev->counter);
+  ev->built = 0;
+}
+
+static int
+malloc_in_range (struct grub_relocator *rel, struct grub_relocator_events *ev,
+		 grub_addr_t start, grub_addr_t end, grub_addr_t align,
+		 grub_size_t size, struct grub_relocator_chunk *res,
+		 int from_low_priv, int collisioncheck)
+{
+  struct grub_relocator_mmap_event *events;
+  int nallocs = 0;
+#if GRUB_RELOCATOR_HAVE_FIRMWARE_REQUESTS
+  int retried = 0;
+#endif
+  unsigned j, N;
+  grub_addr_t target = 0;
+
+  grub_dprintf ("relocator",
+		"trying to allocate in 0x%lx-0x%lx aligned 0x%lx size 0x%lx\n",
+		(unsigned long) start, (unsigned long) end,
+		(unsigned long) align, (unsigned long) size);
+
+  start = ALIGN_UP (start, align);
+  end = ALIGN_DOWN (end - size, align) + size;
+
+  if (end < start + size)
+    return 0;
+
+  if (!ev->built && !events_build (rel, ev))
+    return 0;
+  events = ev->events;
+  N = ev->n;
+
 #if GRUB_RELOCATOR_HAVE_FIRMWARE_REQUESTS
  retry:
 #endif
@@ -719,11 +773,13 @@ malloc_in_range (struct grub_relocator *rel,
 #endif
 
 	  case COLLISION_START:
-	    ncollisions++;
+	    if (collisioncheck)
+	      ncollisions++;
 	    break;
 
 	  case COLLISION_END:
-	    ncollisions--;
+	    if (collisioncheck)
+	      ncollisions--;
 	    break;
 
 	  case IN_REG_START:
@@ -771,10 +827,11 @@ malloc_in_range (struct grub_relocator *rel,
       }
   }
 
-  grub_mm_base = base_saved;
-  grub_free (events);
-  grub_free (eventt);
-  grub_free (counter);
+#if GRUB_RELOCATOR_HAVE_FIRMWARE_REQUESTS
+  /* The events no longer match the heap after a retry.  */
+  if (retried)
+    events_release (ev);
+#endif
   return 0;
 
  found:
@@ -862,6 +919,7 @@ malloc_in_range (struct grub_relocator *rel,
 			    start = fend;
 			  else
 			    end = fstart;
+			  retried = 1;
 			  goto retry;
 			}
 		      break;
@@ -943,10 +1001,12 @@ malloc_in_range (struct grub_relocator *rel,
 	    break;
 #endif
 	  case COLLISION_START:
-	    ncol++;
+	    if (collisioncheck)
+	      ncol++;
 	    break;
 	  case COLLISION_END:
-	    ncol--;
+	    if (collisioncheck)
+	      ncol--;
 	    break;
 	  }
 
@@ -954,10 +1014,12 @@ malloc_in_range (struct grub_relocator *rel,
   }
 
   /* Malloc is available again.  */
-  grub_mm_base = base_saved;
+  grub_mm_base = ev->base_saved;
+  grub_mm_drop_index ();
 
-  grub_free (eventt);
-  grub_free (counter);
+  grub_free (ev->eventt);
+  grub_free (ev->counter);
+  ev->built = 0;
 
   {
     int last_start = 0;
@@ -1173,10 +1235,12 @@ malloc_in_range (struct grub_relocator *rel,
 	    break;
 #endif
 	  case COLLISION_START:
-	    ncol++;
+	    if (collisioncheck)
+	      ncol++;
 	    break;
 	  case COLLISION_END:
-	    ncol--;
+	    if (collisioncheck)
+	      ncol--;
 	    break;
 	  }
       }
@@ -1233,6 +1297,7 @@ grub_relocator_alloc_chunk_addr (struct grub_relocator *rel,
 				 grub_phys_addr_t target, grub_size_t size)
 {
   struct grub_relocator_chunk *chunk;
+  struct grub_relocator_events ev = { .built = 0 };
   grub_phys_addr_t min_addr = 0, max_addr;
 
   if (target > ~size)
@@ -1259,28 +1324,29 @@ grub_relocator_alloc_chunk_addr (struct grub_relocator *rel,
       /* A trick to improve Linux allocation.  */
 #if defined (__i386__) || defined (__x86_64__)
       if (target < 0x100000)
-	if (malloc_in_range (rel, rel->highestnonpostaddr, ~(grub_addr_t)0, 1,
-			     size, chunk, 0, 1))
+	if (malloc_in_range (rel, &ev, rel->highestnonpostaddr, ~(grub_addr_t)0,
+			     1, size, chunk, 0, 1))
 	  {
 	    if (rel->postchunks > chunk->src)
 	      rel->postchunks = chunk->src;
 	    break;
 	  }
 #endif
-      if (malloc_in_range (rel, target, max_addr, 1, size, chunk, 1, 0))
+      if (malloc_in_range (rel, &ev, target, max_addr, 1, size, chunk, 1, 0))
 	break;
 
-      if (malloc_in_range (rel, min_addr, target, 1, size, chunk, 0, 0))
+      if (malloc_in_range (rel, &ev, min_addr, target, 1, size, chunk, 0, 0))
 	break;
 
-      if (malloc_in_range (rel, rel->highestnonpostaddr, ~(grub_addr_t)0, 1,
-			   size, chunk, 0, 1))
+      if (malloc_in_range (rel, &ev, rel->highestnonpostaddr, ~(grub_addr_t)0,
+			   1, size, chunk, 0, 1))
 	{
 	  if (rel->postchunks > chunk->src)
 	    rel->postchunks = chunk->src;
 	  break;
 	}
 
+      events_release (&ev);
       grub_dprintf ("relocator", "not allocated\n");
       grub_free (chunk);
       return grub_error (GRUB_ERR_OUT_OF_MEMORY, N_("out of memory"));
@@ -1388,6 +1454,7 @@ grub_relocator_alloc_chunk_align (struct grub_relocator *rel,
     .preference = preference,
     .found = 0
   };
+  struct grub_relocator_events ev = { .built = 0 };
   grub_addr_t min_addr2 = 0, max_addr2;
 
   if (size && (max_addr > ~size))
@@ -1404,7 +1471,7 @@ grub_relocator_alloc_chunk_align (struct grub_relocator *rel,
   if (!ctx.chunk)
     return grub_errno;
 
-  if (malloc_in_range (rel, min_addr, max_addr, align,
+  if (malloc_in_range (rel, &ev, min_addr, max_addr, align,
 		       size, ctx.chunk,
 		       preference != GRUB_RELOCATOR_PREFERENCE_HIGH, 1))
     {
@@ -1428,18 +1495,19 @@ grub_relocator_alloc_chunk_align (struct grub_relocator *rel,
 
   do
     {
-      if (malloc_in_range (rel, min_addr2, max_addr2, align,
+      if (malloc_in_range (rel, &ev, min_addr2, max_addr2, align,
 			   size, ctx.chunk, 1, 1))
 	break;
 
-      if (malloc_in_range (rel, rel->highestnonpostaddr, ~(grub_addr_t)0, 1,
-			   size, ctx.chunk, 0, 1))
+      if (malloc_in_range (rel, &ev, rel->highestnonpostaddr, ~(grub_addr_t)0,
+			   1, size, ctx.chunk, 0, 1))
 	{
 	  if (rel->postchunks > ctx.chunk->src)
 	    rel->postchunks = ctx.chunk->src;
 	  break;
 	}
 
+      events_release (&ev);
       return grub_error (GRUB_ERR_OUT_OF_MEMORY, N_("out of memory"));
     }
   while (0);
@@ -1532,14 +1600,19 @@ grub_relocator_prepare_relocs (struct grub_relocator *rel, grub_addr_t addr,
   grub_size_t nchunks = 0;
   unsigned j;
   struct grub_relocator_chunk movers_chunk;
+  struct grub_relocator_events ev = { .built = 0 };
 
   grub_dprintf ("relocator", "Preparing relocs (size=%ld)\n",
 		(unsigned long) rel->relocators_size);
 
-  if (!malloc_in_range (rel, 0, ~(grub_addr_t)0 - rel->relocators_size + 1,
+  if (!malloc_in_range (rel, &ev, 0,
+			~(grub_addr_t)0 - rel->relocators_size + 1,
 			grub_relocator_align,
 			rel->relocators_size, &movers_chunk, 1, 1))
-    return grub_error (GRUB_ERR_OUT_OF_MEMORY, N_("out of memory"));
+    {
+      events_release (&ev);
+      return grub_error (GRUB_ERR_OUT_OF_MEMORY, N_("out of memory"));
+    }
   movers_chunk.srcv = rels = rels0
     = grub_map_memory (movers_chunk.src, movers_chunk.size);
 
@@ -0,0 +1,307 @@
+/* sha_hw.c - SHA-1 and SHA-256 on the CPU SHA instructions.  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/sha_hw.h>
+#include <grub/crypto.h>
+#include <grub/dl.h>
+#include <grub/misc.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+typedef void (*sha_hw_transform_t) (grub_uint32_t *state,
+				    const grub_uint8_t *data,
+				    grub_size_t nblocks);
+
+/* SHA-1 and SHA-256 share the block size and the padding, SHA-1 only
+   uses the first five words of the state.  */
+struct sha_hw_ctx
+{
+  grub_uint32_t h[8];
+  grub_uint64_t nbytes;
+  grub_uint8_t buf[GRUB_SHA_HW_BLOCK_SIZE];
+  unsigned count;
+};
+
+static void
+sha_hw_write (struct sha_hw_ctx *ctx, const void *data, grub_size_t len,
+	      sha_hw_transform_t transform)
+{
+  const grub_uint8_t *in = data;
+  grub_size_t n;
+
+  ctx->nbytes += len;
+
+  if (ctx->count)
+    {
+      n = grub_min (len, GRUB_SHA_HW_BLOCK_SIZE - ctx->count);
+      grub_memcpy (ctx->buf + ctx->count, in, n);
+      ctx->count += n;
+      in += n;
+      len -= n;
+      if (ctx->count < GRUB_SHA_HW_BLOCK_SIZE)
+	return;
+      transform (ctx->h, ctx->buf, 1);
+      ctx->count = 0;
+    }
+
+  /* Whole blocks go straight from the caller's buffer.  */
+  n = len / GRUB_SHA_HW_BLOCK_SIZE;
+  if (n)
+    {
+      transform (ctx->h, in, n);
+      in += n * GRUB_SHA_HW_BLOCK_SIZE;
+      len -= n * GRUB_SHA_HW_BLOCK_SIZE;
+    }
+
+  grub_memcpy (ctx->buf, in, len);
+  ctx->count = len;
+}
+
+static void
+sha_hw_final (struct sha_hw_ctx *ctx, sha_hw_transform_t transform,
+	      unsigned nwords)
+{
+  unsigned i;
+
+  ctx->buf[ctx->count++] = 0x80;
+  if (ctx->count > GRUB_SHA_HW_BLOCK_SIZE - 8)
+    {
+      grub_memset (ctx->buf + ctx->count, 0,
+		   GRUB_SHA_HW_BLOCK_SIZE - ctx->count);
+      transform (ctx->h, ctx->buf, 1);
+      ctx->count = 0;
+    }
+  grub_memset (ctx->buf + ctx->count, 0,
+	       GRUB_SHA_HW_BLOCK_SIZE - 8 - ctx->count);
+  grub_set_unaligned64 (ctx->buf + GRUB_SHA_HW_BLOCK_SIZE - 8,
+			grub_cpu_to_be64 (ctx->nbytes << 3));
+  transform (ctx->h, ctx->buf, 1);
+
+  for (i = 0; i < nwords; i++)
+    grub_set_unaligned32 (ctx->buf + 4 * i, grub_cpu_to_be32 (ctx->h[i]));
+}
+
+static unsigned char *
+sha_hw_read (void *context)
+{
+  struct sha_hw_ctx *ctx = context;
+
+  return ctx->buf;
+}
+
+static void
+sha1_hw_init (void *context)
+{
+  struct sha_hw_ctx *ctx = context;
+
+  ctx->h[0] = 0x67452301;
+  ctx->h[1] = 0xefcdab89;
+  ctx->h[2] = 0x98badcfe;
+  ctx->h[3] = 0x10325476;
+  ctx->h[4] = 0xc3d2e1f0;
+  ctx->nbytes = 0;
+  ctx->count = 0;
+}
+
+static void
+sha1_hw_write (void *context, const void *data, grub_size_t len)
+{
+  sha_hw_write (context, data, len, grub_sha1_hw_transform);
+}
+
+static void
+sha1_hw_final (void *context)
+{
+  sha_hw_final (context, grub_sha1_hw_transform, 5);
+}
+
+static void
+sha256_hw_init (void *context)
+{
+  struct sha_hw_ctx *ctx = context;
+
+  ctx->h[0] = 0x6a09e667;
+  ctx->h[1] = 0xbb67ae85;
+  ctx->h[2] = 0x3c6ef372;
+  ctx->h[3] = 0xa54ff53a;
+  ctx->h[4] = 0x510e527f;
+  ctx->h[5] = 0x9b05688c;
+  ctx->h[6] = 0x1f83d9ab;
+  ctx->h[7] = 0x5be0cd19;
+  ctx->nbytes = 0;
+  ctx->count = 0;
+}
+
+static void
+sha256_hw_write (void *context, const void *data, grub_size_t len)
+{
+  sha_hw_write (context, data, len, grub_sha256_hw_transform);
+}
+
+static void
+sha256_hw_final (void *context)
+{
+  sha_hw_final (context, grub_sha256_hw_transform, 8);
+}
+
+static gcry_md_spec_t sha1_hw_spec =
+  {
+    .name = "SHA1",
+    .mdlen = 20,
+    .init = sha1_hw_init,
+    .write = sha1_hw_write,
+    .final = sha1_hw_final,
+    .read = sha_hw_read,
+    .contextsize = sizeof (struct sha_hw_ctx),
+    .blocksize = GRUB_SHA_HW_BLOCK_SIZE
+  };
+
+static gcry_md_spec_t sha256_hw_spec =
+  {
+    .name = "SHA256",
+    .mdlen = 32,
+    .init = sha256_hw_init,
+    .write = sha256_hw_write,
+    .final = sha256_hw_final,
+    .read = sha_hw_read,
+    .contextsize = sizeof (struct sha_hw_ctx),
+    .blocksize = GRUB_SHA_HW_BLOCK_SIZE
+  };
+
+/* Known answers of FIPS 180-2, the last one being one million 'a'.  */
+static const char *const sha_hw_kat_msgs[] =
+  {
+    "abc",
+    "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+    "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmn"
+    "hijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu"
+  };
+
+#define SHA_HW_KATS	(ARRAY_SIZE (sha_hw_kat_msgs) + 1)
+
+static const grub_uint8_t sha1_hw_kat[SHA_HW_KATS][20] =
+  {
+    {
+      0xa9, 0x99, 0x3e, 0x36, 0x47, 0x06, 0x81, 0x6a,
+      0xba, 0x3e, 0x25, 0x71, 0x78, 0x50, 0xc2, 0x6c,
+      0x9c, 0xd0, 0xd8, 0x9d
+    },
+    {
+      0x84, 0x98, 0x3e, 0x44, 0x1c, 0x3b, 0xd2, 0x6e,
+      0xba, 0xae, 0x4a, 0xa1, 0xf9, 0x51, 0x29, 0xe5,
+      0xe5, 0x46, 0x70, 0xf1
+    },
+    {
+      0xa4, 0x9b, 0x24, 0x46, 0xa0, 0x2c, 0x64, 0x5b,
+      0xf4, 0x19, 0xf9, 0x95, 0xb6, 0x70, 0x91, 0x25,
+      0x3a, 0x04, 0xa2, 0x59
+    },
+    {
+      0x34, 0xaa, 0x97, 0x3c, 0xd4, 0xc4, 0xda, 0xa4,
+      0xf6, 0x1e, 0xeb, 0x2b, 0xdb, 0xad, 0x27, 0x31,
+      0x65, 0x34, 0x01, 0x6f
+    }
+  };
+
+static const grub_uint8_t sha256_hw_kat[SHA_HW_KATS][32] =
+  {
+    {
+      0xba, 0x78, 0x16, 0xbf, 0x8f, 0x01, 0xcf, 0xea,
+      0x41, 0x41, 0x40, 0xde, 0x5d, 0xae, 0x22, 0x23,
+      0xb0, 0x03, 0x61, 0xa3, 0x96, 0x17, 0x7a, 0x9c,
+      0xb4, 0x10, 0xff, 0x61, 0xf2, 0x00, 0x15, 0xad
+    },
+    {
+      0x24, 0x8d, 0x6a, 0x61, 0xd2, 0x06, 0x38, 0xb8,
+      0xe5, 0xc0, 0x26, 0x93, 0x0c, 0x3e, 0x60, 0x39,
+      0xa3, 0x3c, 0xe4, 0x59, 0x64, 0xff, 0x21, 0x67,
+      0xf6, 0xec, 0xed, 0xd4, 0x19, 0xdb, 0x06, 0xc1
+    },
+    {
+      0xcf, 0x5b, 0x16, 0xa7, 0x78, 0xaf, 0x83, 0x80,
+      0x03, 0x6c, 0xe5, 0x9e, 0x7b, 0x04, 0x92, 0x37,
+      0x0b, 0x24, 0x9b, 0x11, 0xe8, 0xf0, 0x7a, 0x51,
+      0xaf, 0xac, 0x45, 0x03, 0x7a, 0xfe, 0xe9, 0xd1
+    },
+    {
+      0xcd, 0xc7, 0x6e, 0x5c, 0x99, 0x14, 0xfb, 0x92,
+      0x81, 0xa1, 0xc7, 0xe2, 0x84, 0xd7, 0x3e, 0x67,
+      0xf1, 0x80, 0x9a, 0x48, 0xa4, 0x97, 0x20, 0x0e,
+      0x04, 0x6d, 0x39, 0xcc, 0xc7, 0x11, 0x2c, 0xd0
+    }
+  };
+
+/* Check the CPU code against DIGESTS before it is handed out, so that a
+   broken implementation falls back to the generic one.  */
+static int
+sha_hw_selftest (const gcry_md_spec_t *spec, const grub_uint8_t *digests)
+{
+  struct sha_hw_ctx ctx;
+  char a[1000];
+  unsigned i, j;
+
+  grub_memset (a, 'a', sizeof (a));
+
+  for (i = 0; i < SHA_HW_KATS; i++, digests += spec->mdlen)
+    {
+      spec->init (&ctx);
+      if (i < ARRAY_SIZE (sha_hw_kat_msgs))
+	spec->write (&ctx, sha_hw_kat_msgs[i],
+		     grub_strlen (sha_hw_kat_msgs[i]));
+      else
+	/* Pieces not aligned to the blocks, several blocks each.  */
+	for (j = 0; j < 1000; j++)
+	  spec->write (&ctx, a, sizeof (a));
+      spec->final (&ctx);
+      if (grub_memcmp (spec->read (&ctx), digests, spec->mdlen) != 0)
+	{
+	  grub_dprintf ("crypto", "%s CPU code fails its self-test\n",
+			spec->name);
+	  return 0;
+	}
+    }
+
+  return 1;
+}
+
+static int sha1_registered, sha256_registered;
+
+GRUB_MOD_INIT (sha_hw)
+{
+  if (grub_sha1_hw_supported ()
+      && sha_hw_selftest (&sha1_hw_spec, sha1_hw_kat[0]))
+    {
+      grub_md_accel_register (&sha1_hw_spec);
+      sha1_registered = 1;
+    }
+  if (grub_sha256_hw_supported ()
+      && sha_hw_selftest (&sha256_hw_spec, sha256_hw_kat[0]))
+    {
+      grub_md_accel_register (&sha256_hw_spec);
+      sha256_registered = 1;
+    }
+}
+
+GRUB_MOD_FINI (sha_hw)
+{
+  if (sha1_registered)
+    grub_md_accel_unregister (&sha1_hw_spec);
+  if (sha256_registered)
+    grub_md_accel_unregister (&sha256_hw_spec);
+}
@@ -104,25 +104,11 @@ page_align (grub_size_t size)
   return (size + (1 << 12) - 1) & (~((1 << 12) - 1));
 }
 
-/* Helper for find_mmap_size.  */
-static int
-count_hook (grub_uint64_t addr __attribute__ ((unused)),
-	    grub_uint64_t size __attribute__ ((unused)),
-	    grub_memory_type_t type __attribute__ ((unused)), void *data)
-{
-  grub_size_t *count = data;
-
-  (*count)++;
-  return 0;
-}
-
-/* Find the optimal number of pages for the memory map. */
+/* Find the optimal number of pages for the memory map of COUNT entries. */
 static grub_size_t
-find_mmap_size (void)
+find_mmap_size (grub_size_t count)
 {
-  grub_size_t count = 0, mmap_size;
-
-  grub_mmap_iterate (count_hook, &count);
+  grub_size_t mmap_size;
 
   mmap_size = count * sizeof (struct grub_e820_mmap);
 
@@ -231,6 +217,57 @@ grub_e820_add_region (struct grub_e820_mmap *e820_map, int *e820_num,
   return GRUB_ERR_NONE;
 }
 
+/* The memory map is taken once at boot and every pass reads this copy, as
+   each grub_mmap_iterate fetches, sorts and merges the firmware map anew.  */
+static struct grub_e820_mmap *linux_mmap;
+static int linux_mmap_num;
+static int linux_mmap_allocated;
+
+static void
+linux_mmap_free (void)
+{
+  grub_free (linux_mmap);
+  linux_mmap = NULL;
+  linux_mmap_num = linux_mmap_allocated = 0;
+}
+
+/* Helper for linux_mmap_snapshot.  */
+static int
+linux_mmap_snapshot_hook (grub_uint64_t addr, grub_uint64_t size,
+			  grub_memory_type_t type,
+			  void *data __attribute__ ((unused)))
+{
+  if (linux_mmap_num == linux_mmap_allocated)
+    {
+      struct grub_e820_mmap *n;
+      grub_size_t sz;
+      int allocated = linux_mmap_allocated ? linux_mmap_allocated * 2 : 64;
+
+      if (grub_mul (allocated, sizeof (n[0]), &sz))
+	{
+	  grub_error (GRUB_ERR_OUT_OF_RANGE, N_("overflow is detected"));
+	  return 1;
+	}
+      n = grub_realloc (linux_mmap, sz);
+      if (!n)
+	return 1;
+      linux_mmap = n;
+      linux_mmap_allocated = allocated;
+    }
+
+  grub_e820_add_region (linux_mmap, &linux_mmap_num, addr, size, type);
+  return 0;
+}
+
+static grub_err_t
+linux_mmap_snapshot (void)
+{
+  linux_mmap_free ();
+  if (grub_mmap_iterate (linux_mmap_snapshot_hook, NULL))
+    return grub_errno;
+  return grub_errno;
+}
+
 static grub_err_t
 grub_linux_setup_video (struct linux_kernel_params *params)
 {
@@ -384,20 +421,6 @@ grub_linux_boot_mmap_find (grub_uint64_t addr, grub_uint64_t size,
   return 1;
 }
 
-/* GRUB types conveniently match E820 types.  */
-static int
-grub_linux_boot_mmap_fill (grub_uint64_t addr, grub_uint64_t size,
-			   grub_memory_type_t type, void *data)
-{
-  struct grub_linux_boot_ctx *ctx = data;
-
-  if (grub_e820_add_region (ctx->params->e820_map, &ctx->e820_num,
-			    addr, size, type))
-    return 1;
-
-  return 0;
-}
-
 static grub_err_t
 grub_linux_boot (void)
 {
@@ -514,7 +537,11 @@ grub_linux_boot (void)
   linux_params.acpi_rsdp_addr = grub_le_to_cpu64 (grub_rsdp_addr);
 #endif
 
-  mmap_size = find_mmap_size ();
+  err = linux_mmap_snapshot ();
+  if (err)
+    return err;
+
+  mmap_size = find_mmap_size (linux_mmap_num);
   /* Make sure that each size is aligned to a page boundary.  */
   cl_offset = ALIGN_UP (mmap_size + sizeof (linux_params), 4096);
   if (cl_offset < ((grub_size_t) linux_params.setup_sects << GRUB_DISK_SECTOR_BITS))
@@ -536,7 +563,14 @@ grub_linux_boot (void)
   if (! ctx.real_mode_target)
     grub_efi_mmap_iterate (grub_linux_boot_mmap_find, &ctx, 0);
 #else
-  grub_mmap_iterate (grub_linux_boot_mmap_find, &ctx);
+  {
+    int i;
+
+    for (i = 0; i < linux_mmap_num; i++)
+      if (grub_linux_boot_mmap_find (linux_mmap[i].addr, linux_mmap[i].size,
+				     linux_mmap[i].type, &ctx))
+	break;
+  }
 #endif
   grub_dprintf ("linux", "real_mode_target = %lx, real_size = %x, efi_mmap_size = %x\n",
                 (unsigned long) ctx.real_mode_target,
@@ -574,10 +608,14 @@ grub_linux_boot (void)
   grub_dprintf ("linux", "code32_start = %x\n",
 		(unsigned) ctx.params->code32_start);
 
-  ctx.e820_num = 0;
-  if (grub_mmap_iterate (grub_linux_boot_mmap_fill, &ctx))
-    return grub_errno;
+  /* GRUB types conveniently match E820 types.  */
+  if (linux_mmap_num > (int) ARRAY_SIZE (ctx.params->e820_map))
+    return grub_error (GRUB_ERR_OUT_OF_RANGE, "too many memory map entries");
+  grub_memcpy (ctx.params->e820_map, linux_mmap,
+	       linux_mmap_num * sizeof (linux_mmap[0]));
+  ctx.e820_num = linux_mmap_num;
   ctx.params->mmap_size = ctx.e820_num;
+  linux_mmap_free ();
 
 #ifdef GRUB_MACHINE_EFI
   {
@@ -652,6 +690,7 @@ grub_linux_unload (void)
   loaded = 0;
   grub_free (linux_cmdline);
   linux_cmdline = 0;
+  linux_mmap_free ();
   return GRUB_ERR_NONE;
 }
 
@@ -665,6 +704,7 @@ grub_cmd_linux (grub_command_t cmd __attribute__ ((unused)),
   grub_size_t real_size, prot_size, prot_file_size;
   grub_ssize_t len;
   int i;
+  int size_known;
   grub_size_t align, min_align;
   int relocatable;
   grub_uint64_t preferred_address = GRUB_LINUX_BZIMAGE_ADDR;
@@ -739,7 +779,12 @@ grub_cmd_linux (grub_command_t cmd __attribute__ ((unused)),
     setup_sects = GRUB_LINUX_DEFAULT_SETUP_SECTS;
 
   real_size = setup_sects << GRUB_DISK_SECTOR_BITS;
-  prot_file_size = grub_file_size (file) - real_size - GRUB_DISK_SECTOR_SIZE;
+  /* A kernel decompressed on the fly may have no size until it is read.  */
+  size_known = (grub_file_size (file) != GRUB_FILE_SIZE_UNKNOWN);
+  if (size_known)
+    prot_file_size = grub_file_size (file) - real_size - GRUB_DISK_SECTOR_SIZE;
+  else
+    prot_file_size = 0;
 
   if (grub_le_to_cpu16 (lh.version) >= 0x205
       && lh.kernel_alignment != 0
@@ -760,12 +805,22 @@ grub_cmd_linux (grub_command_t cmd __attribute__ ((unused)),
     {
       min_align = lh.min_alignment;
       prot_size = grub_le_to_cpu32 (lh.init_size);
+      /* The image is read where it runs, so the chunk must hold all of it
+	 even if the header underestimates.  */
+      if (prot_size < prot_file_size)
+	prot_size = prot_file_size;
       prot_init_space = page_align (prot_size);
       if (relocatable)
 	preferred_address = grub_le_to_cpu64 (lh.pref_address);
     }
   else
     {
+      if (!size_known)
+	{
+	  grub_error (GRUB_ERR_BAD_OS,
+		      "kernel without init_size must not be compressed");
+	  goto fail;
+	}
       min_align = align;
       prot_size = prot_file_size;
       /* Usually, the compression ratio is about 50%.  */
@@ -1018,10 +1073,25 @@ grub_cmd_linux (grub_command_t cmd __attribute__ ((unused)),
       goto fail;
   }
 
-  len = prot_file_size;
-  if (grub_file_read (file, prot_mode_mem, len) != len && !grub_errno)
-    grub_error (GRUB_ERR_BAD_OS, N_("premature end of file %s"),
-		argv[0]);
+  if (size_known)
+    {
+      len = prot_file_size;
+      if (grub_file_read (file, prot_mode_mem, len) != len && !grub_errno)
+	grub_error (GRUB_ERR_BAD_OS, N_("premature end of file %s"),
+		    argv[0]);
+    }
+  else
+    {
+      /* Decompress straight into the chunk, which init_size bounds.  */
+      len = grub_file_read (file, prot_mode_mem, prot_size);
+      if (len == (grub_ssize_t) prot_size)
+	{
+	  grub_uint8_t c;
+
+	  if (grub_file_read (file, &c, 1) > 0)
+	    grub_error (GRUB_ERR_BAD_OS, "kernel is larger than its init_size");
+	}
+    }
 
   if (grub_errno == GRUB_ERR_NONE)
     {
@@ -55,6 +55,11 @@ set_field (char *var, grub_uint32_t val)
     *ptr++ = hex((val >> i) & 0xf);
 }
 
+/*
+ * Write the newc header of the path NAME straight into the initrd at PTR.
+ * LEN counts the trailing NUL byte, which is written here, so NAME does not
+ * have to be terminated: directories are a prefix of the path of a file.
+ */
 static grub_uint8_t *
 make_header (grub_uint8_t *ptr,
 	     const char *name, grub_size_t len,
@@ -65,7 +70,6 @@ make_header (grub_uint8_t *ptr,
   grub_uint8_t *optr;
   grub_size_t oh = 0;
 
-  grub_dprintf ("linux", "newc: Creating path '%s', mode=%s%o, size=%" PRIuGRUB_OFFSET "\n", name, (mode == 0) ? "" : "0", mode, fsize);
   grub_memcpy (head->magic, "070701", 6);
   set_field (head->ino, 0);
   set_field (head->mode, mode);
@@ -82,7 +86,9 @@ make_header (grub_uint8_t *ptr,
   set_field (head->check, 0);
   optr = ptr;
   ptr += sizeof (struct newc_head);
-  grub_memcpy (ptr, name, len);
+  grub_memcpy (ptr, name, len - 1);
+  ptr[len - 1] = '\0';
+  grub_dprintf ("linux", "newc: Creating path '%s', mode=%s%o, size=%" PRIuGRUB_OFFSET "\n", (char *) ptr, (mode == 0) ? "" : "0", mode, fsize);
   ptr += len;
   oh = ALIGN_UP_OVERHEAD (ptr - optr, 4);
   grub_memset (ptr, 0, oh);
@@ -129,21 +135,7 @@ insert_dir (const char *name, struct dir **root,
 	  n->next = *head;
 	  n->name = grub_strndup (cb, ce - cb);
 	  if (ptr)
-	    {
-	      /*
-	       * Create the substring with the trailing NUL byte
-	       * to be included in the cpio header.
-	       */
-	      char *tmp_name = grub_strndup (name, ce - name);
-	      if (!tmp_name) {
-		grub_free (n->name);
-		grub_free (n);
-		return grub_errno;
-	      }
-	      ptr = make_header (ptr, tmp_name, ce - name + 1,
-				 040777, 0);
-	      grub_free (tmp_name);
-	    }
+	    ptr = make_header (ptr, name, ce - name + 1, 040777, 0);
 	  if (grub_add (*size,
 		        ALIGN_UP ((ce - (char *) name + 1)
 				  + sizeof (struct newc_head), 4),
@@ -50,6 +50,7 @@
 #include <grub/video.h>
 #include <grub/memory.h>
 #include <grub/i18n.h>
+#include <grub/safemath.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -358,6 +359,51 @@ grub_cmd_multiboot (grub_command_t cmd __attribute__ ((unused)),
   return grub_errno;
 }
 
+/* Read FILE, whose size is only known once it ends, into a heap buffer.  */
+static grub_err_t
+read_unknown_size (grub_file_t file, void **data, grub_size_t *size)
+{
+  char *buf = NULL, *n;
+  grub_size_t allocated = 0, got = 0;
+  grub_ssize_t r;
+
+  for (;;)
+    {
+      if (got == allocated)
+	{
+	  if (!allocated)
+	    allocated = 1 << 20;
+	  else if (grub_mul (allocated, 2, &allocated))
+	    {
+	      grub_free (buf);
+	      return grub_error (GRUB_ERR_OUT_OF_RANGE,
+				 N_("overflow is detected"));
+	    }
+	  n = grub_realloc (buf, allocated);
+	  if (!n)
+	    {
+	      grub_free (buf);
+	      return grub_errno;
+	    }
+	  buf = n;
+	}
+
+      r = grub_file_read (file, buf + got, allocated - got);
+      if (r < 0)
+	{
+	  grub_free (buf);
+	  return grub_errno;
+	}
+      if (r == 0)
+	break;
+      got += r;
+    }
+
+  *data = buf;
+  *size = got;
+  return GRUB_ERR_NONE;
+}
+
 static grub_err_t
 grub_cmd_module (grub_command_t cmd __attribute__ ((unused)),
 		 int argc, char *argv[])
@@ -365,6 +411,7 @@ grub_cmd_module (grub_command_t cmd __attribute__ ((unused)),
   grub_file_t file = 0;
   grub_ssize_t size;
   void *module = NULL;
+  void *data = NULL;
   grub_addr_t target;
   grub_err_t err;
   int nounzip = 0;
@@ -398,7 +445,23 @@ grub_cmd_module (grub_command_t cmd __attribute__ ((unused)),
     lowest_addr = ALIGN_UP (highest_load + 1048576, 4096);
 #endif
 
-  size = grub_file_size (file);
+  if (grub_file_size (file) == GRUB_FILE_SIZE_UNKNOWN)
+    {
+      grub_size_t sz;
+
+      /* Decompressed on the fly or streamed from the network: gather it
+	 first and copy it into place once its size is known.  */
+      err = read_unknown_size (file, &data, &sz);
+      if (err)
+	{
+	  grub_file_close (file);
+	  return err;
+	}
+      size = sz;
+    }
+  else
+    size = grub_file_size (file);
+
   if (size)
   {
     grub_relocator_chunk_t ch;
@@ -408,6 +471,7 @@ grub_cmd_module (grub_command_t cmd __attribute__ ((unused)),
 					    GRUB_RELOCATOR_PREFERENCE_NONE, 1);
     if (err)
       {
+	grub_free (data);
 	grub_file_close (file);
 	return err;
       }
@@ -423,11 +487,17 @@ grub_cmd_module (grub_command_t cmd __attribute__ ((unused)),
   err = GRUB_MULTIBOOT (add_module) (target, size, argc - 1, argv + 1);
   if (err)
     {
+      grub_free (data);
       grub_file_close (file);
       return err;
     }
 
-  if (size && grub_file_read (file, module, size) != size)
+  if (data)
+    {
+      grub_memcpy (module, data, size);
+      grub_free (data);
+    }
+  else if (size && grub_file_read (file, module, size) != size)
     {
       grub_file_close (file);
       if (!grub_errno)
@@ -132,6 +132,7 @@ grub_efi_mmap_iterate (grub_memory_hook_t hook, void *hook_data,
 	}
     }
 
+  grub_free (map_buf);
   return GRUB_ERR_NONE;
 }
 
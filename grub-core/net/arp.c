@@ -52,16 +52,14 @@ struct arppkt {
 static int have_pending;
 static grub_uint32_t pending_req;
 
-grub_err_t
-grub_net_arp_send_request (struct grub_net_network_level_interface *inf,
-			   const grub_net_network_level_address_t *proto_addr)
+static grub_err_t
+arp_send (struct grub_net_network_level_interface *inf,
+	  const grub_net_network_level_address_t *proto_addr)
 {
   struct grub_net_buff nb;
   struct arppkt *arp_packet;
   grub_net_link_level_address_t target_mac_addr;
   grub_err_t err;
-  int i;
-  grub_uint8_t *nbd;
   grub_uint8_t arp_data[128];
 
   if (proto_addr->type != GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV4)
@@ -91,8 +89,20 @@ grub_net_arp_send_request (struct grub_net_network_level_interface *inf,
   /* Target protocol address */
   grub_memset (&target_mac_addr.mac, 0xff, 6);
 
-  nbd = nb.data;
-  send_ethernet_packet (inf, &nb, target_mac_addr, GRUB_NET_ETHERTYPE_ARP);
+  return send_ethernet_packet (inf, &nb, target_mac_addr,
+			       GRUB_NET_ETHERTYPE_ARP);
+}
+
+grub_err_t
+grub_net_arp_send_request (struct grub_net_network_level_interface *inf,
+			   const grub_net_network_level_address_t *proto_addr)
+{
+  int i;
+
+  if (proto_addr->type != GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV4)
+    return grub_error (GRUB_ERR_BUG, "unsupported address family");
+
+  arp_send (inf, proto_addr);
   for (i = 0; i < GRUB_NET_TRIES; i++)
     {
       if (grub_net_link_layer_resolve_check (inf, proto_addr))
@@ -103,13 +113,19 @@ grub_net_arp_send_request (struct grub_net_network_level_interface *inf,
                            &have_pending);
       if (grub_net_link_layer_resolve_check (inf, proto_addr))
 	return GRUB_ERR_NONE;
-      nb.data = nbd;
-      send_ethernet_packet (inf, &nb, target_mac_addr, GRUB_NET_ETHERTYPE_ARP);
+      arp_send (inf, proto_addr);
     }
 
   return GRUB_ERR_NONE;
 }
 
+grub_err_t
+grub_net_arp_prefetch (struct grub_net_network_level_interface *inf,
+		       const grub_net_network_level_address_t *proto_addr)
+{
+  return arp_send (inf, proto_addr);
+}
+
 grub_err_t
 grub_net_arp_receive (struct grub_net_buff *nb, struct grub_net_card *card,
                       grub_uint16_t *vlantag)
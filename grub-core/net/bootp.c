@@ -224,6 +224,28 @@ again:
 
 #define OFFSET_OF(x, y) ((grub_size_t)((grub_uint8_t *)((y)->x) - (grub_uint8_t *)(y)))
 
+/* Ask for the hardware address of the next hop towards ADDR now, so that
+   it is known by the time the first packet goes there.  Return the next
+   hop.  */
+static grub_uint32_t
+prefetch_next_hop (grub_uint32_t addr)
+{
+  grub_net_network_level_address_t target, gateway;
+  struct grub_net_network_level_interface *inf;
+
+  target.type = GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV4;
+  target.ipv4 = addr;
+  target.option = 0;
+  if (grub_net_route_address (target, &gateway, &inf)
+      || gateway.type != GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV4)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return 0;
+    }
+  grub_net_link_layer_prefetch (inf, &gateway);
+  return gateway.ipv4;
+}
+
 struct grub_net_network_level_interface *
 grub_net_configure_by_dhcp_ack (const char *name,
 				struct grub_net_card *card,
@@ -241,6 +263,7 @@ grub_net_configure_by_dhcp_ack (const char *name,
   grub_uint8_t opt_len, overload = 0;
   const char *boot_file = 0, *server_name = 0;
   grub_size_t boot_file_len, server_name_len;
+  grub_uint32_t router = 0, hop = 0;
 
   addr.type = GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV4;
   addr.ipv4 = bp->your_ip;
@@ -384,8 +407,16 @@ grub_net_configure_by_dhcp_ack (const char *name,
       if (rname)
 	grub_net_add_route_gw (rname, target, gw, 0);
       grub_free (rname);
+      router = gw.ipv4;
     }
 
+  /* The boot server is the first to be talked to, through the gateway
+     unless it is on the link.  */
+  if (bp->server_ip)
+    hop = prefetch_next_hop (bp->server_ip);
+  if (router && router != hop)
+    prefetch_next_hop (router);
+
   opt = find_dhcp_option (bp, size, GRUB_NET_BOOTP_DNS, &opt_len);
   if (opt && opt_len && !(opt_len & 3))
     {
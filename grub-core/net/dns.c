@@ -112,6 +112,11 @@ enum
     DNS_PORT = 53
   };
 
+/* Queries are sent DNS_ROUNDS times, waiting twice as long for the replies
+   after each round.  */
+#define DNS_ROUNDS		4
+#define DNS_FIRST_WAIT_MS	125
+
 struct recv_data
 {
   grub_size_t *naddresses;
@@ -122,6 +127,9 @@ struct recv_data
   char *name;
   const char *oname;
   int stop;
+  /* The queries sent in the first round and the replies to them.  */
+  unsigned queries;
+  unsigned answered;
 };
 
 static inline int
@@ -273,6 +281,7 @@ recv_hook (grub_net_udp_socket_t sock __attribute__ ((unused)),
     goto out;
   if (!(head->flags & FLAGS_RESPONSE) || (head->flags & FLAGS_OPCODE))
     goto out;
+  data->answered++;
   if (head->ra_z_r_code & ERRCODE_MASK)
     {
       data->dns_err = 1;
@@ -414,6 +423,9 @@ recv_hook (grub_net_udp_socket_t sock __attribute__ ((unused)),
     }
 
  out:
+  /* Resending does not help once every query got a negative answer.  */
+  if (data->queries && data->answered >= data->queries)
+    data->stop = 1;
   grub_netbuff_free (nb);
   grub_free (redirect_save);
   if (!*data->naddresses)
@@ -440,9 +452,10 @@ grub_net_dns_lookup (const char *name,
   grub_uint8_t *qtypeptr;
   grub_err_t err = GRUB_ERR_NONE;
   struct recv_data data = {naddresses, addresses, cache,
-			   grub_cpu_to_be16 (id++), 0, 0, name, 0};
+			   grub_cpu_to_be16 (id++), 0, 0, name, 0, 0, 0};
   grub_uint8_t *nbd;
-  grub_size_t try_server = 0;
+  grub_size_t *socket_servers;
+  grub_uint32_t wait;
 
   if (!servers)
     {
@@ -478,11 +491,18 @@ grub_net_dns_lookup (const char *name,
   sockets = grub_calloc (n_servers, sizeof (sockets[0]));
   if (!sockets)
     return grub_errno;
+  socket_servers = grub_calloc (n_servers, sizeof (socket_servers[0]));
+  if (!socket_servers)
+    {
+      grub_free (sockets);
+      return grub_errno;
+    }
 
   data.name = grub_strdup (name);
   if (!data.name)
     {
       grub_free (sockets);
+      grub_free (socket_servers);
       return grub_errno;
     }
 
@@ -494,6 +514,7 @@ grub_net_dns_lookup (const char *name,
   if (!nb)
     {
       grub_free (sockets);
+      grub_free (socket_servers);
       grub_free (data.name);
       return grub_errno;
     }
@@ -513,7 +534,9 @@ grub_net_dns_lookup (const char *name,
       if ((dot - iptr) >= 64)
 	{
 	  grub_free (sockets);
+	  grub_free (socket_servers);
 	  grub_free (data.name);
+	  grub_netbuff_free (nb);
 	  return grub_error (GRUB_ERR_BAD_ARGUMENT,
 			     N_("domain name component is too long"));
 	}
@@ -545,59 +568,59 @@ grub_net_dns_lookup (const char *name,
 
   nbd = nb->data;
 
-  for (i = 0; i < n_servers * 4; i++)
+  /* Ask all the servers at once and take the first answer.  */
+  for (i = 0; i < n_servers; i++)
     {
-      /* Connect to a next server.  */
-      while (!(i & 1) && try_server < n_servers)
+      sockets[send_servers] = grub_net_udp_open (servers[i], DNS_PORT,
+						 recv_hook, &data);
+      if (!sockets[send_servers])
 	{
-	  sockets[send_servers] = grub_net_udp_open (servers[try_server++],
-						     DNS_PORT,
-						     recv_hook,
-						     &data);
-	  if (!sockets[send_servers])
-	    {
-	      err = grub_errno;
-	      grub_errno = GRUB_ERR_NONE;
-	    }
-	  else
-	    {
-	      send_servers++;
-	      break;
-	    }
+	  err = grub_errno;
+	  grub_errno = GRUB_ERR_NONE;
+	  continue;
 	}
-      if (!send_servers)
-	goto out;
-      if (*data.naddresses)
-	goto out;
+      socket_servers[send_servers++] = i;
+    }
+  if (!send_servers)
+    goto out;
+
+  for (i = 0, wait = DNS_FIRST_WAIT_MS; i < DNS_ROUNDS; i++, wait *= 2)
+    {
       for (j = 0; j < send_servers; j++)
 	{
-          grub_err_t err2;
-
-          grub_size_t t = 0;
-          do
-            {
-              nb->data = nbd;
-              if (servers[j].option == DNS_OPTION_IPV4 ||
-                 ((servers[j].option == DNS_OPTION_PREFER_IPV4) && (t++ == 0)) ||
-                 ((servers[j].option == DNS_OPTION_PREFER_IPV6) && (t++ == 1)))
-                *qtypeptr = GRUB_DNS_QTYPE_A;
-              else
-                *qtypeptr = GRUB_DNS_QTYPE_AAAA;
-
-              grub_dprintf ("dns", "QTYPE: %u QNAME: %s\n", *qtypeptr, name);
-
-              err2 = grub_net_send_udp_packet (sockets[j], nb);
-              if (err2)
-                {
-                  grub_errno = GRUB_ERR_NONE;
-                  err = err2;
-                }
-              if (*data.naddresses)
-                goto out;
-            }
-          while (t == 1);
+	  const struct grub_net_network_level_address *server;
+	  grub_err_t err2;
+	  grub_size_t t = 0;
+
+	  server = &servers[socket_servers[j]];
+	  do
+	    {
+	      nb->data = nbd;
+	      if (server->option == DNS_OPTION_IPV4 ||
+		 ((server->option == DNS_OPTION_PREFER_IPV4) && (t++ == 0)) ||
+		 ((server->option == DNS_OPTION_PREFER_IPV6) && (t++ == 1)))
+		*qtypeptr = GRUB_DNS_QTYPE_A;
+	      else
+		*qtypeptr = GRUB_DNS_QTYPE_AAAA;
+
+	      grub_dprintf ("dns", "QTYPE: %u QNAME: %s\n", *qtypeptr, name);
+
+	      err2 = grub_net_send_udp_packet (sockets[j], nb);
+	      if (err2)
+		{
+		  grub_errno = GRUB_ERR_NONE;
+		  err = err2;
+		}
+	      else if (i == 0)
+		data.queries++;
+	      if (*data.naddresses)
+		goto out;
+	    }
+	  while (t == 1);
 	}
-      grub_net_poll_cards (200, &data.stop);
+      grub_net_poll_cards (wait, &data.stop);
+      if (data.stop)
+	goto out;
     }
  out:
   grub_free (data.name);
@@ -606,6 +629,7 @@ grub_net_dns_lookup (const char *name,
     grub_net_udp_close (sockets[j]);
 
   grub_free (sockets);
+  grub_free (socket_servers);
 
   if (*data.naddresses)
     return GRUB_ERR_NONE;
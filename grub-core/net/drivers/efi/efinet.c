@@ -30,6 +30,9 @@ GRUB_MOD_LICENSE ("GPLv3+");
 static grub_guid_t net_io_guid = GRUB_EFI_SIMPLE_NETWORK_GUID;
 static grub_guid_t pxe_io_guid = GRUB_EFI_PXE_GUID;
 
+/* The number of receive buffers to set aside when a card is opened.  */
+#define EFINET_RX_POOL	32
+
 static grub_err_t
 send_card_buffer (struct grub_net_card *dev,
 		  struct grub_net_buff *pack)
@@ -100,45 +103,48 @@ get_card_packet (struct grub_net_card *dev)
   grub_efi_simple_network_t *net = dev->efi_net;
   grub_err_t err;
   grub_efi_status_t st;
-  grub_efi_uintn_t bufsize = dev->rcvbufsize;
+  grub_efi_uintn_t bufsize;
   struct grub_net_buff *nb;
   int i;
 
   if (net == NULL)
     return NULL;
 
+  /*
+   * Receive straight into the packet: the buffers come out of the pool of
+   * freed ones, so a poll that finds nothing does not cost an allocation.
+   */
   for (i = 0; i < 2; i++)
     {
-      if (!dev->rcvbuf)
-	dev->rcvbuf = grub_malloc (dev->rcvbufsize);
-      if (!dev->rcvbuf)
+      nb = grub_netbuff_alloc (dev->rcvbufsize + 2);
+      if (!nb)
 	return NULL;
 
+      /* Reserve 2 bytes so that 2 + 14/18 bytes of ethernet header is
+	 divisible by 4. So that IP header is aligned on 4 bytes. */
+      if (grub_netbuff_reserve (nb, 2))
+	{
+	  grub_netbuff_free (nb);
+	  return NULL;
+	}
+
+      bufsize = dev->rcvbufsize;
       st = net->receive (net, NULL, &bufsize,
-		         dev->rcvbuf, NULL, NULL, NULL);
+			 nb->data, NULL, NULL, NULL);
       if (st != GRUB_EFI_BUFFER_TOO_SMALL)
 	break;
       dev->rcvbufsize = 2 * ALIGN_UP (dev->rcvbufsize > bufsize
 				      ? dev->rcvbufsize : bufsize, 64);
-      grub_free (dev->rcvbuf);
-      dev->rcvbuf = 0;
+      grub_netbuff_free (nb);
+      nb = NULL;
     }
 
   if (st != GRUB_EFI_SUCCESS)
-    return NULL;
-
-  nb = grub_netbuff_alloc (bufsize + 2);
-  if (!nb)
-    return NULL;
-
-  /* Reserve 2 bytes so that 2 + 14/18 bytes of ethernet header is divisible
-     by 4. So that IP header is aligned on 4 bytes. */
-  if (grub_netbuff_reserve (nb, 2))
     {
       grub_netbuff_free (nb);
       return NULL;
     }
-  grub_memcpy (nb->data, dev->rcvbuf, bufsize);
+
   err = grub_netbuff_put (nb, bufsize);
   if (err)
     {
@@ -149,6 +155,21 @@ get_card_packet (struct grub_net_card *dev)
   return nb;
 }
 
+static grub_size_t
+get_card_packets (struct grub_net_card *dev, struct grub_net_buff **bufs,
+		  grub_size_t max)
+{
+  grub_size_t n;
+
+  for (n = 0; n < max; n++)
+    {
+      bufs[n] = get_card_packet (dev);
+      if (!bufs[n])
+	break;
+    }
+  return n;
+}
+
 static grub_err_t
 open_card (struct grub_net_card *dev)
 {
@@ -205,6 +226,10 @@ open_card (struct grub_net_card *dev)
 	}
 
       dev->efi_net = net;
+
+      /* A burst of frames is received before any of them is processed.  */
+      grub_netbuff_pool_reserve (dev->rcvbufsize + 2, EFINET_RX_POOL);
+      grub_errno = GRUB_ERR_NONE;
     } else {
       return grub_error (GRUB_ERR_NET_NO_CARD, "%s: can't open protocol",
 			 dev->name);
@@ -227,7 +252,8 @@ static struct grub_net_card_driver efidriver =
     .open = open_card,
     .close = close_card,
     .send = send_card_buffer,
-    .recv = get_card_packet
+    .recv = get_card_packet,
+    .recv_batch = get_card_packets
   };
 
 grub_efi_handle_t
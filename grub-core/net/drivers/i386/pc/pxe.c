@@ -63,39 +63,6 @@ struct grub_pxe_undi_info
 } GRUB_PACKED;
 
 
-struct grub_pxe_undi_isr
-{
-  grub_uint16_t status;
-  grub_uint16_t func_flag;
-  grub_uint16_t buffer_len;
-  grub_uint16_t frame_len;
-  grub_uint16_t frame_hdr_len;
-  grub_uint32_t buffer;
-  grub_uint8_t prot_type;
-  grub_uint8_t pkt_type;
-} GRUB_PACKED;
-
-enum
-  {
-    GRUB_PXE_ISR_IN_START = 1,
-    GRUB_PXE_ISR_IN_PROCESS,
-    GRUB_PXE_ISR_IN_GET_NEXT
-  };
-
-enum
-  {
-    GRUB_PXE_ISR_OUT_OURS = 0,
-    GRUB_PXE_ISR_OUT_NOT_OURS = 1
-  };
-
-enum
-  {
-    GRUB_PXE_ISR_OUT_DONE = 0,
-    GRUB_PXE_ISR_OUT_TRANSMIT = 2,
-    GRUB_PXE_ISR_OUT_RECEIVE = 3,
-    GRUB_PXE_ISR_OUT_BUSY = 4,
-  };
-
 struct grub_pxe_undi_transmit
 {
   grub_uint16_t status;
@@ -166,85 +133,72 @@ grub_pxe_scan (void)
   return bangpxe;
 }
 
-static struct grub_net_buff *
-grub_pxe_recv (struct grub_net_card *dev __attribute__ ((unused)))
-{
-  struct grub_pxe_undi_isr *isr;
-  static int in_progress = 0;
-  grub_uint8_t *ptr, *end;
-  struct grub_net_buff *buf;
+/* Slots of the receive ring, which takes the whole scratch area.  */
+#define PXE_RING_SLOTS \
+  ((GRUB_MEMORY_MACHINE_SCRATCH_SIZE - GRUB_PXE_RING_HEADER_SIZE) \
+   / GRUB_PXE_RING_SLOT_SIZE)
 
-  isr = (void *) grub_absolute_pointer (GRUB_MEMORY_MACHINE_SCRATCH_ADDR);
+/* The function to call the UNDI ISR with the next time.  */
+static grub_uint16_t ring_next = GRUB_PXE_ISR_IN_START;
 
-  if (!in_progress)
-    {
-      grub_memset (isr, 0, sizeof (*isr));
-      isr->func_flag = GRUB_PXE_ISR_IN_START;
-      grub_pxe_call (GRUB_PXENV_UNDI_ISR, isr, pxe_rm_entry);
-      /* Normally according to the specification we should also check
-	 that isr->func_flag != GRUB_PXE_ISR_OUT_OURS but unfortunately it
-	 breaks on intel cards.
-       */
-      if (isr->status)
-	{
-	  in_progress = 0;
-	  return NULL;
-	}
-      grub_memset (isr, 0, sizeof (*isr));
-      isr->func_flag = GRUB_PXE_ISR_IN_PROCESS;
-      grub_pxe_call (GRUB_PXENV_UNDI_ISR, isr, pxe_rm_entry);
-    }
-  else
-    {
-      grub_memset (isr, 0, sizeof (*isr));
-      isr->func_flag = GRUB_PXE_ISR_IN_GET_NEXT;
-      grub_pxe_call (GRUB_PXENV_UNDI_ISR, isr, pxe_rm_entry);
-    }
-
-  while (isr->func_flag != GRUB_PXE_ISR_OUT_RECEIVE)
+static grub_size_t
+grub_pxe_recv_batch (struct grub_net_card *dev __attribute__ ((unused)),
+		     struct grub_net_buff **bufs, grub_size_t max)
+{
+  struct grub_pxe_ring *ring;
+  struct grub_pxe_ring_slot *slots;
+  struct grub_net_buff *buf;
+  grub_size_t i, n = 0;
+
+  COMPILE_TIME_ASSERT (sizeof (struct grub_pxe_ring)
+		       == GRUB_PXE_RING_HEADER_SIZE);
+  COMPILE_TIME_ASSERT (sizeof (struct grub_pxe_ring_slot)
+		       == GRUB_PXE_RING_SLOT_SIZE);
+
+  ring = (void *) grub_absolute_pointer (GRUB_MEMORY_MACHINE_SCRATCH_ADDR);
+  slots = (void *) grub_absolute_pointer (GRUB_MEMORY_MACHINE_SCRATCH_ADDR
+					  + GRUB_PXE_RING_HEADER_SIZE);
+
+  /* The scratch area is shared with sending, so the ring is emptied
+     every time.  */
+  grub_memset (ring, 0, sizeof (*ring));
+  ring->next = ring_next;
+  ring->nslots = grub_min (max, PXE_RING_SLOTS);
+  ring->entry = pxe_rm_entry;
+  grub_pxe_recv_ring (ring);
+  ring_next = ring->next;
+
+  for (i = 0; i < ring->count; i++)
     {
-      if (isr->status || isr->func_flag == GRUB_PXE_ISR_OUT_DONE)
+      /* Only the start of a frame bigger than a slot was kept.  */
+      if (slots[i].frame_len > sizeof (slots[i].data))
+	continue;
+
+      buf = grub_netbuff_alloc (slots[i].frame_len + 2);
+      if (!buf)
+	break;
+      /* Reserve 2 bytes so that 2 + 14/18 bytes of ethernet header is
+	 divisible by 4. So that IP header is aligned on 4 bytes. */
+      if (grub_netbuff_reserve (buf, 2))
 	{
-	  in_progress = 0;
-	  return NULL;
+	  grub_netbuff_free (buf);
+	  break;
 	}
-      grub_memset (isr, 0, sizeof (*isr));
-      isr->func_flag = GRUB_PXE_ISR_IN_GET_NEXT;
-      grub_pxe_call (GRUB_PXENV_UNDI_ISR, isr, pxe_rm_entry);
+      grub_netbuff_put (buf, slots[i].frame_len);
+      grub_memcpy (buf->data, slots[i].data, slots[i].frame_len);
+      bufs[n++] = buf;
     }
 
-  buf = grub_netbuff_alloc (isr->frame_len + 2);
-  if (!buf)
-    return NULL;
-  /* Reserve 2 bytes so that 2 + 14/18 bytes of ethernet header is divisible
-     by 4. So that IP header is aligned on 4 bytes. */
-  if (grub_netbuff_reserve (buf, 2))
-    {
-      grub_netbuff_free (buf);
-      return NULL;
-    }
-  ptr = buf->data;
-  end = ptr + isr->frame_len;
-  grub_netbuff_put (buf, isr->frame_len);
-  grub_memcpy (ptr, LINEAR (isr->buffer), isr->buffer_len);
-  ptr += isr->buffer_len;
-  while (ptr < end)
-    {
-      grub_memset (isr, 0, sizeof (*isr));
-      isr->func_flag = GRUB_PXE_ISR_IN_GET_NEXT;
-      grub_pxe_call (GRUB_PXENV_UNDI_ISR, isr, pxe_rm_entry);
-      if (isr->status || isr->func_flag != GRUB_PXE_ISR_OUT_RECEIVE)
-	{
-	  in_progress = 1;
-	  grub_netbuff_free (buf);
-	  return NULL;
-	}
+  return n;
+}
 
-      grub_memcpy (ptr, LINEAR (isr->buffer), isr->buffer_len);
-      ptr += isr->buffer_len;
-    }
-  in_progress = 1;
+static struct grub_net_buff *
+grub_pxe_recv (struct grub_net_card *dev)
+{
+  struct grub_net_buff *buf;
 
+  if (grub_pxe_recv_batch (dev, &buf, 1) != 1)
+    return NULL;
   return buf;
 }
 
@@ -302,7 +256,8 @@ struct grub_net_card_driver grub_pxe_card_driver =
   .open = grub_pxe_open,
   .close = grub_pxe_close,
   .send = grub_pxe_send,
-  .recv = grub_pxe_recv
+  .recv = grub_pxe_recv,
+  .recv_batch = grub_pxe_recv_batch
 };
 
 struct grub_net_card grub_pxe_card =
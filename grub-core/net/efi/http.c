@@ -0,0 +1,528 @@
+/* http.c - leave HTTP transfers to the HTTP stack of the firmware.  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/charset.h>
+#include <grub/dl.h>
+#include <grub/efi/api.h>
+#include <grub/efi/efi.h>
+#include <grub/err.h>
+#include <grub/file.h>
+#include <grub/i18n.h>
+#include <grub/misc.h>
+#include <grub/mm.h>
+#include <grub/net.h>
+#include <grub/net/netbuff.h>
+#include <grub/time.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+static grub_guid_t http_sb_guid = GRUB_EFI_HTTP_SERVICE_BINDING_PROTOCOL_GUID;
+static grub_guid_t http_guid = GRUB_EFI_HTTP_PROTOCOL_GUID;
+
+/* The body is received in pieces of this size, and up to EFIHTTP_AHEAD of
+   them wait for the reader.  */
+#define EFIHTTP_CHUNK_SIZE	(32 * 1024)
+#define EFIHTTP_AHEAD		8
+
+/* How long the firmware gets to complete a request or a piece.  */
+#define EFIHTTP_TIMEOUT_MS	30000
+
+struct efihttp_data
+{
+  grub_efi_service_binding_t *sb;
+  grub_efi_handle_t child;
+  grub_efi_http_t *http;
+  grub_efi_event_t event;
+  grub_efi_char16_t *url;
+  char *host;
+  /* The body bytes still to come, if the size is known.  */
+  grub_off_t left;
+  int size_known;
+  /* The error that cut the body short, reported to every read after.  */
+  struct grub_error_saved err;
+};
+typedef struct efihttp_data *efihttp_data_t;
+
+/* Find the firmware HTTP service, on the card GRUB booted from if it has
+   one.  */
+static grub_efi_handle_t
+efihttp_find_service (void)
+{
+  grub_efi_handle_t *handles, ret = NULL;
+  grub_efi_uintn_t num_handles, i;
+  struct grub_net_card *card;
+
+  handles = grub_efi_locate_handle (GRUB_EFI_BY_PROTOCOL, &http_sb_guid,
+				    0, &num_handles);
+  if (!handles)
+    return NULL;
+
+  FOR_NET_CARDS (card)
+    {
+      if (grub_strcmp (card->driver->name, "efinet") != 0)
+	continue;
+      for (i = 0; i < num_handles && !ret; i++)
+	if (handles[i] == card->efi_handle)
+	  ret = handles[i];
+    }
+  if (!ret && num_handles)
+    ret = handles[0];
+
+  grub_free (handles);
+  return ret;
+}
+
+/* Drive the firmware until TOKEN completes and return its status.  */
+static grub_efi_status_t
+efihttp_wait (efihttp_data_t data, grub_efi_http_token_t *token)
+{
+  grub_efi_boot_services_t *b = grub_efi_system_table->boot_services;
+  grub_uint64_t start = grub_get_time_ms ();
+
+  while (b->check_event (token->event) == GRUB_EFI_NOT_READY)
+    {
+      data->http->poll (data->http);
+      if (grub_get_time_ms () - start > EFIHTTP_TIMEOUT_MS)
+	{
+	  data->http->cancel (data->http, token);
+	  return GRUB_EFI_TIMEOUT;
+	}
+    }
+  return token->status;
+}
+
+static void
+efihttp_free_headers (grub_efi_http_header_t *headers, grub_efi_uintn_t count)
+{
+  grub_efi_boot_services_t *b = grub_efi_system_table->boot_services;
+  grub_efi_uintn_t i;
+
+  if (!headers)
+    return;
+  for (i = 0; i < count; i++)
+    {
+      if (headers[i].field_name)
+	b->free_pool (headers[i].field_name);
+      if (headers[i].field_value)
+	b->free_pool (headers[i].field_value);
+    }
+  b->free_pool (headers);
+}
+
+static void
+efihttp_disconnect (efihttp_data_t data)
+{
+  if (data->http)
+    {
+      data->http->cancel (data->http, NULL);
+      grub_efi_close_protocol (data->child, &http_guid);
+      data->http = NULL;
+    }
+  if (data->child)
+    {
+      data->sb->destroy_child (data->sb, data->child);
+      data->child = NULL;
+    }
+}
+
+/* Send the GET request for the file from OFFSET on and take the headers of
+   the response.  */
+static grub_err_t
+efihttp_connect (struct grub_file *file, grub_off_t offset)
+{
+  efihttp_data_t data = file->data;
+  grub_efi_httpv4_access_point_t ipv4 = { .use_default_address = 1 };
+  grub_efi_httpv6_access_point_t ipv6;
+  grub_efi_http_config_data_t config;
+  grub_efi_http_request_data_t request;
+  grub_efi_http_response_data_t response;
+  grub_efi_http_header_t headers[3];
+  grub_efi_http_message_t message;
+  grub_efi_http_token_t token;
+  grub_efi_status_t status;
+  grub_efi_uintn_t i;
+  char range[sizeof ("bytes=18446744073709551615-")];
+  int nheaders = 0;
+
+  if (data->sb->create_child (data->sb, &data->child) != GRUB_EFI_SUCCESS)
+    {
+      data->child = NULL;
+      return grub_error (GRUB_ERR_NET_NO_CARD,
+			 N_("firmware HTTP stack is not usable"));
+    }
+  data->http = grub_efi_open_protocol (data->child, &http_guid,
+				       GRUB_EFI_OPEN_PROTOCOL_GET_PROTOCOL);
+  if (!data->http)
+    {
+      efihttp_disconnect (data);
+      return grub_error (GRUB_ERR_NET_NO_CARD,
+			 N_("firmware HTTP stack is not usable"));
+    }
+
+  grub_memset (&config, 0, sizeof (config));
+  config.http_version = GRUB_EFI_HTTP_VERSION_11;
+  config.timeout_millisec = EFIHTTP_TIMEOUT_MS;
+  if (data->host[0] == '[')
+    {
+      grub_memset (&ipv6, 0, sizeof (ipv6));
+      config.local_address_is_ipv6 = 1;
+      config.access_point.ipv6_node = &ipv6;
+    }
+  else
+    config.access_point.ipv4_node = &ipv4;
+
+  status = data->http->configure (data->http, &config);
+  if (status != GRUB_EFI_SUCCESS)
+    {
+      efihttp_disconnect (data);
+      return grub_error (GRUB_ERR_NET_NO_CARD,
+			 N_("couldn't configure firmware HTTP stack"));
+    }
+
+  headers[nheaders].field_name = (char *) "Host";
+  headers[nheaders++].field_value = data->host;
+  headers[nheaders].field_name = (char *) "User-Agent";
+  headers[nheaders++].field_value = (char *) PACKAGE_STRING;
+  if (offset)
+    {
+      grub_snprintf (range, sizeof (range), "bytes=%" PRIuGRUB_UINT64_T "-",
+		     offset);
+      headers[nheaders].field_name = (char *) "Range";
+      headers[nheaders++].field_value = range;
+    }
+
+  request.method = GRUB_EFI_HTTP_METHOD_GET;
+  request.url = data->url;
+  grub_memset (&message, 0, sizeof (message));
+  message.data.request = &request;
+  message.header_count = nheaders;
+  message.headers = headers;
+  token.event = data->event;
+  token.status = GRUB_EFI_SUCCESS;
+  token.message = &message;
+
+  status = data->http->request (data->http, &token);
+  if (status == GRUB_EFI_SUCCESS)
+    status = efihttp_wait (data, &token);
+  if (status != GRUB_EFI_SUCCESS)
+    {
+      efihttp_disconnect (data);
+      return grub_error (GRUB_ERR_NET_UNKNOWN_ERROR,
+			 N_("couldn't send HTTP request: %ld"), (long) status);
+    }
+
+  /* The firmware allocates the headers of the response.  */
+  grub_memset (&message, 0, sizeof (message));
+  grub_memset (&response, 0, sizeof (response));
+  message.data.response = &response;
+  token.status = GRUB_EFI_SUCCESS;
+
+  status = data->http->response (data->http, &token);
+  if (status == GRUB_EFI_SUCCESS)
+    status = efihttp_wait (data, &token);
+  if (status != GRUB_EFI_SUCCESS)
+    {
+      efihttp_free_headers (message.headers, message.header_count);
+      efihttp_disconnect (data);
+      return grub_error (GRUB_ERR_NET_UNKNOWN_ERROR,
+			 N_("couldn't receive HTTP response: %ld"),
+			 (long) status);
+    }
+
+  switch (response.status_code)
+    {
+    case GRUB_EFI_HTTP_STATUS_200_OK:
+      /* A server without ranges sends it all from the start.  */
+      if (offset)
+	{
+	  efihttp_free_headers (message.headers, message.header_count);
+	  efihttp_disconnect (data);
+	  return grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
+			     N_("HTTP server doesn't support ranges"));
+	}
+      break;
+    case GRUB_EFI_HTTP_STATUS_206_PARTIAL_CONTENT:
+      break;
+    case GRUB_EFI_HTTP_STATUS_404_NOT_FOUND:
+      efihttp_free_headers (message.headers, message.header_count);
+      efihttp_disconnect (data);
+      return grub_error (GRUB_ERR_FILE_NOT_FOUND,
+			 N_("file `%s' not found"), file->device->net->name);
+    default:
+      efihttp_free_headers (message.headers, message.header_count);
+      efihttp_disconnect (data);
+      return grub_error (GRUB_ERR_NET_UNKNOWN_ERROR,
+			 N_("unsupported HTTP error %d"),
+			 (int) response.status_code);
+    }
+
+  data->size_known = 0;
+  for (i = 0; i < message.header_count; i++)
+    if (message.headers[i].field_name && message.headers[i].field_value
+	&& grub_strcasecmp (message.headers[i].field_name,
+			    "Content-Length") == 0)
+      {
+	data->left = grub_strtoull (message.headers[i].field_value, 0, 10);
+	data->size_known = 1;
+	if (!offset)
+	  file->size = data->left;
+      }
+  efihttp_free_headers (message.headers, message.header_count);
+
+  if (data->size_known && !data->left)
+    file->device->net->eof = 1;
+
+  return GRUB_ERR_NONE;
+}
+
+/* Keep EFIHTTP_AHEAD pieces of the body queued for the reader.  */
+static grub_err_t
+efihttp_packets_pulled (struct grub_file *file)
+{
+  efihttp_data_t data = file->data;
+  grub_net_t net = file->device->net;
+  grub_efi_http_message_t message;
+  grub_efi_http_token_t token;
+  grub_efi_status_t status;
+  struct grub_net_buff *nb;
+  grub_err_t err;
+
+  if (data->err.grub_errno)
+    {
+      grub_error_load (&data->err);
+      return grub_errno;
+    }
+
+  while (!net->eof && net->packs.count < EFIHTTP_AHEAD)
+    {
+      nb = grub_netbuff_alloc (EFIHTTP_CHUNK_SIZE);
+      if (!nb)
+	goto fail;
+
+      grub_memset (&message, 0, sizeof (message));
+      message.body_length = EFIHTTP_CHUNK_SIZE;
+      if (data->size_known && data->left < EFIHTTP_CHUNK_SIZE)
+	message.body_length = data->left;
+      message.body = nb->data;
+      token.event = data->event;
+      token.status = GRUB_EFI_SUCCESS;
+      token.message = &message;
+
+      status = data->http->response (data->http, &token);
+      if (status == GRUB_EFI_SUCCESS)
+	status = efihttp_wait (data, &token);
+      if (status != GRUB_EFI_SUCCESS || !message.body_length)
+	{
+	  grub_netbuff_free (nb);
+	  /* Without a length, the end of the connection ends the body.  */
+	  if (!data->size_known)
+	    {
+	      net->eof = 1;
+	      return GRUB_ERR_NONE;
+	    }
+	  grub_error (GRUB_ERR_NET_UNKNOWN_ERROR,
+		      N_("couldn't receive HTTP body: %ld"), (long) status);
+	  goto fail;
+	}
+
+      grub_netbuff_put (nb, message.body_length);
+      err = grub_net_put_packet (&net->packs, nb);
+      if (err)
+	{
+	  grub_netbuff_free (nb);
+	  goto fail;
+	}
+
+      if (data->size_known)
+	{
+	  data->left -= message.body_length;
+	  if (!data->left)
+	    net->eof = 1;
+	}
+    }
+  return GRUB_ERR_NONE;
+
+ fail:
+  /* Reads must not go on to poll GRUB's own stack, that would take the
+     card away from the firmware.  */
+  net->eof = 1;
+  grub_error_save (&data->err);
+  grub_error_load (&data->err);
+  return grub_errno;
+}
+
+static void
+efihttp_data_free (efihttp_data_t data)
+{
+  if (!data)
+    return;
+  efihttp_disconnect (data);
+  if (data->event)
+    grub_efi_system_table->boot_services->close_event (data->event);
+  grub_free (data->url);
+  grub_free (data->host);
+  grub_free (data);
+}
+
+static void
+efihttp_drop_packets (grub_net_t net)
+{
+  while (net->packs.first)
+    {
+      grub_netbuff_free (net->packs.first->nb);
+      grub_net_remove_packet (net->packs.first);
+    }
+}
+
+static grub_err_t
+efihttp_open (struct grub_file *file, const char *filename)
+{
+  grub_net_t net = file->device->net;
+  grub_efi_handle_t sb_handle;
+  efihttp_data_t data;
+  grub_efi_status_t status;
+  grub_size_t len;
+  char *url;
+  grub_err_t err;
+
+  sb_handle = efihttp_find_service ();
+  if (!sb_handle)
+    return grub_error (GRUB_ERR_NET_NO_CARD,
+		       N_("firmware has no HTTP stack"));
+
+  data = grub_zalloc (sizeof (*data));
+  if (!data)
+    return grub_errno;
+
+  data->sb = grub_efi_open_protocol (sb_handle, &http_sb_guid,
+				     GRUB_EFI_OPEN_PROTOCOL_GET_PROTOCOL);
+  if (!data->sb)
+    {
+      grub_free (data);
+      return grub_error (GRUB_ERR_NET_NO_CARD,
+			 N_("firmware has no HTTP stack"));
+    }
+
+  if (net->port)
+    data->host = grub_xasprintf ("%s:%d", net->server, net->port);
+  else
+    data->host = grub_strdup (net->server);
+  if (!data->host)
+    goto fail;
+
+  url = grub_xasprintf ("http://%s%s", data->host, filename);
+  if (!url)
+    goto fail;
+  len = grub_strlen (url);
+  data->url = grub_calloc (len + 1, sizeof (data->url[0]));
+  if (!data->url)
+    {
+      grub_free (url);
+      goto fail;
+    }
+  len = grub_utf8_to_utf16 (data->url, len, (grub_uint8_t *) url, len, NULL);
+  data->url[len] = 0;
+  grub_free (url);
+
+  status = grub_efi_system_table->boot_services->create_event (0, 0, NULL,
+							      NULL,
+							      &data->event);
+  if (status != GRUB_EFI_SUCCESS)
+    {
+      data->event = NULL;
+      grub_error (GRUB_ERR_OUT_OF_MEMORY, N_("couldn't create event"));
+      goto fail;
+    }
+
+  file->size = GRUB_FILE_SIZE_UNKNOWN;
+  file->not_easily_seekable = 0;
+  file->data = data;
+  /* The firmware delivers the body, so reads must never poll the cards,
+     which would take the card away from the firmware.  */
+  net->stall = 1;
+
+  err = efihttp_connect (file, 0);
+  if (err)
+    goto fail;
+  err = efihttp_packets_pulled (file);
+  if (err)
+    {
+      efihttp_drop_packets (net);
+      goto fail;
+    }
+  return GRUB_ERR_NONE;
+
+ fail:
+  efihttp_data_free (data);
+  file->data = 0;
+  return grub_errno;
+}
+
+static grub_err_t
+efihttp_seek (struct grub_file *file, grub_off_t off)
+{
+  efihttp_data_t data = file->data;
+  grub_net_t net = file->device->net;
+  grub_err_t err;
+
+  efihttp_drop_packets (net);
+  efihttp_disconnect (data);
+
+  net->stall = 1;
+  net->eof = 0;
+  net->offset = off;
+  data->err.grub_errno = GRUB_ERR_NONE;
+
+  err = efihttp_connect (file, off);
+  if (!err)
+    err = efihttp_packets_pulled (file);
+  if (err)
+    {
+      efihttp_data_free (data);
+      file->data = 0;
+    }
+  return err;
+}
+
+static grub_err_t
+efihttp_close (struct grub_file *file)
+{
+  efihttp_data_free (file->data);
+  file->data = 0;
+  return GRUB_ERR_NONE;
+}
+
+static struct grub_net_app_protocol grub_efihttp_protocol =
+  {
+    .name = "efihttp",
+    .open = efihttp_open,
+    .close = efihttp_close,
+    .seek = efihttp_seek,
+    .packets_pulled = efihttp_packets_pulled
+  };
+
+GRUB_MOD_INIT (efihttp)
+{
+  grub_net_app_level_register (&grub_efihttp_protocol);
+}
+
+GRUB_MOD_FINI (efihttp)
+{
+  grub_net_app_level_unregister (&grub_efihttp_protocol);
+}
@@ -24,6 +24,7 @@
 #include <grub/net.h>
 #include <grub/mm.h>
 #include <grub/dl.h>
+#include <grub/env.h>
 #include <grub/file.h>
 #include <grub/i18n.h>
 
@@ -31,22 +32,103 @@ GRUB_MOD_LICENSE ("GPLv3+");
 
 #define HTTP_PORT	((grub_uint16_t) 80)
 
-typedef struct http_data
+/* At most this many connections are kept open between requests.  */
+#define HTTP_MAX_IDLE_CONNS	4
+
+/* A seek reads a response to its end if at most this much of it is left,
+   so that the connection can take the next request.  */
+#define HTTP_DRAIN_MAX		(64 * 1024)
+
+/*
+ * With http_parallel set above 1, files are fetched in ranges of
+ * HTTP_CHUNK_SIZE bytes over up to HTTP_MAX_PARALLEL connections.  Each
+ * range after the one being read is buffered up to HTTP_AHEAD_MAX_PACKETS
+ * packets.
+ */
+#define HTTP_MAX_PARALLEL	8
+#define HTTP_CHUNK_SIZE		(2 * 1024 * 1024)
+#define HTTP_AHEAD_MAX_PACKETS	1024
+
+/*
+ * A connection whose last response was read to its end, kept open for
+ * the next request to the same server.
+ */
+struct http_conn
+{
+  struct http_conn *next;
+  struct http_conn **prev;
+  char *server;
+  grub_uint16_t port;
+  grub_net_tcp_socket_t sock;
+};
+
+static struct http_conn *idle_conns;
+static unsigned idle_count;
+
+/* A request for a range of the file and the response to it.  */
+typedef struct http_req
 {
+  grub_file_t file;
+  grub_net_tcp_socket_t sock;
+  int in_use;
   char *current_line;
   grub_size_t current_line_len;
   int headers_recv;
   int first_line_recv;
-  int size_recv;
-  grub_net_tcp_socket_t sock;
-  char *filename;
   grub_err_t err;
   char *errmsg;
   int chunked;
   grub_size_t chunk_rem;
   int in_chunk_len;
+  /* The body length of the response and how much of it came so far.  */
+  int length_recv;
+  grub_uint64_t content_length;
+  grub_uint64_t body_recv;
+  int done;
+  /* Whether the server keeps the connection open after the response.  */
+  int keep_alive;
+  /* Whether the connection served an earlier request.  */
+  int reused;
+  /* The range asked for, to the end of the file if END is 0.  */
+  grub_off_t start;
+  grub_off_t end;
+  /* The range the server answers with, from Content-Range.  */
+  int partial;
+  grub_off_t range_start;
+  int range_total_recv;
+  grub_off_t range_total;
+  /* The filter that undoes the Content-Encoding of the body.  */
+  grub_file_filter_t decode;
+  /* Whether the range has to be fetched again.  */
+  int failed;
+  /* The body of a range after the one being read.  */
+  grub_net_packets_t ahead;
+} *http_req_t;
+
+typedef struct http_data
+{
+  char *filename;
+  int size_recv;
+  /*
+   * The requests for consecutive ranges, in a ring of NREQS from the one
+   * being read, CUR, on.  In parallel mode NEXT_START is where the next
+   * range to ask for starts.
+   */
+  struct http_req reqs[HTTP_MAX_PARALLEL];
+  unsigned nreqs;
+  unsigned cur;
+  int parallel;
+  grub_off_t next_start;
+  /* Read from REFETCH_START on over one connection, after a range after
+     the one being read could not be fetched.  */
+  int refetch;
+  grub_off_t refetch_start;
+  /* Whether compressed responses are asked for, from http_compress.  */
+  int compress;
 } *http_data_t;
 
+static void http_err (grub_net_tcp_socket_t sock, void *r);
+
 static grub_off_t
 have_ahead (struct grub_file *file)
 {
@@ -58,9 +140,89 @@ have_ahead (struct grub_file *file)
   return ret;
 }
 
+static inline int
+http_req_active (http_req_t req)
+{
+  http_data_t data = req->file->data;
+
+  return req == &data->reqs[data->cur];
+}
+
+static void
+free_packets (grub_net_packets_t *packs)
+{
+  while (packs->first)
+    {
+      grub_netbuff_free (packs->first->nb);
+      grub_net_remove_packet (packs->first);
+    }
+}
+
+/* Check the response REQ got against the range it asked for.  */
+static void
+http_headers_done (http_req_t req)
+{
+  grub_file_t file = req->file;
+  http_data_t data = file->data;
+
+  /* The length of a chunked body is that of its chunks.  */
+  if (req->chunked)
+    req->length_recv = 0;
+
+  if (req->err || !req->first_line_recv)
+    {
+      if (!http_req_active (req))
+	goto fail;
+      return;
+    }
+
+  if (req->partial ? req->range_start != req->start : req->start != 0)
+    goto fail;
+
+  /* The body is the file compressed for transfer, which opening the file
+     undoes as it is read.  */
+  if (req->decode)
+    file->transfer_decode = req->decode;
+
+  if (!data->size_recv)
+    {
+      if (req->partial && req->range_total_recv)
+	{
+	  file->size = req->range_total;
+	  data->size_recv = 1;
+	}
+      else if (!req->partial && req->length_recv)
+	{
+	  file->size = req->content_length;
+	  data->size_recv = 1;
+	}
+    }
+
+  if (!req->partial)
+    {
+      /* The server sent the whole file.  */
+      req->end = 0;
+      data->parallel = 0;
+    }
+  else if (req->end && (!req->length_recv || !data->size_recv))
+    goto fail;
+
+  if (req->length_recv && !req->content_length)
+    req->done = 1;
+  return;
+
+ fail:
+  grub_dprintf ("http", "unusable response for %s at %" PRIuGRUB_UINT64_T
+		"\n", data->filename, req->start);
+  req->failed = 1;
+  http_err (req->sock, req);
+}
+
 static grub_err_t
-parse_line (grub_file_t file, http_data_t data, char *ptr, grub_size_t len)
+parse_line (http_req_t req, char *ptr, grub_size_t len)
 {
+  grub_file_t file = req->file;
+  http_data_t data = file->data;
   char *end = ptr + len;
   while (end > ptr && *(end - 1) == '\r')
     end--;
@@ -68,46 +230,47 @@ parse_line (grub_file_t file, http_data_t data, char *ptr, grub_size_t len)
   /* LF without CR. */
   if (end == ptr + len)
     {
-      data->errmsg = grub_strdup (_("invalid HTTP header - LF without CR"));
+      req->errmsg = grub_strdup (_("invalid HTTP header - LF without CR"));
       return GRUB_ERR_NONE;
     }
   *end = 0;
 
   /* Trailing CRLF.  */
-  if (data->in_chunk_len == 1)
+  if (req->in_chunk_len == 1)
     {
-      data->in_chunk_len = 2;
+      req->in_chunk_len = 2;
       return GRUB_ERR_NONE;
     }
-  if (data->in_chunk_len == 2)
+  if (req->in_chunk_len == 2)
     {
-      data->chunk_rem = grub_strtoul (ptr, 0, 16);
+      req->chunk_rem = grub_strtoul (ptr, 0, 16);
       grub_errno = GRUB_ERR_NONE;
-      if (data->chunk_rem == 0)
+      if (req->chunk_rem == 0)
 	{
 	  file->device->net->eof = 1;
 	  file->device->net->stall = 1;
 	  if (file->size == GRUB_FILE_SIZE_UNKNOWN)
 	    file->size = have_ahead (file);
 	}
-      data->in_chunk_len = 0;
+      req->in_chunk_len = 0;
       return GRUB_ERR_NONE;
     }
   if (ptr == end)
     {
-      data->headers_recv = 1;
-      if (data->chunked)
-	data->in_chunk_len = 2;
+      req->headers_recv = 1;
+      if (req->chunked)
+	req->in_chunk_len = 2;
+      http_headers_done (req);
       return GRUB_ERR_NONE;
     }
 
-  if (!data->first_line_recv)
+  if (!req->first_line_recv)
     {
       int code;
       if (grub_memcmp (ptr, "HTTP/1.1 ", sizeof ("HTTP/1.1 ") - 1) != 0)
 	{
-	  data->errmsg = grub_strdup (_("unsupported HTTP response"));
-	  data->first_line_recv = 1;
+	  req->errmsg = grub_strdup (_("unsupported HTTP response"));
+	  req->first_line_recv = 1;
 	  return GRUB_ERR_NONE;
 	}
       ptr += sizeof ("HTTP/1.1 ") - 1;
@@ -120,32 +283,73 @@ parse_line (grub_file_t file, http_data_t data, char *ptr, grub_size_t len)
 	case 206:
 	  break;
 	case 404:
-	  data->err = GRUB_ERR_FILE_NOT_FOUND;
-	  data->errmsg = grub_xasprintf (_("file `%s' not found"), data->filename);
+	  req->err = GRUB_ERR_FILE_NOT_FOUND;
+	  req->errmsg = grub_xasprintf (_("file `%s' not found"), data->filename);
 	  return GRUB_ERR_NONE;
 	default:
-	  data->err = GRUB_ERR_NET_UNKNOWN_ERROR;
+	  req->err = GRUB_ERR_NET_UNKNOWN_ERROR;
 	  /* TRANSLATORS: GRUB HTTP code is pretty young. So even perfectly
 	     valid answers like 403 will trigger this very generic message.  */
-	  data->errmsg = grub_xasprintf (_("unsupported HTTP error %d: %s"),
-					 code, ptr);
+	  req->errmsg = grub_xasprintf (_("unsupported HTTP error %d: %s"),
+					code, ptr);
 	  return GRUB_ERR_NONE;
 	}
-      data->first_line_recv = 1;
+      req->first_line_recv = 1;
+      req->partial = (code == 206);
+      req->keep_alive = 1;
       return GRUB_ERR_NONE;
     }
   if (grub_memcmp (ptr, "Content-Length: ", sizeof ("Content-Length: ") - 1)
-      == 0 && !data->size_recv)
+      == 0 && !req->length_recv)
     {
       ptr += sizeof ("Content-Length: ") - 1;
-      file->size = grub_strtoull (ptr, (const char **)&ptr, 10);
-      data->size_recv = 1;
+      req->content_length = grub_strtoull (ptr, (const char **)&ptr, 10);
+      req->length_recv = 1;
+      return GRUB_ERR_NONE;
+    }
+  if (grub_memcmp (ptr, "Content-Range: bytes ",
+		   sizeof ("Content-Range: bytes ") - 1) == 0)
+    {
+      ptr += sizeof ("Content-Range: bytes ") - 1;
+      req->range_start = grub_strtoull (ptr, (const char **)&ptr, 10);
+      ptr = grub_strchr (ptr, '/');
+      if (ptr && ptr[1] != '*')
+	{
+	  req->range_total = grub_strtoull (ptr + 1, 0, 10);
+	  req->range_total_recv = 1;
+	}
+      grub_errno = GRUB_ERR_NONE;
+      return GRUB_ERR_NONE;
+    }
+  if (grub_memcmp (ptr, "Connection: close",
+		   sizeof ("Connection: close") - 1) == 0)
+    {
+      req->keep_alive = 0;
       return GRUB_ERR_NONE;
     }
   if (grub_memcmp (ptr, "Transfer-Encoding: chunked",
 		   sizeof ("Transfer-Encoding: chunked") - 1) == 0)
     {
-      data->chunked = 1;
+      req->chunked = 1;
+      return GRUB_ERR_NONE;
+    }
+  if (data->compress
+      && grub_memcmp (ptr, "Content-Encoding: ",
+		      sizeof ("Content-Encoding: ") - 1) == 0)
+    {
+      ptr += sizeof ("Content-Encoding: ") - 1;
+      if (grub_strcmp (ptr, "gzip") == 0 || grub_strcmp (ptr, "x-gzip") == 0)
+	req->decode = grub_file_filters[GRUB_FILE_FILTER_GZIO];
+      else if (grub_strcmp (ptr, "zstd") == 0)
+	req->decode = grub_file_filters[GRUB_FILE_FILTER_ZSTDIO];
+      else if (grub_strcmp (ptr, "identity") == 0)
+	return GRUB_ERR_NONE;
+      if (!req->decode)
+	{
+	  req->err = GRUB_ERR_NET_UNKNOWN_ERROR;
+	  req->errmsg = grub_xasprintf (_("unsupported HTTP content encoding %s"),
+					ptr);
+	}
       return GRUB_ERR_NONE;
     }
 
@@ -154,42 +358,300 @@ parse_line (grub_file_t file, http_data_t data, char *ptr, grub_size_t len)
 
 static void
 http_err (grub_net_tcp_socket_t sock __attribute__ ((unused)),
-	  void *f)
+	  void *r)
 {
-  grub_file_t file = f;
-  http_data_t data = file->data;
+  http_req_t req = r;
+  grub_file_t file = req->file;
+
+  if (req->sock)
+    grub_net_tcp_close (req->sock, GRUB_NET_TCP_ABORT);
+  req->sock = 0;
+  if (req->current_line)
+    grub_free (req->current_line);
+  req->current_line = 0;
+
+  /* What a complete body or a range after the one being read lost is of no
+     concern to the reader yet.  */
+  if (req->done || !http_req_active (req))
+    {
+      if (!req->done)
+	req->failed = 1;
+      return;
+    }
 
-  if (data->sock)
-    grub_net_tcp_close (data->sock, GRUB_NET_TCP_ABORT);
-  data->sock = 0;
-  if (data->current_line)
-    grub_free (data->current_line);
-  data->current_line = 0;
   file->device->net->eof = 1;
   file->device->net->stall = 1;
   if (file->size == GRUB_FILE_SIZE_UNKNOWN)
     file->size = have_ahead (file);
 }
 
+/* The server closed the connection, so nothing comes after what it sent.  */
+static void
+http_fin (grub_net_tcp_socket_t sock, void *r)
+{
+  http_req_t req = r;
+
+  req->keep_alive = 0;
+  http_err (sock, r);
+}
+
+static void
+idle_drop (struct http_conn *conn, int discard_received)
+{
+  grub_list_remove (GRUB_AS_LIST (conn));
+  idle_count--;
+  grub_net_tcp_close (conn->sock, discard_received);
+  grub_free (conn->server);
+  grub_free (conn);
+}
+
+/* An idle connection must not receive anything.  */
 static grub_err_t
-http_receive (grub_net_tcp_socket_t sock __attribute__ ((unused)),
-	      struct grub_net_buff *nb,
-	      void *f)
+idle_receive (grub_net_tcp_socket_t sock __attribute__ ((unused)),
+	      struct grub_net_buff *nb, void *c)
+{
+  grub_netbuff_free (nb);
+  idle_drop (c, GRUB_NET_TCP_ABORT);
+  return GRUB_ERR_NONE;
+}
+
+static void
+idle_err (grub_net_tcp_socket_t sock __attribute__ ((unused)), void *c)
+{
+  idle_drop (c, GRUB_NET_TCP_ABORT);
+}
+
+static void
+idle_fin (grub_net_tcp_socket_t sock __attribute__ ((unused)), void *c)
+{
+  idle_drop (c, GRUB_NET_TCP_DISCARD);
+}
+
+/* Take an idle connection to SERVER and PORT, if there is one.  */
+static grub_net_tcp_socket_t
+idle_take (const char *server, grub_uint16_t port)
+{
+  struct http_conn *conn;
+  grub_net_tcp_socket_t sock;
+
+  FOR_LIST_ELEMENTS (conn, idle_conns)
+    if (conn->port == port && grub_strcmp (conn->server, server) == 0)
+      {
+	sock = conn->sock;
+	grub_list_remove (GRUB_AS_LIST (conn));
+	idle_count--;
+	grub_free (conn->server);
+	grub_free (conn);
+	return sock;
+      }
+  return NULL;
+}
+
+/* Keep SOCK, to the server of FILE, for the next request, or close it if
+   there are enough idle connections already.  */
+static void
+idle_put (struct grub_file *file, grub_net_tcp_socket_t sock)
+{
+  struct http_conn *conn = NULL;
+
+  if (idle_count < HTTP_MAX_IDLE_CONNS)
+    {
+      conn = grub_malloc (sizeof (*conn));
+      if (conn)
+	{
+	  conn->server = grub_strdup (file->device->net->server);
+	  if (!conn->server)
+	    {
+	      grub_free (conn);
+	      conn = NULL;
+	    }
+	}
+      grub_errno = GRUB_ERR_NONE;
+    }
+
+  if (!conn)
+    {
+      grub_net_tcp_close (sock, GRUB_NET_TCP_ABORT);
+      return;
+    }
+
+  conn->port = file->device->net->port;
+  conn->sock = sock;
+  grub_net_tcp_unstall (sock);
+  grub_net_tcp_set_hooks (sock, idle_receive, idle_err, idle_fin, conn);
+  grub_list_push (GRUB_AS_LIST_P (&idle_conns), GRUB_AS_LIST (conn));
+  idle_count++;
+}
+
+/* Whether the connection of REQ has sent all of its response and takes
+   another request.  */
+static int
+http_reusable (http_req_t req)
+{
+  return (req->sock && req->keep_alive && req->done && !req->failed
+	  && !req->err && !req->errmsg && !req->current_line);
+}
+
+/* Done with REQ.  Its connection stays with it if it takes another
+   request.  */
+static void
+http_req_reset (http_req_t req)
+{
+  grub_net_tcp_socket_t sock = NULL;
+  grub_file_t file = req->file;
+
+  if (http_reusable (req))
+    sock = req->sock;
+  else if (req->sock)
+    grub_net_tcp_close (req->sock, GRUB_NET_TCP_ABORT);
+  grub_free (req->current_line);
+  grub_free (req->errmsg);
+  free_packets (&req->ahead);
+
+  grub_memset (req, 0, sizeof (*req));
+  req->file = file;
+  req->sock = sock;
+}
+
+/* Done with REQ, and with its connection for this file.  */
+static void
+http_req_release (http_req_t req)
+{
+  http_req_reset (req);
+  if (req->sock)
+    idle_put (req->file, req->sock);
+  req->sock = 0;
+}
+
+/* Read what is left of the response of REQ if that is little, for its
+   connection to take another request.  */
+static void
+http_drain (http_req_t req)
+{
+  int i;
+
+  if (!req->sock || !req->in_use || req->done || !req->keep_alive
+      || !req->length_recv
+      || req->content_length - req->body_recv > HTTP_DRAIN_MAX)
+    return;
+
+  grub_net_tcp_unstall (req->sock);
+  for (i = 0; req->sock && !req->done && i < GRUB_NET_TRIES; i++)
+    grub_net_poll_cards (GRUB_NET_INTERVAL, &req->done);
+}
+
+/* The range being read came whole: go on with the one after it, which was
+   fetched ahead.  */
+static void
+http_advance (struct grub_file *file)
+{
+  http_data_t data = file->data;
+  grub_net_t net = file->device->net;
+  http_req_t req = &data->reqs[data->cur];
+  grub_off_t end;
+
+  while (req->done)
+    {
+      end = req->start + req->content_length;
+      http_req_reset (req);
+      if (end >= file->size)
+	{
+	  net->eof = 1;
+	  return;
+	}
+
+      data->cur = (data->cur + 1) % data->nreqs;
+      req = &data->reqs[data->cur];
+
+      /* Let the reader ask for the next range if that was not done yet.  */
+      if (!req->in_use && end == data->next_start)
+	{
+	  net->stall = 1;
+	  return;
+	}
+      if (!req->in_use || req->failed || req->start != end)
+	{
+	  data->refetch = 1;
+	  data->refetch_start = end;
+	  net->stall = 1;
+	  return;
+	}
+
+      while (req->ahead.first)
+	{
+	  grub_net_put_packet (&net->packs, req->ahead.first->nb);
+	  grub_net_remove_packet (req->ahead.first);
+	}
+      if (net->packs.count >= 20)
+	net->stall = 1;
+      if (req->sock && net->packs.count < 100)
+	grub_net_tcp_unstall (req->sock);
+    }
+}
+
+/* Queue the body data in NB, up to the length of the response.  */
+static void
+http_put_body (http_req_t req, struct grub_net_buff *nb)
 {
-  grub_file_t file = f;
+  grub_file_t file = req->file;
   http_data_t data = file->data;
+  grub_net_t net = file->device->net;
+  grub_uint64_t len = nb->tail - nb->data;
+
+  if (req->length_recv && len >= req->content_length - req->body_recv)
+    {
+      len = req->content_length - req->body_recv;
+      nb->tail = nb->data + len;
+      req->done = 1;
+    }
+  req->body_recv += len;
+
+  if (!len)
+    grub_netbuff_free (nb);
+  else if (!http_req_active (req))
+    {
+      grub_net_put_packet (&req->ahead, nb);
+      if (req->ahead.count >= HTTP_AHEAD_MAX_PACKETS)
+	grub_net_tcp_stall (req->sock);
+    }
+  else
+    {
+      grub_net_put_packet (&net->packs, nb);
+      if (net->packs.count >= 20)
+	net->stall = 1;
+
+      if (net->packs.count >= 100)
+	grub_net_tcp_stall (req->sock);
+    }
+
+  if (req->done && data->parallel && http_req_active (req))
+    http_advance (file);
+}
+
+static grub_err_t
+http_receive (grub_net_tcp_socket_t sock,
+	      struct grub_net_buff *nb,
+	      void *r)
+{
+  http_req_t req = r;
+  grub_file_t file = req->file;
   grub_err_t err;
 
-  if (!data->sock)
+  if (!req->sock || !req->in_use || req->done)
     {
       grub_netbuff_free (nb);
+      if (req->sock)
+	{
+	  grub_net_tcp_close (sock, GRUB_NET_TCP_ABORT);
+	  req->sock = 0;
+	}
       return GRUB_ERR_NONE;
     }
 
   while (1)
     {
       char *ptr = (char *) nb->data;
-      if ((!data->headers_recv || data->in_chunk_len) && data->current_line)
+      if ((!req->headers_recv || req->in_chunk_len) && req->current_line)
 	{
 	  int have_line = 1;
 	  char *t;
@@ -199,63 +661,73 @@ http_receive (grub_net_tcp_socket_t sock __attribute__ ((unused)),
 	      have_line = 0;
 	      ptr = (char *) nb->tail;
 	    }
-	  t = grub_realloc (data->current_line,
-			    data->current_line_len + (ptr - (char *) nb->data));
+	  t = grub_realloc (req->current_line,
+			    req->current_line_len + (ptr - (char *) nb->data));
 	  if (!t)
 	    {
 	      grub_netbuff_free (nb);
-	      grub_net_tcp_close (data->sock, GRUB_NET_TCP_ABORT);
+	      grub_net_tcp_close (req->sock, GRUB_NET_TCP_ABORT);
 	      return grub_errno;
 	    }
 
-	  data->current_line = t;
-	  grub_memcpy (data->current_line + data->current_line_len,
+	  req->current_line = t;
+	  grub_memcpy (req->current_line + req->current_line_len,
 		       nb->data, ptr - (char *) nb->data);
-	  data->current_line_len += ptr - (char *) nb->data;
+	  req->current_line_len += ptr - (char *) nb->data;
 	  if (!have_line)
 	    {
 	      grub_netbuff_free (nb);
 	      return GRUB_ERR_NONE;
 	    }
-	  err = parse_line (file, data, data->current_line,
-			    data->current_line_len);
-	  grub_free (data->current_line);
-	  data->current_line = 0;
-	  data->current_line_len = 0;
+	  err = parse_line (req, req->current_line,
+			    req->current_line_len);
+	  grub_free (req->current_line);
+	  req->current_line = 0;
+	  req->current_line_len = 0;
 	  if (err)
 	    {
-	      grub_net_tcp_close (data->sock, GRUB_NET_TCP_ABORT);
+	      grub_net_tcp_close (req->sock, GRUB_NET_TCP_ABORT);
 	      grub_netbuff_free (nb);
 	      return err;
 	    }
+	  if (!req->sock)
+	    {
+	      grub_netbuff_free (nb);
+	      return GRUB_ERR_NONE;
+	    }
 	}
 
-      while (ptr < (char *) nb->tail && (!data->headers_recv
-					 || data->in_chunk_len))
+      while (ptr < (char *) nb->tail && (!req->headers_recv
+					 || req->in_chunk_len))
 	{
 	  char *ptr2;
 	  ptr2 = grub_memchr (ptr, '\n', (char *) nb->tail - ptr);
 	  if (!ptr2)
 	    {
-	      data->current_line = grub_malloc ((char *) nb->tail - ptr);
-	      if (!data->current_line)
+	      req->current_line = grub_malloc ((char *) nb->tail - ptr);
+	      if (!req->current_line)
 		{
 		  grub_netbuff_free (nb);
-		  grub_net_tcp_close (data->sock, GRUB_NET_TCP_ABORT);
+		  grub_net_tcp_close (req->sock, GRUB_NET_TCP_ABORT);
 		  return grub_errno;
 		}
-	      data->current_line_len = (char *) nb->tail - ptr;
-	      grub_memcpy (data->current_line, ptr, data->current_line_len);
+	      req->current_line_len = (char *) nb->tail - ptr;
+	      grub_memcpy (req->current_line, ptr, req->current_line_len);
 	      grub_netbuff_free (nb);
 	      return GRUB_ERR_NONE;
 	    }
-	  err = parse_line (file, data, ptr, ptr2 - ptr);
+	  err = parse_line (req, ptr, ptr2 - ptr);
 	  if (err)
 	    {
-	      grub_net_tcp_close (data->sock, GRUB_NET_TCP_ABORT);
+	      grub_net_tcp_close (req->sock, GRUB_NET_TCP_ABORT);
 	      grub_netbuff_free (nb);
 	      return err;
 	    }
+	  if (!req->sock)
+	    {
+	      grub_netbuff_free (nb);
+	      return GRUB_ERR_NONE;
+	    }
 	  ptr = ptr2 + 1;
 	}
 
@@ -267,55 +739,70 @@ http_receive (grub_net_tcp_socket_t sock __attribute__ ((unused)),
       err = grub_netbuff_pull (nb, ptr - (char *) nb->data);
       if (err)
 	{
-	  grub_net_tcp_close (data->sock, GRUB_NET_TCP_ABORT);
+	  grub_net_tcp_close (req->sock, GRUB_NET_TCP_ABORT);
 	  grub_netbuff_free (nb);
 	  return err;
 	}
-      if (!(data->chunked && (grub_ssize_t) data->chunk_rem
+      if (!(req->chunked && (grub_ssize_t) req->chunk_rem
 	    < nb->tail - nb->data))
 	{
-	  grub_net_put_packet (&file->device->net->packs, nb);
-	  if (file->device->net->packs.count >= 20)
-	    file->device->net->stall = 1;
-
-	  if (file->device->net->packs.count >= 100)
-	    grub_net_tcp_stall (data->sock);
-
-	  if (data->chunked)
-	    data->chunk_rem -= nb->tail - nb->data;
+	  if (req->chunked)
+	    req->chunk_rem -= nb->tail - nb->data;
+	  http_put_body (req, nb);
 	  return GRUB_ERR_NONE;
 	}
-      if (data->chunk_rem)
+      if (req->chunk_rem)
 	{
 	  struct grub_net_buff *nb2;
-	  nb2 = grub_netbuff_alloc (data->chunk_rem);
+	  nb2 = grub_netbuff_alloc (req->chunk_rem);
 	  if (!nb2)
 	    return grub_errno;
-	  grub_netbuff_put (nb2, data->chunk_rem);
-	  grub_memcpy (nb2->data, nb->data, data->chunk_rem);
+	  grub_netbuff_put (nb2, req->chunk_rem);
+	  grub_memcpy (nb2->data, nb->data, req->chunk_rem);
 	  if (file->device->net->packs.count >= 20)
 	    {
 	      file->device->net->stall = 1;
-	      grub_net_tcp_stall (data->sock);
+	      grub_net_tcp_stall (req->sock);
 	    }
 
 	  grub_net_put_packet (&file->device->net->packs, nb2);
-	  grub_netbuff_pull (nb, data->chunk_rem);
+	  grub_netbuff_pull (nb, req->chunk_rem);
 	}
-      data->in_chunk_len = 1;
+      req->in_chunk_len = 1;
     }
 }
 
-static grub_err_t
-http_establish (struct grub_file *file, grub_off_t offset, int initial)
+/* The Accept-Encoding header naming the compressions there are filters
+   loaded for, most compact first, if the file is fetched compressed.  */
+static const char *
+http_accept_encoding (http_data_t data)
+{
+  int gzip = grub_file_filters[GRUB_FILE_FILTER_GZIO] != NULL;
+  int zstd = grub_file_filters[GRUB_FILE_FILTER_ZSTDIO] != NULL;
+
+  if (!data->compress)
+    return "";
+  if (zstd && gzip)
+    return "Accept-Encoding: zstd, gzip\r\n";
+  if (zstd)
+    return "Accept-Encoding: zstd\r\n";
+  if (gzip)
+    return "Accept-Encoding: gzip\r\n";
+  return "";
+}
+
+/* Build the request for the bytes from START to END, or to the end of the
+   file if END is 0, of FILE.  */
+static struct grub_net_buff *
+http_request (struct grub_file *file, grub_off_t start, grub_off_t end)
 {
   http_data_t data = file->data;
   grub_uint8_t *ptr;
-  int i;
   struct grub_net_buff *nb;
   grub_err_t err;
   char *server = file->device->net->server;
   grub_uint16_t port = file->device->net->port;
+  const char *accept = http_accept_encoding (data);
 
   nb = grub_netbuff_alloc (GRUB_NET_TCP_RESERVE_SIZE
 			   + sizeof ("GET ") - 1
@@ -323,11 +810,12 @@ http_establish (struct grub_file *file, grub_off_t offset, int initial)
 			   + sizeof (" HTTP/1.1\r\nHost: ") - 1
 			   + grub_strlen (server) + sizeof (":XXXXXXXXXX")
 			   + sizeof ("\r\nUser-Agent: " PACKAGE_STRING
-				     "\r\n") - 1
+				     "\r\nConnection: keep-alive\r\n") - 1
+			   + grub_strlen (accept)
 			   + sizeof ("Range: bytes=XXXXXXXXXXXXXXXXXXXX"
-				     "-\r\n\r\n"));
+				     "-XXXXXXXXXXXXXXXXXXXX\r\n\r\n"));
   if (!nb)
-    return grub_errno;
+    return NULL;
 
   grub_netbuff_reserve (nb, GRUB_NET_TCP_RESERVE_SIZE);
   ptr = nb->tail;
@@ -335,7 +823,7 @@ http_establish (struct grub_file *file, grub_off_t offset, int initial)
   if (err)
     {
       grub_netbuff_free (nb);
-      return err;
+      return NULL;
     }
   grub_memcpy (ptr, "GET ", sizeof ("GET ") - 1);
 
@@ -345,7 +833,7 @@ http_establish (struct grub_file *file, grub_off_t offset, int initial)
   if (err)
     {
       grub_netbuff_free (nb);
-      return err;
+      return NULL;
     }
   grub_memcpy (ptr, data->filename, grub_strlen (data->filename));
 
@@ -354,7 +842,7 @@ http_establish (struct grub_file *file, grub_off_t offset, int initial)
   if (err)
     {
       grub_netbuff_free (nb);
-      return err;
+      return NULL;
     }
   grub_memcpy (ptr, " HTTP/1.1\r\nHost: ",
 	       sizeof (" HTTP/1.1\r\nHost: ") - 1);
@@ -364,7 +852,7 @@ http_establish (struct grub_file *file, grub_off_t offset, int initial)
   if (err)
     {
       grub_netbuff_free (nb);
-      return err;
+      return NULL;
     }
   grub_memcpy (ptr, file->device->net->server,
 	       grub_strlen (file->device->net->server));
@@ -377,83 +865,284 @@ http_establish (struct grub_file *file, grub_off_t offset, int initial)
 
   ptr = nb->tail;
   err = grub_netbuff_put (nb,
-			  sizeof ("\r\nUser-Agent: " PACKAGE_STRING "\r\n")
-			  - 1);
+			  sizeof ("\r\nUser-Agent: " PACKAGE_STRING
+				  "\r\nConnection: keep-alive\r\n") - 1);
   if (err)
     {
       grub_netbuff_free (nb);
-      return err;
+      return NULL;
+    }
+  grub_memcpy (ptr, "\r\nUser-Agent: " PACKAGE_STRING
+	       "\r\nConnection: keep-alive\r\n",
+	       sizeof ("\r\nUser-Agent: " PACKAGE_STRING
+		       "\r\nConnection: keep-alive\r\n") - 1);
+
+  ptr = nb->tail;
+  err = grub_netbuff_put (nb, grub_strlen (accept));
+  if (err)
+    {
+      grub_netbuff_free (nb);
+      return NULL;
     }
-  grub_memcpy (ptr, "\r\nUser-Agent: " PACKAGE_STRING "\r\n",
-	       sizeof ("\r\nUser-Agent: " PACKAGE_STRING "\r\n") - 1);
-  if (!initial)
+  grub_memcpy (ptr, accept, grub_strlen (accept));
+
+  if (end)
+    {
+      ptr = nb->tail;
+      grub_snprintf ((char *) ptr,
+		     sizeof ("Range: bytes=XXXXXXXXXXXXXXXXXXXX-"
+			     "XXXXXXXXXXXXXXXXXXXX\r\n"),
+		     "Range: bytes=%" PRIuGRUB_UINT64_T "-%" PRIuGRUB_UINT64_T
+		     "\r\n", start, end - 1);
+      grub_netbuff_put (nb, grub_strlen ((char *) ptr));
+    }
+  else if (start)
     {
       ptr = nb->tail;
       grub_snprintf ((char *) ptr,
 		     sizeof ("Range: bytes=XXXXXXXXXXXXXXXXXXXX-"
 			     "\r\n"),
 		     "Range: bytes=%" PRIuGRUB_UINT64_T "-\r\n",
-		     offset);
+		     start);
       grub_netbuff_put (nb, grub_strlen ((char *) ptr));
     }
   ptr = nb->tail;
   grub_netbuff_put (nb, 2);
   grub_memcpy (ptr, "\r\n", 2);
 
-  grub_dprintf ("http", "opening path %s on host %s TCP port %d\n",
-		data->filename, server, port ? port : HTTP_PORT);
-  data->sock = grub_net_tcp_open (server,
-				  port ? port : HTTP_PORT, http_receive,
-				  http_err, NULL,
-				  file);
-  if (!data->sock)
+  return nb;
+}
+
+/* Ask for the bytes from START to END of the file on REQ, on the
+   connection it kept, an idle one or a new one.  */
+static grub_err_t
+http_send (http_req_t req, grub_off_t start, grub_off_t end)
+{
+  grub_file_t file = req->file;
+  http_data_t data = file->data;
+  struct grub_net_buff *nb;
+  grub_err_t err;
+  char *server = file->device->net->server;
+  grub_uint16_t port = file->device->net->port;
+
+  req->in_use = 1;
+  req->start = start;
+  req->end = end;
+
+  while (1)
     {
-      grub_netbuff_free (nb);
-      return grub_errno;
+      nb = http_request (file, start, end);
+      if (!nb)
+	return grub_errno;
+
+      if (!req->sock)
+	req->sock = idle_take (server, port);
+      req->reused = (req->sock != NULL);
+      if (req->sock)
+	{
+	  grub_dprintf ("http", "reusing the connection for path %s on host %s\n",
+			data->filename, server);
+	  grub_net_tcp_unstall (req->sock);
+	  grub_net_tcp_set_hooks (req->sock, http_receive, http_err, http_fin,
+				  req);
+	}
+      else
+	{
+	  grub_dprintf ("http", "opening path %s on host %s TCP port %d\n",
+			data->filename, server, port ? port : HTTP_PORT);
+	  req->sock = grub_net_tcp_open (server,
+					 port ? port : HTTP_PORT, http_receive,
+					 http_err, http_fin,
+					 req);
+	  if (!req->sock)
+	    {
+	      grub_netbuff_free (nb);
+	      return grub_errno;
+	    }
+	}
+
+      err = grub_net_send_tcp_packet (req->sock, nb, 1);
+      if (!err)
+	return GRUB_ERR_NONE;
+
+      grub_net_tcp_close (req->sock, GRUB_NET_TCP_ABORT);
+      req->sock = 0;
+      if (!req->reused)
+	return err;
+      grub_errno = GRUB_ERR_NONE;
     }
+}
 
-  //  grub_net_poll_cards (5000);
+/* Ask for the next ranges of the file on the requests that are free.  */
+static void
+http_fill (struct grub_file *file)
+{
+  http_data_t data = file->data;
+  http_req_t req;
+  grub_off_t start;
+  unsigned i;
 
-  err = grub_net_send_tcp_packet (data->sock, nb, 1);
-  if (err)
+  while (data->parallel && data->next_start < file->size)
     {
-      grub_net_tcp_close (data->sock, GRUB_NET_TCP_ABORT);
-      return err;
+      /* The requests in use are the one being read and the ones after it.  */
+      for (i = 0; i < data->nreqs; i++)
+	if (!data->reqs[(data->cur + i) % data->nreqs].in_use)
+	  break;
+      if (i == data->nreqs)
+	return;
+
+      req = &data->reqs[(data->cur + i) % data->nreqs];
+      start = data->next_start;
+      data->next_start = grub_min (start + HTTP_CHUNK_SIZE, file->size);
+      if (http_send (req, start, data->next_start))
+	{
+	  grub_dprintf ("http", "fetching ahead failed: %s\n", grub_errmsg);
+	  grub_errno = GRUB_ERR_NONE;
+	  req->failed = 1;
+	  if (http_req_active (req))
+	    {
+	      data->refetch = 1;
+	      data->refetch_start = start;
+	      return;
+	    }
+	}
     }
+}
 
-  for (i = 0; data->sock && !data->headers_recv && i < 100; i++)
+/* A range after the one being read could not be fetched: read the rest of
+   the file from there on over one connection.  */
+static void
+http_refetch (struct grub_file *file)
+{
+  http_data_t data = file->data;
+  unsigned i;
+
+  data->refetch = 0;
+  data->parallel = 0;
+  for (i = 0; i < data->nreqs; i++)
+    http_req_release (&data->reqs[i]);
+  data->cur = 0;
+
+  grub_dprintf ("http", "reading %s from %" PRIuGRUB_UINT64_T
+		" over one connection\n", data->filename, data->refetch_start);
+  if (http_send (&data->reqs[0], data->refetch_start, 0))
+    {
+      grub_dprintf ("http", "refetch failed: %s\n", grub_errmsg);
+      grub_errno = GRUB_ERR_NONE;
+      file->device->net->eof = 1;
+      file->device->net->stall = 1;
+    }
+}
+
+static grub_err_t
+http_establish (struct grub_file *file, grub_off_t offset, int initial)
+{
+  http_data_t data = file->data;
+  http_req_t req = &data->reqs[data->cur];
+  grub_off_t end = 0;
+  int i;
+  grub_err_t err;
+
+  /* The first request asks for a range to learn whether the server takes
+     them.  */
+  if (data->parallel && (initial || offset + HTTP_CHUNK_SIZE < file->size))
+    end = offset + HTTP_CHUNK_SIZE;
+
+ again:
+  err = http_send (req, offset, end);
+  if (err)
+    return err;
+
+  for (i = 0; req->sock && !req->headers_recv && i < 100; i++)
     {
       grub_net_tcp_retransmit ();
-      grub_net_poll_cards (300, &data->headers_recv);
+      grub_net_poll_cards (300, &req->headers_recv);
     }
 
-  if (!data->headers_recv)
+  if (!req->headers_recv)
     {
-      if (data->sock)
-        grub_net_tcp_close (data->sock, GRUB_NET_TCP_ABORT);
-      if (data->err)
+      /* The server may have closed the idle connection before it saw the
+	 request.  */
+      if (req->reused && !req->sock && !req->first_line_recv
+	  && !req->errmsg)
+	{
+	  grub_dprintf ("http", "reused connection was closed, reopening\n");
+	  file->device->net->eof = 0;
+	  file->device->net->stall = 0;
+	  req->failed = 0;
+	  grub_errno = GRUB_ERR_NONE;
+	  goto again;
+	}
+      if (req->sock)
+        grub_net_tcp_close (req->sock, GRUB_NET_TCP_ABORT);
+      req->sock = 0;
+      if (req->err)
 	{
-	  char *str = data->errmsg;
-	  err = grub_error (data->err, "%s", str);
+	  char *str = req->errmsg;
+	  err = grub_error (req->err, "%s", str);
 	  grub_free (str);
-	  data->errmsg = 0;
-	  return data->err;
+	  req->errmsg = 0;
+	  return req->err;
 	}
       return grub_error (GRUB_ERR_TIMEOUT, N_("time out opening `%s'"), data->filename);
     }
+  if (req->failed)
+    return grub_error (GRUB_ERR_NET_UNKNOWN_ERROR,
+		       N_("unsupported HTTP response"));
+
+  if (data->parallel)
+    {
+      data->next_start = req->start + req->content_length;
+      http_fill (file);
+    }
   return GRUB_ERR_NONE;
 }
 
+/* How many connections a file is fetched over, from http_parallel.  */
+static unsigned
+http_parallel_conns (void)
+{
+  const char *val;
+  unsigned long n;
+
+  val = grub_env_get ("http_parallel");
+  if (!val)
+    return 1;
+  n = grub_strtoul (val, 0, 10);
+  grub_errno = GRUB_ERR_NONE;
+  if (n < 1)
+    return 1;
+  if (n > HTTP_MAX_PARALLEL)
+    return HTTP_MAX_PARALLEL;
+  return n;
+}
+
+static void
+http_data_free (http_data_t data)
+{
+  unsigned i;
+
+  for (i = 0; i < HTTP_MAX_PARALLEL; i++)
+    http_req_release (&data->reqs[i]);
+  grub_free (data->filename);
+  grub_free (data);
+}
+
 static grub_err_t
 http_seek (struct grub_file *file, grub_off_t off)
 {
-  struct http_data *old_data, *data;
+  http_data_t data = file->data;
   grub_err_t err;
-  old_data = file->data;
-  /* FIXME: Reuse socket?  */
-  if (old_data->sock)
-    grub_net_tcp_close (old_data->sock, GRUB_NET_TCP_ABORT);
-  old_data->sock = 0;
+  unsigned i;
+
+  /* What comes in while draining is thrown away, not read on from.  */
+  data->parallel = 0;
+  data->refetch = 0;
+  for (i = 0; i < data->nreqs; i++)
+    {
+      http_drain (&data->reqs[i]);
+      http_req_release (&data->reqs[i]);
+    }
 
   while (file->device->net->packs.first)
     {
@@ -465,26 +1154,14 @@ http_seek (struct grub_file *file, grub_off_t off)
   file->device->net->eof = 0;
   file->device->net->offset = off;
 
-  data = grub_zalloc (sizeof (*data));
-  if (!data)
-    return grub_errno;
-
   data->size_recv = 1;
-  data->filename = old_data->filename;
-  if (!data->filename)
-    {
-      grub_free (data);
-      file->data = 0;
-      return grub_errno;
-    }
-  grub_free (old_data);
+  data->cur = 0;
+  data->parallel = (data->nreqs > 1);
 
-  file->data = data;
   err = http_establish (file, off, 0);
   if (err)
     {
-      grub_free (data->filename);
-      grub_free (data);
+      http_data_free (data);
       file->data = 0;
       return err;
     }
@@ -496,6 +1173,8 @@ http_open (struct grub_file *file, const char *filename)
 {
   grub_err_t err;
   struct http_data *data;
+  const char *val;
+  unsigned i;
 
   data = grub_zalloc (sizeof (*data));
   if (!data)
@@ -509,14 +1188,20 @@ http_open (struct grub_file *file, const char *filename)
       return grub_errno;
     }
 
+  for (i = 0; i < HTTP_MAX_PARALLEL; i++)
+    data->reqs[i].file = file;
+  data->nreqs = http_parallel_conns ();
+  data->parallel = (data->nreqs > 1);
+  val = grub_env_get ("http_compress");
+  data->compress = (val && grub_strcmp (val, "1") == 0);
+
   file->not_easily_seekable = 0;
   file->data = data;
 
   err = http_establish (file, 0, 1);
   if (err)
     {
-      grub_free (data->filename);
-      grub_free (data);
+      http_data_free (data);
       return err;
     }
 
@@ -531,12 +1216,7 @@ http_close (struct grub_file *file)
   if (!data)
     return GRUB_ERR_NONE;
 
-  if (data->sock)
-    grub_net_tcp_close (data->sock, GRUB_NET_TCP_ABORT);
-  if (data->current_line)
-    grub_free (data->current_line);
-  grub_free (data->filename);
-  grub_free (data);
+  http_data_free (data);
   return GRUB_ERR_NONE;
 }
 
@@ -544,14 +1224,24 @@ static grub_err_t
 http_packets_pulled (struct grub_file *file)
 {
   http_data_t data = file->data;
+  http_req_t req;
+
+  if (!data)
+    return 0;
+
+  if (data->refetch)
+    http_refetch (file);
+  else
+    http_fill (file);
 
   if (file->device->net->packs.count >= 20)
     return 0;
 
   if (!file->device->net->eof)
     file->device->net->stall = 0;
-  if (data && data->sock)
-    grub_net_tcp_unstall (data->sock);
+  req = &data->reqs[data->cur];
+  if (req->sock && req->in_use)
+    grub_net_tcp_unstall (req->sock);
   return 0;
 }
 
@@ -571,5 +1261,7 @@ GRUB_MOD_INIT (http)
 
 GRUB_MOD_FINI (http)
 {
+  while (idle_conns)
+    idle_drop (idle_conns, GRUB_NET_TCP_DISCARD);
   grub_net_app_level_unregister (&grub_http_protocol);
 }
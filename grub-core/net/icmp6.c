@@ -20,6 +20,14 @@
 #include <grub/net/ip.h>
 #include <grub/net/netbuff.h>
 
+/* The address a neighbour solicitation is waiting for, and whether its
+   advertisement came.  */
+static int have_pending;
+static grub_uint64_t pending_req[2];
+
+/* Set whenever a router advertisement has been processed.  */
+int grub_net_icmp6_ra_received;
+
 struct icmp_header
 {
   grub_uint8_t type;
@@ -338,6 +346,9 @@ grub_net_recv_icmp6_packet (struct grub_net_buff *nb,
 		ll_address.type = GRUB_NET_LINK_LEVEL_PROTOCOL_ETHERNET;
 		grub_memcpy (ll_address.mac, ohdr + 1, sizeof (ll_address.mac));
 		grub_net_link_layer_add_address (card, source, &ll_address, 0);
+		if (source->ipv6[0] == pending_req[0]
+		    && source->ipv6[1] == pending_req[1])
+		  have_pending = 1;
 	      }
 	  }
 	break;
@@ -496,6 +507,7 @@ grub_net_recv_icmp6_packet (struct grub_net_buff *nb,
 	    grub_free (name);
 	  }
 next:
+	grub_net_icmp6_ra_received = 1;
 	if (ptr != nb->tail)
 	  break;
       }
@@ -505,19 +517,18 @@ next:
   return GRUB_ERR_NONE;
 }
 
-grub_err_t
-grub_net_icmp6_send_request (struct grub_net_network_level_interface *inf,
-			     const grub_net_network_level_address_t *proto_addr)
+/* Send one neighbour solicitation for PROTO_ADDR.  */
+static grub_err_t
+icmp6_send_solicit (struct grub_net_network_level_interface *inf,
+		    const grub_net_network_level_address_t *proto_addr)
 {
   struct grub_net_buff *nb;
   grub_err_t err = GRUB_ERR_NONE;
-  int i;
   struct option_header *ohdr;
   struct neighbour_solicit *sol;
   struct icmp_header *icmphr;
   grub_net_network_level_address_t multicast;
   grub_net_link_level_address_t ll_multicast;
-  grub_uint8_t *nbd;
   multicast.type = GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV6;
   multicast.ipv6[0] = grub_be_to_cpu64_compile_time (0xff02ULL << 48);
   multicast.ipv6[1] = (grub_be_to_cpu64_compile_time (0x01ff000000ULL)
@@ -575,32 +586,54 @@ grub_net_icmp6_send_request (struct grub_net_network_level_interface *inf,
 						     GRUB_NET_IP_ICMPV6,
 						     &inf->address,
 						     &multicast);
-  nbd = nb->data;
   err = grub_net_send_ip_packet (inf, &multicast, &ll_multicast, nb,
 				 GRUB_NET_IP_ICMPV6);
+
+ fail:
+  grub_netbuff_free (nb);
+  return err;
+}
+
+grub_err_t
+grub_net_icmp6_send_request (struct grub_net_network_level_interface *inf,
+			     const grub_net_network_level_address_t *proto_addr)
+{
+  grub_err_t err;
+  int i;
+
+  err = icmp6_send_solicit (inf, proto_addr);
   if (err)
-    goto fail;
+    return err;
 
   for (i = 0; i < GRUB_NET_TRIES; i++)
     {
       if (grub_net_link_layer_resolve_check (inf, proto_addr))
 	break;
+      /* Stop waiting as soon as the advertisement is in.  */
+      pending_req[0] = proto_addr->ipv6[0];
+      pending_req[1] = proto_addr->ipv6[1];
+      have_pending = 0;
       grub_net_poll_cards (GRUB_NET_INTERVAL + (i * GRUB_NET_INTERVAL_ADDITION),
-                           0);
+			   &have_pending);
       if (grub_net_link_layer_resolve_check (inf, proto_addr))
 	break;
-      nb->data = nbd;
-      err = grub_net_send_ip_packet (inf, &multicast, &ll_multicast, nb,
-				     GRUB_NET_IP_ICMPV6);
+      err = icmp6_send_solicit (inf, proto_addr);
       if (err)
 	break;
     }
 
- fail:
-  grub_netbuff_free (nb);
   return err;
 }
 
+/* Solicit PROTO_ADDR without waiting, so that the advertisement is likely
+   in the cache by the time the address is needed.  */
+grub_err_t
+grub_net_icmp6_prefetch (struct grub_net_network_level_interface *inf,
+			 const grub_net_network_level_address_t *proto_addr)
+{
+  return icmp6_send_solicit (inf, proto_addr);
+}
+
 grub_err_t
 grub_net_icmp6_send_router_solicit (struct grub_net_network_level_interface *inf)
 {
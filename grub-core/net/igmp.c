@@ -0,0 +1,205 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/net.h>
+#include <grub/net/ip.h>
+#include <grub/net/netbuff.h>
+#include <grub/mm.h>
+#include <grub/misc.h>
+#include <grub/i18n.h>
+
+/* IPv4 multicast group membership, reported with IGMPv2 (RFC 2236).  */
+
+struct igmp_header
+{
+  grub_uint8_t type;
+  grub_uint8_t max_resp;
+  grub_uint16_t checksum;
+  grub_uint32_t group;
+} GRUB_PACKED;
+
+enum
+  {
+    IGMP_QUERY = 0x11,
+    IGMP_V2_REPORT = 0x16,
+    IGMP_LEAVE = 0x17
+  };
+
+#define IGMP_ALL_HOSTS		0xe0000001
+#define IGMP_ALL_ROUTERS	0xe0000002
+
+struct grub_net_group
+{
+  struct grub_net_group *next;
+  struct grub_net_network_level_interface *inf;
+  /* In network byte order.  */
+  grub_uint32_t addr;
+  unsigned refcount;
+};
+
+static struct grub_net_group *groups;
+
+static int
+is_multicast (const grub_net_network_level_address_t *addr)
+{
+  return addr->type == GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV4
+    && (grub_be_to_cpu32 (addr->ipv4) >> 28) == 0xe;
+}
+
+static grub_err_t
+igmp_send (struct grub_net_network_level_interface *inf, grub_uint8_t type,
+	   grub_uint32_t group, grub_uint32_t dest)
+{
+  struct grub_net_buff *nb;
+  struct igmp_header *igmph;
+  grub_net_network_level_address_t target;
+  grub_net_link_level_address_t ll_target;
+  grub_uint32_t a = grub_be_to_cpu32 (dest);
+  grub_err_t err;
+
+  nb = grub_netbuff_make_pkt (sizeof (*igmph));
+  if (!nb)
+    return grub_errno;
+
+  igmph = (struct igmp_header *) nb->data;
+  igmph->type = type;
+  igmph->max_resp = 0;
+  igmph->group = group;
+  igmph->checksum = 0;
+  igmph->checksum = grub_net_ip_chksum (igmph, sizeof (*igmph));
+
+  target.type = GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV4;
+  target.ipv4 = dest;
+  /* The group maps to a MAC address of 01:00:5e and its low 23 bits.  */
+  ll_target.type = GRUB_NET_LINK_LEVEL_PROTOCOL_ETHERNET;
+  ll_target.mac[0] = 0x01;
+  ll_target.mac[1] = 0x00;
+  ll_target.mac[2] = 0x5e;
+  ll_target.mac[3] = (a >> 16) & 0x7f;
+  ll_target.mac[4] = (a >> 8) & 0xff;
+  ll_target.mac[5] = a & 0xff;
+
+  err = grub_net_send_ip_packet (inf, &target, &ll_target, nb,
+				 GRUB_NET_IP_IGMP);
+  grub_netbuff_free (nb);
+  return err;
+}
+
+grub_err_t
+grub_net_ip_join_group (struct grub_net_network_level_interface *inf,
+			const grub_net_network_level_address_t *group)
+{
+  struct grub_net_group *g;
+
+  if (!is_multicast (group)
+      || inf->address.type != GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV4)
+    return grub_error (GRUB_ERR_NET_BAD_ADDRESS,
+		       N_("not an IPv4 multicast group"));
+
+  for (g = groups; g; g = g->next)
+    if (g->inf == inf && g->addr == group->ipv4)
+      {
+	g->refcount++;
+	return GRUB_ERR_NONE;
+      }
+
+  g = grub_malloc (sizeof (*g));
+  if (!g)
+    return grub_errno;
+  g->inf = inf;
+  g->addr = group->ipv4;
+  g->refcount = 1;
+  g->next = groups;
+  groups = g;
+
+  /* Snooping switches forward the group to the port once it is reported.  */
+  return igmp_send (inf, IGMP_V2_REPORT, group->ipv4, group->ipv4);
+}
+
+void
+grub_net_ip_leave_group (struct grub_net_network_level_interface *inf,
+			 const grub_net_network_level_address_t *group)
+{
+  struct grub_net_group *g, **prev;
+
+  for (prev = &groups, g = *prev; g; prev = &g->next, g = *prev)
+    if (g->inf == inf && g->addr == group->ipv4)
+      break;
+  if (!g || --g->refcount)
+    return;
+
+  *prev = g->next;
+  igmp_send (inf, IGMP_LEAVE, g->addr,
+	     grub_cpu_to_be32_compile_time (IGMP_ALL_ROUTERS));
+  grub_errno = GRUB_ERR_NONE;
+  grub_free (g);
+}
+
+struct grub_net_network_level_interface *
+grub_net_ip_group_interface (struct grub_net_card *card,
+			     const grub_net_network_level_address_t *dest)
+{
+  struct grub_net_group *g;
+
+  if (!is_multicast (dest))
+    return NULL;
+
+  /* Queries go to all hosts, which a host with groups answers.  */
+  for (g = groups; g; g = g->next)
+    if (g->inf->card == card
+	&& (g->addr == dest->ipv4
+	    || dest->ipv4 == grub_cpu_to_be32_compile_time (IGMP_ALL_HOSTS)))
+      return g->inf;
+  return NULL;
+}
+
+grub_err_t
+grub_net_recv_igmp_packet (struct grub_net_buff *nb,
+			   struct grub_net_network_level_interface *inf)
+{
+  struct igmp_header *igmph;
+  struct grub_net_group *g;
+  grub_uint16_t checksum;
+
+  igmph = (struct igmp_header *) nb->data;
+  if (!inf || nb->tail - nb->data < (grub_ssize_t) sizeof (*igmph))
+    {
+      grub_netbuff_free (nb);
+      return GRUB_ERR_NONE;
+    }
+
+  checksum = igmph->checksum;
+  igmph->checksum = 0;
+  if (checksum != grub_net_ip_chksum (nb->data, nb->tail - nb->data))
+    {
+      grub_netbuff_free (nb);
+      return GRUB_ERR_NONE;
+    }
+
+  /* Report the groups asked about again, or membership times out.  */
+  if (igmph->type == IGMP_QUERY)
+    for (g = groups; g; g = g->next)
+      if (g->inf->card == inf->card && (!igmph->group || igmph->group == g->addr))
+	{
+	  igmp_send (g->inf, IGMP_V2_REPORT, g->addr, g->addr);
+	  grub_errno = GRUB_ERR_NONE;
+	}
+
+  grub_netbuff_free (nb);
+  return GRUB_ERR_NONE;
+}
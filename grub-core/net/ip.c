@@ -24,7 +24,6 @@
 #include <grub/net.h>
 #include <grub/net/netbuff.h>
 #include <grub/mm.h>
-#include <grub/priority_queue.h>
 #include <grub/safemath.h>
 #include <grub/time.h>
 
@@ -59,63 +58,118 @@ struct ip6hdr {
   ip6addr dest;
 } GRUB_PACKED ;
 
-static int
-cmp (const void *a__, const void *b__)
-{
-  struct grub_net_buff *a_ = *(struct grub_net_buff **) a__;
-  struct grub_net_buff *b_ = *(struct grub_net_buff **) b__;
-  struct iphdr *a = (struct iphdr *) a_->data;
-  struct iphdr *b = (struct iphdr *) b_->data;
-  /* We want the first elements to be on top.  */
-  if ((grub_be_to_cpu16 (a->frags) & OFFSET_MASK)
-      < (grub_be_to_cpu16 (b->frags) & OFFSET_MASK))
-    return +1;
-  if ((grub_be_to_cpu16 (a->frags) & OFFSET_MASK)
-      > (grub_be_to_cpu16 (b->frags) & OFFSET_MASK))
-    return -1;
-  return 0;
-}
+/* Fragment offsets are counted in blocks of 8 bytes.  */
+#define FRAGMENT_BLOCK		8
+#define FRAGMENT_MAX_BLOCKS	(OFFSET_MASK + 1)
+
+#define REASSEMBLE_HASH_SIZE	16
+#define REASSEMBLE_MAX		32
+#define REASSEMBLE_TIMEOUT	90000
 
 struct reassemble
 {
+  /* In the hash chain.  */
   struct reassemble *next;
+  /* In the list of the reassemblies by age.  */
+  struct reassemble *older;
+  struct reassemble *newer;
   grub_uint32_t source;
   grub_uint32_t dest;
   grub_uint16_t id;
   grub_uint8_t proto;
-  grub_uint64_t last_time;
-  grub_priority_queue_t pq;
+  grub_uint8_t ttl;
+  grub_uint64_t first_time;
+  /* The payload so far, grown as fragments further on come in.  */
   struct grub_net_buff *asm_netbuff;
+  grub_size_t asm_size;
+  /* Zero until the last fragment has come in.  */
   grub_size_t total_len;
-  grub_size_t cur_ptr;
-  grub_uint8_t ttl;
+  /* The blocks received, each one counted once.  */
+  grub_size_t nblocks;
+  grub_uint8_t have[FRAGMENT_MAX_BLOCKS / 8];
 };
 
-static struct reassemble *reassembles;
+static struct reassemble *reassembles[REASSEMBLE_HASH_SIZE];
+static struct reassemble *oldest, *newest;
+static unsigned nreassembles;
 
-grub_uint16_t
-grub_net_ip_chksum (void *ipv, grub_size_t len)
+/*
+ * The one's complement sum does not depend on the byte order it is done in
+ * (RFC 1071), so the words are added as they are, four bytes at a time, and
+ * the result is stored as it is.  The carries pile up in the upper half and
+ * are folded in at the end.
+ */
+static grub_uint64_t
+chksum_add (grub_uint64_t sum, const grub_uint8_t *p, grub_size_t len)
 {
-  grub_uint16_t *ip = (grub_uint16_t *) ipv;
-  grub_uint32_t sum = 0;
-
-  for (; len >= 2; len -= 2)
+  for (; len >= 16; len -= 16, p += 16)
+    sum += ((grub_uint64_t) grub_get_unaligned32 (p)
+	    + grub_get_unaligned32 (p + 4)
+	    + grub_get_unaligned32 (p + 8)
+	    + grub_get_unaligned32 (p + 12));
+  for (; len >= 4; len -= 4, p += 4)
+    sum += grub_get_unaligned32 (p);
+  if (len >= 2)
     {
-      sum += grub_be_to_cpu16 (grub_get_unaligned16 (ip++));
-      if (sum > 0xFFFF)
-	sum -= 0xFFFF;
+      sum += grub_get_unaligned16 (p);
+      p += 2;
+      len -= 2;
     }
   if (len)
     {
-      sum += *((grub_uint8_t *) ip) << 8;
-      if (sum > 0xFFFF)
-	sum -= 0xFFFF;
+      grub_uint16_t last = 0;
+
+      /* Padded with a zero byte.  */
+      *(grub_uint8_t *) &last = *p;
+      sum += last;
     }
+  return sum;
+}
+
+static grub_uint16_t
+chksum_fold (grub_uint64_t sum)
+{
+  sum = (sum >> 32) + (sum & 0xffffffff);
+  sum = (sum >> 32) + (sum & 0xffffffff);
+  sum = (sum >> 16) + (sum & 0xffff);
+  sum = (sum >> 16) + (sum & 0xffff);
+  sum = (sum >> 16) + (sum & 0xffff);
+  return sum;
+}
+
+grub_uint32_t
+grub_net_ip_chksum_add (grub_uint32_t sum, const void *data, grub_size_t len)
+{
+  return chksum_fold (chksum_add (sum, data, len));
+}
+
+grub_uint16_t
+grub_net_ip_chksum_finish (grub_uint32_t sum)
+{
+  sum = chksum_fold (sum);
+  /* Of the two zeros, the sum is always the positive one.  */
+  if (sum == 0xffff)
+    sum = 0;
+  return ~sum;
+}
+
+grub_uint16_t
+grub_net_ip_chksum_update32 (grub_uint16_t chksum, grub_uint32_t old,
+			     grub_uint32_t new)
+{
+  grub_uint64_t sum;
 
-  if (sum >= 0xFFFF)
-    sum -= 0xFFFF;
+  /* ~(~HC + ~m + m') from RFC 1624.  */
+  sum = (grub_uint16_t) ~chksum;
+  sum += (grub_uint32_t) ~old;
+  sum += new;
+  return grub_net_ip_chksum_finish (chksum_fold (sum));
+}
 
-  return grub_cpu_to_be16 ((~sum) & 0x0000FFFF);
+grub_uint16_t
+grub_net_ip_chksum (void *ipv, grub_size_t len)
+{
+  return grub_net_ip_chksum_finish (grub_net_ip_chksum_add (0, ipv, len));
 }
 
 static int id = 0x2400;
@@ -209,7 +263,8 @@ grub_net_send_ip4_packet (struct grub_net_network_level_interface *inf,
   iph->len = grub_cpu_to_be16 (nb->tail - nb->data);
   iph->ident = grub_cpu_to_be16 (++id);
   iph->frags = 0;
-  iph->ttl = 0xff;
+  /* IGMP must not leave the link.  */
+  iph->ttl = (proto == GRUB_NET_IP_IGMP) ? 1 : 0xff;
   iph->protocol = proto;
   iph->src = inf->address.ipv4;
   iph->dest = target->ipv4;
@@ -280,6 +335,12 @@ handle_dgram (struct grub_net_buff *nb,
 	      && grub_memcmp (inf->hwaddress.mac, &bootp->mac_addr,
 			      sizeof (inf->hwaddress.mac)) == 0)
 	    {
+	      /* The server or the relay sent it from the link, so there is
+		 no need to ask for its hardware address later on.  */
+	      if (source->type == GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV4
+		  && source->ipv4)
+		grub_net_link_layer_add_address (card, source, source_hwaddress,
+						 0);
 	      grub_net_process_dhcp (nb, inf);
 	      grub_netbuff_free (nb);
 	      return GRUB_ERR_NONE;
@@ -327,6 +388,9 @@ handle_dgram (struct grub_net_buff *nb,
       }
   }
 
+  if (!inf)
+    inf = grub_net_ip_group_interface (card, dest);
+
   if (!inf && !(dest->type == GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV6
 		&& dest->ipv6[0] == grub_be_to_cpu64_compile_time (0xff02ULL
 								   << 48)
@@ -341,11 +405,13 @@ handle_dgram (struct grub_net_buff *nb,
   switch (proto)
     {
     case GRUB_NET_IP_UDP:
-      return grub_net_recv_udp_packet (nb, inf, source);
+      return grub_net_recv_udp_packet (nb, inf, source, dest);
     case GRUB_NET_IP_TCP:
       return grub_net_recv_tcp_packet (nb, inf, source);
     case GRUB_NET_IP_ICMP:
       return grub_net_recv_icmp_packet (nb, inf, source_hwaddress, source);
+    case GRUB_NET_IP_IGMP:
+      return grub_net_recv_igmp_packet (nb, inf);
     case GRUB_NET_IP_ICMPV6:
       return grub_net_recv_icmp6_packet (nb, card, inf, source_hwaddress,
 					 source, dest, ttl);
@@ -356,38 +422,77 @@ handle_dgram (struct grub_net_buff *nb,
   return GRUB_ERR_NONE;
 }
 
+static unsigned
+rsm_hash (grub_uint32_t source, grub_uint16_t ident, grub_uint8_t proto)
+{
+  return (source ^ (source >> 16) ^ ident ^ proto) % REASSEMBLE_HASH_SIZE;
+}
+
 static void
 free_rsm (struct reassemble *rsm)
 {
-  struct grub_net_buff **nb;
-  while ((nb = grub_priority_queue_top (rsm->pq)))
-    {
-      grub_netbuff_free (*nb);
-      grub_priority_queue_pop (rsm->pq);
-    }
+  struct reassemble **prev;
+
+  for (prev = &reassembles[rsm_hash (rsm->source, rsm->id, rsm->proto)];
+       *prev != rsm; prev = &(*prev)->next);
+  *prev = rsm->next;
+
+  if (rsm->older)
+    rsm->older->newer = rsm->newer;
+  else
+    oldest = rsm->newer;
+  if (rsm->newer)
+    rsm->newer->older = rsm->older;
+  else
+    newest = rsm->older;
+  nreassembles--;
+
   grub_netbuff_free (rsm->asm_netbuff);
-  grub_priority_queue_destroy (rsm->pq);
   grub_free (rsm);
 }
 
 static void
 free_old_fragments (void)
 {
-  struct reassemble *rsm, **prev;
   grub_uint64_t limit_time = grub_get_time_ms ();
 
-  limit_time = (limit_time > 90000) ? limit_time - 90000 : 0;
+  limit_time = (limit_time > REASSEMBLE_TIMEOUT)
+    ? limit_time - REASSEMBLE_TIMEOUT : 0;
 
-  for (prev = &reassembles, rsm = *prev; rsm; rsm = *prev)
-    if (rsm->last_time < limit_time)
-      {
-	*prev = rsm->next;
-	free_rsm (rsm);
-      }
-    else
-      {
-	prev = &rsm->next;
-      }
+  /* The oldest come first, so only the expired ones are looked at.  */
+  while (oldest && oldest->first_time < limit_time)
+    free_rsm (oldest);
+}
+
+/* Make room for the payload up to END.  */
+static grub_err_t
+rsm_reserve (struct reassemble *rsm, grub_size_t end)
+{
+  struct grub_net_buff *nb;
+  grub_size_t size;
+
+  if (end <= rsm->asm_size)
+    return GRUB_ERR_NONE;
+
+  /* Until the length is known, grow in steps so that the payload is
+     copied only a few times.  */
+  if (rsm->total_len)
+    size = rsm->total_len;
+  else
+    size = grub_min (grub_max (end, 2 * rsm->asm_size),
+		     FRAGMENT_MAX_BLOCKS * FRAGMENT_BLOCK);
+
+  nb = grub_netbuff_alloc (size);
+  if (!nb)
+    return grub_errno;
+  if (rsm->asm_netbuff)
+    {
+      grub_memcpy (nb->data, rsm->asm_netbuff->data, rsm->asm_size);
+      grub_netbuff_free (rsm->asm_netbuff);
+    }
+  rsm->asm_netbuff = nb;
+  rsm->asm_size = size;
+  return GRUB_ERR_NONE;
 }
 
 static grub_err_t
@@ -399,7 +504,9 @@ grub_net_recv_ip4_packets (struct grub_net_buff *nb,
 {
   struct iphdr *iph = (struct iphdr *) nb->data;
   grub_err_t err;
-  struct reassemble *rsm, **prev;
+  struct reassemble *rsm, **head;
+  grub_size_t hlen, off, len, end, i;
+  int more;
 
   if ((iph->verhdrlen >> 4) != 4)
     {
@@ -473,149 +580,156 @@ grub_net_recv_ip4_packets (struct grub_net_buff *nb,
 			   &source, &dest, vlantag, iph->ttl);
     }
 
-  for (prev = &reassembles, rsm = *prev; rsm; prev = &rsm->next, rsm = *prev)
+  hlen = (iph->verhdrlen & 0xf) * sizeof (grub_uint32_t);
+  off = FRAGMENT_BLOCK * (grub_be_to_cpu16 (iph->frags) & OFFSET_MASK);
+  more = !!(grub_be_to_cpu16 (iph->frags) & MORE_FRAGMENTS);
+  len = nb->tail - nb->data - hlen;
+  end = off + len;
+
+  /* All the fragments but the last one carry whole blocks.  */
+  if (more && (len == 0 || len % FRAGMENT_BLOCK))
+    {
+      grub_dprintf ("net", "Bad IP fragment length: %" PRIuGRUB_SIZE "\n",
+		    len);
+      grub_netbuff_free (nb);
+      return GRUB_ERR_NONE;
+    }
+  if (end > FRAGMENT_MAX_BLOCKS * FRAGMENT_BLOCK)
+    {
+      grub_dprintf ("net", "IP fragment past the end\n");
+      grub_netbuff_free (nb);
+      return GRUB_ERR_NONE;
+    }
+
+  free_old_fragments ();
+
+  head = &reassembles[rsm_hash (iph->src, iph->ident, iph->protocol)];
+  for (rsm = *head; rsm; rsm = rsm->next)
     if (rsm->source == iph->src && rsm->dest == iph->dest
 	&& rsm->id == iph->ident && rsm->proto == iph->protocol)
       break;
   if (!rsm)
     {
-      rsm = grub_malloc (sizeof (*rsm));
+      /* Make room by giving up on the oldest datagram.  */
+      if (nreassembles >= REASSEMBLE_MAX)
+	free_rsm (oldest);
+
+      rsm = grub_zalloc (sizeof (*rsm));
       if (!rsm)
-	return grub_errno;
+	{
+	  grub_netbuff_free (nb);
+	  return grub_errno;
+	}
       rsm->source = iph->src;
       rsm->dest = iph->dest;
       rsm->id = iph->ident;
       rsm->proto = iph->protocol;
-      rsm->next = reassembles;
-      reassembles = rsm;
-      prev = &reassembles;
-      rsm->pq = grub_priority_queue_new (sizeof (struct grub_net_buff **), cmp);
-      if (!rsm->pq)
-	{
-	  grub_free (rsm);
-	  return grub_errno;
-	}
-      rsm->asm_netbuff = 0;
-      rsm->total_len = 0;
-      rsm->cur_ptr = 0;
       rsm->ttl = 0xff;
+      rsm->first_time = grub_get_time_ms ();
+
+      rsm->next = *head;
+      *head = rsm;
+      rsm->older = newest;
+      if (newest)
+	newest->newer = rsm;
+      else
+	oldest = rsm;
+      newest = rsm;
+      nreassembles++;
     }
   if (rsm->ttl > iph->ttl)
     rsm->ttl = iph->ttl;
-  rsm->last_time = grub_get_time_ms ();
-  free_old_fragments ();
-
-  err = grub_priority_queue_push (rsm->pq, &nb);
-  if (err)
-    return err;
 
-  if (!(grub_be_to_cpu16 (iph->frags) & MORE_FRAGMENTS))
+  if (!more)
     {
-      rsm->total_len = (8 * (grub_be_to_cpu16 (iph->frags) & OFFSET_MASK)
-			+ (nb->tail - nb->data));
-
-      if (grub_sub (rsm->total_len, (iph->verhdrlen & 0xf) * sizeof (grub_uint32_t),
-		    &rsm->total_len))
+      if (rsm->total_len && rsm->total_len != end)
 	{
-	  grub_dprintf ("net", "IP reassembly size underflow\n");
+	  grub_dprintf ("net", "IP fragments disagree on the length\n");
+	  grub_netbuff_free (nb);
+	  free_rsm (rsm);
 	  return GRUB_ERR_NONE;
 	}
-
-      rsm->asm_netbuff = grub_netbuff_alloc (rsm->total_len);
-      if (!rsm->asm_netbuff)
+      if (!rsm->total_len)
 	{
-	  *prev = rsm->next;
-	  free_rsm (rsm);
-	  return grub_errno;
+	  /* Fragments seen so far must all lie within the datagram, or
+	     NBLOCKS would count blocks past its end.  */
+	  for (i = ALIGN_UP (end, FRAGMENT_BLOCK) / FRAGMENT_BLOCK;
+	       i < FRAGMENT_MAX_BLOCKS; i++)
+	    if (rsm->have[i / 8] & (1 << (i % 8)))
+	      break;
+	  if (i < FRAGMENT_MAX_BLOCKS)
+	    {
+	      grub_dprintf ("net", "IP fragment past the end of the datagram\n");
+	      grub_netbuff_free (nb);
+	      free_rsm (rsm);
+	      return GRUB_ERR_NONE;
+	    }
 	}
+      rsm->total_len = end;
+    }
+  /* Once the length is known, fragments past it never touch the
+     bitmap.  */
+  if (rsm->total_len && end > rsm->total_len)
+    {
+      grub_netbuff_free (nb);
+      return GRUB_ERR_NONE;
     }
-  if (!rsm->asm_netbuff)
-    return GRUB_ERR_NONE;
 
-  while (1)
+  err = rsm_reserve (rsm, end);
+  if (err)
     {
-      struct grub_net_buff **nb_top_p, *nb_top;
-      grub_size_t copy;
-      grub_size_t res_len;
-      struct grub_net_buff *ret;
-      grub_net_ip_protocol_t proto;
-      grub_uint32_t src;
-      grub_uint32_t dst;
-      grub_net_network_level_address_t source;
-      grub_net_network_level_address_t dest;
-      grub_uint8_t ttl;
+      grub_netbuff_free (nb);
+      free_rsm (rsm);
+      return err;
+    }
+  grub_memcpy (rsm->asm_netbuff->data + off, nb->data + hlen, len);
+  grub_netbuff_free (nb);
 
-      nb_top_p = grub_priority_queue_top (rsm->pq);
-      if (!nb_top_p)
-	return GRUB_ERR_NONE;
-      nb_top = *nb_top_p;
-      grub_priority_queue_pop (rsm->pq);
-      iph = (struct iphdr *) nb_top->data;
-      err = grub_netbuff_pull (nb_top, ((iph->verhdrlen & 0xf)
-					* sizeof (grub_uint32_t)));
-      if (err)
-	{
-	  grub_netbuff_free (nb_top);
-	  return err;
-	}
-      if (rsm->cur_ptr < (grub_size_t) 8 * (grub_be_to_cpu16 (iph->frags)
-					    & OFFSET_MASK))
-	{
-	  grub_netbuff_free (nb_top);
-	  return GRUB_ERR_NONE;
-	}
+  for (i = off / FRAGMENT_BLOCK;
+       i < ALIGN_UP (end, FRAGMENT_BLOCK) / FRAGMENT_BLOCK; i++)
+    if (!(rsm->have[i / 8] & (1 << (i % 8))))
+      {
+	rsm->have[i / 8] |= 1 << (i % 8);
+	rsm->nblocks++;
+      }
 
-      rsm->cur_ptr = (8 * (grub_be_to_cpu16 (iph->frags) & OFFSET_MASK)
-		      + (nb_top->tail - nb_top->head));
-      if ((grub_size_t) 8 * (grub_be_to_cpu16 (iph->frags) & OFFSET_MASK)
-	  >= rsm->total_len)
-	{
-	  grub_netbuff_free (nb_top);
-	  continue;
-	}
-      copy = nb_top->tail - nb_top->data;
-      if (rsm->total_len - 8 * (grub_be_to_cpu16 (iph->frags) & OFFSET_MASK)
-	  < copy)
-	copy = rsm->total_len - 8 * (grub_be_to_cpu16 (iph->frags)
-				     & OFFSET_MASK);
-      grub_memcpy (&rsm->asm_netbuff->data[8 * (grub_be_to_cpu16 (iph->frags)
-						& OFFSET_MASK)],
-		   nb_top->data, copy);
-
-      if ((grub_be_to_cpu16 (iph->frags) & MORE_FRAGMENTS))
-	{
-	  grub_netbuff_free (nb_top);
-	  continue;
-	}
-      grub_netbuff_free (nb_top);
+  if (!rsm->total_len
+      || rsm->nblocks != ALIGN_UP (rsm->total_len, FRAGMENT_BLOCK)
+			 / FRAGMENT_BLOCK)
+    return GRUB_ERR_NONE;
 
-      ret = rsm->asm_netbuff;
-      proto = rsm->proto;
-      src = rsm->source;
-      dst = rsm->dest;
-      ttl = rsm->ttl;
+  {
+    struct grub_net_buff *ret;
+    grub_size_t res_len;
+    grub_net_ip_protocol_t proto;
+    grub_net_network_level_address_t source;
+    grub_net_network_level_address_t dest;
+    grub_uint8_t ttl;
 
-      rsm->asm_netbuff = 0;
-      res_len = rsm->total_len;
-      *prev = rsm->next;
-      free_rsm (rsm);
+    ret = rsm->asm_netbuff;
+    res_len = rsm->total_len;
+    proto = rsm->proto;
+    ttl = rsm->ttl;
 
-      if (grub_netbuff_put (ret, res_len))
-	{
-	  grub_netbuff_free (ret);
-	  return GRUB_ERR_NONE;
-	}
+    source.type = GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV4;
+    source.ipv4 = rsm->source;
 
-      source.type = GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV4;
-      source.ipv4 = src;
+    dest.type = GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV4;
+    dest.ipv4 = rsm->dest;
 
-      dest.type = GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV4;
-      dest.ipv4 = dst;
+    rsm->asm_netbuff = 0;
+    free_rsm (rsm);
 
-      return handle_dgram (ret, card, src_hwaddress,
-			   hwaddress, proto, &source, &dest, vlantag,
-			   ttl);
-    }
+    if (grub_netbuff_put (ret, res_len))
+      {
+	grub_netbuff_free (ret);
+	return GRUB_ERR_NONE;
+      }
+
+    return handle_dgram (ret, card, src_hwaddress,
+			 hwaddress, proto, &source, &dest, vlantag,
+			 ttl);
+  }
 }
 
 static grub_err_t
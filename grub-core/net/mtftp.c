@@ -0,0 +1,603 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * TFTP with the multicast option (RFC 2090).  The server sends the blocks
+ * of a file once to a multicast group for all the clients reading it at
+ * the same time.  One client at a time, the master, acknowledges them; the
+ * others take what goes by, and the server makes them master in turn to
+ * ask for the blocks they missed.
+ */
+
+#include <grub/misc.h>
+#include <grub/net/udp.h>
+#include <grub/net/ip.h>
+#include <grub/net/netbuff.h>
+#include <grub/net.h>
+#include <grub/mm.h>
+#include <grub/dl.h>
+#include <grub/file.h>
+#include <grub/i18n.h>
+#include <grub/time.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+enum
+  {
+    TFTP_SERVER_PORT = 69
+  };
+
+enum
+  {
+    TFTP_RRQ = 1,
+    TFTP_DATA = 3,
+    TFTP_ACK = 4,
+    TFTP_ERROR = 5,
+    TFTP_OACK = 6
+  };
+
+enum
+  {
+    TFTP_EUNDEF = 0
+  };
+
+/* The RRQ takes this much room at most, and the block numbers are 16-bit
+   without a roll-over to tell blocks apart that arrive out of order.  */
+#define MTFTP_RRQ_SIZE		600
+#define MTFTP_MAX_BLOCKS	65535
+
+/* The largest block that fits a frame of an MTU of 1500 bytes.  */
+#define MTFTP_BLOCK_SIZE	"1468"
+
+/* A master acknowledges again after this long without a new block, and a
+   client that is not sends the RRQ again so that the server remembers
+   it.  */
+#define MTFTP_REACK_MS		1000
+#define MTFTP_RRQ_RESEND_MS	3000
+
+/* The master stops acknowledging while the reader has this many blocks to
+   take.  */
+#define MTFTP_MAX_QUEUED	50
+
+struct tftphdr {
+  grub_uint16_t opcode;
+  union {
+    struct {
+      grub_uint16_t block;
+    } data;
+    struct {
+      grub_uint16_t block;
+    } ack;
+    struct {
+      grub_uint16_t errcode;
+      grub_int8_t errmsg[0];
+    } err;
+  } u;
+} GRUB_PACKED;
+
+typedef struct mtftp_data
+{
+  grub_uint64_t file_size;
+  grub_uint32_t block_size;
+  /* The blocks given to the reader, in order, and the number of the last
+     one of the file, 0 while it is unknown.  */
+  grub_uint32_t block;
+  grub_uint32_t last_block;
+  grub_uint32_t acked;
+  /* Blocks received ahead of the missing ones, by number.  */
+  struct grub_net_buff **ahead;
+  grub_uint32_t nahead;
+  int multicast;
+  int master;
+  int have_oack;
+  grub_uint64_t last_ack;
+  grub_uint64_t last_recv;
+  struct grub_error_saved save_err;
+  grub_net_network_level_address_t server;
+  grub_net_network_level_address_t group;
+  struct grub_net_network_level_interface *inf;
+  grub_net_udp_socket_t sock;
+  grub_net_udp_socket_t msock;
+  grub_uint8_t rrq[MTFTP_RRQ_SIZE];
+  grub_size_t rrq_len;
+} *mtftp_data_t;
+
+static grub_err_t
+send_packet (mtftp_data_t data, const void *pkt, grub_size_t len)
+{
+  grub_uint8_t nbdata[MTFTP_RRQ_SIZE + 512];
+  struct grub_net_buff nb;
+  grub_err_t err;
+
+  nb.head = nbdata;
+  nb.end = nbdata + sizeof (nbdata);
+  grub_netbuff_clear (&nb);
+  grub_netbuff_reserve (&nb, sizeof (nbdata));
+  err = grub_netbuff_push (&nb, len);
+  if (err)
+    return err;
+  grub_memcpy (nb.data, pkt, len);
+  return grub_net_send_udp_packet (data->sock, &nb);
+}
+
+static grub_err_t
+ack (mtftp_data_t data)
+{
+  struct tftphdr tftph;
+
+  tftph.opcode = grub_cpu_to_be16_compile_time (TFTP_ACK);
+  tftph.u.ack.block = grub_cpu_to_be16 (data->block);
+  data->last_ack = grub_get_time_ms ();
+  data->acked = data->block;
+  return send_packet (data, &tftph, sizeof (tftph.opcode)
+		      + sizeof (tftph.u.ack.block));
+}
+
+static void
+free_ahead (mtftp_data_t data)
+{
+  grub_uint32_t i;
+
+  if (!data->ahead)
+    return;
+  for (i = 0; i < data->nahead; i++)
+    grub_netbuff_free (data->ahead[i]);
+  grub_free (data->ahead);
+  data->ahead = NULL;
+}
+
+/* Stop receiving, telling the server to forget this client unless it has
+   just acknowledged the last block.  */
+static void
+disconnect (mtftp_data_t data, int tell)
+{
+  grub_uint8_t pkt[sizeof (grub_uint16_t) * 2 + sizeof ("closed")];
+  struct tftphdr *tftph = (struct tftphdr *) pkt;
+
+  if (data->sock && tell)
+    {
+      tftph->opcode = grub_cpu_to_be16_compile_time (TFTP_ERROR);
+      tftph->u.err.errcode = grub_cpu_to_be16_compile_time (TFTP_EUNDEF);
+      grub_memcpy (tftph->u.err.errmsg, "closed", sizeof ("closed"));
+      if (send_packet (data, pkt, sizeof (pkt)))
+	grub_print_error ();
+    }
+  if (data->sock)
+    grub_net_udp_close (data->sock);
+  data->sock = NULL;
+  if (data->msock)
+    {
+      grub_net_udp_close (data->msock);
+      grub_net_ip_leave_group (data->inf, &data->group);
+    }
+  data->msock = NULL;
+}
+
+static grub_err_t mtftp_receive (grub_net_udp_socket_t sock,
+				 struct grub_net_buff *nb, void *f);
+
+/* Take "address,port,master" of the multicast option, where the first two
+   may be empty after the first OACK.  */
+static grub_err_t
+parse_multicast (grub_file_t file, const char *val)
+{
+  mtftp_data_t data = file->data;
+  const char *comma, *port_str;
+  char addr[sizeof ("255.255.255.255")];
+  unsigned long port;
+  grub_err_t err;
+
+  comma = grub_strchr (val, ',');
+  if (!comma)
+    return grub_error (GRUB_ERR_NET_INVALID_RESPONSE,
+		       N_("invalid multicast option `%s'"), val);
+  port_str = comma + 1;
+
+  if (comma != val && !data->multicast)
+    {
+      if ((grub_size_t) (comma - val) >= sizeof (addr))
+	return grub_error (GRUB_ERR_NET_INVALID_RESPONSE,
+			   N_("invalid multicast option `%s'"), val);
+      grub_memcpy (addr, val, comma - val);
+      addr[comma - val] = 0;
+      port = grub_strtoul (port_str, 0, 10);
+      if (grub_errno || !port || port > 65535)
+	return grub_error (GRUB_ERR_NET_INVALID_RESPONSE,
+			   N_("invalid multicast option `%s'"), val);
+
+      err = grub_net_resolve_address (addr, &data->group);
+      if (err)
+	return err;
+      err = grub_net_ip_join_group (data->inf, &data->group);
+      if (err)
+	return err;
+
+      data->msock = grub_net_udp_open (data->server, 0, mtftp_receive, file);
+      if (!data->msock)
+	{
+	  grub_net_ip_leave_group (data->inf, &data->group);
+	  return grub_errno;
+	}
+      grub_net_udp_set_in_port (data->msock, port);
+      data->multicast = 1;
+    }
+
+  comma = grub_strchr (port_str, ',');
+  if (!comma)
+    return grub_error (GRUB_ERR_NET_INVALID_RESPONSE,
+		       N_("invalid multicast option `%s'"), val);
+  data->master = (comma[1] == '1');
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+handle_oack (grub_file_t file, struct grub_net_buff *nb)
+{
+  mtftp_data_t data = file->data;
+  const char *multicast = NULL;
+  grub_uint8_t *ptr;
+  grub_err_t err;
+
+  /* Options may be repeated later with the file size and block size
+     already settled.  */
+  for (ptr = nb->data + sizeof (grub_uint16_t); ptr < nb->tail;)
+    {
+      const char *name = (const char *) ptr, *val;
+
+      while (ptr < nb->tail && *ptr)
+	ptr++;
+      ptr++;
+      if (ptr >= nb->tail)
+	break;
+      val = (const char *) ptr;
+      while (ptr < nb->tail && *ptr)
+	ptr++;
+      if (ptr >= nb->tail)
+	break;
+      ptr++;
+
+      if (grub_strcasecmp (name, "multicast") == 0)
+	multicast = val;
+      else if (data->have_oack)
+	continue;
+      else if (grub_strcasecmp (name, "tsize") == 0)
+	data->file_size = grub_strtoull (val, 0, 10);
+      else if (grub_strcasecmp (name, "blksize") == 0)
+	data->block_size = grub_strtoul (val, 0, 10);
+    }
+
+  if (!data->have_oack)
+    {
+      if (!data->block_size || data->block_size > 65464)
+	return grub_error (GRUB_ERR_NET_INVALID_RESPONSE,
+			   N_("invalid TFTP block size"));
+      if (data->file_size)
+	{
+	  if (data->file_size / data->block_size + 1 > MTFTP_MAX_BLOCKS)
+	    return grub_error (GRUB_ERR_OUT_OF_RANGE,
+			       N_("file is too large for multicast TFTP"));
+	  data->last_block = data->file_size / data->block_size + 1;
+	}
+    }
+
+  if (multicast)
+    {
+      err = parse_multicast (file, multicast);
+      if (err)
+	return err;
+    }
+  /* Without the option, it is a plain TFTP transfer to this client.  */
+  else if (!data->have_oack)
+    data->master = 1;
+
+  if (data->multicast && !data->ahead)
+    {
+      if (!data->last_block)
+	return grub_error (GRUB_ERR_NET_INVALID_RESPONSE,
+			   N_("multicast TFTP server did not send the file size"));
+      data->ahead = grub_calloc (data->last_block + 1,
+				 sizeof (data->ahead[0]));
+      if (!data->ahead)
+	return grub_errno;
+      data->nahead = data->last_block + 1;
+    }
+
+  data->have_oack = 1;
+  /* The master asks for the block after the last one it has in order.  */
+  if (data->master)
+    return ack (data);
+  return GRUB_ERR_NONE;
+}
+
+static void
+deliver (grub_file_t file, struct grub_net_buff *nb)
+{
+  mtftp_data_t data = file->data;
+
+  data->block++;
+  if (nb->tail - nb->data > 0)
+    grub_net_put_packet (&file->device->net->packs, nb);
+  else
+    grub_netbuff_free (nb);
+}
+
+static grub_err_t
+handle_data (grub_file_t file, struct grub_net_buff *nb)
+{
+  mtftp_data_t data = file->data;
+  struct tftphdr *tftph = (struct tftphdr *) nb->data;
+  grub_uint32_t b;
+  grub_size_t size;
+  grub_err_t err;
+
+  if (nb->tail - nb->data < (grub_ssize_t) (sizeof (tftph->opcode)
+					    + sizeof (tftph->u.data.block)))
+    {
+      grub_netbuff_free (nb);
+      return GRUB_ERR_NONE;
+    }
+
+  b = grub_be_to_cpu16 (tftph->u.data.block);
+  if (!data->have_oack || b <= data->block
+      || (data->last_block && b > data->last_block)
+      || (data->ahead && data->ahead[b]))
+    {
+      grub_netbuff_free (nb);
+      /* Our ACK got lost.  */
+      if (data->master && b == data->block)
+	return ack (data);
+      return GRUB_ERR_NONE;
+    }
+
+  err = grub_netbuff_pull (nb, sizeof (tftph->opcode)
+			   + sizeof (tftph->u.data.block));
+  if (err)
+    {
+      grub_netbuff_free (nb);
+      return err;
+    }
+  size = nb->tail - nb->data;
+  if (size > data->block_size)
+    grub_netbuff_unput (nb, size - data->block_size);
+  else if (size < data->block_size)
+    data->last_block = b;
+
+  if (b == data->block + 1)
+    {
+      deliver (file, nb);
+      while (data->ahead && data->block < data->last_block
+	     && data->ahead[data->block + 1])
+	{
+	  nb = data->ahead[data->block + 1];
+	  data->ahead[data->block + 1] = NULL;
+	  deliver (file, nb);
+	}
+    }
+  else if (data->ahead)
+    data->ahead[b] = nb;
+  else
+    grub_netbuff_free (nb);
+
+  if (data->last_block && data->block == data->last_block)
+    {
+      if (data->master)
+	ack (data);
+      file->device->net->eof = 1;
+      file->device->net->stall = 1;
+      free_ahead (data);
+      disconnect (data, !data->master);
+      return GRUB_ERR_NONE;
+    }
+
+  if (data->master)
+    {
+      if (file->device->net->packs.count < MTFTP_MAX_QUEUED)
+	return ack (data);
+      file->device->net->stall = 1;
+    }
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+mtftp_receive (grub_net_udp_socket_t sock __attribute__ ((unused)),
+	       struct grub_net_buff *nb, void *f)
+{
+  grub_file_t file = f;
+  mtftp_data_t data = file->data;
+  struct tftphdr *tftph = (struct tftphdr *) nb->data;
+
+  if (nb->tail - nb->data < (grub_ssize_t) sizeof (tftph->opcode))
+    {
+      grub_netbuff_free (nb);
+      return GRUB_ERR_NONE;
+    }
+
+  data->last_recv = grub_get_time_ms ();
+  switch (grub_be_to_cpu16 (tftph->opcode))
+    {
+    case TFTP_OACK:
+      if (handle_oack (file, nb))
+	{
+	  data->have_oack = 1;
+	  grub_error_save (&data->save_err);
+	  file->device->net->eof = 1;
+	}
+      break;
+    case TFTP_DATA:
+      /* A lost ACK is sent again later.  */
+      if (handle_data (file, nb))
+	grub_errno = GRUB_ERR_NONE;
+      return GRUB_ERR_NONE;
+    case TFTP_ERROR:
+      data->have_oack = 1;
+      grub_error (GRUB_ERR_IO, "%.*s",
+		  (int) (nb->tail - nb->data - 2 * sizeof (grub_uint16_t)),
+		  (char *) tftph->u.err.errmsg);
+      grub_error_save (&data->save_err);
+      file->device->net->eof = 1;
+      break;
+    }
+  grub_netbuff_free (nb);
+  return GRUB_ERR_NONE;
+}
+
+static void
+add_option (mtftp_data_t data, const char *s)
+{
+  grub_size_t len = grub_strlen (s) + 1;
+
+  if (data->rrq_len + len > sizeof (data->rrq))
+    return;
+  grub_memcpy (data->rrq + data->rrq_len, s, len);
+  data->rrq_len += len;
+}
+
+static grub_err_t
+mtftp_open (struct grub_file *file, const char *filename)
+{
+  grub_net_network_level_address_t gateway;
+  struct tftphdr *tftph;
+  mtftp_data_t data;
+  grub_err_t err;
+  int port = file->device->net->port;
+  int i;
+
+  if (grub_strlen (filename) + 64 > MTFTP_RRQ_SIZE)
+    return grub_error (GRUB_ERR_BAD_FILENAME, N_("filename is too long"));
+
+  data = grub_zalloc (sizeof (*data));
+  if (!data)
+    return grub_errno;
+
+  tftph = (struct tftphdr *) data->rrq;
+  tftph->opcode = grub_cpu_to_be16_compile_time (TFTP_RRQ);
+  data->rrq_len = sizeof (tftph->opcode);
+  add_option (data, filename);
+  add_option (data, "octet");
+  add_option (data, "blksize");
+  add_option (data, MTFTP_BLOCK_SIZE);
+  add_option (data, "tsize");
+  add_option (data, "0");
+  add_option (data, "multicast");
+  add_option (data, "");
+
+  err = grub_net_resolve_address (file->device->net->server, &data->server);
+  if (!err)
+    err = grub_net_route_address (data->server, &gateway, &data->inf);
+  if (err)
+    {
+      grub_free (data);
+      return err;
+    }
+
+  file->not_easily_seekable = 1;
+  file->data = data;
+
+  data->sock = grub_net_udp_open (data->server,
+				  port ? port : TFTP_SERVER_PORT,
+				  mtftp_receive, file);
+  if (!data->sock)
+    {
+      grub_free (data);
+      file->data = NULL;
+      return grub_errno;
+    }
+
+  for (i = 0; i < GRUB_NET_TRIES && !data->have_oack; i++)
+    {
+      err = send_packet (data, data->rrq, data->rrq_len);
+      if (err)
+	break;
+      grub_net_poll_cards (GRUB_NET_INTERVAL + (i * GRUB_NET_INTERVAL_ADDITION),
+			   &data->have_oack);
+    }
+
+  if (!err && !data->have_oack)
+    grub_error (GRUB_ERR_TIMEOUT, N_("time out opening `%s'"), filename);
+  else if (!err)
+    grub_error_load (&data->save_err);
+  if (grub_errno)
+    {
+      free_ahead (data);
+      disconnect (data, 1);
+      grub_free (data);
+      file->data = NULL;
+      return grub_errno;
+    }
+
+  file->size = data->file_size;
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+mtftp_close (struct grub_file *file)
+{
+  mtftp_data_t data = file->data;
+
+  free_ahead (data);
+  disconnect (data, 1);
+  grub_free (data);
+  file->data = NULL;
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+mtftp_packets_pulled (struct grub_file *file)
+{
+  mtftp_data_t data = file->data;
+  grub_uint64_t now = grub_get_time_ms ();
+
+  if (data->save_err.grub_errno)
+    {
+      grub_error_load (&data->save_err);
+      return grub_errno;
+    }
+
+  if (file->device->net->eof
+      || file->device->net->packs.count >= MTFTP_MAX_QUEUED)
+    return GRUB_ERR_NONE;
+  file->device->net->stall = 0;
+
+  if (data->master
+      && (data->acked < data->block || now - data->last_ack >= MTFTP_REACK_MS))
+    return ack (data);
+  if (!data->master && now - data->last_recv >= MTFTP_RRQ_RESEND_MS)
+    {
+      data->last_recv = now;
+      return send_packet (data, data->rrq, data->rrq_len);
+    }
+  return GRUB_ERR_NONE;
+}
+
+static struct grub_net_app_protocol grub_mtftp_protocol =
+  {
+    .name = "mtftp",
+    .open = mtftp_open,
+    .close = mtftp_close,
+    .packets_pulled = mtftp_packets_pulled
+  };
+
+GRUB_MOD_INIT (mtftp)
+{
+  grub_net_app_level_register (&grub_mtftp_protocol);
+}
+
+GRUB_MOD_FINI (mtftp)
+{
+  grub_net_app_level_unregister (&grub_mtftp_protocol);
+}
@@ -45,26 +45,56 @@ static struct grub_fs grub_net_fs;
 
 struct grub_net_link_layer_entry {
   int avail;
+  /* The next entry in the same hash chain, or -1.  */
+  int next;
   grub_net_network_level_address_t nl_address;
   grub_net_link_level_address_t ll_address;
 };
 
 #define LINK_LAYER_CACHE_SIZE 256
+#define LINK_LAYER_HASH_SIZE 64
+
+struct grub_net_link_layer_table
+{
+  struct grub_net_link_layer_entry entries[LINK_LAYER_CACHE_SIZE];
+  int heads[LINK_LAYER_HASH_SIZE];
+};
+
+static unsigned
+link_layer_hash (const grub_net_network_level_address_t *proto)
+{
+  grub_uint64_t h = 0;
+
+  switch (proto->type)
+    {
+    case GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV4:
+      h = proto->ipv4;
+      break;
+    case GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV6:
+      h = proto->ipv6[0] ^ proto->ipv6[1];
+      break;
+    case GRUB_NET_NETWORK_LEVEL_PROTOCOL_DHCP_RECV:
+      break;
+    }
+  h ^= h >> 32;
+  h ^= h >> 16;
+  h ^= h >> 8;
+  return (proto->type + h) % LINK_LAYER_HASH_SIZE;
+}
 
 static struct grub_net_link_layer_entry *
 link_layer_find_entry (const grub_net_network_level_address_t *proto,
 		       const struct grub_net_card *card)
 {
-  unsigned i;
-  if (!card->link_layer_table)
+  struct grub_net_link_layer_table *table = card->link_layer_table;
+  int i;
+
+  if (!table)
     return NULL;
-  for (i = 0; i < LINK_LAYER_CACHE_SIZE; i++)
-    {
-      if (card->link_layer_table[i].avail == 1
-	  && grub_net_addr_cmp (&card->link_layer_table[i].nl_address,
-				proto) == 0)
-	return &card->link_layer_table[i];
-    }
+  for (i = table->heads[link_layer_hash (proto)]; i >= 0;
+       i = table->entries[i].next)
+    if (grub_net_addr_cmp (&table->entries[i].nl_address, proto) == 0)
+      return &table->entries[i];
   return NULL;
 }
 
@@ -74,7 +104,10 @@ grub_net_link_layer_add_address (struct grub_net_card *card,
 				 const grub_net_link_level_address_t *ll,
 				 int override)
 {
+  struct grub_net_link_layer_table *table;
   struct grub_net_link_layer_entry *entry;
+  int *prev;
+  unsigned i;
 
   /* Check if the sender is in the cache table.  */
   entry = link_layer_find_entry (nl, card);
@@ -87,16 +120,29 @@ grub_net_link_layer_add_address (struct grub_net_card *card,
   /* Add sender to cache table.  */
   if (card->link_layer_table == NULL)
     {
-      card->link_layer_table = grub_zalloc (LINK_LAYER_CACHE_SIZE
-					    * sizeof (card->link_layer_table[0]));
+      card->link_layer_table = grub_zalloc (sizeof (*card->link_layer_table));
       if (card->link_layer_table == NULL)
 	return;
+      for (i = 0; i < LINK_LAYER_HASH_SIZE; i++)
+	card->link_layer_table->heads[i] = -1;
+    }
+  table = card->link_layer_table;
+
+  /* The oldest entry makes room.  */
+  entry = &table->entries[card->new_ll_entry];
+  if (entry->avail)
+    {
+      for (prev = &table->heads[link_layer_hash (&entry->nl_address)];
+	   *prev != card->new_ll_entry; prev = &table->entries[*prev].next);
+      *prev = entry->next;
     }
 
-  entry = &(card->link_layer_table[card->new_ll_entry]);
   entry->avail = 1;
   grub_memcpy (&entry->ll_address, ll, sizeof (entry->ll_address));
   grub_memcpy (&entry->nl_address, nl, sizeof (entry->nl_address));
+  prev = &table->heads[link_layer_hash (nl)];
+  entry->next = *prev;
+  *prev = card->new_ll_entry;
   card->new_ll_entry++;
   if (card->new_ll_entry == LINK_LAYER_CACHE_SIZE)
     card->new_ll_entry = 0;
@@ -184,6 +230,33 @@ grub_net_link_layer_resolve (struct grub_net_network_level_interface *inf,
 		     N_("timeout: could not resolve hardware address"));
 }
 
+void
+grub_net_link_layer_prefetch (struct grub_net_network_level_interface *inf,
+			      const grub_net_network_level_address_t *proto_addr)
+{
+  /* Sending opens the card, which is left to the first real user.  */
+  if (!inf->card->opened
+      || grub_net_link_layer_resolve_check (inf, proto_addr))
+    return;
+
+  switch (proto_addr->type)
+    {
+    case GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV4:
+      if (grub_net_arp_prefetch (inf, proto_addr))
+	grub_errno = GRUB_ERR_NONE;
+      break;
+    case GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV6:
+      /* Multicast addresses map to hardware addresses directly.  */
+      if ((grub_be_to_cpu64 (proto_addr->ipv6[0]) >> 56) == 0xff)
+	break;
+      if (grub_net_icmp6_prefetch (inf, proto_addr))
+	grub_errno = GRUB_ERR_NONE;
+      break;
+    default:
+      break;
+    }
+}
+
 void
 grub_net_card_unregister (struct grub_net_card *card)
 {
@@ -369,9 +442,13 @@ grub_cmd_ipv6_autoconf (struct grub_command *cmd __attribute__ ((unused)),
     j++;
   }
 
+  /* Solicit on all cards at once and stop waiting as soon as every card
+     has an address, rather than at the end of each interval.  */
   for (interval = 200; interval < 10000; interval *= 2)
     {
+      grub_uint64_t start, elapsed;
       int done = 1;
+
       for (j = 0; j < ncards; j++)
 	{
 	  if (slaacs[j]->slaac_counter)
@@ -383,7 +460,21 @@ grub_cmd_ipv6_autoconf (struct grub_command *cmd __attribute__ ((unused)),
 	}
       if (done)
 	break;
-      grub_net_poll_cards (interval, 0);
+
+      start = grub_get_time_ms ();
+      while (!done
+	     && (elapsed = grub_get_time_ms () - start) < (unsigned) interval)
+	{
+	  grub_net_icmp6_ra_received = 0;
+	  grub_net_poll_cards (interval - elapsed,
+			       &grub_net_icmp6_ra_received);
+	  done = 1;
+	  for (j = 0; j < ncards; j++)
+	    if (!slaacs[j]->slaac_counter)
+	      done = 0;
+	}
+      if (done)
+	break;
     }
 
   err = GRUB_ERR_NONE;
@@ -1601,12 +1692,17 @@ grub_net_fs_close (grub_file_t file)
   return GRUB_ERR_NONE;
 }
 
-static void
+/* The most frames taken from a card in one poll, and in one batch.  */
+#define GRUB_NET_RECV_MAX	100
+#define GRUB_NET_RECV_BATCH	16
+
+/* Return the number of frames received.  */
+static int
 receive_packets (struct grub_net_card *card, int *stop_condition)
 {
   int received = 0;
   if (card->num_ifaces == 0)
-    return;
+    return 0;
   if (!card->opened)
     {
       grub_err_t err = GRUB_ERR_NONE;
@@ -1615,35 +1711,58 @@ receive_packets (struct grub_net_card *card, int *stop_condition)
       if (err)
 	{
 	  grub_errno = GRUB_ERR_NONE;
-	  return;
+	  return 0;
 	}
       card->opened = 1;
     }
-  while (received < 100)
+  while (received < GRUB_NET_RECV_MAX)
     {
       /* Maybe should be better have a fixed number of packets for each card
 	 and just mark them as used and not used.  */
-      struct grub_net_buff *nb;
+      struct grub_net_buff *batch[GRUB_NET_RECV_BATCH];
+      grub_size_t n, i, max;
 
       if (received > 10 && stop_condition && *stop_condition)
 	break;
 
-      nb = card->driver->recv (card);
-      if (!nb)
+      /*
+       * Drain the frames the card has before the stack sees any of them,
+       * then let it work through the lot.
+       */
+      if (card->driver->recv_batch)
 	{
-	  card->last_poll = grub_get_time_ms ();
-	  break;
+	  max = grub_min (GRUB_NET_RECV_MAX - received, GRUB_NET_RECV_BATCH);
+	  n = card->driver->recv_batch (card, batch, max);
 	}
-      received++;
-      grub_net_recv_ethernet_packet (nb, card);
-      if (grub_errno)
+      else
 	{
-	  grub_dprintf ("net", "error receiving: %d: %s\n", grub_errno,
-			grub_errmsg);
-	  grub_errno = GRUB_ERR_NONE;
+	  max = 1;
+	  batch[0] = card->driver->recv (card);
+	  n = batch[0] ? 1 : 0;
+	}
+      received += n;
+
+      for (i = 0; i < n; i++)
+	{
+	  grub_net_recv_ethernet_packet (batch[i], card);
+	  if (grub_errno)
+	    {
+	      grub_dprintf ("net", "error receiving: %d: %s\n", grub_errno,
+			    grub_errmsg);
+	      grub_errno = GRUB_ERR_NONE;
+	    }
+	}
+
+      if (n == 0 || (card->driver->recv_batch && n < max))
+	{
+	  card->last_poll = grub_get_time_ms ();
+	  break;
 	}
     }
+  if (received)
+    grub_net_tcp_flush_acks ();
   grub_print_error ();
+  return received;
 }
 
 static char *
@@ -1684,16 +1803,28 @@ grub_env_set_net_property (const char *intername, const char *suffix,
   return ret;
 }
 
+/* A wait that saw no frame for this long idles between polls.  Transfers,
+   which get frames all the time, keep polling flat out.  */
+#define GRUB_NET_IDLE_AFTER_MS	10
+
 void
 grub_net_poll_cards (unsigned time, int *stop_condition)
 {
   struct grub_net_card *card;
-  grub_uint64_t start_time;
-  start_time = grub_get_time_ms ();
+  grub_uint64_t start_time, last_received;
+  start_time = last_received = grub_get_time_ms ();
   while ((grub_get_time_ms () - start_time) < time
 	 && (!stop_condition || !*stop_condition))
-    FOR_NET_CARDS (card)
-      receive_packets (card, stop_condition);
+    {
+      int received = 0;
+
+      FOR_NET_CARDS (card)
+	received += receive_packets (card, stop_condition);
+      if (received)
+	last_received = grub_get_time_ms ();
+      else if (grub_get_time_ms () - last_received >= GRUB_NET_IDLE_AFTER_MS)
+	grub_idle (1);
+    }
   grub_net_tcp_retransmit ();
 }
 
@@ -1757,8 +1888,12 @@ grub_net_fs_read_real (grub_file_t file, char *buf, grub_size_t len)
 	      return total;
 	    }
 	}
-      if (net->protocol->packets_pulled)
-	net->protocol->packets_pulled (file);
+      /* A transfer that ended in an error fails the read rather than
+	 leaving the file cut short.  */
+      if (net->protocol->packets_pulled
+	  && net->protocol->packets_pulled (file) != GRUB_ERR_NONE
+	  && net->eof)
+	return -1;
 
       if (!net->eof)
 	{
@@ -1867,6 +2002,7 @@ grub_net_fini_hw (int noreturn __attribute__ ((unused)))
 	  card->driver->close (card);
 	card->opened = 0;
       }
+  grub_netbuff_pool_drain ();
   return GRUB_ERR_NONE;
 }
 
@@ -21,6 +21,17 @@
 #include <grub/mm.h>
 #include <grub/net/netbuff.h>
 
+/*
+ * Freed buffers are kept for reuse, up to this many.  Allocation sizes are
+ * rounded to NETBUFF_ALIGN, so most packets, received frames included, are
+ * of the same size and a receive loop recycles the same few buffers.
+ */
+#define NETBUFF_POOL_MAX	64
+
+/* While in the pool, a buffer links to the next one from its head.  */
+static struct grub_net_buff *pool;
+static unsigned pool_count;
+
 grub_err_t
 grub_netbuff_put (struct grub_net_buff *nb, grub_size_t len)
 {
@@ -74,7 +85,7 @@ grub_netbuff_reserve (struct grub_net_buff *nb, grub_size_t len)
 struct grub_net_buff *
 grub_netbuff_alloc (grub_size_t len)
 {
-  struct grub_net_buff *nb;
+  struct grub_net_buff *nb, **prev;
   void *data;
 
   COMPILE_TIME_ASSERT (NETBUFF_ALIGN % sizeof (grub_properly_aligned_t) == 0);
@@ -96,6 +107,16 @@ grub_netbuff_alloc (grub_size_t len)
 
   len = ALIGN_UP (len, NETBUFF_ALIGN);
 
+  for (prev = &pool; *prev; prev = (struct grub_net_buff **) (*prev)->head)
+    if ((grub_size_t) ((*prev)->end - (*prev)->head) == len)
+      {
+	nb = *prev;
+	*prev = *(struct grub_net_buff **) nb->head;
+	pool_count--;
+	nb->data = nb->tail = nb->head;
+	return nb;
+      }
+
 #ifdef GRUB_MACHINE_EMU
   data = grub_malloc (len + sizeof (*nb));
 #else
@@ -135,9 +156,58 @@ grub_netbuff_free (struct grub_net_buff *nb)
 {
   if (!nb)
     return;
+  if (pool_count < NETBUFF_POOL_MAX)
+    {
+      *(struct grub_net_buff **) nb->head = pool;
+      pool = nb;
+      pool_count++;
+      return;
+    }
   grub_free (nb->head);
 }
 
+grub_err_t
+grub_netbuff_pool_reserve (grub_size_t len, unsigned count)
+{
+  struct grub_net_buff *nb, *taken = NULL;
+  grub_err_t err = GRUB_ERR_NONE;
+
+  /* Taking them all first makes the pooled ones of LEN count.  */
+  for (count = grub_min (count, NETBUFF_POOL_MAX); count; count--)
+    {
+      nb = grub_netbuff_alloc (len);
+      if (!nb)
+	{
+	  err = grub_errno;
+	  break;
+	}
+      *(struct grub_net_buff **) nb->head = taken;
+      taken = nb;
+    }
+
+  while (taken)
+    {
+      nb = taken;
+      taken = *(struct grub_net_buff **) nb->head;
+      grub_netbuff_free (nb);
+    }
+  return err;
+}
+
+void
+grub_netbuff_pool_drain (void)
+{
+  struct grub_net_buff *nb;
+
+  while (pool)
+    {
+      nb = pool;
+      pool = *(struct grub_net_buff **) nb->head;
+      grub_free (nb->head);
+    }
+  pool_count = 0;
+}
+
 grub_err_t
 grub_netbuff_clear (struct grub_net_buff *nb)
 {
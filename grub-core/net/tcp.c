@@ -22,12 +22,32 @@
 #include <grub/net/netbuff.h>
 #include <grub/time.h>
 #include <grub/priority_queue.h>
+#include <grub/mm.h>
 
 #define TCP_SYN_RETRANSMISSION_TIMEOUT GRUB_NET_INTERVAL
 #define TCP_SYN_RETRANSMISSION_COUNT GRUB_NET_TRIES
 #define TCP_RETRANSMISSION_TIMEOUT GRUB_NET_INTERVAL
 #define TCP_RETRANSMISSION_COUNT GRUB_NET_TRIES
 
+/*
+ * The receive window takes this share of the free heap, within the bounds
+ * below.  It only goes above 64 KiB if the peer takes the window scale
+ * option (RFC 7323).
+ */
+#define TCP_WINDOW_HEAP_SHARE 8
+#define TCP_MIN_WINDOW 0xffff
+#define TCP_MAX_WINDOW (2 * 1024 * 1024)
+#define TCP_MAX_WINDOW_SCALE 14
+
+/*
+ * Data in order is acked at the end of the poll that received it once
+ * this many segments wait for an ACK, and otherwise after the delay.  The
+ * segments we send are resent on that many duplicate ACKs.
+ */
+#define TCP_DELAYED_ACK_SEGMENTS 2
+#define TCP_DELAYED_ACK_TIMEOUT 40
+#define TCP_FAST_RETRANSMIT_DUP_ACKS 3
+
 struct unacked
 {
   struct unacked *next;
@@ -47,6 +67,16 @@ enum
     TCP_URG = 0x20,
   };
 
+enum
+  {
+    TCP_OPT_END = 0,
+    TCP_OPT_NOP = 1,
+    TCP_OPT_WINDOW_SCALE = 3,
+  };
+
+/* The window scale option and a NOP to align the options.  */
+#define TCP_WINDOW_SCALE_OPT_SIZE 4
+
 struct grub_net_tcp_socket
 {
   struct grub_net_tcp_socket *next;
@@ -65,7 +95,18 @@ struct grub_net_tcp_socket
   grub_uint32_t my_cur_seq;
   grub_uint32_t their_start_seq;
   grub_uint32_t their_cur_seq;
-  grub_uint16_t my_window;
+  /* The receive window, in bytes, and the shift the peer applies to the
+     window field.  */
+  grub_uint32_t my_window;
+  grub_uint8_t my_window_scale;
+  int window_scaling;
+  /* The segments received since the last ACK and when it is due.  */
+  int ack_pending;
+  grub_uint64_t ack_due;
+  /* The last ACK of the peer and how often it came again.  */
+  grub_uint32_t their_last_ack;
+  grub_uint16_t their_last_window;
+  int dup_acks;
   struct unacked *unack_first;
   struct unacked *unack_last;
   grub_err_t (*recv_hook) (grub_net_tcp_socket_t sock, struct grub_net_buff *nb,
@@ -163,6 +204,91 @@ tcp_socket_register (grub_net_tcp_socket_t sock)
 		  GRUB_AS_LIST (sock));
 }
 
+/* Whether the sequence number A comes before B, modulo 2^32.  */
+static inline int
+tcp_seq_lt (grub_uint32_t a, grub_uint32_t b)
+{
+  return (grub_int32_t) (a - b) < 0;
+}
+
+/* Size the receive window of SOCK from the free heap.  */
+static void
+tcp_window_init (grub_net_tcp_socket_t sock)
+{
+  grub_size_t window;
+
+  window = grub_mm_free_size () / TCP_WINDOW_HEAP_SHARE;
+  window = grub_max (window, TCP_MIN_WINDOW);
+  window = grub_min (window, TCP_MAX_WINDOW);
+
+  sock->my_window = window;
+  for (sock->my_window_scale = 0;
+       (window >> sock->my_window_scale) > 0xffff;
+       sock->my_window_scale++);
+}
+
+/* Fall back to a window the 16-bit field holds, for a peer without the
+   window scale option.  */
+static void
+tcp_window_unscaled (grub_net_tcp_socket_t sock)
+{
+  sock->window_scaling = 0;
+  sock->my_window = grub_min (sock->my_window, 0xffff);
+  sock->my_window_scale = 0;
+}
+
+/* The window field of the segments sent on SOCK after the SYN ones, which
+   are never scaled.  */
+static grub_uint16_t
+tcp_window (grub_net_tcp_socket_t sock)
+{
+  if (sock->i_stall)
+    return 0;
+  return grub_cpu_to_be16 (sock->my_window >> sock->my_window_scale);
+}
+
+/* Append the window scale option of SOCK to the SYN segment in NB.  */
+static grub_err_t
+tcp_put_window_scale (struct grub_net_buff *nb, grub_net_tcp_socket_t sock)
+{
+  grub_uint8_t *opt = nb->tail;
+  grub_err_t err;
+
+  err = grub_netbuff_put (nb, TCP_WINDOW_SCALE_OPT_SIZE);
+  if (err)
+    return err;
+  opt[0] = TCP_OPT_NOP;
+  opt[1] = TCP_OPT_WINDOW_SCALE;
+  opt[2] = 3;
+  opt[3] = sock->my_window_scale;
+  return GRUB_ERR_NONE;
+}
+
+/* Whether the SYN segment TCPH carries the window scale option.  Its shift
+   only applies to the windows the peer sends, which are not used.  */
+static int
+tcp_has_window_scale (const struct tcphdr *tcph)
+{
+  const grub_uint8_t *opt = (const grub_uint8_t *) (tcph + 1);
+  const grub_uint8_t *end = (const grub_uint8_t *) tcph
+    + (grub_be_to_cpu16 (tcph->flags) >> 12) * sizeof (grub_uint32_t);
+
+  while (opt < end && *opt != TCP_OPT_END)
+    {
+      if (*opt == TCP_OPT_NOP)
+	{
+	  opt++;
+	  continue;
+	}
+      if (end - opt < 2 || opt[1] < 2 || opt[1] > end - opt)
+	break;
+      if (*opt == TCP_OPT_WINDOW_SCALE && opt[1] == 3)
+	return 1;
+      opt += opt[1];
+    }
+  return 0;
+}
+
 static void
 error (grub_net_tcp_socket_t sock)
 {
@@ -198,6 +324,8 @@ tcp_send (struct grub_net_buff *nb, grub_net_tcp_socket_t socket)
   if (grub_be_to_cpu16 (tcph->flags) & TCP_FIN)
     size++;
   socket->my_cur_seq += size;
+  if (tcph->flags & grub_cpu_to_be16_compile_time (TCP_ACK))
+    socket->ack_pending = 0;
   tcph->src = grub_cpu_to_be16 (socket->in_port);
   tcph->dst = grub_cpu_to_be16 (socket->out_port);
   tcph->checksum = 0;
@@ -332,8 +460,7 @@ ack_real (grub_net_tcp_socket_t sock, int res)
     {
       tcph_ack->ack = grub_cpu_to_be32 (sock->their_cur_seq);
       tcph_ack->flags = grub_cpu_to_be16_compile_time ((5 << 12) | TCP_ACK);
-      tcph_ack->window = !sock->i_stall ? grub_cpu_to_be16 (sock->my_window)
-	: 0;
+      tcph_ack->window = tcp_window (sock);
     }
   tcph_ack->urgent = 0;
   tcph_ack->src = grub_cpu_to_be16 (sock->in_port);
@@ -358,6 +485,40 @@ reset (grub_net_tcp_socket_t sock)
   ack_real (sock, 1);
 }
 
+/* Send the unacknowledged segment UNACK of SOCK again.  */
+static void
+tcp_resend (grub_net_tcp_socket_t sock, struct unacked *unack)
+{
+  struct tcphdr *tcph;
+  grub_uint8_t *nbd;
+  grub_err_t err;
+
+  nbd = unack->nb->data;
+  tcph = (struct tcphdr *) nbd;
+
+  if ((tcph->flags & grub_cpu_to_be16_compile_time (TCP_ACK))
+      && tcph->ack != grub_cpu_to_be32 (sock->their_cur_seq))
+    {
+      grub_uint32_t ack = grub_cpu_to_be32 (sock->their_cur_seq);
+
+      /* Acknowledge what came in since, without summing the segment
+	 again.  */
+      tcph->checksum = grub_net_ip_chksum_update32 (tcph->checksum,
+						    tcph->ack, ack);
+      tcph->ack = ack;
+    }
+
+  err = grub_net_send_ip_packet (sock->inf, &(sock->out_nla),
+				 &(sock->ll_target_addr), unack->nb,
+				 GRUB_NET_IP_TCP);
+  unack->nb->data = nbd;
+  if (err)
+    {
+      grub_dprintf ("net", "TCP retransmit failed: %s\n", grub_errmsg);
+      grub_errno = GRUB_ERR_NONE;
+    }
+}
+
 void
 grub_net_tcp_retransmit (void)
 {
@@ -373,12 +534,12 @@ grub_net_tcp_retransmit (void)
   FOR_TCP_SOCKETS (sock)
   {
     struct unacked *unack;
+
+    if (sock->ack_pending && ctime >= sock->ack_due)
+      ack (sock);
+
     for (unack = sock->unack_first; unack; unack = unack->next)
       {
-	struct tcphdr *tcph;
-	grub_uint8_t *nbd;
-	grub_err_t err;
-
 	if (unack->last_try > limit_time)
 	  continue;
 
@@ -389,42 +550,30 @@ grub_net_tcp_retransmit (void)
 	  }
 	unack->try_count++;
 	unack->last_try = ctime;
-	nbd = unack->nb->data;
-	tcph = (struct tcphdr *) nbd;
-
-	if ((tcph->flags & grub_cpu_to_be16_compile_time (TCP_ACK))
-	    && tcph->ack != grub_cpu_to_be32 (sock->their_cur_seq))
-	  {
-	    tcph->checksum = 0;
-	    tcph->checksum = grub_net_ip_transport_checksum (unack->nb,
-							     GRUB_NET_IP_TCP,
-							     &sock->inf->address,
-							     &sock->out_nla);
-	  }
-
-	err = grub_net_send_ip_packet (sock->inf, &(sock->out_nla),
-				       &(sock->ll_target_addr), unack->nb,
-				       GRUB_NET_IP_TCP);
-	unack->nb->data = nbd;
-	if (err)
-	  {
-	    grub_dprintf ("net", "TCP retransmit failed: %s\n", grub_errmsg);
-	    grub_errno = GRUB_ERR_NONE;
-	  }
+	tcp_resend (sock, unack);
       }
   }
 }
 
+void
+grub_net_tcp_flush_acks (void)
+{
+  grub_net_tcp_socket_t sock;
+
+  FOR_TCP_SOCKETS (sock)
+    if (sock->ack_pending >= TCP_DELAYED_ACK_SEGMENTS)
+      ack (sock);
+}
+
 grub_uint16_t
 grub_net_ip_transport_checksum (struct grub_net_buff *nb,
 				grub_uint16_t proto,
 				const grub_net_network_level_address_t *src,
 				const grub_net_network_level_address_t *dst)
 {
-  grub_uint16_t a, b = 0;
-  grub_uint32_t c;
-  a = ~grub_be_to_cpu16 (grub_net_ip_chksum ((void *) nb->data,
-					     nb->tail - nb->data));
+  grub_uint32_t sum;
+
+  sum = grub_net_ip_chksum_add (0, nb->data, nb->tail - nb->data);
 
   switch (dst->type)
     {
@@ -436,7 +585,7 @@ grub_net_ip_transport_checksum (struct grub_net_buff *nb,
 	ph.zero = 0;
 	ph.tcp_length = grub_cpu_to_be16 (nb->tail - nb->data);
 	ph.proto = proto;
-	b = ~grub_be_to_cpu16 (grub_net_ip_chksum ((void *) &ph, sizeof (ph)));
+	sum = grub_net_ip_chksum_add (sum, &ph, sizeof (ph));
 	break;
       }
     case GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV6:
@@ -447,20 +596,17 @@ grub_net_ip_transport_checksum (struct grub_net_buff *nb,
 	grub_memset (ph.zero, 0, sizeof (ph.zero));
 	ph.tcp_length = grub_cpu_to_be32 (nb->tail - nb->data);
 	ph.proto = proto;
-	b = ~grub_be_to_cpu16 (grub_net_ip_chksum ((void *) &ph, sizeof (ph)));
+	sum = grub_net_ip_chksum_add (sum, &ph, sizeof (ph));
 	break;
       }
     case GRUB_NET_NETWORK_LEVEL_PROTOCOL_DHCP_RECV:
-      b = 0;
       break;
     }
-  c = (grub_uint32_t) a + (grub_uint32_t) b;
-  if (c >= 0xffff)
-    c -= 0xffff;
-  return grub_cpu_to_be16 (~c);
+  return grub_net_ip_chksum_finish (sum);
 }
 
-/* FIXME: overflow. */
+/* The queued segments all lie within the receive window, so comparing
+   their sequence numbers modulo 2^32 orders them.  */
 static int
 cmp (const void *a__, const void *b__)
 {
@@ -469,9 +615,9 @@ cmp (const void *a__, const void *b__)
   struct tcphdr *a = (struct tcphdr *) a_->data;
   struct tcphdr *b = (struct tcphdr *) b_->data;
   /* We want the first elements to be on top.  */
-  if (grub_be_to_cpu32 (a->seqnr) < grub_be_to_cpu32 (b->seqnr))
+  if (tcp_seq_lt (grub_be_to_cpu32 (a->seqnr), grub_be_to_cpu32 (b->seqnr)))
     return +1;
-  if (grub_be_to_cpu32 (a->seqnr) > grub_be_to_cpu32 (b->seqnr))
+  if (tcp_seq_lt (grub_be_to_cpu32 (b->seqnr), grub_be_to_cpu32 (a->seqnr)))
     return -1;
   return 0;
 }
@@ -519,7 +665,7 @@ grub_net_tcp_accept (grub_net_tcp_socket_t sock,
   if (err)
     return err;
 
-  nb_ack = grub_netbuff_alloc (sizeof (*tcph)
+  nb_ack = grub_netbuff_alloc (sizeof (*tcph) + TCP_WINDOW_SCALE_OPT_SIZE
 			       + GRUB_NET_OUR_MAX_IP_HEADER_SIZE
 			       + GRUB_NET_MAX_LINK_HEADER_SIZE);
   if (!nb_ack)
@@ -541,7 +687,18 @@ grub_net_tcp_accept (grub_net_tcp_socket_t sock,
   tcph = (void *) nb_ack->data;
   tcph->ack = grub_cpu_to_be32 (sock->their_cur_seq);
   tcph->flags = grub_cpu_to_be16_compile_time ((5 << 12) | TCP_SYN | TCP_ACK);
-  tcph->window = grub_cpu_to_be16 (sock->my_window);
+  if (sock->window_scaling)
+    {
+      err = tcp_put_window_scale (nb_ack, sock);
+      if (err)
+	{
+	  grub_netbuff_free (nb_ack);
+	  return err;
+	}
+      tcph->flags = grub_cpu_to_be16_compile_time ((6 << 12) | TCP_SYN
+						   | TCP_ACK);
+    }
+  tcph->window = grub_cpu_to_be16 (grub_min (sock->my_window, 0xffff));
   tcph->urgent = 0;
   sock->established = 1;
   tcp_socket_register (sock);
@@ -609,7 +766,7 @@ grub_net_tcp_open (char *server,
   socket->fin_hook = fin_hook;
   socket->hook_data = hook_data;
 
-  nb = grub_netbuff_alloc (sizeof (*tcph) + 128);
+  nb = grub_netbuff_alloc (sizeof (*tcph) + TCP_WINDOW_SCALE_OPT_SIZE + 128);
   if (!nb)
     {
       grub_free (socket);
@@ -625,6 +782,14 @@ grub_net_tcp_open (char *server,
     }
 
   err = grub_netbuff_put (nb, sizeof (*tcph));
+  if (err)
+    {
+      grub_free (socket);
+      grub_netbuff_free (nb);
+      return NULL;
+    }
+  tcp_window_init (socket);
+  err = tcp_put_window_scale (nb, socket);
   if (err)
     {
       grub_free (socket);
@@ -642,11 +807,10 @@ grub_net_tcp_open (char *server,
   tcph = (void *) nb->data;
   socket->my_start_seq = grub_get_time_ms ();
   socket->my_cur_seq = socket->my_start_seq + 1;
-  socket->my_window = 8192;
   tcph->seqnr = grub_cpu_to_be32 (socket->my_start_seq);
   tcph->ack = grub_cpu_to_be32_compile_time (0);
-  tcph->flags = grub_cpu_to_be16_compile_time ((5 << 12) | TCP_SYN);
-  tcph->window = grub_cpu_to_be16 (socket->my_window);
+  tcph->flags = grub_cpu_to_be16_compile_time ((6 << 12) | TCP_SYN);
+  tcph->window = grub_cpu_to_be16 (grub_min (socket->my_window, 0xffff));
   tcph->urgent = 0;
   tcph->src = grub_cpu_to_be16 (socket->in_port);
   tcph->dst = grub_cpu_to_be16 (socket->out_port);
@@ -732,8 +896,7 @@ grub_net_send_tcp_packet (const grub_net_tcp_socket_t socket,
       tcph = (struct tcphdr *) nb2->data;
       tcph->ack = grub_cpu_to_be32 (socket->their_cur_seq);
       tcph->flags = grub_cpu_to_be16_compile_time ((5 << 12) | TCP_ACK);
-      tcph->window = !socket->i_stall ? grub_cpu_to_be16 (socket->my_window)
-	: 0;
+      tcph->window = tcp_window (socket);
       tcph->urgent = 0;
       err = grub_netbuff_put (nb2, fraglen);
       if (err)
@@ -756,7 +919,7 @@ grub_net_send_tcp_packet (const grub_net_tcp_socket_t socket,
   tcph->ack = grub_cpu_to_be32 (socket->their_cur_seq);
   tcph->flags = (grub_cpu_to_be16_compile_time ((5 << 12) | TCP_ACK)
 		 | (push ? grub_cpu_to_be16_compile_time (TCP_PUSH) : 0));
-  tcph->window = !socket->i_stall ? grub_cpu_to_be16 (socket->my_window) : 0;
+  tcph->window = tcp_window (socket);
   tcph->urgent = 0;
   return tcp_send (nb, socket);
 }
@@ -828,6 +991,10 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
 	sock->their_start_seq = grub_be_to_cpu32 (tcph->seqnr);
 	sock->their_cur_seq = sock->their_start_seq + 1;
 	sock->established = 1;
+	/* Our SYN offered the option, the peer takes it by sending its own.  */
+	sock->window_scaling = tcp_has_window_scale (tcph);
+	if (!sock->window_scaling)
+	  tcp_window_unscaled (sock);
       }
 
     if (grub_be_to_cpu16 (tcph->flags) & TCP_RST)
@@ -858,7 +1025,7 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
 	    if (grub_be_to_cpu16 (unack_tcph->flags) & TCP_FIN)
 	      seqnr++;
 
-	    if (seqnr > acked)
+	    if (tcp_seq_lt (acked, seqnr))
 	      break;
 	    grub_netbuff_free (unack->nb);
 	    grub_free (unack);
@@ -866,14 +1033,44 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
 	sock->unack_first = unack;
 	if (!sock->unack_first)
 	  sock->unack_last = NULL;
+
+	/*
+	 * An ACK without data that repeats the last one and its window says
+	 * the peer got a segment after a lost one: resend the first segment
+	 * rather than wait for the timer.
+	 */
+	if (acked != sock->their_last_ack || tcph->window != sock->their_last_window
+	    || !sock->unack_first
+	    || (grub_be_to_cpu16 (tcph->flags) & (TCP_SYN | TCP_FIN))
+	    || (nb->tail - nb->data
+		> (grub_be_to_cpu16 (tcph->flags) >> 12) * 4))
+	  {
+	    sock->their_last_ack = acked;
+	    sock->their_last_window = tcph->window;
+	    sock->dup_acks = 0;
+	  }
+	else if (++sock->dup_acks == TCP_FAST_RETRANSMIT_DUP_ACKS)
+	  {
+	    grub_dprintf ("net", "TCP fast retransmit of %u\n", acked);
+	    sock->unack_first->last_try = grub_get_time_ms ();
+	    tcp_resend (sock, sock->unack_first);
+	  }
       }
 
-    if (grub_be_to_cpu32 (tcph->seqnr) < sock->their_cur_seq)
+    if (tcp_seq_lt (grub_be_to_cpu32 (tcph->seqnr), sock->their_cur_seq))
       {
 	ack (sock);
 	grub_netbuff_free (nb);
 	return GRUB_ERR_NONE;
       }
+    /* Do not queue more than the window: the peer sends it again.  */
+    if (grub_be_to_cpu32 (tcph->seqnr) - sock->their_cur_seq >= sock->my_window)
+      {
+	grub_dprintf ("net", "TCP segment beyond the window dropped\n");
+	ack (sock);
+	grub_netbuff_free (nb);
+	return GRUB_ERR_NONE;
+      }
     if (sock->i_reseted && (nb->tail - nb->data
 			    - (grub_be_to_cpu16 (tcph->flags)
 			       >> 12) * sizeof (grub_uint32_t)) > 0)
@@ -891,6 +1088,7 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
     {
       struct grub_net_buff **nb_top_p, *nb_top;
       int do_ack = 0;
+      int data_segs = 0;
       int just_closed = 0;
       while (1)
 	{
@@ -899,7 +1097,7 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
 	    return GRUB_ERR_NONE;
 	  nb_top = *nb_top_p;
 	  tcph = (struct tcphdr *) nb_top->data;
-	  if (grub_be_to_cpu32 (tcph->seqnr) >= sock->their_cur_seq)
+	  if (!tcp_seq_lt (grub_be_to_cpu32 (tcph->seqnr), sock->their_cur_seq))
 	    break;
 	  grub_netbuff_free (nb_top);
 	  grub_priority_queue_pop (sock->pq);
@@ -941,13 +1139,20 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
 	  if ((nb_top->tail - nb_top->data) > 0)
 	    {
 	      grub_net_put_packet (&sock->packs, nb_top);
-	      do_ack = 1;
+	      data_segs++;
 	    }
 	  else
 	    grub_netbuff_free (nb_top);
 	}
+      /* A FIN is acked at once, data maybe with the next segments.  */
       if (do_ack)
 	ack (sock);
+      else if (data_segs)
+	{
+	  if (!sock->ack_pending)
+	    sock->ack_due = grub_get_time_ms () + TCP_DELAYED_ACK_TIMEOUT;
+	  sock->ack_pending += data_segs;
+	}
       while (sock->packs.first)
 	{
 	  nb = sock->packs.first->nb;
@@ -984,7 +1189,10 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
 	sock->their_start_seq = grub_be_to_cpu32 (tcph->seqnr);
 	sock->their_cur_seq = sock->their_start_seq + 1;
 	sock->my_cur_seq = sock->my_start_seq = grub_get_time_ms ();
-	sock->my_window = 8192;
+	tcp_window_init (sock);
+	sock->window_scaling = tcp_has_window_scale (tcph);
+	if (!sock->window_scaling)
+	  tcp_window_unscaled (sock);
 
 	sock->pq = grub_priority_queue_new (sizeof (struct grub_net_buff *),
 					    cmp);
@@ -1006,6 +1214,23 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
   return GRUB_ERR_NONE;
 }
 
+void
+grub_net_tcp_set_hooks (grub_net_tcp_socket_t sock,
+			grub_err_t (*recv_hook) (grub_net_tcp_socket_t sock,
+						 struct grub_net_buff *nb,
+						 void *data),
+			void (*error_hook) (grub_net_tcp_socket_t sock,
+					    void *data),
+			void (*fin_hook) (grub_net_tcp_socket_t sock,
+					  void *data),
+			void *hook_data)
+{
+  sock->recv_hook = recv_hook;
+  sock->error_hook = error_hook;
+  sock->fin_hook = fin_hook;
+  sock->hook_data = hook_data;
+}
+
 void
 grub_net_tcp_stall (grub_net_tcp_socket_t sock)
 {
@@ -25,6 +25,7 @@
 #include <grub/mm.h>
 #include <grub/dl.h>
 #include <grub/file.h>
+#include <grub/env.h>
 #include <grub/i18n.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
@@ -43,6 +44,11 @@ enum
     TFTP_DEFAULTSIZE_PACKET = 512,
   };
 
+/* The number of blocks the server may send before waiting for an ACK
+   (RFC 7440), unless tftp_windowsize says otherwise.  */
+#define TFTP_DEFAULT_WINDOWSIZE	16
+#define TFTP_MAX_WINDOWSIZE	64
+
 enum
   {
     TFTP_CODE_EOF = 1,
@@ -101,6 +107,9 @@ typedef struct tftp_data
   grub_uint64_t file_size;
   grub_uint64_t block;
   grub_uint32_t block_size;
+  grub_uint32_t window_size;
+  /* The number of future blocks received since the last in order one.  */
+  grub_uint32_t gap;
   grub_uint64_t ack_sent;
   int have_oack;
   struct grub_error_saved save_err;
@@ -145,6 +154,7 @@ tftp_receive (grub_net_udp_socket_t sock __attribute__ ((unused)),
   tftp_data_t data = file->data;
   grub_err_t err;
   grub_uint8_t *ptr;
+  grub_int16_t diff;
 
   if (nb->tail - nb->data < (grub_ssize_t) sizeof (tftph->opcode))
     {
@@ -157,6 +167,7 @@ tftp_receive (grub_net_udp_socket_t sock __attribute__ ((unused)),
     {
     case TFTP_OACK:
       data->block_size = TFTP_DEFAULTSIZE_PACKET;
+      data->window_size = 1;
       data->have_oack = 1;
       for (ptr = nb->data + sizeof (tftph->opcode); ptr < nb->tail;)
 	{
@@ -166,10 +177,16 @@ tftp_receive (grub_net_udp_socket_t sock __attribute__ ((unused)),
 	  if (grub_memcmp (ptr, "blksize\0", sizeof ("blksize\0") - 1) == 0)
 	    data->block_size = grub_strtoul ((char *) ptr + sizeof ("blksize\0")
 					     - 1, 0, 0);
+	  if (grub_memcmp (ptr, "windowsize\0", sizeof ("windowsize\0") - 1) == 0)
+	    data->window_size = grub_strtoul ((char *) ptr
+					      + sizeof ("windowsize\0") - 1,
+					      0, 0);
 	  while (ptr < nb->tail && *ptr)
 	    ptr++;
 	  ptr++;
 	}
+      if (data->window_size == 0 || data->window_size > TFTP_MAX_WINDOWSIZE)
+	data->window_size = 1;
       data->block = 0;
       grub_netbuff_free (nb);
       err = ack (data, 0);
@@ -184,8 +201,6 @@ tftp_receive (grub_net_udp_socket_t sock __attribute__ ((unused)),
 	}
 
       /*
-       * Ack old/retransmitted block.
-       *
        * The block number is a 16-bit counter, thus the maximum file size that
        * could be transfered is 65535 * block size. Most TFTP hosts support to
        * roll-over the block counter to allow unlimited transfer file size.
@@ -195,23 +210,35 @@ tftp_receive (grub_net_udp_socket_t sock __attribute__ ((unused)),
        *
        * [0]: https://tools.ietf.org/html/rfc1350
        */
-      if (grub_be_to_cpu16 (tftph->u.data.block) < ((grub_uint16_t) (data->block + 1)))
-	ack (data, grub_be_to_cpu16 (tftph->u.data.block));
-      /* Ignore unexpected block. */
-      else if (grub_be_to_cpu16 (tftph->u.data.block) > ((grub_uint16_t) (data->block + 1)))
-	grub_dprintf ("tftp", "TFTP unexpected block # %d\n", tftph->u.data.block);
+      diff = (grub_int16_t) (grub_be_to_cpu16 (tftph->u.data.block)
+			     - (grub_uint16_t) (data->block + 1));
+
+      /*
+       * A block received again means that the server did not get the ACK
+       * of its window.  Ack once per window, on the last block received.
+       */
+      if (diff < 0)
+	{
+	  if (diff == -1)
+	    ack (data, data->block);
+	}
+      /*
+       * A block was lost.  Ack the last one received in order, which makes
+       * the server send the window again from there (RFC 7440), once for
+       * every window of blocks it keeps sending.
+       */
+      else if (diff > 0)
+	{
+	  grub_dprintf ("tftp", "TFTP unexpected block # %d\n",
+			grub_be_to_cpu16 (tftph->u.data.block));
+	  if (data->gap++ % data->window_size == 0)
+	    ack (data, data->block);
+	}
       else
 	{
 	  unsigned size;
 
-	  if (file->device->net->packs.count < 50)
-	    {
-	      err = ack (data, data->block + 1);
-	      if (err)
-		return err;
-	    }
-	  else
-	    file->device->net->stall = 1;
+	  data->gap = 0;
 
 	  err = grub_netbuff_pull (nb, sizeof (tftph->opcode) +
 				   sizeof (tftph->u.data.block));
@@ -220,6 +247,18 @@ tftp_receive (grub_net_udp_socket_t sock __attribute__ ((unused)),
 	  size = nb->tail - nb->data;
 
 	  data->block++;
+	  /* Ack each whole window, unless the consumer lags behind.  */
+	  if (data->block - data->ack_sent >= data->window_size)
+	    {
+	      if (file->device->net->packs.count < 50)
+		{
+		  err = ack (data, data->block);
+		  if (err)
+		    return err;
+		}
+	      else
+		file->device->net->stall = 1;
+	    }
 	  if (size < data->block_size)
 	    {
 	      if (data->ack_sent < data->block)
@@ -296,10 +335,14 @@ tftp_open (struct grub_file *file, const char *filename)
   grub_uint8_t *nbd;
   grub_net_network_level_address_t addr;
   int port = file->device->net->port;
+  unsigned long windowsize;
+  const char *val;
 
   data = grub_zalloc (sizeof (*data));
   if (!data)
     return grub_errno;
+  /* A server that ignores the options sends data without an OACK.  */
+  data->window_size = 1;
 
   nb.head = open_data;
   nb.end = open_data + sizeof (open_data);
@@ -347,6 +390,26 @@ tftp_open (struct grub_file *file, const char *filename)
   grub_strcpy (rrq, "0");
   rrqlen += grub_strlen ("0") + 1;
   rrq += grub_strlen ("0") + 1;
+
+  windowsize = TFTP_DEFAULT_WINDOWSIZE;
+  val = grub_env_get ("tftp_windowsize");
+  if (val)
+    {
+      windowsize = grub_strtoul (val, 0, 0);
+      grub_errno = GRUB_ERR_NONE;
+      if (windowsize > TFTP_MAX_WINDOWSIZE)
+	windowsize = TFTP_MAX_WINDOWSIZE;
+    }
+  if (windowsize > 1)
+    {
+      grub_strcpy (rrq, "windowsize");
+      rrqlen += grub_strlen ("windowsize") + 1;
+      rrq += grub_strlen ("windowsize") + 1;
+
+      grub_snprintf (rrq, sizeof ("64"), "%lu", windowsize);
+      rrqlen += grub_strlen (rrq) + 1;
+      rrq += grub_strlen (rrq) + 1;
+    }
   hdrlen = sizeof (tftph->opcode) + rrqlen;
 
   err = grub_netbuff_unput (&nb, nb.tail - (nb.data + hdrlen));
@@ -106,6 +106,12 @@ grub_net_udp_open (grub_net_network_level_address_t addr,
   return socket;
 }
 
+void
+grub_net_udp_set_in_port (grub_net_udp_socket_t sock, grub_uint16_t port)
+{
+  sock->in_port = port;
+}
+
 grub_err_t
 grub_net_send_udp_packet (const grub_net_udp_socket_t socket,
 			  struct grub_net_buff *nb)
@@ -138,7 +144,8 @@ grub_net_send_udp_packet (const grub_net_udp_socket_t socket,
 grub_err_t
 grub_net_recv_udp_packet (struct grub_net_buff *nb,
 			  struct grub_net_network_level_interface *inf,
-			  const grub_net_network_level_address_t *source)
+			  const grub_net_network_level_address_t *source,
+			  const grub_net_network_level_address_t *dest)
 {
   struct udphdr *udph;
   grub_net_udp_socket_t sock;
@@ -174,8 +181,7 @@ grub_net_recv_udp_packet (struct grub_net_buff *nb,
 	    chk = udph->chksum;
 	    udph->chksum = 0;
 	    expected = grub_net_ip_transport_checksum (nb, GRUB_NET_IP_UDP,
-						       &sock->out_nla,
-						       &sock->inf->address);
+						       &sock->out_nla, dest);
 	    if (expected != chk)
 	      {
 		grub_dprintf ("net", "Invalid UDP checksum. "
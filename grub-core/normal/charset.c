@@ -857,6 +857,25 @@ grub_bidi_line_logical_to_visual (const grub_uint32_t *logical,
   if (!visual)
     return -1;
 
+  /* Printable ASCII, as most titles and messages are, has no combining,
+     joining or right-to-left characters, so every character is a glyph
+     of its own at level 0.  */
+  for (i = 0; i < logical_len; i++)
+    if (logical[i] < 0x20 || logical[i] > 0x7e)
+      break;
+  if (i == logical_len)
+    {
+      for (i = 0; i < logical_len; i++)
+	{
+	  visual[i].base = logical[i];
+	  visual[i].estimated_width = 1;
+	  visual[i].orig_pos = i;
+	  visual[i].bidi_type = GRUB_BIDI_TYPE_L;
+	}
+      visual_len = logical_len;
+      goto wrap;
+    }
+
   for (i = 0; i < logical_len; i++)
     {
       type = get_bidi_type (logical[i]);
@@ -1145,6 +1164,7 @@ grub_bidi_line_logical_to_visual (const grub_uint32_t *logical,
 	visual[i].bidi_level = 0;
     }
 
+ wrap:
   {
     grub_ssize_t ret;
     ret = bidi_line_wrap (visual_out, visual, visual_len,
@@ -1165,6 +1185,63 @@ is_visible (const struct grub_unicode_glyph *gl)
   return 1;
 }
 
+/* Results of grub_bidi_logical_to_visual for recent strings, as the menu
+   draws the same titles and messages over and over.  Only results without
+   positions asked for and whose glyphs keep their combining characters
+   inline are cached, so that a copy of the glyphs is a deep copy.  */
+#define BIDI_CACHE_SIZE		16
+#define BIDI_CACHE_MAX_LEN	256
+
+/* The wrapping depends on the widths of the characters, which change with
+   the font of the terminal.  */
+#ifdef GRUB_UTIL
+#define BIDI_CACHE_GENERATION	0
+#else
+#define BIDI_CACHE_GENERATION	grub_term_font_generation
+#endif
+
+struct bidi_cache_entry
+{
+  grub_uint32_t hash;
+  grub_size_t logical_len;
+  grub_uint32_t *logical;
+  grub_size_t (*getcharwidth) (const struct grub_unicode_glyph *visual,
+			       void *getcharwidth_arg);
+  void *getcharwidth_arg;
+  grub_size_t max_length;
+  grub_size_t startwidth;
+  grub_uint32_t contchar;
+  int primitive_wrap;
+  unsigned long font_generation;
+  struct grub_unicode_glyph *visual;
+  grub_ssize_t visual_len;
+  grub_uint64_t last_use;
+};
+
+static struct bidi_cache_entry bidi_cache[BIDI_CACHE_SIZE];
+static grub_uint64_t bidi_cache_clock;
+
+static grub_uint32_t
+bidi_cache_hash (const grub_uint32_t *logical, grub_size_t logical_len)
+{
+  grub_uint32_t hash = 2166136261U;
+  grub_size_t i;
+
+  for (i = 0; i < logical_len; i++)
+    hash = (hash ^ logical[i]) * 16777619U;
+  return hash;
+}
+
+static grub_ssize_t
+grub_bidi_logical_to_visual_real (const grub_uint32_t *logical,
+				  grub_size_t logical_len,
+				  struct grub_unicode_glyph **visual_out,
+				  grub_size_t (*getcharwidth) (const struct grub_unicode_glyph *visual, void *getcharwidth_arg),
+				  void *getcharwidth_arg,
+				  grub_size_t max_length, grub_size_t startwidth,
+				  grub_uint32_t contchar, struct grub_term_pos *pos,
+				  int primitive_wrap);
+
 grub_ssize_t
 grub_bidi_logical_to_visual (const grub_uint32_t *logical,
 			     grub_size_t logical_len,
@@ -1173,6 +1250,95 @@ grub_bidi_logical_to_visual (const grub_uint32_t *logical,
 			     void *getcharwidth_arg,
 			     grub_size_t max_length, grub_size_t startwidth,
 			     grub_uint32_t contchar, struct grub_term_pos *pos, int primitive_wrap)
+{
+  struct bidi_cache_entry *c, *victim = &bidi_cache[0];
+  grub_uint32_t hash;
+  grub_ssize_t ret, i;
+
+  if (pos || logical_len > BIDI_CACHE_MAX_LEN)
+    return grub_bidi_logical_to_visual_real (logical, logical_len, visual_out,
+					     getcharwidth, getcharwidth_arg,
+					     max_length, startwidth, contchar,
+					     pos, primitive_wrap);
+
+  hash = bidi_cache_hash (logical, logical_len);
+  for (c = bidi_cache; c < bidi_cache + BIDI_CACHE_SIZE; c++)
+    {
+      if (c->visual && c->hash == hash && c->logical_len == logical_len
+	  && c->getcharwidth == getcharwidth
+	  && c->getcharwidth_arg == getcharwidth_arg
+	  && c->max_length == max_length && c->startwidth == startwidth
+	  && c->contchar == contchar && c->primitive_wrap == primitive_wrap
+	  && c->font_generation == BIDI_CACHE_GENERATION
+	  && grub_memcmp (c->logical, logical,
+			  logical_len * sizeof (logical[0])) == 0)
+	{
+	  /* Callers free what they get, and the allocation is as large as
+	     the uncached one for their sake.  */
+	  *visual_out = grub_calloc (logical_len + 2,
+				     3 * sizeof ((*visual_out)[0]));
+	  if (!*visual_out)
+	    return -1;
+	  grub_memcpy (*visual_out, c->visual,
+		       c->visual_len * sizeof (c->visual[0]));
+	  c->last_use = ++bidi_cache_clock;
+	  return c->visual_len;
+	}
+      if (c->last_use < victim->last_use)
+	victim = c;
+    }
+
+  ret = grub_bidi_logical_to_visual_real (logical, logical_len, visual_out,
+					  getcharwidth, getcharwidth_arg,
+					  max_length, startwidth, contchar,
+					  pos, primitive_wrap);
+  if (ret < 0)
+    return ret;
+
+  for (i = 0; i < ret; i++)
+    if ((*visual_out)[i].ncomb > (int) ARRAY_SIZE ((*visual_out)[i].combining_inline))
+      return ret;
+
+  grub_free (victim->logical);
+  grub_free (victim->visual);
+  victim->visual = NULL;
+  victim->last_use = 0;
+  victim->logical = grub_malloc (logical_len * sizeof (logical[0]) + 1);
+  victim->visual = grub_malloc (ret * sizeof (victim->visual[0]) + 1);
+  if (!victim->logical || !victim->visual)
+    {
+      grub_free (victim->logical);
+      grub_free (victim->visual);
+      victim->logical = NULL;
+      victim->visual = NULL;
+      grub_errno = GRUB_ERR_NONE;
+      return ret;
+    }
+  grub_memcpy (victim->logical, logical, logical_len * sizeof (logical[0]));
+  grub_memcpy (victim->visual, *visual_out, ret * sizeof (victim->visual[0]));
+  victim->hash = hash;
+  victim->logical_len = logical_len;
+  victim->getcharwidth = getcharwidth;
+  victim->getcharwidth_arg = getcharwidth_arg;
+  victim->max_length = max_length;
+  victim->startwidth = startwidth;
+  victim->contchar = contchar;
+  victim->primitive_wrap = primitive_wrap;
+  victim->font_generation = BIDI_CACHE_GENERATION;
+  victim->visual_len = ret;
+  victim->last_use = ++bidi_cache_clock;
+  return ret;
+}
+
+static grub_ssize_t
+grub_bidi_logical_to_visual_real (const grub_uint32_t *logical,
+				  grub_size_t logical_len,
+				  struct grub_unicode_glyph **visual_out,
+				  grub_size_t (*getcharwidth) (const struct grub_unicode_glyph *visual, void *getcharwidth_arg),
+				  void *getcharwidth_arg,
+				  grub_size_t max_length, grub_size_t startwidth,
+				  grub_uint32_t contchar, struct grub_term_pos *pos,
+				  int primitive_wrap)
 {
   const grub_uint32_t *line_start = logical, *ptr;
   struct grub_unicode_glyph *visual_ptr;
@@ -27,6 +27,8 @@
 #include <grub/parser.h>
 #include <grub/extcmd.h>
 #include <grub/charset.h>
+#include <grub/env.h>
+#include <grub/time.h>
 
 /* The current word.  */
 static const char *current_word;
@@ -98,100 +100,234 @@ add_completion (const char *completion, const char *extra,
   return 0;
 }
 
-static int
-iterate_partition (grub_disk_t disk, const grub_partition_t p,
-		   void *data __attribute__ ((unused)))
+/* The candidates read from disk are kept for a few seconds, so that pressing
+   TAB again, to list them or after typing a few more characters, doesn't
+   open every disk or list the directory again.  A list is keyed by "" for
+   the disks, "DISK," for the partitions of DISK and "(DEVICE)DIR/" for the
+   files in a directory, the names of the subdirectories ending with '/'.  */
+#define COMPLETION_CACHE_SIZE		8
+#define COMPLETION_CACHE_TIMEOUT	10000
+
+struct completion_list
 {
-  const char *disk_name = disk->name;
-  char *name;
-  int ret;
-  char *part_name;
+  char *key;
+  grub_uint64_t time;
+  unsigned long generation;
+  char **names;
+  grub_size_t count;
+  grub_size_t alloc;
+};
+
+static struct completion_list *completion_cache[COMPLETION_CACHE_SIZE];
+
+static void
+completion_list_free (struct completion_list *list)
+{
+  grub_size_t i;
+
+  if (! list)
+    return;
+  for (i = 0; i < list->count; i++)
+    grub_free (list->names[i]);
+  grub_free (list->names);
+  grub_free (list->key);
+  grub_free (list);
+}
 
-  part_name = grub_partition_get_name (p);
-  if (! part_name)
-    return 1;
+/* Return a new, empty, list with KEY, which it takes over.  */
+static struct completion_list *
+completion_list_new (char *key)
+{
+  struct completion_list *list;
 
-  name = grub_xasprintf ("%s,%s", disk_name, part_name);
-  grub_free (part_name);
+  list = grub_zalloc (sizeof (*list));
+  if (! list)
+    {
+      grub_free (key);
+      return 0;
+    }
+  list->key = key;
+  return list;
+}
 
+static int
+completion_list_add (struct completion_list *list, char *name)
+{
   if (! name)
     return 1;
 
-  ret = add_completion (name, ")", GRUB_COMPLETION_TYPE_PARTITION);
-  grub_free (name);
-  return ret;
+  if (list->count == list->alloc)
+    {
+      grub_size_t alloc = list->alloc ? list->alloc * 2 : 16;
+      char **names;
+
+      names = grub_realloc (list->names, alloc * sizeof (names[0]));
+      if (! names)
+	{
+	  grub_free (name);
+	  return 1;
+	}
+      list->names = names;
+      list->alloc = alloc;
+    }
+
+  list->names[list->count++] = name;
+  return 0;
 }
 
-static int
-iterate_dir (const char *filename, const struct grub_dirhook_info *info,
-	     void *data __attribute__ ((unused)))
+static struct completion_list *
+completion_cache_find (const char *key)
 {
-  if (! info->dir)
-    {
-      const char *prefix;
-      if (cmdline_state == GRUB_PARSER_STATE_DQUOTE)
-	prefix = "\" ";
-      else if (cmdline_state == GRUB_PARSER_STATE_QUOTE)
-	prefix = "\' ";
-      else
-	prefix = " ";
+  grub_uint64_t now = grub_get_time_ms ();
+  unsigned i;
 
-      if (add_completion (filename, prefix, GRUB_COMPLETION_TYPE_FILE))
-	return 1;
-    }
-  else if (grub_strcmp (filename, ".") && grub_strcmp (filename, ".."))
+  for (i = 0; i < ARRAY_SIZE (completion_cache); i++)
     {
-      char *fname;
+      struct completion_list *list = completion_cache[i];
 
-      fname = grub_xasprintf ("%s/", filename);
-      if (add_completion (fname, "", GRUB_COMPLETION_TYPE_FILE))
+      if (! list)
+	continue;
+      /* Disks written to or whose cache was dropped may have changed.  */
+      if (now - list->time >= COMPLETION_CACHE_TIMEOUT
+	  || list->generation != grub_disk_generation)
 	{
-	  grub_free (fname);
-	  return 1;
+	  completion_list_free (list);
+	  completion_cache[i] = 0;
+	  continue;
 	}
-      grub_free (fname);
+      if (grub_strcmp (list->key, key) == 0)
+	return list;
     }
 
   return 0;
 }
 
+/* Remember LIST, replacing the oldest list if needed.  */
+static void
+completion_cache_add (struct completion_list *list)
+{
+  unsigned i, slot = 0;
+
+  list->time = grub_get_time_ms ();
+  list->generation = grub_disk_generation;
+
+  for (i = 0; i < ARRAY_SIZE (completion_cache); i++)
+    {
+      if (! completion_cache[i])
+	{
+	  slot = i;
+	  break;
+	}
+      if (completion_cache[i]->time < completion_cache[slot]->time)
+	slot = i;
+    }
+
+  completion_list_free (completion_cache[slot]);
+  completion_cache[slot] = list;
+}
+
 static int
-iterate_dev (const char *devname, void *data __attribute__ ((unused)))
+iterate_partition (grub_disk_t disk, const grub_partition_t p,
+		   void *data)
 {
+  struct completion_list *list = data;
+  char *part_name;
+  char *name;
+
+  part_name = grub_partition_get_name (p);
+  if (! part_name)
+    return 1;
+
+  name = grub_xasprintf ("%s,%s", disk->name, part_name);
+  grub_free (part_name);
+
+  return completion_list_add (list, name);
+}
+
+/* Return the partitions of DISK, NULL if DISK can't be opened.  */
+static struct completion_list *
+get_partitions (const char *disk)
+{
+  struct completion_list *list;
   grub_device_t dev;
+  char *key;
 
-  /* Complete the partition part.  */
-  dev = grub_device_open (devname);
+  key = grub_xasprintf ("%s,", disk);
+  if (! key)
+    return 0;
 
-  if (!dev)
+  list = completion_cache_find (key);
+  if (list)
+    {
+      grub_free (key);
+      return list;
+    }
+
+  dev = grub_device_open (disk);
+  if (! dev)
     {
+      grub_free (key);
       grub_errno = GRUB_ERR_NONE;
       return 0;
     }
 
-  if (grub_strcmp (devname, current_word) == 0)
+  list = completion_list_new (key);
+  if (list && dev->disk
+      && grub_partition_iterate (dev->disk, iterate_partition, list))
     {
-      if (add_completion (devname, ")", GRUB_COMPLETION_TYPE_PARTITION))
-	{
-	  grub_device_close (dev);
-	  return 1;
-	}
-
-      if (dev->disk)
-	if (grub_partition_iterate (dev->disk, iterate_partition, NULL))
-	  {
-	    grub_device_close (dev);
-	    return 1;
-	  }
+      completion_list_free (list);
+      list = 0;
     }
-  else if (add_completion (devname, "", GRUB_COMPLETION_TYPE_DEVICE))
+  grub_device_close (dev);
+  grub_errno = GRUB_ERR_NONE;
+
+  if (list)
+    completion_cache_add (list);
+  return list;
+}
+
+static int
+iterate_dir (const char *filename, const struct grub_dirhook_info *info,
+	     void *data)
+{
+  struct completion_list *list = data;
+
+  if (! info->dir)
+    return completion_list_add (list, grub_strdup (filename));
+  else if (grub_strcmp (filename, ".") && grub_strcmp (filename, ".."))
+    return completion_list_add (list, grub_xasprintf ("%s/", filename));
+
+  return 0;
+}
+
+static int
+iterate_dev (const char *devname, void *data)
+{
+  struct completion_list *list = data;
+  grub_device_t dev;
+
+  /* Only list the disks that can be opened.  */
+  dev = grub_device_open (devname);
+
+  if (!dev)
     {
-      grub_device_close (dev);
-      return 1;
+      grub_errno = GRUB_ERR_NONE;
+      return 0;
     }
 
   grub_device_close (dev);
   grub_errno = GRUB_ERR_NONE;
+  return completion_list_add (list, grub_strdup (devname));
+}
+
+static int
+add_partitions (const struct completion_list *list)
+{
+  grub_size_t i;
+
+  for (i = 0; i < list->count; i++)
+    if (add_completion (list->names[i], ")", GRUB_COMPLETION_TYPE_PARTITION))
+      return 1;
   return 0;
 }
 
@@ -201,42 +337,103 @@ complete_device (void)
 {
   /* Check if this is a device or a partition.  */
   char *p = grub_strchr (++current_word, ',');
-  grub_device_t dev;
+  struct completion_list *list;
+  grub_size_t i;
 
   if (! p)
     {
       /* Complete the disk part.  */
-      if (grub_disk_dev_iterate (iterate_dev, NULL))
-	return 1;
+      list = completion_cache_find ("");
+      if (! list)
+	{
+	  char *key = grub_strdup ("");
+
+	  list = key ? completion_list_new (key) : 0;
+	  if (! list)
+	    return 1;
+	  if (grub_disk_dev_iterate (iterate_dev, list))
+	    {
+	      completion_list_free (list);
+	      return 1;
+	    }
+	  completion_cache_add (list);
+	}
+
+      for (i = 0; i < list->count; i++)
+	{
+	  const char *devname = list->names[i];
+
+	  if (grub_strcmp (devname, current_word) == 0)
+	    {
+	      struct completion_list *parts;
+
+	      if (add_completion (devname, ")", GRUB_COMPLETION_TYPE_PARTITION))
+		return 1;
+
+	      parts = get_partitions (devname);
+	      if (parts && add_partitions (parts))
+		return 1;
+	    }
+	  else if (add_completion (devname, "", GRUB_COMPLETION_TYPE_DEVICE))
+	    return 1;
+	}
     }
   else
     {
       /* Complete the partition part.  */
       *p = '\0';
-      dev = grub_device_open (current_word);
+      list = get_partitions (current_word);
       *p = ',';
-      grub_errno = GRUB_ERR_NONE;
 
-      if (dev)
-	{
-	  if (dev->disk)
-	    {
-	      if (grub_partition_iterate (dev->disk, iterate_partition, NULL))
-		{
-		  grub_device_close (dev);
-		  return 1;
-		}
-	    }
-
-	  grub_device_close (dev);
-	}
-      else
+      if (! list || add_partitions (list))
 	return 1;
     }
 
   return 0;
 }
 
+/* Return the files in DIR of DEVICE, with KEY, which it takes over.  */
+static struct completion_list *
+get_files (const char *device, const char *dir, char *key)
+{
+  struct completion_list *list;
+  grub_device_t dev;
+  grub_fs_t fs;
+
+  list = completion_cache_find (key);
+  if (list)
+    {
+      grub_free (key);
+      return list;
+    }
+
+  list = completion_list_new (key);
+  if (! list)
+    return 0;
+
+  dev = grub_device_open (device);
+  if (! dev)
+    goto fail;
+
+  fs = grub_fs_probe (dev);
+  if (! fs)
+    goto fail;
+
+  (fs->fs_dir) (dev, dir, iterate_dir, list);
+  if (grub_errno)
+    goto fail;
+
+  grub_device_close (dev);
+  completion_cache_add (list);
+  return list;
+
+ fail:
+  if (dev)
+    grub_device_close (dev);
+  completion_list_free (list);
+  return 0;
+}
+
 /* Complete a file.  */
 static int
 complete_file (void)
@@ -245,33 +442,23 @@ complete_file (void)
   char *dir;
   char *last_dir;
   grub_fs_t fs;
-  grub_device_t dev;
+  grub_device_t dev = 0;
   int ret = 0;
 
   device = grub_file_get_device_name (current_word);
   if (grub_errno != GRUB_ERR_NONE)
     return 1;
 
-  dev = grub_device_open (device);
-  if (! dev)
-    {
-      ret = 1;
-      goto fail;
-    }
-
-  fs = grub_fs_probe (dev);
-  if (! fs)
-    {
-      ret = 1;
-      goto fail;
-    }
-
   dir = grub_strchr (current_word + (device ? 2 + grub_strlen (device) : 0),
 		     '/');
   last_dir = grub_strrchr (current_word, '/');
   if (dir)
     {
+      struct completion_list *list;
+      const char *prefix;
       char *dirfile;
+      char *key;
+      grub_size_t i;
 
       current_word = last_dir + 1;
 
@@ -287,19 +474,52 @@ complete_file (void)
       if (dirfile)
 	dirfile[1] = '\0';
 
-      /* Iterate the directory.  */
-      (fs->fs_dir) (dev, dir, iterate_dir, NULL);
-
+      key = grub_xasprintf ("(%s)%s", device ? : grub_env_get ("root") ? : "",
+			    dir);
+      list = key ? get_files (device, dir, key) : 0;
       grub_free (dir);
-
-      if (grub_errno)
+      if (! list)
 	{
 	  ret = 1;
 	  goto fail;
 	}
+
+      if (cmdline_state == GRUB_PARSER_STATE_DQUOTE)
+	prefix = "\" ";
+      else if (cmdline_state == GRUB_PARSER_STATE_QUOTE)
+	prefix = "\' ";
+      else
+	prefix = " ";
+
+      for (i = 0; i < list->count; i++)
+	{
+	  const char *name = list->names[i];
+	  int isdir = name[0] && name[grub_strlen (name) - 1] == '/';
+
+	  if (add_completion (name, isdir ? "" : prefix,
+			      GRUB_COMPLETION_TYPE_FILE))
+	    {
+	      ret = 1;
+	      goto fail;
+	    }
+	}
     }
   else
     {
+      dev = grub_device_open (device);
+      if (! dev)
+	{
+	  ret = 1;
+	  goto fail;
+	}
+
+      fs = grub_fs_probe (dev);
+      if (! fs)
+	{
+	  ret = 1;
+	  goto fail;
+	}
+
       current_word += grub_strlen (current_word);
       match = grub_strdup ("/");
       if (! match)
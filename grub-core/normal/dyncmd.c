@@ -27,6 +27,37 @@
 #include <grub/script_sh.h>
 #include <grub/i18n.h>
 
+/*
+ * Remove the stub SELF, whose module is loaded now and has registered its
+ * commands, along with the stubs of the other commands of the module, so
+ * that one load serves all of them.  The name of SELF is left to the
+ * caller.
+ */
+static void
+unregister_module_stubs (grub_extcmd_t self)
+{
+  grub_command_t cmd, next;
+
+  FOR_COMMANDS_SAFE (cmd, next)
+    {
+      grub_extcmd_t extcmd;
+
+      if (!(cmd->flags & GRUB_COMMAND_FLAG_DYNCMD))
+	continue;
+
+      extcmd = cmd->data;
+      if (extcmd == self || grub_strcmp (extcmd->data, self->data) != 0)
+	continue;
+
+      grub_free ((char *) cmd->name);
+      grub_free (extcmd->data);
+      grub_unregister_extcmd (extcmd);
+    }
+
+  grub_free (self->data);
+  grub_unregister_extcmd (self);
+}
+
 grub_command_t
 grub_dyncmd_get_cmd (grub_command_t cmd)
 {
@@ -40,11 +71,10 @@ grub_dyncmd_get_cmd (grub_command_t cmd)
   if (!mod)
     return NULL;
 
-  grub_free (modname);
   grub_dl_ref (mod);
 
   name = (char *) cmd->name;
-  grub_unregister_extcmd (extcmd);
+  unregister_module_stubs (extcmd);
 
   cmd = grub_command_find (name);
 
@@ -69,11 +99,10 @@ grub_dyncmd_dispatcher (struct grub_extcmd_context *ctxt,
   if (!mod)
     return grub_errno;
 
-  grub_free (modname);
   grub_dl_ref (mod);
 
   name = (char *) cmd->name;
-  grub_unregister_extcmd (extcmd);
+  unregister_module_stubs (extcmd);
 
   cmd = grub_command_find (name);
   if (cmd)
@@ -110,7 +139,7 @@ read_command_list (const char *prefix)
 	  if (file)
 	    {
 	      char *buf = NULL;
-	      grub_command_t ptr, last = 0, next;
+	      grub_command_t ptr, next;
 
 	      /* Override previous commands.lst.  */
 	      for (ptr = grub_command_list; ptr; ptr = next)
@@ -118,15 +147,9 @@ read_command_list (const char *prefix)
 		  next = ptr->next;
 		  if (ptr->flags & GRUB_COMMAND_FLAG_DYNCMD)
 		    {
-		      if (last)
-			last->next = ptr->next;
-		      else
-			grub_command_list = ptr->next;
 		      grub_free (ptr->data); /* extcmd struct */
-		      grub_free (ptr);
+		      grub_unregister_command (ptr);
 		    }
-		  else
-		    last = ptr;
 		}
 
 	      for (;; grub_free (buf))
@@ -34,6 +34,7 @@
 #include <grub/charset.h>
 #include <grub/script_sh.h>
 #include <grub/bufio.h>
+#include <grub/trace.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -50,31 +51,14 @@ grub_normal_free_menu (grub_menu_t menu)
   while (entry)
     {
       grub_menu_entry_t next_entry = entry->next;
-      grub_size_t i;
 
-      if (entry->classes)
-	{
-	  struct grub_menu_entry_class *class;
-	  for (class = entry->classes; class; class = class->next)
-	    grub_free (class->name);
-	  grub_free (entry->classes);
-	}
-
-      if (entry->args)
-	{
-	  for (i = 0; entry->args[i]; i++)
-	    grub_free (entry->args[i]);
-	  grub_free (entry->args);
-	}
-
-      grub_free ((void *) entry->id);
-      grub_free ((void *) entry->users);
-      grub_free ((void *) entry->title);
-      grub_free ((void *) entry->sourcecode);
+      /* Everything but the class names, which are shared, was allocated
+	 along with the entry.  */
       grub_free (entry);
       entry = next_entry;
     }
 
+  grub_free (menu->entries);
   grub_free (menu);
   grub_env_unset_menu ();
 }
@@ -109,7 +93,9 @@ read_config_file (const char *config)
   grub_file_t rawfile, file;
   char *old_file = 0, *old_dir = 0;
   char *config_dir, *ptr = 0;
+  char *source = NULL;
   const char *ctmp;
+  grub_uint64_t start = grub_trace_now ();
 
   grub_menu_t newmenu;
 
@@ -165,7 +151,28 @@ read_config_file (const char *config)
   grub_env_export ("config_file");
   grub_env_export ("config_directory");
 
-  while (1)
+  /*
+   * Run the file from memory if it fits, so that the commands are parsed
+   * only the first time it is read.  Otherwise read it line by line.
+   */
+  if (file->size != GRUB_FILE_SIZE_UNKNOWN
+      && file->size < GRUB_SIZE_MAX)
+    source = grub_malloc (file->size + 1);
+  if (source)
+    {
+      if (grub_file_read (file, source, file->size) == (grub_ssize_t) file->size)
+	grub_script_execute_source (source, file->size,
+				    GRUB_SCRIPT_SOURCE_CONFIG);
+      else
+	{
+	  grub_free (source);
+	  source = NULL;
+	  grub_file_seek (file, 0);
+	}
+    }
+  grub_errno = GRUB_ERR_NONE;
+
+  while (!source)
     {
       char *line;
 
@@ -190,9 +197,12 @@ read_config_file (const char *config)
     grub_env_unset ("config_directory");
   grub_free (old_file);
   grub_free (old_dir);
+  grub_free (source);
 
   grub_file_close (file);
 
+  /* This includes running the commands of the file.  */
+  grub_trace_record (GRUB_TRACE_CONFIG, NULL, config, start, 0);
   return newmenu;
 }
 
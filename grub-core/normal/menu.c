@@ -69,17 +69,61 @@ grub_wait_after_message (void)
   endtime = grub_get_time_ms () + 10000;
 
   while (grub_get_time_ms () < endtime
-	 && grub_getkey_noblock () == GRUB_TERM_NO_KEY);
+	 && grub_getkey_noblock () == GRUB_TERM_NO_KEY)
+    grub_term_idle (GRUB_IDLE_POLL_MS);
 
   grub_xputs ("\n");
 }
 
+/* Index the entries of MENU up to NO.  Return 0 if there was no memory
+   for the index.  */
+static int
+index_entries (grub_menu_t menu, int no)
+{
+  grub_menu_entry_t e;
+
+  if (no >= menu->entries_alloc)
+    {
+      grub_menu_entry_t *entries;
+      int alloc = menu->entries_alloc ? : 16;
+
+      while (alloc <= no && alloc <= GRUB_INT_MAX / 2)
+	alloc *= 2;
+      if (alloc <= no)
+	return 0;
+
+      entries = grub_realloc (menu->entries, alloc * sizeof (*entries));
+      if (! entries)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  return 0;
+	}
+      menu->entries = entries;
+      menu->entries_alloc = alloc;
+    }
+
+  e = menu->indexed ? menu->entries[menu->indexed - 1]->next
+    : menu->entry_list;
+  for (; e && menu->indexed <= no; e = e->next)
+    menu->entries[menu->indexed++] = e;
+
+  return 1;
+}
+
 /* Get a menu entry by its index in the entry list.  */
 grub_menu_entry_t
 grub_menu_get_entry (grub_menu_t menu, int no)
 {
   grub_menu_entry_t e;
 
+  if (no <= 0)
+    return menu->entry_list;
+
+  /* Entries are only ever added at the end, so the index stays valid.  */
+  if (no < menu->indexed
+      || (no < menu->size && index_entries (menu, no) && no < menu->indexed))
+    return menu->entries[no];
+
   for (e = menu->entry_list; e && no > 0; e = e->next, no--)
     ;
 
@@ -641,6 +685,8 @@ run_menu (grub_menu_t menu, int nested, int *auto_boot, int *notify_boot)
 	  if (timeout == 0)
 	    /* We will fall through to auto-booting the default entry.  */
 	    break;
+
+	  grub_term_idle (GRUB_IDLE_POLL_MS);
 	}
 
       grub_env_unset ("timeout");
@@ -807,6 +853,8 @@ run_menu (grub_menu_t menu, int nested, int *auto_boot, int *notify_boot)
 	      break;
 	    }
 	}
+      else
+	grub_term_idle (GRUB_IDLE_POLL_MS);
     }
 
   /* Never reach here.  */
@@ -304,6 +304,107 @@ grub_hostdisk_flush_initial_buffer (const char *os_dev)
     close (fd);
 }
 
+/* Reads bypass the page cache when GRUB_HOSTDISK_DIRECT is set, so that
+   probing huge images does not push everything else out of it.  The
+   buffers and offsets of O_DIRECT reads must be aligned, hence the bounce
+   buffer for the callers whose buffer is not.  */
+#define DIRECT_ALIGN		4096
+#define DIRECT_BUFFER_SIZE	(1024 * 1024)
+
+static int hostdisk_direct = -1;
+static char *direct_buffer;
+
+static int
+want_direct (void)
+{
+  const char *v;
+
+  if (hostdisk_direct == -1)
+    {
+      v = getenv ("GRUB_HOSTDISK_DIRECT");
+      hostdisk_direct = (v && v[0] == 'y' && v[1] == '\0');
+    }
+  return hostdisk_direct;
+}
+
+/* Drop O_DIRECT from the open device, and stop asking for it, for the
+   files and devices whose alignment requirements the reads do not meet.  */
+static int
+leave_direct (struct grub_util_hostdisk_data *data)
+{
+  int fl;
+
+  grub_util_info ("direct reads of `%s' failed, using the page cache",
+		  data->dev);
+  data->direct = 0;
+  hostdisk_direct = 0;
+  fl = fcntl (data->fd, F_GETFL);
+  if (fl == -1)
+    return -1;
+  return fcntl (data->fd, F_SETFL, fl & ~O_DIRECT);
+}
+
+ssize_t
+grub_hostdisk_linux_read_direct (struct grub_util_hostdisk_data *data,
+				 char *buf, size_t len)
+{
+  off_t start;
+  size_t done = 0;
+
+  start = lseek (data->fd, 0, SEEK_CUR);
+  if (start == (off_t) -1)
+    return -1;
+
+  if (((grub_addr_t) buf & (DIRECT_ALIGN - 1)) == 0
+      && (len & (DIRECT_ALIGN - 1)) == 0)
+    {
+      ssize_t ret = grub_util_fd_read (data->fd, buf, len);
+      if (ret >= 0 || errno != EINVAL)
+	return ret;
+      goto fallback;
+    }
+
+  if (!direct_buffer
+      && posix_memalign ((void **) &direct_buffer, DIRECT_ALIGN,
+			 DIRECT_BUFFER_SIZE) != 0)
+    {
+      direct_buffer = NULL;
+      goto fallback;
+    }
+
+  while (done < len)
+    {
+      size_t chunk = len - done;
+      size_t aligned;
+      ssize_t ret;
+
+      if (chunk > DIRECT_BUFFER_SIZE)
+	chunk = DIRECT_BUFFER_SIZE;
+      /* The tail of the disk may be shorter than the rounded up size,
+	 which only makes the read short.  */
+      aligned = ALIGN_UP (chunk, DIRECT_ALIGN);
+      ret = pread (data->fd, direct_buffer, aligned, start + done);
+      if (ret < 0 && errno == EINTR)
+	continue;
+      if (ret < 0 && errno == EINVAL)
+	goto fallback;
+      if (ret < (ssize_t) chunk)
+	return ret < 0 ? ret : (ssize_t) (done + ret);
+      memcpy (buf + done, direct_buffer, chunk);
+      done += chunk;
+    }
+
+  if (lseek (data->fd, start + done, SEEK_SET) == (off_t) -1)
+    return -1;
+  return done;
+
+ fallback:
+  if (leave_direct (data) < 0
+      || lseek (data->fd, start, SEEK_SET) == (off_t) -1)
+    return -1;
+  return grub_util_fd_read (data->fd, buf, len);
+}
+
 int
 grub_util_fd_open_device (const grub_disk_t disk, grub_disk_addr_t sector, int flags,
 			  grub_disk_addr_t *max)
@@ -328,6 +429,8 @@ grub_util_fd_open_device (const grub_disk_t disk, grub_disk_addr_t sector, int f
 #ifdef O_CLOEXEC
   flags |= O_CLOEXEC;
 #endif
+  if ((flags & O_ACCMODE) == O_RDONLY && want_direct ())
+    flags |= O_DIRECT;
 
   /* Linux has a bug that the disk cache for a whole disk is not consistent
      with the one for a partition of the disk.  */
@@ -388,9 +491,18 @@ grub_util_fd_open_device (const grub_disk_t disk, grub_disk_addr_t sector, int f
 	data->dev = xstrdup (dev);
 	data->access_mode = (flags & O_ACCMODE);
 	data->fd = fd;
+	data->direct = !!(flags & O_DIRECT);
 
 	if (data->is_disk)
 	  ioctl (data->fd, BLKFLSBUF, 0);
+
+#ifdef HAVE_POSIX_FADVISE
+	/* The reads are scattered over the disk and large ones come as a
+	   single request already, so readahead only fills the page cache
+	   with sectors nobody reads.  */
+	if (data->access_mode == O_RDONLY)
+	  posix_fadvise (fd, 0, 0, POSIX_FADV_RANDOM);
+#endif
       }
 
     if (is_partition)
@@ -25,6 +25,8 @@
 #include <grub/msdos_partition.h>
 #include <grub/gpt_partition.h>
 #include <grub/i18n.h>
+#include <grub/safemath.h>
+#include <grub/lib/crc.h>
 #ifdef GRUB_UTIL
 #include <grub/emu/misc.h>
 #endif
@@ -49,20 +51,105 @@ static struct grub_partition_map grub_gpt_partition_map;
 
 
 
-grub_err_t
-grub_gpt_partition_map_iterate (grub_disk_t disk,
-				grub_partition_iterate_hook_t hook,
-				void *hook_data)
+/* Larger partition entry arrays are read one entry at a time.  */
+#define GPT_MAX_TABLE_SIZE	(1024 * 1024)
+
+/* The partition entry arrays of recently iterated disks, for the many
+   iterations of the same disk as its partitions are opened.  Like the
+   other data kept above the disk cache, they go when grub_disk_generation
+   changes.  */
+#define GPT_CACHE_SIZE	16
+
+struct gpt_table
+{
+  enum grub_disk_dev_id dev_id;
+  unsigned long disk_id;
+  grub_disk_addr_t part_start;
+  unsigned long generation;
+  grub_uint64_t last_use;
+
+  int sector_log;
+  grub_uint64_t entries;
+  grub_uint32_t maxpart;
+  grub_uint32_t entry_size;
+  char *data;
+};
+
+static struct gpt_table gpt_cache[GPT_CACHE_SIZE];
+static grub_uint64_t gpt_cache_clock;
+
+static void
+gpt_table_evict (struct gpt_table *t)
+{
+  grub_free (t->data);
+  t->data = NULL;
+}
+
+/* Take the table of DISK out of the cache into T, so that the hook
+   iterating other disks cannot free it.  */
+static int
+gpt_table_get (grub_disk_t disk, struct gpt_table *t)
+{
+  grub_disk_addr_t part_start = grub_partition_get_start (disk->partition);
+  unsigned i;
+
+  for (i = 0; i < GPT_CACHE_SIZE; i++)
+    if (gpt_cache[i].data
+	&& gpt_cache[i].generation == grub_disk_generation
+	&& gpt_cache[i].dev_id == disk->dev->id
+	&& gpt_cache[i].disk_id == disk->id
+	&& gpt_cache[i].part_start == part_start)
+      {
+	*t = gpt_cache[i];
+	gpt_cache[i].data = NULL;
+	return 1;
+      }
+
+  return 0;
+}
+
+/* Put T back into the cache, in place of the least recently used table.  */
+static void
+gpt_table_put (struct gpt_table *t)
+{
+  struct gpt_table *lru = NULL;
+  unsigned i;
+
+  /* The disk may have been written while the hook ran.  */
+  if (t->generation != grub_disk_generation)
+    {
+      grub_free (t->data);
+      return;
+    }
+
+  for (i = 0; i < GPT_CACHE_SIZE; i++)
+    {
+      if (gpt_cache[i].data && gpt_cache[i].generation != grub_disk_generation)
+	gpt_table_evict (&gpt_cache[i]);
+      if (! lru || (lru->data && (! gpt_cache[i].data
+				  || gpt_cache[i].last_use < lru->last_use)))
+	lru = &gpt_cache[i];
+    }
+
+  gpt_table_evict (lru);
+  *lru = *t;
+  lru->last_use = ++gpt_cache_clock;
+}
+
+/* Check the protective MBR and the header of DISK and read its partition
+   entry array into T.  */
+static grub_err_t
+gpt_table_read (grub_disk_t disk, struct gpt_table *t)
 {
-  struct grub_partition part;
   struct grub_gpt_header gpt;
-  struct grub_gpt_partentry entry;
   struct grub_msdos_partition_mbr mbr;
-  grub_uint64_t entries;
+  grub_size_t size;
+  grub_uint32_t crc;
   unsigned int i;
-  int last_offset = 0;
   int sector_log = 0;
 
+  grub_memset (t, 0, sizeof (*t));
+
   /* Read the protective MBR.  */
   if (grub_disk_read (disk, 0, 0, sizeof (mbr), &mbr))
     return grub_errno;
@@ -92,11 +179,70 @@ grub_gpt_partition_map_iterate (grub_disk_t disk,
 
   grub_dprintf ("gpt", "Read a valid GPT header\n");
 
-  entries = grub_le_to_cpu64 (gpt.partitions) << sector_log;
-  for (i = 0; i < grub_le_to_cpu32 (gpt.maxpart); i++)
+  t->dev_id = disk->dev->id;
+  t->disk_id = disk->id;
+  t->part_start = grub_partition_get_start (disk->partition);
+  t->generation = grub_disk_generation;
+  t->sector_log = sector_log;
+  t->entries = grub_le_to_cpu64 (gpt.partitions) << sector_log;
+  t->maxpart = grub_le_to_cpu32 (gpt.maxpart);
+  t->entry_size = grub_le_to_cpu32 (gpt.partentry_size);
+
+  /* Read the whole array in one request, unless it is too odd for that.  */
+  if (t->entry_size < sizeof (struct grub_gpt_partentry)
+      || grub_mul ((grub_size_t) t->maxpart, (grub_size_t) t->entry_size,
+		   &size)
+      || size > GPT_MAX_TABLE_SIZE)
+    return GRUB_ERR_NONE;
+
+  t->data = grub_malloc (size);
+  if (! t->data)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return GRUB_ERR_NONE;
+    }
+  if (grub_disk_read (disk, t->entries, 0, size, t->data))
     {
-      if (grub_disk_read (disk, entries, last_offset,
-			  sizeof (entry), &entry))
+      gpt_table_evict (t);
+      return grub_errno;
+    }
+
+  /* The array was never checked, and tables with a wrong checksum are
+     still used as before.  */
+  crc = grub_getcrc32 (0, t->data, size);
+  if (crc != grub_le_to_cpu32 (gpt.partentry_crc32))
+    grub_dprintf ("gpt", "partition entry array CRC mismatch: %08x != %08x\n",
+		  crc, grub_le_to_cpu32 (gpt.partentry_crc32));
+
+  return GRUB_ERR_NONE;
+}
+
+grub_err_t
+grub_gpt_partition_map_iterate (grub_disk_t disk,
+				grub_partition_iterate_hook_t hook,
+				void *hook_data)
+{
+  struct grub_partition part;
+  struct gpt_table t;
+  struct grub_gpt_partentry entry;
+  grub_uint64_t entries;
+  unsigned int i;
+  int last_offset = 0;
+  int sector_log;
+  grub_err_t err = GRUB_ERR_NONE;
+
+  if (! gpt_table_get (disk, &t) && gpt_table_read (disk, &t))
+    return grub_errno;
+
+  sector_log = t.sector_log;
+  entries = t.entries;
+  for (i = 0; i < t.maxpart; i++)
+    {
+      if (t.data)
+	grub_memcpy (&entry, t.data + (grub_size_t) i * t.entry_size,
+		     sizeof (entry));
+      else if (grub_disk_read (disk, entries, last_offset,
+			       sizeof (entry), &entry))
 	return grub_errno;
 
       if (grub_memcmp (&grub_gpt_partition_type_empty, &entry.type,
@@ -117,10 +263,13 @@ grub_gpt_partition_map_iterate (grub_disk_t disk,
 			(unsigned long long) part.len);
 
 	  if (hook (disk, &part, hook_data))
-	    return grub_errno;
+	    {
+	      err = grub_errno;
+	      break;
+	    }
 	}
 
-      last_offset += grub_le_to_cpu32 (gpt.partentry_size);
+      last_offset += t.entry_size;
       if (last_offset == GRUB_DISK_SECTOR_SIZE)
 	{
 	  last_offset = 0;
@@ -128,7 +277,10 @@ grub_gpt_partition_map_iterate (grub_disk_t disk,
 	}
     }
 
-  return GRUB_ERR_NONE;
+  if (t.data)
+    gpt_table_put (&t);
+
+  return err;
 }
 
 #ifdef GRUB_UTIL
@@ -237,5 +389,9 @@ GRUB_MOD_INIT(part_gpt)
 
 GRUB_MOD_FINI(part_gpt)
 {
+  unsigned i;
+
   grub_partition_map_unregister (&grub_gpt_partition_map);
+  for (i = 0; i < GPT_CACHE_SIZE; i++)
+    gpt_table_evict (&gpt_cache[i]);
 }
@@ -57,6 +57,10 @@ grub_script_argv_free (struct grub_script_argv *argv)
   argv->argc = 0;
   argv->args = 0;
   argv->script = 0;
+  argv->alloc = 0;
+  argv->last = 0;
+  argv->last_len = 0;
+  argv->last_size = 0;
 }
 
 /* Make argv from argc, args pair.  */
@@ -64,7 +68,7 @@ int
 grub_script_argv_make (struct grub_script_argv *argv, int argc, char **args)
 {
   int i;
-  struct grub_script_argv r = { 0, 0, 0 };
+  struct grub_script_argv r = { 0 };
 
   for (i = 0; i < argc; i++)
     if (grub_script_argv_next (&r)
@@ -83,17 +87,25 @@ grub_script_argv_next (struct grub_script_argv *argv)
 {
   char **p = argv->args;
   grub_size_t sz;
+  unsigned n;
 
   if (argv->args && argv->argc && argv->args[argv->argc - 1] == 0)
     return 0;
 
-  if (grub_add (argv->argc, 2, &sz) ||
-      grub_mul (sz, sizeof (char *), &sz))
+  /* The slots are doubled when they run out.  */
+  if (grub_add (argv->argc, 2, &sz))
     return 1;
+  if (! p || sz > argv->alloc)
+    {
+      n = round_up_exp (sz);
+      if (n < sz || grub_mul (n, sizeof (char *), &sz))
+	return 1;
 
-  p = grub_realloc (p, round_up_exp (sz));
-  if (! p)
-    return 1;
+      p = grub_realloc (p, sz);
+      if (! p)
+	return 1;
+      argv->alloc = n;
+    }
 
   argv->argc++;
   argv->args = p;
@@ -104,32 +116,70 @@ grub_script_argv_next (struct grub_script_argv *argv)
   return 0;
 }
 
+/*
+ * Make room for `len' more bytes at the end of the last argument and
+ * return where they go, for grub_script_argv_commit to add them.  The
+ * argument is doubled in size when it runs out.
+ */
+char *
+grub_script_argv_reserve (struct grub_script_argv *argv, grub_size_t len)
+{
+  char *p = argv->args[argv->argc - 1];
+  grub_size_t sz, size;
+
+  /* Not the argument appended to last time.  */
+  if (p != argv->last || ! p)
+    {
+      argv->last = p;
+      argv->last_len = p ? grub_strlen (p) : 0;
+      argv->last_size = p ? argv->last_len + 1 : 0;
+    }
+
+  if (grub_add (argv->last_len, len, &sz) ||
+      grub_add (sz, 1, &sz))
+    return 0;
+
+  if (sz > argv->last_size)
+    {
+      if (grub_mul (argv->last_size, 2, &size) || size < sz)
+	size = sz < 16 ? 16 : sz;
+
+      p = grub_realloc (p, size);
+      if (! p)
+	return 0;
+
+      argv->args[argv->argc - 1] = p;
+      argv->last = p;
+      argv->last_size = size;
+    }
+
+  return p + argv->last_len;
+}
+
+/* Add the `len' bytes written where grub_script_argv_reserve said.  */
+void
+grub_script_argv_commit (struct grub_script_argv *argv, grub_size_t len)
+{
+  argv->last_len += len;
+  argv->last[argv->last_len] = 0;
+}
+
 /* Append `s' to the last argument.  */
 int
 grub_script_argv_append (struct grub_script_argv *argv, const char *s,
 			 grub_size_t slen)
 {
-  grub_size_t a;
-  char *p = argv->args[argv->argc - 1];
-  grub_size_t sz;
+  char *p;
 
   if (! s)
     return 0;
 
-  a = p ? grub_strlen (p) : 0;
-
-  if (grub_add (a, slen, &sz) ||
-      grub_add (sz, 1, &sz) ||
-      grub_mul (sz, sizeof (char), &sz))
-    return 1;
-
-  p = grub_realloc (p, round_up_exp (sz));
+  p = grub_script_argv_reserve (argv, slen);
   if (! p)
     return 1;
 
-  grub_memcpy (p + a, s, slen);
-  p[a+slen] = 0;
-  argv->args[argv->argc - 1] = p;
+  grub_memcpy (p, s, slen);
+  grub_script_argv_commit (argv, slen);
 
   return 0;
 }
@@ -28,6 +28,7 @@
 #include <grub/extcmd.h>
 #include <grub/i18n.h>
 #include <grub/verify.h>
+#include <grub/safemath.h>
 
 /* Max digits for a char is 3 (0xFF is 255), similarly for an int it
    is sizeof (int) * 3, and one extra for a possible -ve sign.  */
@@ -53,53 +54,52 @@ static struct grub_script_scope *scope = 0;
 /* Wildcard translator for GRUB script.  */
 struct grub_script_wildcard_translator *grub_wildcard_translator;
 
-static char*
-wildcard_escape (const char *s)
+/* Escape S into P, which has room for twice its length, and return the
+   length of the result.  */
+static grub_size_t
+wildcard_escape_to (char *p, const char *s)
 {
-  int i;
-  int len;
+  grub_size_t i = 0;
   char ch;
-  char *p;
-
-  len = grub_strlen (s);
-  p = grub_malloc (len * 2 + 1);
-  if (! p)
-    return NULL;
 
-  i = 0;
   while ((ch = *s++))
     {
       if (ch == '*' || ch == '\\' || ch == '?')
 	p[i++] = '\\';
       p[i++] = ch;
     }
-  p[i] = '\0';
-  return p;
+  return i;
 }
 
 static char*
-wildcard_unescape (const char *s)
+wildcard_escape (const char *s)
 {
-  int i;
-  int len;
-  char ch;
   char *p;
 
-  len = grub_strlen (s);
-  p = grub_malloc (len + 1);
+  p = grub_malloc (grub_strlen (s) * 2 + 1);
   if (! p)
     return NULL;
 
-  i = 0;
+  p[wildcard_escape_to (p, s)] = '\0';
+  return p;
+}
+
+/* Unescape S into P, which may be S itself, and return the length of the
+   result.  */
+static grub_size_t
+wildcard_unescape_to (char *p, const char *s)
+{
+  grub_size_t i = 0;
+  char ch;
+
   while ((ch = *s++))
     {
-      if (ch == '\\')
+      if (ch == '\\' && *s)
 	p[i++] = *s++;
       else
 	p[i++] = ch;
     }
-  p[i] = '\0';
-  return p;
+  return i;
 }
 
 static void
@@ -187,7 +187,7 @@ grub_script_setparams (grub_command_t cmd __attribute__((unused)),
 		       int argc, char **args)
 {
   struct grub_script_scope *new_scope;
-  struct grub_script_argv argv = { 0, 0, 0 };
+  struct grub_script_argv argv = { 0 };
 
   if (! scope)
     return GRUB_ERR_INVALID_COMMAND;
@@ -262,7 +262,7 @@ static char **
 grub_script_env_get (const char *name, grub_script_arg_type_t type)
 {
   unsigned i;
-  struct grub_script_argv result = { 0, 0, 0 };
+  struct grub_script_argv result = { 0 };
 
   if (grub_script_argv_next (&result))
     goto fail;
@@ -595,23 +595,26 @@ static int
 append (struct grub_script_argv *result,
 	const char *s, int escape_type)
 {
-  int r;
-  char *p = 0;
+  grub_size_t len;
+  char *p;
 
   if (escape_type == 0)
     return grub_script_argv_append (result, s, grub_strlen (s));
 
-  if (escape_type > 0)
-    p = wildcard_escape (s);
-  else if (escape_type < 0)
-    p = wildcard_unescape (s);
-
+  /* Escape straight into the argument.  */
+  len = grub_strlen (s);
+  if (escape_type > 0 && grub_mul (len, 2, &len))
+    return 1;
+  p = grub_script_argv_reserve (result, len);
   if (! p)
     return 1;
 
-  r = grub_script_argv_append (result, p, grub_strlen (p));
-  grub_free (p);
-  return r;
+  if (escape_type > 0)
+    len = wildcard_escape_to (p, s);
+  else
+    len = wildcard_unescape_to (p, s);
+  grub_script_argv_commit (result, len);
+  return 0;
 }
 
 /* Convert arguments in ARGLIST into ARGV form.  */
@@ -622,7 +625,7 @@ grub_script_arglist_to_argv (struct grub_script_arglist *arglist,
   int i;
   char **values = 0;
   struct grub_script_arg *arg = 0;
-  struct grub_script_argv result = { 0, 0, 0 };
+  struct grub_script_argv result = { 0 };
 
   if (arglist == NULL)
     return 1;
@@ -655,7 +658,7 @@ grub_script_arglist_to_argv (struct grub_script_arglist *arglist,
 
 			if (arg->type == GRUB_SCRIPT_ARG_TYPE_VAR)
 			  {
-			    int len;
+			    grub_size_t len;
 			    char ch;
 			    char *p;
 			    char *op;
@@ -665,7 +668,7 @@ grub_script_arglist_to_argv (struct grub_script_arglist *arglist,
 			    /* \? -> \\\? */
 			    /* \* -> \\\* */
 			    /* \ -> \\ */
-			    p = grub_malloc (len * 2 + 1);
+			    p = grub_script_argv_reserve (&result, len * 2);
 			    if (! p)
 			      {
 				need_cleanup = 1;
@@ -683,10 +686,7 @@ grub_script_arglist_to_argv (struct grub_script_arglist *arglist,
 				  }
 				*op++ = ch;
 			      }
-			    *op = '\0';
-
-			    need_cleanup = grub_script_argv_append (&result, p, op - p);
-			    grub_free (p);
+			    grub_script_argv_commit (&result, op - p);
 			    /* Fall through to cleanup */
 			  }
 			else
@@ -708,23 +708,10 @@ cleanup:
 	      }
 
 	    case GRUB_SCRIPT_ARG_TYPE_BLOCK:
-	      {
-		char *p;
-		if (grub_script_argv_append (&result, "{", 1))
-		  goto fail;
-		p = wildcard_escape (arg->str);
-		if (!p)
-		  goto fail;
-		if (grub_script_argv_append (&result, p,
-					     grub_strlen (p)))
-		  {
-		    grub_free (p);
-		    goto fail;
-		  }
-		grub_free (p);
-		if (grub_script_argv_append (&result, "}", 1))
-		  goto fail;
-	      }
+	      if (grub_script_argv_append (&result, "{", 1)
+		  || append (&result, arg->str, 1)
+		  || grub_script_argv_append (&result, "}", 1))
+		goto fail;
 	      result.script = arg->script;
 	      break;
 
@@ -763,6 +750,8 @@ cleanup:
 
   result.argc = 0;
   result.args = 0;
+  result.alloc = 0;
+  result.last = 0;
   for (i = 0; unexpanded.args[i]; i++)
     {
       char **expansions = 0;
@@ -774,10 +763,19 @@ cleanup:
 	  goto fail;
 	}
 
+      /* The argument is unescaped where it is and moved over.  */
       if (! expansions)
 	{
-	  grub_script_argv_next (&result);
-	  append (&result, unexpanded.args[i], -1);
+	  char *p = unexpanded.args[i];
+
+	  if (grub_script_argv_next (&result))
+	    {
+	      grub_script_argv_free (&unexpanded);
+	      goto fail;
+	    }
+	  p[wildcard_unescape_to (p, p)] = '\0';
+	  result.args[result.argc - 1] = p;
+	  unexpanded.args[i] = 0;
 	}
       else
 	{
@@ -851,60 +849,331 @@ grub_script_function_call (grub_script_function_t func, int argc, char **args)
   return ret;
 }
 
-/* Helper for grub_script_execute_sourcecode.  */
+/*
+ * Parsed scripts are kept for the source they were parsed from, so that
+ * sourcing a file, entering a submenu or booting an entry again runs the
+ * same commands without lexing and parsing them again.  Only sources
+ * which parsed without errors and defined no functions are kept, since
+ * the parser defines functions as it goes.
+ */
+#define SCRIPT_CACHE_ENTRIES	16
+#define SCRIPT_CACHE_MAX_BYTES	(512 * 1024)
+
+struct grub_script_cache
+{
+  struct grub_script_cache *next;
+  grub_uint32_t hash;
+  grub_size_t size;
+  int flags;
+  char *source;
+  struct grub_script **scripts;
+  grub_size_t nscripts;
+  /* Executions of it in progress, which keep it from being freed.  */
+  unsigned users;
+};
+
+static struct grub_script_cache *script_cache;
+
+static grub_uint32_t
+script_cache_hash (const char *source, grub_size_t size)
+{
+  grub_uint32_t hash = 0x811c9dc5;
+  grub_size_t i;
+
+  for (i = 0; i < size; i++)
+    hash = (hash ^ (grub_uint8_t) source[i]) * 0x01000193;
+  return hash;
+}
+
+static void
+script_cache_free_scripts (struct grub_script **scripts, grub_size_t n)
+{
+  grub_size_t i;
+
+  for (i = 0; i < n; i++)
+    grub_script_free (scripts[i]);
+  grub_free (scripts);
+}
+
+static void
+script_cache_free (struct grub_script_cache *entry)
+{
+  script_cache_free_scripts (entry->scripts, entry->nscripts);
+  grub_free (entry->source);
+  grub_free (entry);
+}
+
+/* Find the entry for SOURCE and move it to the front.  */
+static struct grub_script_cache *
+script_cache_find (const char *source, grub_size_t size, int flags,
+		   grub_uint32_t hash)
+{
+  struct grub_script_cache *entry, **prev;
+
+  for (prev = &script_cache; (entry = *prev); prev = &entry->next)
+    if (entry->hash == hash && entry->size == size && entry->flags == flags
+	&& grub_memcmp (entry->source, source, size) == 0)
+      {
+	*prev = entry->next;
+	entry->next = script_cache;
+	script_cache = entry;
+	return entry;
+      }
+  return NULL;
+}
+
+/* Drop the least recently used entries over the limits, except those
+   being executed.  */
+static void
+script_cache_trim (void)
+{
+  struct grub_script_cache *entry, **prev;
+  grub_size_t n = 0, bytes = 0;
+
+  for (prev = &script_cache; (entry = *prev); )
+    {
+      n++;
+      bytes += entry->size;
+      if ((n > SCRIPT_CACHE_ENTRIES || bytes > SCRIPT_CACHE_MAX_BYTES)
+	  && !entry->users)
+	{
+	  *prev = entry->next;
+	  n--;
+	  bytes -= entry->size;
+	  script_cache_free (entry);
+	  continue;
+	}
+      prev = &entry->next;
+    }
+}
+
+static void
+script_cache_add (const char *source, grub_size_t size, int flags,
+		  grub_uint32_t hash, struct grub_script **scripts,
+		  grub_size_t nscripts)
+{
+  struct grub_script_cache *entry;
+  grub_err_t err = grub_errno;
+
+  if (size > SCRIPT_CACHE_MAX_BYTES)
+    goto fail;
+
+  entry = grub_zalloc (sizeof (*entry));
+  if (!entry)
+    goto fail;
+  entry->source = grub_malloc (size + 1);
+  if (!entry->source)
+    {
+      grub_free (entry);
+      goto fail;
+    }
+  grub_memcpy (entry->source, source, size);
+  entry->hash = hash;
+  entry->size = size;
+  entry->flags = flags;
+  entry->scripts = scripts;
+  entry->nscripts = nscripts;
+  entry->next = script_cache;
+  script_cache = entry;
+  script_cache_trim ();
+  return;
+
+ fail:
+  /* Not keeping the scripts is no error of theirs.  */
+  grub_errno = err;
+  script_cache_free_scripts (scripts, nscripts);
+}
+
+void
+grub_script_cache_flush (void)
+{
+  struct grub_script_cache *entry, **prev;
+
+  for (prev = &script_cache; (entry = *prev); )
+    if (entry->users)
+      prev = &entry->next;
+    else
+      {
+	*prev = entry->next;
+	script_cache_free (entry);
+      }
+}
+
+struct grub_script_source_reader
+{
+  const char *ptr;
+  const char *end;
+  int flags;
+  int done;
+};
+
+/* Helper for grub_script_execute_source.  */
 static grub_err_t
-grub_script_execute_sourcecode_getline (char **line,
-					int cont __attribute__ ((unused)),
-					void *data)
+grub_script_execute_source_getline (char **line,
+				    int cont __attribute__ ((unused)),
+				    void *data)
 {
-  const char **source = data;
+  struct grub_script_source_reader *reader = data;
   const char *p;
+  char *q;
+
+  /* Like the lines of a configuration file taken from the file.  */
+  if (reader->flags & GRUB_SCRIPT_SOURCE_CONFIG)
+    while (1)
+      {
+	if (reader->ptr == reader->end)
+	  {
+	    *line = 0;
+	    return GRUB_ERR_NONE;
+	  }
+
+	p = grub_memchr (reader->ptr, '\n', reader->end - reader->ptr);
+	if (!p)
+	  p = reader->end;
+	*line = q = grub_malloc (p - reader->ptr + 1);
+	if (!q)
+	  return grub_errno;
+	for (; reader->ptr < p; reader->ptr++)
+	  if (*reader->ptr != '\r')
+	    *q++ = *reader->ptr;
+	*q = '\0';
+	if (reader->ptr < reader->end)
+	  reader->ptr++;
+
+	if ((*line)[0] != '#')
+	  return GRUB_ERR_NONE;
+	grub_free (*line);
+      }
 
-  if (! *source)
+  if (reader->done)
     {
       *line = 0;
-      return 0;
+      return GRUB_ERR_NONE;
     }
 
-  p = grub_strchr (*source, '\n');
-
+  p = grub_memchr (reader->ptr, '\n', reader->end - reader->ptr);
   if (p)
-    *line = grub_strndup (*source, p - *source);
+    {
+      *line = grub_strndup (reader->ptr, p - reader->ptr);
+      reader->ptr = p + 1;
+    }
   else
-    *line = grub_strdup (*source);
-  *source = p ? p + 1 : 0;
-  return 0;
+    {
+      *line = grub_strndup (reader->ptr, reader->end - reader->ptr);
+      reader->done = 1;
+    }
+  return GRUB_ERR_NONE;
 }
 
-/* Execute a source script.  */
+/* Execute SIZE bytes of SOURCE, with the scripts parsed from it the last
+   time if it was seen before.  */
 grub_err_t
-grub_script_execute_sourcecode (const char *source)
+grub_script_execute_source (const char *source, grub_size_t size, int flags)
 {
-  grub_err_t ret = 0;
+  struct grub_script_source_reader reader = {
+    .ptr = source,
+    .end = source + size,
+    .flags = flags
+  };
+  grub_uint32_t hash = script_cache_hash (source, size);
+  struct grub_script_cache *entry;
+  struct grub_script **scripts = NULL, **new_scripts;
   struct grub_script *parsed_script;
+  grub_size_t nscripts = 0, alloc = 0, i;
+  unsigned long defined;
+  int cacheable = 1;
+  grub_err_t ret = 0, err;
 
-  while (source)
+  entry = script_cache_find (source, size, flags, hash);
+  if (entry)
+    {
+      entry->users++;
+      for (i = 0; i < entry->nscripts; i++)
+	{
+	  if (flags & GRUB_SCRIPT_SOURCE_CONFIG)
+	    {
+	      grub_print_error ();
+	      grub_errno = GRUB_ERR_NONE;
+	    }
+	  ret = grub_script_execute (entry->scripts[i]);
+	}
+      entry->users--;
+      script_cache_trim ();
+      goto done;
+    }
+
+  while (1)
     {
       char *line;
 
-      grub_script_execute_sourcecode_getline (&line, 0, &source);
+      if (flags & GRUB_SCRIPT_SOURCE_CONFIG)
+	{
+	  grub_print_error ();
+	  grub_errno = GRUB_ERR_NONE;
+	}
+
+      if (grub_script_execute_source_getline (&line, 0, &reader) || !line)
+	break;
+
+      defined = grub_script_function_defined;
       parsed_script = grub_script_parse
-	(line, grub_script_execute_sourcecode_getline, &source);
+	(line, grub_script_execute_source_getline, &reader);
+      if (defined != grub_script_function_defined)
+	cacheable = 0;
       if (! parsed_script)
 	{
-	  ret = grub_errno;
+	  cacheable = 0;
 	  grub_free (line);
+	  if (flags & GRUB_SCRIPT_SOURCE_CONFIG)
+	    continue;
+	  ret = grub_errno;
 	  break;
 	}
 
       ret = grub_script_execute (parsed_script);
-      grub_script_free (parsed_script);
       grub_free (line);
+
+      if (cacheable && nscripts == alloc)
+	{
+	  err = grub_errno;
+	  alloc = alloc ? alloc * 2 : 8;
+	  new_scripts = grub_realloc (scripts, alloc * sizeof (scripts[0]));
+	  if (!new_scripts)
+	    cacheable = 0;
+	  else
+	    scripts = new_scripts;
+	  grub_errno = err;
+	}
+      if (cacheable)
+	scripts[nscripts++] = parsed_script;
+      else
+	grub_script_free (parsed_script);
+    }
+
+ done:
+  if (flags & GRUB_SCRIPT_SOURCE_CONFIG)
+    {
+      grub_print_error ();
+      grub_errno = GRUB_ERR_NONE;
     }
 
+  if (entry)
+    return ret;
+
+  if (cacheable)
+    script_cache_add (source, size, flags, hash, scripts, nscripts);
+  else
+    script_cache_free_scripts (scripts, nscripts);
   return ret;
 }
 
+/* Execute a source script.  */
+grub_err_t
+grub_script_execute_sourcecode (const char *source)
+{
+  return grub_script_execute_source (source, grub_strlen (source), 0);
+}
+
 /* Execute a source script in new scope.  */
 grub_err_t
 grub_script_execute_new_scope (const char *source, int argc, char **args)
@@ -940,7 +1209,7 @@ grub_script_execute_cmdline (struct grub_script_cmd *cmd)
   unsigned int i;
   char **args;
   int invert;
-  struct grub_script_argv argv = { 0, 0, 0 };
+  struct grub_script_argv argv = { 0 };
 
   /* Lookup the command.  */
   if (grub_script_arglist_to_argv (cmdline->arglist, &argv) || ! argv.args || ! argv.args[0])
@@ -984,13 +1253,34 @@ grub_script_execute_cmdline (struct grub_script_cmd *cmd)
       args = argv.args + 2;
       cmdname = argv.args[1];
     }
-  grubcmd = grub_command_find (cmdname);
+  if (cmdline->grubcmd
+      && cmdline->cmd_generation == grub_command_generation
+      && grub_strcmp (cmdline->grubcmd->name, cmdname) == 0)
+    grubcmd = cmdline->grubcmd;
+  else
+    {
+      grubcmd = grub_command_find (cmdname);
+      cmdline->grubcmd = grubcmd;
+      cmdline->cmd_generation = grub_command_generation;
+    }
   if (! grubcmd)
     {
       grub_errno = GRUB_ERR_NONE;
 
-      /* It's not a GRUB command, try all functions.  */
-      func = grub_script_function_find (cmdname);
+      /* It's not a GRUB command, try all functions.  Helpers such as
+	 load_video are called many times from the same place, so reuse
+	 the function this command line found last time unless a
+	 function has been defined or removed since.  */
+      if (cmdline->func
+	  && cmdline->func_defined == grub_script_function_defined
+	  && grub_strcmp (cmdline->func->name, cmdname) == 0)
+	func = cmdline->func;
+      else
+	{
+	  func = grub_script_function_find (cmdname);
+	  cmdline->func = func;
+	  cmdline->func_defined = grub_script_function_defined;
+	}
       if (! func)
 	{
 	  /* As a last resort, try if it is an assignment.  */
@@ -1116,7 +1406,7 @@ grub_script_execute_cmdfor (struct grub_script_cmd *cmd)
 {
   unsigned i;
   grub_err_t result;
-  struct grub_script_argv argv = { 0, 0, 0 };
+  struct grub_script_argv argv = { 0 };
   struct grub_script_cmdfor *cmdfor = (struct grub_script_cmdfor *) cmd;
 
   if (grub_script_arglist_to_argv (cmdfor->words, &argv))
@@ -23,6 +23,7 @@
 #include <grub/charset.h>
 
 grub_script_function_t grub_script_function_list;
+unsigned long grub_script_function_defined;
 
 grub_script_function_t
 grub_script_function_create (struct grub_script_arg *functionname_arg,
@@ -31,6 +32,8 @@ grub_script_function_create (struct grub_script_arg *functionname_arg,
   grub_script_function_t func;
   grub_script_function_t *p;
 
+  grub_script_function_defined++;
+
   func = (grub_script_function_t) grub_malloc (sizeof (*func));
   if (! func)
     return 0;
@@ -89,6 +92,9 @@ grub_script_function_remove (const char *name)
 {
   grub_script_function_t *p, q;
 
+  /* Drop any command line caching a pointer to Q.  */
+  grub_script_function_defined++;
+
   for (p = &grub_script_function_list, q = *p; q; p = &(q->next), q = q->next)
     if (grub_strcmp (name, q->name) == 0)
       {
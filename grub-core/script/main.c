@@ -95,4 +95,6 @@ grub_script_fini (void)
   if (cmd_return)
     grub_unregister_command (cmd_return);
   cmd_return = 0;
+
+  grub_script_cache_flush ();
 }
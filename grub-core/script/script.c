@@ -204,6 +204,10 @@ grub_script_create_cmdline (struct grub_parser_param *state,
   cmd->cmd.exec = grub_script_execute_cmdline;
   cmd->cmd.next = 0;
   cmd->arglist = arglist;
+  cmd->grubcmd = 0;
+  cmd->cmd_generation = 0;
+  cmd->func = 0;
+  cmd->func_defined = 0;
 
   return (struct grub_script_cmd *) cmd;
 }
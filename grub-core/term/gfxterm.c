@@ -121,6 +121,32 @@ static void destroy_window (void);
 
 static struct grub_video_render_target *text_layer;
 
+/*
+ * Characters are painted from an atlas of cells rendered before, in the
+ * format of the text layer, so that painting one is a copy of a rectangle
+ * instead of another conversion of the glyph bitmap.  A cell is found by
+ * its glyph and colors among the GLYPH_ATLAS_WAYS cells of a set, and the
+ * least recently used one of them is drawn again on a miss.  Cells are
+ * twice the normal character width, for wide characters.
+ */
+#define GLYPH_ATLAS_COLUMNS	16
+#define GLYPH_ATLAS_SETS	64
+#define GLYPH_ATLAS_WAYS	4
+#define GLYPH_ATLAS_CELLS	(GLYPH_ATLAS_SETS * GLYPH_ATLAS_WAYS)
+
+struct glyph_atlas_cell
+{
+  /* Glyph drawn in the cell, or NULL if the cell is free.  */
+  struct grub_font_glyph *glyph;
+  grub_video_color_t fg_color;
+  grub_video_color_t bg_color;
+  grub_uint32_t last_used;
+};
+
+static struct grub_video_render_target *glyph_atlas;
+static struct glyph_atlas_cell glyph_atlas_cells[GLYPH_ATLAS_CELLS];
+static grub_uint32_t glyph_atlas_clock;
+
 struct grub_gfxterm_background grub_gfxterm_background;
 
 static struct grub_dirty_region dirty_region;
@@ -199,6 +225,9 @@ grub_virtual_screen_free (void)
   /* Free render targets.  */
   grub_video_delete_render_target (text_layer);
   text_layer = 0;
+  grub_video_delete_render_target (glyph_atlas);
+  glyph_atlas = 0;
+  grub_memset (glyph_atlas_cells, 0, sizeof (glyph_atlas_cells));
 }
 
 static grub_err_t
@@ -223,6 +252,7 @@ grub_virtual_screen_setup (unsigned int x, unsigned int y,
     grub_font_get_max_char_height (virtual_screen.font);
   if (virtual_screen.normal_char_height == 0)
     virtual_screen.normal_char_height = 16;
+  grub_term_font_generation++;
   virtual_screen.cursor_x = 0;
   virtual_screen.cursor_y = 0;
   virtual_screen.cursor_state = 1;
@@ -258,6 +288,19 @@ grub_virtual_screen_setup (unsigned int x, unsigned int y,
   if (grub_errno != GRUB_ERR_NONE)
     return grub_errno;
 
+  /* Without memory for the atlas, characters are drawn one by one.  */
+  if (grub_video_create_render_target (&glyph_atlas,
+				       GLYPH_ATLAS_COLUMNS * 2
+				       * virtual_screen.normal_char_width,
+				       GLYPH_ATLAS_CELLS / GLYPH_ATLAS_COLUMNS
+				       * virtual_screen.normal_char_height,
+				       GRUB_VIDEO_MODE_TYPE_INDEX_COLOR
+				       | GRUB_VIDEO_MODE_TYPE_ALPHA))
+    {
+      glyph_atlas = 0;
+      grub_errno = GRUB_ERR_NONE;
+    }
+
   /* As we want to have colors compatible with rendering target,
      we can only have those after mode is initialized.  */
   grub_video_set_active_render_target (text_layer);
@@ -612,6 +655,68 @@ dirty_region_redraw (void)
   redraw_screen_rect (x, y, width, height);
 }
 
+/* Paint GLYPH in a cell of WIDTH pixels at (X, Y) of the text layer, which
+   is active, from the glyph atlas.  Return 0 if GLYPH cannot be kept
+   there.  */
+static int
+paint_glyph_from_atlas (struct grub_font_glyph *glyph,
+			grub_video_color_t color, grub_video_color_t bgcolor,
+			unsigned x, unsigned y, unsigned width,
+			unsigned height, int ascent)
+{
+  struct glyph_atlas_cell *set, *cell = NULL, *victim = NULL;
+  unsigned i, n, atlas_x, atlas_y;
+
+  if (!glyph_atlas || glyph->width == 0 || glyph->height == 0
+      || width > 2 * virtual_screen.normal_char_width)
+    return 0;
+
+  set = &glyph_atlas_cells[((((grub_addr_t) glyph >> 4) ^ color
+			     ^ (bgcolor << 4)) % GLYPH_ATLAS_SETS)
+			   * GLYPH_ATLAS_WAYS];
+  for (i = 0; i < GLYPH_ATLAS_WAYS; i++)
+    {
+      if (set[i].glyph == glyph && set[i].fg_color == color
+	  && set[i].bg_color == bgcolor)
+	{
+	  cell = &set[i];
+	  break;
+	}
+      if (!victim || (victim->glyph && (!set[i].glyph
+					|| set[i].last_used < victim->last_used)))
+	victim = &set[i];
+    }
+
+  n = (cell ? : victim) - glyph_atlas_cells;
+  atlas_x = (n % GLYPH_ATLAS_COLUMNS) * 2 * virtual_screen.normal_char_width;
+  atlas_y = (n / GLYPH_ATLAS_COLUMNS) * virtual_screen.normal_char_height;
+
+  if (!cell)
+    {
+      /* A glyph reaching out of its cell draws over its neighbours, which
+	 a copy of the cell would not do.  */
+      if (glyph->offset_x < 0 || glyph->offset_x + glyph->width > (int) width
+	  || ascent - glyph->offset_y - glyph->height < 0
+	  || ascent - glyph->offset_y > (int) height)
+	return 0;
+
+      cell = victim;
+      grub_video_set_active_render_target (glyph_atlas);
+      grub_video_fill_rect (bgcolor, atlas_x, atlas_y, width, height);
+      grub_font_draw_glyph (glyph, color, atlas_x, atlas_y + ascent);
+      grub_video_set_active_render_target (text_layer);
+
+      cell->glyph = glyph;
+      cell->fg_color = color;
+      cell->bg_color = bgcolor;
+    }
+  cell->last_used = ++glyph_atlas_clock;
+
+  grub_video_blit_render_target (glyph_atlas, GRUB_VIDEO_BLIT_REPLACE, x, y,
+				 atlas_x, atlas_y, width, height);
+  return 1;
+}
+
 static inline void
 paint_char (unsigned cx, unsigned cy)
 {
@@ -653,10 +758,19 @@ paint_char (unsigned cx, unsigned cy)
   x = cx * virtual_screen.normal_char_width;
   y = (cy + virtual_screen.total_scroll) * virtual_screen.normal_char_height;
 
-  /* Render glyph to text layer.  */
+  /*
+   * Render glyph to text layer.  Only the glyphs of the font itself live
+   * as long as the atlas does, constructed ones are given up after a
+   * while.
+   */
   grub_video_set_active_render_target (text_layer);
-  grub_video_fill_rect (bgcolor, x, y, width, height);
-  grub_font_draw_glyph (glyph, color, x, y + ascent);
+  if (p->code.ncomb || p->code.attributes
+      || !paint_glyph_from_atlas (glyph, color, bgcolor, x, y,
+				  width, height, ascent))
+    {
+      grub_video_fill_rect (bgcolor, x, y, width, height);
+      grub_font_draw_glyph (glyph, color, x, y + ascent);
+    }
   grub_video_set_active_render_target (render_target);
 
   /* Mark character to be drawn.  */
@@ -186,6 +186,14 @@ do_real_config (struct grub_serial_port *port)
       ns8250_reg_write (port, UART_ENABLE_DTRRTS | UART_ENABLE_OUT2, UART_MCR);
     }
 
+  /* An 8250 or 16450 has no FIFO and the one of a 16550 does not work.  */
+  if ((ns8250_reg_read (port, UART_IIR) & UART_FIFO_ENABLED)
+      == UART_FIFO_ENABLED)
+    port->fifo_size = UART_FIFO_SIZE;
+  else
+    port->fifo_size = 1;
+  port->tx_room = 0;
+
   /* Drain the input buffer.  */
   endtime = grub_get_time_ms () + 1000;
   while (ns8250_reg_read (port, UART_LSR) & UART_DATA_READY)
@@ -220,13 +228,24 @@ serial_hw_put (struct grub_serial_port *port, const int c)
 
   do_real_config (port);
 
+  /* The FIFO was empty when last checked, and still has room.  */
+  if (port->tx_room)
+    {
+      port->tx_room--;
+      ns8250_reg_write (port, c, UART_TX);
+      return;
+    }
+
   if (port->broken > 5)
     endtime = grub_get_time_ms ();
   else if (port->broken > 1)
     endtime = grub_get_time_ms () + 50;
   else
     endtime = grub_get_time_ms () + 200;
-  /* Wait until the transmitter holding register is empty.  */
+  /*
+   * Wait until the transmitter holding register is empty.  With a FIFO
+   * that means all of it is, so the next bytes go out without checking.
+   */
   while ((ns8250_reg_read (port, UART_LSR) & UART_EMPTY_TRANSMITTER) == 0)
     {
       if (grub_get_time_ms () > endtime)
@@ -240,6 +259,7 @@ serial_hw_put (struct grub_serial_port *port, const int c)
   if (port->broken)
     port->broken--;
 
+  port->tx_room = port->fifo_size - 1;
   ns8250_reg_write (port, c, UART_TX);
 }
 
@@ -119,7 +119,8 @@ static struct grub_term_input grub_serial_term_input =
   .name = "serial",
   .init = grub_terminfo_input_init,
   .getkey = grub_terminfo_getkey,
-  .data = &grub_serial_terminfo_input
+  .data = &grub_serial_terminfo_input,
+  .flags = GRUB_TERM_INPUT_POLLED
 };
 
 static struct grub_term_output grub_serial_term_output =
@@ -133,6 +134,7 @@ static struct grub_term_output grub_serial_term_output =
   .cls = grub_terminfo_cls,
   .setcolorstate = grub_terminfo_setcolorstate,
   .setcursor = grub_terminfo_setcursor,
+  .refresh = grub_terminfo_refresh,
   .flags = GRUB_TERM_CODE_TYPE_ASCII,
   .data = &grub_serial_terminfo_output,
   .progress_update_divisor = GRUB_PROGRESS_SLOW
@@ -61,6 +61,15 @@ grub_terminfo_free (char **ptr)
   *ptr = 0;
 }
 
+static void
+terminfo_screen_free (struct grub_terminfo_output_state *data)
+{
+  grub_free (data->screen);
+  grub_free (data->shadow);
+  data->screen = NULL;
+  data->shadow = NULL;
+}
+
 static void
 grub_terminfo_all_free (struct grub_term_output *term)
 {
@@ -75,6 +84,7 @@ grub_terminfo_all_free (struct grub_term_output *term)
   grub_terminfo_free (&data->reverse_video_off);
   grub_terminfo_free (&data->cursor_on);
   grub_terminfo_free (&data->cursor_off);
+  terminfo_screen_free (data);
 }
 
 /* Set current terminfo type.  */
@@ -190,14 +200,18 @@ grub_terminfo_output_register (struct grub_term_output *term,
 			       const char *type)
 {
   grub_err_t err;
-  struct grub_terminfo_output_state *data;
+  struct grub_terminfo_output_state *data
+    = (struct grub_terminfo_output_state *) term->data;
+
+  /* The state may be copied from another terminal's.  */
+  data->screen = NULL;
+  data->shadow = NULL;
 
   err = grub_terminfo_set_current (term, type);
 
   if (err)
     return err;
 
-  data = (struct grub_terminfo_output_state *) term->data;
   data->next = terminfo_outputs;
   terminfo_outputs = term;
 
@@ -230,6 +244,311 @@ putstr (struct grub_term_output *term, const char *str)
     data->put (term, *str++);
 }
 
+/* A cell whose content is not known, which never matches another.  */
+#define TERMINFO_CELL_UNKNOWN	0xffffffff
+
+/* Up to this many unchanged cells are sent again rather than skipped with
+   a cursor motion, which takes about as many bytes.  */
+#define TERMINFO_MAX_RESEND	4
+
+static void
+terminfo_cells_fill (struct grub_terminfo_cell *cells, grub_size_t n,
+		     grub_uint32_t code, int attr)
+{
+  grub_size_t i;
+
+  for (i = 0; i < n; i++)
+    {
+      cells[i].code = code;
+      cells[i].attr = attr;
+      cells[i].width = 1;
+    }
+}
+
+static int
+terminfo_color_attr (struct grub_terminfo_output_state *data,
+		     grub_term_color_state state)
+{
+  switch (state)
+    {
+    case GRUB_TERM_COLOR_STANDARD:
+    case GRUB_TERM_COLOR_NORMAL:
+      return data->setcolor ? grub_term_normal_color : 0;
+    case GRUB_TERM_COLOR_HIGHLIGHT:
+      return data->setcolor ? grub_term_highlight_color : 1;
+    default:
+      return -1;
+    }
+}
+
+/*
+ * Return the state of TERM if it is drawn through the screen buffers,
+ * which are set up for its current size first.  Without buffers output is
+ * sent as it comes.
+ */
+static struct grub_terminfo_output_state *
+terminfo_shadow (struct grub_term_output *term)
+{
+  struct grub_terminfo_output_state *data
+    = (struct grub_terminfo_output_state *) term->data;
+  grub_size_t n;
+
+  /* Without cursor motion only a stream of characters can be sent.  */
+  if (term->refresh != grub_terminfo_refresh || !data->gotoxy)
+    return NULL;
+
+  if (data->screen && data->screen_size.x == data->size.x
+      && data->screen_size.y == data->size.y)
+    return data;
+
+  terminfo_screen_free (data);
+  n = (grub_size_t) data->size.x * data->size.y;
+  if (!n)
+    return NULL;
+  data->screen = grub_calloc (n, sizeof (data->screen[0]));
+  data->shadow = grub_calloc (n, sizeof (data->shadow[0]));
+  if (!data->screen || !data->shadow)
+    {
+      terminfo_screen_free (data);
+      grub_errno = GRUB_ERR_NONE;
+      return NULL;
+    }
+
+  /* What is on the terminal already stays there until overwritten.  */
+  terminfo_cells_fill (data->screen, n, TERMINFO_CELL_UNKNOWN, 0);
+  terminfo_cells_fill (data->shadow, n, TERMINFO_CELL_UNKNOWN, 0);
+  data->screen_size = data->size;
+  data->phys_pos_valid = 0;
+  data->phys_attr = -1;
+  data->attr = terminfo_color_attr (data, GRUB_TERM_COLOR_NORMAL);
+  data->cleared = 0;
+  return data;
+}
+
+static void
+terminfo_put_attr (struct grub_term_output *term, int attr)
+{
+  struct grub_terminfo_output_state *data
+    = (struct grub_terminfo_output_state *) term->data;
+
+  if (data->setcolor)
+    {
+      /* Map from VGA to terminal colors.  */
+      static const int colormap[8]
+	= { 0, /* Black. */
+	    4, /* Blue. */
+	    2, /* Green. */
+	    6, /* Cyan. */
+	    1, /* Red.  */
+	    5, /* Magenta.  */
+	    3, /* Yellow.  */
+	    7, /* White.  */
+      };
+
+      putstr (term, grub_terminfo_tparm (data->setcolor, colormap[attr & 7],
+					 colormap[(attr >> 4) & 7]));
+    }
+  else if (attr)
+    putstr (term, grub_terminfo_tparm (data->reverse_video_on));
+  else
+    putstr (term, grub_terminfo_tparm (data->reverse_video_off));
+}
+
+/* Put the cursor of the terminal at X, Y in as few bytes as we can.  */
+static void
+terminfo_move (struct grub_term_output *term, unsigned x, unsigned y)
+{
+  struct grub_terminfo_output_state *data
+    = (struct grub_terminfo_output_state *) term->data;
+  struct grub_terminfo_cell *cell;
+  unsigned i;
+
+  if (data->phys_pos_valid && data->phys_pos.y == y)
+    {
+      if (data->phys_pos.x == x)
+	return;
+
+      /* Sending the cells in between again moves the cursor as well.  */
+      if (x > data->phys_pos.x && x - data->phys_pos.x <= TERMINFO_MAX_RESEND)
+	{
+	  cell = &data->shadow[y * data->screen_size.x + data->phys_pos.x];
+	  for (i = 0; i < x - data->phys_pos.x; i++)
+	    if (cell[i].code == TERMINFO_CELL_UNKNOWN || cell[i].width != 1
+		|| cell[i].attr != data->phys_attr)
+	      break;
+	  if (i == x - data->phys_pos.x)
+	    {
+	      for (i = 0; i < x - data->phys_pos.x; i++)
+		data->put (term, cell[i].code);
+	      data->phys_pos.x = x;
+	      return;
+	    }
+	}
+    }
+
+  if (data->phys_pos_valid && data->phys_pos.y == y && x == 0)
+    data->put (term, '\r');
+  else
+    putstr (term, grub_terminfo_tparm (data->gotoxy, y, x));
+  data->phys_pos.x = x;
+  data->phys_pos.y = y;
+  data->phys_pos_valid = 1;
+}
+
+/* Send what changed on the screen since the last time.  */
+static void
+terminfo_flush (struct grub_term_output *term)
+{
+  struct grub_terminfo_output_state *data
+    = (struct grub_terminfo_output_state *) term->data;
+  unsigned w = data->screen_size.x, h = data->screen_size.y;
+  grub_size_t n = (grub_size_t) w * h, i;
+  struct grub_terminfo_cell *cell, *old;
+  unsigned x, y;
+
+#define CELL_DIFFERS(a, b) ((a)->code != (b)->code || (a)->attr != (b)->attr \
+			    || (a)->width != (b)->width)
+
+  /*
+   * After the screen was cleared, clear the terminal too if that leaves
+   * fewer cells to send than drawing over what it shows.
+   */
+  if (data->cleared)
+    {
+      grub_size_t changed = 0, drawn = 0;
+
+      for (i = 0; i < n; i++)
+	{
+	  cell = &data->screen[i];
+	  if (cell->code == TERMINFO_CELL_UNKNOWN)
+	    continue;
+	  if (CELL_DIFFERS (cell, &data->shadow[i]))
+	    changed++;
+	  if (cell->code != ' ' || cell->attr != data->cls_attr
+	      || cell->width != 1)
+	    drawn++;
+	}
+
+      if (drawn < changed)
+	{
+	  if (data->phys_attr != data->cls_attr)
+	    {
+	      terminfo_put_attr (term, data->cls_attr);
+	      data->phys_attr = data->cls_attr;
+	    }
+	  putstr (term, grub_terminfo_tparm (data->cls));
+	  terminfo_cells_fill (data->shadow, n, ' ', data->cls_attr);
+	  /* Not every clear sequence homes the cursor.  */
+	  data->phys_pos_valid = 0;
+	}
+      data->cleared = 0;
+    }
+
+  for (y = 0; y < h; y++)
+    for (x = 0; x < w; x++)
+      {
+	cell = &data->screen[y * w + x];
+	old = &data->shadow[y * w + x];
+
+	/* The second half of a character goes out with the first.  */
+	if (cell->code == TERMINFO_CELL_UNKNOWN || !cell->width
+	    || !CELL_DIFFERS (cell, old))
+	  continue;
+
+	terminfo_move (term, x, y);
+	if (data->phys_attr != cell->attr)
+	  {
+	    terminfo_put_attr (term, cell->attr);
+	    data->phys_attr = cell->attr;
+	  }
+	data->put (term, cell->code);
+	*old = *cell;
+	if (cell->width == 2 && x + 1 < w)
+	  {
+	    old[1] = cell[1];
+	    x++;
+	  }
+
+	/* Past the last column terminals differ in where the cursor is.  */
+	data->phys_pos.x += cell->width;
+	if (data->phys_pos.x >= w)
+	  data->phys_pos_valid = 0;
+      }
+
+#undef CELL_DIFFERS
+
+  if (data->pos.x < w && data->pos.y < h)
+    terminfo_move (term, data->pos.x, data->pos.y);
+}
+
+/* Move to the next line, scrolling the terminal at the bottom.  */
+static void
+terminfo_newline (struct grub_term_output *term)
+{
+  struct grub_terminfo_output_state *data
+    = (struct grub_terminfo_output_state *) term->data;
+  unsigned w = data->screen_size.x, h = data->screen_size.y;
+
+  if (data->pos.y < h - 1)
+    {
+      data->pos.y++;
+      return;
+    }
+
+  /* Screen and terminal scroll together so that nothing is sent again.  */
+  terminfo_flush (term);
+  terminfo_move (term, 0, h - 1);
+  data->put (term, '\n');
+  grub_memmove (data->screen, data->screen + w,
+		(grub_size_t) w * (h - 1) * sizeof (data->screen[0]));
+  grub_memmove (data->shadow, data->shadow + w,
+		(grub_size_t) w * (h - 1) * sizeof (data->shadow[0]));
+  terminfo_cells_fill (data->screen + (grub_size_t) w * (h - 1), w,
+		       TERMINFO_CELL_UNKNOWN, 0);
+  terminfo_cells_fill (data->shadow + (grub_size_t) w * (h - 1), w,
+		       TERMINFO_CELL_UNKNOWN, 0);
+}
+
+/* Draw a character of WIDTH cells at the cursor.  */
+static void
+terminfo_store (struct grub_terminfo_output_state *data, grub_uint32_t code,
+		int width)
+{
+  unsigned w = data->screen_size.x;
+  struct grub_terminfo_cell *cell
+    = &data->screen[data->pos.y * w + data->pos.x];
+
+  /* The other half of a double-width character that is drawn over is
+     left blank.  */
+  if (!cell->width && data->pos.x > 0)
+    {
+      cell[-1].code = ' ';
+      cell[-1].width = 1;
+    }
+  if (data->pos.x + width < w && !cell[width].width)
+    {
+      cell[width].code = ' ';
+      cell[width].width = 1;
+    }
+
+  cell->code = code;
+  cell->attr = data->attr;
+  cell->width = width;
+  if (width == 2 && data->pos.x + 1 < w)
+    {
+      cell[1].code = 0;
+      cell[1].attr = data->attr;
+      cell[1].width = 0;
+    }
+}
+
+void
+grub_terminfo_refresh (struct grub_term_output *term)
+{
+  if (terminfo_shadow (term))
+    terminfo_flush (term);
+}
+
 struct grub_term_coordinate
 grub_terminfo_getxy (struct grub_term_output *term)
 {
@@ -252,7 +571,9 @@ grub_terminfo_gotoxy (struct grub_term_output *term,
       return;
     }
 
-  if (data->gotoxy)
+  if (terminfo_shadow (term))
+    ;
+  else if (data->gotoxy)
     putstr (term, grub_terminfo_tparm (data->gotoxy, pos.y, pos.x));
   else
     {
@@ -270,6 +591,18 @@ grub_terminfo_cls (struct grub_term_output *term)
   struct grub_terminfo_output_state *data
     = (struct grub_terminfo_output_state *) term->data;
 
+  if (terminfo_shadow (term))
+    {
+      terminfo_cells_fill (data->screen,
+			   (grub_size_t) data->size.x * data->size.y,
+			   ' ', data->attr);
+      data->cls_attr = data->attr;
+      data->cleared = 1;
+      data->pos.x = 0;
+      data->pos.y = 0;
+      return;
+    }
+
   putstr (term, grub_terminfo_tparm (data->cls));
   grub_terminfo_gotoxy (term, (struct grub_term_coordinate) { 0, 0 });
 }
@@ -280,55 +613,20 @@ grub_terminfo_setcolorstate (struct grub_term_output *term,
 {
   struct grub_terminfo_output_state *data
     = (struct grub_terminfo_output_state *) term->data;
+  int attr;
 
-  if (data->setcolor)
-    {
-      int fg;
-      int bg;
-      /* Map from VGA to terminal colors.  */
-      const int colormap[8]
-	= { 0, /* Black. */
-	    4, /* Blue. */
-	    2, /* Green. */
-	    6, /* Cyan. */
-	    1, /* Red.  */
-	    5, /* Magenta.  */
-	    3, /* Yellow.  */
-	    7, /* White.  */
-      };
-
-      switch (state)
-	{
-	case GRUB_TERM_COLOR_STANDARD:
-	case GRUB_TERM_COLOR_NORMAL:
-	  fg = grub_term_normal_color & 0x0f;
-	  bg = grub_term_normal_color >> 4;
-	  break;
-	case GRUB_TERM_COLOR_HIGHLIGHT:
-	  fg = grub_term_highlight_color & 0x0f;
-	  bg = grub_term_highlight_color >> 4;
-	  break;
-	default:
-	  return;
-	}
+  attr = terminfo_color_attr (data, state);
+  if (attr < 0)
+    return;
 
-      putstr (term, grub_terminfo_tparm (data->setcolor, colormap[fg & 7],
-					 colormap[bg & 7]));
+  /* The attribute is only sent with the cells drawn in it.  */
+  if (terminfo_shadow (term))
+    {
+      data->attr = attr;
       return;
     }
 
-  switch (state)
-    {
-    case GRUB_TERM_COLOR_STANDARD:
-    case GRUB_TERM_COLOR_NORMAL:
-      putstr (term, grub_terminfo_tparm (data->reverse_video_off));
-      break;
-    case GRUB_TERM_COLOR_HIGHLIGHT:
-      putstr (term, grub_terminfo_tparm (data->reverse_video_on));
-      break;
-    default:
-      break;
-    }
+  terminfo_put_attr (term, attr);
 }
 
 void
@@ -337,12 +635,66 @@ grub_terminfo_setcursor (struct grub_term_output *term, const int on)
   struct grub_terminfo_output_state *data
     = (struct grub_terminfo_output_state *) term->data;
 
+  /* The cursor shows up where the screen has been drawn up to.  */
+  if (terminfo_shadow (term))
+    terminfo_flush (term);
+
   if (on)
     putstr (term, grub_terminfo_tparm (data->cursor_on));
   else
     putstr (term, grub_terminfo_tparm (data->cursor_off));
 }
 
+/* The terminfo version of putchar for terminals drawn on the screen
+   buffers.  */
+static void
+terminfo_putchar_shadow (struct grub_term_output *term,
+			 const struct grub_unicode_glyph *c)
+{
+  struct grub_terminfo_output_state *data
+    = (struct grub_terminfo_output_state *) term->data;
+
+  switch (c->base)
+    {
+    case '\a':
+      data->put (term, c->base);
+      break;
+
+    case '\b':
+    case 127:
+      if (data->pos.x > 0)
+	data->pos.x--;
+      break;
+
+    case '\n':
+      terminfo_newline (term);
+      break;
+
+    case '\r':
+      data->pos.x = 0;
+      break;
+
+    default:
+      /* What takes no cell goes out right away, where it belongs.  */
+      if (c->estimated_width <= 0)
+	{
+	  terminfo_flush (term);
+	  if (data->phys_pos_valid)
+	    data->put (term, c->base);
+	  break;
+	}
+
+      if ((int) data->pos.x + c->estimated_width >= (int) grub_term_width (term) + 1)
+	{
+	  data->pos.x = 0;
+	  terminfo_newline (term);
+	}
+      terminfo_store (data, c->base, c->estimated_width);
+      data->pos.x += c->estimated_width;
+      break;
+    }
+}
+
 /* The terminfo version of putchar.  */
 void
 grub_terminfo_putchar (struct grub_term_output *term,
@@ -351,6 +703,12 @@ grub_terminfo_putchar (struct grub_term_output *term,
   struct grub_terminfo_output_state *data
     = (struct grub_terminfo_output_state *) term->data;
 
+  if (terminfo_shadow (term))
+    {
+      terminfo_putchar_shadow (term, c);
+      return;
+    }
+
   /* Keep track of the cursor.  */
   switch (c->base)
     {
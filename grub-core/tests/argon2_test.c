@@ -0,0 +1,95 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026 Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/test.h>
+#include <grub/dl.h>
+#include <grub/misc.h>
+#include <grub/crypto.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+static struct
+{
+  int type;
+  grub_uint32_t t;
+  grub_uint32_t m;
+  grub_uint32_t p;
+  const char *P;
+  const char *S;
+  grub_size_t dkLen;
+  const char *DK;
+} vectors[] = {
+  /* Computed with the Argon2 reference implementation.  */
+  {
+    GRUB_CRYPTO_ARGON2I, 2, 256, 1,
+    "password", "somesalt", 32,
+    "\x89\xe9\x02\x9f\x46\x37\xb2\x95\xbe\xb0\x27\x05\x6a\x73\x36\xc4"
+    "\x14\xfa\xdd\x43\xf6\xb2\x08\x64\x52\x81\xcb\x21\x4a\x56\x45\x2f"
+  },
+  {
+    GRUB_CRYPTO_ARGON2ID, 2, 256, 1,
+    "password", "somesalt", 32,
+    "\x9d\xfe\xb9\x10\xe8\x0b\xad\x03\x11\xfe\xe2\x0f\x9c\x0e\x2b\x12"
+    "\xc1\x79\x87\xb4\xca\xc9\x0c\x2e\xf5\x4d\x5b\x30\x21\xc6\x8b\xfe"
+  },
+  {
+    GRUB_CRYPTO_ARGON2ID, 3, 1024, 4,
+    "password", "somesaltsomesalt", 32,
+    "\xd4\x88\xa2\x44\xd7\x64\xd1\x8a\x6d\xb6\x9e\x08\xa2\x9c\x66\x82"
+    "\x4d\x78\xdd\xfa\xcf\x32\x4c\x13\x23\x9e\x35\xdc\xe7\x51\x7e\xea"
+  },
+  {
+    GRUB_CRYPTO_ARGON2D, 1, 64, 2,
+    "differentpassword", "somesalt", 32,
+    "\xdb\x09\x59\xf5\x42\x98\x6d\xe4\x3d\xcb\xca\xbc\x4e\x25\x64\xec"
+    "\x00\x7d\x19\xca\xb4\x44\x3a\xa7\x69\x6e\x0a\x99\xa9\xf2\x22\xa1"
+  },
+  {
+    GRUB_CRYPTO_ARGON2ID, 1, 32, 1,
+    "password", "somesalt", 64,
+    "\xd7\xc7\x87\x36\xfc\x52\x09\xde\x8c\x96\x74\x7c\xfd\xc1\x80\x7e"
+    "\x97\xc8\x2e\x33\xf5\xc2\x6c\x1c\x0a\xd1\xc2\x53\xa6\xcd\x42\xf8"
+    "\x5f\xd5\x9b\xbd\x60\xba\x7b\x29\xc8\xe6\x98\xc6\xfb\x58\xfc\x5e"
+    "\xdb\x7d\x6e\x3f\x9d\xa9\xae\x91\x32\xdc\x23\xfb\x8c\xee\x01\x5e"
+  }
+};
+
+static void
+argon2_test (void)
+{
+  grub_size_t i;
+
+  for (i = 0; i < ARRAY_SIZE (vectors); i++)
+    {
+      gcry_err_code_t err;
+      grub_uint8_t DK[64];
+      err = grub_crypto_argon2 (vectors[i].type, vectors[i].t,
+				vectors[i].m, vectors[i].p,
+				(const grub_uint8_t *) vectors[i].P,
+				grub_strlen (vectors[i].P),
+				(const grub_uint8_t *) vectors[i].S,
+				grub_strlen (vectors[i].S),
+				DK, vectors[i].dkLen);
+      grub_test_assert (err == 0, "gcry error %d", err);
+      grub_test_assert (grub_memcmp (DK, vectors[i].DK, vectors[i].dkLen) == 0,
+			"Argon2 mismatch");
+    }
+}
+
+/* Register argon2_test method as a functional test.  */
+GRUB_FUNCTIONAL_TEST (argon2_test, argon2_test);
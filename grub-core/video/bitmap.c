@@ -30,6 +30,8 @@ GRUB_MOD_LICENSE ("GPLv3+");
 /* List of bitmap readers registered to system.  */
 static grub_video_bitmap_reader_t bitmap_readers_list;
 
+static grub_uint32_t bitmap_serial;
+
 /* Register bitmap reader.  */
 void
 grub_video_bitmap_reader_register (grub_video_bitmap_reader_t reader)
@@ -150,6 +152,9 @@ grub_video_bitmap_create (struct grub_video_bitmap **bitmap,
   if (! (*bitmap)->data)
     goto fail;
 
+  (*bitmap)->refcount = 1;
+  (*bitmap)->serial = ++bitmap_serial;
+
   return GRUB_ERR_NONE;
 
  fail:
@@ -159,13 +164,20 @@ grub_video_bitmap_create (struct grub_video_bitmap **bitmap,
   return grub_errno;
 }
 
-/* Frees all resources allocated by bitmap.  */
+/* Drops a reference to bitmap, and frees all resources allocated by it
+   along with the last one.  */
 grub_err_t
 grub_video_bitmap_destroy (struct grub_video_bitmap *bitmap)
 {
   if (! bitmap)
     return GRUB_ERR_NONE;
 
+  if (bitmap->refcount > 1)
+    {
+      bitmap->refcount--;
+      return GRUB_ERR_NONE;
+    }
+
   grub_free (bitmap->data);
   grub_free (bitmap);
 
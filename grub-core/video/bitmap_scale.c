@@ -24,6 +24,7 @@
 #include <grub/bitmap_scale.h>
 #include <grub/types.h>
 #include <grub/dl.h>
+#include <grub/i18n.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -73,6 +74,140 @@ grub_video_bitmap_scale (struct grub_video_bitmap *dst,
     }
 }
 
+/* Scaled bitmaps are kept for reuse, since themes scale the same images
+   to the same sizes whenever they are laid out again.  A hit hands out
+   another reference to the bitmap kept, which is not modified any more.  */
+#define SCALE_CACHE_SIZE	8
+#define SCALE_CACHE_MAX_BYTES	(64 * 1024 * 1024)
+
+struct scale_cache_entry
+{
+  struct grub_video_bitmap *bitmap;
+  grub_uint64_t last_use;
+
+  /* What it was scaled from, and how.  SELECTION_METHOD is -1 for
+     grub_video_bitmap_create_scaled.  */
+  struct grub_video_bitmap *src;
+  grub_uint32_t src_serial;
+  int width;
+  int height;
+  int scale_method;
+  int selection_method;
+  int v_align;
+  int h_align;
+};
+
+static struct scale_cache_entry scale_cache[SCALE_CACHE_SIZE];
+static grub_uint64_t scale_cache_clock;
+
+static grub_size_t scale_cache_reclaim (struct grub_mm_cache *mm,
+					grub_size_t target);
+
+/* The bitmaps are only kept to save rescaling, so all of them may go
+   under memory pressure.  */
+static struct grub_mm_cache scale_cache_mm =
+  {
+    .name = "bitmap_scale",
+    .budget = 0,
+    .reclaim = scale_cache_reclaim
+  };
+
+static struct grub_video_bitmap *
+scale_cache_find (const struct scale_cache_entry *key)
+{
+  struct scale_cache_entry *e;
+
+  for (e = scale_cache; e < scale_cache + SCALE_CACHE_SIZE; e++)
+    if (e->bitmap && e->src == key->src && e->src_serial == key->src_serial
+	&& e->width == key->width && e->height == key->height
+	&& e->scale_method == key->scale_method
+	&& e->selection_method == key->selection_method
+	&& e->v_align == key->v_align && e->h_align == key->h_align)
+      {
+	e->last_use = ++scale_cache_clock;
+	return grub_video_bitmap_ref (e->bitmap);
+      }
+  return NULL;
+}
+
+static grub_size_t
+scale_cache_bytes (const struct grub_video_bitmap *bitmap)
+{
+  return (grub_size_t) bitmap->mode_info.pitch * bitmap->mode_info.height;
+}
+
+/* Drop the entry E.  The bitmap itself lives on while users hold
+   references to it.  */
+static void
+scale_cache_drop (struct scale_cache_entry *e)
+{
+  grub_mm_cache_uncharge (&scale_cache_mm, scale_cache_bytes (e->bitmap));
+  grub_video_bitmap_destroy (e->bitmap);
+  e->bitmap = NULL;
+}
+
+/* Drop the least recently used bitmaps until TARGET bytes are freed.  */
+static grub_size_t
+scale_cache_reclaim (struct grub_mm_cache *mm __attribute__ ((unused)),
+		     grub_size_t target)
+{
+  struct scale_cache_entry *e, *lru;
+  grub_size_t freed = 0;
+
+  while (freed < target)
+    {
+      lru = NULL;
+      for (e = scale_cache; e < scale_cache + SCALE_CACHE_SIZE; e++)
+	if (e->bitmap && (!lru || e->last_use < lru->last_use))
+	  lru = e;
+      if (!lru)
+	break;
+      freed += scale_cache_bytes (lru->bitmap);
+      scale_cache_drop (lru);
+    }
+
+  return freed;
+}
+
+/* Keep BITMAP, scaled as described by KEY, evicting the least recently
+   used bitmaps to make room.  */
+static void
+scale_cache_add (const struct scale_cache_entry *key,
+		 struct grub_video_bitmap *bitmap)
+{
+  struct scale_cache_entry *e, *lru, *free_entry;
+  grub_size_t size = scale_cache_bytes (bitmap), total;
+
+  if (size > SCALE_CACHE_MAX_BYTES)
+    return;
+
+  while (1)
+    {
+      total = size;
+      lru = free_entry = NULL;
+      for (e = scale_cache; e < scale_cache + SCALE_CACHE_SIZE; e++)
+	{
+	  if (!e->bitmap)
+	    {
+	      if (!free_entry)
+		free_entry = e;
+	      continue;
+	    }
+	  total += scale_cache_bytes (e->bitmap);
+	  if (!lru || e->last_use < lru->last_use)
+	    lru = e;
+	}
+      if (free_entry && total <= SCALE_CACHE_MAX_BYTES)
+	break;
+      scale_cache_drop (lru);
+    }
+
+  *free_entry = *key;
+  free_entry->bitmap = grub_video_bitmap_ref (bitmap);
+  free_entry->last_use = ++scale_cache_clock;
+  grub_mm_cache_charge (&scale_cache_mm, size);
+}
+
 /* This function creates a new scaled version of the bitmap SRC.  The new
    bitmap has dimensions DST_WIDTH by DST_HEIGHT.  The scaling algorithm
    is given by SCALE_METHOD.  If an error is encountered, the return code is
@@ -99,6 +234,18 @@ grub_video_bitmap_create_scaled (struct grub_video_bitmap **dst,
     return grub_error (GRUB_ERR_BUG,
                        "requested to scale to a size w/ a zero dimension");
 
+  struct scale_cache_entry key = {
+    .src = src,
+    .src_serial = src->serial,
+    .width = dst_width,
+    .height = dst_height,
+    .scale_method = scale_method,
+    .selection_method = -1
+  };
+  *dst = scale_cache_find (&key);
+  if (*dst)
+    return GRUB_ERR_NONE;
+
   /* Create the new bitmap. */
   grub_err_t ret;
   ret = grub_video_bitmap_create (dst, dst_width, dst_height,
@@ -111,6 +258,7 @@ grub_video_bitmap_create_scaled (struct grub_video_bitmap **dst,
   if (ret == GRUB_ERR_NONE)
     {
       /* Success:  *dst is now a pointer to the scaled bitmap. */
+      scale_cache_add (&key, *dst);
       return GRUB_ERR_NONE;
     }
   else
@@ -201,6 +349,20 @@ grub_video_bitmap_scale_proportional (struct grub_video_bitmap **dst,
     return grub_error (GRUB_ERR_BUG,
                        "requested to scale to a size w/ a zero dimension");
 
+  struct scale_cache_entry key = {
+    .src = src,
+    .src_serial = src->serial,
+    .width = dst_width,
+    .height = dst_height,
+    .scale_method = scale_method,
+    .selection_method = selection_method,
+    .v_align = v_align,
+    .h_align = h_align
+  };
+  *dst = scale_cache_find (&key);
+  if (*dst)
+    return GRUB_ERR_NONE;
+
   ret = grub_video_bitmap_create (dst, dst_width, dst_height,
                                   src->mode_info.blit_format);
   if (ret != GRUB_ERR_NONE)
@@ -287,6 +449,7 @@ grub_video_bitmap_scale_proportional (struct grub_video_bitmap **dst,
   if (ret == GRUB_ERR_NONE)
     {
       /* Success:  *dst is now a pointer to the scaled bitmap. */
+      scale_cache_add (&key, *dst);
       return GRUB_ERR_NONE;
     }
   else
@@ -412,10 +575,108 @@ scale_nn (struct grub_video_bitmap *dst, struct grub_video_bitmap *src)
    dimensions of DST.  This function uses the bilinear interpolation algorithm
    to interpolate the pixels.
 
+   The interpolation is done in two passes: source lines are first scaled
+   horizontally into fixed-point .8 intermediate lines, which are kept while
+   destination lines use them, then each destination line blends two of
+   those.  With 32-bit pixels, all four components are handled together in
+   lanes of integer words.
+
    Supports only direct color modes which have components separated
    into bytes (e.g., RGBA 8:8:8:8 or BGR 8:8:8 true color).
    But because of this simplifying assumption, the implementation is
    greatly simplified.  */
+
+struct scale_column
+{
+  /* Offset of the left source pixel, in bytes.  */
+  unsigned offset;
+  /* Fixed-point .8 distance from it to the right one.  */
+  unsigned u;
+};
+
+/* Scale source line SLINE horizontally into LINE for the first NINTERP
+   columns.  */
+static void
+scale_bilinear_line (void *line, const grub_uint8_t *sline,
+		     const struct scale_column *cols, unsigned ninterp,
+		     int bytes_per_pixel)
+{
+  unsigned dx;
+  int comp;
+
+  if (bytes_per_pixel == 4)
+    {
+      grub_uint64_t *out = line;
+
+      for (dx = 0; dx < ninterp; dx++)
+	{
+	  const grub_uint8_t *sptr = sline + cols[dx].offset;
+	  grub_uint32_t p0 = grub_get_unaligned32 (sptr);
+	  grub_uint32_t p1 = grub_get_unaligned32 (sptr + 4);
+	  unsigned u = cols[dx].u;
+	  grub_uint32_t even, odd;
+
+	  /* Components 0 and 2, then 1 and 3, in 16-bit lanes which at
+	     most reach 255 * 256.  */
+	  even = (p0 & 0x00ff00ff) * (256 - u) + (p1 & 0x00ff00ff) * u;
+	  odd = ((p0 >> 8) & 0x00ff00ff) * (256 - u)
+	    + ((p1 >> 8) & 0x00ff00ff) * u;
+	  out[dx] = ((grub_uint64_t) odd << 32) | even;
+	}
+      return;
+    }
+
+  for (dx = 0; dx < ninterp; dx++)
+    {
+      const grub_uint8_t *sptr = sline + cols[dx].offset;
+      grub_uint16_t *out = (grub_uint16_t *) line + dx * bytes_per_pixel;
+      unsigned u = cols[dx].u;
+
+      for (comp = 0; comp < bytes_per_pixel; comp++)
+	out[comp] = (256 - u) * sptr[comp] + u * sptr[comp + bytes_per_pixel];
+    }
+}
+
+/* Blend intermediate lines LINE0 and LINE1 into DPTR with weight V of the
+   second.  */
+static void
+scale_bilinear_blend (grub_uint8_t *dptr, const void *line0,
+		      const void *line1, unsigned v, unsigned ninterp,
+		      int bytes_per_pixel)
+{
+  unsigned dx;
+  int comp;
+
+  if (bytes_per_pixel == 4)
+    {
+      const grub_uint64_t *in0 = line0, *in1 = line1;
+      grub_uint64_t m = 0x0000ffff0000ffffULL;
+
+      for (dx = 0; dx < ninterp; dx++, dptr += 4)
+	{
+	  grub_uint64_t a, b;
+
+	  /* Spread to 32-bit lanes, which at most reach 255 * 256 * 256.  */
+	  a = (in0[dx] & m) * (256 - v) + (in1[dx] & m) * v;
+	  b = ((in0[dx] >> 16) & m) * (256 - v) + ((in1[dx] >> 16) & m) * v;
+	  a = (a >> 16) & 0x000000ff000000ffULL;
+	  b = (b >> 16) & 0x000000ff000000ffULL;
+	  grub_set_unaligned32 (dptr, (grub_uint32_t) (a | (a >> 24)
+						       | (b << 16) | (b >> 8)));
+	}
+      return;
+    }
+
+  for (dx = 0; dx < ninterp; dx++)
+    {
+      const grub_uint16_t *in0 = (const grub_uint16_t *) line0 + dx * bytes_per_pixel;
+      const grub_uint16_t *in1 = (const grub_uint16_t *) line1 + dx * bytes_per_pixel;
+
+      for (comp = 0; comp < bytes_per_pixel; comp++)
+	*dptr++ = ((256 - v) * in0[comp] + v * in1[comp]) >> 16;
+    }
+}
+
 static grub_err_t
 scale_bilinear (struct grub_video_bitmap *dst, struct grub_video_bitmap *src)
 {
@@ -433,15 +694,50 @@ scale_bilinear (struct grub_video_bitmap *dst, struct grub_video_bitmap *src)
   int sstride = src->mode_info.pitch;
   /* bytes_per_pixel is the same for both src and dst. */
   int bytes_per_pixel = dst->mode_info.bytes_per_pixel;
-  unsigned dy, syf, sy, ystep, yfrac, yover;
-  unsigned sxf, sx, xstep, xfrac, xover;
-  grub_uint8_t *dptr, *dline_end, *sline;
+  unsigned dx, dy, syf, sy, ystep, yfrac, yover;
+  unsigned sxf, xstep, xfrac, xover;
+  unsigned ninterp;
+  grub_uint8_t *dptr, *sline;
+  struct scale_column *cols;
+  void *lines[2], *tmp;
+  /* The source line held by each of LINES, or -1.  */
+  int line_sy[2] = { -1, -1 };
+  grub_size_t line_size;
+
+  if (grub_mul (dw, bytes_per_pixel * sizeof (grub_uint16_t), &line_size))
+    return grub_error (GRUB_ERR_OUT_OF_RANGE, N_("overflow is detected"));
+
+  cols = grub_calloc (dw, sizeof (*cols));
+  lines[0] = grub_malloc (line_size);
+  lines[1] = grub_malloc (line_size);
+  if (!cols || !lines[0] || !lines[1])
+    {
+      grub_free (cols);
+      grub_free (lines[0]);
+      grub_free (lines[1]);
+      return grub_errno;
+    }
 
   xstep = (sw << 8) / dw;
   xover = (sw << 8) % dw;
   ystep = (sh << 8) / dh;
   yover = (sh << 8) % dh;
 
+  /* Columns from the last source one on fall back to nearest neighbor.  */
+  ninterp = dw;
+  for (dx = 0, sxf = 0, xfrac = 0; dx < dw; dx++, sxf += xstep, xfrac += xover)
+    {
+      if (xfrac >= dw)
+	{
+	  xfrac -= dw;
+	  sxf++;
+	}
+      cols[dx].offset = (sxf >> 8) * bytes_per_pixel;
+      cols[dx].u = sxf & 0xff;
+      if ((sxf >> 8) >= sw - 1 && ninterp == dw)
+	ninterp = dx;
+    }
+
   for (dy = 0, syf = 0, yfrac = 0; dy < dh; dy++, syf += ystep, yfrac += yover)
     {
       if (yfrac >= dh)
@@ -451,65 +747,61 @@ scale_bilinear (struct grub_video_bitmap *dst, struct grub_video_bitmap *src)
 	}
       sy = syf >> 8;
       dptr = ddata + dy * dstride;
-      dline_end = dptr + dw * bytes_per_pixel;
       sline = sdata + sy * sstride;
-      for (sxf = 0, xfrac = 0; dptr < dline_end; sxf += xstep, xfrac += xover, dptr += bytes_per_pixel)
-        {
-          grub_uint8_t *sptr;
-          int comp;
 
-	  if (xfrac >= dw)
+      dx = 0;
+      if (sy < sh - 1)
+	{
+	  /* Moving down by one line reuses the lower one as the upper.  */
+	  if (line_sy[0] != (int) sy && line_sy[1] == (int) sy)
 	    {
-	      xfrac -= dw;
-	      sxf++;
+	      tmp = lines[0];
+	      lines[0] = lines[1];
+	      lines[1] = tmp;
+	      line_sy[0] = sy;
+	      line_sy[1] = -1;
+	    }
+	  if (line_sy[0] != (int) sy)
+	    {
+	      scale_bilinear_line (lines[0], sline, cols, ninterp,
+				   bytes_per_pixel);
+	      line_sy[0] = sy;
+	    }
+	  if (line_sy[1] != (int) sy + 1)
+	    {
+	      scale_bilinear_line (lines[1], sline + sstride, cols, ninterp,
+				   bytes_per_pixel);
+	      line_sy[1] = sy + 1;
 	    }
 
-          /* Get the address of the pixels in src and dst. */
-	  sx = sxf >> 8;
-	  sptr = sline + sx * bytes_per_pixel;
+	  scale_bilinear_blend (dptr, lines[0], lines[1], syf & 0xff, ninterp,
+				bytes_per_pixel);
+	  dx = ninterp;
+	}
 
-          /* If we have enough space to do so, use bilinear interpolation.
-             Otherwise, fall back to nearest neighbor for this pixel. */
-          if (sx < sw - 1 && sy < sh - 1)
-            {
-              /* Do bilinear interpolation. */
-
-              /* Fixed-point .8 numbers representing the fraction of the
-                 distance in the x (u) and y (v) direction within the
-                 box of 4 pixels in the source. */
-              unsigned u = sxf & 0xff;
-              unsigned v = syf & 0xff;
-
-              for (comp = 0; comp < bytes_per_pixel; comp++)
-                {
-                  /* Get the component's values for the
-                     four source corner pixels. */
-                  unsigned f00 = sptr[comp];
-                  unsigned f10 = sptr[comp + bytes_per_pixel];
-                  unsigned f01 = sptr[comp + sstride];
-                  unsigned f11 = sptr[comp + sstride + bytes_per_pixel];
-
-                  /* Count coeffecients. */
-                  unsigned c00 = (256 - u) * (256 - v);
-                  unsigned c10 = u * (256 - v);
-                  unsigned c01 = (256 - u) * v;
-                  unsigned c11 = u * v;
-
-                  /* Interpolate. */
-                  unsigned fxy = c00 * f00 + c01 * f01 + c10 * f10 + c11 * f11;
-                  fxy = fxy >> 16;
-
-                  dptr[comp] = fxy;
-                }
-            }
-          else
-            {
-              /* Fall back to nearest neighbor interpolation. */
-              /* Copy the pixel color value. */
-              for (comp = 0; comp < bytes_per_pixel; comp++)
-                dptr[comp] = sptr[comp];
-            }
-        }
+      /* Fall back to nearest neighbor interpolation. */
+      for (; dx < dw; dx++)
+	grub_memcpy (dptr + dx * bytes_per_pixel, sline + cols[dx].offset,
+		     bytes_per_pixel);
     }
+
+  grub_free (cols);
+  grub_free (lines[0]);
+  grub_free (lines[1]);
   return GRUB_ERR_NONE;
 }
+
+GRUB_MOD_INIT(bitmap_scale)
+{
+  grub_mm_cache_register (&scale_cache_mm);
+}
+
+GRUB_MOD_FINI(bitmap_scale)
+{
+  struct scale_cache_entry *e;
+
+  grub_mm_cache_unregister (&scale_cache_mm);
+  for (e = scale_cache; e < scale_cache + SCALE_CACHE_SIZE; e++)
+    if (e->bitmap)
+      scale_cache_drop (e);
+}
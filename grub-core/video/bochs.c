@@ -373,7 +373,17 @@ grub_video_bochs_setup (unsigned int width, unsigned int height,
 
   framebuffer.mode_info.blit_format = grub_video_get_blit_format (&framebuffer.mode_info);
 
-  if (BOCHS_APERTURE_SIZE >= 2 * page_size)
+  if (BOCHS_APERTURE_SIZE >= 3 * page_size)
+    {
+      volatile void *pages[3] = { framebuffer.ptr,
+				  framebuffer.ptr + page_size,
+				  framebuffer.ptr + 2 * page_size };
+
+      err = grub_video_fb_setup_pages (mode_type, mode_mask,
+				       &framebuffer.mode_info, pages, 3,
+				       doublebuf_pageflipping_set_page);
+    }
+  else if (BOCHS_APERTURE_SIZE >= 2 * page_size)
     err = grub_video_fb_setup (mode_type, mode_mask,
 			       &framebuffer.mode_info,
 			       framebuffer.ptr,
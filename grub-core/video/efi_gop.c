@@ -21,6 +21,7 @@
 #include <grub/err.h>
 #include <grub/types.h>
 #include <grub/dl.h>
+#include <grub/env.h>
 #include <grub/misc.h>
 #include <grub/mm.h>
 #include <grub/video.h>
@@ -36,20 +37,51 @@ static grub_guid_t graphics_output_guid = GRUB_EFI_GOP_GUID;
 static grub_guid_t active_edid_guid = GRUB_EFI_EDID_ACTIVE_GUID;
 static grub_guid_t discovered_edid_guid = GRUB_EFI_EDID_DISCOVERED_GUID;
 static grub_guid_t efi_var_guid = GRUB_EFI_GLOBAL_VARIABLE_GUID;
+static grub_guid_t dxe_services_guid = GRUB_EFI_DXE_SERVICES_TABLE_GUID;
 static struct grub_efi_gop *gop;
 static unsigned old_mode;
 static int restore_needed;
 static grub_efi_handle_t gop_handle;
 
+/* The framebuffer attributes to put back when it was made write-combining.  */
+static int wc_restore_needed;
+static grub_efi_physical_address_t wc_base;
+static grub_efi_uint64_t wc_length;
+static grub_efi_uint64_t wc_old_attributes;
+
 static int
 grub_video_gop_iterate (int (*hook) (const struct grub_video_mode_info *info, void *hook_arg), void *hook_arg);
 
+/* What QueryMode said about the modes of the GOP on HANDLE, and the
+   preferred size in its EDID.  They don't change while GRUB runs, and some
+   firmware have hundreds of modes and are slow to answer, so they are only
+   asked for once, when a mode is first set.  */
+struct gop_mode
+{
+  unsigned mode;
+  grub_efi_uint32_t width;
+  grub_efi_uint32_t height;
+  unsigned bpp;
+};
+
+static struct
+{
+  grub_efi_handle_t handle;
+  struct gop_mode *modes;
+  unsigned nmodes;
+  grub_efi_handle_t preferred_handle;
+  unsigned int preferred_width;
+  unsigned int preferred_height;
+} mode_cache;
+
 static struct
 {
   struct grub_video_mode_info mode_info;
   struct grub_video_render_target *render_target;
   grub_uint8_t *ptr;
   grub_uint8_t *offscreen;
+  /* Whether the offscreen buffer is copied to PTR rather than blitted.  */
+  int direct;
 } framebuffer;
 
 static int
@@ -98,6 +130,58 @@ check_protocol (void)
   return 0;
 }
 
+/* Make the framebuffer write-combining if the firmware left it uncached,
+   so that writes to it are gathered into bursts.  Return whether it is
+   cached in some way now.  */
+static int
+grub_video_gop_enable_wc (void)
+{
+  grub_efi_dxe_services_t *dxe;
+  grub_efi_gcd_memory_space_descriptor_t desc;
+  grub_efi_physical_address_t base = gop->mode->fb_base;
+  grub_efi_uint64_t length = gop->mode->fb_size;
+  grub_efi_uint64_t attributes;
+
+  dxe = grub_efi_find_configuration_table (&dxe_services_guid);
+  if (!dxe || !base || !length)
+    return 0;
+
+  if (dxe->get_memory_space_descriptor (base, &desc) != GRUB_EFI_SUCCESS
+      || base + length > desc.base_address + desc.length)
+    return 0;
+  if (!(desc.attributes & (GRUB_EFI_MEMORY_UC | GRUB_EFI_MEMORY_UCE)))
+    return 1;
+  if (!(desc.capabilities & GRUB_EFI_MEMORY_WC))
+    return 0;
+
+  attributes = (desc.attributes & ~GRUB_EFI_MEMORY_CACHETYPE_MASK)
+    | GRUB_EFI_MEMORY_WC;
+  if (dxe->set_memory_space_attributes (base, length, attributes)
+      != GRUB_EFI_SUCCESS)
+    return 0;
+
+  grub_dprintf ("video", "GOP: framebuffer @ 0x%llx is write-combining\n",
+		(unsigned long long) base);
+  wc_restore_needed = 1;
+  wc_base = base;
+  wc_length = length;
+  wc_old_attributes = desc.attributes;
+  return 1;
+}
+
+static void
+grub_video_gop_restore_wc (void)
+{
+  grub_efi_dxe_services_t *dxe;
+
+  if (!wc_restore_needed)
+    return;
+  wc_restore_needed = 0;
+  dxe = grub_efi_find_configuration_table (&dxe_services_guid);
+  if (dxe)
+    dxe->set_memory_space_attributes (wc_base, wc_length, wc_old_attributes);
+}
+
 static grub_err_t
 grub_video_gop_init (void)
 {
@@ -113,6 +197,7 @@ grub_video_gop_fini (void)
       gop->set_mode (gop, old_mode);
       restore_needed = 0;
     }
+  grub_video_gop_restore_wc ();
   grub_free (framebuffer.offscreen);
   framebuffer.offscreen = 0;
   return grub_video_fb_fini ();
@@ -262,11 +347,67 @@ grub_video_gop_fill_mode_info (unsigned mode,
 		     | GRUB_VIDEO_MODE_TYPE_UPDATING_SWAP);
 }
 
+static grub_err_t
+grub_video_gop_load_modes (void)
+{
+  unsigned mode;
+
+  if (mode_cache.modes && mode_cache.handle == gop_handle)
+    return GRUB_ERR_NONE;
+
+  grub_free (mode_cache.modes);
+  mode_cache.nmodes = 0;
+  mode_cache.handle = 0;
+  mode_cache.modes = grub_calloc (gop->mode->max_mode ? : 1,
+				  sizeof (mode_cache.modes[0]));
+  if (!mode_cache.modes)
+    return grub_errno;
+
+  for (mode = 0; mode < gop->mode->max_mode; mode++)
+    {
+      grub_efi_uintn_t size;
+      struct grub_efi_gop_mode_info *info = NULL;
+      struct gop_mode *m;
+
+      if (gop->query_mode (gop, mode, &size, &info))
+	continue;
+
+      m = &mode_cache.modes[mode_cache.nmodes++];
+      m->mode = mode;
+      m->width = info->width;
+      m->height = info->height;
+      m->bpp = grub_video_gop_get_bpp (info);
+    }
+
+  mode_cache.handle = gop_handle;
+  return GRUB_ERR_NONE;
+}
+
 static int
 grub_video_gop_iterate (int (*hook) (const struct grub_video_mode_info *info, void *hook_arg), void *hook_arg)
 {
   unsigned mode;
 
+  if (mode_cache.modes && mode_cache.handle == gop_handle)
+    {
+      unsigned i;
+
+      for (i = 0; i < mode_cache.nmodes; i++)
+	{
+	  struct grub_efi_gop_mode_info info = {
+	    .width = mode_cache.modes[i].width,
+	    .height = mode_cache.modes[i].height
+	  };
+	  struct grub_video_mode_info mode_info;
+
+	  grub_video_gop_fill_mode_info (mode_cache.modes[i].mode, &info,
+					 &mode_info);
+	  if (hook (&mode_info, hook_arg))
+	    return 1;
+	}
+      return 0;
+    }
+
   for (mode = 0; mode < gop->mode->max_mode; mode++)
     {
       grub_efi_uintn_t size;
@@ -335,6 +476,13 @@ grub_gop_get_preferred_mode (unsigned int *width, unsigned int *height)
   struct grub_video_edid_info edid_info;
   grub_err_t err;
 
+  if (mode_cache.preferred_handle == gop_handle)
+    {
+      *width = mode_cache.preferred_width;
+      *height = mode_cache.preferred_height;
+      return GRUB_ERR_NONE;
+    }
+
   err = grub_video_gop_get_edid (&edid_info);
   if (err)
     return err;
@@ -374,6 +522,9 @@ grub_video_gop_setup (unsigned int width, unsigned int height,
 	  preferred_height = 600;
 	  grub_errno = GRUB_ERR_NONE;
 	}
+      mode_cache.preferred_handle = gop_handle;
+      mode_cache.preferred_width = preferred_width;
+      mode_cache.preferred_height = preferred_height;
     }
 
   /* Keep current mode if possible.  */
@@ -393,31 +544,29 @@ grub_video_gop_setup (unsigned int width, unsigned int height,
 
   if (!found)
     {
-      unsigned mode;
+      unsigned i;
+
+      err = grub_video_gop_load_modes ();
+      if (err)
+	return err;
+
       grub_dprintf ("video", "GOP: %d modes detected\n", gop->mode->max_mode);
-      for (mode = 0; mode < gop->mode->max_mode; mode++)
+      for (i = 0; i < mode_cache.nmodes; i++)
 	{
-	  grub_efi_uintn_t size;
-	  grub_efi_status_t status;
+	  const struct gop_mode *m = &mode_cache.modes[i];
+	  unsigned mode = m->mode;
 
-	  status = gop->query_mode (gop, mode, &size, &info);
-	  if (status)
-	    {
-	      info = 0;
-	      continue;
-	    }
-
-	  grub_dprintf ("video", "GOP: mode %d: %dx%d\n", mode, info->width,
-			info->height);
+	  grub_dprintf ("video", "GOP: mode %d: %dx%d\n", mode, m->width,
+			m->height);
 
-	  if (preferred_width && (info->width > preferred_width
-				  || info->height > preferred_height))
+	  if (preferred_width && (m->width > preferred_width
+				  || m->height > preferred_height))
 	    {
 	      grub_dprintf ("video", "GOP: mode %d: too large\n", mode);
 	      continue;
 	    }
 
-	  bpp = grub_video_gop_get_bpp (info);
+	  bpp = m->bpp;
 	  if (!bpp)
 	    {
 	      grub_dprintf ("video", "GOP: mode %d: incompatible pixel mode\n",
@@ -427,7 +576,7 @@ grub_video_gop_setup (unsigned int width, unsigned int height,
 
 	  grub_dprintf ("video", "GOP: mode %d: depth %d\n", mode, bpp);
 
-	  if (!(((info->width == width && info->height == height)
+	  if (!(((m->width == width && m->height == height)
 		|| (width == 0 && height == 0))
 		&& (bpp == depth || depth == 0)))
 	    {
@@ -435,12 +584,12 @@ grub_video_gop_setup (unsigned int width, unsigned int height,
 	      continue;
 	    }
 
-	  if (best_volume < ((unsigned long long) info->width)
-	      * ((unsigned long long) info->height)
+	  if (best_volume < ((unsigned long long) m->width)
+	      * ((unsigned long long) m->height)
 	      * ((unsigned long long) bpp))
 	    {
-	      best_volume = ((unsigned long long) info->width)
-		* ((unsigned long long) info->height)
+	      best_volume = ((unsigned long long) m->width)
+		* ((unsigned long long) m->height)
 		* ((unsigned long long) bpp);
 	      best_mode = mode;
 	    }
@@ -454,6 +603,9 @@ grub_video_gop_setup (unsigned int width, unsigned int height,
       return grub_error (GRUB_ERR_UNKNOWN_DEVICE, "no matching mode found");
     }
 
+  grub_video_gop_restore_wc ();
+  framebuffer.direct = 0;
+
   if (best_mode != gop->mode->mode)
     {
       if (!restore_needed)
@@ -489,6 +641,12 @@ grub_video_gop_setup (unsigned int width, unsigned int height,
 				     &framebuffer.mode_info);
       buffer = framebuffer.ptr;
     }
+  /* The offscreen buffer is laid out as the framebuffer is in this format,
+     and a plain copy is much faster than the firmware's blit once the
+     framebuffer is no longer uncached.  */
+  else if (info->pixel_format == GRUB_EFI_GOT_BGRA8
+	   && grub_env_get_bool ("efigop_wc", 0))
+    framebuffer.direct = grub_video_gop_enable_wc ();
 
   grub_dprintf ("video", "GOP: initialising FB @ %p %dx%dx%d\n",
 		framebuffer.ptr, framebuffer.mode_info.width,
@@ -525,7 +683,17 @@ grub_video_gop_setup (unsigned int width, unsigned int height,
 static grub_err_t
 grub_video_gop_swap_buffers (void)
 {
-  if (framebuffer.offscreen)
+  if (framebuffer.direct)
+    {
+      unsigned int y;
+      grub_size_t pitch = (grub_size_t) gop->mode->info->pixels_per_scanline * 4;
+      grub_size_t size = (grub_size_t) framebuffer.mode_info.width * 4;
+
+      for (y = 0; y < framebuffer.mode_info.height; y++)
+	grub_video_fb_copy_to_screen (framebuffer.ptr + y * pitch,
+				      framebuffer.offscreen + y * size, size);
+    }
+  else if (framebuffer.offscreen)
     {
       gop->blt (gop, framebuffer.offscreen,
 		GRUB_EFI_BLT_BUFFER_TO_VIDEO, 0, 0, 0, 0,
@@ -562,8 +730,10 @@ grub_video_gop_get_info_and_fini (struct grub_video_mode_info *mode_info,
 
   grub_video_fb_fini ();
 
+  grub_video_gop_restore_wc ();
   grub_free (framebuffer.offscreen);
   framebuffer.offscreen = 0;
+  framebuffer.direct = 0;
 
   return GRUB_ERR_NONE;
 }
@@ -622,4 +792,6 @@ GRUB_MOD_FINI(efi_gop)
     }
   if (gop)
     grub_video_unregister (&grub_video_gop_adapter);
+  grub_free (mode_cache.modes);
+  mode_cache.modes = 0;
 }
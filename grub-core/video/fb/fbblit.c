@@ -759,6 +759,15 @@ grub_video_fbblit_blend_8bit_indexa (struct grub_video_fbblit_info *dst,
 }
 
 
+/* Exchange the first and the third byte of a 32-bit pixel, which turns
+   RGBX8888 into BGRX8888 and back in either byte order.  */
+static inline grub_uint32_t
+swap_red_blue (grub_uint32_t color)
+{
+  return ((color & 0xff00ff00) | ((color >> 16) & 0xff)
+	  | ((color & 0xff) << 16));
+}
+
 /* Optimized replacing blitter for RGBX8888 to BGRX8888.  */
 static void
 grub_video_fbblit_replace_BGRX8888_RGBX8888 (struct grub_video_fbblit_info *dst,
@@ -769,8 +778,8 @@ grub_video_fbblit_replace_BGRX8888_RGBX8888 (struct grub_video_fbblit_info *dst,
 {
   int i;
   int j;
-  grub_uint8_t *srcptr;
-  grub_uint8_t *dstptr;
+  grub_uint32_t *srcptr;
+  grub_uint32_t *dstptr;
   unsigned int srcrowskip;
   unsigned int dstrowskip;
 
@@ -782,33 +791,14 @@ grub_video_fbblit_replace_BGRX8888_RGBX8888 (struct grub_video_fbblit_info *dst,
   srcptr = grub_video_fb_get_video_ptr (src, offset_x, offset_y);
   dstptr = grub_video_fb_get_video_ptr (dst, x, y);
 
+  /* A whole pixel at a time rather than byte by byte.  */
   for (j = 0; j < height; j++)
     {
       for (i = 0; i < width; i++)
-        {
-#ifdef GRUB_CPU_WORDS_BIGENDIAN
-          grub_uint8_t a = *srcptr++;
-#endif
-          grub_uint8_t r = *srcptr++;
-          grub_uint8_t g = *srcptr++;
-          grub_uint8_t b = *srcptr++;
-#ifndef GRUB_CPU_WORDS_BIGENDIAN
-          grub_uint8_t a = *srcptr++;
-#endif
+	*dstptr++ = swap_red_blue (*srcptr++);
 
-#ifdef GRUB_CPU_WORDS_BIGENDIAN
-          *dstptr++ = a;
-#endif
-          *dstptr++ = b;
-          *dstptr++ = g;
-          *dstptr++ = r;
-#ifndef GRUB_CPU_WORDS_BIGENDIAN
-          *dstptr++ = a;
-#endif
-        }
-
-      srcptr += srcrowskip;
-      dstptr += dstrowskip;
+      GRUB_VIDEO_FB_ADVANCE_POINTER (srcptr, srcrowskip);
+      GRUB_VIDEO_FB_ADVANCE_POINTER (dstptr, dstrowskip);
     }
 }
 
@@ -1159,6 +1149,25 @@ alpha_dilute (grub_uint8_t bg, grub_uint8_t fg, grub_uint8_t alpha)
   return h;
 }
 
+/*
+ * alpha_dilute on the three lower channels of the 32-bit pixels BG and FG,
+ * giving the same results.  Red and blue sit in separate 16-bit halves of the word, so
+ * one multiplication serves both, and the division by 255 is done on both
+ * halves at once: (s + 1 + (s >> 8)) >> 8 is what alpha_dilute computes,
+ * and it never carries out of its half.
+ */
+static inline grub_uint32_t
+alpha_dilute32 (grub_uint32_t bg, grub_uint32_t fg, unsigned int alpha)
+{
+  grub_uint32_t rb, g;
+
+  rb = (fg & 0xff00ff) * alpha + (bg & 0xff00ff) * (255 ^ alpha);
+  rb = ((rb + 0x10001 + ((rb >> 8) & 0xff00ff)) >> 8) & 0xff00ff;
+  g = ((fg >> 8) & 0xff) * alpha + ((bg >> 8) & 0xff) * (255 ^ alpha);
+  g = (g + 1 + (g >> 8)) >> 8;
+  return rb | (g << 8);
+}
+
 /* Generic blending blitter.  Works for every supported format.  */
 static void
 grub_video_fbblit_blend (struct grub_video_fbblit_info *dst,
@@ -1245,13 +1254,7 @@ grub_video_fbblit_blend_BGRA8888_RGBA8888 (struct grub_video_fbblit_info *dst,
       for (i = 0; i < width; i++)
         {
           grub_uint32_t color;
-          unsigned int sr;
-          unsigned int sg;
-          unsigned int sb;
           unsigned int a;
-          unsigned int dr;
-          unsigned int dg;
-          unsigned int db;
 
           color = *srcptr++;
 
@@ -1264,31 +1267,11 @@ grub_video_fbblit_blend_BGRA8888_RGBA8888 (struct grub_video_fbblit_info *dst,
               continue;
             }
 
-          sr = (color >> 0) & 0xFF;
-          sg = (color >> 8) & 0xFF;
-          sb = (color >> 16) & 0xFF;
-
-          if (a == 255)
-            {
-              /* Opaque pixel shortcut.  */
-              dr = sr;
-              dg = sg;
-              db = sb;
-            }
-          else
-            {
-              /* General pixel color blending.  */
-              color = *dstptr;
-
-              dr = (color >> 16) & 0xFF;
-              dr = alpha_dilute (dr, sr, a);
-              dg = (color >> 8) & 0xFF;
-              dg = alpha_dilute (dg, sg, a);
-              db = (color >> 0) & 0xFF;
-              db = alpha_dilute (db, sb, a);
-            }
+          color = swap_red_blue (color);
 
-          color = (a << 24) | (dr << 16) | (dg << 8) | db;
+          /* Opaque pixels are copied as they are.  */
+          if (a != 255)
+            color = (a << 24) | alpha_dilute32 (*dstptr, color, a);
 
           *dstptr++ = color;
         }
@@ -1405,13 +1388,7 @@ grub_video_fbblit_blend_RGBA8888_RGBA8888 (struct grub_video_fbblit_info *dst,
   int j;
   grub_uint32_t *srcptr;
   grub_uint32_t *dstptr;
-  unsigned int sr;
-  unsigned int sg;
-  unsigned int sb;
   unsigned int a;
-  unsigned int dr;
-  unsigned int dg;
-  unsigned int db;
   grub_size_t srcrowskip;
   grub_size_t dstrowskip;
 
@@ -1441,23 +1418,8 @@ grub_video_fbblit_blend_RGBA8888_RGBA8888 (struct grub_video_fbblit_info *dst,
               continue;
             }
 
-          sr = (color >> 0) & 0xFF;
-          sg = (color >> 8) & 0xFF;
-          sb = (color >> 16) & 0xFF;
-
-          color = *dstptr;
-
-          dr = (color >> 0) & 0xFF;
-          dg = (color >> 8) & 0xFF;
-          db = (color >> 16) & 0xFF;
-
-          dr = alpha_dilute (dr, sr, a);
-          dg = alpha_dilute (dg, sg, a);
-          db = alpha_dilute (db, sb, a);
-
-          color = (a << 24) | (db << 16) | (dg << 8) | dr;
-
-          *dstptr++ = color;
+          *dstptr = (a << 24) | alpha_dilute32 (*dstptr, color, a);
+          dstptr++;
         }
       GRUB_VIDEO_FB_ADVANCE_POINTER (srcptr, srcrowskip);
       GRUB_VIDEO_FB_ADVANCE_POINTER (dstptr, dstrowskip);
@@ -2031,6 +1993,15 @@ grub_video_fb_dispatch_blit (struct grub_video_fbblit_info *target,
 	    }
 	  break;
 	case GRUB_VIDEO_BLIT_FORMAT_INDEXCOLOR_ALPHA:
+	  /* Between two such render targets the pixels stay as they are.  */
+	  if (target->mode_info->blit_format
+	      == GRUB_VIDEO_BLIT_FORMAT_INDEXCOLOR_ALPHA)
+	    {
+	      grub_video_fbblit_replace_directN (target, source,
+						 x, y, width, height,
+						 offset_x, offset_y);
+	      return;
+	    }
 	  switch (target->mode_info->bytes_per_pixel)
 	    {
 	    case 4:
@@ -47,6 +47,33 @@ grub_video_fbfill (struct grub_video_fbblit_info *dst,
       set_pixel (dst, x + i, y + j, color);
 }
 
+/* Set N pixels at DSTPTR to COLOR.  */
+static inline void
+fill32 (grub_uint32_t *dstptr, grub_uint32_t color, grub_size_t n)
+{
+#if defined (__i386__) || defined (__x86_64__)
+  /* The string instructions need no SIMD state and write whole lines of
+     the framebuffer at a time.  */
+  asm volatile ("rep stosl"
+		: "+D" (dstptr), "+c" (n) : "a" (color) : "memory");
+#else
+#if GRUB_CPU_SIZEOF_VOID_P == 8
+  grub_uint64_t pattern = ((grub_uint64_t) color << 32) | color;
+
+  /* Two pixels at a time once aligned.  */
+  if (n && ((grub_addr_t) dstptr & 4))
+    {
+      *dstptr++ = color;
+      n--;
+    }
+  for (; n >= 2; n -= 2, dstptr += 2)
+    *(grub_uint64_t *) dstptr = pattern;
+#endif
+  while (n--)
+    *dstptr++ = color;
+#endif
+}
+
 /* Optimized filler for direct color 32 bit modes.  It is assumed that color
    is already mapped to destination format.  */
 static void
@@ -54,7 +81,7 @@ grub_video_fbfill_direct32 (struct grub_video_fbblit_info *dst,
 			    grub_video_color_t color, int x, int y,
 			    unsigned int width, unsigned int height)
 {
-  unsigned int i, j;
+  unsigned int j;
   grub_uint32_t *dstptr;
   grub_size_t rowskip;
 
@@ -67,10 +94,17 @@ grub_video_fbfill_direct32 (struct grub_video_fbblit_info *dst,
   /* Get the start address.  */
   dstptr = grub_video_fb_get_video_ptr (dst, x, y);
 
+  /* Lines without a gap in between are filled in one go.  */
+  if (rowskip == 0)
+    {
+      fill32 (dstptr, color, (grub_size_t) width * height);
+      return;
+    }
+
   for (j = 0; j < height; j++)
     {
-      for (i = 0; i < width; i++)
-        *dstptr++ = color;
+      fill32 (dstptr, color, width);
+      dstptr += width;
 
       /* Advance the dest pointer to the right location on the next line.  */
       GRUB_VIDEO_FB_ADVANCE_POINTER (dstptr, rowskip);
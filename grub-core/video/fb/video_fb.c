@@ -26,16 +26,28 @@
 #include <grub/bitmap.h>
 #include <grub/dl.h>
 #include <grub/safemath.h>
+#include <grub/time.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
 typedef grub_err_t (*grub_video_fb_doublebuf_update_screen_t) (void);
 typedef volatile void *framebuf_t;
 
+/* Rectangles of the back buffer changed since the last update.  Those
+   that overlap or touch are merged, and once the list is full a new one
+   is merged into the rectangle it enlarges least.  */
+#define DIRTY_MAX_RECTS	8
+
+struct dirty_rect
+{
+  int x1, y1;
+  int x2, y2;
+};
+
 struct dirty
 {
-  int first_line;
-  int last_line;
+  int count;
+  struct dirty_rect rects[DIRTY_MAX_RECTS];
 };
 
 static struct
@@ -43,16 +55,20 @@ static struct
   struct grub_video_fbrender_target *render_target;
   struct grub_video_fbrender_target *back_target;
   struct grub_video_palette_data *palette;
-  framebuf_t pages[2];
+  framebuf_t pages[GRUB_VIDEO_FB_MAX_PAGES];
 
   unsigned int palette_size;
 
   struct dirty current_dirty;
-  struct dirty previous_dirty;
+  /* What changed in the frames shown since the back buffer page was last
+     brought up to date, most recent first.  */
+  struct dirty previous_dirty[GRUB_VIDEO_FB_MAX_PAGES - 1];
 
   /* For page flipping strategy.  */
+  int page_count;
   int displayed_page;           /* The page # that is the front buffer.  */
   int render_page;              /* The page # that is the back buffer.  */
+  grub_uint64_t last_flip;
   grub_video_fb_set_page_t set_page;
   char *offscreen_buffer;
   grub_video_fb_doublebuf_update_screen_t update_screen;
@@ -830,15 +846,135 @@ grub_video_fb_unmap_color_int (struct grub_video_fbblit_info * source,
     }
 }
 
+static grub_uint64_t
+dirty_rect_area (const struct dirty_rect *r)
+{
+  return (grub_uint64_t) (r->x2 - r->x1) * (r->y2 - r->y1);
+}
+
+static void
+dirty_rect_union (struct dirty_rect *r, const struct dirty_rect *other)
+{
+  if (r->x1 > other->x1)
+    r->x1 = other->x1;
+  if (r->y1 > other->y1)
+    r->y1 = other->y1;
+  if (r->x2 < other->x2)
+    r->x2 = other->x2;
+  if (r->y2 < other->y2)
+    r->y2 = other->y2;
+}
+
 static void
-dirty (int y, int height)
+dirty_add (struct dirty *d, struct dirty_rect r)
 {
+  struct dirty_rect u;
+  grub_uint64_t cost, best_cost = 0;
+  int i, best = 0;
+
+  if (r.x1 >= r.x2 || r.y1 >= r.y2)
+    return;
+
+  /* Merging may make the result touch rectangles it did not before.  */
+  for (i = 0; i < d->count; i++)
+    if (r.x1 <= d->rects[i].x2 && d->rects[i].x1 <= r.x2
+	&& r.y1 <= d->rects[i].y2 && d->rects[i].y1 <= r.y2)
+      {
+	dirty_rect_union (&r, &d->rects[i]);
+	d->rects[i] = d->rects[--d->count];
+	i = -1;
+      }
+
+  if (d->count < DIRTY_MAX_RECTS)
+    {
+      d->rects[d->count++] = r;
+      return;
+    }
+
+  for (i = 0; i < d->count; i++)
+    {
+      u = d->rects[i];
+      dirty_rect_union (&u, &r);
+      cost = dirty_rect_area (&u) - dirty_rect_area (&d->rects[i]);
+      if (i == 0 || cost < best_cost)
+	{
+	  best = i;
+	  best_cost = cost;
+	}
+    }
+  dirty_rect_union (&d->rects[best], &r);
+}
+
+static void
+dirty (int x, int y, int width, int height)
+{
+  struct dirty_rect r;
+
   if (framebuffer.render_target != framebuffer.back_target)
     return;
-  if (framebuffer.current_dirty.first_line > y)
-    framebuffer.current_dirty.first_line = y;
-  if (framebuffer.current_dirty.last_line < y + height)
-    framebuffer.current_dirty.last_line = y + height;
+  r.x1 = x;
+  r.y1 = y;
+  r.x2 = x + width;
+  r.y2 = y + height;
+  dirty_add (&framebuffer.current_dirty, r);
+}
+
+/* Copy SIZE bytes to video memory.  The copy is never read back, so on
+   x86_64 it is written with non-temporal stores: they leave the cache
+   alone and are combined into full bursts on write-combining memory
+   rather than each waiting for the bus on uncached memory.  */
+void
+grub_video_fb_copy_to_screen (volatile void *dst, const void *src,
+			      grub_size_t size)
+{
+#ifdef __x86_64__
+  grub_uint8_t *d = (grub_uint8_t *) dst;
+  const grub_uint8_t *s = src;
+
+  for (; size && ((grub_addr_t) d & 7); size--)
+    *d++ = *s++;
+  for (; size >= 8; size -= 8, d += 8, s += 8)
+    asm volatile ("movnti %1, %0" : "=m" (*(grub_uint64_t *) d)
+		  : "r" (grub_get_unaligned64 (s)));
+  for (; size; size--)
+    *d++ = *s++;
+  /* Non-temporal stores are weakly ordered.  */
+  asm volatile ("sfence" : : : "memory");
+#else
+  grub_memcpy ((void *) dst, src, size);
+#endif
+}
+
+/* Copy the rectangles in D from the back buffer to PAGE.  */
+static void
+dirty_flush (const struct dirty *d, volatile void *page)
+{
+  struct grub_video_mode_info *mode_info = &framebuffer.back_target->mode_info;
+  grub_size_t offset, size;
+  int i, y;
+
+  for (i = 0; i < d->count; i++)
+    {
+      const struct dirty_rect *r = &d->rects[i];
+
+      offset = (grub_size_t) r->y1 * mode_info->pitch
+	+ (grub_size_t) r->x1 * mode_info->bytes_per_pixel;
+      size = (grub_size_t) (r->x2 - r->x1) * mode_info->bytes_per_pixel;
+
+      /* Whole lines are contiguous.  */
+      if (r->x1 == 0 && r->x2 == (int) mode_info->width)
+	{
+	  grub_video_fb_copy_to_screen ((char *) page + offset,
+					(char *) framebuffer.back_target->data + offset,
+					(grub_size_t) (r->y2 - r->y1) * mode_info->pitch);
+	  continue;
+	}
+
+      for (y = r->y1; y < r->y2; y++, offset += mode_info->pitch)
+	grub_video_fb_copy_to_screen ((char *) page + offset,
+				      (char *) framebuffer.back_target->data + offset,
+				      size);
+    }
 }
 
 grub_err_t
@@ -896,7 +1032,7 @@ grub_video_fb_fill_rect (grub_video_color_t color, int x, int y,
   x += area_x;
   y += area_y;
 
-  dirty (y, height);
+  dirty (x, y, width, height);
 
   /* Use fbblit_info to encapsulate rendering.  */
   target.mode_info = &framebuffer.render_target->mode_info;
@@ -1009,7 +1145,7 @@ grub_video_fb_blit_source (struct grub_video_fbblit_info *source,
   target.data = framebuffer.render_target->data;
 
   /* Do actual blitting.  */
-  dirty (y, height);
+  dirty (x, y, width, height);
   grub_video_fb_dispatch_blit (&target, source, oper, x, y, width, height,
                                offset_x, offset_y);
 
@@ -1061,7 +1197,9 @@ grub_video_fb_scroll (grub_video_color_t color, int dx, int dy)
   width = framebuffer.render_target->viewport.width - grub_abs (dx);
   height = framebuffer.render_target->viewport.height - grub_abs (dy);
 
-  dirty (framebuffer.render_target->viewport.y,
+  dirty (framebuffer.render_target->viewport.x,
+	 framebuffer.render_target->viewport.y,
+	 framebuffer.render_target->viewport.width,
 	 framebuffer.render_target->viewport.height);
 
   if (dx < 0)
@@ -1416,28 +1554,8 @@ grub_video_fb_get_active_render_target (struct grub_video_fbrender_target **targ
 static grub_err_t
 doublebuf_blit_update_screen (void)
 {
-  if (framebuffer.current_dirty.first_line
-      <= framebuffer.current_dirty.last_line)
-    {
-      grub_size_t copy_size;
-
-      if (grub_sub (framebuffer.current_dirty.last_line,
-		    framebuffer.current_dirty.first_line, &copy_size) ||
-	  grub_mul (framebuffer.back_target->mode_info.pitch, copy_size, &copy_size))
-	{
-	  /* Shouldn't happen, but if it does we've a bug. */
-	  return GRUB_ERR_BUG;
-	}
-
-      grub_memcpy ((char *) framebuffer.pages[0] + framebuffer.current_dirty.first_line *
-		   framebuffer.back_target->mode_info.pitch,
-		   (char *) framebuffer.back_target->data + framebuffer.current_dirty.first_line *
-		   framebuffer.back_target->mode_info.pitch,
-		   copy_size);
-    }
-  framebuffer.current_dirty.first_line
-    = framebuffer.back_target->mode_info.height;
-  framebuffer.current_dirty.last_line = 0;
+  dirty_flush (&framebuffer.current_dirty, framebuffer.pages[0]);
+  framebuffer.current_dirty.count = 0;
 
   return GRUB_ERR_NONE;
 }
@@ -1470,8 +1588,7 @@ grub_video_fb_doublebuf_blit_init (struct grub_video_fbrender_target **back,
   framebuffer.pages[0] = framebuf;
   framebuffer.displayed_page = 0;
   framebuffer.render_page = 0;
-  framebuffer.current_dirty.first_line = mode_info.height;
-  framebuffer.current_dirty.last_line = 0;
+  framebuffer.current_dirty.count = 0;
 
   return GRUB_ERR_NONE;
 }
@@ -1479,63 +1596,56 @@ grub_video_fb_doublebuf_blit_init (struct grub_video_fbrender_target **back,
 static grub_err_t
 doublebuf_pageflipping_update_screen (void)
 {
-  int new_displayed_page;
+  int old_displayed_page, old_render_page;
   grub_err_t err;
-  int first_line, last_line;
-
-  first_line = framebuffer.current_dirty.first_line;
-  last_line = framebuffer.current_dirty.last_line;
-  if (first_line > framebuffer.previous_dirty.first_line)
-    first_line = framebuffer.previous_dirty.first_line;
-  if (last_line < framebuffer.previous_dirty.last_line)
-    last_line = framebuffer.previous_dirty.last_line;
-
-  if (first_line <= last_line)
-    {
-      grub_size_t copy_size;
-
-      if (grub_sub (last_line, first_line, &copy_size) ||
-	  grub_mul (framebuffer.back_target->mode_info.pitch, copy_size, &copy_size))
-	{
-	  /* Shouldn't happen, but if it does we've a bug. */
-	  return GRUB_ERR_BUG;
-	}
-
-      grub_memcpy ((char *) framebuffer.pages[framebuffer.render_page] + first_line *
-		   framebuffer.back_target->mode_info.pitch,
-		   (char *) framebuffer.back_target->data + first_line *
-		   framebuffer.back_target->mode_info.pitch,
-		   copy_size);
-    }
-
-  framebuffer.previous_dirty = framebuffer.current_dirty;
-  framebuffer.current_dirty.first_line
-    = framebuffer.back_target->mode_info.height;
-  framebuffer.current_dirty.last_line = 0;
-
-  /* Swap the page numbers in the framebuffer struct.  */
-  new_displayed_page = framebuffer.render_page;
-  framebuffer.render_page = framebuffer.displayed_page;
-  framebuffer.displayed_page = new_displayed_page;
+  struct dirty all;
+  int i, j;
+
+  /* The page about to be shown still lacks what changed for the pages
+     shown since it was last drawn.  */
+  all = framebuffer.current_dirty;
+  for (j = 0; j < framebuffer.page_count - 1; j++)
+    for (i = 0; i < framebuffer.previous_dirty[j].count; i++)
+      dirty_add (&all, framebuffer.previous_dirty[j].rects[i]);
+  dirty_flush (&all, framebuffer.pages[framebuffer.render_page]);
+
+  /* A flip only takes effect at the next vertical retrace, so flipping
+     again within the same frame would make the page still being scanned
+     out the next back buffer.  Pace flips to the display refresh.  */
+  while (grub_get_time_ms () - framebuffer.last_flip
+	 < GRUB_VIDEO_FB_FRAME_MS)
+    grub_cpu_idle ();
+
+  old_displayed_page = framebuffer.displayed_page;
+  old_render_page = framebuffer.render_page;
+  framebuffer.displayed_page = framebuffer.render_page;
+  framebuffer.render_page = (framebuffer.render_page + 1)
+    % framebuffer.page_count;
 
   err = framebuffer.set_page (framebuffer.displayed_page);
   if (err)
     {
       /* Restore previous state.  */
-      framebuffer.render_page = framebuffer.displayed_page;
-      framebuffer.displayed_page = new_displayed_page;
+      framebuffer.displayed_page = old_displayed_page;
+      framebuffer.render_page = old_render_page;
       return err;
     }
+  framebuffer.last_flip = grub_get_time_ms ();
+
+  for (j = framebuffer.page_count - 2; j > 0; j--)
+    framebuffer.previous_dirty[j] = framebuffer.previous_dirty[j - 1];
+  framebuffer.previous_dirty[0] = framebuffer.current_dirty;
+  framebuffer.current_dirty.count = 0;
 
   return GRUB_ERR_NONE;
 }
 
 static grub_err_t
 doublebuf_pageflipping_init (struct grub_video_mode_info *mode_info,
-			     volatile void *page0_ptr,
-			     grub_video_fb_set_page_t set_page_in,
-			     volatile void *page1_ptr)
+			     volatile void **pages, int page_count,
+			     grub_video_fb_set_page_t set_page_in)
 {
+  int i;
   grub_err_t err;
   grub_size_t page_size = 0;
 
@@ -1563,19 +1673,18 @@ doublebuf_pageflipping_init (struct grub_video_mode_info *mode_info,
     }
   framebuffer.back_target->is_allocated = 1;
 
+  framebuffer.page_count = page_count;
   framebuffer.displayed_page = 0;
   framebuffer.render_page = 1;
+  framebuffer.last_flip = 0;
 
   framebuffer.update_screen = doublebuf_pageflipping_update_screen;
-  framebuffer.pages[0] = page0_ptr;
-  framebuffer.pages[1] = page1_ptr;
+  for (i = 0; i < page_count; i++)
+    framebuffer.pages[i] = pages[i];
 
-  framebuffer.current_dirty.first_line
-    = framebuffer.back_target->mode_info.height;
-  framebuffer.current_dirty.last_line = 0;
-  framebuffer.previous_dirty.first_line
-    = framebuffer.back_target->mode_info.height;
-  framebuffer.previous_dirty.last_line = 0;
+  framebuffer.current_dirty.count = 0;
+  for (i = 0; i < page_count - 1; i++)
+    framebuffer.previous_dirty[i].count = 0;
 
   /* Set the framebuffer memory data pointer and display the right page.  */
   err = set_page_in (framebuffer.displayed_page);
@@ -1596,20 +1705,39 @@ grub_video_fb_setup (unsigned int mode_type, unsigned int mode_mask,
 		     volatile void *page0_ptr,
 		     grub_video_fb_set_page_t set_page_in,
 		     volatile void *page1_ptr)
+{
+  volatile void *pages[2] = { page0_ptr, page1_ptr };
+
+  return grub_video_fb_setup_pages (mode_type, mode_mask, mode_info,
+				    pages, set_page_in ? 2 : 1, set_page_in);
+}
+
+/* Like grub_video_fb_setup, but with PAGE_COUNT pages of video memory
+   that SET_PAGE_IN can display.  With three pages drawing never touches
+   a page that may still be on screen until the next retrace.  */
+grub_err_t
+grub_video_fb_setup_pages (unsigned int mode_type, unsigned int mode_mask,
+			   struct grub_video_mode_info *mode_info,
+			   volatile void **pages, int page_count,
+			   grub_video_fb_set_page_t set_page_in)
 {
   grub_err_t err;
+  volatile void *page0_ptr = pages[0];
+
+  if (page_count > GRUB_VIDEO_FB_MAX_PAGES)
+    page_count = GRUB_VIDEO_FB_MAX_PAGES;
 
   /* Do double buffering only if it's either requested or efficient.  */
-  if (set_page_in && grub_video_check_mode_flag (mode_type, mode_mask,
-						 GRUB_VIDEO_MODE_TYPE_DOUBLE_BUFFERED,
-						 1))
+  if (set_page_in && page_count >= 2
+      && grub_video_check_mode_flag (mode_type, mode_mask,
+				     GRUB_VIDEO_MODE_TYPE_DOUBLE_BUFFERED,
+				     1))
     {
       mode_info->mode_type |= GRUB_VIDEO_MODE_TYPE_DOUBLE_BUFFERED;
       mode_info->mode_type |= GRUB_VIDEO_MODE_TYPE_UPDATING_SWAP;
 
-      err = doublebuf_pageflipping_init (mode_info, page0_ptr,
-					 set_page_in,
-					 page1_ptr);
+      err = doublebuf_pageflipping_init (mode_info, pages, page_count,
+					 set_page_in);
       if (!err)
 	{
 	  framebuffer.render_target = framebuffer.back_target;
@@ -1661,9 +1789,7 @@ grub_video_fb_setup (unsigned int mode_type, unsigned int mode_mask,
   framebuffer.displayed_page = 0;
   framebuffer.render_page = 0;
   framebuffer.set_page = 0;
-  framebuffer.current_dirty.first_line
-    = framebuffer.back_target->mode_info.height;
-  framebuffer.current_dirty.last_line = 0;
+  framebuffer.current_dirty.count = 0;
 
   mode_info->mode_type &= ~GRUB_VIDEO_MODE_TYPE_DOUBLE_BUFFERED;
 
@@ -1696,10 +1822,10 @@ grub_video_fb_get_info_and_fini (struct grub_video_mode_info *mode_info,
 
   /* We are about to load a kernel.  Switch back to page zero, since some
      kernel drivers expect that.  */
-  if (framebuffer.set_page && framebuffer.displayed_page != 0)
-    {
-      framebuffer.update_screen ();
-    }
+  if (framebuffer.set_page)
+    while (framebuffer.displayed_page != 0)
+      if (framebuffer.update_screen ())
+	break;
 
   *framebuf = (void *) framebuffer.pages[framebuffer.displayed_page];
 
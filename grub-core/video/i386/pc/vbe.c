@@ -46,6 +46,8 @@ static struct
 
   grub_uint8_t *ptr;
   int mtrr;
+  /* Whether a page flip waits for the vertical retrace.  */
+  int flip_wait;
 } framebuffer;
 
 static grub_uint32_t initial_vbe_mode;
@@ -376,9 +378,10 @@ grub_vbe_bios_get_scanline_length (grub_uint32_t *length)
   return regs.eax & 0xffff;
 }
 
-/* Call VESA BIOS 0x4f07 to set display start, return status.  */
+/* Call VESA BIOS 0x4f07 to set display start, return status.  If WAIT,
+   the change is made during the vertical retrace.  */
 static grub_vbe_status_t
-grub_vbe_bios_set_display_start (grub_uint32_t x, grub_uint32_t y)
+grub_vbe_bios_set_display_start (grub_uint32_t x, grub_uint32_t y, int wait)
 {
   struct grub_bios_int_registers regs;
 
@@ -389,8 +392,9 @@ grub_vbe_bios_set_display_start (grub_uint32_t x, grub_uint32_t y)
   regs.ecx = x;
   regs.edx = y;
   regs.eax = 0x4f07;
-  /* BL = 80h, Set Display Start during Vertical Retrace.  */
-  regs.ebx = 0x0080;
+  /* BL = 80h, Set Display Start during Vertical Retrace, or BL = 0,
+     Set Display Start.  */
+  regs.ebx = wait ? 0x0080 : 0;
   regs.flags = GRUB_CPU_INT_FLAGS_DEFAULT;
   grub_bios_interrupt (0x10, &regs);
 
@@ -847,7 +851,8 @@ doublebuf_pageflipping_set_page (int page)
     = framebuffer.mode_info.height * page;
 
   grub_vbe_status_t vbe_err =
-    grub_vbe_bios_set_display_start (0, display_start_line);
+    grub_vbe_bios_set_display_start (0, display_start_line,
+				     framebuffer.flip_wait);
 
   if (vbe_err != GRUB_VBE_STATUS_OK)
     return grub_error (GRUB_ERR_IO, "couldn't commit pageflip");
@@ -1122,12 +1127,29 @@ grub_video_vbe_setup (unsigned int width, unsigned int height,
 
 	page_size = framebuffer.mode_info.pitch * framebuffer.mode_info.height;
 
-	if (vram_size >= 2 * page_size)
-	  err = grub_video_fb_setup (mode_type, mode_mask,
-				     &framebuffer.mode_info,
-				     framebuffer.ptr,
-				     doublebuf_pageflipping_set_page,
-				     framebuffer.ptr + page_size);
+	/* With a third page nothing is drawn to the page that may be on
+	   screen until the retrace, so flips need not wait for it.  */
+	if (vram_size >= 3 * page_size)
+	  {
+	    volatile void *pages[3] = { framebuffer.ptr,
+					framebuffer.ptr + page_size,
+					framebuffer.ptr + 2 * page_size };
+
+	    framebuffer.flip_wait = 0;
+	    err = grub_video_fb_setup_pages (mode_type, mode_mask,
+					     &framebuffer.mode_info,
+					     pages, 3,
+					     doublebuf_pageflipping_set_page);
+	  }
+	else if (vram_size >= 2 * page_size)
+	  {
+	    framebuffer.flip_wait = 1;
+	    err = grub_video_fb_setup (mode_type, mode_mask,
+				       &framebuffer.mode_info,
+				       framebuffer.ptr,
+				       doublebuf_pageflipping_set_page,
+				       framebuffer.ptr + page_size);
+	  }
 	else
 	  err = grub_video_fb_setup (mode_type, mode_mask,
 				     &framebuffer.mode_info,
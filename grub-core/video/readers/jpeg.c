@@ -58,6 +58,15 @@ enum
 
 #define JPEG_UNIT_SIZE		8
 
+/* Huffman codes up to this many bits long are decoded with one lookup.  */
+#define JPEG_HUFF_LOOKAHEAD	9
+
+/* Size of the buffer entropy-coded data is read into.  */
+#define JPEG_INPUT_SIZE		4096
+
+/* In the AAN IDCT, the first pass keeps this many more bits of precision.  */
+#define JPEG_PASS1_BITS		5
+
 static const grub_uint8_t jpeg_zigzag_order[64] = {
   0, 1, 8, 16, 9, 2, 3, 10,
   17, 24, 32, 25, 18, 11, 4, 5,
@@ -69,6 +78,20 @@ static const grub_uint8_t jpeg_zigzag_order[64] = {
   53, 60, 61, 54, 47, 55, 62, 63
 };
 
+/* Scale factors of the AAN IDCT, 16384 * s(u) * s(v) with s(0) = 1 and
+   s(k) = cos (k * pi / 16) * sqrt (2), which are folded into the
+   dequantization.  */
+static const grub_uint16_t jpeg_aan_scales[64] = {
+  16384, 22725, 21407, 19266, 16384, 12873,  8867,  4520,
+  22725, 31521, 29692, 26722, 22725, 17855, 12299,  6270,
+  21407, 29692, 27969, 25172, 21407, 16819, 11585,  5906,
+  19266, 26722, 25172, 22654, 19266, 15137, 10426,  5315,
+  16384, 22725, 21407, 19266, 16384, 12873,  8867,  4520,
+  12873, 17855, 16819, 15137, 12873, 10114,  6967,  3552,
+   8867, 12299, 11585, 10426,  8867,  6967,  4799,  2446,
+   4520,  6270,  5906,  5315,  4520,  3552,  2446,  1247
+};
+
 #ifdef JPEG_DEBUG
 static grub_command_t cmd;
 #endif
@@ -87,8 +110,13 @@ struct grub_jpeg_data
   grub_uint8_t *huff_value[4];
   int huff_offset[4][16];
   int huff_maxval[4][16];
+  /* Length in the high byte and value in the low byte of the codes which
+     start with each JPEG_HUFF_LOOKAHEAD bits, or 0 for longer codes.  */
+  grub_uint16_t huff_lookup[4][1 << JPEG_HUFF_LOOKAHEAD];
 
-  grub_uint8_t quan_table[2][64];
+  /* Quantization tables in zigzag order, multiplied by the AAN scale
+     factors with JPEG_PASS1_BITS of fraction.  */
+  int quan_table[2][64];
   int comp_index[3][3];
 
   jpeg_data_unit_t ydu[4];
@@ -103,7 +131,20 @@ struct grub_jpeg_data
 
   int color_components;
 
-  int bit_mask, bit_save;
+  /* Entropy-coded data read ahead, IN_BUF starting at IN_OFFSET in the
+     file.  */
+  grub_uint8_t in_buf[JPEG_INPUT_SIZE];
+  unsigned in_pos, in_len;
+  grub_off_t in_offset;
+
+  /* Bits not used yet, starting at the most significant one.  */
+  grub_uint32_t bit_buf;
+  int bit_count;
+
+  /* Whether the data was read up to the marker ending it, at
+     MARKER_OFFSET.  Zeros are used from there on.  */
+  int marker_hit;
+  grub_off_t marker_offset;
 };
 
 static grub_uint8_t
@@ -144,53 +185,113 @@ grub_jpeg_get_word (struct grub_jpeg_data *data)
   return grub_be_to_cpu16 (r);
 }
 
+/* Return the next byte of entropy-coded data, or -1 at the end of the
+   file.  */
 static int
-grub_jpeg_get_bit (struct grub_jpeg_data *data)
+grub_jpeg_input_byte (struct grub_jpeg_data *data)
 {
-  int ret;
+  grub_ssize_t n;
 
-  if (data->bit_mask == 0)
+  if (data->in_pos == data->in_len)
     {
-      data->bit_save = grub_jpeg_get_byte (data);
-      if (grub_errno != GRUB_ERR_NONE) {
-	grub_error (GRUB_ERR_BAD_FILE_TYPE,
-		    "jpeg: file read error");
-	return 0;
-      }
-      if (data->bit_save == JPEG_ESC_CHAR)
+      data->in_offset += data->in_len;
+      data->in_pos = data->in_len = 0;
+      n = grub_file_read (data->file, data->in_buf, sizeof (data->in_buf));
+      if (n <= 0)
+	return -1;
+      data->in_len = n;
+    }
+
+  return data->in_buf[data->in_pos++];
+}
+
+/* Return the next byte of entropy-coded data with stuffing removed, or -1
+   at the marker which ends the data.  */
+static int
+grub_jpeg_next_data_byte (struct grub_jpeg_data *data)
+{
+  grub_off_t offset = data->in_offset + data->in_pos;
+  int c;
+
+  c = grub_jpeg_input_byte (data);
+  if (c == JPEG_ESC_CHAR && grub_jpeg_input_byte (data) == 0)
+    return c;
+  if (c >= 0 && c != JPEG_ESC_CHAR)
+    return c;
+
+  data->marker_hit = 1;
+  data->marker_offset = offset;
+  return -1;
+}
+
+/* Have at least 25 bits in the bit buffer.  */
+static void
+grub_jpeg_fill_bits (struct grub_jpeg_data *data)
+{
+  int c;
+
+  while (data->bit_count <= 24)
+    {
+      c = 0;
+      if (!data->marker_hit)
 	{
-	  if (grub_jpeg_get_byte (data) != 0)
-	    {
-	      grub_error (GRUB_ERR_BAD_FILE_TYPE,
-			  "jpeg: invalid 0xFF in data stream");
-	      return 0;
-	    }
-	  if (grub_errno != GRUB_ERR_NONE)
-	    {
-	      grub_error (GRUB_ERR_BAD_FILE_TYPE, "jpeg: file read error");
-	      return 0;
-	    }
+	  c = grub_jpeg_next_data_byte (data);
+	  if (c < 0 && data->marker_offset >= data->file->size)
+	    grub_error (GRUB_ERR_BAD_FILE_TYPE, "jpeg: unexpected end of data");
+	  if (c < 0)
+	    c = 0;
 	}
-      data->bit_mask = 0x80;
+      data->bit_buf |= (grub_uint32_t) c << (24 - data->bit_count);
+      data->bit_count += 8;
     }
+}
+
+/* Get the next NUM bits, NUM being at most 16.  */
+static unsigned
+grub_jpeg_get_bits (struct grub_jpeg_data *data, int num)
+{
+  unsigned ret;
 
-  ret = ((data->bit_save & data->bit_mask) != 0);
-  data->bit_mask >>= 1;
+  if (num == 0)
+    return 0;
+  if (data->bit_count < num)
+    grub_jpeg_fill_bits (data);
+
+  ret = data->bit_buf >> (32 - num);
+  data->bit_buf <<= num;
+  data->bit_count -= num;
   return ret;
 }
 
+/* Discard what is left of the entropy-coded data, which is padding, and
+   put the file back at the marker which follows it.  */
+static void
+grub_jpeg_sync_input (struct grub_jpeg_data *data)
+{
+  while (!data->marker_hit)
+    grub_jpeg_next_data_byte (data);
+
+  grub_file_seek (data->file, data->marker_offset);
+  data->bit_buf = 0;
+  data->bit_count = 0;
+  data->marker_hit = 0;
+}
+
 static int
 grub_jpeg_get_number (struct grub_jpeg_data *data, int num)
 {
-  int value, i, msb;
+  int value;
 
   if (num == 0)
     return 0;
+  if (num > 16)
+    {
+      grub_error (GRUB_ERR_BAD_FILE_TYPE, "jpeg: invalid coefficient size");
+      return 0;
+    }
 
-  msb = value = grub_jpeg_get_bit (data);
-  for (i = 1; i < num && grub_errno == GRUB_ERR_NONE; i++)
-    value = (value << 1) + (grub_jpeg_get_bit (data) != 0);
-  if (!msb)
+  value = grub_jpeg_get_bits (data, num);
+  if (!(value >> (num - 1)))
     value += 1 - (1 << num);
 
   return value;
@@ -199,16 +300,27 @@ grub_jpeg_get_number (struct grub_jpeg_data *data, int num)
 static int
 grub_jpeg_get_huff_code (struct grub_jpeg_data *data, int id)
 {
-  int code;
+  unsigned code, entry;
   unsigned i;
 
-  code = 0;
-  for (i = 0; i < ARRAY_SIZE (data->huff_maxval[id]); i++)
+  if (data->bit_count < 16)
+    grub_jpeg_fill_bits (data);
+
+  code = data->bit_buf >> (32 - JPEG_HUFF_LOOKAHEAD);
+  entry = data->huff_lookup[id][code];
+  if (entry)
+    {
+      data->bit_buf <<= entry >> 8;
+      data->bit_count -= entry >> 8;
+      return entry & 0xff;
+    }
+
+  /* Longer codes are looked for one length after the other.  */
+  grub_jpeg_get_bits (data, JPEG_HUFF_LOOKAHEAD);
+  for (i = JPEG_HUFF_LOOKAHEAD; i < ARRAY_SIZE (data->huff_maxval[id]); i++)
     {
-      code <<= 1;
-      if (grub_jpeg_get_bit (data))
-	code++;
-      if (code < data->huff_maxval[id][i])
+      code = (code << 1) | grub_jpeg_get_bits (data, 1);
+      if ((int) code < data->huff_maxval[id][i])
 	return data->huff_value[id][code + data->huff_offset[id][i]];
     }
   grub_error (GRUB_ERR_BAD_FILE_TYPE, "jpeg: huffman decode fails");
@@ -221,7 +333,7 @@ grub_jpeg_decode_huff_table (struct grub_jpeg_data *data)
   int id, ac, n, base, ofs;
   grub_uint32_t next_marker;
   grub_uint8_t count[16];
-  unsigned i;
+  unsigned i, code, len, fill;
 
   next_marker = data->file->offset;
   next_marker += grub_jpeg_get_word (data);
@@ -272,6 +384,14 @@ grub_jpeg_decode_huff_table (struct grub_jpeg_data *data)
 	  data->huff_maxval[id][i] = base;
 	  data->huff_offset[id][i] = ofs - base;
 
+	  /* Codes of this length are the COUNT[i] ones up to BASE.  */
+	  len = i + 1;
+	  if (len <= JPEG_HUFF_LOOKAHEAD && base <= (1 << len))
+	    for (code = base - count[i]; code < (unsigned) base; code++)
+	      for (fill = 0; fill < (1U << (JPEG_HUFF_LOOKAHEAD - len)); fill++)
+		data->huff_lookup[id][(code << (JPEG_HUFF_LOOKAHEAD - len)) | fill]
+		  = (len << 8) | data->huff_value[id][code + ofs - base];
+
 	  base <<= 1;
 	}
     }
@@ -287,6 +407,8 @@ grub_jpeg_decode_quan_table (struct grub_jpeg_data *data)
 {
   int id;
   grub_uint32_t next_marker;
+  grub_uint8_t table[64];
+  unsigned i;
 
   next_marker = data->file->offset;
   next_marker += grub_jpeg_get_word (data);
@@ -299,8 +421,7 @@ grub_jpeg_decode_quan_table (struct grub_jpeg_data *data)
       return grub_error (GRUB_ERR_BAD_FILE_TYPE, "jpeg: invalid next reference");
     }
 
-  while (data->file->offset + sizeof (data->quan_table[id]) + 1
-	 <= next_marker)
+  while (data->file->offset + sizeof (table) + 1 <= next_marker)
     {
       id = grub_jpeg_get_byte (data);
       if (grub_errno != GRUB_ERR_NONE)
@@ -313,11 +434,14 @@ grub_jpeg_decode_quan_table (struct grub_jpeg_data *data)
 	return grub_error (GRUB_ERR_BAD_FILE_TYPE,
 			   "jpeg: too many quantization tables");
 
-      if (grub_file_read (data->file, &data->quan_table[id],
-			  sizeof (data->quan_table[id]))
-	  != sizeof (data->quan_table[id]))
+      if (grub_file_read (data->file, table, sizeof (table)) != sizeof (table))
 	return grub_errno;
 
+      for (i = 0; i < ARRAY_SIZE (table); i++)
+	data->quan_table[id][i]
+	  = ((grub_uint32_t) table[i] * jpeg_aan_scales[jpeg_zigzag_order[i]]
+	     + (1 << (13 - JPEG_PASS1_BITS))) >> (14 - JPEG_PASS1_BITS);
+
     }
 
   if (data->file->offset != next_marker)
@@ -409,13 +533,83 @@ grub_jpeg_decode_dri (struct grub_jpeg_data *data)
   return grub_errno;
 }
 
+#define JPEG_MULTIPLY(v, c)	(((v) * CONST (c)) >> SHIFT_BITS)
+
+/* One-dimensional AAN IDCT of the 8 values STEP apart in PD, which
+   already have the scale factors applied.  */
+#define JPEG_IDCT_1D(pd, step, out)					\
+  do									\
+    {									\
+      int t0, t1, t2, t3, t4, t5, t6, t7;				\
+      int t10, t11, t12, t13, z5, z10, z11, z12, z13;			\
+									\
+      t0 = pd[(step) * 0];						\
+      t1 = pd[(step) * 2];						\
+      t2 = pd[(step) * 4];						\
+      t3 = pd[(step) * 6];						\
+									\
+      t10 = t0 + t2;							\
+      t11 = t0 - t2;							\
+      t13 = t1 + t3;							\
+      t12 = JPEG_MULTIPLY (t1 - t3, 1.414213562) - t13;		\
+									\
+      t0 = t10 + t13;							\
+      t3 = t10 - t13;							\
+      t1 = t11 + t12;							\
+      t2 = t11 - t12;							\
+									\
+      t4 = pd[(step) * 1];						\
+      t5 = pd[(step) * 3];						\
+      t6 = pd[(step) * 5];						\
+      t7 = pd[(step) * 7];						\
+									\
+      z13 = t6 + t5;							\
+      z10 = t6 - t5;							\
+      z11 = t4 + t7;							\
+      z12 = t4 - t7;							\
+									\
+      t7 = z11 + z13;							\
+      t11 = JPEG_MULTIPLY (z11 - z13, 1.414213562);			\
+      z5 = JPEG_MULTIPLY (z10 + z12, 1.847759065);			\
+      t10 = JPEG_MULTIPLY (z12, 1.082392200) - z5;			\
+      t12 = z5 - JPEG_MULTIPLY (z10, 2.613125930);			\
+									\
+      t6 = t12 - t7;							\
+      t5 = t11 - t6;							\
+      t4 = t10 + t5;							\
+									\
+      pd[(step) * 0] = out (t0 + t7);					\
+      pd[(step) * 7] = out (t0 - t7);					\
+      pd[(step) * 1] = out (t1 + t6);					\
+      pd[(step) * 6] = out (t1 - t6);					\
+      pd[(step) * 2] = out (t2 + t5);					\
+      pd[(step) * 5] = out (t2 - t5);					\
+      pd[(step) * 4] = out (t3 + t4);					\
+      pd[(step) * 3] = out (t3 - t4);					\
+    }									\
+  while (0)
+
+#define JPEG_IDCT_PASS1(x)	(x)
+#define JPEG_IDCT_PASS2(x)	grub_jpeg_clamp ((((x) + (1 << (JPEG_PASS1_BITS + 2))) \
+						  >> (JPEG_PASS1_BITS + 3)) + 128)
+
+static inline int
+grub_jpeg_clamp (int v)
+{
+  if (v < 0)
+    return 0;
+  if (v > 255)
+    return 255;
+  return v;
+}
+
+/* Fast integer IDCT by Arai, Agui and Nakajima, with 5 multiplications in
+   each one-dimensional transform, and level shift.  */
 static void
 grub_jpeg_idct_transform (jpeg_data_unit_t du)
 {
   int *pd;
   int i;
-  int t0, t1, t2, t3, t4, t5, t6, t7;
-  int v0, v1, v2, v3, v4;
 
   pd = du;
   for (i = 0; i < JPEG_UNIT_SIZE; i++, pd++)
@@ -425,63 +619,14 @@ grub_jpeg_idct_transform (jpeg_data_unit_t du)
 	   pd[JPEG_UNIT_SIZE * 5] | pd[JPEG_UNIT_SIZE * 6] |
 	   pd[JPEG_UNIT_SIZE * 7]) == 0)
 	{
-	  pd[JPEG_UNIT_SIZE * 0] <<= SHIFT_BITS;
-
 	  pd[JPEG_UNIT_SIZE * 1] = pd[JPEG_UNIT_SIZE * 2]
 	    = pd[JPEG_UNIT_SIZE * 3] = pd[JPEG_UNIT_SIZE * 4]
 	    = pd[JPEG_UNIT_SIZE * 5] = pd[JPEG_UNIT_SIZE * 6]
 	    = pd[JPEG_UNIT_SIZE * 7] = pd[JPEG_UNIT_SIZE * 0];
-
 	  continue;
 	}
 
-      t0 = pd[JPEG_UNIT_SIZE * 0];
-      t1 = pd[JPEG_UNIT_SIZE * 2];
-      t2 = pd[JPEG_UNIT_SIZE * 4];
-      t3 = pd[JPEG_UNIT_SIZE * 6];
-
-      v4 = (t1 + t3) * CONST (0.541196100);
-
-      v0 = ((t0 + t2) << SHIFT_BITS);
-      v1 = ((t0 - t2) << SHIFT_BITS);
-      v2 = v4 - t3 * CONST (1.847759065);
-      v3 = v4 + t1 * CONST (0.765366865);
-
-      t0 = v0 + v3;
-      t3 = v0 - v3;
-      t1 = v1 + v2;
-      t2 = v1 - v2;
-
-      t4 = pd[JPEG_UNIT_SIZE * 7];
-      t5 = pd[JPEG_UNIT_SIZE * 5];
-      t6 = pd[JPEG_UNIT_SIZE * 3];
-      t7 = pd[JPEG_UNIT_SIZE * 1];
-
-      v0 = t4 + t7;
-      v1 = t5 + t6;
-      v2 = t4 + t6;
-      v3 = t5 + t7;
-
-      v4 = (v2 + v3) * CONST (1.175875602);
-
-      v0 *= CONST (0.899976223);
-      v1 *= CONST (2.562915447);
-      v2 = v2 * CONST (1.961570560) - v4;
-      v3 = v3 * CONST (0.390180644) - v4;
-
-      t4 = t4 * CONST (0.298631336) - v0 - v2;
-      t5 = t5 * CONST (2.053119869) - v1 - v3;
-      t6 = t6 * CONST (3.072711026) - v1 - v2;
-      t7 = t7 * CONST (1.501321110) - v0 - v3;
-
-      pd[JPEG_UNIT_SIZE * 0] = t0 + t7;
-      pd[JPEG_UNIT_SIZE * 7] = t0 - t7;
-      pd[JPEG_UNIT_SIZE * 1] = t1 + t6;
-      pd[JPEG_UNIT_SIZE * 6] = t1 - t6;
-      pd[JPEG_UNIT_SIZE * 2] = t2 + t5;
-      pd[JPEG_UNIT_SIZE * 5] = t2 - t5;
-      pd[JPEG_UNIT_SIZE * 3] = t3 + t4;
-      pd[JPEG_UNIT_SIZE * 4] = t3 - t4;
+      JPEG_IDCT_1D (pd, JPEG_UNIT_SIZE, JPEG_IDCT_PASS1);
     }
 
   pd = du;
@@ -489,63 +634,12 @@ grub_jpeg_idct_transform (jpeg_data_unit_t du)
     {
       if ((pd[1] | pd[2] | pd[3] | pd[4] | pd[5] | pd[6] | pd[7]) == 0)
 	{
-	  pd[0] >>= (SHIFT_BITS + 3);
+	  pd[0] = JPEG_IDCT_PASS2 (pd[0]);
 	  pd[1] = pd[2] = pd[3] = pd[4] = pd[5] = pd[6] = pd[7] = pd[0];
 	  continue;
 	}
 
-      v4 = (pd[2] + pd[6]) * CONST (0.541196100);
-
-      v0 = (pd[0] + pd[4]) << SHIFT_BITS;
-      v1 = (pd[0] - pd[4]) << SHIFT_BITS;
-      v2 = v4 - pd[6] * CONST (1.847759065);
-      v3 = v4 + pd[2] * CONST (0.765366865);
-
-      t0 = v0 + v3;
-      t3 = v0 - v3;
-      t1 = v1 + v2;
-      t2 = v1 - v2;
-
-      t4 = pd[7];
-      t5 = pd[5];
-      t6 = pd[3];
-      t7 = pd[1];
-
-      v0 = t4 + t7;
-      v1 = t5 + t6;
-      v2 = t4 + t6;
-      v3 = t5 + t7;
-
-      v4 = (v2 + v3) * CONST (1.175875602);
-
-      v0 *= CONST (0.899976223);
-      v1 *= CONST (2.562915447);
-      v2 = v2 * CONST (1.961570560) - v4;
-      v3 = v3 * CONST (0.390180644) - v4;
-
-      t4 = t4 * CONST (0.298631336) - v0 - v2;
-      t5 = t5 * CONST (2.053119869) - v1 - v3;
-      t6 = t6 * CONST (3.072711026) - v1 - v2;
-      t7 = t7 * CONST (1.501321110) - v0 - v3;
-
-      pd[0] = (t0 + t7) >> (SHIFT_BITS * 2 + 3);
-      pd[7] = (t0 - t7) >> (SHIFT_BITS * 2 + 3);
-      pd[1] = (t1 + t6) >> (SHIFT_BITS * 2 + 3);
-      pd[6] = (t1 - t6) >> (SHIFT_BITS * 2 + 3);
-      pd[2] = (t2 + t5) >> (SHIFT_BITS * 2 + 3);
-      pd[5] = (t2 - t5) >> (SHIFT_BITS * 2 + 3);
-      pd[3] = (t3 + t4) >> (SHIFT_BITS * 2 + 3);
-      pd[4] = (t3 - t4) >> (SHIFT_BITS * 2 + 3);
-    }
-
-  for (i = 0; i < JPEG_UNIT_SIZE * JPEG_UNIT_SIZE; i++)
-    {
-      du[i] += 128;
-
-      if (du[i] < 0)
-	du[i] = 0;
-      if (du[i] > 255)
-	du[i] = 255;
+      JPEG_IDCT_1D (pd, 1, JPEG_IDCT_PASS2);
     }
 }
 
@@ -598,50 +692,58 @@ grub_jpeg_decode_du (struct grub_jpeg_data *data, int id, jpeg_data_unit_t du)
   return GRUB_ERR_NONE;
 }
 
-static void
-grub_jpeg_ycrcb_to_rgb (int yy, int cr, int cb, grub_uint8_t * rgb)
+static inline void
+grub_jpeg_put_rgb (grub_uint8_t *rgb, int r, int g, int b)
 {
-  int dd;
-
-  cr -= 128;
-  cb -= 128;
-
-  /* Red  */
-  dd = yy + ((cr * CONST (1.402)) >> SHIFT_BITS);
-  if (dd < 0)
-    dd = 0;
-  if (dd > 255)
-    dd = 255;
 #ifdef GRUB_CPU_WORDS_BIGENDIAN
-  rgb[2] = dd;
+  rgb[0] = grub_jpeg_clamp (b);
+  rgb[1] = grub_jpeg_clamp (g);
+  rgb[2] = grub_jpeg_clamp (r);
 #else
-  *(rgb++) = dd;
+  rgb[0] = grub_jpeg_clamp (r);
+  rgb[1] = grub_jpeg_clamp (g);
+  rgb[2] = grub_jpeg_clamp (b);
 #endif
+}
 
-  /* Green  */
-  dd = yy - ((cb * CONST (0.34414) + cr * CONST (0.71414)) >> SHIFT_BITS);
-  if (dd < 0)
-    dd = 0;
-  if (dd > 255)
-    dd = 255;
-#ifdef GRUB_CPU_WORDS_BIGENDIAN
-  rgb[1] = dd;
-#else
-  *(rgb++) = dd;
-#endif
+/* Convert the NR2 by NC2 pixels of the MCU just decoded to RGB at PTR,
+   upsampling the chroma.  The chroma terms are computed once for each
+   chroma sample rather than for each pixel it covers.  */
+static void
+grub_jpeg_ycrcb_to_rgb (struct grub_jpeg_data *data, grub_uint8_t *ptr,
+			unsigned nr2, unsigned nc2)
+{
+  int red[64], green[64], blue[64];
+  unsigned i, r2, c2;
 
-  /* Blue  */
-  dd = yy + ((cb * CONST (1.772)) >> SHIFT_BITS);
-  if (dd < 0)
-    dd = 0;
-  if (dd > 255)
-    dd = 255;
-#ifdef GRUB_CPU_WORDS_BIGENDIAN
-  rgb[0] = dd;
-  rgb += 3;
-#else
-  *(rgb++) = dd;
-#endif
+  if (data->color_components >= 3)
+    for (i = 0; i < 64; i++)
+      {
+	int cr = data->crdu[i] - 128;
+	int cb = data->cbdu[i] - 128;
+
+	red[i] = (cr * CONST (1.402)) >> SHIFT_BITS;
+	green[i] = -((cb * CONST (0.34414) + cr * CONST (0.71414)) >> SHIFT_BITS);
+	blue[i] = (cb * CONST (1.772)) >> SHIFT_BITS;
+      }
+
+  for (r2 = 0; r2 < nr2; r2++, ptr += (data->image_width - nc2) * 3)
+    {
+      unsigned crow = (r2 >> data->log_vs) * 8;
+
+      for (c2 = 0; c2 < nc2; c2++, ptr += 3)
+	{
+	  int yy = data->ydu[(r2 / 8) * 2 + (c2 / 8)][(r2 % 8) * 8 + (c2 % 8)];
+
+	  if (data->color_components >= 3)
+	    {
+	      i = crow + (c2 >> data->log_hs);
+	      grub_jpeg_put_rgb (ptr, yy + red[i], yy + green[i], yy + blue[i]);
+	    }
+	  else
+	    ptr[0] = ptr[1] = ptr[2] = yy;
+	}
+    }
 }
 
 static grub_err_t
@@ -717,6 +819,9 @@ grub_jpeg_decode_data (struct grub_jpeg_data *data)
     return grub_error (GRUB_ERR_BAD_FILE_TYPE,
 		       "jpeg: attempted to decode data before start of stream");
 
+  data->in_offset = data->file->offset;
+  data->in_pos = data->in_len = 0;
+
   if (grub_mul(vb, data->image_width, &stride_a) ||
       grub_mul(hb, nc1, &stride_b) ||
       grub_sub(stride_a, stride_b, &stride))
@@ -729,7 +834,6 @@ grub_jpeg_decode_data (struct grub_jpeg_data *data)
 	c1++, rst--, data->bitmap_ptr += hb * 3)
       {
 	unsigned r2, c2, nr2, nc2;
-	grub_uint8_t *ptr2;
 
 	for (r2 = 0; r2 < (1U << data->log_vs); r2++)
 	  for (c2 = 0; c2 < (1U << data->log_hs); c2++)
@@ -752,39 +856,19 @@ grub_jpeg_decode_data (struct grub_jpeg_data *data)
 	nr2 = (data->r1 == nr1 - 1) ? (data->image_height - data->r1 * vb) : vb;
 	nc2 = (c1 == nc1 - 1) ? (data->image_width - c1 * hb) : hb;
 
-	ptr2 = data->bitmap_ptr;
-	for (r2 = 0; r2 < nr2; r2++, ptr2 += (data->image_width - nc2) * 3)
-	  for (c2 = 0; c2 < nc2; c2++, ptr2 += 3)
-	    {
-	      unsigned i0;
-	      int yy;
-
-	      i0 = (r2 >> data->log_vs) * 8 + (c2 >> data->log_hs);
-	      yy = data->ydu[(r2 / 8) * 2 + (c2 / 8)][(r2 % 8) * 8 + (c2 % 8)];
-
-	      if (data->color_components >= 3)
-		{
-		  int cr, cb;
-		  cr = data->crdu[i0];
-		  cb = data->cbdu[i0];
-		  grub_jpeg_ycrcb_to_rgb (yy, cr, cb, ptr2);
-		}
-	      else
-		{
-		  ptr2[0] = yy;
-		  ptr2[1] = yy;
-		  ptr2[2] = yy;
-		}
-	    }
+	grub_jpeg_ycrcb_to_rgb (data, data->bitmap_ptr, nr2, nc2);
       }
 
+  grub_jpeg_sync_input (data);
   return grub_errno;
 }
 
 static void
 grub_jpeg_reset (struct grub_jpeg_data *data)
 {
-  data->bit_mask = 0x0;
+  data->bit_buf = 0;
+  data->bit_count = 0;
+  data->marker_hit = 0;
 
   data->dc_value[0] = 0;
   data->dc_value[1] = 0;
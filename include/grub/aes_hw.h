@@ -0,0 +1,48 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GRUB_AES_HW_HEADER
+#define GRUB_AES_HW_HEADER	1
+
+#include <grub/types.h>
+
+#define GRUB_AES_HW_BLOCK_SIZE	16
+#define GRUB_AES_HW_MAX_ROUNDS	14
+
+/*
+ * Primitives of the CPU AES instructions, provided by each architecture.
+ * Round keys are GRUB_AES_HW_BLOCK_SIZE bytes each, the decryption ones
+ * being those of the equivalent inverse cipher.
+ */
+
+/* Return non-zero if the CPU has the AES instructions.  */
+int grub_aes_hw_supported (void);
+
+/* Apply the S-box to each byte of W.  */
+grub_uint32_t grub_aes_hw_sub_word (grub_uint32_t w);
+
+/* Apply InvMixColumns to the round key KEY.  */
+void grub_aes_hw_inv_mix_columns (grub_uint8_t *key);
+
+/* En- or decrypt NBLOCKS blocks of DATA in place with ROUNDS rounds.  */
+void grub_aes_hw_encrypt (const grub_uint8_t *keys, int rounds,
+			  grub_uint8_t *data, grub_size_t nblocks);
+void grub_aes_hw_decrypt (const grub_uint8_t *keys, int rounds,
+			  grub_uint8_t *data, grub_size_t nblocks);
+
+#endif
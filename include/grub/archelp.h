@@ -34,6 +34,7 @@ typedef enum
   } grub_archelp_mode_t;
 
 struct grub_archelp_data;
+struct grub_archelp_index;
 
 struct grub_archelp_ops
 {
@@ -47,6 +48,20 @@ struct grub_archelp_ops
 
   void
   (*rewind) (struct grub_archelp_data *data);
+
+  /* Optional.  Filesystems which keep DATA across operations provide
+     these so that the members are only read once: get_index returns
+     where DATA keeps its index, tell returns the position of the member
+     find_file reads next and seek makes find_file read the member at
+     a position returned by tell.  */
+  struct grub_archelp_index **
+  (*get_index) (struct grub_archelp_data *data);
+
+  grub_off_t
+  (*tell) (struct grub_archelp_data *data);
+
+  void
+  (*seek) (struct grub_archelp_data *data, grub_off_t pos);
 };
 
 grub_err_t
@@ -60,4 +75,7 @@ grub_archelp_open (struct grub_archelp_data *data,
 		   struct grub_archelp_ops *ops,
 		   const char *name_in);
 
+void
+grub_archelp_free_index (struct grub_archelp_index *index);
+
 #endif
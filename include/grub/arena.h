@@ -0,0 +1,62 @@
+/* arena.h - bump allocation of memory that is freed all at once */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GRUB_ARENA_HEADER
+#define GRUB_ARENA_HEADER	1
+
+#include <grub/symbol.h>
+#include <grub/types.h>
+
+/* The default size of the chunks an arena gets from the heap.  */
+#define GRUB_ARENA_CHUNK_SIZE	4096
+
+struct grub_arena_chunk;
+
+/*
+ * An arena hands out memory from chunks of the heap by bumping a pointer,
+ * and only gives it back all at once.  It suits the many small objects of
+ * a parse that all die together.  Allocations are aligned to the size of
+ * two pointers.
+ */
+struct grub_arena
+{
+  struct grub_arena_chunk *chunks;
+  grub_uint8_t *cur;
+  grub_uint8_t *end;
+  grub_size_t chunk_size;
+};
+typedef struct grub_arena *grub_arena_t;
+
+/* Set up an empty arena taking chunks of CHUNK_SIZE bytes, or of
+   GRUB_ARENA_CHUNK_SIZE if it is 0.  */
+void EXPORT_FUNC (grub_arena_init) (grub_arena_t arena, grub_size_t chunk_size);
+
+void *EXPORT_FUNC (grub_arena_alloc) (grub_arena_t arena, grub_size_t size);
+void *EXPORT_FUNC (grub_arena_zalloc) (grub_arena_t arena, grub_size_t size);
+char *EXPORT_FUNC (grub_arena_strndup) (grub_arena_t arena, const char *s,
+					grub_size_t n);
+char *EXPORT_FUNC (grub_arena_strdup) (grub_arena_t arena, const char *s);
+
+/* Forget all allocations but keep the first chunk for reuse.  */
+void EXPORT_FUNC (grub_arena_reset) (grub_arena_t arena);
+
+/* Give all the memory of ARENA back to the heap.  */
+void EXPORT_FUNC (grub_arena_fini) (grub_arena_t arena);
+
+#endif /* ! GRUB_ARENA_HEADER */
@@ -85,6 +85,7 @@ enum grub_ata_commands
     GRUB_ATA_CMD_READ_SECTORS_EXT	= 0x24,
     GRUB_ATA_CMD_READ_SECTORS_DMA	= 0xc8,
     GRUB_ATA_CMD_READ_SECTORS_DMA_EXT	= 0x25,
+    GRUB_ATA_CMD_READ_FPDMA_QUEUED	= 0x60,
 
     GRUB_ATA_CMD_SECURITY_FREEZE_LOCK	= 0xf5,
     GRUB_ATA_CMD_SET_FEATURES		= 0xef,
@@ -95,6 +96,7 @@ enum grub_ata_commands
     GRUB_ATA_CMD_WRITE_SECTORS_EXT	= 0x34,
     GRUB_ATA_CMD_WRITE_SECTORS_DMA_EXT	= 0x35,
     GRUB_ATA_CMD_WRITE_SECTORS_DMA	= 0xca,
+    GRUB_ATA_CMD_WRITE_FPDMA_QUEUED	= 0x61,
   };
 
 enum grub_ata_timeout_milliseconds
@@ -184,6 +186,14 @@ struct grub_ata
 
   grub_size_t maxbuffer;
 
+  /* Queue depth reported by the device for native command queuing, 0 if
+     NCQ is not supported.  */
+  unsigned queue_depth;
+
+  /* Bytes the controller can keep in flight with queued commands, 0 if
+     the controller has no NCQ support.  */
+  grub_size_t maxqueued;
+
   int *present;
 
   void *data;
@@ -213,6 +223,12 @@ struct grub_ata_dev
 			   struct grub_disk_ata_pass_through_parms *parms,
 			   int spinup);
 
+  /* Transfer SIZE sectors at SECTOR using native command queuing.  Only
+     called if both queue_depth and maxqueued are set.  Optional.  */
+  grub_err_t (*readwrite_queued) (struct grub_ata *ata,
+				  grub_disk_addr_t sector, grub_size_t size,
+				  char *buf, int write);
+
   /* The next scsi device.  */
   struct grub_ata_dev *next;
 };
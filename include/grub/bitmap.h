@@ -34,6 +34,14 @@ struct grub_video_bitmap
 
   /* Pointer to bitmap data formatted according to mode_info.  */
   void *data;
+
+  /* Number of users, the bitmap is freed when the last one destroys it.
+     A bitmap with more than one is not modified any more.  */
+  unsigned refcount;
+
+  /* Different for every bitmap created, unlike the address which may be
+     reused once it is destroyed.  */
+  grub_uint32_t serial;
 };
 
 struct grub_video_bitmap_reader
@@ -62,6 +70,14 @@ grub_err_t EXPORT_FUNC (grub_video_bitmap_destroy) (struct grub_video_bitmap *bi
 grub_err_t EXPORT_FUNC (grub_video_bitmap_load) (struct grub_video_bitmap **bitmap,
 						 const char *filename);
 
+/* Take another reference to BITMAP, released by grub_video_bitmap_destroy.  */
+static inline struct grub_video_bitmap *
+grub_video_bitmap_ref (struct grub_video_bitmap *bitmap)
+{
+  bitmap->refcount++;
+  return bitmap;
+}
+
 /* Return bitmap width.  */
 static inline unsigned int
 grub_video_bitmap_get_width (struct grub_video_bitmap *bitmap)
@@ -75,10 +75,17 @@ struct grub_command
 
   /* Arbitrary data.  */
   void *data;
+
+  /* The next active command in the same name hash bucket.  */
+  struct grub_command *hash_next;
 };
 typedef struct grub_command *grub_command_t;
 
 extern grub_command_t EXPORT_VAR(grub_command_list);
+/* Bumped whenever a command is registered or unregistered, so that
+   callers caching the result of grub_command_find can tell when it may
+   have changed.  */
+extern unsigned long EXPORT_VAR(grub_command_generation);
 
 grub_command_t
 EXPORT_FUNC(grub_register_command_prio) (const char *name,
@@ -111,11 +118,7 @@ grub_register_command_p1 (const char *name,
   return grub_register_command_prio (name, func, summary, description, 1);
 }
 
-static inline grub_command_t
-grub_command_find (const char *name)
-{
-  return grub_named_list_find (GRUB_AS_NAMED_LIST (grub_command_list), name);
-}
+grub_command_t EXPORT_FUNC(grub_command_find) (const char *name);
 
 static inline grub_err_t
 grub_command_execute (const char *name, int argc, char **argv)
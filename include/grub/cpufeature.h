@@ -0,0 +1,105 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GRUB_CPUFEATURE_HEADER
+#define GRUB_CPUFEATURE_HEADER	1
+
+#include <grub/symbol.h>
+#include <grub/types.h>
+
+/* CPU features optimized code may depend on.  A feature is only reported
+   when it can be used in the boot environment, with SIMD state enabled
+   by grub_cpu_simd_begin where the firmware left it off.  */
+enum
+  {
+    /* SSE2 or Advanced SIMD.  */
+    GRUB_CPU_FEATURE_SIMD = 1 << 0,
+    GRUB_CPU_FEATURE_SSSE3 = 1 << 1,
+    GRUB_CPU_FEATURE_SSE4_1 = 1 << 2,
+    GRUB_CPU_FEATURE_AVX = 1 << 3,
+    GRUB_CPU_FEATURE_AVX2 = 1 << 4,
+    /* AES rounds in SIMD registers.  */
+    GRUB_CPU_FEATURE_AES = 1 << 5,
+    /* Carry-less multiply, PCLMULQDQ or PMULL.  */
+    GRUB_CPU_FEATURE_CLMUL = 1 << 6,
+    GRUB_CPU_FEATURE_SHA1 = 1 << 7,
+    GRUB_CPU_FEATURE_SHA256 = 1 << 8,
+    /* CRC32C on general purpose registers.  */
+    GRUB_CPU_FEATURE_CRC32C = 1 << 9
+  };
+
+/* Return the set of GRUB_CPU_FEATURE_* bits the CPU has.  */
+grub_uint32_t EXPORT_FUNC(grub_cpu_get_features) (void);
+
+static inline int
+grub_cpu_has_features (grub_uint32_t features)
+{
+  return (grub_cpu_get_features () & features) == features;
+}
+
+/* Code using SIMD registers runs between these two.  They enable the
+   SIMD unit if the firmware left it off and put it back afterwards, and
+   cost nothing where the firmware keeps it on.  */
+struct grub_cpu_simd_state
+{
+  int saved;
+  unsigned long cr0;
+  unsigned long cr4;
+};
+
+void EXPORT_FUNC(grub_cpu_simd_begin) (struct grub_cpu_simd_state *state);
+void EXPORT_FUNC(grub_cpu_simd_end) (struct grub_cpu_simd_state *state);
+
+/* One optimized implementation of a dispatch point.  */
+struct grub_cpu_variant
+{
+  struct grub_cpu_variant *next;
+  struct grub_cpu_variant **prev;
+  const char *name;
+  /* GRUB_CPU_FEATURE_* bits the variant needs.  */
+  grub_uint32_t features;
+  /* Of the variants the CPU can run, the highest priority one is used.  */
+  int prio;
+  void *func;
+};
+
+/* A function with a generic implementation and optional variants.
+   Callers cast FUNC to the function type and call through it.  */
+struct grub_cpu_dispatch
+{
+  struct grub_cpu_dispatch *next;
+  struct grub_cpu_dispatch **prev;
+  const char *name;
+  void *generic;
+  struct grub_cpu_variant *variants;
+  /* The implementation in use.  */
+  void *func;
+};
+
+#define GRUB_CPU_DISPATCH(dispatch, type) ((type) (dispatch)->func)
+
+void EXPORT_FUNC(grub_cpu_dispatch_register) (struct grub_cpu_dispatch *dispatch);
+void EXPORT_FUNC(grub_cpu_dispatch_unregister) (struct grub_cpu_dispatch *dispatch);
+void EXPORT_FUNC(grub_cpu_variant_register) (struct grub_cpu_dispatch *dispatch,
+					     struct grub_cpu_variant *variant);
+void EXPORT_FUNC(grub_cpu_variant_unregister) (struct grub_cpu_dispatch *dispatch,
+					       struct grub_cpu_variant *variant);
+
+void grub_cpu_dispatch_init (void);
+
+#endif /* ! GRUB_CPUFEATURE_HEADER */
@@ -334,6 +334,10 @@ void
 grub_md_register (gcry_md_spec_t *digest);
 void
 grub_md_unregister (gcry_md_spec_t *cipher);
+void
+grub_md_accel_register (gcry_md_spec_t *digest);
+void
+grub_md_accel_unregister (gcry_md_spec_t *digest);
 
 extern struct gcry_pk_spec *grub_crypto_pk_dsa;
 extern struct gcry_pk_spec *grub_crypto_pk_ecdsa;
@@ -345,6 +349,16 @@ grub_crypto_hash (const gcry_md_spec_t *hash, void *out, const void *in,
 		  grub_size_t inlen);
 const gcry_md_spec_t *
 grub_crypto_lookup_md_by_name (const char *name);
+/* Return a CPU-accelerated implementation of HASH if one is available,
+   else HASH itself.  The two may not share contexts.
+   grub_crypto_lookup_md_by_name () already returns these.  */
+const gcry_md_spec_t *
+grub_crypto_md_accel (const gcry_md_spec_t *hash);
+
+/* Return the portable implementation of HASH, for code that cannot rely
+   on the CPU features of the accelerated ones.  */
+const gcry_md_spec_t *
+grub_crypto_md_soft (const gcry_md_spec_t *hash);
 
 grub_err_t
 grub_crypto_gcry_error (gcry_err_code_t in);
@@ -392,6 +406,49 @@ grub_crypto_pbkdf2 (const struct gcry_md_spec *md,
 		    unsigned int c,
 		    grub_uint8_t *DK, grub_size_t dkLen);
 
+/* As grub_crypto_pbkdf2 (), but without allocating: MEM provides the
+   grub_crypto_pbkdf2_memsize (MD) octets of scratch memory and MD is used
+   as given, not replaced by grub_crypto_md_accel ().  */
+grub_size_t
+grub_crypto_pbkdf2_memsize (const struct gcry_md_spec *md);
+gcry_err_code_t
+grub_crypto_pbkdf2_prealloc (const struct gcry_md_spec *md,
+			     const grub_uint8_t *P, grub_size_t Plen,
+			     const grub_uint8_t *S, grub_size_t Slen,
+			     unsigned int c,
+			     grub_uint8_t *DK, grub_size_t dkLen,
+			     void *mem);
+
+/* Argon2 variants, numbered as in RFC 9106.  */
+#define GRUB_CRYPTO_ARGON2D	0
+#define GRUB_CRYPTO_ARGON2I	1
+#define GRUB_CRYPTO_ARGON2ID	2
+
+/* Implement Argon2 version 0x13 as per RFC 9106.  TYPE is one of the
+   GRUB_CRYPTO_ARGON2 variants, T_COST the number of passes, M_COST the
+   memory size in KiB and PARALLELISM the number of lanes.  The password P
+   of length PLEN and the salt S of length SLEN give DKLEN octets of
+   derived data in DK.  No secret and no associated data are used.  */
+gcry_err_code_t
+grub_crypto_argon2 (int type, grub_uint32_t t_cost, grub_uint32_t m_cost,
+		    grub_uint32_t parallelism,
+		    const grub_uint8_t *P, grub_size_t Plen,
+		    const grub_uint8_t *S, grub_size_t Slen,
+		    grub_uint8_t *DK, grub_size_t dkLen);
+
+/* As grub_crypto_argon2 (), but without allocating: MEM provides the
+   grub_crypto_argon2_memsize (M_COST, PARALLELISM) octets of memory,
+   which is 0 for invalid parameters.  */
+grub_size_t
+grub_crypto_argon2_memsize (grub_uint32_t m_cost, grub_uint32_t parallelism);
+gcry_err_code_t
+grub_crypto_argon2_prealloc (int type, grub_uint32_t t_cost,
+			     grub_uint32_t m_cost, grub_uint32_t parallelism,
+			     const grub_uint8_t *P, grub_size_t Plen,
+			     const grub_uint8_t *S, grub_size_t Slen,
+			     grub_uint8_t *DK, grub_size_t dkLen,
+			     void *mem);
+
 int
 grub_crypto_memcmp (const void *a, const void *b, grub_size_t n);
 
@@ -66,6 +66,34 @@ typedef enum
 
 struct grub_cryptodisk;
 
+/*
+ * A hardware implementation of a cipher mode.  It is used in place of the
+ * generic code for the devices whose cipher and key it accepts.
+ */
+struct grub_cryptodisk_accel
+{
+  struct grub_cryptodisk_accel *next;
+  struct grub_cryptodisk_accel **prev;
+
+  const char *name;
+  /*
+   * Return a context for KEY, or NULL if CIPHER in MODE is not handled.
+   * In XTS mode KEY holds the data key followed by the tweak key.
+   */
+  void *(*init) (const gcry_cipher_spec_t *cipher, grub_cryptodisk_mode_t mode,
+		 const grub_uint8_t *key, grub_size_t keysize);
+  /*
+   * Encrypt or decrypt NSECTORS consecutive sectors of DATA in place.  IVS
+   * holds the initial vector of each sector, one cipher block apiece,
+   * before their encryption with the tweak key in XTS mode.
+   */
+  void (*crypt) (void *ctx, grub_uint8_t *data, grub_size_t nsectors,
+		 grub_size_t log_sector_size, const grub_uint8_t *ivs,
+		 int do_encrypt);
+  void (*fini) (void *ctx);
+};
+typedef struct grub_cryptodisk_accel *grub_cryptodisk_accel_t;
+
 typedef gcry_err_code_t
 (*grub_cryptodisk_rekey_func_t) (struct grub_cryptodisk *dev,
 				 grub_uint64_t zoneno);
@@ -127,6 +155,8 @@ struct grub_cryptodisk
   grub_uint64_t last_rekey;
   int rekey_derived_size;
   grub_disk_addr_t partition_start;
+  grub_cryptodisk_accel_t accel;
+  void *accel_ctx;
 };
 typedef struct grub_cryptodisk *grub_cryptodisk_t;
 
@@ -158,6 +188,11 @@ grub_cryptodisk_dev_unregister (grub_cryptodisk_dev_t cr)
 
 #define FOR_CRYPTODISK_DEVS(var) FOR_LIST_ELEMENTS((var), (grub_cryptodisk_list))
 
+void
+grub_cryptodisk_accel_register (grub_cryptodisk_accel_t accel);
+void
+grub_cryptodisk_accel_unregister (grub_cryptodisk_accel_t accel);
+
 grub_err_t
 grub_cryptodisk_setcipher (grub_cryptodisk_t crypt, const char *ciphername, const char *ciphermode);
 
@@ -52,6 +52,7 @@ enum grub_disk_dev_id
     GRUB_DISK_DEVICE_UBOOTDISK_ID,
     GRUB_DISK_DEVICE_XEN,
     GRUB_DISK_DEVICE_OBDISK_ID,
+    GRUB_DISK_DEVICE_NVME_ID,
   };
 
 struct grub_disk;
@@ -69,6 +70,17 @@ typedef enum
 
 typedef int (*grub_disk_dev_iterate_hook_t) (const char *name, void *data);
 
+/* A segment of a vectored read. For grub_disk_readv SECTOR is in units of
+   GRUB_DISK_SECTOR_SIZE relative to the partition and SIZE is in bytes. For
+   the disk_readv device function both are in units of the disk sector
+   size.  */
+struct grub_disk_iovec
+{
+  grub_disk_addr_t sector;
+  grub_size_t size;
+  char *buf;
+};
+
 /* Disk device.  */
 struct grub_disk_dev
 {
@@ -96,6 +108,12 @@ struct grub_disk_dev
   grub_err_t (*disk_write) (struct grub_disk *disk, grub_disk_addr_t sector,
 		       grub_size_t size, const char *buf);
 
+  /* Read IOVCNT segments described by IOV from the disk DISK. Optional, no
+     segment is larger than the disk's max_agglomerate.  */
+  grub_err_t (*disk_readv) (struct grub_disk *disk,
+			    const struct grub_disk_iovec *iov,
+			    unsigned int iovcnt);
+
 #ifdef GRUB_UTIL
   struct grub_disk_memberlist *(*disk_memberlist) (struct grub_disk *disk);
   const char * (*disk_raidname) (struct grub_disk *disk);
@@ -110,6 +128,35 @@ extern grub_disk_dev_t EXPORT_VAR (grub_disk_dev_list);
 
 struct grub_partition;
 
+/* Always-on I/O statistics of a disk, kept across open/close cycles.  */
+struct grub_disk_stats
+{
+  struct grub_disk_stats *next;
+  char *name;
+  enum grub_disk_dev_id dev_id;
+  unsigned long disk_id;
+
+  /* Disk cache lookups which were found and not found.  */
+  grub_uint64_t hits;
+  grub_uint64_t misses;
+  /* Cache entries replaced by this disk.  */
+  grub_uint64_t evictions;
+  /* Bytes requested through grub_disk_read.  */
+  grub_uint64_t bytes_read;
+  /* Calls of the device read function and time spent in them.  */
+  grub_uint64_t read_calls;
+  grub_uint64_t read_time_ms;
+};
+
+extern struct grub_disk_stats *EXPORT_VAR(grub_disk_stats_list);
+
+/* If set, called with every range read through grub_disk_read, SECTOR
+   being relative to the start of the whole disk.  */
+extern void (*EXPORT_VAR(grub_disk_read_record)) (struct grub_disk *disk,
+						  grub_disk_addr_t sector,
+						  grub_off_t offset,
+						  grub_size_t size);
+
 typedef grub_err_t (*grub_disk_read_hook_t) (grub_disk_addr_t sector,
 					     unsigned offset, unsigned length,
 					     char *buf, void *data);
@@ -135,6 +182,16 @@ struct grub_disk
   /* The id used by the disk cache manager.  */
   unsigned long id;
 
+  /* Sequential read detection. READ_AHEAD_NEXT is the sector following the
+     last read from the device, READ_AHEAD_WINDOW the number of cache units
+     currently read ahead and READ_AHEAD_MAX its limit.  */
+  grub_disk_addr_t read_ahead_next;
+  unsigned int read_ahead_window;
+  unsigned int read_ahead_max;
+
+  /* Statistics of this disk, may be NULL.  */
+  struct grub_disk_stats *stats;
+
   /* The partition information. This is machine-specific.  */
   struct grub_partition *partition;
 
@@ -169,9 +226,17 @@ typedef struct grub_disk_memberlist *grub_disk_memberlist_t;
  */
 #define GRUB_DISK_MAX_SECTORS	(1ULL << (60 - GRUB_DISK_SECTOR_BITS))
 
-/* The maximum number of disk caches.  */
+/* The default number of disk cache entries, used when the heap size
+   is not known.  */
 #define GRUB_DISK_CACHE_NUM	1021
 
+/* The number of entries (ways) in each disk cache set.  */
+#define GRUB_DISK_CACHE_WAYS	4
+
+/* Bounds on the number of disk cache sets chosen at runtime.  */
+#define GRUB_DISK_CACHE_MIN_SETS	64
+#define GRUB_DISK_CACHE_MAX_SETS	4096
+
 /*
  * The maximum number of disks in an mdraid device.
  *
@@ -188,6 +253,10 @@ typedef struct grub_disk_memberlist *grub_disk_memberlist_t;
 #define GRUB_DISK_CACHE_BITS	6
 #define GRUB_DISK_CACHE_SIZE	(1 << GRUB_DISK_CACHE_BITS)
 
+/* Default limit of the read-ahead window in KiB, overridden by the
+   disk_readahead environment variable.  */
+#define GRUB_DISK_READ_AHEAD_DEFAULT	1024
+
 #define GRUB_DISK_MAX_MAX_AGGLOMERATE ((1 << (30 - GRUB_DISK_CACHE_BITS - GRUB_DISK_SECTOR_BITS)) - 1)
 
 /* Maximum number of sectors to read in LBA mode at once. */
@@ -230,7 +299,7 @@ grub_disk_to_native_sector (grub_disk_t disk, grub_disk_addr_t sector)
 }
 
 /* This is called from the memory manager.  */
-void grub_disk_cache_invalidate_all (void);
+void EXPORT_FUNC(grub_disk_cache_invalidate_all) (void);
 
 void EXPORT_FUNC(grub_disk_dev_register) (grub_disk_dev_t dev);
 void EXPORT_FUNC(grub_disk_dev_unregister) (grub_disk_dev_t dev);
@@ -255,6 +324,17 @@ grub_err_t EXPORT_FUNC(grub_disk_read) (grub_disk_t disk,
 					grub_off_t offset,
 					grub_size_t size,
 					void *buf);
+grub_err_t EXPORT_FUNC(grub_disk_readv) (grub_disk_t disk,
+					 const struct grub_disk_iovec *iov,
+					 unsigned int iovcnt);
+grub_err_t
+EXPORT_FUNC(grub_disk_readv_merge) (grub_disk_t disk,
+				    const struct grub_disk_iovec *iov,
+				    unsigned int iovcnt,
+				    grub_err_t (*read) (grub_disk_t disk,
+							grub_disk_addr_t sector,
+							grub_size_t size,
+							char *buf));
 grub_err_t grub_disk_write (grub_disk_t disk,
 			    grub_disk_addr_t sector,
 			    grub_off_t offset,
@@ -269,10 +349,8 @@ extern grub_err_t (*EXPORT_VAR(grub_disk_write_weak)) (grub_disk_t disk,
 
 grub_uint64_t EXPORT_FUNC(grub_disk_native_sectors) (grub_disk_t disk);
 
-#if DISK_CACHE_STATS
 void
 EXPORT_FUNC(grub_disk_cache_get_performance) (unsigned long *hits, unsigned long *misses);
-#endif
 
 extern void (* EXPORT_VAR(grub_disk_firmware_fini)) (void);
 extern int EXPORT_VAR(grub_disk_firmware_is_tainted);
@@ -297,9 +375,18 @@ struct grub_disk_cache
   grub_disk_addr_t sector;
   char *data;
   int lock;
+  /* Value of the access clock when this entry was last used.  */
+  grub_uint64_t last_use;
 };
 
-extern struct grub_disk_cache EXPORT_VAR(grub_disk_cache_table)[GRUB_DISK_CACHE_NUM];
+/* The cache is GRUB_DISK_CACHE_WAYS-way set associative. Entry W of set S
+   is grub_disk_cache_table[S * GRUB_DISK_CACHE_WAYS + W].  */
+extern struct grub_disk_cache *EXPORT_VAR(grub_disk_cache_table);
+extern unsigned EXPORT_VAR(grub_disk_cache_num_sets);
+
+/* Incremented whenever data cached above the disk layer may have become
+   stale: on every write and whenever the disk cache is invalidated.  */
+extern unsigned long EXPORT_VAR(grub_disk_generation);
 
 #if defined (GRUB_UTIL)
 void grub_lvm_init (void);
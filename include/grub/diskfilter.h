@@ -129,6 +129,9 @@ struct grub_diskfilter_node {
   char *name;
   struct grub_diskfilter_pv *pv;
   struct grub_diskfilter_lv *lv;
+  /* Failed reads from this copy of a mirror, which is then tried after
+     the others.  */
+  unsigned int read_errors;
 };
 
 struct grub_diskfilter_vg *
@@ -178,6 +178,9 @@ struct grub_dl
   int persistent;
   grub_dl_dep_t dep;
   grub_dl_segment_t segment;
+  /* The segments of all the sections, indexed by section number.  */
+  struct grub_dl_segment *sections;
+  unsigned nsections;
   Elf_Sym *symtab;
   grub_size_t symsize;
   void (*init) (struct grub_dl *mod);
@@ -89,6 +89,11 @@
     { 0x8e, 0x39, 0x00, 0xa0, 0xc9, 0x69, 0x72, 0x3b } \
   }
 
+#define GRUB_EFI_BLOCK_IO2_GUID	\
+  { 0xa77b2472, 0xe282, 0x4e9f, \
+    { 0xa2, 0x45, 0xc2, 0xc0, 0xe2, 0x7b, 0xbc, 0xc1 } \
+  }
+
 #define GRUB_EFI_SERIAL_IO_GUID \
   { 0xbb25cf6f, 0xf1d4, 0x11d2, \
     { 0x9a, 0x0c, 0x00, 0x90, 0x27, 0x3f, 0xc1, 0xfd } \
@@ -369,6 +374,21 @@
     { 0x86, 0x2e, 0xc0, 0x1c, 0xdc, 0x29, 0x1f, 0x44 } \
   }
 
+#define GRUB_EFI_MP_SERVICES_PROTOCOL_GUID \
+  { 0x3fdda605, 0xa76e, 0x4f46, \
+    { 0xad, 0x29, 0x12, 0xf4, 0x53, 0x1b, 0x3d, 0x08 } \
+  }
+
+#define GRUB_EFI_HTTP_SERVICE_BINDING_PROTOCOL_GUID \
+  { 0xbdc8e6af, 0xd9bc, 0x4379, \
+    { 0xa7, 0x2a, 0xe0, 0xc4, 0xe7, 0x5d, 0xae, 0x1c } \
+  }
+
+#define GRUB_EFI_HTTP_PROTOCOL_GUID \
+  { 0x7a59b29b, 0x910b, 0x4171, \
+    { 0x82, 0x42, 0xa8, 0x5a, 0x0d, 0xf2, 0x5b, 0x5b } \
+  }
+
 #define LINUX_EFI_INITRD_MEDIA_GUID  \
   { 0x5568e427, 0x68fc, 0x4f3d, \
     { 0xac, 0x74, 0xca, 0x55, 0x52, 0x31, 0xcc, 0x68 } \
@@ -1598,6 +1618,43 @@ struct grub_efi_system_table
 };
 typedef struct grub_efi_system_table  grub_efi_system_table_t;
 
+/* From the Platform Initialization specification, the part of the DXE
+   services which manages the attributes of memory space.  */
+struct grub_efi_gcd_memory_space_descriptor
+{
+  grub_efi_physical_address_t base_address;
+  grub_efi_uint64_t length;
+  grub_efi_uint64_t capabilities;
+  grub_efi_uint64_t attributes;
+  grub_efi_uint32_t gcd_memory_type;
+  grub_efi_handle_t image_handle;
+  grub_efi_handle_t device_handle;
+};
+typedef struct grub_efi_gcd_memory_space_descriptor grub_efi_gcd_memory_space_descriptor_t;
+
+#define GRUB_EFI_MEMORY_CACHETYPE_MASK	(GRUB_EFI_MEMORY_UC | GRUB_EFI_MEMORY_WC \
+					 | GRUB_EFI_MEMORY_WT | GRUB_EFI_MEMORY_WB \
+					 | GRUB_EFI_MEMORY_UCE)
+
+struct grub_efi_dxe_services
+{
+  grub_efi_table_header_t hdr;
+  void *add_memory_space;
+  void *allocate_memory_space;
+  void *free_memory_space;
+  void *remove_memory_space;
+
+  grub_efi_status_t
+  (__grub_efi_api *get_memory_space_descriptor) (grub_efi_physical_address_t base_address,
+						 grub_efi_gcd_memory_space_descriptor_t *descriptor);
+
+  grub_efi_status_t
+  (__grub_efi_api *set_memory_space_attributes) (grub_efi_physical_address_t base_address,
+						 grub_efi_uint64_t length,
+						 grub_efi_uint64_t attributes);
+};
+typedef struct grub_efi_dxe_services grub_efi_dxe_services_t;
+
 struct grub_efi_loaded_image
 {
   grub_efi_uint32_t revision;
@@ -1775,6 +1832,35 @@ struct grub_efi_block_io
 };
 typedef struct grub_efi_block_io grub_efi_block_io_t;
 
+struct grub_efi_block_io2_token
+{
+  grub_efi_event_t event;
+  grub_efi_status_t transaction_status;
+};
+typedef struct grub_efi_block_io2_token grub_efi_block_io2_token_t;
+
+struct grub_efi_block_io2
+{
+  grub_efi_block_io_media_t *media;
+  grub_efi_status_t (__grub_efi_api *reset) (struct grub_efi_block_io2 *this,
+					     grub_efi_boolean_t extended_verification);
+  grub_efi_status_t (__grub_efi_api *read_blocks_ex) (struct grub_efi_block_io2 *this,
+						      grub_efi_uint32_t media_id,
+						      grub_efi_lba_t lba,
+						      grub_efi_block_io2_token_t *token,
+						      grub_efi_uintn_t buffer_size,
+						      void *buffer);
+  grub_efi_status_t (__grub_efi_api *write_blocks_ex) (struct grub_efi_block_io2 *this,
+						       grub_efi_uint32_t media_id,
+						       grub_efi_lba_t lba,
+						       grub_efi_block_io2_token_t *token,
+						       grub_efi_uintn_t buffer_size,
+						       void *buffer);
+  grub_efi_status_t (__grub_efi_api *flush_blocks_ex) (struct grub_efi_block_io2 *this,
+						       grub_efi_block_io2_token_t *token);
+};
+typedef struct grub_efi_block_io2 grub_efi_block_io2_t;
+
 struct grub_efi_shim_lock_protocol
 {
   /*
@@ -1799,6 +1885,190 @@ struct grub_efi_rng_protocol
 };
 typedef struct grub_efi_rng_protocol grub_efi_rng_protocol_t;
 
+#define GRUB_EFI_PROCESSOR_AS_BSP	0x1
+#define GRUB_EFI_PROCESSOR_ENABLED	0x2
+#define GRUB_EFI_PROCESSOR_HEALTH_STATUS	0x4
+
+struct grub_efi_cpu_physical_location
+{
+  grub_efi_uint32_t package;
+  grub_efi_uint32_t core;
+  grub_efi_uint32_t thread;
+};
+typedef struct grub_efi_cpu_physical_location grub_efi_cpu_physical_location_t;
+
+struct grub_efi_processor_information
+{
+  grub_efi_uint64_t processor_id;
+  grub_efi_uint32_t status_flag;
+  grub_efi_cpu_physical_location_t location;
+};
+typedef struct grub_efi_processor_information grub_efi_processor_information_t;
+
+typedef void (__grub_efi_api *grub_efi_ap_procedure_t) (void *buffer);
+
+struct grub_efi_mp_services
+{
+  grub_efi_status_t (__grub_efi_api *get_number_of_processors) (struct grub_efi_mp_services *this,
+								grub_efi_uintn_t *number_of_processors,
+								grub_efi_uintn_t *number_of_enabled_processors);
+  grub_efi_status_t (__grub_efi_api *get_processor_info) (struct grub_efi_mp_services *this,
+							  grub_efi_uintn_t processor_number,
+							  grub_efi_processor_information_t *processor_info_buffer);
+  grub_efi_status_t (__grub_efi_api *startup_all_aps) (struct grub_efi_mp_services *this,
+						       grub_efi_ap_procedure_t procedure,
+						       grub_efi_boolean_t single_thread,
+						       grub_efi_event_t wait_event,
+						       grub_efi_uintn_t timeout_in_microseconds,
+						       void *procedure_argument,
+						       grub_efi_uintn_t **failed_cpu_list);
+  grub_efi_status_t (__grub_efi_api *startup_this_ap) (struct grub_efi_mp_services *this,
+						       grub_efi_ap_procedure_t procedure,
+						       grub_efi_uintn_t processor_number,
+						       grub_efi_event_t wait_event,
+						       grub_efi_uintn_t timeout_in_microseconds,
+						       void *procedure_argument,
+						       grub_efi_boolean_t *finished);
+  grub_efi_status_t (__grub_efi_api *switch_bsp) (struct grub_efi_mp_services *this,
+						  grub_efi_uintn_t processor_number,
+						  grub_efi_boolean_t enable_old_bsp);
+  grub_efi_status_t (__grub_efi_api *enable_disable_ap) (struct grub_efi_mp_services *this,
+							 grub_efi_uintn_t processor_number,
+							 grub_efi_boolean_t enable_ap,
+							 grub_efi_uint32_t *health_flag);
+  grub_efi_status_t (__grub_efi_api *who_am_i) (struct grub_efi_mp_services *this,
+						grub_efi_uintn_t *processor_number);
+};
+typedef struct grub_efi_mp_services grub_efi_mp_services_t;
+
+struct grub_efi_service_binding
+{
+  grub_efi_status_t (__grub_efi_api *create_child) (struct grub_efi_service_binding *this,
+						    grub_efi_handle_t *child_handle);
+  grub_efi_status_t (__grub_efi_api *destroy_child) (struct grub_efi_service_binding *this,
+						     grub_efi_handle_t child_handle);
+};
+typedef struct grub_efi_service_binding grub_efi_service_binding_t;
+
+enum grub_efi_http_version
+  {
+    GRUB_EFI_HTTP_VERSION_10,
+    GRUB_EFI_HTTP_VERSION_11,
+    GRUB_EFI_HTTP_VERSION_UNSUPPORTED
+  };
+typedef enum grub_efi_http_version grub_efi_http_version_t;
+
+enum grub_efi_http_method
+  {
+    GRUB_EFI_HTTP_METHOD_GET,
+    GRUB_EFI_HTTP_METHOD_POST,
+    GRUB_EFI_HTTP_METHOD_PATCH,
+    GRUB_EFI_HTTP_METHOD_OPTIONS,
+    GRUB_EFI_HTTP_METHOD_CONNECT,
+    GRUB_EFI_HTTP_METHOD_HEAD,
+    GRUB_EFI_HTTP_METHOD_PUT,
+    GRUB_EFI_HTTP_METHOD_DELETE,
+    GRUB_EFI_HTTP_METHOD_TRACE
+  };
+typedef enum grub_efi_http_method grub_efi_http_method_t;
+
+/* The status codes are an enumeration, not the numbers of RFC 9110.  */
+enum grub_efi_http_status_code
+  {
+    GRUB_EFI_HTTP_STATUS_UNSUPPORTED_STATUS = 0,
+    GRUB_EFI_HTTP_STATUS_200_OK = 3,
+    GRUB_EFI_HTTP_STATUS_206_PARTIAL_CONTENT = 9,
+    GRUB_EFI_HTTP_STATUS_404_NOT_FOUND = 21
+  };
+typedef enum grub_efi_http_status_code grub_efi_http_status_code_t;
+
+struct grub_efi_httpv4_access_point
+{
+  grub_efi_boolean_t use_default_address;
+  grub_efi_ipv4_address_t local_address;
+  grub_efi_ipv4_address_t local_subnet;
+  grub_efi_uint16_t local_port;
+};
+typedef struct grub_efi_httpv4_access_point grub_efi_httpv4_access_point_t;
+
+struct grub_efi_httpv6_access_point
+{
+  grub_efi_ipv6_address_t local_address;
+  grub_efi_uint16_t local_port;
+};
+typedef struct grub_efi_httpv6_access_point grub_efi_httpv6_access_point_t;
+
+struct grub_efi_http_config_data
+{
+  grub_efi_http_version_t http_version;
+  grub_efi_uint32_t timeout_millisec;
+  grub_efi_boolean_t local_address_is_ipv6;
+  union
+  {
+    grub_efi_httpv4_access_point_t *ipv4_node;
+    grub_efi_httpv6_access_point_t *ipv6_node;
+  } access_point;
+};
+typedef struct grub_efi_http_config_data grub_efi_http_config_data_t;
+
+struct grub_efi_http_request_data
+{
+  grub_efi_http_method_t method;
+  grub_efi_char16_t *url;
+};
+typedef struct grub_efi_http_request_data grub_efi_http_request_data_t;
+
+struct grub_efi_http_response_data
+{
+  grub_efi_http_status_code_t status_code;
+};
+typedef struct grub_efi_http_response_data grub_efi_http_response_data_t;
+
+struct grub_efi_http_header
+{
+  char *field_name;
+  char *field_value;
+};
+typedef struct grub_efi_http_header grub_efi_http_header_t;
+
+struct grub_efi_http_message
+{
+  union
+  {
+    grub_efi_http_request_data_t *request;
+    grub_efi_http_response_data_t *response;
+  } data;
+  grub_efi_uintn_t header_count;
+  grub_efi_http_header_t *headers;
+  grub_efi_uintn_t body_length;
+  void *body;
+};
+typedef struct grub_efi_http_message grub_efi_http_message_t;
+
+struct grub_efi_http_token
+{
+  grub_efi_event_t event;
+  grub_efi_status_t status;
+  grub_efi_http_message_t *message;
+};
+typedef struct grub_efi_http_token grub_efi_http_token_t;
+
+struct grub_efi_http
+{
+  grub_efi_status_t (__grub_efi_api *get_mode_data) (struct grub_efi_http *this,
+						     grub_efi_http_config_data_t *http_config_data);
+  grub_efi_status_t (__grub_efi_api *configure) (struct grub_efi_http *this,
+						 grub_efi_http_config_data_t *http_config_data);
+  grub_efi_status_t (__grub_efi_api *request) (struct grub_efi_http *this,
+					       grub_efi_http_token_t *token);
+  grub_efi_status_t (__grub_efi_api *cancel) (struct grub_efi_http *this,
+					      grub_efi_http_token_t *token);
+  grub_efi_status_t (__grub_efi_api *response) (struct grub_efi_http *this,
+						grub_efi_http_token_t *token);
+  grub_efi_status_t (__grub_efi_api *poll) (struct grub_efi_http *this);
+};
+typedef struct grub_efi_http grub_efi_http_t;
+
 struct grub_efi_load_file2
 {
   grub_efi_status_t (__grub_efi_api *load_file)(struct grub_efi_load_file2 *this,
@@ -0,0 +1,64 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GRUB_EFI_MP_H
+#define GRUB_EFI_MP_H	1
+
+#include <grub/types.h>
+#include <grub/err.h>
+
+/*
+ * One of the N jobs given to grub_efi_mp_run ().  ON_AP is set when it runs
+ * on an application processor.  There it must not call into GRUB or the
+ * firmware: no allocation, no grub_errno, no output, no disk access.  Only
+ * pure computation on memory set up beforehand is safe.
+ */
+typedef void (*grub_efi_mp_job_t) (void *data, grub_size_t i, int on_ap);
+
+#ifdef GRUB_MACHINE_EFI
+/* Return the number of processors the jobs are spread over, 1 without MP
+   services or unless the efi_mp variable is set to 1.  */
+grub_size_t
+grub_efi_mp_processors (void);
+
+/* Run JOB (DATA, I, ...) for every I below N and return once all of them
+   have finished.  Called from within a job, it runs the jobs one after
+   the other on the calling processor, with ON_AP set.  If the APs don't
+   finish in time, GRUB_ERR_TIMEOUT is returned, some of the jobs may have
+   been cut short and the caller has to start over; the jobs then run on
+   the BSP.  */
+grub_err_t
+grub_efi_mp_run (grub_efi_mp_job_t job, void *data, grub_size_t n);
+#else
+static inline grub_size_t
+grub_efi_mp_processors (void)
+{
+  return 1;
+}
+
+static inline grub_err_t
+grub_efi_mp_run (grub_efi_mp_job_t job, void *data, grub_size_t n)
+{
+  grub_size_t i;
+
+  for (i = 0; i < n; i++)
+    job (data, i, 0);
+  return GRUB_ERR_NONE;
+}
+#endif
+#endif /* GRUB_EFI_MP_H */
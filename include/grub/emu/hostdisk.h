@@ -88,8 +88,17 @@ struct grub_util_hostdisk_data
   grub_util_fd_t fd;
   int is_disk;
   int device_map;
+  /* FD was opened with O_DIRECT and must be read through
+     grub_hostdisk_linux_read_direct.  */
+  int direct;
 };
 
+#ifdef __linux__
+ssize_t
+grub_hostdisk_linux_read_direct (struct grub_util_hostdisk_data *data,
+				 char *buf, size_t len);
+#endif
+
 void grub_host_init (void);
 void grub_host_fini (void);
 void grub_hostfs_init (void);
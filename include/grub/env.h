@@ -37,8 +37,7 @@ struct grub_env_var
   char *value;
   grub_env_read_hook_t read_hook;
   grub_env_write_hook_t write_hook;
-  struct grub_env_var *next;
-  struct grub_env_var **prevp;
+  grub_uint32_t hash;
   struct grub_env_var *sorted_next;
   int global;
 };
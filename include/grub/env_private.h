@@ -21,14 +21,25 @@
 
 #include <grub/env.h>
 
-/* The size of the hash table.  */
-#define	HASHSZ	13
-
 /* A hashtable for quick lookup of variables.  */
 struct grub_env_context
 {
-  /* A hash table for variables.  */
-  struct grub_env_var *vars[HASHSZ];
+  /*
+   * An open addressing hash table of the variables set in this context,
+   * with SIZE slots, a power of two.  COUNT are in use and USED are not
+   * free, counting those of removed variables.
+   */
+  struct grub_env_var **vars;
+  grub_size_t size;
+  grub_size_t count;
+  grub_size_t used;
+
+  /*
+   * Variables of PREV are seen through this context until they are set
+   * here: all of them if INHERIT_ALL is set, otherwise only the exported
+   * ones.
+   */
+  int inherit_all;
 
   /* One level deeper on the stack.  */
   struct grub_env_context *prev;
@@ -43,4 +54,6 @@ struct grub_env_sorted_var
 
 extern struct grub_env_context *EXPORT_VAR(grub_current_context);
 
+void EXPORT_FUNC(grub_env_context_free_vars) (struct grub_env_context *context);
+
 #endif /* ! GRUB_ENV_PRIVATE_HEADER */
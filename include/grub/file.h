@@ -129,6 +129,8 @@ enum grub_file_type
 
     GRUB_FILE_TYPE_LOADENV,
     GRUB_FILE_TYPE_SAVEENV,
+    /* List of disk ranges read during boot for prefetch.  */
+    GRUB_FILE_TYPE_PREFETCH_LIST,
 
     GRUB_FILE_TYPE_VERIFY_SIGNATURE,
 
@@ -166,6 +168,11 @@ struct grub_file
   /* If file is not easily seekable. Should be set by underlying layer.  */
   int not_easily_seekable;
 
+  /* Set by the underlying layer when the data was compressed for transfer
+     only, to the filter that restores the file.  */
+  struct grub_file *(*transfer_decode) (struct grub_file *in,
+					enum grub_file_type type);
+
   /* Filesystem-specific data.  */
   void *data;
 
@@ -186,9 +193,11 @@ typedef enum grub_file_filter_id
     GRUB_FILE_FILTER_GZIO,
     GRUB_FILE_FILTER_XZIO,
     GRUB_FILE_FILTER_LZOPIO,
+    GRUB_FILE_FILTER_ZSTDIO,
+    GRUB_FILE_FILTER_LZ4IO,
     GRUB_FILE_FILTER_MAX,
     GRUB_FILE_FILTER_COMPRESSION_FIRST = GRUB_FILE_FILTER_GZIO,
-    GRUB_FILE_FILTER_COMPRESSION_LAST = GRUB_FILE_FILTER_LZOPIO,
+    GRUB_FILE_FILTER_COMPRESSION_LAST = GRUB_FILE_FILTER_LZ4IO,
   } grub_file_filter_id_t;
 
 typedef grub_file_t (*grub_file_filter_t) (grub_file_t in, enum grub_file_type type);
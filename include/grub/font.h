@@ -45,6 +45,13 @@ struct grub_font
   grub_uint32_t num_chars;
   struct char_index_entry *char_index;
   grub_uint16_t *bmp_idx;
+
+  /* For a large font the index stays in the file, starting at
+     INDEX_OFFSET, and only the first code point of every page of it is
+     kept.  Glyphs are then found in LOADED_GLYPHS once they are read.  */
+  grub_off_t index_offset;
+  grub_uint32_t *index_page_code;
+  struct loaded_glyph **loaded_glyphs;
 };
 
 /* Font type used to access font functions.  */
@@ -39,8 +39,12 @@ struct grub_dirhook_info
   unsigned mtimeset:1;
   unsigned case_insensitive:1;
   unsigned inodeset:1;
+  /* SIZE is the size of a regular file, as grub_file_open would report
+     it, so listings don't have to open every file.  */
+  unsigned sizeset:1;
   grub_int64_t mtime;
   grub_uint64_t inode;
+  grub_uint64_t size;
 };
 
 typedef int (*grub_fs_dir_hook_t) (const char *filename,
@@ -62,6 +62,47 @@ EXPORT_FUNC(grub_fshelp_find_file) (const char *path,
 				    enum grub_fshelp_filetype expect);
 
 
+/* Lets grub_fshelp_find_file_cached remember directory lookups across
+   mounts.  NODE_ID returns a number identifying NODE on its filesystem,
+   e.g. its inode number.  NODE_FROM_ID creates a new malloc'ed node for
+   the entry ID of the directory DIR.  */
+struct grub_fshelp_dcache_ops
+{
+  grub_uint64_t (*node_id) (grub_fshelp_node_t node);
+  grub_fshelp_node_t (*node_from_id) (grub_fshelp_node_t dir,
+				      grub_uint64_t id);
+};
+
+/* Like grub_fshelp_find_file, but the result of looking up a name in a
+   directory of the filesystem on DISK is cached, including misses.  The
+   cache survives unmounting and is dropped whenever
+   grub_disk_generation changes.  */
+grub_err_t
+EXPORT_FUNC(grub_fshelp_find_file_cached) (const char *path,
+					   grub_fshelp_node_t rootnode,
+					   grub_fshelp_node_t *foundnode,
+					   int (*iterate_dir) (grub_fshelp_node_t dir,
+							       grub_fshelp_iterate_dir_hook_t hook,
+							       void *hook_data),
+					   char *(*read_symlink) (grub_fshelp_node_t node),
+					   enum grub_fshelp_filetype expect,
+					   grub_disk_t disk,
+					   const struct grub_fshelp_dcache_ops *ops);
+
+grub_err_t
+EXPORT_FUNC(grub_fshelp_find_file_lookup_cached) (const char *path,
+						  grub_fshelp_node_t rootnode,
+						  grub_fshelp_node_t *foundnode,
+						  grub_err_t (*lookup_file) (grub_fshelp_node_t dir,
+									     const char *name,
+									     grub_fshelp_node_t *foundnode,
+									     enum grub_fshelp_filetype *foundtype),
+						  char *(*read_symlink) (grub_fshelp_node_t node),
+						  enum grub_fshelp_filetype expect,
+						  grub_disk_t disk,
+						  const struct grub_fshelp_dcache_ops *ops);
+
+
 grub_err_t
 EXPORT_FUNC(grub_fshelp_find_file_lookup) (const char *path,
 					   grub_fshelp_node_t rootnode,
@@ -88,4 +129,35 @@ EXPORT_FUNC(grub_fshelp_read_file) (grub_disk_t disk, grub_fshelp_node_t node,
 				    grub_off_t filesize, int log2blocksize,
 				    grub_disk_addr_t blocks_start);
 
+/* Like grub_fshelp_read_file, but GET_EXTENT also sets COUNT to the
+   number of blocks starting at BLOCK that are contiguous on disk (or,
+   if 0 is returned, that are absent).  Each such run is read with a
+   single disk read.  */
+grub_ssize_t
+EXPORT_FUNC(grub_fshelp_read_file_extents) (grub_disk_t disk,
+					    grub_fshelp_node_t node,
+					    grub_disk_read_hook_t read_hook,
+					    void *read_hook_data,
+					    grub_off_t pos, grub_size_t len,
+					    char *buf,
+					    grub_disk_addr_t (*get_extent) (grub_fshelp_node_t node,
+									    grub_disk_addr_t block,
+									    grub_disk_addr_t *count),
+					    grub_off_t filesize,
+					    int log2blocksize,
+					    grub_disk_addr_t blocks_start);
+
+/* Filesystems keep their mounts across grub_device_open/close cycles
+   by handing them to grub_fshelp_mount_put instead of freeing them and
+   asking grub_fshelp_mount_get before mounting DISK again.  The mounts
+   are keyed by FSNAME and the partition of DISK.  A mount returned by
+   grub_fshelp_mount_get belongs to the caller until it is put back, and
+   the module must call grub_fshelp_mount_flush before it is unloaded.  */
+void *EXPORT_FUNC(grub_fshelp_mount_get) (const char *fsname,
+					  grub_disk_t disk);
+void EXPORT_FUNC(grub_fshelp_mount_put) (const char *fsname,
+					 grub_disk_t disk, void *data,
+					 void (*free_data) (void *data));
+void EXPORT_FUNC(grub_fshelp_mount_flush) (const char *fsname);
+
 #endif /* ! GRUB_FSHELP_HEADER */
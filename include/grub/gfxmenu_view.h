@@ -80,6 +80,12 @@ int grub_font_get_string_width (grub_font_t font,
 #include <grub/gfxwidgets.h>
 #include <grub/icon_manager.h>
 
+/* Load the image in FILENAME, or take another reference to the bitmap if
+   it has been loaded before.  The bitmap must not be modified.  */
+grub_err_t grub_gfxmenu_bitmap_load (struct grub_video_bitmap **bitmap,
+				     const char *filename);
+void grub_gfxmenu_bitmap_cache_flush (void);
+
 /* Definition of the private representation of the view.  */
 struct grub_gfxmenu_view
 {
@@ -69,6 +69,10 @@ struct grub_gui_list_ops
                          grub_gfxmenu_view_t view);
   void (*refresh_list) (void *self,
                         grub_gfxmenu_view_t view);
+  /* Get the area of the row of ENTRY, if it is shown as the list is
+     scrolled now.  */
+  int (*get_entry_bounds) (void *self, int entry,
+                           grub_video_rect_t *bounds);
 };
 
 struct grub_gui_progress_ops
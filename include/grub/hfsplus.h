@@ -69,6 +69,14 @@ struct grub_hfsplus_volheader
   struct grub_hfsplus_forkdata startup_file;
 } GRUB_PACKED;
 
+/* A run of blocks of a fork, decoded from its extents.  */
+struct grub_hfsplus_run
+{
+  grub_uint64_t fileblock;
+  grub_uint32_t start;
+  grub_uint32_t count;
+};
+
 struct grub_hfsplus_compress_index
 {
   grub_uint32_t start;
@@ -90,6 +98,9 @@ struct grub_hfsplus_file
   struct grub_hfsplus_compress_index *compress_index;
   grub_uint32_t cbuf_block;
   grub_uint32_t compress_index_size;
+  /* All extents of the fork being read, when decoded on open.  */
+  struct grub_hfsplus_run *runs;
+  grub_size_t nruns;
 };
 
 struct grub_hfsplus_btree
@@ -101,6 +112,18 @@ struct grub_hfsplus_btree
   struct grub_hfsplus_file file;
 };
 
+#define GRUB_HFSPLUS_BTNODE_CACHE_SIZE 32
+
+/* A B-tree node kept by the node cache of a mount.  */
+struct grub_hfsplus_btnode_cache
+{
+  struct grub_hfsplus_btree *tree;
+  grub_uint64_t nodeno;
+  unsigned long last_use;
+  grub_size_t alloc;
+  char *buf;
+};
+
 /* Information about a "mounted" HFS+ filesystem.  */
 struct grub_hfsplus_data
 {
@@ -122,6 +145,10 @@ struct grub_hfsplus_data
      filesystem (one inside a plain HFS wrapper).  */
   grub_disk_addr_t embedded_offset;
   int case_sensitive;
+
+  /* Recently read nodes of the catalog, extents and attributes trees.  */
+  unsigned long btnode_clock;
+  struct grub_hfsplus_btnode_cache btnode_cache[GRUB_HFSPLUS_BTNODE_CACHE_SIZE];
 };
 
 /* Internal representation of a catalog key.  */
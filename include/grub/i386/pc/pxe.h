@@ -19,7 +19,9 @@
 #ifndef GRUB_CPU_PXE_H
 #define GRUB_CPU_PXE_H
 
+#ifndef ASM_FILE
 #include <grub/types.h>
+#endif
 
 #define GRUB_PXENV_TFTP_OPEN			0x0020
 #define GRUB_PXENV_TFTP_CLOSE			0x0021
@@ -161,6 +163,31 @@
 
 #define GRUB_PXE_ERR_LEN	0xFFFFFFFF
 
+#define GRUB_PXE_ISR_IN_START		1
+#define GRUB_PXE_ISR_IN_PROCESS		2
+#define GRUB_PXE_ISR_IN_GET_NEXT	3
+
+#define GRUB_PXE_ISR_OUT_OURS		0
+#define GRUB_PXE_ISR_OUT_NOT_OURS	1
+
+#define GRUB_PXE_ISR_OUT_DONE		0
+#define GRUB_PXE_ISR_OUT_TRANSMIT	2
+#define GRUB_PXE_ISR_OUT_RECEIVE	3
+#define GRUB_PXE_ISR_OUT_BUSY		4
+
+/* Layout of the receive ring filled by grub_pxe_recv_ring.  The header
+   starts with the UNDI ISR block and is followed by the slots, each one
+   holding the length of a frame and then the frame.  */
+#define GRUB_PXE_RING_NEXT		16
+#define GRUB_PXE_RING_NSLOTS		18
+#define GRUB_PXE_RING_COUNT		20
+#define GRUB_PXE_RING_DONE		22
+#define GRUB_PXE_RING_ENTRY		24
+#define GRUB_PXE_RING_RECEIVED		28
+#define GRUB_PXE_RING_HEADER_SIZE	32
+#define GRUB_PXE_RING_SLOT_SIZE		0x610
+#define GRUB_PXE_RING_SLOT_DATA		16
+
 #ifndef ASM_FILE
 
 #define GRUB_PXE_SIGNATURE "PXENV+"
@@ -282,6 +309,37 @@ struct grub_pxenv_unload_stack
 
 int EXPORT_FUNC(grub_pxe_call) (int func, void * data, grub_uint32_t pxe_rm_entry) __attribute__ ((regparm(3)));
 
+struct grub_pxe_ring
+{
+  grub_uint16_t isr_status;
+  grub_uint16_t isr_func_flag;
+  grub_uint16_t isr_buffer_len;
+  grub_uint16_t isr_frame_len;
+  grub_uint16_t isr_frame_hdr_len;
+  grub_uint32_t isr_buffer;
+  grub_uint8_t isr_prot_type;
+  grub_uint8_t isr_pkt_type;
+  /* GRUB_PXE_ISR_IN_START or GRUB_PXE_ISR_IN_GET_NEXT.  */
+  grub_uint16_t next;
+  grub_uint16_t nslots;
+  grub_uint16_t count;
+  grub_uint16_t done;
+  grub_uint32_t entry;
+  grub_uint16_t received;
+  grub_uint16_t reserved;
+} GRUB_PACKED;
+
+struct grub_pxe_ring_slot
+{
+  grub_uint16_t frame_len;
+  grub_uint8_t reserved[GRUB_PXE_RING_SLOT_DATA - 2];
+  grub_uint8_t data[GRUB_PXE_RING_SLOT_SIZE - GRUB_PXE_RING_SLOT_DATA];
+} GRUB_PACKED;
+
+/* Drain the frames the UNDI has received into the slots of RING, which
+   must be paragraph aligned in low memory, in one trip to real mode.  */
+void EXPORT_FUNC(grub_pxe_recv_ring) (struct grub_pxe_ring *ring) __attribute__ ((regparm(3)));
+
 extern struct grub_pxe_bangpxe *grub_pxe_pxenv;
 
 void *
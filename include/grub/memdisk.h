@@ -0,0 +1,51 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GRUB_MEMDISK_HEADER
+#define GRUB_MEMDISK_HEADER	1
+
+#include <grub/types.h>
+
+/*
+ * A compressed memdisk image is cut into chunks of CHUNK_SIZE bytes, the
+ * last one possibly shorter, each compressed on its own.  The header is
+ * followed by NCHUNKS + 1 offsets from the start of the header: chunk I
+ * is stored between offsets I and I + 1, as is when that is its full
+ * size.  All the numbers are little endian.
+ */
+
+#define GRUB_MEMDISK_CHUNKED_MAGIC	"GRUBMDZ1"
+#define GRUB_MEMDISK_CHUNK_SIZE		65536
+
+enum
+  {
+    /* Raw LZ4 blocks, without the frame format.  */
+    GRUB_MEMDISK_COMPRESSION_LZ4 = 1
+  };
+
+struct grub_memdisk_chunked_header
+{
+  char magic[8];
+  grub_uint32_t compression;
+  grub_uint32_t chunk_size;
+  /* The size of the disk, a multiple of 512.  */
+  grub_uint64_t size;
+  grub_uint64_t nchunks;
+} GRUB_PACKED;
+
+#endif /* ! GRUB_MEMDISK_HEADER */
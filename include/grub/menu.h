@@ -71,6 +71,12 @@ struct grub_menu
 
   /* The list of menu entries.  */
   grub_menu_entry_t entry_list;
+
+  /* The first INDEXED entries of the list by their index, filled in as
+     grub_menu_get_entry is asked for them.  */
+  grub_menu_entry_t *entries;
+  int indexed;
+  int entries_alloc;
 };
 typedef struct grub_menu *grub_menu_t;
 
@@ -46,6 +46,23 @@ typedef grub_err_t (*grub_mm_add_region_func_t) (grub_size_t, unsigned int);
 extern grub_mm_add_region_func_t EXPORT_VAR(grub_mm_add_region_fn);
 #endif
 
+/*
+ * Functions used to get and give back page aligned memory of `grub_size_t`
+ * bytes straight from the firmware. The first one returns NULL if it
+ * cannot.
+ */
+typedef void *(*grub_mm_alloc_pages_func_t) (grub_size_t);
+typedef void (*grub_mm_free_pages_func_t) (void *, grub_size_t);
+
+/*
+ * Set these function pointers to serve large allocations from pages of
+ * their own rather than from the regions.
+ */
+#ifndef GRUB_MACHINE_EMU
+extern grub_mm_alloc_pages_func_t EXPORT_VAR(grub_mm_alloc_pages_fn);
+extern grub_mm_free_pages_func_t EXPORT_VAR(grub_mm_free_pages_fn);
+#endif
+
 void grub_mm_init_region (void *addr, grub_size_t size);
 void *EXPORT_FUNC(grub_calloc) (grub_size_t nmemb, grub_size_t size);
 void *EXPORT_FUNC(grub_malloc) (grub_size_t size);
@@ -56,6 +73,49 @@ void *EXPORT_FUNC(grub_realloc) (void *ptr, grub_size_t size);
 void *EXPORT_FUNC(grub_memalign) (grub_size_t align, grub_size_t size);
 #endif
 
+/* The number of bytes in the free blocks of the heap, without the memory
+   the heap could still be grown by.  */
+grub_size_t EXPORT_FUNC(grub_mm_free_size) (void);
+
+/* A cache whose memory the heap can take back when it runs short.  When
+   an allocation would otherwise grow the heap, caches holding more than
+   their BUDGET are trimmed down to it.  When it would fail, they are
+   emptied as far as they can be.  */
+struct grub_mm_cache
+{
+  struct grub_mm_cache *next;
+  struct grub_mm_cache **prev;
+  const char *name;
+  /* Bytes held, kept current with grub_mm_cache_charge and
+     grub_mm_cache_uncharge.  */
+  grub_size_t used;
+  /* Bytes the cache may keep under memory pressure.  */
+  grub_size_t budget;
+  /* Free about TARGET bytes, or as much as possible, and return how many
+     were freed.  Called from within the allocator, so it must not
+     allocate memory.  */
+  grub_size_t (*reclaim) (struct grub_mm_cache *cache, grub_size_t target);
+};
+
+void EXPORT_FUNC(grub_mm_cache_register) (struct grub_mm_cache *cache);
+void EXPORT_FUNC(grub_mm_cache_unregister) (struct grub_mm_cache *cache);
+
+/* Trim the caches to their budgets and then, if fewer than TARGET bytes
+   were freed, below them.  Return the number of bytes freed.  */
+grub_size_t EXPORT_FUNC(grub_mm_cache_reclaim) (grub_size_t target);
+
+static inline void
+grub_mm_cache_charge (struct grub_mm_cache *cache, grub_size_t size)
+{
+  cache->used += size;
+}
+
+static inline void
+grub_mm_cache_uncharge (struct grub_mm_cache *cache, grub_size_t size)
+{
+  cache->used -= size;
+}
+
 void grub_mm_check_real (const char *file, int line);
 #define grub_mm_check() grub_mm_check_real (GRUB_FILE, __LINE__);
 
@@ -66,6 +126,11 @@ extern int EXPORT_VAR(grub_mm_debug);
 
 void EXPORT_FUNC(grub_mm_dump_free) (void);
 void EXPORT_FUNC(grub_mm_dump) (unsigned lineno);
+void EXPORT_FUNC(grub_mm_dump_slabs) (void);
+/* Heap use by the module that made each live allocation.  */
+void EXPORT_FUNC(grub_mm_dump_owners) (void);
+/* Free memory, free blocks and the largest free block of each region.  */
+void EXPORT_FUNC(grub_mm_dump_regions) (void);
 
 #define grub_calloc(nmemb, size)	\
   grub_debug_calloc (GRUB_FILE, __LINE__, nmemb, size)
@@ -90,13 +90,26 @@ typedef struct grub_mm_region
   /* How many bytes are in this region? (free and allocated) */
   grub_size_t size;
 
+  /*
+   * The root of the size index of the free blocks, see kern/mm.c. It is
+   * only kept up to date while 'indexed' is set.
+   */
+  struct grub_mm_header *index;
+  grub_size_t indexed;
+
   /* pad to a multiple of cell size */
-  char padding[3 * GRUB_CPU_SIZEOF_VOID_P];
+  char padding[GRUB_CPU_SIZEOF_VOID_P];
 }
 *grub_mm_region_t;
 
 #ifndef GRUB_MACHINE_EMU
 extern grub_mm_region_t EXPORT_VAR (grub_mm_base);
+
+/*
+ * Code changing the free rings of the regions behind the back of the
+ * allocator must call this before the next allocation or free.
+ */
+void EXPORT_FUNC (grub_mm_drop_index) (void);
 #endif
 
 static inline void
@@ -0,0 +1,55 @@
+/* modpack.h - the archive of the modules of a platform directory */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GRUB_MODPACK_HEADER
+#define GRUB_MODPACK_HEADER	1
+
+#include <grub/types.h>
+
+/*
+ * modules.pack holds the modules of a platform directory in one file: a
+ * header, the index of the modules sorted by name, then their data.  Each
+ * module is stored as its .mod file was installed, possibly compressed.
+ * All the numbers are little endian.
+ */
+
+#define GRUB_MODPACK_FILENAME	"modules.pack"
+#define GRUB_MODPACK_MAGIC	"GRUBMPK1"
+#define GRUB_MODPACK_NAME_SIZE	48
+/* The most modules an archive can index.  */
+#define GRUB_MODPACK_MAX_ENTRIES	4096
+
+struct grub_modpack_header
+{
+  char magic[8];
+  grub_uint32_t nentries;
+  grub_uint32_t reserved;
+} GRUB_PACKED;
+
+struct grub_modpack_entry
+{
+  /* The module name, without the .mod suffix, padded with NUL bytes.  */
+  char name[GRUB_MODPACK_NAME_SIZE];
+  /* The offset of the data from the start of the archive.  */
+  grub_uint64_t offset;
+  grub_uint32_t size;
+  grub_uint32_t reserved;
+} GRUB_PACKED;
+
+#endif /* ! GRUB_MODPACK_HEADER */
@@ -80,6 +80,10 @@ struct grub_net_card_driver
   grub_err_t (*send) (struct grub_net_card *dev,
 		      struct grub_net_buff *buf);
   struct grub_net_buff * (*recv) (struct grub_net_card *dev);
+  /* Optional: receive up to MAX frames into BUFS at once and return how
+     many were received.  Fewer than MAX means that the card is drained.  */
+  grub_size_t (*recv_batch) (struct grub_net_card *dev,
+			     struct grub_net_buff **bufs, grub_size_t max);
 };
 
 typedef struct grub_net_packet
@@ -110,7 +114,7 @@ struct grub_net_slaac_mac_list
   char *name;
 };
 
-struct grub_net_link_layer_entry;
+struct grub_net_link_layer_table;
 
 struct grub_net_card
 {
@@ -127,7 +131,7 @@ struct grub_net_card
   grub_size_t mtu;
   struct grub_net_slaac_mac_list *slaac_list;
   grub_ssize_t new_ll_entry;
-  struct grub_net_link_layer_entry *link_layer_table;
+  struct grub_net_link_layer_table *link_layer_table;
   void *txbuf;
   void *rcvbuf;
   grub_size_t rcvbufsize;
@@ -554,6 +558,10 @@ grub_net_network_level_interface_unregister (struct grub_net_network_level_inter
 void
 grub_net_tcp_retransmit (void);
 
+/* Send the ACKs the segments of the last poll are waiting for.  */
+void
+grub_net_tcp_flush_acks (void);
+
 void
 grub_net_link_layer_add_address (struct grub_net_card *card,
 				 const grub_net_network_level_address_t *nl,
@@ -566,6 +574,11 @@ grub_err_t
 grub_net_link_layer_resolve (struct grub_net_network_level_interface *inf,
 			     const grub_net_network_level_address_t *proto_addr,
 			     grub_net_link_level_address_t *hw_addr);
+/* Start resolving PROTO_ADDR without waiting, so that the answer is
+   there by the time it is needed.  */
+void
+grub_net_link_layer_prefetch (struct grub_net_network_level_interface *inf,
+			      const grub_net_network_level_address_t *proto_addr);
 grub_err_t
 grub_net_dns_lookup (const char *name,
 		     const struct grub_net_network_level_address *servers,
@@ -24,6 +24,7 @@
 typedef enum grub_net_ip_protocol
   {
     GRUB_NET_IP_ICMP = 1,
+    GRUB_NET_IP_IGMP = 2,
     GRUB_NET_IP_TCP = 6,
     GRUB_NET_IP_UDP = 17,
     GRUB_NET_IP_ICMPV6 = 58
@@ -44,6 +45,17 @@ grub_net_ipv6_get_id (const grub_net_link_level_address_t *addr)
 
 grub_uint16_t grub_net_ip_chksum(void *ipv, grub_size_t len);
 
+/* Add the one's complement sum of LEN bytes at DATA to SUM, which starts
+   at 0.  All of them but the last piece summed must have an even length.  */
+grub_uint32_t grub_net_ip_chksum_add (grub_uint32_t sum, const void *data,
+				      grub_size_t len);
+/* The checksum, as it is stored, of the data summed into SUM.  */
+grub_uint16_t grub_net_ip_chksum_finish (grub_uint32_t sum);
+/* The new CHKSUM after a 32-bit word it covers changed from OLD to NEW.  */
+grub_uint16_t grub_net_ip_chksum_update32 (grub_uint16_t chksum,
+					   grub_uint32_t old,
+					   grub_uint32_t new);
+
 grub_err_t
 grub_net_recv_ip_packets (struct grub_net_buff *nb,
 			  struct grub_net_card *card,
@@ -74,12 +86,30 @@ grub_net_recv_icmp6_packet (struct grub_net_buff *nb,
 grub_err_t
 grub_net_recv_udp_packet (struct grub_net_buff *nb,
 			  struct grub_net_network_level_interface *inf,
-			  const grub_net_network_level_address_t *src);
+			  const grub_net_network_level_address_t *src,
+			  const grub_net_network_level_address_t *dest);
 grub_err_t
 grub_net_recv_tcp_packet (struct grub_net_buff *nb,
 			  struct grub_net_network_level_interface *inf,
 			  const grub_net_network_level_address_t *source);
 
+grub_err_t
+grub_net_recv_igmp_packet (struct grub_net_buff *nb,
+			   struct grub_net_network_level_interface *inf);
+
+/* Receive the datagrams sent to the IPv4 multicast GROUP on INF, until it
+   is left as many times as it was joined.  */
+grub_err_t
+grub_net_ip_join_group (struct grub_net_network_level_interface *inf,
+			const grub_net_network_level_address_t *group);
+void
+grub_net_ip_leave_group (struct grub_net_network_level_interface *inf,
+			 const grub_net_network_level_address_t *group);
+/* The interface on CARD that joined the group DEST, if DEST is one.  */
+struct grub_net_network_level_interface *
+grub_net_ip_group_interface (struct grub_net_card *card,
+			     const grub_net_network_level_address_t *dest);
+
 grub_uint16_t
 grub_net_ip_transport_checksum (struct grub_net_buff *nb,
 				grub_uint16_t proto,
@@ -93,6 +123,12 @@ grub_err_t
 grub_net_icmp6_send_request (struct grub_net_network_level_interface *inf,
 			     const grub_net_network_level_address_t *proto_addr);
 
+grub_err_t
+grub_net_icmp6_prefetch (struct grub_net_network_level_interface *inf,
+			 const grub_net_network_level_address_t *proto_addr);
+
 grub_err_t
 grub_net_icmp6_send_router_solicit (struct grub_net_network_level_interface *inf);
+
+extern int grub_net_icmp6_ra_received;
 #endif
@@ -27,5 +27,10 @@ grub_err_t grub_netbuff_clear (struct grub_net_buff *net_buff);
 struct grub_net_buff * grub_netbuff_alloc (grub_size_t len);
 struct grub_net_buff * grub_netbuff_make_pkt (grub_size_t len);
 void grub_netbuff_free (struct grub_net_buff *net_buff);
+/* Make sure that COUNT buffers of LEN bytes wait in the pool of freed
+   buffers, as far as it has room.  */
+grub_err_t grub_netbuff_pool_reserve (grub_size_t len, unsigned count);
+/* Give the pooled buffers back to the heap.  */
+void grub_netbuff_pool_drain (void);
 
 #endif
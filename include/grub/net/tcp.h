@@ -76,6 +76,18 @@ grub_net_tcp_accept (grub_net_tcp_socket_t sock,
 				       void *data),
 		     void *hook_data);
 
+/* Hand an open connection over to new hooks.  */
+void
+grub_net_tcp_set_hooks (grub_net_tcp_socket_t sock,
+			grub_err_t (*recv_hook) (grub_net_tcp_socket_t sock,
+						 struct grub_net_buff *nb,
+						 void *data),
+			void (*error_hook) (grub_net_tcp_socket_t sock,
+					    void *data),
+			void (*fin_hook) (grub_net_tcp_socket_t sock,
+					  void *data),
+			void *hook_data);
+
 void
 grub_net_tcp_stall (grub_net_tcp_socket_t sock);
 
@@ -43,6 +43,11 @@ grub_net_udp_open (grub_net_network_level_address_t addr,
 void
 grub_net_udp_close (grub_net_udp_socket_t sock);
 
+/* Receive on the local PORT instead of the one picked by grub_net_udp_open,
+   such as the port of a multicast stream.  */
+void
+grub_net_udp_set_in_port (grub_net_udp_socket_t sock, grub_uint16_t port);
+
 grub_err_t
 grub_net_send_udp_packet (const grub_net_udp_socket_t socket,
 			  struct grub_net_buff *nb);
@@ -88,6 +88,8 @@ enum
 #define GRUB_NTFS_COM_LOG_LEN	12
 #define GRUB_NTFS_COM_SEC		(GRUB_NTFS_COM_LEN >> GRUB_NTFS_BLK_SHR)
 #define GRUB_NTFS_LOG_COM_SEC		(GRUB_NTFS_COM_LOG_LEN - GRUB_NTFS_BLK_SHR)
+/* A compression unit is 16 clusters.  */
+#define GRUB_NTFS_LOG_COM_UNIT		4
 
 enum
   {
@@ -127,14 +129,41 @@ struct grub_ntfs_bpb
   grub_uint32_t checksum;
 } GRUB_PACKED;
 
+#define GRUB_NTFS_MFT_CACHE_SIZE	16
+#define GRUB_NTFS_COMP_CACHE_SIZE	4
+
+/* One decoded extent of a non-resident attribute.  */
+struct grub_ntfs_run
+{
+  grub_disk_addr_t vcn;
+  grub_disk_addr_t lcn;
+  grub_uint64_t len;
+  int sparse;
+};
+
+/* A decompressed compression unit.  */
+struct grub_ntfs_comp_unit
+{
+  /* The first VCN of the unit, or -1 if BUF holds nothing.  */
+  grub_disk_addr_t vcn;
+  grub_uint8_t *buf;
+};
+
 struct grub_ntfs_attr
 {
   int flags;
   grub_uint8_t *emft_buf, *edat_buf;
   grub_uint8_t *attr_cur, *attr_nxt, *attr_end;
-  grub_uint32_t save_pos;
-  grub_uint8_t *sbuf;
+  /* Units of a compressed attribute, replaced in turn, and the buffer
+     their clusters are read into.  */
+  struct grub_ntfs_comp_unit comp_units[GRUB_NTFS_COMP_CACHE_SIZE];
+  unsigned comp_next;
+  grub_uint8_t *comp_raw;
   struct grub_ntfs_file *mft;
+  /* Decoded run list of the attribute record at RUNS_PA.  */
+  const grub_uint8_t *runs_pa;
+  struct grub_ntfs_run *runs;
+  grub_size_t nruns;
 };
 
 struct grub_ntfs_file
@@ -158,22 +187,20 @@ struct grub_ntfs_data
   int log_spc;
   grub_uint64_t mft_start;
   grub_uint64_t uuid;
-};
-
-struct grub_ntfs_comp_table_element
-{
-  grub_uint32_t next_vcn;
-  grub_uint32_t next_lcn;
+  /* Fixed-up MFT records, replaced least recently used first.  */
+  struct
+  {
+    grub_uint64_t mftno;
+    unsigned long last_use;
+    grub_uint8_t *buf;
+  } mft_cache[GRUB_NTFS_MFT_CACHE_SIZE];
+  unsigned long mft_clock;
 };
 
 struct grub_ntfs_comp
 {
   grub_disk_t disk;
-  int comp_head, comp_tail;
-  struct grub_ntfs_comp_table_element comp_table[16];
-  grub_uint32_t cbuf_ofs, cbuf_vcn;
   int log_spc;
-  grub_uint8_t *cbuf;
 };
 
 struct grub_ntfs_rlst
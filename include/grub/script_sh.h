@@ -80,6 +80,13 @@ struct grub_script_argv
   unsigned argc;
   char **args;
   struct grub_script *script;
+
+  /* Slots allocated in ARGS, and the length and allocated size of LAST,
+     the argument being appended to.  */
+  unsigned alloc;
+  char *last;
+  grub_size_t last_len;
+  grub_size_t last_size;
 };
 
 /* Pluggable wildcard translator.  */
@@ -107,6 +114,16 @@ struct grub_script_cmdline
 
   /* The arguments for this command.  */
   struct grub_script_arglist *arglist;
+
+  /* Command this command line last resolved to, valid while
+     grub_command_generation still equals CMD_GENERATION.  */
+  struct grub_command *grubcmd;
+  unsigned long cmd_generation;
+
+  /* Function this command line last resolved to, valid while
+     grub_script_function_defined still equals FUNC_DEFINED.  */
+  struct grub_script_function *func;
+  unsigned long func_defined;
 };
 
 /* An if statement.  */
@@ -250,6 +267,8 @@ int grub_script_argv_next     (struct grub_script_argv *argv);
 int grub_script_argv_append   (struct grub_script_argv *argv, const char *s,
 			       grub_size_t slen);
 int grub_script_argv_split_append (struct grub_script_argv *argv, const char *s);
+char *grub_script_argv_reserve (struct grub_script_argv *argv, grub_size_t len);
+void grub_script_argv_commit (struct grub_script_argv *argv, grub_size_t len);
 
 struct grub_script_arglist *
 grub_script_create_arglist (struct grub_parser_param *state);
@@ -327,9 +346,23 @@ grub_err_t grub_script_execute_cmdif (struct grub_script_cmd *cmd);
 grub_err_t grub_script_execute_cmdfor (struct grub_script_cmd *cmd);
 grub_err_t grub_script_execute_cmdwhile (struct grub_script_cmd *cmd);
 
+/* Flags for grub_script_execute_source.  */
+enum
+  {
+    /*
+     * Read the source as a configuration file: carriage returns and lines
+     * starting with '#' are dropped, and a command that does not parse is
+     * reported before going on with the next one.
+     */
+    GRUB_SCRIPT_SOURCE_CONFIG = 1
+  };
+
 /* Execute any GRUB pre-parsed command or script.  */
 grub_err_t grub_script_execute (struct grub_script *script);
 grub_err_t grub_script_execute_sourcecode (const char *source);
+grub_err_t grub_script_execute_source (const char *source, grub_size_t size,
+				       int flags);
+void grub_script_cache_flush (void);
 grub_err_t grub_script_execute_new_scope (const char *source, int argc, char **args);
 
 /* Break command for loops.  */
@@ -367,6 +400,8 @@ struct grub_script_function
 typedef struct grub_script_function *grub_script_function_t;
 
 extern grub_script_function_t grub_script_function_list;
+/* Number of function definitions so far.  */
+extern unsigned long grub_script_function_defined;
 
 #define FOR_SCRIPT_FUNCTIONS(var) for((var) = grub_script_function_list; \
 				      (var); (var) = (var)->next)
@@ -86,6 +86,9 @@ struct grub_scsi
   /* Type of SCSI device.  XXX: Make enum.  */
   grub_uint8_t devtype;
 
+  /* Version of the SCSI standard the device claims.  */
+  grub_uint8_t version;
+
   int bus;
 
   /* Number of LUNs.  */
@@ -103,6 +106,14 @@ struct grub_scsi
   /* Size of one block.  */
   grub_uint32_t blocksize;
 
+  /* Largest transfer of a single command in bytes, set by the driver.
+     0 means the default of 32KiB.  */
+  grub_size_t max_transfer;
+
+  /* Largest transfer of a single command in blocks, as the device
+     reports in its Block Limits page.  0 means no limit.  */
+  grub_uint32_t max_blocks;
+
   /* Device-specific data.  */
   void *data;
 };
@@ -24,6 +24,15 @@
 #define GRUB_SCSI_DEVTYPE_MASK	31
 #define GRUB_SCSI_REMOVABLE_BIT	7
 #define GRUB_SCSI_LUN_SHIFT	5
+#define GRUB_SCSI_INQUIRY_EVPD	1
+
+/* Vital product data pages.  */
+#define GRUB_SCSI_VPD_SUPPORTED_PAGES	0x00
+#define GRUB_SCSI_VPD_BLOCK_LIMITS	0xb0
+
+/* The first version of SPC whose devices are expected to report the
+   VPD pages they support.  */
+#define GRUB_SCSI_VERSION_SPC3	5
 
 struct grub_scsi_test_unit_ready
 {
@@ -51,7 +60,8 @@ struct grub_scsi_inquiry_data
 {
   grub_uint8_t devtype;
   grub_uint8_t rmb;
-  grub_uint16_t reserved;
+  grub_uint8_t version;
+  grub_uint8_t reserved;
   grub_uint8_t length;
   grub_uint8_t reserved2[3];
   char vendor[8];
@@ -59,6 +69,23 @@ struct grub_scsi_inquiry_data
   char prodrev[4];
 } GRUB_PACKED;
 
+struct grub_scsi_vpd_header
+{
+  grub_uint8_t devtype;
+  grub_uint8_t page;
+  grub_uint16_t length;
+} GRUB_PACKED;
+
+struct grub_scsi_block_limits_data
+{
+  struct grub_scsi_vpd_header header;
+  grub_uint8_t wsnz;
+  grub_uint8_t max_compare_write;
+  grub_uint16_t opt_transfer_granularity;
+  grub_uint32_t max_transfer;
+  grub_uint32_t opt_transfer;
+} GRUB_PACKED;
+
 struct grub_scsi_request_sense
 {
   grub_uint8_t opcode;
@@ -101,6 +101,10 @@ struct grub_serial_port
           grub_uint8_t access_size;
         } mmio;
       };
+      /* Bytes the transmitter FIFO holds, and how many more can be written
+         before the line status has to be checked again.  */
+      grub_uint8_t fifo_size;
+      grub_uint8_t tx_room;
     };
     struct
     {
@@ -0,0 +1,43 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GRUB_SHA_HW_HEADER
+#define GRUB_SHA_HW_HEADER	1
+
+#include <grub/types.h>
+
+#define GRUB_SHA_HW_BLOCK_SIZE	64
+
+/* Primitives of the CPU SHA instructions, provided by each
+   architecture.  */
+
+/* Return non-zero if the CPU has the SHA-1 instructions.  */
+int grub_sha1_hw_supported (void);
+
+/* Compress NBLOCKS blocks of DATA into the five words of STATE.  */
+void grub_sha1_hw_transform (grub_uint32_t *state, const grub_uint8_t *data,
+			     grub_size_t nblocks);
+
+/* Return non-zero if the CPU has the SHA-256 instructions.  */
+int grub_sha256_hw_supported (void);
+
+/* Compress NBLOCKS blocks of DATA into the eight words of STATE.  */
+void grub_sha256_hw_transform (grub_uint32_t *state, const grub_uint8_t *data,
+			       grub_size_t nblocks);
+
+#endif
@@ -117,6 +117,9 @@ grub_term_color_state;
 /* Glyph description in visual order.  */
 #define GRUB_TERM_CODE_TYPE_VISUAL_GLYPHS       (4 << GRUB_TERM_CODE_TYPE_SHIFT)
 
+/* Set on input terminals whose device GRUB polls itself and which only
+   buffer a few characters, so that the polling loops must not idle.  */
+#define GRUB_TERM_INPUT_POLLED		(1 << 0)
 
 /* Bitmasks for modifier keys returned by grub_getkeystatus.  */
 #define GRUB_TERM_STATUS_RSHIFT	(1 << 0)
@@ -159,6 +162,9 @@ struct grub_term_input
   int (*getkeystatus) (struct grub_term_input *term);
 
   void *data;
+
+  /* The GRUB_TERM_INPUT_* flags.  */
+  grub_uint32_t flags;
 };
 typedef struct grub_term_input *grub_term_input_t;
 
@@ -242,6 +248,9 @@ extern struct grub_term_output *EXPORT_VAR(grub_term_outputs_disabled);
 extern struct grub_term_input *EXPORT_VAR(grub_term_inputs_disabled);
 extern struct grub_term_output *EXPORT_VAR(grub_term_outputs);
 extern struct grub_term_input *EXPORT_VAR(grub_term_inputs);
+/* Bumped whenever the widths of the characters on a terminal may have
+   changed, such as when gfxterm switches fonts.  */
+extern unsigned long EXPORT_VAR(grub_term_font_generation);
 
 static inline void
 grub_term_register_input (const char *name __attribute__ ((unused)),
@@ -330,6 +339,7 @@ void grub_putcode (grub_uint32_t code, struct grub_term_output *term);
 int EXPORT_FUNC(grub_getkey) (void);
 int EXPORT_FUNC(grub_getkey_noblock) (void);
 int EXPORT_FUNC(grub_getkeystatus) (void);
+void EXPORT_FUNC(grub_term_idle) (grub_uint32_t ms);
 int EXPORT_FUNC(grub_key_is_interrupt) (int key);
 void grub_cls (void);
 void EXPORT_FUNC(grub_refresh) (void);
@@ -39,6 +39,15 @@ struct grub_terminfo_input_state
   int (*readkey) (struct grub_term_input *term);
 };
 
+/* One character cell of the screen.  The second half of a double-width
+   character has a width of 0.  */
+struct grub_terminfo_cell
+{
+  grub_uint32_t code;
+  grub_uint8_t attr;
+  grub_uint8_t width;
+};
+
 struct grub_terminfo_output_state
 {
   struct grub_term_output *next;
@@ -57,6 +66,24 @@ struct grub_terminfo_output_state
   struct grub_term_coordinate pos;
 
   void (*put) (struct grub_term_output *term, const int c);
+
+  /*
+   * Terminals with grub_terminfo_refresh as refresh hook are drawn on
+   * SCREEN and only the cells which differ from SHADOW, what the terminal
+   * shows, are sent on refresh.
+   */
+  struct grub_terminfo_cell *screen;
+  struct grub_terminfo_cell *shadow;
+  struct grub_term_coordinate screen_size;
+  /* Where the cursor of the terminal is, if PHYS_POS_VALID.  */
+  struct grub_term_coordinate phys_pos;
+  int phys_pos_valid;
+  /* Attribute of what is drawn, of the terminal (or -1) and of the screen
+     after a pending clear.  */
+  int attr;
+  int phys_attr;
+  int cls_attr;
+  int cleared;
 };
 
 grub_err_t EXPORT_FUNC(grub_terminfo_output_init) (struct grub_term_output *term);
@@ -75,6 +102,7 @@ int EXPORT_FUNC (grub_terminfo_getkey) (struct grub_term_input *term);
 void EXPORT_FUNC (grub_terminfo_putchar) (struct grub_term_output *term,
 					  const struct grub_unicode_glyph *c);
 struct grub_term_coordinate EXPORT_FUNC (grub_terminfo_getwh) (struct grub_term_output *term);
+void EXPORT_FUNC (grub_terminfo_refresh) (struct grub_term_output *term);
 
 
 grub_err_t EXPORT_FUNC (grub_terminfo_output_register) (struct grub_term_output *term,
@@ -35,6 +35,25 @@ grub_cpu_idle(void)
 void EXPORT_FUNC(grub_millisleep) (grub_uint32_t ms);
 grub_uint64_t EXPORT_FUNC(grub_get_time_ms) (void);
 
+/* How long the polling loops idle between two polls, short enough for USB
+   keyboards.  Serial ports, whose FIFO fills in about 1.4 ms at 115200
+   baud, don't let the terminal loops idle at all, see grub_term_idle.  */
+#define GRUB_IDLE_POLL_MS	10
+
+#if !defined(GRUB_MACHINE_EMU) && !defined(GRUB_UTIL)
+/* Let the CPU sleep for up to MS milliseconds, less when the firmware has
+   input, where the platform can do so.  */
+void EXPORT_FUNC(grub_idle) (grub_uint32_t ms);
+
+void grub_install_idle (void (*idle_func) (grub_uint32_t ms));
+#else
+static inline void
+grub_idle (grub_uint32_t ms)
+{
+  grub_millisleep (ms);
+}
+#endif
+
 grub_uint64_t grub_rtc_get_time_ms (void);
 
 static __inline void
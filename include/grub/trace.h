@@ -0,0 +1,101 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GRUB_TRACE_HEADER
+#define GRUB_TRACE_HEADER	1
+
+#include <grub/types.h>
+#include <grub/symbol.h>
+
+/*
+ * Boot time tracing.  The kernel records how long the boot phases take,
+ * each as an event with its start and end, so that `boottime --trace' can
+ * show where the time went.  Recording is always on and costs two clock
+ * reads and a copy per event; the events are in clock ticks, converted
+ * to microseconds only when they are read.
+ */
+
+#define GRUB_TRACE_NAME_SIZE	24
+#define GRUB_TRACE_DETAIL_SIZE	40
+
+enum grub_trace_category
+  {
+    GRUB_TRACE_MODULE,
+    GRUB_TRACE_OPEN,
+    GRUB_TRACE_READ,
+    GRUB_TRACE_DISK,
+    GRUB_TRACE_VERIFY,
+    GRUB_TRACE_CONFIG
+  };
+
+struct grub_trace_event
+{
+  grub_uint64_t start;
+  grub_uint64_t end;
+  /* Bytes for reads, 0 otherwise.  */
+  grub_uint64_t arg;
+  enum grub_trace_category category;
+  char name[GRUB_TRACE_NAME_SIZE];
+  char detail[GRUB_TRACE_DETAIL_SIZE];
+};
+
+#ifndef GRUB_UTIL
+
+typedef grub_uint64_t (*grub_trace_clock_t) (void);
+
+extern struct grub_trace_event *EXPORT_VAR (grub_trace_events);
+extern grub_size_t EXPORT_VAR (grub_trace_nevents);
+extern grub_size_t EXPORT_VAR (grub_trace_dropped);
+
+grub_uint64_t EXPORT_FUNC (grub_trace_now) (void);
+
+/* Record an event of CATEGORY which started at START, a value of
+   grub_trace_now, and ends now.  NAME and DETAIL are copied and may be
+   NULL.  */
+void EXPORT_FUNC (grub_trace_record) (enum grub_trace_category category,
+				      const char *name, const char *detail,
+				      grub_uint64_t start, grub_uint64_t arg);
+
+const char *EXPORT_FUNC (grub_trace_category_name) (enum grub_trace_category category);
+
+/* Count in ticks of CLOCK, RATE microseconds per 2^32 ticks, from now on.
+   Ignored once events have been recorded, as they would mix units.  */
+void grub_trace_set_clock (grub_trace_clock_t clock, grub_uint32_t rate);
+
+grub_uint64_t EXPORT_FUNC (grub_trace_to_us) (grub_uint64_t ticks);
+
+#else
+
+static inline grub_uint64_t
+grub_trace_now (void)
+{
+  return 0;
+}
+
+static inline void
+grub_trace_record (enum grub_trace_category category __attribute__ ((unused)),
+		   const char *name __attribute__ ((unused)),
+		   const char *detail __attribute__ ((unused)),
+		   grub_uint64_t start __attribute__ ((unused)),
+		   grub_uint64_t arg __attribute__ ((unused)))
+{
+}
+
+#endif
+
+#endif /* ! GRUB_TRACE_HEADER */
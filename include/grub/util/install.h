@@ -43,9 +43,14 @@
   { "compress", GRUB_INSTALL_OPTIONS_INSTALL_COMPRESS,		  \
     "no|xz|gz|lzo", 0,				  \
     N_("compress GRUB files [optional]"), 1 },			          \
+  { "pack-modules", GRUB_INSTALL_OPTIONS_PACK_MODULES, 0, 0,	  \
+    N_("store the modules in a single archive file"), 1 },		  \
   {"core-compress", GRUB_INSTALL_OPTIONS_INSTALL_CORE_COMPRESS,		\
-      "xz|none|auto",						\
+      "xz|lz4|none|auto",					\
       0, N_("choose the compression to use for core image"), 2},	\
+  {"memdisk-compress", GRUB_INSTALL_OPTIONS_MEMDISK_COMPRESS,		\
+      "lz4|none",						\
+      0, N_("keep the memdisk of the core image compressed"), 2},	\
     /* TRANSLATORS: platform here isn't identifier. It can be translated. */ \
   { "directory", 'd', N_("DIR"), 0,					\
     N_("use images and modules under DIR [default=%s/<platform>]"), 1 },  \
@@ -129,7 +134,9 @@ enum grub_install_options {
   GRUB_INSTALL_OPTIONS_INSTALL_CORE_COMPRESS,
   GRUB_INSTALL_OPTIONS_DTB,
   GRUB_INSTALL_OPTIONS_SBAT,
-  GRUB_INSTALL_OPTIONS_DISABLE_SHIM_LOCK
+  GRUB_INSTALL_OPTIONS_DISABLE_SHIM_LOCK,
+  GRUB_INSTALL_OPTIONS_PACK_MODULES,
+  GRUB_INSTALL_OPTIONS_MEMDISK_COMPRESS
 };
 
 extern char *grub_install_source_directory;
@@ -159,9 +166,39 @@ typedef enum {
   GRUB_COMPRESSION_AUTO,
   GRUB_COMPRESSION_NONE,
   GRUB_COMPRESSION_XZ,
-  GRUB_COMPRESSION_LZMA
+  GRUB_COMPRESSION_LZMA,
+  GRUB_COMPRESSION_LZ4
 } grub_compression_t;
 
+/* What grub_install_make_image_mem makes an image of, as given to
+   grub-mkimage.  MODULES ends with NULL; the paths may be NULL but for
+   DIR, which has the kernel and the modules.  */
+struct grub_install_image_settings
+{
+  const char *dir;
+  const char *prefix;
+  const char *format;
+  char **modules;
+  grub_compression_t compression;
+  char *memdisk_path;
+  char *config_path;
+  char **pubkeys;
+  size_t npubkeys;
+  const char *dtb_path;
+  const char *sbat_path;
+  int note;
+  int disable_shim_lock;
+  int compress_memdisk;
+};
+
+/* Make the image described by SETTINGS in memory, for programs making
+   many images without starting grub-mkimage for each.  Return it, to be
+   freed with free (), and its size in *SIZE.  Errors are fatal, as they
+   are for grub-mkimage.  Nothing is kept from one call to the next.  */
+char *
+grub_install_make_image_mem (const struct grub_install_image_settings *settings,
+			     size_t *size);
+
 void
 grub_install_make_image_wrap (const char *dir, const char *prefix,
 			      const char *outname, char *memdisk_path,
@@ -191,7 +228,8 @@ grub_install_generate_image (const char *dir, const char *prefix,
 			     const struct grub_install_image_target_desc *image_target,
 			     int note,
 			     grub_compression_t comp, const char *dtb_file,
-			     const char *sbat_path, const int disable_shim_lock);
+			     const char *sbat_path, const int disable_shim_lock,
+			     int compress_memdisk);
 
 const struct grub_install_image_target_desc *
 grub_install_get_image_target (const char *arg);
@@ -273,6 +311,10 @@ grub_util_get_target_name (const struct grub_install_image_target_desc *t);
 extern char *grub_install_copy_buffer;
 #define GRUB_INSTALL_COPY_BUFFER_SIZE 1048576
 
+/* If set, grub_install_make_image_wrap does not make an image again when
+   the digest of its inputs is the one recorded next to it.  */
+extern int grub_install_reuse_images;
+
 int
 grub_install_is_short_mbrgap_supported (void);
 
@@ -134,8 +134,18 @@ EXPORT_FUNC(grub_video_fb_get_active_render_target) (struct grub_video_fbrender_
 grub_err_t
 EXPORT_FUNC(grub_video_fb_set_active_render_target) (struct grub_video_fbrender_target *target);
 
+void
+EXPORT_FUNC(grub_video_fb_copy_to_screen) (volatile void *dst, const void *src,
+					   grub_size_t size);
+
 typedef grub_err_t (*grub_video_fb_set_page_t) (int page);
 
+/* Most pages of video memory page flipping uses.  */
+#define GRUB_VIDEO_FB_MAX_PAGES	3
+
+/* Shortest time between two page flips, one frame at 60 Hz.  */
+#define GRUB_VIDEO_FB_FRAME_MS	17
+
 grub_err_t
 EXPORT_FUNC (grub_video_fb_setup) (unsigned int mode_type, unsigned int mode_mask,
 		     struct grub_video_mode_info *mode_info,
@@ -143,6 +153,12 @@ EXPORT_FUNC (grub_video_fb_setup) (unsigned int mode_type, unsigned int mode_mas
 		     grub_video_fb_set_page_t set_page_in,
 		     volatile void *page1_ptr);
 grub_err_t
+EXPORT_FUNC (grub_video_fb_setup_pages) (unsigned int mode_type,
+					 unsigned int mode_mask,
+					 struct grub_video_mode_info *mode_info,
+					 volatile void **pages, int page_count,
+					 grub_video_fb_set_page_t set_page_in);
+grub_err_t
 EXPORT_FUNC (grub_video_fb_swap_buffers) (void);
 grub_err_t
 EXPORT_FUNC (grub_video_fb_get_info_and_fini) (struct grub_video_mode_info *mode_info,
@@ -0,0 +1,748 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Microbenchmarks of the code GRUB spends its time in, run by "make bench".
+ * Each benchmark repeats one operation until it has run long enough to be
+ * timed and prints a line of tab separated fields: the name, the bytes each
+ * operation handles, the nanoseconds each operation takes and the
+ * resulting MiB/s.  Two such result files can be compared with --compare.
+ */
+
+#include <config.h>
+
+#include <grub/types.h>
+#include <grub/emu/misc.h>
+#include <grub/emu/hostdisk.h>
+#include <grub/util/misc.h>
+#include <grub/misc.h>
+#include <grub/mm.h>
+#include <grub/env.h>
+#include <grub/file.h>
+#include <grub/crypto.h>
+#include <grub/cryptodisk.h>
+#include <grub/lib/crc.h>
+#include <grub/video.h>
+#include <grub/fbblit.h>
+#include <grub/fbutil.h>
+#include <grub/parser.h>
+#include <grub/script_sh.h>
+#include <grub/i18n.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "progname.h"
+
+/* Run each benchmark at least this long, so that the clock resolution and
+   the warm up do not show.  */
+#define BENCH_MIN_NS	200000000ULL
+
+/* The data the decompressors are timed on, made by --make-data.  It must
+   stay the same from release to release for the results to compare.  */
+#define BENCH_DATA_SIZE	(4 * 1024 * 1024)
+#define BENCH_SEED	0x9e3779b97f4a7c15ULL
+
+#define BENCH_BLIT_WIDTH	640
+#define BENCH_BLIT_HEIGHT	480
+
+typedef void (*bench_func_t) (void *data);
+
+static const char *only;
+
+/* Results benchmarks store so that the compiler can't drop the work,
+   checked once the benchmark has run.  */
+static volatile grub_uint32_t bench_sink;
+
+static grub_uint64_t
+bench_now_ns (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (grub_uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Time FUNC, which handles BYTES bytes each time it is called.  */
+static void
+bench_run (const char *name, grub_size_t bytes, bench_func_t func, void *data)
+{
+  grub_uint64_t iterations = 1, done = 0, start, elapsed = 0;
+  double ns, mib;
+
+  if (only && !strstr (name, only))
+    return;
+
+  func (data);
+  while (elapsed < BENCH_MIN_NS)
+    {
+      grub_uint64_t i;
+
+      start = bench_now_ns ();
+      for (i = 0; i < iterations; i++)
+	func (data);
+      elapsed += bench_now_ns () - start;
+      done += iterations;
+      iterations *= 2;
+    }
+
+  ns = (double) elapsed / done;
+  mib = bytes ? (bytes / (1024.0 * 1024.0)) / (ns / 1e9) : 0;
+  printf ("%s\t%lu\t%.1f\t%.1f\n", name, (unsigned long) bytes, ns, mib);
+  fflush (stdout);
+}
+
+static void
+bench_skip (const char *name, const char *why)
+{
+  if (only && !strstr (name, only))
+    return;
+  printf ("# %s skipped: %s\n", name, why);
+}
+
+static grub_uint64_t
+random_next (grub_uint64_t *state)
+{
+  *state ^= *state << 13;
+  *state ^= *state >> 7;
+  *state ^= *state << 17;
+  return *state;
+}
+
+static void
+fill_random (grub_uint8_t *buf, grub_size_t size)
+{
+  grub_uint64_t state = BENCH_SEED;
+  grub_size_t i;
+
+  for (i = 0; i < size; i++)
+    buf[i] = random_next (&state);
+}
+
+/* Text made of words, which compresses about as well as kernels and
+   initrds do.  */
+static int
+make_data (const char *path)
+{
+  static const char *const words[] =
+    {
+      "grub", "linux", "initrd", "menuentry", "search", "insmod", "set",
+      "root", "boot", "kernel", "module", "partition", "0x7c00", "efi",
+      "vmlinuz", "quiet", "splash", "{", "}", "if", "then", "fi", "\n"
+    };
+  grub_uint64_t state = BENCH_SEED;
+  grub_size_t done = 0;
+  FILE *f;
+
+  f = grub_util_fopen (path, "wb");
+  if (!f)
+    {
+      fprintf (stderr, _("cannot open `%s': %s"), path, strerror (errno));
+      fprintf (stderr, "\n");
+      return 1;
+    }
+
+  while (done < BENCH_DATA_SIZE)
+    {
+      const char *w = words[random_next (&state) % ARRAY_SIZE (words)];
+      grub_size_t len = strlen (w);
+
+      if (len > BENCH_DATA_SIZE - done)
+	len = BENCH_DATA_SIZE - done;
+      fwrite (w, 1, len, f);
+      done += len;
+      if (done < BENCH_DATA_SIZE && w[0] != '\n')
+	{
+	  fputc (' ', f);
+	  done++;
+	}
+    }
+
+  if (fclose (f))
+    {
+      fprintf (stderr, _("cannot close `%s': %s"), path, strerror (errno));
+      fprintf (stderr, "\n");
+      return 1;
+    }
+  return 0;
+}
+
+struct buffers
+{
+  grub_uint8_t *src;
+  grub_uint8_t *dest;
+  grub_size_t size;
+};
+
+static void
+bench_memmove (void *data)
+{
+  struct buffers *b = data;
+
+  grub_memmove (b->dest, b->src, b->size);
+}
+
+static void
+bench_memmove_overlap (void *data)
+{
+  struct buffers *b = data;
+
+  grub_memmove (b->src + 1, b->src, b->size - 1);
+}
+
+static void
+bench_memset (void *data)
+{
+  struct buffers *b = data;
+
+  grub_memset (b->dest, 0x5a, b->size);
+}
+
+static void
+bench_crc32c (void *data)
+{
+  struct buffers *b = data;
+
+  bench_sink = grub_getcrc32c (0, b->src, b->size);
+}
+
+static void
+run_memory_benchmarks (void)
+{
+  static const grub_size_t sizes[] = { 64, 4096, 1024 * 1024 };
+  struct buffers b;
+  char name[64];
+  grub_uint32_t crc;
+  unsigned i;
+
+  b.src = xmalloc (sizes[ARRAY_SIZE (sizes) - 1] + 1);
+  b.dest = xmalloc (sizes[ARRAY_SIZE (sizes) - 1]);
+  fill_random (b.src, sizes[ARRAY_SIZE (sizes) - 1] + 1);
+
+  for (i = 0; i < ARRAY_SIZE (sizes); i++)
+    {
+      b.size = sizes[i];
+      snprintf (name, sizeof (name), "memmove/%lu", (unsigned long) b.size);
+      bench_run (name, b.size, bench_memmove, &b);
+      snprintf (name, sizeof (name), "memmove_overlap/%lu",
+		(unsigned long) b.size);
+      bench_run (name, b.size, bench_memmove_overlap, &b);
+      snprintf (name, sizeof (name), "memset/%lu", (unsigned long) b.size);
+      bench_run (name, b.size, bench_memset, &b);
+      snprintf (name, sizeof (name), "crc32c/%lu", (unsigned long) b.size);
+      crc = grub_getcrc32c (0, b.src, b.size);
+      bench_sink = crc;
+      bench_run (name, b.size, bench_crc32c, &b);
+      if (bench_sink != crc)
+	grub_util_error ("%s: wrong result %08x, expected %08x", name,
+			 (unsigned) bench_sink, (unsigned) crc);
+    }
+
+  free (b.src);
+  free (b.dest);
+}
+
+struct hash_bench
+{
+  const gcry_md_spec_t *md;
+  void *context;
+  struct buffers b;
+};
+
+static void
+bench_hash (void *data)
+{
+  struct hash_bench *h = data;
+
+  h->md->init (h->context);
+  h->md->write (h->context, h->b.src, h->b.size);
+  h->md->final (h->context);
+}
+
+static void
+run_hash_benchmarks (void)
+{
+  static const char *const hashes[] = { "sha256", "sha512", "sha1" };
+  struct hash_bench h;
+  char name[64];
+  unsigned i;
+
+  h.b.size = 64 * 1024;
+  h.b.src = xmalloc (h.b.size);
+  fill_random (h.b.src, h.b.size);
+
+  for (i = 0; i < ARRAY_SIZE (hashes); i++)
+    {
+      snprintf (name, sizeof (name), "%s/%lu", hashes[i],
+		(unsigned long) h.b.size);
+      h.md = grub_crypto_lookup_md_by_name (hashes[i]);
+      if (!h.md)
+	{
+	  bench_skip (name, "unknown hash");
+	  continue;
+	}
+      h.context = xmalloc (h.md->contextsize);
+      bench_run (name, h.b.size, bench_hash, &h);
+      free (h.context);
+    }
+
+  free (h.b.src);
+}
+
+struct xts_bench
+{
+  grub_cryptodisk_t dev;
+  struct buffers b;
+};
+
+static void
+bench_xts_decrypt (void *data)
+{
+  struct xts_bench *x = data;
+
+  grub_cryptodisk_decrypt (x->dev, x->b.src, x->b.size, 0,
+			   GRUB_DISK_SECTOR_BITS);
+}
+
+static void
+run_cipher_benchmarks (void)
+{
+  struct xts_bench x;
+  grub_uint8_t key[64];
+  const char *name = "aes-xts-plain64-decrypt/4096";
+
+  x.dev = grub_zalloc (sizeof (*x.dev));
+  if (!x.dev)
+    grub_util_error ("%s", _("out of memory"));
+  fill_random (key, sizeof (key));
+  if (grub_cryptodisk_setcipher (x.dev, "aes", "xts-plain64")
+      || grub_cryptodisk_setkey (x.dev, key, sizeof (key)))
+    {
+      bench_skip (name, grub_errmsg);
+      grub_errno = GRUB_ERR_NONE;
+      grub_free (x.dev);
+      return;
+    }
+
+  x.b.size = 4096;
+  x.b.src = xmalloc (x.b.size);
+  fill_random (x.b.src, x.b.size);
+  bench_run (name, x.b.size, bench_xts_decrypt, &x);
+
+  free (x.b.src);
+  grub_crypto_cipher_close (x.dev->cipher);
+  grub_crypto_cipher_close (x.dev->secondary_cipher);
+  grub_free (x.dev);
+}
+
+struct decompress_bench
+{
+  const char *path;
+  grub_uint8_t *buf;
+  grub_size_t size;
+};
+
+static void
+bench_decompress (void *data)
+{
+  struct decompress_bench *d = data;
+  grub_file_t file;
+
+  file = grub_file_open (d->path, GRUB_FILE_TYPE_TESTLOAD);
+  if (!file)
+    grub_util_error ("%s", grub_errmsg);
+  if (grub_file_read (file, d->buf, d->size) != (grub_ssize_t) d->size)
+    grub_util_error (_("premature end of file %s"), d->path);
+  grub_file_close (file);
+}
+
+/* Time reading DATA and its compressed copies DATA.gz and so on, which the
+   file filters decompress.  */
+static void
+run_decompress_benchmarks (const char *data)
+{
+  static const char *const suffixes[] = { "", ".gz", ".xz", ".lzo", ".zst" };
+  struct decompress_bench d;
+  grub_uint8_t *expected;
+  unsigned i;
+
+  if (!data)
+    {
+      bench_skip ("decompress", "no --data");
+      return;
+    }
+
+  expected = xmalloc (BENCH_DATA_SIZE);
+  d.buf = xmalloc (BENCH_DATA_SIZE);
+  d.size = BENCH_DATA_SIZE;
+  d.path = data;
+  bench_decompress (&d);
+  memcpy (expected, d.buf, d.size);
+
+  for (i = 0; i < ARRAY_SIZE (suffixes); i++)
+    {
+      char name[64];
+      char *path;
+      grub_file_t file;
+
+      snprintf (name, sizeof (name), "decompress/%s",
+		suffixes[i][0] ? suffixes[i] + 1 : "none");
+      path = xasprintf ("%s%s", data, suffixes[i]);
+      file = grub_file_open (path, GRUB_FILE_TYPE_TESTLOAD);
+      if (!file || file->size != BENCH_DATA_SIZE)
+	{
+	  bench_skip (name, file ? "not decompressed" : grub_errmsg);
+	  grub_errno = GRUB_ERR_NONE;
+	  if (file)
+	    grub_file_close (file);
+	  free (path);
+	  continue;
+	}
+      grub_file_close (file);
+
+      d.path = path;
+      bench_decompress (&d);
+      if (memcmp (d.buf, expected, d.size) != 0)
+	grub_util_error (_("%s does not decompress to %s"), path, data);
+      bench_run (name, d.size, bench_decompress, &d);
+      free (path);
+    }
+
+  free (expected);
+  free (d.buf);
+}
+
+struct blit_bench
+{
+  struct grub_video_mode_info source_mode, target_mode;
+  struct grub_video_fbblit_info source, target;
+  enum grub_video_blit_operators oper;
+};
+
+static void
+set_mode (struct grub_video_mode_info *mode, enum grub_video_blit_format format)
+{
+  memset (mode, 0, sizeof (*mode));
+  mode->width = BENCH_BLIT_WIDTH;
+  mode->height = BENCH_BLIT_HEIGHT;
+  mode->mode_type = GRUB_VIDEO_MODE_TYPE_RGB;
+  mode->bpp = 32;
+  mode->bytes_per_pixel = 4;
+  mode->pitch = BENCH_BLIT_WIDTH * 4;
+  mode->blit_format = format;
+  mode->red_mask_size = 8;
+  mode->green_mask_size = 8;
+  mode->blue_mask_size = 8;
+  mode->reserved_mask_size = 8;
+  mode->green_field_pos = 8;
+  mode->reserved_field_pos = 24;
+  if (format == GRUB_VIDEO_BLIT_FORMAT_RGBA_8888)
+    {
+      mode->mode_type |= GRUB_VIDEO_MODE_TYPE_ALPHA;
+      mode->blue_field_pos = 16;
+    }
+  else
+    mode->red_field_pos = 16;
+}
+
+static void
+bench_blit (void *data)
+{
+  struct blit_bench *b = data;
+
+  grub_video_fb_dispatch_blit (&b->target, &b->source, b->oper, 0, 0,
+			       BENCH_BLIT_WIDTH, BENCH_BLIT_HEIGHT, 0, 0);
+}
+
+/* Blit a theme image with alpha to a framebuffer as firmware hands out.  */
+static void
+run_blit_benchmarks (void)
+{
+  struct blit_bench b;
+  grub_size_t size = BENCH_BLIT_WIDTH * BENCH_BLIT_HEIGHT * 4;
+
+  set_mode (&b.source_mode, GRUB_VIDEO_BLIT_FORMAT_RGBA_8888);
+  set_mode (&b.target_mode, GRUB_VIDEO_BLIT_FORMAT_BGRA_8888);
+  b.source.mode_info = &b.source_mode;
+  b.target.mode_info = &b.target_mode;
+  b.source.data = xmalloc (size);
+  b.target.data = xmalloc (size);
+  fill_random (b.source.data, size);
+  fill_random (b.target.data, size);
+
+  b.oper = GRUB_VIDEO_BLIT_REPLACE;
+  bench_run ("fbblit/replace/RGBA8888-BGRA8888", size, bench_blit, &b);
+  b.oper = GRUB_VIDEO_BLIT_BLEND;
+  bench_run ("fbblit/blend/RGBA8888-BGRA8888", size, bench_blit, &b);
+
+  free (b.source.data);
+  free (b.target.data);
+}
+
+/* A configuration file like grub-mkconfig writes.  */
+static const char bench_script[] =
+  "if [ -s $prefix/grubenv ]; then\n"
+  "  load_env\n"
+  "fi\n"
+  "if [ \"${next_entry}\" ] ; then\n"
+  "   set default=\"${next_entry}\"\n"
+  "   set next_entry=\n"
+  "   save_env next_entry\n"
+  "else\n"
+  "   set default=\"0\"\n"
+  "fi\n"
+  "function load_video {\n"
+  "  if [ x$feature_all_video_module = xy ]; then\n"
+  "    insmod all_video\n"
+  "  else\n"
+  "    insmod efi_gop\n"
+  "    insmod video_bochs\n"
+  "  fi\n"
+  "}\n"
+  "menuentry 'Linux' --class gnu-linux $menuentry_id_option 'linux-simple' {\n"
+  "\tload_video\n"
+  "\tinsmod gzio\n"
+  "\tinsmod part_gpt\n"
+  "\tinsmod ext2\n"
+  "\tsearch --no-floppy --fs-uuid --set=root 0b5e1d0c-6c1f-4b4e-9c5e-3d2f1a0b9c8d\n"
+  "\techo\t'Loading Linux ...'\n"
+  "\tlinux\t/boot/vmlinuz root=UUID=0b5e1d0c-6c1f-4b4e-9c5e-3d2f1a0b9c8d ro quiet\n"
+  "\tinitrd\t/boot/initrd.img\n"
+  "}\n"
+  "for i in 1 2 3 4; do\n"
+  "  if [ \"$i\" = \"$default\" ]; then echo \"${i}\"; fi\n"
+  "done\n";
+
+struct script_bench
+{
+  const char *next;
+};
+
+static grub_err_t
+script_getline (char **line, int cont __attribute__ ((unused)), void *data)
+{
+  struct script_bench *s = data;
+  const char *end;
+
+  *line = NULL;
+  if (!*s->next)
+    return GRUB_ERR_NONE;
+
+  end = strchr (s->next, '\n');
+  if (!end)
+    end = s->next + strlen (s->next);
+  *line = grub_strndup (s->next, end - s->next);
+  s->next = *end ? end + 1 : end;
+  return GRUB_ERR_NONE;
+}
+
+static void
+bench_script_parse (void *data)
+{
+  struct script_bench *s = data;
+  struct grub_script *script;
+  char *line;
+
+  s->next = bench_script;
+  while (1)
+    {
+      script_getline (&line, 0, s);
+      if (!line)
+	break;
+      script = grub_script_parse (line, script_getline, s);
+      grub_free (line);
+      if (!script)
+	grub_util_error ("%s", _("syntax error in the benchmark script"));
+      grub_script_free (script);
+    }
+}
+
+static void
+run_script_benchmarks (void)
+{
+  struct script_bench s;
+
+  bench_run ("script_parse/grub.cfg", sizeof (bench_script) - 1,
+	     bench_script_parse, &s);
+}
+
+struct result
+{
+  char *name;
+  double ns;
+};
+
+static struct result *
+read_results (const char *path, grub_size_t *n)
+{
+  struct result *results = NULL;
+  grub_size_t allocated = 0;
+  char line[512];
+  FILE *f;
+
+  f = grub_util_fopen (path, "r");
+  if (!f)
+    grub_util_error (_("cannot open `%s': %s"), path, strerror (errno));
+
+  *n = 0;
+  while (fgets (line, sizeof (line), f))
+    {
+      char *name, *bytes, *ns;
+
+      if (line[0] == '#')
+	continue;
+      name = strtok (line, "\t\n");
+      bytes = strtok (NULL, "\t\n");
+      ns = strtok (NULL, "\t\n");
+      if (!name || !bytes || !ns)
+	continue;
+      if (*n == allocated)
+	{
+	  allocated = allocated ? allocated * 2 : 64;
+	  results = xrealloc (results, allocated * sizeof (*results));
+	}
+      results[*n].name = xstrdup (name);
+      results[*n].ns = strtod (ns, NULL);
+      (*n)++;
+    }
+
+  fclose (f);
+  return results;
+}
+
+/* Show how the results in NEW differ from the ones in OLD and fail when a
+   benchmark got slower by more than THRESHOLD percent.  */
+static int
+compare_results (const char *old, const char *new, double threshold)
+{
+  struct result *a, *b;
+  grub_size_t na, nb, i, j;
+  int regressed = 0;
+
+  a = read_results (old, &na);
+  b = read_results (new, &nb);
+
+  for (j = 0; j < nb; j++)
+    for (i = 0; i < na; i++)
+      if (strcmp (a[i].name, b[j].name) == 0 && a[i].ns > 0)
+	{
+	  double change = (b[j].ns - a[i].ns) * 100 / a[i].ns;
+	  int slower = change > threshold;
+
+	  printf ("%s\t%.1f\t%.1f\t%+.1f%%%s\n", b[j].name, a[i].ns, b[j].ns,
+		  change, slower ? "\tREGRESSION" : "");
+	  regressed |= slower;
+	  break;
+	}
+
+  for (i = 0; i < na; i++)
+    free (a[i].name);
+  for (j = 0; j < nb; j++)
+    free (b[j].name);
+  free (a);
+  free (b);
+
+  return regressed;
+}
+
+static void
+usage (int status)
+{
+  fprintf (status ? stderr : stdout,
+	   _("Usage: %s [--data=FILE] [--only=NAME]\n"
+	     "       %s --make-data=FILE\n"
+	     "       %s --compare [--threshold=PERCENT] OLD NEW\n"),
+	   program_name, program_name, program_name);
+  exit (status);
+}
+
+int
+main (int argc, char *argv[])
+{
+  const char *data = NULL, *make = NULL;
+  char *data_path = NULL;
+  double threshold = 10;
+  int compare = 0, i;
+  const char *files[2];
+  int nfiles = 0;
+
+  grub_util_host_init (&argc, &argv);
+
+  for (i = 1; i < argc; i++)
+    {
+      if (strncmp (argv[i], "--data=", sizeof ("--data=") - 1) == 0)
+	data = argv[i] + sizeof ("--data=") - 1;
+      else if (strncmp (argv[i], "--make-data=",
+			sizeof ("--make-data=") - 1) == 0)
+	make = argv[i] + sizeof ("--make-data=") - 1;
+      else if (strncmp (argv[i], "--only=", sizeof ("--only=") - 1) == 0)
+	only = argv[i] + sizeof ("--only=") - 1;
+      else if (strncmp (argv[i], "--threshold=",
+			sizeof ("--threshold=") - 1) == 0)
+	threshold = strtod (argv[i] + sizeof ("--threshold=") - 1, NULL);
+      else if (strcmp (argv[i], "--compare") == 0)
+	compare = 1;
+      else if (strcmp (argv[i], "--help") == 0)
+	usage (0);
+      else if (argv[i][0] != '-' && nfiles < 2)
+	files[nfiles++] = argv[i];
+      else
+	usage (1);
+    }
+
+  if (make)
+    return make_data (make);
+  if (compare)
+    {
+      if (nfiles != 2)
+	usage (1);
+      return compare_results (files[0], files[1], threshold);
+    }
+  if (nfiles)
+    usage (1);
+
+  grub_init_all ();
+  grub_gcry_init_all ();
+  grub_hostfs_init ();
+  grub_host_init ();
+  grub_env_set ("root", "host");
+
+  if (data)
+    {
+      data_path = grub_canonicalize_file_name (data);
+      if (!data_path)
+	grub_util_error (_("cannot open `%s': %s"), data, strerror (errno));
+    }
+
+  printf ("# %s %s\n", PACKAGE_NAME, PACKAGE_VERSION);
+  printf ("# name\tbytes\tns/op\tMiB/s\n");
+
+  run_memory_benchmarks ();
+  run_hash_benchmarks ();
+  run_cipher_benchmarks ();
+  run_decompress_benchmarks (data_path);
+  run_blit_benchmarks ();
+  run_script_benchmarks ();
+
+  free (data_path);
+  grub_fini_all ();
+  return 0;
+}
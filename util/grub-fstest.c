@@ -39,6 +39,7 @@
 #include <stdio.h>
 #include <errno.h>
 #include <string.h>
+#include <time.h>
 
 #include "progname.h"
 #pragma GCC diagnostic ignored "-Wmissing-prototypes"
@@ -69,7 +70,8 @@ enum {
   CMD_BLOCKLIST,
   CMD_TESTLOAD,
   CMD_ZFSINFO,
-  CMD_XNU_UUID
+  CMD_XNU_UUID,
+  CMD_BENCH
 };
 #define BUF_SIZE  32256
 
@@ -373,6 +375,250 @@ cmd_crc (char *pathname)
   free (crc32_context);
 }
 
+/* Read latencies of the bench command are counted in buckets of powers
+   of two microseconds: bucket I holds those below 2^I.  */
+#define BENCH_BUCKETS 32
+
+struct bench_ctx
+{
+  grub_uint64_t files;
+  grub_uint64_t bytes;
+  grub_uint64_t calls;
+  grub_uint64_t max_us;
+  grub_uint64_t hist[BENCH_BUCKETS];
+};
+
+static grub_uint64_t
+bench_time_us (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (grub_uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void
+bench_file (const char *pathname, struct bench_ctx *ctx)
+{
+  static char buf[BUF_SIZE];
+  grub_file_t file;
+
+  file = grub_file_open (pathname, ((uncompress == 0)
+				    ? GRUB_FILE_TYPE_NO_DECOMPRESS : GRUB_FILE_TYPE_NONE)
+			 | GRUB_FILE_TYPE_FSTEST);
+  if (!file)
+    grub_util_error (_("cannot open `%s': %s"), pathname, grub_errmsg);
+
+  while (1)
+    {
+      grub_uint64_t start, us;
+      grub_ssize_t sz;
+      unsigned b;
+
+      start = bench_time_us ();
+      sz = grub_file_read (file, buf, BUF_SIZE);
+      us = bench_time_us () - start;
+      if (sz < 0)
+	grub_util_error (_("read error at offset %llu: %s"),
+			 (unsigned long long) file->offset, grub_errmsg);
+      if (sz == 0)
+	break;
+
+      for (b = 0; b < BENCH_BUCKETS - 1 && (us >> b) != 0; b++);
+      ctx->hist[b]++;
+      if (us > ctx->max_us)
+	ctx->max_us = us;
+      ctx->calls++;
+      ctx->bytes += sz;
+    }
+
+  ctx->files++;
+  grub_file_close (file);
+}
+
+struct bench_dirent
+{
+  struct bench_dirent *next;
+  int dir;
+  char name[0];
+};
+
+/* Helper for bench_tree.  The entries are collected first: not every
+   driver copes with being entered again from its own hook.  */
+static int
+bench_dir_hook (const char *filename, const struct grub_dirhook_info *info,
+		void *data)
+{
+  struct bench_dirent **list = data, *e;
+
+  if (grub_strcmp (filename, ".") == 0 || grub_strcmp (filename, "..") == 0)
+    return 0;
+  e = xmalloc (sizeof (*e) + strlen (filename) + 1);
+  strcpy (e->name, filename);
+  e->dir = info->dir;
+  e->next = *list;
+  *list = e;
+  return 0;
+}
+
+static void
+bench_tree (grub_device_t dev, grub_fs_t fs, const char *device_name,
+	    const char *path, struct bench_ctx *ctx)
+{
+  struct bench_dirent *list = NULL, *e, *next;
+
+  if ((fs->fs_dir) (dev, path[0] ? path : "/", bench_dir_hook, &list))
+    grub_util_error (_("cannot list `%s': %s"), path, grub_errmsg);
+
+  for (e = list; e; e = next)
+    {
+      char *sub;
+
+      next = e->next;
+      sub = xasprintf ("%s/%s", path, e->name);
+      if (e->dir)
+	bench_tree (dev, fs, device_name, sub, ctx);
+      else
+	{
+	  char *full = xasprintf ("(%s)%s", device_name, sub);
+	  bench_file (full, ctx);
+	  free (full);
+	}
+      free (sub);
+      free (e);
+    }
+}
+
+/* The device reads and cache counters of each disk when the benchmark
+   started, to report only what it caused.  */
+struct bench_disk_base
+{
+  struct grub_disk_stats *stats;
+  grub_uint64_t read_calls;
+  grub_uint64_t hits;
+  grub_uint64_t misses;
+};
+
+static void
+cmd_bench (char *pathname)
+{
+  struct bench_ctx ctx;
+  struct bench_disk_base *base;
+  struct grub_disk_stats *stats;
+  grub_uint64_t start, elapsed, n;
+  unsigned nbase = 0, i, b;
+  static const unsigned percentiles[] = { 50, 90, 99 };
+
+  grub_memset (&ctx, 0, sizeof (ctx));
+
+  for (stats = grub_disk_stats_list; stats; stats = stats->next)
+    nbase++;
+  base = xcalloc (nbase + 1, sizeof (base[0]));
+  for (stats = grub_disk_stats_list, i = 0; stats; stats = stats->next, i++)
+    {
+      base[i].stats = stats;
+      base[i].read_calls = stats->read_calls;
+      base[i].hits = stats->hits;
+      base[i].misses = stats->misses;
+    }
+
+  /* Start cold, so that runs can be compared.  */
+  grub_disk_cache_invalidate_all ();
+
+  start = bench_time_us ();
+  {
+    char *device_name;
+    grub_device_t dev;
+    grub_fs_t fs;
+    const char *path;
+
+    device_name = grub_file_get_device_name (pathname);
+    dev = grub_device_open (device_name);
+    if (!dev)
+      grub_util_error ("%s", grub_errmsg);
+    fs = grub_fs_probe (dev);
+    if (!fs)
+      grub_util_error ("%s", grub_errmsg);
+    path = (pathname[0] == '(') ? grub_strchr (pathname, ')') : NULL;
+    path = path ? path + 1 : pathname;
+
+    {
+      grub_file_t file;
+
+      file = grub_file_open (pathname, GRUB_FILE_TYPE_GET_SIZE
+			     | GRUB_FILE_TYPE_NO_DECOMPRESS);
+      if (file)
+	{
+	  grub_file_close (file);
+	  bench_file (pathname, &ctx);
+	}
+      else if (grub_errno == GRUB_ERR_BAD_FILE_TYPE)
+	{
+	  char *dir = xstrdup (path);
+
+	  grub_errno = GRUB_ERR_NONE;
+	  /* Remove trailing '/'.  */
+	  while (dir[0] && dir[strlen (dir) - 1] == '/')
+	    dir[strlen (dir) - 1] = 0;
+	  bench_tree (dev, fs, device_name ? : grub_env_get ("root"), dir,
+		      &ctx);
+	  free (dir);
+	}
+      else
+	grub_util_error (_("cannot open `%s': %s"), pathname, grub_errmsg);
+    }
+
+    grub_device_close (dev);
+    grub_free (device_name);
+  }
+  elapsed = bench_time_us () - start;
+
+  printf ("files: %llu\n", (unsigned long long) ctx.files);
+  printf ("bytes: %llu\n", (unsigned long long) ctx.bytes);
+  printf ("time: %llu.%06llu s\n", (unsigned long long) (elapsed / 1000000),
+	  (unsigned long long) (elapsed % 1000000));
+  printf ("throughput: %.2f MB/s\n",
+	  elapsed ? (double) ctx.bytes / (double) elapsed : 0.0);
+  printf ("read calls: %llu, max latency %llu us\n",
+	  (unsigned long long) ctx.calls, (unsigned long long) ctx.max_us);
+
+  for (i = 0; i < ARRAY_SIZE (percentiles) && ctx.calls; i++)
+    {
+      grub_uint64_t want = (ctx.calls * percentiles[i] + 99) / 100;
+
+      for (b = 0, n = 0; b < BENCH_BUCKETS - 1; b++)
+	{
+	  n += ctx.hist[b];
+	  if (n >= want)
+	    break;
+	}
+      printf ("p%u latency: < %llu us\n", percentiles[i], 1ULL << b);
+    }
+
+  for (b = 0; b < BENCH_BUCKETS; b++)
+    if (ctx.hist[b])
+      printf ("  < %10llu us: %llu\n", 1ULL << b,
+	      (unsigned long long) ctx.hist[b]);
+
+  for (stats = grub_disk_stats_list; stats; stats = stats->next)
+    {
+      struct bench_disk_base zero = { 0 }, *old = &zero;
+
+      for (i = 0; i < nbase; i++)
+	if (base[i].stats == stats)
+	  old = &base[i];
+      if (stats->read_calls == old->read_calls
+	  && stats->hits == old->hits && stats->misses == old->misses)
+	continue;
+      printf ("disk %s: %llu device reads, %llu cache hits, %llu misses\n",
+	      stats->name,
+	      (unsigned long long) (stats->read_calls - old->read_calls),
+	      (unsigned long long) (stats->hits - old->hits),
+	      (unsigned long long) (stats->misses - old->misses));
+    }
+  free (base);
+}
+
 static const char *root = NULL;
 static int args_count = 0;
 static int nparm = 0;
@@ -456,6 +702,9 @@ fstest (int n)
     case CMD_CRC:
       cmd_crc (args[0]);
       break;
+    case CMD_BENCH:
+      cmd_bench (args[0]);
+      break;
     case CMD_BLOCKLIST:
       execute_command ("blocklist", n, args);
       grub_printf ("\n");
@@ -516,6 +765,7 @@ static struct argp_option options[] = {
   {N_("cmp FILE LOCAL"), 0, 0, OPTION_DOC, N_("Compare FILE with local file LOCAL."), 1},
   {N_("hex FILE"), 0, 0      , OPTION_DOC, N_("Show contents of FILE in hex."), 1},
   {N_("crc FILE"), 0, 0     , OPTION_DOC, N_("Get crc32 checksum of FILE."), 1},
+  {N_("bench PATH"), 0, 0    , OPTION_DOC, N_("Time reading the file or the whole directory PATH."), 1},
   {N_("blocklist FILE"), 0, 0, OPTION_DOC, N_("Display blocklist of FILE."), 1},
   {N_("xnu_uuid DEVICE"), 0, 0, OPTION_DOC, N_("Compute XNU UUID of the device."), 1},
 
@@ -697,6 +947,11 @@ argp_parser (int key, char *arg, struct argp_state *state)
 	  cmd = CMD_CRC;
           nparm = 1;
 	}
+      else if (!grub_strcmp (arg, "bench"))
+	{
+	  cmd = CMD_BENCH;
+          nparm = 1;
+	}
       else if (!grub_strcmp (arg, "blocklist"))
 	{
 	  cmd = CMD_BLOCKLIST;
@@ -35,6 +35,7 @@
 #include <grub/zfs/zfs.h>
 #include <grub/util/install.h>
 #include <grub/util/resolve.h>
+#include <grub/modpack.h>
 #include <grub/emu/hostfile.h>
 #include <grub/emu/config.h>
 #include <grub/emu/hostfile.h>
@@ -74,6 +75,83 @@ grub_install_help_filter (int key, const char *text,
 static int (*compress_func) (const char *src, const char *dest) = NULL;
 char *grub_install_copy_buffer;
 static char *dtb;
+int grub_install_reuse_images;
+
+static void remember_reused (const char *dst);
+
+/* Return 1 if the files A and B can both be read and have the same
+   contents.  */
+static int
+files_equal (const char *a, const char *b)
+{
+  static char *buf_b;
+  grub_util_fd_t fa, fb;
+  ssize_t ra, rb;
+  int ret = 0;
+
+  fb = grub_util_fd_open (b, GRUB_UTIL_FD_O_RDONLY);
+  if (!GRUB_UTIL_FD_IS_VALID (fb))
+    return 0;
+  fa = grub_util_fd_open (a, GRUB_UTIL_FD_O_RDONLY);
+  if (!GRUB_UTIL_FD_IS_VALID (fa))
+    {
+      grub_util_fd_close (fb);
+      return 0;
+    }
+  if (grub_util_get_fd_size (fa, a, NULL) != grub_util_get_fd_size (fb, b, NULL))
+    goto out;
+
+  if (!grub_install_copy_buffer)
+    grub_install_copy_buffer = xmalloc (GRUB_INSTALL_COPY_BUFFER_SIZE);
+  if (!buf_b)
+    buf_b = xmalloc (GRUB_INSTALL_COPY_BUFFER_SIZE);
+
+  while (1)
+    {
+      ra = grub_util_fd_read (fa, grub_install_copy_buffer,
+			      GRUB_INSTALL_COPY_BUFFER_SIZE);
+      rb = grub_util_fd_read (fb, buf_b, GRUB_INSTALL_COPY_BUFFER_SIZE);
+      if (ra < 0 || ra != rb
+	  || memcmp (grub_install_copy_buffer, buf_b, ra) != 0)
+	break;
+      if (ra == 0)
+	{
+	  ret = 1;
+	  break;
+	}
+    }
+
+ out:
+  grub_util_fd_close (fa);
+  grub_util_fd_close (fb);
+  return ret;
+}
+
+/* Leave DST alone if it has the contents of SRC already, or bring back the
+   backup clean_grub_dir made of it if that has them: the ESP and /boot are
+   then not written to for the files which did not change.  */
+static int
+keep_unchanged (const char *src, const char *dst)
+{
+  char *backup;
+  int ret = 0;
+
+  if (files_equal (src, dst))
+    {
+      grub_util_info ("`%s' is unchanged", dst);
+      return 1;
+    }
+
+  backup = grub_util_path_concat_ext (1, dst, "~");
+  if (files_equal (src, backup) && grub_util_rename (backup, dst) == 0)
+    {
+      grub_util_info ("`%s' is unchanged", dst);
+      remember_reused (dst);
+      ret = 1;
+    }
+  free (backup);
+  return ret;
+}
 
 int
 grub_install_copy_file (const char *src,
@@ -83,6 +161,9 @@ grub_install_copy_file (const char *src,
   grub_util_fd_t in, out;
   ssize_t r;
 
+  if (keep_unchanged (src, dst))
+    return 1;
+
   grub_util_info ("copying `%s' -> `%s'", src, dst);
 
   in = grub_util_fd_open (src, GRUB_UTIL_FD_O_RDONLY);
@@ -213,6 +294,10 @@ static size_t backup_dirs_size = 0;
 static char **backup_dirs = NULL;
 static pid_t backup_process = 0;
 static int grub_install_backup_ponr = 0;
+/* Backups which keep_unchanged renamed back to the files they were made
+   of: they have to become backups again to restore them.  */
+static size_t reused_files_size = 0;
+static char **reused_files = NULL;
 
 void
 grub_set_install_backup_ponr (void)
@@ -251,6 +336,7 @@ clean_grub_dir_real (const char *di, enum clean_grub_dir_mode mode)
 		   || strcmp_ext (ext, ".mo", suffix) == 0)
 	   && strcmp_ext (de->d_name, "menu.lst", suffix) != 0)
 	  || strcmp_ext (de->d_name, "modinfo.sh", suffix) == 0
+	  || strcmp_ext (de->d_name, GRUB_MODPACK_FILENAME, suffix) == 0
 	  || strcmp_ext (de->d_name, "efiemu32.o", suffix) == 0
 	  || strcmp_ext (de->d_name, "efiemu64.o", suffix) == 0)
 	{
@@ -300,6 +386,15 @@ restore_backup_atexit (void)
   if (backup_process != getpid ())
     return;
 
+  if (!grub_install_backup_ponr)
+    for (i = 0; i < reused_files_size; i++)
+      {
+	char *backup = grub_util_path_concat_ext (1, reused_files[i], "~");
+
+	grub_util_rename (reused_files[i], backup);
+	free (backup);
+      }
+
   for (i = 0; i < backup_dirs_size; i++)
     {
       /*
@@ -333,11 +428,24 @@ append_to_backup_dirs (const char *dir)
       backup_process = getpid ();
     }
 }
+
+static void
+remember_reused (const char *dst)
+{
+  reused_files = xrealloc (reused_files,
+			   sizeof (char *) * (reused_files_size + 1));
+  reused_files[reused_files_size++] = xstrdup (dst);
+}
 #else
 static void
 append_to_backup_dirs (const char *dir __attribute__ ((unused)))
 {
 }
+
+static void
+remember_reused (const char *dst __attribute__ ((unused)))
+{
+}
 #endif
 
 static void
@@ -465,6 +573,8 @@ static char **pubkeys;
 static size_t npubkeys;
 static char *sbat;
 static int disable_shim_lock;
+static int pack_modules;
+static int compress_memdisk;
 static grub_compression_t compression;
 
 int
@@ -482,6 +592,8 @@ grub_install_parse (int key, char *arg)
 			   _("grub-mkimage is compiled without XZ support"));
 #endif
 	}
+      else if (grub_strcmp (arg, "lz4") == 0)
+	compression = GRUB_COMPRESSION_LZ4;
       else if (grub_strcmp (arg, "none") == 0)
 	compression = GRUB_COMPRESSION_NONE;
       else if (grub_strcmp (arg, "auto") == 0)
@@ -504,6 +616,17 @@ grub_install_parse (int key, char *arg)
     case GRUB_INSTALL_OPTIONS_DISABLE_SHIM_LOCK:
       disable_shim_lock = 1;
       return 1;
+    case GRUB_INSTALL_OPTIONS_PACK_MODULES:
+      pack_modules = 1;
+      return 1;
+    case GRUB_INSTALL_OPTIONS_MEMDISK_COMPRESS:
+      if (grub_strcmp (arg, "lz4") == 0)
+	compress_memdisk = 1;
+      else if (grub_strcmp (arg, "none") == 0)
+	compress_memdisk = 0;
+      else
+	grub_util_error (_("Unknown compression format %s"), arg);
+      return 1;
 
     case GRUB_INSTALL_OPTIONS_VERBOSITY:
       verbosity++;
@@ -610,6 +733,7 @@ grub_install_make_image_wrap_file (const char *dir, const char *prefix,
       [GRUB_COMPRESSION_NONE] = "none",
       [GRUB_COMPRESSION_XZ] = "xz",
       [GRUB_COMPRESSION_LZMA] = "lzma",
+      [GRUB_COMPRESSION_LZ4] = "lz4",
     };
   grub_size_t slen = 1;
   char *s, *p;
@@ -679,11 +803,12 @@ grub_install_make_image_wrap_file (const char *dir, const char *prefix,
   *p = '\0';
 
   grub_util_info ("grub-mkimage --directory '%s' --prefix '%s' --output '%s'"
-		  " --format '%s' --compression '%s'%s%s%s\n",
+		  " --format '%s' --compression '%s'%s%s%s%s\n",
 		  dir, prefix, outname,
 		  mkimage_target, compnames[compression],
 		  note ? " --note" : "",
-		  disable_shim_lock ? " --disable-shim-lock" : "", s);
+		  disable_shim_lock ? " --disable-shim-lock" : "",
+		  compress_memdisk ? " --memdisk-compression 'lz4'" : "", s);
   free (s);
 
   tgt = grub_install_get_image_target (mkimage_target);
@@ -694,19 +819,207 @@ grub_install_make_image_wrap_file (const char *dir, const char *prefix,
 			       modules.entries, memdisk_path,
 			       pubkeys, npubkeys, config_path, tgt,
 			       note, compression, dtb, sbat,
-			       disable_shim_lock);
+			       disable_shim_lock, compress_memdisk);
   while (dc--)
     grub_install_pop_module ();
 }
 
+static void
+digest_string (void *ctx, const char *str)
+{
+  if (!str)
+    str = "";
+  GRUB_MD_SHA256->write (ctx, str, strlen (str) + 1);
+}
+
+static void
+digest_file (void *ctx, const char *name)
+{
+  grub_util_fd_t fd;
+  ssize_t r;
+
+  digest_string (ctx, name);
+  fd = grub_util_fd_open (name, GRUB_UTIL_FD_O_RDONLY);
+  if (!GRUB_UTIL_FD_IS_VALID (fd))
+    return;
+  if (!grub_install_copy_buffer)
+    grub_install_copy_buffer = xmalloc (GRUB_INSTALL_COPY_BUFFER_SIZE);
+  while ((r = grub_util_fd_read (fd, grub_install_copy_buffer,
+				 GRUB_INSTALL_COPY_BUFFER_SIZE)) > 0)
+    GRUB_MD_SHA256->write (ctx, grub_install_copy_buffer, r);
+  grub_util_fd_close (fd);
+}
+
+static int
+cmp_names (const void *a, const void *b)
+{
+  return strcmp (*(char *const *) a, *(char *const *) b);
+}
+
+static void
+digest_end (void *ctx, char *hex)
+{
+  const grub_uint8_t *d;
+  grub_size_t i;
+
+  GRUB_MD_SHA256->final (ctx);
+  d = GRUB_MD_SHA256->read (ctx);
+  for (i = 0; i < GRUB_MD_SHA256->mdlen; i++)
+    sprintf (hex + 2 * i, "%02x", d[i]);
+}
+
+/* Make a digest of all that goes into the image: the files of DIR, where
+   the kernel and the modules are, the other files given and the
+   settings.  HEX receives it in hexadecimal.  */
+static void
+image_inputs_digest (const char *dir, const char *prefix,
+		     const char *memdisk_path, const char *config_path,
+		     const char *mkimage_target, int note, char *hex)
+{
+  void *ctx = xmalloc (GRUB_MD_SHA256->contextsize);
+  grub_util_fd_dir_t d;
+  grub_util_fd_dirent_t de;
+  char **names = NULL;
+  size_t nnames = 0, i;
+  char buf[64];
+
+  GRUB_MD_SHA256->init (ctx);
+  digest_string (ctx, PACKAGE_STRING);
+  digest_string (ctx, prefix);
+  digest_string (ctx, mkimage_target);
+  snprintf (buf, sizeof (buf), "%d %d %d %d", compression, note,
+	    disable_shim_lock, compress_memdisk);
+  digest_string (ctx, buf);
+  for (i = 0; i < modules.n_entries; i++)
+    digest_string (ctx, modules.entries[i]);
+  digest_string (ctx, "");
+  for (i = 0; i < npubkeys; i++)
+    digest_file (ctx, pubkeys[i]);
+  digest_string (ctx, "");
+  if (memdisk_path)
+    digest_file (ctx, memdisk_path);
+  if (config_path)
+    digest_file (ctx, config_path);
+  if (dtb)
+    digest_file (ctx, dtb);
+  if (sbat)
+    digest_file (ctx, sbat);
+
+  d = grub_util_fd_opendir (dir);
+  if (!d)
+    grub_util_error (_("cannot open directory `%s': %s"),
+		     dir, grub_util_fd_strerror ());
+  while ((de = grub_util_fd_readdir (d)))
+    {
+      char *name = grub_util_path_concat (2, dir, de->d_name);
+
+      if (grub_util_is_special_file (name) || grub_util_is_directory (name))
+	{
+	  free (name);
+	  continue;
+	}
+      names = xrealloc (names, sizeof (names[0]) * (nnames + 1));
+      names[nnames++] = name;
+    }
+  grub_util_fd_closedir (d);
+
+  qsort (names, nnames, sizeof (names[0]), cmp_names);
+  for (i = 0; i < nnames; i++)
+    {
+      digest_file (ctx, names[i]);
+      free (names[i]);
+    }
+  free (names);
+
+  digest_end (ctx, hex);
+  free (ctx);
+}
+
+static int
+image_digest (const char *name, char *hex)
+{
+  void *ctx;
+  FILE *fp;
+
+  fp = grub_util_fopen (name, "rb");
+  if (!fp)
+    return 0;
+  fclose (fp);
+
+  ctx = xmalloc (GRUB_MD_SHA256->contextsize);
+  GRUB_MD_SHA256->init (ctx);
+  digest_file (ctx, name);
+  digest_end (ctx, hex);
+  free (ctx);
+  return 1;
+}
+
+/* Return 1 if the stamp STAMP_NAME records INPUTS as the digest of the
+   inputs, and OUTNAME, or its backup brought back, is still the image made
+   from them.  */
+static int
+image_is_up_to_date (const char *outname, const char *stamp_name,
+		     const char *inputs)
+{
+  char stamp[4 * GRUB_CRYPTO_MAX_MDLEN + 3];
+  char out[2 * GRUB_CRYPTO_MAX_MDLEN + 1];
+  size_t len = 0, inputs_len = strlen (inputs);
+  const char *want;
+  char *backup;
+  int ret = 0;
+  FILE *fp;
+
+  fp = grub_util_fopen (stamp_name, "r");
+  if (!fp)
+    return 0;
+  len = fread (stamp, 1, sizeof (stamp) - 1, fp);
+  fclose (fp);
+  stamp[len] = '\0';
+
+  if (strncmp (stamp, inputs, inputs_len) != 0 || stamp[inputs_len] != ' ')
+    return 0;
+  want = stamp + inputs_len + 1;
+
+  if (image_digest (outname, out) && strncmp (want, out, strlen (out)) == 0)
+    return 1;
+
+  backup = grub_util_path_concat_ext (1, outname, "~");
+  if (image_digest (backup, out) && strncmp (want, out, strlen (out)) == 0
+      && grub_util_rename (backup, outname) == 0)
+    {
+      remember_reused (outname);
+      ret = 1;
+    }
+  free (backup);
+  return ret;
+}
+
 void
 grub_install_make_image_wrap (const char *dir, const char *prefix,
 			      const char *outname, char *memdisk_path,
 			      char *config_path,
 			      const char *mkimage_target, int note)
 {
+  char inputs[2 * GRUB_CRYPTO_MAX_MDLEN + 1];
+  char *stamp_name = NULL;
   FILE *fp;
 
+  /* The digests of the inputs, and of the image made from them, are kept
+     in a file next to the image.  When the inputs did not change, the
+     image is left as it is.  */
+  if (grub_install_reuse_images)
+    {
+      image_inputs_digest (dir, prefix, memdisk_path, config_path,
+			   mkimage_target, note, inputs);
+      stamp_name = grub_util_path_concat_ext (1, outname, ".inputs");
+      if (image_is_up_to_date (outname, stamp_name, inputs))
+	{
+	  grub_util_info ("`%s' is up to date", outname);
+	  free (stamp_name);
+	  return;
+	}
+    }
+
   fp = grub_util_fopen (outname, "wb");
   if (! fp)
     grub_util_error (_("cannot open `%s': %s"), outname,
@@ -717,6 +1030,22 @@ grub_install_make_image_wrap (const char *dir, const char *prefix,
   if (grub_util_file_sync (fp) < 0)
     grub_util_error (_("cannot sync `%s': %s"), outname, strerror (errno));
   fclose (fp);
+
+  if (stamp_name)
+    {
+      char out[2 * GRUB_CRYPTO_MAX_MDLEN + 1];
+
+      /* Without a stamp, the image is only made again next time.  */
+      fp = NULL;
+      if (image_digest (outname, out))
+	fp = grub_util_fopen (stamp_name, "w");
+      if (fp)
+	{
+	  fprintf (fp, "%s %s\n", inputs, out);
+	  fclose (fp);
+	}
+      free (stamp_name);
+    }
 }
 
 static void
@@ -975,6 +1304,92 @@ grub_install_get_platform_platform (enum grub_install_plat platid)
   return platforms[platid].platform;
 }
 
+/* Move the modules installed in DIR into an archive there, which the
+   kernel reads them from with a single lookup of its index.  */
+static void
+pack_installed_modules (const char *dir)
+{
+  grub_util_fd_dir_t d;
+  grub_util_fd_dirent_t de;
+  char **names = NULL;
+  size_t n = 0, i;
+  struct grub_modpack_header head;
+  struct grub_modpack_entry *index;
+  grub_uint64_t offset;
+  char *packf;
+  FILE *fp;
+
+  d = grub_util_fd_opendir (dir);
+  if (!d)
+    grub_util_error (_("cannot open directory `%s': %s"),
+		     dir, grub_util_fd_strerror ());
+  while ((de = grub_util_fd_readdir (d)))
+    {
+      size_t len = strlen (de->d_name);
+
+      if (len <= 4 || strcmp (de->d_name + len - 4, ".mod") != 0)
+	continue;
+      if (len - 4 >= GRUB_MODPACK_NAME_SIZE)
+	grub_util_error (_("module name `%s' is too long to be packed"),
+			 de->d_name);
+      names = xrealloc (names, (n + 1) * sizeof (names[0]));
+      names[n++] = xstrdup (de->d_name);
+    }
+  grub_util_fd_closedir (d);
+
+  if (n > GRUB_MODPACK_MAX_ENTRIES)
+    grub_util_error (_("too many modules to pack"));
+  qsort (names, n, sizeof (names[0]), cmp_names);
+
+  index = xcalloc (n ? : 1, sizeof (index[0]));
+  offset = sizeof (head) + n * sizeof (index[0]);
+  for (i = 0; i < n; i++)
+    {
+      char *srcf = grub_util_path_concat (2, dir, names[i]);
+      size_t size = grub_util_get_image_size (srcf);
+
+      if (size > GRUB_UINT_MAX)
+	grub_util_error (_("module `%s' is too big to be packed"), srcf);
+      memcpy (index[i].name, names[i], strlen (names[i]) - 4);
+      index[i].offset = grub_cpu_to_le64 (offset);
+      index[i].size = grub_cpu_to_le32 (size);
+      offset += size;
+      free (srcf);
+    }
+
+  memset (&head, 0, sizeof (head));
+  memcpy (head.magic, GRUB_MODPACK_MAGIC, sizeof (head.magic));
+  head.nentries = grub_cpu_to_le32 (n);
+
+  packf = grub_util_path_concat (2, dir, GRUB_MODPACK_FILENAME);
+  grub_util_info ("packing %" GRUB_HOST_PRIuLONG_LONG " modules into `%s'",
+		  (unsigned long long) n, packf);
+  fp = grub_util_fopen (packf, "wb");
+  if (!fp)
+    grub_util_error (_("cannot open `%s': %s"), packf, strerror (errno));
+  grub_util_write_image ((char *) &head, sizeof (head), fp, packf);
+  grub_util_write_image ((char *) index, n * sizeof (index[0]), fp, packf);
+
+  for (i = 0; i < n; i++)
+    {
+      char *srcf = grub_util_path_concat (2, dir, names[i]);
+      char *buf = grub_util_read_image (srcf);
+
+      grub_util_write_image (buf, grub_le_to_cpu32 (index[i].size), fp, packf);
+      free (buf);
+      if (grub_util_unlink (srcf) < 0)
+	grub_util_error (_("cannot delete `%s': %s"), srcf,
+			 grub_util_fd_strerror ());
+      free (srcf);
+      free (names[i]);
+    }
+
+  grub_util_file_sync (fp);
+  fclose (fp);
+  free (packf);
+  free (index);
+  free (names);
+}
 
 void
 grub_install_copy_files (const char *src,
@@ -1026,6 +1441,9 @@ grub_install_copy_files (const char *src,
       grub_util_free_path_list (path_list);
     }
 
+  if (pack_modules)
+    pack_installed_modules (dst_platform);
+
   const char *pkglib_DATA[] = {"efiemu32.o", "efiemu64.o",
 			       "moddep.lst", "command.lst",
 			       "fs.lst", "partmap.lst",
@@ -871,6 +871,10 @@ main (int argc, char *argv[])
 
   argp_parse (&argp, argc, argv, 0, 0, 0);
 
+  /* Installing again after an update often installs the same files: do not
+     make the images again then, nor write the files which did not change.  */
+  grub_install_reuse_images = 1;
+
   if (verbosity > 1)
     grub_env_set ("debug", "all");
 
@@ -1351,6 +1355,7 @@ main (int argc, char *argv[])
     {
       grub_install_push_module ("pata");
       grub_install_push_module ("ahci");
+      grub_install_push_module ("nvme");
       grub_install_push_module ("ohci");
       grub_install_push_module ("uhci");
       grub_install_push_module ("ehci");
@@ -42,6 +42,11 @@
 #include <assert.h>
 
 #include <errno.h>
+#include <unistd.h>
+#if !defined (_WIN32)
+#include <poll.h>
+#include <sys/wait.h>
+#endif
 
 #include <ft2build.h>
 #include FT_FREETYPE_H
@@ -135,9 +140,11 @@ add_pixel (grub_uint8_t **data, int *mask, int not_blank)
   *mask >>= 1;
 }
 
-static void
-add_glyph (struct grub_font_info *font_info, FT_UInt glyph_idx, FT_Face face,
-	   grub_uint32_t char_code, int nocut)
+/* Render glyph GLYPH_IDX of FACE, CHAR_CODE being only used in the
+   messages.  The glyph returned is not added to FONT_INFO yet.  */
+static struct grub_glyph_info *
+render_glyph (const struct grub_font_info *font_info, FT_UInt glyph_idx,
+	      FT_Face face, grub_uint32_t char_code, int nocut)
 {
   struct grub_glyph_info *glyph_info;
   int width, height;
@@ -176,7 +183,7 @@ add_glyph (struct grub_font_info *font_info, FT_UInt glyph_idx, FT_Face face,
 	printf (": %s\n", ft_errmsgs[err]);
       else
 	printf ("\n");
-      return;
+      return NULL;
     }
 
   glyph = face->glyph;
@@ -242,10 +249,7 @@ add_glyph (struct grub_font_info *font_info, FT_UInt glyph_idx, FT_Face face,
   glyph_info->bitmap = xmalloc (bitmap_size);
   glyph_info->bitmap_size = bitmap_size;
 
-  glyph_info->next = font_info->glyphs_unsorted;
-  font_info->glyphs_unsorted = glyph_info;
-  font_info->num_glyphs++;
-
+  glyph_info->next = NULL;
   glyph_info->char_code = char_code;
   glyph_info->width = width;
   glyph_info->height = height;
@@ -253,18 +257,6 @@ add_glyph (struct grub_font_info *font_info, FT_UInt glyph_idx, FT_Face face,
   glyph_info->y_ofs = glyph->bitmap_top - height - cuttop;
   glyph_info->device_width = glyph->metrics.horiAdvance / 64;
 
-  if (width > font_info->max_width)
-    font_info->max_width = width;
-
-  if (height > font_info->max_height)
-    font_info->max_height = height;
-
-  if (glyph_info->y_ofs < font_info->min_y && glyph_info->y_ofs > -font_info->size)
-    font_info->min_y = glyph_info->y_ofs;
-
-  if (glyph_info->y_ofs + height > font_info->max_y)
-    font_info->max_y = glyph_info->y_ofs + height;
-
   mask = 0;
   data = &glyph_info->bitmap[0] - 1;
   for (j = cuttop; j < height + cuttop; j++)
@@ -272,6 +264,58 @@ add_glyph (struct grub_font_info *font_info, FT_UInt glyph_idx, FT_Face face,
       add_pixel (&data, &mask,
 		 glyph->bitmap.buffer[i / 8 + j * glyph->bitmap.pitch] &
 		 (1 << (7 - (i & 7))));
+
+  return glyph_info;
+}
+
+static void
+link_glyph (struct grub_font_info *font_info,
+	    struct grub_glyph_info *glyph_info, grub_uint32_t char_code)
+{
+  glyph_info->next = font_info->glyphs_unsorted;
+  font_info->glyphs_unsorted = glyph_info;
+  font_info->num_glyphs++;
+
+  glyph_info->char_code = char_code;
+
+  if (glyph_info->width > font_info->max_width)
+    font_info->max_width = glyph_info->width;
+
+  if (glyph_info->height > font_info->max_height)
+    font_info->max_height = glyph_info->height;
+
+  if (glyph_info->y_ofs < font_info->min_y && glyph_info->y_ofs > -font_info->size)
+    font_info->min_y = glyph_info->y_ofs;
+
+  if (glyph_info->y_ofs + glyph_info->height > font_info->max_y)
+    font_info->max_y = glyph_info->y_ofs + glyph_info->height;
+}
+
+/* The glyphs of a face are queued while its characters are listed, and
+   rendered all at once by render_glyphs.  A glyph is then rendered only
+   once however many characters use it, by several processes, and only if
+   the glyph cache does not have it already.  */
+struct glyph_job
+{
+  FT_UInt glyph_idx;
+  grub_uint32_t char_code;
+};
+
+static struct glyph_job *glyph_jobs;
+static size_t num_glyph_jobs, max_glyph_jobs;
+
+static void
+add_glyph (FT_UInt glyph_idx, grub_uint32_t char_code)
+{
+  if (num_glyph_jobs == max_glyph_jobs)
+    {
+      max_glyph_jobs = max_glyph_jobs ? 2 * max_glyph_jobs : 1024;
+      glyph_jobs = xrealloc (glyph_jobs,
+			     max_glyph_jobs * sizeof (glyph_jobs[0]));
+    }
+  glyph_jobs[num_glyph_jobs].glyph_idx = glyph_idx;
+  glyph_jobs[num_glyph_jobs].char_code = char_code;
+  num_glyph_jobs++;
 }
 
 struct glyph_replace *subst_rightjoin, *subst_leftjoin, *subst_medijoin;
@@ -284,8 +328,7 @@ struct glyph_replace
 
 /* TODO: sort glyph_replace and use binary search if necessary.  */
 static void
-add_char (struct grub_font_info *font_info, FT_Face face,
-	  grub_uint32_t char_code, int nocut)
+add_char (FT_Face face, grub_uint32_t char_code)
 {
   FT_UInt glyph_idx;
   struct glyph_replace *cur;
@@ -293,12 +336,11 @@ add_char (struct grub_font_info *font_info, FT_Face face,
   glyph_idx = FT_Get_Char_Index (face, char_code);
   if (!glyph_idx)
     return;
-  add_glyph (font_info, glyph_idx, face, char_code, nocut);
+  add_glyph (glyph_idx, char_code);
   for (cur = subst_rightjoin; cur; cur = cur->next)
     if (cur->from == glyph_idx)
       {
-	add_glyph (font_info, cur->to, face,
-		   char_code | GRUB_FONT_CODE_RIGHT_JOINED, nocut);
+	add_glyph (cur->to, char_code | GRUB_FONT_CODE_RIGHT_JOINED);
 	break;
       }
   if (!cur && char_code >= GRUB_UNICODE_ARABIC_START
@@ -313,8 +355,7 @@ add_char (struct grub_font_info *font_info, FT_Face face,
 	    idx2 = FT_Get_Char_Index (face, grub_unicode_arabic_shapes[i]
 				      .right_linked);
 	    if (idx2)
-	      add_glyph (font_info, idx2, face,
-			 char_code | GRUB_FONT_CODE_RIGHT_JOINED, nocut);
+	      add_glyph (idx2, char_code | GRUB_FONT_CODE_RIGHT_JOINED);
 	    break;
 	  }
 
@@ -323,8 +364,7 @@ add_char (struct grub_font_info *font_info, FT_Face face,
   for (cur = subst_leftjoin; cur; cur = cur->next)
     if (cur->from == glyph_idx)
       {
-	add_glyph (font_info, cur->to, face,
-		   char_code | GRUB_FONT_CODE_LEFT_JOINED, nocut);
+	add_glyph (cur->to, char_code | GRUB_FONT_CODE_LEFT_JOINED);
 	break;
       }
   if (!cur && char_code >= GRUB_UNICODE_ARABIC_START
@@ -339,8 +379,7 @@ add_char (struct grub_font_info *font_info, FT_Face face,
 	    idx2 = FT_Get_Char_Index (face, grub_unicode_arabic_shapes[i]
 				      .left_linked);
 	    if (idx2)
-	      add_glyph (font_info, idx2, face,
-			 char_code | GRUB_FONT_CODE_LEFT_JOINED, nocut);
+	      add_glyph (idx2, char_code | GRUB_FONT_CODE_LEFT_JOINED);
 	    break;
 	  }
 
@@ -348,9 +387,8 @@ add_char (struct grub_font_info *font_info, FT_Face face,
   for (cur = subst_medijoin; cur; cur = cur->next)
     if (cur->from == glyph_idx)
       {
-	add_glyph (font_info, cur->to, face,
-		   char_code | GRUB_FONT_CODE_LEFT_JOINED
-		   | GRUB_FONT_CODE_RIGHT_JOINED, nocut);
+	add_glyph (cur->to, char_code | GRUB_FONT_CODE_LEFT_JOINED
+		   | GRUB_FONT_CODE_RIGHT_JOINED);
 	break;
       }
   if (!cur && char_code >= GRUB_UNICODE_ARABIC_START
@@ -365,9 +403,8 @@ add_char (struct grub_font_info *font_info, FT_Face face,
 	    idx2 = FT_Get_Char_Index (face, grub_unicode_arabic_shapes[i]
 				      .both_linked);
 	    if (idx2)
-	      add_glyph (font_info, idx2, face,
-			 char_code | GRUB_FONT_CODE_LEFT_JOINED
-			 | GRUB_FONT_CODE_RIGHT_JOINED, nocut);
+	      add_glyph (idx2, char_code | GRUB_FONT_CODE_LEFT_JOINED
+			 | GRUB_FONT_CODE_RIGHT_JOINED);
 	    break;
 	  }
 
@@ -616,7 +653,7 @@ process_cursive (struct gsub_feature *feature,
 }
 
 static void
-add_font (struct grub_font_info *font_info, FT_Face face, int nocut)
+add_font (struct grub_font_info *font_info, FT_Face face)
 {
   struct gsub_header *gsub = NULL;
   FT_ULong gsub_len = 0;
@@ -710,7 +747,7 @@ add_font (struct grub_font_info *font_info, FT_Face face, int nocut)
       for (i = 0; i < font_info->num_range; i++)
 	for (j = font_info->ranges[i * 2]; j <= font_info->ranges[i * 2 + 1];
 	     j++)
-	  add_char (font_info, face, j, nocut);
+	  add_char (face, j);
     }
   else
     {
@@ -719,10 +756,442 @@ add_font (struct grub_font_info *font_info, FT_Face face, int nocut)
       for (char_code = FT_Get_First_Char (face, &glyph_index);
 	   glyph_index;
 	   char_code = FT_Get_Next_Char (face, char_code, &glyph_index))
-	add_char (font_info, face, char_code, nocut);
+	add_char (face, char_code);
     }
 }
 
+/* Rendered glyphs come back from the rendering processes, and are kept in
+   the glyph cache, as these records, each followed by its bitmap.  */
+struct glyph_record
+{
+  grub_uint32_t glyph_idx;
+  grub_int32_t width;
+  grub_int32_t height;
+  grub_int32_t x_ofs;
+  grub_int32_t y_ofs;
+  grub_int32_t device_width;
+  grub_uint32_t bitmap_size;
+} GRUB_PACKED;
+
+#define GLYPH_CACHE_MAGIC	"GRUBGLC1"
+
+struct glyph_buffer
+{
+  grub_uint8_t *data;
+  size_t len;
+  size_t max;
+};
+
+static int render_processes = 1;
+static const char *glyph_cache_dir;
+
+static void
+glyph_buffer_append (struct glyph_buffer *buf, const void *data, size_t len)
+{
+  if (buf->len + len > buf->max)
+    {
+      buf->max = 2 * (buf->len + len);
+      buf->data = xrealloc (buf->data, buf->max);
+    }
+  memcpy (buf->data + buf->len, data, len);
+  buf->len += len;
+}
+
+static void
+glyph_buffer_add (struct glyph_buffer *buf, FT_UInt glyph_idx,
+		  const struct grub_glyph_info *glyph_info)
+{
+  struct glyph_record rec;
+
+  rec.glyph_idx = glyph_idx;
+  rec.width = glyph_info->width;
+  rec.height = glyph_info->height;
+  rec.x_ofs = glyph_info->x_ofs;
+  rec.y_ofs = glyph_info->y_ofs;
+  rec.device_width = glyph_info->device_width;
+  rec.bitmap_size = glyph_info->bitmap_size;
+  glyph_buffer_append (buf, &rec, sizeof (rec));
+  glyph_buffer_append (buf, glyph_info->bitmap, glyph_info->bitmap_size);
+}
+
+/* Store the glyphs of the records in DATA into RENDERED, which has NUM
+   entries.  Return 0 if the records are corrupted.  */
+static int
+glyph_buffer_parse (const grub_uint8_t *data, size_t len,
+		    struct grub_glyph_info **rendered, FT_UInt num)
+{
+  while (len)
+    {
+      struct glyph_record rec;
+      struct grub_glyph_info *glyph_info;
+
+      if (len < sizeof (rec))
+	return 0;
+      memcpy (&rec, data, sizeof (rec));
+      data += sizeof (rec);
+      len -= sizeof (rec);
+
+      if (rec.glyph_idx >= num || rec.width < 0 || rec.height < 0
+	  || rec.width > 0xffff || rec.height > 0xffff
+	  || rec.bitmap_size != ((grub_uint64_t) rec.width * rec.height + 7) / 8
+	  || rec.bitmap_size > len)
+	return 0;
+
+      if (!rendered[rec.glyph_idx])
+	{
+	  glyph_info = xmalloc (sizeof (struct grub_glyph_info));
+	  glyph_info->bitmap = xmalloc (rec.bitmap_size);
+	  memcpy (glyph_info->bitmap, data, rec.bitmap_size);
+	  glyph_info->bitmap_size = rec.bitmap_size;
+	  glyph_info->next = NULL;
+	  glyph_info->char_code = 0;
+	  glyph_info->width = rec.width;
+	  glyph_info->height = rec.height;
+	  glyph_info->x_ofs = rec.x_ofs;
+	  glyph_info->y_ofs = rec.y_ofs;
+	  glyph_info->device_width = rec.device_width;
+	  rendered[rec.glyph_idx] = glyph_info;
+	}
+      data += rec.bitmap_size;
+      len -= rec.bitmap_size;
+    }
+  return 1;
+}
+
+/* The cache file of glyphs rendered from the face FACE_INDEX of FILENAME
+   with the current settings.  Its name has a hash of the contents of the
+   font file, so that a font changing or moving is noticed.  */
+static char *
+glyph_cache_name (const struct grub_font_info *font_info,
+		  const char *filename, int face_index, int nocut)
+{
+  static grub_uint8_t buf[65536];
+  grub_uint64_t hash = 0xcbf29ce484222325ULL;
+  size_t len, i;
+  char *name;
+  FILE *file;
+
+  file = grub_util_fopen (filename, "rb");
+  if (!file)
+    return NULL;
+  while ((len = fread (buf, 1, sizeof (buf), file)) > 0)
+    for (i = 0; i < len; i++)
+      hash = (hash ^ buf[i]) * 0x100000001b3ULL;
+  fclose (file);
+
+  len = strlen (glyph_cache_dir) + 128;
+  name = xmalloc (len);
+  snprintf (name, len, "%s/%016llx-%d-%d-%x-%d-%d.%d.%d.glyphs",
+	    glyph_cache_dir, (unsigned long long) hash, face_index,
+	    font_info->size, font_info->flags, nocut,
+	    FREETYPE_MAJOR, FREETYPE_MINOR, FREETYPE_PATCH);
+  return name;
+}
+
+static void
+glyph_cache_load (const char *name, struct grub_glyph_info **rendered,
+		  FT_UInt num)
+{
+  struct glyph_buffer buf = { NULL, 0, 0 };
+  grub_uint8_t chunk[65536];
+  size_t len;
+  FILE *file;
+
+  file = grub_util_fopen (name, "rb");
+  if (!file)
+    return;
+  while ((len = fread (chunk, 1, sizeof (chunk), file)) > 0)
+    glyph_buffer_append (&buf, chunk, len);
+  fclose (file);
+
+  if (buf.len < sizeof (GLYPH_CACHE_MAGIC) - 1
+      || memcmp (buf.data, GLYPH_CACHE_MAGIC,
+		 sizeof (GLYPH_CACHE_MAGIC) - 1) != 0
+      || !glyph_buffer_parse (buf.data + sizeof (GLYPH_CACHE_MAGIC) - 1,
+			      buf.len - (sizeof (GLYPH_CACHE_MAGIC) - 1),
+			      rendered, num))
+    grub_util_info ("glyph cache %s is corrupted", name);
+  free (buf.data);
+}
+
+/* Write all the glyphs of RENDERED to the cache file NAME, through a
+   temporary file so that a run stopped halfway leaves no partial cache.  */
+static void
+glyph_cache_save (const char *name, struct grub_glyph_info **rendered,
+		  FT_UInt num)
+{
+  struct glyph_buffer buf = { NULL, 0, 0 };
+  size_t len = strlen (name) + 32;
+  char *tmp;
+  FT_UInt i;
+  FILE *file;
+  int ok;
+
+  glyph_buffer_append (&buf, GLYPH_CACHE_MAGIC,
+		       sizeof (GLYPH_CACHE_MAGIC) - 1);
+  for (i = 0; i < num; i++)
+    if (rendered[i])
+      glyph_buffer_add (&buf, i, rendered[i]);
+
+  tmp = xmalloc (len);
+  snprintf (tmp, len, "%s.%d", name, (int) getpid ());
+  file = grub_util_fopen (tmp, "wb");
+  ok = file && fwrite (buf.data, 1, buf.len, file) == buf.len;
+  if (file && fclose (file) != 0)
+    ok = 0;
+  if (ok && rename (tmp, name) != 0)
+    ok = 0;
+  if (!ok)
+    {
+      grub_util_info ("cannot write glyph cache %s: %s", name,
+		      strerror (errno));
+      if (file)
+	unlink (tmp);
+    }
+  free (tmp);
+  free (buf.data);
+}
+
+#if !defined (_WIN32)
+static int
+write_all (int fd, const grub_uint8_t *data, size_t len)
+{
+  while (len)
+    {
+      ssize_t ret = write (fd, data, len);
+      if (ret < 0 && errno == EINTR)
+	continue;
+      if (ret <= 0)
+	return 0;
+      data += ret;
+      len -= ret;
+    }
+  return 1;
+}
+
+/* Render the glyphs of TODO by RENDER_PROCESSES processes, each with a face
+   of its own opened from FILENAME: process K renders the glyphs K, K + N,
+   K + 2N...  The share of a process which could not be started, or which
+   failed, is rendered here afterwards.  */
+static void
+render_forked (const struct grub_font_info *font_info, FT_Face face,
+	       const char *filename, int face_index, int nocut,
+	       const struct glyph_job **todo, size_t ntodo,
+	       struct grub_glyph_info **rendered)
+{
+  int n = render_processes, k, left = 0;
+  pid_t *pids = xmalloc (n * sizeof (pids[0]));
+  struct pollfd *fds = xmalloc (n * sizeof (fds[0]));
+  struct glyph_buffer *bufs = xcalloc (n, sizeof (bufs[0]));
+  FT_UInt num = face->num_glyphs;
+  size_t i;
+
+  /* Do not let the children output what is buffered.  */
+  fflush (NULL);
+
+  for (k = 0; k < n; k++)
+    {
+      int pipefd[2];
+
+      pids[k] = -1;
+      fds[k].fd = -1;
+      fds[k].events = POLLIN;
+      if (pipe (pipefd) < 0)
+	continue;
+      pids[k] = fork ();
+      if (pids[k] < 0)
+	{
+	  close (pipefd[0]);
+	  close (pipefd[1]);
+	  continue;
+	}
+      if (pids[k] == 0)
+	{
+	  struct glyph_buffer out = { NULL, 0, 0 };
+	  FT_Library lib;
+	  FT_Face own;
+	  int ret;
+
+	  close (pipefd[0]);
+	  if (FT_Init_FreeType (&lib)
+	      || FT_New_Face (lib, filename, face_index, &own)
+	      || FT_Set_Pixel_Sizes (own, font_info->size, font_info->size))
+	    _exit (1);
+	  for (i = k; i < ntodo; i += n)
+	    {
+	      struct grub_glyph_info *glyph_info;
+
+	      glyph_info = render_glyph (font_info, todo[i]->glyph_idx, own,
+					 todo[i]->char_code, nocut);
+	      if (glyph_info)
+		glyph_buffer_add (&out, todo[i]->glyph_idx, glyph_info);
+	    }
+	  fflush (stdout);
+	  ret = write_all (pipefd[1], out.data, out.len);
+	  _exit (ret ? 0 : 1);
+	}
+      close (pipefd[1]);
+      fds[k].fd = pipefd[0];
+      left++;
+    }
+
+  while (left)
+    {
+      if (poll (fds, n, -1) < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  grub_util_error ("poll: %s", strerror (errno));
+	}
+      for (k = 0; k < n; k++)
+	{
+	  grub_uint8_t chunk[65536];
+	  ssize_t ret;
+
+	  if (fds[k].fd < 0 || !fds[k].revents)
+	    continue;
+	  ret = read (fds[k].fd, chunk, sizeof (chunk));
+	  if (ret < 0 && errno == EINTR)
+	    continue;
+	  if (ret > 0)
+	    {
+	      glyph_buffer_append (&bufs[k], chunk, ret);
+	      continue;
+	    }
+	  close (fds[k].fd);
+	  fds[k].fd = -1;
+	  left--;
+	}
+    }
+
+  for (k = 0; k < n; k++)
+    {
+      int status = 0;
+
+      if (pids[k] > 0)
+	{
+	  while (waitpid (pids[k], &status, 0) < 0 && errno == EINTR);
+	  if (WIFEXITED (status) && WEXITSTATUS (status) == 0
+	      && glyph_buffer_parse (bufs[k].data, bufs[k].len,
+				     rendered, num))
+	    {
+	      free (bufs[k].data);
+	      continue;
+	    }
+	  grub_util_info ("glyph rendering process %d failed", k);
+	}
+      free (bufs[k].data);
+
+      /* A glyph failing to render is reported again here, as it is when
+	 there is a single process.  */
+      for (i = k; i < ntodo; i += n)
+	if (!rendered[todo[i]->glyph_idx])
+	  rendered[todo[i]->glyph_idx]
+	    = render_glyph (font_info, todo[i]->glyph_idx, face,
+			    todo[i]->char_code, nocut);
+    }
+
+  free (bufs);
+  free (fds);
+  free (pids);
+}
+#endif
+
+/* Render the glyphs queued for FACE, opened from the face FACE_INDEX of
+   FILENAME, and add them to FONT_INFO in the order they were queued.  */
+static void
+render_glyphs (struct grub_font_info *font_info, FT_Face face,
+	       const char *filename, int face_index, int nocut)
+{
+  FT_UInt num = face->num_glyphs;
+  struct grub_glyph_info **rendered;
+  const struct glyph_job **todo;
+  grub_uint8_t *state;
+  size_t i, ntodo = 0;
+  char *cache_name = NULL;
+  FT_UInt j;
+
+  rendered = xcalloc (num ? : 1, sizeof (rendered[0]));
+  /* 1 for the glyphs queued, 2 once they have been added.  */
+  state = xcalloc (num ? : 1, 1);
+  todo = xmalloc ((num_glyph_jobs ? : 1) * sizeof (todo[0]));
+
+  if (glyph_cache_dir)
+    cache_name = glyph_cache_name (font_info, filename, face_index, nocut);
+  if (cache_name)
+    glyph_cache_load (cache_name, rendered, num);
+
+  for (i = 0; i < num_glyph_jobs; i++)
+    {
+      FT_UInt idx = glyph_jobs[i].glyph_idx;
+      if (idx >= num || state[idx])
+	continue;
+      state[idx] = 1;
+      if (!rendered[idx])
+	todo[ntodo++] = &glyph_jobs[i];
+    }
+
+  grub_util_info ("rendering %" PRIuGRUB_SIZE " glyphs, %" PRIuGRUB_SIZE
+		  " from the cache", ntodo,
+		  num_glyph_jobs - ntodo);
+
+#if !defined (_WIN32)
+  if (render_processes > 1 && ntodo >= 64 * (size_t) render_processes)
+    render_forked (font_info, face, filename, face_index, nocut,
+		   todo, ntodo, rendered);
+  else
+#endif
+    for (i = 0; i < ntodo; i++)
+      rendered[todo[i]->glyph_idx]
+	= render_glyph (font_info, todo[i]->glyph_idx, face,
+			todo[i]->char_code, nocut);
+
+  if (cache_name && ntodo)
+    glyph_cache_save (cache_name, rendered, num);
+  free (cache_name);
+
+  for (i = 0; i < num_glyph_jobs; i++)
+    {
+      FT_UInt idx = glyph_jobs[i].glyph_idx;
+      struct grub_glyph_info *glyph_info;
+
+      if (idx >= num)
+	{
+	  /* Out of the face, so that FreeType reports the error.  */
+	  glyph_info = render_glyph (font_info, idx, face,
+				     glyph_jobs[i].char_code, nocut);
+	  if (glyph_info)
+	    link_glyph (font_info, glyph_info, glyph_jobs[i].char_code);
+	  continue;
+	}
+      if (!rendered[idx])
+	continue;
+      if (state[idx] == 2)
+	{
+	  /* Several characters share this glyph, and its bitmap.  */
+	  glyph_info = xmalloc (sizeof (struct grub_glyph_info));
+	  *glyph_info = *rendered[idx];
+	}
+      else
+	glyph_info = rendered[idx];
+      state[idx] = 2;
+      link_glyph (font_info, glyph_info, glyph_jobs[i].char_code);
+    }
+
+  /* Glyphs of the cache no character of this run uses.  */
+  for (j = 0; j < num; j++)
+    if (rendered[j] && state[j] != 2)
+      {
+	free (rendered[j]->bitmap);
+	free (rendered[j]);
+      }
+
+  num_glyph_jobs = 0;
+  free (todo);
+  free (state);
+  free (rendered);
+}
+
 static void
 write_string_section (const char *name, const char *str,
 		      int *offset, FILE *file,
@@ -1005,6 +1474,11 @@ static struct argp_option options[] = {
       pre-rendered bitmap is available.
     */
    N_("ignore bitmap strikes when loading"), 0},
+  {"jobs",  'j', N_("NUM"), 0,
+   N_("render the glyphs in NUM processes [default=number of CPUs]"), 0},
+  {"cache",  0x102, N_("DIR"), 0,
+   N_("keep the rendered glyphs in the existing directory DIR, and reuse"
+      " them when the same font is converted again"), 0},
   {"verbose",  'v', 0, 0, N_("print verbose messages."), 0},
   { 0, 0, 0, 0, 0, 0 }
 };
@@ -1045,7 +1519,7 @@ static int
 has_argument (int v)
 {
   return v =='o' || v == 'i' || v == 'r' || v == 'n' || v == 's'
-    || v == 'd' || v == 'c';
+    || v == 'd' || v == 'c' || v == 'j';
 }
 
 #endif
@@ -1135,6 +1609,16 @@ argp_parser (int key, char *arg, struct my_argp_state *state)
       arguments->font_info.asce = strtoul (arg, NULL, 0);
       break;
 
+    case 'j':
+      render_processes = strtoul (arg, NULL, 0);
+      if (render_processes < 1)
+	render_processes = 1;
+      break;
+
+    case 0x102:
+      glyph_cache_dir = xstrdup (arg);
+      break;
+
     case 'v':
       font_verbosity++;
       break;
@@ -1212,6 +1696,13 @@ main (int argc, char *argv[])
 
   memset (&arguments, 0, sizeof (struct arguments));
   arguments.file_format = PF2;
+#if !defined (_WIN32)
+  {
+    long ncpus = sysconf (_SC_NPROCESSORS_ONLN);
+    if (ncpus > 1)
+      render_processes = ncpus;
+  }
+#endif
   arguments.files_max = argc + 1;
   arguments.files = xmalloc ((arguments.files_max + 1)
 			     * sizeof (arguments.files[0]));
@@ -1276,7 +1767,9 @@ main (int argc, char *argv[])
 			   size, size, err,
 			   (err > 0 && err < (signed) ARRAY_SIZE (ft_errmsgs))
 			   ? ft_errmsgs[err] : "");
-	add_font (&arguments.font_info, ft_face, arguments.file_format != PF2);
+	add_font (&arguments.font_info, ft_face);
+	render_glyphs (&arguments.font_info, ft_face, arguments.files[i],
+		       arguments.font_index, arguments.file_format != PF2);
 	FT_Done_Face (ft_face);
       }
   }
@@ -80,7 +80,9 @@ static struct argp_option options[] = {
   {"note",   'n', 0, 0, N_("add NOTE segment for CHRP IEEE1275"), 0},
   {"output",  'o', N_("FILE"), 0, N_("output a generated image to FILE [default=stdout]"), 0},
   {"format",  'O', N_("FORMAT"), 0, 0, 0},
-  {"compression",  'C', "(xz|none|auto)", 0, N_("choose the compression to use for core image"), 0},
+  {"compression",  'C', "(xz|lz4|none|auto)", 0, N_("choose the compression to use for core image"), 0},
+  {"memdisk-compression", GRUB_INSTALL_OPTIONS_MEMDISK_COMPRESS, "(lz4|none)", 0,
+   N_("keep the memdisk image compressed, to be decompressed as it is read"), 0},
   {"sbat", 's', N_("FILE"), 0, N_("SBAT metadata"), 0},
   {"disable-shim-lock", GRUB_INSTALL_OPTIONS_DISABLE_SHIM_LOCK, 0, 0, N_("disable shim_lock verifier"), 0},
   {"verbose",     'v', 0,      0, N_("print verbose messages."), 0},
@@ -128,6 +130,7 @@ struct arguments
   char *sbat;
   int note;
   int disable_shim_lock;
+  int compress_memdisk;
   const struct grub_install_image_target_desc *image_target;
   grub_compression_t comp;
 };
@@ -213,6 +216,8 @@ argp_parser (int key, char *arg, struct argp_state *state)
 			   _("grub-mkimage is compiled without XZ support"));
 #endif
 	}
+      else if (grub_strcmp (arg, "lz4") == 0)
+	arguments->comp = GRUB_COMPRESSION_LZ4;
       else if (grub_strcmp (arg, "none") == 0)
 	arguments->comp = GRUB_COMPRESSION_NONE;
       else if (grub_strcmp (arg, "auto") == 0)
@@ -239,6 +244,15 @@ argp_parser (int key, char *arg, struct argp_state *state)
       arguments->disable_shim_lock = 1;
       break;
 
+    case GRUB_INSTALL_OPTIONS_MEMDISK_COMPRESS:
+      if (grub_strcmp (arg, "lz4") == 0)
+	arguments->compress_memdisk = 1;
+      else if (grub_strcmp (arg, "none") == 0)
+	arguments->compress_memdisk = 0;
+      else
+	grub_util_error (_("Unknown compression format %s"), arg);
+      break;
+
     case 'v':
       verbosity++;
       break;
@@ -325,7 +339,8 @@ main (int argc, char *argv[])
 			       arguments.npubkeys, arguments.config,
 			       arguments.image_target, arguments.note,
 			       arguments.comp, arguments.dtb,
-			       arguments.sbat, arguments.disable_shim_lock);
+			       arguments.sbat, arguments.disable_shim_lock,
+			       arguments.compress_memdisk);
 
   if (grub_util_file_sync (fp) < 0)
     grub_util_error (_("cannot sync `%s': %s"), arguments.output ? : "stdout",
@@ -36,6 +36,8 @@
 
 #include <string.h>
 #include <time.h>
+#include <errno.h>
+#include <unistd.h>
 
 static char *source_dirs[GRUB_INSTALL_PLATFORM_MAX];
 static char *rom_directory;
@@ -244,6 +246,107 @@ write_part (FILE *f, const char *srcdir)
   fclose (in);
 }
 
+/* The images of the platforms do not depend on each other, and building
+   one is mostly compression, so each is built by a child process while
+   the next is set up.  */
+struct image_job
+{
+  pid_t pid;
+  char *load_cfg;
+  char *mkimage_target;
+};
+
+static struct image_job *image_jobs;
+static int image_jobs_running;
+static int image_jobs_max;
+static int image_jobs_failed;
+
+/* Reap one child, at least one running.  */
+static void
+image_job_reap (void)
+{
+  int wstatus, i;
+  pid_t pid;
+
+  do
+    pid = waitpid (-1, &wstatus, 0);
+  while (pid == -1 && errno == EINTR);
+  if (pid == -1)
+    grub_util_error ("waitpid: %s", strerror (errno));
+
+  for (i = 0; i < image_jobs_running; i++)
+    if (image_jobs[i].pid == pid)
+      break;
+  /* Not one of ours.  */
+  if (i == image_jobs_running)
+    return;
+
+  if (!WIFEXITED (wstatus) || WEXITSTATUS (wstatus) != 0)
+    {
+      grub_util_warn (_("building the %s image failed"),
+		      image_jobs[i].mkimage_target);
+      image_jobs_failed = 1;
+    }
+  grub_util_unlink (image_jobs[i].load_cfg);
+  free (image_jobs[i].load_cfg);
+  free (image_jobs[i].mkimage_target);
+  image_jobs[i] = image_jobs[--image_jobs_running];
+}
+
+/* Wait for the images being built, before using them.  */
+static void
+image_jobs_wait (void)
+{
+  while (image_jobs_running)
+    image_job_reap ();
+  if (image_jobs_failed)
+    grub_util_error ("%s", _("some images could not be built"));
+}
+
+/* Build the image like grub_install_make_image_wrap does, with the
+   modules pushed now, in the background.  LOAD_CFG is taken over and
+   removed once done.  */
+static void
+image_job_start (const char *dir, const char *prefix, const char *output,
+		 char *load_cfg, const char *mkimage_target)
+{
+  pid_t pid;
+
+  if (!image_jobs_max)
+    {
+      long ncpus = sysconf (_SC_NPROCESSORS_ONLN);
+
+      image_jobs_max = (ncpus > 0) ? ncpus : 1;
+      image_jobs = xcalloc (image_jobs_max, sizeof (image_jobs[0]));
+    }
+  while (image_jobs_running >= image_jobs_max)
+    image_job_reap ();
+
+  /* Or the child would write out what is buffered once more.  */
+  fflush (NULL);
+  pid = fork ();
+  if (pid < 0)
+    {
+      /* Do it here then.  */
+      grub_install_make_image_wrap (dir, prefix, output, 0, load_cfg,
+				    mkimage_target, 0);
+      grub_util_unlink (load_cfg);
+      free (load_cfg);
+      return;
+    }
+  if (pid == 0)
+    {
+      grub_install_make_image_wrap (dir, prefix, output, 0, load_cfg,
+				    mkimage_target, 0);
+      exit (0);
+    }
+
+  image_jobs[image_jobs_running].pid = pid;
+  image_jobs[image_jobs_running].load_cfg = load_cfg;
+  image_jobs[image_jobs_running].mkimage_target = xstrdup (mkimage_target);
+  image_jobs_running++;
+}
+
 static void
 make_image_abs (enum grub_install_plat plat,
 		const char *mkimage_target,
@@ -288,12 +391,10 @@ make_image_abs (enum grub_install_plat plat,
 
   grub_install_push_module ("search");
   grub_install_push_module ("iso9660");
-  grub_install_make_image_wrap (source_dirs[plat], "/boot/grub", output,
-				0, load_cfg,
-				mkimage_target, 0);
+  image_job_start (source_dirs[plat], "/boot/grub", output, load_cfg,
+		   mkimage_target);
   grub_install_pop_module ();
   grub_install_pop_module ();
-  grub_util_unlink (load_cfg);
 }
 
 static void
@@ -327,10 +428,9 @@ make_image_fwdisk_abs (enum grub_install_plat plat,
   fclose (load_cfg_f);
 
   grub_install_push_module ("iso9660");
-  grub_install_make_image_wrap (source_dirs[plat], "()/boot/grub", output,
-				0, load_cfg, mkimage_target, 0);
+  image_job_start (source_dirs[plat], "()/boot/grub", output, load_cfg,
+		   mkimage_target);
   grub_install_pop_module ();
-  grub_util_unlink (load_cfg);
 }
 
 static int
@@ -688,11 +788,13 @@ main (int argc, char *argv[])
   /** build multiboot core.img */
   grub_install_push_module ("pata");
   grub_install_push_module ("ahci");
+  grub_install_push_module ("nvme");
   grub_install_push_module ("at_keyboard");
   make_image (GRUB_INSTALL_PLATFORM_I386_MULTIBOOT, "i386-multiboot", "i386-multiboot/core.elf");
   grub_install_pop_module ();
   grub_install_pop_module ();
   grub_install_pop_module ();
+  grub_install_pop_module ();
 
   make_image_fwdisk (GRUB_INSTALL_PLATFORM_I386_IEEE1275, "i386-ieee1275", "ofwx86.elf");
 
@@ -826,6 +928,8 @@ main (int argc, char *argv[])
       make_image_abs (GRUB_INSTALL_PLATFORM_RISCV64_EFI, "riscv64-efi", imgname);
       free (imgname);
 
+      image_jobs_wait ();
+
       if (source_dirs[GRUB_INSTALL_PLATFORM_I386_EFI])
 	{
 	  imgname = grub_util_path_concat (2, efidir_efi_boot, "boot.efi");
@@ -976,11 +1080,15 @@ main (int argc, char *argv[])
   make_image (GRUB_INSTALL_PLATFORM_I386_QEMU, "i386-qemu", "roms/qemu.img");
 
   grub_install_push_module ("ahci");
+  grub_install_push_module ("nvme");
 
   make_image (GRUB_INSTALL_PLATFORM_I386_COREBOOT, "i386-coreboot", "roms/coreboot.elf");
   grub_install_pop_module ();
   grub_install_pop_module ();
   grub_install_pop_module ();
+  grub_install_pop_module ();
+
+  image_jobs_wait ();
 
   if (rom_directory)
     {
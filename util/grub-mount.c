@@ -39,6 +39,7 @@
 #include <unistd.h>
 #include <string.h>
 #include <stdlib.h>
+#include <pthread.h>
 
 #pragma GCC diagnostic ignored "-Wmissing-prototypes"
 #pragma GCC diagnostic ignored "-Wmissing-declarations"
@@ -120,6 +121,130 @@ translate_error (void)
   return ret;
 }
 
+/* FUSE calls in from several threads, but the GRUB core is not meant to
+   be entered twice, so every operation runs under this lock.  Reads of
+   pages the kernel keeps do not reach us at all.  */
+static pthread_mutex_t grub_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* The image does not change under us, so the attributes found once are
+   kept.  Without them each stat lists the parent directory again, which
+   made walking a directory quadratic in its size.  An entry with EXISTS
+   clear records a name known not to exist.  */
+#define ATTR_CACHE_BUCKETS	4096
+#define ATTR_CACHE_MAX		262144
+
+struct attr_cache_entry
+{
+  struct attr_cache_entry *next;
+  int exists;
+  struct stat st;
+  char path[0];
+};
+
+static struct attr_cache_entry *attr_cache[ATTR_CACHE_BUCKETS];
+static unsigned attr_cache_count;
+
+static unsigned
+attr_cache_hash (const char *path)
+{
+  unsigned h = 5381;
+
+  for (; *path; path++)
+    h = h * 33 + (unsigned char) *path;
+  return h % ATTR_CACHE_BUCKETS;
+}
+
+static struct attr_cache_entry *
+attr_cache_find (const char *path)
+{
+  struct attr_cache_entry *e;
+
+  for (e = attr_cache[attr_cache_hash (path)]; e; e = e->next)
+    if (strcmp (e->path, path) == 0)
+      return e;
+  return NULL;
+}
+
+static void
+attr_cache_flush (void)
+{
+  struct attr_cache_entry *e, *next;
+  unsigned i;
+
+  for (i = 0; i < ATTR_CACHE_BUCKETS; i++)
+    {
+      for (e = attr_cache[i]; e; e = next)
+	{
+	  next = e->next;
+	  free (e);
+	}
+      attr_cache[i] = NULL;
+    }
+  attr_cache_count = 0;
+}
+
+/* Remember ST, or that PATH does not exist if ST is NULL.  */
+static void
+attr_cache_add (const char *path, const struct stat *st)
+{
+  struct attr_cache_entry *e;
+  unsigned h;
+
+  if (attr_cache_find (path))
+    return;
+
+  /* The directories of a whole image rarely get there; when they do,
+     starting over is as good as anything finer.  */
+  if (attr_cache_count >= ATTR_CACHE_MAX)
+    attr_cache_flush ();
+
+  e = malloc (sizeof (*e) + strlen (path) + 1);
+  if (!e)
+    return;
+  strcpy (e->path, path);
+  e->exists = !!st;
+  if (st)
+    e->st = *st;
+  h = attr_cache_hash (path);
+  e->next = attr_cache[h];
+  attr_cache[h] = e;
+  attr_cache_count++;
+}
+
+/* Fill ST for a file or directory described by INFO.  PATH is used to
+   get the size of files.  */
+static int
+fill_stat (const char *path, const struct grub_dirhook_info *info,
+	   struct stat *st)
+{
+  grub_memset (st, 0, sizeof (*st));
+  st->st_ino = info->inodeset ? info->inode : 0;
+  st->st_mode = info->dir ? (0555 | S_IFDIR) : (0444 | S_IFREG);
+  if (!info->dir)
+    {
+      grub_file_t file;
+      file = grub_file_open (path, GRUB_FILE_TYPE_GET_SIZE);
+      /* Symlink to directory.  */
+      if (! file && grub_errno == GRUB_ERR_BAD_FILE_TYPE)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  st->st_mode = (0555 | S_IFDIR);
+	}
+      else if (! file)
+	return translate_error ();
+      else
+	{
+	  st->st_size = file->size;
+	  grub_file_close (file);
+	}
+    }
+  st->st_blksize = 512;
+  st->st_blocks = (st->st_size + 511) >> 9;
+  st->st_atime = st->st_mtime = st->st_ctime
+    = info->mtimeset ? info->mtime : 0;
+  return 0;
+}
+
 /* Context for fuse_getattr.  */
 struct fuse_getattr_ctx
 {
@@ -145,17 +270,13 @@ fuse_getattr_find_file (const char *cur_filename,
   return 0;
 }
 
-#if FUSE_USE_VERSION < 30
-static int
-fuse_getattr (const char *path, struct stat *st)
-#else
 static int
-fuse_getattr (const char *path, struct stat *st,
-              struct fuse_file_info *fi __attribute__ ((unused)))
-#endif
+getattr_locked (const char *path, struct stat *st)
 {
   struct fuse_getattr_ctx ctx;
+  struct attr_cache_entry *e;
   char *pathname, *path2;
+  int ret;
 
   if (path[0] == '/' && path[1] == 0)
     {
@@ -180,6 +301,16 @@ fuse_getattr (const char *path, struct stat *st,
   while (*pathname && pathname[grub_strlen (pathname) - 1] == '/')
     pathname[grub_strlen (pathname) - 1] = 0;
 
+  e = attr_cache_find (pathname);
+  if (e)
+    {
+      free (pathname);
+      if (!e->exists)
+	return -ENOENT;
+      *st = e->st;
+      return 0;
+    }
+
   /* Split into path and filename. */
   ctx.filename = grub_strrchr (pathname, '/');
   if (! ctx.filename)
@@ -198,42 +329,35 @@ fuse_getattr (const char *path, struct stat *st,
   (fs->fs_dir) (dev, path2, fuse_getattr_find_file, &ctx);
 
   grub_free (path2);
-  free (pathname);
+  grub_errno = GRUB_ERR_NONE;
   if (!ctx.file_exists)
     {
-      grub_errno = GRUB_ERR_NONE;
+      attr_cache_add (pathname, NULL);
+      free (pathname);
       return -ENOENT;
     }
-  st->st_dev = 0;
-  st->st_ino = 0;
-  st->st_mode = ctx.file_info.dir ? (0555 | S_IFDIR) : (0444 | S_IFREG);
-  st->st_uid = 0;
-  st->st_gid = 0;
-  st->st_rdev = 0;
-  st->st_size = 0;
-  if (!ctx.file_info.dir)
-    {
-      grub_file_t file;
-      file = grub_file_open (path, GRUB_FILE_TYPE_GET_SIZE);
-      if (! file && grub_errno == GRUB_ERR_BAD_FILE_TYPE)
-	{
-	  grub_errno = GRUB_ERR_NONE;
-	  st->st_mode = (0555 | S_IFDIR);
-	}
-      else if (! file)
-	return translate_error ();
-      else
-	{
-	  st->st_size = file->size;
-	  grub_file_close (file);
-	}
-    }
-  st->st_blksize = 512;
-  st->st_blocks = (st->st_size + 511) >> 9;
-  st->st_atime = st->st_mtime = st->st_ctime = ctx.file_info.mtimeset
-    ? ctx.file_info.mtime : 0;
-  grub_errno = GRUB_ERR_NONE;
-  return 0;
+  ret = fill_stat (path, &ctx.file_info, st);
+  if (ret == 0)
+    attr_cache_add (pathname, st);
+  free (pathname);
+  return ret;
+}
+
+#if FUSE_USE_VERSION < 30
+static int
+fuse_getattr (const char *path, struct stat *st)
+#else
+static int
+fuse_getattr (const char *path, struct stat *st,
+              struct fuse_file_info *fi __attribute__ ((unused)))
+#endif
+{
+  int ret;
+
+  pthread_mutex_lock (&grub_lock);
+  ret = getattr_locked (path, st);
+  pthread_mutex_unlock (&grub_lock);
+  return ret;
 }
 
 static int
@@ -242,55 +366,65 @@ fuse_opendir (const char *path, struct fuse_file_info *fi)
   return 0;
 }
 
-/* FIXME */
-static grub_file_t files[65536];
-static int first_fd = 1;
-
 static int
 fuse_open (const char *path, struct fuse_file_info *fi)
 {
+  grub_file_t file;
+  int ret = 0;
+
   if ((fi->flags & O_ACCMODE) != O_RDONLY)
     return -EROFS;
 
-  grub_file_t file;
+  pthread_mutex_lock (&grub_lock);
   file = grub_file_open (path, GRUB_FILE_TYPE_MOUNT);
   if (! file)
-    return translate_error ();
-  files[first_fd++] = file;
-  fi->fh = first_fd;
-  files[first_fd++] = file;
-  grub_errno = GRUB_ERR_NONE;
-  return 0;
+    ret = translate_error ();
+  else
+    {
+      fi->fh = (grub_addr_t) file;
+      /* Nothing changes the image, so what the kernel has cached from an
+	 earlier open is still good.  */
+      fi->keep_cache = 1;
+      grub_errno = GRUB_ERR_NONE;
+    }
+  pthread_mutex_unlock (&grub_lock);
+  return ret;
 }
 
 static int
 fuse_read (const char *path, char *buf, size_t sz, off_t off,
 	   struct fuse_file_info *fi)
 {
-  grub_file_t file = files[fi->fh];
+  grub_file_t file = (grub_file_t) (grub_addr_t) fi->fh;
   grub_ssize_t size;
+  int ret;
 
   if (off > file->size)
     return -EINVAL;
 
+  pthread_mutex_lock (&grub_lock);
   file->offset = off;
 
   size = grub_file_read (file, buf, sz);
   if (size < 0)
-    return translate_error ();
+    ret = translate_error ();
   else
     {
       grub_errno = GRUB_ERR_NONE;
-      return size;
+      ret = size;
     }
+  pthread_mutex_unlock (&grub_lock);
+  return ret;
 }
 
 static int
 fuse_release (const char *path, struct fuse_file_info *fi)
 {
-  grub_file_close (files[fi->fh]);
-  files[fi->fh] = NULL;
+  pthread_mutex_lock (&grub_lock);
+  grub_file_close ((grub_file_t) (grub_addr_t) fi->fh);
+  fi->fh = 0;
   grub_errno = GRUB_ERR_NONE;
+  pthread_mutex_unlock (&grub_lock);
   return 0;
 }
 
@@ -308,37 +442,17 @@ fuse_readdir_call_fill (const char *filename,
 			const struct grub_dirhook_info *info, void *data)
 {
   struct fuse_readdir_ctx *ctx = data;
+  struct attr_cache_entry *e;
   struct stat st;
-
-  grub_memset (&st, 0, sizeof (st));
-  st.st_mode = info->dir ? (0555 | S_IFDIR) : (0444 | S_IFREG);
-  if (!info->dir)
-    {
-      grub_file_t file;
-      char *tmp;
-      tmp = xasprintf ("%s/%s", ctx->path, filename);
-      file = grub_file_open (tmp, GRUB_FILE_TYPE_GET_SIZE);
-      free (tmp);
-      /* Symlink to directory.  */
-      if (! file && grub_errno == GRUB_ERR_BAD_FILE_TYPE)
-	{
-	  grub_errno = GRUB_ERR_NONE;
-	  st.st_mode = (0555 | S_IFDIR);
-	}
-      else if (!file)
-	{
-	  grub_errno = GRUB_ERR_NONE;
-	}
-      else
-	{
-	  st.st_size = file->size;
-	  grub_file_close (file);
-	}
-    }
-  st.st_blksize = 512;
-  st.st_blocks = (st.st_size + 511) >> 9;
-  st.st_atime = st.st_mtime = st.st_ctime
-    = info->mtimeset ? info->mtime : 0;
+  char *tmp;
+
+  tmp = xasprintf ("%s/%s", ctx->path[1] ? ctx->path : "", filename);
+  e = attr_cache_find (tmp);
+  if (e && e->exists)
+    st = e->st;
+  else if (fill_stat (tmp, info, &st) == 0)
+    attr_cache_add (tmp, &st);
+  free (tmp);
 #if FUSE_USE_VERSION < 30
   ctx->fill (ctx->buf, filename, &st, 0);
 #else
@@ -359,7 +473,6 @@ fuse_readdir (const char *path, void *buf,
 #endif
 {
   struct fuse_readdir_ctx ctx = {
-    .path = path,
     .buf = buf,
     .fill = fill
   };
@@ -371,10 +484,13 @@ fuse_readdir (const char *path, void *buf,
   while (pathname [0] && pathname[1]
 	 && pathname[grub_strlen (pathname) - 1] == '/')
     pathname[grub_strlen (pathname) - 1] = 0;
+  ctx.path = pathname;
 
+  pthread_mutex_lock (&grub_lock);
   (fs->fs_dir) (dev, pathname, fuse_readdir_call_fill, &ctx);
-  free (pathname);
   grub_errno = GRUB_ERR_NONE;
+  pthread_mutex_unlock (&grub_lock);
+  free (pathname);
   return 0;
 }
 
@@ -446,6 +562,7 @@ fuse_init (void)
 
   if (fuse_main (fuse_argc, fuse_args, &grub_opers, NULL))
     grub_error (GRUB_ERR_IO, "fuse_main failed");
+  attr_cache_flush ();
 
   for (i = 0; i < num_disks; i++)
     {
@@ -584,12 +701,9 @@ main (int argc, char *argv[])
 
   grub_util_host_init (&argc, &argv);
 
-  fuse_args = xrealloc (fuse_args, (fuse_argc + 2) * sizeof (fuse_args[0]));
+  fuse_args = xrealloc (fuse_args, (fuse_argc + 1) * sizeof (fuse_args[0]));
   fuse_args[fuse_argc] = xstrdup (argv[0]);
   fuse_argc++;
-  /* Run single-threaded.  */
-  fuse_args[fuse_argc] = xstrdup ("-s");
-  fuse_argc++;
 
   argp_parse (&argp, argc, argv, 0, 0, 0);
 
@@ -43,6 +43,9 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 #include <stdlib.h>
 #include <assert.h>
 
@@ -308,25 +311,29 @@ probe_abstraction (grub_disk_t disk, char delim)
     printf ("raid6rec%c", delim);
 }
 
-static void
-probe (const char *path, char **device_names, char delim)
+static char **
+resolve_path (const char *path)
 {
-  char **drives_names = NULL;
-  char **curdev, **curdrive;
-  char *grub_path = NULL;
-  int ndev = 0;
+  char **device_names;
+  char *grub_path;
 
-  if (path != NULL)
-    {
-      grub_path = grub_canonicalize_file_name (path);
-      if (! grub_path)
-	grub_util_error (_("failed to get canonical path of `%s'"), path);
-      device_names = grub_guess_root_devices (grub_path);
-      free (grub_path);
-    }
+  grub_path = grub_canonicalize_file_name (path);
+  if (! grub_path)
+    grub_util_error (_("failed to get canonical path of `%s'"), path);
+  device_names = grub_guess_root_devices (grub_path);
+  free (grub_path);
 
   if (! device_names)
     grub_util_error (_("cannot find a device for %s (is /dev mounted?)"), path);
+  return device_names;
+}
+
+static void
+probe (char **device_names, char delim)
+{
+  char **drives_names = NULL;
+  char **curdev, **curdrive;
+  int ndev = 0;
 
   if (print == PRINT_DEVICE)
     {
@@ -335,7 +342,7 @@ probe (const char *path, char **device_names, char delim)
 	  printf ("%s", *curdev);
 	  putchar (delim);
 	}
-      goto free_device_names;
+      return;
     }
 
   if (print == PRINT_DISK)
@@ -353,7 +360,7 @@ probe (const char *path, char **device_names, char delim)
 	  putchar (delim);
 	  free (disk);
 	}
-      goto free_device_names;
+      return;
     }
 
   for (curdev = device_names; *curdev; curdev++)
@@ -716,13 +723,213 @@ probe (const char *path, char **device_names, char delim)
   for (curdrive = drives_names; *curdrive; curdrive++)
     free (*curdrive);
   free (drives_names);
+}
+
+/* With a cache file, as grub-mkconfig sets through GRUB_PROBE_CACHE for
+   the scripts it runs, the answer of every successful query is kept, and
+   a later run asking the same question prints it without probing again.
+   A query is the target, the options changing the output and the
+   arguments, each with the device, inode, number and modification time
+   of what it names, so that a device or file replaced is probed again.
+   The file is a sequence of records, a key and an answer each preceded by
+   its length, in the byte order of the host; it is meant to live for one
+   grub-mkconfig run only.  */
+static const char *probe_cache;
+static FILE *probe_capture;
+static int probe_saved_stdout = -1;
 
-free_device_names:
-  if (path != NULL)
+static char *
+probe_cache_key (char **args, size_t nargs, const char *dev_map, char delim)
+{
+  size_t i, len = 0;
+  char *key, *ptr;
+
+  for (i = 0; i < nargs; i++)
+    len += strlen (args[i]) + 100;
+  len += strlen (dev_map) + 100;
+  key = xmalloc (len);
+  ptr = key + sprintf (key, "%s %d %d %s", targets[print], argument_is_device,
+		       delim, dev_map);
+  for (i = 0; i < nargs; i++)
     {
-      for (curdev = device_names; *curdev; curdev++)
-	free (*curdev);
-      free (device_names);
+      struct stat st;
+
+      if (stat (args[i], &st) < 0)
+	memset (&st, 0, sizeof (st));
+      ptr += sprintf (ptr, "\n%s %llx %llx %llx %lld", args[i],
+		      (unsigned long long) st.st_dev,
+		      (unsigned long long) st.st_ino,
+		      (unsigned long long) st.st_rdev,
+		      (long long) st.st_mtime);
+    }
+  return key;
+}
+
+/* Print the answer to KEY if the cache has it.  */
+static int
+probe_cache_lookup (const char *key)
+{
+  size_t key_len = strlen (key);
+  grub_uint32_t lens[2];
+  char *found = NULL;
+  size_t found_len = 0;
+  FILE *file;
+
+  file = grub_util_fopen (probe_cache, "rb");
+  if (!file)
+    return 0;
+  while (fread (lens, sizeof (lens), 1, file) == 1)
+    {
+      char *buf = xmalloc ((grub_size_t) lens[0] + lens[1] + 1);
+
+      if (fread (buf, 1, (grub_size_t) lens[0] + lens[1], file)
+	  != (grub_size_t) lens[0] + lens[1])
+	{
+	  free (buf);
+	  break;
+	}
+      if (lens[0] == key_len && memcmp (buf, key, key_len) == 0)
+	{
+	  free (found);
+	  found = buf;
+	  found_len = lens[1];
+	}
+      else
+	free (buf);
+    }
+  fclose (file);
+
+  if (!found)
+    return 0;
+  grub_util_info ("answer found in %s", probe_cache);
+  fwrite (found + key_len, 1, found_len, stdout);
+  free (found);
+  return 1;
+}
+
+static void
+probe_capture_start (void)
+{
+  fflush (stdout);
+  probe_capture = tmpfile ();
+  if (!probe_capture)
+    return;
+  probe_saved_stdout = dup (1);
+  if (probe_saved_stdout < 0 || dup2 (fileno (probe_capture), 1) < 0)
+    {
+      if (probe_saved_stdout >= 0)
+	close (probe_saved_stdout);
+      probe_saved_stdout = -1;
+      fclose (probe_capture);
+      probe_capture = NULL;
+    }
+}
+
+/* Print what was captured, and return it in *ANSWER, if not NULL.  This is
+   also how what a failing query printed before its error is released.  */
+static void
+probe_capture_end (char **answer, size_t *answer_len)
+{
+  size_t len = 0, max = 4096, r;
+  char *buf;
+
+  if (!probe_capture)
+    return;
+
+  fflush (stdout);
+  dup2 (probe_saved_stdout, 1);
+  close (probe_saved_stdout);
+  probe_saved_stdout = -1;
+
+  buf = xmalloc (max);
+  rewind (probe_capture);
+  while ((r = fread (buf + len, 1, max - len, probe_capture)) > 0)
+    {
+      len += r;
+      if (len == max)
+	buf = xrealloc (buf, max *= 2);
+    }
+  fclose (probe_capture);
+  probe_capture = NULL;
+
+  fwrite (buf, 1, len, stdout);
+  fflush (stdout);
+  if (answer)
+    {
+      *answer = buf;
+      *answer_len = len;
+    }
+  else
+    free (buf);
+}
+
+static void
+probe_capture_atexit (void)
+{
+  probe_capture_end (NULL, NULL);
+}
+
+static void
+probe_cache_add (const char *key, const char *answer, size_t answer_len)
+{
+  grub_uint32_t lens[2];
+  char *rec;
+  int fd;
+
+  lens[0] = strlen (key);
+  lens[1] = answer_len;
+  rec = xmalloc (sizeof (lens) + lens[0] + answer_len);
+  memcpy (rec, lens, sizeof (lens));
+  memcpy (rec + sizeof (lens), key, lens[0]);
+  memcpy (rec + sizeof (lens) + lens[0], answer, answer_len);
+
+  /* A single write to a file opened for appending, so that the records of
+     runs at the same time do not mix.  */
+  fd = open (probe_cache, O_WRONLY | O_APPEND | O_CREAT, 0600);
+  if (fd < 0
+      || write (fd, rec, sizeof (lens) + lens[0] + answer_len)
+      != (ssize_t) (sizeof (lens) + lens[0] + answer_len))
+    grub_util_info ("cannot write to %s: %s", probe_cache, strerror (errno));
+  if (fd >= 0)
+    close (fd);
+  free (rec);
+}
+
+/* Answer the query about ARGS for the current target.  *DEVICE_NAMES are
+   the devices to probe; when it is NULL, ARGS is the path to find them
+   for, and they are only looked for if the cache does not have the
+   answer.  */
+static void
+probe_cached (char ***device_names, char **args, size_t nargs,
+	      const char *dev_map, char delim)
+{
+  char *key = NULL, *answer = NULL;
+  size_t answer_len = 0;
+
+  if (probe_cache)
+    {
+      key = probe_cache_key (args, nargs, dev_map, delim);
+      if (probe_cache_lookup (key))
+	{
+	  free (key);
+	  return;
+	}
+      probe_capture_start ();
+    }
+
+  if (!*device_names)
+    *device_names = resolve_path (args[0]);
+  probe (*device_names, delim);
+  if (delim == ' ')
+    putchar ('\n');
+
+  if (probe_cache)
+    {
+      probe_capture_end (&answer, &answer_len);
+      if (answer)
+	probe_cache_add (key, answer, answer_len);
+      free (answer);
+      free (key);
     }
 }
 
@@ -732,6 +939,9 @@ static struct argp_option options[] = {
   {"device-map",  'm', N_("FILE"), 0,
    N_("use FILE as the device map [default=%s]"), 0},
   {"target",  't', N_("TARGET"), 0, 0, 0},
+  {"cache",  0x100, N_("FILE"), 0,
+   N_("keep the answers in FILE and reuse the ones found there"
+      " [default=$GRUB_PROBE_CACHE]"), 0},
   {"verbose",     'v', 0,      0,
    N_("print verbose messages (pass twice to enable debug printing)."), 0},
   {0, '0', 0, 0, N_("separate items in output using ASCII NUL characters"), 0},
@@ -754,7 +964,7 @@ help_filter (int key, const char *text, void *input __attribute__ ((unused)))
 
 	  def = xasprintf (_("[default=%s]"), targets[print]);
 
-	  ret = xasprintf ("%s\n%s %s %s", _("print TARGET"),
+	  ret = xasprintf ("%s\n%s %s %s", _("print TARGET, which may be given several times"),
 			    _("available targets:"), t, def);
 	  free (t);
 	  free (def);
@@ -775,6 +985,8 @@ struct arguments
   size_t ndevices;
   char *dev_map;
   int zero_delim;
+  int *targets;
+  size_t ntargets;
 };
 
 static error_t
@@ -803,15 +1015,20 @@ argp_parser (int key, char *arg, struct argp_state *state)
 
 	for (i = PRINT_FS; i < ARRAY_SIZE (targets); i++)
 	  if (strcmp (arg, targets[i]) == 0)
-	    {
-	      print = i;
-	      break;
-	    }
+	    break;
 	if (i == ARRAY_SIZE (targets))
 	  argp_usage (state);
+	arguments->targets = xrealloc (arguments->targets,
+				       (arguments->ntargets + 1)
+				       * sizeof (arguments->targets[0]));
+	arguments->targets[arguments->ntargets++] = i;
       }
       break;
 
+    case 0x100:
+      probe_cache = arg;
+      break;
+
     case '0':
       arguments->zero_delim = 1;
       break;
@@ -837,9 +1054,11 @@ argp_parser (int key, char *arg, struct argp_state *state)
 }
 
 static struct argp argp = {
-  options, argp_parser, N_("[OPTION]... [PATH|DEVICE]"),
+  options, argp_parser, N_("[OPTION]... [PATH...|DEVICE...]"),
   N_("\
-Probe device information for a given path (or device, if the -d option is given)."),
+Probe device information for the given paths (or device, if the -d option is given).\v\
+With several targets or paths, the answers are printed one after the other, \
+the targets of the first path first, as separate runs would print them."),
   NULL, help_filter, NULL
 };
 
@@ -848,6 +1067,7 @@ main (int argc, char *argv[])
 {
   char delim;
   struct arguments arguments;
+  size_t i;
 
   grub_util_host_init (&argc, &argv);
 
@@ -868,17 +1088,6 @@ main (int argc, char *argv[])
   if (verbosity > 1)
     grub_env_set ("debug", "all");
 
-  /* Obtain ARGUMENT.  */
-  if (arguments.ndevices != 1 && !argument_is_device)
-    {
-      char *program = xstrdup(program_name);
-      fprintf (stderr, _("Unknown extra argument `%s'."), arguments.devices[1]);
-      fprintf (stderr, "\n");
-      argp_help (&argp, stderr, ARGP_HELP_STD_USAGE, program);
-      free (program);
-      exit(1);
-    }
-
   /* Initialize the emulated biosdisk driver.  */
   grub_util_biosdisk_init (arguments.dev_map ? : DEFAULT_DEVICE_MAP);
 
@@ -895,36 +1104,64 @@ main (int argc, char *argv[])
   grub_mdraid1x_init ();
   grub_lvm_init ();
 
-  if (print == PRINT_BIOS_HINT
-      || print == PRINT_IEEE1275_HINT || print == PRINT_BAREMETAL_HINT
-      || print == PRINT_EFI_HINT || print == PRINT_ARC_HINT)
-    delim = ' ';
-  else
-    delim = '\n';
+  if (!probe_cache)
+    probe_cache = getenv ("GRUB_PROBE_CACHE");
+  if (probe_cache && !*probe_cache)
+    probe_cache = NULL;
+  if (probe_cache)
+    atexit (probe_capture_atexit);
 
-  if (arguments.zero_delim)
-    delim = '\0';
+  if (!arguments.ntargets)
+    {
+      arguments.targets = xmalloc (sizeof (arguments.targets[0]));
+      arguments.targets[arguments.ntargets++] = PRINT_FS;
+    }
 
-  /* Do it.  */
-  if (argument_is_device)
-    probe (NULL, arguments.devices, delim);
-  else
-    probe (arguments.devices[0], NULL, delim);
+  /* Do it.  The devices found for a path serve all the targets.  */
+  for (i = 0; i < (argument_is_device ? 1 : arguments.ndevices); i++)
+    {
+      char **device_names = argument_is_device ? arguments.devices : NULL;
+      char **curdev;
+      size_t j;
 
-  if (delim == ' ')
-    putchar ('\n');
+      for (j = 0; j < arguments.ntargets; j++)
+	{
+	  print = arguments.targets[j];
+	  if (print == PRINT_BIOS_HINT
+	      || print == PRINT_IEEE1275_HINT || print == PRINT_BAREMETAL_HINT
+	      || print == PRINT_EFI_HINT || print == PRINT_ARC_HINT)
+	    delim = ' ';
+	  else
+	    delim = '\n';
+
+	  if (arguments.zero_delim)
+	    delim = '\0';
+
+	  if (argument_is_device)
+	    probe_cached (&device_names, arguments.devices, arguments.ndevices,
+			  arguments.dev_map ? : DEFAULT_DEVICE_MAP, delim);
+	  else
+	    probe_cached (&device_names, &arguments.devices[i], 1,
+			  arguments.dev_map ? : DEFAULT_DEVICE_MAP, delim);
+	}
+
+      if (!argument_is_device && device_names)
+	{
+	  for (curdev = device_names; *curdev; curdev++)
+	    free (*curdev);
+	  free (device_names);
+	}
+    }
 
   /* Free resources.  */
   grub_gcry_fini_all ();
   grub_fini_all ();
   grub_util_biosdisk_fini ();
 
-  {
-    size_t i;
-    for (i = 0; i < arguments.ndevices; i++)
-      free (arguments.devices[i]);
-  }
+  for (i = 0; i < arguments.ndevices; i++)
+    free (arguments.devices[i]);
   free (arguments.devices);
+  free (arguments.targets);
 
   free (arguments.dev_map);
 
@@ -31,6 +31,7 @@
 #include <grub/offsets.h>
 #include <grub/crypto.h>
 #include <grub/dl.h>
+#include <grub/memdisk.h>
 #include <time.h>
 #include <multiboot.h>
 
@@ -39,6 +40,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <errno.h>
 #include <grub/efi/pe32.h>
 #include <grub/uboot/image.h>
 #include <grub/arm/reloc.h>
@@ -754,6 +756,104 @@ compress_kernel_xz (char *kernel_img, size_t kernel_size,
 }
 #endif
 
+/* Compress the N bytes at SRC into a raw LZ4 block of at most CAP bytes
+   at DST, greedily.  Return its size, or 0 when it does not fit.  */
+static size_t
+lz4_compress_block (const grub_uint8_t *src, size_t n,
+		    grub_uint8_t *dst, size_t cap)
+{
+  /* A match starts at least 12 bytes and ends at least 5 bytes before the
+     end of the block, as the format requires.  */
+  enum { HASH_BITS = 12, MIN_MATCH = 4, MF_LIMIT = 12, LAST_LITERALS = 5 };
+  grub_uint32_t table[1 << HASH_BITS];
+  size_t ip = 0, anchor = 0, op = 0, lit;
+
+#define LZ4_PUT(b) do { if (op >= cap) return 0; dst[op++] = (b); } while (0)
+#define LZ4_READ32(p) (src[p] | (src[(p) + 1] << 8) | (src[(p) + 2] << 16) \
+		       | ((grub_uint32_t) src[(p) + 3] << 24))
+
+  memset (table, 0, sizeof (table));
+
+  while (n >= MF_LIMIT && ip + MF_LIMIT < n)
+    {
+      grub_uint32_t seq = LZ4_READ32 (ip);
+      grub_uint32_t h = (seq * 2654435761U) >> (32 - HASH_BITS);
+      size_t ref = table[h], len, l;
+
+      table[h] = ip + 1;
+      if (!ref-- || ip - ref > 65535 || LZ4_READ32 (ref) != seq)
+	{
+	  ip++;
+	  continue;
+	}
+
+      len = MIN_MATCH;
+      while (ip + len < n - LAST_LITERALS && src[ref + len] == src[ip + len])
+	len++;
+
+      lit = ip - anchor;
+      LZ4_PUT (((lit >= 15 ? 15 : lit) << 4)
+	       | (len - MIN_MATCH >= 15 ? 15 : len - MIN_MATCH));
+      if (lit >= 15)
+	{
+	  for (l = lit - 15; l >= 255; l -= 255)
+	    LZ4_PUT (255);
+	  LZ4_PUT (l);
+	}
+      if (op + lit > cap)
+	return 0;
+      memcpy (dst + op, src + anchor, lit);
+      op += lit;
+      LZ4_PUT ((ip - ref) & 0xff);
+      LZ4_PUT ((ip - ref) >> 8);
+      if (len - MIN_MATCH >= 15)
+	{
+	  for (l = len - MIN_MATCH - 15; l >= 255; l -= 255)
+	    LZ4_PUT (255);
+	  LZ4_PUT (l);
+	}
+
+      ip += len;
+      anchor = ip;
+    }
+
+  /* The last literals.  */
+  lit = n - anchor;
+  LZ4_PUT ((lit >= 15 ? 15 : lit) << 4);
+  if (lit >= 15)
+    {
+      size_t l;
+
+      for (l = lit - 15; l >= 255; l -= 255)
+	LZ4_PUT (255);
+      LZ4_PUT (l);
+    }
+  if (op + lit > cap)
+    return 0;
+  memcpy (dst + op, src + anchor, lit);
+  op += lit;
+
+#undef LZ4_PUT
+#undef LZ4_READ32
+
+  return op;
+}
+
+static void
+compress_kernel_lz4 (char *kernel_img, size_t kernel_size,
+		     char **core_img, size_t *core_size)
+{
+  /* The worst case of the format, for data that does not compress.  */
+  size_t cap = kernel_size + kernel_size / 255 + 16;
+
+  *core_img = xmalloc (cap);
+  *core_size = lz4_compress_block ((const grub_uint8_t *) kernel_img,
+				   kernel_size, (grub_uint8_t *) *core_img,
+				   cap);
+  if (*core_size == 0)
+    grub_util_error ("%s", _("cannot compress the kernel image"));
+}
+
 static void
 compress_kernel (const struct grub_install_image_target_desc *image_target, char *kernel_img,
 		 size_t kernel_size, char **core_img, size_t *core_size,
@@ -767,6 +867,14 @@ compress_kernel (const struct grub_install_image_target_desc *image_target, char
       return;
     }
 
+  if (image_target->flags & PLATFORM_FLAGS_DECOMPRESSORS
+      && (comp == GRUB_COMPRESSION_LZ4))
+    {
+      compress_kernel_lz4 (kernel_img, kernel_size, core_img,
+			   core_size);
+      return;
+    }
+
 #ifdef USE_LIBLZMA
  if (image_target->flags & PLATFORM_FLAGS_DECOMPRESSORS
      && (comp == GRUB_COMPRESSION_XZ))
@@ -786,6 +894,64 @@ compress_kernel (const struct grub_install_image_target_desc *image_target, char
   *core_size = kernel_size;
 }
 
+/* Build a compressed memdisk image of the file at PATH, in chunks the
+   memdisk module decompresses as they are read.  */
+static char *
+make_chunked_memdisk (const char *path, size_t *size)
+{
+  struct grub_memdisk_chunked_header *head;
+  grub_uint64_t *offsets;
+  size_t disk_size, nchunks, i, pos, alloc;
+  char *disk, *img;
+
+  disk_size = ALIGN_UP (grub_util_get_image_size (path), GRUB_DISK_SECTOR_SIZE);
+  if (disk_size == 0)
+    grub_util_error (_("the memdisk image `%s' is empty"), path);
+  disk = xcalloc (1, disk_size);
+  grub_util_load_image (path, disk);
+
+  nchunks = (disk_size + GRUB_MEMDISK_CHUNK_SIZE - 1) / GRUB_MEMDISK_CHUNK_SIZE;
+  pos = sizeof (*head) + (nchunks + 1) * sizeof (offsets[0]);
+  /* Chunks that do not shrink are stored as they are.  */
+  alloc = ALIGN_UP (pos + disk_size, GRUB_DISK_SECTOR_SIZE);
+  img = xcalloc (1, alloc);
+
+  head = (struct grub_memdisk_chunked_header *) img;
+  memcpy (head->magic, GRUB_MEMDISK_CHUNKED_MAGIC, sizeof (head->magic));
+  head->compression = grub_cpu_to_le32 (GRUB_MEMDISK_COMPRESSION_LZ4);
+  head->chunk_size = grub_cpu_to_le32 (GRUB_MEMDISK_CHUNK_SIZE);
+  head->size = grub_cpu_to_le64 (disk_size);
+  head->nchunks = grub_cpu_to_le64 (nchunks);
+  offsets = (grub_uint64_t *) (head + 1);
+
+  for (i = 0; i < nchunks; i++)
+    {
+      size_t len = disk_size - i * GRUB_MEMDISK_CHUNK_SIZE, clen;
+      const char *src = disk + i * GRUB_MEMDISK_CHUNK_SIZE;
+
+      if (len > GRUB_MEMDISK_CHUNK_SIZE)
+	len = GRUB_MEMDISK_CHUNK_SIZE;
+      offsets[i] = grub_cpu_to_le64 (pos);
+      clen = lz4_compress_block ((const grub_uint8_t *) src, len,
+				 (grub_uint8_t *) img + pos, len - 1);
+      if (!clen)
+	{
+	  memcpy (img + pos, src, len);
+	  clen = len;
+	}
+      pos += clen;
+    }
+  offsets[nchunks] = grub_cpu_to_le64 (pos);
+
+  grub_util_info ("compressed the memory disk from 0x%" GRUB_HOST_PRIxLONG_LONG
+		  " to 0x%" GRUB_HOST_PRIxLONG_LONG " bytes",
+		  (unsigned long long) disk_size, (unsigned long long) pos);
+
+  free (disk);
+  *size = ALIGN_UP (pos, GRUB_DISK_SECTOR_SIZE);
+  return img;
+}
+
 const struct grub_install_image_target_desc *
 grub_install_get_image_target (const char *arg)
 {
@@ -886,11 +1052,13 @@ grub_install_generate_image (const char *dir, const char *prefix,
 			     size_t npubkeys, char *config_path,
 			     const struct grub_install_image_target_desc *image_target,
 			     int note, grub_compression_t comp, const char *dtb_path,
-			     const char *sbat_path, int disable_shim_lock)
+			     const char *sbat_path, int disable_shim_lock,
+			     int compress_memdisk)
 {
   char *kernel_img, *core_img;
   size_t total_module_size, core_size;
   size_t memdisk_size = 0, config_size = 0;
+  char *memdisk_img = NULL;
   size_t prefix_size = 0, dtb_size = 0, sbat_size = 0;
   char *kernel_path;
   size_t offset;
@@ -901,9 +1069,11 @@ grub_install_generate_image (const char *dir, const char *prefix,
   if (comp == GRUB_COMPRESSION_AUTO)
     comp = image_target->default_compression;
 
-  if (image_target->id == IMAGE_I386_PC
-      || image_target->id == IMAGE_I386_PC_PXE
-      || image_target->id == IMAGE_I386_PC_ELTORITO)
+  /* The i386-pc startup code decompresses LZMA or LZ4 only.  */
+  if ((image_target->id == IMAGE_I386_PC
+       || image_target->id == IMAGE_I386_PC_PXE
+       || image_target->id == IMAGE_I386_PC_ELTORITO)
+      && comp != GRUB_COMPRESSION_LZ4)
     comp = GRUB_COMPRESSION_LZMA;
 
   path_list = grub_util_resolve_dependencies (dir, "moddep.lst", mods);
@@ -930,7 +1100,10 @@ grub_install_generate_image (const char *dir, const char *prefix,
 
   if (memdisk_path)
     {
-      memdisk_size = ALIGN_UP(grub_util_get_image_size (memdisk_path), 512);
+      if (compress_memdisk)
+	memdisk_img = make_chunked_memdisk (memdisk_path, &memdisk_size);
+      else
+	memdisk_size = ALIGN_UP(grub_util_get_image_size (memdisk_path), 512);
       grub_util_info ("the size of memory disk is 0x%" GRUB_HOST_PRIxLONG_LONG,
 		      (unsigned long long) memdisk_size);
       total_module_size += memdisk_size + sizeof (struct grub_module_header);
@@ -1067,7 +1240,13 @@ grub_install_generate_image (const char *dir, const char *prefix,
       header->size = grub_host_to_target32 (memdisk_size + sizeof (*header));
       offset += sizeof (*header);
 
-      grub_util_load_image (memdisk_path, kernel_img + offset);
+      if (memdisk_img)
+	{
+	  memcpy (kernel_img + offset, memdisk_img, memdisk_size);
+	  free (memdisk_img);
+	}
+      else
+	grub_util_load_image (memdisk_path, kernel_img + offset);
       offset += memdisk_size;
     }
 
@@ -1150,6 +1329,9 @@ grub_install_generate_image (const char *dir, const char *prefix,
 	case GRUB_COMPRESSION_LZMA:
 	  name = "lzma_decompress.img";
 	  break;
+	case GRUB_COMPRESSION_LZ4:
+	  name = "lz4_decompress.img";
+	  break;
 	case GRUB_COMPRESSION_NONE:
 	  name = "none_decompress.img";
 	  break;
@@ -1826,3 +2008,57 @@ grub_install_generate_image (const char *dir, const char *prefix,
 
   grub_util_free_path_list (path_list);
 }
+
+char *
+grub_install_make_image_mem (const struct grub_install_image_settings *settings,
+			     size_t *size)
+{
+  const struct grub_install_image_target_desc *tgt;
+  char *buf = NULL;
+  FILE *out;
+
+  tgt = grub_install_get_image_target (settings->format);
+  if (!tgt)
+    grub_util_error (_("unknown target format %s"), settings->format);
+
+  /* The image is only ever written in sequence, so a stream writing to
+     memory takes the place of the file.  */
+#ifdef HAVE_OPEN_MEMSTREAM
+  out = open_memstream (&buf, size);
+#else
+  out = tmpfile ();
+#endif
+  if (!out)
+    grub_util_error (_("cannot open a temporary file: %s"), strerror (errno));
+
+  grub_install_generate_image (settings->dir, settings->prefix, out,
+			       settings->format, settings->modules,
+			       settings->memdisk_path, settings->pubkeys,
+			       settings->npubkeys, settings->config_path, tgt,
+			       settings->note, settings->compression,
+			       settings->dtb_path, settings->sbat_path,
+			       settings->disable_shim_lock,
+			       settings->compress_memdisk);
+
+#ifdef HAVE_OPEN_MEMSTREAM
+  if (fclose (out) != 0)
+    grub_util_error (_("cannot write to `%s': %s"), settings->format,
+		     strerror (errno));
+#else
+  {
+    long len = ftello (out);
+
+    if (len < 0 || fseeko (out, 0, SEEK_SET) < 0)
+      grub_util_error (_("cannot seek `%s': %s"), settings->format,
+		       strerror (errno));
+    *size = len;
+    buf = xmalloc (len ? : 1);
+    if (fread (buf, 1, len, out) != (size_t) len)
+      grub_util_error (_("cannot read `%s': %s"), settings->format,
+		       strerror (errno));
+    fclose (out);
+  }
+#endif
+
+  return buf;
+}